@@ -0,0 +1,285 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+//! Async variants of the playback and capture stream interfaces.
+//!
+//! The blocking `PlaybackBufferStream` and `CaptureBufferStream` need a thread per stream. The
+//! streams here return futures instead, so many streams can share the threads of an executor.
+//! The executor is provided by the user through `AudioStreamsExecutor`, which lets a stream wait
+//! for its wake fd to become readable or for a timer, without blocking the executor thread.
+//!
+//! The buffers are the same `PlaybackBuffer` and `CaptureBuffer` as the blocking streams, so the
+//! samples are still read and written in place, and dropping a buffer commits it.
+//!
+//! ```
+//! use audio_streams::async_api::AudioStreamsExecutor;
+//! use audio_streams::{BoxError, SampleFormat, StreamSource, NoopStreamSource};
+//! use std::io::Write;
+//!
+//! # async fn play(ex: &dyn AudioStreamsExecutor) -> Result<(), BoxError> {
+//! let mut stream_source = NoopStreamSource::new();
+//! let (_, mut stream) =
+//!     stream_source.new_async_playback_stream(2, SampleFormat::S16LE, 48000, 480)?;
+//! let buf = [0xa5u8; 480 * 2 * 2];
+//! for _ in 0..10 {
+//!     let mut stream_buffer = stream.next_playback_buffer(ex).await?;
+//!     stream_buffer.write_all(&buf)?;
+//! }
+//! # Ok(())
+//! # }
+//! ```
+
+use std::error;
+use std::fmt::{self, Display};
+use std::future::Future;
+use std::os::unix::io::RawFd;
+use std::pin::Pin;
+use std::result::Result;
+use std::time::Duration;
+
+use super::{capture::CaptureBuffer, BoxError, PlaybackBuffer};
+
+/// A future that borrows for `'a`. Executors of audio streams are usually single threaded, so the
+/// future doesn't need to be `Send`.
+pub type BoxFuture<'a, T> = Pin<Box<dyn Future<Output = T> + 'a>>;
+
+/// `AudioStreamsExecutor` is what async streams need from the executor that runs them.
+pub trait AudioStreamsExecutor {
+    /// Completes when `fd` is readable.
+    fn wait_fd_readable(&self, fd: RawFd) -> BoxFuture<'_, Result<(), BoxError>>;
+
+    /// Completes after `dur`.
+    fn delay(&self, dur: Duration) -> BoxFuture<'_, Result<(), BoxError>>;
+}
+
+/// `AsyncPlaybackBufferStream` provides `PlaybackBuffer`s to fill with audio samples for playback,
+/// without blocking the thread while it waits for the next one.
+pub trait AsyncPlaybackBufferStream: Send {
+    fn next_playback_buffer<'a>(
+        &'a mut self,
+        ex: &'a dyn AudioStreamsExecutor,
+    ) -> BoxFuture<'a, Result<PlaybackBuffer<'a>, BoxError>>;
+}
+
+/// `AsyncCaptureBufferStream` provides `CaptureBuffer`s to read audio samples from capture,
+/// without blocking the thread while it waits for the next one.
+pub trait AsyncCaptureBufferStream: Send {
+    fn next_capture_buffer<'a>(
+        &'a mut self,
+        ex: &'a dyn AudioStreamsExecutor,
+    ) -> BoxFuture<'a, Result<CaptureBuffer<'a>, BoxError>>;
+}
+
+/// Errors that are possible when creating an async stream.
+#[derive(Debug)]
+pub enum AsyncStreamError {
+    Unsupported,
+}
+
+impl error::Error for AsyncStreamError {}
+
+impl Display for AsyncStreamError {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        match self {
+            AsyncStreamError::Unsupported => write!(f, "Async streams are not supported"),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::super::*;
+    use super::*;
+    use std::io::{Read, Write};
+    use std::sync::Arc;
+    use std::task::{Context, Poll, Wake, Waker};
+    use std::thread;
+    use std::time::Instant;
+
+    /// Runs futures on the calling thread, a timer thread wakes it when a delay expires.
+    struct TestExecutor;
+
+    struct Delay {
+        deadline: Instant,
+        timer_started: bool,
+    }
+
+    impl Future for Delay {
+        type Output = Result<(), BoxError>;
+
+        fn poll(mut self: Pin<&mut Self>, cx: &mut Context) -> Poll<Self::Output> {
+            let now = Instant::now();
+            if now >= self.deadline {
+                return Poll::Ready(Ok(()));
+            }
+            if !self.timer_started {
+                self.timer_started = true;
+                let waker = cx.waker().clone();
+                let dur = self.deadline - now;
+                thread::spawn(move || {
+                    thread::sleep(dur);
+                    waker.wake();
+                });
+            }
+            Poll::Pending
+        }
+    }
+
+    impl AudioStreamsExecutor for TestExecutor {
+        fn wait_fd_readable(&self, _fd: RawFd) -> BoxFuture<'_, Result<(), BoxError>> {
+            Box::pin(async { Ok(()) })
+        }
+
+        fn delay(&self, dur: Duration) -> BoxFuture<'_, Result<(), BoxError>> {
+            Box::pin(Delay {
+                deadline: Instant::now() + dur,
+                timer_started: false,
+            })
+        }
+    }
+
+    struct ThreadWaker(thread::Thread);
+
+    impl Wake for ThreadWaker {
+        fn wake(self: Arc<Self>) {
+            self.0.unpark();
+        }
+    }
+
+    fn block_on<T>(mut fut: BoxFuture<T>) -> T {
+        let waker = Waker::from(Arc::new(ThreadWaker(thread::current())));
+        let mut cx = Context::from_waker(&waker);
+        loop {
+            if let Poll::Ready(v) = fut.as_mut().poll(&mut cx) {
+                return v;
+            }
+            thread::park();
+        }
+    }
+
+    /// Polls a set of futures on one thread until they are all done.
+    struct JoinAll<'a>(Vec<Option<BoxFuture<'a, ()>>>);
+
+    impl<'a> Future for JoinAll<'a> {
+        type Output = ();
+
+        fn poll(mut self: Pin<&mut Self>, cx: &mut Context) -> Poll<()> {
+            let mut done = true;
+            for slot in self.0.iter_mut() {
+                if let Some(fut) = slot {
+                    if fut.as_mut().poll(cx).is_ready() {
+                        *slot = None;
+                    } else {
+                        done = false;
+                    }
+                }
+            }
+            if done {
+                Poll::Ready(())
+            } else {
+                Poll::Pending
+            }
+        }
+    }
+
+    #[test]
+    fn async_playback() {
+        let ex = TestExecutor;
+        let mut server = NoopStreamSource::new();
+        let (_, mut stream) = server
+            .new_async_playback_stream(2, SampleFormat::S16LE, 48000, 480)
+            .unwrap();
+        let start = Instant::now();
+        block_on(Box::pin(async {
+            for _ in 0..2 {
+                let mut stream_buffer = stream.next_playback_buffer(&ex).await.unwrap();
+                assert_eq!(stream_buffer.frame_capacity(), 480);
+                let pb_buf = [0xa5u8; 480 * 2 * 2];
+                assert_eq!(stream_buffer.write(&pb_buf).unwrap(), 480 * 2 * 2);
+            }
+        }));
+        // The second buffer should wait until the first one is consumed.
+        assert!(start.elapsed() > Duration::from_millis(10));
+    }
+
+    #[test]
+    fn async_capture() {
+        let ex = TestExecutor;
+        let mut server = NoopStreamSource::new();
+        let (_, mut stream) = server
+            .new_async_capture_stream(2, SampleFormat::S16LE, 48000, 480)
+            .unwrap();
+        block_on(Box::pin(async {
+            let mut stream_buffer = stream.next_capture_buffer(&ex).await.unwrap();
+            assert_eq!(stream_buffer.frame_capacity(), 480);
+            let mut cp_buf = [0xa5u8; 480 * 2 * 2];
+            assert_eq!(stream_buffer.read(&mut cp_buf).unwrap(), 480 * 2 * 2);
+            assert!(cp_buf.iter().all(|&b| b == 0));
+        }));
+    }
+
+    #[test]
+    fn many_streams_one_thread() {
+        // Streams waiting for their next buffer don't block each other.
+        const NUM_STREAMS: usize = 8;
+        let ex = TestExecutor;
+        let mut server = NoopStreamSource::new();
+        let mut streams: Vec<_> = (0..NUM_STREAMS)
+            .map(|_| {
+                server
+                    .new_async_playback_stream(2, SampleFormat::S16LE, 48000, 480)
+                    .unwrap()
+                    .1
+            })
+            .collect();
+        let start = Instant::now();
+        let ex_ref = &ex;
+        let futs = streams
+            .iter_mut()
+            .map(|stream| -> Option<BoxFuture<()>> {
+                Some(Box::pin(async move {
+                    for _ in 0..3 {
+                        let _buf = stream.next_playback_buffer(ex_ref).await.unwrap();
+                    }
+                }))
+            })
+            .collect();
+        block_on(Box::pin(JoinAll(futs)));
+        // Three 10ms buffers per stream, if the streams waited one after the other this would
+        // take 8 times longer.
+        let elapsed = start.elapsed();
+        assert!(elapsed >= Duration::from_millis(20));
+        assert!(elapsed < Duration::from_millis(20 * NUM_STREAMS as u64));
+    }
+
+    #[test]
+    fn unsupported_by_default() {
+        struct BlockingSource;
+        impl StreamSource for BlockingSource {
+            #[allow(clippy::type_complexity)]
+            fn new_playback_stream(
+                &mut self,
+                num_channels: usize,
+                format: SampleFormat,
+                frame_rate: u32,
+                buffer_size: usize,
+            ) -> Result<(Box<dyn StreamControl>, Box<dyn PlaybackBufferStream>), BoxError>
+            {
+                NoopStreamSource::new().new_playback_stream(
+                    num_channels,
+                    format,
+                    frame_rate,
+                    buffer_size,
+                )
+            }
+        }
+        let mut source = BlockingSource;
+        assert!(source
+            .new_async_playback_stream(2, SampleFormat::S16LE, 48000, 480)
+            .is_err());
+        assert!(source
+            .new_async_capture_stream(2, SampleFormat::S16LE, 48000, 480)
+            .is_err());
+    }
+}
@@ -46,6 +46,11 @@ use std::result::Result;
 use std::str::FromStr;
 use std::time::{Duration, Instant};
 
+use async_api::{
+    AsyncCaptureBufferStream, AsyncPlaybackBufferStream, AsyncStreamError, AudioStreamsExecutor,
+    BoxFuture,
+};
+
 #[derive(Copy, Clone, Debug, PartialEq)]
 pub enum SampleFormat {
     U8,
@@ -92,6 +97,7 @@ pub enum StreamEffect {
     EchoCancellation,
 }
 
+pub mod async_api;
 pub mod capture;
 pub mod shm_streams;
 
@@ -171,6 +177,34 @@ pub trait StreamSource: Send {
         ))
     }
 
+    /// Returns a stream control and an async buffer generator object, which waits for buffers
+    /// without blocking the thread. See `async_api`.
+    /// Default implementation returns `AsyncStreamError::Unsupported`.
+    #[allow(clippy::type_complexity)]
+    fn new_async_playback_stream(
+        &mut self,
+        _num_channels: usize,
+        _format: SampleFormat,
+        _frame_rate: u32,
+        _buffer_size: usize,
+    ) -> Result<(Box<dyn StreamControl>, Box<dyn AsyncPlaybackBufferStream>), BoxError> {
+        Err(Box::new(AsyncStreamError::Unsupported))
+    }
+
+    /// Returns a stream control and an async buffer generator object, which waits for buffers
+    /// without blocking the thread. See `async_api`.
+    /// Default implementation returns `AsyncStreamError::Unsupported`.
+    #[allow(clippy::type_complexity)]
+    fn new_async_capture_stream(
+        &mut self,
+        _num_channels: usize,
+        _format: SampleFormat,
+        _frame_rate: u32,
+        _buffer_size: usize,
+    ) -> Result<(Box<dyn StreamControl>, Box<dyn AsyncCaptureBufferStream>), BoxError> {
+        Err(Box::new(AsyncStreamError::Unsupported))
+    }
+
     /// Returns any open file descriptors needed by the implementor. The FD list helps users of the
     /// StreamSource enter Linux jails making sure not to close needed FDs.
     fn keep_fds(&self) -> Option<Vec<RawFd>> {
@@ -336,19 +370,25 @@ impl NoopStream {
             },
         }
     }
-}
 
-impl PlaybackBufferStream for NoopStream {
-    fn next_playback_buffer(&mut self) -> Result<PlaybackBuffer, BoxError> {
-        if let Some(start_time) = self.start_time {
-            if start_time.elapsed() < self.next_frame {
-                std::thread::sleep(self.next_frame - start_time.elapsed());
+    // Returns how long until the next buffer is due, and moves on to the one after it.
+    fn next_buffer_delay(&mut self) -> Duration {
+        let delay = match self.start_time {
+            Some(start_time) => self
+                .next_frame
+                .checked_sub(start_time.elapsed())
+                .unwrap_or_default(),
+            None => {
+                self.start_time = Some(Instant::now());
+                self.next_frame = Duration::from_millis(0);
+                Duration::from_millis(0)
             }
-            self.next_frame += self.interval;
-        } else {
-            self.start_time = Some(Instant::now());
-            self.next_frame = self.interval;
-        }
+        };
+        self.next_frame += self.interval;
+        delay
+    }
+
+    fn playback_buffer(&mut self) -> Result<PlaybackBuffer, BoxError> {
         Ok(PlaybackBuffer::new(
             self.frame_size,
             &mut self.buffer,
@@ -357,6 +397,25 @@ impl PlaybackBufferStream for NoopStream {
     }
 }
 
+impl PlaybackBufferStream for NoopStream {
+    fn next_playback_buffer(&mut self) -> Result<PlaybackBuffer, BoxError> {
+        std::thread::sleep(self.next_buffer_delay());
+        self.playback_buffer()
+    }
+}
+
+impl AsyncPlaybackBufferStream for NoopStream {
+    fn next_playback_buffer<'a>(
+        &'a mut self,
+        ex: &'a dyn AudioStreamsExecutor,
+    ) -> BoxFuture<'a, Result<PlaybackBuffer<'a>, BoxError>> {
+        Box::pin(async move {
+            ex.delay(self.next_buffer_delay()).await?;
+            self.playback_buffer()
+        })
+    }
+}
+
 /// No-op control for `NoopStream`s.
 /// Should be deprecated once all existing use of DummyStreamControl removed.
 #[derive(Default)]
@@ -411,6 +470,44 @@ impl StreamSource for NoopStreamSource {
             )),
         ))
     }
+
+    #[allow(clippy::type_complexity)]
+    fn new_async_playback_stream(
+        &mut self,
+        num_channels: usize,
+        format: SampleFormat,
+        frame_rate: u32,
+        buffer_size: usize,
+    ) -> Result<(Box<dyn StreamControl>, Box<dyn AsyncPlaybackBufferStream>), BoxError> {
+        Ok((
+            Box::new(NoopStreamControl::new()),
+            Box::new(NoopStream::new(
+                num_channels,
+                format,
+                frame_rate,
+                buffer_size,
+            )),
+        ))
+    }
+
+    #[allow(clippy::type_complexity)]
+    fn new_async_capture_stream(
+        &mut self,
+        num_channels: usize,
+        format: SampleFormat,
+        frame_rate: u32,
+        buffer_size: usize,
+    ) -> Result<(Box<dyn StreamControl>, Box<dyn AsyncCaptureBufferStream>), BoxError> {
+        Ok((
+            Box::new(NoopStreamControl::new()),
+            Box::new(capture::NoopCaptureStream::new(
+                num_channels,
+                format,
+                frame_rate,
+                buffer_size,
+            )),
+        ))
+    }
 }
 
 #[cfg(test)]
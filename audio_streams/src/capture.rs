@@ -34,6 +34,7 @@ use std::{
     time::{Duration, Instant},
 };
 
+use super::async_api::{AsyncCaptureBufferStream, AudioStreamsExecutor, BoxFuture};
 use super::{AudioBuffer, BoxError, BufferDrop, NoopBufferDrop, SampleFormat};
 
 /// `CaptureBufferStream` provides `CaptureBuffer`s to read with audio samples from capture.
@@ -152,19 +153,25 @@ impl NoopCaptureStream {
             },
         }
     }
-}
 
-impl CaptureBufferStream for NoopCaptureStream {
-    fn next_capture_buffer(&mut self) -> Result<CaptureBuffer, BoxError> {
-        if let Some(start_time) = self.start_time {
-            if start_time.elapsed() < self.next_frame {
-                std::thread::sleep(self.next_frame - start_time.elapsed());
+    // Returns how long until the next buffer is due, and moves on to the one after it.
+    fn next_buffer_delay(&mut self) -> Duration {
+        let delay = match self.start_time {
+            Some(start_time) => self
+                .next_frame
+                .checked_sub(start_time.elapsed())
+                .unwrap_or_default(),
+            None => {
+                self.start_time = Some(Instant::now());
+                self.next_frame = Duration::from_millis(0);
+                Duration::from_millis(0)
             }
-            self.next_frame += self.interval;
-        } else {
-            self.start_time = Some(Instant::now());
-            self.next_frame = self.interval;
-        }
+        };
+        self.next_frame += self.interval;
+        delay
+    }
+
+    fn capture_buffer(&mut self) -> Result<CaptureBuffer, BoxError> {
         Ok(CaptureBuffer::new(
             self.frame_size,
             &mut self.buffer,
@@ -173,6 +180,25 @@ impl CaptureBufferStream for NoopCaptureStream {
     }
 }
 
+impl CaptureBufferStream for NoopCaptureStream {
+    fn next_capture_buffer(&mut self) -> Result<CaptureBuffer, BoxError> {
+        std::thread::sleep(self.next_buffer_delay());
+        self.capture_buffer()
+    }
+}
+
+impl AsyncCaptureBufferStream for NoopCaptureStream {
+    fn next_capture_buffer<'a>(
+        &'a mut self,
+        ex: &'a dyn AudioStreamsExecutor,
+    ) -> BoxFuture<'a, Result<CaptureBuffer<'a>, BoxError>> {
+        Box::pin(async move {
+            ex.delay(self.next_buffer_delay()).await?;
+            self.capture_buffer()
+        })
+    }
+}
+
 #[cfg(test)]
 mod tests {
     use super::super::*;
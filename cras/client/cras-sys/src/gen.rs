@@ -29,17 +29,26 @@ pub const CRAS_MAX_AUDIO_THREAD_SNAPSHOTS: u32 = 10;
 pub const CRAS_MAX_HOTWORD_MODEL_NAME_SIZE: u32 = 12;
 pub const MAX_DEBUG_DEVS: u32 = 4;
 pub const MAX_DEBUG_STREAMS: u32 = 8;
+pub const CRAS_MAX_PERF_STATS: u32 = 4;
 pub const CRAS_BT_EVENT_LOG_SIZE: u32 = 1024;
-pub const CRAS_SERVER_STATE_VERSION: u32 = 2;
-pub const CRAS_PROTO_VER: u32 = 7;
-pub const CRAS_SERV_MAX_MSG_SIZE: u32 = 256;
+pub const CRAS_DEV_IO_STAGE_HIST_BINS: u32 = 8;
+pub const CRAS_SERVER_STATE_VERSION: u32 = 11;
+pub const CRAS_PROTO_VER: u32 = 11;
+pub const CRAS_SERV_MAX_MSG_SIZE: u32 = 1024;
 pub const CRAS_CLIENT_MAX_MSG_SIZE: u32 = 256;
 pub const CRAS_MAX_HOTWORD_MODELS: u32 = 243;
 pub const CRAS_MAX_REMIX_CHANNELS: u32 = 8;
 pub const CRAS_MAX_TEST_DATA_LEN: u32 = 224;
 pub const CRAS_AEC_DUMP_FILE_NAME_LEN: u32 = 128;
+pub const CRAS_MAX_BATCH_STREAMS: u32 = 8;
+pub const CRAS_BUF_ALIGN: u32 = 64;
 pub const CRAS_NUM_SHM_BUFFERS: u32 = 2;
 pub const CRAS_SHM_BUFFERS_MASK: u32 = 1;
+pub const CRAS_MAX_SHM_BUFFERS: u32 = 8;
+pub const CRAS_SHM_LAYOUT_VERSION: u32 = 5;
+pub const CRAS_SHM_TELEMETRY_VERSION: u32 = 2;
+pub const CRAS_SHM_TELEMETRY_TRIES: u32 = 4;
+pub const CRAS_SHM_CACHE_LINE: u32 = 64;
 pub type __int8_t = ::std::os::raw::c_schar;
 pub type __uint8_t = ::std::os::raw::c_uchar;
 pub type __int32_t = ::std::os::raw::c_int;
@@ -55,12 +64,15 @@ pub struct cras_iodev_info {
     pub name: [::std::os::raw::c_char; 64usize],
     pub stable_id: u32,
     pub max_supported_channels: u32,
+    pub preferred_rate: u32,
+    pub preferred_num_channels: u32,
+    pub preferred_format: i32,
 }
 #[test]
 fn bindgen_test_layout_cras_iodev_info() {
     assert_eq!(
         ::std::mem::size_of::<cras_iodev_info>(),
-        76usize,
+        88usize,
         concat!("Size of: ", stringify!(cras_iodev_info))
     );
     assert_eq!(
@@ -110,6 +122,40 @@ fn bindgen_test_layout_cras_iodev_info() {
             stringify!(max_supported_channels)
         )
     );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_iodev_info>())).preferred_rate as *const _ as usize },
+        76usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_iodev_info),
+            "::",
+            stringify!(preferred_rate)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_iodev_info>())).preferred_num_channels as *const _ as usize
+        },
+        80usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_iodev_info),
+            "::",
+            stringify!(preferred_num_channels)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_iodev_info>())).preferred_format as *const _ as usize
+        },
+        84usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_iodev_info),
+            "::",
+            stringify!(preferred_format)
+        )
+    );
 }
 #[repr(C, packed)]
 #[derive(Copy, Clone)]
@@ -616,17 +662,21 @@ fn bindgen_test_layout_cras_audio_format_packed() {
 #[repr(C)]
 #[derive(Copy, Clone)]
 pub struct packet_status_logger {
-    pub data: [u8; 64usize],
-    pub size: ::std::os::raw::c_int,
-    pub wp: ::std::os::raw::c_int,
-    pub num_wraps: ::std::os::raw::c_int,
+    pub data: [u8; 8192usize],
+    pub len: u32,
+    pub seq: u32,
+    pub run: u32,
+    pub first_lost: u32,
+    pub full: u32,
+    pub num_packets: u32,
+    pub num_lost: u32,
     pub ts: timespec,
 }
 #[test]
 fn bindgen_test_layout_packet_status_logger() {
     assert_eq!(
         ::std::mem::size_of::<packet_status_logger>(),
-        96usize,
+        8240usize,
         concat!("Size of: ", stringify!(packet_status_logger))
     );
     assert_eq!(
@@ -645,38 +695,80 @@ fn bindgen_test_layout_packet_status_logger() {
         )
     );
     assert_eq!(
-        unsafe { &(*(::std::ptr::null::<packet_status_logger>())).size as *const _ as usize },
-        64usize,
+        unsafe { &(*(::std::ptr::null::<packet_status_logger>())).len as *const _ as usize },
+        8192usize,
         concat!(
             "Offset of field: ",
             stringify!(packet_status_logger),
             "::",
-            stringify!(size)
+            stringify!(len)
         )
     );
     assert_eq!(
-        unsafe { &(*(::std::ptr::null::<packet_status_logger>())).wp as *const _ as usize },
-        68usize,
+        unsafe { &(*(::std::ptr::null::<packet_status_logger>())).seq as *const _ as usize },
+        8196usize,
         concat!(
             "Offset of field: ",
             stringify!(packet_status_logger),
             "::",
-            stringify!(wp)
+            stringify!(seq)
         )
     );
     assert_eq!(
-        unsafe { &(*(::std::ptr::null::<packet_status_logger>())).num_wraps as *const _ as usize },
-        72usize,
+        unsafe { &(*(::std::ptr::null::<packet_status_logger>())).run as *const _ as usize },
+        8200usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(packet_status_logger),
+            "::",
+            stringify!(run)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<packet_status_logger>())).first_lost as *const _ as usize },
+        8204usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(packet_status_logger),
+            "::",
+            stringify!(first_lost)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<packet_status_logger>())).full as *const _ as usize },
+        8208usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(packet_status_logger),
+            "::",
+            stringify!(full)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<packet_status_logger>())).num_packets as *const _ as usize
+        },
+        8212usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(packet_status_logger),
+            "::",
+            stringify!(num_packets)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<packet_status_logger>())).num_lost as *const _ as usize },
+        8216usize,
         concat!(
             "Offset of field: ",
             stringify!(packet_status_logger),
             "::",
-            stringify!(num_wraps)
+            stringify!(num_lost)
         )
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<packet_status_logger>())).ts as *const _ as usize },
-        80usize,
+        8224usize,
         concat!(
             "Offset of field: ",
             stringify!(packet_status_logger),
@@ -767,6 +859,12 @@ pub enum CRAS_INPUT_STREAM_FLAG {
     HOTWORD_STREAM = 3,
     TRIGGER_ONLY = 4,
     SERVER_ONLY = 8,
+    SHM_WAKE = 16,
+    LOW_LATENCY = 32,
+    PASSTHROUGH = 64,
+    EXCLUSIVE = 128,
+    DEEP_BUFFER = 256,
+    VAD_GATED = 512,
 }
 #[repr(u32)]
 #[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
@@ -788,6 +886,14 @@ pub enum CRAS_STREAM_TYPE {
 }
 #[repr(u32)]
 #[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
+pub enum CRAS_SRC_QUALITY {
+    CRAS_SRC_QUALITY_DEFAULT = 0,
+    CRAS_SRC_QUALITY_LOW_LATENCY = 1,
+    CRAS_SRC_QUALITY_HIGH = 2,
+    CRAS_SRC_QUALITY_LINEAR = 3,
+}
+#[repr(u32)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
 pub enum CRAS_CLIENT_TYPE {
     CRAS_CLIENT_TYPE_UNKNOWN = 0,
     CRAS_CLIENT_TYPE_LEGACY = 1,
@@ -1070,6 +1176,80 @@ fn bindgen_test_layout_audio_thread_event_log() {
         )
     );
 }
+#[repr(u32)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
+pub enum CRAS_DEV_IO_STAGE {
+    CRAS_DEV_IO_STAGE_FETCH = 0,
+    CRAS_DEV_IO_STAGE_CAPTURE_READ = 1,
+    CRAS_DEV_IO_STAGE_CAPTURE_STREAMS = 2,
+    CRAS_DEV_IO_STAGE_SEND_CAPTURED = 3,
+    CRAS_DEV_IO_STAGE_MIX = 4,
+    CRAS_DEV_IO_STAGE_WRITE = 5,
+    CRAS_NUM_DEV_IO_STAGES = 6,
+}
+#[repr(C, packed)]
+#[derive(Debug, Copy, Clone)]
+pub struct audio_stage_debug_info {
+    pub count: u32,
+    pub max_usec: u32,
+    pub total_usec: u64,
+    pub hist: [u32; 8usize],
+}
+#[test]
+fn bindgen_test_layout_audio_stage_debug_info() {
+    assert_eq!(
+        ::std::mem::size_of::<audio_stage_debug_info>(),
+        48usize,
+        concat!("Size of: ", stringify!(audio_stage_debug_info))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<audio_stage_debug_info>(),
+        1usize,
+        concat!("Alignment of ", stringify!(audio_stage_debug_info))
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_stage_debug_info>())).count as *const _ as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_stage_debug_info),
+            "::",
+            stringify!(count)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_stage_debug_info>())).max_usec as *const _ as usize },
+        4usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_stage_debug_info),
+            "::",
+            stringify!(max_usec)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<audio_stage_debug_info>())).total_usec as *const _ as usize
+        },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_stage_debug_info),
+            "::",
+            stringify!(total_usec)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_stage_debug_info>())).hist as *const _ as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_stage_debug_info),
+            "::",
+            stringify!(hist)
+        )
+    );
+}
 #[repr(C, packed)]
 #[derive(Copy, Clone)]
 pub struct audio_dev_debug_info {
@@ -1090,12 +1270,14 @@ pub struct audio_dev_debug_info {
     pub longest_wake_sec: u32,
     pub longest_wake_nsec: u32,
     pub software_gain_scaler: f64,
+    pub stages: [audio_stage_debug_info; 6usize],
+    pub mem_bytes: u64,
 }
 #[test]
 fn bindgen_test_layout_audio_dev_debug_info() {
     assert_eq!(
         ::std::mem::size_of::<audio_dev_debug_info>(),
-        133usize,
+        429usize,
         concat!("Size of: ", stringify!(audio_dev_debug_info))
     );
     assert_eq!(
@@ -1303,6 +1485,26 @@ fn bindgen_test_layout_audio_dev_debug_info() {
             stringify!(software_gain_scaler)
         )
     );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_dev_debug_info>())).stages as *const _ as usize },
+        133usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_dev_debug_info),
+            "::",
+            stringify!(stages)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_dev_debug_info>())).mem_bytes as *const _ as usize },
+        421usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_dev_debug_info),
+            "::",
+            stringify!(mem_bytes)
+        )
+    );
 }
 #[repr(C, packed)]
 #[derive(Debug, Copy, Clone)]
@@ -1328,12 +1530,16 @@ pub struct audio_stream_debug_info {
     pub runtime_nsec: u32,
     pub stream_volume: f64,
     pub channel_layout: [i8; 11usize],
+    pub convert_ns: u64,
+    pub mix_ns: u64,
+    pub apm_ns: u64,
+    pub mem_bytes: u64,
 }
 #[test]
 fn bindgen_test_layout_audio_stream_debug_info() {
     assert_eq!(
         ::std::mem::size_of::<audio_stream_debug_info>(),
-        103usize,
+        135usize,
         concat!("Size of: ", stringify!(audio_stream_debug_info))
     );
     assert_eq!(
@@ -1589,6 +1795,50 @@ fn bindgen_test_layout_audio_stream_debug_info() {
             stringify!(channel_layout)
         )
     );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<audio_stream_debug_info>())).convert_ns as *const _ as usize
+        },
+        103usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_stream_debug_info),
+            "::",
+            stringify!(convert_ns)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_stream_debug_info>())).mix_ns as *const _ as usize },
+        111usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_stream_debug_info),
+            "::",
+            stringify!(mix_ns)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_stream_debug_info>())).apm_ns as *const _ as usize },
+        119usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_stream_debug_info),
+            "::",
+            stringify!(apm_ns)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<audio_stream_debug_info>())).mem_bytes as *const _ as usize
+        },
+        127usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_stream_debug_info),
+            "::",
+            stringify!(mem_bytes)
+        )
+    );
 }
 #[repr(C, packed)]
 #[derive(Copy, Clone)]
@@ -1598,12 +1848,16 @@ pub struct audio_debug_info {
     pub devs: [audio_dev_debug_info; 4usize],
     pub streams: [audio_stream_debug_info; 8usize],
     pub log: audio_thread_event_log,
+    pub rt_memory_locked: u32,
+    pub minor_faults: u64,
+    pub major_faults: u64,
+    pub conv_mem_bytes: u64,
 }
 #[test]
 fn bindgen_test_layout_audio_debug_info() {
     assert_eq!(
         ::std::mem::size_of::<audio_debug_info>(),
-        124264usize,
+        125732usize,
         concat!("Size of: ", stringify!(audio_debug_info))
     );
     assert_eq!(
@@ -1643,7 +1897,7 @@ fn bindgen_test_layout_audio_debug_info() {
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<audio_debug_info>())).streams as *const _ as usize },
-        540usize,
+        1724usize,
         concat!(
             "Offset of field: ",
             stringify!(audio_debug_info),
@@ -1653,7 +1907,7 @@ fn bindgen_test_layout_audio_debug_info() {
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<audio_debug_info>())).log as *const _ as usize },
-        1364usize,
+        2804usize,
         concat!(
             "Offset of field: ",
             stringify!(audio_debug_info),
@@ -1661,6 +1915,48 @@ fn bindgen_test_layout_audio_debug_info() {
             stringify!(log)
         )
     );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<audio_debug_info>())).rt_memory_locked as *const _ as usize
+        },
+        125704usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_debug_info),
+            "::",
+            stringify!(rt_memory_locked)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_debug_info>())).minor_faults as *const _ as usize },
+        125708usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_debug_info),
+            "::",
+            stringify!(minor_faults)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_debug_info>())).major_faults as *const _ as usize },
+        125716usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_debug_info),
+            "::",
+            stringify!(major_faults)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_debug_info>())).conv_mem_bytes as *const _ as usize },
+        125724usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_debug_info),
+            "::",
+            stringify!(conv_mem_bytes)
+        )
+    );
 }
 #[repr(C, packed)]
 #[derive(Debug, Copy, Clone)]
@@ -1785,100 +2081,252 @@ fn bindgen_test_layout_main_thread_event_log() {
     );
 }
 #[repr(C, packed)]
-#[derive(Copy, Clone)]
-pub struct main_thread_debug_info {
-    pub main_log: main_thread_event_log,
-}
-#[test]
-fn bindgen_test_layout_main_thread_debug_info() {
-    assert_eq!(
-        ::std::mem::size_of::<main_thread_debug_info>(),
-        20488usize,
-        concat!("Size of: ", stringify!(main_thread_debug_info))
-    );
-    assert_eq!(
-        ::std::mem::align_of::<main_thread_debug_info>(),
-        1usize,
-        concat!("Alignment of ", stringify!(main_thread_debug_info))
-    );
-    assert_eq!(
-        unsafe { &(*(::std::ptr::null::<main_thread_debug_info>())).main_log as *const _ as usize },
-        0usize,
-        concat!(
-            "Offset of field: ",
-            stringify!(main_thread_debug_info),
-            "::",
-            stringify!(main_log)
-        )
-    );
-}
-#[repr(C, packed)]
 #[derive(Debug, Copy, Clone)]
-pub struct cras_bt_event {
-    pub tag_sec: u32,
-    pub nsec: u32,
+pub struct main_thread_startup_phase {
+    pub phase: u32,
     pub data1: u32,
     pub data2: u32,
+    pub thread: u32,
+    pub sec: u32,
+    pub nsec: u32,
+    pub duration_us: u32,
 }
 #[test]
-fn bindgen_test_layout_cras_bt_event() {
+fn bindgen_test_layout_main_thread_startup_phase() {
     assert_eq!(
-        ::std::mem::size_of::<cras_bt_event>(),
-        16usize,
-        concat!("Size of: ", stringify!(cras_bt_event))
+        ::std::mem::size_of::<main_thread_startup_phase>(),
+        28usize,
+        concat!("Size of: ", stringify!(main_thread_startup_phase))
     );
     assert_eq!(
-        ::std::mem::align_of::<cras_bt_event>(),
+        ::std::mem::align_of::<main_thread_startup_phase>(),
         1usize,
-        concat!("Alignment of ", stringify!(cras_bt_event))
+        concat!("Alignment of ", stringify!(main_thread_startup_phase))
     );
     assert_eq!(
-        unsafe { &(*(::std::ptr::null::<cras_bt_event>())).tag_sec as *const _ as usize },
+        unsafe { &(*(::std::ptr::null::<main_thread_startup_phase>())).phase as *const _ as usize },
         0usize,
         concat!(
             "Offset of field: ",
-            stringify!(cras_bt_event),
+            stringify!(main_thread_startup_phase),
             "::",
-            stringify!(tag_sec)
+            stringify!(phase)
         )
     );
     assert_eq!(
-        unsafe { &(*(::std::ptr::null::<cras_bt_event>())).nsec as *const _ as usize },
+        unsafe { &(*(::std::ptr::null::<main_thread_startup_phase>())).data1 as *const _ as usize },
         4usize,
         concat!(
             "Offset of field: ",
-            stringify!(cras_bt_event),
+            stringify!(main_thread_startup_phase),
             "::",
-            stringify!(nsec)
+            stringify!(data1)
         )
     );
     assert_eq!(
-        unsafe { &(*(::std::ptr::null::<cras_bt_event>())).data1 as *const _ as usize },
+        unsafe { &(*(::std::ptr::null::<main_thread_startup_phase>())).data2 as *const _ as usize },
         8usize,
         concat!(
             "Offset of field: ",
-            stringify!(cras_bt_event),
+            stringify!(main_thread_startup_phase),
             "::",
-            stringify!(data1)
+            stringify!(data2)
         )
     );
     assert_eq!(
-        unsafe { &(*(::std::ptr::null::<cras_bt_event>())).data2 as *const _ as usize },
+        unsafe {
+            &(*(::std::ptr::null::<main_thread_startup_phase>())).thread as *const _ as usize
+        },
         12usize,
         concat!(
             "Offset of field: ",
-            stringify!(cras_bt_event),
+            stringify!(main_thread_startup_phase),
             "::",
-            stringify!(data2)
+            stringify!(thread)
         )
     );
-}
-#[repr(C, packed)]
-#[derive(Copy, Clone)]
-pub struct cras_bt_event_log {
-    pub write_pos: u32,
-    pub len: u32,
-    pub log: [cras_bt_event; 1024usize],
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<main_thread_startup_phase>())).sec as *const _ as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(main_thread_startup_phase),
+            "::",
+            stringify!(sec)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<main_thread_startup_phase>())).nsec as *const _ as usize },
+        20usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(main_thread_startup_phase),
+            "::",
+            stringify!(nsec)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<main_thread_startup_phase>())).duration_us as *const _ as usize
+        },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(main_thread_startup_phase),
+            "::",
+            stringify!(duration_us)
+        )
+    );
+}
+#[repr(C, packed)]
+#[derive(Copy, Clone)]
+pub struct main_thread_startup_log {
+    pub num_phases: u32,
+    pub phases: [main_thread_startup_phase; 128usize],
+}
+#[test]
+fn bindgen_test_layout_main_thread_startup_log() {
+    assert_eq!(
+        ::std::mem::size_of::<main_thread_startup_log>(),
+        3588usize,
+        concat!("Size of: ", stringify!(main_thread_startup_log))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<main_thread_startup_log>(),
+        1usize,
+        concat!("Alignment of ", stringify!(main_thread_startup_log))
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<main_thread_startup_log>())).num_phases as *const _ as usize
+        },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(main_thread_startup_log),
+            "::",
+            stringify!(num_phases)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<main_thread_startup_log>())).phases as *const _ as usize },
+        4usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(main_thread_startup_log),
+            "::",
+            stringify!(phases)
+        )
+    );
+}
+#[repr(C, packed)]
+#[derive(Copy, Clone)]
+pub struct main_thread_debug_info {
+    pub main_log: main_thread_event_log,
+    pub startup_log: main_thread_startup_log,
+}
+#[test]
+fn bindgen_test_layout_main_thread_debug_info() {
+    assert_eq!(
+        ::std::mem::size_of::<main_thread_debug_info>(),
+        24076usize,
+        concat!("Size of: ", stringify!(main_thread_debug_info))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<main_thread_debug_info>(),
+        1usize,
+        concat!("Alignment of ", stringify!(main_thread_debug_info))
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<main_thread_debug_info>())).main_log as *const _ as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(main_thread_debug_info),
+            "::",
+            stringify!(main_log)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<main_thread_debug_info>())).startup_log as *const _ as usize
+        },
+        20488usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(main_thread_debug_info),
+            "::",
+            stringify!(startup_log)
+        )
+    );
+}
+#[repr(C, packed)]
+#[derive(Debug, Copy, Clone)]
+pub struct cras_bt_event {
+    pub tag_sec: u32,
+    pub nsec: u32,
+    pub data1: u32,
+    pub data2: u32,
+}
+#[test]
+fn bindgen_test_layout_cras_bt_event() {
+    assert_eq!(
+        ::std::mem::size_of::<cras_bt_event>(),
+        16usize,
+        concat!("Size of: ", stringify!(cras_bt_event))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<cras_bt_event>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_bt_event))
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_bt_event>())).tag_sec as *const _ as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_bt_event),
+            "::",
+            stringify!(tag_sec)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_bt_event>())).nsec as *const _ as usize },
+        4usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_bt_event),
+            "::",
+            stringify!(nsec)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_bt_event>())).data1 as *const _ as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_bt_event),
+            "::",
+            stringify!(data1)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_bt_event>())).data2 as *const _ as usize },
+        12usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_bt_event),
+            "::",
+            stringify!(data2)
+        )
+    );
+}
+#[repr(C, packed)]
+#[derive(Copy, Clone)]
+pub struct cras_bt_event_log {
+    pub write_pos: u32,
+    pub len: u32,
+    pub log: [cras_bt_event; 1024usize],
 }
 #[test]
 fn bindgen_test_layout_cras_bt_event_log() {
@@ -1933,7 +2381,7 @@ pub struct cras_bt_debug_info {
 fn bindgen_test_layout_cras_bt_debug_info() {
     assert_eq!(
         ::std::mem::size_of::<cras_bt_debug_info>(),
-        16488usize,
+        24632usize,
         concat!("Size of: ", stringify!(cras_bt_debug_info))
     );
     assert_eq!(
@@ -1942,23 +2390,445 @@ fn bindgen_test_layout_cras_bt_debug_info() {
         concat!("Alignment of ", stringify!(cras_bt_debug_info))
     );
     assert_eq!(
-        unsafe { &(*(::std::ptr::null::<cras_bt_debug_info>())).bt_log as *const _ as usize },
-        0usize,
+        unsafe { &(*(::std::ptr::null::<cras_bt_debug_info>())).bt_log as *const _ as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_bt_debug_info),
+            "::",
+            stringify!(bt_log)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_bt_debug_info>())).wbs_logger as *const _ as usize },
+        16392usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_bt_debug_info),
+            "::",
+            stringify!(wbs_logger)
+        )
+    );
+}
+#[repr(C, packed)]
+#[derive(Debug, Copy, Clone)]
+pub struct cras_dev_perf_stats {
+    pub dev_idx: u32,
+    pub direction: u32,
+    pub frame_rate: u32,
+    pub buffer_size: u32,
+    pub min_buffer_level: u32,
+    pub highest_hw_level: u32,
+    pub margin_us: u32,
+    pub min_margin_us: u32,
+    pub lateness_us: u32,
+    pub late_us: u32,
+    pub max_late_us: u32,
+    pub num_risks: u32,
+    pub num_underruns: u32,
+    pub num_severe_underruns: u32,
+    pub stage_count: [u32; 6usize],
+    pub stage_total_usec: [u64; 6usize],
+    pub stage_max_usec: [u32; 6usize],
+}
+#[test]
+fn bindgen_test_layout_cras_dev_perf_stats() {
+    assert_eq!(
+        ::std::mem::size_of::<cras_dev_perf_stats>(),
+        152usize,
+        concat!("Size of: ", stringify!(cras_dev_perf_stats))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<cras_dev_perf_stats>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_dev_perf_stats))
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_dev_perf_stats>())).dev_idx as *const _ as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_dev_perf_stats),
+            "::",
+            stringify!(dev_idx)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_dev_perf_stats>())).direction as *const _ as usize },
+        4usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_dev_perf_stats),
+            "::",
+            stringify!(direction)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_dev_perf_stats>())).frame_rate as *const _ as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_dev_perf_stats),
+            "::",
+            stringify!(frame_rate)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_dev_perf_stats>())).buffer_size as *const _ as usize },
+        12usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_dev_perf_stats),
+            "::",
+            stringify!(buffer_size)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_dev_perf_stats>())).min_buffer_level as *const _ as usize
+        },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_dev_perf_stats),
+            "::",
+            stringify!(min_buffer_level)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_dev_perf_stats>())).highest_hw_level as *const _ as usize
+        },
+        20usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_dev_perf_stats),
+            "::",
+            stringify!(highest_hw_level)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_dev_perf_stats>())).margin_us as *const _ as usize },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_dev_perf_stats),
+            "::",
+            stringify!(margin_us)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_dev_perf_stats>())).min_margin_us as *const _ as usize
+        },
+        28usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_dev_perf_stats),
+            "::",
+            stringify!(min_margin_us)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_dev_perf_stats>())).lateness_us as *const _ as usize },
+        32usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_dev_perf_stats),
+            "::",
+            stringify!(lateness_us)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_dev_perf_stats>())).late_us as *const _ as usize },
+        36usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_dev_perf_stats),
+            "::",
+            stringify!(late_us)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_dev_perf_stats>())).max_late_us as *const _ as usize },
+        40usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_dev_perf_stats),
+            "::",
+            stringify!(max_late_us)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_dev_perf_stats>())).num_risks as *const _ as usize },
+        44usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_dev_perf_stats),
+            "::",
+            stringify!(num_risks)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_dev_perf_stats>())).num_underruns as *const _ as usize
+        },
+        48usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_dev_perf_stats),
+            "::",
+            stringify!(num_underruns)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_dev_perf_stats>())).num_severe_underruns as *const _
+                as usize
+        },
+        52usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_dev_perf_stats),
+            "::",
+            stringify!(num_severe_underruns)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_dev_perf_stats>())).stage_count as *const _ as usize },
+        56usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_dev_perf_stats),
+            "::",
+            stringify!(stage_count)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_dev_perf_stats>())).stage_total_usec as *const _ as usize
+        },
+        80usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_dev_perf_stats),
+            "::",
+            stringify!(stage_total_usec)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_dev_perf_stats>())).stage_max_usec as *const _ as usize
+        },
+        128usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_dev_perf_stats),
+            "::",
+            stringify!(stage_max_usec)
+        )
+    );
+}
+#[repr(C, packed)]
+#[derive(Debug, Copy, Clone)]
+pub struct cras_stream_perf_stats {
+    pub stream_id: u32,
+    pub dev_idx: u32,
+    pub direction: u32,
+    pub frame_rate: u32,
+    pub cb_threshold: u32,
+    pub num_missed_cb: u32,
+    pub num_overruns: u32,
+    pub longest_fetch_usec: u32,
+}
+#[test]
+fn bindgen_test_layout_cras_stream_perf_stats() {
+    assert_eq!(
+        ::std::mem::size_of::<cras_stream_perf_stats>(),
+        32usize,
+        concat!("Size of: ", stringify!(cras_stream_perf_stats))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<cras_stream_perf_stats>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_stream_perf_stats))
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_stream_perf_stats>())).stream_id as *const _ as usize
+        },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_stream_perf_stats),
+            "::",
+            stringify!(stream_id)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_stream_perf_stats>())).dev_idx as *const _ as usize },
+        4usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_stream_perf_stats),
+            "::",
+            stringify!(dev_idx)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_stream_perf_stats>())).direction as *const _ as usize
+        },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_stream_perf_stats),
+            "::",
+            stringify!(direction)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_stream_perf_stats>())).frame_rate as *const _ as usize
+        },
+        12usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_stream_perf_stats),
+            "::",
+            stringify!(frame_rate)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_stream_perf_stats>())).cb_threshold as *const _ as usize
+        },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_stream_perf_stats),
+            "::",
+            stringify!(cb_threshold)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_stream_perf_stats>())).num_missed_cb as *const _ as usize
+        },
+        20usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_stream_perf_stats),
+            "::",
+            stringify!(num_missed_cb)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_stream_perf_stats>())).num_overruns as *const _ as usize
+        },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_stream_perf_stats),
+            "::",
+            stringify!(num_overruns)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_stream_perf_stats>())).longest_fetch_usec as *const _
+                as usize
+        },
+        28usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_stream_perf_stats),
+            "::",
+            stringify!(longest_fetch_usec)
+        )
+    );
+}
+#[repr(C, packed)]
+#[derive(Debug, Copy, Clone)]
+pub struct cras_perf_stats {
+    pub seq: u32,
+    pub timestamp: cras_timespec,
+    pub num_devs: u32,
+    pub num_streams: u32,
+    pub devs: [cras_dev_perf_stats; 4usize],
+    pub streams: [cras_stream_perf_stats; 8usize],
+}
+#[test]
+fn bindgen_test_layout_cras_perf_stats() {
+    assert_eq!(
+        ::std::mem::size_of::<cras_perf_stats>(),
+        892usize,
+        concat!("Size of: ", stringify!(cras_perf_stats))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<cras_perf_stats>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_perf_stats))
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_perf_stats>())).seq as *const _ as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_perf_stats),
+            "::",
+            stringify!(seq)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_perf_stats>())).timestamp as *const _ as usize },
+        4usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_perf_stats),
+            "::",
+            stringify!(timestamp)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_perf_stats>())).num_devs as *const _ as usize },
+        20usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_perf_stats),
+            "::",
+            stringify!(num_devs)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_perf_stats>())).num_streams as *const _ as usize },
+        24usize,
         concat!(
             "Offset of field: ",
-            stringify!(cras_bt_debug_info),
+            stringify!(cras_perf_stats),
             "::",
-            stringify!(bt_log)
+            stringify!(num_streams)
         )
     );
     assert_eq!(
-        unsafe { &(*(::std::ptr::null::<cras_bt_debug_info>())).wbs_logger as *const _ as usize },
-        16392usize,
+        unsafe { &(*(::std::ptr::null::<cras_perf_stats>())).devs as *const _ as usize },
+        28usize,
         concat!(
             "Offset of field: ",
-            stringify!(cras_bt_debug_info),
+            stringify!(cras_perf_stats),
             "::",
-            stringify!(wbs_logger)
+            stringify!(devs)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_perf_stats>())).streams as *const _ as usize },
+        636usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_perf_stats),
+            "::",
+            stringify!(streams)
         )
     );
 }
@@ -1973,7 +2843,8 @@ pub enum CRAS_AUDIO_THREAD_EVENT_TYPE {
     AUDIO_THREAD_EVENT_UNDERRUN = 5,
     AUDIO_THREAD_EVENT_DROP_SAMPLES = 6,
     AUDIO_THREAD_EVENT_DEV_OVERRUN = 7,
-    AUDIO_THREAD_EVENT_TYPE_COUNT = 8,
+    AUDIO_THREAD_EVENT_UNDERRUN_RISK = 8,
+    AUDIO_THREAD_EVENT_TYPE_COUNT = 9,
 }
 #[repr(C, packed)]
 #[derive(Copy, Clone)]
@@ -1986,7 +2857,7 @@ pub struct cras_audio_thread_snapshot {
 fn bindgen_test_layout_cras_audio_thread_snapshot() {
     assert_eq!(
         ::std::mem::size_of::<cras_audio_thread_snapshot>(),
-        124284usize,
+        125752usize,
         concat!("Size of: ", stringify!(cras_audio_thread_snapshot))
     );
     assert_eq!(
@@ -2042,7 +2913,7 @@ pub struct cras_audio_thread_snapshot_buffer {
 fn bindgen_test_layout_cras_audio_thread_snapshot_buffer() {
     assert_eq!(
         ::std::mem::size_of::<cras_audio_thread_snapshot_buffer>(),
-        1242844usize,
+        1257524usize,
         concat!("Size of: ", stringify!(cras_audio_thread_snapshot_buffer))
     );
     assert_eq!(
@@ -2070,7 +2941,7 @@ fn bindgen_test_layout_cras_audio_thread_snapshot_buffer() {
         unsafe {
             &(*(::std::ptr::null::<cras_audio_thread_snapshot_buffer>())).pos as *const _ as usize
         },
-        1242840usize,
+        1257520usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_thread_snapshot_buffer),
@@ -2079,6 +2950,15 @@ fn bindgen_test_layout_cras_audio_thread_snapshot_buffer() {
         )
     );
 }
+#[repr(u32)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
+pub enum CRAS_SERVER_STATE_SECTION {
+    CRAS_STATE_OUTPUT_DEVS = 0,
+    CRAS_STATE_INPUT_DEVS = 1,
+    CRAS_STATE_CLIENTS = 2,
+    CRAS_STATE_STREAMS = 3,
+    CRAS_STATE_NUM_SECTIONS = 4,
+}
 #[repr(C, packed)]
 #[derive(Copy, Clone)]
 pub struct cras_server_state {
@@ -2117,12 +2997,15 @@ pub struct cras_server_state {
     pub bt_wbs_enabled: i32,
     pub deprioritize_bt_wbs_mic: i32,
     pub main_thread_debug_info: main_thread_debug_info,
+    pub num_input_streams_with_permission: [u32; 10usize],
+    pub section_update_count: [u32; 4usize],
+    pub perf_stats: [cras_perf_stats; 4usize],
 }
 #[test]
 fn bindgen_test_layout_cras_server_state() {
     assert_eq!(
         ::std::mem::size_of::<cras_server_state>(),
-        1414292usize,
+        1446276usize,
         concat!("Size of: ", stringify!(cras_server_state))
     );
     assert_eq!(
@@ -2294,7 +3177,7 @@ fn bindgen_test_layout_cras_server_state() {
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<cras_server_state>())).input_devs as *const _ as usize },
-        1576usize,
+        1816usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2306,7 +3189,7 @@ fn bindgen_test_layout_cras_server_state() {
         unsafe {
             &(*(::std::ptr::null::<cras_server_state>())).num_output_nodes as *const _ as usize
         },
-        3096usize,
+        3576usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2318,7 +3201,7 @@ fn bindgen_test_layout_cras_server_state() {
         unsafe {
             &(*(::std::ptr::null::<cras_server_state>())).num_input_nodes as *const _ as usize
         },
-        3100usize,
+        3580usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2328,7 +3211,7 @@ fn bindgen_test_layout_cras_server_state() {
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<cras_server_state>())).output_nodes as *const _ as usize },
-        3104usize,
+        3584usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2338,7 +3221,7 @@ fn bindgen_test_layout_cras_server_state() {
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<cras_server_state>())).input_nodes as *const _ as usize },
-        6464usize,
+        6944usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2350,7 +3233,7 @@ fn bindgen_test_layout_cras_server_state() {
         unsafe {
             &(*(::std::ptr::null::<cras_server_state>())).num_attached_clients as *const _ as usize
         },
-        9824usize,
+        10304usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2360,7 +3243,7 @@ fn bindgen_test_layout_cras_server_state() {
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<cras_server_state>())).client_info as *const _ as usize },
-        9828usize,
+        10308usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2370,7 +3253,7 @@ fn bindgen_test_layout_cras_server_state() {
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<cras_server_state>())).update_count as *const _ as usize },
-        10148usize,
+        10628usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2382,7 +3265,7 @@ fn bindgen_test_layout_cras_server_state() {
         unsafe {
             &(*(::std::ptr::null::<cras_server_state>())).num_active_streams as *const _ as usize
         },
-        10152usize,
+        10632usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2395,7 +3278,7 @@ fn bindgen_test_layout_cras_server_state() {
             &(*(::std::ptr::null::<cras_server_state>())).last_active_stream_time as *const _
                 as usize
         },
-        10168usize,
+        10648usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2407,7 +3290,7 @@ fn bindgen_test_layout_cras_server_state() {
         unsafe {
             &(*(::std::ptr::null::<cras_server_state>())).audio_debug_info as *const _ as usize
         },
-        10184usize,
+        10664usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2420,7 +3303,7 @@ fn bindgen_test_layout_cras_server_state() {
             &(*(::std::ptr::null::<cras_server_state>())).default_output_buffer_size as *const _
                 as usize
         },
-        134448usize,
+        136396usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2432,7 +3315,7 @@ fn bindgen_test_layout_cras_server_state() {
         unsafe {
             &(*(::std::ptr::null::<cras_server_state>())).non_empty_status as *const _ as usize
         },
-        134452usize,
+        136400usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2442,7 +3325,7 @@ fn bindgen_test_layout_cras_server_state() {
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<cras_server_state>())).aec_supported as *const _ as usize },
-        134456usize,
+        136404usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2452,7 +3335,7 @@ fn bindgen_test_layout_cras_server_state() {
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<cras_server_state>())).aec_group_id as *const _ as usize },
-        134460usize,
+        136408usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2464,7 +3347,7 @@ fn bindgen_test_layout_cras_server_state() {
         unsafe {
             &(*(::std::ptr::null::<cras_server_state>())).snapshot_buffer as *const _ as usize
         },
-        134464usize,
+        136412usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2474,7 +3357,7 @@ fn bindgen_test_layout_cras_server_state() {
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<cras_server_state>())).bt_debug_info as *const _ as usize },
-        1377308usize,
+        1393936usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2486,7 +3369,7 @@ fn bindgen_test_layout_cras_server_state() {
         unsafe {
             &(*(::std::ptr::null::<cras_server_state>())).bt_wbs_enabled as *const _ as usize
         },
-        1393796usize,
+        1418568usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2499,7 +3382,7 @@ fn bindgen_test_layout_cras_server_state() {
             &(*(::std::ptr::null::<cras_server_state>())).deprioritize_bt_wbs_mic as *const _
                 as usize
         },
-        1393800usize,
+        1418572usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2512,7 +3395,7 @@ fn bindgen_test_layout_cras_server_state() {
             &(*(::std::ptr::null::<cras_server_state>())).main_thread_debug_info as *const _
                 as usize
         },
-        1393804usize,
+        1418576usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2520,6 +3403,41 @@ fn bindgen_test_layout_cras_server_state() {
             stringify!(main_thread_debug_info)
         )
     );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_server_state>())).num_input_streams_with_permission
+                as *const _ as usize
+        },
+        1442652usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_server_state),
+            "::",
+            stringify!(num_input_streams_with_permission)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_server_state>())).section_update_count as *const _ as usize
+        },
+        1442692usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_server_state),
+            "::",
+            stringify!(section_update_count)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_server_state>())).perf_stats as *const _ as usize },
+        1442708usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_server_state),
+            "::",
+            stringify!(perf_stats)
+        )
+    );
 }
 pub const cras_notify_device_action_CRAS_DEVICE_ACTION_ADD: cras_notify_device_action = 0;
 pub const cras_notify_device_action_CRAS_DEVICE_ACTION_REMOVE: cras_notify_device_action = 1;
@@ -2688,6 +3606,10 @@ pub enum CRAS_SERVER_MESSAGE_ID {
     CRAS_SERVER_SET_BT_WBS_ENABLED = 29,
     CRAS_SERVER_GET_ATLOG_FD = 30,
     CRAS_SERVER_DUMP_MAIN = 31,
+    CRAS_SERVER_CONNECT_STREAMS = 32,
+    CRAS_SERVER_DISCONNECT_STREAMS = 33,
+    CRAS_SERVER_SET_STREAM_EFFECTS = 34,
+    CRAS_SERVER_SET_STREAM_PAUSED = 35,
 }
 #[repr(u32)]
 #[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
@@ -2803,12 +3725,15 @@ pub struct cras_connect_message {
     pub client_type: CRAS_CLIENT_TYPE,
     pub client_shm_size: u64,
     pub buffer_offsets: [u64; 2usize],
+    pub num_shm_buffers: u32,
+    pub scheduled_ts: cras_timespec,
+    pub pre_roll_frames: u32,
 }
 #[test]
 fn bindgen_test_layout_cras_connect_message() {
     assert_eq!(
         ::std::mem::size_of::<cras_connect_message>(),
-        99usize,
+        123usize,
         concat!("Size of: ", stringify!(cras_connect_message))
     );
     assert_eq!(
@@ -2960,61 +3885,342 @@ fn bindgen_test_layout_cras_connect_message() {
     );
     assert_eq!(
         unsafe {
-            &(*(::std::ptr::null::<cras_connect_message>())).buffer_offsets as *const _ as usize
+            &(*(::std::ptr::null::<cras_connect_message>())).buffer_offsets as *const _ as usize
+        },
+        83usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_connect_message),
+            "::",
+            stringify!(buffer_offsets)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_connect_message>())).num_shm_buffers as *const _ as usize
+        },
+        99usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_connect_message),
+            "::",
+            stringify!(num_shm_buffers)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_connect_message>())).scheduled_ts as *const _ as usize
+        },
+        103usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_connect_message),
+            "::",
+            stringify!(scheduled_ts)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_connect_message>())).pre_roll_frames as *const _ as usize
+        },
+        119usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_connect_message),
+            "::",
+            stringify!(pre_roll_frames)
+        )
+    );
+}
+#[repr(C, packed)]
+#[derive(Debug, Copy, Clone)]
+pub struct cras_disconnect_stream_message {
+    pub header: cras_server_message,
+    pub stream_id: cras_stream_id_t,
+}
+#[test]
+fn bindgen_test_layout_cras_disconnect_stream_message() {
+    assert_eq!(
+        ::std::mem::size_of::<cras_disconnect_stream_message>(),
+        12usize,
+        concat!("Size of: ", stringify!(cras_disconnect_stream_message))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<cras_disconnect_stream_message>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_disconnect_stream_message))
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_disconnect_stream_message>())).header as *const _ as usize
+        },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_disconnect_stream_message),
+            "::",
+            stringify!(header)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_disconnect_stream_message>())).stream_id as *const _
+                as usize
+        },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_disconnect_stream_message),
+            "::",
+            stringify!(stream_id)
+        )
+    );
+}
+#[repr(C, packed)]
+#[derive(Debug, Copy, Clone)]
+pub struct cras_connect_streams_message {
+    pub header: cras_server_message,
+    pub num_streams: u32,
+    pub streams: [cras_connect_message; 8usize],
+}
+#[test]
+fn bindgen_test_layout_cras_connect_streams_message() {
+    assert_eq!(
+        ::std::mem::size_of::<cras_connect_streams_message>(),
+        996usize,
+        concat!("Size of: ", stringify!(cras_connect_streams_message))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<cras_connect_streams_message>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_connect_streams_message))
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_connect_streams_message>())).header as *const _ as usize
+        },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_connect_streams_message),
+            "::",
+            stringify!(header)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_connect_streams_message>())).num_streams as *const _
+                as usize
+        },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_connect_streams_message),
+            "::",
+            stringify!(num_streams)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_connect_streams_message>())).streams as *const _ as usize
+        },
+        12usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_connect_streams_message),
+            "::",
+            stringify!(streams)
+        )
+    );
+}
+#[repr(C, packed)]
+#[derive(Debug, Copy, Clone)]
+pub struct cras_disconnect_streams_message {
+    pub header: cras_server_message,
+    pub num_streams: u32,
+    pub stream_ids: [cras_stream_id_t; 8usize],
+}
+#[test]
+fn bindgen_test_layout_cras_disconnect_streams_message() {
+    assert_eq!(
+        ::std::mem::size_of::<cras_disconnect_streams_message>(),
+        44usize,
+        concat!("Size of: ", stringify!(cras_disconnect_streams_message))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<cras_disconnect_streams_message>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_disconnect_streams_message))
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_disconnect_streams_message>())).header as *const _ as usize
+        },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_disconnect_streams_message),
+            "::",
+            stringify!(header)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_disconnect_streams_message>())).num_streams as *const _
+                as usize
+        },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_disconnect_streams_message),
+            "::",
+            stringify!(num_streams)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_disconnect_streams_message>())).stream_ids as *const _
+                as usize
+        },
+        12usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_disconnect_streams_message),
+            "::",
+            stringify!(stream_ids)
+        )
+    );
+}
+#[repr(C, packed)]
+#[derive(Debug, Copy, Clone)]
+pub struct cras_set_stream_effects_message {
+    pub header: cras_server_message,
+    pub stream_id: cras_stream_id_t,
+    pub effects: u64,
+}
+#[test]
+fn bindgen_test_layout_cras_set_stream_effects_message() {
+    assert_eq!(
+        ::std::mem::size_of::<cras_set_stream_effects_message>(),
+        20usize,
+        concat!("Size of: ", stringify!(cras_set_stream_effects_message))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<cras_set_stream_effects_message>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_set_stream_effects_message))
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_set_stream_effects_message>())).header as *const _ as usize
+        },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_set_stream_effects_message),
+            "::",
+            stringify!(header)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_set_stream_effects_message>())).stream_id as *const _
+                as usize
+        },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_set_stream_effects_message),
+            "::",
+            stringify!(stream_id)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_set_stream_effects_message>())).effects as *const _ as usize
         },
-        83usize,
+        12usize,
         concat!(
             "Offset of field: ",
-            stringify!(cras_connect_message),
+            stringify!(cras_set_stream_effects_message),
             "::",
-            stringify!(buffer_offsets)
+            stringify!(effects)
         )
     );
 }
+
 #[repr(C, packed)]
 #[derive(Debug, Copy, Clone)]
-pub struct cras_disconnect_stream_message {
+pub struct cras_set_stream_paused_message {
     pub header: cras_server_message,
     pub stream_id: cras_stream_id_t,
+    pub paused: u32,
+    pub fade_in_ms: u32,
 }
 #[test]
-fn bindgen_test_layout_cras_disconnect_stream_message() {
+fn bindgen_test_layout_cras_set_stream_paused_message() {
     assert_eq!(
-        ::std::mem::size_of::<cras_disconnect_stream_message>(),
-        12usize,
-        concat!("Size of: ", stringify!(cras_disconnect_stream_message))
+        ::std::mem::size_of::<cras_set_stream_paused_message>(),
+        20usize,
+        concat!("Size of: ", stringify!(cras_set_stream_paused_message))
     );
     assert_eq!(
-        ::std::mem::align_of::<cras_disconnect_stream_message>(),
+        ::std::mem::align_of::<cras_set_stream_paused_message>(),
         1usize,
-        concat!("Alignment of ", stringify!(cras_disconnect_stream_message))
+        concat!("Alignment of ", stringify!(cras_set_stream_paused_message))
     );
     assert_eq!(
         unsafe {
-            &(*(::std::ptr::null::<cras_disconnect_stream_message>())).header as *const _ as usize
+            &(*(::std::ptr::null::<cras_set_stream_paused_message>())).header as *const _ as usize
         },
         0usize,
         concat!(
             "Offset of field: ",
-            stringify!(cras_disconnect_stream_message),
+            stringify!(cras_set_stream_paused_message),
             "::",
             stringify!(header)
         )
     );
     assert_eq!(
         unsafe {
-            &(*(::std::ptr::null::<cras_disconnect_stream_message>())).stream_id as *const _
+            &(*(::std::ptr::null::<cras_set_stream_paused_message>())).stream_id as *const _
                 as usize
         },
         8usize,
         concat!(
             "Offset of field: ",
-            stringify!(cras_disconnect_stream_message),
+            stringify!(cras_set_stream_paused_message),
             "::",
             stringify!(stream_id)
         )
     );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_set_stream_paused_message>())).paused as *const _ as usize
+        },
+        12usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_set_stream_paused_message),
+            "::",
+            stringify!(paused)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_set_stream_paused_message>())).fade_in_ms as *const _
+                as usize
+        },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_set_stream_paused_message),
+            "::",
+            stringify!(fade_in_ms)
+        )
+    );
 }
+
 #[repr(C, packed)]
 #[derive(Debug, Copy, Clone)]
 pub struct cras_switch_stream_type_iodev {
@@ -4528,164 +5734,399 @@ fn bindgen_test_layout_cras_client_num_active_streams_changed() {
     );
     assert_eq!(
         unsafe {
-            &(*(::std::ptr::null::<cras_client_num_active_streams_changed>())).header as *const _
-                as usize
+            &(*(::std::ptr::null::<cras_client_num_active_streams_changed>())).header as *const _
+                as usize
+        },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_client_num_active_streams_changed),
+            "::",
+            stringify!(header)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_client_num_active_streams_changed>())).direction as *const _
+                as usize
+        },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_client_num_active_streams_changed),
+            "::",
+            stringify!(direction)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_client_num_active_streams_changed>())).num_active_streams
+                as *const _ as usize
+        },
+        12usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_client_num_active_streams_changed),
+            "::",
+            stringify!(num_active_streams)
+        )
+    );
+}
+#[repr(u32)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
+pub enum CRAS_AUDIO_MESSAGE_ID {
+    AUDIO_MESSAGE_REQUEST_DATA = 0,
+    AUDIO_MESSAGE_DATA_READY = 1,
+    AUDIO_MESSAGE_DATA_CAPTURED = 2,
+    NUM_AUDIO_MESSAGES = 3,
+}
+#[repr(C, packed)]
+#[derive(Debug, Copy, Clone)]
+pub struct audio_message {
+    pub id: CRAS_AUDIO_MESSAGE_ID,
+    pub error: i32,
+    pub frames: u32,
+}
+#[test]
+fn bindgen_test_layout_audio_message() {
+    assert_eq!(
+        ::std::mem::size_of::<audio_message>(),
+        12usize,
+        concat!("Size of: ", stringify!(audio_message))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<audio_message>(),
+        1usize,
+        concat!("Alignment of ", stringify!(audio_message))
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_message>())).id as *const _ as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_message),
+            "::",
+            stringify!(id)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_message>())).error as *const _ as usize },
+        4usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_message),
+            "::",
+            stringify!(error)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_message>())).frames as *const _ as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_message),
+            "::",
+            stringify!(frames)
+        )
+    );
+}
+#[repr(C, packed)]
+#[derive(Debug, Copy, Clone)]
+pub struct cras_audio_shm_config {
+    pub used_size: u32,
+    pub frame_bytes: u32,
+    pub num_buffers: u32,
+    pub layout_version: u32,
+}
+#[test]
+fn bindgen_test_layout_cras_audio_shm_config() {
+    assert_eq!(
+        ::std::mem::size_of::<cras_audio_shm_config>(),
+        16usize,
+        concat!("Size of: ", stringify!(cras_audio_shm_config))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<cras_audio_shm_config>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_audio_shm_config))
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_audio_shm_config>())).used_size as *const _ as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_config),
+            "::",
+            stringify!(used_size)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_config>())).frame_bytes as *const _ as usize
+        },
+        4usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_config),
+            "::",
+            stringify!(frame_bytes)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_config>())).num_buffers as *const _ as usize
+        },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_config),
+            "::",
+            stringify!(num_buffers)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_config>())).layout_version as *const _ as usize
+        },
+        12usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_config),
+            "::",
+            stringify!(layout_version)
+        )
+    );
+}
+#[repr(C, packed)]
+#[derive(Debug, Copy, Clone)]
+pub struct cras_audio_shm_telemetry {
+    pub seq: u32,
+    pub version: u32,
+    pub dev_delay_frames: u32,
+    pub dsp_delay_frames: u32,
+    pub src_delay_frames: u32,
+    pub dev_rate: u32,
+    pub rate_ratio: f64,
+    pub num_overruns: u32,
+    pub num_underruns: u32,
+    pub ts: cras_timespec,
+    pub stream_power: f32,
+    pub stream_peak: f32,
+    pub dev_power: f32,
+    pub dev_peak: f32,
+}
+#[test]
+fn bindgen_test_layout_cras_audio_shm_telemetry() {
+    assert_eq!(
+        ::std::mem::size_of::<cras_audio_shm_telemetry>(),
+        72usize,
+        concat!("Size of: ", stringify!(cras_audio_shm_telemetry))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<cras_audio_shm_telemetry>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_audio_shm_telemetry))
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_audio_shm_telemetry>())).seq as *const _ as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_telemetry),
+            "::",
+            stringify!(seq)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_telemetry>())).version as *const _ as usize
+        },
+        4usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_telemetry),
+            "::",
+            stringify!(version)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_telemetry>())).dev_delay_frames as *const _
+                as usize
+        },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_telemetry),
+            "::",
+            stringify!(dev_delay_frames)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_telemetry>())).dsp_delay_frames as *const _
+                as usize
+        },
+        12usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_telemetry),
+            "::",
+            stringify!(dsp_delay_frames)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_telemetry>())).src_delay_frames as *const _
+                as usize
+        },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_telemetry),
+            "::",
+            stringify!(src_delay_frames)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_telemetry>())).dev_rate as *const _ as usize
         },
-        0usize,
+        20usize,
         concat!(
             "Offset of field: ",
-            stringify!(cras_client_num_active_streams_changed),
+            stringify!(cras_audio_shm_telemetry),
             "::",
-            stringify!(header)
+            stringify!(dev_rate)
         )
     );
     assert_eq!(
         unsafe {
-            &(*(::std::ptr::null::<cras_client_num_active_streams_changed>())).direction as *const _
-                as usize
+            &(*(::std::ptr::null::<cras_audio_shm_telemetry>())).rate_ratio as *const _ as usize
         },
-        8usize,
+        24usize,
         concat!(
             "Offset of field: ",
-            stringify!(cras_client_num_active_streams_changed),
+            stringify!(cras_audio_shm_telemetry),
             "::",
-            stringify!(direction)
+            stringify!(rate_ratio)
         )
     );
     assert_eq!(
         unsafe {
-            &(*(::std::ptr::null::<cras_client_num_active_streams_changed>())).num_active_streams
-                as *const _ as usize
+            &(*(::std::ptr::null::<cras_audio_shm_telemetry>())).num_overruns as *const _ as usize
         },
-        12usize,
+        32usize,
         concat!(
             "Offset of field: ",
-            stringify!(cras_client_num_active_streams_changed),
+            stringify!(cras_audio_shm_telemetry),
             "::",
-            stringify!(num_active_streams)
+            stringify!(num_overruns)
         )
     );
-}
-#[repr(u32)]
-#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
-pub enum CRAS_AUDIO_MESSAGE_ID {
-    AUDIO_MESSAGE_REQUEST_DATA = 0,
-    AUDIO_MESSAGE_DATA_READY = 1,
-    AUDIO_MESSAGE_DATA_CAPTURED = 2,
-    NUM_AUDIO_MESSAGES = 3,
-}
-#[repr(C, packed)]
-#[derive(Debug, Copy, Clone)]
-pub struct audio_message {
-    pub id: CRAS_AUDIO_MESSAGE_ID,
-    pub error: i32,
-    pub frames: u32,
-}
-#[test]
-fn bindgen_test_layout_audio_message() {
-    assert_eq!(
-        ::std::mem::size_of::<audio_message>(),
-        12usize,
-        concat!("Size of: ", stringify!(audio_message))
-    );
-    assert_eq!(
-        ::std::mem::align_of::<audio_message>(),
-        1usize,
-        concat!("Alignment of ", stringify!(audio_message))
-    );
     assert_eq!(
-        unsafe { &(*(::std::ptr::null::<audio_message>())).id as *const _ as usize },
-        0usize,
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_telemetry>())).num_underruns as *const _ as usize
+        },
+        36usize,
         concat!(
             "Offset of field: ",
-            stringify!(audio_message),
+            stringify!(cras_audio_shm_telemetry),
             "::",
-            stringify!(id)
+            stringify!(num_underruns)
         )
     );
     assert_eq!(
-        unsafe { &(*(::std::ptr::null::<audio_message>())).error as *const _ as usize },
-        4usize,
+        unsafe { &(*(::std::ptr::null::<cras_audio_shm_telemetry>())).ts as *const _ as usize },
+        40usize,
         concat!(
             "Offset of field: ",
-            stringify!(audio_message),
+            stringify!(cras_audio_shm_telemetry),
             "::",
-            stringify!(error)
+            stringify!(ts)
         )
     );
     assert_eq!(
-        unsafe { &(*(::std::ptr::null::<audio_message>())).frames as *const _ as usize },
-        8usize,
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_telemetry>())).stream_power as *const _ as usize
+        },
+        56usize,
         concat!(
             "Offset of field: ",
-            stringify!(audio_message),
+            stringify!(cras_audio_shm_telemetry),
             "::",
-            stringify!(frames)
+            stringify!(stream_power)
         )
     );
-}
-#[repr(C, packed)]
-#[derive(Debug, Copy, Clone)]
-pub struct cras_audio_shm_config {
-    pub used_size: u32,
-    pub frame_bytes: u32,
-}
-#[test]
-fn bindgen_test_layout_cras_audio_shm_config() {
-    assert_eq!(
-        ::std::mem::size_of::<cras_audio_shm_config>(),
-        8usize,
-        concat!("Size of: ", stringify!(cras_audio_shm_config))
-    );
     assert_eq!(
-        ::std::mem::align_of::<cras_audio_shm_config>(),
-        1usize,
-        concat!("Alignment of ", stringify!(cras_audio_shm_config))
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_telemetry>())).stream_peak as *const _ as usize
+        },
+        60usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_telemetry),
+            "::",
+            stringify!(stream_peak)
+        )
     );
     assert_eq!(
-        unsafe { &(*(::std::ptr::null::<cras_audio_shm_config>())).used_size as *const _ as usize },
-        0usize,
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_telemetry>())).dev_power as *const _ as usize
+        },
+        64usize,
         concat!(
             "Offset of field: ",
-            stringify!(cras_audio_shm_config),
+            stringify!(cras_audio_shm_telemetry),
             "::",
-            stringify!(used_size)
+            stringify!(dev_power)
         )
     );
     assert_eq!(
         unsafe {
-            &(*(::std::ptr::null::<cras_audio_shm_config>())).frame_bytes as *const _ as usize
+            &(*(::std::ptr::null::<cras_audio_shm_telemetry>())).dev_peak as *const _ as usize
         },
-        4usize,
+        68usize,
         concat!(
             "Offset of field: ",
-            stringify!(cras_audio_shm_config),
+            stringify!(cras_audio_shm_telemetry),
             "::",
-            stringify!(frame_bytes)
+            stringify!(dev_peak)
         )
     );
 }
 #[repr(C, packed)]
-#[derive(Debug, Copy, Clone)]
+#[derive(Copy, Clone)]
 pub struct cras_audio_shm_header {
     pub config: cras_audio_shm_config,
-    pub read_buf_idx: u32,
-    pub write_buf_idx: u32,
-    pub read_offset: [u32; 2usize],
-    pub write_offset: [u32; 2usize],
-    pub write_in_progress: [i32; 2usize],
     pub volume_scaler: f32,
     pub mute: i32,
-    pub callback_pending: i32,
+    pub wake_enabled: u32,
+    pub pad_setup: [u8; 36usize],
+    pub buffer_offset: [u64; 8usize],
+    pub read_buf_idx: u32,
+    pub read_offset: [u32; 8usize],
+    pub pad_reader: [u8; 28usize],
+    pub write_buf_idx: u32,
+    pub write_offset: [u32; 8usize],
+    pub write_in_progress: [i32; 8usize],
     pub num_overruns: u32,
     pub ts: cras_timespec,
-    pub buffer_offset: [u64; 2usize],
+    pub pad_writer: [u8; 40usize],
+    pub callback_pending: i32,
+    pub wake_seq: u32,
+    pub wake_frames: u32,
+    pub vad_active: u32,
+    pub vad_seq: u32,
+    pub pad_wake: [u8; 44usize],
+    pub telemetry: cras_audio_shm_telemetry,
+    pub pad_telemetry: [u8; 56usize],
 }
 #[test]
 fn bindgen_test_layout_cras_audio_shm_header() {
     assert_eq!(
         ::std::mem::size_of::<cras_audio_shm_header>(),
-        88usize,
+        512usize,
         concat!("Size of: ", stringify!(cras_audio_shm_header))
     );
     assert_eq!(
@@ -4705,33 +6146,77 @@ fn bindgen_test_layout_cras_audio_shm_header() {
     );
     assert_eq!(
         unsafe {
-            &(*(::std::ptr::null::<cras_audio_shm_header>())).read_buf_idx as *const _ as usize
+            &(*(::std::ptr::null::<cras_audio_shm_header>())).volume_scaler as *const _ as usize
         },
-        8usize,
+        16usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_shm_header),
             "::",
-            stringify!(read_buf_idx)
+            stringify!(volume_scaler)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_audio_shm_header>())).mute as *const _ as usize },
+        20usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(mute)
         )
     );
     assert_eq!(
         unsafe {
-            &(*(::std::ptr::null::<cras_audio_shm_header>())).write_buf_idx as *const _ as usize
+            &(*(::std::ptr::null::<cras_audio_shm_header>())).wake_enabled as *const _ as usize
         },
-        12usize,
+        24usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_shm_header),
             "::",
-            stringify!(write_buf_idx)
+            stringify!(wake_enabled)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_audio_shm_header>())).pad_setup as *const _ as usize },
+        28usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(pad_setup)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_header>())).buffer_offset as *const _ as usize
+        },
+        64usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(buffer_offset)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_header>())).read_buf_idx as *const _ as usize
+        },
+        128usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(read_buf_idx)
         )
     );
     assert_eq!(
         unsafe {
             &(*(::std::ptr::null::<cras_audio_shm_header>())).read_offset as *const _ as usize
         },
-        16usize,
+        132usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_shm_header),
@@ -4739,11 +6224,35 @@ fn bindgen_test_layout_cras_audio_shm_header() {
             stringify!(read_offset)
         )
     );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_header>())).pad_reader as *const _ as usize
+        },
+        164usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(pad_reader)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_header>())).write_buf_idx as *const _ as usize
+        },
+        192usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(write_buf_idx)
+        )
+    );
     assert_eq!(
         unsafe {
             &(*(::std::ptr::null::<cras_audio_shm_header>())).write_offset as *const _ as usize
         },
-        24usize,
+        196usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_shm_header),
@@ -4755,7 +6264,7 @@ fn bindgen_test_layout_cras_audio_shm_header() {
         unsafe {
             &(*(::std::ptr::null::<cras_audio_shm_header>())).write_in_progress as *const _ as usize
         },
-        32usize,
+        228usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_shm_header),
@@ -4765,31 +6274,43 @@ fn bindgen_test_layout_cras_audio_shm_header() {
     );
     assert_eq!(
         unsafe {
-            &(*(::std::ptr::null::<cras_audio_shm_header>())).volume_scaler as *const _ as usize
+            &(*(::std::ptr::null::<cras_audio_shm_header>())).num_overruns as *const _ as usize
         },
-        40usize,
+        260usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_shm_header),
             "::",
-            stringify!(volume_scaler)
+            stringify!(num_overruns)
         )
     );
     assert_eq!(
-        unsafe { &(*(::std::ptr::null::<cras_audio_shm_header>())).mute as *const _ as usize },
-        44usize,
+        unsafe { &(*(::std::ptr::null::<cras_audio_shm_header>())).ts as *const _ as usize },
+        264usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_shm_header),
             "::",
-            stringify!(mute)
+            stringify!(ts)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_header>())).pad_writer as *const _ as usize
+        },
+        280usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(pad_writer)
         )
     );
     assert_eq!(
         unsafe {
             &(*(::std::ptr::null::<cras_audio_shm_header>())).callback_pending as *const _ as usize
         },
-        48usize,
+        320usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_shm_header),
@@ -4797,38 +6318,80 @@ fn bindgen_test_layout_cras_audio_shm_header() {
             stringify!(callback_pending)
         )
     );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_audio_shm_header>())).wake_seq as *const _ as usize },
+        324usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(wake_seq)
+        )
+    );
     assert_eq!(
         unsafe {
-            &(*(::std::ptr::null::<cras_audio_shm_header>())).num_overruns as *const _ as usize
+            &(*(::std::ptr::null::<cras_audio_shm_header>())).wake_frames as *const _ as usize
         },
-        52usize,
+        328usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_shm_header),
             "::",
-            stringify!(num_overruns)
+            stringify!(wake_frames)
         )
     );
     assert_eq!(
-        unsafe { &(*(::std::ptr::null::<cras_audio_shm_header>())).ts as *const _ as usize },
-        56usize,
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_header>())).vad_active as *const _ as usize
+        },
+        332usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_shm_header),
             "::",
-            stringify!(ts)
+            stringify!(vad_active)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_audio_shm_header>())).vad_seq as *const _ as usize },
+        336usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(vad_seq)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_audio_shm_header>())).pad_wake as *const _ as usize },
+        340usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(pad_wake)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_audio_shm_header>())).telemetry as *const _ as usize },
+        384usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(telemetry)
         )
     );
     assert_eq!(
         unsafe {
-            &(*(::std::ptr::null::<cras_audio_shm_header>())).buffer_offset as *const _ as usize
+            &(*(::std::ptr::null::<cras_audio_shm_header>())).pad_telemetry as *const _ as usize
         },
-        72usize,
+        456usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_shm_header),
             "::",
-            stringify!(buffer_offset)
+            stringify!(pad_telemetry)
         )
     );
 }
@@ -4895,7 +6458,7 @@ pub struct cras_audio_shm {
 fn bindgen_test_layout_cras_audio_shm() {
     assert_eq!(
         ::std::mem::size_of::<cras_audio_shm>(),
-        568usize,
+        576usize,
         concat!("Size of: ", stringify!(cras_audio_shm))
     );
     assert_eq!(
@@ -4915,7 +6478,7 @@ fn bindgen_test_layout_cras_audio_shm() {
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<cras_audio_shm>())).header_info as *const _ as usize },
-        8usize,
+        16usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_shm),
@@ -4925,7 +6488,7 @@ fn bindgen_test_layout_cras_audio_shm() {
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<cras_audio_shm>())).header as *const _ as usize },
-        280usize,
+        288usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_shm),
@@ -4935,7 +6498,7 @@ fn bindgen_test_layout_cras_audio_shm() {
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<cras_audio_shm>())).samples_info as *const _ as usize },
-        288usize,
+        296usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_shm),
@@ -4945,7 +6508,7 @@ fn bindgen_test_layout_cras_audio_shm() {
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<cras_audio_shm>())).samples as *const _ as usize },
-        560usize,
+        568usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_shm),
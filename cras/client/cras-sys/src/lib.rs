@@ -18,10 +18,11 @@ use std::time::Duration;
 #[allow(non_snake_case)]
 pub mod gen;
 use gen::{
-    _snd_pcm_format, audio_dev_debug_info, audio_message, audio_stream_debug_info,
-    cras_audio_format_packed, cras_iodev_info, cras_ionode_info, cras_ionode_info__bindgen_ty_1,
-    cras_timespec, snd_pcm_format_t, CRAS_AUDIO_MESSAGE_ID, CRAS_CHANNEL, CRAS_CLIENT_TYPE,
-    CRAS_NODE_TYPE, CRAS_STREAM_DIRECTION, CRAS_STREAM_EFFECT, CRAS_STREAM_TYPE,
+    _snd_pcm_format, audio_dev_debug_info, audio_message, audio_stage_debug_info,
+    audio_stream_debug_info, cras_audio_format_packed, cras_iodev_info, cras_ionode_info,
+    cras_ionode_info__bindgen_ty_1, cras_timespec, snd_pcm_format_t, CRAS_AUDIO_MESSAGE_ID,
+    CRAS_CHANNEL, CRAS_CLIENT_TYPE, CRAS_NODE_TYPE, CRAS_STREAM_DIRECTION, CRAS_STREAM_EFFECT,
+    CRAS_STREAM_TYPE,
 };
 
 use audio_streams::{SampleFormat, StreamDirection, StreamEffect};
@@ -180,6 +181,9 @@ impl Default for cras_iodev_info {
             name: [0; 64usize],
             stable_id: 0,
             max_supported_channels: 0,
+            preferred_rate: 0,
+            preferred_num_channels: 0,
+            preferred_format: 0,
         }
     }
 }
@@ -323,6 +327,19 @@ impl Default for audio_dev_debug_info {
             longest_wake_sec: 0,
             longest_wake_nsec: 0,
             software_gain_scaler: 0.0,
+            stages: [audio_stage_debug_info::default(); 6],
+            mem_bytes: 0,
+        }
+    }
+}
+
+impl Default for audio_stage_debug_info {
+    fn default() -> Self {
+        Self {
+            count: 0,
+            max_usec: 0,
+            total_usec: 0,
+            hist: [0; 8],
         }
     }
 }
@@ -450,6 +467,10 @@ impl Default for audio_stream_debug_info {
             runtime_nsec: 0,
             stream_volume: 0.0,
             channel_layout: [0; 11],
+            convert_ns: 0,
+            mix_ns: 0,
+            apm_ns: 0,
+            mem_bytes: 0,
         }
     }
 }
@@ -8,13 +8,15 @@ use std::os::unix::io::{AsRawFd, RawFd};
 use std::ptr;
 use std::ptr::NonNull;
 use std::slice;
-use std::sync::atomic::{self, Ordering};
+use std::sync::atomic::{self, AtomicU32, Ordering};
 use std::thread;
+use std::time::Duration;
 
 use cras_sys::gen::{
     audio_dev_debug_info, audio_stream_debug_info, cras_audio_shm_header, cras_iodev_info,
     cras_ionode_info, cras_server_state, CRAS_MAX_IODEVS, CRAS_MAX_IONODES, CRAS_NUM_SHM_BUFFERS,
-    CRAS_SERVER_STATE_VERSION, CRAS_SHM_BUFFERS_MASK, MAX_DEBUG_DEVS, MAX_DEBUG_STREAMS,
+    CRAS_SERVER_STATE_VERSION, CRAS_SHM_BUFFERS_MASK, CRAS_SHM_LAYOUT_VERSION, MAX_DEBUG_DEVS,
+    MAX_DEBUG_STREAMS,
 };
 use cras_sys::{
     AudioDebugInfo, AudioDevDebugInfo, AudioStreamDebugInfo, CrasIodevInfo, CrasIonodeInfo,
@@ -63,6 +65,11 @@ pub struct CrasAudioHeader<'a> {
     read_offset: [VolatileRef<'a, u32>; CRAS_NUM_SHM_BUFFERS as usize],
     write_offset: [VolatileRef<'a, u32>; CRAS_NUM_SHM_BUFFERS as usize],
     buffer_offset: [VolatileRef<'a, u64>; CRAS_NUM_SHM_BUFFERS as usize],
+    callback_pending: VolatileRef<'a, i32>,
+    wake_enabled: VolatileRef<'a, u32>,
+    /// Futex word bumped by the server, read atomically so it can be waited on.
+    wake_seq: &'a AtomicU32,
+    wake_frames: VolatileRef<'a, u32>,
 }
 
 // It is safe to send audio buffers between threads as this struct has exclusive ownership of the
@@ -110,6 +117,24 @@ impl<'a> CrasAudioHeader<'a> {
         let mut addr = NonNull::new(mmap_addr as *mut cras_audio_shm_header)
             .ok_or_else(|| io::Error::new(io::ErrorKind::Other, "Failed to create header."))?;
 
+        // The field offsets below are only valid for the layout this client
+        // was built against.
+        // Safe because we know that addr is a non-null pointer to cras_audio_shm_header.
+        let layout_version = unsafe { vref_from_addr!(addr, config.layout_version) }.load();
+        if layout_version != CRAS_SHM_LAYOUT_VERSION {
+            // Safe because no reference into the mapped area outlives this block.
+            unsafe {
+                libc::munmap(mmap_addr, header_fd.fd.size);
+            }
+            return Err(io::Error::new(
+                io::ErrorKind::Other,
+                format!(
+                    "CrasAudioHeader layout version {} does not match expected version {}",
+                    layout_version, CRAS_SHM_LAYOUT_VERSION
+                ),
+            ));
+        }
+
         // Safe because we know that mmap_addr (contained in addr) contains a
         // cras_audio_shm_header, and the mapped area will be exclusively
         // owned by this struct.
@@ -133,6 +158,12 @@ impl<'a> CrasAudioHeader<'a> {
                     vref_from_addr!(addr, buffer_offset[0]),
                     vref_from_addr!(addr, buffer_offset[1]),
                 ],
+                callback_pending: vref_from_addr!(addr, callback_pending),
+                wake_enabled: vref_from_addr!(addr, wake_enabled),
+                // `wake_seq` is 4 bytes aligned within the page aligned header
+                // and `AtomicU32` has the same layout as `u32`.
+                wake_seq: &*(&mut addr.as_mut().wake_seq as *mut u32 as *const AtomicU32),
+                wake_frames: vref_from_addr!(addr, wake_frames),
             })
         }
     }
@@ -471,6 +502,79 @@ impl<'a> CrasAudioHeader<'a> {
         }
         Ok(())
     }
+
+    /// Returns true if the server signals requests through the wake word in the
+    /// header instead of audio messages. The server enables it for streams
+    /// connected with the `SHM_WAKE` flag.
+    pub fn wake_enabled(&self) -> bool {
+        self.wake_enabled.load() != 0
+    }
+
+    /// Waits for the server to bump the wake word past `seq`. Wakes that came
+    /// in since `seq` are coalesced into the latest one, since the server only
+    /// has one request outstanding at a time.
+    ///
+    /// # Arguments
+    ///
+    /// * `seq` - The last wake word value handled, updated on return.
+    /// * `timeout` - Longest time to wait, `None` to wait forever.
+    ///
+    /// # Returns
+    ///
+    /// * `Some(frames)` - Frames requested or handed over by the latest wake.
+    /// * `None` - The wait timed out.
+    ///
+    /// # Errors
+    ///
+    /// Returns error if the futex wait fails.
+    pub fn wait_wake(&self, seq: &mut u32, timeout: Option<Duration>) -> io::Result<Option<u32>> {
+        let ts = timeout.map(|t| libc::timespec {
+            tv_sec: t.as_secs() as libc::time_t,
+            tv_nsec: t.subsec_nanos() as libc::c_long,
+        });
+        let ts_ptr = ts
+            .as_ref()
+            .map_or(ptr::null(), |t| t as *const libc::timespec);
+
+        loop {
+            let curr = self.wake_seq.load(Ordering::Acquire);
+            if curr != *seq {
+                *seq = curr;
+                return Ok(Some(self.wake_frames.load()));
+            }
+
+            // Safe because `wake_seq` points into the header mapping owned by
+            // this struct and `ts_ptr` is either null or points to `ts`.
+            let ret = unsafe {
+                libc::syscall(
+                    libc::SYS_futex,
+                    self.wake_seq as *const AtomicU32,
+                    libc::FUTEX_WAIT,
+                    curr,
+                    ts_ptr,
+                    ptr::null::<u32>(),
+                    0,
+                )
+            };
+            if ret < 0 {
+                let err = io::Error::last_os_error();
+                match err.raw_os_error() {
+                    Some(libc::ETIMEDOUT) => return Ok(None),
+                    // The word already moved on, or a signal came in.
+                    Some(libc::EAGAIN) | Some(libc::EINTR) => {}
+                    _ => return Err(err),
+                }
+            }
+        }
+    }
+
+    /// Tells the server that the samples of the current request are written
+    /// or read. Replaces the audio message reply when the wake word is enabled.
+    pub fn complete_callback(&mut self) {
+        // Samples and offsets must be visible before the server sees the reply.
+        atomic::fence(Ordering::Release);
+        self.callback_pending.store(0);
+    }
 }
 
 impl<'a> Drop for CrasAudioHeader<'a> {
@@ -916,6 +1020,7 @@ impl CrasServerStateShmFd {
 mod tests {
     use super::*;
     use std::fs::File;
+    use std::os::unix::fs::FileExt;
     use std::os::unix::io::IntoRawFd;
     use std::sync::{Arc, Mutex};
     use std::thread;
@@ -1157,6 +1262,38 @@ mod tests {
         assert!(header.set_buffer_offset(0, 33).is_err());
     }
 
+    #[test]
+    fn cras_audio_header_wait_wake() {
+        let header = create_cras_audio_header(20);
+        let mut seq = 0;
+        assert_eq!(
+            header
+                .wait_wake(&mut seq, Some(Duration::from_millis(1)))
+                .unwrap(),
+            None
+        );
+
+        // Two wakes since the last one handled come back as one.
+        header.wake_frames.store(480);
+        header.wake_seq.fetch_add(2, Ordering::Release);
+        assert_eq!(header.wait_wake(&mut seq, None).unwrap(), Some(480));
+        assert_eq!(seq, 2);
+    }
+
+    #[test]
+    fn cras_audio_header_complete_callback() {
+        let mut header = create_cras_audio_header(20);
+        header.callback_pending.store(1);
+        header.complete_callback();
+        assert_eq!(header.callback_pending.load(), 0);
+    }
+
+    #[test]
+    fn cras_audio_header_rejects_unknown_layout() {
+        let header_fd = cras_audio_header_fd_with_version(CRAS_SHM_LAYOUT_VERSION + 1);
+        assert!(CrasAudioHeader::new(header_fd, 20).is_err());
+    }
+
     #[test]
     fn create_header_and_buffers_test() {
         if !kernel_has_memfd() {
@@ -1179,8 +1316,19 @@ mod tests {
     }
 
     fn cras_audio_header_fd() -> CrasAudioShmHeaderFd {
+        cras_audio_header_fd_with_version(CRAS_SHM_LAYOUT_VERSION)
+    }
+
+    fn cras_audio_header_fd_with_version(layout_version: u32) -> CrasAudioShmHeaderFd {
         let size = mem::size_of::<cras_audio_shm_header>();
         let shm = create_shm(size);
+        // Safe because cras_audio_shm_header is plain data, valid when zeroed.
+        let mut header: cras_audio_shm_header = unsafe { mem::zeroed() };
+        header.config.layout_version = layout_version;
+        // Safe because the slice covers exactly the header built above.
+        let bytes = unsafe { slice::from_raw_parts(&header as *const _ as *const u8, size) };
+        shm.write_all_at(bytes, 0)
+            .expect("failed to write the shm header");
         unsafe { CrasAudioShmHeaderFd::new(shm.into_raw_fd()) }
     }
 
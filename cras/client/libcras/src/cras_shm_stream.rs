@@ -49,6 +49,11 @@ pub struct CrasShmStream<'a> {
     frame_rate: u32,
     // The index of the next buffer within SHM to set the buffer offset for.
     next_buffer_idx: usize,
+    // Requests and replies go through the wake word in the header rather than
+    // `audio_socket`, set when the server enabled it.
+    shm_wake: bool,
+    // The last value of the wake word handled.
+    wake_seq: u32,
 }
 
 impl<'a> CrasShmStream<'a> {
@@ -85,6 +90,7 @@ impl<'a> CrasShmStream<'a> {
         samples_len: usize,
     ) -> Result<Self, BoxError> {
         let header = cras_shm::create_header(header_fd, samples_len)?;
+        let shm_wake = header.wake_enabled();
         Ok(Self {
             stream_id,
             server_socket,
@@ -97,6 +103,8 @@ impl<'a> CrasShmStream<'a> {
             // We have either sent zero or two offsets to the server, so we will
             // need to update index 0 next.
             next_buffer_idx: 0,
+            shm_wake,
+            wake_seq: 0,
         })
     }
 }
@@ -127,6 +135,13 @@ impl<'a> ShmStream for CrasShmStream<'a> {
         &mut self,
         timeout: Duration,
     ) -> Result<Option<ServerRequest>, BoxError> {
+        if self.shm_wake {
+            return match self.header.wait_wake(&mut self.wake_seq, Some(timeout))? {
+                Some(frames) => Ok(Some(ServerRequest::new(frames as usize, self))),
+                None => Ok(None),
+            };
+        }
+
         let expected_id = match self.direction {
             StreamDirection::Playback => CRAS_AUDIO_MESSAGE_ID::AUDIO_MESSAGE_REQUEST_DATA,
             StreamDirection::Capture => CRAS_AUDIO_MESSAGE_ID::AUDIO_MESSAGE_DATA_READY,
@@ -157,7 +172,11 @@ impl BufferSet for CrasShmStream<'_> {
                 self.header.commit_written_frames(frames)?;
 
                 // Notify CRAS that we've made playback data available.
-                self.audio_socket.data_ready(frames)?
+                if self.shm_wake {
+                    self.header.complete_callback();
+                } else {
+                    self.audio_socket.data_ready(frames)?
+                }
             }
             StreamDirection::Capture => {
                 let used_size = self.header.get_used_size();
@@ -169,7 +188,11 @@ impl BufferSet for CrasShmStream<'_> {
                 }
 
                 self.header.commit_read_frames(frames)?;
-                self.audio_socket.capture_ready(frames)?;
+                if self.shm_wake {
+                    self.header.complete_callback();
+                } else {
+                    self.audio_socket.capture_ready(frames)?;
+                }
             }
         }
 
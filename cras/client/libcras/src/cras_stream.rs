@@ -4,9 +4,13 @@
 use std::cmp::min;
 use std::io;
 use std::marker::PhantomData;
+use std::os::unix::io::AsRawFd;
 use std::{error, fmt};
 
 use audio_streams::{
+    async_api::{
+        AsyncCaptureBufferStream, AsyncPlaybackBufferStream, AudioStreamsExecutor, BoxFuture,
+    },
     capture::{CaptureBuffer, CaptureBufferStream},
     BoxError, BufferDrop, PlaybackBuffer, PlaybackBufferStream,
 };
@@ -182,6 +186,36 @@ impl<'a, T: CrasStreamData<'a> + BufferDrop> CrasStream<'a, T> {
             _ => Err(Error::MessageTypeError),
         }
     }
+
+    // Waits until the audio socket is readable without blocking the executor thread, so the
+    // blocking read of the next audio message returns at once.
+    async fn wait_audio_sock_readable(
+        &mut self,
+        ex: &dyn AudioStreamsExecutor,
+    ) -> Result<(), BoxError> {
+        let fd = self.controls.audio_sock_mut().as_raw_fd();
+        ex.wait_fd_readable(fd).await
+    }
+
+    fn playback_buffer(&mut self) -> Result<PlaybackBuffer, BoxError> {
+        let header = self.controls.header_mut();
+        let frame_size = header.get_frame_size();
+        let (offset, len) = header.get_write_offset_and_len()?;
+        let buf = &mut self.audio_buffer.get_buffer()[offset..offset + len];
+
+        PlaybackBuffer::new(frame_size, buf, &mut self.controls).map_err(Box::from)
+    }
+
+    fn capture_buffer(&mut self, frames: u32) -> Result<CaptureBuffer, BoxError> {
+        let header = self.controls.header_mut();
+        let frame_size = header.get_frame_size();
+        let shm_frames = header.get_readable_frames()?;
+        let len = min(shm_frames, frames as usize) * frame_size;
+        let offset = header.get_read_buffer_offset()?;
+        let buf = &mut self.audio_buffer.get_buffer()[offset..offset + len];
+
+        CaptureBuffer::new(frame_size, buf, &mut self.controls).map_err(Box::from)
+    }
 }
 
 impl<'a, T: CrasStreamData<'a> + BufferDrop> Drop for CrasStream<'a, T> {
@@ -199,12 +233,20 @@ impl<'a, T: CrasStreamData<'a> + BufferDrop> PlaybackBufferStream for CrasStream
     fn next_playback_buffer(&mut self) -> Result<PlaybackBuffer, BoxError> {
         // Wait for request audio message
         self.wait_request_data()?;
-        let header = self.controls.header_mut();
-        let frame_size = header.get_frame_size();
-        let (offset, len) = header.get_write_offset_and_len()?;
-        let buf = &mut self.audio_buffer.get_buffer()[offset..offset + len];
+        self.playback_buffer()
+    }
+}
 
-        PlaybackBuffer::new(frame_size, buf, &mut self.controls).map_err(Box::from)
+impl<'a, T: CrasStreamData<'a> + BufferDrop> AsyncPlaybackBufferStream for CrasStream<'a, T> {
+    fn next_playback_buffer<'b>(
+        &'b mut self,
+        ex: &'b dyn AudioStreamsExecutor,
+    ) -> BoxFuture<'b, Result<PlaybackBuffer<'b>, BoxError>> {
+        Box::pin(async move {
+            self.wait_audio_sock_readable(ex).await?;
+            self.wait_request_data()?;
+            self.playback_buffer()
+        })
     }
 }
 
@@ -212,13 +254,19 @@ impl<'a, T: CrasStreamData<'a> + BufferDrop> CaptureBufferStream for CrasStream<
     fn next_capture_buffer(&mut self) -> Result<CaptureBuffer, BoxError> {
         // Wait for data ready message
         let frames = self.wait_data_ready()?;
-        let header = self.controls.header_mut();
-        let frame_size = header.get_frame_size();
-        let shm_frames = header.get_readable_frames()?;
-        let len = min(shm_frames, frames as usize) * frame_size;
-        let offset = header.get_read_buffer_offset()?;
-        let buf = &mut self.audio_buffer.get_buffer()[offset..offset + len];
+        self.capture_buffer(frames)
+    }
+}
 
-        CaptureBuffer::new(frame_size, buf, &mut self.controls).map_err(Box::from)
+impl<'a, T: CrasStreamData<'a> + BufferDrop> AsyncCaptureBufferStream for CrasStream<'a, T> {
+    fn next_capture_buffer<'b>(
+        &'b mut self,
+        ex: &'b dyn AudioStreamsExecutor,
+    ) -> BoxFuture<'b, Result<CaptureBuffer<'b>, BoxError>> {
+        Box::pin(async move {
+            self.wait_audio_sock_readable(ex).await?;
+            let frames = self.wait_data_ready()?;
+            self.capture_buffer(frames)
+        })
     }
 }
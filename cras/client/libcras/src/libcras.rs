@@ -126,6 +126,7 @@ use std::{error, fmt};
 
 pub use audio_streams::BoxError;
 use audio_streams::{
+    async_api::{AsyncCaptureBufferStream, AsyncPlaybackBufferStream},
     capture::{CaptureBufferStream, NoopCaptureStream},
     shm_streams::{NullShmStream, ShmStream, ShmStreamSource},
     BufferDrop, NoopStreamControl, PlaybackBufferStream, SampleFormat, StreamControl,
@@ -424,6 +425,12 @@ impl<'a> CrasClient<'a> {
             client_type: self.client_type,
             client_shm_size: 0,
             buffer_offsets: [0, 0],
+            num_shm_buffers: 0,
+            scheduled_ts: cras_timespec {
+                tv_sec: 0,
+                tv_nsec: 0,
+            },
+            pre_roll_frames: 0,
         };
 
         // Creates AudioSocket pair
@@ -607,6 +614,62 @@ impl<'a> StreamSource for CrasClient<'a> {
         }
     }
 
+    #[allow(clippy::type_complexity)]
+    fn new_async_playback_stream(
+        &mut self,
+        num_channels: usize,
+        format: SampleFormat,
+        frame_rate: u32,
+        buffer_size: usize,
+    ) -> std::result::Result<(Box<dyn StreamControl>, Box<dyn AsyncPlaybackBufferStream>), BoxError>
+    {
+        Ok((
+            Box::new(NoopStreamControl::new()),
+            Box::new(self.create_stream::<CrasPlaybackData>(
+                None,
+                buffer_size as u32,
+                CRAS_STREAM_DIRECTION::CRAS_STREAM_OUTPUT,
+                frame_rate,
+                num_channels,
+                format,
+            )?),
+        ))
+    }
+
+    #[allow(clippy::type_complexity)]
+    fn new_async_capture_stream(
+        &mut self,
+        num_channels: usize,
+        format: SampleFormat,
+        frame_rate: u32,
+        buffer_size: usize,
+    ) -> std::result::Result<(Box<dyn StreamControl>, Box<dyn AsyncCaptureBufferStream>), BoxError>
+    {
+        if self.cras_capture {
+            Ok((
+                Box::new(NoopStreamControl::new()),
+                Box::new(self.create_stream::<CrasCaptureData>(
+                    None,
+                    buffer_size as u32,
+                    CRAS_STREAM_DIRECTION::CRAS_STREAM_INPUT,
+                    frame_rate,
+                    num_channels,
+                    format,
+                )?),
+            ))
+        } else {
+            Ok((
+                Box::new(NoopStreamControl::new()),
+                Box::new(NoopCaptureStream::new(
+                    num_channels,
+                    format,
+                    frame_rate,
+                    buffer_size,
+                )),
+            ))
+        }
+    }
+
     fn keep_fds(&self) -> Option<Vec<RawFd>> {
         Some(CrasClient::keep_fds(self))
     }
@@ -656,13 +719,21 @@ impl<'a> ShmStreamSource for CrasClient<'a> {
             stream_type: CRAS_STREAM_TYPE::CRAS_STREAM_TYPE_DEFAULT,
             buffer_frames: buffer_size,
             cb_threshold: buffer_size,
-            flags: 0,
+            // Requests are signaled through the shm header rather than one
+            // audio message per period, if the server supports it.
+            flags: CRAS_INPUT_STREAM_FLAG::SHM_WAKE as u32,
             format: audio_format,
             dev_idx: CRAS_SPECIAL_DEVICE::NO_DEVICE as u32,
             effects: effects.iter().collect::<CrasStreamEffect>().into(),
             client_type: self.client_type,
             client_shm_size: client_shm.size(),
             buffer_offsets,
+            num_shm_buffers: 0,
+            scheduled_ts: cras_timespec {
+                tv_sec: 0,
+                tv_nsec: 0,
+            },
+            pre_roll_frames: 0,
         };
 
         // Creates AudioSocket pair
@@ -85,12 +85,14 @@ static int snd_pcm_cras_close(snd_pcm_ioplug_t *io)
 static int snd_pcm_cras_poll_revents(snd_pcm_ioplug_t *io, struct pollfd *pfds,
 				     unsigned int nfds, unsigned short *revents)
 {
-	static char buf[1];
+	static char buf[64];
 	int rc;
 
 	if (pfds == NULL || nfds != 1 || revents == NULL)
 		return -EINVAL;
-	rc = read(pfds[0].fd, buf, 1);
+	/* Drain all pending wake ups, ALSA checks the available frames after
+	 * each poll so one wake up is enough for several periods. */
+	rc = read(pfds[0].fd, buf, sizeof(buf));
 	if (rc < 0 && errno != EWOULDBLOCK && errno != EAGAIN) {
 		fprintf(stderr, "%s read failed %d\n", __func__, errno);
 		return errno;
@@ -110,6 +112,25 @@ static snd_pcm_sframes_t snd_pcm_cras_pointer(snd_pcm_ioplug_t *io)
 	return pcm_cras->hw_ptr;
 }
 
+/* Checks if the ALSA areas hold whole interleaved frames in a single
+ * buffer, so they can be copied to or from CRAS as is. */
+static int areas_interleaved(const snd_pcm_ioplug_t *io,
+			     const snd_pcm_channel_area_t *areas)
+{
+	unsigned int width = snd_pcm_format_physical_width(io->format);
+	size_t chan;
+
+	if (areas[0].first % 8)
+		return 0;
+	for (chan = 0; chan < io->channels; chan++) {
+		if (areas[chan].addr != areas[0].addr ||
+		    areas[chan].first != areas[0].first + chan * width ||
+		    areas[chan].step != width * io->channels)
+			return 0;
+	}
+	return 1;
+}
+
 /* Main callback for processing audio.  This is called by CRAS when more samples
  * are needed (playback) or ready (capture).  Copies bytes between ALSA and CRAS
  * buffers. */
@@ -127,7 +148,9 @@ static int pcm_cras_process_cb(struct cras_client *client,
 	char empty_byte;
 	size_t chan, frame_bytes, sample_bytes;
 	int rc;
+	int interleaved;
 	uint8_t *samples;
+	uint8_t *alsa_samples;
 	const struct timespec *sample_time;
 
 	samples = capture_samples ?: playback_samples;
@@ -159,17 +182,23 @@ static int pcm_cras_process_cb(struct cras_client *client,
 		pcm_cras->capture_sample_time = *sample_time;
 	}
 
-	/* CRAS always takes interleaved samples. */
-	for (chan = 0; chan < io->channels; chan++) {
-		pcm_cras->areas[chan].addr = samples + chan * sample_bytes;
-		pcm_cras->areas[chan].first = 0;
-		pcm_cras->areas[chan].step =
-			snd_pcm_format_physical_width(io->format) *
-			io->channels;
-	}
-
 	areas = snd_pcm_ioplug_mmap_areas(io);
 
+	/* CRAS always takes interleaved samples. When the ALSA buffer is
+	 * interleaved too, whole frames are copied at once. */
+	interleaved = areas_interleaved(io, areas);
+	alsa_samples = (uint8_t *)areas[0].addr + areas[0].first / 8;
+	if (!interleaved) {
+		for (chan = 0; chan < io->channels; chan++) {
+			pcm_cras->areas[chan].addr =
+				samples + chan * sample_bytes;
+			pcm_cras->areas[chan].first = 0;
+			pcm_cras->areas[chan].step =
+				snd_pcm_format_physical_width(io->format) *
+				io->channels;
+		}
+	}
+
 	copied_frames = 0;
 	while (copied_frames < nframes) {
 		snd_pcm_uframes_t frames = nframes - copied_frames;
@@ -178,18 +207,32 @@ static int pcm_cras_process_cb(struct cras_client *client,
 		if (frames > remain)
 			frames = remain;
 
-		for (chan = 0; chan < io->channels; chan++)
+		if (interleaved) {
+			uint8_t *cras_ptr =
+				samples + copied_frames * frame_bytes;
+			uint8_t *alsa_ptr =
+				alsa_samples + pcm_cras->hw_ptr * frame_bytes;
+			size_t bytes = frames * frame_bytes;
+
 			if (io->stream == SND_PCM_STREAM_PLAYBACK)
-				snd_pcm_area_copy(&pcm_cras->areas[chan],
-						  copied_frames, &areas[chan],
-						  pcm_cras->hw_ptr, frames,
-						  io->format);
+				memcpy(cras_ptr, alsa_ptr, bytes);
 			else
-				snd_pcm_area_copy(&areas[chan],
-						  pcm_cras->hw_ptr,
-						  &pcm_cras->areas[chan],
-						  copied_frames, frames,
-						  io->format);
+				memcpy(alsa_ptr, cras_ptr, bytes);
+		} else {
+			for (chan = 0; chan < io->channels; chan++)
+				if (io->stream == SND_PCM_STREAM_PLAYBACK)
+					snd_pcm_area_copy(
+						&pcm_cras->areas[chan],
+						copied_frames, &areas[chan],
+						pcm_cras->hw_ptr, frames,
+						io->format);
+				else
+					snd_pcm_area_copy(
+						&areas[chan], pcm_cras->hw_ptr,
+						&pcm_cras->areas[chan],
+						copied_frames, frames,
+						io->format);
+		}
 
 		pcm_cras->hw_ptr += frames;
 		pcm_cras->hw_ptr %= io->buffer_size;
@@ -0,0 +1,47 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <benchmark/benchmark.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "benchmark_util.h"
+
+extern "C" {
+#include "dsp_util.h"
+}
+
+// Runs the CRAS benchmarks. Results go to stdout as JSON unless
+// --benchmark_format is given, so runs can be collected per board. The JSON
+// context lists the instruction sets that were benchmarked.
+int main(int argc, char** argv) {
+  std::vector<char*> args(argv, argv + argc);
+  char json_format[] = "--benchmark_format=json";
+  std::string isas;
+  bool has_format = false;
+
+  for (int i = 1; i < argc; i++)
+    if (strncmp(argv[i], "--benchmark_format", 18) == 0)
+      has_format = true;
+  if (!has_format)
+    args.push_back(json_format);
+  argc = args.size();
+  args.push_back(nullptr);
+
+  for (const bench::Isa& isa : bench::SupportedIsas())
+    isas += (isas.empty() ? "" : ",") + isa.name;
+  benchmark::AddCustomContext("cras_isas", isas);
+
+  // Matches the audio thread, which runs the DSP with denormals flushed.
+  dsp_enable_flush_denormal_to_zero();
+
+  benchmark::Initialize(&argc, args.data());
+  if (benchmark::ReportUnrecognizedArguments(argc, args.data()))
+    return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
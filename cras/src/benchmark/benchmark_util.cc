@@ -0,0 +1,97 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "benchmark_util.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+extern "C" {
+#include "cras_mix.h"
+}
+
+namespace bench {
+
+const std::vector<int64_t>& FrameCounts() {
+  static const std::vector<int64_t> counts = {256, 512, 1024, 2048, 4096};
+  return counts;
+}
+
+const std::vector<Isa>& SupportedIsas() {
+  static const std::vector<Isa> isas = [] {
+    std::vector<Isa> v = {{"c", 0}};
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+#if defined HAVE_SSE42
+    if (__builtin_cpu_supports("sse4.2"))
+      v.push_back({"sse42", CPU_X86_SSE4_2});
+#endif
+#if defined HAVE_AVX
+    if (__builtin_cpu_supports("avx"))
+      v.push_back({"avx", CPU_X86_AVX});
+#endif
+#if defined HAVE_AVX2
+    if (__builtin_cpu_supports("avx2"))
+      v.push_back({"avx2", CPU_X86_AVX2});
+#endif
+#if defined HAVE_FMA
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+      v.push_back({"fma", CPU_X86_FMA});
+#endif
+#endif
+    return v;
+  }();
+  return isas;
+}
+
+std::vector<uint8_t> RandomBytes(size_t size) {
+  std::mt19937 gen(0x5eed);
+  std::uniform_int_distribution<int> dist(0, 0xff);
+  std::vector<uint8_t> v(size);
+  for (auto& b : v)
+    b = dist(gen);
+  return v;
+}
+
+std::vector<float> RandomFloats(size_t count) {
+  std::mt19937 gen(0x5eed);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+  std::vector<float> v(count);
+  for (auto& f : v)
+    f = dist(gen);
+  return v;
+}
+
+std::vector<uint8_t> RandomSamples(snd_pcm_format_t fmt, size_t size) {
+  std::vector<uint8_t> v = RandomBytes(size);
+  if (fmt == SND_PCM_FORMAT_FLOAT_LE) {
+    std::vector<float> f = RandomFloats(size / sizeof(float));
+    memcpy(v.data(), f.data(), f.size() * sizeof(float));
+  }
+  return v;
+}
+
+double Histogram::Sum() const {
+  return std::accumulate(samples_.begin(), samples_.end(), 0.0);
+}
+
+double Histogram::Percentile(double p) {
+  if (samples_.empty())
+    return 0;
+  size_t n = std::min<size_t>(p * samples_.size(), samples_.size() - 1);
+  std::nth_element(samples_.begin(), samples_.begin() + n, samples_.end());
+  return samples_[n];
+}
+
+void Histogram::Report(benchmark::State& state, const std::string& name) {
+  state.counters[name + "_p50_us"] = Percentile(0.5);
+  state.counters[name + "_p99_us"] = Percentile(0.99);
+  state.counters[name + "_p999_us"] = Percentile(0.999);
+  state.counters[name + "_max_us"] = Percentile(1.0);
+}
+
+}  // namespace bench
@@ -0,0 +1,70 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRAS_BENCHMARK_BENCHMARK_UTIL_H_
+#define CRAS_BENCHMARK_BENCHMARK_UTIL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <benchmark/benchmark.h>
+
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "cras_types.h"
+}
+
+namespace bench {
+
+// An instruction set the SIMD ops are built for.
+//    name - Suffix of the benchmark names using it, "c" for generic code.
+//    cpu_flags - CPU_X86_* flags selecting it in the *_init() functions.
+struct Isa {
+  std::string name;
+  unsigned int cpu_flags;
+};
+
+// Returns the instruction sets that are both built in and supported by the
+// CPU running the benchmarks, generic C first.
+const std::vector<Isa>& SupportedIsas();
+
+// Returns size bytes of random data. The seed is fixed so runs compare.
+std::vector<uint8_t> RandomBytes(size_t size);
+
+// Returns count random floats in [-1.0, 1.0).
+std::vector<float> RandomFloats(size_t count);
+
+// Returns size bytes of random samples in fmt. Float samples are kept in
+// [-1.0, 1.0) so no kernel runs into denormals or NaNs.
+std::vector<uint8_t> RandomSamples(snd_pcm_format_t fmt, size_t size);
+
+// Frame counts benchmarked by the kernels, spanning typical callback sizes.
+// A function so that benchmarks registered at static init can use it.
+const std::vector<int64_t>& FrameCounts();
+
+// Samples of a latency or duration in microseconds. Every sample is kept,
+// reserve room for them up front when adding from the audio thread.
+class Histogram {
+ public:
+  void Reserve(size_t count) { samples_.reserve(count); }
+  void Add(double us) { samples_.push_back(us); }
+  size_t Count() const { return samples_.size(); }
+  double Sum() const;
+
+  // Returns the sample that the fraction p of the samples don't exceed, 0
+  // if there are none.
+  double Percentile(double p);
+
+  // Adds the <name>_p50_us, _p99_us, _p999_us and _max_us counters.
+  void Report(benchmark::State& state, const std::string& name);
+
+ private:
+  std::vector<double> samples_;
+};
+
+}  // namespace bench
+
+#endif  // CRAS_BENCHMARK_BENCHMARK_UTIL_H_
@@ -0,0 +1,513 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Runs the Bluetooth audio paths with the real codecs against headsets
+// simulated over socketpairs: A2DP SBC encoding and packetization into a
+// socket the headset drains, and HFP wideband capture of the mSBC a headset
+// sends over SCO, through hfp_info and PLC. The link drops and delays packets
+// by a loss and jitter model. Reports the CPU spent per second of audio, the
+// latency and the packet level glitches, so Bluetooth changes can be checked
+// without headsets.
+
+#include <benchmark/benchmark.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark_util.h"
+#include "server_util.h"
+
+extern "C" {
+#include "audio_thread.h"
+#include "cras_a2dp_codec.h"
+#include "cras_a2dp_info.h"
+#include "cras_audio_codec.h"
+#include "cras_hfp_info.h"
+#include "cras_hfp_slc.h"
+#include "cras_sbc_codec.h"
+#include "packet_status_logger.h"
+#include "rtp.h"
+}
+
+namespace {
+
+const std::chrono::seconds kRunTime(3);
+
+// Send buffer of the A2DP socket in packets, close to what L2CAP reports.
+const int kA2dpSockDepthPackets = 4;
+
+// HFP wideband: 16kHz mono, one mSBC frame of 120 frames per 7.5ms carried
+// in 60 bytes of SCO data. The capture stream reads 10ms at a time.
+const size_t kHfpRate = 16000;
+const size_t kMsbcPktSize = 60;
+const size_t kMsbcCodeSize = 240;
+const size_t kMsbcFrameLen = 57;
+const int64_t kMsbcFrameNs = 7500000;
+const size_t kHfpCbFrames = 160;
+const uint8_t kH2Header0 = 0x01;
+const uint8_t kH2FramesCount[] = {0x08, 0x38, 0xc8, 0xf8};
+
+int64_t NowNs() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int64_t ThreadCpuNs() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void SleepUntilNs(int64_t ns) {
+  struct timespec ts = {ns / 1000000000LL, ns % 1000000000LL};
+
+  clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+// How the simulated link treats packets.
+//    name - Suffix of the benchmark names using it.
+//    loss_pct - Percentage of packets lost. A lost A2DP packet is sent again
+//        a packet period later, a lost SCO packet arrives corrupted.
+//    jitter_ms - Packets are held back by up to this long, in order, so they
+//        come in bursts.
+struct LinkModel {
+  const char* name;
+  int loss_pct;
+  int jitter_ms;
+};
+
+const LinkModel kLinkModels[] = {
+    {"clean", 0, 0},
+    {"jitter", 0, 20},
+    {"lossy", 5, 5},
+    {"bad", 10, 40},
+};
+
+// Draws the fate of each packet from a LinkModel. The seed is fixed so runs
+// compare.
+class Link {
+ public:
+  explicit Link(const LinkModel& model) : model_(model), rng_(0x5eed) {}
+
+  bool Lost() { return (int)(rng_() % 100) < model_.loss_pct; }
+
+  int64_t DelayNs() {
+    if (!model_.jitter_ms)
+      return 0;
+    return rng_() % (model_.jitter_ms * 1000000LL);
+  }
+
+ private:
+  LinkModel model_;
+  std::mt19937 rng_;
+};
+
+// Sets up a2dp with the SBC configuration picked against our own
+// capabilities, and the frames of one packet for the given MTU as the A2DP
+// iodev does.
+int InitA2dpSbc(struct a2dp_info* a2dp,
+                size_t mtu,
+                size_t* rate,
+                size_t* frame_bytes,
+                unsigned int* write_block) {
+  const struct cras_a2dp_codec* sbc = cras_a2dp_codec_get(A2DP_CODEC_SBC);
+  uint8_t caps[A2DP_MAX_CONFIG_LEN], config[A2DP_MAX_CONFIG_LEN];
+  int caps_len = sizeof(caps);
+  int config_len, rc;
+  size_t channels;
+
+  if (!sbc || sbc->get_capabilities(caps, &caps_len))
+    return -EINVAL;
+  config_len = sbc->select_configuration(caps, caps_len, config);
+  if (config_len < 0)
+    return config_len;
+  rc = init_a2dp(a2dp, A2DP_CODEC_SBC, config, config_len);
+  if (rc)
+    return rc;
+  a2dp_get_format(a2dp, rate, &channels);
+  *frame_bytes = channels * 2;
+  *write_block = a2dp_block_size(a2dp, mtu - sizeof(struct rtp_header) -
+                                           sizeof(struct rtp_payload)) /
+                 *frame_bytes;
+  a2dp_set_frames_per_packet(a2dp,
+                             *write_block * *frame_bytes / a2dp_codesize(a2dp));
+  return 0;
+}
+
+// Encodes PCM from pcm, starting at *pos and wrapping around, until a packet
+// is complete.
+int EncodePacket(struct a2dp_info* a2dp,
+                 const std::vector<uint8_t>& pcm,
+                 size_t* pos,
+                 size_t frame_bytes,
+                 size_t mtu) {
+  int processed;
+
+  for (;;) {
+    processed = a2dp_encode(a2dp, pcm.data() + *pos, pcm.size() - *pos,
+                            frame_bytes, mtu);
+    if (processed == -ENOSPC || processed == 0)
+      return 0;
+    if (processed < 0)
+      return processed;
+    *pos = (*pos + processed) % pcm.size();
+  }
+}
+
+// Encodes and writes packets back to back, for the CPU cost of SBC and the
+// packetization. state.range(0) is the MTU.
+void BM_A2dpEncode(benchmark::State& state) {
+  const size_t mtu = state.range(0);
+  struct a2dp_info a2dp = {};
+  std::vector<uint8_t> packet(mtu);
+  size_t rate, frame_bytes, pos = 0;
+  unsigned int write_block, packets;
+  int64_t frames = 0, bytes = 0, cpu;
+  int sock[2], rc;
+
+  if (InitA2dpSbc(&a2dp, mtu, &rate, &frame_bytes, &write_block))
+    return state.SkipWithError("Failed to set up SBC");
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock)) {
+    destroy_a2dp(&a2dp);
+    return state.SkipWithError("Failed to create socketpair");
+  }
+  std::vector<uint8_t> pcm = bench::RandomSamples(
+      SND_PCM_FORMAT_S16_LE, 16 * write_block * frame_bytes);
+
+  cpu = ThreadCpuNs();
+  for (auto _ : state) {
+    if (EncodePacket(&a2dp, pcm, &pos, frame_bytes, mtu) < 0) {
+      state.SkipWithError("Failed to encode");
+      break;
+    }
+    rc = a2dp_write(&a2dp, sock[0], mtu, &packets);
+    if (rc <= 0) {
+      state.SkipWithError("Failed to write");
+      break;
+    }
+    frames += rc;
+    bytes += recv(sock[1], packet.data(), packet.size(), 0);
+  }
+  cpu = ThreadCpuNs() - cpu;
+
+  state.counters["write_block"] = write_block;
+  state.counters["packet_bytes"] =
+      benchmark::Counter(bytes, benchmark::Counter::kAvgIterations);
+  state.counters["cpu_per_audio_sec"] =
+      frames ? (cpu / 1e9) / ((double)frames / rate) : 0;
+  state.SetItemsProcessed(frames);
+
+  close(sock[0]);
+  close(sock[1]);
+  destroy_a2dp(&a2dp);
+}
+
+// The A2DP headset. Takes packet k from the socket no earlier than its
+// nominal time plus the delay the link adds, and records how long after its
+// RTP timestamp the packet arrived.
+//    start_ns - When the first packet was due.
+//    rate - Frame rate of the RTP timestamps.
+//    period_ns - The time one packet plays for.
+void RunA2dpHeadset(int fd,
+                    size_t mtu,
+                    int64_t start_ns,
+                    size_t rate,
+                    int64_t period_ns,
+                    const LinkModel* model,
+                    const std::atomic<bool>* stop,
+                    bench::Histogram* latency) {
+  std::vector<uint8_t> packet(mtu);
+  struct rtp_header* header = (struct rtp_header*)packet.data();
+  struct pollfd pfd = {fd, POLLIN, 0};
+  Link link(*model);
+  int64_t take_ns = start_ns, delay_ns, due_ns;
+  uint64_t k;
+
+  for (k = 0; !*stop; k++) {
+    delay_ns = link.DelayNs();
+    if (link.Lost())
+      delay_ns += period_ns;
+    take_ns = std::max(take_ns, start_ns + (int64_t)k * period_ns + delay_ns);
+    SleepUntilNs(take_ns);
+    if (poll(&pfd, 1, 100) <= 0)
+      continue;
+    if (recv(fd, packet.data(), packet.size(), 0) <
+        (ssize_t)sizeof(*header))
+      continue;
+    due_ns = start_ns + ntohl(header->timestamp) * 1000000000LL / rate;
+    latency->Add((NowNs() - due_ns) / 1e3);
+  }
+}
+
+// Writes a packet every packet period for kRunTime, the way the A2DP encoder
+// thread paces its flushes, to a headset draining the socket through the
+// link model. state.range(0) is the MTU.
+void BM_A2dpFlush(benchmark::State& state, const LinkModel& model) {
+  const size_t mtu = state.range(0);
+  struct a2dp_info a2dp = {};
+  std::atomic<bool> stop(false);
+  bench::Histogram latency;
+  size_t rate, frame_bytes, pos = 0;
+  unsigned int write_block, packets;
+  int64_t start_ns, period_ns, next_ns, end_ns, cpu = 0;
+  int64_t frames = 0, eagains = 0;
+  int sock[2], sndbuf, rc;
+
+  if (InitA2dpSbc(&a2dp, mtu, &rate, &frame_bytes, &write_block))
+    return state.SkipWithError("Failed to set up SBC");
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock)) {
+    destroy_a2dp(&a2dp);
+    return state.SkipWithError("Failed to create socketpair");
+  }
+  sndbuf = kA2dpSockDepthPackets * mtu;
+  setsockopt(sock[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+  std::vector<uint8_t> pcm = bench::RandomSamples(
+      SND_PCM_FORMAT_S16_LE, 16 * write_block * frame_bytes);
+  period_ns = write_block * 1000000000LL / rate;
+  latency.Reserve(2 * kRunTime.count() * 1000000000LL / period_ns);
+
+  for (auto _ : state) {
+    start_ns = NowNs();
+    end_ns = start_ns + kRunTime.count() * 1000000000LL;
+    std::thread headset(RunA2dpHeadset, sock[1], mtu, start_ns, rate,
+                        period_ns, &model, &stop, &latency);
+    cpu = ThreadCpuNs();
+    for (next_ns = start_ns; next_ns < end_ns; next_ns += period_ns) {
+      SleepUntilNs(next_ns);
+      if (EncodePacket(&a2dp, pcm, &pos, frame_bytes, mtu) < 0)
+        break;
+      rc = a2dp_write(&a2dp, sock[0], mtu, &packets);
+      if (rc == -EAGAIN)
+        eagains++;
+      else if (rc > 0)
+        frames += rc;
+    }
+    cpu = ThreadCpuNs() - cpu;
+    stop = true;
+    headset.join();
+  }
+
+  latency.Report(state, "latency");
+  state.counters["eagains"] = eagains;
+  state.counters["cpu_per_audio_sec"] =
+      frames ? (cpu / 1e9) / ((double)frames / rate) : 0;
+
+  close(sock[0]);
+  close(sock[1]);
+  destroy_a2dp(&a2dp);
+}
+
+// What the capture side sees each time it reads. Only touched from the audio
+// thread while it runs.
+//    info - The hfp_info capturing.
+//    timer_fd - Fires every kHfpCbFrames.
+//    first_cpu_ns, last_cpu_ns - CPU time of the audio thread at the first
+//        and the last read.
+//    started - Set once the first frames were due.
+//    underruns - Reads that found less than kHfpCbFrames due.
+//    latency - Frames due plus the jitter buffer depth, in microseconds.
+struct HfpCapture {
+  struct hfp_info* info;
+  int timer_fd;
+  int64_t first_cpu_ns;
+  int64_t last_cpu_ns;
+  bool started;
+  unsigned int underruns;
+  bench::Histogram latency;
+};
+
+// Reads kHfpCbFrames from hfp_info like the HFP input iodev. Runs on the
+// audio thread, next to the SCO callback of hfp_info.
+int ReadHfpCapture(void* data, int revents) {
+  HfpCapture* cap = static_cast<HfpCapture*>(data);
+  unsigned int due, frames, count;
+  uint64_t expirations;
+  uint8_t* buf;
+
+  if (read(cap->timer_fd, &expirations, sizeof(expirations)) < 0)
+    return 0;
+  cap->last_cpu_ns = ThreadCpuNs();
+  if (!cap->first_cpu_ns)
+    cap->first_cpu_ns = cap->last_cpu_ns;
+
+  due = hfp_capture_frames_due(cap->info);
+  if (!cap->started && !due)
+    return 0;
+  cap->started = true;
+  cap->latency.Add(
+      (due + hfp_capture_jitter_depth(cap->info)) * 1e6 / kHfpRate);
+  if (due < kHfpCbFrames)
+    cap->underruns++;
+
+  frames = std::min<unsigned int>(due, kHfpCbFrames);
+  while (frames) {
+    count = frames;
+    hfp_buf_acquire(cap->info, CRAS_STREAM_INPUT, &buf, &count);
+    if (!count)
+      break;
+    hfp_buf_release(cap->info, CRAS_STREAM_INPUT, count);
+    frames -= count;
+  }
+  return 0;
+}
+
+// The HFP headset. Sends mSBC frames encoded from pcm in packet_size SCO
+// packets, each no earlier than its nominal time plus the delay the link
+// adds. A lost mSBC frame is sent with its bytes zeroed. Drains what the AG
+// sends back.
+void RunHfpHeadset(int fd,
+                   size_t packet_size,
+                   const std::vector<uint8_t>& pcm,
+                   const LinkModel* model,
+                   const std::atomic<bool>* stop,
+                   unsigned int* lost) {
+  struct cras_audio_codec* msbc = cras_msbc_codec_create();
+  const int64_t period_ns = kMsbcFrameNs * packet_size / kMsbcPktSize;
+  std::vector<uint8_t> stream, reply(kMsbcPktSize);
+  Link link(*model);
+  int64_t start_ns = NowNs(), send_ns = start_ns;
+  size_t pcm_pos = 0, stream_pos = 0, encoded;
+  uint64_t k, seq = 0;
+  uint8_t* frame;
+
+  for (k = 0; !*stop; k++) {
+    // Keep a packet of mSBC frames ahead.
+    while (stream.size() - stream_pos < packet_size) {
+      stream.erase(stream.begin(), stream.begin() + stream_pos);
+      stream_pos = 0;
+      stream.resize(stream.size() + kMsbcPktSize);
+      frame = stream.data() + stream.size() - kMsbcPktSize;
+      frame[0] = kH2Header0;
+      frame[1] = kH2FramesCount[seq++ % 4];
+      msbc->encode(msbc, pcm.data() + pcm_pos, kMsbcCodeSize, frame + 2,
+                   kMsbcFrameLen, &encoded);
+      frame[kMsbcPktSize - 1] = 0;
+      pcm_pos = (pcm_pos + kMsbcCodeSize) % pcm.size();
+      if (link.Lost()) {
+        memset(frame, 0, kMsbcPktSize);
+        (*lost)++;
+      }
+    }
+
+    send_ns = std::max(send_ns, start_ns + (int64_t)k * period_ns +
+                                    link.DelayNs());
+    SleepUntilNs(send_ns);
+    if (send(fd, stream.data() + stream_pos, packet_size, 0) < 0)
+      break;
+    stream_pos += packet_size;
+    while (recv(fd, reply.data(), reply.size(), MSG_DONTWAIT) > 0)
+      ;
+  }
+  cras_sbc_codec_destroy(msbc);
+}
+
+// Captures wideband speech from a headset sending through the link model
+// for kRunTime. state.range(0) is the SCO packet size.
+void BM_HfpCapture(benchmark::State& state, const LinkModel& model) {
+  const size_t packet_size = state.range(0);
+  const struct itimerspec period = {{0, 10000000}, {0, 10000000}};
+  struct cras_audio_format fmt = {};
+  struct packet_status_logger logger;
+  struct audio_thread* thread;
+  std::atomic<bool> stop(false);
+  HfpCapture cap = {};
+  unsigned int lost = 0;
+  int sock[2];
+
+  bench::InitServer();
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = kHfpRate;
+  fmt.num_channels = 1;
+  std::vector<uint8_t> pcm =
+      bench::RandomSamples(SND_PCM_FORMAT_S16_LE, 64 * kMsbcCodeSize);
+  cap.latency.Reserve(2 * kRunTime.count() * 100);
+
+  thread = audio_thread_create();
+  if (!thread)
+    return state.SkipWithError("Failed to create audio thread");
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock)) {
+    audio_thread_destroy(thread);
+    return state.SkipWithError("Failed to create socketpair");
+  }
+  cap.info = hfp_info_create();
+  hfp_info_set_wbs_logger(cap.info, &logger);
+  hfp_info_start(sock[1], packet_size, HFP_CODEC_ID_MSBC, cap.info, thread);
+  hfp_info_add_iodev(cap.info, CRAS_STREAM_INPUT, &fmt);
+  cap.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+  timerfd_settime(cap.timer_fd, 0, &period, NULL);
+  audio_thread_add_events_callback(thread, cap.timer_fd, ReadHfpCapture,
+                                   &cap, POLLIN);
+  audio_thread_start(thread);
+
+  for (auto _ : state) {
+    std::thread headset(RunHfpHeadset, sock[0], packet_size, std::cref(pcm),
+                        &model, &stop, &lost);
+    std::this_thread::sleep_for(kRunTime);
+    stop = true;
+    headset.join();
+  }
+
+  hfp_info_stop(cap.info);
+  audio_thread_rm_callback_sync(thread, cap.timer_fd);
+  audio_thread_destroy(thread);
+  close(cap.timer_fd);
+  close(sock[0]);
+  hfp_info_destroy(cap.info);
+
+  cap.latency.Report(state, "latency");
+  state.counters["underruns"] = cap.underruns;
+  state.counters["lost_frames"] = lost;
+  state.counters["cpu_per_audio_sec"] =
+      (cap.last_cpu_ns - cap.first_cpu_ns) / 1e9 / kRunTime.count();
+}
+
+// Registers BM_A2dpEncode/mtu:N, BM_A2dpFlush/<link>/mtu:N and
+// BM_HfpCapture/<link>/packet_size:N.
+int RegisterBtAudioBenchmarks() {
+  benchmark::RegisterBenchmark("BM_A2dpEncode", BM_A2dpEncode)
+      ->ArgName("mtu")
+      ->Arg(672)
+      ->Arg(895)
+      ->Arg(1005);
+
+  for (const LinkModel& model : kLinkModels) {
+    std::string name = std::string("BM_A2dpFlush/") + model.name;
+    benchmark::RegisterBenchmark(name.c_str(), BM_A2dpFlush, model)
+        ->ArgName("mtu")
+        ->Arg(672)
+        ->Arg(1005)
+        ->Iterations(1)
+        ->UseRealTime()
+        ->Unit(benchmark::kMillisecond);
+
+    name = std::string("BM_HfpCapture/") + model.name;
+    benchmark::RegisterBenchmark(name.c_str(), BM_HfpCapture, model)
+        ->ArgName("packet_size")
+        ->Arg(60)
+        ->Arg(24)
+        ->Iterations(1)
+        ->UseRealTime()
+        ->Unit(benchmark::kMillisecond);
+  }
+  return 0;
+}
+
+const int registered = RegisterBtAudioBenchmarks();
+
+}  // namespace
@@ -0,0 +1,476 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Drives a real CRAS server with many libcras clients to measure how much
+// control traffic the main thread sustains: stream connects and disconnects
+// through rclient, cras_iodev_list and the audio thread, notification fan out
+// to observers, and floods of node attribute and observer registration
+// messages. The server runs cras_server_run in a child process with the
+// devices udev finds and the fallback devices, so CRAS must be stopped.
+
+#include <benchmark/benchmark.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "benchmark_util.h"
+
+extern "C" {
+#include "cras_apm_list.h"
+#include "cras_client.h"
+#include "cras_config.h"
+#include "cras_dsp.h"
+#include "cras_iodev_list.h"
+#include "cras_server.h"
+#include "cras_shm.h"
+#include "cras_system_state.h"
+}
+
+namespace {
+
+const unsigned int kConnectTimeoutMs = 5000;
+const std::chrono::seconds kWaitTimeout(5);
+
+// Messages each client sends per iteration of the flood benchmarks, below
+// the node message burst a client is allowed.
+const int kFloodMessages = 16;
+
+// The playback streams connected: 10ms callbacks of 48kHz stereo.
+const size_t kStreamRate = 48000;
+const size_t kStreamBufferFrames = 960;
+const size_t kStreamCbFrames = 480;
+
+int64_t NowNs() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Brings the server up as cras.c does, without the ALSA plugin, file and RTP
+// devices, and never returns.
+void RunServer() {
+  struct cras_server_state* exp_state;
+  char shm_name[NAME_MAX];
+  int rw_shm_fd, ro_shm_fd;
+
+  cras_server_init();
+  snprintf(shm_name, sizeof(shm_name), "/cras-bench-%d", getpid());
+  exp_state = (struct cras_server_state*)cras_shm_setup(
+      shm_name, sizeof(*exp_state), &rw_shm_fd, &ro_shm_fd);
+  if (!exp_state)
+    _exit(1);
+  cras_system_state_init(CRAS_CONFIG_FILE_DIR, shm_name, rw_shm_fd,
+                         ro_shm_fd, exp_state, sizeof(*exp_state));
+  cras_dsp_init(CRAS_CONFIG_FILE_DIR "/dsp.ini", NULL);
+  cras_apm_list_init(CRAS_CONFIG_FILE_DIR);
+  cras_iodev_list_init();
+  _exit(cras_server_run(0) ? 1 : 0);
+}
+
+pid_t server_pid;
+
+void StopServer() {
+  char path[CRAS_MAX_SOCKET_PATH_SIZE];
+
+  kill(server_pid, SIGKILL);
+  waitpid(server_pid, NULL, 0);
+  for (int type = 0; type < CRAS_NUM_CONN_TYPE; type++)
+    if (!cras_fill_socket_path((enum CRAS_CONNECTION_TYPE)type, path))
+      unlink(path);
+}
+
+// Returns a client connected to the server, or NULL.
+struct cras_client* ConnectClient() {
+  struct cras_client* client;
+
+  if (cras_client_create(&client))
+    return NULL;
+  if (cras_client_connect_timeout(client, kConnectTimeoutMs) ||
+      cras_client_run_thread(client) || cras_client_connected_wait(client)) {
+    cras_client_destroy(client);
+    return NULL;
+  }
+  return client;
+}
+
+// Starts the server in a child process once, killed when the benchmarks
+// exit. Returns false if it can't run, also when a CRAS already listens on
+// the socket, as the benchmark would take its socket files.
+bool StartServer() {
+  static bool started = [] {
+    struct cras_client* client;
+
+    if (cras_client_create(&client))
+      return false;
+    bool running = !cras_client_connect_timeout(client, 100);
+    cras_client_destroy(client);
+    if (running)
+      return false;
+
+    server_pid = fork();
+    if (server_pid < 0)
+      return false;
+    if (server_pid == 0) {
+      prctl(PR_SET_PDEATHSIG, SIGKILL);
+      RunServer();
+    }
+    atexit(StopServer);
+
+    client = ConnectClient();
+    if (!client)
+      return false;
+    cras_client_destroy(client);
+    return true;
+  }();
+  return started;
+}
+
+// A libcras client whose callbacks are waited for from the benchmark thread.
+class Client {
+ public:
+  static std::unique_ptr<Client> Create() {
+    struct cras_client* client = ConnectClient();
+
+    if (!client)
+      return nullptr;
+    return std::unique_ptr<Client>(new Client(client));
+  }
+
+  ~Client() {
+    {
+      std::lock_guard<std::mutex> lock(registry_lock_);
+      registry_.erase(client_);
+    }
+    cras_client_destroy(client_);
+  }
+
+  struct cras_client* get() { return client_; }
+
+  // Asks for the hotword models of a node that doesn't exist, which the
+  // server answers after the messages this client sent before.
+  void SendBarrier() {
+    std::lock_guard<std::mutex> lock(lock_);
+    barriers_++;
+    cras_client_get_hotword_models(client_, cras_make_node_id(0, 0),
+                                   HotwordModelsReady);
+  }
+
+  // Waits for the answers to SendBarrier(). Returns false on timeout.
+  bool WaitBarriers() {
+    std::unique_lock<std::mutex> lock(lock_);
+    return cond_.wait_for(lock, kWaitTimeout, [this] { return !barriers_; });
+  }
+
+  // Observes the system volume. WaitVolume() returns once it is seen.
+  void ObserveVolume() {
+    cras_client_set_state_change_callback_context(client_, this);
+    cras_client_set_output_volume_changed_callback(client_,
+                                                   OutputVolumeChanged);
+  }
+
+  // Waits for the volume to be notified. Returns the time it was, or 0 on
+  // timeout.
+  int64_t WaitVolume(int32_t volume) {
+    std::unique_lock<std::mutex> lock(lock_);
+    if (!cond_.wait_for(lock, kWaitTimeout,
+                        [this, volume] { return volume_ == volume; }))
+      return 0;
+    return volume_ns_;
+  }
+
+ private:
+  explicit Client(struct cras_client* client) : client_(client) {
+    std::lock_guard<std::mutex> lock(registry_lock_);
+    registry_[client_] = this;
+  }
+
+  static void HotwordModelsReady(struct cras_client* client,
+                                 const char* hotword_models) {
+    std::lock_guard<std::mutex> registry_lock(registry_lock_);
+    auto it = registry_.find(client);
+    if (it == registry_.end())
+      return;
+    Client* self = it->second;
+    std::lock_guard<std::mutex> lock(self->lock_);
+    if (self->barriers_)
+      self->barriers_--;
+    self->cond_.notify_all();
+  }
+
+  static void OutputVolumeChanged(void* context, int32_t volume) {
+    Client* self = (Client*)context;
+    std::lock_guard<std::mutex> lock(self->lock_);
+    self->volume_ = volume;
+    self->volume_ns_ = NowNs();
+    self->cond_.notify_all();
+  }
+
+  struct cras_client* client_;
+  std::mutex lock_;
+  std::condition_variable cond_;
+  int barriers_ = 0;
+  int32_t volume_ = -1;
+  int64_t volume_ns_ = 0;
+
+  // libcras only passes the client to the hotword models callback.
+  static std::mutex registry_lock_;
+  static std::map<struct cras_client*, Client*> registry_;
+};
+
+std::mutex Client::registry_lock_;
+std::map<struct cras_client*, Client*> Client::registry_;
+
+// Creates count clients. Returns false if any fails to connect.
+bool CreateClients(size_t count, std::vector<std::unique_ptr<Client>>* out) {
+  for (size_t i = 0; i < count; i++) {
+    out->push_back(Client::Create());
+    if (!out->back())
+      return false;
+  }
+  return true;
+}
+
+// A playback stream being connected, done at its first audio callback.
+struct PendingStream {
+  std::mutex lock;
+  std::condition_variable cond;
+  int64_t connect_ns = 0;
+  int64_t first_cb_ns = 0;
+};
+
+int PlaybackCb(struct cras_client* client, cras_stream_id_t stream_id,
+               uint8_t* samples, size_t frames,
+               const struct timespec* sample_time, void* user_arg) {
+  PendingStream* pending = (PendingStream*)user_arg;
+
+  memset(samples, 0, frames * 4);
+  std::lock_guard<std::mutex> lock(pending->lock);
+  if (!pending->first_cb_ns) {
+    pending->first_cb_ns = NowNs();
+    pending->cond.notify_all();
+  }
+  return frames;
+}
+
+int StreamErrorCb(struct cras_client* client, cras_stream_id_t stream_id,
+                  int err, void* user_arg) {
+  return 0;
+}
+
+// Each of state.range(0) clients connects a playback stream and removes it
+// once it is called for audio. The latency is from the connect call to the
+// first callback, through rclient, cras_iodev_list and the audio thread.
+void BM_StreamConnect(benchmark::State& state) {
+  const size_t num_clients = state.range(0);
+  std::vector<std::unique_ptr<Client>> clients;
+  std::vector<cras_stream_id_t> stream_ids(num_clients);
+  struct cras_audio_format* fmt;
+  bench::Histogram latency;
+  bool failed = false;
+
+  if (!StartServer())
+    return state.SkipWithError("Failed to start a server, is CRAS running?");
+  if (!CreateClients(num_clients, &clients))
+    return state.SkipWithError("Failed to connect clients");
+  fmt = cras_audio_format_create(SND_PCM_FORMAT_S16_LE, kStreamRate, 2);
+
+  for (auto _ : state) {
+    std::vector<PendingStream> pending(num_clients);
+
+    for (size_t i = 0; i < num_clients; i++) {
+      struct cras_stream_params* params = cras_client_stream_params_create(
+          CRAS_STREAM_OUTPUT, kStreamBufferFrames, kStreamCbFrames, 0,
+          CRAS_STREAM_TYPE_DEFAULT, 0, &pending[i], PlaybackCb,
+          StreamErrorCb, fmt);
+      pending[i].connect_ns = NowNs();
+      cras_client_add_stream(clients[i]->get(), &stream_ids[i], params);
+      cras_client_stream_params_destroy(params);
+    }
+    for (size_t i = 0; i < num_clients; i++) {
+      std::unique_lock<std::mutex> lock(pending[i].lock);
+      if (!pending[i].cond.wait_for(lock, kWaitTimeout, [&] {
+            return pending[i].first_cb_ns != 0;
+          })) {
+        state.SkipWithError("Stream not called for audio");
+        failed = true;
+        break;
+      }
+      latency.Add((pending[i].first_cb_ns - pending[i].connect_ns) / 1e3);
+    }
+    for (size_t i = 0; i < num_clients; i++)
+      cras_client_rm_stream(clients[i]->get(), stream_ids[i]);
+    if (failed)
+      break;
+  }
+
+  cras_audio_format_destroy(fmt);
+  latency.Report(state, "connect");
+  state.counters["connects_per_sec"] = benchmark::Counter(
+      state.iterations() * num_clients, benchmark::Counter::kIsRate);
+}
+
+// One client changes the system volume and waits for each of state.range(0)
+// observers to be notified. The latency is to each delivery.
+void BM_NotificationFanout(benchmark::State& state) {
+  const size_t num_observers = state.range(0);
+  std::vector<std::unique_ptr<Client>> observers;
+  std::unique_ptr<Client> setter;
+  bench::Histogram latency;
+  size_t volume = 50;
+  bool failed = false;
+
+  if (!StartServer())
+    return state.SkipWithError("Failed to start a server, is CRAS running?");
+  setter = Client::Create();
+  if (!setter || !CreateClients(num_observers, &observers))
+    return state.SkipWithError("Failed to connect clients");
+  for (auto& observer : observers) {
+    observer->ObserveVolume();
+    observer->SendBarrier();
+    observer->WaitBarriers();
+  }
+
+  for (auto _ : state) {
+    volume = volume == 50 ? 51 : 50;
+    int64_t set_ns = NowNs();
+    cras_client_set_system_volume(setter->get(), volume);
+    for (auto& observer : observers) {
+      int64_t seen_ns = observer->WaitVolume(volume);
+      if (!seen_ns) {
+        state.SkipWithError("Volume change not notified");
+        failed = true;
+        break;
+      }
+      latency.Add((seen_ns - set_ns) / 1e3);
+    }
+    if (failed)
+      break;
+  }
+
+  latency.Report(state, "delivery");
+  state.counters["notifications_per_sec"] = benchmark::Counter(
+      state.iterations() * num_observers, benchmark::Counter::kIsRate);
+}
+
+// Sends the messages of one client in a flood.
+using FloodFn = void (*)(struct cras_client* client, cras_node_id_t node,
+                         int i);
+
+void SetNodeAttr(struct cras_client* client, cras_node_id_t node, int i) {
+  cras_client_set_node_attr(client, node, IONODE_ATTR_VOLUME, 50 + i % 2);
+}
+
+void OutputNodeVolumeChanged(void* context, cras_node_id_t node_id,
+                             int32_t volume) {}
+
+void RegisterObserver(struct cras_client* client, cras_node_id_t node, int i) {
+  cras_client_set_output_node_volume_changed_callback(
+      client, i % 2 ? NULL : OutputNodeVolumeChanged);
+}
+
+// Returns the first output node, or an unknown node if there is none, which
+// the server looks up and ignores.
+cras_node_id_t FirstOutputNode(struct cras_client* client) {
+  struct cras_iodev_info devs[CRAS_MAX_IODEVS];
+  struct cras_ionode_info nodes[CRAS_MAX_IONODES];
+  size_t num_devs = CRAS_MAX_IODEVS, num_nodes = CRAS_MAX_IONODES;
+
+  if (cras_client_get_output_devices(client, devs, nodes, &num_devs,
+                                     &num_nodes) < 0 ||
+      !num_nodes)
+    return cras_make_node_id(0, 0);
+  return cras_make_node_id(nodes[0].iodev_idx, nodes[0].ionode_idx);
+}
+
+// Each of state.range(0) clients floods kFloodMessages messages, then all
+// wait for the server to get through them. The latency is of the wait of each
+// client, the time its last message spent queued behind the others.
+void BM_ControlFlood(benchmark::State& state, FloodFn flood) {
+  const size_t num_clients = state.range(0);
+  std::vector<std::unique_ptr<Client>> clients;
+  bench::Histogram latency;
+  cras_node_id_t node;
+  bool failed = false;
+
+  if (!StartServer())
+    return state.SkipWithError("Failed to start a server, is CRAS running?");
+  if (!CreateClients(num_clients, &clients))
+    return state.SkipWithError("Failed to connect clients");
+  node = FirstOutputNode(clients[0]->get());
+
+  for (auto _ : state) {
+    int64_t start_ns = NowNs();
+    for (int i = 0; i < kFloodMessages; i++)
+      for (auto& client : clients)
+        flood(client->get(), node, i);
+    for (auto& client : clients)
+      client->SendBarrier();
+    for (auto& client : clients) {
+      if (!client->WaitBarriers()) {
+        state.SkipWithError("Server not answering");
+        failed = true;
+        break;
+      }
+      latency.Add((NowNs() - start_ns) / 1e3);
+    }
+    if (failed)
+      break;
+  }
+
+  latency.Report(state, "drain");
+  state.counters["msgs_per_sec"] =
+      benchmark::Counter(state.iterations() * num_clients * kFloodMessages,
+                         benchmark::Counter::kIsRate);
+}
+
+// Registers BM_StreamConnect/clients:N, BM_NotificationFanout/observers:N and
+// BM_ControlFlood/<message>/clients:N.
+int RegisterControlBenchmarks() {
+  benchmark::RegisterBenchmark("BM_StreamConnect", BM_StreamConnect)
+      ->ArgName("clients")
+      ->RangeMultiplier(4)
+      ->Range(1, 64)
+      ->UseRealTime()
+      ->Unit(benchmark::kMicrosecond);
+  benchmark::RegisterBenchmark("BM_NotificationFanout", BM_NotificationFanout)
+      ->ArgName("observers")
+      ->RangeMultiplier(4)
+      ->Range(1, 64)
+      ->UseRealTime()
+      ->Unit(benchmark::kMicrosecond);
+  benchmark::RegisterBenchmark("BM_ControlFlood/set_node_attr",
+                               BM_ControlFlood, SetNodeAttr)
+      ->ArgName("clients")
+      ->RangeMultiplier(4)
+      ->Range(1, 64)
+      ->UseRealTime()
+      ->Unit(benchmark::kMicrosecond);
+  benchmark::RegisterBenchmark("BM_ControlFlood/register_observer",
+                               BM_ControlFlood, RegisterObserver)
+      ->ArgName("clients")
+      ->RangeMultiplier(4)
+      ->Range(1, 64)
+      ->UseRealTime()
+      ->Unit(benchmark::kMicrosecond);
+  return 0;
+}
+
+const int registered = RegisterControlBenchmarks();
+
+}  // namespace
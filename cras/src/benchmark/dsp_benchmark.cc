@@ -0,0 +1,144 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <benchmark/benchmark.h>
+
+#include "benchmark_util.h"
+
+extern "C" {
+#include "crossover2.h"
+#include "drc_kernel.h"
+#include "dsp_util.h"
+#include "eq2.h"
+}
+
+namespace {
+
+// Sample rate the filters are designed for.
+const float kSampleRate = 48000;
+
+void BM_DrcKernel(benchmark::State& state) {
+  const unsigned int frames = state.range(0);
+  std::vector<float> left = bench::RandomFloats(frames);
+  std::vector<float> right = bench::RandomFloats(frames);
+  float* data[2] = {left.data(), right.data()};
+  struct drc_kernel dk;
+
+  // The default parameters of the first DRC band.
+  dk_init(&dk, kSampleRate);
+  dk_set_parameters(&dk, -24, 30, 12, 0.003f, 0.250f, 0.006f, 0, 0.09f,
+                    0.16f, 0.42f, 0.98f);
+  dk_set_enabled(&dk, 1);
+
+  for (auto _ : state) {
+    dk_process(&dk, data, frames);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * frames);
+
+  dk_free(&dk);
+}
+
+void BM_Eq2(benchmark::State& state) {
+  const unsigned int frames = state.range(0);
+  std::vector<float> left = bench::RandomFloats(frames);
+  std::vector<float> right = bench::RandomFloats(frames);
+  struct eq2* eq2 = eq2_new();
+
+  // A speaker tuning like EQ, four biquads per channel.
+  for (int ch = 0; ch < 2; ch++) {
+    eq2_append_biquad(eq2, ch, BQ_HIGHPASS, 200 / (kSampleRate / 2), 0.7, 0);
+    eq2_append_biquad(eq2, ch, BQ_PEAKING, 1000 / (kSampleRate / 2), 2, -3);
+    eq2_append_biquad(eq2, ch, BQ_PEAKING, 4000 / (kSampleRate / 2), 2, 3);
+    eq2_append_biquad(eq2, ch, BQ_HIGHSHELF, 10000 / (kSampleRate / 2), 0,
+                      -2);
+  }
+
+  for (auto _ : state) {
+    eq2_process(eq2, left.data(), right.data(), frames);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * frames);
+
+  eq2_free(eq2);
+}
+
+void BM_Crossover2(benchmark::State& state) {
+  const unsigned int frames = state.range(0);
+  std::vector<float> in_left = bench::RandomFloats(frames);
+  std::vector<float> in_right = bench::RandomFloats(frames);
+  std::vector<float> bands(frames * 4);
+  struct crossover2 xo2;
+
+  crossover2_init(&xo2, 200 / (kSampleRate / 2), 2000 / (kSampleRate / 2));
+
+  for (auto _ : state) {
+    crossover2_process(&xo2, frames, in_left.data(), in_right.data(),
+                       &bands[0], &bands[frames], &bands[frames * 2],
+                       &bands[frames * 3]);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * frames);
+}
+
+void BM_DspUtilInterleave(benchmark::State& state, snd_pcm_format_t fmt) {
+  const unsigned int frames = state.range(0);
+  std::vector<float> left = bench::RandomFloats(frames);
+  std::vector<float> right = bench::RandomFloats(frames);
+  float* const in[2] = {left.data(), right.data()};
+  std::vector<uint8_t> out(frames * 2 * snd_pcm_format_physical_width(fmt) /
+                           8);
+
+  for (auto _ : state) {
+    dsp_util_interleave(in, out.data(), 2, fmt, frames);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * frames);
+  state.SetBytesProcessed(state.iterations() * out.size());
+}
+
+void BM_DspUtilDeinterleave(benchmark::State& state, snd_pcm_format_t fmt) {
+  const unsigned int frames = state.range(0);
+  std::vector<uint8_t> in = bench::RandomSamples(
+      fmt, frames * 2 * snd_pcm_format_physical_width(fmt) / 8);
+  std::vector<float> left(frames);
+  std::vector<float> right(frames);
+  float* const out[2] = {left.data(), right.data()};
+
+  for (auto _ : state) {
+    dsp_util_deinterleave(in.data(), out, 2, fmt, frames);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * frames);
+  state.SetBytesProcessed(state.iterations() * in.size());
+}
+
+int RegisterDspBenchmarks() {
+  static const snd_pcm_format_t formats[] = {
+      SND_PCM_FORMAT_S16_LE,
+      SND_PCM_FORMAT_S24_LE,
+      SND_PCM_FORMAT_S32_LE,
+  };
+
+  benchmark::RegisterBenchmark("BM_DrcKernel", BM_DrcKernel)
+      ->ArgsProduct({bench::FrameCounts()});
+  benchmark::RegisterBenchmark("BM_Eq2", BM_Eq2)
+      ->ArgsProduct({bench::FrameCounts()});
+  benchmark::RegisterBenchmark("BM_Crossover2", BM_Crossover2)
+      ->ArgsProduct({bench::FrameCounts()});
+  for (snd_pcm_format_t fmt : formats) {
+    std::string suffix = std::string("/") + snd_pcm_format_name(fmt);
+    benchmark::RegisterBenchmark(("BM_DspUtilInterleave" + suffix).c_str(),
+                                 BM_DspUtilInterleave, fmt)
+        ->ArgsProduct({bench::FrameCounts()});
+    benchmark::RegisterBenchmark(("BM_DspUtilDeinterleave" + suffix).c_str(),
+                                 BM_DspUtilDeinterleave, fmt)
+        ->ArgsProduct({bench::FrameCounts()});
+  }
+  return 0;
+}
+
+const int registered = RegisterDspBenchmarks();
+
+}  // namespace
@@ -0,0 +1,176 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+
+#include "benchmark_util.h"
+
+extern "C" {
+#include "cras_audio_format.h"
+#include "cras_fmt_conv.h"
+#include "linear_resampler.h"
+}
+
+namespace {
+
+// A conversion to benchmark, the layouts are set for more than two channels.
+struct Conversion {
+  snd_pcm_format_t in_format;
+  size_t in_channels;
+  size_t in_rate;
+  snd_pcm_format_t out_format;
+  size_t out_channels;
+  size_t out_rate;
+};
+
+const Conversion kConversions[] = {
+    // Format only.
+    {SND_PCM_FORMAT_S24_LE, 2, 48000, SND_PCM_FORMAT_S16_LE, 2, 48000},
+    // Sample rate, polyphase and speex ratios.
+    {SND_PCM_FORMAT_S16_LE, 2, 44100, SND_PCM_FORMAT_S16_LE, 2, 48000},
+    {SND_PCM_FORMAT_S16_LE, 2, 22050, SND_PCM_FORMAT_S16_LE, 2, 48000},
+    {SND_PCM_FORMAT_FLOAT_LE, 2, 96000, SND_PCM_FORMAT_S32_LE, 2, 48000},
+    // Channels and rate.
+    {SND_PCM_FORMAT_S16_LE, 1, 16000, SND_PCM_FORMAT_S16_LE, 2, 48000},
+    // Downmix, 5.1 and 7.1 to stereo.
+    {SND_PCM_FORMAT_S32_LE, 6, 48000, SND_PCM_FORMAT_S16_LE, 2, 48000},
+    {SND_PCM_FORMAT_S16_LE, 8, 48000, SND_PCM_FORMAT_S16_LE, 2, 48000},
+};
+
+// FL, FR, RL, RR, FC, LFE, SL, SR in channel order.
+const int8_t kSurroundLayout[CRAS_CH_MAX] = {0, 1, 2,  3,  4, 5,
+                                             6, 7, -1, -1, -1};
+
+void SetFormat(struct cras_audio_format* fmt,
+               snd_pcm_format_t format,
+               size_t channels,
+               size_t rate) {
+  fmt->format = format;
+  fmt->num_channels = channels;
+  fmt->frame_rate = rate;
+  for (int i = 0; i < CRAS_CH_MAX; i++)
+    fmt->channel_layout[i] = -1;
+  if (channels == 2) {
+    fmt->channel_layout[CRAS_CH_FL] = 0;
+    fmt->channel_layout[CRAS_CH_FR] = 1;
+  } else if (channels > 2) {
+    for (int i = 0; i < CRAS_CH_MAX; i++)
+      if (kSurroundLayout[i] < (int)channels)
+        fmt->channel_layout[i] = kSurroundLayout[i];
+  }
+}
+
+void BM_FmtConv(benchmark::State& state,
+                const bench::Isa& isa,
+                const Conversion& c) {
+  struct cras_audio_format in_fmt, out_fmt;
+  struct cras_fmt_conv* conv;
+  unsigned int in_frames = state.range(0);
+  size_t out_frames;
+
+  cras_fmt_conv_init(isa.cpu_flags);
+  linear_resampler_init(isa.cpu_flags);
+  SetFormat(&in_fmt, c.in_format, c.in_channels, c.in_rate);
+  SetFormat(&out_fmt, c.out_format, c.out_channels, c.out_rate);
+  out_frames = in_frames * c.out_rate / c.in_rate + 1;
+  conv = cras_fmt_conv_create(&in_fmt, &out_fmt,
+                              std::max<size_t>(in_frames, out_frames), 0);
+  if (!conv) {
+    state.SkipWithError("Failed to create converter");
+    return;
+  }
+
+  std::vector<uint8_t> in = bench::RandomSamples(
+      c.in_format, in_frames * cras_get_format_bytes(&in_fmt));
+  std::vector<uint8_t> out(out_frames * cras_get_format_bytes(&out_fmt));
+
+  for (auto _ : state) {
+    unsigned int frames = in_frames;
+    benchmark::DoNotOptimize(cras_fmt_conv_convert_frames(
+        conv, in.data(), out.data(), &frames, out_frames));
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * in_frames);
+  state.SetBytesProcessed(state.iterations() * in.size());
+
+  cras_fmt_conv_destroy(&conv);
+}
+
+void BM_LinearResample(benchmark::State& state,
+                       const bench::Isa& isa,
+                       snd_pcm_format_t fmt,
+                       unsigned int channels) {
+  struct linear_resampler* lr;
+  const unsigned int frames = state.range(0);
+  const unsigned int frame_bytes =
+      channels * snd_pcm_format_physical_width(fmt) / 8;
+
+  linear_resampler_init(isa.cpu_flags);
+  // A typical clock drift correction, slightly faster than real time.
+  if (fmt == SND_PCM_FORMAT_FLOAT_LE)
+    lr = linear_resampler_create_float(channels, 48000, 48048);
+  else
+    lr = linear_resampler_create(channels, frame_bytes, 48000, 48048);
+  if (!lr) {
+    state.SkipWithError("Failed to create resampler");
+    return;
+  }
+
+  std::vector<uint8_t> in = bench::RandomSamples(fmt, frames * frame_bytes);
+  std::vector<uint8_t> out((frames + frames / 100 + 2) * frame_bytes);
+
+  for (auto _ : state) {
+    unsigned int src_frames = frames;
+    benchmark::DoNotOptimize(linear_resampler_resample(
+        lr, in.data(), &src_frames, out.data(), out.size() / frame_bytes));
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * frames);
+  state.SetBytesProcessed(state.iterations() * in.size());
+
+  linear_resampler_destroy(lr);
+}
+
+std::string ConversionName(const Conversion& c) {
+  return std::string(snd_pcm_format_name(c.in_format)) + "_" +
+         std::to_string(c.in_channels) + "ch_" + std::to_string(c.in_rate) +
+         "_to_" + snd_pcm_format_name(c.out_format) + "_" +
+         std::to_string(c.out_channels) + "ch_" + std::to_string(c.out_rate);
+}
+
+// Registers BM_FmtConv/<conversion>/<isa>/<frames> and
+// BM_LinearResample/<format>_<channels>ch/<isa>/<frames>.
+int RegisterFmtConvBenchmarks() {
+  static const struct {
+    snd_pcm_format_t fmt;
+    unsigned int channels;
+  } resamples[] = {
+      {SND_PCM_FORMAT_S16_LE, 2},
+      {SND_PCM_FORMAT_S16_LE, 8},
+      {SND_PCM_FORMAT_FLOAT_LE, 2},
+  };
+
+  for (const bench::Isa& isa : bench::SupportedIsas()) {
+    for (const Conversion& c : kConversions) {
+      std::string name = "BM_FmtConv/" + ConversionName(c) + "/" + isa.name;
+      benchmark::RegisterBenchmark(name.c_str(), BM_FmtConv, isa, c)
+          ->ArgsProduct({bench::FrameCounts()});
+    }
+    for (const auto& r : resamples) {
+      std::string name = std::string("BM_LinearResample/") +
+                         snd_pcm_format_name(r.fmt) + "_" +
+                         std::to_string(r.channels) + "ch/" + isa.name;
+      benchmark::RegisterBenchmark(name.c_str(), BM_LinearResample, isa,
+                                   r.fmt, r.channels)
+          ->ArgsProduct({bench::FrameCounts()});
+    }
+  }
+  return 0;
+}
+
+const int registered = RegisterFmtConvBenchmarks();
+
+}  // namespace
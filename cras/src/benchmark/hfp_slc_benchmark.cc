@@ -0,0 +1,123 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Measures how long the HFP service level connection takes to handle the AT
+// commands a headset sends, the per command cost of chatty headsets that
+// report battery and indicator changes all the time.
+
+#include <benchmark/benchmark.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "server_util.h"
+
+extern "C" {
+#include "cras_bt_device.h"
+#include "cras_bt_log.h"
+#include "cras_hfp_slc.h"
+#include "cras_server_metrics.h"
+}
+
+namespace {
+
+// The commands of the cras_hfp_slc fuzzer dictionary with typical arguments,
+// leaving out those that answer, place or end calls. The AG doesn't support
+// HF indicators so AT+CMER doesn't start a timer each time.
+const char* const kCommands[] = {
+    "AT+BAC=1,2",
+    "AT+BCC",
+    "AT+BCS=1",
+    "AT+BIA=0,0,0,1,1,1,0",
+    "AT+BIEV=2,80",
+    "AT+BIND=1,2",
+    "AT+BIND=?",
+    "AT+BRSF=191",
+    "AT+CCWA=1",
+    "AT+CIND=?",
+    "AT+CIND?",
+    "AT+CLCC",
+    "AT+CLIP=1",
+    "AT+CMEE=1",
+    "AT+CMER=3,0,0,1",
+    "AT+CNUM",
+    "AT+COPS?",
+    "AT+IPHONEACCEV=2,1,8,2,0",
+    "AT+VGM=8",
+    "AT+VGS=8",
+    "AT+VTS=1",
+    "AT+XAPL=05AC-1234-0100,10",
+    "AT+NREC=0",
+};
+const size_t kNumCommands = sizeof(kCommands) / sizeof(kCommands[0]);
+
+int DisconnectCb(struct hfp_slc_handle* handle) {
+  return 0;
+}
+
+// An SLC answering to /dev/null, as the RFCOMM socket never blocks on the
+// short replies.
+class Slc {
+ public:
+  Slc() {
+    static bool done = [] {
+      bench::InitServer();
+      btlog = cras_bt_event_log_init();
+      cras_server_metrics_init();
+      return true;
+    }();
+    (void)done;
+
+    fd_ = open("/dev/null", O_RDWR);
+    device_ = cras_bt_device_create(NULL, "");
+    handle_ = hfp_slc_create(fd_, 0, 0, device_, NULL, DisconnectCb);
+  }
+
+  ~Slc() {
+    hfp_slc_destroy(handle_);
+    cras_bt_device_remove(device_);
+    close(fd_);
+  }
+
+  struct hfp_slc_handle* handle() { return handle_; }
+
+ private:
+  int fd_;
+  struct cras_bt_device* device_;
+  struct hfp_slc_handle* handle_;
+};
+
+void BM_HfpSlcCommand(benchmark::State& state, const char* cmd) {
+  Slc slc;
+
+  for (auto _ : state)
+    handle_at_command_for_test(slc.handle(), cmd);
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Runs through all the commands, for a single number to compare.
+void BM_HfpSlcAllCommands(benchmark::State& state) {
+  Slc slc;
+
+  for (auto _ : state)
+    for (const char* cmd : kCommands)
+      handle_at_command_for_test(slc.handle(), cmd);
+  state.SetItemsProcessed(state.iterations() * kNumCommands);
+}
+
+// Registers a benchmark per command, named BM_HfpSlcCommand/<command>.
+int RegisterHfpSlcBenchmarks() {
+  for (const char* cmd : kCommands) {
+    std::string name = std::string("BM_HfpSlcCommand/") + cmd;
+    benchmark::RegisterBenchmark(name.c_str(), BM_HfpSlcCommand, cmd);
+  }
+  benchmark::RegisterBenchmark("BM_HfpSlcAllCommands", BM_HfpSlcAllCommands);
+  return 0;
+}
+
+const int registered = RegisterHfpSlcBenchmarks();
+
+}  // namespace
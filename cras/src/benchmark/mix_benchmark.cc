@@ -0,0 +1,201 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <benchmark/benchmark.h>
+
+#include "benchmark_util.h"
+
+extern "C" {
+#include "cras_audio_area.h"
+#include "cras_mix.h"
+#include "cras_mix_ops.h"
+}
+
+namespace {
+
+const snd_pcm_format_t kFormats[] = {
+    SND_PCM_FORMAT_S16_LE,
+    SND_PCM_FORMAT_S24_LE,
+    SND_PCM_FORMAT_S32_LE,
+    SND_PCM_FORMAT_FLOAT_LE,
+};
+
+const struct cras_mix_ops* MixOps(const bench::Isa& isa) {
+#if defined HAVE_SSE42
+  if (isa.cpu_flags == CPU_X86_SSE4_2)
+    return &mixer_ops_sse42;
+#endif
+#if defined HAVE_AVX
+  if (isa.cpu_flags == CPU_X86_AVX)
+    return &mixer_ops_avx;
+#endif
+#if defined HAVE_AVX2
+  if (isa.cpu_flags == CPU_X86_AVX2)
+    return &mixer_ops_avx2;
+#endif
+#if defined HAVE_FMA
+  if (isa.cpu_flags == CPU_X86_FMA)
+    return &mixer_ops_fma;
+#endif
+  return &mixer_ops;
+}
+
+// Samples are stereo throughout, state.range(0) is the frame count.
+const unsigned int kChannels = 2;
+
+void BM_MixAdd(benchmark::State& state,
+               const struct cras_mix_ops* ops,
+               snd_pcm_format_t fmt) {
+  const unsigned int samples = state.range(0) * kChannels;
+  const size_t bytes = samples * snd_pcm_format_physical_width(fmt) / 8;
+  std::vector<uint8_t> src = bench::RandomSamples(fmt, bytes);
+  std::vector<uint8_t> dst = bench::RandomSamples(fmt, bytes);
+
+  for (auto _ : state) {
+    ops->add(fmt, dst.data(), src.data(), samples, 1, 0, 0.5f);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+void BM_MixScaleBuffer(benchmark::State& state,
+                       const struct cras_mix_ops* ops,
+                       snd_pcm_format_t fmt) {
+  const unsigned int samples = state.range(0) * kChannels;
+  const size_t bytes = samples * snd_pcm_format_physical_width(fmt) / 8;
+  std::vector<uint8_t> buf = bench::RandomSamples(fmt, bytes);
+
+  for (auto _ : state) {
+    ops->scale_buffer(fmt, buf.data(), samples, 0.5f);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+void BM_MixScaleBufferIncrement(benchmark::State& state,
+                                const struct cras_mix_ops* ops,
+                                snd_pcm_format_t fmt) {
+  const unsigned int frames = state.range(0);
+  const size_t bytes = frames * kChannels *
+                       snd_pcm_format_physical_width(fmt) / 8;
+  std::vector<uint8_t> buf = bench::RandomSamples(fmt, bytes);
+
+  for (auto _ : state) {
+    ops->scale_buffer_increment(fmt, buf.data(), frames, 0.1f,
+                                0.8f / frames, 0.9f, kChannels);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+void BM_MixAddScaleStride(benchmark::State& state,
+                          const struct cras_mix_ops* ops,
+                          snd_pcm_format_t fmt) {
+  const unsigned int frames = state.range(0);
+  const unsigned int sample_bytes = snd_pcm_format_physical_width(fmt) / 8;
+  const unsigned int stride = kChannels * sample_bytes;
+  std::vector<uint8_t> src = bench::RandomSamples(fmt, frames * stride);
+  std::vector<uint8_t> dst = bench::RandomSamples(fmt, frames * stride);
+
+  for (auto _ : state) {
+    ops->add_scale_stride(fmt, dst.data(), src.data(), frames, stride,
+                          stride, 0.5f);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() * frames * sample_bytes);
+}
+
+// Copies a stereo area into one of the same layout, as capture does into
+// the stream shm with software gain. With swapped set the channels trade
+// places, which takes the strided copy of one channel at a time.
+void BM_AreaCopy(benchmark::State& state,
+                 unsigned int cpu_flags,
+                 snd_pcm_format_t fmt,
+                 bool swapped) {
+  const unsigned int frames = state.range(0);
+  struct cras_audio_format format;
+  struct cras_audio_format src_format;
+  struct cras_audio_area* dst_area = cras_audio_area_create(kChannels);
+  struct cras_audio_area* src_area = cras_audio_area_create(kChannels);
+
+  cras_mix_init(cpu_flags);
+  format.format = fmt;
+  format.frame_rate = 48000;
+  format.num_channels = kChannels;
+  cras_audio_format_set_default_channel_layout(&format);
+  src_format = format;
+  if (swapped) {
+    src_format.channel_layout[CRAS_CH_FL] = 1;
+    src_format.channel_layout[CRAS_CH_FR] = 0;
+  }
+
+  const size_t bytes = frames * cras_get_format_bytes(&format);
+  std::vector<uint8_t> src = bench::RandomSamples(fmt, bytes);
+  std::vector<uint8_t> dst(bytes);
+  cras_audio_area_config_channels(dst_area, &format);
+  cras_audio_area_config_buf_pointers(dst_area, &format, dst.data());
+  cras_audio_area_config_channels(src_area, &src_format);
+  cras_audio_area_config_buf_pointers(src_area, &src_format, src.data());
+  dst_area->frames = frames;
+  src_area->frames = frames;
+
+  for (auto _ : state) {
+    cras_audio_area_copy(dst_area, 0, &format, src_area, 0, 0.5f);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetBytesProcessed(state.iterations() * bytes);
+
+  cras_audio_area_destroy(dst_area);
+  cras_audio_area_destroy(src_area);
+  cras_mix_init(0);
+}
+
+// Registers every kernel for every format and instruction set, named
+// BM_<kernel>/<format>/<isa>/<frames>.
+int RegisterMixBenchmarks() {
+  static const struct {
+    const char* name;
+    void (*fn)(benchmark::State&, const struct cras_mix_ops*,
+               snd_pcm_format_t);
+  } kernels[] = {
+      {"BM_MixAdd", BM_MixAdd},
+      {"BM_MixScaleBuffer", BM_MixScaleBuffer},
+      {"BM_MixScaleBufferIncrement", BM_MixScaleBufferIncrement},
+      {"BM_MixAddScaleStride", BM_MixAddScaleStride},
+  };
+
+  for (const auto& k : kernels) {
+    for (snd_pcm_format_t fmt : kFormats) {
+      for (const bench::Isa& isa : bench::SupportedIsas()) {
+        std::string name = std::string(k.name) + "/" +
+                           snd_pcm_format_name(fmt) + "/" + isa.name;
+        benchmark::RegisterBenchmark(name.c_str(), k.fn, MixOps(isa), fmt)
+            ->ArgsProduct({bench::FrameCounts()});
+      }
+    }
+  }
+
+  for (bool swapped : {false, true}) {
+    for (snd_pcm_format_t fmt : kFormats) {
+      for (const bench::Isa& isa : bench::SupportedIsas()) {
+        std::string name =
+            std::string(swapped ? "BM_AreaCopySwapped" : "BM_AreaCopy") +
+            "/" + snd_pcm_format_name(fmt) + "/" + isa.name;
+        benchmark::RegisterBenchmark(name.c_str(), BM_AreaCopy,
+                                     isa.cpu_flags, fmt, swapped)
+            ->ArgsProduct({bench::FrameCounts()});
+      }
+    }
+  }
+  return 0;
+}
+
+const int registered = RegisterMixBenchmarks();
+
+}  // namespace
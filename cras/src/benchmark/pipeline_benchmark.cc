@@ -0,0 +1,366 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Runs the audio thread against empty iodevs with synthetic clients served
+// over the same audio sockets and shm as real ones, and reports how long the
+// thread takes to service each wake as the stream count grows.
+
+#include <benchmark/benchmark.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "benchmark_util.h"
+#include "server_util.h"
+
+extern "C" {
+#include "audio_thread.h"
+#include "cras_audio_format.h"
+#include "cras_empty_iodev.h"
+#include "cras_iodev.h"
+#include "cras_messages.h"
+#include "cras_rstream.h"
+#include "cras_shm.h"
+#include "cras_util.h"
+}
+
+namespace {
+
+// 10ms callbacks on a 20ms buffer of 48kHz stereo, as most clients use.
+const size_t kRate = 48000;
+const size_t kChannels = 2;
+const size_t kCbThreshold = 480;
+const size_t kBufferFrames = 2 * kCbThreshold;
+const size_t kFrameBytes = kChannels * 2;
+const std::chrono::seconds kRunTime(5);
+
+double ToUs(const struct timespec& ts) {
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+double UsBetween(const struct timespec& beg, const struct timespec& end) {
+  struct timespec diff;
+
+  subtract_timespecs(&end, &beg, &diff);
+  return ToUs(diff);
+}
+
+// What the audio thread does each wake. Only touched from the audio thread
+// while it runs, read once it has been joined.
+//    wake_ts - When the thread last woke.
+//    cpu_ts - CPU time of the thread when it last woke.
+//    wrote - Set once the device buffer was committed since the last wake.
+//    wake_to_write - From waking to committing the device buffer.
+//    wake_cpu - CPU time the thread spent from one wake to the next.
+struct WakeStats {
+  struct timespec wake_ts;
+  struct timespec cpu_ts;
+  bool wrote;
+  bench::Histogram wake_to_write;
+  bench::Histogram wake_cpu;
+};
+
+WakeStats* wake_stats;
+int (*empty_put_buffer)(struct cras_iodev* iodev, unsigned int frames);
+
+// Called by the audio thread each time it wakes.
+int OnWake(void* data, int revents) {
+  WakeStats* stats = static_cast<WakeStats*>(data);
+  struct timespec cpu;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+  if (timespec_is_nonzero(&stats->cpu_ts))
+    stats->wake_cpu.Add(UsBetween(stats->cpu_ts, cpu));
+  stats->cpu_ts = cpu;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &stats->wake_ts);
+  stats->wrote = false;
+  return 0;
+}
+
+// Commits the empty iodev buffer and notes the first commit of each wake.
+int PutBuffer(struct cras_iodev* iodev, unsigned int frames) {
+  struct timespec now;
+
+  if (wake_stats && !wake_stats->wrote &&
+      timespec_is_nonzero(&wake_stats->wake_ts)) {
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    wake_stats->wake_to_write.Add(UsBetween(wake_stats->wake_ts, now));
+    wake_stats->wrote = true;
+  }
+  return empty_put_buffer(iodev, frames);
+}
+
+// A synthetic client stream.
+//    stream - The server side of the stream.
+//    shm - The client mapping of the stream shm.
+//    fd - The client end of the audio socket.
+//    last_cb - When the last callback came, zero before the first.
+struct Client {
+  struct cras_rstream* stream;
+  struct cras_audio_shm* shm;
+  int fd;
+  struct timespec last_cb;
+};
+
+// Maps the shm of a stream the way a client does when it connects.
+int MapClientShm(struct cras_rstream* stream, struct cras_audio_shm** shm) {
+  struct cras_shm_info header_info, samples_info;
+  int header_fd, samples_fd, rc;
+
+  cras_rstream_get_shm_fds(stream, &header_fd, &samples_fd);
+  rc = cras_shm_info_init_with_fd(header_fd, cras_shm_header_size(),
+                                  &header_info);
+  if (rc < 0)
+    return rc;
+  rc = cras_shm_info_init_with_fd(
+      samples_fd, cras_rstream_get_samples_shm_size(stream), &samples_info);
+  if (rc < 0) {
+    cras_shm_info_cleanup(&header_info);
+    return rc;
+  }
+  rc = cras_audio_shm_create(
+      &header_info, &samples_info,
+      stream_uses_output(stream) ? PROT_WRITE : PROT_READ, shm);
+  if (rc < 0)
+    return rc;
+  cras_shm_copy_shared_config(*shm);
+  return 0;
+}
+
+int CreateClient(enum CRAS_STREAM_DIRECTION dir,
+                 unsigned int idx,
+                 const struct cras_audio_format* fmt,
+                 Client* client) {
+  struct cras_rstream_config config;
+  const uint64_t buffer_offsets[2] = {0, 0};
+  int fds[2], shm_fd = -1;
+  int rc;
+
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds))
+    return -errno;
+  cras_make_fd_nonblocking(fds[0]);
+  cras_make_fd_nonblocking(fds[1]);
+
+  cras_rstream_config_init(NULL, cras_get_stream_id(1, idx),
+                           CRAS_STREAM_TYPE_DEFAULT, CRAS_CLIENT_TYPE_TEST, dir,
+                           NO_DEVICE, 0, 0, fmt, kBufferFrames, kCbThreshold,
+                           &fds[0], &shm_fd, 0, buffer_offsets, &config);
+  rc = cras_rstream_create(&config, &client->stream);
+  cras_rstream_config_cleanup(&config);
+  if (rc < 0) {
+    close(fds[1]);
+    return rc;
+  }
+  rc = MapClientShm(client->stream, &client->shm);
+  if (rc < 0) {
+    cras_rstream_destroy(client->stream);
+    close(fds[1]);
+    return rc;
+  }
+  client->fd = fds[1];
+  client->last_cb = {0, 0};
+  return 0;
+}
+
+void DestroyClient(Client* client) {
+  close(client->fd);
+  cras_audio_shm_destroy(client->shm);
+  cras_rstream_destroy(client->stream);
+}
+
+// Answers one audio message like cras_client does, with random samples for
+// playback. Records how far the callback strayed from its period.
+void ServeClient(Client* client,
+                 const std::vector<uint8_t>& samples,
+                 bench::Histogram* jitter) {
+  const double period_us = 1e6 * kCbThreshold / kRate;
+  struct audio_message msg;
+  struct timespec now;
+  unsigned int frames;
+
+  while (read(client->fd, &msg, sizeof(msg)) == sizeof(msg)) {
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    if (timespec_is_nonzero(&client->last_cb))
+      jitter->Add(std::abs(UsBetween(client->last_cb, now) - period_us));
+    client->last_cb = now;
+
+    frames = std::min<unsigned int>(msg.frames, kCbThreshold);
+    if (msg.id == AUDIO_MESSAGE_REQUEST_DATA) {
+      memcpy(cras_shm_get_write_buffer_base(client->shm), samples.data(),
+             frames * kFrameBytes);
+      cras_shm_buffer_written_start(client->shm, frames);
+      msg.id = AUDIO_MESSAGE_DATA_READY;
+    } else if (msg.id == AUDIO_MESSAGE_DATA_READY) {
+      if (cras_shm_get_curr_read_frames(client->shm) < frames)
+        frames = 0;
+      cras_shm_buffer_read_current(client->shm, frames);
+      msg.id = AUDIO_MESSAGE_DATA_CAPTURED;
+    } else {
+      continue;
+    }
+    msg.frames = frames;
+    msg.error = 0;
+    if (write(client->fd, &msg, sizeof(msg)) != sizeof(msg))
+      return;
+  }
+}
+
+// Serves all clients from one thread until stop is set.
+void RunClients(std::vector<Client>* clients,
+                const std::atomic<bool>* stop,
+                bench::Histogram* jitter) {
+  std::vector<uint8_t> samples =
+      bench::RandomSamples(SND_PCM_FORMAT_S16_LE, kCbThreshold * kFrameBytes);
+  std::vector<struct epoll_event> events(clients->size());
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  int i, n;
+
+  for (Client& client : *clients) {
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &client;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client.fd, &ev);
+  }
+  while (!*stop) {
+    n = epoll_wait(epoll_fd, events.data(), events.size(), 100);
+    for (i = 0; i < n; i++)
+      ServeClient(static_cast<Client*>(events[i].data.ptr), samples,
+                  jitter);
+  }
+  close(epoll_fd);
+}
+
+// Runs num_streams streams of direction dir through the audio thread for
+// kRunTime. state.range(0) is the stream count.
+void BM_Pipeline(benchmark::State& state, enum CRAS_STREAM_DIRECTION dir) {
+  const unsigned int num_streams = state.range(0);
+  const size_t expected_wakes =
+      4 * num_streams * kRate * kRunTime.count() / kCbThreshold;
+  struct cras_audio_format fmt;
+  struct audio_thread* thread;
+  struct cras_iodev* iodev;
+  std::vector<Client> clients(num_streams);
+  std::atomic<bool> stop(false);
+  bench::Histogram jitter;
+  WakeStats stats = {};
+  unsigned int i, missed_cbs = 0;
+  int wake_fd;
+
+  bench::InitServer();
+  cras_audio_format_set_default_channel_layout(&fmt);
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = kRate;
+  fmt.num_channels = kChannels;
+  stats.wake_to_write.Reserve(expected_wakes);
+  stats.wake_cpu.Reserve(expected_wakes);
+  jitter.Reserve(expected_wakes);
+
+  // The thread goes first, opening a device logs to its event log.
+  thread = audio_thread_create();
+  if (!thread)
+    return state.SkipWithError("Failed to create audio thread");
+  iodev = empty_iodev_create(dir, CRAS_NODE_TYPE_UNKNOWN);
+  if (!iodev || cras_iodev_open(iodev, kCbThreshold, &fmt)) {
+    if (iodev)
+      empty_iodev_destroy(iodev);
+    audio_thread_destroy(thread);
+    return state.SkipWithError("Failed to open empty iodev");
+  }
+  empty_put_buffer = iodev->put_buffer;
+  iodev->put_buffer = PutBuffer;
+
+  wake_fd = eventfd(0, EFD_CLOEXEC);
+  audio_thread_add_events_callback(thread, wake_fd, OnWake, &stats, POLLIN);
+  audio_thread_config_events_callback(thread, wake_fd, TRIGGER_WAKEUP);
+  wake_stats = &stats;
+  audio_thread_start(thread);
+  audio_thread_add_open_dev(thread, iodev);
+
+  for (i = 0; i < num_streams; i++) {
+    if (CreateClient(dir, i, &fmt, &clients[i])) {
+      clients.resize(i);
+      break;
+    }
+  }
+  std::thread client_thread(RunClients, &clients, &stop, &jitter);
+  for (Client& client : clients)
+    audio_thread_add_stream(thread, client.stream, &iodev, 1);
+
+  for (auto _ : state) {
+    if (clients.size() != num_streams) {
+      state.SkipWithError("Failed to create streams");
+      break;
+    }
+    std::this_thread::sleep_for(kRunTime);
+  }
+
+  for (Client& client : clients)
+    audio_thread_disconnect_stream(thread, client.stream, iodev);
+  audio_thread_rm_open_dev(thread, dir, iodev->info.idx);
+  // Destroying the thread drops its callbacks.
+  audio_thread_destroy(thread);
+  wake_stats = NULL;
+  close(wake_fd);
+  stop = true;
+  client_thread.join();
+
+  for (Client& client : clients) {
+    missed_cbs += client.stream->num_missed_cb;
+    DestroyClient(&client);
+  }
+
+  stats.wake_to_write.Report(state, "wake_to_write");
+  stats.wake_cpu.Report(state, "wake_cpu");
+  jitter.Report(state, "cb_jitter");
+  state.counters["wakes_per_sec"] =
+      stats.wake_cpu.Count() / (double)kRunTime.count();
+  state.counters["cpu_util"] = stats.wake_cpu.Sum() / 1e6 / kRunTime.count();
+  state.counters["underruns"] = iodev->num_underruns;
+  state.counters["severe_underruns"] =
+      cras_iodev_get_num_severe_underruns(iodev);
+  state.counters["missed_cbs"] = missed_cbs;
+
+  cras_iodev_close(iodev);
+  cras_iodev_free_format(iodev);
+  empty_iodev_destroy(iodev);
+}
+
+// Registers playback and capture, named BM_Pipeline/<direction>/streams:N
+// for 1 to 64 streams.
+int RegisterPipelineBenchmarks() {
+  static const struct {
+    const char* name;
+    enum CRAS_STREAM_DIRECTION dir;
+  } directions[] = {
+      {"playback", CRAS_STREAM_OUTPUT},
+      {"capture", CRAS_STREAM_INPUT},
+  };
+
+  for (const auto& d : directions) {
+    std::string name = std::string("BM_Pipeline/") + d.name;
+    benchmark::RegisterBenchmark(name.c_str(), BM_Pipeline, d.dir)
+        ->ArgName("streams")
+        ->RangeMultiplier(2)
+        ->Range(1, 64)
+        ->Iterations(1)
+        ->UseRealTime()
+        ->Unit(benchmark::kMillisecond);
+  }
+  return 0;
+}
+
+const int registered = RegisterPipelineBenchmarks();
+
+}  // namespace
@@ -0,0 +1,48 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "server_util.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "benchmark_util.h"
+
+extern "C" {
+#include "cras_fmt_conv.h"
+#include "cras_main_message.h"
+#include "cras_mix.h"
+#include "cras_observer.h"
+#include "cras_system_state.h"
+#include "linear_resampler.h"
+}
+
+namespace bench {
+
+void InitServer() {
+  static bool done = [] {
+    static struct cras_server_state exp_state;
+    char shm_name[NAME_MAX];
+    unsigned int cpu_flags = 0;
+
+    snprintf(shm_name, sizeof(shm_name), "/cras-bench-%d", getpid());
+    cras_system_state_init("/tmp", shm_name, open("/dev/null", O_RDWR),
+                           open("/dev/null", O_RDONLY), &exp_state,
+                           sizeof(exp_state));
+    cras_observer_server_init();
+    cras_main_message_init();
+
+    for (const Isa& isa : SupportedIsas())
+      cpu_flags |= isa.cpu_flags;
+    cras_mix_init(cpu_flags);
+    cras_fmt_conv_init(cpu_flags);
+    linear_resampler_init(cpu_flags);
+    return true;
+  }();
+  (void)done;
+}
+
+}  // namespace bench
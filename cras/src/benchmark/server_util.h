@@ -0,0 +1,16 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CRAS_BENCHMARK_SERVER_UTIL_H_
+#define CRAS_BENCHMARK_SERVER_UTIL_H_
+
+namespace bench {
+
+// Brings up the system state, observers, main messages and the SIMD ops of
+// the server, once, for benchmarks that run server code.
+void InitServer();
+
+}  // namespace bench
+
+#endif  // CRAS_BENCHMARK_SERVER_UTIL_H_
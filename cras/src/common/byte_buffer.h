@@ -10,21 +10,25 @@
 #include <stdlib.h>
 #include <sys/param.h>
 
+#include "cras_util.h"
+
+/* The bytes start on a CRAS_BUF_ALIGN boundary so vector kernels working on
+ * them from the start of the buffer get aligned loads. */
 struct byte_buffer {
 	unsigned int write_idx;
 	unsigned int read_idx;
 	unsigned int level;
 	unsigned int max_size;
 	unsigned int used_size;
-	uint8_t bytes[];
+	uint8_t bytes[] __attribute__((aligned(CRAS_BUF_ALIGN)));
 };
 
 /* Create a byte buffer to hold buffer_size_bytes worth of data. */
 static inline struct byte_buffer *byte_buffer_create(size_t buffer_size_bytes)
 {
 	struct byte_buffer *buf;
-	buf = (struct byte_buffer *)calloc(1, sizeof(struct byte_buffer) +
-						      buffer_size_bytes);
+	buf = (struct byte_buffer *)cras_aligned_calloc(
+		sizeof(struct byte_buffer) + buffer_size_bytes);
 	if (!buf)
 		return buf;
 	buf->max_size = buffer_size_bytes;
@@ -14,6 +14,7 @@
 #define CRAS_SERVER_RT_THREAD_PRIORITY 12
 #define CRAS_CLIENT_RT_THREAD_PRIORITY 10
 #define CRAS_CLIENT_NICENESS_LEVEL -10
+#define CRAS_MAX_AUDIO_THREADS 4
 #define CRAS_SOCKET_FILE ".cras_socket"
 #define CRAS_PLAYBACK_SOCKET_FILE ".cras_playback"
 #define CRAS_CAPTURE_SOCKET_FILE ".cras_capture"
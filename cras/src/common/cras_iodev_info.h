@@ -20,12 +20,18 @@
  *    name - Name displayed to the user.
  *    stable_id - ID that does not change due to device plug/unplug or reboot.
  *    max_supported_channels - Max supported channel count of this device.
+ *    preferred_rate, preferred_num_channels, preferred_format - The format the
+ *        device last opened with. Streams in this format play or record
+ *        without conversion. Zero until the device has been opened once.
  */
 struct __attribute__((__packed__)) cras_iodev_info {
 	uint32_t idx;
 	char name[CRAS_IODEV_NAME_BUFFER_SIZE];
 	uint32_t stable_id;
 	uint32_t max_supported_channels;
+	uint32_t preferred_rate;
+	uint32_t preferred_num_channels;
+	int32_t preferred_format;
 };
 
 /* Identifying information about an ionode on an iodev.
@@ -9,6 +9,7 @@
 #ifndef CRAS_MESSAGES_H_
 #define CRAS_MESSAGES_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "cras_iodev_info.h"
@@ -16,13 +17,14 @@
 
 /* Rev when message format changes. If new messages are added, or message ID
  * values change. */
-#define CRAS_PROTO_VER 7
-#define CRAS_SERV_MAX_MSG_SIZE 256
+#define CRAS_PROTO_VER 11
+#define CRAS_SERV_MAX_MSG_SIZE 1024
 #define CRAS_CLIENT_MAX_MSG_SIZE 256
 #define CRAS_MAX_HOTWORD_MODELS 243
 #define CRAS_MAX_REMIX_CHANNELS 8
 #define CRAS_MAX_TEST_DATA_LEN 224
 #define CRAS_AEC_DUMP_FILE_NAME_LEN 128
+#define CRAS_MAX_BATCH_STREAMS 8
 
 /* Message IDs. */
 enum CRAS_SERVER_MESSAGE_ID {
@@ -59,6 +61,10 @@ enum CRAS_SERVER_MESSAGE_ID {
 	CRAS_SERVER_SET_BT_WBS_ENABLED,
 	CRAS_SERVER_GET_ATLOG_FD,
 	CRAS_SERVER_DUMP_MAIN,
+	CRAS_SERVER_CONNECT_STREAMS,
+	CRAS_SERVER_DISCONNECT_STREAMS,
+	CRAS_SERVER_SET_STREAM_EFFECTS,
+	CRAS_SERVER_SET_STREAM_PAUSED,
 };
 
 enum CRAS_CLIENT_MESSAGE_ID {
@@ -118,7 +124,29 @@ struct __attribute__((__packed__)) cras_connect_message {
 	/* Initial values for shm samples buffer offsets. These will be 0 for
 	 * streams that do not use client-provided shm */
 	uint64_t buffer_offsets[2];
-};
+	/* Number of buffers in the samples shm, 0 for the default. Added in
+	 * CRAS_PROTO_VER 8, older clients leave it out of the message. */
+	uint32_t num_shm_buffers;
+	/* CLOCK_MONOTONIC_RAW time the first frame of the stream should play
+	 * at, zero to play right away. Added in CRAS_PROTO_VER 10. */
+	struct cras_timespec scheduled_ts;
+	/* Frames captured before an input stream connected that it starts
+	 * with, taken from the history the device keeps. Added in
+	 * CRAS_PROTO_VER 11. */
+	uint32_t pre_roll_frames;
+};
+
+/* Size of a connect message from a client older than CRAS_PROTO_VER 8. */
+#define CRAS_CONNECT_MESSAGE_V7_SIZE                                           \
+	offsetof(struct cras_connect_message, num_shm_buffers)
+
+/* Size of a connect message from a client older than CRAS_PROTO_VER 10. */
+#define CRAS_CONNECT_MESSAGE_V9_SIZE                                           \
+	offsetof(struct cras_connect_message, scheduled_ts)
+
+/* Size of a connect message from a client older than CRAS_PROTO_VER 11. */
+#define CRAS_CONNECT_MESSAGE_V10_SIZE                                          \
+	offsetof(struct cras_connect_message, pre_roll_frames)
 
 static inline void cras_fill_connect_message(
 	struct cras_connect_message *m, enum CRAS_STREAM_DIRECTION direction,
@@ -141,6 +169,10 @@ static inline void cras_fill_connect_message(
 	m->client_shm_size = 0;
 	m->buffer_offsets[0] = 0;
 	m->buffer_offsets[1] = 0;
+	m->num_shm_buffers = 0;
+	m->scheduled_ts.tv_sec = 0;
+	m->scheduled_ts.tv_nsec = 0;
+	m->pre_roll_frames = 0;
 	m->header.id = CRAS_SERVER_CONNECT_STREAM;
 	m->header.length = sizeof(struct cras_connect_message);
 }
@@ -159,6 +191,91 @@ cras_fill_disconnect_stream_message(struct cras_disconnect_stream_message *m,
 	m->header.length = sizeof(struct cras_disconnect_stream_message);
 }
 
+/* Sent by a client to connect several streams at once. The audio fd of each
+ * stream is attached to the message in the same order as streams. Streams
+ * using client-provided shm can't be connected this way. The server replies
+ * with one CRAS_CLIENT_STREAM_CONNECTED message per stream. */
+struct __attribute__((__packed__)) cras_connect_streams_message {
+	struct cras_server_message header;
+	uint32_t num_streams;
+	struct cras_connect_message streams[CRAS_MAX_BATCH_STREAMS];
+};
+
+/* Size of a connect streams message carrying n streams. */
+#define CRAS_CONNECT_STREAMS_MESSAGE_SIZE(n)                                   \
+	(offsetof(struct cras_connect_streams_message, streams) +              \
+	 (n) * sizeof(struct cras_connect_message))
+
+/* Sets the header of a connect streams message carrying num_streams streams,
+ * each already filled with cras_fill_connect_message(). */
+static inline void
+cras_fill_connect_streams_message(struct cras_connect_streams_message *m,
+				  unsigned int num_streams)
+{
+	m->num_streams = num_streams;
+	m->header.id = CRAS_SERVER_CONNECT_STREAMS;
+	m->header.length = CRAS_CONNECT_STREAMS_MESSAGE_SIZE(num_streams);
+}
+
+/* Sent by a client to remove several streams at once. */
+struct __attribute__((__packed__)) cras_disconnect_streams_message {
+	struct cras_server_message header;
+	uint32_t num_streams;
+	cras_stream_id_t stream_ids[CRAS_MAX_BATCH_STREAMS];
+};
+static inline void
+cras_fill_disconnect_streams_message(struct cras_disconnect_streams_message *m,
+				     const cras_stream_id_t *stream_ids,
+				     unsigned int num_streams)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_streams; i++)
+		m->stream_ids[i] = stream_ids[i];
+	m->num_streams = num_streams;
+	m->header.id = CRAS_SERVER_DISCONNECT_STREAMS;
+	m->header.length = sizeof(struct cras_disconnect_streams_message);
+}
+
+/* Sent by a client to change the effects of one of its running input
+ * streams, without reconnecting it. */
+struct __attribute__((__packed__)) cras_set_stream_effects_message {
+	struct cras_server_message header;
+	cras_stream_id_t stream_id;
+	uint64_t effects;
+};
+static inline void
+cras_fill_set_stream_effects_message(struct cras_set_stream_effects_message *m,
+				     cras_stream_id_t stream_id,
+				     uint64_t effects)
+{
+	m->stream_id = stream_id;
+	m->effects = effects;
+	m->header.id = CRAS_SERVER_SET_STREAM_EFFECTS;
+	m->header.length = sizeof(struct cras_set_stream_effects_message);
+}
+
+/* Sent by a client to pause or resume one of its streams. A paused stream
+ * stays connected with its shm, but isn't asked for or sent any frames.
+ * Output streams resume fading in over fade_in_ms. */
+struct __attribute__((__packed__)) cras_set_stream_paused_message {
+	struct cras_server_message header;
+	cras_stream_id_t stream_id;
+	uint32_t paused;
+	uint32_t fade_in_ms;
+};
+static inline void
+cras_fill_set_stream_paused_message(struct cras_set_stream_paused_message *m,
+				    cras_stream_id_t stream_id, int paused,
+				    unsigned int fade_in_ms)
+{
+	m->stream_id = stream_id;
+	m->paused = paused;
+	m->fade_in_ms = fade_in_ms;
+	m->header.id = CRAS_SERVER_SET_STREAM_PAUSED;
+	m->header.length = sizeof(struct cras_set_stream_paused_message);
+}
+
 /* Move streams of "type" to the iodev at "iodev_idx". */
 struct __attribute__((__packed__)) cras_switch_stream_type_iodev {
 	struct cras_server_message header;
@@ -41,6 +41,34 @@ void cras_metrics_log_sparse_histogram(const char *name, int sample)
 	CMetricsLibraryDelete(handle);
 }
 
+void cras_metrics_log_histogram_repeated(const char *name, int sample, int min,
+					 int max, int nbuckets,
+					 unsigned int count)
+{
+	CMetricsLibrary handle;
+	unsigned int i;
+
+	syslog(LOG_DEBUG, "UMA name: %s, %u samples", name, count);
+	handle = CMetricsLibraryNew();
+	for (i = 0; i < count; i++)
+		CMetricsLibrarySendToUMA(handle, name, sample, min, max,
+					 nbuckets);
+	CMetricsLibraryDelete(handle);
+}
+
+void cras_metrics_log_sparse_histogram_repeated(const char *name, int sample,
+						unsigned int count)
+{
+	CMetricsLibrary handle;
+	unsigned int i;
+
+	syslog(LOG_DEBUG, "UMA name: %s, %u samples", name, count);
+	handle = CMetricsLibraryNew();
+	for (i = 0; i < count; i++)
+		CMetricsLibrarySendSparseToUMA(handle, name, sample);
+	CMetricsLibraryDelete(handle);
+}
+
 #else
 void cras_metrics_log_event(const char *event)
 {
@@ -55,4 +83,13 @@ void cras_metrics_log_enum_histogram(const char *name, int sample, int max)
 void cras_metrics_log_sparse_histogram(const char *name, int sample)
 {
 }
+void cras_metrics_log_histogram_repeated(const char *name, int sample, int min,
+					 int max, int nbuckets,
+					 unsigned int count)
+{
+}
+void cras_metrics_log_sparse_histogram_repeated(const char *name, int sample,
+						unsigned int count)
+{
+}
 #endif
@@ -16,4 +16,13 @@ void cras_metrics_log_histogram(const char *name, int sample, int min, int max,
 /* Sends sparse histogram data. */
 void cras_metrics_log_sparse_histogram(const char *name, int sample);
 
+/* Sends count samples of the same histogram data. */
+void cras_metrics_log_histogram_repeated(const char *name, int sample, int min,
+					 int max, int nbuckets,
+					 unsigned int count);
+
+/* Sends count samples of the same sparse histogram data. */
+void cras_metrics_log_sparse_histogram_repeated(const char *name, int sample,
+						unsigned int count);
+
 #endif /* CRAS_METRICS_H_ */
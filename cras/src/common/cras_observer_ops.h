@@ -54,6 +54,10 @@ struct cras_observer_ops {
 	/* Hotword triggered. */
 	void (*hotword_triggered)(void *context, int64_t tv_sec,
 				  int64_t tv_nsec);
+	/* A hotword model load asked for on node_id is done, error is 0 on
+	 * success or a negative errno. */
+	void (*hotword_model_loaded)(void *context, cras_node_id_t node_id,
+				     const char *model_name, int error);
 	/* State regarding whether non-empty audio is being played/captured has
 	 * changed. */
 	void (*non_empty_audio_state_changed)(void *context, int non_empty);
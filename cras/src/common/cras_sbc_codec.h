@@ -41,4 +41,12 @@ int cras_sbc_get_codesize(struct cras_audio_codec *codec);
  */
 int cras_sbc_get_frame_length(struct cras_audio_codec *codec);
 
+/* Changes the bitpool of an sbc encoder. Takes effect from the next encoded
+ * frame, and changes frame_length but not codesize.
+ * Args:
+ *    codec: the codec to change.
+ *    bitpool: the new bitpool.
+ */
+void cras_sbc_set_bitpool(struct cras_audio_codec *codec, uint8_t bitpool);
+
 #endif /* COMMON_CRAS_SBC_CODEC_H_ */
@@ -7,61 +7,169 @@
 #define CRAS_SHM_H_
 
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/param.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include "cras_types.h"
 #include "cras_util.h"
 
-#define CRAS_NUM_SHM_BUFFERS 2U /* double buffer */
+#define CRAS_NUM_SHM_BUFFERS 2U /* default, double buffer */
 #define CRAS_SHM_BUFFERS_MASK (CRAS_NUM_SHM_BUFFERS - 1)
+#define CRAS_MAX_SHM_BUFFERS 8U
+/* Bumped whenever the layout of cras_audio_shm_header changes. */
+#define CRAS_SHM_LAYOUT_VERSION 5
+/* Bumped whenever the content of cras_audio_shm_telemetry changes. */
+#define CRAS_SHM_TELEMETRY_VERSION 2
+/* Times a reader copies the telemetry before giving up on a busy writer. */
+#define CRAS_SHM_TELEMETRY_TRIES 4
 
 /* Configuration of the shm area.
  *
  *  used_size - The size in bytes of the sample area being actively used.
  *  frame_bytes - The size of each frame in bytes.
+ *  num_buffers - Number of buffers in the ring, a power of two no more than
+ *    CRAS_MAX_SHM_BUFFERS. 0 means CRAS_NUM_SHM_BUFFERS.
+ *  layout_version - CRAS_SHM_LAYOUT_VERSION of the server that set up the
+ *    header. Kept at the same offset in every layout.
  */
 struct __attribute__((__packed__)) cras_audio_shm_config {
 	uint32_t used_size;
 	uint32_t frame_bytes;
+	uint32_t num_buffers;
+	uint32_t layout_version;
+};
+
+/* Timing and levels of a stream as seen by the server, so clients can
+ * compensate A/V sync and show level meters without polling debug info or
+ * opening streams of their own. The server refreshes it each time it sets
+ * the time stamp of the stream. Only the server writes it, seq is odd while
+ * it does so clients can read it without a lock.
+ *
+ *  seq - Update count, odd while an update is in progress.
+ *  version - CRAS_SHM_TELEMETRY_VERSION, 0 until the server first fills it.
+ *  dev_delay_frames - Delay of the device hardware, in device frames.
+ *  dsp_delay_frames - Delay of the device DSP pipeline, in device frames.
+ *  src_delay_frames - Delay of the stream sample rate converter, in stream
+ *    frames.
+ *  dev_rate - Nominal frame rate of the device, for the device delays.
+ *  rate_ratio - Estimated rate of the device over its nominal rate.
+ *  num_overruns - Times samples of the stream were overwritten before being
+ *    read.
+ *  num_underruns - Times the device ran out of samples to play.
+ *  ts - Time of the update, CLOCK_MONOTONIC_RAW.
+ *  stream_power - Moving average of the mean square of the samples of the
+ *    stream, in [0, 1]. Samples are scaled to [-1, 1).
+ *  stream_peak - Largest sample magnitude of the last stream buffer metered.
+ *  dev_power - As stream_power, for the device the stream is attached to.
+ *    Output devices are metered before their DSP, input devices after it.
+ *  dev_peak - As stream_peak, for the device.
+ */
+struct __attribute__((__packed__)) cras_audio_shm_telemetry {
+	uint32_t seq;
+	uint32_t version;
+	uint32_t dev_delay_frames;
+	uint32_t dsp_delay_frames;
+	uint32_t src_delay_frames;
+	uint32_t dev_rate;
+	double rate_ratio;
+	uint32_t num_overruns;
+	uint32_t num_underruns;
+	struct cras_timespec ts;
+	float stream_power;
+	float stream_peak;
+	float dev_power;
+	float dev_peak;
 };
 
 /* Structure containing stream metadata shared between client and server.
+ * The header is mapped page aligned. Fields are grouped by who writes them
+ * and each group starts on its own CRAS_SHM_CACHE_LINE, so the reader moving
+ * its offsets doesn't keep pulling the line the writer is updating away from
+ * the other side. The struct stays packed so 32 and 64 bit peers agree on
+ * the layout, the padding is explicit.
  *
  *  config - Size config data.  A copy of the config shared with clients.
- *  read_buf_idx - index of the current buffer to read from (0 or 1 if double
- *    buffered).
- *  write_buf_idx - index of the current buffer to write to (0 or 1 if double
- *    buffered).
+ *  volume_scaler - volume scaling factor (0.0-1.0).
+ *  muted - bool, true if stream should be muted.
+ *  wake_enabled - Set by the server when requests and replies of a SHM_WAKE
+ *    stream go through wake_seq rather than audio messages.
+ *  buffer_offset - Offset of each buffer from start of samples area.
+ *                  Valid range: 0 <= buffer_offset <= shm->samples_info.length
+ *  read_buf_idx - index of the current buffer to read from, in
+ *    0..num_buffers - 1. Only moved by the reader.
  *  read_offset - offset of the next sample to read (one per buffer).
+ *  write_buf_idx - index of the current buffer to write to, in
+ *    0..num_buffers - 1. Only moved by the writer, once the samples and
+ *    write_offset of the buffer it leaves are in place.
  *  write_offset - offset of the next sample to write (one per buffer).
  *  write_in_progress - non-zero when a write is in progress.
- *  volume_scaler - volume scaling factor (0.0-1.0).
- *  muted - bool, true if stream should be muted.
  *  num_overruns - Starting at 0 this is incremented very time data is over
  *    written because too much accumulated before a read.
  *  ts - For capture, the time stamp of the next sample at read_index.  For
  *    playback, this is the time that the next sample written will be played.
  *    This is only valid in audio callbacks.
- *  buffer_offset - Offset of each buffer from start of samples area.
- *                  Valid range: 0 <= buffer_offset <= shm->samples_info.length
+ *  callback_pending - Set by the server when it asks the client for samples,
+ *    cleared by the client when it replies.
+ *  wake_seq - Futex word bumped by the server each time it requests or hands
+ *    over samples. The client replies by clearing callback_pending.
+ *  wake_frames - Frames requested or handed over by the last wake.
+ *  vad_active - For VAD_GATED streams, non-zero while the server hears voice
+ *    and passes samples on. 0 for other streams.
+ *  vad_seq - Futex word bumped by the server each time vad_active changes.
+ *  telemetry - Timing of the stream, see cras_audio_shm_telemetry.
  */
+#define CRAS_SHM_CACHE_LINE 64
 struct __attribute__((__packed__)) cras_audio_shm_header {
+	/* Set up with the stream, then rarely written. */
 	struct cras_audio_shm_config config;
-	uint32_t read_buf_idx; /* use buffer A or B */
-	uint32_t write_buf_idx;
-	uint32_t read_offset[CRAS_NUM_SHM_BUFFERS];
-	uint32_t write_offset[CRAS_NUM_SHM_BUFFERS];
-	int32_t write_in_progress[CRAS_NUM_SHM_BUFFERS];
 	float volume_scaler;
 	int32_t mute;
-	int32_t callback_pending;
+	uint32_t wake_enabled;
+	uint8_t pad_setup[36];
+	uint64_t buffer_offset[CRAS_MAX_SHM_BUFFERS];
+	/* Written by the reader. */
+	uint32_t read_buf_idx;
+	uint32_t read_offset[CRAS_MAX_SHM_BUFFERS];
+	uint8_t pad_reader[28];
+	/* Written by the writer. */
+	uint32_t write_buf_idx;
+	uint32_t write_offset[CRAS_MAX_SHM_BUFFERS];
+	int32_t write_in_progress[CRAS_MAX_SHM_BUFFERS];
 	uint32_t num_overruns;
 	struct cras_timespec ts;
-	uint64_t buffer_offset[CRAS_NUM_SHM_BUFFERS];
+	uint8_t pad_writer[40];
+	/* Handshake between server and client. */
+	int32_t callback_pending;
+	uint32_t wake_seq;
+	uint32_t wake_frames;
+	uint32_t vad_active;
+	uint32_t vad_seq;
+	uint8_t pad_wake[44];
+	/* Written by the server, read by clients. */
+	struct cras_audio_shm_telemetry telemetry;
+	uint8_t pad_telemetry[56];
 };
 
+#define CRAS_SHM_STARTS_LINE(field)                                            \
+	(offsetof(struct cras_audio_shm_header, field) %                       \
+		 CRAS_SHM_CACHE_LINE ==                                        \
+	 0)
+static_assert(CRAS_SHM_STARTS_LINE(buffer_offset), "Misaligned buffer_offset");
+static_assert(CRAS_SHM_STARTS_LINE(read_buf_idx), "Misaligned reader fields");
+static_assert(CRAS_SHM_STARTS_LINE(write_buf_idx), "Misaligned writer fields");
+static_assert(CRAS_SHM_STARTS_LINE(callback_pending), "Misaligned wake fields");
+static_assert(CRAS_SHM_STARTS_LINE(telemetry), "Misaligned telemetry");
+static_assert(sizeof(struct cras_audio_shm_header) % CRAS_SHM_CACHE_LINE == 0,
+	      "Header must end on a cache line");
+
 /* Returns the number of bytes needed to hold a cras_audio_shm_header. */
 static inline uint32_t cras_shm_header_size()
 {
@@ -69,10 +177,19 @@ static inline uint32_t cras_shm_header_size()
 }
 
 /* Returns the number of bytes needed to hold the samples area for an audio
- * shm with the given used_size */
-static inline uint32_t cras_shm_calculate_samples_size(uint32_t used_size)
+ * shm with the given used_size and number of buffers, 0 for the default. */
+static inline uint32_t cras_shm_calculate_samples_size(uint32_t used_size,
+						       uint32_t num_buffers)
 {
-	return used_size * CRAS_NUM_SHM_BUFFERS;
+	return used_size * (num_buffers ?: CRAS_NUM_SHM_BUFFERS);
+}
+
+/* Returns non-zero if num_buffers can be used for the ring. */
+static inline int cras_shm_num_buffers_valid(uint32_t num_buffers)
+{
+	return num_buffers == 0 ||
+	       (num_buffers <= CRAS_MAX_SHM_BUFFERS &&
+		(num_buffers & (num_buffers - 1)) == 0);
 }
 
 /* Holds identifiers for a shm segment. All valid cras_shm_info objects will
@@ -159,6 +276,38 @@ int cras_audio_shm_create(struct cras_shm_info *header_info,
  */
 void cras_audio_shm_destroy(struct cras_audio_shm *shm);
 
+/* Returns the number of buffers in the ring. */
+static inline unsigned cras_shm_num_buffers(const struct cras_audio_shm *shm)
+{
+	unsigned num_buffers = shm->config.num_buffers;
+
+	if (num_buffers == 0 || !cras_shm_num_buffers_valid(num_buffers))
+		return CRAS_NUM_SHM_BUFFERS;
+	return num_buffers;
+}
+
+/* Returns the mask wrapping a buffer index around the ring. */
+static inline unsigned cras_shm_buffers_mask(const struct cras_audio_shm *shm)
+{
+	return cras_shm_num_buffers(shm) - 1;
+}
+
+/* Returns the buffer the reader is on. Pairs with the release store in
+ * cras_shm_buffer_read(). */
+static inline unsigned cras_shm_read_buf_idx(const struct cras_audio_shm *shm)
+{
+	return __atomic_load_n(&shm->header->read_buf_idx, __ATOMIC_ACQUIRE) &
+	       cras_shm_buffers_mask(shm);
+}
+
+/* Returns the buffer the writer is on. Pairs with the release store in
+ * cras_shm_buffer_write_complete(). */
+static inline unsigned cras_shm_write_buf_idx(const struct cras_audio_shm *shm)
+{
+	return __atomic_load_n(&shm->header->write_buf_idx, __ATOMIC_ACQUIRE) &
+	       cras_shm_buffers_mask(shm);
+}
+
 /* Limit a buffer offset to within the samples area size. */
 static inline unsigned
 cras_shm_get_checked_buffer_offset(const struct cras_audio_shm *shm,
@@ -174,8 +323,8 @@ cras_shm_get_checked_buffer_offset(const struct cras_audio_shm *shm,
 static inline uint8_t *cras_shm_buff_for_idx(const struct cras_audio_shm *shm,
 					     size_t idx)
 {
-	assert_on_compile_is_power_of_2(CRAS_NUM_SHM_BUFFERS);
-	idx = idx & CRAS_SHM_BUFFERS_MASK;
+	assert_on_compile_is_power_of_2(CRAS_MAX_SHM_BUFFERS);
+	idx = idx & cras_shm_buffers_mask(shm);
 
 	return shm->samples + cras_shm_get_checked_buffer_offset(shm, idx);
 }
@@ -224,7 +373,7 @@ cras_shm_get_checked_write_offset(const struct cras_audio_shm *shm,
 static inline unsigned
 cras_shm_get_curr_read_frames(const struct cras_audio_shm *shm)
 {
-	unsigned buf_idx = shm->header->read_buf_idx & CRAS_SHM_BUFFERS_MASK;
+	unsigned buf_idx = cras_shm_read_buf_idx(shm);
 	unsigned read_offset, write_offset;
 
 	read_offset = cras_shm_get_checked_read_offset(shm, buf_idx);
@@ -240,7 +389,7 @@ cras_shm_get_curr_read_frames(const struct cras_audio_shm *shm)
 static inline uint8_t *
 cras_shm_get_read_buffer_base(const struct cras_audio_shm *shm)
 {
-	unsigned i = shm->header->read_buf_idx & CRAS_SHM_BUFFERS_MASK;
+	unsigned i = cras_shm_read_buf_idx(shm);
 	return cras_shm_buff_for_idx(shm, i);
 }
 
@@ -248,7 +397,7 @@ cras_shm_get_read_buffer_base(const struct cras_audio_shm *shm)
 static inline uint8_t *
 cras_shm_get_write_buffer_base(const struct cras_audio_shm *shm)
 {
-	unsigned i = shm->header->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
+	unsigned i = cras_shm_write_buf_idx(shm);
 
 	return cras_shm_buff_for_idx(shm, i);
 }
@@ -258,7 +407,7 @@ static inline uint8_t *
 cras_shm_get_writeable_frames(const struct cras_audio_shm *shm,
 			      unsigned limit_frames, unsigned *frames)
 {
-	unsigned buf_idx = shm->header->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
+	unsigned buf_idx = cras_shm_write_buf_idx(shm);
 	unsigned write_offset;
 	const unsigned frame_bytes = shm->config.frame_bytes;
 	unsigned written;
@@ -276,32 +425,32 @@ cras_shm_get_writeable_frames(const struct cras_audio_shm *shm,
 }
 
 /* Get a pointer to the current read buffer plus an offset.  The offset might be
- * in the next buffer. 'frames' is filled with the number of frames that can be
- * copied from the returned buffer.
+ * in one of the following buffers. 'frames' is filled with the number of frames
+ * that can be copied from the returned buffer.
  */
 static inline uint8_t *
 cras_shm_get_readable_frames(const struct cras_audio_shm *shm, size_t offset,
 			     size_t *frames)
 {
-	unsigned buf_idx = shm->header->read_buf_idx & CRAS_SHM_BUFFERS_MASK;
+	unsigned buf_idx = cras_shm_read_buf_idx(shm);
 	unsigned read_offset, write_offset, final_offset;
+	unsigned n = 1;
 
 	assert(frames != NULL);
 
 	read_offset = cras_shm_get_checked_read_offset(shm, buf_idx);
 	write_offset = cras_shm_get_checked_write_offset(shm, buf_idx);
 	final_offset = read_offset + offset * shm->config.frame_bytes;
-	if (final_offset >= write_offset) {
+	while (final_offset >= write_offset) {
+		if (n++ == cras_shm_num_buffers(shm)) {
+			/* Past end of samples. */
+			*frames = 0;
+			return NULL;
+		}
 		final_offset -= write_offset;
-		assert_on_compile_is_power_of_2(CRAS_NUM_SHM_BUFFERS);
-		buf_idx = (buf_idx + 1) & CRAS_SHM_BUFFERS_MASK;
+		buf_idx = (buf_idx + 1) & cras_shm_buffers_mask(shm);
 		write_offset = cras_shm_get_checked_write_offset(shm, buf_idx);
 	}
-	if (final_offset >= write_offset) {
-		/* Past end of samples. */
-		*frames = 0;
-		return NULL;
-	}
 	*frames = (write_offset - final_offset) / shm->config.frame_bytes;
 	return cras_shm_buff_for_idx(shm, buf_idx) + final_offset;
 }
@@ -313,7 +462,7 @@ static inline size_t cras_shm_get_bytes_queued(const struct cras_audio_shm *shm)
 	const unsigned used_size = shm->config.used_size;
 
 	total = 0;
-	for (i = 0; i < CRAS_NUM_SHM_BUFFERS; i++) {
+	for (i = 0; i < cras_shm_num_buffers(shm); i++) {
 		unsigned read_offset, write_offset;
 
 		read_offset = MIN(shm->header->read_offset[i], used_size);
@@ -340,7 +489,7 @@ static inline int cras_shm_get_frames(const struct cras_audio_shm *shm)
 static inline size_t
 cras_shm_get_frames_in_curr_buffer(const struct cras_audio_shm *shm)
 {
-	size_t buf_idx = shm->header->read_buf_idx & CRAS_SHM_BUFFERS_MASK;
+	size_t buf_idx = cras_shm_read_buf_idx(shm);
 	unsigned read_offset, write_offset;
 	const unsigned used_size = shm->config.used_size;
 
@@ -356,7 +505,7 @@ cras_shm_get_frames_in_curr_buffer(const struct cras_audio_shm *shm)
 /* Return 1 if there is an empty buffer in the list. */
 static inline int cras_shm_is_buffer_available(const struct cras_audio_shm *shm)
 {
-	size_t buf_idx = shm->header->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
+	size_t buf_idx = cras_shm_write_buf_idx(shm);
 
 	return (shm->header->write_offset[buf_idx] == 0);
 }
@@ -377,8 +526,7 @@ cras_shm_get_num_writeable(const struct cras_audio_shm *shm)
 static inline int cras_shm_check_write_overrun(struct cras_audio_shm *shm)
 {
 	int ret = 0;
-	size_t write_buf_idx =
-		shm->header->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
+	size_t write_buf_idx = cras_shm_write_buf_idx(shm);
 
 	if (!shm->header->write_in_progress[write_buf_idx]) {
 		unsigned int used_size = shm->config.used_size;
@@ -400,7 +548,7 @@ static inline int cras_shm_check_write_overrun(struct cras_audio_shm *shm)
 static inline void cras_shm_buffer_written(struct cras_audio_shm *shm,
 					   size_t frames)
 {
-	size_t buf_idx = shm->header->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
+	size_t buf_idx = cras_shm_write_buf_idx(shm);
 
 	if (frames == 0)
 		return;
@@ -413,28 +561,30 @@ static inline void cras_shm_buffer_written(struct cras_audio_shm *shm,
 static inline unsigned int
 cras_shm_frames_written(const struct cras_audio_shm *shm)
 {
-	size_t buf_idx = shm->header->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
+	size_t buf_idx = cras_shm_write_buf_idx(shm);
 
 	return shm->header->write_offset[buf_idx] / shm->config.frame_bytes;
 }
 
-/* Signals the writing to this buffer is complete and moves to the next one. */
+/* Signals the writing to this buffer is complete and moves to the next one.
+ * The release store publishes the samples to a reader on another thread or
+ * process. */
 static inline void cras_shm_buffer_write_complete(struct cras_audio_shm *shm)
 {
-	size_t buf_idx = shm->header->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
+	size_t buf_idx = cras_shm_write_buf_idx(shm);
 
 	shm->header->write_in_progress[buf_idx] = 0;
 
-	assert_on_compile_is_power_of_2(CRAS_NUM_SHM_BUFFERS);
-	buf_idx = (buf_idx + 1) & CRAS_SHM_BUFFERS_MASK;
-	shm->header->write_buf_idx = buf_idx;
+	buf_idx = (buf_idx + 1) & cras_shm_buffers_mask(shm);
+	__atomic_store_n(&shm->header->write_buf_idx, buf_idx,
+			 __ATOMIC_RELEASE);
 }
 
 /* Set the write pointer for the current buffer and complete the write. */
 static inline void cras_shm_buffer_written_start(struct cras_audio_shm *shm,
 						 size_t frames)
 {
-	size_t buf_idx = shm->header->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
+	size_t buf_idx = cras_shm_write_buf_idx(shm);
 
 	shm->header->write_offset[buf_idx] = frames * shm->config.frame_bytes;
 	shm->header->read_offset[buf_idx] = 0;
@@ -442,35 +592,39 @@ static inline void cras_shm_buffer_written_start(struct cras_audio_shm *shm,
 }
 
 /* Increment the read pointer.  If it goes past the write pointer for this
- * buffer, move to the next buffer. */
+ * buffer, move on through the following buffers. */
 static inline void cras_shm_buffer_read(struct cras_audio_shm *shm,
 					size_t frames)
 {
-	size_t buf_idx = shm->header->read_buf_idx & CRAS_SHM_BUFFERS_MASK;
+	size_t buf_idx = cras_shm_read_buf_idx(shm);
 	size_t remainder;
 	struct cras_audio_shm_header *header = shm->header;
 	struct cras_audio_shm_config *config = &shm->config;
+	unsigned n;
 
 	if (frames == 0)
 		return;
 
 	header->read_offset[buf_idx] += frames * config->frame_bytes;
-	if (header->read_offset[buf_idx] >= header->write_offset[buf_idx]) {
+	if (header->read_offset[buf_idx] < header->write_offset[buf_idx])
+		return;
+
+	for (n = 0; n < cras_shm_num_buffers(shm); n++) {
+		if (header->read_offset[buf_idx] <
+		    header->write_offset[buf_idx])
+			break;
 		remainder = header->read_offset[buf_idx] -
 			    header->write_offset[buf_idx];
 		header->read_offset[buf_idx] = 0;
 		header->write_offset[buf_idx] = 0;
-		assert_on_compile_is_power_of_2(CRAS_NUM_SHM_BUFFERS);
-		buf_idx = (buf_idx + 1) & CRAS_SHM_BUFFERS_MASK;
-		if (remainder < header->write_offset[buf_idx]) {
-			header->read_offset[buf_idx] = remainder;
-		} else if (remainder) {
-			/* Read all of this buffer too. */
-			header->write_offset[buf_idx] = 0;
-			buf_idx = (buf_idx + 1) & CRAS_SHM_BUFFERS_MASK;
-		}
-		header->read_buf_idx = buf_idx;
+		buf_idx = (buf_idx + 1) & cras_shm_buffers_mask(shm);
+		/* Carry the rest over, reading this buffer too if it's
+		 * covered. Nothing follows an empty buffer. */
+		if (!remainder || !header->write_offset[buf_idx])
+			break;
+		header->read_offset[buf_idx] = remainder;
 	}
+	__atomic_store_n(&header->read_buf_idx, buf_idx, __ATOMIC_RELEASE);
 }
 
 /* Read from the current buffer. This is similar to cras_shm_buffer_read(), but
@@ -478,7 +632,7 @@ static inline void cras_shm_buffer_read(struct cras_audio_shm *shm,
 static inline void cras_shm_buffer_read_current(struct cras_audio_shm *shm,
 						size_t frames)
 {
-	size_t buf_idx = shm->header->read_buf_idx & CRAS_SHM_BUFFERS_MASK;
+	size_t buf_idx = cras_shm_read_buf_idx(shm);
 	struct cras_audio_shm_header *header = shm->header;
 	struct cras_audio_shm_config *config = &shm->config;
 
@@ -486,8 +640,9 @@ static inline void cras_shm_buffer_read_current(struct cras_audio_shm *shm,
 	if (header->read_offset[buf_idx] >= header->write_offset[buf_idx]) {
 		header->read_offset[buf_idx] = 0;
 		header->write_offset[buf_idx] = 0;
-		buf_idx = (buf_idx + 1) & CRAS_SHM_BUFFERS_MASK;
-		header->read_buf_idx = buf_idx;
+		buf_idx = (buf_idx + 1) & cras_shm_buffers_mask(shm);
+		__atomic_store_n(&header->read_buf_idx, buf_idx,
+				 __ATOMIC_RELEASE);
 	}
 }
 
@@ -543,7 +698,121 @@ static inline void cras_shm_set_callback_pending(struct cras_audio_shm *shm,
 /* Returns non-zero if a callback is pending for this shm region. */
 static inline int cras_shm_callback_pending(const struct cras_audio_shm *shm)
 {
-	return shm->header->callback_pending;
+	return __atomic_load_n(&shm->header->callback_pending,
+			       __ATOMIC_ACQUIRE);
+}
+
+/* Clears the pending callback once the samples are written or read. Lets the
+ * server pick them up on its next wake for SHM_WAKE streams. */
+static inline void cras_shm_complete_callback(struct cras_audio_shm *shm)
+{
+	__atomic_store_n(&shm->header->callback_pending, 0, __ATOMIC_RELEASE);
+}
+
+/* Marks requests and replies of this shm to go through the wake word. */
+static inline void cras_shm_enable_wake(struct cras_audio_shm *shm)
+{
+	shm->header->wake_enabled = 1;
+}
+
+/* Returns non-zero if the server signals this shm through the wake word. */
+static inline int cras_shm_wake_enabled(const struct cras_audio_shm *shm)
+{
+	return shm->header->wake_enabled;
+}
+
+/* Returns the current value of the wake word. */
+static inline uint32_t cras_shm_wake_seq(const struct cras_audio_shm *shm)
+{
+	return __atomic_load_n(&shm->header->wake_seq, __ATOMIC_ACQUIRE);
+}
+
+/* Bumps the wake word and wakes the thread waiting on it in
+ * cras_shm_wait_wake(). Costs a single syscall, instead of an audio message
+ * write plus its read on the other end.
+ * Args:
+ *    shm - The shm of the stream.
+ *    frames - Frames requested or handed over, passed to the waiter.
+ */
+static inline void cras_shm_wake(struct cras_audio_shm *shm, uint32_t frames)
+{
+	shm->header->wake_frames = frames;
+	__atomic_add_fetch(&shm->header->wake_seq, 1, __ATOMIC_RELEASE);
+	syscall(SYS_futex, (void *)&shm->header->wake_seq, FUTEX_WAKE, 1, NULL,
+		NULL, 0);
+}
+
+/* Waits for the wake word to move on from seq.
+ * Args:
+ *    shm - The shm of the stream.
+ *    seq - The last value seen, updated to the current one on return.
+ *    timeout - Longest time to wait, NULL to wait for ever.
+ * Returns:
+ *    The frames passed by the last wake, or -ETIMEDOUT.
+ */
+static inline int cras_shm_wait_wake(struct cras_audio_shm *shm, uint32_t *seq,
+				     const struct timespec *timeout)
+{
+	uint32_t curr;
+
+	while ((curr = cras_shm_wake_seq(shm)) == *seq) {
+		if (syscall(SYS_futex, (void *)&shm->header->wake_seq,
+			    FUTEX_WAIT, *seq, timeout, NULL, 0) < 0 &&
+		    errno == ETIMEDOUT)
+			return -ETIMEDOUT;
+	}
+	*seq = curr;
+	return shm->header->wake_frames;
+}
+
+/* Returns non-zero while voice is heard for a VAD_GATED stream. */
+static inline int cras_shm_vad_active(const struct cras_audio_shm *shm)
+{
+	return __atomic_load_n(&shm->header->vad_active, __ATOMIC_ACQUIRE);
+}
+
+/* Publishes whether voice is heard for a VAD_GATED stream, and wakes every
+ * thread waiting in cras_shm_wait_vad() if that changed.
+ * Returns:
+ *    Non-zero if the state changed.
+ */
+static inline int cras_shm_set_vad_active(struct cras_audio_shm *shm,
+					  int active)
+{
+	uint32_t val = !!active;
+
+	if (shm->header->vad_active == val)
+		return 0;
+	__atomic_store_n(&shm->header->vad_active, val, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&shm->header->vad_seq, 1, __ATOMIC_RELEASE);
+	syscall(SYS_futex, (void *)&shm->header->vad_seq, FUTEX_WAKE, INT_MAX,
+		NULL, NULL, 0);
+	return 1;
+}
+
+/* Waits for the voice activity of a VAD_GATED stream to become active, so a
+ * client can sleep through silence instead of polling.
+ * Args:
+ *    shm - The shm of the stream.
+ *    active - The state to wait for.
+ *    timeout - Longest time to wait, NULL to wait for ever.
+ * Returns:
+ *    0 once the state is reached, or -ETIMEDOUT.
+ */
+static inline int cras_shm_wait_vad(struct cras_audio_shm *shm, int active,
+				    const struct timespec *timeout)
+{
+	uint32_t seq;
+
+	for (;;) {
+		seq = __atomic_load_n(&shm->header->vad_seq, __ATOMIC_ACQUIRE);
+		if (!cras_shm_vad_active(shm) == !active)
+			return 0;
+		if (syscall(SYS_futex, (void *)&shm->header->vad_seq,
+			    FUTEX_WAIT, seq, timeout, NULL, 0) < 0 &&
+		    errno == ETIMEDOUT)
+			return -ETIMEDOUT;
+	}
 }
 
 /* Sets the starting offset of a buffer */
@@ -567,11 +836,31 @@ static inline void cras_shm_set_used_size(struct cras_audio_shm *shm,
 	if (shm->header) {
 		shm->header->config.used_size = used_size;
 
-		for (i = 0; i < CRAS_NUM_SHM_BUFFERS; i++)
+		for (i = 0; i < cras_shm_num_buffers(shm); i++)
 			cras_shm_set_buffer_offset(shm, i, i * used_size);
 	}
 }
 
+/* Sets the number of buffers in the ring, must be followed by
+ * cras_shm_set_used_size() to lay them out. Also stamps the header with
+ * the layout version so clients can check they understand it. */
+static inline void cras_shm_set_num_buffers(struct cras_audio_shm *shm,
+					    unsigned num_buffers)
+{
+	shm->config.num_buffers = num_buffers;
+	shm->config.layout_version = CRAS_SHM_LAYOUT_VERSION;
+	if (shm->header) {
+		shm->header->config.num_buffers = num_buffers;
+		shm->header->config.layout_version = CRAS_SHM_LAYOUT_VERSION;
+	}
+}
+
+/* Returns non-zero if the header was laid out by this version. */
+static inline int cras_shm_layout_supported(const struct cras_audio_shm *shm)
+{
+	return shm->header->config.layout_version == CRAS_SHM_LAYOUT_VERSION;
+}
+
 /* Returns the used size of the shm region in bytes. */
 static inline unsigned cras_shm_used_size(const struct cras_audio_shm *shm)
 {
@@ -596,6 +885,58 @@ static inline unsigned cras_shm_num_overruns(const struct cras_audio_shm *shm)
 	return shm->header->num_overruns;
 }
 
+/* Publishes new timing of the stream. Called by the server only.
+ * Args:
+ *    shm - The shm of the stream.
+ *    telemetry - The new values, seq and version are ignored.
+ */
+static inline void
+cras_shm_set_telemetry(struct cras_audio_shm *shm,
+		       const struct cras_audio_shm_telemetry *telemetry)
+{
+	struct cras_audio_shm_telemetry *dst = &shm->header->telemetry;
+	const size_t start = offsetof(struct cras_audio_shm_telemetry, version);
+	uint32_t seq = dst->seq;
+
+	__atomic_store_n(&dst->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy((uint8_t *)dst + start, (const uint8_t *)telemetry + start,
+	       sizeof(*dst) - start);
+	dst->version = CRAS_SHM_TELEMETRY_VERSION;
+	__atomic_store_n(&dst->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Copies the timing of the stream published by the server.
+ * Args:
+ *    shm - The shm of the stream.
+ *    telemetry - Filled with a consistent copy on success.
+ * Returns:
+ *    0 on success, -ENODATA if the server hasn't published anything yet or
+ *    -EAGAIN if it kept updating during CRAS_SHM_TELEMETRY_TRIES copies.
+ */
+static inline int
+cras_shm_get_telemetry(const struct cras_audio_shm *shm,
+		       struct cras_audio_shm_telemetry *telemetry)
+{
+	const struct cras_audio_shm_telemetry *src = &shm->header->telemetry;
+	uint32_t seq;
+	int i;
+
+	for (i = 0; i < CRAS_SHM_TELEMETRY_TRIES; i++) {
+		seq = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		memcpy(telemetry, src, sizeof(*telemetry));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&src->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+		return telemetry->version == CRAS_SHM_TELEMETRY_VERSION ?
+			       0 :
+			       -ENODATA;
+	}
+	return -EAGAIN;
+}
+
 /* Copy the config from the shm region to the local config.  Used by clients
  * when initially setting up the region.
  */
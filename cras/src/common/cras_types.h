@@ -108,6 +108,28 @@ cras_stream_direction_mask(const enum CRAS_STREAM_DIRECTION dir)
  *      and does not want to receive data. Used with HOTWORD_STREAM.
  *  SERVER_ONLY - This stream doesn't associate to a client. It's used mainly
  *      for audio data to flow from hardware through iodev's dsp pipeline.
+ *  SHM_WAKE - Signal audio requests and replies through the wake word in the
+ *      shm header instead of audio messages on the stream socket. Used only
+ *      when the server enables it, see cras_shm_wake_enabled().
+ *  LOW_LATENCY - Service this stream exactly on its period, without the slack
+ *      normally allowed to share wakes. It must use the format of the device
+ *      so it is never converted, and is refused when the device can't keep
+ *      up with its period.
+ *  PASSTHROUGH - The stream carries compressed audio as IEC 61937 bursts in
+ *      two channel S16_LE frames. It plays like an EXCLUSIVE stream, and is
+ *      refused unless every device can decode the bursts.
+ *  EXCLUSIVE - The stream has the output devices to itself. Its frames are
+ *      written to the device bit-exact, without mixing, DSP or volume, and
+ *      other output streams are paused while it plays. It must use the
+ *      format of the device so it is never converted.
+ *  DEEP_BUFFER - The playback stream tolerates latency. While only such
+ *      streams play on a device it is filled as deep as they allow, and the
+ *      audio queued is rewound and mixed again when another stream starts so
+ *      that stream is heard right away. Output streams only.
+ *  VAD_GATED - The capture stream only wants voice. A cheap detector on the
+ *      device power gates it, dropping frames before the stream's APM and
+ *      without waking the client while no voice is heard. Transitions are
+ *      published in the shm, see cras_shm_vad_active(). Input streams only.
  */
 enum CRAS_INPUT_STREAM_FLAG {
 	BULK_AUDIO_OK = 0x01,
@@ -115,6 +137,12 @@ enum CRAS_INPUT_STREAM_FLAG {
 	HOTWORD_STREAM = BULK_AUDIO_OK | USE_DEV_TIMING,
 	TRIGGER_ONLY = 0x04,
 	SERVER_ONLY = 0x08,
+	SHM_WAKE = 0x10,
+	LOW_LATENCY = 0x20,
+	PASSTHROUGH = 0x40,
+	EXCLUSIVE = 0x80,
+	DEEP_BUFFER = 0x100,
+	VAD_GATED = 0x200,
 };
 
 /*
@@ -157,6 +185,21 @@ enum CRAS_STREAM_TYPE {
 	CRAS_STREAM_NUM_TYPES,
 };
 
+/* Trade off between latency, CPU and quality of the sample rate converter
+ * used by a stream.
+ * CRAS_SRC_QUALITY_DEFAULT - Balanced setting.
+ * CRAS_SRC_QUALITY_LOW_LATENCY - Shorter filters for the least delay.
+ * CRAS_SRC_QUALITY_HIGH - Longer filters for the cleanest output.
+ * CRAS_SRC_QUALITY_LINEAR - Linear interpolation, the cheapest and the
+ *     noisiest. Only used while the audio thread is overloaded.
+ */
+enum CRAS_SRC_QUALITY {
+	CRAS_SRC_QUALITY_DEFAULT,
+	CRAS_SRC_QUALITY_LOW_LATENCY,
+	CRAS_SRC_QUALITY_HIGH,
+	CRAS_SRC_QUALITY_LINEAR,
+};
+
 /* Types of audio clients. */
 enum CRAS_CLIENT_TYPE {
 	CRAS_CLIENT_TYPE_UNKNOWN, /* Unknown client */
@@ -263,9 +306,11 @@ static inline uint32_t node_index_of(cras_node_id_t id)
 #define CRAS_MAX_HOTWORD_MODEL_NAME_SIZE 12
 #define MAX_DEBUG_DEVS 4
 #define MAX_DEBUG_STREAMS 8
+#define CRAS_MAX_PERF_STATS 4 /* One per audio thread. */
 #define AUDIO_THREAD_EVENT_LOG_SIZE (1024 * 6)
 #define CRAS_BT_EVENT_LOG_SIZE 1024
 #define MAIN_THREAD_EVENT_LOG_SIZE 1024
+#define MAIN_THREAD_STARTUP_LOG_SIZE 128
 
 /* There are 8 bits of space for events. */
 enum AUDIO_THREAD_LOG_EVENTS {
@@ -289,6 +334,7 @@ enum AUDIO_THREAD_LOG_EVENTS {
 	AUDIO_THREAD_A2DP_FLUSH,
 	AUDIO_THREAD_A2DP_THROTTLE_TIME,
 	AUDIO_THREAD_A2DP_WRITE,
+	AUDIO_THREAD_A2DP_BITPOOL,
 	AUDIO_THREAD_DEV_STREAM_MIX,
 	AUDIO_THREAD_CAPTURE_POST,
 	AUDIO_THREAD_CAPTURE_WRITE,
@@ -317,13 +363,49 @@ enum AUDIO_THREAD_LOG_EVENTS {
 	AUDIO_THREAD_LOOPBACK_GET,
 	AUDIO_THREAD_LOOPBACK_SAMPLE_HOOK,
 	AUDIO_THREAD_DEV_OVERRUN,
+	AUDIO_THREAD_DEV_IO_STAGE_MAX,
+	AUDIO_THREAD_UNDERRUN_RISK,
+	AUDIO_THREAD_BUFFER_LEVEL_ADJUST,
+	AUDIO_THREAD_DEV_REWIND,
+	AUDIO_THREAD_STREAM_SCHEDULED_START,
+	AUDIO_THREAD_STREAM_VAD,
+	AUDIO_THREAD_STREAM_PRE_ROLL,
+	AUDIO_THREAD_STREAM_PAUSED,
+	AUDIO_THREAD_DSP_RUN_MAX,
+	/* The workload events below are logged only when the server runs with
+	 * --record_workload, see atlog_workload. */
+	AUDIO_THREAD_STREAM_FORMAT,
+	AUDIO_THREAD_STREAM_CONFIG,
+	AUDIO_THREAD_STREAM_REPLY,
+	AUDIO_THREAD_DEV_FORMAT,
+	AUDIO_THREAD_DEV_DELAY,
 };
 
+/* Packs the direction, sample format, client type and channels of a stream
+ * in data3 of AUDIO_THREAD_STREAM_FORMAT. */
+static inline uint32_t atlog_pack_stream_format(uint32_t direction,
+						uint32_t format,
+						uint32_t client_type,
+						uint32_t num_channels)
+{
+	return ((direction & 0xff) << 24) | ((format & 0xff) << 16) |
+	       ((client_type & 0xff) << 8) | (num_channels & 0xff);
+}
+
+/* Packs the effects and flags of a stream in data3 of
+ * AUDIO_THREAD_STREAM_CONFIG. */
+static inline uint32_t atlog_pack_stream_config(uint32_t effects,
+						uint32_t flags)
+{
+	return ((effects & 0xffff) << 16) | (flags & 0xffff);
+}
+
 /* Important events in main thread.
  * MAIN_THREAD_DEV_CLOSE - When an iodev closes at stream removal.
  * MAIN_THREAD_DEV_DISABLE - When an iodev is removed from active dev list.
  * MAIN_THREAD_DEV_INIT - When an iodev opens when stream attachs.
  * MAIN_THREAD_DEV_REOPEN - When an iodev reopens for format change.
+ * MAIN_THREAD_DEV_STANDBY - When a disabled iodev is kept open in standby.
  * MAIN_THREAD_ADD_ACTIVE_NODE - When an iodev is set as an additional
  *    active device.
  * MAIN_THREAD_SELECT_NODE - When UI selects an iodev as active.
@@ -336,6 +418,8 @@ enum AUDIO_THREAD_LOG_EVENTS {
  * MAIN_THREAD_SUSPEND_DEVS - When system suspends and notifies CRAS.
  * MAIN_THREAD_STREAM_ADDED - When an audio stream is added.
  * MAIN_THREAD_STREAM_REMOVED - When an audio stream is removed.
+ * MAIN_THREAD_STREAM_EFFECTS - When a running stream changes effects.
+ * MAIN_THREAD_STREAM_PAUSED - When a stream is paused or resumed.
  */
 enum MAIN_THREAD_LOG_EVENTS {
 	/* iodev related */
@@ -343,6 +427,7 @@ enum MAIN_THREAD_LOG_EVENTS {
 	MAIN_THREAD_DEV_DISABLE,
 	MAIN_THREAD_DEV_INIT,
 	MAIN_THREAD_DEV_REOPEN,
+	MAIN_THREAD_DEV_STANDBY,
 	MAIN_THREAD_ADD_ACTIVE_NODE,
 	MAIN_THREAD_SELECT_NODE,
 	MAIN_THREAD_NODE_PLUGGED,
@@ -355,6 +440,47 @@ enum MAIN_THREAD_LOG_EVENTS {
 	/* stream related */
 	MAIN_THREAD_STREAM_ADDED,
 	MAIN_THREAD_STREAM_REMOVED,
+	MAIN_THREAD_STREAM_EFFECTS,
+	MAIN_THREAD_STREAM_PAUSED,
+};
+
+/* Phases of the server startup, and of the init of each card and device,
+ * timed in the startup log. Card phases carry the card index in data1, device
+ * phases the card index and the device index in data1 and data2.
+ * STARTUP_SERVER_INIT - cras_server_init.
+ * STARTUP_SYSTEM_STATE_INIT - cras_system_state_init, with the board config.
+ * STARTUP_DSP_INIT - cras_dsp_init, loading the DSP config.
+ * STARTUP_APM_LIST_INIT - cras_apm_list_init, loading the AEC config.
+ * STARTUP_IODEV_LIST_INIT - cras_iodev_list_init, starting audio threads.
+ * STARTUP_UDEV_ENUMERATE - The enumeration of the sound devices at start,
+ *    which adds the cards present.
+ * STARTUP_CARD_PROBE - Opening the control of a card, with its UCM and mixer.
+ * STARTUP_CARD_UCM - Loading the UCM config of a card.
+ * STARTUP_CARD_MIXER - Loading the controls and the mixer of a card.
+ * STARTUP_CARD_PCM_PROBE - Probing the formats of the PCMs of a card.
+ * STARTUP_CARD_COMMIT - Creating the devices of a probed card.
+ * STARTUP_DEVICE_CREATE - Creating the iodev of a PCM.
+ * STARTUP_DEVICE_JACKS - Finding the nodes and jacks of an iodev.
+ * STARTUP_BT_INIT - Connecting to D-Bus and starting the Bluetooth profiles.
+ * STARTUP_READY - Instant the main loop starts serving clients.
+ */
+enum MAIN_THREAD_STARTUP_PHASE {
+	STARTUP_SERVER_INIT,
+	STARTUP_SYSTEM_STATE_INIT,
+	STARTUP_DSP_INIT,
+	STARTUP_APM_LIST_INIT,
+	STARTUP_IODEV_LIST_INIT,
+	STARTUP_UDEV_ENUMERATE,
+	STARTUP_CARD_PROBE,
+	STARTUP_CARD_UCM,
+	STARTUP_CARD_MIXER,
+	STARTUP_CARD_PCM_PROBE,
+	STARTUP_CARD_COMMIT,
+	STARTUP_DEVICE_CREATE,
+	STARTUP_DEVICE_JACKS,
+	STARTUP_BT_INIT,
+	STARTUP_READY,
+	STARTUP_NUM_PHASES,
 };
 
 /* There are 8 bits of space for events. */
@@ -404,6 +530,40 @@ struct __attribute__((__packed__)) audio_thread_event_log {
 	struct audio_thread_event log[AUDIO_THREAD_EVENT_LOG_SIZE];
 };
 
+/* Stages of servicing a device in one wake of the audio thread.
+ * CRAS_DEV_IO_STAGE_FETCH - Fetching samples from the playback streams.
+ * CRAS_DEV_IO_STAGE_CAPTURE_READ - Reading from the device, including the
+ *    device DSP.
+ * CRAS_DEV_IO_STAGE_CAPTURE_STREAMS - Converting, processing and copying the
+ *    captured samples to the streams.
+ * CRAS_DEV_IO_STAGE_SEND_CAPTURED - Posting captured samples to the clients.
+ * CRAS_DEV_IO_STAGE_MIX - Mixing the playback streams.
+ * CRAS_DEV_IO_STAGE_WRITE - Writing the mix to the device, including the
+ *    device DSP and format conversion.
+ */
+enum CRAS_DEV_IO_STAGE {
+	CRAS_DEV_IO_STAGE_FETCH,
+	CRAS_DEV_IO_STAGE_CAPTURE_READ,
+	CRAS_DEV_IO_STAGE_CAPTURE_STREAMS,
+	CRAS_DEV_IO_STAGE_SEND_CAPTURED,
+	CRAS_DEV_IO_STAGE_MIX,
+	CRAS_DEV_IO_STAGE_WRITE,
+	CRAS_NUM_DEV_IO_STAGES,
+};
+
+/* Number of bins in the histogram of the time taken by a stage. Bin i counts
+ * the wakes taking less than 2^(i + 5) microseconds, the last bin all the
+ * longer ones. */
+#define CRAS_DEV_IO_STAGE_HIST_BINS 8
+
+/* Time spent by a device in one stage, over the wakes it was serviced in. */
+struct __attribute__((__packed__)) audio_stage_debug_info {
+	uint32_t count;
+	uint32_t max_usec;
+	uint64_t total_usec;
+	uint32_t hist[CRAS_DEV_IO_STAGE_HIST_BINS];
+};
+
 struct __attribute__((__packed__)) audio_dev_debug_info {
 	char dev_name[CRAS_NODE_NAME_BUFFER_SIZE];
 	uint32_t buffer_size;
@@ -422,8 +582,15 @@ struct __attribute__((__packed__)) audio_dev_debug_info {
 	uint32_t longest_wake_sec;
 	uint32_t longest_wake_nsec;
 	double software_gain_scaler;
+	struct audio_stage_debug_info stages[CRAS_NUM_DEV_IO_STAGES];
+	uint64_t mem_bytes;
 };
 
+/* Debug info of a stream on a device.
+ *    convert_ns, mix_ns, apm_ns - Time spent on the stream since it started,
+ *        see struct cras_rstream_cost.
+ *    mem_bytes - Memory the server holds for the stream on the device.
+ */
 struct __attribute__((__packed__)) audio_stream_debug_info {
 	uint64_t stream_id;
 	uint32_t dev_idx;
@@ -446,15 +613,30 @@ struct __attribute__((__packed__)) audio_stream_debug_info {
 	uint32_t runtime_nsec;
 	double stream_volume;
 	int8_t channel_layout[CRAS_CH_MAX];
+	uint64_t convert_ns;
+	uint64_t mix_ns;
+	uint64_t apm_ns;
+	uint64_t mem_bytes;
 };
 
-/* Debug info shared from server to client. */
+/* Debug info shared from server to client.
+ *    rt_memory_locked - Non-zero if the audio threads run with their memory
+ *        locked.
+ *    minor_faults, major_faults - Page faults taken by the audio threads since
+ *        they started, summed over the threads.
+ *    conv_mem_bytes - Scratch memory of the format converters, summed over
+ *        the audio threads.
+ */
 struct __attribute__((__packed__)) audio_debug_info {
 	uint32_t num_streams;
 	uint32_t num_devs;
 	struct audio_dev_debug_info devs[MAX_DEBUG_DEVS];
 	struct audio_stream_debug_info streams[MAX_DEBUG_STREAMS];
 	struct audio_thread_event_log log;
+	uint32_t rt_memory_locked;
+	uint64_t minor_faults;
+	uint64_t major_faults;
+	uint64_t conv_mem_bytes;
 };
 
 struct __attribute__((__packed__)) main_thread_event {
@@ -471,8 +653,37 @@ struct __attribute__((__packed__)) main_thread_event_log {
 	struct main_thread_event log[MAIN_THREAD_EVENT_LOG_SIZE];
 };
 
+/* Duration of a phase that hasn't ended yet. */
+#define STARTUP_PHASE_RUNNING 0xffffffff
+
+/* A phase in the startup log.
+ *    phase - A MAIN_THREAD_STARTUP_PHASE.
+ *    data1, data2 - Tell the instances of card and device phases apart.
+ *    thread - Id of the thread running it, cards are probed in parallel.
+ *    sec, nsec - CLOCK_MONOTONIC_RAW time the phase started.
+ *    duration_us - How long it took, STARTUP_PHASE_RUNNING until it ends.
+ */
+struct __attribute__((__packed__)) main_thread_startup_phase {
+	uint32_t phase;
+	uint32_t data1;
+	uint32_t data2;
+	uint32_t thread;
+	uint32_t sec;
+	uint32_t nsec;
+	uint32_t duration_us;
+};
+
+/* Phases in the order they started. The log keeps the first
+ * MAIN_THREAD_STARTUP_LOG_SIZE phases, num_phases counts the dropped ones
+ * too. */
+struct __attribute__((__packed__)) main_thread_startup_log {
+	uint32_t num_phases;
+	struct main_thread_startup_phase phases[MAIN_THREAD_STARTUP_LOG_SIZE];
+};
+
 struct __attribute__((__packed__)) main_thread_debug_info {
 	struct main_thread_event_log main_log;
+	struct main_thread_startup_log startup_log;
 };
 
 struct __attribute__((__packed__)) cras_bt_event {
@@ -493,6 +704,82 @@ struct __attribute__((__packed__)) cras_bt_debug_info {
 	struct packet_status_logger wbs_logger;
 };
 
+/* Live performance of a device, see struct cras_perf_stats.
+ *    dev_idx - Index of the device.
+ *    direction - CRAS_STREAM_OUTPUT or CRAS_STREAM_INPUT.
+ *    frame_rate - Rate the device is open at.
+ *    buffer_size - Size of the hardware buffer in frames.
+ *    min_buffer_level - Frames kept in the buffer of an output device.
+ *    highest_hw_level - Highest level of the hardware buffer seen.
+ *    margin_us - Time left in the buffer of an output device at its last
+ *        wake, 0 for input devices.
+ *    min_margin_us - Lowest margin_us since the device was opened.
+ *    lateness_us - Average lateness of the wakes of an output device.
+ *    late_us - How late the device was serviced in the last wake it was due.
+ *    max_late_us - Latest the device was serviced since it was opened.
+ *    num_risks - Times an output device became at risk of underrun.
+ *    num_underruns, num_severe_underruns - Underruns since it was opened.
+ *    stage_count, stage_total_usec, stage_max_usec - Wakes that ran each
+ *        CRAS_DEV_IO_STAGE for the device, and the time they spent in it.
+ */
+struct __attribute__((__packed__)) cras_dev_perf_stats {
+	uint32_t dev_idx;
+	uint32_t direction;
+	uint32_t frame_rate;
+	uint32_t buffer_size;
+	uint32_t min_buffer_level;
+	uint32_t highest_hw_level;
+	uint32_t margin_us;
+	uint32_t min_margin_us;
+	uint32_t lateness_us;
+	uint32_t late_us;
+	uint32_t max_late_us;
+	uint32_t num_risks;
+	uint32_t num_underruns;
+	uint32_t num_severe_underruns;
+	uint32_t stage_count[CRAS_NUM_DEV_IO_STAGES];
+	uint64_t stage_total_usec[CRAS_NUM_DEV_IO_STAGES];
+	uint32_t stage_max_usec[CRAS_NUM_DEV_IO_STAGES];
+};
+
+/* Live performance of a stream on a device, see struct cras_perf_stats.
+ *    stream_id - Id of the stream.
+ *    dev_idx - Index of the device the stream is attached to.
+ *    direction - Direction of the stream.
+ *    frame_rate - Rate of the stream.
+ *    cb_threshold - Frames the client handles in each callback.
+ *    num_missed_cb - Callbacks the client didn't answer in time.
+ *    num_overruns - Overruns of the stream shm.
+ *    longest_fetch_usec - Longest time the client took to answer.
+ */
+struct __attribute__((__packed__)) cras_stream_perf_stats {
+	uint32_t stream_id;
+	uint32_t dev_idx;
+	uint32_t direction;
+	uint32_t frame_rate;
+	uint32_t cb_threshold;
+	uint32_t num_missed_cb;
+	uint32_t num_overruns;
+	uint32_t longest_fetch_usec;
+};
+
+/* Performance counters an audio thread publishes in the server state every
+ * so often, for tools to watch without messaging the thread.
+ *    seq - Odd while the audio thread writes, readers copy again when it
+ *        is odd or has changed across their copy. 0 if never published.
+ *    timestamp - CLOCK_MONOTONIC_RAW time of the update.
+ *    num_devs - Number of devices in devs.
+ *    num_streams - Number of streams in streams.
+ */
+struct __attribute__((__packed__)) cras_perf_stats {
+	uint32_t seq;
+	struct cras_timespec timestamp;
+	uint32_t num_devs;
+	uint32_t num_streams;
+	struct cras_dev_perf_stats devs[MAX_DEBUG_DEVS];
+	struct cras_stream_perf_stats streams[MAX_DEBUG_STREAMS];
+};
+
 /*
  * All event enums should be less then AUDIO_THREAD_EVENT_TYPE_COUNT,
  * or they will be ignored by the handler.
@@ -506,6 +793,7 @@ enum CRAS_AUDIO_THREAD_EVENT_TYPE {
 	AUDIO_THREAD_EVENT_UNDERRUN,
 	AUDIO_THREAD_EVENT_DROP_SAMPLES,
 	AUDIO_THREAD_EVENT_DEV_OVERRUN,
+	AUDIO_THREAD_EVENT_UNDERRUN_RISK,
 	AUDIO_THREAD_EVENT_TYPE_COUNT,
 };
 
@@ -527,6 +815,22 @@ struct __attribute__((__packed__)) cras_audio_thread_snapshot_buffer {
 	int pos;
 };
 
+/* Parts of cras_server_state that are versioned on their own.
+ *    CRAS_STATE_OUTPUT_DEVS - num_output_devs, output_devs, num_output_nodes
+ *        and output_nodes.
+ *    CRAS_STATE_INPUT_DEVS - The same for the input direction.
+ *    CRAS_STATE_CLIENTS - num_attached_clients and client_info.
+ *    CRAS_STATE_STREAMS - num_active_streams, last_active_stream_time and
+ *        num_input_streams_with_permission.
+ */
+enum CRAS_SERVER_STATE_SECTION {
+	CRAS_STATE_OUTPUT_DEVS,
+	CRAS_STATE_INPUT_DEVS,
+	CRAS_STATE_CLIENTS,
+	CRAS_STATE_STREAMS,
+	CRAS_STATE_NUM_SECTIONS,
+};
+
 /* The server state that is shared with clients.
  *    state_version - Version of this structure.
  *    volume - index from 0-100.
@@ -573,8 +877,14 @@ struct __attribute__((__packed__)) cras_audio_thread_snapshot_buffer {
  *    main_thread_debug_info - ring buffer for storing main thread event logs.
  *    num_input_streams_with_permission - An array containing numbers of input
  *        streams with permission in each client type.
+ *    section_update_count - Update count of each CRAS_SERVER_STATE_SECTION.
+ *        Incremented twice each time the section changes, odd during updates.
+ *        Readers of a single section only retry when that section changes,
+ *        and can skip copying it when the count matches their last read.
+ *    perf_stats - Performance counters of each audio thread, written by the
+ *        thread itself under the seq of each entry.
  */
-#define CRAS_SERVER_STATE_VERSION 2
+#define CRAS_SERVER_STATE_VERSION 11
 struct __attribute__((packed, aligned(4))) cras_server_state {
 	uint32_t state_version;
 	uint32_t volume;
@@ -612,6 +922,8 @@ struct __attribute__((packed, aligned(4))) cras_server_state {
 	int32_t deprioritize_bt_wbs_mic;
 	struct main_thread_debug_info main_thread_debug_info;
 	uint32_t num_input_streams_with_permission[CRAS_NUM_CLIENT_TYPE];
+	uint32_t section_update_count[CRAS_STATE_NUM_SECTIONS];
+	struct cras_perf_stats perf_stats[CRAS_MAX_PERF_STATS];
 };
 
 /* Actions for card add/remove/change. */
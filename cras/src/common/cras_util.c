@@ -14,6 +14,8 @@
 #include <string.h>
 #include <syslog.h>
 #include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/syscall.h>
@@ -28,6 +30,10 @@ int cras_set_rt_scheduling(int rt_lim)
 
 	rl.rlim_cur = rl.rlim_max = rt_lim;
 
+	/* Wake on time even if the priority can't be raised, whatever slack
+	 * was inherited from the creating thread. */
+	cras_set_timer_slack(1);
+
 	if (setrlimit(RLIMIT_RTPRIO, &rl) < 0) {
 		syslog(LOG_WARNING, "setrlimit %u failed: %d\n",
 		       (unsigned)rt_lim, errno);
@@ -36,6 +42,76 @@ int cras_set_rt_scheduling(int rt_lim)
 	return 0;
 }
 
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+
+/* The argument of sched_setattr(2), which glibc doesn't wrap. */
+struct deadline_sched_attr {
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+};
+
+int cras_set_deadline_scheduling(uint64_t runtime_ns, uint64_t deadline_ns,
+				 uint64_t period_ns)
+{
+#ifdef SYS_sched_setattr
+	struct deadline_sched_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.sched_policy = SCHED_DEADLINE;
+	attr.sched_runtime = runtime_ns;
+	attr.sched_deadline = deadline_ns;
+	attr.sched_period = period_ns;
+
+	if (syscall(SYS_sched_setattr, 0, &attr, 0) < 0)
+		return -errno;
+	return 0;
+#else
+	return -ENOSYS;
+#endif
+}
+
+/* How much of the stack of a real time thread is faulted in up front. */
+#define RT_STACK_PREFAULT_BYTES (128 * 1024)
+
+/* Touches the next RT_STACK_PREFAULT_BYTES of the stack below the caller. */
+static __attribute__((noinline)) void prefault_stack()
+{
+	volatile char stack[RT_STACK_PREFAULT_BYTES];
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t i;
+
+	for (i = 0; i < sizeof(stack); i += page)
+		stack[i] = 0;
+}
+
+int cras_lock_rt_memory()
+{
+	struct rlimit rl;
+	int rc;
+
+	/* Only possible with CAP_SYS_RESOURCE, otherwise the limit set for the
+	 * daemon applies. */
+	rl.rlim_cur = rl.rlim_max = RLIM_INFINITY;
+	setrlimit(RLIMIT_MEMLOCK, &rl);
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) < 0) {
+		rc = -errno;
+		syslog(LOG_WARNING, "mlockall failed: %d\n", rc);
+		return rc;
+	}
+	prefault_stack();
+	return 0;
+}
+
 int cras_set_thread_priority(int priority)
 {
 	struct sched_param sched_param;
@@ -54,6 +130,16 @@ int cras_set_thread_priority(int priority)
 	return err;
 }
 
+int cras_set_timer_slack(unsigned long slack_ns)
+{
+	if (prctl(PR_SET_TIMERSLACK, slack_ns, 0, 0, 0)) {
+		syslog(LOG_WARNING, "Failed to set timer slack to %lu ns: %d",
+		       slack_ns, errno);
+		return -errno;
+	}
+	return 0;
+}
+
 int cras_set_nice_level(int nice)
 {
 	int rc;
@@ -128,8 +214,33 @@ int cras_send_with_fds(int sockfd, const void *buf, size_t len, int *fd,
 	return rc;
 }
 
-int cras_recv_with_fds(int sockfd, void *buf, size_t len, int *fd,
-		       unsigned int *num_fds)
+int cras_send_messages(int sockfd, const struct iovec *msgs,
+		       unsigned int num_msgs)
+{
+	struct mmsghdr hdrs[num_msgs];
+	unsigned int sent = 0;
+	unsigned int i;
+	int rc;
+
+	memset(hdrs, 0, sizeof(hdrs));
+	for (i = 0; i < num_msgs; i++) {
+		hdrs[i].msg_hdr.msg_iov = (struct iovec *)&msgs[i];
+		hdrs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	/* sendmmsg stops early only when a later message fails, retry from
+	 * there so that the error is reported. */
+	while (sent < num_msgs) {
+		rc = sendmmsg(sockfd, &hdrs[sent], num_msgs - sent, 0);
+		if (rc < 0)
+			return sent ? (int)sent : -errno;
+		sent += rc;
+	}
+	return sent;
+}
+
+static int recv_with_fds(int sockfd, void *buf, size_t len, int *fd,
+			 unsigned int *num_fds, int flags)
 {
 	struct msghdr msg = { 0 };
 	struct iovec iov;
@@ -151,7 +262,7 @@ int cras_recv_with_fds(int sockfd, void *buf, size_t len, int *fd,
 	msg.msg_control = control;
 	msg.msg_controllen = control_size;
 
-	rc = recvmsg(sockfd, &msg, 0);
+	rc = recvmsg(sockfd, &msg, flags);
 	if (rc < 0) {
 		rc = -errno;
 		goto exit;
@@ -175,6 +286,18 @@ exit:
 	return rc;
 }
 
+int cras_recv_with_fds(int sockfd, void *buf, size_t len, int *fd,
+		       unsigned int *num_fds)
+{
+	return recv_with_fds(sockfd, buf, len, fd, num_fds, 0);
+}
+
+int cras_recv_with_fds_nonblocking(int sockfd, void *buf, size_t len, int *fd,
+				   unsigned int *num_fds)
+{
+	return recv_with_fds(sockfd, buf, len, fd, num_fds, MSG_DONTWAIT);
+}
+
 int cras_poll(struct pollfd *fds, nfds_t nfds, struct timespec *timeout,
 	      const sigset_t *sigmask)
 {
@@ -11,12 +11,35 @@ extern "C" {
 #endif
 
 #include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
 #include <time.h>
 
 #include "cras_types.h"
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
 
+/* Alignment of sample buffers. A cache line, and a whole number of the
+ * widest vectors the mixing and DSP kernels load. */
+#define CRAS_BUF_ALIGN 64
+
+/* Rounds n up to a multiple of CRAS_BUF_ALIGN. */
+#define CRAS_BUF_ALIGN_UP(n)                                                   \
+	(((n) + CRAS_BUF_ALIGN - 1) & ~(size_t)(CRAS_BUF_ALIGN - 1))
+
+/* Allocates size bytes of zeroed memory aligned to CRAS_BUF_ALIGN, to be
+ * released with free(). Returns NULL on failure. */
+static inline void *cras_aligned_calloc(size_t size)
+{
+	void *p;
+
+	if (posix_memalign(&p, CRAS_BUF_ALIGN, size ? size : 1))
+		return NULL;
+	memset(p, 0, size);
+	return p;
+}
+
 #define assert_on_compile(e) ((void)sizeof(char[1 - 2 * !(e)]))
 #define assert_on_compile_is_power_of_2(n)                                     \
 	assert_on_compile((n) != 0 && (((n) & ((n)-1)) == 0))
@@ -25,8 +48,24 @@ extern "C" {
 int cras_set_rt_scheduling(int rt_lim);
 /* Sets the priority. */
 int cras_set_thread_priority(int priority);
+/* Puts the calling thread under SCHED_DEADLINE, guaranteeing it runtime_ns
+ * of CPU within deadline_ns of the start of every period_ns. The kernel
+ * refuses when the thread lacks CAP_SYS_NICE, its CPU affinity is
+ * restricted or the bandwidth doesn't pass admission control.
+ * Returns 0 on success or a negative error code. */
+int cras_set_deadline_scheduling(uint64_t runtime_ns, uint64_t deadline_ns,
+				 uint64_t period_ns);
+/* Locks the memory of the process so the real time threads don't take major
+ * page faults, and faults in the stack of the calling thread. Pages are
+ * locked as they are first touched, so mappings are not populated up front.
+ * Returns 0 on success or a negative error code. */
+int cras_lock_rt_memory();
 /* Sets the niceness level of the current thread. */
 int cras_set_nice_level(int nice);
+/* Sets how late the kernel may wake the current thread from a timed wait, to
+ * batch it with other wake ups. Threads created later inherit it. 0 restores
+ * the default of 50us, so 1 asks for the least slack. */
+int cras_set_timer_slack(unsigned long slack_ns);
 
 /* Converts a buffer level from one sample rate to another. */
 static inline size_t cras_frames_at_rate(size_t orig_rate, size_t orig_frames,
@@ -78,11 +117,22 @@ int cras_make_fd_blocking(int fd);
 int cras_send_with_fds(int sockfd, const void *buf, size_t len, int *fd,
 		       unsigned int num_fds);
 
+/* Send each of the num_msgs buffers in msgs as a separate message on the
+ * socket, with a single system call when possible. Returns the number of
+ * messages sent, or a negative error code if none could be sent. */
+int cras_send_messages(int sockfd, const struct iovec *msgs,
+		       unsigned int num_msgs);
+
 /* Receive data in buf from the socket. If file descriptors are received, put
  * them in *fd, otherwise set *fd to -1. */
 int cras_recv_with_fds(int sockfd, void *buf, size_t len, int *fd,
 		       unsigned int *num_fds);
 
+/* Same as cras_recv_with_fds but returns -EAGAIN instead of blocking when no
+ * message is queued on the socket. */
+int cras_recv_with_fds_nonblocking(int sockfd, void *buf, size_t len, int *fd,
+				   unsigned int *num_fds);
+
 /* This must be written a million times... */
 static inline void subtract_timespecs(const struct timespec *end,
 				      const struct timespec *beg,
@@ -161,6 +211,13 @@ static inline void ms_to_timespec(time_t milliseconds, struct timespec *ts)
 	ts->tv_nsec = (milliseconds % 1000) * 1000000;
 }
 
+/* Returns non-zero if all the bytes of buf are zero. The compare stops at the
+ * first difference, so it is cheap on buffers that hold audio. */
+static inline int cras_buffer_is_zero(const uint8_t *buf, size_t bytes)
+{
+	return !bytes || (!*buf && !memcmp(buf, buf + 1, bytes - 1));
+}
+
 /* Returns true if the given timespec is zero. */
 static inline int timespec_is_zero(const struct timespec *ts)
 {
@@ -11,25 +11,82 @@
 
 void packet_status_logger_init(struct packet_status_logger *logger)
 {
-	memset(logger->data, 0, PACKET_STATUS_LEN_BYTES);
-	logger->size = PACKET_STATUS_LEN_BYTES * 8;
-	logger->wp = 0;
-	logger->num_wraps = 0;
-	clock_gettime(CLOCK_MONOTONIC_RAW, &logger->ts);
+	memset(logger, 0, sizeof(*logger));
 }
 
-void packet_status_logger_update(struct packet_status_logger *logger, bool val)
+/* Appends the length of a closed run to the history, unless it's full. */
+static void close_run(struct packet_status_logger *logger, uint32_t n)
 {
-	if (val) {
-		logger->data[logger->wp / 8] |= 1UL << (logger->wp % 8);
-	} else {
-		logger->data[logger->wp / 8] &= ~(1UL << (logger->wp % 8));
+	uint8_t buf[3];
+	unsigned int i = 0;
+
+	while (n >= 0x80) {
+		buf[i++] = (n & 0x7f) | 0x80;
+		n >>= 7;
 	}
-	logger->wp++;
-	if (logger->wp >= logger->size) {
-		logger->wp %= logger->size;
-		logger->num_wraps += 1;
+	buf[i++] = n;
+
+	if (logger->full || logger->len + i > PACKET_STATUS_HISTORY_BYTES) {
+		logger->full = 1;
+		return;
 	}
-	if (logger->wp == 0 || (logger->num_wraps == 0 && logger->wp == 1))
+	memcpy(logger->data + logger->len, buf, i);
+	logger->len += i;
+}
+
+void packet_status_logger_update(struct packet_status_logger *logger, bool val)
+{
+	uint32_t lost = val ? PACKET_STATUS_RUN_LOST : 0;
+	uint32_t run = logger->run;
+
+	if (logger->num_packets == 0) {
+		logger->first_lost = val;
 		clock_gettime(CLOCK_MONOTONIC_RAW, &logger->ts);
+		__atomic_store_n(&logger->run, lost | 1, __ATOMIC_RELAXED);
+	} else if ((run & PACKET_STATUS_RUN_LOST) == lost &&
+		   (run & ~PACKET_STATUS_RUN_LOST) < PACKET_STATUS_RUN_MAX) {
+		__atomic_store_n(&logger->run, run + 1, __ATOMIC_RELAXED);
+	} else {
+		/* Readers retry while seq is odd or has moved, so they never
+		 * see the closed run both in data and as the open run. */
+		__atomic_store_n(&logger->seq, logger->seq + 1,
+				 __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		close_run(logger, run & ~PACKET_STATUS_RUN_LOST);
+		if ((run & PACKET_STATUS_RUN_LOST) == lost)
+			close_run(logger, 0);
+		__atomic_store_n(&logger->run, lost | 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&logger->seq, logger->seq + 1,
+				 __ATOMIC_RELEASE);
+	}
+	logger->num_packets++;
+	if (val)
+		logger->num_lost++;
+}
+
+void packet_status_logger_copy(struct packet_status_logger *dst,
+			       const struct packet_status_logger *src)
+{
+	uint32_t seq;
+
+	do {
+		seq = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		dst->len = src->len;
+		dst->run = __atomic_load_n(&src->run, __ATOMIC_RELAXED);
+		dst->full = src->full;
+		dst->num_packets = src->num_packets;
+		dst->num_lost = src->num_lost;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) ||
+		 seq != __atomic_load_n(&src->seq, __ATOMIC_RELAXED));
+
+	/* Closed runs are never rewritten, so the bytes they took at the
+	 * snapshot can be copied after it. */
+	memcpy(dst->data, src->data, dst->len);
+	memset(dst->data + dst->len, 0, PACKET_STATUS_HISTORY_BYTES - dst->len);
+	dst->seq = 0;
+	dst->first_lost = src->first_lost;
+	dst->ts = src->ts;
 }
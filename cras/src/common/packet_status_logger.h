@@ -8,111 +8,177 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
 
-#define PACKET_STATUS_LEN_BYTES 64
+#define PACKET_STATUS_HISTORY_BYTES 8192
 #define WBS_FRAME_NS 7500000
 
+/* Longest run stored as one varint, so a run takes at most 3 bytes. */
+#define PACKET_STATUS_RUN_MAX ((1U << 21) - 1)
+/* Set in |run| of the logger when the open run is of lost packets. */
+#define PACKET_STATUS_RUN_LOST (1U << 31)
+
 /* Avoid 32, 40, 64 consecutive hex characters so CrOS feedback redact
  * tool doesn't trim our dump. */
 #define PACKET_STATUS_LOG_LINE_WRAP 50
 
 /*
- * Object to log consecutive packets' status.
+ * Object to log the status of every packet of a call as a run-length
+ * encoded history. Runs of received and lost packets alternate, so only
+ * their lengths are stored, each as a varint of 7 bits per byte, low bits
+ * first and bit 7 set on all but the last byte. A run longer than
+ * PACKET_STATUS_RUN_MAX is split by a zero length run of the other status.
+ * Most runs take one byte, so at 1% random loss |data| holds about 50
+ * minutes of packets.
+ * Only the audio thread updates the logger. Other threads read it with
+ * packet_status_logger_copy(), which never blocks the updates.
  * Members:
- *    data - Bytes to store packets' status.
- *    size - Total number of bits in |data|.
- *    wp - Position of the next bit to log packet status.
- *    num_wraps - Number of times the ring buffer has wrapped.
- *    ts - The timestamp of the last time when the first bit of |data| updated.
+ *    data - Varint lengths of the closed runs.
+ *    len - Bytes of |data| in use.
+ *    seq - Odd while a run is being closed, bumped when that is done.
+ *    run - Length of the open run, ORed with PACKET_STATUS_RUN_LOST if it
+ *        is of lost packets.
+ *    first_lost - 1 if the first run is of lost packets.
+ *    full - 1 once a run didn't fit in |data|. Packets after that are only
+ *        counted.
+ *    num_packets - Number of packets logged.
+ *    num_lost - Number of lost packets logged.
+ *    ts - The time the first packet was logged.
  */
 struct packet_status_logger {
-	uint8_t data[PACKET_STATUS_LEN_BYTES];
-	int size;
-	int wp;
-	int num_wraps;
+	uint8_t data[PACKET_STATUS_HISTORY_BYTES];
+	uint32_t len;
+	uint32_t seq;
+	uint32_t run;
+	uint32_t first_lost;
+	uint32_t full;
+	uint32_t num_packets;
+	uint32_t num_lost;
 	struct timespec ts;
 };
 
+/*
+ * Position of a walk through the runs of a logger's history.
+ * Members:
+ *    pos - Offset in data of the next closed run, past len once the open
+ *        run has been visited.
+ *    lost - True if the current run is of lost packets.
+ *    len - Number of packets in the current run.
+ */
+struct packet_status_run {
+	uint32_t pos;
+	bool lost;
+	uint32_t len;
+};
+
 /* Initializes the packet status logger. */
 void packet_status_logger_init(struct packet_status_logger *logger);
 
 /* Updates the next packet status to logger. */
 void packet_status_logger_update(struct packet_status_logger *logger, bool val);
 
-/* Rewinds logger's time stamp to calculate the beginning.
- * If logger's ring buffer hasn't wrapped, simply return logger_ts.
- * Otherwise beginning_ts = logger_ts - WBS_FRAME_NS * (size - wp)
+/* Copies a consistent snapshot of the logger while it may be updated. */
+void packet_status_logger_copy(struct packet_status_logger *dst,
+			       const struct packet_status_logger *src);
+
+/*
+ * Moves to the next run of the history, the closed runs in order and then
+ * the open one. Start from a zeroed |run|.
+ * Args:
+ *    logger - A logger not being updated, e.g. a copy of one.
+ *    run - The position to advance, filled with the next run.
+ * Returns:
+ *    False when there are no more runs.
  */
+static inline bool
+packet_status_logger_next_run(const struct packet_status_logger *logger,
+			      struct packet_status_run *run)
+{
+	unsigned int shift = 0;
+	uint8_t b;
+
+	if (run->pos > logger->len)
+		return false;
+	if (run->pos == logger->len) {
+		run->pos++;
+		run->lost = !!(logger->run & PACKET_STATUS_RUN_LOST);
+		run->len = logger->run & ~PACKET_STATUS_RUN_LOST;
+		return !logger->full && run->len;
+	}
+	run->lost = run->pos ? !run->lost : !!logger->first_lost;
+	run->len = 0;
+	do {
+		b = logger->data[run->pos++];
+		run->len |= (uint32_t)(b & 0x7f) << shift;
+		shift += 7;
+	} while ((b & 0x80) && run->pos < logger->len);
+	return true;
+}
+
+/* Gets the time the first packet was logged. */
 static inline void
 packet_status_logger_begin_ts(const struct packet_status_logger *logger,
 			      struct timespec *ts)
 {
-	long nsec = WBS_FRAME_NS * (logger->size - logger->wp);
-
 	*ts = logger->ts;
-	if (logger->num_wraps == 0)
-		return;
-	while (nsec > 1000000000L) {
-		ts->tv_sec--;
-		nsec -= 1000000000L;
-	}
-	ts->tv_nsec -= nsec;
-	if (ts->tv_nsec < 0) {
-		ts->tv_sec--;
-		ts->tv_nsec += 1000000000L;
-	}
 }
 
 /* Fast-forwards the logger's time stamp to calculate the end.
- * In other words, end_ts = logger_ts + WBS_FRAME_NS * wp
+ * In other words, end_ts = logger_ts + WBS_FRAME_NS * num_packets
  */
 static inline void
 packet_status_logger_end_ts(const struct packet_status_logger *logger,
 			    struct timespec *ts)
 {
+	int64_t nsec = (int64_t)WBS_FRAME_NS * logger->num_packets;
+
 	*ts = logger->ts;
-	ts->tv_nsec += WBS_FRAME_NS * logger->wp;
-	while (ts->tv_nsec > 1000000000L) {
+	ts->tv_sec += nsec / 1000000000L;
+	ts->tv_nsec += nsec % 1000000000L;
+	if (ts->tv_nsec >= 1000000000L) {
 		ts->tv_sec++;
 		ts->tv_nsec -= 1000000000L;
 	}
 }
 
-/* Prints the logger data in hex format */
+/* Prints the run lengths of the history as hex varints, the open run
+ * included. */
 static inline void
 packet_status_logger_dump_hex(const struct packet_status_logger *logger)
 {
-	int i = logger->wp / 8;
-
-	/* Print the bits after wp only if buffer has wrapped. */
-	if (logger->num_wraps) {
-		if (logger->wp % 8)
-			printf("%.2x",
-			       logger->data[i] & (0xff << (logger->wp % 8)));
-		for (; i < PACKET_STATUS_LEN_BYTES; i++)
-			printf("%.2x", logger->data[i]);
+	struct packet_status_run run = { 0 };
+	uint32_t n;
+	int i = 0;
+
+	while (packet_status_logger_next_run(logger, &run)) {
+		n = run.len;
+		do {
+			printf("%.2x", (n & 0x7f) | (n >= 0x80 ? 0x80 : 0));
+			n >>= 7;
+			/* Two characters a byte, so lines wrap on a byte. */
+			i += 2;
+			if (i % PACKET_STATUS_LOG_LINE_WRAP == 0)
+				printf("\n");
+		} while (n);
 	}
-	for (i = 0; i < logger->wp / 8; i++)
-		printf("%.2x", logger->data[i]);
-	if (logger->wp % 8)
-		printf("%.2x", logger->data[i] & (~(0xff << (logger->wp % 8))));
-	printf("\n");
+	if (i % PACKET_STATUS_LOG_LINE_WRAP)
+		printf("\n");
 }
 
-/* Prints the logger data in binary format */
+/* Prints the status of every packet in the history, 1 for lost */
 static inline void
 packet_status_logger_dump_binary(const struct packet_status_logger *logger)
 {
-	/* Don't print the bits after wp if buffer hasn't wrapped. */
-	int head = logger->num_wraps ? logger->wp : 0;
-	int len = logger->num_wraps ? logger->size : logger->wp;
-	int i, j;
-
-	for (i = 0; i < len; ++i) {
-		j = (head + i) % logger->size;
-		printf("%d", (logger->data[j / 8] >> (j % 8)) & 1U);
-		if ((i + 1) % PACKET_STATUS_LOG_LINE_WRAP == 0)
-			printf("\n");
+	struct packet_status_run run = { 0 };
+	uint32_t i, len = 0;
+
+	while (packet_status_logger_next_run(logger, &run)) {
+		for (i = 0; i < run.len; i++) {
+			printf("%d", run.lost);
+			if (++len % PACKET_STATUS_LOG_LINE_WRAP == 0)
+				printf("\n");
+		}
 	}
 	/* Fill indicator digit 'D' until the last line wraps. */
 	if (len % PACKET_STATUS_LOG_LINE_WRAP) {
@@ -55,6 +55,15 @@ struct crossover2 {
  */
 void crossover2_init(struct crossover2 *xo2, float freq1, float freq2);
 
+/* Changes the frequencies of a crossover2 filter, keeping the state of its
+ * filters so it can be changed while audio runs through it.
+ * Args:
+ *    xo2 - The crossover2 filter we want to change.
+ *    freq1 - The normalized frequency splits low and mid band.
+ *    freq2 - The normalized frequency splits mid and high band.
+ */
+void crossover2_set_freqs(struct crossover2 *xo2, float freq1, float freq2);
+
 /* Splits input samples to three bands.
  * Args:
  *    xo2 - The crossover2 filter to use.
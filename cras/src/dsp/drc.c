@@ -19,6 +19,7 @@ static void init_data_buffer(struct drc *drc);
 static void init_emphasis_eq(struct drc *drc);
 static void init_crossover(struct drc *drc);
 static void init_kernel(struct drc *drc);
+static void set_kernel_params(struct drc *drc, int i);
 static void free_data_buffer(struct drc *drc);
 static void free_emphasis_eq(struct drc *drc);
 static void free_kernel(struct drc *drc);
@@ -39,6 +40,17 @@ void drc_init(struct drc *drc)
 	init_kernel(drc);
 }
 
+void drc_update_params(struct drc *drc)
+{
+	int i;
+
+	crossover2_set_freqs(&drc->xo2,
+			     drc->parameters[1][PARAM_CROSSOVER_LOWER_FREQ],
+			     drc->parameters[2][PARAM_CROSSOVER_LOWER_FREQ]);
+	for (i = 0; i < DRC_NUM_KERNELS; i++)
+		set_kernel_params(drc, i);
+}
+
 void drc_free(struct drc *drc)
 {
 	free_kernel(drc);
@@ -215,29 +227,35 @@ static void init_kernel(struct drc *drc)
 
 	for (i = 0; i < DRC_NUM_KERNELS; i++) {
 		dk_init(&drc->kernel[i], drc->sample_rate);
-
-		float db_threshold = drc_get_param(drc, i, PARAM_THRESHOLD);
-		float db_knee = drc_get_param(drc, i, PARAM_KNEE);
-		float ratio = drc_get_param(drc, i, PARAM_RATIO);
-		float attack_time = drc_get_param(drc, i, PARAM_ATTACK);
-		float release_time = drc_get_param(drc, i, PARAM_RELEASE);
-		float pre_delay_time = drc_get_param(drc, i, PARAM_PRE_DELAY);
-		float releaseZone1 = drc_get_param(drc, i, PARAM_RELEASE_ZONE1);
-		float releaseZone2 = drc_get_param(drc, i, PARAM_RELEASE_ZONE2);
-		float releaseZone3 = drc_get_param(drc, i, PARAM_RELEASE_ZONE3);
-		float releaseZone4 = drc_get_param(drc, i, PARAM_RELEASE_ZONE4);
-		float db_post_gain = drc_get_param(drc, i, PARAM_POST_GAIN);
-		int enabled = drc_get_param(drc, i, PARAM_ENABLED);
-
-		dk_set_parameters(&drc->kernel[i], db_threshold, db_knee, ratio,
-				  attack_time, release_time, pre_delay_time,
-				  db_post_gain, releaseZone1, releaseZone2,
-				  releaseZone3, releaseZone4);
-
-		dk_set_enabled(&drc->kernel[i], enabled);
+		dk_set_gain_table(&drc->kernel[i], drc->gain_table_enabled);
+		set_kernel_params(drc, i);
 	}
 }
 
+/* Sets the parameters of a compressor kernel */
+static void set_kernel_params(struct drc *drc, int i)
+{
+	float db_threshold = drc_get_param(drc, i, PARAM_THRESHOLD);
+	float db_knee = drc_get_param(drc, i, PARAM_KNEE);
+	float ratio = drc_get_param(drc, i, PARAM_RATIO);
+	float attack_time = drc_get_param(drc, i, PARAM_ATTACK);
+	float release_time = drc_get_param(drc, i, PARAM_RELEASE);
+	float pre_delay_time = drc_get_param(drc, i, PARAM_PRE_DELAY);
+	float releaseZone1 = drc_get_param(drc, i, PARAM_RELEASE_ZONE1);
+	float releaseZone2 = drc_get_param(drc, i, PARAM_RELEASE_ZONE2);
+	float releaseZone3 = drc_get_param(drc, i, PARAM_RELEASE_ZONE3);
+	float releaseZone4 = drc_get_param(drc, i, PARAM_RELEASE_ZONE4);
+	float db_post_gain = drc_get_param(drc, i, PARAM_POST_GAIN);
+	int enabled = drc_get_param(drc, i, PARAM_ENABLED);
+
+	dk_set_parameters(&drc->kernel[i], db_threshold, db_knee, ratio,
+			  attack_time, release_time, pre_delay_time,
+			  db_post_gain, releaseZone1, releaseZone2,
+			  releaseZone3, releaseZone4);
+
+	dk_set_enabled(&drc->kernel[i], enabled);
+}
+
 /* Frees the compressor kernels */
 static void free_kernel(struct drc *drc)
 {
@@ -111,6 +111,10 @@ struct drc {
 	/* 1 to disable the emphasis and deemphasis, 0 to enable it. */
 	int emphasis_disabled;
 
+	/* 1 to look up the compression curve from a table, see
+	 * dk_set_gain_table(). */
+	int gain_table_enabled;
+
 	/* parameters holds the tweakable compressor parameters. */
 	float parameters[DRC_NUM_KERNELS][PARAM_LAST];
 
@@ -154,6 +158,12 @@ struct drc *drc_new(float sample_rate);
 /* Initializes a DRC. */
 void drc_init(struct drc *drc);
 
+/* Applies the parameters set with drc_set_param() after drc_init() to the
+ * crossover and the compressor kernels, keeping their state so it can be
+ * done while audio runs through the DRC. The emphasis filters keep the
+ * parameters they were initialized with. */
+void drc_update_params(struct drc *drc);
+
 /* Frees a DRC.*/
 void drc_free(struct drc *drc);
 
@@ -8,17 +8,18 @@
  * found in the LICENSE.WEBKIT file.
  */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "drc_math.h"
 #include "drc_kernel.h"
+#include "drc_kernel_ops.h"
 
 #define MAX_PRE_DELAY_FRAMES 1024
 #define MAX_PRE_DELAY_FRAMES_MASK (MAX_PRE_DELAY_FRAMES - 1)
 #define DEFAULT_PRE_DELAY_FRAMES 256
-#define DIVISION_FRAMES 32
 #define DIVISION_FRAMES_MASK (DIVISION_FRAMES - 1)
 
 #define assert_on_compile(e) ((void)sizeof(char[1 - 2 * !(e)]))
@@ -27,6 +28,12 @@
 
 const float uninitialized_value = -1;
 static int drc_math_initialized;
+static const struct drc_kernel_ops *ops = &drc_kernel_ops;
+
+void dk_set_ops(const struct drc_kernel_ops *kernel_ops)
+{
+	ops = kernel_ops ? kernel_ops : &drc_kernel_ops;
+}
 
 void dk_init(struct drc_kernel *dk, float sample_rate)
 {
@@ -54,6 +61,8 @@ void dk_init(struct drc_kernel *dk, float sample_rate)
 	dk->knee_threshold = uninitialized_value;
 	dk->ratio_base = uninitialized_value;
 	dk->K = uninitialized_value;
+	dk->gain_table = NULL;
+	dk->release_table = NULL;
 
 	assert_on_compile_is_power_of_2(DIVISION_FRAMES);
 	assert_on_compile(DIVISION_FRAMES % 4 == 0);
@@ -70,6 +79,7 @@ void dk_free(struct drc_kernel *dk)
 	int i;
 	for (i = 0; i < DRC_NUM_CHANNELS; ++i)
 		free(dk->pre_delay_buffers[i]);
+	free(dk->gain_table);
 }
 
 /* Sets the pre-delay (lookahead) buffer size */
@@ -240,6 +250,36 @@ static float volume_gain(struct drc_kernel *dk, float x)
 	return y;
 }
 
+/* The rate the detector releases at when the gain is below -2dB. */
+static float sat_release_rate(struct drc_kernel *dk, float gain)
+{
+	float gain_db = linear_to_decibels(gain);
+	float db_per_frame = gain_db * dk->sat_release_frames_inv_neg;
+
+	return decibels_to_linear(db_per_frame) - 1;
+}
+
+/* Samples volume_gain() and sat_release_rate() at the levels of the gain
+ * table, see DRC_GAIN_TABLE_STEP_BITS. */
+static void update_gain_table(struct drc_kernel *dk)
+{
+	uint32_t bits;
+	int i;
+
+	/* Start at the power of two below the threshold. */
+	memcpy(&bits, &dk->linear_threshold, sizeof(bits));
+	dk->gain_table_base = (bits & 0x7f800000) >> DRC_GAIN_TABLE_SHIFT;
+
+	for (i = 0; i < DRC_GAIN_TABLE_SIZE; i++) {
+		float x;
+
+		bits = (dk->gain_table_base + i) << DRC_GAIN_TABLE_SHIFT;
+		memcpy(&x, &bits, sizeof(x));
+		dk->gain_table[i] = volume_gain(dk, x);
+		dk->release_table[i] = sat_release_rate(dk, dk->gain_table[i]);
+	}
+}
+
 void dk_set_parameters(struct drc_kernel *dk, float db_threshold, float db_knee,
 		       float ratio, float attack_time, float release_time,
 		       float pre_delay_time, float db_post_gain,
@@ -304,6 +344,30 @@ void dk_set_parameters(struct drc_kernel *dk, float db_threshold, float db_knee,
 	 * compression.
 	 */
 	set_pre_delay_time(dk, pre_delay_time);
+
+	if (dk->gain_table)
+		update_gain_table(dk);
+}
+
+void dk_set_gain_table(struct drc_kernel *dk, int enabled)
+{
+	if (!enabled) {
+		free(dk->gain_table);
+		dk->gain_table = NULL;
+		dk->release_table = NULL;
+		return;
+	}
+	if (dk->gain_table)
+		return;
+
+	dk->gain_table = (float *)calloc(2 * DRC_GAIN_TABLE_SIZE, sizeof(float));
+	if (!dk->gain_table)
+		return;
+	dk->release_table = dk->gain_table + DRC_GAIN_TABLE_SIZE;
+
+	/* Build it now if the parameters are already set. */
+	if (dk->K != uninitialized_value)
+		update_gain_table(dk);
 }
 
 void dk_set_enabled(struct drc_kernel *dk, int enabled)
@@ -397,111 +461,13 @@ static void dk_update_envelope(struct drc_kernel *dk)
 	dk->scaled_desired_gain = scaled_desired_gain;
 }
 
-/* For a division of frames, take the absolute values of left channel and right
- * channel, store the maximum of them in output. */
-#if defined(__aarch64__)
-static inline void max_abs_division(float *output, const float *data0,
-				    const float *data1)
-{
-	int count = DIVISION_FRAMES / 4;
-
-	// clang-format off
-	__asm__ __volatile__(
-		"1:                                     \n"
-		"ld1 {v0.4s}, [%[data0]], #16           \n"
-		"ld1 {v1.4s}, [%[data1]], #16           \n"
-		"fabs v0.4s, v0.4s                      \n"
-		"fabs v1.4s, v1.4s                      \n"
-		"fmax v0.4s, v0.4s, v1.4s               \n"
-		"st1 {v0.4s}, [%[output]], #16          \n"
-		"subs %w[count], %w[count], #1          \n"
-		"b.ne 1b                                \n"
-		: /* output */
-		  [data0]"+r"(data0),
-		  [data1]"+r"(data1),
-		  [output]"+r"(output),
-		  [count]"+r"(count)
-		: /* input */
-		: /* clobber */
-		  "v0", "v1", "memory", "cc");
-	// clang-format on
-}
-#elif defined(__ARM_NEON__)
-static inline void max_abs_division(float *output, const float *data0,
-				    const float *data1)
-{
-	int count = DIVISION_FRAMES / 4;
-
-	// clang-format off
-	__asm__ __volatile__(
-		"1:                                     \n"
-		"vld1.32 {q0}, [%[data0]]!              \n"
-		"vld1.32 {q1}, [%[data1]]!              \n"
-		"vabs.f32 q0, q0                        \n"
-		"vabs.f32 q1, q1                        \n"
-		"vmax.f32 q0, q1                        \n"
-		"vst1.32 {q0}, [%[output]]!             \n"
-		"subs %[count], #1                      \n"
-		"bne 1b                                 \n"
-		: /* output */
-		  [data0]"+r"(data0),
-		  [data1]"+r"(data1),
-		  [output]"+r"(output),
-		  [count]"+r"(count)
-		: /* input */
-		: /* clobber */
-		  "q0", "q1", "memory", "cc");
-	// clang-format on
-}
-#elif defined(__SSE3__)
-#include <emmintrin.h>
-static inline void max_abs_division(float *output, const float *data0,
-				    const float *data1)
-{
-	__m128 x, y;
-	int count = DIVISION_FRAMES / 4;
-	// clang-format off
-	__asm__ __volatile__(
-		"1:                                     \n"
-		"lddqu (%[data0]), %[x]                 \n"
-		"lddqu (%[data1]), %[y]                 \n"
-		"andps %[mask], %[x]                    \n"
-		"andps %[mask], %[y]                    \n"
-		"maxps %[y], %[x]                       \n"
-		"movdqu %[x], (%[output])               \n"
-		"add $16, %[data0]                      \n"
-		"add $16, %[data1]                      \n"
-		"add $16, %[output]                     \n"
-		"sub $1, %[count]                       \n"
-		"jnz 1b                                 \n"
-		: /* output */
-		  [data0]"+r"(data0),
-		  [data1]"+r"(data1),
-		  [output]"+r"(output),
-		  [count]"+r"(count),
-		  [x]"=&x"(x),
-		  [y]"=&x"(y)
-		: /* input */
-		  [mask]"x"(_mm_set1_epi32(0x7fffffff))
-		: /* clobber */
-		  "memory", "cc");
-	// clang-format on
-}
-#else
-static inline void max_abs_division(float *output, const float *data0,
-				    const float *data1)
-{
-	int i;
-	for (i = 0; i < DIVISION_FRAMES; i++)
-		output[i] = fmaxf(fabsf(data0[i]), fabsf(data1[i]));
-}
-#endif
 
 /* Update detector_average from the last input division. */
 static void dk_update_detector_average(struct drc_kernel *dk)
 {
 	float abs_input_array[DIVISION_FRAMES];
-	const float sat_release_frames_inv_neg = dk->sat_release_frames_inv_neg;
+	float gain_array[DIVISION_FRAMES];
+	float release_rate_array[DIVISION_FRAMES];
 	const float sat_release_rate_at_neg_two_db =
 		dk->sat_release_rate_at_neg_two_db;
 	float detector_average = dk->detector_average;
@@ -515,12 +481,20 @@ static void dk_update_detector_average(struct drc_kernel *dk)
 	}
 
 	/* The max abs value across all channels for this frame */
-	max_abs_division(abs_input_array, &dk->pre_delay_buffers[0][div_start],
-			 &dk->pre_delay_buffers[1][div_start]);
+	ops->max_abs_division(abs_input_array,
+			      &dk->pre_delay_buffers[0][div_start],
+			      &dk->pre_delay_buffers[1][div_start]);
+
+	/* Interpolate the curve for the whole division when it is tabled,
+	 * levels beyond the table get a negative gain and are computed below. */
+	if (dk->gain_table)
+		ops->lookup_gain_division(dk, gain_array, release_rate_array,
+					  abs_input_array);
 
 	for (i = 0; i < DIVISION_FRAMES; i++) {
 		/* Compute compression amount from un-delayed signal */
 		float abs_input = abs_input_array[i];
+		int tabled = dk->gain_table && gain_array[i] >= 0;
 
 		/* Calculate shaped power on undelayed input.  Put through
 		 * shaping curve. This is linear up to the threshold, then
@@ -529,7 +503,7 @@ static void dk_update_detector_average(struct drc_kernel *dk)
 		 * derivative matched). The transition from the knee to the
 		 * ratio portion is smooth (1st derivative matched).
 		 */
-		float gain = volume_gain(dk, abs_input);
+		float gain = tabled ? gain_array[i] : volume_gain(dk, abs_input);
 		int is_release = (gain > detector_average);
 		if (is_release) {
 			if (gain > NEG_TWO_DB) {
@@ -537,13 +511,11 @@ static void dk_update_detector_average(struct drc_kernel *dk)
 					(gain - detector_average) *
 					sat_release_rate_at_neg_two_db;
 			} else {
-				float gain_db = linear_to_decibels(gain);
-				float db_per_frame =
-					gain_db * sat_release_frames_inv_neg;
-				float sat_release_rate =
-					decibels_to_linear(db_per_frame) - 1;
-				detector_average += (gain - detector_average) *
-						    sat_release_rate;
+				float rate = tabled ?
+						     release_rate_array[i] :
+						     sat_release_rate(dk, gain);
+				detector_average +=
+					(gain - detector_average) * rate;
 			}
 		} else {
 			detector_average = gain;
@@ -559,403 +531,6 @@ static void dk_update_detector_average(struct drc_kernel *dk)
 	dk->detector_average = detector_average;
 }
 
-/* Calculate compress_gain from the envelope and apply total_gain to compress
- * the next output division. */
-/* TODO(fbarchard): Port to aarch64 */
-#if defined(__ARM_NEON__)
-#include <arm_neon.h>
-static void dk_compress_output(struct drc_kernel *dk)
-{
-	const float master_linear_gain = dk->master_linear_gain;
-	const float envelope_rate = dk->envelope_rate;
-	const float scaled_desired_gain = dk->scaled_desired_gain;
-	const float compressor_gain = dk->compressor_gain;
-	const int div_start = dk->pre_delay_read_index;
-	float *ptr_left = &dk->pre_delay_buffers[0][div_start];
-	float *ptr_right = &dk->pre_delay_buffers[1][div_start];
-	int count = DIVISION_FRAMES / 4;
-
-	/* See warp_sinf() for the details for the constants. */
-	const float32x4_t A7 = vdupq_n_f32(-4.3330336920917034149169921875e-3f);
-	const float32x4_t A5 = vdupq_n_f32(7.9434238374233245849609375e-2f);
-	const float32x4_t A3 = vdupq_n_f32(-0.645892798900604248046875f);
-	const float32x4_t A1 = vdupq_n_f32(1.5707910060882568359375f);
-
-	/* Exponential approach to desired gain. */
-	if (envelope_rate < 1) {
-		float c = compressor_gain - scaled_desired_gain;
-		float r = 1 - envelope_rate;
-		float32x4_t x0 = { c * r, c * r * r, c * r * r * r,
-				   c * r * r * r * r };
-		float32x4_t x, x2, x4, left, right, tmp1, tmp2;
-
-		// clang-format off
-		__asm__ __volatile(
-			"b 2f                                               \n"
-			"1:                                                 \n"
-			"vmul.f32 %q[x0], %q[r4]                            \n"
-			"2:                                                 \n"
-			"vld1.32 {%e[left],%f[left]}, [%[ptr_left]]         \n"
-			"vld1.32 {%e[right],%f[right]}, [%[ptr_right]]      \n"
-			"vadd.f32 %q[x], %q[x0], %q[base]                   \n"
-			/* Calculate warp_sin() for four values in x. */
-			"vmul.f32 %q[x2], %q[x], %q[x]                      \n"
-			"vmov.f32 %q[tmp1], %q[A5]                          \n"
-			"vmov.f32 %q[tmp2], %q[A1]                          \n"
-			"vmul.f32 %q[x4], %q[x2], %q[x2]                    \n"
-			"vmla.f32 %q[tmp1], %q[A7], %q[x2]                  \n"
-			"vmla.f32 %q[tmp2], %q[A3], %q[x2]                  \n"
-			"vmla.f32 %q[tmp2], %q[tmp1], %q[x4]                \n"
-			"vmul.f32 %q[tmp2], %q[tmp2], %q[x]                 \n"
-			/* Now tmp2 contains the result of warp_sin(). */
-			"vmul.f32 %q[tmp2], %q[tmp2], %q[g]                 \n"
-			"vmul.f32 %q[left], %q[tmp2]                        \n"
-			"vmul.f32 %q[right], %q[tmp2]                       \n"
-			"vst1.32 {%e[left],%f[left]}, [%[ptr_left]]!        \n"
-			"vst1.32 {%e[right],%f[right]}, [%[ptr_right]]!     \n"
-			"subs %[count], #1                                  \n"
-			"bne 1b                                             \n"
-			: /* output */
-			  "=r"(count),
-			  "=r"(ptr_left),
-			  "=r"(ptr_right),
-			  "=w"(x0),
-			  [x]"=&w"(x),
-			  [x2]"=&w"(x2),
-			  [x4]"=&w"(x4),
-			  [left]"=&w"(left),
-			  [right]"=&w"(right),
-			  [tmp1]"=&w"(tmp1),
-			  [tmp2]"=&w"(tmp2)
-			: /* input */
-			  [count]"0"(count),
-			  [ptr_left]"1"(ptr_left),
-			  [ptr_right]"2"(ptr_right),
-			  [x0]"3"(x0),
-			  [A1]"w"(A1),
-			  [A3]"w"(A3),
-			  [A5]"w"(A5),
-			  [A7]"w"(A7),
-			  [base]"w"(vdupq_n_f32(scaled_desired_gain)),
-			  [r4]"w"(vdupq_n_f32(r*r*r*r)),
-			  [g]"w"(vdupq_n_f32(master_linear_gain))
-			: /* clobber */
-			  "memory", "cc");
-		// clang-format on
-		dk->compressor_gain = x[3];
-	} else {
-		float c = compressor_gain;
-		float r = envelope_rate;
-		float32x4_t x = { c * r, c * r * r, c * r * r * r,
-				  c * r * r * r * r };
-		float32x4_t x2, x4, left, right, tmp1, tmp2;
-
-		// clang-format off
-		__asm__ __volatile(
-			"b 2f                                               \n"
-			"1:                                                 \n"
-			"vmul.f32 %q[x], %q[r4]                             \n"
-			"2:                                                 \n"
-			"vld1.32 {%e[left],%f[left]}, [%[ptr_left]]         \n"
-			"vld1.32 {%e[right],%f[right]}, [%[ptr_right]]      \n"
-			"vmin.f32 %q[x], %q[one]                            \n"
-			/* Calculate warp_sin() for four values in x. */
-			"vmul.f32 %q[x2], %q[x], %q[x]                      \n"
-			"vmov.f32 %q[tmp1], %q[A5]                          \n"
-			"vmov.f32 %q[tmp2], %q[A1]                          \n"
-			"vmul.f32 %q[x4], %q[x2], %q[x2]                    \n"
-			"vmla.f32 %q[tmp1], %q[A7], %q[x2]                  \n"
-			"vmla.f32 %q[tmp2], %q[A3], %q[x2]                  \n"
-			"vmla.f32 %q[tmp2], %q[tmp1], %q[x4]                \n"
-			"vmul.f32 %q[tmp2], %q[tmp2], %q[x]                 \n"
-			/* Now tmp2 contains the result of warp_sin(). */
-			"vmul.f32 %q[tmp2], %q[tmp2], %q[g]                 \n"
-			"vmul.f32 %q[left], %q[tmp2]                        \n"
-			"vmul.f32 %q[right], %q[tmp2]                       \n"
-			"vst1.32 {%e[left],%f[left]}, [%[ptr_left]]!        \n"
-			"vst1.32 {%e[right],%f[right]}, [%[ptr_right]]!     \n"
-			"subs %[count], #1                                  \n"
-			"bne 1b                                             \n"
-			: /* output */
-			  "=r"(count),
-			  "=r"(ptr_left),
-			  "=r"(ptr_right),
-			  "=w"(x),
-			  [x2]"=&w"(x2),
-			  [x4]"=&w"(x4),
-			  [left]"=&w"(left),
-			  [right]"=&w"(right),
-			  [tmp1]"=&w"(tmp1),
-			  [tmp2]"=&w"(tmp2)
-			: /* input */
-			  [count]"0"(count),
-			  [ptr_left]"1"(ptr_left),
-			  [ptr_right]"2"(ptr_right),
-			  [x]"3"(x),
-			  [A1]"w"(A1),
-			  [A3]"w"(A3),
-			  [A5]"w"(A5),
-			  [A7]"w"(A7),
-			  [one]"w"(vdupq_n_f32(1)),
-			  [r4]"w"(vdupq_n_f32(r*r*r*r)),
-			  [g]"w"(vdupq_n_f32(master_linear_gain))
-			: /* clobber */
-			  "memory", "cc");
-		// clang-format on
-		dk->compressor_gain = x[3];
-	}
-}
-#elif defined(__SSE3__) && defined(__x86_64__)
-#include <emmintrin.h>
-static void dk_compress_output(struct drc_kernel *dk)
-{
-	const float master_linear_gain = dk->master_linear_gain;
-	const float envelope_rate = dk->envelope_rate;
-	const float scaled_desired_gain = dk->scaled_desired_gain;
-	const float compressor_gain = dk->compressor_gain;
-	const int div_start = dk->pre_delay_read_index;
-	float *ptr_left = &dk->pre_delay_buffers[0][div_start];
-	float *ptr_right = &dk->pre_delay_buffers[1][div_start];
-	int count = DIVISION_FRAMES / 4;
-
-	/* See warp_sinf() for the details for the constants. */
-	const __m128 A7 = _mm_set1_ps(-4.3330336920917034149169921875e-3f);
-	const __m128 A5 = _mm_set1_ps(7.9434238374233245849609375e-2f);
-	const __m128 A3 = _mm_set1_ps(-0.645892798900604248046875f);
-	const __m128 A1 = _mm_set1_ps(1.5707910060882568359375f);
-
-	/* Exponential approach to desired gain. */
-	if (envelope_rate < 1) {
-		float c = compressor_gain - scaled_desired_gain;
-		float r = 1 - envelope_rate;
-		__m128 x0 = { c * r, c * r * r, c * r * r * r,
-			      c * r * r * r * r };
-		__m128 x, x2, x4, left, right, tmp1, tmp2;
-
-		// clang-format off
-		__asm__ __volatile(
-			"jmp 2f                                     \n"
-			"1:                                         \n"
-			"mulps %[r4], %[x0]                         \n"
-			"2:                                         \n"
-			"lddqu (%[ptr_left]), %[left]               \n"
-			"lddqu (%[ptr_right]), %[right]             \n"
-			"movaps %[x0], %[x]                         \n"
-			"addps %[base], %[x]                        \n"
-			/* Calculate warp_sin() for four values in x. */
-			"movaps %[x], %[x2]                         \n"
-			"mulps %[x], %[x2]                          \n"
-			"movaps %[x2], %[x4]                        \n"
-			"movaps %[x2], %[tmp1]                      \n"
-			"movaps %[x2], %[tmp2]                      \n"
-			"mulps %[x2], %[x4]                         \n"
-			"mulps %[A7], %[tmp1]                       \n"
-			"mulps %[A3], %[tmp2]                       \n"
-			"addps %[A5], %[tmp1]                       \n"
-			"addps %[A1], %[tmp2]                       \n"
-			"mulps %[x4], %[tmp1]                       \n"
-			"addps %[tmp1], %[tmp2]                     \n"
-			"mulps %[x], %[tmp2]                        \n"
-			/* Now tmp2 contains the result of warp_sin(). */
-			"mulps %[g], %[tmp2]                        \n"
-			"mulps %[tmp2], %[left]                     \n"
-			"mulps %[tmp2], %[right]                    \n"
-			"movdqu %[left], (%[ptr_left])              \n"
-			"movdqu %[right], (%[ptr_right])            \n"
-			"add $16, %[ptr_left]                       \n"
-			"add $16, %[ptr_right]                      \n"
-			"sub $1, %[count]                           \n"
-			"jne 1b                                     \n"
-			: /* output */
-			  "=r"(count),
-			  "=r"(ptr_left),
-			  "=r"(ptr_right),
-			  "=x"(x0),
-			  [x]"=&x"(x),
-			  [x2]"=&x"(x2),
-			  [x4]"=&x"(x4),
-			  [left]"=&x"(left),
-			  [right]"=&x"(right),
-			  [tmp1]"=&x"(tmp1),
-			  [tmp2]"=&x"(tmp2)
-			: /* input */
-			  [count]"0"(count),
-			  [ptr_left]"1"(ptr_left),
-			  [ptr_right]"2"(ptr_right),
-			  [x0]"3"(x0),
-			  [A1]"x"(A1),
-			  [A3]"x"(A3),
-			  [A5]"x"(A5),
-			  [A7]"x"(A7),
-			  [base]"x"(_mm_set1_ps(scaled_desired_gain)),
-			  [r4]"x"(_mm_set1_ps(r*r*r*r)),
-			  [g]"x"(_mm_set1_ps(master_linear_gain))
-			: /* clobber */
-			  "memory", "cc");
-		// clang-format on
-		dk->compressor_gain = x[3];
-	} else {
-		/* See warp_sinf() for the details for the constants. */
-		__m128 A7 = _mm_set1_ps(-4.3330336920917034149169921875e-3f);
-		__m128 A5 = _mm_set1_ps(7.9434238374233245849609375e-2f);
-		__m128 A3 = _mm_set1_ps(-0.645892798900604248046875f);
-		__m128 A1 = _mm_set1_ps(1.5707910060882568359375f);
-
-		float c = compressor_gain;
-		float r = envelope_rate;
-		__m128 x = { c * r, c * r * r, c * r * r * r,
-			     c * r * r * r * r };
-		__m128 x2, x4, left, right, tmp1, tmp2;
-
-		// clang-format off
-		__asm__ __volatile(
-			"jmp 2f                                     \n"
-			"1:                                         \n"
-			"mulps %[r4], %[x]                          \n"
-			"2:                                         \n"
-			"lddqu (%[ptr_left]), %[left]               \n"
-			"lddqu (%[ptr_right]), %[right]             \n"
-			"minps %[one], %[x]                         \n"
-			/* Calculate warp_sin() for four values in x. */
-			"movaps %[x], %[x2]                         \n"
-			"mulps %[x], %[x2]                          \n"
-			"movaps %[x2], %[x4]                        \n"
-			"movaps %[x2], %[tmp1]                      \n"
-			"movaps %[x2], %[tmp2]                      \n"
-			"mulps %[x2], %[x4]                         \n"
-			"mulps %[A7], %[tmp1]                       \n"
-			"mulps %[A3], %[tmp2]                       \n"
-			"addps %[A5], %[tmp1]                       \n"
-			"addps %[A1], %[tmp2]                       \n"
-			"mulps %[x4], %[tmp1]                       \n"
-			"addps %[tmp1], %[tmp2]                     \n"
-			"mulps %[x], %[tmp2]                        \n"
-			/* Now tmp2 contains the result of warp_sin(). */
-			"mulps %[g], %[tmp2]                        \n"
-			"mulps %[tmp2], %[left]                     \n"
-			"mulps %[tmp2], %[right]                    \n"
-			"movdqu %[left], (%[ptr_left])              \n"
-			"movdqu %[right], (%[ptr_right])            \n"
-			"add $16, %[ptr_left]                       \n"
-			"add $16, %[ptr_right]                      \n"
-			"sub $1, %[count]                           \n"
-			"jne 1b                                     \n"
-			: /* output */
-			  "=r"(count),
-			  "=r"(ptr_left),
-			  "=r"(ptr_right),
-			  "=x"(x),
-			  [x2]"=&x"(x2),
-			  [x4]"=&x"(x4),
-			  [left]"=&x"(left),
-			  [right]"=&x"(right),
-			  [tmp1]"=&x"(tmp1),
-			  [tmp2]"=&x"(tmp2)
-			: /* input */
-			  [count]"0"(count),
-			  [ptr_left]"1"(ptr_left),
-			  [ptr_right]"2"(ptr_right),
-			  [x]"3"(x),
-			  [A1]"x"(A1),
-			  [A3]"x"(A3),
-			  [A5]"x"(A5),
-			  [A7]"x"(A7),
-			  [one]"x"(_mm_set1_ps(1)),
-			  [r4]"x"(_mm_set1_ps(r*r*r*r)),
-			  [g]"x"(_mm_set1_ps(master_linear_gain))
-			: /* clobber */
-			  "memory", "cc");
-		// clang-format on
-		dk->compressor_gain = x[3];
-	}
-}
-#else
-static void dk_compress_output(struct drc_kernel *dk)
-{
-	const float master_linear_gain = dk->master_linear_gain;
-	const float envelope_rate = dk->envelope_rate;
-	const float scaled_desired_gain = dk->scaled_desired_gain;
-	const float compressor_gain = dk->compressor_gain;
-	const int div_start = dk->pre_delay_read_index;
-	float *ptr_left = &dk->pre_delay_buffers[0][div_start];
-	float *ptr_right = &dk->pre_delay_buffers[1][div_start];
-	int count = DIVISION_FRAMES / 4;
-
-	int i, j;
-
-	/* Exponential approach to desired gain. */
-	if (envelope_rate < 1) {
-		/* Attack - reduce gain to desired. */
-		float c = compressor_gain - scaled_desired_gain;
-		float base = scaled_desired_gain;
-		float r = 1 - envelope_rate;
-		float x[4] = { c * r, c * r * r, c * r * r * r,
-			       c * r * r * r * r };
-		float r4 = r * r * r * r;
-
-		i = 0;
-		while (1) {
-			for (j = 0; j < 4; j++) {
-				/* Warp pre-compression gain to smooth out sharp
-				 * exponential transition points.
-				 */
-				float post_warp_compressor_gain =
-					warp_sinf(x[j] + base);
-
-				/* Calculate total gain using master gain. */
-				float total_gain = master_linear_gain *
-						   post_warp_compressor_gain;
-
-				/* Apply final gain. */
-				*ptr_left++ *= total_gain;
-				*ptr_right++ *= total_gain;
-			}
-
-			if (++i == count)
-				break;
-
-			for (j = 0; j < 4; j++)
-				x[j] = x[j] * r4;
-		}
-
-		dk->compressor_gain = x[3] + base;
-	} else {
-		/* Release - exponentially increase gain to 1.0 */
-		float c = compressor_gain;
-		float r = envelope_rate;
-		float x[4] = { c * r, c * r * r, c * r * r * r,
-			       c * r * r * r * r };
-		float r4 = r * r * r * r;
-
-		i = 0;
-		while (1) {
-			for (j = 0; j < 4; j++) {
-				/* Warp pre-compression gain to smooth out sharp
-				 * exponential transition points.
-				 */
-				float post_warp_compressor_gain =
-					warp_sinf(x[j]);
-
-				/* Calculate total gain using master gain. */
-				float total_gain = master_linear_gain *
-						   post_warp_compressor_gain;
-
-				/* Apply final gain. */
-				*ptr_left++ *= total_gain;
-				*ptr_right++ *= total_gain;
-			}
-
-			if (++i == count)
-				break;
-
-			for (j = 0; j < 4; j++)
-				x[j] = min(1.0f, x[j] * r4);
-		}
-
-		dk->compressor_gain = x[3];
-	}
-}
-#endif
 
 /* After one complete divison of samples have been received (and one divison of
  * samples have been output), we calculate shaped power average
@@ -967,7 +542,7 @@ static void dk_process_one_division(struct drc_kernel *dk)
 {
 	dk_update_detector_average(dk);
 	dk_update_envelope(dk);
-	dk_compress_output(dk);
+	ops->compress_output(dk);
 }
 
 /* Copy the input data to the pre-delay buffer, and copy the output data back to
@@ -1042,7 +617,7 @@ void dk_process(struct drc_kernel *dk, float *data_channels[], unsigned count)
 
 	if (!dk->processed) {
 		dk_update_envelope(dk);
-		dk_compress_output(dk);
+		ops->compress_output(dk);
 		dk->processed = 1;
 	}
 
@@ -17,6 +17,8 @@ extern "C" {
 
 #define DRC_NUM_CHANNELS 2
 
+struct drc_kernel_ops;
+
 struct drc_kernel {
 	float sample_rate;
 
@@ -76,8 +78,20 @@ struct drc_kernel {
 	/* envelope for the current division */
 	float envelope_rate;
 	float scaled_desired_gain;
+
+	/* Optional tables of the gain and the saturated release rate, sampled
+	 * at DRC_GAIN_TABLE_SIZE levels starting from the float whose bits
+	 * shifted by DRC_GAIN_TABLE_SHIFT are gain_table_base. See
+	 * dk_set_gain_table(). */
+	float *gain_table;
+	float *release_table;
+	unsigned int gain_table_base;
 };
 
+/* Selects the per division loops used by all drc kernels, see
+ * drc_kernel_ops.h. NULL restores the default built for the target. */
+void dk_set_ops(const struct drc_kernel_ops *kernel_ops);
+
 /* Initializes a drc kernel */
 void dk_init(struct drc_kernel *dk, float sample_rate);
 
@@ -91,6 +105,12 @@ void dk_set_parameters(struct drc_kernel *dk, float db_threshold, float db_knee,
 		       float releaseZone1, float releaseZone2,
 		       float releaseZone3, float releaseZone4);
 
+/* Enables or disables looking up the compression curve from a table instead
+ * of evaluating it for every frame. The table is rebuilt whenever
+ * dk_set_parameters() is called, and interpolating it changes the gain by a
+ * small fraction of a dB. */
+void dk_set_gain_table(struct drc_kernel *dk, int enabled);
+
 /* Enables or disables a drc kernel */
 void dk_set_enabled(struct drc_kernel *dk, int enabled);
 
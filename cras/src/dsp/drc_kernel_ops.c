@@ -0,0 +1,728 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/* Copyright (C) 2011 Google Inc. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE.WEBKIT file.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "drc_math.h"
+#include "drc_kernel.h"
+#include "drc_kernel_ops.h"
+
+/* function suffixes for SIMD ops */
+#ifdef OPS_SSE42
+#define OPS(a) a##_sse42
+#elif OPS_AVX
+#define OPS(a) a##_avx
+#elif OPS_AVX2
+#define OPS(a) a##_avx2
+#elif OPS_FMA
+#define OPS(a) a##_fma
+#else
+#define OPS(a) a
+#endif
+
+/* The AVX builds process LANES frames per step with generic vector types,
+ * which the compiler maps to full width registers of the target. */
+#if defined(OPS_AVX) || defined(OPS_AVX2) || defined(OPS_FMA)
+#define DRC_KERNEL_WIDE
+#define LANES 8
+typedef float vfloat __attribute__((vector_size(LANES * sizeof(float))));
+typedef int vint __attribute__((vector_size(LANES * sizeof(int))));
+
+static inline vfloat vdup(float f)
+{
+	vfloat v;
+	int j;
+
+	for (j = 0; j < LANES; j++)
+		v[j] = f;
+	return v;
+}
+
+static inline vint vdupi(int n)
+{
+	vint v;
+	int j;
+
+	for (j = 0; j < LANES; j++)
+		v[j] = n;
+	return v;
+}
+#endif
+
+/* For a division of frames, take the absolute values of left channel and right
+ * channel, store the maximum of them in output. */
+#if defined(DRC_KERNEL_WIDE)
+static void max_abs_division(float *restrict output,
+			     const float *restrict data0,
+			     const float *restrict data1)
+{
+	int i;
+	for (i = 0; i < DIVISION_FRAMES; i++)
+		output[i] = fmaxf(fabsf(data0[i]), fabsf(data1[i]));
+}
+#elif defined(__aarch64__)
+static void max_abs_division(float *output, const float *data0,
+				    const float *data1)
+{
+	int count = DIVISION_FRAMES / 4;
+
+	// clang-format off
+	__asm__ __volatile__(
+		"1:                                     \n"
+		"ld1 {v0.4s}, [%[data0]], #16           \n"
+		"ld1 {v1.4s}, [%[data1]], #16           \n"
+		"fabs v0.4s, v0.4s                      \n"
+		"fabs v1.4s, v1.4s                      \n"
+		"fmax v0.4s, v0.4s, v1.4s               \n"
+		"st1 {v0.4s}, [%[output]], #16          \n"
+		"subs %w[count], %w[count], #1          \n"
+		"b.ne 1b                                \n"
+		: /* output */
+		  [data0]"+r"(data0),
+		  [data1]"+r"(data1),
+		  [output]"+r"(output),
+		  [count]"+r"(count)
+		: /* input */
+		: /* clobber */
+		  "v0", "v1", "memory", "cc");
+	// clang-format on
+}
+#elif defined(__ARM_NEON__)
+static void max_abs_division(float *output, const float *data0,
+				    const float *data1)
+{
+	int count = DIVISION_FRAMES / 4;
+
+	// clang-format off
+	__asm__ __volatile__(
+		"1:                                     \n"
+		"vld1.32 {q0}, [%[data0]]!              \n"
+		"vld1.32 {q1}, [%[data1]]!              \n"
+		"vabs.f32 q0, q0                        \n"
+		"vabs.f32 q1, q1                        \n"
+		"vmax.f32 q0, q1                        \n"
+		"vst1.32 {q0}, [%[output]]!             \n"
+		"subs %[count], #1                      \n"
+		"bne 1b                                 \n"
+		: /* output */
+		  [data0]"+r"(data0),
+		  [data1]"+r"(data1),
+		  [output]"+r"(output),
+		  [count]"+r"(count)
+		: /* input */
+		: /* clobber */
+		  "q0", "q1", "memory", "cc");
+	// clang-format on
+}
+#elif defined(__SSE3__)
+#include <emmintrin.h>
+static void max_abs_division(float *output, const float *data0,
+				    const float *data1)
+{
+	__m128 x, y;
+	int count = DIVISION_FRAMES / 4;
+	// clang-format off
+	__asm__ __volatile__(
+		"1:                                     \n"
+		"lddqu (%[data0]), %[x]                 \n"
+		"lddqu (%[data1]), %[y]                 \n"
+		"andps %[mask], %[x]                    \n"
+		"andps %[mask], %[y]                    \n"
+		"maxps %[y], %[x]                       \n"
+		"movdqu %[x], (%[output])               \n"
+		"add $16, %[data0]                      \n"
+		"add $16, %[data1]                      \n"
+		"add $16, %[output]                     \n"
+		"sub $1, %[count]                       \n"
+		"jnz 1b                                 \n"
+		: /* output */
+		  [data0]"+r"(data0),
+		  [data1]"+r"(data1),
+		  [output]"+r"(output),
+		  [count]"+r"(count),
+		  [x]"=&x"(x),
+		  [y]"=&x"(y)
+		: /* input */
+		  [mask]"x"(_mm_set1_epi32(0x7fffffff))
+		: /* clobber */
+		  "memory", "cc");
+	// clang-format on
+}
+#else
+static void max_abs_division(float *output, const float *data0,
+				    const float *data1)
+{
+	int i;
+	for (i = 0; i < DIVISION_FRAMES; i++)
+		output[i] = fmaxf(fabsf(data0[i]), fabsf(data1[i]));
+}
+#endif
+
+/* Calculate compress_gain from the envelope and apply total_gain to compress
+ * the next output division. */
+#if defined(DRC_KERNEL_WIDE)
+static void dk_compress_output(struct drc_kernel *dk)
+{
+	const float master_linear_gain = dk->master_linear_gain;
+	const float envelope_rate = dk->envelope_rate;
+	const float scaled_desired_gain = dk->scaled_desired_gain;
+	const int div_start = dk->pre_delay_read_index;
+	float *ptr_left = &dk->pre_delay_buffers[0][div_start];
+	float *ptr_right = &dk->pre_delay_buffers[1][div_start];
+	int is_attack = envelope_rate < 1;
+	float c, r, rn;
+	vfloat x, base, left, right;
+	int i, j;
+
+	/* See warp_sinf() for the details for the constants. */
+	const vfloat A7 = vdup(-4.3330336920917034149169921875e-3f);
+	const vfloat A5 = vdup(7.9434238374233245849609375e-2f);
+	const vfloat A3 = vdup(-0.645892798900604248046875f);
+	const vfloat A1 = vdup(1.5707910060882568359375f);
+	const vfloat one = vdup(1);
+
+	/* Attack reduces the gain to the desired one, release increases it
+	 * exponentially to 1.0. x holds the distance to the base of the
+	 * approach for the LANES frames of the current step. */
+	if (is_attack) {
+		c = dk->compressor_gain - scaled_desired_gain;
+		r = 1 - envelope_rate;
+		base = vdup(scaled_desired_gain);
+	} else {
+		c = dk->compressor_gain;
+		r = envelope_rate;
+		base = vdup(0);
+	}
+	rn = 1;
+	for (j = 0; j < LANES; j++) {
+		rn *= r;
+		x[j] = c * rn;
+	}
+
+	for (i = 0; i < DIVISION_FRAMES; i += LANES) {
+		vfloat g, x2, x4;
+
+		if (!is_attack) {
+			vint lt = x < one;
+			x = (vfloat)((lt & (vint)x) | (~lt & (vint)one));
+		}
+
+		/* Warp pre-compression gain to smooth out sharp exponential
+		 * transition points, then apply the master gain. */
+		g = x + base;
+		x2 = g * g;
+		x4 = x2 * x2;
+		g = ((A7 * x2 + A5) * x4 + (A3 * x2 + A1)) * g;
+		g *= master_linear_gain;
+
+		memcpy(&left, ptr_left + i, sizeof(left));
+		memcpy(&right, ptr_right + i, sizeof(right));
+		left *= g;
+		right *= g;
+		memcpy(ptr_left + i, &left, sizeof(left));
+		memcpy(ptr_right + i, &right, sizeof(right));
+
+		if (i + LANES < DIVISION_FRAMES)
+			x *= rn;
+	}
+
+	dk->compressor_gain = x[LANES - 1] + base[0];
+}
+#elif defined(__ARM_NEON__)
+/* TODO(fbarchard): Port to aarch64 */
+#include <arm_neon.h>
+static void dk_compress_output(struct drc_kernel *dk)
+{
+	const float master_linear_gain = dk->master_linear_gain;
+	const float envelope_rate = dk->envelope_rate;
+	const float scaled_desired_gain = dk->scaled_desired_gain;
+	const float compressor_gain = dk->compressor_gain;
+	const int div_start = dk->pre_delay_read_index;
+	float *ptr_left = &dk->pre_delay_buffers[0][div_start];
+	float *ptr_right = &dk->pre_delay_buffers[1][div_start];
+	int count = DIVISION_FRAMES / 4;
+
+	/* See warp_sinf() for the details for the constants. */
+	const float32x4_t A7 = vdupq_n_f32(-4.3330336920917034149169921875e-3f);
+	const float32x4_t A5 = vdupq_n_f32(7.9434238374233245849609375e-2f);
+	const float32x4_t A3 = vdupq_n_f32(-0.645892798900604248046875f);
+	const float32x4_t A1 = vdupq_n_f32(1.5707910060882568359375f);
+
+	/* Exponential approach to desired gain. */
+	if (envelope_rate < 1) {
+		float c = compressor_gain - scaled_desired_gain;
+		float r = 1 - envelope_rate;
+		float32x4_t x0 = { c * r, c * r * r, c * r * r * r,
+				   c * r * r * r * r };
+		float32x4_t x, x2, x4, left, right, tmp1, tmp2;
+
+		// clang-format off
+		__asm__ __volatile(
+			"b 2f                                               \n"
+			"1:                                                 \n"
+			"vmul.f32 %q[x0], %q[r4]                            \n"
+			"2:                                                 \n"
+			"vld1.32 {%e[left],%f[left]}, [%[ptr_left]]         \n"
+			"vld1.32 {%e[right],%f[right]}, [%[ptr_right]]      \n"
+			"vadd.f32 %q[x], %q[x0], %q[base]                   \n"
+			/* Calculate warp_sin() for four values in x. */
+			"vmul.f32 %q[x2], %q[x], %q[x]                      \n"
+			"vmov.f32 %q[tmp1], %q[A5]                          \n"
+			"vmov.f32 %q[tmp2], %q[A1]                          \n"
+			"vmul.f32 %q[x4], %q[x2], %q[x2]                    \n"
+			"vmla.f32 %q[tmp1], %q[A7], %q[x2]                  \n"
+			"vmla.f32 %q[tmp2], %q[A3], %q[x2]                  \n"
+			"vmla.f32 %q[tmp2], %q[tmp1], %q[x4]                \n"
+			"vmul.f32 %q[tmp2], %q[tmp2], %q[x]                 \n"
+			/* Now tmp2 contains the result of warp_sin(). */
+			"vmul.f32 %q[tmp2], %q[tmp2], %q[g]                 \n"
+			"vmul.f32 %q[left], %q[tmp2]                        \n"
+			"vmul.f32 %q[right], %q[tmp2]                       \n"
+			"vst1.32 {%e[left],%f[left]}, [%[ptr_left]]!        \n"
+			"vst1.32 {%e[right],%f[right]}, [%[ptr_right]]!     \n"
+			"subs %[count], #1                                  \n"
+			"bne 1b                                             \n"
+			: /* output */
+			  "=r"(count),
+			  "=r"(ptr_left),
+			  "=r"(ptr_right),
+			  "=w"(x0),
+			  [x]"=&w"(x),
+			  [x2]"=&w"(x2),
+			  [x4]"=&w"(x4),
+			  [left]"=&w"(left),
+			  [right]"=&w"(right),
+			  [tmp1]"=&w"(tmp1),
+			  [tmp2]"=&w"(tmp2)
+			: /* input */
+			  [count]"0"(count),
+			  [ptr_left]"1"(ptr_left),
+			  [ptr_right]"2"(ptr_right),
+			  [x0]"3"(x0),
+			  [A1]"w"(A1),
+			  [A3]"w"(A3),
+			  [A5]"w"(A5),
+			  [A7]"w"(A7),
+			  [base]"w"(vdupq_n_f32(scaled_desired_gain)),
+			  [r4]"w"(vdupq_n_f32(r*r*r*r)),
+			  [g]"w"(vdupq_n_f32(master_linear_gain))
+			: /* clobber */
+			  "memory", "cc");
+		// clang-format on
+		dk->compressor_gain = x[3];
+	} else {
+		float c = compressor_gain;
+		float r = envelope_rate;
+		float32x4_t x = { c * r, c * r * r, c * r * r * r,
+				  c * r * r * r * r };
+		float32x4_t x2, x4, left, right, tmp1, tmp2;
+
+		// clang-format off
+		__asm__ __volatile(
+			"b 2f                                               \n"
+			"1:                                                 \n"
+			"vmul.f32 %q[x], %q[r4]                             \n"
+			"2:                                                 \n"
+			"vld1.32 {%e[left],%f[left]}, [%[ptr_left]]         \n"
+			"vld1.32 {%e[right],%f[right]}, [%[ptr_right]]      \n"
+			"vmin.f32 %q[x], %q[one]                            \n"
+			/* Calculate warp_sin() for four values in x. */
+			"vmul.f32 %q[x2], %q[x], %q[x]                      \n"
+			"vmov.f32 %q[tmp1], %q[A5]                          \n"
+			"vmov.f32 %q[tmp2], %q[A1]                          \n"
+			"vmul.f32 %q[x4], %q[x2], %q[x2]                    \n"
+			"vmla.f32 %q[tmp1], %q[A7], %q[x2]                  \n"
+			"vmla.f32 %q[tmp2], %q[A3], %q[x2]                  \n"
+			"vmla.f32 %q[tmp2], %q[tmp1], %q[x4]                \n"
+			"vmul.f32 %q[tmp2], %q[tmp2], %q[x]                 \n"
+			/* Now tmp2 contains the result of warp_sin(). */
+			"vmul.f32 %q[tmp2], %q[tmp2], %q[g]                 \n"
+			"vmul.f32 %q[left], %q[tmp2]                        \n"
+			"vmul.f32 %q[right], %q[tmp2]                       \n"
+			"vst1.32 {%e[left],%f[left]}, [%[ptr_left]]!        \n"
+			"vst1.32 {%e[right],%f[right]}, [%[ptr_right]]!     \n"
+			"subs %[count], #1                                  \n"
+			"bne 1b                                             \n"
+			: /* output */
+			  "=r"(count),
+			  "=r"(ptr_left),
+			  "=r"(ptr_right),
+			  "=w"(x),
+			  [x2]"=&w"(x2),
+			  [x4]"=&w"(x4),
+			  [left]"=&w"(left),
+			  [right]"=&w"(right),
+			  [tmp1]"=&w"(tmp1),
+			  [tmp2]"=&w"(tmp2)
+			: /* input */
+			  [count]"0"(count),
+			  [ptr_left]"1"(ptr_left),
+			  [ptr_right]"2"(ptr_right),
+			  [x]"3"(x),
+			  [A1]"w"(A1),
+			  [A3]"w"(A3),
+			  [A5]"w"(A5),
+			  [A7]"w"(A7),
+			  [one]"w"(vdupq_n_f32(1)),
+			  [r4]"w"(vdupq_n_f32(r*r*r*r)),
+			  [g]"w"(vdupq_n_f32(master_linear_gain))
+			: /* clobber */
+			  "memory", "cc");
+		// clang-format on
+		dk->compressor_gain = x[3];
+	}
+}
+#elif defined(__SSE3__) && defined(__x86_64__)
+#include <emmintrin.h>
+static void dk_compress_output(struct drc_kernel *dk)
+{
+	const float master_linear_gain = dk->master_linear_gain;
+	const float envelope_rate = dk->envelope_rate;
+	const float scaled_desired_gain = dk->scaled_desired_gain;
+	const float compressor_gain = dk->compressor_gain;
+	const int div_start = dk->pre_delay_read_index;
+	float *ptr_left = &dk->pre_delay_buffers[0][div_start];
+	float *ptr_right = &dk->pre_delay_buffers[1][div_start];
+	int count = DIVISION_FRAMES / 4;
+
+	/* See warp_sinf() for the details for the constants. */
+	const __m128 A7 = _mm_set1_ps(-4.3330336920917034149169921875e-3f);
+	const __m128 A5 = _mm_set1_ps(7.9434238374233245849609375e-2f);
+	const __m128 A3 = _mm_set1_ps(-0.645892798900604248046875f);
+	const __m128 A1 = _mm_set1_ps(1.5707910060882568359375f);
+
+	/* Exponential approach to desired gain. */
+	if (envelope_rate < 1) {
+		float c = compressor_gain - scaled_desired_gain;
+		float r = 1 - envelope_rate;
+		__m128 x0 = { c * r, c * r * r, c * r * r * r,
+			      c * r * r * r * r };
+		__m128 x, x2, x4, left, right, tmp1, tmp2;
+
+		// clang-format off
+		__asm__ __volatile(
+			"jmp 2f                                     \n"
+			"1:                                         \n"
+			"mulps %[r4], %[x0]                         \n"
+			"2:                                         \n"
+			"lddqu (%[ptr_left]), %[left]               \n"
+			"lddqu (%[ptr_right]), %[right]             \n"
+			"movaps %[x0], %[x]                         \n"
+			"addps %[base], %[x]                        \n"
+			/* Calculate warp_sin() for four values in x. */
+			"movaps %[x], %[x2]                         \n"
+			"mulps %[x], %[x2]                          \n"
+			"movaps %[x2], %[x4]                        \n"
+			"movaps %[x2], %[tmp1]                      \n"
+			"movaps %[x2], %[tmp2]                      \n"
+			"mulps %[x2], %[x4]                         \n"
+			"mulps %[A7], %[tmp1]                       \n"
+			"mulps %[A3], %[tmp2]                       \n"
+			"addps %[A5], %[tmp1]                       \n"
+			"addps %[A1], %[tmp2]                       \n"
+			"mulps %[x4], %[tmp1]                       \n"
+			"addps %[tmp1], %[tmp2]                     \n"
+			"mulps %[x], %[tmp2]                        \n"
+			/* Now tmp2 contains the result of warp_sin(). */
+			"mulps %[g], %[tmp2]                        \n"
+			"mulps %[tmp2], %[left]                     \n"
+			"mulps %[tmp2], %[right]                    \n"
+			"movdqu %[left], (%[ptr_left])              \n"
+			"movdqu %[right], (%[ptr_right])            \n"
+			"add $16, %[ptr_left]                       \n"
+			"add $16, %[ptr_right]                      \n"
+			"sub $1, %[count]                           \n"
+			"jne 1b                                     \n"
+			: /* output */
+			  "=r"(count),
+			  "=r"(ptr_left),
+			  "=r"(ptr_right),
+			  "=x"(x0),
+			  [x]"=&x"(x),
+			  [x2]"=&x"(x2),
+			  [x4]"=&x"(x4),
+			  [left]"=&x"(left),
+			  [right]"=&x"(right),
+			  [tmp1]"=&x"(tmp1),
+			  [tmp2]"=&x"(tmp2)
+			: /* input */
+			  [count]"0"(count),
+			  [ptr_left]"1"(ptr_left),
+			  [ptr_right]"2"(ptr_right),
+			  [x0]"3"(x0),
+			  [A1]"x"(A1),
+			  [A3]"x"(A3),
+			  [A5]"x"(A5),
+			  [A7]"x"(A7),
+			  [base]"x"(_mm_set1_ps(scaled_desired_gain)),
+			  [r4]"x"(_mm_set1_ps(r*r*r*r)),
+			  [g]"x"(_mm_set1_ps(master_linear_gain))
+			: /* clobber */
+			  "memory", "cc");
+		// clang-format on
+		dk->compressor_gain = x[3];
+	} else {
+		/* See warp_sinf() for the details for the constants. */
+		__m128 A7 = _mm_set1_ps(-4.3330336920917034149169921875e-3f);
+		__m128 A5 = _mm_set1_ps(7.9434238374233245849609375e-2f);
+		__m128 A3 = _mm_set1_ps(-0.645892798900604248046875f);
+		__m128 A1 = _mm_set1_ps(1.5707910060882568359375f);
+
+		float c = compressor_gain;
+		float r = envelope_rate;
+		__m128 x = { c * r, c * r * r, c * r * r * r,
+			     c * r * r * r * r };
+		__m128 x2, x4, left, right, tmp1, tmp2;
+
+		// clang-format off
+		__asm__ __volatile(
+			"jmp 2f                                     \n"
+			"1:                                         \n"
+			"mulps %[r4], %[x]                          \n"
+			"2:                                         \n"
+			"lddqu (%[ptr_left]), %[left]               \n"
+			"lddqu (%[ptr_right]), %[right]             \n"
+			"minps %[one], %[x]                         \n"
+			/* Calculate warp_sin() for four values in x. */
+			"movaps %[x], %[x2]                         \n"
+			"mulps %[x], %[x2]                          \n"
+			"movaps %[x2], %[x4]                        \n"
+			"movaps %[x2], %[tmp1]                      \n"
+			"movaps %[x2], %[tmp2]                      \n"
+			"mulps %[x2], %[x4]                         \n"
+			"mulps %[A7], %[tmp1]                       \n"
+			"mulps %[A3], %[tmp2]                       \n"
+			"addps %[A5], %[tmp1]                       \n"
+			"addps %[A1], %[tmp2]                       \n"
+			"mulps %[x4], %[tmp1]                       \n"
+			"addps %[tmp1], %[tmp2]                     \n"
+			"mulps %[x], %[tmp2]                        \n"
+			/* Now tmp2 contains the result of warp_sin(). */
+			"mulps %[g], %[tmp2]                        \n"
+			"mulps %[tmp2], %[left]                     \n"
+			"mulps %[tmp2], %[right]                    \n"
+			"movdqu %[left], (%[ptr_left])              \n"
+			"movdqu %[right], (%[ptr_right])            \n"
+			"add $16, %[ptr_left]                       \n"
+			"add $16, %[ptr_right]                      \n"
+			"sub $1, %[count]                           \n"
+			"jne 1b                                     \n"
+			: /* output */
+			  "=r"(count),
+			  "=r"(ptr_left),
+			  "=r"(ptr_right),
+			  "=x"(x),
+			  [x2]"=&x"(x2),
+			  [x4]"=&x"(x4),
+			  [left]"=&x"(left),
+			  [right]"=&x"(right),
+			  [tmp1]"=&x"(tmp1),
+			  [tmp2]"=&x"(tmp2)
+			: /* input */
+			  [count]"0"(count),
+			  [ptr_left]"1"(ptr_left),
+			  [ptr_right]"2"(ptr_right),
+			  [x]"3"(x),
+			  [A1]"x"(A1),
+			  [A3]"x"(A3),
+			  [A5]"x"(A5),
+			  [A7]"x"(A7),
+			  [one]"x"(_mm_set1_ps(1)),
+			  [r4]"x"(_mm_set1_ps(r*r*r*r)),
+			  [g]"x"(_mm_set1_ps(master_linear_gain))
+			: /* clobber */
+			  "memory", "cc");
+		// clang-format on
+		dk->compressor_gain = x[3];
+	}
+}
+#else
+static void dk_compress_output(struct drc_kernel *dk)
+{
+	const float master_linear_gain = dk->master_linear_gain;
+	const float envelope_rate = dk->envelope_rate;
+	const float scaled_desired_gain = dk->scaled_desired_gain;
+	const float compressor_gain = dk->compressor_gain;
+	const int div_start = dk->pre_delay_read_index;
+	float *ptr_left = &dk->pre_delay_buffers[0][div_start];
+	float *ptr_right = &dk->pre_delay_buffers[1][div_start];
+	int count = DIVISION_FRAMES / 4;
+
+	int i, j;
+
+	/* Exponential approach to desired gain. */
+	if (envelope_rate < 1) {
+		/* Attack - reduce gain to desired. */
+		float c = compressor_gain - scaled_desired_gain;
+		float base = scaled_desired_gain;
+		float r = 1 - envelope_rate;
+		float x[4] = { c * r, c * r * r, c * r * r * r,
+			       c * r * r * r * r };
+		float r4 = r * r * r * r;
+
+		i = 0;
+		while (1) {
+			for (j = 0; j < 4; j++) {
+				/* Warp pre-compression gain to smooth out sharp
+				 * exponential transition points.
+				 */
+				float post_warp_compressor_gain =
+					warp_sinf(x[j] + base);
+
+				/* Calculate total gain using master gain. */
+				float total_gain = master_linear_gain *
+						   post_warp_compressor_gain;
+
+				/* Apply final gain. */
+				*ptr_left++ *= total_gain;
+				*ptr_right++ *= total_gain;
+			}
+
+			if (++i == count)
+				break;
+
+			for (j = 0; j < 4; j++)
+				x[j] = x[j] * r4;
+		}
+
+		dk->compressor_gain = x[3] + base;
+	} else {
+		/* Release - exponentially increase gain to 1.0 */
+		float c = compressor_gain;
+		float r = envelope_rate;
+		float x[4] = { c * r, c * r * r, c * r * r * r,
+			       c * r * r * r * r };
+		float r4 = r * r * r * r;
+
+		i = 0;
+		while (1) {
+			for (j = 0; j < 4; j++) {
+				/* Warp pre-compression gain to smooth out sharp
+				 * exponential transition points.
+				 */
+				float post_warp_compressor_gain =
+					warp_sinf(x[j]);
+
+				/* Calculate total gain using master gain. */
+				float total_gain = master_linear_gain *
+						   post_warp_compressor_gain;
+
+				/* Apply final gain. */
+				*ptr_left++ *= total_gain;
+				*ptr_right++ *= total_gain;
+			}
+
+			if (++i == count)
+				break;
+
+			for (j = 0; j < 4; j++)
+				x[j] = min(1.0f, x[j] * r4);
+		}
+
+		dk->compressor_gain = x[3];
+	}
+}
+#endif
+
+/* Interpolate the gain table linearly between the two levels around each
+ * input. The levels are a power of two times a step, so the index and the
+ * fraction are the high and low bits of the float. */
+#if defined(DRC_KERNEL_WIDE)
+static void lookup_gain_division(const struct drc_kernel *dk,
+				 float *restrict gain,
+				 float *restrict release_rate,
+				 const float *restrict abs_input)
+{
+	const float *gain_table = dk->gain_table;
+	const float *release_table = dk->release_table;
+	const vint base = vdupi(dk->gain_table_base);
+	const vint frac_mask = vdupi((1 << DRC_GAIN_TABLE_SHIFT) - 1);
+	const vfloat frac_scale = vdup(1.0f / (1 << DRC_GAIN_TABLE_SHIFT));
+	const vfloat threshold = vdup(dk->linear_threshold);
+	const vfloat one = vdup(1);
+	int i, j;
+
+	for (i = 0; i < DIVISION_FRAMES; i += LANES) {
+		vfloat x, frac, g0, g1, r0, r1, g, r;
+		vint bits, k, in_table, below;
+
+		memcpy(&x, abs_input + i, sizeof(x));
+		bits = (vint)x;
+		k = (bits >> DRC_GAIN_TABLE_SHIFT) - base;
+		in_table = (k >= 0) & (k < DRC_GAIN_TABLE_SIZE - 1);
+		k &= in_table;
+		frac = __builtin_convertvector(bits & frac_mask, vfloat) *
+		       frac_scale;
+
+		/* Load the two points around each level, lane by lane. */
+		for (j = 0; j < LANES; j++) {
+			g0[j] = gain_table[k[j]];
+			g1[j] = gain_table[k[j] + 1];
+			r0[j] = release_table[k[j]];
+			r1[j] = release_table[k[j] + 1];
+		}
+
+		g = g0 + frac * (g1 - g0);
+		r = r0 + frac * (r1 - r0);
+
+		/* 1 below the threshold, -1 beyond the table. */
+		below = x < threshold;
+		g = (vfloat)((in_table & (vint)g) | (~in_table & (vint)-one));
+		g = (vfloat)((below & (vint)one) | (~below & (vint)g));
+		memcpy(gain + i, &g, sizeof(g));
+		memcpy(release_rate + i, &r, sizeof(r));
+	}
+}
+#else
+static void lookup_gain_division(const struct drc_kernel *dk,
+				 float *restrict gain,
+				 float *restrict release_rate,
+				 const float *restrict abs_input)
+{
+	const float *gain_table = dk->gain_table;
+	const float *release_table = dk->release_table;
+	const int base = dk->gain_table_base;
+	const uint32_t frac_mask = (1 << DRC_GAIN_TABLE_SHIFT) - 1;
+	const float frac_scale = 1.0f / (1 << DRC_GAIN_TABLE_SHIFT);
+	int i;
+
+	for (i = 0; i < DIVISION_FRAMES; i++) {
+		uint32_t bits;
+		float frac;
+		int k;
+
+		if (abs_input[i] < dk->linear_threshold) {
+			gain[i] = 1;
+			continue;
+		}
+
+		memcpy(&bits, &abs_input[i], sizeof(bits));
+		k = (int)(bits >> DRC_GAIN_TABLE_SHIFT) - base;
+		if (k < 0 || k >= DRC_GAIN_TABLE_SIZE - 1) {
+			gain[i] = -1;
+			continue;
+		}
+		frac = (bits & frac_mask) * frac_scale;
+
+		gain[i] = gain_table[k] +
+			  frac * (gain_table[k + 1] - gain_table[k]);
+		release_rate[i] = release_table[k] +
+				  frac * (release_table[k + 1] -
+					  release_table[k]);
+	}
+}
+#endif
+
+const struct drc_kernel_ops OPS(drc_kernel_ops) = {
+	.max_abs_division = max_abs_division,
+	.compress_output = dk_compress_output,
+	.lookup_gain_division = lookup_gain_division,
+};
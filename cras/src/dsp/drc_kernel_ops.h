@@ -0,0 +1,64 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef DRC_KERNEL_OPS_H_
+#define DRC_KERNEL_OPS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The kernel envelope is updated once per division of this many frames. */
+#define DIVISION_FRAMES 32
+
+/* The optional gain table samples the compression curve at
+ * 1 << DRC_GAIN_TABLE_STEP_BITS points per octave of input level, for
+ * DRC_GAIN_TABLE_OCTAVES octaves starting from the one holding the threshold.
+ * The points are the floats whose low DRC_GAIN_TABLE_SHIFT mantissa bits are
+ * zero, so a level is looked up from its bits without taking the log. */
+#define DRC_GAIN_TABLE_STEP_BITS 7
+#define DRC_GAIN_TABLE_OCTAVES 8
+#define DRC_GAIN_TABLE_SHIFT (23 - DRC_GAIN_TABLE_STEP_BITS)
+#define DRC_GAIN_TABLE_SIZE                                                    \
+	((DRC_GAIN_TABLE_OCTAVES << DRC_GAIN_TABLE_STEP_BITS) + 1)
+
+struct drc_kernel;
+
+extern const struct drc_kernel_ops drc_kernel_ops;
+extern const struct drc_kernel_ops drc_kernel_ops_sse42;
+extern const struct drc_kernel_ops drc_kernel_ops_avx;
+extern const struct drc_kernel_ops drc_kernel_ops_avx2;
+extern const struct drc_kernel_ops drc_kernel_ops_fma;
+
+/* Struct containing the per division loops of the drc kernel. Like
+ * cras_mix_ops, the same source is built once per instruction set and
+ * dk_set_ops() picks the one to use. drc_kernel_ops uses the NEON or SSE
+ * code chosen at compile time, the x86 variants process eight frames per
+ * step.
+ *
+ * Members:
+ *   max_abs_division: Stores the larger absolute value of the two channels
+ *       for each of DIVISION_FRAMES frames in output.
+ *   compress_output: Moves compressor_gain along the envelope and applies it
+ *       to the next output division of the pre-delay buffers.
+ *   lookup_gain_division: Interpolates the gain table of dk for each of
+ *       DIVISION_FRAMES levels in abs_input, storing the gain and the
+ *       saturated release rate. The gain is 1 below the threshold, and
+ *       negative when the level is beyond the table.
+ */
+struct drc_kernel_ops {
+	void (*max_abs_division)(float *output, const float *data0,
+				 const float *data1);
+	void (*compress_output)(struct drc_kernel *dk);
+	void (*lookup_gain_division)(const struct drc_kernel *dk, float *gain,
+				     float *release_rate,
+				     const float *abs_input);
+};
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* DRC_KERNEL_OPS_H_ */
@@ -0,0 +1,1907 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <limits.h>
+#include <string.h>
+
+#include "biquad.h"
+#include "crossover2.h"
+#include "dsp_ops.h"
+
+/* function suffixes for SIMD ops */
+#ifdef OPS_SSE42
+#define OPS(a) a##_sse42
+#elif OPS_AVX
+#define OPS(a) a##_avx
+#elif OPS_AVX2
+#define OPS(a) a##_avx2
+#elif OPS_FMA
+#define OPS(a) a##_fma
+#else
+#define OPS(a) a
+#endif
+
+/* The AVX builds use generic vector types and intrinsics in place of the SSE
+ * asm, so all their code is VEX encoded and doesn't pay for switching between
+ * the two encodings. */
+#if defined(OPS_AVX) || defined(OPS_AVX2) || defined(OPS_FMA)
+#define DSP_OPS_VEX
+typedef float vfloat __attribute__((vector_size(4 * sizeof(float))));
+#endif
+
+#ifndef max
+#define max(a, b)                                                              \
+	({                                                                     \
+		__typeof__(a) _a = (a);                                        \
+		__typeof__(b) _b = (b);                                        \
+		_a > _b ? _a : _b;                                             \
+	})
+#endif
+
+#ifndef min
+#define min(a, b)                                                              \
+	({                                                                     \
+		__typeof__(a) _a = (a);                                        \
+		__typeof__(b) _b = (b);                                        \
+		_a < _b ? _a : _b;                                             \
+	})
+#endif
+
+/* Runs one biquad on each of the two channels. */
+static void eq2_process_one(struct biquad (*bq)[2], float *data0,
+			    float *data1, int count)
+{
+	struct biquad *qL = &bq[0][0];
+	struct biquad *qR = &bq[0][1];
+
+	float x1L = qL->x1;
+	float x2L = qL->x2;
+	float y1L = qL->y1;
+	float y2L = qL->y2;
+	float b0L = qL->b0;
+	float b1L = qL->b1;
+	float b2L = qL->b2;
+	float a1L = qL->a1;
+	float a2L = qL->a2;
+
+	float x1R = qR->x1;
+	float x2R = qR->x2;
+	float y1R = qR->y1;
+	float y2R = qR->y2;
+	float b0R = qR->b0;
+	float b1R = qR->b1;
+	float b2R = qR->b2;
+	float a1R = qR->a1;
+	float a2R = qR->a2;
+
+	int j;
+	for (j = 0; j < count; j++) {
+		float xL = data0[j];
+		float xR = data1[j];
+
+		float yL = b0L * xL + b1L * x1L + b2L * x2L - a1L * y1L -
+			   a2L * y2L;
+		x2L = x1L;
+		x1L = xL;
+		y2L = y1L;
+		y1L = yL;
+
+		float yR = b0R * xR + b1R * x1R + b2R * x2R - a1R * y1R -
+			   a2R * y2R;
+		x2R = x1R;
+		x1R = xR;
+		y2R = y1R;
+		y1R = yR;
+
+		data0[j] = yL;
+		data1[j] = yR;
+	}
+
+	qL->x1 = x1L;
+	qL->x2 = x2L;
+	qL->y1 = y1L;
+	qL->y2 = y2L;
+	qR->x1 = x1R;
+	qR->x2 = x2R;
+	qR->y1 = y1R;
+	qR->y2 = y2R;
+}
+
+/* Runs two biquads in series on each of the two channels. */
+#if defined(DSP_OPS_VEX)
+static void eq2_process_two(struct biquad (*bq)[2], float *data0,
+			    float *data1, int count)
+{
+	struct biquad *qL = &bq[0][0];
+	struct biquad *rL = &bq[1][0];
+	struct biquad *qR = &bq[0][1];
+	struct biquad *rR = &bq[1][1];
+
+	vfloat x1 = { qL->x1, qR->x1 };
+	vfloat x2 = { qL->x2, qR->x2 };
+	vfloat y1 = { qL->y1, qR->y1 };
+	vfloat y2 = { qL->y2, qR->y2 };
+	vfloat qb0 = { qL->b0, qR->b0 };
+	vfloat qb1 = { qL->b1, qR->b1 };
+	vfloat qb2 = { qL->b2, qR->b2 };
+	vfloat qa1 = { qL->a1, qR->a1 };
+	vfloat qa2 = { qL->a2, qR->a2 };
+
+	vfloat z1 = { rL->y1, rR->y1 };
+	vfloat z2 = { rL->y2, rR->y2 };
+	vfloat rb0 = { rL->b0, rR->b0 };
+	vfloat rb1 = { rL->b1, rR->b1 };
+	vfloat rb2 = { rL->b2, rR->b2 };
+	vfloat ra1 = { rL->a1, rR->a1 };
+	vfloat ra2 = { rL->a2, rR->a2 };
+
+	int j;
+
+	/* The first two lanes hold the left and right channels, the output
+	 * of the first biquad is the input of the second. */
+	for (j = 0; j < count; j++) {
+		vfloat x = { data0[j], data1[j] };
+		vfloat y, z;
+
+		y = qb0 * x + qb1 * x1 + qb2 * x2 - qa1 * y1 - qa2 * y2;
+		z = rb0 * y + rb1 * y1 + rb2 * y2 - ra1 * z1 - ra2 * z2;
+		x2 = x1;
+		x1 = x;
+		y2 = y1;
+		y1 = y;
+		z2 = z1;
+		z1 = z;
+
+		data0[j] = z[0];
+		data1[j] = z[1];
+	}
+
+	qL->x1 = x1[0];
+	qL->x2 = x2[0];
+	qL->y1 = y1[0];
+	qL->y2 = y2[0];
+	rL->y1 = z1[0];
+	rL->y2 = z2[0];
+	qR->x1 = x1[1];
+	qR->x2 = x2[1];
+	qR->y1 = y1[1];
+	qR->y2 = y2[1];
+	rR->y1 = z1[1];
+	rR->y2 = z2[1];
+}
+#elif defined(__ARM_NEON__)
+#include <arm_neon.h>
+static void eq2_process_two(struct biquad (*bq)[2], float *data0,
+			    float *data1, int count)
+{
+	struct biquad *qL = &bq[0][0];
+	struct biquad *rL = &bq[1][0];
+	struct biquad *qR = &bq[0][1];
+	struct biquad *rR = &bq[1][1];
+
+	float32x2_t x1 = { qL->x1, qR->x1 };
+	float32x2_t x2 = { qL->x2, qR->x2 };
+	float32x2_t y1 = { qL->y1, qR->y1 };
+	float32x2_t y2 = { qL->y2, qR->y2 };
+	float32x2_t qb0 = { qL->b0, qR->b0 };
+	float32x2_t qb1 = { qL->b1, qR->b1 };
+	float32x2_t qb2 = { qL->b2, qR->b2 };
+	float32x2_t qa1 = { qL->a1, qR->a1 };
+	float32x2_t qa2 = { qL->a2, qR->a2 };
+
+	float32x2_t z1 = { rL->y1, rR->y1 };
+	float32x2_t z2 = { rL->y2, rR->y2 };
+	float32x2_t rb0 = { rL->b0, rR->b0 };
+	float32x2_t rb1 = { rL->b1, rR->b1 };
+	float32x2_t rb2 = { rL->b2, rR->b2 };
+	float32x2_t ra1 = { rL->a1, rR->a1 };
+	float32x2_t ra2 = { rL->a2, rR->a2 };
+
+	// clang-format off
+	__asm__ __volatile__(
+		/* d0 = x, d1 = y, d2 = z */
+		"1:                                     \n"
+		"vmul.f32 d1, %P[qb1], %P[x1]           \n"
+		"vld1.32 d0[0], [%[data0]]              \n"
+		"vld1.32 d0[1], [%[data1]]              \n"
+		"subs %[count], #1                      \n"
+		"vmul.f32 d2, %P[rb1], %P[y1]           \n"
+		"vmla.f32 d1, %P[qb0], d0               \n"
+		"vmla.f32 d1, %P[qb2], %P[x2]           \n"
+		"vmov.f32 %P[x2], %P[x1]                \n"
+		"vmov.f32 %P[x1], d0                    \n"
+		"vmls.f32 d1, %P[qa1], %P[y1]           \n"
+		"vmls.f32 d1, %P[qa2], %P[y2]           \n"
+		"vmla.f32 d2, %P[rb0], d1               \n"
+		"vmla.f32 d2, %P[rb2], %P[y2]           \n"
+		"vmov.f32 %P[y2], %P[y1]                \n"
+		"vmov.f32 %P[y1], d1                    \n"
+		"vmls.f32 d2, %P[ra1], %P[z1]           \n"
+		"vmls.f32 d2, %P[ra2], %P[z2]           \n"
+		"vmov.f32 %P[z2], %P[z1]                \n"
+		"vmov.f32 %P[z1], d2                    \n"
+		"vst1.f32 d2[0], [%[data0]]!            \n"
+		"vst1.f32 d2[1], [%[data1]]!            \n"
+		"bne 1b                                 \n"
+		: /* output */
+		  [data0]"+r"(data0),
+		  [data1]"+r"(data1),
+		  [count]"+r"(count),
+		  [x1]"+w"(x1),
+		  [x2]"+w"(x2),
+		  [y1]"+w"(y1),
+		  [y2]"+w"(y2),
+		  [z1]"+w"(z1),
+		  [z2]"+w"(z2)
+		: /* input */
+		  [qb0]"w"(qb0),
+		  [qb1]"w"(qb1),
+		  [qb2]"w"(qb2),
+		  [qa1]"w"(qa1),
+		  [qa2]"w"(qa2),
+		  [rb0]"w"(rb0),
+		  [rb1]"w"(rb1),
+		  [rb2]"w"(rb2),
+		  [ra1]"w"(ra1),
+		  [ra2]"w"(ra2)
+		: /* clobber */
+		  "d0", "d1", "d2", "memory", "cc");
+	// clang-format on
+
+	qL->x1 = x1[0];
+	qL->x2 = x2[0];
+	qL->y1 = y1[0];
+	qL->y2 = y2[0];
+	rL->y1 = z1[0];
+	rL->y2 = z2[0];
+	qR->x1 = x1[1];
+	qR->x2 = x2[1];
+	qR->y1 = y1[1];
+	qR->y2 = y2[1];
+	rR->y1 = z1[1];
+	rR->y2 = z2[1];
+}
+#elif defined(__SSE3__) && defined(__x86_64__)
+#include <emmintrin.h>
+static void eq2_process_two(struct biquad (*bq)[2], float *data0,
+			    float *data1, int count)
+{
+	struct biquad *qL = &bq[0][0];
+	struct biquad *rL = &bq[1][0];
+	struct biquad *qR = &bq[0][1];
+	struct biquad *rR = &bq[1][1];
+
+	__m128 x1 = { qL->x1, qR->x1 };
+	__m128 x2 = { qL->x2, qR->x2 };
+	__m128 y1 = { qL->y1, qR->y1 };
+	__m128 y2 = { qL->y2, qR->y2 };
+	__m128 qb0 = { qL->b0, qR->b0 };
+	__m128 qb1 = { qL->b1, qR->b1 };
+	__m128 qb2 = { qL->b2, qR->b2 };
+	__m128 qa1 = { qL->a1, qR->a1 };
+	__m128 qa2 = { qL->a2, qR->a2 };
+
+	__m128 z1 = { rL->y1, rR->y1 };
+	__m128 z2 = { rL->y2, rR->y2 };
+	__m128 rb0 = { rL->b0, rR->b0 };
+	__m128 rb1 = { rL->b1, rR->b1 };
+	__m128 rb2 = { rL->b2, rR->b2 };
+	__m128 ra1 = { rL->a1, rR->a1 };
+	__m128 ra2 = { rL->a2, rR->a2 };
+
+	// clang-format off
+	__asm__ __volatile__(
+		"1:                                     \n"
+		"movss (%[data0]), %%xmm2               \n"
+		"movss (%[data1]), %%xmm1               \n"
+		"unpcklps %%xmm1, %%xmm2                \n"
+		"mulps %[qb2],%[x2]                     \n"
+		"lddqu %[qb0],%%xmm0                    \n"
+		"mulps %[ra2],%[z2]                     \n"
+		"lddqu %[qb1],%%xmm1                    \n"
+		"mulps %%xmm2,%%xmm0                    \n"
+		"mulps %[x1],%%xmm1                     \n"
+		"addps %%xmm1,%%xmm0                    \n"
+		"movaps %[qa1],%%xmm1                   \n"
+		"mulps %[y1],%%xmm1                     \n"
+		"addps %[x2],%%xmm0                     \n"
+		"movaps %[rb1],%[x2]                    \n"
+		"mulps %[y1],%[x2]                      \n"
+		"subps %%xmm1,%%xmm0                    \n"
+		"movaps %[qa2],%%xmm1                   \n"
+		"mulps %[y2],%%xmm1                     \n"
+		"mulps %[rb2],%[y2]                     \n"
+		"subps %%xmm1,%%xmm0                    \n"
+		"movaps %[rb0],%%xmm1                   \n"
+		"mulps %%xmm0,%%xmm1                    \n"
+		"addps %[x2],%%xmm1                     \n"
+		"movaps %[x1],%[x2]                     \n"
+		"movaps %%xmm2,%[x1]                    \n"
+		"addps %[y2],%%xmm1                     \n"
+		"movaps %[ra1],%[y2]                    \n"
+		"mulps %[z1],%[y2]                      \n"
+		"subps %[y2],%%xmm1                     \n"
+		"movaps %[y1],%[y2]                     \n"
+		"movaps %%xmm0,%[y1]                    \n"
+		"subps %[z2],%%xmm1                     \n"
+		"movaps %[z1],%[z2]                     \n"
+		"movaps %%xmm1,%[z1]                    \n"
+		"movss %%xmm1, (%[data0])               \n"
+		"shufps $1, %%xmm1, %%xmm1              \n"
+		"movss %%xmm1, (%[data1])               \n"
+		"add $4, %[data0]                       \n"
+		"add $4, %[data1]                       \n"
+		"sub $1, %[count]                       \n"
+		"jnz 1b                                 \n"
+		: /* output */
+		  [data0]"+r"(data0),
+		  [data1]"+r"(data1),
+		  [count]"+r"(count),
+		  [x1]"+x"(x1),
+		  [x2]"+x"(x2),
+		  [y1]"+x"(y1),
+		  [y2]"+x"(y2),
+		  [z1]"+x"(z1),
+		  [z2]"+x"(z2)
+		: /* input */
+		  [qb0]"m"(qb0),
+		  [qb1]"m"(qb1),
+		  [qb2]"m"(qb2),
+		  [qa1]"x"(qa1),
+		  [qa2]"x"(qa2),
+		  [rb0]"x"(rb0),
+		  [rb1]"x"(rb1),
+		  [rb2]"x"(rb2),
+		  [ra1]"x"(ra1),
+		  [ra2]"x"(ra2)
+		: /* clobber */
+		  "xmm0", "xmm1", "xmm2", "memory", "cc");
+	// clang-format on
+
+	qL->x1 = x1[0];
+	qL->x2 = x2[0];
+	qL->y1 = y1[0];
+	qL->y2 = y2[0];
+	rL->y1 = z1[0];
+	rL->y2 = z2[0];
+	qR->x1 = x1[1];
+	qR->x2 = x2[1];
+	qR->y1 = y1[1];
+	qR->y2 = y2[1];
+	rR->y1 = z1[1];
+	rR->y2 = z2[1];
+}
+#else
+static void eq2_process_two(struct biquad (*bq)[2], float *data0,
+			    float *data1, int count)
+{
+	eq2_process_one(&bq[0], data0, data1, count);
+	eq2_process_one(&bq[1], data0, data1, count);
+}
+#endif
+
+/* Split input data using two LR4 filters, put the result into the input array
+ * and another array.
+ *
+ * data0 --+-- lp --> data0
+ *         |
+ *         \-- hp --> data1
+ */
+#if defined(DSP_OPS_VEX)
+/* The history of lp and hp for both channels, one filter per lane. */
+struct lr42_vec {
+	vfloat x1, x2, y1, y2, z1, z2;
+	vfloat b0, b1, b2, a1, a2;
+};
+
+static inline void lr42_vec_load(struct lr42_vec *v, const struct lr42 *lp,
+				 const struct lr42 *hp)
+{
+	v->x1 = (vfloat){ lp->x1L, hp->x1L, lp->x1R, hp->x1R };
+	v->x2 = (vfloat){ lp->x2L, hp->x2L, lp->x2R, hp->x2R };
+	v->y1 = (vfloat){ lp->y1L, hp->y1L, lp->y1R, hp->y1R };
+	v->y2 = (vfloat){ lp->y2L, hp->y2L, lp->y2R, hp->y2R };
+	v->z1 = (vfloat){ lp->z1L, hp->z1L, lp->z1R, hp->z1R };
+	v->z2 = (vfloat){ lp->z2L, hp->z2L, lp->z2R, hp->z2R };
+	v->b0 = (vfloat){ lp->b0, hp->b0, lp->b0, hp->b0 };
+	v->b1 = (vfloat){ lp->b1, hp->b1, lp->b1, hp->b1 };
+	v->b2 = (vfloat){ lp->b2, hp->b2, lp->b2, hp->b2 };
+	v->a1 = (vfloat){ lp->a1, hp->a1, lp->a1, hp->a1 };
+	v->a2 = (vfloat){ lp->a2, hp->a2, lp->a2, hp->a2 };
+}
+
+static inline void lr42_vec_store(const struct lr42_vec *v, struct lr42 *lp,
+				  struct lr42 *hp)
+{
+	lp->x1L = v->x1[0];
+	lp->x1R = v->x1[2];
+	lp->x2L = v->x2[0];
+	lp->x2R = v->x2[2];
+	lp->y1L = v->y1[0];
+	lp->y1R = v->y1[2];
+	lp->y2L = v->y2[0];
+	lp->y2R = v->y2[2];
+	lp->z1L = v->z1[0];
+	lp->z1R = v->z1[2];
+	lp->z2L = v->z2[0];
+	lp->z2R = v->z2[2];
+
+	hp->x1L = v->x1[1];
+	hp->x1R = v->x1[3];
+	hp->x2L = v->x2[1];
+	hp->x2R = v->x2[3];
+	hp->y1L = v->y1[1];
+	hp->y1R = v->y1[3];
+	hp->y2L = v->y2[1];
+	hp->y2R = v->y2[3];
+	hp->z1L = v->z1[1];
+	hp->z1R = v->z1[3];
+	hp->z2L = v->z2[1];
+	hp->z2R = v->z2[3];
+}
+
+/* Runs both biquads of lp and hp on the input x, returns the output z. */
+static inline vfloat lr42_vec_step(struct lr42_vec *v, vfloat x)
+{
+	vfloat y, z;
+
+	y = v->b0 * x + v->b1 * v->x1 + v->b2 * v->x2 - v->a1 * v->y1 -
+	    v->a2 * v->y2;
+	z = v->b0 * y + v->b1 * v->y1 + v->b2 * v->y2 - v->a1 * v->z1 -
+	    v->a2 * v->z2;
+	v->x2 = v->x1;
+	v->x1 = x;
+	v->y2 = v->y1;
+	v->y1 = y;
+	v->z2 = v->z1;
+	v->z1 = z;
+	return z;
+}
+
+static void lr42_split(struct lr42 *lp, struct lr42 *hp, int count,
+		       float *data0L, float *data0R, float *data1L,
+		       float *data1R)
+{
+	struct lr42_vec v;
+	int i;
+
+	lr42_vec_load(&v, lp, hp);
+	for (i = 0; i < count; i++) {
+		vfloat x = { data0L[i], data0L[i], data0R[i], data0R[i] };
+		vfloat z = lr42_vec_step(&v, x);
+
+		data0L[i] = z[0];
+		data1L[i] = z[1];
+		data0R[i] = z[2];
+		data1R[i] = z[3];
+	}
+	lr42_vec_store(&v, lp, hp);
+}
+#elif defined(__ARM_NEON__)
+#include <arm_neon.h>
+static void lr42_split(struct lr42 *lp, struct lr42 *hp, int count,
+		       float *data0L, float *data0R, float *data1L,
+		       float *data1R)
+{
+	float32x4_t x1 = { lp->x1L, hp->x1L, lp->x1R, hp->x1R };
+	float32x4_t x2 = { lp->x2L, hp->x2L, lp->x2R, hp->x2R };
+	float32x4_t y1 = { lp->y1L, hp->y1L, lp->y1R, hp->y1R };
+	float32x4_t y2 = { lp->y2L, hp->y2L, lp->y2R, hp->y2R };
+	float32x4_t z1 = { lp->z1L, hp->z1L, lp->z1R, hp->z1R };
+	float32x4_t z2 = { lp->z2L, hp->z2L, lp->z2R, hp->z2R };
+	float32x4_t b0 = { lp->b0, hp->b0, lp->b0, hp->b0 };
+	float32x4_t b1 = { lp->b1, hp->b1, lp->b1, hp->b1 };
+	float32x4_t b2 = { lp->b2, hp->b2, lp->b2, hp->b2 };
+	float32x4_t a1 = { lp->a1, hp->a1, lp->a1, hp->a1 };
+	float32x4_t a2 = { lp->a2, hp->a2, lp->a2, hp->a2 };
+
+	// clang-format off
+	__asm__ __volatile__(
+		/* q0 = x, q1 = y, q2 = z */
+		"1:                                     \n"
+		"vmul.f32 q1, %q[b1], %q[x1]            \n"
+		"vld1.32 d0[], [%[data0L]]              \n"
+		"vld1.32 d1[], [%[data0R]]              \n"
+		"subs %[count], #1                      \n"
+		"vmul.f32 q2, %q[b1], %q[y1]            \n"
+		"vmla.f32 q1, %q[b0], q0                \n"
+		"vmla.f32 q1, %q[b2], %q[x2]            \n"
+		"vmov.f32 %q[x2], %q[x1]                \n"
+		"vmov.f32 %q[x1], q0                    \n"
+		"vmls.f32 q1, %q[a1], %q[y1]            \n"
+		"vmls.f32 q1, %q[a2], %q[y2]            \n"
+		"vmla.f32 q2, %q[b0], q1                \n"
+		"vmla.f32 q2, %q[b2], %q[y2]            \n"
+		"vmov.f32 %q[y2], %q[y1]                \n"
+		"vmov.f32 %q[y1], q1                    \n"
+		"vmls.f32 q2, %q[a1], %q[z1]            \n"
+		"vmls.f32 q2, %q[a2], %q[z2]            \n"
+		"vmov.f32 %q[z2], %q[z1]                \n"
+		"vmov.f32 %q[z1], q2                    \n"
+		"vst1.f32 d4[0], [%[data0L]]!           \n"
+		"vst1.f32 d4[1], [%[data1L]]!           \n"
+		"vst1.f32 d5[0], [%[data0R]]!           \n"
+		"vst1.f32 d5[1], [%[data1R]]!           \n"
+		"bne 1b                                 \n"
+		: /* output */
+		  "=r"(data0L),
+		  "=r"(data0R),
+		  "=r"(data1L),
+		  "=r"(data1R),
+		  "=r"(count),
+		  [x1]"+w"(x1),
+		  [x2]"+w"(x2),
+		  [y1]"+w"(y1),
+		  [y2]"+w"(y2),
+		  [z1]"+w"(z1),
+		  [z2]"+w"(z2)
+		: /* input */
+		  [data0L]"0"(data0L),
+		  [data0R]"1"(data0R),
+		  [data1L]"2"(data1L),
+		  [data1R]"3"(data1R),
+		  [count]"4"(count),
+		  [b0]"w"(b0),
+		  [b1]"w"(b1),
+		  [b2]"w"(b2),
+		  [a1]"w"(a1),
+		  [a2]"w"(a2)
+		: /* clobber */
+		  "q0", "q1", "q2", "memory", "cc");
+	// clang-format on
+
+	lp->x1L = x1[0];
+	lp->x1R = x1[2];
+	lp->x2L = x2[0];
+	lp->x2R = x2[2];
+	lp->y1L = y1[0];
+	lp->y1R = y1[2];
+	lp->y2L = y2[0];
+	lp->y2R = y2[2];
+	lp->z1L = z1[0];
+	lp->z1R = z1[2];
+	lp->z2L = z2[0];
+	lp->z2R = z2[2];
+
+	hp->x1L = x1[1];
+	hp->x1R = x1[3];
+	hp->x2L = x2[1];
+	hp->x2R = x2[3];
+	hp->y1L = y1[1];
+	hp->y1R = y1[3];
+	hp->y2L = y2[1];
+	hp->y2R = y2[3];
+	hp->z1L = z1[1];
+	hp->z1R = z1[3];
+	hp->z2L = z2[1];
+	hp->z2R = z2[3];
+}
+#elif defined(__SSE3__) && defined(__x86_64__)
+#include <emmintrin.h>
+static void lr42_split(struct lr42 *lp, struct lr42 *hp, int count,
+		       float *data0L, float *data0R, float *data1L,
+		       float *data1R)
+{
+	__m128 x1 = { lp->x1L, hp->x1L, lp->x1R, hp->x1R };
+	__m128 x2 = { lp->x2L, hp->x2L, lp->x2R, hp->x2R };
+	__m128 y1 = { lp->y1L, hp->y1L, lp->y1R, hp->y1R };
+	__m128 y2 = { lp->y2L, hp->y2L, lp->y2R, hp->y2R };
+	__m128 z1 = { lp->z1L, hp->z1L, lp->z1R, hp->z1R };
+	__m128 z2 = { lp->z2L, hp->z2L, lp->z2R, hp->z2R };
+	__m128 b0 = { lp->b0, hp->b0, lp->b0, hp->b0 };
+	__m128 b1 = { lp->b1, hp->b1, lp->b1, hp->b1 };
+	__m128 b2 = { lp->b2, hp->b2, lp->b2, hp->b2 };
+	__m128 a1 = { lp->a1, hp->a1, lp->a1, hp->a1 };
+	__m128 a2 = { lp->a2, hp->a2, lp->a2, hp->a2 };
+
+	// clang-format off
+	__asm__ __volatile__(
+		"1:                                     \n"
+		"movss (%[data0L]), %%xmm2              \n"
+		"movss (%[data0R]), %%xmm1              \n"
+		"shufps $0, %%xmm1, %%xmm2              \n"
+		"mulps %[b2],%[x2]                      \n"
+		"movaps %[b0], %%xmm0                   \n"
+		"mulps %[a2],%[z2]                      \n"
+		"movaps %[b1], %%xmm1                   \n"
+		"mulps %%xmm2,%%xmm0                    \n"
+		"mulps %[x1],%%xmm1                     \n"
+		"addps %%xmm1,%%xmm0                    \n"
+		"movaps %[a1],%%xmm1                    \n"
+		"mulps %[y1],%%xmm1                     \n"
+		"addps %[x2],%%xmm0                     \n"
+		"movaps %[b1],%[x2]                     \n"
+		"mulps %[y1],%[x2]                      \n"
+		"subps %%xmm1,%%xmm0                    \n"
+		"movaps %[a2],%%xmm1                    \n"
+		"mulps %[y2],%%xmm1                     \n"
+		"mulps %[b2],%[y2]                      \n"
+		"subps %%xmm1,%%xmm0                    \n"
+		"movaps %[b0],%%xmm1                    \n"
+		"mulps %%xmm0,%%xmm1                    \n"
+		"addps %[x2],%%xmm1                     \n"
+		"movaps %[x1],%[x2]                     \n"
+		"movaps %%xmm2,%[x1]                    \n"
+		"addps %[y2],%%xmm1                     \n"
+		"movaps %[a1],%[y2]                     \n"
+		"mulps %[z1],%[y2]                      \n"
+		"subps %[y2],%%xmm1                     \n"
+		"movaps %[y1],%[y2]                     \n"
+		"movaps %%xmm0,%[y1]                    \n"
+		"subps %[z2],%%xmm1                     \n"
+		"movaps %[z1],%[z2]                     \n"
+		"movaps %%xmm1,%[z1]                    \n"
+		"movss %%xmm1, (%[data0L])              \n"
+		"shufps $0x39, %%xmm1, %%xmm1           \n"
+		"movss %%xmm1, (%[data1L])              \n"
+		"shufps $0x39, %%xmm1, %%xmm1           \n"
+		"movss %%xmm1, (%[data0R])              \n"
+		"shufps $0x39, %%xmm1, %%xmm1           \n"
+		"movss %%xmm1, (%[data1R])              \n"
+		"add $4, %[data0L]                      \n"
+		"add $4, %[data1L]                      \n"
+		"add $4, %[data0R]                      \n"
+		"add $4, %[data1R]                      \n"
+		"sub $1, %[count]                       \n"
+		"jnz 1b                                 \n"
+		: /* output */
+		  [data0L]"+r"(data0L),
+		  [data0R]"+r"(data0R),
+		  [data1L]"+r"(data1L),
+		  [data1R]"+r"(data1R),
+		  [count]"+r"(count),
+		  [x1]"+x"(x1),
+		  [x2]"+x"(x2),
+		  [y1]"+x"(y1),
+		  [y2]"+x"(y2),
+		  [z1]"+x"(z1),
+		  [z2]"+x"(z2)
+		: /* input */
+		  [b0]"x"(b0),
+		  [b1]"x"(b1),
+		  [b2]"x"(b2),
+		  [a1]"x"(a1),
+		  [a2]"x"(a2)
+		: /* clobber */
+		  "xmm0", "xmm1", "xmm2", "memory", "cc");
+	// clang-format on
+
+	lp->x1L = x1[0];
+	lp->x1R = x1[2];
+	lp->x2L = x2[0];
+	lp->x2R = x2[2];
+	lp->y1L = y1[0];
+	lp->y1R = y1[2];
+	lp->y2L = y2[0];
+	lp->y2R = y2[2];
+	lp->z1L = z1[0];
+	lp->z1R = z1[2];
+	lp->z2L = z2[0];
+	lp->z2R = z2[2];
+
+	hp->x1L = x1[1];
+	hp->x1R = x1[3];
+	hp->x2L = x2[1];
+	hp->x2R = x2[3];
+	hp->y1L = y1[1];
+	hp->y1R = y1[3];
+	hp->y2L = y2[1];
+	hp->y2R = y2[3];
+	hp->z1L = z1[1];
+	hp->z1R = z1[3];
+	hp->z2L = z2[1];
+	hp->z2R = z2[3];
+}
+#else
+static void lr42_split(struct lr42 *lp, struct lr42 *hp, int count,
+		       float *data0L, float *data0R, float *data1L,
+		       float *data1R)
+{
+	float lx1L = lp->x1L, lx1R = lp->x1R;
+	float lx2L = lp->x2L, lx2R = lp->x2R;
+	float ly1L = lp->y1L, ly1R = lp->y1R;
+	float ly2L = lp->y2L, ly2R = lp->y2R;
+	float lz1L = lp->z1L, lz1R = lp->z1R;
+	float lz2L = lp->z2L, lz2R = lp->z2R;
+	float lb0 = lp->b0;
+	float lb1 = lp->b1;
+	float lb2 = lp->b2;
+	float la1 = lp->a1;
+	float la2 = lp->a2;
+
+	float hx1L = hp->x1L, hx1R = hp->x1R;
+	float hx2L = hp->x2L, hx2R = hp->x2R;
+	float hy1L = hp->y1L, hy1R = hp->y1R;
+	float hy2L = hp->y2L, hy2R = hp->y2R;
+	float hz1L = hp->z1L, hz1R = hp->z1R;
+	float hz2L = hp->z2L, hz2R = hp->z2R;
+	float hb0 = hp->b0;
+	float hb1 = hp->b1;
+	float hb2 = hp->b2;
+	float ha1 = hp->a1;
+	float ha2 = hp->a2;
+
+	int i;
+	for (i = 0; i < count; i++) {
+		float xL, yL, zL, xR, yR, zR;
+		xL = data0L[i];
+		xR = data0R[i];
+		yL = lb0 * xL + lb1 * lx1L + lb2 * lx2L - la1 * ly1L -
+		     la2 * ly2L;
+		yR = lb0 * xR + lb1 * lx1R + lb2 * lx2R - la1 * ly1R -
+		     la2 * ly2R;
+		zL = lb0 * yL + lb1 * ly1L + lb2 * ly2L - la1 * lz1L -
+		     la2 * lz2L;
+		zR = lb0 * yR + lb1 * ly1R + lb2 * ly2R - la1 * lz1R -
+		     la2 * lz2R;
+		lx2L = lx1L;
+		lx2R = lx1R;
+		lx1L = xL;
+		lx1R = xR;
+		ly2L = ly1L;
+		ly2R = ly1R;
+		ly1L = yL;
+		ly1R = yR;
+		lz2L = lz1L;
+		lz2R = lz1R;
+		lz1L = zL;
+		lz1R = zR;
+		data0L[i] = zL;
+		data0R[i] = zR;
+
+		yL = hb0 * xL + hb1 * hx1L + hb2 * hx2L - ha1 * hy1L -
+		     ha2 * hy2L;
+		yR = hb0 * xR + hb1 * hx1R + hb2 * hx2R - ha1 * hy1R -
+		     ha2 * hy2R;
+		zL = hb0 * yL + hb1 * hy1L + hb2 * hy2L - ha1 * hz1L -
+		     ha2 * hz2L;
+		zR = hb0 * yR + hb1 * hy1R + hb2 * hy2R - ha1 * hz1R -
+		     ha2 * hz2R;
+		hx2L = hx1L;
+		hx2R = hx1R;
+		hx1L = xL;
+		hx1R = xR;
+		hy2L = hy1L;
+		hy2R = hy1R;
+		hy1L = yL;
+		hy1R = yR;
+		hz2L = hz1L;
+		hz2R = hz1R;
+		hz1L = zL;
+		hz1R = zR;
+		data1L[i] = zL;
+		data1R[i] = zR;
+	}
+
+	lp->x1L = lx1L;
+	lp->x1R = lx1R;
+	lp->x2L = lx2L;
+	lp->x2R = lx2R;
+	lp->y1L = ly1L;
+	lp->y1R = ly1R;
+	lp->y2L = ly2L;
+	lp->y2R = ly2R;
+	lp->z1L = lz1L;
+	lp->z1R = lz1R;
+	lp->z2L = lz2L;
+	lp->z2R = lz2R;
+
+	hp->x1L = hx1L;
+	hp->x1R = hx1R;
+	hp->x2L = hx2L;
+	hp->x2R = hx2R;
+	hp->y1L = hy1L;
+	hp->y1R = hy1R;
+	hp->y2L = hy2L;
+	hp->y2R = hy2R;
+	hp->z1L = hz1L;
+	hp->z1R = hz1R;
+	hp->z2L = hz2L;
+	hp->z2R = hz2R;
+}
+#endif
+
+/* Split input data using two LR4 filters and sum them back to the original
+ * data array.
+ *
+ * data --+-- lp --+--> data
+ *        |        |
+ *        \-- hp --/
+ */
+#if defined(DSP_OPS_VEX)
+static void lr42_merge(struct lr42 *lp, struct lr42 *hp, int count,
+		       float *dataL, float *dataR)
+{
+	struct lr42_vec v;
+	int i;
+
+	lr42_vec_load(&v, lp, hp);
+	for (i = 0; i < count; i++) {
+		vfloat x = { dataL[i], dataL[i], dataR[i], dataR[i] };
+		vfloat z = lr42_vec_step(&v, x);
+
+		dataL[i] = z[0] + z[1];
+		dataR[i] = z[2] + z[3];
+	}
+	lr42_vec_store(&v, lp, hp);
+}
+#elif defined(__ARM_NEON__)
+#include <arm_neon.h>
+static void lr42_merge(struct lr42 *lp, struct lr42 *hp, int count,
+		       float *dataL, float *dataR)
+{
+	float32x4_t x1 = { lp->x1L, hp->x1L, lp->x1R, hp->x1R };
+	float32x4_t x2 = { lp->x2L, hp->x2L, lp->x2R, hp->x2R };
+	float32x4_t y1 = { lp->y1L, hp->y1L, lp->y1R, hp->y1R };
+	float32x4_t y2 = { lp->y2L, hp->y2L, lp->y2R, hp->y2R };
+	float32x4_t z1 = { lp->z1L, hp->z1L, lp->z1R, hp->z1R };
+	float32x4_t z2 = { lp->z2L, hp->z2L, lp->z2R, hp->z2R };
+	float32x4_t b0 = { lp->b0, hp->b0, lp->b0, hp->b0 };
+	float32x4_t b1 = { lp->b1, hp->b1, lp->b1, hp->b1 };
+	float32x4_t b2 = { lp->b2, hp->b2, lp->b2, hp->b2 };
+	float32x4_t a1 = { lp->a1, hp->a1, lp->a1, hp->a1 };
+	float32x4_t a2 = { lp->a2, hp->a2, lp->a2, hp->a2 };
+
+	// clang-format off
+	__asm__ __volatile__(
+		/* q0 = x, q1 = y, q2 = z */
+		"1:                                     \n"
+		"vmul.f32 q1, %q[b1], %q[x1]            \n"
+		"vld1.32 d0[], [%[dataL]]               \n"
+		"vld1.32 d1[], [%[dataR]]               \n"
+		"subs %[count], #1                      \n"
+		"vmul.f32 q2, %q[b1], %q[y1]            \n"
+		"vmla.f32 q1, %q[b0], q0                \n"
+		"vmla.f32 q1, %q[b2], %q[x2]            \n"
+		"vmov.f32 %q[x2], %q[x1]                \n"
+		"vmov.f32 %q[x1], q0                    \n"
+		"vmls.f32 q1, %q[a1], %q[y1]            \n"
+		"vmls.f32 q1, %q[a2], %q[y2]            \n"
+		"vmla.f32 q2, %q[b0], q1                \n"
+		"vmla.f32 q2, %q[b2], %q[y2]            \n"
+		"vmov.f32 %q[y2], %q[y1]                \n"
+		"vmov.f32 %q[y1], q1                    \n"
+		"vmls.f32 q2, %q[a1], %q[z1]            \n"
+		"vmls.f32 q2, %q[a2], %q[z2]            \n"
+		"vmov.f32 %q[z2], %q[z1]                \n"
+		"vmov.f32 %q[z1], q2                    \n"
+		"vpadd.f32 d4, d4, d5                   \n"
+		"vst1.f32 d4[0], [%[dataL]]!            \n"
+		"vst1.f32 d4[1], [%[dataR]]!            \n"
+		"bne 1b                                 \n"
+		: /* output */
+		  "=r"(dataL),
+		  "=r"(dataR),
+		  "=r"(count),
+		  [x1]"+w"(x1),
+		  [x2]"+w"(x2),
+		  [y1]"+w"(y1),
+		  [y2]"+w"(y2),
+		  [z1]"+w"(z1),
+		  [z2]"+w"(z2)
+		: /* input */
+		  [dataL]"0"(dataL),
+		  [dataR]"1"(dataR),
+		  [count]"2"(count),
+		  [b0]"w"(b0),
+		  [b1]"w"(b1),
+		  [b2]"w"(b2),
+		  [a1]"w"(a1),
+		  [a2]"w"(a2)
+		: /* clobber */
+		  "q0", "q1", "q2", "memory", "cc");
+	// clang-format on
+
+	lp->x1L = x1[0];
+	lp->x1R = x1[2];
+	lp->x2L = x2[0];
+	lp->x2R = x2[2];
+	lp->y1L = y1[0];
+	lp->y1R = y1[2];
+	lp->y2L = y2[0];
+	lp->y2R = y2[2];
+	lp->z1L = z1[0];
+	lp->z1R = z1[2];
+	lp->z2L = z2[0];
+	lp->z2R = z2[2];
+
+	hp->x1L = x1[1];
+	hp->x1R = x1[3];
+	hp->x2L = x2[1];
+	hp->x2R = x2[3];
+	hp->y1L = y1[1];
+	hp->y1R = y1[3];
+	hp->y2L = y2[1];
+	hp->y2R = y2[3];
+	hp->z1L = z1[1];
+	hp->z1R = z1[3];
+	hp->z2L = z2[1];
+	hp->z2R = z2[3];
+}
+#elif defined(__SSE3__) && defined(__x86_64__)
+#include <emmintrin.h>
+static void lr42_merge(struct lr42 *lp, struct lr42 *hp, int count,
+		       float *dataL, float *dataR)
+{
+	__m128 x1 = { lp->x1L, hp->x1L, lp->x1R, hp->x1R };
+	__m128 x2 = { lp->x2L, hp->x2L, lp->x2R, hp->x2R };
+	__m128 y1 = { lp->y1L, hp->y1L, lp->y1R, hp->y1R };
+	__m128 y2 = { lp->y2L, hp->y2L, lp->y2R, hp->y2R };
+	__m128 z1 = { lp->z1L, hp->z1L, lp->z1R, hp->z1R };
+	__m128 z2 = { lp->z2L, hp->z2L, lp->z2R, hp->z2R };
+	__m128 b0 = { lp->b0, hp->b0, lp->b0, hp->b0 };
+	__m128 b1 = { lp->b1, hp->b1, lp->b1, hp->b1 };
+	__m128 b2 = { lp->b2, hp->b2, lp->b2, hp->b2 };
+	__m128 a1 = { lp->a1, hp->a1, lp->a1, hp->a1 };
+	__m128 a2 = { lp->a2, hp->a2, lp->a2, hp->a2 };
+
+	// clang-format off
+	__asm__ __volatile__(
+		"1:                                     \n"
+		"movss (%[dataL]), %%xmm2               \n"
+		"movss (%[dataR]), %%xmm1               \n"
+		"shufps $0, %%xmm1, %%xmm2              \n"
+		"mulps %[b2],%[x2]                      \n"
+		"movaps %[b0], %%xmm0                   \n"
+		"mulps %[a2],%[z2]                      \n"
+		"movaps %[b1], %%xmm1                   \n"
+		"mulps %%xmm2,%%xmm0                    \n"
+		"mulps %[x1],%%xmm1                     \n"
+		"addps %%xmm1,%%xmm0                    \n"
+		"movaps %[a1],%%xmm1                    \n"
+		"mulps %[y1],%%xmm1                     \n"
+		"addps %[x2],%%xmm0                     \n"
+		"movaps %[b1],%[x2]                     \n"
+		"mulps %[y1],%[x2]                      \n"
+		"subps %%xmm1,%%xmm0                    \n"
+		"movaps %[a2],%%xmm1                    \n"
+		"mulps %[y2],%%xmm1                     \n"
+		"mulps %[b2],%[y2]                      \n"
+		"subps %%xmm1,%%xmm0                    \n"
+		"movaps %[b0],%%xmm1                    \n"
+		"mulps %%xmm0,%%xmm1                    \n"
+		"addps %[x2],%%xmm1                     \n"
+		"movaps %[x1],%[x2]                     \n"
+		"movaps %%xmm2,%[x1]                    \n"
+		"addps %[y2],%%xmm1                     \n"
+		"movaps %[a1],%[y2]                     \n"
+		"mulps %[z1],%[y2]                      \n"
+		"subps %[y2],%%xmm1                     \n"
+		"movaps %[y1],%[y2]                     \n"
+		"movaps %%xmm0,%[y1]                    \n"
+		"subps %[z2],%%xmm1                     \n"
+		"movaps %[z1],%[z2]                     \n"
+		"movaps %%xmm1,%[z1]                    \n"
+		"haddps %%xmm1, %%xmm1                  \n"
+		"movss %%xmm1, (%[dataL])               \n"
+		"shufps $0x39, %%xmm1, %%xmm1           \n"
+		"movss %%xmm1, (%[dataR])               \n"
+		"add $4, %[dataL]                       \n"
+		"add $4, %[dataR]                       \n"
+		"sub $1, %[count]                       \n"
+		"jnz 1b                                 \n"
+		: /* output */
+		  [dataL]"+r"(dataL),
+		  [dataR]"+r"(dataR),
+		  [count]"+r"(count),
+		  [x1]"+x"(x1),
+		  [x2]"+x"(x2),
+		  [y1]"+x"(y1),
+		  [y2]"+x"(y2),
+		  [z1]"+x"(z1),
+		  [z2]"+x"(z2)
+		: /* input */
+		  [b0]"x"(b0),
+		  [b1]"x"(b1),
+		  [b2]"x"(b2),
+		  [a1]"x"(a1),
+		  [a2]"x"(a2)
+		: /* clobber */
+		  "xmm0", "xmm1", "xmm2", "memory", "cc");
+	// clang-format on
+
+	lp->x1L = x1[0];
+	lp->x1R = x1[2];
+	lp->x2L = x2[0];
+	lp->x2R = x2[2];
+	lp->y1L = y1[0];
+	lp->y1R = y1[2];
+	lp->y2L = y2[0];
+	lp->y2R = y2[2];
+	lp->z1L = z1[0];
+	lp->z1R = z1[2];
+	lp->z2L = z2[0];
+	lp->z2R = z2[2];
+
+	hp->x1L = x1[1];
+	hp->x1R = x1[3];
+	hp->x2L = x2[1];
+	hp->x2R = x2[3];
+	hp->y1L = y1[1];
+	hp->y1R = y1[3];
+	hp->y2L = y2[1];
+	hp->y2R = y2[3];
+	hp->z1L = z1[1];
+	hp->z1R = z1[3];
+	hp->z2L = z2[1];
+	hp->z2R = z2[3];
+}
+#else
+static void lr42_merge(struct lr42 *lp, struct lr42 *hp, int count,
+		       float *dataL, float *dataR)
+{
+	float lx1L = lp->x1L, lx1R = lp->x1R;
+	float lx2L = lp->x2L, lx2R = lp->x2R;
+	float ly1L = lp->y1L, ly1R = lp->y1R;
+	float ly2L = lp->y2L, ly2R = lp->y2R;
+	float lz1L = lp->z1L, lz1R = lp->z1R;
+	float lz2L = lp->z2L, lz2R = lp->z2R;
+	float lb0 = lp->b0;
+	float lb1 = lp->b1;
+	float lb2 = lp->b2;
+	float la1 = lp->a1;
+	float la2 = lp->a2;
+
+	float hx1L = hp->x1L, hx1R = hp->x1R;
+	float hx2L = hp->x2L, hx2R = hp->x2R;
+	float hy1L = hp->y1L, hy1R = hp->y1R;
+	float hy2L = hp->y2L, hy2R = hp->y2R;
+	float hz1L = hp->z1L, hz1R = hp->z1R;
+	float hz2L = hp->z2L, hz2R = hp->z2R;
+	float hb0 = hp->b0;
+	float hb1 = hp->b1;
+	float hb2 = hp->b2;
+	float ha1 = hp->a1;
+	float ha2 = hp->a2;
+
+	int i;
+	for (i = 0; i < count; i++) {
+		float xL, yL, zL, xR, yR, zR;
+		xL = dataL[i];
+		xR = dataR[i];
+		yL = lb0 * xL + lb1 * lx1L + lb2 * lx2L - la1 * ly1L -
+		     la2 * ly2L;
+		yR = lb0 * xR + lb1 * lx1R + lb2 * lx2R - la1 * ly1R -
+		     la2 * ly2R;
+		zL = lb0 * yL + lb1 * ly1L + lb2 * ly2L - la1 * lz1L -
+		     la2 * lz2L;
+		zR = lb0 * yR + lb1 * ly1R + lb2 * ly2R - la1 * lz1R -
+		     la2 * lz2R;
+		lx2L = lx1L;
+		lx2R = lx1R;
+		lx1L = xL;
+		lx1R = xR;
+		ly2L = ly1L;
+		ly2R = ly1R;
+		ly1L = yL;
+		ly1R = yR;
+		lz2L = lz1L;
+		lz2R = lz1R;
+		lz1L = zL;
+		lz1R = zR;
+
+		yL = hb0 * xL + hb1 * hx1L + hb2 * hx2L - ha1 * hy1L -
+		     ha2 * hy2L;
+		yR = hb0 * xR + hb1 * hx1R + hb2 * hx2R - ha1 * hy1R -
+		     ha2 * hy2R;
+		zL = hb0 * yL + hb1 * hy1L + hb2 * hy2L - ha1 * hz1L -
+		     ha2 * hz2L;
+		zR = hb0 * yR + hb1 * hy1R + hb2 * hy2R - ha1 * hz1R -
+		     ha2 * hz2R;
+		hx2L = hx1L;
+		hx2R = hx1R;
+		hx1L = xL;
+		hx1R = xR;
+		hy2L = hy1L;
+		hy2R = hy1R;
+		hy1L = yL;
+		hy1R = yR;
+		hz2L = hz1L;
+		hz2R = hz1R;
+		hz1L = zL;
+		hz1R = zR;
+		dataL[i] = zL + lz1L;
+		dataR[i] = zR + lz1R;
+	}
+
+	lp->x1L = lx1L;
+	lp->x1R = lx1R;
+	lp->x2L = lx2L;
+	lp->x2R = lx2R;
+	lp->y1L = ly1L;
+	lp->y1R = ly1R;
+	lp->y2L = ly2L;
+	lp->y2R = ly2R;
+	lp->z1L = lz1L;
+	lp->z1R = lz1R;
+	lp->z2L = lz2L;
+	lp->z2R = lz2R;
+
+	hp->x1L = hx1L;
+	hp->x1R = hx1R;
+	hp->x2L = hx2L;
+	hp->x2R = hx2R;
+	hp->y1L = hy1L;
+	hp->y1R = hy1R;
+	hp->y2L = hy2L;
+	hp->y2R = hy2R;
+	hp->z1L = hz1L;
+	hp->z1R = hz1R;
+	hp->z2L = hz2L;
+	hp->z2R = hz2R;
+}
+#endif
+
+#if defined(DSP_OPS_VEX)
+#include <emmintrin.h>
+
+/* Same as the SSE3 versions below, with intrinsics the compiler encodes with
+ * VEX. */
+static void deinterleave_stereo(int16_t *input, float *output1, float *output2,
+				int frames)
+{
+	const __m128 scale_2_n31 = _mm_set1_ps(1.0f / (1 << 15) / (1 << 16));
+	const __m128 scale_2_n15 = _mm_set1_ps(1.0f / (1 << 15));
+	int chunk = frames >> 2;
+
+	/* Process 4 frames (8 samples) each loop. */
+	frames &= 3;
+	while (chunk--) {
+		__m128i x = _mm_loadu_si128((const __m128i *)input);
+		__m128 l = _mm_cvtepi32_ps(_mm_slli_epi32(x, 16));
+		__m128 r = _mm_cvtepi32_ps(_mm_srai_epi32(x, 16));
+
+		_mm_storeu_ps(output1, _mm_mul_ps(l, scale_2_n31));
+		_mm_storeu_ps(output2, _mm_mul_ps(r, scale_2_n15));
+		input += 8;
+		output1 += 4;
+		output2 += 4;
+	}
+
+	/* The remaining samples. */
+	while (frames--) {
+		*output1++ = *input++ / 32768.0f;
+		*output2++ = *input++ / 32768.0f;
+	}
+}
+#define deinterleave_stereo deinterleave_stereo
+
+static void interleave_stereo(float *input1, float *input2, int16_t *output,
+			      int frames)
+{
+	const __m128i scale_2_15 = _mm_set1_epi32(15 << 23);
+	int chunk = frames >> 2;
+
+	/* Process 4 frames (8 samples) each loop. */
+	frames &= 3;
+	while (chunk--) {
+		__m128 l = _mm_loadu_ps(input1);
+		__m128 r = _mm_loadu_ps(input2);
+		__m128i lo = _mm_castps_si128(_mm_unpacklo_ps(l, r));
+		__m128i hi = _mm_castps_si128(_mm_unpackhi_ps(l, r));
+
+		/* Scale by adding 15 to the exponents. */
+		lo = _mm_cvtps_epi32(
+			_mm_castsi128_ps(_mm_adds_epi16(lo, scale_2_15)));
+		hi = _mm_cvtps_epi32(
+			_mm_castsi128_ps(_mm_adds_epi16(hi, scale_2_15)));
+		_mm_storeu_si128((__m128i *)output, _mm_packs_epi32(lo, hi));
+		input1 += 4;
+		input2 += 4;
+		output += 8;
+	}
+
+	/* The remaining samples */
+	while (frames--) {
+		float f;
+		f = *input1++ * 32768.0f;
+		f += (f >= 0) ? 0.5f : -0.5f;
+		*output++ = max(-32768, min(32767, (int)(f)));
+		f = *input2++ * 32768.0f;
+		f += (f >= 0) ? 0.5f : -0.5f;
+		*output++ = max(-32768, min(32767, (int)(f)));
+	}
+}
+#define interleave_stereo interleave_stereo
+#else
+
+/* Converts shorts in range of -32768 to 32767 to floats in range of
+ * -1.0f to 1.0f.
+ * scvtf instruction accepts fixed point ints, so sxtl is used to lengthen
+ * shorts to int with sign extension.
+ */
+#ifdef __aarch64__
+static void deinterleave_stereo(int16_t *input, float *output1, float *output2,
+				int frames)
+{
+	int chunk = frames >> 3;
+	frames &= 7;
+	/* Process 8 frames (16 samples) each loop. */
+	/* L0 R0 L1 R1 L2 R2 L3 R3... -> L0 L1 L2 L3... R0 R1 R2 R3... */
+	if (chunk) {
+		// clang-format off
+		__asm__ __volatile__(
+			"1:                                         \n"
+			"ld2  {v2.8h, v3.8h}, [%[input]], #32       \n"
+			"subs %w[chunk], %w[chunk], #1              \n"
+			"sxtl   v0.4s, v2.4h                        \n"
+			"sxtl2  v1.4s, v2.8h                        \n"
+			"sxtl   v2.4s, v3.4h                        \n"
+			"sxtl2  v3.4s, v3.8h                        \n"
+			"scvtf  v0.4s, v0.4s, #15                   \n"
+			"scvtf  v1.4s, v1.4s, #15                   \n"
+			"scvtf  v2.4s, v2.4s, #15                   \n"
+			"scvtf  v3.4s, v3.4s, #15                   \n"
+			"st1    {v0.4s, v1.4s}, [%[output1]], #32   \n"
+			"st1    {v2.4s, v3.4s}, [%[output2]], #32   \n"
+			"b.ne   1b                                  \n"
+			: /* output */
+			  [chunk]"+r"(chunk),
+			  [input]"+r"(input),
+			  [output1]"+r"(output1),
+			  [output2]"+r"(output2)
+			: /* input */
+			: /* clobber */
+			  "v0", "v1", "v2", "v3", "memory", "cc");
+		// clang-format on
+	}
+
+	/* The remaining samples. */
+	while (frames--) {
+		*output1++ = *input++ / 32768.0f;
+		*output2++ = *input++ / 32768.0f;
+	}
+}
+#define deinterleave_stereo deinterleave_stereo
+
+/* Converts floats in range of -1.0f to 1.0f to shorts in range of
+ * -32768 to 32767 with rounding to nearest, with ties (0.5) rounding away
+ * from zero.
+ * Rounding is achieved by using fcvtas instruction. (a = away)
+ * The float scaled to a range of -32768 to 32767 by adding 15 to the exponent.
+ * Add to exponent is equivalent to multiply for exponent range of 0 to 239,
+ * which is 2.59 * 10^33.  A signed saturating add (sqadd) limits exponents
+ * from 240 to 255 to clamp to 255.
+ * For very large values, beyond +/- 2 billion, fcvtas will clamp the result
+ * to the min or max value that fits an int.
+ * For other values, sqxtn clamps the output to -32768 to 32767 range.
+ */
+static void interleave_stereo(float *input1, float *input2, int16_t *output,
+			      int frames)
+{
+	/* Process 4 frames (8 samples) each loop. */
+	/* L0 L1 L2 L3, R0 R1 R2 R3 -> L0 R0 L1 R1, L2 R2 L3 R3 */
+	int chunk = frames >> 2;
+	frames &= 3;
+
+	if (chunk) {
+		// clang-format off
+		__asm__ __volatile__(
+			"dup    v2.4s, %w[scale]                    \n"
+			"1:                                         \n"
+			"ld1    {v0.4s}, [%[input1]], #16           \n"
+			"ld1    {v1.4s}, [%[input2]], #16           \n"
+			"subs   %w[chunk], %w[chunk], #1            \n"
+			"sqadd  v0.4s, v0.4s, v2.4s                 \n"
+			"sqadd  v1.4s, v1.4s, v2.4s                 \n"
+			"fcvtas v0.4s, v0.4s                        \n"
+			"fcvtas v1.4s, v1.4s                        \n"
+			"sqxtn  v0.4h, v0.4s                        \n"
+			"sqxtn  v1.4h, v1.4s                        \n"
+			"st2    {v0.4h, v1.4h}, [%[output]], #16    \n"
+			"b.ne   1b                                  \n"
+			: /* output */
+			  [chunk]"+r"(chunk),
+			  [input1]"+r"(input1),
+			  [input2]"+r"(input2),
+			  [output]"+r"(output)
+			: /* input */
+			  [scale]"r"(15 << 23)
+			: /* clobber */
+			  "v0", "v1", "v2", "memory", "cc");
+		// clang-format on
+	}
+
+	/* The remaining samples */
+	while (frames--) {
+		float f;
+		f = *input1++ * 32768.0f;
+		f += (f >= 0) ? 0.5f : -0.5f;
+		*output++ = max(-32768, min(32767, (int)(f)));
+		f = *input2++ * 32768.0f;
+		f += (f >= 0) ? 0.5f : -0.5f;
+		*output++ = max(-32768, min(32767, (int)(f)));
+	}
+}
+#define interleave_stereo interleave_stereo
+#endif
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+
+static void deinterleave_stereo(int16_t *input, float *output1, float *output2,
+				int frames)
+{
+	/* Process 8 frames (16 samples) each loop. */
+	/* L0 R0 L1 R1 L2 R2 L3 R3... -> L0 L1 L2 L3... R0 R1 R2 R3... */
+	int chunk = frames >> 3;
+	frames &= 7;
+	if (chunk) {
+		// clang-format off
+		__asm__ __volatile__(
+			"1:					    \n"
+			"vld2.16 {d0-d3}, [%[input]]!		    \n"
+			"subs %[chunk], #1			    \n"
+			"vmovl.s16 q3, d3			    \n"
+			"vmovl.s16 q2, d2			    \n"
+			"vmovl.s16 q1, d1			    \n"
+			"vmovl.s16 q0, d0			    \n"
+			"vcvt.f32.s32 q3, q3, #15		    \n"
+			"vcvt.f32.s32 q2, q2, #15		    \n"
+			"vcvt.f32.s32 q1, q1, #15		    \n"
+			"vcvt.f32.s32 q0, q0, #15		    \n"
+			"vst1.32 {d4-d7}, [%[output2]]!		    \n"
+			"vst1.32 {d0-d3}, [%[output1]]!		    \n"
+			"bne 1b					    \n"
+			: /* output */
+			  [chunk]"+r"(chunk),
+			  [input]"+r"(input),
+			  [output1]"+r"(output1),
+			  [output2]"+r"(output2)
+			: /* input */
+			: /* clobber */
+			  "q0", "q1", "q2", "q3", "memory", "cc");
+		// clang-format on
+	}
+
+	/* The remaining samples. */
+	while (frames--) {
+		*output1++ = *input++ / 32768.0f;
+		*output2++ = *input++ / 32768.0f;
+	}
+}
+#define deinterleave_stereo deinterleave_stereo
+
+/* Converts floats in range of -1.0f to 1.0f to shorts in range of
+ * -32768 to 32767 with rounding to nearest, with ties (0.5) rounding away
+ * from zero.
+ * Rounding is achieved by adding 0.5 or -0.5 adjusted for fixed point
+ * precision, and then converting float to fixed point using vcvt instruction
+ * which truncated toward zero.
+ * For very large values, beyond +/- 2 billion, vcvt will clamp the result
+ * to the min or max value that fits an int.
+ * For other values, vqmovn clamps the output to -32768 to 32767 range.
+ */
+static void interleave_stereo(float *input1, float *input2, int16_t *output,
+			      int frames)
+{
+	/* Process 4 frames (8 samples) each loop. */
+	/* L0 L1 L2 L3, R0 R1 R2 R3 -> L0 R0 L1 R1, L2 R2 L3 R3 */
+	float32x4_t pos = vdupq_n_f32(0.5f / 32768.0f);
+	float32x4_t neg = vdupq_n_f32(-0.5f / 32768.0f);
+	int chunk = frames >> 2;
+	frames &= 3;
+
+	if (chunk) {
+		// clang-format off
+		__asm__ __volatile__(
+			"veor q0, q0, q0			    \n"
+			"1:					    \n"
+			"vld1.32 {d2-d3}, [%[input1]]!		    \n"
+			"vld1.32 {d4-d5}, [%[input2]]!		    \n"
+			"subs %[chunk], #1			    \n"
+			/* We try to round to the nearest number by adding 0.5
+			 * to positive input, and adding -0.5 to the negative
+			 * input, then truncate.
+			 */
+			"vcgt.f32 q3, q1, q0			    \n"
+			"vcgt.f32 q4, q2, q0			    \n"
+			"vbsl q3, %q[pos], %q[neg]		    \n"
+			"vbsl q4, %q[pos], %q[neg]		    \n"
+			"vadd.f32 q1, q1, q3			    \n"
+			"vadd.f32 q2, q2, q4			    \n"
+			"vcvt.s32.f32 q1, q1, #15		    \n"
+			"vcvt.s32.f32 q2, q2, #15		    \n"
+			"vqmovn.s32 d2, q1			    \n"
+			"vqmovn.s32 d3, q2			    \n"
+			"vst2.16 {d2-d3}, [%[output]]!		    \n"
+			"bne 1b					    \n"
+			: /* output */
+			  [chunk]"+r"(chunk),
+			  [input1]"+r"(input1),
+			  [input2]"+r"(input2),
+			  [output]"+r"(output)
+			: /* input */
+			  [pos]"w"(pos),
+			  [neg]"w"(neg)
+			: /* clobber */
+			  "q0", "q1", "q2", "q3", "q4", "memory", "cc");
+		// clang-format on
+	}
+
+	/* The remaining samples */
+	while (frames--) {
+		float f;
+		f = *input1++ * 32768.0f;
+		f += (f >= 0) ? 0.5f : -0.5f;
+		*output++ = max(-32768, min(32767, (int)(f)));
+		f = *input2++ * 32768.0f;
+		f += (f >= 0) ? 0.5f : -0.5f;
+		*output++ = max(-32768, min(32767, (int)(f)));
+	}
+}
+#define interleave_stereo interleave_stereo
+#endif
+
+#ifdef __SSE3__
+#include <emmintrin.h>
+
+/* Converts shorts in range of -32768 to 32767 to floats in range of
+ * -1.0f to 1.0f.
+ * pslld and psrad shifts are used to isolate the low and high word, but
+ * each in a different range:
+ * The low word is shifted to the high bits in range 0x80000000 .. 0x7fff0000.
+ * The high word is shifted to the low bits in range 0x00008000 .. 0x00007fff.
+ * cvtdq2ps converts ints to floats as is.
+ * mulps is used to normalize the range of the low and high words, adjusting
+ * for high and low words being in different range.
+ */
+static void deinterleave_stereo(int16_t *input, float *output1, float *output2,
+				int frames)
+{
+	/* Process 8 frames (16 samples) each loop. */
+	/* L0 R0 L1 R1 L2 R2 L3 R3... -> L0 L1 L2 L3... R0 R1 R2 R3... */
+	int chunk = frames >> 3;
+	frames &= 7;
+	if (chunk) {
+		// clang-format off
+		__asm__ __volatile__(
+			"1:                                         \n"
+			"lddqu (%[input]), %%xmm0                   \n"
+			"lddqu 16(%[input]), %%xmm1                 \n"
+			"add $32, %[input]                          \n"
+			"movdqa %%xmm0, %%xmm2                      \n"
+			"movdqa %%xmm1, %%xmm3                      \n"
+			"pslld $16, %%xmm0                          \n"
+			"pslld $16, %%xmm1                          \n"
+			"psrad $16, %%xmm2                          \n"
+			"psrad $16, %%xmm3                          \n"
+			"cvtdq2ps %%xmm0, %%xmm0                    \n"
+			"cvtdq2ps %%xmm1, %%xmm1                    \n"
+			"cvtdq2ps %%xmm2, %%xmm2                    \n"
+			"cvtdq2ps %%xmm3, %%xmm3                    \n"
+			"mulps %[scale_2_n31], %%xmm0               \n"
+			"mulps %[scale_2_n31], %%xmm1               \n"
+			"mulps %[scale_2_n15], %%xmm2               \n"
+			"mulps %[scale_2_n15], %%xmm3               \n"
+			"movdqu %%xmm0, (%[output1])                \n"
+			"movdqu %%xmm1, 16(%[output1])              \n"
+			"movdqu %%xmm2, (%[output2])                \n"
+			"movdqu %%xmm3, 16(%[output2])              \n"
+			"add $32, %[output1]                        \n"
+			"add $32, %[output2]                        \n"
+			"sub $1, %[chunk]                           \n"
+			"jnz 1b                                     \n"
+			: /* output */
+			  [chunk]"+r"(chunk),
+			  [input]"+r"(input),
+			  [output1]"+r"(output1),
+			  [output2]"+r"(output2)
+			: /* input */
+			  [scale_2_n31]"x"(_mm_set1_ps(1.0f/(1<<15)/(1<<16))),
+			  [scale_2_n15]"x"(_mm_set1_ps(1.0f/(1<<15)))
+			: /* clobber */
+			  "xmm0", "xmm1", "xmm2", "xmm3", "memory", "cc");
+		// clang-format on
+	}
+
+	/* The remaining samples. */
+	while (frames--) {
+		*output1++ = *input++ / 32768.0f;
+		*output2++ = *input++ / 32768.0f;
+	}
+}
+#define deinterleave_stereo deinterleave_stereo
+
+/* Converts floats in range of -1.0f to 1.0f to shorts in range of
+ * -32768 to 32767 with rounding to nearest, with ties (0.5) rounding to
+ * even.
+ * For very large values, beyond +/- 2 billion, cvtps2dq will produce
+ * 0x80000000 and packssdw will clamp -32768.
+ */
+static void interleave_stereo(float *input1, float *input2, int16_t *output,
+			      int frames)
+{
+	/* Process 4 frames (8 samples) each loop. */
+	/* L0 L1 L2 L3, R0 R1 R2 R3 -> L0 R0 L1 R1, L2 R2 L3 R3 */
+	int chunk = frames >> 2;
+	frames &= 3;
+
+	if (chunk) {
+		// clang-format off
+		__asm__ __volatile__(
+			"1:                                         \n"
+			"lddqu (%[input1]), %%xmm0                  \n"
+			"lddqu (%[input2]), %%xmm2                  \n"
+			"add $16, %[input1]                         \n"
+			"add $16, %[input2]                         \n"
+			"movaps %%xmm0, %%xmm1                      \n"
+			"unpcklps %%xmm2, %%xmm0                    \n"
+			"unpckhps %%xmm2, %%xmm1                    \n"
+			"paddsw %[scale_2_15], %%xmm0               \n"
+			"paddsw %[scale_2_15], %%xmm1               \n"
+			"cvtps2dq %%xmm0, %%xmm0                    \n"
+			"cvtps2dq %%xmm1, %%xmm1                    \n"
+			"packssdw %%xmm1, %%xmm0                    \n"
+			"movdqu %%xmm0, (%[output])                 \n"
+			"add $16, %[output]                         \n"
+			"sub $1, %[chunk]                           \n"
+			"jnz 1b                                     \n"
+			: /* output */
+			  [chunk]"+r"(chunk),
+			  [input1]"+r"(input1),
+			  [input2]"+r"(input2),
+			  [output]"+r"(output)
+			: /* input */
+			  [scale_2_15]"x"(_mm_set1_epi32(15 << 23)),
+			  [clamp_large]"x"(_mm_set1_ps(32767.0f))
+			: /* clobber */
+			  "xmm0", "xmm1", "xmm2", "memory", "cc");
+		// clang-format on
+	}
+
+	/* The remaining samples */
+	while (frames--) {
+		float f;
+		f = *input1++ * 32768.0f;
+		f += (f >= 0) ? 0.5f : -0.5f;
+		*output++ = max(-32768, min(32767, (int)(f)));
+		f = *input2++ * 32768.0f;
+		f += (f >= 0) ? 0.5f : -0.5f;
+		*output++ = max(-32768, min(32767, (int)(f)));
+	}
+}
+#define interleave_stereo interleave_stereo
+#endif
+#endif
+
+#ifndef deinterleave_stereo
+static void deinterleave_stereo(int16_t *input, float *output1, float *output2,
+				int frames)
+{
+	while (frames--) {
+		*output1++ = *input++ / 32768.0f;
+		*output2++ = *input++ / 32768.0f;
+	}
+}
+#endif
+
+#ifndef interleave_stereo
+static void interleave_stereo(float *input1, float *input2, int16_t *output,
+			      int frames)
+{
+	while (frames--) {
+		float f;
+		f = *input1++ * 32768.0f;
+		f += (f >= 0) ? 0.5f : -0.5f;
+		*output++ = max(-32768, min(32767, (int)(f)));
+		f = *input2++ * 32768.0f;
+		f += (f >= 0) ? 0.5f : -0.5f;
+		*output++ = max(-32768, min(32767, (int)(f)));
+	}
+}
+#endif
+
+/* The multichannel (de)interleave loops convert TRANSPOSE_FRAMES frames at a
+ * time. The samples of a block are contiguous in the interleaved buffer, so
+ * they are converted with straight vector loops into a float block, which is
+ * then transposed to or from the channel buffers. The loops are specialized
+ * for each channel count so the transpose is a fixed pattern of shuffles, and
+ * each build vectorizes them to the width of its instruction set. */
+#define TRANSPOSE_FRAMES 8
+
+static inline int32_t float_to_s32(float f)
+{
+	f *= 2147483648.0f;
+	f += (f >= 0) ? 0.5f : -0.5f;
+	return max((float)INT_MIN, min((float)INT_MAX, f));
+}
+
+/* Converts count interleaved samples in to floats in out. */
+static inline void to_float(enum dsp_ops_format format, const uint8_t *in,
+			    float *out, int count)
+{
+	int i;
+
+	switch (format) {
+	case DSP_OPS_S16_LE:
+		for (i = 0; i < count; i++)
+			out[i] = ((const int16_t *)in)[i] / 32768.0f;
+		break;
+	case DSP_OPS_S24_LE:
+		for (i = 0; i < count; i++)
+			out[i] = (int32_t)((uint32_t)((const int32_t *)in)[i]
+					   << 8) /
+				 2147483648.0f;
+		break;
+	case DSP_OPS_S24_3LE:
+		for (i = 0; i < count; i++, in += 3)
+			out[i] = (int32_t)((uint32_t)in[0] << 8 |
+					   (uint32_t)in[1] << 16 |
+					   (uint32_t)in[2] << 24) /
+				 2147483648.0f;
+		break;
+	case DSP_OPS_S32_LE:
+		for (i = 0; i < count; i++)
+			out[i] = ((const int32_t *)in)[i] / 2147483648.0f;
+		break;
+	case DSP_OPS_FLOAT_LE:
+		memcpy(out, in, count * sizeof(float));
+		break;
+	}
+}
+
+/* Converts count floats in in to interleaved samples in out. */
+static inline void from_float(enum dsp_ops_format format, const float *in,
+			      uint8_t *out, int count)
+{
+	int32_t tmp;
+	int i;
+
+	switch (format) {
+	case DSP_OPS_S16_LE:
+		for (i = 0; i < count; i++) {
+			float f = in[i] * 32768.0f;
+			f += (f >= 0) ? 0.5f : -0.5f;
+			((int16_t *)out)[i] = max(-32768, min(32767, (int)(f)));
+		}
+		break;
+	case DSP_OPS_S24_LE:
+		for (i = 0; i < count; i++)
+			((int32_t *)out)[i] =
+				(float_to_s32(in[i]) >> 8) & 0x00ffffff;
+		break;
+	case DSP_OPS_S24_3LE:
+		for (i = 0; i < count; i++, out += 3) {
+			tmp = float_to_s32(in[i]) >> 8;
+			out[0] = tmp;
+			out[1] = tmp >> 8;
+			out[2] = tmp >> 16;
+		}
+		break;
+	case DSP_OPS_S32_LE:
+		for (i = 0; i < count; i++)
+			((int32_t *)out)[i] = float_to_s32(in[i]);
+		break;
+	case DSP_OPS_FLOAT_LE:
+		memcpy(out, in, count * sizeof(float));
+		break;
+	}
+}
+
+static inline int format_bytes(enum dsp_ops_format format)
+{
+	switch (format) {
+	case DSP_OPS_S16_LE:
+		return 2;
+	case DSP_OPS_S24_3LE:
+		return 3;
+	default:
+		return 4;
+	}
+}
+
+static inline void deinterleave_channels(enum dsp_ops_format format,
+					 const uint8_t *input,
+					 float *const *output, int channels,
+					 int frames)
+{
+	float block[DSP_OPS_MAX_CHANNELS * TRANSPOSE_FRAMES];
+	int step = channels * format_bytes(format);
+	int i, j, n;
+
+	for (n = 0; n + TRANSPOSE_FRAMES <= frames; n += TRANSPOSE_FRAMES) {
+		to_float(format, input, block, TRANSPOSE_FRAMES * channels);
+		for (j = 0; j < channels; j++)
+			for (i = 0; i < TRANSPOSE_FRAMES; i++)
+				output[j][n + i] = block[i * channels + j];
+		input += TRANSPOSE_FRAMES * step;
+	}
+
+	/* The remaining frames. */
+	to_float(format, input, block, (frames - n) * channels);
+	for (j = 0; j < channels; j++)
+		for (i = 0; n + i < frames; i++)
+			output[j][n + i] = block[i * channels + j];
+}
+
+static inline void interleave_channels(enum dsp_ops_format format,
+				       float *const *input, uint8_t *output,
+				       int channels, int frames)
+{
+	float block[DSP_OPS_MAX_CHANNELS * TRANSPOSE_FRAMES];
+	int step = channels * format_bytes(format);
+	int i, j, n;
+
+	for (n = 0; n + TRANSPOSE_FRAMES <= frames; n += TRANSPOSE_FRAMES) {
+		for (j = 0; j < channels; j++)
+			for (i = 0; i < TRANSPOSE_FRAMES; i++)
+				block[i * channels + j] = input[j][n + i];
+		from_float(format, block, output, TRANSPOSE_FRAMES * channels);
+		output += TRANSPOSE_FRAMES * step;
+	}
+
+	/* The remaining frames. */
+	for (j = 0; j < channels; j++)
+		for (i = 0; n + i < frames; i++)
+			block[i * channels + j] = input[j][n + i];
+	from_float(format, block, output, (frames - n) * channels);
+}
+
+/* Expands to a call of fn with a constant channel count, so each count gets
+ * its own copy of the loops. */
+#define CALL_WITH_CHANNELS(fn, format, input, output, channels, frames)        \
+	do {                                                                   \
+		switch (channels) {                                            \
+		case 1:                                                        \
+			fn(format, input, output, 1, frames);                  \
+			break;                                                 \
+		case 2:                                                        \
+			fn(format, input, output, 2, frames);                  \
+			break;                                                 \
+		case 3:                                                        \
+			fn(format, input, output, 3, frames);                  \
+			break;                                                 \
+		case 4:                                                        \
+			fn(format, input, output, 4, frames);                  \
+			break;                                                 \
+		case 5:                                                        \
+			fn(format, input, output, 5, frames);                  \
+			break;                                                 \
+		case 6:                                                        \
+			fn(format, input, output, 6, frames);                  \
+			break;                                                 \
+		case 7:                                                        \
+			fn(format, input, output, 7, frames);                  \
+			break;                                                 \
+		case 8:                                                        \
+			fn(format, input, output, 8, frames);                  \
+			break;                                                 \
+		}                                                              \
+	} while (0)
+
+static void deinterleave(enum dsp_ops_format format, const uint8_t *input,
+			 float *const *output, int channels, int frames)
+{
+	switch (format) {
+	case DSP_OPS_S16_LE:
+		CALL_WITH_CHANNELS(deinterleave_channels, DSP_OPS_S16_LE, input,
+				   output, channels, frames);
+		break;
+	case DSP_OPS_S24_LE:
+		CALL_WITH_CHANNELS(deinterleave_channels, DSP_OPS_S24_LE, input,
+				   output, channels, frames);
+		break;
+	case DSP_OPS_S24_3LE:
+		CALL_WITH_CHANNELS(deinterleave_channels, DSP_OPS_S24_3LE,
+				   input, output, channels, frames);
+		break;
+	case DSP_OPS_S32_LE:
+		CALL_WITH_CHANNELS(deinterleave_channels, DSP_OPS_S32_LE, input,
+				   output, channels, frames);
+		break;
+	case DSP_OPS_FLOAT_LE:
+		CALL_WITH_CHANNELS(deinterleave_channels, DSP_OPS_FLOAT_LE,
+				   input, output, channels, frames);
+		break;
+	}
+}
+
+static void interleave(enum dsp_ops_format format, float *const *input,
+		       uint8_t *output, int channels, int frames)
+{
+	switch (format) {
+	case DSP_OPS_S16_LE:
+		CALL_WITH_CHANNELS(interleave_channels, DSP_OPS_S16_LE, input,
+				   output, channels, frames);
+		break;
+	case DSP_OPS_S24_LE:
+		CALL_WITH_CHANNELS(interleave_channels, DSP_OPS_S24_LE, input,
+				   output, channels, frames);
+		break;
+	case DSP_OPS_S24_3LE:
+		CALL_WITH_CHANNELS(interleave_channels, DSP_OPS_S24_3LE, input,
+				   output, channels, frames);
+		break;
+	case DSP_OPS_S32_LE:
+		CALL_WITH_CHANNELS(interleave_channels, DSP_OPS_S32_LE, input,
+				   output, channels, frames);
+		break;
+	case DSP_OPS_FLOAT_LE:
+		CALL_WITH_CHANNELS(interleave_channels, DSP_OPS_FLOAT_LE, input,
+				   output, channels, frames);
+		break;
+	}
+}
+
+/* Adds the samples of src to the ones of dst. */
+#if defined(DSP_OPS_VEX)
+static void accumulate(float *dst, const float *src, int count)
+{
+	int chunk = count >> 2;
+
+	/* Process 4 samples each loop. */
+	count &= 3;
+	while (chunk--) {
+		vfloat d, s;
+
+		memcpy(&d, dst, sizeof(d));
+		memcpy(&s, src, sizeof(s));
+		d += s;
+		memcpy(dst, &d, sizeof(d));
+		dst += 4;
+		src += 4;
+	}
+
+	/* The remaining samples. */
+	while (count--)
+		*dst++ += *src++;
+}
+#elif defined(__ARM_NEON__)
+#include <arm_neon.h>
+static void accumulate(float *dst, const float *src, int count)
+{
+	int chunk = count >> 2;
+
+	/* Process 4 samples each loop. */
+	count &= 3;
+	while (chunk--) {
+		vst1q_f32(dst, vaddq_f32(vld1q_f32(dst), vld1q_f32(src)));
+		dst += 4;
+		src += 4;
+	}
+
+	/* The remaining samples. */
+	while (count--)
+		*dst++ += *src++;
+}
+#elif defined(__SSE3__) && defined(__x86_64__)
+#include <emmintrin.h>
+static void accumulate(float *dst, const float *src, int count)
+{
+	int chunk = count >> 2;
+
+	/* Process 4 samples each loop. */
+	count &= 3;
+	while (chunk--) {
+		_mm_storeu_ps(dst,
+			      _mm_add_ps(_mm_loadu_ps(dst), _mm_loadu_ps(src)));
+		dst += 4;
+		src += 4;
+	}
+
+	/* The remaining samples. */
+	while (count--)
+		*dst++ += *src++;
+}
+#else
+static void accumulate(float *dst, const float *src, int count)
+{
+	while (count--)
+		*dst++ += *src++;
+}
+#endif
+
+const struct dsp_ops OPS(dsp_ops) = {
+	.eq2_process_one = eq2_process_one,
+	.eq2_process_two = eq2_process_two,
+	.lr42_split = lr42_split,
+	.lr42_merge = lr42_merge,
+	.deinterleave_stereo = deinterleave_stereo,
+	.interleave_stereo = interleave_stereo,
+	.deinterleave = deinterleave,
+	.interleave = interleave,
+	.accumulate = accumulate,
+};
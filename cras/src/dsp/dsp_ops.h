@@ -0,0 +1,93 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef DSP_OPS_H_
+#define DSP_OPS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "biquad.h"
+
+struct lr42;
+
+/* Most channels the deinterleave and interleave ops convert. */
+#define DSP_OPS_MAX_CHANNELS 8
+
+/* Sample formats of the deinterleave and interleave ops. */
+enum dsp_ops_format {
+	DSP_OPS_S16_LE,
+	DSP_OPS_S24_LE,
+	DSP_OPS_S24_3LE,
+	DSP_OPS_S32_LE,
+	DSP_OPS_FLOAT_LE,
+};
+
+extern const struct dsp_ops dsp_ops;
+extern const struct dsp_ops dsp_ops_sse42;
+extern const struct dsp_ops dsp_ops_avx;
+extern const struct dsp_ops dsp_ops_avx2;
+extern const struct dsp_ops dsp_ops_fma;
+
+/* Struct containing the two channel loops of eq2 and crossover2, and the
+ * sample conversion loops of dsp_util.
+ * Like drc_kernel_ops, the same source is built once per instruction set and
+ * dsp_set_ops() picks the one to use. dsp_ops uses the NEON or SSE code
+ * chosen at compile time, the AVX variants run the same algorithms with VEX
+ * encoded instructions.
+ *
+ * Members:
+ *   eq2_process_one: Runs bq[0][0] on data0 and bq[0][1] on data1.
+ *   eq2_process_two: Runs bq[0] then bq[1] in series on both channels.
+ *   lr42_split: Runs the left and right input in data0L and data0R through
+ *       lp and hp, storing the lowpass output in data0 and the highpass
+ *       output in data1.
+ *   lr42_merge: Runs data through lp and hp and stores their sum in data.
+ *   deinterleave_stereo: Converts interleaved S16 frames to two channels of
+ *       floats.
+ *   interleave_stereo: Converts two channels of floats to interleaved S16
+ *       frames.
+ *   deinterleave: Converts interleaved frames of format to channels
+ *       channels of floats. channels is 1 to DSP_OPS_MAX_CHANNELS.
+ *   interleave: Converts channels channels of floats to interleaved frames
+ *       of format. channels is 1 to DSP_OPS_MAX_CHANNELS.
+ *   accumulate: Adds count floats of src to the ones of dst.
+ */
+struct dsp_ops {
+	void (*eq2_process_one)(struct biquad (*bq)[2], float *data0,
+				float *data1, int count);
+	void (*eq2_process_two)(struct biquad (*bq)[2], float *data0,
+				float *data1, int count);
+	void (*lr42_split)(struct lr42 *lp, struct lr42 *hp, int count,
+			   float *data0L, float *data0R, float *data1L,
+			   float *data1R);
+	void (*lr42_merge)(struct lr42 *lp, struct lr42 *hp, int count,
+			   float *dataL, float *dataR);
+	void (*deinterleave_stereo)(int16_t *input, float *output1,
+				    float *output2, int frames);
+	void (*interleave_stereo)(float *input1, float *input2,
+				  int16_t *output, int frames);
+	void (*deinterleave)(enum dsp_ops_format format, const uint8_t *input,
+			     float *const *output, int channels, int frames);
+	void (*interleave)(enum dsp_ops_format format, float *const *input,
+			   uint8_t *output, int channels, int frames);
+	void (*accumulate)(float *dst, const float *src, int count);
+};
+
+/* Selects the loops used by all eq2, crossover2 and dsp_util users. NULL
+ * restores the default built for the target. */
+void dsp_set_ops(const struct dsp_ops *ops);
+
+/* Returns the loops selected by dsp_set_ops(). */
+const struct dsp_ops *dsp_get_ops();
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* DSP_OPS_H_ */
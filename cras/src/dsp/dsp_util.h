@@ -16,7 +16,8 @@ extern "C" {
 
 /* Converts from interleaved int16_t samples to non-interleaved float samples.
  * The int16_t samples have range [-32768, 32767], and the float samples have
- * range [-1.0, 1.0].
+ * range [-1.0, 1.0]. Other integer formats are scaled the same way, float
+ * samples are only deinterleaved.
  * Args:
  *    input - The interleaved input buffer. Every "channels" samples is a frame.
  *    output - Pointers to output buffers. There are "channels" output buffers.
@@ -30,7 +31,8 @@ int dsp_util_deinterleave(uint8_t *input, float *const *output, int channels,
 
 /* Converts from non-interleaved float samples to interleaved int16_t samples.
  * The int16_t samples have range [-32768, 32767], and the float samples have
- * range [-1.0, 1.0]. This is the inverse of dsputil_deinterleave().
+ * range [-1.0, 1.0]. This is the inverse of dsputil_deinterleave(), float
+ * output is interleaved without clipping.
  * Args:
  *    input - Pointers to input buffers. There are "channels" input buffers.
  *    output - The interleaved output buffer. Every "channels" samples is a
@@ -43,6 +45,55 @@ int dsp_util_deinterleave(uint8_t *input, float *const *output, int channels,
 int dsp_util_interleave(float *const *input, uint8_t *output, int channels,
 			snd_pcm_format_t format, int frames);
 
+/* Elementwise stereo operations dsp_util_interleave_stereo() can apply on
+ * the way out, matching the swap_lr, invert_lr and mix_stereo builtins. */
+enum dsp_util_stereo_op {
+	DSP_UTIL_STEREO_SWAP,
+	DSP_UTIL_STEREO_INVERT_LEFT,
+	DSP_UTIL_STEREO_MIX,
+};
+
+/* Same as dsp_util_interleave() for two channels, but applies op to each
+ * frame while interleaving instead of in a separate pass.
+ * Args:
+ *    input - Pointers to the two input buffers.
+ *    output - The interleaved output buffer.
+ *    op - The operation to apply to each frame.
+ *    frames - The number of frames to convert.
+ * Returns:
+ *    Negative error if format isn't supported, otherwise 0.
+ */
+int dsp_util_interleave_stereo(float *const *input, uint8_t *output,
+			       enum dsp_util_stereo_op op,
+			       snd_pcm_format_t format, int frames);
+
+/* Same as dsp_util_interleave(), but scales each frame along a ramp while
+ * interleaving instead of in a separate pass.
+ * Args:
+ *    input - Pointers to input buffers, one for each channel.
+ *    output - The interleaved output buffer.
+ *    channels - The number of channels.
+ *    format - The format of the output buffer.
+ *    frames - The number of frames to convert.
+ *    scaler - Scaler applied to the first frame.
+ *    increment - The increment(+/-) of scaler at each frame.
+ *    target - The value at which to clip the scaler.
+ * Returns:
+ *    Negative error if format isn't supported, otherwise 0.
+ */
+int dsp_util_interleave_ramp(float *const *input, uint8_t *output, int channels,
+			     snd_pcm_format_t format, int frames, float scaler,
+			     float increment, float target);
+
+/* Adds the samples of one channel to another, with the SIMD loop picked by
+ * dsp_set_ops().
+ * Args:
+ *    dst - The samples to add to.
+ *    src - The samples to add.
+ *    frames - The number of samples.
+ */
+void dsp_util_accumulate(float *dst, const float *src, int frames);
+
 /* Disables denormal numbers in floating point calculation. Denormal numbers
  * happens often in IIR filters, and it can be very slow.
  */
@@ -55,6 +55,21 @@ int eq2_append_biquad(struct eq2 *eq2, int channel, enum biquad_type type,
 int eq2_append_biquad_direct(struct eq2 *eq2, int channel,
 			     const struct biquad *biquad);
 
+/* Changes the biquad filter at index of a channel of an EQ2. The history of
+ * the filter is kept, so it can be changed while audio runs through it.
+ * Filters up to index which were not appended yet are added as identity
+ * filters.
+ * Args:
+ *    eq2 - The EQ2 we want to use.
+ *    channel - 0 or 1. The channel of the filter.
+ *    index - The position of the filter in the channel, from 0.
+ *    type, frequency, Q, gain - As in eq2_append_biquad().
+ * Returns:
+ *    0 if success. -1 if index is out of range.
+ */
+int eq2_set_biquad(struct eq2 *eq2, int channel, int index,
+		   enum biquad_type type, float freq, float Q, float gain);
+
 /* Process a buffer of audio data through the EQ2.
  * Args:
  *    eq2 - The EQ2 we want to use.
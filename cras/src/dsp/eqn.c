@@ -0,0 +1,186 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdlib.h>
+#include "eqn.h"
+
+/* Frames transposed into lane order per pass. */
+#define BLOCK_FRAMES 64
+
+/* One biquad of every channel. Unused lanes hold an identity filter. */
+struct eqn_stage {
+	float b0[EQN_MAX_CHANNELS];
+	float b1[EQN_MAX_CHANNELS];
+	float b2[EQN_MAX_CHANNELS];
+	float a1[EQN_MAX_CHANNELS];
+	float a2[EQN_MAX_CHANNELS];
+	float x1[EQN_MAX_CHANNELS];
+	float x2[EQN_MAX_CHANNELS];
+	float y1[EQN_MAX_CHANNELS];
+	float y2[EQN_MAX_CHANNELS];
+};
+
+/* Members:
+ *    num_channels - The number of channels to process.
+ *    lanes - num_channels rounded up to 4 or 8, the width of the inner
+ *        loops.
+ *    n - The number of biquads appended to each channel.
+ *    num_stages - The largest of n.
+ *    stage - The biquads, structure-of-arrays across channels.
+ *    block - Samples of BLOCK_FRAMES frames, one lane per channel.
+ */
+struct eqn {
+	int num_channels;
+	int lanes;
+	int n[EQN_MAX_CHANNELS];
+	int num_stages;
+	struct eqn_stage stage[MAX_BIQUADS_PER_EQN];
+	float block[BLOCK_FRAMES][EQN_MAX_CHANNELS];
+};
+
+struct eqn *eqn_new(int num_channels)
+{
+	struct eqn *eqn;
+	int i, j;
+
+	if (num_channels < 1 || num_channels > EQN_MAX_CHANNELS)
+		return NULL;
+
+	eqn = (struct eqn *)calloc(1, sizeof(*eqn));
+	if (!eqn)
+		return NULL;
+
+	eqn->num_channels = num_channels;
+	eqn->lanes = num_channels <= 4 ? 4 : EQN_MAX_CHANNELS;
+
+	/* Initialize all biquads to identity filter, so channels can have
+	 * different numbers of biquads. */
+	for (i = 0; i < MAX_BIQUADS_PER_EQN; i++)
+		for (j = 0; j < EQN_MAX_CHANNELS; j++)
+			eqn->stage[i].b0[j] = 1;
+
+	return eqn;
+}
+
+void eqn_free(struct eqn *eqn)
+{
+	free(eqn);
+}
+
+int eqn_append_biquad(struct eqn *eqn, int channel, enum biquad_type type,
+		      float freq, float Q, float gain)
+{
+	struct biquad bq;
+
+	biquad_set(&bq, type, freq, Q, gain);
+	return eqn_append_biquad_direct(eqn, channel, &bq);
+}
+
+int eqn_append_biquad_direct(struct eqn *eqn, int channel,
+			     const struct biquad *biquad)
+{
+	struct eqn_stage *s;
+
+	if (channel < 0 || channel >= eqn->num_channels ||
+	    eqn->n[channel] >= MAX_BIQUADS_PER_EQN)
+		return -1;
+
+	s = &eqn->stage[eqn->n[channel]++];
+	s->b0[channel] = biquad->b0;
+	s->b1[channel] = biquad->b1;
+	s->b2[channel] = biquad->b2;
+	s->a1[channel] = biquad->a1;
+	s->a2[channel] = biquad->a2;
+	s->x1[channel] = biquad->x1;
+	s->x2[channel] = biquad->x2;
+	s->y1[channel] = biquad->y1;
+	s->y2[channel] = biquad->y2;
+
+	if (eqn->n[channel] > eqn->num_stages)
+		eqn->num_stages = eqn->n[channel];
+	return 0;
+}
+
+/* Runs one stage over the transposed block. lanes is a constant at every
+ * call site, and the filter state is copied to locals so it does not alias
+ * the block, which lets the inner loop become straight vector code. */
+static inline void eqn_process_stage(struct eqn_stage *s,
+				     float (*block)[EQN_MAX_CHANNELS],
+				     int count, const int lanes)
+{
+	float b0[EQN_MAX_CHANNELS], b1[EQN_MAX_CHANNELS], b2[EQN_MAX_CHANNELS];
+	float a1[EQN_MAX_CHANNELS], a2[EQN_MAX_CHANNELS];
+	float x1[EQN_MAX_CHANNELS], x2[EQN_MAX_CHANNELS];
+	float y1[EQN_MAX_CHANNELS], y2[EQN_MAX_CHANNELS];
+	int j, l;
+
+	for (l = 0; l < lanes; l++) {
+		b0[l] = s->b0[l];
+		b1[l] = s->b1[l];
+		b2[l] = s->b2[l];
+		a1[l] = s->a1[l];
+		a2[l] = s->a2[l];
+		x1[l] = s->x1[l];
+		x2[l] = s->x2[l];
+		y1[l] = s->y1[l];
+		y2[l] = s->y2[l];
+	}
+
+	for (j = 0; j < count; j++) {
+		float *v = block[j];
+
+		for (l = 0; l < lanes; l++) {
+			float x = v[l];
+			float y = b0[l] * x + b1[l] * x1[l] + b2[l] * x2[l] -
+				  a1[l] * y1[l] - a2[l] * y2[l];
+			x2[l] = x1[l];
+			x1[l] = x;
+			y2[l] = y1[l];
+			y1[l] = y;
+			v[l] = y;
+		}
+	}
+
+	for (l = 0; l < lanes; l++) {
+		s->x1[l] = x1[l];
+		s->x2[l] = x2[l];
+		s->y1[l] = y1[l];
+		s->y2[l] = y2[l];
+	}
+}
+
+static inline void eqn_process_block(struct eqn *eqn, float *const *data,
+				     int offset, int count, const int lanes)
+{
+	int ch, i, j;
+
+	for (ch = 0; ch < eqn->num_channels; ch++)
+		for (j = 0; j < count; j++)
+			eqn->block[j][ch] = data[ch][offset + j];
+
+	for (i = 0; i < eqn->num_stages; i++)
+		eqn_process_stage(&eqn->stage[i], eqn->block, count, lanes);
+
+	for (ch = 0; ch < eqn->num_channels; ch++)
+		for (j = 0; j < count; j++)
+			data[ch][offset + j] = eqn->block[j][ch];
+}
+
+void eqn_process(struct eqn *eqn, float *const *data, int count)
+{
+	int offset, chunk;
+
+	for (offset = 0; offset < count; offset += chunk) {
+		chunk = count - offset;
+		if (chunk > BLOCK_FRAMES)
+			chunk = BLOCK_FRAMES;
+
+		if (eqn->lanes == 4)
+			eqn_process_block(eqn, data, offset, chunk, 4);
+		else
+			eqn_process_block(eqn, data, offset, chunk,
+					  EQN_MAX_CHANNELS);
+	}
+}
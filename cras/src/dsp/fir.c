@@ -0,0 +1,229 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fir.h"
+
+/* The FFT size. Each transform covers the previous and the current block. */
+#define FFT_SIZE (FIR_BLOCK_FRAMES * 2)
+/* Bins kept of the spectrum of a real signal, the rest are conjugates. */
+#define NUM_BINS (FFT_SIZE / 2 + 1)
+
+/* A spectrum with real and imaginary parts stored apart, so the multiply
+ * accumulate below runs over plain float arrays and vectorizes. */
+struct spectrum {
+	float re[NUM_BINS];
+	float im[NUM_BINS];
+};
+
+/* Members:
+ *    num_partitions - The number of FIR_BLOCK_FRAMES tap partitions.
+ *    ir - The spectra of the partitions of the impulse response.
+ *    history - The spectra of the last num_partitions input blocks.
+ *    newest - Index in history of the spectrum of the latest block.
+ *    input - The previous and the current input block.
+ *    output - The output block being played out while input fills.
+ *    pos - The number of frames of the current block received.
+ *    re, im - FFT work buffers.
+ *    twiddle_re, twiddle_im - exp(-2 pi i k / FFT_SIZE) for the first half.
+ *    bitrev - The bit reversed index of each FFT position.
+ */
+struct fir {
+	int num_partitions;
+	struct spectrum *ir;
+	struct spectrum *history;
+	int newest;
+	float input[FFT_SIZE];
+	float output[FIR_BLOCK_FRAMES];
+	int pos;
+	float re[FFT_SIZE];
+	float im[FFT_SIZE];
+	float twiddle_re[FFT_SIZE / 2];
+	float twiddle_im[FFT_SIZE / 2];
+	int bitrev[FFT_SIZE];
+};
+
+/* In place iterative radix-2 FFT of fir->re and fir->im. The inverse
+ * transform is not scaled. */
+static void fft(struct fir *fir, int inverse)
+{
+	float *re = fir->re;
+	float *im = fir->im;
+	int i, j, k, len, half, step;
+
+	for (i = 0; i < FFT_SIZE; i++) {
+		j = fir->bitrev[i];
+		if (j > i) {
+			float t = re[i];
+			re[i] = re[j];
+			re[j] = t;
+			t = im[i];
+			im[i] = im[j];
+			im[j] = t;
+		}
+	}
+
+	for (len = 2; len <= FFT_SIZE; len <<= 1) {
+		half = len / 2;
+		step = FFT_SIZE / len;
+		for (i = 0; i < FFT_SIZE; i += len) {
+			for (k = 0; k < half; k++) {
+				float wr = fir->twiddle_re[k * step];
+				float wi = inverse ? -fir->twiddle_im[k * step] :
+						     fir->twiddle_im[k * step];
+				int a = i + k;
+				int b = a + half;
+				float tr = re[b] * wr - im[b] * wi;
+				float ti = re[b] * wi + im[b] * wr;
+
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+}
+
+/* Transforms FFT_SIZE real samples and keeps the non redundant bins. */
+static void forward(struct fir *fir, const float *samples,
+		    struct spectrum *out)
+{
+	memcpy(fir->re, samples, sizeof(fir->re));
+	memset(fir->im, 0, sizeof(fir->im));
+	fft(fir, 0);
+	memcpy(out->re, fir->re, sizeof(out->re));
+	memcpy(out->im, fir->im, sizeof(out->im));
+}
+
+static void spectrum_mac(struct spectrum *restrict acc,
+			 const struct spectrum *restrict x,
+			 const struct spectrum *restrict h)
+{
+	int k;
+
+	for (k = 0; k < NUM_BINS; k++) {
+		acc->re[k] += x->re[k] * h->re[k] - x->im[k] * h->im[k];
+		acc->im[k] += x->re[k] * h->im[k] + x->im[k] * h->re[k];
+	}
+}
+
+/* Convolves the input block which just completed and refills output. */
+static void process_block(struct fir *fir)
+{
+	struct spectrum acc;
+	int p, idx, k;
+
+	fir->newest = (fir->newest + 1) % fir->num_partitions;
+	forward(fir, fir->input, &fir->history[fir->newest]);
+
+	memset(&acc, 0, sizeof(acc));
+	idx = fir->newest;
+	for (p = 0; p < fir->num_partitions; p++) {
+		spectrum_mac(&acc, &fir->history[idx], &fir->ir[p]);
+		idx = idx ? idx - 1 : fir->num_partitions - 1;
+	}
+
+	/* Rebuild the conjugate symmetric half and transform back. Only
+	 * the second half of the result is free of circular wrap. */
+	for (k = 0; k < NUM_BINS; k++) {
+		fir->re[k] = acc.re[k];
+		fir->im[k] = acc.im[k];
+	}
+	for (k = NUM_BINS; k < FFT_SIZE; k++) {
+		fir->re[k] = acc.re[FFT_SIZE - k];
+		fir->im[k] = -acc.im[FFT_SIZE - k];
+	}
+	fft(fir, 1);
+	for (k = 0; k < FIR_BLOCK_FRAMES; k++)
+		fir->output[k] = fir->re[FIR_BLOCK_FRAMES + k] / FFT_SIZE;
+
+	memmove(fir->input, fir->input + FIR_BLOCK_FRAMES,
+		FIR_BLOCK_FRAMES * sizeof(float));
+}
+
+struct fir *fir_new(const float *ir, int taps)
+{
+	struct fir *fir;
+	float padded[FFT_SIZE];
+	int i, bits, p, n;
+
+	if (taps < 1 || taps > FIR_MAX_TAPS)
+		return NULL;
+
+	fir = (struct fir *)calloc(1, sizeof(*fir));
+	if (!fir)
+		return NULL;
+
+	fir->num_partitions = (taps + FIR_BLOCK_FRAMES - 1) / FIR_BLOCK_FRAMES;
+	fir->ir = (struct spectrum *)calloc(fir->num_partitions,
+					    sizeof(struct spectrum));
+	fir->history = (struct spectrum *)calloc(fir->num_partitions,
+						 sizeof(struct spectrum));
+	if (!fir->ir || !fir->history) {
+		fir_free(fir);
+		return NULL;
+	}
+
+	for (i = 0; i < FFT_SIZE / 2; i++) {
+		double angle = -2 * M_PI * i / FFT_SIZE;
+		fir->twiddle_re[i] = cos(angle);
+		fir->twiddle_im[i] = sin(angle);
+	}
+	for (bits = 0; (1 << bits) < FFT_SIZE; bits++)
+		;
+	for (i = 0; i < FFT_SIZE; i++) {
+		int r = 0, b;
+		for (b = 0; b < bits; b++)
+			if (i & (1 << b))
+				r |= 1 << (bits - 1 - b);
+		fir->bitrev[i] = r;
+	}
+
+	/* Each partition is zero padded to the FFT size, so its product with
+	 * an input spectrum is the linear convolution with two blocks. */
+	for (p = 0; p < fir->num_partitions; p++) {
+		n = taps - p * FIR_BLOCK_FRAMES;
+		if (n > FIR_BLOCK_FRAMES)
+			n = FIR_BLOCK_FRAMES;
+		memset(padded, 0, sizeof(padded));
+		memcpy(padded, ir + p * FIR_BLOCK_FRAMES, n * sizeof(float));
+		forward(fir, padded, &fir->ir[p]);
+	}
+
+	return fir;
+}
+
+void fir_free(struct fir *fir)
+{
+	if (!fir)
+		return;
+	free(fir->ir);
+	free(fir->history);
+	free(fir);
+}
+
+void fir_process(struct fir *fir, float *data, int count)
+{
+	int i, chunk;
+
+	for (i = 0; i < count; i += chunk) {
+		chunk = FIR_BLOCK_FRAMES - fir->pos;
+		if (chunk > count - i)
+			chunk = count - i;
+
+		memcpy(fir->input + FIR_BLOCK_FRAMES + fir->pos, data + i,
+		       chunk * sizeof(float));
+		memcpy(data + i, fir->output + fir->pos, chunk * sizeof(float));
+		fir->pos += chunk;
+
+		if (fir->pos == FIR_BLOCK_FRAMES) {
+			process_block(fir);
+			fir->pos = 0;
+		}
+	}
+}
@@ -0,0 +1,53 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef FIR_H_
+#define FIR_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* "fir" convolves one channel of audio with an impulse response. It uses a
+ * uniformly partitioned overlap-save convolution: the impulse response is
+ * split into partitions of FIR_BLOCK_FRAMES taps whose spectra are
+ * multiplied with the spectra of the last input blocks. The cost per frame
+ * grows with the number of partitions instead of the number of taps, at the
+ * price of FIR_BLOCK_FRAMES frames of latency. */
+
+/* The number of frames in each block, also the latency of the filter. */
+#define FIR_BLOCK_FRAMES 128
+
+/* Maximum number of taps in an impulse response */
+#define FIR_MAX_TAPS 65536
+
+struct fir;
+
+/* Create a FIR filter.
+ * Args:
+ *    ir - The impulse response.
+ *    taps - The number of samples in ir, in the range [1, FIR_MAX_TAPS].
+ * Returns:
+ *    The new filter, or NULL if taps is out of range or allocation failed.
+ */
+struct fir *fir_new(const float *ir, int taps);
+
+/* Free a FIR filter. */
+void fir_free(struct fir *fir);
+
+/* Process a buffer of audio data through the filter in place. The output
+ * lags the input by FIR_BLOCK_FRAMES frames.
+ * Args:
+ *    fir - The filter we want to use.
+ *    data - The array of audio samples.
+ *    count - The number of elements in the data array to process.
+ */
+void fir_process(struct fir *fir, float *data, int count);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* FIR_H_ */
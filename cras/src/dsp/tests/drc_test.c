@@ -4,6 +4,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 #include "dsp_test_util.h"
@@ -51,9 +52,18 @@ int main(int argc, char **argv)
 	struct drc *drc;
 	size_t frames;
 	float *buf;
+	int gain_table = 0;
+
+	/* -t looks up the compression curve from a table, so its output can
+	 * be compared with the one computed per frame. */
+	if (argc == 4 && !strcmp(argv[1], "-t")) {
+		gain_table = 1;
+		argc--;
+		argv++;
+	}
 
 	if (argc != 3) {
-		printf("Usage: drc_test input.raw output.raw\n");
+		printf("Usage: drc_test [-t] input.raw output.raw\n");
 		return 1;
 	}
 
@@ -62,6 +72,7 @@ int main(int argc, char **argv)
 	drc = drc_new(44100);
 
 	drc->emphasis_disabled = 0;
+	drc->gain_table_enabled = gain_table;
 	drc_set_param(drc, 0, PARAM_CROSSOVER_LOWER_FREQ, 0);
 	drc_set_param(drc, 0, PARAM_ENABLED, 1);
 	drc_set_param(drc, 0, PARAM_THRESHOLD, -29);
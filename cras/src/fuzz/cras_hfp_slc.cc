@@ -8,6 +8,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "fuzz_latency.h"
+
 extern "C" {
 #include "cras_bt_device.h"
 #include "cras_bt_log.h"
@@ -21,6 +23,8 @@ extern "C" {
 struct cras_bt_event_log* btlog;
 }
 
+static FuzzLatencyBudget latency_budget;
+
 int disconnect_cb(struct hfp_slc_handle*) {
   return 0;
 }
@@ -38,7 +42,9 @@ extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
   if (!handle)
     return 0;
 
+  latency_budget.Start();
   handle_at_command_for_test(handle, command.c_str());
+  latency_budget.Check("handle_at_command", size);
 
   hfp_slc_destroy(handle);
   cras_bt_device_remove(bt_dev);
@@ -62,5 +68,6 @@ extern "C" int LLVMFuzzerInitialize(int* argc, char*** argv) {
   cras_mix_init(0);
   cras_iodev_list_init();
   btlog = cras_bt_event_log_init();
+  latency_budget.Init();
   return 0;
 }
@@ -0,0 +1,57 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_FUZZ_LATENCY_H_
+#define CRAS_FUZZ_LATENCY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Measures how long a fuzzer takes to process each input. The budget is read
+ * from CRAS_FUZZ_LATENCY_BUDGET_US and checking is off when it is not set.
+ * An input that runs over the budget is reported and aborts the fuzzer, so
+ * libFuzzer keeps it as a crash artifact that -minimize_crash=1 can shrink
+ * while it stays slow.
+ */
+class FuzzLatencyBudget {
+ public:
+  void Init() {
+    const char* budget = getenv("CRAS_FUZZ_LATENCY_BUDGET_US");
+    if (budget)
+      budget_us_ = strtoull(budget, NULL, 0);
+  }
+
+  void Start() {
+    if (budget_us_)
+      clock_gettime(CLOCK_MONOTONIC, &start_);
+  }
+
+  void Check(const char* what, size_t size) {
+    struct timespec end;
+    uint64_t elapsed_us;
+
+    if (!budget_us_)
+      return;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed_us = (end.tv_sec - start_.tv_sec) * 1000000ULL +
+                 (end.tv_nsec - start_.tv_nsec) / 1000;
+    if (elapsed_us <= budget_us_)
+      return;
+    fprintf(stderr, "%s took %llu us for %zu bytes, budget %llu us\n", what,
+            (unsigned long long)elapsed_us, size,
+            (unsigned long long)budget_us_);
+    abort();
+  }
+
+ private:
+  uint64_t budget_us_ = 0;
+  struct timespec start_ = {};
+};
+
+#endif /* CRAS_FUZZ_LATENCY_H_ */
@@ -8,6 +8,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "fuzz_latency.h"
+
 extern "C" {
 #include "cras_apm_list.h"
 #include "cras_bt_log.h"
@@ -22,8 +24,11 @@ extern "C" {
 struct cras_bt_event_log* btlog;
 }
 
+static FuzzLatencyBudget latency_budget;
+
 extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
   cras_rclient* client = cras_rclient_create(0, 0, CRAS_CONTROL);
+  latency_budget.Start();
   if (size < 300) {
     /* Feeds input data directly if the given bytes is too short. */
     cras_rclient_buffer_from_client(client, data, size, NULL, 0);
@@ -35,6 +40,7 @@ extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
     cras_rclient_buffer_from_client(client, msg.data(), msg.size(), fds,
                                     num_fds);
   }
+  latency_budget.Check("rclient_handle_message_from_client", size);
   cras_rclient_destroy(client);
 
   return 0;
@@ -61,8 +67,9 @@ extern "C" int LLVMFuzzerInitialize(int* argc, char*** argv) {
   /* For cros fuzz, emerge adhd with USE=fuzzer will copy dsp.ini.sample to
    * etc/cras. For OSS-Fuzz the Dockerfile will be responsible for copying the
    * file. This shouldn't crash CRAS even if the dsp file does not exist. */
-  cras_dsp_init("/etc/cras/dsp.ini.sample");
+  cras_dsp_init("/etc/cras/dsp.ini.sample", NULL);
   /* Initializes btlog for CRAS_SERVER_DUMP_BT path with CRAS_DBUS defined. */
   btlog = cras_bt_event_log_init();
+  latency_budget.Init();
   return 0;
 }
@@ -59,6 +59,8 @@ static const size_t SERVER_SHUTDOWN_TIMEOUT_US = 500000;
 static const size_t SERVER_CONNECT_TIMEOUT_MS = 1000;
 static const size_t HOTWORD_FRAME_RATE = 16000;
 static const size_t HOTWORD_BLOCK_SIZE = 320;
+/* Longest a SHM_WAKE stream waits before checking that aud_fd is still up. */
+static const long SHM_WAKE_CHECK_NS = 100000000;
 
 /* Commands sent from the user to the running client. */
 enum { CLIENT_STOP,
@@ -67,6 +69,10 @@ enum { CLIENT_STOP,
        CLIENT_SET_STREAM_VOLUME_SCALER,
        CLIENT_SERVER_CONNECT,
        CLIENT_SERVER_CONNECT_ASYNC,
+       CLIENT_ADD_STREAMS,
+       CLIENT_REMOVE_STREAMS,
+       CLIENT_SET_STREAM_EFFECTS,
+       CLIENT_SET_STREAM_PAUSED,
 };
 
 struct command_msg {
@@ -80,6 +86,17 @@ struct set_stream_volume_command_message {
 	float volume_scaler;
 };
 
+struct set_stream_effects_command_message {
+	struct command_msg header;
+	uint64_t effects;
+};
+
+struct set_stream_paused_command_message {
+	struct command_msg header;
+	int paused;
+	unsigned int fade_in_ms;
+};
+
 /* Adds a stream to the client.
  *  stream - The stream to add.
  *  stream_id_out - Filled with the stream id of the new stream.
@@ -93,6 +110,28 @@ struct add_stream_command_message {
 	uint32_t dev_idx;
 };
 
+/* Adds several streams to the client at once.
+ *  streams - The streams to add.
+ *  stream_ids_out - Filled with the stream ids of the new streams.
+ *  num_streams - Number of entries in streams and stream_ids_out.
+ */
+struct add_streams_command_message {
+	struct command_msg header;
+	struct client_stream **streams;
+	cras_stream_id_t *stream_ids_out;
+	unsigned int num_streams;
+};
+
+/* Removes several streams from the client at once.
+ *  stream_ids - The streams to remove.
+ *  num_streams - Number of entries in stream_ids.
+ */
+struct rm_streams_command_message {
+	struct command_msg header;
+	const cras_stream_id_t *stream_ids;
+	unsigned int num_streams;
+};
+
 /* Commands send from a running stream to the client. */
 enum { CLIENT_STREAM_EOF,
 };
@@ -128,6 +167,11 @@ struct cras_stream_params {
 	enum CRAS_CLIENT_TYPE client_type;
 	uint32_t flags;
 	uint64_t effects;
+	uint32_t num_shm_buffers;
+	struct timespec scheduled_ts;
+	uint32_t pre_roll_frames;
+	int external_poll;
+	int own_thread;
 	void *user_data;
 	cras_playback_cb_t aud_cb;
 	cras_unified_cb_t unified_cb;
@@ -149,6 +193,14 @@ struct cras_stream_params {
  * client - The client this stream is attached to.
  * config - Audio stream configuration.
  * shm - Shared memory used to exchange audio samples with the server.
+ * shm_wake - Requests and replies go through the shm wake word rather than
+ *    aud_fd, set when SHM_WAKE was asked for and the server enabled it.
+ * wake_seq - Last value of the shm wake word handled.
+ * external_poll - Serviced by the user with cras_client_stream_process()
+ *    rather than by an audio thread.
+ * shared_thread - Serviced by the audio thread shared by the streams of the
+ *    client rather than by one of its own, see
+ *    cras_client_share_audio_thread().
  * prev, next - Form a linked list of streams attached to a client.
  */
 struct client_stream {
@@ -162,6 +214,11 @@ struct client_stream {
 	struct cras_client *client;
 	struct cras_stream_params *config;
 	struct cras_audio_shm *shm;
+	int shm_wake;
+	uint32_t wake_seq;
+	int external_poll;
+	int shared_thread;
+	int paused;
 	struct client_stream *prev, *next;
 };
 
@@ -205,6 +262,8 @@ typedef enum cras_socket_state {
  * tid - Thread ID of the client thread started by "cras_client_run_thread".
  * last_command_result - Passes back the result of the last user command.
  * streams - Linked list of streams attached to this client.
+ * streams_rwlock - Held for writing while streams is modified, for reading
+ *    while the user services a stream with cras_client_stream_process().
  * server_state - RO shared memory region holding server state.
  * atlog_ro - RO shared memory region holding audio thread log.
  * debug_info_callback - Function to call when debug info is received.
@@ -213,6 +272,11 @@ typedef enum cras_socket_state {
  * server_connection_cb - Function to called when a connection state changes.
  * server_connection_user_arg - User argument for server_connection_cb.
  * thread_priority_cb - Function to call for setting audio thread priority.
+ * share_aud_thread - Set by cras_client_share_audio_thread().
+ * aud_thread - Audio thread shared by the streams with shared_thread set.
+ * aud_wake_fds - Pipe to wake aud_thread when its streams change.
+ * num_aud_streams - Number of streams serviced by aud_thread, it runs while
+ *    there are any.
  * observer_ops - Functions to call when system state changes.
  * observer_context - Context passed to client in state change callbacks.
  */
@@ -233,6 +297,7 @@ struct cras_client {
 	pthread_mutex_t stream_start_lock;
 	int last_command_result;
 	struct client_stream *streams;
+	pthread_rwlock_t streams_rwlock;
 	const struct cras_server_state *server_state;
 	struct audio_thread_event_log *atlog_ro;
 	void (*debug_info_callback)(struct cras_client *);
@@ -241,19 +306,45 @@ struct cras_client {
 	cras_connection_status_cb_t server_connection_cb;
 	void *server_connection_user_arg;
 	cras_thread_priority_cb_t thread_priority_cb;
+	int share_aud_thread;
+	struct thread_state aud_thread;
+	int aud_wake_fds[2];
+	unsigned int num_aud_streams;
 	struct cras_observer_ops observer_ops;
 	void *observer_context;
 };
 
+/*
+ * Local copy of the devices and nodes of one direction in the server state.
+ *
+ * update_count - section_update_count of the copied section, odd when the
+ *     copy is invalid.
+ * num_devs, devs - The copied devices.
+ * num_nodes, nodes - The copied nodes.
+ */
+struct dev_section_cache {
+	unsigned update_count;
+	unsigned num_devs;
+	struct cras_iodev_info devs[CRAS_MAX_IODEVS];
+	unsigned num_nodes;
+	struct cras_ionode_info nodes[CRAS_MAX_IONODES];
+};
+
 /*
  * Holds the client pointer plus internal book keeping.
  *
  * client - The client
  * server_state_rwlock - lock to make the client's server_state thread-safe.
+ * dev_cache_lock - Protects dev_cache.
+ * dev_cache - Devices and nodes last read from server_state, indexed by
+ *     CRAS_STREAM_OUTPUT and CRAS_STREAM_INPUT. They are copied again only
+ *     when the server changes them.
  */
 struct client_int {
 	struct cras_client client;
 	pthread_rwlock_t server_state_rwlock;
+	pthread_mutex_t dev_cache_lock;
+	struct dev_section_cache dev_cache[2];
 };
 
 #define to_client_int(cptr)                                                    \
@@ -281,6 +372,9 @@ struct cras_hotword_handle {
 static int client_thread_rm_stream(struct cras_client *client,
 				   cras_stream_id_t stream_id);
 static int handle_message_from_server(struct cras_client *client);
+static int client_thread_set_stream_paused(struct cras_client *client,
+					   cras_stream_id_t stream_id,
+					   int paused, unsigned int fade_in_ms);
 static int reregister_notifications(struct cras_client *client);
 
 /*
@@ -359,6 +453,26 @@ static struct client_stream *stream_from_id(const struct cras_client *client,
 	return out;
 }
 
+/* Adds a stream to the list of the client. Only the client thread modifies
+ * the list, but externally polled streams are looked up from user threads. */
+static void add_stream_to_list(struct cras_client *client,
+			       struct client_stream *stream)
+{
+	pthread_rwlock_wrlock(&client->streams_rwlock);
+	DL_APPEND(client->streams, stream);
+	pthread_rwlock_unlock(&client->streams_rwlock);
+}
+
+/* Removes a stream from the list of the client. Once this returns no user
+ * thread is servicing the stream anymore. */
+static void rm_stream_from_list(struct cras_client *client,
+				struct client_stream *stream)
+{
+	pthread_rwlock_wrlock(&client->streams_rwlock);
+	DL_DELETE(client->streams, stream);
+	pthread_rwlock_unlock(&client->streams_rwlock);
+}
+
 /*
  * Fill a pollfd structure with the current server fd and events.
  */
@@ -1056,6 +1170,11 @@ static int send_capture_reply(struct client_stream *stream, unsigned int frames,
 	if (!cras_stream_uses_input_hw(stream->direction))
 		return 0;
 
+	if (stream->shm_wake) {
+		cras_shm_complete_callback(stream->shm);
+		return 0;
+	}
+
 	aud_msg.id = AUDIO_MESSAGE_DATA_CAPTURED;
 	aud_msg.frames = frames;
 	aud_msg.error = err;
@@ -1129,6 +1248,11 @@ static int send_playback_reply(struct client_stream *stream,
 	if (!cras_stream_uses_output_hw(stream->direction))
 		return 0;
 
+	if (stream->shm_wake) {
+		cras_shm_complete_callback(stream->shm);
+		return 0;
+	}
+
 	aud_msg.id = AUDIO_MESSAGE_DATA_READY;
 	aud_msg.frames = frames;
 	aud_msg.error = error;
@@ -1190,11 +1314,11 @@ reply_written:
 	return rc;
 }
 
-static void audio_thread_set_priority(struct client_stream *stream)
+static void audio_thread_set_priority(struct cras_client *client)
 {
 	/* Use provided callback to set priority if available. */
-	if (stream->client->thread_priority_cb) {
-		stream->client->thread_priority_cb(stream->client);
+	if (client->thread_priority_cb) {
+		client->thread_priority_cb(client);
 		return;
 	}
 
@@ -1204,8 +1328,69 @@ static void audio_thread_set_priority(struct client_stream *stream)
 		cras_set_nice_level(CRAS_CLIENT_NICENESS_LEVEL);
 }
 
+/* Waits for the server to wake a SHM_WAKE stream and fills aud_msg with what
+ * it would have sent over aud_fd. The wake word can't tell that the server
+ * closed the stream or went away, so aud_fd is checked for a hang up between
+ * bounded waits, as the socket path would have seen it.
+ * Returns:
+ *    The size of the message, 0 if there is nothing to handle, or -EIO if
+ *    aud_fd hung up.
+ */
+static int read_shm_wake(struct client_stream *stream,
+			 struct audio_message *aud_msg)
+{
+	struct timespec timeout = { 0, SHM_WAKE_CHECK_NS };
+	struct pollfd pollfd;
+	int frames;
+
+	frames = cras_shm_wait_wake(stream->shm, &stream->wake_seq, &timeout);
+	if (frames == -ETIMEDOUT) {
+		pollfd.fd = stream->aud_fd;
+		pollfd.events = 0;
+		if (poll(&pollfd, 1, 0) > 0 &&
+		    (pollfd.revents & (POLLHUP | POLLERR | POLLNVAL)))
+			return -EIO;
+		return 0;
+	}
+	if (frames < 0 || !thread_is_running(&stream->thread))
+		return 0;
+
+	aud_msg->id = (stream->direction == CRAS_STREAM_OUTPUT) ?
+			      AUDIO_MESSAGE_REQUEST_DATA :
+			      AUDIO_MESSAGE_DATA_READY;
+	aud_msg->error = 0;
+	aud_msg->frames = frames;
+	return sizeof(*aud_msg);
+}
+
+/* Services the request of the server in aud_msg.
+ * Returns:
+ *    0, unless there is a fatal error or the client declares end of file.
+ */
+static int handle_audio_message(struct client_stream *stream,
+				const struct audio_message *aud_msg)
+{
+	switch (aud_msg->id) {
+	case AUDIO_MESSAGE_DATA_READY:
+		return handle_capture_data_ready(stream, aud_msg->frames);
+	case AUDIO_MESSAGE_REQUEST_DATA:
+		return handle_playback_request(stream, aud_msg->frames);
+	default:
+		return 0;
+	}
+}
+
+/* Notifies the control thread that an audio thread has started. */
+static void notify_thread_started(struct cras_client *client)
+{
+	pthread_mutex_lock(&client->stream_start_lock);
+	pthread_cond_broadcast(&client->stream_start_cond);
+	pthread_mutex_unlock(&client->stream_start_lock);
+}
+
 /* Listens to the audio socket for messages from the server indicating that
- * the stream needs to be serviced.  One of these runs per stream. */
+ * the stream needs to be serviced.  One of these runs per stream that doesn't
+ * share the audio thread of the client. */
 static void *audio_thread(void *arg)
 {
 	struct client_stream *stream = (struct client_stream *)arg;
@@ -1217,12 +1402,8 @@ static void *audio_thread(void *arg)
 	if (arg == NULL)
 		return (void *)-EIO;
 
-	audio_thread_set_priority(stream);
-
-	/* Notify the control thread that we've started. */
-	pthread_mutex_lock(&stream->client->stream_start_lock);
-	pthread_cond_broadcast(&stream->client->stream_start_cond);
-	pthread_mutex_unlock(&stream->client->stream_start_lock);
+	audio_thread_set_priority(stream->client);
+	notify_thread_started(stream->client);
 
 	while (thread_is_running(&stream->thread) && !thread_terminated) {
 		/* While we are warming up, aud_fd may not be valid and some
@@ -1230,42 +1411,181 @@ static void *audio_thread(void *arg)
 		aud_fd = (stream->thread.state == CRAS_THREAD_WARMUP) ?
 				 -1 :
 				 stream->aud_fd;
-		num_read =
-			read_with_wake_fd(stream->wake_fds[0], aud_fd,
-					  (uint8_t *)&aud_msg, sizeof(aud_msg));
+		if (aud_fd >= 0 && stream->shm_wake)
+			num_read = read_shm_wake(stream, &aud_msg);
+		else
+			num_read = read_with_wake_fd(stream->wake_fds[0],
+						     aud_fd,
+						     (uint8_t *)&aud_msg,
+						     sizeof(aud_msg));
 		if (num_read < 0)
 			return (void *)-EIO;
 		if (num_read == 0)
 			continue;
 
-		switch (aud_msg.id) {
-		case AUDIO_MESSAGE_DATA_READY:
-			thread_terminated = handle_capture_data_ready(
-				stream, aud_msg.frames);
-			break;
-		case AUDIO_MESSAGE_REQUEST_DATA:
-			thread_terminated =
-				handle_playback_request(stream, aud_msg.frames);
-			break;
-		default:
-			break;
+		thread_terminated = handle_audio_message(stream, &aud_msg);
+	}
+
+	return NULL;
+}
+
+/* Services the streams of the shared audio thread whose aud_fd polled
+ * readable. A stream that fails or declares end of file isn't polled again,
+ * as its own thread would have exited.
+ * Args:
+ *    client - The client the streams are attached to.
+ *    pollfds - The polled aud_fd of the streams.
+ *    ids - The id of the stream of each of pollfds.
+ *    num_fds - Number of entries in pollfds and ids.
+ */
+static void service_shared_streams(struct cras_client *client,
+				   const struct pollfd *pollfds,
+				   const cras_stream_id_t *ids,
+				   unsigned int num_fds)
+{
+	struct client_stream *stream;
+	struct audio_message aud_msg;
+	unsigned int i;
+	int rc;
+
+	/* Streams are unlisted under the write lock before they are freed. */
+	pthread_rwlock_rdlock(&client->streams_rwlock);
+	for (i = 0; i < num_fds; i++) {
+		if (!pollfds[i].revents)
+			continue;
+		stream = stream_from_id(client, ids[i]);
+		if (!stream || !stream->shared_thread ||
+		    stream->aud_fd != pollfds[i].fd)
+			continue;
+		rc = read(stream->aud_fd, &aud_msg, sizeof(aud_msg));
+		if (rc != sizeof(aud_msg) ||
+		    handle_audio_message(stream, &aud_msg))
+			stream->thread.state = CRAS_THREAD_STOP;
+	}
+	pthread_rwlock_unlock(&client->streams_rwlock);
+}
+
+/* Doubles the room in the poll set of the shared audio thread. */
+static int grow_poll_set(struct pollfd **pollfds, cras_stream_id_t **ids,
+			 unsigned int *max_fds)
+{
+	unsigned int num = 2 * *max_fds;
+	void *p;
+
+	p = realloc(*pollfds, num * sizeof(**pollfds));
+	if (!p)
+		return -ENOMEM;
+	*pollfds = (struct pollfd *)p;
+	p = realloc(*ids, num * sizeof(**ids));
+	if (!p)
+		return -ENOMEM;
+	*ids = (cras_stream_id_t *)p;
+	*max_fds = num;
+	return 0;
+}
+
+/* Listens to the audio sockets of all the streams of the client that share
+ * its audio thread, and services them as the server asks. The poll set is
+ * built again on each wake, aud_wake_fds is written when streams come, go or
+ * get connected. */
+static void *shared_audio_thread(void *arg)
+{
+	struct cras_client *client = (struct cras_client *)arg;
+	struct pollfd *pollfds;
+	cras_stream_id_t *ids;
+	unsigned int max_fds = 8, num_fds;
+	struct client_stream *stream;
+	char tmp;
+	int rc;
+
+	audio_thread_set_priority(client);
+	notify_thread_started(client);
+
+	/* Index 0 is the wake pipe, the streams follow. */
+	pollfds = (struct pollfd *)calloc(max_fds, sizeof(*pollfds));
+	ids = (cras_stream_id_t *)calloc(max_fds, sizeof(*ids));
+	if (!pollfds || !ids)
+		goto exit;
+
+	while (thread_is_running(&client->aud_thread)) {
+		pollfds[0].fd = client->aud_wake_fds[0];
+		pollfds[0].events = POLLIN;
+		pollfds[0].revents = 0;
+		num_fds = 1;
+
+		pthread_rwlock_rdlock(&client->streams_rwlock);
+		DL_FOREACH (client->streams, stream) {
+			if (!stream->shared_thread ||
+			    stream->thread.state != CRAS_THREAD_RUNNING)
+				continue;
+			if (num_fds == max_fds &&
+			    grow_poll_set(&pollfds, &ids, &max_fds)) {
+				pthread_rwlock_unlock(&client->streams_rwlock);
+				goto exit;
+			}
+			pollfds[num_fds].fd = stream->aud_fd;
+			pollfds[num_fds].events = POLLIN;
+			pollfds[num_fds].revents = 0;
+			ids[num_fds] = stream->id;
+			num_fds++;
+		}
+		pthread_rwlock_unlock(&client->streams_rwlock);
+
+		rc = poll(pollfds, num_fds, -1);
+		if (rc <= 0)
+			continue;
+		if (pollfds[0].revents & POLLIN) {
+			rc = read(client->aud_wake_fds[0], &tmp, 1);
+			if (rc < 0)
+				break;
 		}
+		service_shared_streams(client, &pollfds[1], &ids[1],
+				       num_fds - 1);
 	}
 
+exit:
+	free(pollfds);
+	free(ids);
 	return NULL;
 }
 
 /* Pokes the audio thread so that it can notice if it has been terminated. */
 static int wake_aud_thread(struct client_stream *stream)
 {
+	int fd = stream->shared_thread ? stream->client->aud_wake_fds[1] :
+					 stream->wake_fds[1];
 	int rc;
 
-	rc = write(stream->wake_fds[1], &rc, 1);
+	rc = write(fd, &rc, 1);
 	if (rc != 1)
 		return rc;
 	return 0;
 }
 
+/* Stops the audio thread shared by the streams of client.
+ * Args:
+ *    client - The client owning the thread.
+ *    join - When non-zero, wait for the thread to complete.
+ */
+static void stop_shared_aud_thread(struct cras_client *client, int join)
+{
+	int rc;
+
+	if (thread_is_running(&client->aud_thread)) {
+		client->aud_thread.state = CRAS_THREAD_STOP;
+		rc = write(client->aud_wake_fds[1], &rc, 1);
+		if (join)
+			pthread_join(client->aud_thread.tid, NULL);
+	}
+
+	if (client->aud_wake_fds[0] >= 0) {
+		close(client->aud_wake_fds[0]);
+		close(client->aud_wake_fds[1]);
+		client->aud_wake_fds[0] = -1;
+		client->aud_wake_fds[1] = -1;
+	}
+}
+
 /* Stop the audio thread for the given stream.
  * Args:
  *    stream - Stream for which to stop the audio thread.
@@ -1274,9 +1594,28 @@ static int wake_aud_thread(struct client_stream *stream)
  */
 static void stop_aud_thread(struct client_stream *stream, int join)
 {
+	if (stream->external_poll) {
+		stream->thread.state = CRAS_THREAD_STOP;
+		return;
+	}
+
+	if (stream->shared_thread) {
+		stream->thread.state = CRAS_THREAD_STOP;
+		/* Drops the stream from the poll set, or stops the thread
+		 * after the last one. */
+		wake_aud_thread(stream);
+		stream->shared_thread = 0;
+		if (--stream->client->num_aud_streams == 0)
+			stop_shared_aud_thread(stream->client, join);
+		return;
+	}
+
 	if (thread_is_running(&stream->thread)) {
 		stream->thread.state = CRAS_THREAD_STOP;
 		wake_aud_thread(stream);
+		/* A SHM_WAKE stream waits on the shm instead of wake_fds. */
+		if (stream->shm_wake)
+			cras_shm_wake(stream->shm, 0);
 		if (join)
 			pthread_join(stream->thread.tid, NULL);
 	}
@@ -1288,6 +1627,47 @@ static void stop_aud_thread(struct client_stream *stream, int join)
 	}
 }
 
+/* Creates a thread running fn and waits for it to signal that it started.
+ * Args:
+ *    client - The client the thread runs for.
+ *    thread - State of the new thread, in CRAS_THREAD_WARMUP while it runs.
+ *    fn, arg - The function the thread runs, and its argument.
+ * Returns:
+ *    0 for success, or a negative error code.
+ */
+static int create_audio_thread(struct cras_client *client,
+			       struct thread_state *thread,
+			       void *(*fn)(void *), void *arg)
+{
+	struct timespec future;
+	int rc;
+
+	thread->state = CRAS_THREAD_WARMUP;
+
+	pthread_mutex_lock(&client->stream_start_lock);
+	rc = pthread_create(&thread->tid, NULL, fn, arg);
+	if (rc) {
+		pthread_mutex_unlock(&client->stream_start_lock);
+		syslog(LOG_ERR, "cras_client: Couldn't create audio stream: %s",
+		       strerror(rc));
+		thread->state = CRAS_THREAD_STOP;
+		return -rc;
+	}
+
+	/* stream_start_cond waits on CLOCK_MONOTONIC. */
+	clock_gettime(CLOCK_MONOTONIC, &future);
+	future.tv_sec += 2; /* Wait up to two seconds. */
+	rc = pthread_cond_timedwait(&client->stream_start_cond,
+				    &client->stream_start_lock, &future);
+	pthread_mutex_unlock(&client->stream_start_lock);
+	if (rc != 0) {
+		syslog(LOG_ERR, "cras_client: Client thread not responding: %s",
+		       strerror(rc));
+		return -rc;
+	}
+	return 0;
+}
+
 /* Start the audio thread for this stream.
  * Returns when the thread has started and is waiting.
  * Args:
@@ -1298,7 +1678,6 @@ static void stop_aud_thread(struct client_stream *stream, int join)
 static int start_aud_thread(struct client_stream *stream)
 {
 	int rc;
-	struct timespec future;
 
 	rc = pipe(stream->wake_fds);
 	if (rc < 0) {
@@ -1307,33 +1686,47 @@ static int start_aud_thread(struct client_stream *stream)
 		return rc;
 	}
 
-	stream->thread.state = CRAS_THREAD_WARMUP;
-
-	pthread_mutex_lock(&stream->client->stream_start_lock);
-	rc = pthread_create(&stream->thread.tid, NULL, audio_thread, stream);
+	rc = create_audio_thread(stream->client, &stream->thread, audio_thread,
+				 stream);
 	if (rc) {
-		pthread_mutex_unlock(&stream->client->stream_start_lock);
-		syslog(LOG_ERR, "cras_client: Couldn't create audio stream: %s",
-		       strerror(rc));
-		stream->thread.state = CRAS_THREAD_STOP;
-		stop_aud_thread(stream, 0);
-		return -rc;
-	}
-
-	clock_gettime(CLOCK_REALTIME, &future);
-	future.tv_sec += 2; /* Wait up to two seconds. */
-	rc = pthread_cond_timedwait(&stream->client->stream_start_cond,
-				    &stream->client->stream_start_lock,
-				    &future);
-	pthread_mutex_unlock(&stream->client->stream_start_lock);
-	if (rc != 0) {
 		/* Something is very wrong: try to cancel the thread and don't
 		 * wait for it. */
-		syslog(LOG_ERR, "cras_client: Client thread not responding: %s",
-		       strerror(rc));
 		stop_aud_thread(stream, 0);
-		return -rc;
+		return rc;
+	}
+	return 0;
+}
+
+/* Hands the stream to the audio thread shared by the streams of the client,
+ * starting the thread for the first one. The stream is polled once it is
+ * connected. */
+static int share_aud_thread(struct client_stream *stream)
+{
+	struct cras_client *client = stream->client;
+	int rc;
+
+	if (!thread_is_running(&client->aud_thread)) {
+		rc = pipe(client->aud_wake_fds);
+		if (rc < 0) {
+			rc = -errno;
+			syslog(LOG_ERR, "cras_client: pipe: %s",
+			       strerror(-rc));
+			client->aud_wake_fds[0] = -1;
+			client->aud_wake_fds[1] = -1;
+			return rc;
+		}
+		rc = create_audio_thread(client, &client->aud_thread,
+					 shared_audio_thread, client);
+		if (rc) {
+			stop_shared_aud_thread(client, 0);
+			return rc;
+		}
+		client->aud_thread.state = CRAS_THREAD_RUNNING;
 	}
+
+	stream->thread.state = CRAS_THREAD_WARMUP;
+	stream->shared_thread = 1;
+	client->num_aud_streams++;
 	return 0;
 }
 
@@ -1341,36 +1734,106 @@ static int start_aud_thread(struct client_stream *stream)
  * Client thread.
  */
 
-/* Gets the update_count of the server state shm region. */
+/* Gets the update count of a section of the server state shm region. Updates
+ * to the other sections don't make the read retry. */
 static inline unsigned
-begin_server_state_read(const struct cras_server_state *state)
+begin_section_read(const struct cras_server_state *state,
+		   enum CRAS_SERVER_STATE_SECTION section)
 {
-	unsigned count;
+	const volatile unsigned *count = &state->section_update_count[section];
+	unsigned value;
 
-	/* Version will be odd when the server is writing. */
-	while ((count = *(volatile unsigned *)&state->update_count) & 1)
+	/* Count will be odd when the server is writing. */
+	while ((value = *count) & 1)
 		sched_yield();
 	__sync_synchronize();
-	return count;
+	return value;
 }
 
-/* Checks if the update count of the server state shm region has changed from
- * count.  Returns 0 if the count still matches.
+/* Checks if the update count of a section of the server state shm region has
+ * changed from count.  Returns 0 if the count still matches.
  */
-static inline int end_server_state_read(const struct cras_server_state *state,
-					unsigned count)
+static inline int end_section_read(const struct cras_server_state *state,
+				   enum CRAS_SERVER_STATE_SECTION section,
+				   unsigned count)
 {
 	__sync_synchronize();
-	if (count != *(volatile unsigned *)&state->update_count)
+	if (count != *(volatile unsigned *)&state->section_update_count[section])
 		return -EAGAIN;
 	return 0;
 }
 
+/* Invalidates the copied devices, for example when a new server state is
+ * mapped and its update counts start over. */
+static void invalidate_dev_cache(struct client_int *client_int)
+{
+	pthread_mutex_lock(&client_int->dev_cache_lock);
+	client_int->dev_cache[CRAS_STREAM_OUTPUT].update_count = 1;
+	client_int->dev_cache[CRAS_STREAM_INPUT].update_count = 1;
+	pthread_mutex_unlock(&client_int->dev_cache_lock);
+}
+
+/* Copies the devices and nodes of one direction to the caller. The shared
+ * state is only read when its section changed since the last call, otherwise
+ * the local copy is used. Must be called with the server_state read lock.
+ */
+static void get_dev_section(const struct cras_client *client,
+			    enum CRAS_STREAM_DIRECTION dir,
+			    struct cras_iodev_info *devs,
+			    struct cras_ionode_info *nodes, size_t *num_devs,
+			    size_t *num_nodes)
+{
+	struct client_int *client_int = to_client_int(client);
+	struct dev_section_cache *cache = &client_int->dev_cache[dir];
+	const struct cras_server_state *state = client->server_state;
+	enum CRAS_SERVER_STATE_SECTION section;
+	const struct cras_iodev_info *state_devs;
+	const struct cras_ionode_info *state_nodes;
+	const uint32_t *state_num_devs, *state_num_nodes;
+	unsigned count;
+
+	if (dir == CRAS_STREAM_OUTPUT) {
+		section = CRAS_STATE_OUTPUT_DEVS;
+		state_num_devs = &state->num_output_devs;
+		state_devs = state->output_devs;
+		state_num_nodes = &state->num_output_nodes;
+		state_nodes = state->output_nodes;
+	} else {
+		section = CRAS_STATE_INPUT_DEVS;
+		state_num_devs = &state->num_input_devs;
+		state_devs = state->input_devs;
+		state_num_nodes = &state->num_input_nodes;
+		state_nodes = state->input_nodes;
+	}
+
+	pthread_mutex_lock(&client_int->dev_cache_lock);
+	count = begin_section_read(state, section);
+	while (count != cache->update_count) {
+		cache->num_devs = MIN(*state_num_devs, CRAS_MAX_IODEVS);
+		memcpy(cache->devs, state_devs,
+		       cache->num_devs * sizeof(*cache->devs));
+		cache->num_nodes = MIN(*state_num_nodes, CRAS_MAX_IONODES);
+		memcpy(cache->nodes, state_nodes,
+		       cache->num_nodes * sizeof(*cache->nodes));
+		if (end_section_read(state, section, count) == 0)
+			cache->update_count = count;
+		else
+			count = begin_section_read(state, section);
+	}
+
+	*num_devs = MIN(*num_devs, cache->num_devs);
+	memcpy(devs, cache->devs, *num_devs * sizeof(*devs));
+	*num_nodes = MIN(*num_nodes, cache->num_nodes);
+	memcpy(nodes, cache->nodes, *num_nodes * sizeof(*nodes));
+	pthread_mutex_unlock(&client_int->dev_cache_lock);
+}
+
 /* Release shm areas if references to them are held. */
 static void free_shm(struct client_stream *stream)
 {
 	cras_audio_shm_destroy(stream->shm);
 	stream->shm = NULL;
+	stream->shm_wake = 0;
 }
 
 /* Handles the stream connected message from the server.  Check if we need a
@@ -1414,11 +1877,28 @@ static int stream_connected(struct client_stream *stream,
 		syslog(LOG_ERR, "cras_client: Error configuring shm");
 		goto err_ret;
 	}
+	if (!cras_shm_layout_supported(stream->shm)) {
+		syslog(LOG_ERR, "cras_client: Unknown shm layout version %u",
+		       stream->shm->header->config.layout_version);
+		rc = -EINVAL;
+		goto err_ret;
+	}
 	cras_shm_copy_shared_config(stream->shm);
 	cras_shm_set_volume_scaler(stream->shm, stream->volume_scaler);
+	/* The server may already have asked for samples, start from the
+	 * initial value of the wake word so that isn't missed. */
+	stream->shm_wake = (stream->flags & SHM_WAKE) &&
+			   cras_shm_wake_enabled(stream->shm);
+	stream->wake_seq = 0;
 
 	stream->thread.state = CRAS_THREAD_RUNNING;
-	wake_aud_thread(stream);
+	if (!stream->external_poll)
+		wake_aud_thread(stream);
+
+	/* A stream paused before the server restarted stays paused. */
+	if (stream->paused)
+		client_thread_set_stream_paused(stream->client, stream->id, 1,
+						0);
 
 	close(stream_fds[0]);
 	close(stream_fds[1]);
@@ -1431,28 +1911,52 @@ err_ret:
 	return rc;
 }
 
-static int send_connect_message(struct cras_client *client,
-				struct client_stream *stream, uint32_t dev_idx)
+/* Fills the message asking the server to connect stream. */
+static void fill_stream_connect_message(struct cras_connect_message *serv_msg,
+					const struct client_stream *stream,
+					uint32_t dev_idx)
+{
+	cras_fill_connect_message(serv_msg, stream->config->direction,
+				  stream->id, stream->config->stream_type,
+				  stream->config->client_type,
+				  stream->config->buffer_frames,
+				  stream->config->cb_threshold, stream->flags,
+				  stream->config->effects,
+				  stream->config->format, dev_idx);
+	serv_msg->num_shm_buffers = stream->config->num_shm_buffers;
+	serv_msg->scheduled_ts.tv_sec = stream->config->scheduled_ts.tv_sec;
+	serv_msg->scheduled_ts.tv_nsec = stream->config->scheduled_ts.tv_nsec;
+	serv_msg->pre_roll_frames = stream->config->pre_roll_frames;
+}
+
+/* Creates the socket pair the server uses to notify a stream of audio events.
+ * sock[0] is kept by the client, sock[1] is sent to the server. */
+static int create_aud_socketpair(int sock[2])
 {
 	int rc;
-	struct cras_connect_message serv_msg;
-	int sock[2] = { -1, -1 };
 
-	/* Create a socket pair for the server to notify of audio events. */
 	rc = socketpair(AF_UNIX, SOCK_STREAM, 0, sock);
 	if (rc != 0) {
 		rc = -errno;
 		syslog(LOG_ERR, "cras_client: socketpair: %s", strerror(-rc));
-		goto fail;
+		sock[0] = -1;
+		sock[1] = -1;
 	}
+	return rc;
+}
 
-	cras_fill_connect_message(&serv_msg, stream->config->direction,
-				  stream->id, stream->config->stream_type,
-				  stream->config->client_type,
-				  stream->config->buffer_frames,
-				  stream->config->cb_threshold, stream->flags,
-				  stream->config->effects,
-				  stream->config->format, dev_idx);
+static int send_connect_message(struct cras_client *client,
+				struct client_stream *stream, uint32_t dev_idx)
+{
+	int rc;
+	struct cras_connect_message serv_msg;
+	int sock[2] = { -1, -1 };
+
+	rc = create_aud_socketpair(sock);
+	if (rc != 0)
+		goto fail;
+
+	fill_stream_connect_message(&serv_msg, stream, dev_idx);
 
 	rc = cras_send_with_fds(client->server_fd, &serv_msg, sizeof(serv_msg),
 				&sock[1], 1);
@@ -1475,15 +1979,57 @@ fail:
 	return rc;
 }
 
-/* Adds a stream to a running client.  Checks to make sure that the client is
- * attached, waits if it isn't.  The stream is prepared on the  main thread and
- * passed here. */
-static int client_thread_add_stream(struct cras_client *client,
-				    struct client_stream *stream,
-				    cras_stream_id_t *stream_id_out,
-				    uint32_t dev_idx)
+/* Sends one message asking the server to connect all of streams. */
+static int send_connect_streams_message(struct cras_client *client,
+					struct client_stream **streams,
+					unsigned int num_streams)
+{
+	struct cras_connect_streams_message serv_msg;
+	int socks[CRAS_MAX_BATCH_STREAMS][2];
+	int fds[CRAS_MAX_BATCH_STREAMS];
+	unsigned int i, n;
+	int rc = 0;
+
+	for (n = 0; n < num_streams; n++) {
+		rc = create_aud_socketpair(socks[n]);
+		if (rc != 0)
+			goto fail;
+		fill_stream_connect_message(&serv_msg.streams[n], streams[n],
+					    NO_DEVICE);
+		fds[n] = socks[n][1];
+	}
+	cras_fill_connect_streams_message(&serv_msg, num_streams);
+
+	rc = cras_send_with_fds(client->server_fd, &serv_msg,
+				serv_msg.header.length, fds, num_streams);
+	if (rc != (int)serv_msg.header.length) {
+		rc = -EIO;
+		syslog(LOG_ERR,
+		       "cras_client: add_streams: Send server message failed.");
+		goto fail;
+	}
+
+	for (i = 0; i < num_streams; i++) {
+		streams[i]->aud_fd = socks[i][0];
+		close(socks[i][1]);
+	}
+	return 0;
+
+fail:
+	for (i = 0; i < n; i++) {
+		close(socks[i][0]);
+		close(socks[i][1]);
+	}
+	return rc;
+}
+
+/* Picks an id for a new stream and starts its audio thread, unless the user
+ * polls the stream. For hotword streams dev_idx is updated with the hotword
+ * device. */
+static int prepare_stream(struct cras_client *client,
+			  struct client_stream *stream,
+			  cras_stream_id_t *stream_id_out, uint32_t *dev_idx)
 {
-	int rc;
 	cras_stream_id_t new_id;
 	struct client_stream *out;
 
@@ -1493,20 +2039,20 @@ static int client_thread_add_stream(struct cras_client *client,
 			client, CRAS_NODE_TYPE_HOTWORD, CRAS_STREAM_INPUT);
 
 		/* Find the hotword device index. */
-		if (dev_idx == NO_DEVICE) {
+		if (*dev_idx == NO_DEVICE) {
 			if (hotword_idx < 0) {
 				syslog(LOG_ERR,
 				       "cras_client: add_stream: No hotword dev");
 				return hotword_idx;
 			} else {
-				dev_idx = (uint32_t)hotword_idx;
+				*dev_idx = (uint32_t)hotword_idx;
 			}
 		}
 		/* A known Use case for client to pin hotword stream on a not
 		 * hotword device is to use internal mic for Assistant to work
 		 * on board without usable DSP hotwording. We assume there will
 		 * be only one hotword device exists. */
-		else if (dev_idx != (uint32_t)hotword_idx) {
+		else if (*dev_idx != (uint32_t)hotword_idx) {
 			/* Unmask the flag to fallback to normal pinned stream
 			 * on specified device. */
 			stream->flags &= ~HOTWORD_STREAM;
@@ -1524,8 +2070,32 @@ static int client_thread_add_stream(struct cras_client *client,
 	*stream_id_out = new_id;
 	stream->client = client;
 
+	/* The user services the stream once it's connected. */
+	if (stream->external_poll) {
+		stream->thread.state = CRAS_THREAD_WARMUP;
+		return 0;
+	}
+
+	/* Waiting on the shm wake word needs a thread of its own. */
+	if (client->share_aud_thread && !stream->config->own_thread &&
+	    !(stream->flags & SHM_WAKE))
+		return share_aud_thread(stream);
+
 	/* Start the audio thread. */
-	rc = start_aud_thread(stream);
+	return start_aud_thread(stream);
+}
+
+/* Adds a stream to a running client.  Checks to make sure that the client is
+ * attached, waits if it isn't.  The stream is prepared on the  main thread and
+ * passed here. */
+static int client_thread_add_stream(struct cras_client *client,
+				    struct client_stream *stream,
+				    cras_stream_id_t *stream_id_out,
+				    uint32_t dev_idx)
+{
+	int rc;
+
+	rc = prepare_stream(client, stream, stream_id_out, &dev_idx);
 	if (rc != 0)
 		return rc;
 
@@ -1538,9 +2108,66 @@ static int client_thread_add_stream(struct cras_client *client,
 	}
 
 	/* Add the stream to the linked list */
-	DL_APPEND(client->streams, stream);
+	add_stream_to_list(client, stream);
+
+	return 0;
+}
+
+/* Adds several streams to a running client with a single connect message.
+ * Either all of the streams are added or none of them. Hotword streams need
+ * to be pinned to the hotword device, so they can't be part of a batch. */
+static int client_thread_add_streams(struct cras_client *client,
+				     struct client_stream **streams,
+				     cras_stream_id_t *stream_ids_out,
+				     unsigned int num_streams)
+{
+	uint32_t dev_idx;
+	unsigned int i, n;
+	int rc = 0;
+
+	for (n = 0; n < num_streams; n++) {
+		if ((streams[n]->flags & HOTWORD_STREAM) == HOTWORD_STREAM) {
+			rc = -EINVAL;
+			goto fail;
+		}
+		dev_idx = NO_DEVICE;
+		rc = prepare_stream(client, streams[n], &stream_ids_out[n],
+				    &dev_idx);
+		if (rc != 0)
+			goto fail;
+		/* Listed right away so the next stream gets a different id. */
+		add_stream_to_list(client, streams[n]);
+	}
 
+	rc = send_connect_streams_message(client, streams, num_streams);
+	if (rc != 0)
+		goto fail;
 	return 0;
+
+fail:
+	for (i = 0; i < n; i++) {
+		rm_stream_from_list(client, streams[i]);
+		stop_aud_thread(streams[i], 1);
+	}
+	return rc;
+}
+
+/* Stops a stream and frees it after the server has been told to remove it. */
+static void destroy_stream(struct cras_client *client,
+			   struct client_stream *stream)
+{
+	/* Unlisted first so the user can't be servicing it from here on. */
+	rm_stream_from_list(client, stream);
+
+	stop_aud_thread(stream, 1);
+
+	free_shm(stream);
+
+	if (stream->aud_fd >= 0)
+		close(stream->aud_fd);
+
+	free(stream->config);
+	free(stream);
 }
 
 /* Removes a stream from a running client from within the running client's
@@ -1565,35 +2192,115 @@ static int client_thread_rm_stream(struct cras_client *client,
 	}
 
 	/* And shut down locally. */
-	stop_aud_thread(stream, 1);
+	destroy_stream(client, stream);
 
-	free_shm(stream);
+	return 0;
+}
 
-	DL_DELETE(client->streams, stream);
-	if (stream->aud_fd >= 0)
-		close(stream->aud_fd);
+/* Removes several streams from a running client with a single disconnect
+ * message, from within the running client's context. */
+static int client_thread_rm_streams(struct cras_client *client,
+				    const cras_stream_id_t *stream_ids,
+				    unsigned int num_streams)
+{
+	struct cras_disconnect_streams_message msg;
+	struct client_stream *streams[CRAS_MAX_BATCH_STREAMS];
+	cras_stream_id_t ids[CRAS_MAX_BATCH_STREAMS];
+	unsigned int i, n = 0;
+	int rc;
 
-	free(stream->config);
-	free(stream);
+	for (i = 0; i < num_streams; i++) {
+		streams[n] = stream_from_id(client, stream_ids[i]);
+		if (streams[n] == NULL)
+			continue;
+		ids[n++] = stream_ids[i];
+	}
+	if (n == 0)
+		return 0;
+
+	/* Tell server to remove. */
+	if (client->server_fd_state == CRAS_SOCKET_STATE_CONNECTED) {
+		cras_fill_disconnect_streams_message(&msg, ids, n);
+		rc = write(client->server_fd, &msg, sizeof(msg));
+		if (rc < 0)
+			syslog(LOG_ERR,
+			       "cras_client: error removing streams from server\n");
+	}
+
+	/* And shut down locally. */
+	for (i = 0; i < n; i++)
+		destroy_stream(client, streams[i]);
+
+	return 0;
+}
+
+/* Sets the volume scaling factor for a playback or capture stream. */
+static int client_thread_set_stream_volume(struct cras_client *client,
+					   cras_stream_id_t stream_id,
+					   float volume_scaler)
+{
+	struct client_stream *stream;
 
+	stream = stream_from_id(client, stream_id);
+	if (stream == NULL || volume_scaler > 1.0 || volume_scaler < 0.0)
+		return -EINVAL;
+
+	stream->volume_scaler = volume_scaler;
+	if (stream->shm)
+		cras_shm_set_volume_scaler(stream->shm, volume_scaler);
+
+	return 0;
+}
+
+/* Changes the effects of an input stream, on the server too if it's
+ * connected. */
+static int client_thread_set_stream_effects(struct cras_client *client,
+					    cras_stream_id_t stream_id,
+					    uint64_t effects)
+{
+	struct cras_set_stream_effects_message msg;
+	struct client_stream *stream;
+	int rc;
+
+	stream = stream_from_id(client, stream_id);
+	if (stream == NULL || stream->direction != CRAS_STREAM_INPUT)
+		return -EINVAL;
+
+	/* Kept for when the stream is connected again. */
+	stream->config->effects = effects;
+
+	if (client->server_fd_state == CRAS_SOCKET_STATE_CONNECTED) {
+		cras_fill_set_stream_effects_message(&msg, stream_id, effects);
+		rc = write(client->server_fd, &msg, sizeof(msg));
+		if (rc < 0)
+			return -errno;
+	}
 	return 0;
 }
 
-/* Sets the volume scaling factor for a playback or capture stream. */
-static int client_thread_set_stream_volume(struct cras_client *client,
+/* Pauses or resumes a stream, on the server too if it's connected. */
+static int client_thread_set_stream_paused(struct cras_client *client,
 					   cras_stream_id_t stream_id,
-					   float volume_scaler)
+					   int paused, unsigned int fade_in_ms)
 {
+	struct cras_set_stream_paused_message msg;
 	struct client_stream *stream;
+	int rc;
 
 	stream = stream_from_id(client, stream_id);
-	if (stream == NULL || volume_scaler > 1.0 || volume_scaler < 0.0)
+	if (stream == NULL)
 		return -EINVAL;
 
-	stream->volume_scaler = volume_scaler;
-	if (stream->shm)
-		cras_shm_set_volume_scaler(stream->shm, volume_scaler);
+	/* Kept for when the stream is connected again. */
+	stream->paused = paused;
 
+	if (client->server_fd_state == CRAS_SOCKET_STATE_CONNECTED) {
+		cras_fill_set_stream_paused_message(&msg, stream_id, paused,
+						    fade_in_ms);
+		rc = write(client->server_fd, &msg, sizeof(msg));
+		if (rc < 0)
+			return -errno;
+	}
 	return 0;
 }
 
@@ -1629,6 +2336,8 @@ static int client_attach_shm(struct cras_client *client, int shm_fd)
 		goto error;
 	}
 
+	invalidate_dev_cache(to_client_int(client));
+
 	if (client->server_state->state_version != CRAS_SERVER_STATE_VERSION) {
 		munmap((void *)client->server_state,
 		       sizeof(*client->server_state));
@@ -1892,6 +2601,21 @@ static int handle_command_message(struct cras_client *client, int poll_revents)
 	case CLIENT_REMOVE_STREAM:
 		rc = client_thread_rm_stream(client, msg->stream_id);
 		break;
+	case CLIENT_ADD_STREAMS: {
+		struct add_streams_command_message *add_msg =
+			(struct add_streams_command_message *)msg;
+		rc = client_thread_add_streams(client, add_msg->streams,
+					       add_msg->stream_ids_out,
+					       add_msg->num_streams);
+		break;
+	}
+	case CLIENT_REMOVE_STREAMS: {
+		struct rm_streams_command_message *rm_msg =
+			(struct rm_streams_command_message *)msg;
+		rc = client_thread_rm_streams(client, rm_msg->stream_ids,
+					      rm_msg->num_streams);
+		break;
+	}
 	case CLIENT_SET_STREAM_VOLUME_SCALER: {
 		struct set_stream_volume_command_message *vol_msg =
 			(struct set_stream_volume_command_message *)msg;
@@ -1900,6 +2624,22 @@ static int handle_command_message(struct cras_client *client, int poll_revents)
 						     vol_msg->volume_scaler);
 		break;
 	}
+	case CLIENT_SET_STREAM_EFFECTS: {
+		struct set_stream_effects_command_message *fx_msg =
+			(struct set_stream_effects_command_message *)msg;
+		rc = client_thread_set_stream_effects(client,
+						      fx_msg->header.stream_id,
+						      fx_msg->effects);
+		break;
+	}
+	case CLIENT_SET_STREAM_PAUSED: {
+		struct set_stream_paused_command_message *pause_msg =
+			(struct set_stream_paused_command_message *)msg;
+		rc = client_thread_set_stream_paused(
+			client, pause_msg->header.stream_id, pause_msg->paused,
+			pause_msg->fade_in_ms);
+		break;
+	}
 	case CLIENT_SERVER_CONNECT:
 		rc = connect_to_server_wait(client, false);
 		break;
@@ -2111,11 +2851,26 @@ int cras_client_create_with_type(struct cras_client **client,
 		goto free_client;
 	}
 
+	rc = pthread_mutex_init(&client_int->dev_cache_lock, NULL);
+	if (rc != 0) {
+		syslog(LOG_ERR, "cras_client: Could not init dev cache lock.");
+		rc = -rc;
+		goto free_rwlock;
+	}
+	invalidate_dev_cache(client_int);
+
+	rc = pthread_rwlock_init(&(*client)->streams_rwlock, NULL);
+	if (rc != 0) {
+		syslog(LOG_ERR, "cras_client: Could not init streams rwlock.");
+		rc = -rc;
+		goto free_dev_cache_lock;
+	}
+
 	rc = pthread_mutex_init(&(*client)->stream_start_lock, NULL);
 	if (rc != 0) {
 		syslog(LOG_ERR, "cras_client: Could not init start lock.");
 		rc = -rc;
-		goto free_rwlock;
+		goto free_streams_rwlock;
 	}
 
 	pthread_condattr_init(&cond_attr);
@@ -2167,6 +2922,8 @@ int cras_client_create_with_type(struct cras_client **client,
 	}
 	(*client)->command_reply_fds[0] = -1;
 	(*client)->command_reply_fds[1] = -1;
+	(*client)->aud_wake_fds[0] = -1;
+	(*client)->aud_wake_fds[1] = -1;
 
 	return 0;
 free_error:
@@ -2179,6 +2936,10 @@ free_cond:
 	pthread_cond_destroy(&(*client)->stream_start_cond);
 free_lock:
 	pthread_mutex_destroy(&(*client)->stream_start_lock);
+free_streams_rwlock:
+	pthread_rwlock_destroy(&(*client)->streams_rwlock);
+free_dev_cache_lock:
+	pthread_mutex_destroy(&client_int->dev_cache_lock);
 free_rwlock:
 	pthread_rwlock_destroy(&client_int->server_state_rwlock);
 free_client:
@@ -2207,6 +2968,8 @@ void cras_client_destroy(struct cras_client *client)
 	close(client->stream_fds[0]);
 	close(client->stream_fds[1]);
 	cras_file_wait_destroy(client->sock_file_wait);
+	pthread_rwlock_destroy(&client->streams_rwlock);
+	pthread_mutex_destroy(&client_int->dev_cache_lock);
 	pthread_rwlock_destroy(&client_int->server_state_rwlock);
 	free((void *)client->sock_file);
 	free(client_int);
@@ -2249,6 +3012,12 @@ struct cras_stream_params *cras_client_stream_params_create(
 	params->buffer_frames = buffer_frames;
 	params->cb_threshold = cb_threshold;
 	params->effects = 0;
+	params->num_shm_buffers = 0;
+	params->scheduled_ts.tv_sec = 0;
+	params->scheduled_ts.tv_nsec = 0;
+	params->pre_roll_frames = 0;
+	params->external_poll = 0;
+	params->own_thread = 0;
 	params->stream_type = stream_type;
 	params->client_type = CRAS_CLIENT_TYPE_UNKNOWN;
 	params->flags = flags;
@@ -2266,6 +3035,107 @@ void cras_client_stream_params_set_client_type(
 	params->client_type = client_type;
 }
 
+int cras_client_stream_params_set_num_shm_buffers(
+	struct cras_stream_params *params, unsigned int num_buffers)
+{
+	if (!cras_shm_num_buffers_valid(num_buffers))
+		return -EINVAL;
+	params->num_shm_buffers = num_buffers;
+	return 0;
+}
+
+int cras_client_stream_params_set_scheduled_start(
+	struct cras_stream_params *params, const struct timespec *start)
+{
+	if (params->direction != CRAS_STREAM_OUTPUT)
+		return -EINVAL;
+	if (start->tv_sec < 0 || start->tv_nsec < 0 ||
+	    start->tv_nsec >= 1000000000L)
+		return -EINVAL;
+	params->scheduled_ts = *start;
+	return 0;
+}
+
+int cras_client_stream_params_set_pre_roll(struct cras_stream_params *params,
+					   unsigned int frames)
+{
+	if (params->direction != CRAS_STREAM_INPUT ||
+	    frames > params->buffer_frames)
+		return -EINVAL;
+	params->pre_roll_frames = frames;
+	return 0;
+}
+
+int cras_client_get_preferred_format(const struct cras_client *client,
+				     enum CRAS_STREAM_DIRECTION direction,
+				     uint32_t dev_idx,
+				     struct cras_audio_format *fmt)
+{
+	struct cras_iodev_info devs[CRAS_MAX_IODEVS];
+	struct cras_ionode_info nodes[CRAS_MAX_IONODES];
+	size_t num_devs = CRAS_MAX_IODEVS, num_nodes = CRAS_MAX_IONODES;
+	size_t i;
+	int lock_rc;
+
+	if (!client || !fmt ||
+	    (direction != CRAS_STREAM_OUTPUT && direction != CRAS_STREAM_INPUT))
+		return -EINVAL;
+	lock_rc = server_state_rdlock(client);
+	if (lock_rc)
+		return -EINVAL;
+	get_dev_section(client, direction, devs, nodes, &num_devs, &num_nodes);
+	server_state_unlock(client, lock_rc);
+
+	if (dev_idx == NO_DEVICE) {
+		for (i = 0; i < num_nodes; i++) {
+			if (nodes[i].active) {
+				dev_idx = nodes[i].iodev_idx;
+				break;
+			}
+		}
+	}
+
+	for (i = 0; i < num_devs; i++) {
+		if (devs[i].idx != dev_idx)
+			continue;
+		if (!devs[i].preferred_rate ||
+		    !devs[i].preferred_num_channels)
+			return -ENODATA;
+		fmt->format = (snd_pcm_format_t)devs[i].preferred_format;
+		fmt->frame_rate = devs[i].preferred_rate;
+		fmt->num_channels = devs[i].preferred_num_channels;
+		cras_audio_format_set_default_channel_layout(fmt);
+		return 0;
+	}
+	return -ENODEV;
+}
+
+int cras_client_stream_params_match_device(const struct cras_client *client,
+					   struct cras_stream_params *params,
+					   uint32_t dev_idx,
+					   struct cras_audio_format *fmt)
+{
+	int rc;
+
+	rc = cras_client_get_preferred_format(client, params->direction,
+					      dev_idx, &params->format);
+	if (fmt)
+		*fmt = params->format;
+	return rc;
+}
+
+void cras_client_stream_params_enable_external_poll(
+	struct cras_stream_params *params)
+{
+	params->external_poll = 1;
+}
+
+void cras_client_stream_params_enable_own_thread(
+	struct cras_stream_params *params)
+{
+	params->own_thread = 1;
+}
+
 void cras_client_stream_params_enable_aec(struct cras_stream_params *params)
 {
 	params->effects |= APM_ECHO_CANCELLATION;
@@ -2325,6 +3195,12 @@ struct cras_stream_params *cras_client_unified_params_create(
 	params->client_type = CRAS_CLIENT_TYPE_UNKNOWN;
 	params->flags = flags;
 	params->effects = 0;
+	params->num_shm_buffers = 0;
+	params->scheduled_ts.tv_sec = 0;
+	params->scheduled_ts.tv_nsec = 0;
+	params->pre_roll_frames = 0;
+	params->external_poll = 0;
+	params->own_thread = 0;
 	params->user_data = user_data;
 	params->aud_cb = 0;
 	params->unified_cb = unified_cb;
@@ -2339,33 +3215,30 @@ void cras_client_stream_params_destroy(struct cras_stream_params *params)
 	free(params);
 }
 
-static inline int cras_client_send_add_stream_command_message(
-	struct cras_client *client, uint32_t dev_idx,
-	cras_stream_id_t *stream_id_out, struct cras_stream_params *config)
+/* Checks that the callbacks needed by a stream are set. */
+static int stream_params_valid(const struct cras_stream_params *config)
 {
-	struct add_stream_command_message cmd_msg;
-	struct client_stream *stream;
-	int rc = 0;
-
-	if (client == NULL || config == NULL || stream_id_out == NULL)
-		return -EINVAL;
-
+	if (config == NULL)
+		return 0;
 	if (config->aud_cb == NULL && config->unified_cb == NULL)
-		return -EINVAL;
+		return 0;
+	return config->err_cb != NULL;
+}
 
-	if (config->err_cb == NULL)
-		return -EINVAL;
+/* Allocates a stream to pass to the client thread, with a copy of config. */
+static struct client_stream *
+client_stream_create(const struct cras_stream_params *config)
+{
+	struct client_stream *stream;
 
 	stream = (struct client_stream *)calloc(1, sizeof(*stream));
-	if (stream == NULL) {
-		rc = -ENOMEM;
-		goto add_failed;
-	}
+	if (stream == NULL)
+		return NULL;
 	stream->config =
 		(struct cras_stream_params *)malloc(sizeof(*(stream->config)));
 	if (stream->config == NULL) {
-		rc = -ENOMEM;
-		goto add_failed;
+		free(stream);
+		return NULL;
 	}
 	memcpy(stream->config, config, sizeof(*config));
 	stream->aud_fd = -1;
@@ -2373,11 +3246,41 @@ static inline int cras_client_send_add_stream_command_message(
 	stream->wake_fds[1] = -1;
 	stream->direction = config->direction;
 	stream->flags = config->flags;
+	/* There is no futex to poll, the server must write to aud_fd. */
+	stream->external_poll = config->external_poll;
+	if (stream->external_poll)
+		stream->flags &= ~SHM_WAKE;
 
 	/* Caller might not set this volume scaler after stream created,
 	 * so always initialize it to 1.0f */
 	stream->volume_scaler = 1.0f;
 
+	return stream;
+}
+
+/* Frees a stream the client thread failed to add. */
+static void client_stream_free(struct client_stream *stream)
+{
+	free(stream->config);
+	free(stream);
+}
+
+static inline int cras_client_send_add_stream_command_message(
+	struct cras_client *client, uint32_t dev_idx,
+	cras_stream_id_t *stream_id_out, struct cras_stream_params *config)
+{
+	struct add_stream_command_message cmd_msg;
+	struct client_stream *stream;
+	int rc = 0;
+
+	if (client == NULL || stream_id_out == NULL ||
+	    !stream_params_valid(config))
+		return -EINVAL;
+
+	stream = client_stream_create(config);
+	if (stream == NULL)
+		return -ENOMEM;
+
 	cmd_msg.header.len = sizeof(cmd_msg);
 	cmd_msg.header.msg_id = CLIENT_ADD_STREAM;
 	cmd_msg.header.stream_id = stream->id;
@@ -2388,18 +3291,11 @@ static inline int cras_client_send_add_stream_command_message(
 	if (rc < 0) {
 		syslog(LOG_ERR,
 		       "cras_client: adding stream failed in thread %d", rc);
-		goto add_failed;
+		client_stream_free(stream);
+		return rc;
 	}
 
 	return 0;
-
-add_failed:
-	if (stream) {
-		if (stream->config)
-			free(stream->config);
-		free(stream);
-	}
-	return rc;
 }
 
 int cras_client_add_stream(struct cras_client *client,
@@ -2418,6 +3314,52 @@ int cras_client_add_pinned_stream(struct cras_client *client, uint32_t dev_idx,
 		client, dev_idx, stream_id_out, config);
 }
 
+int cras_client_add_streams(struct cras_client *client,
+			    unsigned int num_streams,
+			    struct cras_stream_params *const *configs,
+			    cras_stream_id_t *stream_ids_out)
+{
+	struct add_streams_command_message cmd_msg;
+	struct client_stream *streams[CRAS_MAX_BATCH_STREAMS];
+	unsigned int i, n;
+	int rc;
+
+	if (client == NULL || configs == NULL || stream_ids_out == NULL ||
+	    num_streams == 0 || num_streams > CRAS_MAX_BATCH_STREAMS)
+		return -EINVAL;
+	for (i = 0; i < num_streams; i++)
+		if (!stream_params_valid(configs[i]))
+			return -EINVAL;
+
+	for (n = 0; n < num_streams; n++) {
+		streams[n] = client_stream_create(configs[n]);
+		if (streams[n] == NULL) {
+			rc = -ENOMEM;
+			goto add_failed;
+		}
+	}
+
+	cmd_msg.header.len = sizeof(cmd_msg);
+	cmd_msg.header.msg_id = CLIENT_ADD_STREAMS;
+	cmd_msg.header.stream_id = 0;
+	cmd_msg.streams = streams;
+	cmd_msg.stream_ids_out = stream_ids_out;
+	cmd_msg.num_streams = num_streams;
+	rc = send_command_message(client, &cmd_msg.header);
+	if (rc < 0) {
+		syslog(LOG_ERR,
+		       "cras_client: adding streams failed in thread %d", rc);
+		goto add_failed;
+	}
+
+	return 0;
+
+add_failed:
+	for (i = 0; i < n; i++)
+		client_stream_free(streams[i]);
+	return rc;
+}
+
 int cras_client_rm_stream(struct cras_client *client,
 			  cras_stream_id_t stream_id)
 {
@@ -2427,6 +3369,81 @@ int cras_client_rm_stream(struct cras_client *client,
 	return send_simple_cmd_msg(client, stream_id, CLIENT_REMOVE_STREAM);
 }
 
+int cras_client_rm_streams(struct cras_client *client,
+			   unsigned int num_streams,
+			   const cras_stream_id_t *stream_ids)
+{
+	struct rm_streams_command_message cmd_msg;
+
+	if (client == NULL || stream_ids == NULL ||
+	    num_streams > CRAS_MAX_BATCH_STREAMS)
+		return -EINVAL;
+
+	cmd_msg.header.len = sizeof(cmd_msg);
+	cmd_msg.header.msg_id = CLIENT_REMOVE_STREAMS;
+	cmd_msg.header.stream_id = 0;
+	cmd_msg.stream_ids = stream_ids;
+	cmd_msg.num_streams = num_streams;
+	return send_command_message(client, &cmd_msg.header);
+}
+
+int cras_client_stream_get_fd(struct cras_client *client,
+			      cras_stream_id_t stream_id)
+{
+	struct client_stream *stream;
+	int fd = -EINVAL;
+
+	if (client == NULL)
+		return -EINVAL;
+
+	pthread_rwlock_rdlock(&client->streams_rwlock);
+	stream = stream_from_id(client, stream_id);
+	if (stream && stream->external_poll)
+		fd = stream->aud_fd;
+	pthread_rwlock_unlock(&client->streams_rwlock);
+	return fd;
+}
+
+int cras_client_stream_process(struct cras_client *client,
+			       cras_stream_id_t stream_id)
+{
+	struct client_stream *stream;
+	struct audio_message aud_msg;
+	int rc;
+
+	if (client == NULL)
+		return -EINVAL;
+
+	pthread_rwlock_rdlock(&client->streams_rwlock);
+	stream = stream_from_id(client, stream_id);
+	if (stream == NULL || !stream->external_poll) {
+		rc = -EINVAL;
+		goto unlock;
+	}
+	/* Requests wait in aud_fd until the shm is set up. */
+	if (stream->thread.state != CRAS_THREAD_RUNNING) {
+		rc = 0;
+		goto unlock;
+	}
+
+	rc = recv(stream->aud_fd, &aud_msg, sizeof(aud_msg), MSG_DONTWAIT);
+	if (rc < 0) {
+		rc = (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -errno;
+		goto unlock;
+	}
+	if (rc != sizeof(aud_msg)) {
+		rc = -EIO;
+		goto unlock;
+	}
+
+	rc = handle_audio_message(stream, &aud_msg);
+	if (rc == 0)
+		rc = 1;
+unlock:
+	pthread_rwlock_unlock(&client->streams_rwlock);
+	return rc;
+}
+
 int cras_client_set_stream_volume(struct cras_client *client,
 				  cras_stream_id_t stream_id,
 				  float volume_scaler)
@@ -2437,6 +3454,53 @@ int cras_client_set_stream_volume(struct cras_client *client,
 	return send_stream_volume_command_msg(client, stream_id, volume_scaler);
 }
 
+int cras_client_set_stream_effects(struct cras_client *client,
+				   cras_stream_id_t stream_id, uint64_t effects)
+{
+	struct set_stream_effects_command_message msg;
+
+	if (client == NULL)
+		return -EINVAL;
+
+	msg.header.len = sizeof(msg);
+	msg.header.stream_id = stream_id;
+	msg.header.msg_id = CLIENT_SET_STREAM_EFFECTS;
+	msg.effects = effects;
+	return send_command_message(client, &msg.header);
+}
+
+/* Sends the command pausing or resuming a stream to the client thread. */
+static int send_stream_paused_command_msg(struct cras_client *client,
+					  cras_stream_id_t stream_id,
+					  int paused, unsigned int fade_in_ms)
+{
+	struct set_stream_paused_command_message msg;
+
+	if (client == NULL)
+		return -EINVAL;
+
+	msg.header.len = sizeof(msg);
+	msg.header.stream_id = stream_id;
+	msg.header.msg_id = CLIENT_SET_STREAM_PAUSED;
+	msg.paused = paused;
+	msg.fade_in_ms = fade_in_ms;
+	return send_command_message(client, &msg.header);
+}
+
+int cras_client_pause_stream(struct cras_client *client,
+			     cras_stream_id_t stream_id)
+{
+	return send_stream_paused_command_msg(client, stream_id, 1, 0);
+}
+
+int cras_client_resume_stream(struct cras_client *client,
+			      cras_stream_id_t stream_id,
+			      unsigned int fade_in_ms)
+{
+	return send_stream_paused_command_msg(client, stream_id, 0,
+					      fade_in_ms);
+}
+
 int cras_client_set_system_volume(struct cras_client *client, size_t volume)
 {
 	struct cras_set_system_volume msg;
@@ -2632,6 +3696,37 @@ cras_client_get_audio_debug_info(const struct cras_client *client)
 	return debug_info;
 }
 
+int cras_client_get_perf_stats(const struct cras_client *client,
+			       struct cras_perf_stats *stats,
+			       unsigned int num_stats)
+{
+	const struct cras_perf_stats *src;
+	unsigned int i;
+	uint32_t seq;
+	int lock_rc;
+
+	lock_rc = server_state_rdlock(client);
+	if (lock_rc)
+		return -lock_rc;
+
+	num_stats = MIN(num_stats, CRAS_MAX_PERF_STATS);
+	for (i = 0; i < num_stats; i++) {
+		src = &client->server_state->perf_stats[i];
+		/* The audio thread doesn't wait for readers, copy again if
+		 * it wrote during the copy. */
+		do {
+			while ((seq = __atomic_load_n(&src->seq,
+						      __ATOMIC_ACQUIRE)) &
+			       1)
+				sched_yield();
+			memcpy(&stats[i], src, sizeof(stats[i]));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		} while (seq != __atomic_load_n(&src->seq, __ATOMIC_RELAXED));
+	}
+	server_state_unlock(client, lock_rc);
+	return num_stats;
+}
+
 const struct main_thread_debug_info *
 cras_client_get_main_thread_debug_info(const struct cras_client *client)
 {
@@ -2688,7 +3783,7 @@ unsigned cras_client_get_num_active_streams(const struct cras_client *client,
 		return 0;
 
 read_active_streams_again:
-	version = begin_server_state_read(client->server_state);
+	version = begin_section_read(client->server_state, CRAS_STATE_STREAMS);
 	num_streams = 0;
 	for (i = 0; i < CRAS_NUM_DIRECTIONS; i++)
 		num_streams += client->server_state->num_active_streams[i];
@@ -2700,7 +3795,7 @@ read_active_streams_again:
 				ts,
 				&client->server_state->last_active_stream_time);
 	}
-	if (end_server_state_read(client->server_state, version))
+	if (end_section_read(client->server_state, CRAS_STATE_STREAMS, version))
 		goto read_active_streams_again;
 
 	server_state_unlock(client, lock_rc);
@@ -2763,33 +3858,25 @@ void cras_client_set_thread_priority_cb(struct cras_client *client,
 	client->thread_priority_cb = cb;
 }
 
+void cras_client_share_audio_thread(struct cras_client *client)
+{
+	client->share_aud_thread = 1;
+}
+
 int cras_client_get_output_devices(const struct cras_client *client,
 				   struct cras_iodev_info *devs,
 				   struct cras_ionode_info *nodes,
 				   size_t *num_devs, size_t *num_nodes)
 {
-	const struct cras_server_state *state;
-	unsigned avail_devs, avail_nodes, version;
 	int lock_rc;
 
 	lock_rc = server_state_rdlock(client);
 	if (lock_rc)
 		return -EINVAL;
-	state = client->server_state;
-
-read_outputs_again:
-	version = begin_server_state_read(state);
-	avail_devs = MIN(*num_devs, state->num_output_devs);
-	memcpy(devs, state->output_devs, avail_devs * sizeof(*devs));
-	avail_nodes = MIN(*num_nodes, state->num_output_nodes);
-	memcpy(nodes, state->output_nodes, avail_nodes * sizeof(*nodes));
-	if (end_server_state_read(state, version))
-		goto read_outputs_again;
+	get_dev_section(client, CRAS_STREAM_OUTPUT, devs, nodes, num_devs,
+			num_nodes);
 	server_state_unlock(client, lock_rc);
 
-	*num_devs = avail_devs;
-	*num_nodes = avail_nodes;
-
 	return 0;
 }
 
@@ -2798,28 +3885,15 @@ int cras_client_get_input_devices(const struct cras_client *client,
 				  struct cras_ionode_info *nodes,
 				  size_t *num_devs, size_t *num_nodes)
 {
-	const struct cras_server_state *state;
-	unsigned avail_devs, avail_nodes, version;
 	int lock_rc;
 
 	lock_rc = server_state_rdlock(client);
-	if (!client)
+	if (lock_rc)
 		return -EINVAL;
-	state = client->server_state;
-
-read_inputs_again:
-	version = begin_server_state_read(state);
-	avail_devs = MIN(*num_devs, state->num_input_devs);
-	memcpy(devs, state->input_devs, avail_devs * sizeof(*devs));
-	avail_nodes = MIN(*num_nodes, state->num_input_nodes);
-	memcpy(nodes, state->input_nodes, avail_nodes * sizeof(*nodes));
-	if (end_server_state_read(state, version))
-		goto read_inputs_again;
+	get_dev_section(client, CRAS_STREAM_INPUT, devs, nodes, num_devs,
+			num_nodes);
 	server_state_unlock(client, lock_rc);
 
-	*num_devs = avail_devs;
-	*num_nodes = avail_nodes;
-
 	return 0;
 }
 
@@ -2837,10 +3911,10 @@ int cras_client_get_attached_clients(const struct cras_client *client,
 	state = client->server_state;
 
 read_clients_again:
-	version = begin_server_state_read(state);
+	version = begin_section_read(state, CRAS_STATE_CLIENTS);
 	num = MIN(max_clients, state->num_attached_clients);
 	memcpy(clients, state->client_info, num * sizeof(*clients));
-	if (end_server_state_read(state, version))
+	if (end_section_read(state, CRAS_STATE_CLIENTS, version))
 		goto read_clients_again;
 	server_state_unlock(client, lock_rc);
 
@@ -3073,6 +4147,31 @@ int cras_client_calc_capture_latency(const struct timespec *sample_time,
 	return 0;
 }
 
+int cras_client_get_stream_telemetry(struct cras_client *client,
+				     cras_stream_id_t stream_id,
+				     struct cras_audio_shm_telemetry *telemetry)
+{
+	struct client_stream *stream;
+	int rc = -EINVAL;
+
+	if (client == NULL || telemetry == NULL)
+		return -EINVAL;
+
+	pthread_rwlock_rdlock(&client->streams_rwlock);
+	stream = stream_from_id(client, stream_id);
+	if (stream == NULL)
+		goto unlock;
+	/* Not connected yet. */
+	if (stream->shm == NULL) {
+		rc = -ENODATA;
+		goto unlock;
+	}
+	rc = cras_shm_get_telemetry(stream->shm, telemetry);
+unlock:
+	pthread_rwlock_unlock(&client->streams_rwlock);
+	return rc;
+}
+
 int cras_client_reload_dsp(struct cras_client *client)
 {
 	struct cras_reload_dsp msg;
@@ -3379,6 +4478,7 @@ int cras_client_get_first_node_type_idx(const struct cras_client *client,
 					cras_node_id_t *node_id)
 {
 	const struct cras_server_state *state;
+	enum CRAS_SERVER_STATE_SECTION section;
 	unsigned int version;
 	unsigned int i;
 	const struct cras_ionode_info *node_list;
@@ -3390,8 +4490,11 @@ int cras_client_get_first_node_type_idx(const struct cras_client *client,
 		return -EINVAL;
 	state = client->server_state;
 
+	section = direction == CRAS_STREAM_OUTPUT ? CRAS_STATE_OUTPUT_DEVS :
+						    CRAS_STATE_INPUT_DEVS;
+
 read_nodes_again:
-	version = begin_server_state_read(state);
+	version = begin_section_read(state, section);
 	if (direction == CRAS_STREAM_OUTPUT) {
 		node_list = state->output_nodes;
 		num_nodes = state->num_output_nodes;
@@ -3407,7 +4510,7 @@ read_nodes_again:
 			return 0;
 		}
 	}
-	if (end_server_state_read(state, version))
+	if (end_section_read(state, section, version))
 		goto read_nodes_again;
 	server_state_unlock(client, lock_rc);
 
@@ -58,6 +58,7 @@ extern "C" {
 #include "cras_types.h"
 #include "cras_util.h"
 
+struct cras_audio_shm_telemetry;
 struct cras_client;
 struct cras_hotword_handle;
 struct cras_stream_params;
@@ -292,6 +293,17 @@ void cras_client_set_connection_status_cb(
 void cras_client_set_thread_priority_cb(struct cras_client *client,
 					cras_thread_priority_cb_t cb);
 
+/* Services the streams of the client from a single audio thread instead of
+ * starting one for each stream. The thread polls the audio sockets of all the
+ * streams and runs their callbacks one after the other, so a slow callback
+ * delays the others. Streams with SHM_WAKE, or set up with
+ * cras_client_stream_params_enable_own_thread(), still get a thread of their
+ * own. Only affects the streams added after the call.
+ * Args:
+ *    client - The client from cras_client_create.
+ */
+void cras_client_share_audio_thread(struct cras_client *client);
+
 /* Returns the current list of output devices.
  *
  * Requires that the connection to the server has been established.
@@ -583,6 +595,104 @@ struct cras_stream_params *cras_client_stream_params_create(
 void cras_client_stream_params_set_client_type(
 	struct cras_stream_params *params, enum CRAS_CLIENT_TYPE client_type);
 
+/* Sets how many buffers the stream's samples shm is split in. Deeper rings
+ * let a jittery client queue several periods ahead. The depth must be a
+ * power of two up to CRAS_MAX_SHM_BUFFERS, 0 keeps the double buffer.
+ * Args:
+ *    params - Stream configuration parameters.
+ *    num_buffers - Number of buffers.
+ * Returns:
+ *    0 on success, -EINVAL if num_buffers isn't supported.
+ */
+int cras_client_stream_params_set_num_shm_buffers(
+	struct cras_stream_params *params, unsigned int num_buffers);
+
+/* Schedules the first frame of a playback stream to leave the speaker at a
+ * given time. The stream is connected right away but the server holds back
+ * its callbacks until shortly before the start, then places the first frame
+ * so it is heard at that time. Several streams given the same time start
+ * together, on one device or on several. A time already passed starts the
+ * stream right away.
+ * Args:
+ *    params - Stream configuration parameters.
+ *    start - The start time on CLOCK_MONOTONIC_RAW, zero to disable.
+ * Returns:
+ *    0 on success, -EINVAL if the stream isn't for playback or start isn't a
+ *    valid time.
+ */
+int cras_client_stream_params_set_scheduled_start(
+	struct cras_stream_params *params, const struct timespec *start);
+
+/* Starts a capture stream with audio captured before it was connected, so
+ * the first words said before a push-to-talk are not lost. The frames come
+ * from the history an input device keeps once streams ask for pre-roll on
+ * it, a device that was closed has none yet. They are not processed by the
+ * effects of the stream, a stream with effects starts without them.
+ * Args:
+ *    params - Stream configuration parameters.
+ *    frames - Number of frames to start with, at most the buffer of the
+ *        stream. Zero to disable.
+ * Returns:
+ *    0 on success, -EINVAL if the stream isn't for capture or frames is
+ *    larger than its buffer.
+ */
+int cras_client_stream_params_set_pre_roll(struct cras_stream_params *params,
+					   unsigned int frames);
+
+/* Gets the format a device prefers, the one it last opened with. Streams in
+ * this format are mixed or copied without conversion in the server.
+ * Args:
+ *    client - The client from cras_client_create.
+ *    direction - The direction of the device.
+ *    dev_idx - Index of the device, or NO_DEVICE for the active one.
+ *    fmt - Filled with the preferred rate, channels and sample format, and a
+ *        default channel layout.
+ * Returns:
+ *    0 on success, -EINVAL if the client isn't valid or isn't running,
+ *    -ENODEV if there is no such device, -ENODATA if it hasn't opened yet.
+ */
+int cras_client_get_preferred_format(const struct cras_client *client,
+				     enum CRAS_STREAM_DIRECTION direction,
+				     uint32_t dev_idx,
+				     struct cras_audio_format *fmt);
+
+/* Opts the stream in to the format of the device it will run on, so the
+ * server doesn't have to convert it. The stream keeps its own format when
+ * the device format isn't known yet.
+ * Args:
+ *    client - The client from cras_client_create.
+ *    params - Stream configuration parameters.
+ *    dev_idx - The device the stream will be pinned to, or NO_DEVICE.
+ *    fmt - If not NULL, filled with the format the stream ends up with. The
+ *        audio callbacks get their samples in this format.
+ * Returns:
+ *    0 if the stream now uses the device format, negative error code from
+ *    cras_client_get_preferred_format otherwise.
+ */
+int cras_client_stream_params_match_device(const struct cras_client *client,
+					   struct cras_stream_params *params,
+					   uint32_t dev_idx,
+					   struct cras_audio_format *fmt);
+
+/* Lets the user service the stream from its own event loop instead of an
+ * audio thread started by the client. The user polls the fd returned by
+ * cras_client_stream_get_fd() and calls cras_client_stream_process() when it
+ * is readable, the audio callbacks then run from that call. SHM_WAKE is
+ * ignored for these streams, the server has to signal them through the fd.
+ * Args:
+ *    params - Stream configuration parameters.
+ */
+void cras_client_stream_params_enable_external_poll(
+	struct cras_stream_params *params);
+
+/* Gives the stream an audio thread of its own even when the client shares
+ * one between its streams, see cras_client_share_audio_thread().
+ * Args:
+ *    params - Stream configuration parameters.
+ */
+void cras_client_stream_params_enable_own_thread(
+	struct cras_stream_params *params);
+
 /* Functions to enable or disable specific effect on given stream parameter.
  * Args:
  *    params - Stream configuration parameters.
@@ -660,6 +770,30 @@ int cras_client_add_pinned_stream(struct cras_client *client, uint32_t dev_idx,
 				  cras_stream_id_t *stream_id_out,
 				  struct cras_stream_params *config);
 
+/* Creates several streams at once. The streams are connected to the server
+ * with a single message and attached to their devices together, which is
+ * faster than adding them one by one.
+ *
+ * Requires execution of cras_client_run_thread(), and an active connection
+ * to the audio server.
+ *
+ * Args:
+ *    client - The client to add the streams to (from cras_client_create).
+ *    num_streams - Number of streams, at most CRAS_MAX_BATCH_STREAMS.
+ *    configs - The parameters of each stream.
+ *    stream_ids_out - On success will be filled with the new stream ids, in
+ *        the same order as configs. Guaranteed to be set before any
+ *        callbacks are made.
+ * Returns:
+ *    0 on success, negative error code on failure (from errno.h). On failure
+ *    none of the streams is added. A stream the server fails to set up is
+ *    reported through its err_cb, as with cras_client_add_stream().
+ */
+int cras_client_add_streams(struct cras_client *client,
+			    unsigned int num_streams,
+			    struct cras_stream_params *const *configs,
+			    cras_stream_id_t *stream_ids_out);
+
 /* Removes a currently playing/capturing stream.
  *
  * Requires execution of cras_client_run_thread().
@@ -674,6 +808,104 @@ int cras_client_add_pinned_stream(struct cras_client *client, uint32_t dev_idx,
 int cras_client_rm_stream(struct cras_client *client,
 			  cras_stream_id_t stream_id);
 
+/* Removes several streams at once with a single message to the server.
+ *
+ * Requires execution of cras_client_run_thread().
+ *
+ * Args:
+ *    client - Client to remove the streams (returned from cras_client_create).
+ *    num_streams - Number of streams, at most CRAS_MAX_BATCH_STREAMS.
+ *    stream_ids - IDs of the streams to remove. Unknown ids are ignored.
+ * Returns:
+ *    0 on success negative error code on failure (from errno.h).
+ */
+int cras_client_rm_streams(struct cras_client *client,
+			   unsigned int num_streams,
+			   const cras_stream_id_t *stream_ids);
+
+/* Gets the fd to poll for a stream added with external poll enabled, see
+ * cras_client_stream_params_enable_external_poll(). It becomes readable each
+ * time the server needs the stream serviced. The fd is owned by the client
+ * and is closed when the stream is removed.
+ *
+ * Args:
+ *    client - Client owning the stream.
+ *    stream_id - ID returned from cras_client_add_stream.
+ * Returns:
+ *    The fd on success, -EINVAL if the stream is unknown or isn't polled
+ *    externally.
+ */
+int cras_client_stream_get_fd(struct cras_client *client,
+			      cras_stream_id_t stream_id);
+
+/* Services a stream added with external poll enabled without blocking. Reads
+ * at most one message from the stream fd and runs the audio callback for it.
+ * Must not be called from an audio callback, nor concurrently for the same
+ * stream.
+ *
+ * Args:
+ *    client - Client owning the stream.
+ *    stream_id - ID returned from cras_client_add_stream.
+ * Returns:
+ *    1 if a request was serviced, 0 if there was nothing to do yet, for
+ *    example the stream isn't connected, or a negative error code. -EINVAL
+ *    once the stream is removed, the user should stop polling its fd.
+ */
+int cras_client_stream_process(struct cras_client *client,
+			       cras_stream_id_t stream_id);
+
+/* Changes the effects of a running input stream, without removing and
+ * adding it again. The server keeps delivering the captured frames without
+ * a gap. The effects are the APM_* bits set by
+ * cras_client_stream_params_enable_aec() and friends.
+ *
+ * Requires execution of cras_client_run_thread().
+ *
+ * Args:
+ *    client - Client owning the stream.
+ *    stream_id - ID returned from cras_client_add_stream.
+ *    effects - Bit map of the effects to apply from now on.
+ * Returns:
+ *    0 on success, -EINVAL if there's no such input stream.
+ */
+int cras_client_set_stream_effects(struct cras_client *client,
+				   cras_stream_id_t stream_id,
+				   uint64_t effects);
+
+/* Pauses a stream. The server stops asking it for samples, or sending it
+ * captured ones, but keeps it connected so cras_client_resume_stream() can
+ * start it again at once. Unlike removing the stream, its shm, format
+ * converters and effects stay set up. The samples an output stream has
+ * queued are played once it resumes.
+ *
+ * Requires execution of cras_client_run_thread().
+ *
+ * Args:
+ *    client - Client owning the stream.
+ *    stream_id - ID returned from cras_client_add_stream.
+ * Returns:
+ *    0 on success, -EINVAL if there's no such stream.
+ */
+int cras_client_pause_stream(struct cras_client *client,
+			     cras_stream_id_t stream_id);
+
+/* Resumes a stream paused by cras_client_pause_stream(). Captured samples
+ * resume from the time of the call.
+ *
+ * Requires execution of cras_client_run_thread().
+ *
+ * Args:
+ *    client - Client owning the stream.
+ *    stream_id - ID returned from cras_client_add_stream.
+ *    fade_in_ms - For output streams, how long it takes to fade in from
+ *        silence, 0 to start at full volume.
+ * Returns:
+ *    0 on success, -EINVAL if there's no such stream.
+ */
+int cras_client_resume_stream(struct cras_client *client,
+			      cras_stream_id_t stream_id,
+			      unsigned int fade_in_ms);
+
 /* Sets the volume scaling factor for the given stream.
  *
  * Requires execution of cras_client_run_thread().
@@ -866,6 +1098,24 @@ cras_client_get_audio_debug_info(const struct cras_client *client);
 const struct cras_bt_debug_info *
 cras_client_get_bt_debug_info(const struct cras_client *client);
 
+/* Copies the perf stats each audio thread publishes in the server state,
+ * see struct cras_perf_stats. Reading them sends nothing to the server.
+ *
+ * Requires that the connection to the server has been established.
+ *
+ * Args:
+ *    client - The client from cras_client_create.
+ *    stats - Filled with the stats of each audio thread, an entry whose seq
+ *        is 0 belongs to a thread that doesn't run.
+ *    num_stats - Number of entries in stats, up to CRAS_MAX_PERF_STATS are
+ *        filled.
+ * Returns:
+ *    The number of entries filled, or a negative error code.
+ */
+int cras_client_get_perf_stats(const struct cras_client *client,
+			       struct cras_perf_stats *stats,
+			       unsigned int num_stats);
+
 /* Gets main thread debug info.
  * Args:
  *    client - The client from cras_client_create.
@@ -946,6 +1196,25 @@ int cras_client_calc_playback_latency(const struct timespec *sample_time,
 int cras_client_calc_capture_latency(const struct timespec *sample_time,
 				     struct timespec *delay);
 
+/* Gets the timing of a stream published by the server: device, DSP and
+ * sample rate converter delays, the estimated device rate, the overrun
+ * and underrun counts and the power and peak levels of the stream and its
+ * device, see struct cras_audio_shm_telemetry in cras_shm.h.
+ * Doesn't block, and can be called from any thread including the audio
+ * callback.
+ * Args:
+ *    client - Client owning the stream.
+ *    stream_id - ID returned from cras_client_add_stream.
+ *    telemetry - Filled with the timing of the stream.
+ * Returns:
+ *    0 on success, -EINVAL if the stream is unknown, -ENODATA if the server
+ *    hasn't published anything yet, or -EAGAIN if it was busy updating, in
+ *    which case the call can be retried.
+ */
+int cras_client_get_stream_telemetry(struct cras_client *client,
+				     cras_stream_id_t stream_id,
+				     struct cras_audio_shm_telemetry *telemetry);
+
 /* Set the volume of the given output node. Only for output nodes.
  *
  * Args:
@@ -143,8 +143,10 @@ int cras_msbc_plc_handle_good_frames(struct cras_msbc_plc *state,
 	if (state->handled_bad_frames == 0) {
 		/* If there was no packet concealment before this good frame,
 		 * we just simply copy the input to output without reconverge.
+		 * Nothing to copy when decoding in place.
 		 */
-		memmove(output, input, MSBC_FS * MSBC_SAMPLE_SIZE);
+		if (output != input)
+			memmove(output, input, MSBC_FS * MSBC_SAMPLE_SIZE);
 	} else {
 		frame_head = &state->hist[PLC_HL];
 		input_samples = (int16_t *)input;
@@ -174,25 +176,71 @@ int cras_msbc_plc_handle_good_frames(struct cras_msbc_plc *state,
 	return MSBC_CODE_SIZE;
 }
 
-float cross_correlation(int16_t *x, int16_t *y)
+/* Dot product of PLC_TL samples, the inner loop of the pattern search. */
+#if defined(__ARM_NEON__) || defined(__aarch64__)
+#include <arm_neon.h>
+static float dot_product(const float *x, const float *y)
 {
-	float sum = 0, x2 = 0, y2 = 0;
+	float32x4_t acc = vdupq_n_f32(0);
+	float32x2_t sum;
 
-	for (int i = 0; i < PLC_TL; i++) {
-		sum += ((float)x[i]) * y[i];
-		x2 += ((float)x[i]) * x[i];
-		y2 += ((float)y[i]) * y[i];
-	}
-	return sum / sqrtf(x2 * y2);
+	for (int i = 0; i < PLC_TL; i += 4)
+		acc = vmlaq_f32(acc, vld1q_f32(x + i), vld1q_f32(y + i));
+	sum = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+	return vget_lane_f32(vpadd_f32(sum, sum), 0);
+}
+#elif defined(__SSE3__) && defined(__x86_64__)
+#include <pmmintrin.h>
+static float dot_product(const float *x, const float *y)
+{
+	__m128 acc = _mm_setzero_ps();
+
+	for (int i = 0; i < PLC_TL; i += 4)
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + i),
+						 _mm_loadu_ps(y + i)));
+	acc = _mm_hadd_ps(acc, acc);
+	acc = _mm_hadd_ps(acc, acc);
+	return _mm_cvtss_f32(acc);
+}
+#else
+static float dot_product(const float *x, const float *y)
+{
+	float sum = 0;
+
+	for (int i = 0; i < PLC_TL; i++)
+		sum += x[i] * y[i];
+	return sum;
 }
+#endif
 
+/* Finds the window of PLC_TL samples in the first PLC_WL positions of hist
+ * which has the highest normalized cross correlation with the template, the
+ * last PLC_TL samples of hist. The energy of the template is the same for
+ * every window and the energy of a window is updated from the previous one,
+ * so only the dot product is computed per position. */
 int pattern_match(int16_t *hist)
 {
+	float samples[PLC_HL];
+	const float *template = &samples[PLC_HL - PLC_TL];
+	int64_t x2 = 0, y2 = 0;
 	int best = 0;
 	float cn, max_cn = FLT_MIN;
 
+	for (int i = 0; i < PLC_HL; i++)
+		samples[i] = hist[i];
+
+	/* Energies are summed as integers, so the sliding update is exact. */
+	for (int i = 0; i < PLC_TL; i++) {
+		x2 += hist[PLC_HL - PLC_TL + i] * hist[PLC_HL - PLC_TL + i];
+		y2 += hist[i] * hist[i];
+	}
+
 	for (int i = 0; i < PLC_WL; i++) {
-		cn = cross_correlation(&hist[PLC_HL - PLC_TL], &hist[i]);
+		if (i > 0)
+			y2 += hist[i + PLC_TL - 1] * hist[i + PLC_TL - 1] -
+			      hist[i - 1] * hist[i - 1];
+		cn = dot_product(template, &samples[i]) /
+		     sqrtf((float)x2 * (float)y2);
 		if (cn > max_cn) {
 			best = i;
 			max_cn = cn;
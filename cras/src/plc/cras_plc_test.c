@@ -14,6 +14,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "cras_sbc_codec.h"
@@ -31,6 +32,12 @@ static const uint8_t msbc_zero_frame[] = {
 	0x6d, 0xb6, 0xdd, 0xdb, 0x6d, 0xb7, 0x76, 0xdb, 0x6c
 };
 
+static double tp_diff(struct timespec *tp2, struct timespec *tp1)
+{
+	return (tp2->tv_sec - tp1->tv_sec) +
+	       (tp2->tv_nsec - tp1->tv_nsec) * 1e-9;
+}
+
 bool *generate_pl_seq(int input_file_size, float pl_percent)
 {
 	unsigned pk_count, pl_count;
@@ -90,6 +97,9 @@ void plc_experiment(const char *input_filename, bool *pl_seq, bool with_plc)
 	uint8_t buffer[MSBC_CODE_SIZE], packet_buffer[MSBC_PKT_FRAME_LEN];
 	size_t encoded, decoded;
 	unsigned count = 0;
+	unsigned concealed = 0;
+	double plc_time = 0;
+	struct timespec tp1, tp2;
 
 	input_fd = open(input_filename, O_RDONLY);
 	if (input_fd == -1) {
@@ -122,8 +132,12 @@ void plc_experiment(const char *input_filename, bool *pl_seq, bool with_plc)
 
 		if (pl_seq[count]) {
 			if (with_plc) {
+				clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tp1);
 				cras_msbc_plc_handle_bad_frames(
 					plc, msbc_output, buffer);
+				clock_gettime(CLOCK_THREAD_CPUTIME_ID, &tp2);
+				plc_time += tp_diff(&tp2, &tp1);
+				concealed++;
 				decoded = MSBC_CODE_SIZE;
 			} else
 				msbc_output->decode(msbc_output,
@@ -145,6 +159,10 @@ void plc_experiment(const char *input_filename, bool *pl_seq, bool with_plc)
 			return;
 		}
 	}
+
+	if (concealed)
+		printf("concealing takes %g us per frame for %u frames\n",
+		       plc_time * 1e6 / concealed, concealed);
 }
 
 static void show_usage()
@@ -7,31 +7,49 @@
 #define _GNU_SOURCE /* for ppoll and asprintf*/
 #endif
 
+#include <errno.h>
 #include <pthread.h>
 #include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/param.h>
+#include <sys/resource.h>
 #include <syslog.h>
 
 #include "audio_thread_log.h"
+#include "cras_apm_list.h"
 #include "cras_audio_thread_monitor.h"
+#include "cras_cmd_ring.h"
 #include "cras_config.h"
 #include "cras_device_monitor.h"
+#include "cras_dsp_pipeline.h"
 #include "cras_fmt_conv.h"
 #include "cras_iodev.h"
+#include "cras_main_message.h"
+#include "cras_mix_pool.h"
+#include "cras_overload.h"
 #include "cras_rstream.h"
 #include "cras_server_metrics.h"
 #include "cras_system_state.h"
 #include "cras_types.h"
 #include "cras_util.h"
+#include "cras_virtual_clock.h"
 #include "dev_stream.h"
+#include "input_data.h"
 #include "audio_thread.h"
 #include "utlist.h"
 
 #define MIN_PROCESS_TIME_US 500 /* 0.5ms - min amount of time to mix/src. */
 #define SLEEP_FUZZ_FRAMES 10 /* # to consider "close enough" to sleep frames. */
 #define MIN_READ_WAIT_US 2000 /* 2ms */
+#define MAX_EPOLL_EVENTS 32 /* # of ready events to handle per wake. */
+#define CMD_SLOT_SIZE 256 /* Max size of a message to the audio thread. */
+#define NUM_CMD_SLOTS 32 /* # of messages that can be queued. */
+#define SNAPSHOT_PERIOD_SEC 1 /* Refresh of the debug snapshot counters. */
+#define PERF_STATS_PERIOD_MS 100 /* Refresh of the shared perf stats. */
 /*
  * # to check whether a busyloop event happens
  */
@@ -52,22 +70,42 @@ enum AUDIO_THREAD_COMMAND {
 	AUDIO_THREAD_ADD_STREAM,
 	AUDIO_THREAD_DISCONNECT_STREAM,
 	AUDIO_THREAD_STOP,
-	AUDIO_THREAD_DUMP_THREAD_INFO,
 	AUDIO_THREAD_DRAIN_STREAM,
 	AUDIO_THREAD_CONFIG_GLOBAL_REMIX,
 	AUDIO_THREAD_DEV_START_RAMP,
 	AUDIO_THREAD_REMOVE_CALLBACK,
 	AUDIO_THREAD_AEC_DUMP,
+	AUDIO_THREAD_ADD_STREAMS,
+	AUDIO_THREAD_SWAP_STREAM_APMS,
+	AUDIO_THREAD_SET_STREAM_PAUSED,
 };
 
+/* Header of the messages sent from the main thread to the audio thread.
+ * Members:
+ *    length - Size of the whole message.
+ *    id - The command to run.
+ *    async - Non-zero if the sender doesn't wait for the command to finish.
+ *    rc - Result of the command, filled in by the audio thread for
+ *        synchronous messages.
+ */
 struct audio_thread_msg {
 	size_t length;
 	enum AUDIO_THREAD_COMMAND id;
+	int async;
+	int rc;
+};
+
+/* Sent to the main thread when an asynchronous command fails. */
+struct audio_thread_async_reply_msg {
+	struct cras_main_message header;
+	enum AUDIO_THREAD_COMMAND id;
+	int rc;
 };
 
 struct audio_thread_config_global_remix {
 	struct audio_thread_msg header;
 	struct cras_fmt_conv *fmt_conv;
+	struct cras_fmt_conv *old_fmt_conv;
 };
 
 struct audio_thread_open_device_msg {
@@ -93,9 +131,10 @@ struct audio_thread_add_rm_stream_msg {
 	unsigned int num_devs;
 };
 
-struct audio_thread_dump_debug_info_msg {
+struct audio_thread_add_streams_msg {
 	struct audio_thread_msg header;
-	struct audio_debug_info *info;
+	struct audio_thread_stream_attach *attaches;
+	unsigned int num;
 };
 
 struct audio_thread_dev_start_ramp_msg {
@@ -104,6 +143,12 @@ struct audio_thread_dev_start_ramp_msg {
 	enum CRAS_IODEV_RAMP_REQUEST request;
 };
 
+struct audio_thread_set_stream_paused_msg {
+	struct audio_thread_msg header;
+	struct cras_rstream *stream;
+	unsigned int fade_in_ms;
+};
+
 struct audio_thread_aec_dump_msg {
 	struct audio_thread_msg header;
 	cras_stream_id_t stream_id;
@@ -119,8 +164,11 @@ struct audio_thread_event_log *atlog;
 char *atlog_name;
 int atlog_rw_shm_fd;
 int atlog_ro_shm_fd;
+int atlog_workload;
 
-static struct iodev_callback_list *iodev_callbacks;
+/* Number of audio threads sharing atlog. The first one to be created sets it
+ * up and the last one to be destroyed tears it down. */
+static unsigned int num_atlog_users;
 
 struct iodev_callback_list {
 	int fd;
@@ -128,17 +176,48 @@ struct iodev_callback_list {
 	enum AUDIO_THREAD_EVENTS_CB_TRIGGER trigger;
 	thread_callback cb;
 	void *cb_data;
-	struct pollfd *pollfd;
 	struct iodev_callback_list *prev, *next;
 };
 
-void audio_thread_add_events_callback(int fd, thread_callback cb, void *data,
+/* Makes the epoll registration of fd match the poll triggered callbacks that
+ * are currently registered on it. */
+static void update_callback_epoll(struct audio_thread *thread, int fd)
+{
+	struct iodev_callback_list *iodev_cb;
+	struct epoll_event ev;
+	int rc;
+
+	if (thread->wake_epoll_fd < 0)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.data.fd = fd;
+	DL_FOREACH (thread->iodev_callbacks, iodev_cb) {
+		if (iodev_cb->fd == fd && iodev_cb->trigger == TRIGGER_POLL)
+			ev.events |= iodev_cb->events;
+	}
+
+	if (!ev.events) {
+		epoll_ctl(thread->wake_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+		return;
+	}
+
+	rc = epoll_ctl(thread->wake_epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+	if (rc < 0 && errno == ENOENT)
+		rc = epoll_ctl(thread->wake_epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+	if (rc < 0)
+		syslog(LOG_ERR, "Failed to watch callback fd %d: %d", fd,
+		       errno);
+}
+
+void audio_thread_add_events_callback(struct audio_thread *thread, int fd,
+				      thread_callback cb, void *data,
 				      int events)
 {
 	struct iodev_callback_list *iodev_cb;
 
 	/* Don't add iodev_cb twice */
-	DL_FOREACH (iodev_callbacks, iodev_cb)
+	DL_FOREACH (thread->iodev_callbacks, iodev_cb)
 		if (iodev_cb->fd == fd && iodev_cb->cb_data == data)
 			return;
 
@@ -149,110 +228,184 @@ void audio_thread_add_events_callback(int fd, thread_callback cb, void *data,
 	iodev_cb->trigger = TRIGGER_POLL;
 	iodev_cb->events = events;
 
-	DL_APPEND(iodev_callbacks, iodev_cb);
+	DL_APPEND(thread->iodev_callbacks, iodev_cb);
+	update_callback_epoll(thread, fd);
 }
 
-void audio_thread_rm_callback(int fd)
+void audio_thread_rm_callback(struct audio_thread *thread, int fd)
 {
 	struct iodev_callback_list *iodev_cb;
 
-	DL_FOREACH (iodev_callbacks, iodev_cb) {
+	DL_FOREACH (thread->iodev_callbacks, iodev_cb) {
 		if (iodev_cb->fd == fd) {
-			DL_DELETE(iodev_callbacks, iodev_cb);
+			DL_DELETE(thread->iodev_callbacks, iodev_cb);
 			free(iodev_cb);
+			update_callback_epoll(thread, fd);
 			return;
 		}
 	}
 }
 
 void audio_thread_config_events_callback(
-	int fd, enum AUDIO_THREAD_EVENTS_CB_TRIGGER trigger)
+	struct audio_thread *thread, int fd,
+	enum AUDIO_THREAD_EVENTS_CB_TRIGGER trigger)
 {
 	struct iodev_callback_list *iodev_cb;
 
-	DL_FOREACH (iodev_callbacks, iodev_cb) {
+	DL_FOREACH (thread->iodev_callbacks, iodev_cb) {
 		if (iodev_cb->fd == fd) {
 			iodev_cb->trigger = trigger;
+			update_callback_epoll(thread, fd);
 			return;
 		}
 	}
 }
 
-/* Sends a response (error code) from the audio thread to the main thread.
- * Indicates that the last message sent to the audio thread has been handled
- * with an error code of rc.
+/* Reports the failure of an asynchronous command to the main thread. */
+static void send_async_reply(enum AUDIO_THREAD_COMMAND id, int rc)
+{
+	struct audio_thread_async_reply_msg msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.header.type = CRAS_MAIN_AUDIO_THREAD_REPLY;
+	msg.header.length = sizeof(msg);
+	msg.id = id;
+	msg.rc = rc;
+	cras_main_message_send(&msg.header);
+}
+
+/* Finishes a message from the main thread and gives its slot back. Called
+ * from the audio thread. The reply of a synchronous message is left in the
+ * slot, which the blocked main thread reads before it queues anything else.
  * Args:
  *    thread - thread responding to command.
- *    rc - Result code to send back to the main thread.
- * Returns:
- *    The number of bytes written to the main thread.
+ *    msg - The message that was handled.
+ *    rc - Result code of the command.
  */
-static int audio_thread_send_response(struct audio_thread *thread, int rc)
+static void audio_thread_complete_message(struct audio_thread *thread,
+					  struct audio_thread_msg *msg, int rc)
 {
-	return write(thread->to_main_fds[1], &rc, sizeof(rc));
+	enum AUDIO_THREAD_COMMAND id = msg->id;
+	int async = msg->async;
+
+	msg->rc = rc;
+	cras_cmd_ring_commit_read(thread->cmd_ring);
+
+	if (!async)
+		eventfd_write(thread->to_main_fd, 1);
+	else if (rc < 0)
+		send_async_reply(id, rc);
 }
 
-/* Reads from a file descriptor until all bytes are read.
- *
- * Args:
- *    fd - file descriptor to read
- *    buf - the buffer to be written.
- *    count - the number of bytes to read from fd
- * Returns:
- *    |count| on success, negative error code on failure.
- */
-static int read_until_finished(int fd, void *buf, size_t count)
+/* The SCHED_DEADLINE runtime is a multiple of the peak CPU time of a wake,
+ * as a period can hold a few wakes, within DEADLINE_MIN_RUNTIME_NS and
+ * DEADLINE_MAX_RUNTIME_PERCENT of the period. */
+#define DEADLINE_RUNTIME_PEAK_MULTIPLE 2
+#define DEADLINE_MIN_RUNTIME_NS 500000
+#define DEADLINE_MAX_RUNTIME_PERCENT 50
+/* The peak CPU time of a wake decays by 1/2^WAKE_CPU_PEAK_SHIFT per wake. */
+#define WAKE_CPU_PEAK_SHIFT 8
+
+/* Runs the thread at the fixed real time priority of the server. */
+static void set_rt_priority()
 {
-	int nread, count_left = count;
+	if (cras_set_rt_scheduling(CRAS_SERVER_RT_THREAD_PRIORITY) == 0)
+		cras_set_thread_priority(CRAS_SERVER_RT_THREAD_PRIORITY);
+}
 
-	while (count_left > 0) {
-		nread = read(fd, (uint8_t *)buf + count - count_left,
-			     count_left);
-		if (nread < 0) {
-			if (errno == EINTR)
+/* Returns the shortest callback period of the open devices in nanoseconds,
+ * 0 if no device is open. */
+static uint64_t min_dev_period_ns(struct audio_thread *thread)
+{
+	struct open_dev *adev;
+	struct cras_iodev *iodev;
+	uint64_t period, min_period = 0;
+	int dir;
+
+	for (dir = 0; dir < CRAS_NUM_DIRECTIONS; dir++) {
+		DL_FOREACH (thread->open_devs[dir], adev) {
+			iodev = adev->dev;
+			if (!iodev->format || !iodev->format->frame_rate ||
+			    !iodev->min_cb_level)
 				continue;
-			else
-				return nread;
-		} else if (nread == 0) {
-			syslog(LOG_ERR, "Pipe has been closed.");
-			return -EPIPE;
+			period = (uint64_t)iodev->min_cb_level * 1000000000 /
+				 iodev->format->frame_rate;
+			if (!min_period || period < min_period)
+				min_period = period;
 		}
-		count_left -= nread;
 	}
-	return count;
+	return min_period;
 }
 
-/* Reads a command from the main thread.  Called from the playback/capture
- * thread.  This will read the next available command from the main thread and
- * put it in buf.
- * Args:
- *    thread - thread reading the command.
- *    buf - Message is stored here on return.
- *    max_len - maximum length of message to put into buf.
- * Returns:
- *    0 on success, negative error code on failure.
- */
-static int audio_thread_read_command(struct audio_thread *thread, uint8_t *buf,
-				     size_t max_len)
+/* Returns the SCHED_DEADLINE runtime for period given the CPU the wakes
+ * took lately. */
+static uint64_t deadline_runtime_ns(struct audio_thread *thread,
+				    uint64_t period)
+{
+	uint64_t runtime;
+
+	runtime = thread->wake_cpu_peak_ns * DEADLINE_RUNTIME_PEAK_MULTIPLE;
+	runtime = MAX(runtime, DEADLINE_MIN_RUNTIME_NS);
+	return MIN(runtime, period * DEADLINE_MAX_RUNTIME_PERCENT / 100);
+}
+
+/* Sizes the SCHED_DEADLINE reservation of the thread to the open devices,
+ * with the deadline at the end of the shortest callback period. The thread
+ * goes back to its RT priority when no device is open, and for good when
+ * the kernel refuses the reservation. */
+static void update_deadline_scheduling(struct audio_thread *thread)
 {
-	int to_read, nread, rc;
-	struct audio_thread_msg *msg = (struct audio_thread_msg *)buf;
+	uint64_t period, runtime;
+	int rc;
 
-	/* Get the length of the message first */
-	nread = read_until_finished(thread->to_thread_fds[0], buf,
-				    sizeof(msg->length));
-	if (nread < 0)
-		return nread;
+	if (!thread->sched_deadline)
+		return;
 
-	if (msg->length > max_len)
-		return -ENOMEM;
+	period = min_dev_period_ns(thread);
+	if (period == 0) {
+		if (thread->deadline_period_ns) {
+			set_rt_priority();
+			thread->deadline_period_ns = 0;
+			thread->deadline_runtime_ns = 0;
+		}
+		return;
+	}
 
-	to_read = msg->length - sizeof(msg->length);
-	rc = read_until_finished(thread->to_thread_fds[0],
-				 &buf[0] + sizeof(msg->length), to_read);
-	if (rc < 0)
-		return rc;
-	return 0;
+	runtime = deadline_runtime_ns(thread, period);
+	if (period == thread->deadline_period_ns &&
+	    runtime == thread->deadline_runtime_ns)
+		return;
+
+	rc = cras_set_deadline_scheduling(runtime, period, period);
+	if (rc < 0) {
+		syslog(LOG_WARNING,
+		       "SCHED_DEADLINE %lu/%lu ns refused: %d, using priority",
+		       (unsigned long)runtime, (unsigned long)period, rc);
+		thread->sched_deadline = 0;
+		thread->deadline_period_ns = 0;
+		thread->deadline_runtime_ns = 0;
+		set_rt_priority();
+		return;
+	}
+	thread->deadline_period_ns = period;
+	thread->deadline_runtime_ns = runtime;
+}
+
+/* Tracks the peak CPU time of a wake, and grows the SCHED_DEADLINE runtime
+ * as soon as the wakes need more than it was sized for. Shrinking waits for
+ * devices or streams to come and go, to not call into the kernel on every
+ * wake while the peak decays. */
+static void update_wake_cpu_peak(struct audio_thread *thread, uint64_t cpu_ns)
+{
+	uint64_t peak = thread->wake_cpu_peak_ns;
+
+	peak -= peak >> WAKE_CPU_PEAK_SHIFT;
+	thread->wake_cpu_peak_ns = MAX(peak, cpu_ns);
+
+	if (thread->deadline_period_ns &&
+	    deadline_runtime_ns(thread, thread->deadline_period_ns) >
+		    thread->deadline_runtime_ns)
+		update_deadline_scheduling(thread);
 }
 
 /* Builds an initial buffer to avoid an underrun. Adds min_level of latency. */
@@ -282,8 +435,12 @@ static int thread_add_open_dev(struct audio_thread *thread,
 		fill_odevs_zeros_min_level(iodev);
 
 	ATLOG(atlog, AUDIO_THREAD_DEV_ADDED, iodev->info.idx, 0, 0);
+	ATLOG_WORKLOAD(atlog, AUDIO_THREAD_DEV_FORMAT, iodev->info.idx,
+		       iodev->format ? iodev->format->frame_rate : 0,
+		       iodev->buffer_size);
 
 	DL_APPEND(thread->open_devs[iodev->direction], adev);
+	update_deadline_scheduling(thread);
 
 	return 0;
 }
@@ -299,6 +456,7 @@ static int thread_rm_open_dev(struct audio_thread *thread,
 		return -EINVAL;
 
 	dev_io_rm_open_dev(&thread->open_devs[dir], adev);
+	update_deadline_scheduling(thread);
 	return 0;
 }
 
@@ -375,6 +533,52 @@ static int thread_find_stream(struct audio_thread *thread,
 	return 0;
 }
 
+/* Returns true if a reply from the client of this stream should wake the
+ * audio thread, matching the cases in dev_stream_poll_stream_fd(). */
+static bool stream_reply_wakes_thread(const struct cras_rstream *stream)
+{
+	/* Replies through the shm are picked up on the next timed wake. */
+	if (cras_rstream_uses_shm_wake(stream))
+		return false;
+	if (stream_uses_input(stream) && (stream->flags & USE_DEV_TIMING))
+		return true;
+	return stream_uses_output(stream);
+}
+
+/* Adds the fd of a stream to the wake set, once per rstream no matter how
+ * many devices it is attached to. The fd is edge triggered so that a reply
+ * left unread, or a hung up client, doesn't keep waking the thread. */
+static void watch_stream_fd(struct audio_thread *thread,
+			    struct cras_rstream *stream)
+{
+	struct epoll_event ev;
+	int rc;
+
+	if (!stream_reply_wakes_thread(stream))
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.fd = stream->fd;
+	rc = epoll_ctl(thread->wake_epoll_fd, EPOLL_CTL_ADD, stream->fd, &ev);
+	if (rc < 0 && errno != EEXIST)
+		syslog(LOG_WARNING, "Failed to watch stream fd %d: %d",
+		       stream->fd, errno);
+}
+
+/* Removes the fd of a stream from the wake set once it has left all devices.
+ * Streams removed by dev_io on error stay in the set until the fd is closed,
+ * which costs at most one spurious wake. */
+static void unwatch_stream_fd(struct audio_thread *thread,
+			      struct cras_rstream *stream)
+{
+	if (!stream_reply_wakes_thread(stream) ||
+	    thread_find_stream(thread, stream))
+		return;
+
+	epoll_ctl(thread->wake_epoll_fd, EPOLL_CTL_DEL, stream->fd, NULL);
+}
+
 /* Handles the disconnect_stream message from the main thread. */
 static int thread_disconnect_stream(struct audio_thread *thread,
 				    struct cras_rstream *stream,
@@ -387,6 +591,7 @@ static int thread_disconnect_stream(struct audio_thread *thread,
 
 	rc = dev_io_remove_stream(&thread->open_devs[stream->direction], stream,
 				  dev);
+	unwatch_stream_fd(thread, stream);
 
 	return rc;
 }
@@ -402,7 +607,8 @@ static int thread_drain_stream_ms_remaining(struct audio_thread *thread,
 	int fr_in_buff;
 	struct cras_audio_shm *shm;
 
-	if (rstream->direction != CRAS_STREAM_OUTPUT)
+	/* A paused stream isn't played, there is nothing to wait for. */
+	if (rstream->direction != CRAS_STREAM_OUTPUT || rstream->paused)
 		return 0;
 
 	shm = cras_rstream_shm(rstream);
@@ -428,13 +634,36 @@ static int thread_drain_stream(struct audio_thread *thread,
 		return 0;
 
 	ms_left = thread_drain_stream_ms_remaining(thread, rstream);
-	if (ms_left == 0)
+	if (ms_left == 0) {
 		dev_io_remove_stream(&thread->open_devs[rstream->direction],
 				     rstream, NULL);
+		unwatch_stream_fd(thread, rstream);
+	}
 
 	return ms_left;
 }
 
+/* Picks the sample rate converters of all the streams of the thread for
+ * its overload level. Those already at it are left alone. */
+static void apply_overload_src(struct audio_thread *thread)
+{
+	enum CRAS_OVERLOAD_LEVEL level;
+	struct open_dev *adev;
+	struct dev_stream *stream;
+	int dir;
+
+	level = cras_overload_get_level(thread->overload);
+	for (dir = 0; dir < CRAS_NUM_DIRECTIONS; dir++) {
+		DL_FOREACH (thread->open_devs[dir], adev) {
+			DL_FOREACH (adev->dev->streams, stream)
+				dev_stream_set_overload_level(stream, level);
+			if (adev->dev->input_data)
+				input_data_set_overload_level(
+					adev->dev->input_data, level);
+		}
+	}
+}
+
 /* Handles the add_stream message from the main thread. */
 static int thread_add_stream(struct audio_thread *thread,
 			     struct cras_rstream *stream,
@@ -448,6 +677,27 @@ static int thread_add_stream(struct audio_thread *thread,
 	if (rc < 0)
 		return rc;
 
+	ATLOG_WORKLOAD(atlog, AUDIO_THREAD_STREAM_FORMAT, stream->stream_id,
+		       stream->format.frame_rate,
+		       atlog_pack_stream_format(stream->direction,
+						stream->format.format,
+						stream->client_type,
+						stream->format.num_channels));
+	ATLOG_WORKLOAD(atlog, AUDIO_THREAD_STREAM_CONFIG, stream->stream_id,
+		       stream->cb_threshold,
+		       atlog_pack_stream_config(cras_rstream_get_effects(stream),
+						stream->flags));
+
+	/* Streams join the savings of an overloaded thread. */
+	if (thread->overload &&
+	    cras_overload_get_level(thread->overload) != CRAS_OVERLOAD_NONE)
+		apply_overload_src(thread);
+
+	/* The stream may have lowered the callback level of its devices. */
+	update_deadline_scheduling(thread);
+
+	watch_stream_fd(thread, stream);
+
 	return 0;
 }
 
@@ -476,9 +726,55 @@ static int thread_set_aec_dump(struct audio_thread *thread,
 	return 0;
 }
 
+/* Moves a stream to the APMs staged for its new effects on each device
+ * it's attached to. Returns 1 if the stream runs on this thread. */
+static int thread_swap_stream_apms(struct audio_thread *thread,
+				   struct cras_rstream *rstream)
+{
+	struct open_dev *adev;
+	struct dev_stream *stream;
+	int found = 0;
+
+	DL_FOREACH (thread->open_devs[CRAS_STREAM_INPUT], adev) {
+		DL_FOREACH (adev->dev->streams, stream) {
+			if (stream->stream != rstream)
+				continue;
+			cras_apm_list_swap_apm(rstream->apm_list, adev->dev);
+			found = 1;
+		}
+	}
+	if (found)
+		cras_apm_list_commit_effects(rstream->apm_list);
+	return found;
+}
+
+static void reserve_worker_conv_scratch(void *arg)
+{
+	cras_fmt_conv_reserve_scratch();
+}
+
+/* Grows the conversion scratch of this thread and of its mix workers to
+ * what the converters created so far need. Called between wakes, so the
+ * conversions in a wake don't allocate. */
+static void reserve_conv_scratch(struct audio_thread *thread)
+{
+	size_t bytes = cras_fmt_conv_get_scratch_needed();
+
+	if (bytes <= thread->conv_scratch_bytes)
+		return;
+	cras_fmt_conv_reserve_scratch();
+	if (thread->mix_pool)
+		cras_mix_pool_run_on_workers(thread->mix_pool,
+					     reserve_worker_conv_scratch, NULL);
+	thread->conv_scratch_bytes = bytes;
+}
+
 /* Stop the playback thread */
 static void terminate_pb_thread()
 {
+	dev_io_set_mix_pool(NULL, 0);
+	cras_dsp_pipeline_set_worker_pool(NULL);
+	dev_stream_free_cached();
 	pthread_exit(0);
 }
 
@@ -507,6 +803,8 @@ static void append_dev_dump_info(struct audio_dev_debug_info *di,
 	di->runtime_nsec = time_since.tv_nsec;
 	di->longest_wake_sec = adev->longest_wake.tv_sec;
 	di->longest_wake_nsec = adev->longest_wake.tv_nsec;
+	memcpy(di->stages, adev->stages, sizeof(di->stages));
+	di->mem_bytes = cras_iodev_get_mem_bytes(adev->dev);
 
 	if (fmt) {
 		di->frame_rate = fmt->frame_rate;
@@ -519,16 +817,14 @@ static void append_dev_dump_info(struct audio_dev_debug_info *di,
 	}
 }
 
-/* Put stream info for the given stream into the info struct. */
-static void append_stream_dump_info(struct audio_debug_info *info,
+/* Put stream info for the given stream into si. */
+static void append_stream_dump_info(struct audio_stream_debug_info *si,
 				    struct dev_stream *stream,
-				    unsigned int dev_idx, int index)
+				    unsigned int dev_idx)
 {
-	struct audio_stream_debug_info *si;
+	struct cras_rstream_cost cost;
 	struct timespec now, time_since;
 
-	si = &info->streams[index];
-
 	si->stream_id = stream->stream->stream_id;
 	si->dev_idx = dev_idx;
 	si->direction = stream->stream->direction;
@@ -553,22 +849,238 @@ static void append_stream_dump_info(struct audio_debug_info *info,
 	subtract_timespecs(&now, &stream->stream->start_ts, &time_since);
 	si->runtime_sec = time_since.tv_sec;
 	si->runtime_nsec = time_since.tv_nsec;
+
+	dev_stream_get_cost(stream, &cost);
+	si->convert_ns = cost.convert_ns;
+	si->mix_ns = cost.mix_ns;
+	si->apm_ns = cost.apm_ns;
+	si->mem_bytes = cost.mem_bytes;
+}
+
+/* Copies the devices and streams of dir into snap. */
+static void snapshot_devs(struct audio_thread *thread,
+			  enum CRAS_STREAM_DIRECTION dir,
+			  struct audio_thread_snapshot *snap)
+{
+	struct dev_stream *curr;
+	struct open_dev *adev;
+
+	DL_FOREACH (thread->open_devs[dir], adev) {
+		if (snap->num_devs == MAX_DEBUG_DEVS)
+			break;
+		append_dev_dump_info(&snap->devs[snap->num_devs++], adev);
+		DL_FOREACH (adev->dev->streams, curr) {
+			if (snap->num_streams == MAX_DEBUG_STREAMS)
+				break;
+			append_stream_dump_info(
+				&snap->streams[snap->num_streams++], curr,
+				adev->dev->info.idx);
+		}
+	}
+}
+
+/* Writes the devices and streams to the snapshot not being read, then
+ * publishes it. The seq of the snapshot tells a reader that raced with the
+ * write to copy it again. */
+static void publish_snapshot(struct audio_thread *thread)
+{
+	struct audio_thread_snapshot *snap;
+	struct rusage usage;
+	struct timespec now;
+	unsigned int idx = !thread->snapshot_idx;
+	uint32_t seq;
+
+	snap = &thread->snapshots[idx];
+	seq = __atomic_load_n(&snap->seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&snap->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	snap->num_devs = 0;
+	snap->num_streams = 0;
+	snapshot_devs(thread, CRAS_STREAM_OUTPUT, snap);
+	snapshot_devs(thread, CRAS_STREAM_INPUT, snap);
+	if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+		snap->minor_faults = usage.ru_minflt;
+		snap->major_faults = usage.ru_majflt;
+	}
+	snap->conv_mem_bytes = cras_fmt_conv_get_scratch_bytes();
+
+	__atomic_store_n(&snap->seq, seq + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&thread->snapshot_idx, idx, __ATOMIC_RELEASE);
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	thread->snapshot_due = now;
+	thread->snapshot_due.tv_sec += SNAPSHOT_PERIOD_SEC;
+}
+
+/* Refreshes the run times and counters in the snapshot once in a while. */
+static void update_snapshot(struct audio_thread *thread)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	if (timespec_after(&now, &thread->snapshot_due))
+		publish_snapshot(thread);
+}
+
+static void fill_dev_perf_stats(struct cras_dev_perf_stats *ds,
+				const struct open_dev *adev)
+{
+	const struct cras_iodev *dev = adev->dev;
+	unsigned int stage;
+
+	ds->dev_idx = dev->info.idx;
+	ds->direction = dev->direction;
+	ds->frame_rate = dev->format ? dev->format->frame_rate : 0;
+	ds->buffer_size = dev->buffer_size;
+	ds->min_buffer_level = dev->min_buffer_level;
+	ds->highest_hw_level = dev->highest_hw_level;
+	ds->margin_us = adev->health.margin_us;
+	ds->min_margin_us = adev->health.min_margin_us;
+	ds->lateness_us = adev->health.lateness_us;
+	ds->late_us = adev->late_us;
+	ds->max_late_us = adev->max_late_us;
+	ds->num_risks = adev->health.num_risks;
+	ds->num_underruns = cras_iodev_get_num_underruns(dev);
+	ds->num_severe_underruns = cras_iodev_get_num_severe_underruns(dev);
+	for (stage = 0; stage < CRAS_NUM_DEV_IO_STAGES; stage++) {
+		ds->stage_count[stage] = adev->stages[stage].count;
+		ds->stage_total_usec[stage] = adev->stages[stage].total_usec;
+		ds->stage_max_usec[stage] = adev->stages[stage].max_usec;
+	}
+}
+
+static void fill_stream_perf_stats(struct cras_stream_perf_stats *ss,
+				   const struct dev_stream *stream,
+				   unsigned int dev_idx)
+{
+	const struct cras_rstream *rstream = stream->stream;
+
+	ss->stream_id = rstream->stream_id;
+	ss->dev_idx = dev_idx;
+	ss->direction = rstream->direction;
+	ss->frame_rate = rstream->format.frame_rate;
+	ss->cb_threshold = rstream->cb_threshold;
+	ss->num_missed_cb = rstream->num_missed_cb;
+	ss->num_overruns = cras_shm_num_overruns(rstream->shm);
+	ss->longest_fetch_usec =
+		rstream->longest_fetch_interval.tv_sec * 1000000 +
+		rstream->longest_fetch_interval.tv_nsec / 1000;
+}
+
+/* Writes the perf stats of the devices and streams of thread to the server
+ * state. Unlike the snapshot this is read by other processes, so it is
+ * written in place under its seq. */
+static void publish_perf_stats(struct audio_thread *thread)
+{
+	static const struct timespec period = {
+		0, PERF_STATS_PERIOD_MS * 1000000
+	};
+	struct cras_perf_stats *stats = thread->perf_stats;
+	struct dev_stream *curr;
+	struct open_dev *adev;
+	struct timespec now;
+	unsigned int dir;
+	uint32_t seq;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	seq = __atomic_load_n(&stats->seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	stats->timestamp.tv_sec = now.tv_sec;
+	stats->timestamp.tv_nsec = now.tv_nsec;
+	stats->num_devs = 0;
+	stats->num_streams = 0;
+	for (dir = 0; dir < CRAS_NUM_DIRECTIONS; dir++) {
+		DL_FOREACH (thread->open_devs[dir], adev) {
+			if (stats->num_devs == MAX_DEBUG_DEVS)
+				break;
+			fill_dev_perf_stats(&stats->devs[stats->num_devs++],
+					    adev);
+			DL_FOREACH (adev->dev->streams, curr) {
+				if (stats->num_streams == MAX_DEBUG_STREAMS)
+					break;
+				fill_stream_perf_stats(
+					&stats->streams[stats->num_streams++],
+					curr, adev->dev->info.idx);
+			}
+		}
+	}
+
+	__atomic_store_n(&stats->seq, seq + 2, __ATOMIC_RELEASE);
+
+	thread->perf_stats_due = now;
+	add_timespecs(&thread->perf_stats_due, &period);
+}
+
+/* Refreshes the shared perf stats every PERF_STATS_PERIOD_MS. */
+static void update_perf_stats(struct audio_thread *thread)
+{
+	struct timespec now;
+
+	if (!thread->perf_stats)
+		return;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	if (!timespec_after(&thread->perf_stats_due, &now))
+		publish_perf_stats(thread);
+}
+
+/* Copies the last published snapshot of thread to snap, without waiting for
+ * the audio thread. */
+static void read_snapshot(struct audio_thread *thread,
+			  struct audio_thread_snapshot *snap)
+{
+	const struct audio_thread_snapshot *src;
+	uint32_t seq;
+
+	do {
+		src = &thread->snapshots[__atomic_load_n(&thread->snapshot_idx,
+							 __ATOMIC_ACQUIRE)];
+		seq = __atomic_load_n(&src->seq, __ATOMIC_ACQUIRE);
+		memcpy(snap, src, sizeof(*snap));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) ||
+		 seq != __atomic_load_n(&src->seq, __ATOMIC_RELAXED));
+}
+
+/* Adds the snapshot of thread to info, after the devices and streams already
+ * in it. */
+static void append_thread_info(struct audio_thread *thread,
+			       struct audio_debug_info *info)
+{
+	struct audio_thread_snapshot snap;
+	unsigned int num;
+
+	read_snapshot(thread, &snap);
+
+	num = MIN(snap.num_devs, MAX_DEBUG_DEVS - info->num_devs);
+	memcpy(&info->devs[info->num_devs], snap.devs,
+	       num * sizeof(snap.devs[0]));
+	info->num_devs += num;
+	num = MIN(snap.num_streams, MAX_DEBUG_STREAMS - info->num_streams);
+	memcpy(&info->streams[info->num_streams], snap.streams,
+	       num * sizeof(snap.streams[0]));
+	info->num_streams += num;
+
+	/* Faults are summed over the threads dumping to info. */
+	info->rt_memory_locked &=
+		!!__atomic_load_n(&thread->rt_memory_locked, __ATOMIC_RELAXED);
+	info->minor_faults += snap.minor_faults;
+	info->major_faults += snap.major_faults;
+	info->conv_mem_bytes += snap.conv_mem_bytes;
+
+	memcpy(&info->log, atlog, sizeof(info->log));
 }
 
 /* Handle a message sent from main thread to the audio thread.
  * Returns:
- *    Error code when reading or sending message fails.
+ *    The result code of the command.
  */
-static int handle_audio_thread_message(struct audio_thread *thread)
+static int handle_audio_thread_message(struct audio_thread *thread,
+				       struct audio_thread_msg *msg)
 {
-	uint8_t buf[256];
-	struct audio_thread_msg *msg = (struct audio_thread_msg *)buf;
 	int ret = 0;
-	int err;
-
-	err = audio_thread_read_command(thread, buf, 256);
-	if (err < 0)
-		return err;
 
 	ATLOG(atlog, AUDIO_THREAD_PB_MSG, msg->id, 0, 0);
 
@@ -582,6 +1094,21 @@ static int handle_audio_thread_message(struct audio_thread *thread)
 					amsg->num_devs);
 		break;
 	}
+	case AUDIO_THREAD_ADD_STREAMS: {
+		struct audio_thread_add_streams_msg *amsg;
+		struct audio_thread_stream_attach *a;
+		unsigned int i;
+
+		amsg = (struct audio_thread_add_streams_msg *)msg;
+		for (i = 0; i < amsg->num; i++) {
+			a = &amsg->attaches[i];
+			ATLOG(atlog, AUDIO_THREAD_WRITE_STREAMS_WAIT,
+			      a->stream->stream_id, 0, 0);
+			a->rc = thread_add_stream(thread, a->stream, a->devs,
+						  a->num_devs);
+		}
+		break;
+	}
 	case AUDIO_THREAD_DISCONNECT_STREAM: {
 		struct audio_thread_add_rm_stream_msg *rmsg;
 
@@ -613,83 +1140,48 @@ static int handle_audio_thread_message(struct audio_thread *thread)
 		break;
 	}
 	case AUDIO_THREAD_STOP:
-		ret = 0;
-		err = audio_thread_send_response(thread, ret);
-		if (err < 0)
-			return err;
+		audio_thread_complete_message(thread, msg, 0);
 		terminate_pb_thread();
 		break;
-	case AUDIO_THREAD_DUMP_THREAD_INFO: {
-		struct dev_stream *curr;
-		struct open_dev *adev;
-		struct audio_thread_dump_debug_info_msg *dmsg;
-		struct audio_debug_info *info;
-		unsigned int num_streams = 0;
-		unsigned int num_devs = 0;
-
-		ret = 0;
-		dmsg = (struct audio_thread_dump_debug_info_msg *)msg;
-		info = dmsg->info;
-
-		/* Go through all open devices. */
-		DL_FOREACH (thread->open_devs[CRAS_STREAM_OUTPUT], adev) {
-			append_dev_dump_info(&info->devs[num_devs], adev);
-			if (++num_devs == MAX_DEBUG_DEVS)
-				break;
-			DL_FOREACH (adev->dev->streams, curr) {
-				if (num_streams == MAX_DEBUG_STREAMS)
-					break;
-				append_stream_dump_info(info, curr,
-							adev->dev->info.idx,
-							num_streams++);
-			}
-		}
-		DL_FOREACH (thread->open_devs[CRAS_STREAM_INPUT], adev) {
-			if (num_devs == MAX_DEBUG_DEVS)
-				break;
-			append_dev_dump_info(&info->devs[num_devs], adev);
-			DL_FOREACH (adev->dev->streams, curr) {
-				if (num_streams == MAX_DEBUG_STREAMS)
-					break;
-				append_stream_dump_info(info, curr,
-							adev->dev->info.idx,
-							num_streams++);
-			}
-			++num_devs;
-		}
-		info->num_devs = num_devs;
-
-		info->num_streams = num_streams;
+	case AUDIO_THREAD_DRAIN_STREAM: {
+		struct audio_thread_add_rm_stream_msg *rmsg;
 
-		memcpy(&info->log, atlog, sizeof(info->log));
+		rmsg = (struct audio_thread_add_rm_stream_msg *)msg;
+		ret = thread_drain_stream(thread, rmsg->stream);
 		break;
 	}
-	case AUDIO_THREAD_DRAIN_STREAM: {
+	case AUDIO_THREAD_SWAP_STREAM_APMS: {
 		struct audio_thread_add_rm_stream_msg *rmsg;
 
 		rmsg = (struct audio_thread_add_rm_stream_msg *)msg;
-		ret = thread_drain_stream(thread, rmsg->stream);
+		ret = thread_swap_stream_apms(thread, rmsg->stream);
+		break;
+	}
+	case AUDIO_THREAD_SET_STREAM_PAUSED: {
+		struct audio_thread_set_stream_paused_msg *pmsg;
+
+		pmsg = (struct audio_thread_set_stream_paused_msg *)msg;
+		ret = dev_io_set_stream_paused(
+			thread->open_devs[pmsg->stream->direction],
+			pmsg->stream, pmsg->fade_in_ms);
 		break;
 	}
 	case AUDIO_THREAD_REMOVE_CALLBACK: {
 		struct audio_thread_rm_callback_msg *rmsg;
 
 		rmsg = (struct audio_thread_rm_callback_msg *)msg;
-		audio_thread_rm_callback(rmsg->fd);
+		audio_thread_rm_callback(thread, rmsg->fd);
 		break;
 	}
 	case AUDIO_THREAD_CONFIG_GLOBAL_REMIX: {
 		struct audio_thread_config_global_remix *rmsg;
-		void *rsp;
 
 		/* Respond the pointer to the old remix converter, so it can be
 		 * freed later in main thread. */
-		rsp = (void *)thread->remix_converter;
-
 		rmsg = (struct audio_thread_config_global_remix *)msg;
+		rmsg->old_fmt_conv = thread->remix_converter;
 		thread->remix_converter = rmsg->fmt_conv;
-
-		return write(thread->to_main_fds[1], &rsp, sizeof(rsp));
+		break;
 	}
 	case AUDIO_THREAD_DEV_START_RAMP: {
 		struct audio_thread_dev_start_ramp_msg *rmsg;
@@ -711,10 +1203,27 @@ static int handle_audio_thread_message(struct audio_thread *thread)
 		break;
 	}
 
-	err = audio_thread_send_response(thread, ret);
-	if (err < 0)
-		return err;
-	return 0;
+	return ret;
+}
+
+/* Handles all messages queued by the main thread. The doorbell is cleared
+ * first so that a message queued while draining wakes the thread again. */
+static void handle_audio_thread_messages(struct audio_thread *thread)
+{
+	struct audio_thread_msg *msg;
+	eventfd_t count;
+
+	eventfd_read(thread->to_thread_fd, &count);
+
+	while ((msg = (struct audio_thread_msg *)cras_cmd_ring_read_slot(
+			thread->cmd_ring))) {
+		int rc = handle_audio_thread_message(thread, msg);
+
+		/* Messages change the devices and streams, so dumps taken
+		 * right after one see the change. */
+		publish_snapshot(thread);
+		audio_thread_complete_message(thread, msg, rc);
+	}
 }
 
 /* Returns the number of active streams plus the number of active devices. */
@@ -730,7 +1239,7 @@ static int fill_next_sleep_interval(struct audio_thread *thread,
 	/* Limit the sleep time to 20 seconds. */
 	min_ts.tv_sec = 20;
 	min_ts.tv_nsec = 0;
-	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	cras_virtual_clock_gettime(&now);
 	add_timespecs(&min_ts, &now);
 	ret = dev_io_next_output_wake(&thread->open_devs[CRAS_STREAM_OUTPUT],
 				      &min_ts);
@@ -742,25 +1251,31 @@ static int fill_next_sleep_interval(struct audio_thread *thread,
 	return ret;
 }
 
-static struct pollfd *add_pollfd(struct audio_thread *thread, int fd,
-				 int events)
+/* Runs the callbacks of the iodev fds that are ready. Stream fds need no
+ * handling here, waking the thread is all they are for. */
+static void handle_ready_events(struct audio_thread *thread)
 {
-	thread->pollfds[thread->num_pollfds].fd = fd;
-	thread->pollfds[thread->num_pollfds].events = events;
-	thread->num_pollfds++;
-	if (thread->num_pollfds >= thread->pollfds_size) {
-		thread->pollfds_size *= 2;
-		thread->pollfds = (struct pollfd *)realloc(
-			thread->pollfds,
-			sizeof(*thread->pollfds) * thread->pollfds_size);
-		return NULL;
+	struct epoll_event events[MAX_EPOLL_EVENTS];
+	struct iodev_callback_list *iodev_cb;
+	int i, n;
+
+	n = epoll_wait(thread->wake_epoll_fd, events, MAX_EPOLL_EVENTS, 0);
+	for (i = 0; i < n; i++) {
+		DL_FOREACH (thread->iodev_callbacks, iodev_cb) {
+			if (iodev_cb->fd != events[i].data.fd ||
+			    iodev_cb->trigger != TRIGGER_POLL ||
+			    !(events[i].events & iodev_cb->events))
+				continue;
+			ATLOG(atlog, AUDIO_THREAD_IODEV_CB, events[i].events,
+			      iodev_cb->events, 0);
+			iodev_cb->cb(iodev_cb->cb_data, events[i].events);
+		}
 	}
-
-	return &thread->pollfds[thread->num_pollfds - 1];
 }
 
-static int continuous_zero_sleep_count = 0;
-static unsigned busyloop_count = 0;
+/* Busyloop state of the calling audio thread. */
+static __thread int continuous_zero_sleep_count = 0;
+static __thread unsigned busyloop_count = 0;
 
 /*
  * Logs the number of busyloop during one audio thread running state
@@ -768,8 +1283,8 @@ static unsigned busyloop_count = 0;
  */
 static void log_busyloop(struct timespec *wait_ts)
 {
-	static struct timespec start_time;
-	static bool started = false;
+	static __thread struct timespec start_time;
+	static __thread bool started = false;
 	struct timespec diff, now;
 
 	/* If wait_ts is NULL, there is no stream running. */
@@ -810,6 +1325,76 @@ static void check_busyloop(struct timespec *wait_ts)
 	}
 }
 
+static uint64_t timespec_to_ns(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+/* Starts measuring the CPU time of the wakes from now on. */
+static void init_wake_times(struct audio_thread *thread)
+{
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &thread->wake_cpu_ts);
+	clock_gettime(CLOCK_MONOTONIC_RAW, &thread->wake_ts);
+}
+
+/* Gets the CPU time the thread took and the wall time passed since the
+ * previous wake, in nanoseconds. */
+static void measure_wake(struct audio_thread *thread, uint64_t *cpu_ns,
+			 uint64_t *wall_ns)
+{
+	struct timespec cpu_ts, wake_ts, cpu, wall;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_ts);
+	clock_gettime(CLOCK_MONOTONIC_RAW, &wake_ts);
+	subtract_timespecs(&cpu_ts, &thread->wake_cpu_ts, &cpu);
+	subtract_timespecs(&wake_ts, &thread->wake_ts, &wall);
+	thread->wake_cpu_ts = cpu_ts;
+	thread->wake_ts = wake_ts;
+
+	*cpu_ns = timespec_to_ns(&cpu);
+	*wall_ns = timespec_to_ns(&wall);
+}
+
+/* Feeds the governor with the CPU time the thread took since the previous
+ * wake, and applies its level when it changes. Entering and leaving the
+ * DSP and APM levels is reported to the main thread and to the APMs, which
+ * other threads may be overloading too. */
+static void update_overload(struct audio_thread *thread, uint64_t cpu_ns,
+			    uint64_t wall_ns)
+{
+	enum CRAS_OVERLOAD_LEVEL prev, level;
+	int changed;
+
+	prev = cras_overload_get_level(thread->overload);
+	changed = cras_overload_update(thread->overload, cpu_ns, wall_ns);
+	if (!changed)
+		return;
+
+	level = cras_overload_get_level(thread->overload);
+	syslog(LOG_WARNING, "Audio thread load %u/1000, processing level %d",
+	       cras_overload_get_load(thread->overload), level);
+
+	apply_overload_src(thread);
+	if ((prev >= CRAS_OVERLOAD_DSP) != (level >= CRAS_OVERLOAD_DSP))
+		cras_overload_send_dsp_msg(level >= CRAS_OVERLOAD_DSP);
+	if ((prev >= CRAS_OVERLOAD_APM) != (level >= CRAS_OVERLOAD_APM))
+		cras_apm_list_set_overloaded(level >= CRAS_OVERLOAD_APM);
+}
+
+/* Returns non-zero if the thread should poll without blocking and advance the
+ * virtual clock over the wait instead of sleeping it out. That is whenever
+ * offline rendering runs the virtual clock, except while a client owes a
+ * reply: time stands still until every stream has delivered its audio. */
+static int skip_sleep(struct audio_thread *thread)
+{
+	struct open_dev **odevs = thread->open_devs;
+
+	if (!cras_virtual_clock_enabled())
+		return 0;
+	return !dev_io_has_pending_reply(odevs[CRAS_STREAM_OUTPUT]) &&
+	       !dev_io_has_pending_reply(odevs[CRAS_STREAM_INPUT]);
+}
+
 /* For playback, fill the audio buffer when needed, for capture, pull out
  * samples when they are ready.
  * This thread will attempt to run at a high priority to allow for low latency
@@ -820,28 +1405,53 @@ static void check_busyloop(struct timespec *wait_ts)
 static void *audio_io_thread(void *arg)
 {
 	struct audio_thread *thread = (struct audio_thread *)arg;
-	struct open_dev *adev;
-	struct dev_stream *curr;
 	struct timespec ts;
 	int msg_fd;
 	int rc;
 
-	msg_fd = thread->to_thread_fds[0];
+	msg_fd = thread->to_thread_fd;
 
-	/* Attempt to get realtime scheduling */
-	if (cras_set_rt_scheduling(CRAS_SERVER_RT_THREAD_PRIORITY) == 0)
-		cras_set_thread_priority(CRAS_SERVER_RT_THREAD_PRIORITY);
+	/* Attempt to get realtime scheduling, SCHED_DEADLINE takes over once
+	 * devices are open if enabled. */
+	set_rt_priority();
+
+	if (cras_system_get_lock_rt_memory())
+		thread->rt_memory_locked = cras_lock_rt_memory() == 0;
+
+	/* The mix pool is per thread, each audio thread submits to its own. */
+	if (thread->mix_pool) {
+		dev_io_set_mix_pool(thread->mix_pool,
+				    cras_system_get_mix_worker_min_streams());
+		cras_dsp_pipeline_set_worker_pool(thread->mix_pool);
+	}
+	reserve_conv_scratch(thread);
 
+	/* ppoll keeps the nanosecond sleep precision epoll_wait lacks. */
 	thread->pollfds[0].fd = msg_fd;
 	thread->pollfds[0].events = POLLIN;
+	thread->pollfds[1].fd = thread->wake_epoll_fd;
+	thread->pollfds[1].events = POLLIN;
+
+	if (thread->overload || thread->sched_deadline)
+		init_wake_times(thread);
 
 	while (1) {
+		static const struct timespec no_wait_ts = { 0, 0 };
+		static const struct timespec main_msg_retry_ts = { 0, 1000000 };
 		struct timespec *wait_ts;
 		struct iodev_callback_list *iodev_cb;
-		int non_empty;
+		uint64_t cpu_ns, wall_ns;
+		int non_empty, skip;
 
 		wait_ts = NULL;
-		thread->num_pollfds = 1;
+
+		if (thread->overload || thread->sched_deadline) {
+			measure_wake(thread, &cpu_ns, &wall_ns);
+			if (thread->overload)
+				update_overload(thread, cpu_ns, wall_ns);
+			if (thread->sched_deadline)
+				update_wake_cpu_peak(thread, cpu_ns);
+		}
 
 		/* device opened */
 		dev_io_run(&thread->open_devs[CRAS_STREAM_OUTPUT],
@@ -851,42 +1461,20 @@ static void *audio_io_thread(void *arg)
 		non_empty = dev_io_check_non_empty_state_transition(
 			thread->open_devs[CRAS_STREAM_OUTPUT]);
 
+		update_snapshot(thread);
+		update_perf_stats(thread);
+
 		if (fill_next_sleep_interval(thread, &ts))
 			wait_ts = &ts;
-
-	restart_poll_loop:
-		thread->num_pollfds = 1;
-
-		DL_FOREACH (iodev_callbacks, iodev_cb) {
-			if (iodev_cb->trigger != TRIGGER_POLL) {
-				iodev_cb->pollfd = NULL;
-				continue;
-			}
-			iodev_cb->pollfd = add_pollfd(thread, iodev_cb->fd,
-						      iodev_cb->events);
-			if (!iodev_cb->pollfd)
-				goto restart_poll_loop;
-		}
-
-		/* TODO(dgreid) - once per rstream not per dev_stream */
-		DL_FOREACH (thread->open_devs[CRAS_STREAM_OUTPUT], adev) {
-			DL_FOREACH (adev->dev->streams, curr) {
-				int fd = dev_stream_poll_stream_fd(curr);
-				if (fd < 0)
-					continue;
-				if (!add_pollfd(thread, fd, POLLIN))
-					goto restart_poll_loop;
-			}
-		}
-		DL_FOREACH (thread->open_devs[CRAS_STREAM_INPUT], adev) {
-			DL_FOREACH (adev->dev->streams, curr) {
-				int fd = dev_stream_poll_stream_fd(curr);
-				if (fd < 0)
-					continue;
-				if (!add_pollfd(thread, fd, POLLIN))
-					goto restart_poll_loop;
-			}
+		/* Messages to the main thread that didn't fit are sent again
+		 * on a wake that comes soon. */
+		if (cras_main_message_retry() &&
+		    (!wait_ts || timespec_after(wait_ts, &main_msg_retry_ts))) {
+			ts = main_msg_retry_ts;
+			wait_ts = &ts;
 		}
+		dev_io_end_wake(thread->open_devs[CRAS_STREAM_OUTPUT]);
+		dev_io_end_wake(thread->open_devs[CRAS_STREAM_INPUT]);
 
 		log_busyloop(wait_ts);
 
@@ -899,11 +1487,15 @@ static void *audio_io_thread(void *arg)
 		__sync_synchronize();
 		atlog->sync_write_pos = atlog->write_pos;
 
-		rc = ppoll(thread->pollfds, thread->num_pollfds, wait_ts, NULL);
+		skip = wait_ts && skip_sleep(thread);
+		rc = ppoll(thread->pollfds, ARRAY_SIZE(thread->pollfds),
+			   skip ? &no_wait_ts : wait_ts, NULL);
+		if (rc == 0 && skip)
+			cras_virtual_clock_advance(wait_ts);
 		ATLOG(atlog, AUDIO_THREAD_WAKE, rc, 0, 0);
 
 		/* Handle callbacks registered by TRIGGER_WAKEUP */
-		DL_FOREACH (iodev_callbacks, iodev_cb) {
+		DL_FOREACH (thread->iodev_callbacks, iodev_cb) {
 			if (iodev_cb->trigger == TRIGGER_WAKEUP) {
 				ATLOG(atlog, AUDIO_THREAD_IODEV_CB, 0, 0, 0);
 				iodev_cb->cb(iodev_cb->cb_data, 0);
@@ -915,31 +1507,54 @@ static void *audio_io_thread(void *arg)
 			continue;
 
 		if (thread->pollfds[0].revents & POLLIN) {
-			rc = handle_audio_thread_message(thread);
-			if (rc < 0)
-				syslog(LOG_ERR, "handle message %d", rc);
+			handle_audio_thread_messages(thread);
+			reserve_conv_scratch(thread);
+			/* Show added and removed devices and streams
+			 * right away. */
+			thread->perf_stats_due.tv_sec = 0;
+			thread->perf_stats_due.tv_nsec = 0;
 		}
 
-		DL_FOREACH (iodev_callbacks, iodev_cb) {
-			if (iodev_cb->pollfd &&
-			    iodev_cb->pollfd->revents & iodev_cb->events) {
-				ATLOG(atlog, AUDIO_THREAD_IODEV_CB,
-				      iodev_cb->pollfd->revents,
-				      iodev_cb->events, 0);
-				iodev_cb->cb(iodev_cb->cb_data,
-					     iodev_cb->pollfd->revents);
-			}
-		}
+		if (thread->pollfds[1].revents & POLLIN)
+			handle_ready_events(thread);
 	}
 
 	return NULL;
 }
 
+/* Queues a message in the command ring and rings the doorbell of the audio
+ * thread. Called from the main thread, the only producer of the ring.
+ * Returns:
+ *    The slot holding the message, or NULL if the ring is full.
+ */
+static struct audio_thread_msg *queue_message(struct audio_thread *thread,
+					      struct audio_thread_msg *msg,
+					      int async)
+{
+	struct audio_thread_msg *slot;
+
+	assert(msg->length <= cras_cmd_ring_slot_size(thread->cmd_ring));
+
+	slot = (struct audio_thread_msg *)cras_cmd_ring_write_slot(
+		thread->cmd_ring);
+	if (!slot) {
+		syslog(LOG_ERR, "Audio thread command ring full.");
+		return NULL;
+	}
+	memcpy(slot, msg, msg->length);
+	slot->async = async;
+	cras_cmd_ring_commit_write(thread->cmd_ring);
+	eventfd_write(thread->to_thread_fd, 1);
+
+	return slot;
+}
+
 /* Write a message to the playback thread and wait for an ack, This keeps these
  * operations synchronous for the main server thread.  For instance when the
  * RM_STREAM message is sent, the stream can be deleted after the function
  * returns.  Making this synchronous also allows the thread to return an error
- * code that can be handled by the caller.
+ * code that can be handled by the caller. The handled message is copied back
+ * to msg so that the thread can return data in it.
  * Args:
  *    thread - thread to receive message.
  *    msg - The message to send.
@@ -949,21 +1564,39 @@ static void *audio_io_thread(void *arg)
 static int audio_thread_post_message(struct audio_thread *thread,
 				     struct audio_thread_msg *msg)
 {
-	int err, rsp;
+	struct audio_thread_msg *slot;
+	eventfd_t count;
+	int err;
+
+	slot = queue_message(thread, msg, 0);
+	if (!slot)
+		return -EAGAIN;
 
-	err = write(thread->to_thread_fds[1], msg, msg->length);
-	if (err < 0) {
-		syslog(LOG_ERR, "Failed to post message to thread.");
-		return err;
-	}
 	/* Synchronous action, wait for response. */
-	err = read_until_finished(thread->to_main_fds[0], &rsp, sizeof(rsp));
+	do {
+		err = eventfd_read(thread->to_main_fd, &count);
+	} while (err < 0 && errno == EINTR);
 	if (err < 0) {
 		syslog(LOG_ERR, "Failed to read reply from thread.");
-		return err;
+		return -errno;
 	}
 
-	return rsp;
+	memcpy(msg, slot, msg->length);
+	return msg->rc;
+}
+
+/* Queues a message for the audio thread without waiting for it to be handled.
+ * A failure of the command is reported back through a main thread message.
+ * Args:
+ *    thread - thread to receive message.
+ *    msg - The message to send.
+ * Returns:
+ *    0 if the message is queued, negative error code otherwise.
+ */
+static int audio_thread_post_message_async(struct audio_thread *thread,
+					   struct audio_thread_msg *msg)
+{
+	return queue_message(thread, msg, 1) ? 0 : -EAGAIN;
 }
 
 static void init_open_device_msg(struct audio_thread_open_device_msg *msg,
@@ -1001,16 +1634,6 @@ static void init_add_rm_stream_msg(struct audio_thread_add_rm_stream_msg *msg,
 	msg->num_devs = num_devs;
 }
 
-static void
-init_dump_debug_info_msg(struct audio_thread_dump_debug_info_msg *msg,
-			 struct audio_debug_info *info)
-{
-	memset(msg, 0, sizeof(*msg));
-	msg->header.id = AUDIO_THREAD_DUMP_THREAD_INFO;
-	msg->header.length = sizeof(*msg);
-	msg->info = info;
-}
-
 static void
 init_config_global_remix_msg(struct audio_thread_config_global_remix *msg)
 {
@@ -1054,6 +1677,27 @@ int audio_thread_add_stream(struct audio_thread *thread,
 	return audio_thread_post_message(thread, &msg.header);
 }
 
+int audio_thread_add_streams(struct audio_thread *thread,
+			     struct audio_thread_stream_attach *attaches,
+			     unsigned int num)
+{
+	struct audio_thread_add_streams_msg msg;
+
+	assert(thread && attaches);
+
+	if (!thread->started)
+		return -EINVAL;
+	if (num == 0)
+		return 0;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.header.id = AUDIO_THREAD_ADD_STREAMS;
+	msg.header.length = sizeof(msg);
+	msg.attaches = attaches;
+	msg.num = num;
+	return audio_thread_post_message(thread, &msg.header);
+}
+
 int audio_thread_disconnect_stream(struct audio_thread *thread,
 				   struct cras_rstream *stream,
 				   struct cras_iodev *dev)
@@ -1079,13 +1723,52 @@ int audio_thread_drain_stream(struct audio_thread *thread,
 	return audio_thread_post_message(thread, &msg.header);
 }
 
+int audio_thread_swap_stream_apms(struct audio_thread *thread,
+				  struct cras_rstream *stream)
+{
+	struct audio_thread_add_rm_stream_msg msg;
+
+	assert(thread && stream);
+
+	init_add_rm_stream_msg(&msg, AUDIO_THREAD_SWAP_STREAM_APMS, stream,
+			       NULL, 0);
+	return audio_thread_post_message(thread, &msg.header);
+}
+
+int audio_thread_set_stream_paused(struct audio_thread *thread,
+				   struct cras_rstream *stream,
+				   unsigned int fade_in_ms)
+{
+	struct audio_thread_set_stream_paused_msg msg;
+
+	assert(thread && stream);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.header.id = AUDIO_THREAD_SET_STREAM_PAUSED;
+	msg.header.length = sizeof(msg);
+	msg.stream = stream;
+	msg.fade_in_ms = fade_in_ms;
+	return audio_thread_post_message(thread, &msg.header);
+}
+
 int audio_thread_dump_thread_info(struct audio_thread *thread,
 				  struct audio_debug_info *info)
 {
-	struct audio_thread_dump_debug_info_msg msg;
+	info->num_devs = 0;
+	info->num_streams = 0;
+	info->rt_memory_locked = 1;
+	info->minor_faults = 0;
+	info->major_faults = 0;
+	info->conv_mem_bytes = 0;
+	append_thread_info(thread, info);
+	return 0;
+}
 
-	init_dump_debug_info_msg(&msg, info);
-	return audio_thread_post_message(thread, &msg.header);
+int audio_thread_append_thread_info(struct audio_thread *thread,
+				    struct audio_debug_info *info)
+{
+	append_thread_info(thread, info);
+	return 0;
 }
 
 int audio_thread_set_aec_dump(struct audio_thread *thread,
@@ -1123,7 +1806,6 @@ int audio_thread_config_global_remix(struct audio_thread *thread,
 	int identity_remix = 1;
 	unsigned int i, j;
 	struct audio_thread_config_global_remix msg;
-	void *rsp;
 
 	init_config_global_remix_msg(&msg);
 
@@ -1151,61 +1833,100 @@ int audio_thread_config_global_remix(struct audio_thread *thread,
 			return -ENOMEM;
 	}
 
-	err = write(thread->to_thread_fds[1], &msg, msg.header.length);
-	if (err < 0) {
-		syslog(LOG_ERR, "Failed to post message to thread.");
-		return err;
-	}
-	/* Synchronous action, wait for response. */
-	err = read_until_finished(thread->to_main_fds[0], &rsp, sizeof(rsp));
+	err = audio_thread_post_message(thread, &msg.header);
 	if (err < 0) {
-		syslog(LOG_ERR, "Failed to read reply from thread.");
+		if (msg.fmt_conv)
+			cras_fmt_conv_destroy(&msg.fmt_conv);
 		return err;
 	}
 
-	if (rsp)
-		cras_fmt_conv_destroy((struct cras_fmt_conv **)&rsp);
+	if (msg.old_fmt_conv)
+		cras_fmt_conv_destroy(&msg.old_fmt_conv);
 	return 0;
 }
 
+static void free_thread_messaging(struct audio_thread *thread)
+{
+	struct iodev_callback_list *iodev_cb;
+
+	cras_cmd_ring_destroy(thread->cmd_ring);
+	if (thread->to_thread_fd >= 0)
+		close(thread->to_thread_fd);
+	if (thread->to_main_fd >= 0)
+		close(thread->to_main_fd);
+	if (thread->wake_epoll_fd >= 0) {
+		close(thread->wake_epoll_fd);
+		thread->wake_epoll_fd = -1;
+	}
+	DL_FOREACH (thread->iodev_callbacks, iodev_cb) {
+		DL_DELETE(thread->iodev_callbacks, iodev_cb);
+		free(iodev_cb);
+	}
+}
+
+/* Logs the failures of asynchronous commands. Called from the main thread. */
+static void handle_async_reply(struct cras_main_message *msg, void *arg)
+{
+	struct audio_thread_async_reply_msg *rmsg =
+		(struct audio_thread_async_reply_msg *)msg;
+
+	syslog(LOG_WARNING, "Audio thread command %d failed: %d", rmsg->id,
+	       rmsg->rc);
+}
+
 struct audio_thread *audio_thread_create()
 {
-	int rc;
 	struct audio_thread *thread;
 
 	thread = (struct audio_thread *)calloc(1, sizeof(*thread));
 	if (!thread)
 		return NULL;
 
-	thread->to_thread_fds[0] = -1;
-	thread->to_thread_fds[1] = -1;
-	thread->to_main_fds[0] = -1;
-	thread->to_main_fds[1] = -1;
-
-	/* Two way pipes for communication with the device's audio thread. */
-	rc = pipe(thread->to_thread_fds);
-	if (rc < 0) {
-		syslog(LOG_ERR, "Failed to pipe");
-		free(thread);
-		return NULL;
-	}
-	rc = pipe(thread->to_main_fds);
-	if (rc < 0) {
-		syslog(LOG_ERR, "Failed to pipe");
+	/* Command ring and doorbells for communication with the device's audio
+	 * thread. */
+	thread->cmd_ring = cras_cmd_ring_create(CMD_SLOT_SIZE, NUM_CMD_SLOTS);
+	thread->to_thread_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	thread->to_main_fd = eventfd(0, EFD_CLOEXEC);
+	thread->wake_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (!thread->cmd_ring || thread->to_thread_fd < 0 ||
+	    thread->to_main_fd < 0 || thread->wake_epoll_fd < 0) {
+		syslog(LOG_ERR, "Failed to set up audio thread messaging");
+		free_thread_messaging(thread);
 		free(thread);
 		return NULL;
 	}
 
-	if (asprintf(&atlog_name, "/ATlog-%d", getpid()) < 0) {
-		syslog(LOG_ERR, "Failed to generate ATlog name.");
-		exit(-1);
-	}
+	/* All audio threads log to the same atlog. */
+	if (num_atlog_users++ == 0) {
+		if (asprintf(&atlog_name, "/ATlog-%d", getpid()) < 0) {
+			syslog(LOG_ERR, "Failed to generate ATlog name.");
+			exit(-1);
+		}
 
-	atlog = audio_thread_event_log_init(atlog_name);
+		atlog = audio_thread_event_log_init(atlog_name);
+	}
 
-	thread->pollfds_size = 32;
-	thread->pollfds = (struct pollfd *)malloc(sizeof(*thread->pollfds) *
-						  thread->pollfds_size);
+	/* Installed by the audio thread itself once it runs. */
+	if (cras_system_get_mix_worker_threads()) {
+		thread->mix_pool = cras_mix_pool_create(
+			cras_system_get_mix_worker_threads());
+		if (!thread->mix_pool)
+			syslog(LOG_ERR, "Failed to create mix worker pool");
+	}
+	dev_io_set_input_wake_slack(cras_system_get_input_wake_slack_us());
+	dev_io_set_adaptive_buffer_max_ms(
+		cras_system_get_adaptive_buffer_max_ms());
+	dev_io_set_stream_ramp_ms(cras_system_get_stream_ramp_ms());
+	dev_io_set_deep_buffer(cras_system_get_deep_buffer());
+
+	/* Offline rendering never sleeps, so it would always look busy and
+	 * exhaust any SCHED_DEADLINE runtime. */
+	if (!cras_virtual_clock_enabled()) {
+		thread->overload = cras_overload_create();
+		if (!thread->overload)
+			syslog(LOG_ERR, "Failed to create overload governor");
+		thread->sched_deadline = cras_system_get_sched_deadline();
+	}
 
 	return thread;
 }
@@ -1263,7 +1984,7 @@ int audio_thread_dev_start_ramp(struct audio_thread *thread,
 
 	init_device_start_ramp_msg(&msg, AUDIO_THREAD_DEV_START_RAMP, dev_idx,
 				   request);
-	return audio_thread_post_message(thread, &msg.header);
+	return audio_thread_post_message_async(thread, &msg.header);
 }
 
 int audio_thread_start(struct audio_thread *thread)
@@ -1277,10 +1998,42 @@ int audio_thread_start(struct audio_thread *thread)
 	}
 
 	thread->started = 1;
+	cras_main_message_add_handler(CRAS_MAIN_AUDIO_THREAD_REPLY,
+				      handle_async_reply, NULL);
 
 	return 0;
 }
 
+int audio_thread_set_cpu_affinity(struct audio_thread *thread,
+				  unsigned long cpu_mask)
+{
+	cpu_set_t cpus;
+	unsigned int i;
+	int rc;
+
+	if (!thread->started || !cpu_mask)
+		return -EINVAL;
+
+	CPU_ZERO(&cpus);
+	for (i = 0; i < sizeof(cpu_mask) * 8 && i < CPU_SETSIZE; i++)
+		if (cpu_mask & (1UL << i))
+			CPU_SET(i, &cpus);
+
+	rc = pthread_setaffinity_np(thread->tid, sizeof(cpus), &cpus);
+	if (rc) {
+		syslog(LOG_ERR, "Failed to set audio thread affinity %#lx: %d",
+		       cpu_mask, rc);
+		return -rc;
+	}
+	return 0;
+}
+
+void audio_thread_set_perf_stats(struct audio_thread *thread,
+				 struct cras_perf_stats *stats)
+{
+	thread->perf_stats = stats;
+}
+
 void audio_thread_destroy(struct audio_thread *thread)
 {
 	if (thread->started) {
@@ -1292,22 +2045,30 @@ void audio_thread_destroy(struct audio_thread *thread)
 		pthread_join(thread->tid, NULL);
 	}
 
-	free(thread->pollfds);
-
-	audio_thread_event_log_deinit(atlog, atlog_name);
-	free(atlog_name);
-
-	if (thread->to_thread_fds[0] != -1) {
-		close(thread->to_thread_fds[0]);
-		close(thread->to_thread_fds[1]);
-	}
-	if (thread->to_main_fds[0] != -1) {
-		close(thread->to_main_fds[0]);
-		close(thread->to_main_fds[1]);
+	if (--num_atlog_users == 0) {
+		audio_thread_event_log_deinit(atlog, atlog_name);
+		free(atlog_name);
+		atlog_name = NULL;
 	}
 
+	free_thread_messaging(thread);
+
 	if (thread->remix_converter)
 		cras_fmt_conv_destroy(&thread->remix_converter);
 
+	if (thread->mix_pool)
+		cras_mix_pool_destroy(thread->mix_pool);
+
+	/* Give back what the stopped thread held against the others. */
+	if (thread->overload) {
+		if (cras_overload_get_level(thread->overload) >=
+		    CRAS_OVERLOAD_DSP)
+			cras_overload_send_dsp_msg(0);
+		if (cras_overload_get_level(thread->overload) >=
+		    CRAS_OVERLOAD_APM)
+			cras_apm_list_set_overloaded(false);
+		cras_overload_destroy(thread->overload);
+	}
+
 	free(thread);
 }
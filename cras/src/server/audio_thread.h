@@ -6,6 +6,7 @@
 #ifndef AUDIO_THREAD_H_
 #define AUDIO_THREAD_H_
 
+#include <poll.h>
 #include <pthread.h>
 #include <stdint.h>
 
@@ -14,35 +15,101 @@
 #include "dev_io.h"
 
 struct buffer_share;
+struct cras_cmd_ring;
 struct cras_fmt_conv;
 struct cras_iodev;
+struct iodev_callback_list;
 struct cras_rstream;
+struct cras_mix_pool;
+struct cras_overload;
 struct dev_stream;
 
+/* A copy of the devices and streams of an audio thread, published for debug
+ * dumps so they never have to stop the thread.
+ *    seq - Odd while the audio thread writes the copy.
+ *    num_devs, devs - The open devices, output ones first.
+ *    num_streams, streams - The streams attached to them.
+ *    minor_faults, major_faults - Page faults taken by the thread.
+ *    conv_mem_bytes - Scratch memory of the format converters of the thread.
+ */
+struct audio_thread_snapshot {
+	uint32_t seq;
+	uint32_t num_devs;
+	uint32_t num_streams;
+	struct audio_dev_debug_info devs[MAX_DEBUG_DEVS];
+	struct audio_stream_debug_info streams[MAX_DEBUG_STREAMS];
+	uint64_t minor_faults;
+	uint64_t major_faults;
+	uint64_t conv_mem_bytes;
+};
+
 /* Hold communication pipes and pthread info for the thread used to play or
  * record audio.
- *    to_thread_fds - Send a message from main to running thread.
- *    to_main_fds - Send a synchronous response to main from running thread.
+ *    cmd_ring - Messages from main to running thread.
+ *    to_thread_fd - Event fd signaled when a message is queued in cmd_ring.
+ *    to_main_fd - Event fd signaled when a synchronous message is handled.
  *    tid - Thread ID of the running playback/capture thread.
  *    started - Non-zero if the thread has started successfully.
  *    suspended - Non-zero if the thread is suspended.
  *    open_devs - Lists of open input and output devices.
- *    pollfds - What FDs wake up this thread.
- *    pollfds_size - Number of available poll fds.
- *    num_pollfds - Number of currently registered poll fds.
+ *    pollfds - The message fd and the epoll fd of iodev and stream fds
+ *        that wake up this thread.
  *    remix_converter - Format converter used to remix output channels.
+ *    mix_pool - Worker threads rendering playback streams in parallel, NULL
+ *        if disabled.
+ *    conv_scratch_bytes - Conversion scratch reserved on this thread and
+ *        its mix workers.
+ *    iodev_callbacks - Callbacks registered by the devices of this thread.
+ *    wake_epoll_fd - The epoll set holding the iodev callback and stream fds
+ *        that wake this thread. Fds are added and removed when callbacks and
+ *        streams come and go, instead of being collected on every wake.
+ *    rt_memory_locked - Non-zero if the thread locked memory when it
+ *        started.
+ *    overload - Governor degrading the processing when the thread runs
+ *        short of CPU, NULL if it couldn't be created.
+ *    wake_cpu_ts - CPU time of the thread at the previous wake.
+ *    wake_ts - Time of the previous wake.
+ *    sched_deadline - Non-zero if the thread runs under SCHED_DEADLINE
+ *        while devices are open, cleared once the kernel refuses it.
+ *    deadline_period_ns - Period of the SCHED_DEADLINE reservation in
+ *        effect, 0 while the thread runs at its fixed RT priority.
+ *    deadline_runtime_ns - Runtime of the reservation in effect.
+ *    wake_cpu_peak_ns - Slowly decaying peak of the CPU time of a wake.
+ *    snapshots - Double buffered copy of the devices and streams for debug
+ *        dumps, written by the audio thread and read by the main thread.
+ *    snapshot_idx - Which of snapshots was published last.
+ *    snapshot_due - When the counters in the snapshot are refreshed next.
+ *    perf_stats - Where the thread publishes its perf stats in the server
+ *        state, NULL if it doesn't.
+ *    perf_stats_due - When the perf stats are published next.
  */
 struct audio_thread {
-	int to_thread_fds[2];
-	int to_main_fds[2];
+	struct cras_cmd_ring *cmd_ring;
+	int to_thread_fd;
+	int to_main_fd;
 	pthread_t tid;
 	int started;
 	int suspended;
 	struct open_dev *open_devs[CRAS_NUM_DIRECTIONS];
-	struct pollfd *pollfds;
-	size_t pollfds_size;
-	size_t num_pollfds;
+	struct pollfd pollfds[2];
 	struct cras_fmt_conv *remix_converter;
+	struct cras_mix_pool *mix_pool;
+	size_t conv_scratch_bytes;
+	struct iodev_callback_list *iodev_callbacks;
+	int wake_epoll_fd;
+	int rt_memory_locked;
+	struct cras_overload *overload;
+	struct timespec wake_cpu_ts;
+	struct timespec wake_ts;
+	int sched_deadline;
+	uint64_t deadline_period_ns;
+	uint64_t deadline_runtime_ns;
+	uint64_t wake_cpu_peak_ns;
+	struct audio_thread_snapshot snapshots[2];
+	unsigned int snapshot_idx;
+	struct timespec snapshot_due;
+	struct cras_perf_stats *perf_stats;
+	struct timespec perf_stats_due;
 };
 
 /*
@@ -99,20 +166,23 @@ int audio_thread_is_dev_open(struct audio_thread *thread,
 /* Adds a thread_callback to audio thread for requested events. By default
  * the callback trigger is set to TRIGGER_POLL.
  * Args:
+ *    thread - The thread servicing the device that owns fd.
  *    fd - The file descriptor to be polled for the callback.
  *      The callback will be called when any of requested events matched.
  *    cb - The callback function.
  *    data - The data for the callback function.
  *    events - The requested events to ppoll().
  */
-void audio_thread_add_events_callback(int fd, thread_callback cb, void *data,
+void audio_thread_add_events_callback(struct audio_thread *thread, int fd,
+				      thread_callback cb, void *data,
 				      int events);
 
 /* Removes an thread_callback from audio thread.
  * Args:
+ *    thread - The thread the callback was added to.
  *    fd - The file descriptor of the previous added callback.
  */
-void audio_thread_rm_callback(int fd);
+void audio_thread_rm_callback(struct audio_thread *thread, int fd);
 
 /* Removes a thread_callback from main thread.
  * Args:
@@ -123,11 +193,13 @@ int audio_thread_rm_callback_sync(struct audio_thread *thread, int fd);
 
 /* Configures the callback associated with fd when it should be triggerred.
  * Args:
+ *    thread - The thread the callback was added to.
  *    fd - The file descriptor associate to the callback.
  *    trigger - Specifies how the callback should be triggered.
  */
 void audio_thread_config_events_callback(
-	int fd, enum AUDIO_THREAD_EVENTS_CB_TRIGGER trigger);
+	struct audio_thread *thread, int fd,
+	enum AUDIO_THREAD_EVENTS_CB_TRIGGER trigger);
 
 /* Starts a thread created with audio_thread_create.
  * Args:
@@ -137,6 +209,24 @@ void audio_thread_config_events_callback(
  */
 int audio_thread_start(struct audio_thread *thread);
 
+/* Restricts a started audio thread to a set of CPUs.
+ * Args:
+ *    thread - The thread to pin.
+ *    cpu_mask - Bit i set allows the thread to run on CPU i.
+ * Returns:
+ *    0 on success, negative error code on failure.
+ */
+int audio_thread_set_cpu_affinity(struct audio_thread *thread,
+				  unsigned long cpu_mask);
+
+/* Lets the thread publish its perf stats, see struct cras_perf_stats.
+ * Args:
+ *    thread - The thread to publish from, not started yet.
+ *    stats - The entry of the server state the thread owns.
+ */
+void audio_thread_set_perf_stats(struct audio_thread *thread,
+				 struct cras_perf_stats *stats);
+
 /* Frees an audio thread created with audio_thread_create(). */
 void audio_thread_destroy(struct audio_thread *thread);
 
@@ -159,6 +249,35 @@ int audio_thread_add_stream(struct audio_thread *thread,
 			    struct cras_rstream *stream,
 			    struct cras_iodev **devs, unsigned int num_devs);
 
+/* A stream to attach as part of a batch.
+ * Members:
+ *    stream - The stream to add, owned by the audio thread once attached.
+ *    devs - The devices to attach it to.
+ *    num_devs - Number of devices in devs.
+ *    rc - Set by the audio thread to the result of attaching this stream.
+ */
+struct audio_thread_stream_attach {
+	struct cras_rstream *stream;
+	struct cras_iodev **devs;
+	unsigned int num_devs;
+	int rc;
+};
+
+/* Adds several streams to the thread in a single command, so that the main
+ * thread waits for the audio thread once instead of once per stream.
+ * Args:
+ *    thread - a pointer to the audio thread.
+ *    attaches - the streams to add with their devices. The rc member of
+ *        each entry is filled in with the result for that stream.
+ *    num - number of entries in attaches.
+ * Returns:
+ *    zero if the command was handled, negative error code otherwise. Per
+ *    stream failures are only reported through the rc members.
+ */
+int audio_thread_add_streams(struct audio_thread *thread,
+			     struct audio_thread_stream_attach *attaches,
+			     unsigned int num);
+
 /* Begin draining a stream and check the draining status.
  * Args:
  *    thread - a pointer to the audio thread.
@@ -171,6 +290,32 @@ int audio_thread_add_stream(struct audio_thread *thread,
 int audio_thread_drain_stream(struct audio_thread *thread,
 			      struct cras_rstream *stream);
 
+/* Moves an input stream to the APMs staged for its new effects, and makes
+ * them those of its APM list.
+ * Args:
+ *    thread - a pointer to the audio thread.
+ *    stream - the stream changing effects.
+ * Returns:
+ *    1 if the stream runs on this thread, 0 if it doesn't, negative if
+ *    error.
+ */
+int audio_thread_swap_stream_apms(struct audio_thread *thread,
+				  struct cras_rstream *stream);
+
+/* Pauses or resumes a stream as its paused flag says. A paused stream stays
+ * attached to its devices without being fetched, mixed or captured to.
+ * Args:
+ *    thread - a pointer to the audio thread.
+ *    stream - the stream to pause or resume.
+ *    fade_in_ms - how long a resumed output stream takes to fade in.
+ * Returns:
+ *    1 if the stream runs on this thread, 0 if it doesn't, negative if
+ *    error.
+ */
+int audio_thread_set_stream_paused(struct audio_thread *thread,
+				   struct cras_rstream *stream,
+				   unsigned int fade_in_ms);
+
 /* Disconnect a stream from the client.
  * Args:
  *    thread - a pointer to the audio thread.
@@ -183,10 +328,17 @@ int audio_thread_disconnect_stream(struct audio_thread *thread,
 				   struct cras_rstream *stream,
 				   struct cras_iodev *iodev);
 
-/* Dumps information about all active streams to syslog. */
+/* Fills info with the devices and streams of thread from its last published
+ * snapshot, which is refreshed on every message handled and once a second.
+ * Doesn't wait for the audio thread. */
 int audio_thread_dump_thread_info(struct audio_thread *thread,
 				  struct audio_debug_info *info);
 
+/* Like audio_thread_dump_thread_info(), but adds the devices and streams of
+ * thread after the ones already in info. Used to dump several threads. */
+int audio_thread_append_thread_info(struct audio_thread *thread,
+				    struct audio_debug_info *info);
+
 /* Starts or stops the aec dump task.
  * Args:
  *    thread - pointer to the audio thread.
@@ -214,7 +366,8 @@ int audio_thread_config_global_remix(struct audio_thread *thread,
  *   dev_idx - Index of the the device to start ramping.
  *   request - Check the docstrings of CRAS_IODEV_RAMP_REQUEST.
  * Returns:
- *    0 on success, negative if error.
+ *    0 if the request is queued, negative if error. The request is handled
+ *    asynchronously, failures in the audio thread are only logged.
  */
 int audio_thread_dev_start_ramp(struct audio_thread *thread,
 				unsigned int dev_idx,
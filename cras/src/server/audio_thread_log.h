@@ -21,11 +21,22 @@
 #if (AUDIO_THREAD_LOGGING)
 #define ATLOG(log, event, data1, data2, data3)                                 \
 	audio_thread_event_log_data(log, event, data1, data2, data3);
+/* Logs an event describing the workload, only when it is being recorded. */
+#define ATLOG_WORKLOAD(log, event, data1, data2, data3)                        \
+	do {                                                                   \
+		if (atlog_workload)                                            \
+			audio_thread_event_log_data(log, event, data1, data2,  \
+						    data3);                    \
+	} while (0)
 #else
 #define ATLOG(log, event, data1, data2, data3)
+#define ATLOG_WORKLOAD(log, event, data1, data2, data3)
 #endif
 
 extern struct audio_thread_event_log *atlog;
+/* Non-zero to log the stream formats, client reply times and device delays
+ * that let a workload be replayed, set by cras --record_workload. */
+extern int atlog_workload;
 extern int atlog_rw_shm_fd;
 extern int atlog_ro_shm_fd;
 
@@ -70,6 +81,7 @@ audio_thread_event_log_deinit(struct audio_thread_event_log *log, char *name)
 
 /* Log a tag and the current time, Uses two words, the first is split
  * 8 bits for tag and 24 for seconds, second word is micro seconds.
+ * The slot is claimed atomically since the A2DP encoder thread logs too.
  */
 static inline void
 audio_thread_event_log_data(struct audio_thread_event_log *log,
@@ -77,7 +89,9 @@ audio_thread_event_log_data(struct audio_thread_event_log *log,
 			    uint32_t data2, uint32_t data3)
 {
 	struct timespec now;
-	uint64_t pos_mod_len = log->write_pos % AUDIO_THREAD_EVENT_LOG_SIZE;
+	uint64_t pos_mod_len =
+		__atomic_fetch_add(&log->write_pos, 1, __ATOMIC_RELAXED) %
+		AUDIO_THREAD_EVENT_LOG_SIZE;
 	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 
 	log->log[pos_mod_len].tag_sec =
@@ -86,8 +100,6 @@ audio_thread_event_log_data(struct audio_thread_event_log *log,
 	log->log[pos_mod_len].data1 = data1;
 	log->log[pos_mod_len].data2 = data2;
 	log->log[pos_mod_len].data3 = data3;
-
-	log->write_pos++;
 }
 
 #endif /* AUDIO_THREAD_LOG_H_ */
@@ -9,43 +9,99 @@
 #include "cras_types.h"
 #include "buffer_share.h"
 
-static inline struct id_offset *find_unused(const struct buffer_share *mix)
+static inline int find_id(const struct buffer_share *mix, unsigned int id)
 {
 	unsigned int i;
 
 	for (i = 0; i < mix->id_sz; i++) {
-		if (!mix->wr_idx[i].used)
-			return &mix->wr_idx[i];
+		if (mix->wr_idx[i].used && id == mix->wr_idx[i].id)
+			return i;
 	}
 
-	return NULL;
+	return -ENOENT;
 }
 
-static inline struct id_offset *find_id(const struct buffer_share *mix,
-					unsigned int id)
+static inline unsigned int heap_offset(const struct buffer_share *mix,
+				       unsigned int pos)
 {
-	unsigned int i;
+	return mix->wr_idx[mix->heap[pos]].written - mix->write_point;
+}
 
-	for (i = 0; i < mix->id_sz; i++) {
-		if (mix->wr_idx[i].used && id == mix->wr_idx[i].id)
-			return &mix->wr_idx[i];
+static void heap_swap(struct buffer_share *mix, unsigned int a, unsigned int b)
+{
+	unsigned int slot = mix->heap[a];
+
+	mix->heap[a] = mix->heap[b];
+	mix->heap[b] = slot;
+	mix->wr_idx[mix->heap[a]].heap_pos = a;
+	mix->wr_idx[mix->heap[b]].heap_pos = b;
+}
+
+static void heap_sift_up(struct buffer_share *mix, unsigned int pos)
+{
+	unsigned int parent;
+
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+		if (heap_offset(mix, parent) <= heap_offset(mix, pos))
+			break;
+		heap_swap(mix, parent, pos);
+		pos = parent;
 	}
+}
 
-	return NULL;
+static void heap_sift_down(struct buffer_share *mix, unsigned int pos)
+{
+	unsigned int child;
+
+	for (;;) {
+		child = 2 * pos + 1;
+		if (child >= mix->num_used)
+			break;
+		if (child + 1 < mix->num_used &&
+		    heap_offset(mix, child + 1) < heap_offset(mix, child))
+			child++;
+		if (heap_offset(mix, pos) <= heap_offset(mix, child))
+			break;
+		heap_swap(mix, pos, child);
+		pos = child;
+	}
 }
 
-static void alloc_more_ids(struct buffer_share *mix)
+/* Chains the slots from first to the end of the slab into the free list. */
+static void chain_free_slots(struct buffer_share *mix, unsigned int first)
 {
-	unsigned int new_size = mix->id_sz * 2;
 	unsigned int i;
 
-	mix->wr_idx = (struct id_offset *)realloc(
-		mix->wr_idx, sizeof(mix->wr_idx[0]) * new_size);
-
-	for (i = mix->id_sz; i < new_size; i++)
+	for (i = first; i < mix->id_sz; i++) {
 		mix->wr_idx[i].used = 0;
+		mix->wr_idx[i].heap_pos = i + 1;
+	}
+	mix->free_slot = first;
+}
+
+static int alloc_more_ids(struct buffer_share *mix)
+{
+	unsigned int new_size = mix->id_sz * 2;
+	struct id_offset *wr_idx;
+	unsigned int *heap;
+	unsigned int old_size = mix->id_sz;
+
+	wr_idx = (struct id_offset *)realloc(mix->wr_idx,
+					     sizeof(*wr_idx) * new_size);
+	if (!wr_idx)
+		return -ENOMEM;
+	mix->wr_idx = wr_idx;
+
+	heap = (unsigned int *)realloc(mix->heap, sizeof(*heap) * new_size);
+	if (!heap)
+		return -ENOMEM;
+	mix->heap = heap;
 
 	mix->id_sz = new_size;
+	chain_free_slots(mix, old_size);
+
+	return 0;
 }
 
 struct buffer_share *buffer_share_create(unsigned int buf_sz)
@@ -56,7 +112,9 @@ struct buffer_share *buffer_share_create(unsigned int buf_sz)
 	mix->id_sz = INITIAL_ID_SIZE;
 	mix->wr_idx =
 		(struct id_offset *)calloc(mix->id_sz, sizeof(mix->wr_idx[0]));
+	mix->heap = (unsigned int *)calloc(mix->id_sz, sizeof(mix->heap[0]));
 	mix->buf_sz = buf_sz;
+	chain_free_slots(mix, 0);
 
 	return mix;
 }
@@ -65,6 +123,7 @@ void buffer_share_destroy(struct buffer_share *mix)
 {
 	if (!mix)
 		return;
+	free(mix->heap);
 	free(mix->wr_idx);
 	free(mix);
 }
@@ -72,33 +131,57 @@ void buffer_share_destroy(struct buffer_share *mix)
 int buffer_share_add_id(struct buffer_share *mix, unsigned int id, void *data)
 {
 	struct id_offset *o;
+	unsigned int slot;
+	int rc;
 
-	o = find_id(mix, id);
-	if (o)
+	if (find_id(mix, id) >= 0)
 		return -EEXIST;
 
-	o = find_unused(mix);
-	if (!o)
-		alloc_more_ids(mix);
+	if (mix->free_slot == mix->id_sz) {
+		rc = alloc_more_ids(mix);
+		if (rc)
+			return rc;
+	}
 
-	o = find_unused(mix);
+	slot = mix->free_slot;
+	o = &mix->wr_idx[slot];
+	mix->free_slot = o->heap_pos;
 	o->used = 1;
 	o->id = id;
-	o->offset = 0;
+	o->written = mix->write_point;
 	o->data = data;
 
+	/* A new user has written nothing, it's the new minimum. */
+	o->heap_pos = mix->num_used;
+	mix->heap[mix->num_used++] = slot;
+	heap_sift_up(mix, o->heap_pos);
+
 	return 0;
 }
 
 int buffer_share_rm_id(struct buffer_share *mix, unsigned int id)
 {
 	struct id_offset *o;
+	unsigned int pos, last;
+	int slot;
 
-	o = find_id(mix, id);
-	if (!o)
+	slot = find_id(mix, id);
+	if (slot < 0)
 		return -ENOENT;
+	o = &mix->wr_idx[slot];
+
+	pos = o->heap_pos;
+	last = --mix->num_used;
+	if (pos != last) {
+		heap_swap(mix, pos, last);
+		heap_sift_down(mix, pos);
+		heap_sift_up(mix, pos);
+	}
+
 	o->used = 0;
 	o->data = NULL;
+	o->heap_pos = mix->free_slot;
+	mix->free_slot = slot;
 
 	return 0;
 }
@@ -106,36 +189,21 @@ int buffer_share_rm_id(struct buffer_share *mix, unsigned int id)
 int buffer_share_offset_update(struct buffer_share *mix, unsigned int id,
 			       unsigned int delta)
 {
-	unsigned int i;
-
-	for (i = 0; i < mix->id_sz; i++) {
-		if (id != mix->wr_idx[i].id)
-			continue;
-
-		mix->wr_idx[i].offset += delta;
-		break;
-	}
-
+	buffer_share_slot_offset_update(mix, find_id(mix, id), delta);
 	return 0;
 }
 
 unsigned int buffer_share_get_new_write_point(struct buffer_share *mix)
 {
-	unsigned int min_written = mix->buf_sz + 1;
-	unsigned int i;
+	unsigned int min_written;
 
-	for (i = 0; i < mix->id_sz; i++) {
-		struct id_offset *o = &mix->wr_idx[i];
+	if (!mix->num_used)
+		return 0;
 
-		if (!o->used)
-			continue;
-
-		min_written = MIN(min_written, o->offset);
-	}
-	for (i = 0; i < mix->id_sz; i++) {
-		struct id_offset *o = &mix->wr_idx[i];
-		o->offset -= min_written;
-	}
+	/* Offsets are relative to the write point, moving it is enough to
+	 * take min_written off every user. */
+	min_written = heap_offset(mix, 0);
+	mix->write_point += min_written;
 
 	if (min_written > mix->buf_sz)
 		return 0;
@@ -143,29 +211,39 @@ unsigned int buffer_share_get_new_write_point(struct buffer_share *mix)
 	return min_written;
 }
 
-static struct id_offset *get_id_offset(const struct buffer_share *mix,
-				       unsigned int id)
+unsigned int buffer_share_id_offset(const struct buffer_share *mix,
+				    unsigned int id)
 {
-	unsigned int i;
-	struct id_offset *o;
+	return buffer_share_slot_offset(mix, find_id(mix, id));
+}
 
-	for (i = 0; i < mix->id_sz; i++) {
-		o = &mix->wr_idx[i];
-		if (o->used && o->id == id)
-			return o;
-	}
-	return NULL;
+void *buffer_share_get_data(const struct buffer_share *mix, unsigned int id)
+{
+	int slot = find_id(mix, id);
+	return slot >= 0 ? mix->wr_idx[slot].data : NULL;
 }
 
-unsigned int buffer_share_id_offset(const struct buffer_share *mix,
-				    unsigned int id)
+int buffer_share_id_slot(const struct buffer_share *mix, unsigned int id)
 {
-	struct id_offset *o = get_id_offset(mix, id);
-	return o ? o->offset : 0;
+	return find_id(mix, id);
 }
 
-void *buffer_share_get_data(const struct buffer_share *mix, unsigned int id)
+void buffer_share_slot_offset_update(struct buffer_share *mix, int slot,
+				     unsigned int frames)
 {
-	struct id_offset *o = get_id_offset(mix, id);
-	return o ? o->data : NULL;
+	struct id_offset *o;
+
+	if (slot < 0)
+		return;
+	o = &mix->wr_idx[slot];
+	o->written += frames;
+	heap_sift_down(mix, o->heap_pos);
+}
+
+unsigned int buffer_share_slot_offset(const struct buffer_share *mix,
+				      int slot)
+{
+	if (slot < 0)
+		return 0;
+	return mix->wr_idx[slot].written - mix->write_point;
 }
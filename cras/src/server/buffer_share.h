@@ -8,17 +8,45 @@
 
 #define INITIAL_ID_SIZE 3
 
+/*
+ * One user of the shared buffer. Entries live in a slab, an entry keeps its
+ * slot from add to rm so users can address it by slot.
+ * Members:
+ *    used - Non-zero if the slot holds a user.
+ *    id - The id of the user.
+ *    written - Frames written by the user, counted from the same origin as
+ *        the write point of the buffer_share.
+ *    data - The data pointer given when the user was added.
+ *    heap_pos - Position of the slot in the min heap when used, next free
+ *        slot otherwise.
+ */
 struct id_offset {
 	unsigned int used;
 	unsigned int id;
-	unsigned int offset;
+	unsigned int written;
 	void *data;
+	unsigned int heap_pos;
 };
 
+/*
+ * Members:
+ *    buf_sz - The size of the shared buffer.
+ *    id_sz - The number of slots in wr_idx.
+ *    wr_idx - The slab of users.
+ *    write_point - Frames written by all users, the origin of the offsets.
+ *    heap - Slots of the used entries, a min heap ordered by offset so the
+ *        new write point is read from heap[0].
+ *    num_used - The number of users, also the size of the heap.
+ *    free_slot - The first free slot, id_sz if the slab is full.
+ */
 struct buffer_share {
 	unsigned int buf_sz;
 	unsigned int id_sz;
 	struct id_offset *wr_idx;
+	unsigned int write_point;
+	unsigned int *heap;
+	unsigned int num_used;
+	unsigned int free_slot;
 };
 
 /*
@@ -58,4 +86,22 @@ unsigned int buffer_share_id_offset(const struct buffer_share *mix,
  */
 void *buffer_share_get_data(const struct buffer_share *mix, unsigned int id);
 
+/*
+ * Gets the slot holding the given id, valid until the id is removed. The slot
+ * functions below skip the id lookup for users that update every wake.
+ * Returns:
+ *    The slot, or -ENOENT if id isn't in the buffer_share.
+ */
+int buffer_share_id_slot(const struct buffer_share *mix, unsigned int id);
+
+/* Like buffer_share_offset_update for the user in slot. A negative slot is
+ * ignored. */
+void buffer_share_slot_offset_update(struct buffer_share *mix, int slot,
+				     unsigned int frames);
+
+/* Like buffer_share_id_offset for the user in slot. Returns 0 for a negative
+ * slot. */
+unsigned int buffer_share_slot_offset(const struct buffer_share *mix,
+				      int slot);
+
 #endif /* BUFFER_SHARE_H_ */
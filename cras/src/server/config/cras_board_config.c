@@ -14,6 +14,18 @@ static const int32_t AEC_SUPPORTED_DEFAULT = 0;
 static const int32_t AEC_GROUP_ID_DEFAULT = -1;
 static const int32_t BLUETOOTH_WBS_ENABLED_INI_DEFAULT = 1;
 static const int32_t BLUETOOTH_DEPRIORITIZE_WBS_MIC_INI_DEFAULT = 0;
+static const int32_t MIX_WORKER_THREADS_DEFAULT = 0;
+static const int32_t MIX_WORKER_MIN_STREAMS_DEFAULT = 8;
+static const int32_t UNCACHED_DMA_BUFFER_DEFAULT = 0;
+static const int32_t INPUT_WAKE_SLACK_US_DEFAULT = 1000;
+static const int32_t ADAPTIVE_BUFFER_MAX_MS_DEFAULT = 0;
+static const int32_t OUTPUT_STANDBY_MS_DEFAULT = 0;
+static const int32_t STREAM_RAMP_MS_DEFAULT = 5;
+static const int32_t NUM_AUDIO_THREADS_DEFAULT = 1;
+static const int32_t AUDIO_THREAD_CPU_MASK_DEFAULT = 0;
+static const int32_t LOCK_RT_MEMORY_DEFAULT = 0;
+static const int32_t SCHED_DEADLINE_DEFAULT = 0;
+static const int32_t DEEP_BUFFER_DEFAULT = 0;
 
 #define CONFIG_NAME "board.ini"
 #define DEFAULT_OUTPUT_BUF_SIZE_INI_KEY "output:default_output_buffer_size"
@@ -22,6 +34,18 @@ static const int32_t BLUETOOTH_DEPRIORITIZE_WBS_MIC_INI_DEFAULT = 0;
 #define BLUETOOTH_WBS_ENABLED_INI_KEY "bluetooth:wbs_enabled"
 #define BLUETOOTH_DEPRIORITIZE_WBS_MIC_INI_KEY "bluetooth:deprioritize_wbs_mic"
 #define UCM_IGNORE_SUFFIX_KEY "ucm:ignore_suffix"
+#define MIX_WORKER_THREADS_INI_KEY "output:mix_worker_threads"
+#define MIX_WORKER_MIN_STREAMS_INI_KEY "output:mix_worker_min_streams"
+#define UNCACHED_DMA_BUFFER_INI_KEY "output:uncached_dma_buffer"
+#define INPUT_WAKE_SLACK_US_INI_KEY "input:wake_slack_us"
+#define ADAPTIVE_BUFFER_MAX_MS_INI_KEY "output:adaptive_buffer_max_ms"
+#define OUTPUT_STANDBY_MS_INI_KEY "output:standby_ms"
+#define STREAM_RAMP_MS_INI_KEY "output:stream_ramp_ms"
+#define NUM_AUDIO_THREADS_INI_KEY "audio_thread:num_threads"
+#define AUDIO_THREAD_CPU_MASK_INI_KEY "audio_thread:cpu_mask_%u"
+#define LOCK_RT_MEMORY_INI_KEY "audio_thread:lock_memory"
+#define SCHED_DEADLINE_INI_KEY "audio_thread:sched_deadline"
+#define DEEP_BUFFER_INI_KEY "output:deep_buffer"
 
 void cras_board_config_get(const char *config_path,
 			   struct cras_board_config *board_config)
@@ -30,6 +54,7 @@ void cras_board_config_get(const char *config_path,
 	char ini_key[MAX_INI_KEY_LENGTH + 1];
 	const char *ptr;
 	dictionary *ini;
+	unsigned int i;
 
 	board_config->default_output_buffer_size = DEFAULT_OUTPUT_BUFFER_SIZE;
 	board_config->aec_supported = AEC_SUPPORTED_DEFAULT;
@@ -38,6 +63,20 @@ void cras_board_config_get(const char *config_path,
 	board_config->bt_wbs_enabled = BLUETOOTH_WBS_ENABLED_INI_DEFAULT;
 	board_config->deprioritize_bt_wbs_mic =
 		BLUETOOTH_DEPRIORITIZE_WBS_MIC_INI_DEFAULT;
+	board_config->mix_worker_threads = MIX_WORKER_THREADS_DEFAULT;
+	board_config->mix_worker_min_streams = MIX_WORKER_MIN_STREAMS_DEFAULT;
+	board_config->uncached_dma_buffer = UNCACHED_DMA_BUFFER_DEFAULT;
+	board_config->input_wake_slack_us = INPUT_WAKE_SLACK_US_DEFAULT;
+	board_config->adaptive_buffer_max_ms = ADAPTIVE_BUFFER_MAX_MS_DEFAULT;
+	board_config->output_standby_ms = OUTPUT_STANDBY_MS_DEFAULT;
+	board_config->stream_ramp_ms = STREAM_RAMP_MS_DEFAULT;
+	board_config->num_audio_threads = NUM_AUDIO_THREADS_DEFAULT;
+	for (i = 0; i < CRAS_MAX_AUDIO_THREADS; i++)
+		board_config->audio_thread_cpu_mask[i] =
+			AUDIO_THREAD_CPU_MASK_DEFAULT;
+	board_config->lock_rt_memory = LOCK_RT_MEMORY_DEFAULT;
+	board_config->sched_deadline = SCHED_DEADLINE_DEFAULT;
+	board_config->deep_buffer = DEEP_BUFFER_DEFAULT;
 	if (config_path == NULL)
 		return;
 
@@ -76,6 +115,69 @@ void cras_board_config_get(const char *config_path,
 	board_config->deprioritize_bt_wbs_mic = iniparser_getint(
 		ini, ini_key, BLUETOOTH_DEPRIORITIZE_WBS_MIC_INI_DEFAULT);
 
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, MIX_WORKER_THREADS_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->mix_worker_threads =
+		iniparser_getint(ini, ini_key, MIX_WORKER_THREADS_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, MIX_WORKER_MIN_STREAMS_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->mix_worker_min_streams =
+		iniparser_getint(ini, ini_key, MIX_WORKER_MIN_STREAMS_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, UNCACHED_DMA_BUFFER_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->uncached_dma_buffer =
+		iniparser_getint(ini, ini_key, UNCACHED_DMA_BUFFER_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, INPUT_WAKE_SLACK_US_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->input_wake_slack_us =
+		iniparser_getint(ini, ini_key, INPUT_WAKE_SLACK_US_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, ADAPTIVE_BUFFER_MAX_MS_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->adaptive_buffer_max_ms =
+		iniparser_getint(ini, ini_key, ADAPTIVE_BUFFER_MAX_MS_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, OUTPUT_STANDBY_MS_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->output_standby_ms =
+		iniparser_getint(ini, ini_key, OUTPUT_STANDBY_MS_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, STREAM_RAMP_MS_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->stream_ramp_ms =
+		iniparser_getint(ini, ini_key, STREAM_RAMP_MS_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, NUM_AUDIO_THREADS_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->num_audio_threads =
+		iniparser_getint(ini, ini_key, NUM_AUDIO_THREADS_DEFAULT);
+
+	for (i = 0; i < CRAS_MAX_AUDIO_THREADS; i++) {
+		snprintf(ini_key, MAX_INI_KEY_LENGTH,
+			 AUDIO_THREAD_CPU_MASK_INI_KEY, i);
+		ini_key[MAX_INI_KEY_LENGTH] = 0;
+		board_config->audio_thread_cpu_mask[i] = iniparser_getint(
+			ini, ini_key, AUDIO_THREAD_CPU_MASK_DEFAULT);
+	}
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, LOCK_RT_MEMORY_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->lock_rt_memory =
+		iniparser_getint(ini, ini_key, LOCK_RT_MEMORY_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, SCHED_DEADLINE_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->sched_deadline =
+		iniparser_getint(ini, ini_key, SCHED_DEADLINE_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, DEEP_BUFFER_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->deep_buffer =
+		iniparser_getint(ini, ini_key, DEEP_BUFFER_DEFAULT);
+
 	snprintf(ini_key, MAX_INI_KEY_LENGTH, UCM_IGNORE_SUFFIX_KEY);
 	ini_key[MAX_INI_KEY_LENGTH] = 0;
 	ptr = iniparser_getstring(ini, ini_key, "");
@@ -8,6 +8,8 @@
 
 #include <stdint.h>
 
+#include "cras_config.h"
+
 struct cras_board_config {
 	int32_t default_output_buffer_size;
 	int32_t aec_supported;
@@ -15,6 +17,18 @@ struct cras_board_config {
 	int32_t bt_wbs_enabled;
 	int32_t deprioritize_bt_wbs_mic;
 	char *ucm_ignore_suffix;
+	int32_t mix_worker_threads;
+	int32_t mix_worker_min_streams;
+	int32_t uncached_dma_buffer;
+	int32_t input_wake_slack_us;
+	int32_t adaptive_buffer_max_ms;
+	int32_t output_standby_ms;
+	int32_t stream_ramp_ms;
+	int32_t num_audio_threads;
+	int32_t audio_thread_cpu_mask[CRAS_MAX_AUDIO_THREADS];
+	int32_t lock_rt_memory;
+	int32_t sched_deadline;
+	int32_t deep_buffer;
 };
 
 /* Gets a configuration based on the config file specified.
@@ -5,6 +5,8 @@
 
 #include <syslog.h>
 
+#include "cras_audio_format.h"
+#include "cras_channel_matrix.h"
 #include "cras_util.h"
 #include "cras_volume_curve.h"
 #include "iniparser_wrapper.h"
@@ -50,6 +52,39 @@ create_explicit_curve(const struct cras_card_config *card_config,
 	return cras_volume_curve_create_explicit(dB_values);
 }
 
+/* Parses "<in>*<out>" coefficients separated by commas or spaces, one row of
+ * in values per output channel. Returns NULL if the count is wrong. */
+static struct cras_channel_matrix *
+parse_channel_matrix(const char *value, unsigned int num_in_ch,
+		     unsigned int num_out_ch)
+{
+	float mtx[CRAS_CH_MAX][CRAS_CH_MAX];
+	float *rows[CRAS_CH_MAX];
+	unsigned int n = 0;
+	const char *p = value;
+	char *end;
+	float coef;
+
+	for (;;) {
+		while (*p == ',' || *p == ' ' || *p == '\t')
+			p++;
+		if (*p == '\0')
+			break;
+		coef = strtof(p, &end);
+		if (end == p || n == num_in_ch * num_out_ch)
+			return NULL;
+		mtx[n / num_in_ch][n % num_in_ch] = coef;
+		n++;
+		p = end;
+	}
+	if (n != num_in_ch * num_out_ch)
+		return NULL;
+
+	for (n = 0; n < num_out_ch; n++)
+		rows[n] = mtx[n];
+	return cras_channel_matrix_create(rows, num_in_ch, num_out_ch);
+}
+
 /*
  * Exported interface.
  */
@@ -108,3 +143,38 @@ struct cras_volume_curve *cras_card_config_get_volume_curve_for_control(
 	syslog(LOG_DEBUG, "No configure curve found for %s.", control_name);
 	return NULL;
 }
+
+struct cras_channel_matrix *
+cras_card_config_get_channel_matrices(const struct cras_card_config *card_config,
+				      const char *node_name)
+{
+	char ini_key[MAX_INI_KEY_LENGTH + 1];
+	struct cras_channel_matrix *list = NULL, *m;
+	unsigned int in, out;
+	const char *value;
+
+	if (card_config == NULL || node_name == NULL)
+		return NULL;
+
+	for (in = 1; in <= CRAS_CH_MAX; in++) {
+		for (out = 1; out <= CRAS_CH_MAX; out++) {
+			snprintf(ini_key, MAX_INI_KEY_LENGTH,
+				 "%s:channel_matrix_%u_%u", node_name, in, out);
+			ini_key[MAX_INI_KEY_LENGTH] = 0;
+			value = iniparser_getstring(card_config->ini, ini_key,
+						    NULL);
+			if (value == NULL)
+				continue;
+			m = parse_channel_matrix(value, in, out);
+			if (m == NULL) {
+				syslog(LOG_ERR, "Invalid %s, need %u values.",
+				       ini_key, in * out);
+				continue;
+			}
+			syslog(LOG_INFO, "Channel matrix %u to %u for %s.", in,
+			       out, node_name);
+			DL_APPEND(list, m);
+		}
+	}
+	return list;
+}
@@ -7,6 +7,7 @@
 #define CRAS_CARD_CONFIG_H_
 
 struct cras_card_config;
+struct cras_channel_matrix;
 struct cras_volume_curve;
 
 /* Creates a configuration based on the config file specified.
@@ -34,4 +35,19 @@ void cras_card_config_destroy(struct cras_card_config *card_config);
 struct cras_volume_curve *cras_card_config_get_volume_curve_for_control(
 	const struct cras_card_config *card_config, const char *control_name);
 
+/* Returns the channel conversion matrices configured for a node. A matrix
+ * from <in> to <out> channels is set by the key
+ * "<node_name>:channel_matrix_<in>_<out>" holding in * out coefficients, the
+ * in coefficients of the first output channel first.
+ * Args:
+ *    card_config - Card configuration returned by cras_card_config_create()
+ *    node_name - Name of the node, the section of its keys.
+ * Returns:
+ *    A list of matrices, NULL if there is none. Free with
+ *    cras_channel_matrix_destroy_list().
+ */
+struct cras_channel_matrix *
+cras_card_config_get_channel_matrices(const struct cras_card_config *card_config,
+				      const char *node_name);
+
 #endif /* CRAS_CARD_CONFIG_H_ */
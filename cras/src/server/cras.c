@@ -5,25 +5,38 @@
 
 #define _GNU_SOURCE /* for asprintf */
 #include <getopt.h>
+#include <netdb.h>
 #include <signal.h>
 #include <stdio.h>
 #include <syslog.h>
 
+#include "audio_thread_log.h"
 #include "cras_alsa_plugin_io.h"
 #include "cras_apm_list.h"
 #include "cras_config.h"
+#include "cras_file_iodev.h"
+#include "cras_iodev.h"
 #include "cras_iodev_list.h"
+#include "cras_rtp_iodev.h"
 #include "cras_server.h"
 #include "cras_shm.h"
+#include "cras_startup_log.h"
 #include "cras_system_state.h"
 #include "cras_dsp.h"
+#include "cras_virtual_clock.h"
 
 static struct option long_options[] = {
 	{ "dsp_config", required_argument, 0, 'd' },
+	{ "dsp_cache", required_argument, 0, 'C' },
 	{ "syslog_mask", required_argument, 0, 'l' },
 	{ "device_config_dir", required_argument, 0, 'c' },
 	{ "disable_profile", required_argument, 0, 'D' },
 	{ "internal_ucm_suffix", required_argument, 0, 'u' },
+	{ "offline_output", required_argument, 0, 'o' },
+	{ "offline_input", required_argument, 0, 'i' },
+	{ "rtp_output", required_argument, 0, 'r' },
+	{ "rtp_input", required_argument, 0, 'R' },
+	{ "record_workload", no_argument, 0, 'w' },
 	{ 0, 0, 0, 0 }
 };
 
@@ -34,16 +47,70 @@ static void set_signals()
 	signal(SIGCHLD, SIG_IGN);
 }
 
+/* Creates a file device for offline rendering and selects its node. */
+static void select_offline_dev(enum CRAS_STREAM_DIRECTION direction,
+			       const char *path)
+{
+	struct cras_iodev *iodev;
+
+	iodev = file_iodev_create(direction, path);
+	if (!iodev) {
+		fprintf(stderr, "Failed to open offline device %s\n", path);
+		exit(-1);
+	}
+	cras_iodev_list_select_node(direction,
+				    cras_make_node_id(iodev->info.idx, 0));
+}
+
+/* Creates an RTP device sending to or receiving on addr, given as a numeric
+ * "host:port". */
+static void add_rtp_dev(enum CRAS_STREAM_DIRECTION direction, const char *addr)
+{
+	struct addrinfo hints = {
+		.ai_socktype = SOCK_DGRAM,
+		.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV,
+	};
+	struct addrinfo *res;
+	const char *port;
+	char *host;
+	int rc;
+
+	port = strrchr(addr, ':');
+	if (!port) {
+		fprintf(stderr, "RTP address %s has no port\n", addr);
+		exit(-1);
+	}
+	host = strndup(addr, port - addr);
+	rc = getaddrinfo(host, port + 1, &hints, &res);
+	free(host);
+	if (rc) {
+		fprintf(stderr, "Bad RTP address %s: %s\n", addr,
+			gai_strerror(rc));
+		exit(-1);
+	}
+	if (!rtp_iodev_create(direction, res->ai_addr, res->ai_addrlen)) {
+		fprintf(stderr, "Failed to create RTP device %s\n", addr);
+		exit(-1);
+	}
+	freeaddrinfo(res);
+}
+
 /* Entry point for the server. */
 int main(int argc, char **argv)
 {
 	int c, option_index;
+	int phase;
 	int log_mask = LOG_WARNING;
 	const char default_dsp_config[] = CRAS_CONFIG_FILE_DIR "/dsp.ini";
 	const char *dsp_config = default_dsp_config;
+	char *dsp_cache = NULL;
 	const char *device_config_dir = CRAS_CONFIG_FILE_DIR;
 	const char *internal_ucm_suffix = NULL;
 	unsigned int profile_disable_mask = 0;
+	const char *offline_output = NULL;
+	const char *offline_input = NULL;
+	const char *rtp_output = NULL;
+	const char *rtp_input = NULL;
 
 	set_signals();
 
@@ -70,6 +137,11 @@ int main(int argc, char **argv)
 		case 'd':
 			dsp_config = optarg;
 			break;
+		/* An empty --dsp_cache disables caching the dsp ini. */
+		case 'C':
+			free(dsp_cache);
+			dsp_cache = strdup(optarg);
+			break;
 		/* --disable_profile option takes list of profile names separated by ',' */
 		case 'D':
 			while ((optarg != NULL) && (*optarg != 0)) {
@@ -95,6 +167,27 @@ int main(int argc, char **argv)
 			if (*optarg != 0)
 				internal_ucm_suffix = optarg;
 			break;
+		/* Offline rendering plays to and captures from raw files on a
+		 * virtual clock, as fast as the streams keep up. */
+		case 'o':
+			offline_output = optarg;
+			break;
+		case 'i':
+			offline_input = optarg;
+			break;
+		/* Network devices streaming RTP to a remote sink and from a
+		 * remote source, they are selected like any other device. */
+		case 'r':
+			rtp_output = optarg;
+			break;
+		case 'R':
+			rtp_input = optarg;
+			break;
+		/* Logs what cras_test_client --record_workload needs to
+		 * replay the streams and devices later. */
+		case 'w':
+			atlog_workload = 1;
+			break;
 		default:
 			break;
 		}
@@ -119,8 +212,13 @@ int main(int argc, char **argv)
 	}
 	setlogmask(LOG_UPTO(log_mask));
 
+	if (offline_output || offline_input)
+		cras_virtual_clock_enable();
+
 	/* Initialize system. */
+	phase = cras_startup_log_begin(STARTUP_SERVER_INIT, 0, 0);
 	cras_server_init();
+	cras_startup_log_end(phase);
 	char *shm_name;
 	if (asprintf(&shm_name, "/cras-%d", getpid()) < 0)
 		exit(-1);
@@ -131,15 +229,38 @@ int main(int argc, char **argv)
 			shm_name, sizeof(*exp_state), &rw_shm_fd, &ro_shm_fd);
 	if (!exp_state)
 		exit(-1);
+	phase = cras_startup_log_begin(STARTUP_SYSTEM_STATE_INIT, 0, 0);
 	cras_system_state_init(device_config_dir, shm_name, rw_shm_fd,
 			       ro_shm_fd, exp_state, sizeof(*exp_state));
+	cras_startup_log_end(phase);
 	free(shm_name);
 	if (internal_ucm_suffix)
 		cras_system_state_set_internal_ucm_suffix(internal_ucm_suffix);
-	cras_dsp_init(dsp_config);
+	/* The runtime dir outlives crash restarts, but not reboots. */
+	if (dsp_cache == NULL &&
+	    asprintf(&dsp_cache, "%s/dsp.ini.cache",
+		     cras_config_get_system_socket_file_dir()) < 0)
+		dsp_cache = NULL;
+	phase = cras_startup_log_begin(STARTUP_DSP_INIT, 0, 0);
+	cras_dsp_init(dsp_config,
+		      (dsp_cache && *dsp_cache) ? dsp_cache : NULL);
+	cras_startup_log_end(phase);
+	free(dsp_cache);
+	phase = cras_startup_log_begin(STARTUP_APM_LIST_INIT, 0, 0);
 	cras_apm_list_init(device_config_dir);
+	cras_startup_log_end(phase);
+	phase = cras_startup_log_begin(STARTUP_IODEV_LIST_INIT, 0, 0);
 	cras_iodev_list_init();
+	cras_startup_log_end(phase);
 	cras_alsa_plugin_io_init(device_config_dir);
+	if (offline_output)
+		select_offline_dev(CRAS_STREAM_OUTPUT, offline_output);
+	if (offline_input)
+		select_offline_dev(CRAS_STREAM_INPUT, offline_input);
+	if (rtp_output)
+		add_rtp_dev(CRAS_STREAM_OUTPUT, rtp_output);
+	if (rtp_input)
+		add_rtp_dev(CRAS_STREAM_INPUT, rtp_input);
 
 	/* Start the server. */
 	return cras_server_run(profile_disable_mask);
@@ -0,0 +1,298 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <sbc/sbc.h>
+#include <syslog.h>
+
+#include "cras_a2dp_codec.h"
+#include "cras_a2dp_info.h"
+#include "cras_sbc_codec.h"
+#include "rtp.h"
+
+static int sbc_get_capabilities(void *caps, int *len)
+{
+	a2dp_sbc_t *sbc_caps = caps;
+
+	if (*len < sizeof(*sbc_caps))
+		return -ENOSPC;
+
+	*len = sizeof(*sbc_caps);
+
+	/* Return all capabilities. */
+	sbc_caps->channel_mode =
+		SBC_CHANNEL_MODE_MONO | SBC_CHANNEL_MODE_DUAL_CHANNEL |
+		SBC_CHANNEL_MODE_STEREO | SBC_CHANNEL_MODE_JOINT_STEREO;
+	sbc_caps->frequency = SBC_SAMPLING_FREQ_16000 |
+			      SBC_SAMPLING_FREQ_32000 |
+			      SBC_SAMPLING_FREQ_44100 | SBC_SAMPLING_FREQ_48000;
+	sbc_caps->allocation_method =
+		SBC_ALLOCATION_SNR | SBC_ALLOCATION_LOUDNESS;
+	sbc_caps->subbands = SBC_SUBBANDS_4 | SBC_SUBBANDS_8;
+	sbc_caps->block_length = SBC_BLOCK_LENGTH_4 | SBC_BLOCK_LENGTH_8 |
+				 SBC_BLOCK_LENGTH_12 | SBC_BLOCK_LENGTH_16;
+	sbc_caps->min_bitpool = MIN_BITPOOL;
+	sbc_caps->max_bitpool = MAX_BITPOOL;
+
+	return 0;
+}
+
+static int sbc_select_configuration(const void *caps, int len, void *config)
+{
+	const a2dp_sbc_t *sbc_caps = caps;
+	a2dp_sbc_t *sbc_config = config;
+
+	if (len < sizeof(*sbc_caps))
+		return -EINVAL;
+
+	/* Pick the highest configuration. */
+	if (sbc_caps->channel_mode & SBC_CHANNEL_MODE_JOINT_STEREO) {
+		sbc_config->channel_mode = SBC_CHANNEL_MODE_JOINT_STEREO;
+	} else if (sbc_caps->channel_mode & SBC_CHANNEL_MODE_STEREO) {
+		sbc_config->channel_mode = SBC_CHANNEL_MODE_STEREO;
+	} else if (sbc_caps->channel_mode & SBC_CHANNEL_MODE_DUAL_CHANNEL) {
+		sbc_config->channel_mode = SBC_CHANNEL_MODE_DUAL_CHANNEL;
+	} else if (sbc_caps->channel_mode & SBC_CHANNEL_MODE_MONO) {
+		sbc_config->channel_mode = SBC_CHANNEL_MODE_MONO;
+	} else {
+		syslog(LOG_WARNING, "No supported channel modes.");
+		return -ENOSYS;
+	}
+
+	if (sbc_caps->frequency & SBC_SAMPLING_FREQ_48000) {
+		sbc_config->frequency = SBC_SAMPLING_FREQ_48000;
+	} else if (sbc_caps->frequency & SBC_SAMPLING_FREQ_44100) {
+		sbc_config->frequency = SBC_SAMPLING_FREQ_44100;
+	} else if (sbc_caps->frequency & SBC_SAMPLING_FREQ_32000) {
+		sbc_config->frequency = SBC_SAMPLING_FREQ_32000;
+	} else if (sbc_caps->frequency & SBC_SAMPLING_FREQ_16000) {
+		sbc_config->frequency = SBC_SAMPLING_FREQ_16000;
+	} else {
+		syslog(LOG_WARNING, "No supported sampling frequencies.");
+		return -ENOSYS;
+	}
+
+	if (sbc_caps->allocation_method & SBC_ALLOCATION_LOUDNESS) {
+		sbc_config->allocation_method = SBC_ALLOCATION_LOUDNESS;
+	} else if (sbc_caps->allocation_method & SBC_ALLOCATION_SNR) {
+		sbc_config->allocation_method = SBC_ALLOCATION_SNR;
+	} else {
+		syslog(LOG_WARNING, "No supported allocation method.");
+		return -ENOSYS;
+	}
+
+	if (sbc_caps->subbands & SBC_SUBBANDS_8) {
+		sbc_config->subbands = SBC_SUBBANDS_8;
+	} else if (sbc_caps->subbands & SBC_SUBBANDS_4) {
+		sbc_config->subbands = SBC_SUBBANDS_4;
+	} else {
+		syslog(LOG_WARNING, "No supported subbands.");
+		return -ENOSYS;
+	}
+
+	if (sbc_caps->block_length & SBC_BLOCK_LENGTH_16) {
+		sbc_config->block_length = SBC_BLOCK_LENGTH_16;
+	} else if (sbc_caps->block_length & SBC_BLOCK_LENGTH_12) {
+		sbc_config->block_length = SBC_BLOCK_LENGTH_12;
+	} else if (sbc_caps->block_length & SBC_BLOCK_LENGTH_8) {
+		sbc_config->block_length = SBC_BLOCK_LENGTH_8;
+	} else if (sbc_caps->block_length & SBC_BLOCK_LENGTH_4) {
+		sbc_config->block_length = SBC_BLOCK_LENGTH_4;
+	} else {
+		syslog(LOG_WARNING, "No supported block length.");
+		return -ENOSYS;
+	}
+
+	sbc_config->min_bitpool =
+		(sbc_caps->min_bitpool > MIN_BITPOOL ? sbc_caps->min_bitpool :
+						       MIN_BITPOOL);
+	sbc_config->max_bitpool =
+		(sbc_caps->max_bitpool < MAX_BITPOOL ? sbc_caps->max_bitpool :
+						       MAX_BITPOOL);
+
+	return sizeof(*sbc_config);
+}
+
+static int sbc_get_format(const void *config, int len, size_t *rate,
+			  size_t *num_channels)
+{
+	const a2dp_sbc_t *sbc = config;
+
+	if (len < sizeof(*sbc))
+		return -EINVAL;
+
+	*num_channels = (sbc->channel_mode == SBC_CHANNEL_MODE_MONO) ? 1 : 2;
+
+	if (sbc->frequency & SBC_SAMPLING_FREQ_48000)
+		*rate = 48000;
+	else if (sbc->frequency & SBC_SAMPLING_FREQ_44100)
+		*rate = 44100;
+	else if (sbc->frequency & SBC_SAMPLING_FREQ_32000)
+		*rate = 32000;
+	else if (sbc->frequency & SBC_SAMPLING_FREQ_16000)
+		*rate = 16000;
+	else
+		*rate = 0;
+
+	return 0;
+}
+
+static int sbc_init(struct a2dp_info *a2dp, const void *config, int len)
+{
+	const a2dp_sbc_t *sbc = config;
+	uint8_t frequency = 0, mode = 0, subbands = 0, allocation, blocks = 0,
+		bitpool;
+
+	if (len < sizeof(*sbc))
+		return -EINVAL;
+
+	if (sbc->frequency & SBC_SAMPLING_FREQ_48000)
+		frequency = SBC_FREQ_48000;
+	else if (sbc->frequency & SBC_SAMPLING_FREQ_44100)
+		frequency = SBC_FREQ_44100;
+	else if (sbc->frequency & SBC_SAMPLING_FREQ_32000)
+		frequency = SBC_FREQ_32000;
+	else if (sbc->frequency & SBC_SAMPLING_FREQ_16000)
+		frequency = SBC_FREQ_16000;
+
+	if (sbc->channel_mode & SBC_CHANNEL_MODE_JOINT_STEREO)
+		mode = SBC_MODE_JOINT_STEREO;
+	else if (sbc->channel_mode & SBC_CHANNEL_MODE_STEREO)
+		mode = SBC_MODE_STEREO;
+	else if (sbc->channel_mode & SBC_CHANNEL_MODE_DUAL_CHANNEL)
+		mode = SBC_MODE_DUAL_CHANNEL;
+	else if (sbc->channel_mode & SBC_CHANNEL_MODE_MONO)
+		mode = SBC_MODE_MONO;
+
+	if (sbc->allocation_method & SBC_ALLOCATION_LOUDNESS)
+		allocation = SBC_AM_LOUDNESS;
+	else
+		allocation = SBC_AM_SNR;
+
+	switch (sbc->subbands) {
+	case SBC_SUBBANDS_4:
+		subbands = SBC_SB_4;
+		break;
+	case SBC_SUBBANDS_8:
+		subbands = SBC_SB_8;
+		break;
+	}
+
+	switch (sbc->block_length) {
+	case SBC_BLOCK_LENGTH_4:
+		blocks = SBC_BLK_4;
+		break;
+	case SBC_BLOCK_LENGTH_8:
+		blocks = SBC_BLK_8;
+		break;
+	case SBC_BLOCK_LENGTH_12:
+		blocks = SBC_BLK_12;
+		break;
+	case SBC_BLOCK_LENGTH_16:
+		blocks = SBC_BLK_16;
+		break;
+	}
+
+	bitpool = sbc->max_bitpool;
+
+	a2dp->codec = cras_sbc_codec_create(frequency, mode, subbands,
+					    allocation, blocks, bitpool);
+	if (!a2dp->codec)
+		return -ENOMEM;
+
+	a2dp->codesize = cras_sbc_get_codesize(a2dp->codec);
+	a2dp->frame_length = cras_sbc_get_frame_length(a2dp->codec);
+	a2dp->bitpool = bitpool;
+	a2dp->min_bitpool = sbc->min_bitpool;
+	a2dp->max_bitpool = bitpool;
+
+	return 0;
+}
+
+static void sbc_destroy(struct a2dp_info *a2dp)
+{
+	cras_sbc_codec_destroy(a2dp->codec);
+}
+
+static void sbc_set_bitpool(struct a2dp_info *a2dp, int bitpool)
+{
+	cras_sbc_set_bitpool(a2dp->codec, bitpool);
+	a2dp->frame_length = cras_sbc_get_frame_length(a2dp->codec);
+}
+
+static void sbc_fill_payload_header(uint8_t *header, int frame_count)
+{
+	struct rtp_payload *payload = (struct rtp_payload *)header;
+
+	payload->frame_count = frame_count;
+}
+
+static const struct cras_a2dp_codec sbc_codec = {
+	.id = A2DP_CODEC_SBC,
+	.name = "SBC",
+	.payload_type = 1,
+	.payload_header_len = sizeof(struct rtp_payload),
+	/* The frame count in the payload header is 4 bits. */
+	.max_frames_per_packet = 15,
+	.get_capabilities = sbc_get_capabilities,
+	.select_configuration = sbc_select_configuration,
+	.get_format = sbc_get_format,
+	.init = sbc_init,
+	.destroy = sbc_destroy,
+	.fill_payload_header = sbc_fill_payload_header,
+	.set_bitpool = sbc_set_bitpool,
+};
+
+static const struct cras_a2dp_codec *codecs[CRAS_A2DP_MAX_CODECS] = {
+	&sbc_codec,
+};
+static unsigned int num_codecs = 1;
+
+int cras_a2dp_codec_register(const struct cras_a2dp_codec *codec)
+{
+	if (cras_a2dp_codec_get(codec->id))
+		return -EEXIST;
+	if (num_codecs == CRAS_A2DP_MAX_CODECS)
+		return -ENOSPC;
+
+	codecs[num_codecs++] = codec;
+	return 0;
+}
+
+void cras_a2dp_codec_unregister(const struct cras_a2dp_codec *codec)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_codecs; i++) {
+		if (codecs[i] != codec)
+			continue;
+		for (; i + 1 < num_codecs; i++)
+			codecs[i] = codecs[i + 1];
+		num_codecs--;
+		return;
+	}
+}
+
+unsigned int cras_a2dp_codec_count()
+{
+	return num_codecs;
+}
+
+const struct cras_a2dp_codec *cras_a2dp_codec_at(unsigned int index)
+{
+	if (index >= num_codecs)
+		return NULL;
+	return codecs[index];
+}
+
+const struct cras_a2dp_codec *cras_a2dp_codec_get(uint8_t id)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_codecs; i++)
+		if (codecs[i]->id == id)
+			return codecs[i];
+	return NULL;
+}
@@ -0,0 +1,88 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_A2DP_CODEC_H_
+#define CRAS_A2DP_CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct a2dp_info;
+
+/* Maximum number of A2DP codecs that can be registered. */
+#define CRAS_A2DP_MAX_CODECS 4
+
+/* Maximum size in bytes of the capabilities or configuration of a codec. */
+#define A2DP_MAX_CONFIG_LEN 16
+
+/* An A2DP codec. Each registered codec is exposed to BlueZ as one A2DP source
+ * endpoint, and is used to packetize the audio of the transports configured
+ * through it.
+ * Members:
+ *    id - The A2DP_CODEC_* type of the codec.
+ *    name - Short name, used in the endpoint object path and in logs.
+ *    payload_type - RTP payload type of the media packets.
+ *    payload_header_len - Size of the media payload header which follows the
+ *        RTP header, 0 if the codec has none.
+ *    max_frames_per_packet - Maximum number of encoded frames sent in one
+ *        media packet, 0 to pack as many as the MTU allows.
+ *    get_capabilities - Fills caps with all the capabilities we support.
+ *        len holds the size of caps and is set to the size used. Returns 0
+ *        on success or a negative error code.
+ *    select_configuration - Picks the configuration to use from the
+ *        capabilities of the remote device. Returns the size of config, or
+ *        a negative error code if no configuration is supported.
+ *    get_format - Gets the rate and the number of channels of config.
+ *        Returns 0 on success or a negative error code.
+ *    init - Creates a2dp->codec for config and fills in a2dp->codesize and
+ *        a2dp->frame_length, and the bitpool range if the codec has one.
+ *        Returns 0 on success or a negative error code.
+ *    destroy - Destroys the codec created by init.
+ *    fill_payload_header - Writes the media payload header of a packet of
+ *        frame_count frames. Only called if payload_header_len is not 0.
+ *    set_bitpool - Changes the bitpool of a2dp->codec and updates
+ *        a2dp->frame_length. NULL if the codec has no bitpool.
+ */
+struct cras_a2dp_codec {
+	uint8_t id;
+	const char *name;
+	uint8_t payload_type;
+	int payload_header_len;
+	int max_frames_per_packet;
+	int (*get_capabilities)(void *caps, int *len);
+	int (*select_configuration)(const void *caps, int len, void *config);
+	int (*get_format)(const void *config, int len, size_t *rate,
+			  size_t *num_channels);
+	int (*init)(struct a2dp_info *a2dp, const void *config, int len);
+	void (*destroy)(struct a2dp_info *a2dp);
+	void (*fill_payload_header)(uint8_t *header, int frame_count);
+	void (*set_bitpool)(struct a2dp_info *a2dp, int bitpool);
+};
+
+/* Adds a codec to the registry. SBC, which every A2DP device must support, is
+ * always registered first.
+ * Args:
+ *    codec - The codec to add, must stay valid while registered.
+ * Returns:
+ *    0 on success, -EEXIST if a codec of the same id is registered, or
+ *    -ENOSPC if CRAS_A2DP_MAX_CODECS codecs are already registered.
+ */
+int cras_a2dp_codec_register(const struct cras_a2dp_codec *codec);
+
+/* Removes a codec from the registry. */
+void cras_a2dp_codec_unregister(const struct cras_a2dp_codec *codec);
+
+/* Gets the number of registered codecs. */
+unsigned int cras_a2dp_codec_count();
+
+/* Gets the registered codec at index, in registration order. Returns NULL if
+ * index is out of range. */
+const struct cras_a2dp_codec *cras_a2dp_codec_at(unsigned int index);
+
+/* Gets the registered codec of the given A2DP_CODEC_* id, or NULL if there is
+ * none. */
+const struct cras_a2dp_codec *cras_a2dp_codec_get(uint8_t id);
+
+#endif /* CRAS_A2DP_CODEC_H_ */
@@ -5,9 +5,12 @@
 
 #include <errno.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include <syslog.h>
 
 #include "a2dp-codecs.h"
+#include "cras_a2dp_codec.h"
 #include "cras_a2dp_endpoint.h"
 #include "cras_a2dp_iodev.h"
 #include "cras_iodev.h"
@@ -26,107 +29,39 @@ static struct a2dp {
 	struct cras_bt_device *device;
 } connected_a2dp;
 
+/* An A2DP source endpoint exposing one registered codec.
+ * Members:
+ *    base - The endpoint registered to BlueZ.
+ *    codec - The codec this endpoint negotiates.
+ *    object_path - Storage of base.object_path.
+ */
+struct a2dp_endpoint {
+	struct cras_bt_endpoint base;
+	const struct cras_a2dp_codec *codec;
+	char object_path[64];
+};
+
+static struct a2dp_endpoint a2dp_endpoints[CRAS_A2DP_MAX_CODECS];
+static unsigned int num_a2dp_endpoints;
+
+static const struct cras_a2dp_codec *
+endpoint_codec(struct cras_bt_endpoint *endpoint)
+{
+	return ((struct a2dp_endpoint *)endpoint)->codec;
+}
+
 static int cras_a2dp_get_capabilities(struct cras_bt_endpoint *endpoint,
 				      void *capabilities, int *len)
 {
-	a2dp_sbc_t *sbc_caps = capabilities;
-
-	if (*len < sizeof(*sbc_caps))
-		return -ENOSPC;
-
-	*len = sizeof(*sbc_caps);
-
-	/* Return all capabilities. */
-	sbc_caps->channel_mode =
-		SBC_CHANNEL_MODE_MONO | SBC_CHANNEL_MODE_DUAL_CHANNEL |
-		SBC_CHANNEL_MODE_STEREO | SBC_CHANNEL_MODE_JOINT_STEREO;
-	sbc_caps->frequency = SBC_SAMPLING_FREQ_16000 |
-			      SBC_SAMPLING_FREQ_32000 |
-			      SBC_SAMPLING_FREQ_44100 | SBC_SAMPLING_FREQ_48000;
-	sbc_caps->allocation_method =
-		SBC_ALLOCATION_SNR | SBC_ALLOCATION_LOUDNESS;
-	sbc_caps->subbands = SBC_SUBBANDS_4 | SBC_SUBBANDS_8;
-	sbc_caps->block_length = SBC_BLOCK_LENGTH_4 | SBC_BLOCK_LENGTH_8 |
-				 SBC_BLOCK_LENGTH_12 | SBC_BLOCK_LENGTH_16;
-	sbc_caps->min_bitpool = MIN_BITPOOL;
-	sbc_caps->max_bitpool = MAX_BITPOOL;
-
-	return 0;
+	return endpoint_codec(endpoint)->get_capabilities(capabilities, len);
 }
 
 static int cras_a2dp_select_configuration(struct cras_bt_endpoint *endpoint,
 					  void *capabilities, int len,
 					  void *configuration)
 {
-	a2dp_sbc_t *sbc_caps = capabilities;
-	a2dp_sbc_t *sbc_config = configuration;
-
-	/* Pick the highest configuration. */
-	if (sbc_caps->channel_mode & SBC_CHANNEL_MODE_JOINT_STEREO) {
-		sbc_config->channel_mode = SBC_CHANNEL_MODE_JOINT_STEREO;
-	} else if (sbc_caps->channel_mode & SBC_CHANNEL_MODE_STEREO) {
-		sbc_config->channel_mode = SBC_CHANNEL_MODE_STEREO;
-	} else if (sbc_caps->channel_mode & SBC_CHANNEL_MODE_DUAL_CHANNEL) {
-		sbc_config->channel_mode = SBC_CHANNEL_MODE_DUAL_CHANNEL;
-	} else if (sbc_caps->channel_mode & SBC_CHANNEL_MODE_MONO) {
-		sbc_config->channel_mode = SBC_CHANNEL_MODE_MONO;
-	} else {
-		syslog(LOG_WARNING, "No supported channel modes.");
-		return -ENOSYS;
-	}
-
-	if (sbc_caps->frequency & SBC_SAMPLING_FREQ_48000) {
-		sbc_config->frequency = SBC_SAMPLING_FREQ_48000;
-	} else if (sbc_caps->frequency & SBC_SAMPLING_FREQ_44100) {
-		sbc_config->frequency = SBC_SAMPLING_FREQ_44100;
-	} else if (sbc_caps->frequency & SBC_SAMPLING_FREQ_32000) {
-		sbc_config->frequency = SBC_SAMPLING_FREQ_32000;
-	} else if (sbc_caps->frequency & SBC_SAMPLING_FREQ_16000) {
-		sbc_config->frequency = SBC_SAMPLING_FREQ_16000;
-	} else {
-		syslog(LOG_WARNING, "No supported sampling frequencies.");
-		return -ENOSYS;
-	}
-
-	if (sbc_caps->allocation_method & SBC_ALLOCATION_LOUDNESS) {
-		sbc_config->allocation_method = SBC_ALLOCATION_LOUDNESS;
-	} else if (sbc_caps->allocation_method & SBC_ALLOCATION_SNR) {
-		sbc_config->allocation_method = SBC_ALLOCATION_SNR;
-	} else {
-		syslog(LOG_WARNING, "No supported allocation method.");
-		return -ENOSYS;
-	}
-
-	if (sbc_caps->subbands & SBC_SUBBANDS_8) {
-		sbc_config->subbands = SBC_SUBBANDS_8;
-	} else if (sbc_caps->subbands & SBC_SUBBANDS_4) {
-		sbc_config->subbands = SBC_SUBBANDS_4;
-	} else {
-		syslog(LOG_WARNING, "No supported subbands.");
-		return -ENOSYS;
-	}
-
-	if (sbc_caps->block_length & SBC_BLOCK_LENGTH_16) {
-		sbc_config->block_length = SBC_BLOCK_LENGTH_16;
-	} else if (sbc_caps->block_length & SBC_BLOCK_LENGTH_12) {
-		sbc_config->block_length = SBC_BLOCK_LENGTH_12;
-	} else if (sbc_caps->block_length & SBC_BLOCK_LENGTH_8) {
-		sbc_config->block_length = SBC_BLOCK_LENGTH_8;
-	} else if (sbc_caps->block_length & SBC_BLOCK_LENGTH_4) {
-		sbc_config->block_length = SBC_BLOCK_LENGTH_4;
-	} else {
-		syslog(LOG_WARNING, "No supported block length.");
-		return -ENOSYS;
-	}
-
-	sbc_config->min_bitpool =
-		(sbc_caps->min_bitpool > MIN_BITPOOL ? sbc_caps->min_bitpool :
-						       MIN_BITPOOL);
-	sbc_config->max_bitpool =
-		(sbc_caps->max_bitpool < MAX_BITPOOL ? sbc_caps->max_bitpool :
-						       MAX_BITPOOL);
-
-	return 0;
+	return endpoint_codec(endpoint)->select_configuration(capabilities, len,
+							      configuration);
 }
 
 static void cras_a2dp_set_configuration(struct cras_bt_endpoint *endpoint,
@@ -162,34 +97,83 @@ static void a2dp_transport_state_changed(struct cras_bt_endpoint *endpoint,
 	}
 }
 
-static struct cras_bt_endpoint cras_a2dp_endpoint = {
-	/* BlueZ connects the device A2DP Sink to our A2DP Source endpoint,
-	 * and the device A2DP Source to our A2DP Sink. It's best if you don't
-	 * think about it too hard.
-	 */
-	.object_path = A2DP_SOURCE_ENDPOINT_PATH,
-	.uuid = A2DP_SOURCE_UUID,
-	.codec = A2DP_CODEC_SBC,
-
-	.get_capabilities = cras_a2dp_get_capabilities,
-	.select_configuration = cras_a2dp_select_configuration,
-	.set_configuration = cras_a2dp_set_configuration,
-	.suspend = cras_a2dp_suspend,
-	.transport_state_changed = a2dp_transport_state_changed
-};
-
 int cras_a2dp_endpoint_create(DBusConnection *conn)
 {
-	return cras_bt_endpoint_add(conn, &cras_a2dp_endpoint);
+	struct a2dp_endpoint *a2dp_endpoint;
+	const struct cras_a2dp_codec *codec;
+	unsigned int i;
+	int rc;
+
+	/* Add one endpoint per registered codec, BlueZ negotiates the codec
+	 * by picking one of them. */
+	for (i = 0; i < cras_a2dp_codec_count(); i++) {
+		codec = cras_a2dp_codec_at(i);
+		a2dp_endpoint = &a2dp_endpoints[num_a2dp_endpoints];
+		memset(a2dp_endpoint, 0, sizeof(*a2dp_endpoint));
+
+		/* SBC keeps the original path of the only endpoint. */
+		if (codec->id == A2DP_CODEC_SBC)
+			snprintf(a2dp_endpoint->object_path,
+				 sizeof(a2dp_endpoint->object_path), "%s",
+				 A2DP_SOURCE_ENDPOINT_PATH);
+		else
+			snprintf(a2dp_endpoint->object_path,
+				 sizeof(a2dp_endpoint->object_path), "%s/%s",
+				 A2DP_SOURCE_ENDPOINT_PATH, codec->name);
+
+		/* BlueZ connects the device A2DP Sink to our A2DP Source
+		 * endpoint, and the device A2DP Source to our A2DP Sink. It's
+		 * best if you don't think about it too hard.
+		 */
+		a2dp_endpoint->base.object_path = a2dp_endpoint->object_path;
+		a2dp_endpoint->base.uuid = A2DP_SOURCE_UUID;
+		a2dp_endpoint->base.codec = codec->id;
+		a2dp_endpoint->base.get_capabilities =
+			cras_a2dp_get_capabilities;
+		a2dp_endpoint->base.select_configuration =
+			cras_a2dp_select_configuration;
+		a2dp_endpoint->base.set_configuration =
+			cras_a2dp_set_configuration;
+		a2dp_endpoint->base.suspend = cras_a2dp_suspend;
+		a2dp_endpoint->base.transport_state_changed =
+			a2dp_transport_state_changed;
+		a2dp_endpoint->codec = codec;
+
+		rc = cras_bt_endpoint_add(conn, &a2dp_endpoint->base);
+		if (rc < 0) {
+			syslog(LOG_ERR, "Failed to add A2DP %s endpoint",
+			       codec->name);
+			return rc;
+		}
+		num_a2dp_endpoints++;
+	}
+
+	return 0;
+}
+
+/* Finds the transport of device among the transports of the codec
+ * endpoints. */
+static struct cras_bt_transport *
+a2dp_device_transport(struct cras_bt_device *device)
+{
+	struct cras_bt_transport *transport;
+	unsigned int i;
+
+	for (i = 0; i < num_a2dp_endpoints; i++) {
+		transport = a2dp_endpoints[i].base.transport;
+		if (transport && device == cras_bt_transport_device(transport))
+			return transport;
+	}
+	return NULL;
 }
 
 void cras_a2dp_start(struct cras_bt_device *device)
 {
-	struct cras_bt_transport *transport = cras_a2dp_endpoint.transport;
+	struct cras_bt_transport *transport = a2dp_device_transport(device);
 
 	BTLOG(btlog, BT_A2DP_START, 0, 0);
 
-	if (!transport || device != cras_bt_transport_device(transport)) {
+	if (!transport) {
 		syslog(LOG_ERR, "Device and active transport not match.");
 		return;
 	}
@@ -3,90 +3,111 @@
  * found in the LICENSE file.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for sendmmsg */
+#endif
+
+#include <errno.h>
 #include <netinet/in.h>
-#include <sbc/sbc.h>
+#include <string.h>
+#include <sys/socket.h>
 #include <syslog.h>
 
 #include "cras_a2dp_info.h"
-#include "cras_sbc_codec.h"
+#include "cras_audio_codec.h"
 #include "cras_types.h"
 #include "rtp.h"
 
-int init_a2dp(struct a2dp_info *a2dp, a2dp_sbc_t *sbc)
-{
-	uint8_t frequency = 0, mode = 0, subbands = 0, allocation, blocks = 0,
-		bitpool;
-
-	if (sbc->frequency & SBC_SAMPLING_FREQ_48000)
-		frequency = SBC_FREQ_48000;
-	else if (sbc->frequency & SBC_SAMPLING_FREQ_44100)
-		frequency = SBC_FREQ_44100;
-	else if (sbc->frequency & SBC_SAMPLING_FREQ_32000)
-		frequency = SBC_FREQ_32000;
-	else if (sbc->frequency & SBC_SAMPLING_FREQ_16000)
-		frequency = SBC_FREQ_16000;
-
-	if (sbc->channel_mode & SBC_CHANNEL_MODE_JOINT_STEREO)
-		mode = SBC_MODE_JOINT_STEREO;
-	else if (sbc->channel_mode & SBC_CHANNEL_MODE_STEREO)
-		mode = SBC_MODE_STEREO;
-	else if (sbc->channel_mode & SBC_CHANNEL_MODE_DUAL_CHANNEL)
-		mode = SBC_MODE_DUAL_CHANNEL;
-	else if (sbc->channel_mode & SBC_CHANNEL_MODE_MONO)
-		mode = SBC_MODE_MONO;
-
-	if (sbc->allocation_method & SBC_ALLOCATION_LOUDNESS)
-		allocation = SBC_AM_LOUDNESS;
-	else
-		allocation = SBC_AM_SNR;
-
-	switch (sbc->subbands) {
-	case SBC_SUBBANDS_4:
-		subbands = SBC_SB_4;
-		break;
-	case SBC_SUBBANDS_8:
-		subbands = SBC_SB_8;
-		break;
-	}
+/* Size of the RTP header plus the media payload header of the codec. */
+static size_t packet_header_len(const struct a2dp_info *a2dp)
+{
+	return sizeof(struct rtp_header) + a2dp->ops->payload_header_len;
+}
 
-	switch (sbc->block_length) {
-	case SBC_BLOCK_LENGTH_4:
-		blocks = SBC_BLK_4;
-		break;
-	case SBC_BLOCK_LENGTH_8:
-		blocks = SBC_BLK_8;
-		break;
-	case SBC_BLOCK_LENGTH_12:
-		blocks = SBC_BLK_12;
-		break;
-	case SBC_BLOCK_LENGTH_16:
-		blocks = SBC_BLK_16;
-		break;
-	}
+/* Slot of the complete packet idx packets after the oldest one. idx equal to
+ * num_packets is the packet being filled. */
+static unsigned int packet_slot(const struct a2dp_info *a2dp, unsigned int idx)
+{
+	return (a2dp->packet_head + idx) % A2DP_MAX_BATCH_PACKETS;
+}
 
-	bitpool = sbc->max_bitpool;
+/* Whether the packet being filled has no room for another codec frame. */
+static int packet_full(const struct a2dp_info *a2dp, size_t link_mtu)
+{
+	return a2dp->a2dp_buf_used + a2dp->frame_length > link_mtu ||
+	       (a2dp->max_frames_per_packet &&
+		a2dp->frame_count >= a2dp->max_frames_per_packet);
+}
 
-	a2dp->codec = cras_sbc_codec_create(frequency, mode, subbands,
-					    allocation, blocks, bitpool);
-	if (!a2dp->codec)
-		return -1;
+/* Fills in the headers of the packet being filled and queues it to be
+ * written. Encoding continues in the next slot. */
+static void complete_packet(struct a2dp_info *a2dp)
+{
+	unsigned int slot = packet_slot(a2dp, a2dp->num_packets);
+	uint8_t *buf = a2dp->a2dp_buf[slot];
+	struct rtp_header *header = (struct rtp_header *)buf;
+
+	memset(buf, 0, packet_header_len(a2dp));
+	if (a2dp->ops->payload_header_len)
+		a2dp->ops->fill_payload_header(buf + sizeof(*header),
+					       a2dp->frame_count);
+	header->v = 2;
+	header->pt = a2dp->ops->payload_type;
+	header->sequence_number = htons(a2dp->seq_num);
+	header->timestamp = htonl(a2dp->nsamples);
+	header->ssrc = htonl(1);
 
-	/* SBC info */
-	a2dp->codesize = cras_sbc_get_codesize(a2dp->codec);
-	a2dp->frame_length = cras_sbc_get_frame_length(a2dp->codec);
+	a2dp->packet_len[slot] = a2dp->a2dp_buf_used;
+	a2dp->packet_samples[slot] = a2dp->samples;
+	a2dp->packed_samples += a2dp->samples;
+	a2dp->num_packets++;
+	a2dp->seq_num++;
 
-	a2dp->a2dp_buf_used =
-		sizeof(struct rtp_header) + sizeof(struct rtp_payload);
+	a2dp->a2dp_buf_used = packet_header_len(a2dp);
+	a2dp->frame_count = 0;
+	a2dp->samples = 0;
+}
+
+int init_a2dp(struct a2dp_info *a2dp, uint8_t codec_id, const void *config,
+	      int len)
+{
+	int err;
+
+	a2dp->ops = cras_a2dp_codec_get(codec_id);
+	if (!a2dp->ops) {
+		syslog(LOG_ERR, "A2DP codec %u not supported", codec_id);
+		return -ENOSYS;
+	}
+	if (len < 0 || len > sizeof(a2dp->config))
+		return -EINVAL;
+
+	a2dp->codec = NULL;
+	a2dp->bitpool = 0;
+	a2dp->max_frames_per_packet = a2dp->ops->max_frames_per_packet;
+	err = a2dp->ops->init(a2dp, config, len);
+	if (err)
+		return err;
+
+	memcpy(a2dp->config, config, len);
+	a2dp->config_len = len;
+
+	a2dp->a2dp_buf_used = packet_header_len(a2dp);
 	a2dp->frame_count = 0;
 	a2dp->seq_num = 0;
 	a2dp->samples = 0;
+	a2dp->packet_head = 0;
+	a2dp->num_packets = 0;
+	a2dp->max_packets = 1;
+	a2dp->packed_samples = 0;
 
 	return 0;
 }
 
 void destroy_a2dp(struct a2dp_info *a2dp)
 {
-	cras_sbc_codec_destroy(a2dp->codec);
+	if (a2dp->ops && a2dp->codec)
+		a2dp->ops->destroy(a2dp);
+	a2dp->codec = NULL;
 }
 
 int a2dp_codesize(struct a2dp_info *a2dp)
@@ -94,72 +115,99 @@ int a2dp_codesize(struct a2dp_info *a2dp)
 	return a2dp->codesize;
 }
 
-int a2dp_block_size(struct a2dp_info *a2dp, int a2dp_bytes)
+int a2dp_get_format(struct a2dp_info *a2dp, size_t *rate,
+		    size_t *num_channels)
 {
-	return a2dp_bytes / a2dp->frame_length * a2dp->codesize;
+	return a2dp->ops->get_format(a2dp->config, a2dp->config_len, rate,
+				     num_channels);
 }
 
-int a2dp_queued_frames(const struct a2dp_info *a2dp)
+void a2dp_set_frames_per_packet(struct a2dp_info *a2dp, int frames)
 {
-	return a2dp->samples;
+	if (a2dp->ops->max_frames_per_packet &&
+	    (frames == 0 || frames > a2dp->ops->max_frames_per_packet))
+		frames = a2dp->ops->max_frames_per_packet;
+	a2dp->max_frames_per_packet = frames;
 }
 
-void a2dp_reset(struct a2dp_info *a2dp)
+void a2dp_set_max_packets(struct a2dp_info *a2dp, unsigned int packets)
 {
-	a2dp->a2dp_buf_used =
-		sizeof(struct rtp_header) + sizeof(struct rtp_payload);
-	a2dp->samples = 0;
-	a2dp->seq_num = 0;
-	a2dp->frame_count = 0;
+	if (packets < 1)
+		packets = 1;
+	if (packets > A2DP_MAX_BATCH_PACKETS)
+		packets = A2DP_MAX_BATCH_PACKETS;
+	a2dp->max_packets = packets;
 }
 
-static int avdtp_write(int stream_fd, struct a2dp_info *a2dp)
+int a2dp_set_bitpool(struct a2dp_info *a2dp, int bitpool)
 {
-	int err, samples;
-	struct rtp_header *header;
-	struct rtp_payload *payload;
-
-	header = (struct rtp_header *)a2dp->a2dp_buf;
-	payload = (struct rtp_payload *)(a2dp->a2dp_buf + sizeof(*header));
-	memset(a2dp->a2dp_buf, 0, sizeof(*header) + sizeof(*payload));
+	if (!a2dp->ops->set_bitpool)
+		return -ENOSYS;
+
+	if (bitpool < a2dp->min_bitpool)
+		bitpool = a2dp->min_bitpool;
+	if (bitpool > a2dp->max_bitpool)
+		bitpool = a2dp->max_bitpool;
+	if (bitpool != a2dp->bitpool) {
+		a2dp->ops->set_bitpool(a2dp, bitpool);
+		a2dp->bitpool = bitpool;
+	}
+	return bitpool;
+}
 
-	payload->frame_count = a2dp->frame_count;
-	header->v = 2;
-	header->pt = 1;
-	header->sequence_number = htons(a2dp->seq_num);
-	header->timestamp = htonl(a2dp->nsamples);
-	header->ssrc = htonl(1);
+int a2dp_block_size(struct a2dp_info *a2dp, int a2dp_bytes)
+{
+	int frames = a2dp_bytes / a2dp->frame_length;
 
-	err = send(stream_fd, a2dp->a2dp_buf, a2dp->a2dp_buf_used,
-		   MSG_DONTWAIT);
-	if (err < 0)
-		return -errno;
+	if (a2dp->max_frames_per_packet &&
+	    frames > a2dp->max_frames_per_packet)
+		frames = a2dp->max_frames_per_packet;
+	return frames * a2dp->codesize;
+}
 
-	/* Returns the number of samples in frame. */
-	samples = a2dp->samples;
+int a2dp_queued_frames(const struct a2dp_info *a2dp)
+{
+	return a2dp->samples + a2dp->packed_samples;
+}
 
-	/* Reset some data */
-	a2dp->a2dp_buf_used = sizeof(*header) + sizeof(*payload);
-	a2dp->frame_count = 0;
+void a2dp_reset(struct a2dp_info *a2dp)
+{
+	a2dp->a2dp_buf_used = packet_header_len(a2dp);
 	a2dp->samples = 0;
-	a2dp->seq_num++;
-
-	return samples;
+	a2dp->seq_num = 0;
+	a2dp->frame_count = 0;
+	a2dp->packet_head = 0;
+	a2dp->num_packets = 0;
+	a2dp->packed_samples = 0;
 }
 
 int a2dp_encode(struct a2dp_info *a2dp, const void *pcm_buf, int pcm_buf_size,
 		int format_bytes, size_t link_mtu)
 {
-	int processed;
+	int processed, max_frames;
 	size_t out_encoded;
+	uint8_t *buf;
 
 	if (link_mtu > A2DP_BUF_SIZE_BYTES)
 		link_mtu = A2DP_BUF_SIZE_BYTES;
-	if (link_mtu == a2dp->a2dp_buf_used)
-		return 0;
+	if (packet_full(a2dp, link_mtu)) {
+		if (a2dp->num_packets + 1 >= a2dp->max_packets)
+			return 0;
+		complete_packet(a2dp);
+	}
+	buf = a2dp->a2dp_buf[packet_slot(a2dp, a2dp->num_packets)];
+
+	/* Don't encode more frames than one packet can carry. */
+	max_frames = a2dp->max_frames_per_packet;
+	if (max_frames && a2dp->codesize > 0) {
+		if (pcm_buf_size > (max_frames - a2dp->frame_count) *
+					   a2dp->codesize)
+			pcm_buf_size = (max_frames - a2dp->frame_count) *
+				       a2dp->codesize;
+	}
 
 	processed = a2dp->codec->encode(a2dp->codec, pcm_buf, pcm_buf_size,
-					a2dp->a2dp_buf + a2dp->a2dp_buf_used,
+					buf + a2dp->a2dp_buf_used,
 					link_mtu - a2dp->a2dp_buf_used,
 					&out_encoded);
 	if (processed < 0) {
@@ -177,11 +225,48 @@ int a2dp_encode(struct a2dp_info *a2dp, const void *pcm_buf, int pcm_buf_size,
 	return processed;
 }
 
-int a2dp_write(struct a2dp_info *a2dp, int stream_fd, size_t link_mtu)
+int a2dp_write(struct a2dp_info *a2dp, int stream_fd, size_t link_mtu,
+	       unsigned int *packets)
 {
-	/* Do avdtp write when the max number of SBC frames is reached. */
-	if (a2dp->a2dp_buf_used + a2dp->frame_length > link_mtu)
-		return avdtp_write(stream_fd, a2dp);
+	struct mmsghdr msgs[A2DP_MAX_BATCH_PACKETS];
+	struct iovec iovs[A2DP_MAX_BATCH_PACKETS];
+	unsigned int i, slot;
+	int rc, samples = 0;
 
-	return 0;
+	*packets = 0;
+	if (link_mtu > A2DP_BUF_SIZE_BYTES)
+		link_mtu = A2DP_BUF_SIZE_BYTES;
+
+	/* The packet being filled goes out once no codec frame fits, or the
+	 * max number of codec frames is reached. */
+	if (packet_full(a2dp, link_mtu))
+		complete_packet(a2dp);
+	if (a2dp->num_packets == 0)
+		return 0;
+
+	/* Packets are encoded in place behind their headers, so each one is
+	 * a single buffer. */
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < a2dp->num_packets; i++) {
+		slot = packet_slot(a2dp, i);
+		iovs[i].iov_base = a2dp->a2dp_buf[slot];
+		iovs[i].iov_len = a2dp->packet_len[slot];
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	rc = sendmmsg(stream_fd, msgs, a2dp->num_packets, MSG_DONTWAIT);
+	if (rc < 0)
+		return -errno;
+
+	/* Packets the socket didn't take stay queued for the next write. */
+	for (i = 0; i < rc; i++) {
+		samples += a2dp->packet_samples[a2dp->packet_head];
+		a2dp->packet_head = packet_slot(a2dp, 1);
+	}
+	a2dp->num_packets -= rc;
+	a2dp->packed_samples -= samples;
+	*packets = rc;
+
+	return samples;
 }
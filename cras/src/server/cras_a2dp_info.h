@@ -7,37 +7,78 @@
 #define CRAS_A2DP_INFO_H_
 
 #include "a2dp-codecs.h"
+#include "cras_a2dp_codec.h"
 
 #define A2DP_BUF_SIZE_BYTES 2048
+/* Most packets encoded ahead and sent together in one a2dp_write. */
+#define A2DP_MAX_BATCH_PACKETS 4
 
 /* Represents the codec and encoded state of a2dp iodev.
  * Members:
+ *    ops - The registered A2DP codec in use.
  *    codec - The codec used to encode PCM buffer to a2dp buffer.
- *    a2dp_buf - The buffer to hold encoded frames.
- *    codesize - Size of a SBC frame in bytes.
- *    frame_length - Size of an encoded SBC frame in bytes.
- *    frame_count - Queued SBC frame count currently in a2dp buffer.
+ *    config - The codec configuration negotiated for the transport.
+ *    config_len - Size of config in bytes.
+ *    a2dp_buf - Packet slots holding the RTP header and encoded frames,
+ *        used as a ring starting at packet_head.
+ *    codesize - Size of the PCM input of one codec frame in bytes.
+ *    frame_length - Maximum size of an encoded codec frame in bytes.
+ *    frame_count - Codec frame count in the packet being filled.
+ *    max_frames_per_packet - Maximum number of codec frames sent in one
+ *        packet, 0 to pack as many as the MTU allows.
+ *    bitpool - The bitpool the codec encodes with, 0 if it has none.
+ *    min_bitpool, max_bitpool - The range the bitpool can be set to.
  *    seq_num - Sequence number in rtp header.
- *    samples - Queued PCM frame count currently in a2dp buffer.
+ *    samples - PCM frame count in the packet being filled.
  *    nsamples - Cumulative number of encoded PCM frames.
- *    a2dp_buf_used - Used a2dp buffer counter in bytes.
+ *    a2dp_buf_used - Bytes used in the packet being filled.
+ *    packet_head - Slot of the oldest complete packet.
+ *    num_packets - Complete packets waiting to be sent. The packet being
+ *        filled is in the slot after them.
+ *    max_packets - Packets, including the one being filled, that can be
+ *        queued before a2dp_encode stops.
+ *    packet_len - Size in bytes of each complete packet.
+ *    packet_samples - PCM frame count of each complete packet.
+ *    packed_samples - PCM frame count of all the complete packets.
  */
 struct a2dp_info {
+	const struct cras_a2dp_codec *ops;
 	struct cras_audio_codec *codec;
-	uint8_t a2dp_buf[A2DP_BUF_SIZE_BYTES];
+	uint8_t config[A2DP_MAX_CONFIG_LEN];
+	int config_len;
+	uint8_t a2dp_buf[A2DP_MAX_BATCH_PACKETS][A2DP_BUF_SIZE_BYTES];
 	int codesize;
 	int frame_length;
 	int frame_count;
+	int max_frames_per_packet;
+	int bitpool;
+	int min_bitpool;
+	int max_bitpool;
 	uint16_t seq_num;
 	int samples;
 	int nsamples;
 	size_t a2dp_buf_used;
+	unsigned int packet_head;
+	unsigned int num_packets;
+	unsigned int max_packets;
+	size_t packet_len[A2DP_MAX_BATCH_PACKETS];
+	int packet_samples[A2DP_MAX_BATCH_PACKETS];
+	int packed_samples;
 };
 
 /*
- * Set up codec for given sbc capability.
+ * Set up the registered codec of codec_id for the given configuration.
+ * Args:
+ *    a2dp: The a2dp info object.
+ *    codec_id: The A2DP_CODEC_* type the transport is configured with.
+ *    config: The codec configuration of the transport.
+ *    len: Size of config in bytes.
+ * Returns:
+ *    0 on success, or a negative error code if the codec isn't registered or
+ *    fails to initialize.
  */
-int init_a2dp(struct a2dp_info *a2dp, a2dp_sbc_t *sbc);
+int init_a2dp(struct a2dp_info *a2dp, uint8_t codec_id, const void *config,
+	      int len);
 
 /*
  * Destroys an a2dp_info.
@@ -45,10 +86,34 @@ int init_a2dp(struct a2dp_info *a2dp, a2dp_sbc_t *sbc);
 void destroy_a2dp(struct a2dp_info *a2dp);
 
 /*
- * Gets the codesize of the SBC codec.
+ * Gets the codesize of the codec.
  */
 int a2dp_codesize(struct a2dp_info *a2dp);
 
+/*
+ * Gets the rate and number of channels of the configured codec.
+ */
+int a2dp_get_format(struct a2dp_info *a2dp, size_t *rate,
+		    size_t *num_channels);
+
+/*
+ * Limits the number of codec frames sent in one packet. The limit of the
+ * codec, if any, still applies.
+ */
+void a2dp_set_frames_per_packet(struct a2dp_info *a2dp, int frames);
+
+/*
+ * Sets how many packets a2dp_encode can fill before they are written,
+ * clamped to 1 and A2DP_MAX_BATCH_PACKETS. Packets already encoded are kept.
+ */
+void a2dp_set_max_packets(struct a2dp_info *a2dp, unsigned int packets);
+
+/*
+ * Changes the bitpool of the codec, clamped to the negotiated range. Returns
+ * the bitpool now in use, or -ENOSYS if the codec has no bitpool.
+ */
+int a2dp_set_bitpool(struct a2dp_info *a2dp, int bitpool);
+
 /*
  * Gets original size of a2dp encoded bytes.
  */
@@ -66,7 +131,8 @@ void a2dp_reset(struct a2dp_info *a2dp);
 
 /*
  * Encodes samples using the codec for this a2dp instance, returns the number of
- * pcm bytes processed.
+ * pcm bytes processed. A full packet is completed and encoding moves on to the
+ * next one, as long as fewer than max_packets are queued.
  * Args:
  *    a2dp: The a2dp info object.
  *    pcm_buf: The buffer of pcm samples.
@@ -78,12 +144,16 @@ int a2dp_encode(struct a2dp_info *a2dp, const void *pcm_buf, int pcm_buf_size,
 		int format_bytes, size_t link_mtu);
 
 /*
- * Writes samples using a2dp, returns number of frames written.
+ * Writes the complete packets, and the one being filled if it is full, with
+ * one system call. Returns the number of frames written, or a negative error
+ * code if none could be.
  * Args:
  *    a2dp: The a2dp info object.
  *    stream_fd: The file descriptor to send stream to.
  *    link_mtu: The maximum transmit unit.
+ *    packets: Filled with the number of packets written.
  */
-int a2dp_write(struct a2dp_info *a2dp, int stream_fd, size_t link_mtu);
+int a2dp_write(struct a2dp_info *a2dp, int stream_fd, size_t link_mtu,
+	       unsigned int *packets);
 
 #endif /* CRAS_A2DP_INFO_H_ */
@@ -3,7 +3,14 @@
  * found in the LICENSE file.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for ppoll */
+#endif
+
+#include <poll.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/param.h>
 #include <linux/sockios.h>
@@ -12,10 +19,8 @@
 #include <syslog.h>
 #include <time.h>
 
-#include "audio_thread.h"
 #include "audio_thread_log.h"
-#include "byte_buffer.h"
-#include "cras_iodev_list.h"
+#include "cras_config.h"
 #include "cras_a2dp_endpoint.h"
 #include "cras_a2dp_info.h"
 #include "cras_a2dp_iodev.h"
@@ -23,7 +28,10 @@
 #include "cras_audio_thread_monitor.h"
 #include "cras_bt_device.h"
 #include "cras_iodev.h"
+#include "cras_system_state.h"
 #include "cras_util.h"
+#include "dev_stream.h"
+#include "rate_estimator.h"
 #include "sfh.h"
 #include "rtp.h"
 #include "utlist.h"
@@ -41,52 +49,192 @@ static const struct timespec throttle_event_threshold = {
 	2, 0 /* 2s */
 };
 
-/* Child of cras_iodev to handle bluetooth A2DP streaming.
+/* Adaptive bitpool. On socket backpressure the bitpool steps down by
+ * BITPOOL_DECREASE_STEP, at most once per BITPOOL_HOLD_PACKETS packets so
+ * the socket can drain in between. After BITPOOL_RECOVER_PACKETS packets
+ * written on time it steps back up by one. */
+#define BITPOOL_DECREASE_STEP 6
+#define BITPOOL_HOLD_PACKETS 25
+#define BITPOOL_RECOVER_PACKETS 250
+
+/* Low latency target level. While a voice communication stream plays, the
+ * local queue is kept at most target_blocks write blocks above
+ * min_buffer_level instead of filling up the PCM buffer. Socket backpressure
+ * widens it by one block, up to LL_TARGET_MAX_BLOCKS. After
+ * LL_TARGET_SHRINK_PACKETS packets written on time with the socket drained
+ * it narrows by one block, down to LL_TARGET_MIN_BLOCKS. */
+#define LL_TARGET_MIN_BLOCKS 1
+#define LL_TARGET_INIT_BLOCKS 2
+#define LL_TARGET_MAX_BLOCKS 8
+#define LL_TARGET_SHRINK_PACKETS 500
+
+/* Window and smooth factor of the estimate of the rate the headset drains
+ * the socket at, the same as the iodev rate estimator uses. */
+static const struct timespec drain_est_window = {
+	5, 0 /* 5 sec. */
+};
+static const double drain_est_smooth_factor = 0.3f;
+
+#define CACHE_LINE_SIZE 64
+
+/* What the encoder thread waits for after a pass of encode_and_flush.
+ *    A2DP_ENCODER_WAIT_EVENT - A wake up from the audio thread, which starts
+ *        the flushes, queues more PCM or closes the device.
+ *    A2DP_ENCODER_WAIT_TIME - The next flush time.
+ *    A2DP_ENCODER_WAIT_SOCKET - The socket to become writable.
+ */
+enum a2dp_encoder_wait {
+	A2DP_ENCODER_WAIT_EVENT,
+	A2DP_ENCODER_WAIT_TIME,
+	A2DP_ENCODER_WAIT_SOCKET,
+};
+
+/* Child of cras_iodev to handle bluetooth A2DP streaming. The audio thread
+ * writes PCM to pcm_buf, and an encoder thread encodes it and writes the
+ * packets to the socket, paced by next_flush_time. pcm_buf is a lock free
+ * ring with one writer on each side.
  * Members:
  *    base - The cras_iodev structure "base class"
- *    a2dp - The codec and encoded state of a2dp_io.
+ *    a2dp - The codec and encoded state of a2dp_io. Only touched by the
+ *        encoder thread while it runs.
  *    transport - The transport object for bluez media API.
  *    sock_depth_frames - Socket depth in frames of the a2dp socket.
- *    pcm_buf - Buffer to hold pcm samples before encode.
+ *    sock_depth_bytes - Send buffer size of the a2dp socket.
+ *    pcm_buf - Ring to hold pcm samples before encode.
+ *    pcm_buf_size - Size of pcm_buf in bytes.
  *    destroyed - Flag to note if this a2dp_io is about to destroy.
- *    next_flush_time - The time when it is okay for next flush call.
- *    flush_period - The time period between two a2dp packet writes.
+ *    next_flush_time - The time when it is okay for next flush call. Owned
+ *        by the encoder thread once flushing is set.
+ *    flush_period - The time period between two a2dp packet writes, at
+ *        the rate drain_est estimates. Owned by the encoder thread once
+ *        flushing is set.
+ *    drain_est - Estimates the rate the headset drains the socket at from
+ *        the frames written and the level of the socket. Only used by the
+ *        encoder thread.
  *    write_block - How many frames of audio samples are transferred in one
  *        a2dp packet write.
+ *    encoder_thread - Thread running encoder_thread_loop.
+ *    wake_fd - Eventfd the audio thread uses to wake the encoder thread.
+ *    flushing - Set by start() to let the encoder thread write packets.
+ *    stopping - Set by close_dev() to stop the encoder thread.
+ *    failed - Set by the encoder thread after a fatal socket error.
+ *    need_data - Set by the encoder thread when it waits for more PCM.
+ *    encoded_frames - PCM frames encoded but not yet written, published by
+ *        the encoder thread for the audio thread.
+ *    adapt_bitpool - Whether the bitpool follows socket backpressure.
+ *    bitpool_hold - Packets to write before the bitpool may drop again.
+ *    packets_on_time - Packets written on time since the last
+ *        backpressure.
+ *    target_blocks - Write blocks the low latency target level keeps above
+ *        min_buffer_level. Adapted by the encoder thread, read by the audio
+ *        thread.
+ *    target_on_time - Packets written on time since target_blocks last
+ *        changed.
+ *    pcm_write_bytes - Bytes ever written to pcm_buf. Only written by the
+ *        audio thread.
+ *    pcm_read_bytes - Bytes ever consumed from pcm_buf. Only written by the
+ *        encoder thread.
  */
 struct a2dp_io {
 	struct cras_iodev base;
 	struct a2dp_info a2dp;
 	struct cras_bt_transport *transport;
 	unsigned sock_depth_frames;
-	struct byte_buffer *pcm_buf;
+	int sock_depth_bytes;
+	uint8_t *pcm_buf;
+	unsigned int pcm_buf_size;
 	int destroyed;
 	struct timespec next_flush_time;
 	struct timespec flush_period;
+	struct rate_estimator *drain_est;
 	unsigned int write_block;
+	pthread_t encoder_thread;
+	int wake_fd;
+	int flushing;
+	int stopping;
+	int failed;
+	int need_data;
+	unsigned int encoded_frames;
+	int adapt_bitpool;
+	unsigned int bitpool_hold;
+	unsigned int packets_on_time;
+	unsigned int target_blocks;
+	unsigned int target_on_time;
+	unsigned int pcm_write_bytes __attribute__((aligned(CACHE_LINE_SIZE)));
+	unsigned int pcm_read_bytes __attribute__((aligned(CACHE_LINE_SIZE)));
 };
 
-static int encode_and_flush(const struct cras_iodev *iodev);
+/* Bytes of PCM queued in pcm_buf. Safe to call from either thread. */
+static unsigned int pcm_queued(struct a2dp_io *a2dpio)
+{
+	return __atomic_load_n(&a2dpio->pcm_write_bytes, __ATOMIC_ACQUIRE) -
+	       __atomic_load_n(&a2dpio->pcm_read_bytes, __ATOMIC_ACQUIRE);
+}
+
+/* Contiguous bytes the audio thread can write at pcm_write_pointer(). */
+static unsigned int pcm_writable(struct a2dp_io *a2dpio)
+{
+	unsigned int offset = a2dpio->pcm_write_bytes % a2dpio->pcm_buf_size;
+
+	return MIN(a2dpio->pcm_buf_size - pcm_queued(a2dpio),
+		   a2dpio->pcm_buf_size - offset);
+}
+
+static uint8_t *pcm_write_pointer(struct a2dp_io *a2dpio)
+{
+	return a2dpio->pcm_buf + a2dpio->pcm_write_bytes % a2dpio->pcm_buf_size;
+}
+
+static void pcm_commit_write(struct a2dp_io *a2dpio, unsigned int bytes)
+{
+	__atomic_store_n(&a2dpio->pcm_write_bytes,
+			 a2dpio->pcm_write_bytes + bytes, __ATOMIC_SEQ_CST);
+}
+
+/* Contiguous bytes the encoder thread can read at pcm_read_pointer(). */
+static unsigned int pcm_readable(struct a2dp_io *a2dpio)
+{
+	unsigned int offset = a2dpio->pcm_read_bytes % a2dpio->pcm_buf_size;
+
+	return MIN(pcm_queued(a2dpio), a2dpio->pcm_buf_size - offset);
+}
+
+static const uint8_t *pcm_read_pointer(struct a2dp_io *a2dpio)
+{
+	return a2dpio->pcm_buf + a2dpio->pcm_read_bytes % a2dpio->pcm_buf_size;
+}
+
+static void pcm_commit_read(struct a2dp_io *a2dpio, unsigned int bytes)
+{
+	__atomic_store_n(&a2dpio->pcm_read_bytes,
+			 a2dpio->pcm_read_bytes + bytes, __ATOMIC_RELEASE);
+}
+
+/* Called by the encoder thread whenever a2dp changes, so the encoded frames
+ * count read by the audio thread stays current. */
+static void publish_encoded_frames(struct a2dp_io *a2dpio)
+{
+	__atomic_store_n(&a2dpio->encoded_frames,
+			 a2dp_queued_frames(&a2dpio->a2dp), __ATOMIC_RELEASE);
+}
+
+static void wake_encoder(struct a2dp_io *a2dpio)
+{
+	eventfd_write(a2dpio->wake_fd, 1);
+}
+
+static void *encoder_thread_loop(void *arg);
 
 static int update_supported_formats(struct cras_iodev *iodev)
 {
 	struct a2dp_io *a2dpio = (struct a2dp_io *)iodev;
 	size_t rate = 0;
-	size_t channel;
-	a2dp_sbc_t a2dp;
-
-	cras_bt_transport_configuration(a2dpio->transport, &a2dp, sizeof(a2dp));
-
-	channel = (a2dp.channel_mode == SBC_CHANNEL_MODE_MONO) ? 1 : 2;
+	size_t channel = 0;
+	int err;
 
-	if (a2dp.frequency & SBC_SAMPLING_FREQ_48000)
-		rate = 48000;
-	else if (a2dp.frequency & SBC_SAMPLING_FREQ_44100)
-		rate = 44100;
-	else if (a2dp.frequency & SBC_SAMPLING_FREQ_32000)
-		rate = 32000;
-	else if (a2dp.frequency & SBC_SAMPLING_FREQ_16000)
-		rate = 16000;
+	err = a2dp_get_format(&a2dpio->a2dp, &rate, &channel);
+	if (err)
+		return err;
 
 	free(iodev->supported_rates);
 	iodev->supported_rates = (size_t *)malloc(2 * sizeof(rate));
@@ -110,9 +258,8 @@ static int update_supported_formats(struct cras_iodev *iodev)
 static unsigned int bt_local_queued_frames(const struct cras_iodev *iodev)
 {
 	struct a2dp_io *a2dpio = (struct a2dp_io *)iodev;
-	return a2dp_queued_frames(&a2dpio->a2dp) +
-	       buf_queued(a2dpio->pcm_buf) /
-		       cras_get_format_bytes(iodev->format);
+	return __atomic_load_n(&a2dpio->encoded_frames, __ATOMIC_ACQUIRE) +
+	       pcm_queued(a2dpio) / cras_get_format_bytes(iodev->format);
 }
 
 static int frames_queued(const struct cras_iodev *iodev,
@@ -123,6 +270,29 @@ static int frames_queued(const struct cras_iodev *iodev,
 	return MIN(iodev->buffer_size, local_queued_frames);
 }
 
+/* Whether the local queue follows the low latency target level, which it
+ * does while a voice communication stream is attached. Called on the audio
+ * thread. */
+static int low_latency(const struct cras_iodev *iodev)
+{
+	struct dev_stream *stream;
+
+	DL_FOREACH (iodev->streams, stream) {
+		if (stream->stream->stream_type ==
+		    CRAS_STREAM_TYPE_VOICE_COMMUNICATION)
+			return 1;
+	}
+	return 0;
+}
+
+/* The local queue level in low latency mode. */
+static unsigned int low_latency_target(struct a2dp_io *a2dpio)
+{
+	return a2dpio->base.min_buffer_level +
+	       __atomic_load_n(&a2dpio->target_blocks, __ATOMIC_RELAXED) *
+		       a2dpio->write_block;
+}
+
 /*
  * Utility function to fill zero frames until buffer level reaches
  * target_level. This is useful to allocate just enough data to write
@@ -173,20 +343,26 @@ static int output_underrun(struct cras_iodev *iodev)
 /*
  * This will be called multiple times when a2dpio is in no_stream state
  * frames_to_play_in_sleep ops determins how regular this will be called.
+ * The encoder thread keeps flushing the zeros on its own schedule.
  */
 static int enter_no_stream(struct a2dp_io *a2dpio)
 {
 	struct cras_iodev *odev = &a2dpio->base;
+	unsigned int target;
 	int rc;
 	/*
          * Setting target level to 3 times of min_buffer_level.
          * We want hw_level to stay bewteen 1-2 times of min_buffer_level on
-	 * top of the underrun threshold(i.e one min_cb_level).
+	 * top of the underrun threshold(i.e one min_cb_level). In low latency
+	 * mode keep to the target level instead.
          */
-	rc = fill_zeros_to_target_level(odev, 3 * odev->min_buffer_level);
+	target = 3 * odev->min_buffer_level;
+	if (low_latency(odev))
+		target = MIN(target, low_latency_target(a2dpio));
+	rc = fill_zeros_to_target_level(odev, target);
 	if (rc)
 		syslog(LOG_ERR, "Error in A2DP enter_no_stream");
-	return encode_and_flush(odev);
+	return rc;
 }
 
 /*
@@ -223,7 +399,7 @@ static int no_stream(struct cras_iodev *odev, int enable)
 }
 
 /* Encode as much PCM data as we can until the buffer level of a2dp_info
- * reaches MTU.
+ * reaches MTU. Runs on the encoder thread.
  * Returns:
  *    0 for success, otherwise negative error code.
  */
@@ -232,28 +408,157 @@ static int encode_a2dp_packet(struct a2dp_io *a2dpio)
 	int processed;
 	size_t format_bytes = cras_get_format_bytes(a2dpio->base.format);
 
-	while (buf_queued(a2dpio->pcm_buf)) {
+	while (pcm_queued(a2dpio)) {
 		processed = a2dp_encode(
-			&a2dpio->a2dp, buf_read_pointer(a2dpio->pcm_buf),
-			buf_readable(a2dpio->pcm_buf), format_bytes,
+			&a2dpio->a2dp, pcm_read_pointer(a2dpio),
+			pcm_readable(a2dpio), format_bytes,
 			cras_bt_transport_write_mtu(a2dpio->transport));
 		if (processed == -ENOSPC || processed == 0)
 			break;
 		if (processed < 0)
 			return processed;
 
-		buf_increment_read(a2dpio->pcm_buf, processed);
+		/* Publish the encoded frames before releasing the PCM so the
+		 * audio thread never sees them missing from both. */
+		publish_encoded_frames(a2dpio);
+		pcm_commit_read(a2dpio, processed);
 	}
 	return 0;
 }
 
-/*
- * To be called when a2dp socket becomes writable.
+/* Makes the encoder thread wait for the audio thread to queue at least
+ * min_frames of PCM.
+ * Returns:
+ *    A2DP_ENCODER_WAIT_EVENT, or A2DP_ENCODER_WAIT_TIME if enough PCM
+ *    arrived in the meantime to make another pass right away.
  */
-static int a2dp_socket_write_cb(void *arg, int revent)
+static void set_bitpool(struct a2dp_io *a2dpio, int bitpool)
+{
+	int old_bitpool = a2dpio->a2dp.bitpool;
+
+	bitpool = a2dp_set_bitpool(&a2dpio->a2dp, bitpool);
+	if (bitpool > 0 && bitpool != old_bitpool)
+		ATLOG(atlog, AUDIO_THREAD_A2DP_BITPOOL, bitpool,
+		      a2dpio->a2dp.frame_length, 0);
+}
+
+/* Frames of encoded audio still queued in the socket. For SIOCOUTQ the
+ * L2CAP socket reports the free space of its send buffer. */
+static unsigned int socket_queued_frames(struct a2dp_io *a2dpio)
+{
+	int free_bytes;
+
+	if (ioctl(cras_bt_transport_fd(a2dpio->transport), SIOCOUTQ,
+		  &free_bytes) < 0 ||
+	    free_bytes >= a2dpio->sock_depth_bytes)
+		return 0;
+
+	return a2dp_block_size(&a2dpio->a2dp,
+			       a2dpio->sock_depth_bytes - free_bytes) /
+	       cras_get_format_bytes(a2dpio->base.format);
+}
+
+/* Lowers the bitpool when the socket backs up, so fewer bytes go out per
+ * packet while the link is degraded. The number of frames per packet is
+ * fixed, so packets shrink rather than carry more audio. Also widens the
+ * low latency target level to ride out the trouble. */
+static void handle_backpressure(struct a2dp_io *a2dpio)
+{
+	a2dpio->packets_on_time = 0;
+	a2dpio->target_on_time = 0;
+	if (a2dpio->target_blocks < LL_TARGET_MAX_BLOCKS)
+		__atomic_store_n(&a2dpio->target_blocks,
+				 a2dpio->target_blocks + 1, __ATOMIC_RELAXED);
+
+	if (!a2dpio->adapt_bitpool || a2dpio->bitpool_hold)
+		return;
+
+	set_bitpool(a2dpio, a2dpio->a2dp.bitpool - BITPOOL_DECREASE_STEP);
+	a2dpio->bitpool_hold = BITPOOL_HOLD_PACKETS;
+}
+
+/* Called when a packet is written. late is set if it went out past the
+ * throttle log threshold. */
+static void handle_packet_written(struct a2dp_io *a2dpio, int late)
+{
+	if (a2dpio->bitpool_hold)
+		a2dpio->bitpool_hold--;
+
+	if (late) {
+		handle_backpressure(a2dpio);
+		return;
+	}
+
+	/* Narrow the target level only once the headset keeps up, with no
+	 * more than a packet left in the socket. */
+	if (++a2dpio->target_on_time >= LL_TARGET_SHRINK_PACKETS) {
+		a2dpio->target_on_time = 0;
+		if (a2dpio->target_blocks > LL_TARGET_MIN_BLOCKS &&
+		    socket_queued_frames(a2dpio) <= a2dpio->write_block)
+			__atomic_store_n(&a2dpio->target_blocks,
+					 a2dpio->target_blocks - 1,
+					 __ATOMIC_RELAXED);
+	}
+
+	if (!a2dpio->adapt_bitpool ||
+	    ++a2dpio->packets_on_time < BITPOOL_RECOVER_PACKETS)
+		return;
+
+	a2dpio->packets_on_time = 0;
+	if (a2dpio->a2dp.bitpool < a2dpio->a2dp.max_bitpool)
+		set_bitpool(a2dpio, a2dpio->a2dp.bitpool + 1);
+}
+
+/* Paces the packet writes at the drain rate estimate, so packets don't
+ * pile up in the socket when the headset runs slower than its nominal
+ * rate. Since the audio thread estimates the device rate from how fast
+ * the encoder takes PCM, cras_iodev_get_est_rate_ratio follows it too. */
+static void update_flush_period(struct a2dp_io *a2dpio)
+{
+	cras_frames_to_time_precise(a2dpio->write_block,
+				    rate_estimator_get_rate(a2dpio->drain_est),
+				    &a2dpio->flush_period);
+}
+
+/* Starts the drain rate estimate over at the nominal rate. */
+static void reset_drain_rate(struct a2dp_io *a2dpio)
 {
-	struct cras_iodev *iodev = (struct cras_iodev *)arg;
-	return encode_and_flush(iodev);
+	rate_estimator_reset_rate(a2dpio->drain_est,
+				  a2dpio->base.format->frame_rate);
+	update_flush_period(a2dpio);
+}
+
+static enum a2dp_encoder_wait wait_for_data(struct a2dp_io *a2dpio,
+					    unsigned int min_frames)
+{
+	size_t format_bytes = cras_get_format_bytes(a2dpio->base.format);
+	unsigned int queued;
+
+	/* Pairs with put_buffer, so either the audio thread sees need_data
+	 * or this sees the new PCM. */
+	__atomic_store_n(&a2dpio->need_data, 1, __ATOMIC_SEQ_CST);
+	queued = __atomic_load_n(&a2dpio->pcm_write_bytes, __ATOMIC_SEQ_CST) -
+		 a2dpio->pcm_read_bytes;
+	if (queued / format_bytes >= min_frames) {
+		__atomic_store_n(&a2dpio->need_data, 0, __ATOMIC_SEQ_CST);
+		return A2DP_ENCODER_WAIT_TIME;
+	}
+	return A2DP_ENCODER_WAIT_EVENT;
+}
+
+/* Sends Acquire ahead of configure_dev, so the round trip to BlueZ overlaps
+ * with the format and DSP setup done in between. */
+static int open_dev(struct cras_iodev *iodev)
+{
+	struct a2dp_io *a2dpio = (struct a2dp_io *)iodev;
+	int err;
+
+	err = cras_bt_transport_acquire_async(a2dpio->transport);
+	if (err < 0)
+		syslog(LOG_WARNING, "transport_acquire_async failed: %d", err);
+
+	/* configure_dev acquires the transport anyway, don't fail here. */
+	return 0;
 }
 
 static int configure_dev(struct cras_iodev *iodev)
@@ -281,9 +586,27 @@ static int configure_dev(struct cras_iodev *iodev)
 	iodev->format->format = SND_PCM_FORMAT_S16_LE;
 	cras_iodev_init_audio_area(iodev, iodev->format->num_channels);
 
-	a2dpio->pcm_buf = byte_buffer_create(PCM_BUF_MAX_SIZE_BYTES);
+	/* Keep the ring a whole number of codesize, so the encoder never
+	 * finds less than one codec frame of PCM before the wrap. */
+	a2dpio->pcm_buf_size = PCM_BUF_MAX_SIZE_BYTES;
+	if (a2dp_codesize(&a2dpio->a2dp) > 0)
+		a2dpio->pcm_buf_size -=
+			PCM_BUF_MAX_SIZE_BYTES % a2dp_codesize(&a2dpio->a2dp);
+	a2dpio->pcm_buf = (uint8_t *)calloc(1, a2dpio->pcm_buf_size);
 	if (!a2dpio->pcm_buf)
 		return -ENOMEM;
+	a2dpio->pcm_write_bytes = 0;
+	a2dpio->pcm_read_bytes = 0;
+	a2dpio->encoded_frames = 0;
+
+	/* Start every stream at the negotiated bitpool. Headsets which need
+	 * a fixed packet size keep it for the whole stream. */
+	a2dp_set_frames_per_packet(&a2dpio->a2dp, 0);
+	a2dpio->adapt_bitpool =
+		a2dp_set_bitpool(&a2dpio->a2dp, a2dpio->a2dp.max_bitpool) > 0 &&
+		!cras_system_get_bt_fix_a2dp_packet_size_enabled();
+	a2dpio->bitpool_hold = 0;
+	a2dpio->packets_on_time = 0;
 
 	/* Set up the socket to hold two MTUs full of data before returning
 	 * EAGAIN.  This will allow the write to be throttled when a reasonable
@@ -294,6 +617,7 @@ static int configure_dev(struct cras_iodev *iodev)
 	optlen = sizeof(sock_depth);
 	getsockopt(cras_bt_transport_fd(a2dpio->transport), SOL_SOCKET,
 		   SO_SNDBUF, &sock_depth, &optlen);
+	a2dpio->sock_depth_bytes = sock_depth;
 	a2dpio->sock_depth_frames = a2dp_block_size(&a2dpio->a2dp, sock_depth) /
 				    cras_get_format_bytes(iodev->format);
 	/*
@@ -307,8 +631,22 @@ static int configure_dev(struct cras_iodev *iodev)
 	a2dpio->write_block =
 		a2dp_block_size(&a2dpio->a2dp, a2dp_payload_length) /
 		cras_get_format_bytes(iodev->format);
-	cras_frames_to_time(a2dpio->write_block, iodev->format->frame_rate,
-			    &a2dpio->flush_period);
+	if (!a2dpio->drain_est)
+		a2dpio->drain_est = rate_estimator_create(
+			iodev->format->frame_rate, &drain_est_window,
+			drain_est_smooth_factor);
+	if (!a2dpio->drain_est) {
+		err = -ENOMEM;
+		goto free_pcm_buf;
+	}
+	reset_drain_rate(a2dpio);
+
+	/* Keep the frames per packet, and so the flush period, when the
+	 * bitpool drops and more frames would fit in the MTU. */
+	a2dp_set_frames_per_packet(&a2dpio->a2dp,
+				   a2dpio->write_block *
+					   cras_get_format_bytes(iodev->format) /
+					   a2dp_codesize(&a2dpio->a2dp));
 
 	/* PCM buffer size plus one encoded a2dp packet. */
 	iodev->buffer_size = PCM_BUF_MAX_SIZE_FRAMES + a2dpio->write_block;
@@ -319,13 +657,32 @@ static int configure_dev(struct cras_iodev *iodev)
 	 * underruns, audio thread can take action to fill some zeros.
 	 */
 	iodev->min_buffer_level = a2dpio->write_block;
-
-	audio_thread_add_events_callback(
-		cras_bt_transport_fd(a2dpio->transport), a2dp_socket_write_cb,
-		iodev, POLLOUT | POLLERR | POLLHUP);
-	audio_thread_config_events_callback(
-		cras_bt_transport_fd(a2dpio->transport), TRIGGER_NONE);
+	a2dpio->target_blocks = LL_TARGET_INIT_BLOCKS;
+	a2dpio->target_on_time = 0;
+
+	a2dpio->flushing = 0;
+	a2dpio->stopping = 0;
+	a2dpio->failed = 0;
+	a2dpio->need_data = 0;
+	a2dpio->wake_fd = eventfd(0, EFD_CLOEXEC);
+	if (a2dpio->wake_fd < 0) {
+		err = -errno;
+		goto free_pcm_buf;
+	}
+	err = pthread_create(&a2dpio->encoder_thread, NULL, encoder_thread_loop,
+			     a2dpio);
+	if (err) {
+		syslog(LOG_ERR, "Failed to start A2DP encoder thread: %d", err);
+		close(a2dpio->wake_fd);
+		err = -err;
+		goto free_pcm_buf;
+	}
 	return 0;
+
+free_pcm_buf:
+	free(a2dpio->pcm_buf);
+	a2dpio->pcm_buf = NULL;
+	return err;
 }
 
 static int start(const struct cras_iodev *iodev)
@@ -335,9 +692,11 @@ static int start(const struct cras_iodev *iodev)
 	/*
 	 * This is called when iodev in open state, at the moment when
 	 * output sample is ready. Initialize the next_flush_time for
-	 * following flush calls.
+	 * following flush calls, then hand it to the encoder thread.
 	 */
 	clock_gettime(CLOCK_MONOTONIC_RAW, &a2dpio->next_flush_time);
+	__atomic_store_n(&a2dpio->flushing, 1, __ATOMIC_RELEASE);
+	wake_encoder(a2dpio);
 
 	return 0;
 }
@@ -351,10 +710,15 @@ static int close_dev(struct cras_iodev *iodev)
 	if (!a2dpio->transport)
 		return 0;
 
-	/* Remove audio thread callback and sync before releasing
-	 * the transport. */
-	audio_thread_rm_callback_sync(cras_iodev_list_get_audio_thread(),
-				      cras_bt_transport_fd(a2dpio->transport));
+	/* Stop the encoder thread before releasing the transport. */
+	if (a2dpio->pcm_buf) {
+		__atomic_store_n(&a2dpio->stopping, 1, __ATOMIC_RELEASE);
+		wake_encoder(a2dpio);
+		pthread_join(a2dpio->encoder_thread, NULL);
+		close(a2dpio->wake_fd);
+	}
+	rate_estimator_destroy(a2dpio->drain_est);
+	a2dpio->drain_est = NULL;
 
 	err = cras_bt_transport_release(a2dpio->transport, !a2dpio->destroyed);
 	if (err < 0)
@@ -364,7 +728,8 @@ static int close_dev(struct cras_iodev *iodev)
 	if (device)
 		cras_bt_device_cancel_suspend(device);
 	a2dp_reset(&a2dpio->a2dp);
-	byte_buffer_destroy(&a2dpio->pcm_buf);
+	free(a2dpio->pcm_buf);
+	a2dpio->pcm_buf = NULL;
 	cras_iodev_free_format(iodev);
 	cras_iodev_free_audio_area(iodev);
 	return 0;
@@ -375,7 +740,6 @@ static unsigned int frames_to_play_in_sleep(struct cras_iodev *iodev,
 					    struct timespec *hw_tstamp)
 {
 	struct a2dp_io *a2dpio = (struct a2dp_io *)iodev;
-	int frames_until;
 
 	*hw_level = frames_queued(iodev, hw_tstamp);
 	if (*hw_level < a2dpio->write_block)
@@ -383,75 +747,87 @@ static unsigned int frames_to_play_in_sleep(struct cras_iodev *iodev,
 	else
 		*hw_level -= a2dpio->write_block;
 
-	frames_until = cras_frames_until_time(&a2dpio->next_flush_time,
-					      iodev->format->frame_rate);
-	if (frames_until > 0)
-		return frames_until;
-
-	/* If time has passed next_flush_time, for example when socket write
-	 * throttles, sleep a moderate of time so that audio thread doesn't
-	 * busy wake up. */
+	/* The encoder thread drains one write_block per flush_period, so
+	 * sleep until the level reaches min_buffer_level. When it is already
+	 * there, for example when socket write throttles, sleep a moderate
+	 * of time so that audio thread doesn't busy wake up. */
+	if (*hw_level > iodev->min_buffer_level)
+		return *hw_level - iodev->min_buffer_level;
 	return a2dpio->write_block;
 }
 
-/* Encodes PCM data to a2dp frames and try to flush it to the socket.
+/* Number of packets to write in a flush which is late by the given time.
+ * One, plus one for each flush_period missed, as long as the PCM left
+ * stays above min_buffer_level. */
+static unsigned int packets_due(struct a2dp_io *a2dpio,
+				const struct timespec *late)
+{
+	struct cras_iodev *iodev = &a2dpio->base;
+	unsigned int queued, due, spare;
+	uint64_t period_ns, late_ns;
+
+	period_ns = a2dpio->flush_period.tv_sec * 1000000000ULL +
+		    a2dpio->flush_period.tv_nsec;
+	if (period_ns == 0 || a2dpio->write_block == 0)
+		return 1;
+
+	late_ns = late->tv_sec * 1000000000ULL + late->tv_nsec;
+	due = 1 + MIN(late_ns / period_ns, A2DP_MAX_BATCH_PACKETS);
+
+	queued = pcm_queued(a2dpio) / cras_get_format_bytes(iodev->format);
+	spare = 0;
+	if (queued > iodev->min_buffer_level)
+		spare = (queued - iodev->min_buffer_level) /
+			a2dpio->write_block;
+
+	return MIN(MIN(due, spare + 1), A2DP_MAX_BATCH_PACKETS);
+}
+
+/* Encodes PCM data to a2dp frames and try to flush it to the socket. This
+ * is one pass of the encoder thread.
  * Returns:
- *    0 when the flush succeeded, -1 when error occurred.
+ *    What the encoder thread should wait for before the next pass.
  */
-static int encode_and_flush(const struct cras_iodev *iodev)
+static enum a2dp_encoder_wait encode_and_flush(struct a2dp_io *a2dpio)
 {
+	struct cras_iodev *iodev = &a2dpio->base;
 	int err;
 	size_t format_bytes;
 	int written = 0;
-	unsigned int queued_frames;
-	struct a2dp_io *a2dpio;
+	int late;
+	unsigned int queued_frames, batch, packets, i;
 	struct cras_bt_device *device;
 	struct timespec now, ts;
 	static const struct timespec flush_wake_fuzz_ts = {
 		0, 1000000 /* 1ms */
 	};
 
-	a2dpio = (struct a2dp_io *)iodev;
 	format_bytes = cras_get_format_bytes(iodev->format);
 	device = cras_bt_transport_device(a2dpio->transport);
 
 	/* If bt device has been destroyed, this a2dp iodev will soon be
 	 * destroyed as well. */
 	if (device == NULL)
-		return -EINVAL;
+		return A2DP_ENCODER_WAIT_EVENT;
+
+	/* Only allow data to be flushed after start() ops is called. */
+	if (!__atomic_load_n(&a2dpio->flushing, __ATOMIC_ACQUIRE) ||
+	    a2dpio->failed)
+		return A2DP_ENCODER_WAIT_EVENT;
 
 	ATLOG(atlog, AUDIO_THREAD_A2DP_FLUSH, iodev->state,
 	      a2dpio->next_flush_time.tv_sec, a2dpio->next_flush_time.tv_nsec);
 
-	/* Only allow data to be flushed after start() ops is called. */
-	if ((iodev->state != CRAS_IODEV_STATE_NORMAL_RUN) &&
-	    (iodev->state != CRAS_IODEV_STATE_NO_STREAM_RUN))
-		return 0;
-
 	err = encode_a2dp_packet(a2dpio);
 	if (err < 0)
-		return err;
+		goto fatal;
 
 do_flush:
 	/* If flush gets called before targeted next flush time, do nothing. */
 	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 	add_timespecs(&now, &flush_wake_fuzz_ts);
-	if (!timespec_after(&now, &a2dpio->next_flush_time)) {
-		if (iodev->buffer_size == bt_local_queued_frames(iodev)) {
-			/*
-			 * If buffer is full, audio thread will no longer call
-			 * into get/put buffer in subsequent wake-ups. In that
-			 * case set the registered callback to be triggered at
-			 * next audio thread wake up.
-			 */
-			audio_thread_config_events_callback(
-				cras_bt_transport_fd(a2dpio->transport),
-				TRIGGER_WAKEUP);
-			cras_audio_thread_event_a2dp_overrun();
-			syslog(LOG_WARNING, "Buffer overrun in A2DP iodev");
-		}
-		return 0;
-	}
+	if (!timespec_after(&now, &a2dpio->next_flush_time))
+		return A2DP_ENCODER_WAIT_TIME;
 
 	/* If the A2DP write schedule miss exceeds a small threshold, log it for
 	 * debug purpose. */
@@ -464,40 +840,60 @@ do_flush:
 	 * that we consider it as something severe. */
 	if (timespec_after(&ts, &throttle_event_threshold))
 		cras_audio_thread_event_a2dp_throttle();
+	late = timespec_after(&ts, &throttle_log_threshold);
+
+	/* When the flush is late by more than a flush period, encode the
+	 * packets missed and write them all with one system call. */
+	batch = packets_due(a2dpio, &ts);
+	if (batch > 1) {
+		a2dp_set_max_packets(&a2dpio->a2dp, batch);
+		err = encode_a2dp_packet(a2dpio);
+		a2dp_set_max_packets(&a2dpio->a2dp, 1);
+		if (err < 0)
+			goto fatal;
+	}
 
 	written = a2dp_write(&a2dpio->a2dp,
 			     cras_bt_transport_fd(a2dpio->transport),
-			     cras_bt_transport_write_mtu(a2dpio->transport));
+			     cras_bt_transport_write_mtu(a2dpio->transport),
+			     &packets);
+	publish_encoded_frames(a2dpio);
 	ATLOG(atlog, AUDIO_THREAD_A2DP_WRITE, written,
-	      a2dp_queued_frames(&a2dpio->a2dp), 0);
+	      a2dp_queued_frames(&a2dpio->a2dp), packets);
 	if (written == -EAGAIN) {
 		/* If EAGAIN error lasts longer than 5 seconds, suspend the
 		 * a2dp connection. */
 		cras_bt_device_schedule_suspend(device, 5000,
 						A2DP_LONG_TX_FAILURE);
-		audio_thread_config_events_callback(
-			cras_bt_transport_fd(a2dpio->transport), TRIGGER_POLL);
-		return 0;
+		handle_backpressure(a2dpio);
+		return A2DP_ENCODER_WAIT_SOCKET;
 	} else if (written < 0) {
-		/* Suspend a2dp immediately when receives error other than
-		 * EAGAIN. */
-		cras_bt_device_cancel_suspend(device);
-		cras_bt_device_schedule_suspend(device, 0, A2DP_TX_FATAL_ERROR);
-		/* Stop polling the socket in audio thread. Main thread will
-		 * close this iodev soon. */
-		audio_thread_config_events_callback(
-			cras_bt_transport_fd(a2dpio->transport), TRIGGER_NONE);
-		return written;
+		err = written;
+		goto fatal;
 	}
 
-	/* Update the next flush time if one block successfully been written. */
-	if (written)
-		add_timespecs(&a2dpio->next_flush_time, &a2dpio->flush_period);
+	/* Not enough encoded data for a packet yet. The writes are short of
+	 * data rather than paced by the headset, so the drain rate estimated
+	 * so far doesn't hold. */
+	if (written == 0) {
+		reset_drain_rate(a2dpio);
+		return wait_for_data(a2dpio,
+				     a2dpio->write_block -
+					     a2dp_queued_frames(&a2dpio->a2dp));
+	}
+
+	rate_estimator_add_frames(a2dpio->drain_est, written);
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	if (rate_estimator_check(a2dpio->drain_est,
+				 socket_queued_frames(a2dpio), &now))
+		update_flush_period(a2dpio);
 
-	/* a2dp_write no longer return -EAGAIN when reaches here, disable
-	 * the polling write callback. */
-	audio_thread_config_events_callback(
-		cras_bt_transport_fd(a2dpio->transport), TRIGGER_NONE);
+	/* Update the next flush time by one flush period for each block
+	 * successfully written. */
+	for (i = 0; i < packets; i++) {
+		add_timespecs(&a2dpio->next_flush_time, &a2dpio->flush_period);
+		handle_packet_written(a2dpio, late);
+	}
 
 	/* Data succcessfully written to a2dp socket, cancel any scheduled
 	 * suspend timer. */
@@ -507,16 +903,75 @@ do_flush:
 	 * encode more. But avoid the case when PCM buffer level is too close
 	 * to min_buffer_level so that another A2DP write could causes underrun.
 	 */
-	queued_frames = buf_queued(a2dpio->pcm_buf) / format_bytes;
-	if (written &&
-	    (iodev->min_buffer_level + a2dpio->write_block < queued_frames)) {
+	queued_frames = pcm_queued(a2dpio) / format_bytes;
+	if (iodev->min_buffer_level + a2dpio->write_block < queued_frames) {
 		err = encode_a2dp_packet(a2dpio);
 		if (err < 0)
-			return err;
+			goto fatal;
 		goto do_flush;
 	}
 
-	return 0;
+	/* Wait for the next flush time, or for more data if that has
+	 * already passed. */
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	add_timespecs(&now, &flush_wake_fuzz_ts);
+	if (!timespec_after(&now, &a2dpio->next_flush_time))
+		return A2DP_ENCODER_WAIT_TIME;
+	return wait_for_data(a2dpio,
+			     iodev->min_buffer_level + a2dpio->write_block + 1);
+
+fatal:
+	/* Suspend a2dp immediately when receives error other than
+	 * EAGAIN. Main thread will close this iodev soon. */
+	syslog(LOG_ERR, "A2DP encode and flush failed: %d", err);
+	a2dpio->failed = 1;
+	cras_bt_device_cancel_suspend(device);
+	cras_bt_device_schedule_suspend(device, 0, A2DP_TX_FATAL_ERROR);
+	return A2DP_ENCODER_WAIT_EVENT;
+}
+
+/* Runs encode_and_flush until close_dev() stops it, sleeping on wake_fd,
+ * the socket and next_flush_time in between. */
+static void *encoder_thread_loop(void *arg)
+{
+	struct a2dp_io *a2dpio = (struct a2dp_io *)arg;
+	struct pollfd pollfds[2];
+	struct timespec now, ts, *wait_ts;
+	enum a2dp_encoder_wait wait;
+	eventfd_t count;
+	nfds_t nfds;
+
+	/* Run just below the audio thread so it keeps the priority. */
+	if (cras_set_rt_scheduling(CRAS_SERVER_RT_THREAD_PRIORITY) == 0)
+		cras_set_thread_priority(CRAS_SERVER_RT_THREAD_PRIORITY - 1);
+
+	pollfds[0].fd = a2dpio->wake_fd;
+	pollfds[0].events = POLLIN;
+	pollfds[1].fd = cras_bt_transport_fd(a2dpio->transport);
+	pollfds[1].events = POLLOUT;
+
+	while (!__atomic_load_n(&a2dpio->stopping, __ATOMIC_ACQUIRE)) {
+		wait = encode_and_flush(a2dpio);
+
+		wait_ts = NULL;
+		nfds = 1;
+		if (wait == A2DP_ENCODER_WAIT_SOCKET) {
+			nfds = 2;
+		} else if (wait == A2DP_ENCODER_WAIT_TIME) {
+			clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+			if (timespec_after(&a2dpio->next_flush_time, &now))
+				subtract_timespecs(&a2dpio->next_flush_time,
+						   &now, &ts);
+			else
+				ts.tv_sec = ts.tv_nsec = 0;
+			wait_ts = &ts;
+		}
+
+		if (ppoll(pollfds, nfds, wait_ts, NULL) > 0 &&
+		    (pollfds[0].revents & POLLIN))
+			eventfd_read(a2dpio->wake_fd, &count);
+	}
+	return NULL;
 }
 
 static int delay_frames(const struct cras_iodev *iodev)
@@ -541,10 +996,19 @@ static int get_buffer(struct cras_iodev *iodev, struct cras_audio_area **area,
 	if (iodev->direction != CRAS_STREAM_OUTPUT)
 		return 0;
 
-	*frames = MIN(*frames, buf_writable(a2dpio->pcm_buf) / format_bytes);
+	*frames = MIN(*frames, pcm_writable(a2dpio) / format_bytes);
+
+	/* In low latency mode queue no more than the target level. The rest
+	 * stays with the streams until the encoder drains the queue. */
+	if (low_latency(iodev)) {
+		unsigned int queued = bt_local_queued_frames(iodev);
+		unsigned int target = low_latency_target(a2dpio);
+
+		*frames = queued < target ? MIN(*frames, target - queued) : 0;
+	}
 	iodev->area->frames = *frames;
 	cras_audio_area_config_buf_pointers(iodev->area, iodev->format,
-					    buf_write_pointer(a2dpio->pcm_buf));
+					    pcm_write_pointer(a2dpio));
 	*area = iodev->area;
 	return 0;
 }
@@ -558,12 +1022,22 @@ static int put_buffer(struct cras_iodev *iodev, unsigned nwritten)
 	format_bytes = cras_get_format_bytes(iodev->format);
 	written_bytes = nwritten * format_bytes;
 
-	if (written_bytes > buf_writable(a2dpio->pcm_buf))
+	if (written_bytes > pcm_writable(a2dpio))
 		return -EINVAL;
 
-	buf_increment_write(a2dpio->pcm_buf, written_bytes);
+	pcm_commit_write(a2dpio, written_bytes);
+	if (__atomic_exchange_n(&a2dpio->need_data, 0, __ATOMIC_SEQ_CST))
+		wake_encoder(a2dpio);
+
+	/* The encoder thread has fallen behind the schedule, for example
+	 * because the socket throttles, and the audio thread can't queue
+	 * more. */
+	if (pcm_queued(a2dpio) == a2dpio->pcm_buf_size) {
+		cras_audio_thread_event_a2dp_overrun();
+		syslog(LOG_WARNING, "Buffer overrun in A2DP iodev");
+	}
 
-	return encode_and_flush(iodev);
+	return 0;
 }
 
 static int flush_buffer(struct cras_iodev *iodev)
@@ -613,7 +1087,9 @@ struct cras_iodev *a2dp_iodev_create(struct cras_bt_transport *transport)
 	struct a2dp_io *a2dpio;
 	struct cras_iodev *iodev;
 	struct cras_ionode *node;
-	a2dp_sbc_t a2dp;
+	uint8_t config[A2DP_MAX_CONFIG_LEN];
+	int config_len;
+	size_t rate, channels;
 	struct cras_bt_device *device;
 	const char *name;
 
@@ -622,8 +1098,10 @@ struct cras_iodev *a2dp_iodev_create(struct cras_bt_transport *transport)
 		goto error;
 
 	a2dpio->transport = transport;
-	cras_bt_transport_configuration(a2dpio->transport, &a2dp, sizeof(a2dp));
-	err = init_a2dp(&a2dpio->a2dp, &a2dp);
+	config_len = cras_bt_transport_configuration(a2dpio->transport, config,
+						     sizeof(config));
+	err = init_a2dp(&a2dpio->a2dp, cras_bt_transport_codec(transport),
+			config, config_len);
 	if (err) {
 		syslog(LOG_ERR, "Fail to init a2dp");
 		goto error;
@@ -649,6 +1127,7 @@ struct cras_iodev *a2dp_iodev_create(struct cras_bt_transport *transport)
 			      strlen(cras_bt_device_object_path(device)),
 			      strlen(cras_bt_device_object_path(device)));
 
+	iodev->open_dev = open_dev;
 	iodev->configure_dev = configure_dev;
 	iodev->frames_queued = frames_queued;
 	iodev->delay_frames = delay_frames;
@@ -681,8 +1160,8 @@ struct cras_iodev *a2dp_iodev_create(struct cras_bt_transport *transport)
 		device, iodev, cras_bt_transport_profile(a2dpio->transport));
 
 	/* Record max supported channels into cras_iodev_info. */
-	iodev->info.max_supported_channels =
-		(a2dp.channel_mode == SBC_CHANNEL_MODE_MONO) ? 1 : 2;
+	if (a2dp_get_format(&a2dpio->a2dp, &rate, &channels) == 0)
+		iodev->info.max_supported_channels = channels;
 
 	ewma_power_disable(&iodev->ewma);
 
@@ -0,0 +1,514 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <syslog.h>
+
+#include "cras_aggregate_iodev.h"
+#include "cras_audio_area.h"
+#include "cras_iodev.h"
+#include "cras_iodev_list.h"
+#include "cras_types.h"
+#include "cras_util.h"
+#include "linear_resampler.h"
+#include "rate_estimator.h"
+
+/* Same rate estimation tuning as cras_iodev. */
+static const struct timespec rate_estimation_window_sz = {
+	5, 0 /* 5 sec. */
+};
+static const double rate_estimation_smooth_factor = 0.3f;
+
+/* Only S16_LE can be resampled to follow the members' clocks. */
+static snd_pcm_format_t aggregate_supported_formats[] = {
+	SND_PCM_FORMAT_S16_LE, 0
+};
+
+/* A device the aggregate iodev plays to.
+ * Members:
+ *    dev - The member iodev.
+ *    resampler - Converts from the rate the master consumes audio at to the
+ *        rate this member does. NULL for the master.
+ *    rate_est - Estimates the rate this member consumes audio at. NULL for
+ *        the master, which uses the estimator of the aggregate iodev.
+ */
+struct aggregate_member {
+	struct cras_iodev *dev;
+	struct linear_resampler *resampler;
+	struct rate_estimator *rate_est;
+};
+
+/* An output iodev fanning out to several others.
+ * Members:
+ *    base - The base class cras_iodev.
+ *    members - The devices played to, the master clock first.
+ *    num_members - The number of devices in members.
+ *    master_buf - The master buffer last handed out by get_buffer. Streams
+ *        are mixed straight into it and copied from there to the others.
+ */
+struct aggregate_iodev {
+	struct cras_iodev base;
+	struct aggregate_member members[MAX_AGGREGATE_MEMBERS];
+	unsigned int num_members;
+	uint8_t *master_buf;
+};
+
+static struct cras_iodev *master_dev(const struct cras_iodev *iodev)
+{
+	return ((struct aggregate_iodev *)iodev)->members[0].dev;
+}
+
+/* Returns non-zero if the zero terminated list holds val. */
+static int list_has(const size_t *list, size_t val)
+{
+	for (; list && *list; list++)
+		if (*list == val)
+			return 1;
+	return 0;
+}
+
+static int format_supported(const struct cras_iodev *dev,
+			    snd_pcm_format_t format)
+{
+	const snd_pcm_format_t *f;
+
+	for (f = dev->supported_formats; f && *f; f++)
+		if (*f == format)
+			return 1;
+	return 0;
+}
+
+/* Follows the clock of a member relative to the master. The level is read
+ * before new frames are written, like the audio thread does for the master. */
+static void update_member_rate(struct aggregate_iodev *aggio,
+			       struct aggregate_member *m)
+{
+	struct cras_iodev *dev = m->dev;
+	struct timespec ts;
+	int level;
+
+	level = dev->frames_queued(dev, &ts);
+	if (level < 0)
+		return;
+
+	/* An underrun throws the estimate off, start over. */
+	if (!level)
+		rate_estimator_reset_rate(m->rate_est, dev->format->frame_rate);
+	if (rate_estimator_check(m->rate_est, level, &ts))
+		linear_resampler_set_rates(
+			m->resampler,
+			rate_estimator_get_rate(aggio->base.rate_est),
+			rate_estimator_get_rate(m->rate_est));
+}
+
+/* Plays frames from the master buffer on another member. Frames the member
+ * has no room for are dropped. */
+static int write_member(struct aggregate_member *m, uint8_t *src,
+			unsigned int frames)
+{
+	struct cras_iodev *dev = m->dev;
+	const unsigned int frame_bytes = cras_get_format_bytes(dev->format);
+	struct cras_audio_area *area;
+	unsigned int in_frames, out_frames;
+	int resample = linear_resampler_needed(m->resampler);
+	int rc;
+
+	while (frames) {
+		out_frames = resample ? linear_resampler_in_frames_to_out(
+						m->resampler, frames) :
+					frames;
+		rc = dev->get_buffer(dev, &area, &out_frames);
+		if (rc < 0)
+			return rc;
+		if (!out_frames)
+			return 0;
+
+		in_frames = frames;
+		if (resample) {
+			out_frames = linear_resampler_resample(
+				m->resampler, src, &in_frames,
+				area->channels[0].buf, out_frames);
+		} else {
+			in_frames = MIN(frames, out_frames);
+			out_frames = in_frames;
+			memcpy(area->channels[0].buf, src,
+			       out_frames * frame_bytes);
+		}
+
+		rc = dev->put_buffer(dev, out_frames);
+		if (rc < 0)
+			return rc;
+		rate_estimator_add_frames(m->rate_est, out_frames);
+		src += in_frames * frame_bytes;
+		frames -= in_frames;
+	}
+	return 0;
+}
+
+static void close_members(struct aggregate_iodev *aggio, unsigned int num)
+{
+	struct aggregate_member *m;
+	unsigned int i;
+
+	for (i = 0; i < num; i++) {
+		m = &aggio->members[i];
+		m->dev->close_dev(m->dev);
+		cras_iodev_free_format(m->dev);
+		if (m->resampler) {
+			linear_resampler_destroy(m->resampler);
+			m->resampler = NULL;
+		}
+		if (m->rate_est) {
+			rate_estimator_destroy(m->rate_est);
+			m->rate_est = NULL;
+		}
+	}
+}
+
+/* Members run at the format of the aggregate iodev, or at their first rate
+ * when they don't support its rate and resample to it. */
+static int configure_member(struct aggregate_iodev *aggio,
+			    struct aggregate_member *m)
+{
+	const struct cras_audio_format *fmt = aggio->base.format;
+	struct cras_iodev *dev = m->dev;
+	int rc;
+
+	if (dev->format == NULL) {
+		dev->format = (struct cras_audio_format *)malloc(
+			sizeof(*dev->format));
+		if (!dev->format)
+			return -ENOMEM;
+	}
+	*dev->format = *fmt;
+	if (!list_has(dev->supported_rates, fmt->frame_rate))
+		dev->format->frame_rate = dev->supported_rates[0];
+
+	rc = dev->configure_dev(dev);
+	if (rc)
+		return rc;
+
+	if (m == &aggio->members[0])
+		return 0;
+
+	m->rate_est = rate_estimator_create(dev->format->frame_rate,
+					    &rate_estimation_window_sz,
+					    rate_estimation_smooth_factor);
+	m->resampler = linear_resampler_create(fmt->num_channels,
+					       cras_get_format_bytes(fmt),
+					       fmt->frame_rate,
+					       dev->format->frame_rate);
+	if (!m->rate_est || !m->resampler)
+		return -ENOMEM;
+	return 0;
+}
+
+/*
+ * iodev callbacks.
+ */
+
+static int open_dev(struct cras_iodev *iodev)
+{
+	struct aggregate_iodev *aggio = (struct aggregate_iodev *)iodev;
+	struct cras_iodev *dev;
+	unsigned int i;
+	int rc;
+
+	for (i = 0; i < aggio->num_members; i++) {
+		dev = aggio->members[i].dev;
+		rc = cras_iodev_is_open(dev) ? -EBUSY : 0;
+		if (!rc && dev->open_dev)
+			rc = dev->open_dev(dev);
+		if (rc) {
+			syslog(LOG_ERR,
+			       "Failed to open aggregate member %s: %d",
+			       dev->info.name, rc);
+			close_members(aggio, i);
+			return rc;
+		}
+	}
+	return 0;
+}
+
+/* The aggregate runs at the rates of the master and the channel counts every
+ * member supports. */
+static int update_supported_formats(struct cras_iodev *iodev)
+{
+	struct aggregate_iodev *aggio = (struct aggregate_iodev *)iodev;
+	struct cras_iodev *master = master_dev(iodev);
+	struct cras_iodev *dev;
+	const size_t *c;
+	size_t num;
+	unsigned int i;
+	int rc;
+
+	for (i = 0; i < aggio->num_members; i++) {
+		dev = aggio->members[i].dev;
+		if (dev->update_supported_formats) {
+			rc = dev->update_supported_formats(dev);
+			if (rc)
+				return rc;
+		}
+		if (!format_supported(dev, SND_PCM_FORMAT_S16_LE) ||
+		    !dev->supported_rates || !dev->supported_rates[0])
+			return -EINVAL;
+	}
+
+	for (num = 0; master->supported_rates[num]; num++)
+		;
+	free(iodev->supported_rates);
+	iodev->supported_rates =
+		calloc(num + 1, sizeof(*iodev->supported_rates));
+	if (!iodev->supported_rates)
+		return -ENOMEM;
+	memcpy(iodev->supported_rates, master->supported_rates,
+	       num * sizeof(*iodev->supported_rates));
+
+	for (num = 0, c = master->supported_channel_counts; c && *c; c++)
+		num++;
+	free(iodev->supported_channel_counts);
+	iodev->supported_channel_counts =
+		calloc(num + 1, sizeof(*iodev->supported_channel_counts));
+	if (!iodev->supported_channel_counts)
+		return -ENOMEM;
+	num = 0;
+	for (c = master->supported_channel_counts; c && *c; c++) {
+		for (i = 1; i < aggio->num_members; i++)
+			if (!list_has(aggio->members[i]
+					      .dev->supported_channel_counts,
+				      *c))
+				break;
+		if (i == aggio->num_members)
+			iodev->supported_channel_counts[num++] = *c;
+	}
+	if (!num)
+		return -EINVAL;
+	return 0;
+}
+
+static int configure_dev(struct cras_iodev *iodev)
+{
+	struct aggregate_iodev *aggio = (struct aggregate_iodev *)iodev;
+	struct cras_iodev *dev;
+	unsigned int i;
+	size_t size;
+	int rc;
+
+	if (iodev->format == NULL)
+		return -EINVAL;
+
+	for (i = 0; i < aggio->num_members; i++) {
+		rc = configure_member(aggio, &aggio->members[i]);
+		if (rc) {
+			syslog(LOG_ERR,
+			       "Failed to configure aggregate member %s: %d",
+			       aggio->members[i].dev->info.name, rc);
+			return rc;
+		}
+	}
+
+	/* Don't queue more than the smallest member can hold. */
+	iodev->buffer_size = master_dev(iodev)->buffer_size;
+	for (i = 1; i < aggio->num_members; i++) {
+		dev = aggio->members[i].dev;
+		size = cras_frames_at_rate(dev->format->frame_rate,
+					   dev->buffer_size,
+					   iodev->format->frame_rate);
+		iodev->buffer_size = MIN(iodev->buffer_size, size);
+	}
+	iodev->min_buffer_level = master_dev(iodev)->min_buffer_level;
+	return 0;
+}
+
+static int close_dev(struct cras_iodev *iodev)
+{
+	struct aggregate_iodev *aggio = (struct aggregate_iodev *)iodev;
+
+	close_members(aggio, aggio->num_members);
+	aggio->master_buf = NULL;
+	cras_iodev_free_format(iodev);
+	return 0;
+}
+
+static int frames_queued(const struct cras_iodev *iodev,
+			 struct timespec *tstamp)
+{
+	struct cras_iodev *master = master_dev(iodev);
+
+	return master->frames_queued(master, tstamp);
+}
+
+static int delay_frames(const struct cras_iodev *iodev)
+{
+	struct cras_iodev *master = master_dev(iodev);
+
+	return master->delay_frames(master);
+}
+
+/* Streams are mixed into the master buffer, so the master plays without a
+ * copy. */
+static int get_buffer(struct cras_iodev *iodev, struct cras_audio_area **area,
+		      unsigned *frames)
+{
+	struct aggregate_iodev *aggio = (struct aggregate_iodev *)iodev;
+	struct cras_iodev *master = master_dev(iodev);
+	int rc;
+
+	*frames = MIN(*frames, iodev->buffer_size);
+	rc = master->get_buffer(master, area, frames);
+	if (rc < 0)
+		return rc;
+	aggio->master_buf = (*area)->channels[0].buf;
+	return 0;
+}
+
+static int put_buffer(struct cras_iodev *iodev, unsigned nwritten)
+{
+	struct aggregate_iodev *aggio = (struct aggregate_iodev *)iodev;
+	struct cras_iodev *master = master_dev(iodev);
+	struct aggregate_member *m;
+	unsigned int i;
+
+	/* A member failing is left to catch up on the next write, only the
+	 * master stops the aggregate. */
+	for (i = 1; i < aggio->num_members; i++) {
+		m = &aggio->members[i];
+		update_member_rate(aggio, m);
+		write_member(m, aggio->master_buf, nwritten);
+	}
+	return master->put_buffer(master, nwritten);
+}
+
+static int flush_buffer(struct cras_iodev *iodev)
+{
+	struct aggregate_iodev *aggio = (struct aggregate_iodev *)iodev;
+	struct cras_iodev *dev;
+	unsigned int i;
+
+	for (i = 1; i < aggio->num_members; i++) {
+		dev = aggio->members[i].dev;
+		if (dev->flush_buffer)
+			dev->flush_buffer(dev);
+	}
+	return master_dev(iodev)->flush_buffer(master_dev(iodev));
+}
+
+static int start(const struct cras_iodev *iodev)
+{
+	struct aggregate_iodev *aggio = (struct aggregate_iodev *)iodev;
+	struct cras_iodev *dev;
+	unsigned int i;
+	int rc;
+
+	for (i = 0; i < aggio->num_members; i++) {
+		dev = aggio->members[i].dev;
+		if (!dev->start)
+			continue;
+		rc = dev->start(dev);
+		if (rc)
+			return rc;
+	}
+	return 0;
+}
+
+static void update_active_node(struct cras_iodev *iodev, unsigned node_idx,
+			       unsigned dev_enabled)
+{
+}
+
+/*
+ * Exported Interface.
+ */
+
+struct cras_iodev *aggregate_iodev_create(struct cras_iodev *const *members,
+					  unsigned int num_members)
+{
+	struct aggregate_iodev *aggio;
+	struct cras_iodev *iodev;
+	struct cras_ionode *node;
+	unsigned int i;
+
+	if (num_members == 0 || num_members > MAX_AGGREGATE_MEMBERS)
+		return NULL;
+	for (i = 0; i < num_members; i++)
+		if (members[i]->direction != CRAS_STREAM_OUTPUT)
+			return NULL;
+
+	aggio = calloc(1, sizeof(*aggio));
+	if (!aggio)
+		return NULL;
+	for (i = 0; i < num_members; i++)
+		aggio->members[i].dev = members[i];
+	aggio->num_members = num_members;
+
+	iodev = &aggio->base;
+	iodev->direction = CRAS_STREAM_OUTPUT;
+	iodev->supported_formats = aggregate_supported_formats;
+	/* Members keep their own hardware volume, the system volume is applied
+	 * once to the mix. */
+	iodev->software_volume_needed = 1;
+
+	iodev->open_dev = open_dev;
+	iodev->update_supported_formats = update_supported_formats;
+	iodev->configure_dev = configure_dev;
+	iodev->close_dev = close_dev;
+	iodev->frames_queued = frames_queued;
+	iodev->delay_frames = delay_frames;
+	iodev->get_buffer = get_buffer;
+	iodev->put_buffer = put_buffer;
+	iodev->flush_buffer = flush_buffer;
+	iodev->start = start;
+	iodev->update_active_node = update_active_node;
+	iodev->no_stream = cras_iodev_default_no_stream_playback;
+
+	node = (struct cras_ionode *)calloc(1, sizeof(*node));
+	if (!node) {
+		free(aggio);
+		return NULL;
+	}
+	node->dev = iodev;
+	node->type = CRAS_NODE_TYPE_UNKNOWN;
+	node->plugged = 1;
+	node->volume = 100;
+	node->ui_gain_scaler = 1.0f;
+	strcpy(node->name, "(default)");
+	cras_iodev_add_node(iodev, node);
+	cras_iodev_set_active_node(iodev, node);
+
+	iodev->info.max_supported_channels =
+		members[0]->info.max_supported_channels;
+	snprintf(iodev->info.name, ARRAY_SIZE(iodev->info.name),
+		 "Aggregate playback device.");
+
+	cras_iodev_list_add_output(iodev);
+	return iodev;
+}
+
+void aggregate_iodev_destroy(struct cras_iodev *iodev)
+{
+	cras_iodev_list_rm_output(iodev);
+	free(iodev->active_node);
+	free(iodev->supported_rates);
+	free(iodev->supported_channel_counts);
+	cras_iodev_free_resources(iodev);
+	free(iodev);
+}
+
+int aggregate_iodev_has_member(const struct cras_iodev *iodev,
+			       const struct cras_iodev *dev)
+{
+	const struct aggregate_iodev *aggio =
+		(const struct aggregate_iodev *)iodev;
+	unsigned int i;
+
+	for (i = 0; i < aggio->num_members; i++)
+		if (aggio->members[i].dev == dev)
+			return 1;
+	return 0;
+}
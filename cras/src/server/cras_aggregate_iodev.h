@@ -0,0 +1,43 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_AGGREGATE_IODEV_H_
+#define CRAS_AGGREGATE_IODEV_H_
+
+struct cras_iodev;
+
+/* Most output devices an aggregate iodev can play to. */
+#define MAX_AGGREGATE_MEMBERS 4
+
+/*
+ * Creates an aggregate output iodev.
+ *
+ * Streams are mixed once into the aggregate iodev, which copies every buffer
+ * it is given to each member device. The first member is the master clock the
+ * aggregate runs from. Every other member resamples what it plays from the
+ * rate the master consumes audio at to its own estimated rate, so all members
+ * stay sample-synchronized however far their clocks drift apart.
+ *
+ * The members are opened and closed with the aggregate iodev and must not be
+ * enabled on their own while it is open.
+ * Args:
+ *    members - The output devices to play to, master first.
+ *    num_members - The number of devices in members, at most
+ *        MAX_AGGREGATE_MEMBERS.
+ * Returns:
+ *    A pointer to the newly created iodev if successful, NULL otherwise.
+ */
+struct cras_iodev *aggregate_iodev_create(struct cras_iodev *const *members,
+					  unsigned int num_members);
+
+/* Destroys an aggregate iodev created with aggregate_iodev_create. The member
+ * devices are left as they are. */
+void aggregate_iodev_destroy(struct cras_iodev *iodev);
+
+/* Returns non-zero if dev is a member of the aggregate iodev. */
+int aggregate_iodev_has_member(const struct cras_iodev *iodev,
+			       const struct cras_iodev *dev);
+
+#endif /* CRAS_AGGREGATE_IODEV_H_ */
@@ -7,8 +7,12 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "cras_alert.h"
+#include "cras_system_state.h"
+#include "cras_tm.h"
+#include "cras_util.h"
 #include "utlist.h"
 
 /* A list of callbacks for an alert */
@@ -25,12 +29,22 @@ struct cras_alert_data {
 	char buf[];
 };
 
+/* Members:
+ *    min_interval_ms - The rate limit set by cras_alert_set_rate_limit.
+ *    last_processed - When the callbacks were last invoked.
+ *    rate_limit_timer - Armed while a rate limited alert is held back.
+ *    key_size - The size of the key of the data, 0 if there is none.
+ */
 struct cras_alert {
 	int pending;
 	unsigned int flags;
 	cras_alert_prepare prepare;
 	struct cras_alert_cb_list *callbacks;
 	struct cras_alert_data *data;
+	unsigned int min_interval_ms;
+	struct timespec last_processed;
+	struct cras_timer *rate_limit_timer;
+	size_t key_size;
 	struct cras_alert *prev, *next;
 };
 
@@ -87,6 +101,56 @@ int cras_alert_rm_callback(struct cras_alert *alert, cras_alert_cb cb,
 	return -ENOENT;
 }
 
+void cras_alert_set_rate_limit(struct cras_alert *alert,
+			       unsigned int min_interval_ms)
+{
+	alert->min_interval_ms = min_interval_ms;
+}
+
+void cras_alert_set_data_key_size(struct cras_alert *alert, size_t key_size)
+{
+	alert->key_size = key_size;
+}
+
+/* The held back alert can be processed again. */
+static void rate_limit_expired(struct cras_timer *timer, void *arg)
+{
+	struct cras_alert *alert = (struct cras_alert *)arg;
+
+	alert->rate_limit_timer = NULL;
+	has_alert_pending = 1;
+}
+
+/* Checks if a rate limited alert has to wait before its callbacks are invoked
+ * again, and arms a timer to process it later if so. */
+static int cras_alert_hold_back(struct cras_alert *alert)
+{
+	struct timespec now, elapsed;
+	unsigned int elapsed_ms;
+	struct cras_tm *tm;
+
+	if (!alert->min_interval_ms)
+		return 0;
+	if (alert->rate_limit_timer)
+		return 1;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	if (timespec_is_nonzero(&alert->last_processed)) {
+		subtract_timespecs(&now, &alert->last_processed, &elapsed);
+		elapsed_ms = timespec_to_ms(&elapsed);
+		tm = cras_system_state_get_tm();
+		if (elapsed_ms < alert->min_interval_ms && tm) {
+			alert->rate_limit_timer = cras_tm_create_timer(
+				tm, alert->min_interval_ms - elapsed_ms,
+				rate_limit_expired, alert);
+			if (alert->rate_limit_timer)
+				return 1;
+		}
+	}
+	alert->last_processed = now;
+	return 0;
+}
+
 /* Checks if the alert is pending, and invoke the prepare function and callbacks
  * if so. */
 static void cras_alert_process(struct cras_alert *alert)
@@ -96,6 +160,8 @@ static void cras_alert_process(struct cras_alert *alert)
 
 	if (!alert->pending)
 		return;
+	if (cras_alert_hold_back(alert))
+		return;
 
 	alert->pending = 0;
 	if (alert->prepare)
@@ -128,10 +194,21 @@ void cras_alert_pending_data(struct cras_alert *alert, void *data,
 
 	alert->pending = 1;
 	has_alert_pending = 1;
+
+	/* Update the data of the same key in place, keeping its order. */
+	if (alert->key_size && data_size >= alert->key_size) {
+		DL_FOREACH (alert->data, d)
+			if (!memcmp(d->buf, data, alert->key_size)) {
+				memcpy(d->buf, data, data_size);
+				return;
+			}
+	}
+
 	d = calloc(1, offsetof(struct cras_alert_data, buf) + data_size);
 	memcpy(d->buf, data, data_size);
 
-	if (!(alert->flags & CRAS_ALERT_FLAG_KEEP_ALL_DATA) && alert->data) {
+	if (!(alert->flags & CRAS_ALERT_FLAG_KEEP_ALL_DATA) &&
+	    !alert->key_size && alert->data) {
 		/* There will never be more than one item in the list. */
 		free(alert->data);
 		alert->data = NULL;
@@ -161,6 +238,10 @@ void cras_alert_destroy(struct cras_alert *alert)
 	if (!alert)
 		return;
 
+	if (alert->rate_limit_timer)
+		cras_tm_cancel_timer(cras_system_state_get_tm(),
+				     alert->rate_limit_timer);
+
 	DL_FOREACH (alert->callbacks, cb) {
 		DL_DELETE(alert->callbacks, cb);
 		free(cb);
@@ -6,6 +6,8 @@
 #ifndef _CRAS_ALERT_H
 #define _CRAS_ALERT_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -26,6 +28,10 @@ extern "C" {
  * of each alert a chance to update the system to a consistent state before
  * signalling the clients.
  *
+ * An alert which changes quickly, like a volume being dragged, can be rate
+ * limited. Changes within the limit are held back and merged with the later
+ * ones until the callbacks can be invoked again.
+ *
  * The alert functions should only be used from the main thread.
  */
 
@@ -83,6 +89,26 @@ int cras_alert_add_callback(struct cras_alert *alert, cras_alert_cb cb,
 int cras_alert_rm_callback(struct cras_alert *alert, cras_alert_cb cb,
 			   void *arg);
 
+/* Limits how often the callbacks of an alert are invoked. An alert becoming
+ * pending sooner than min_interval_ms after the callbacks were last invoked is
+ * processed once that interval has passed, with the latest data.
+ * Args:
+ *    alert - A pointer to the alert.
+ *    min_interval_ms - The minimum time between two invocations, 0 to invoke
+ *        the callbacks at the end of every event loop they are pending.
+ */
+void cras_alert_set_rate_limit(struct cras_alert *alert,
+			       unsigned int min_interval_ms);
+
+/* Keeps the latest data per key instead of only the latest data. The key is
+ * the first key_size bytes of the data passed to cras_alert_pending_data, so
+ * for example the changes of two different nodes are both delivered.
+ * Args:
+ *    alert - A pointer to the alert.
+ *    key_size - The size of the key, 0 to keep only the latest data.
+ */
+void cras_alert_set_data_key_size(struct cras_alert *alert, size_t key_size);
+
 /* Marks an alert as pending. We don't call the callbacks immediately when an
  * alert becomes pending, but will do that when
  * cras_alert_process_all_pending_alerts() is called.
@@ -11,6 +11,7 @@
 #include <syslog.h>
 
 #include "cras_alsa_card.h"
+#include "cras_alsa_helpers.h"
 #include "cras_alsa_io.h"
 #include "cras_alsa_mixer.h"
 #include "cras_alsa_ucm.h"
@@ -19,6 +20,7 @@
 #include "cras_config.h"
 #include "cras_iodev.h"
 #include "cras_iodev_list.h"
+#include "cras_startup_log.h"
 #include "cras_system_state.h"
 #include "cras_types.h"
 #include "cras_util.h"
@@ -35,6 +37,16 @@ struct iodev_list_node {
 	struct iodev_list_node *prev, *next;
 };
 
+/* Formats a PCM device of the card was probed to support. */
+struct probed_formats {
+	unsigned int device_index;
+	enum CRAS_STREAM_DIRECTION direction;
+	size_t *rates;
+	size_t *channel_counts;
+	snd_pcm_format_t *formats;
+	struct probed_formats *prev, *next;
+};
+
 /* Keeps an fd that is registered with system state.  A list of fds must be
  * kept so that they can be removed when the card is destroyed. */
 struct hctl_poll_fd {
@@ -51,6 +63,10 @@ struct hctl_poll_fd {
  * hctl - ALSA high-level control interface.
  * hctl_poll_fds - List of fds registered with cras_system_state.
  * config - Config info for this card, can be NULL if none found.
+ * handle - The control of the card, open between probe and commit.
+ * card_name - The name of the card from ALSA.
+ * probed_formats - Formats of the PCM devices, handed to the iodevs on
+ *     commit.
  */
 struct cras_alsa_card {
 	char name[MAX_ALSA_CARD_NAME_LENGTH];
@@ -61,6 +77,9 @@ struct cras_alsa_card {
 	snd_hctl_t *hctl;
 	struct hctl_poll_fd *hctl_poll_fds;
 	struct cras_card_config *config;
+	snd_ctl_t *handle;
+	char *card_name;
+	struct probed_formats *probed_formats;
 };
 
 /* Creates an iodev for the given device.
@@ -84,6 +103,7 @@ struct cras_iodev *create_iodev_for_device(
 	struct iodev_list_node *new_dev;
 	struct iodev_list_node *node;
 	int first = 1;
+	int phase;
 	char pcm_name[MAX_ALSA_PCM_NAME_LENGTH];
 
 	/* Find whether this is the first device in this direction, and
@@ -110,6 +130,8 @@ struct cras_iodev *create_iodev_for_device(
 		 device_index);
 
 	new_dev->direction = direction;
+	phase = cras_startup_log_begin(STARTUP_DEVICE_CREATE, info->card_index,
+				       device_index);
 	new_dev->iodev =
 		alsa_iodev_create(info->card_index, card_name, device_index,
 				  pcm_name, dev_name, dev_id, info->card_type,
@@ -117,6 +139,7 @@ struct cras_iodev *create_iodev_for_device(
 				  alsa_card->ucm, alsa_card->hctl, direction,
 				  info->usb_vendor_id, info->usb_product_id,
 				  info->usb_serial_number);
+	cras_startup_log_end(phase);
 	if (new_dev->iodev == NULL) {
 		syslog(LOG_ERR, "Couldn't create alsa_iodev for %s", pcm_name);
 		free(new_dev);
@@ -193,6 +216,19 @@ static void alsa_control_event_pending(void *arg, int revent)
 	snd_hctl_handle_events(card->hctl);
 }
 
+/* Finds the nodes and jacks of an iodev created without UCM sections. */
+static int legacy_complete_init(struct cras_alsa_card_info *info,
+				struct cras_iodev *iodev, int dev_idx)
+{
+	int phase, rc;
+
+	phase = cras_startup_log_begin(STARTUP_DEVICE_JACKS, info->card_index,
+				       dev_idx);
+	rc = alsa_iodev_legacy_complete_init(iodev);
+	cras_startup_log_end(phase);
+	return rc;
+}
+
 static int
 add_controls_and_iodevs_by_matching(struct cras_alsa_card_info *info,
 				    struct cras_device_blocklist *blocklist,
@@ -265,7 +301,8 @@ add_controls_and_iodevs_by_matching(struct cras_alsa_card_info *info,
 				snd_pcm_info_get_id(dev_info), dev_idx,
 				CRAS_STREAM_OUTPUT);
 			if (iodev) {
-				rc = alsa_iodev_legacy_complete_init(iodev);
+				rc = legacy_complete_init(info, iodev,
+							  dev_idx);
 				if (rc < 0)
 					goto error;
 			}
@@ -280,7 +317,8 @@ add_controls_and_iodevs_by_matching(struct cras_alsa_card_info *info,
 				snd_pcm_info_get_id(dev_info), dev_idx,
 				CRAS_STREAM_INPUT);
 			if (iodev) {
-				rc = alsa_iodev_legacy_complete_init(iodev);
+				rc = legacy_complete_init(info, iodev,
+							  dev_idx);
 				if (rc < 0)
 					goto error;
 			}
@@ -301,6 +339,7 @@ static int add_controls_and_iodevs_with_ucm(struct cras_alsa_card_info *info,
 	struct mixer_name *main_volume_control_names;
 	struct iodev_list_node *node;
 	int rc = 0;
+	int phase;
 	struct ucm_section *section;
 	struct ucm_section *ucm_sections;
 
@@ -391,8 +430,12 @@ static int add_controls_and_iodevs_with_ucm(struct cras_alsa_card_info *info,
 				break;
 		}
 		if (node) {
+			phase = cras_startup_log_begin(STARTUP_DEVICE_JACKS,
+						       info->card_index,
+						       section->dev_idx);
 			rc = alsa_iodev_ucm_add_nodes_and_jacks(node->iodev,
 								section);
+			cras_startup_log_end(phase);
 			if (rc < 0)
 				goto cleanup;
 		}
@@ -451,8 +494,24 @@ struct cras_alsa_card *cras_alsa_card_create(
 	struct cras_alsa_card_info *info, const char *device_config_dir,
 	struct cras_device_blocklist *blocklist, const char *ucm_suffix)
 {
-	snd_ctl_t *handle = NULL;
-	int rc, n;
+	struct cras_alsa_card *alsa_card;
+
+	alsa_card = cras_alsa_card_probe(info, device_config_dir, ucm_suffix);
+	if (alsa_card == NULL)
+		return NULL;
+
+	if (cras_alsa_card_commit(alsa_card, info, blocklist)) {
+		cras_alsa_card_destroy(alsa_card);
+		return NULL;
+	}
+	return alsa_card;
+}
+
+static struct cras_alsa_card *probe_card(struct cras_alsa_card_info *info,
+					 const char *device_config_dir,
+					 const char *ucm_suffix)
+{
+	int rc, phase, mixer_phase = -1;
 	snd_ctl_card_info_t *card_info;
 	const char *card_name;
 	struct cras_alsa_card *alsa_card;
@@ -472,13 +531,14 @@ struct cras_alsa_card *cras_alsa_card_create(
 	snprintf(alsa_card->name, MAX_ALSA_CARD_NAME_LENGTH, "hw:%u",
 		 info->card_index);
 
-	rc = snd_ctl_open(&handle, alsa_card->name, 0);
+	rc = snd_ctl_open(&alsa_card->handle, alsa_card->name, 0);
 	if (rc < 0) {
 		syslog(LOG_ERR, "Fail opening control %s.", alsa_card->name);
+		alsa_card->handle = NULL;
 		goto error_bail;
 	}
 
-	rc = snd_ctl_card_info(handle, card_info);
+	rc = snd_ctl_card_info(alsa_card->handle, card_info);
 	if (rc < 0) {
 		syslog(LOG_ERR, "Error getting card info.");
 		goto error_bail;
@@ -489,6 +549,9 @@ struct cras_alsa_card *cras_alsa_card_create(
 		syslog(LOG_ERR, "Error getting card name.");
 		goto error_bail;
 	}
+	alsa_card->card_name = strdup(card_name);
+	if (alsa_card->card_name == NULL)
+		goto error_bail;
 
 	if (info->card_type != ALSA_CARD_TYPE_INTERNAL ||
 	    cras_system_check_ignore_ucm_suffix(card_name))
@@ -501,6 +564,7 @@ struct cras_alsa_card *cras_alsa_card_create(
 		syslog(LOG_DEBUG, "No config file for %s", alsa_card->name);
 
 	/* Create a use case manager if a configuration is available. */
+	phase = cras_startup_log_begin(STARTUP_CARD_UCM, info->card_index, 0);
 	if (ucm_suffix) {
 		char *ucm_name;
 		if (asprintf(&ucm_name, "%s.%s", card_name, ucm_suffix) == -1) {
@@ -516,10 +580,13 @@ struct cras_alsa_card *cras_alsa_card_create(
 		syslog(LOG_INFO, "Card %s (%s) has UCM: %s", alsa_card->name,
 		       card_name, alsa_card->ucm ? "yes" : "no");
 	}
+	cras_startup_log_end(phase);
 
 	if (info->card_type == ALSA_CARD_TYPE_INTERNAL && !alsa_card->ucm)
 		syslog(LOG_ERR, "No ucm config on internal card %s", card_name);
 
+	mixer_phase =
+		cras_startup_log_begin(STARTUP_CARD_MIXER, info->card_index, 0);
 	rc = snd_hctl_open(&alsa_card->hctl, alsa_card->name, SND_CTL_NONBLOCK);
 	if (rc < 0) {
 		syslog(LOG_DEBUG, "failed to get hctl for %s", alsa_card->name);
@@ -547,17 +614,134 @@ struct cras_alsa_card *cras_alsa_card_create(
 		syslog(LOG_ERR, "Fail opening mixer for %s.", alsa_card->name);
 		goto error_bail;
 	}
+	cras_startup_log_end(mixer_phase);
+
+	return alsa_card;
+
+error_bail:
+	cras_startup_log_end(mixer_phase);
+	cras_alsa_card_destroy(alsa_card);
+	return NULL;
+}
+
+struct cras_alsa_card *cras_alsa_card_probe(struct cras_alsa_card_info *info,
+					    const char *device_config_dir,
+					    const char *ucm_suffix)
+{
+	struct cras_alsa_card *alsa_card;
+	int phase;
+
+	phase = cras_startup_log_begin(STARTUP_CARD_PROBE, info->card_index, 0);
+	alsa_card = probe_card(info, device_config_dir, ucm_suffix);
+	cras_startup_log_end(phase);
+	return alsa_card;
+}
+
+void cras_alsa_card_probe_formats(struct cras_alsa_card *alsa_card)
+{
+	static const snd_pcm_stream_t streams[] = { SND_PCM_STREAM_PLAYBACK,
+						    SND_PCM_STREAM_CAPTURE };
+	snd_pcm_info_t *dev_info;
+	char pcm_name[MAX_ALSA_PCM_NAME_LENGTH];
+	int dev_idx = -1;
+	unsigned int i;
+	int phase;
+
+	snd_pcm_info_alloca(&dev_info);
+	phase = cras_startup_log_begin(STARTUP_CARD_PCM_PROBE,
+				       alsa_card->card_index, 0);
+
+	while (snd_ctl_pcm_next_device(alsa_card->handle, &dev_idx) == 0 &&
+	       dev_idx >= 0) {
+		snprintf(pcm_name, MAX_ALSA_PCM_NAME_LENGTH, "%s,%u",
+			 alsa_card->name, dev_idx);
+
+		for (i = 0; i < ARRAY_SIZE(streams); i++) {
+			struct probed_formats *probed;
+			snd_pcm_t *handle;
+			int rc;
+
+			snd_pcm_info_set_device(dev_info, dev_idx);
+			snd_pcm_info_set_subdevice(dev_info, 0);
+			snd_pcm_info_set_stream(dev_info, streams[i]);
+			if (snd_ctl_pcm_info(alsa_card->handle, dev_info))
+				continue;
+
+			if (cras_alsa_pcm_open(&handle, pcm_name, streams[i]))
+				continue;
+
+			probed = calloc(1, sizeof(*probed));
+			if (probed == NULL) {
+				cras_alsa_pcm_close(handle);
+				cras_startup_log_end(phase);
+				return;
+			}
+			probed->device_index = dev_idx;
+			probed->direction =
+				streams[i] == SND_PCM_STREAM_PLAYBACK ?
+					CRAS_STREAM_OUTPUT :
+					CRAS_STREAM_INPUT;
+			rc = cras_alsa_fill_properties(handle, &probed->rates,
+						       &probed->channel_counts,
+						       &probed->formats);
+			cras_alsa_pcm_close(handle);
+			if (rc) {
+				free(probed);
+				continue;
+			}
+			DL_APPEND(alsa_card->probed_formats, probed);
+		}
+	}
+	cras_startup_log_end(phase);
+}
+
+/* Hands the probed formats to the iodevs of the card. */
+static void set_probed_formats(struct cras_alsa_card *alsa_card)
+{
+	struct probed_formats *probed;
+	struct iodev_list_node *node;
+
+	DL_FOREACH (alsa_card->probed_formats, probed) {
+		DL_FOREACH (alsa_card->iodevs, node) {
+			if (node->direction == probed->direction &&
+			    alsa_iodev_index(node->iodev) ==
+				    probed->device_index)
+				break;
+		}
+		if (node) {
+			alsa_iodev_set_probed_formats(node->iodev,
+						      probed->rates,
+						      probed->channel_counts,
+						      probed->formats);
+		} else {
+			free(probed->rates);
+			free(probed->channel_counts);
+			free(probed->formats);
+		}
+		DL_DELETE(alsa_card->probed_formats, probed);
+		free(probed);
+	}
+}
+
+static int commit_card(struct cras_alsa_card *alsa_card,
+		       struct cras_alsa_card_info *info,
+		       struct cras_device_blocklist *blocklist)
+{
+	int rc, n;
 
 	if (alsa_card->ucm && ucm_has_fully_specified_ucm_flag(alsa_card->ucm))
 		rc = add_controls_and_iodevs_with_ucm(info, alsa_card,
-						      card_name, handle);
+						      alsa_card->card_name,
+						      alsa_card->handle);
 	else
 		rc = add_controls_and_iodevs_by_matching(
-			info, blocklist, alsa_card, card_name, handle);
+			info, blocklist, alsa_card, alsa_card->card_name,
+			alsa_card->handle);
 	if (rc)
-		goto error_bail;
+		return rc;
 
 	configure_echo_reference_dev(alsa_card);
+	set_probed_formats(alsa_card);
 
 	n = alsa_card->hctl ? snd_hctl_poll_descriptors_count(alsa_card->hctl) :
 			      0;
@@ -567,18 +751,15 @@ struct cras_alsa_card *cras_alsa_card_create(
 		int i;
 
 		pollfds = malloc(n * sizeof(*pollfds));
-		if (pollfds == NULL) {
-			rc = -ENOMEM;
-			goto error_bail;
-		}
+		if (pollfds == NULL)
+			return -ENOMEM;
 
 		n = snd_hctl_poll_descriptors(alsa_card->hctl, pollfds, n);
 		for (i = 0; i < n; i++) {
 			registered_fd = calloc(1, sizeof(*registered_fd));
 			if (registered_fd == NULL) {
 				free(pollfds);
-				rc = -ENOMEM;
-				goto error_bail;
+				return -ENOMEM;
 			}
 			registered_fd->fd = pollfds[i].fd;
 			DL_APPEND(alsa_card->hctl_poll_fds, registered_fd);
@@ -588,31 +769,48 @@ struct cras_alsa_card *cras_alsa_card_create(
 			if (rc < 0) {
 				DL_DELETE(alsa_card->hctl_poll_fds,
 					  registered_fd);
+				free(registered_fd);
 				free(pollfds);
-				goto error_bail;
+				return rc;
 			}
 		}
 		free(pollfds);
 	}
 
-	snd_ctl_close(handle);
-	return alsa_card;
+	snd_ctl_close(alsa_card->handle);
+	alsa_card->handle = NULL;
+	return 0;
+}
 
-error_bail:
-	if (handle != NULL)
-		snd_ctl_close(handle);
-	cras_alsa_card_destroy(alsa_card);
-	return NULL;
+int cras_alsa_card_commit(struct cras_alsa_card *alsa_card,
+			  struct cras_alsa_card_info *info,
+			  struct cras_device_blocklist *blocklist)
+{
+	int phase, rc;
+
+	phase = cras_startup_log_begin(STARTUP_CARD_COMMIT, info->card_index,
+				       0);
+	rc = commit_card(alsa_card, info, blocklist);
+	cras_startup_log_end(phase);
+	return rc;
 }
 
 void cras_alsa_card_destroy(struct cras_alsa_card *alsa_card)
 {
 	struct iodev_list_node *curr;
 	struct hctl_poll_fd *poll_fd;
+	struct probed_formats *probed;
 
 	if (alsa_card == NULL)
 		return;
 
+	DL_FOREACH (alsa_card->probed_formats, probed) {
+		free(probed->rates);
+		free(probed->channel_counts);
+		free(probed->formats);
+		DL_DELETE(alsa_card->probed_formats, probed);
+		free(probed);
+	}
 	DL_FOREACH (alsa_card->iodevs, curr) {
 		alsa_iodev_destroy(curr->iodev);
 		DL_DELETE(alsa_card->iodevs, curr);
@@ -631,6 +829,9 @@ void cras_alsa_card_destroy(struct cras_alsa_card *alsa_card)
 		cras_alsa_mixer_destroy(alsa_card->mixer);
 	if (alsa_card->config)
 		cras_card_config_destroy(alsa_card->config);
+	if (alsa_card->handle)
+		snd_ctl_close(alsa_card->handle);
+	free(alsa_card->card_name);
 	free(alsa_card);
 }
 
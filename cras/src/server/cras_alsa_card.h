@@ -34,6 +34,51 @@ struct cras_alsa_card *cras_alsa_card_create(
 	struct cras_alsa_card_info *info, const char *device_config_dir,
 	struct cras_device_blocklist *blocklist, const char *ucm_suffix);
 
+/* Creating a card is split in two so that cards can be probed concurrently.
+ * cras_alsa_card_probe opens the card and loads its UCM config, controls and
+ * mixer, and cras_alsa_card_probe_formats probes the formats of its PCMs.
+ * Both only touch the card, so they can run on any thread.
+ * cras_alsa_card_commit then creates the iodevs and adds them to the system,
+ * on the main thread. cras_alsa_card_create does all three steps, without
+ * probing formats.
+ */
+
+/* Probes the card without adding anything to the system.
+ * Args:
+ *    card_info - Contains the card index, type, and priority.
+ *    device_config_dir - The directory of device configs which contains the
+ *                        volume curves.
+ *    ucm_suffix - The ucm config name is formed as <card-name>.<suffix>
+ * Returns:
+ *    A pointer to the probed cras_alsa_card which must later be committed
+ *    or freed by calling cras_alsa_card_destroy, NULL on error.
+ */
+struct cras_alsa_card *cras_alsa_card_probe(struct cras_alsa_card_info *info,
+					    const char *device_config_dir,
+					    const char *ucm_suffix);
+
+/* Probes the formats supported by each PCM device of a probed card, which
+ * otherwise happens when the device is first opened.
+ * Args:
+ *    alsa_card - The cras_alsa_card pointer returned from
+ *        cras_alsa_card_probe.
+ */
+void cras_alsa_card_probe_formats(struct cras_alsa_card *alsa_card);
+
+/* Enumerates the devices of a probed card and adds them to the system as
+ * possible playback or capture endpoints. Must run on the main thread.
+ * Args:
+ *    alsa_card - The cras_alsa_card pointer returned from
+ *        cras_alsa_card_probe.
+ *    card_info - The card_info the card was probed with.
+ *    blocklist - List of devices that should be ignored.
+ * Returns:
+ *    0 on success. On error a negative code, and the card must be destroyed.
+ */
+int cras_alsa_card_commit(struct cras_alsa_card *alsa_card,
+			  struct cras_alsa_card_info *info,
+			  struct cras_device_blocklist *blocklist);
+
 /* Destroys a cras_alsa_card that was returned from cras_alsa_card_create.
  * Args:
  *    alsa_card - The cras_alsa_card pointer returned from
@@ -45,7 +45,7 @@ static const size_t test_channel_counts[] = { 10, 6, 4, 2, 1, 8, 0 };
 
 static const snd_pcm_format_t test_formats[] = {
 	SND_PCM_FORMAT_S16_LE, SND_PCM_FORMAT_S24_LE, SND_PCM_FORMAT_S32_LE,
-	SND_PCM_FORMAT_S24_3LE, (snd_pcm_format_t)0
+	SND_PCM_FORMAT_S24_3LE, SND_PCM_FORMAT_FLOAT_LE, (snd_pcm_format_t)0
 };
 
 /* Looks up the list of channel map for the one can exactly matches
@@ -235,6 +235,21 @@ int cras_alsa_pcm_start(snd_pcm_t *handle)
 	return snd_pcm_start(handle);
 }
 
+int cras_alsa_pcm_reprepare(snd_pcm_t *handle)
+{
+	int rc;
+
+	if (snd_pcm_state(handle) == SND_PCM_STATE_DISCONNECTED)
+		return -ENODEV;
+
+	/* Dropping works from the suspended state too, and goes back to the
+	 * setup state with the parameters in place. */
+	rc = snd_pcm_drop(handle);
+	if (rc < 0)
+		return rc;
+	return snd_pcm_prepare(handle);
+}
+
 int cras_alsa_pcm_drain(snd_pcm_t *handle)
 {
 	return snd_pcm_drain(handle);
@@ -281,6 +296,25 @@ int cras_alsa_resume_appl_ptr(snd_pcm_t *handle, snd_pcm_uframes_t ahead)
 	return 0;
 }
 
+snd_pcm_sframes_t cras_alsa_rewind(snd_pcm_t *handle,
+				   snd_pcm_uframes_t frames)
+{
+	snd_pcm_sframes_t rc;
+
+	rc = snd_pcm_rewindable(handle);
+	if (rc < 0)
+		return rc;
+	if ((snd_pcm_uframes_t)rc < frames)
+		frames = rc;
+	if (frames == 0)
+		return 0;
+
+	rc = snd_pcm_rewind(handle, frames);
+	if (rc < 0)
+		syslog(LOG_ERR, "Fail to rewind: %s", snd_strerror(rc));
+	return rc;
+}
+
 int cras_alsa_set_channel_map(snd_pcm_t *handle, struct cras_audio_format *fmt)
 {
 	size_t i, ch;
@@ -466,11 +500,14 @@ int cras_alsa_set_hwparams(snd_pcm_t *handle, struct cras_audio_format *format,
 		syslog(LOG_ERR, "Disabling resampling %s\n", snd_strerror(err));
 		return err;
 	}
-	/* Always interleaved. */
+	/* Interleaved if the hardware can, planar otherwise. */
 	err = snd_pcm_hw_params_set_access(handle, hwparams,
 					   SND_PCM_ACCESS_MMAP_INTERLEAVED);
+	if (err < 0)
+		err = snd_pcm_hw_params_set_access(
+			handle, hwparams, SND_PCM_ACCESS_MMAP_NONINTERLEAVED);
 	if (err < 0) {
-		syslog(LOG_ERR, "Setting interleaved %s\n", snd_strerror(err));
+		syslog(LOG_ERR, "Setting mmap access %s\n", snd_strerror(err));
 		return err;
 	}
 	/* If period_wakeup flag is not set, try to disable ALSA wakeups,
@@ -556,7 +593,7 @@ int cras_alsa_set_hwparams(snd_pcm_t *handle, struct cras_audio_format *format,
 	return 0;
 }
 
-int cras_alsa_set_swparams(snd_pcm_t *handle)
+int cras_alsa_set_swparams(snd_pcm_t *handle, int *hw_tstamps)
 {
 	int err;
 	snd_pcm_sw_params_t *swparams;
@@ -593,6 +630,20 @@ int cras_alsa_set_swparams(snd_pcm_t *handle)
 		return err;
 	}
 
+	/* Time stamp hardware pointer updates on the audio thread clock. Older
+	 * kernels only stamp CLOCK_MONOTONIC, which can't be compared. */
+	*hw_tstamps = 0;
+	err = snd_pcm_sw_params_set_tstamp_mode(handle, swparams,
+						SND_PCM_TSTAMP_ENABLE);
+	if (err == 0)
+		err = snd_pcm_sw_params_set_tstamp_type(
+			handle, swparams, SND_PCM_TSTAMP_TYPE_MONOTONIC_RAW);
+	if (err < 0)
+		syslog(LOG_INFO, "No raw hardware time stamps: %s\n",
+		       snd_strerror(err));
+	else
+		*hw_tstamps = 1;
+
 	err = snd_pcm_sw_params(handle, swparams);
 
 	if (err < 0) {
@@ -661,13 +712,20 @@ error:
 }
 
 int cras_alsa_get_delay_frames(snd_pcm_t *handle, snd_pcm_uframes_t buf_size,
-			       snd_pcm_sframes_t *delay)
+			       snd_pcm_sframes_t *delay,
+			       struct timespec *tstamp)
 {
+	snd_pcm_uframes_t avail;
 	int rc;
 
 	rc = snd_pcm_delay(handle, delay);
 	if (rc < 0)
 		return rc;
+	/* snd_pcm_delay synced the hardware pointer this stamp belongs to. */
+	if (snd_pcm_htimestamp(handle, &avail, tstamp) < 0) {
+		tstamp->tv_sec = 0;
+		tstamp->tv_nsec = 0;
+	}
 	if (*delay > (snd_pcm_sframes_t)buf_size)
 		*delay = buf_size;
 	if (*delay < 0)
@@ -730,16 +788,32 @@ int cras_alsa_mmap_get_whole_buffer(snd_pcm_t *handle, uint8_t **dst)
 	return cras_alsa_mmap_begin(handle, 0, dst, &offset, &frames);
 }
 
-int cras_alsa_mmap_begin(snd_pcm_t *handle, unsigned int format_bytes,
-			 uint8_t **dst, snd_pcm_uframes_t *offset,
-			 snd_pcm_uframes_t *frames)
+int cras_alsa_is_noninterleaved(snd_pcm_t *handle)
+{
+	snd_pcm_hw_params_t *hwparams;
+	snd_pcm_access_t access;
+	int rc;
+
+	snd_pcm_hw_params_alloca(&hwparams);
+	rc = snd_pcm_hw_params_current(handle, hwparams);
+	if (rc < 0)
+		return rc;
+	rc = snd_pcm_hw_params_get_access(hwparams, &access);
+	if (rc < 0)
+		return rc;
+	return access == SND_PCM_ACCESS_MMAP_NONINTERLEAVED;
+}
+
+/* Calls snd_pcm_mmap_begin, recovering from suspend and xruns. */
+static int mmap_begin_areas(snd_pcm_t *handle,
+			    const snd_pcm_channel_area_t **areas,
+			    snd_pcm_uframes_t *offset, snd_pcm_uframes_t *frames)
 {
 	int rc;
 	unsigned int attempts = 0;
-	const snd_pcm_channel_area_t *my_areas;
 
 	while (attempts++ < MAX_MMAP_BEGIN_ATTEMPTS) {
-		rc = snd_pcm_mmap_begin(handle, &my_areas, offset, frames);
+		rc = snd_pcm_mmap_begin(handle, areas, offset, frames);
 		if (rc == -ESTRPIPE) {
 			/* First handle suspend/resume. */
 			rc = cras_alsa_attempt_resume(handle);
@@ -764,12 +838,43 @@ int cras_alsa_mmap_begin(snd_pcm_t *handle, unsigned int format_bytes,
 			syslog(LOG_INFO, "mmap_begin set frames to 0.");
 			return -EIO;
 		}
-		*dst = (uint8_t *)my_areas[0].addr + (*offset) * format_bytes;
 		return 0;
 	}
 	return -EIO;
 }
 
+int cras_alsa_mmap_begin(snd_pcm_t *handle, unsigned int format_bytes,
+			 uint8_t **dst, snd_pcm_uframes_t *offset,
+			 snd_pcm_uframes_t *frames)
+{
+	const snd_pcm_channel_area_t *my_areas;
+	int rc;
+
+	rc = mmap_begin_areas(handle, &my_areas, offset, frames);
+	if (rc < 0)
+		return rc;
+	*dst = (uint8_t *)my_areas[0].addr + (*offset) * format_bytes;
+	return 0;
+}
+
+int cras_alsa_mmap_begin_planar(snd_pcm_t *handle, unsigned int num_channels,
+				uint8_t **channels, snd_pcm_uframes_t *offset,
+				snd_pcm_uframes_t *frames)
+{
+	const snd_pcm_channel_area_t *my_areas;
+	unsigned int i;
+	int rc;
+
+	rc = mmap_begin_areas(handle, &my_areas, offset, frames);
+	if (rc < 0)
+		return rc;
+	for (i = 0; i < num_channels; i++)
+		channels[i] = (uint8_t *)my_areas[i].addr +
+			      (my_areas[i].first +
+			       (*offset) * my_areas[i].step) / 8;
+	return 0;
+}
+
 int cras_alsa_mmap_commit(snd_pcm_t *handle, snd_pcm_uframes_t offset,
 			  snd_pcm_uframes_t frames)
 {
@@ -62,6 +62,16 @@ int cras_alsa_pcm_close(snd_pcm_t *handle);
  */
 int cras_alsa_pcm_start(snd_pcm_t *handle);
 
+/* Brings a PCM back to the prepared state after a system suspend, dropping
+ * the samples in its buffer but keeping its hardware and software parameters.
+ * Args:
+ *    handle - The open PCM.
+ * Returns:
+ *    0 on success, -ENODEV if the PCM was disconnected, or another negative
+ *    error if it has to be reopened.
+ */
+int cras_alsa_pcm_reprepare(snd_pcm_t *handle);
+
 /* Drains an alsa device, thin wrapper to snd_pcm_drain.
  * Args:
  *    handle - Filled with a pointer to the opened pcm.
@@ -100,6 +110,18 @@ int cras_alsa_pcm_drain(snd_pcm_t *handle);
  */
 int cras_alsa_resume_appl_ptr(snd_pcm_t *handle, snd_pcm_uframes_t ahead);
 
+/* Moves appl_ptr back by up to frames, as far as the frames written but not
+ * yet played allow.
+ * Args:
+ *    handle - The open PCM.
+ *    frames - The most frames to move appl_ptr back by.
+ * Returns:
+ *    The number of frames appl_ptr moved back. A negative error code on
+ *    failure.
+ */
+snd_pcm_sframes_t cras_alsa_rewind(snd_pcm_t *handle,
+				   snd_pcm_uframes_t frames);
+
 /* Probes properties of the alsa device.
  * Args:
  *    handle - The open PCM to configure.
@@ -135,10 +157,12 @@ int cras_alsa_set_hwparams(snd_pcm_t *handle, struct cras_audio_format *format,
 /* Sets up the swparams to alsa.
  * Args:
  *    handle - The open PCM to configure.
+ *    hw_tstamps - Set to 1 if ALSA time stamps hardware pointer updates on
+ *        CLOCK_MONOTONIC_RAW, 0 if its time stamps can't be used.
  * Returns:
  *    0 on success, negative error on failure.
  */
-int cras_alsa_set_swparams(snd_pcm_t *handle);
+int cras_alsa_set_swparams(snd_pcm_t *handle, int *hw_tstamps);
 
 /* Get the number of used frames in the alsa buffer.
  *
@@ -169,11 +193,14 @@ int cras_alsa_get_avail_frames(snd_pcm_t *handle, snd_pcm_uframes_t buf_size,
  *    handle - The open PCM to configure.
  *    buf_size - Number of frames in the ALSA buffer.
  *    delay - Filled with the number of delay frames.
+ *    tstamp - Filled with the time the delay was measured by the hardware,
+ *        zeroed if there is no time stamp.
  * Returns:
  *    0 on success, negative error on failure.
  */
 int cras_alsa_get_delay_frames(snd_pcm_t *handle, snd_pcm_uframes_t buf_size,
-			       snd_pcm_sframes_t *delay);
+			       snd_pcm_sframes_t *delay,
+			       struct timespec *tstamp);
 
 /* Wrapper for snd_pcm_mmap_begin where only buffer is concerned.
  * Offset and frames from cras_alsa_mmap_begin are neglected.
@@ -201,6 +228,32 @@ int cras_alsa_mmap_begin(snd_pcm_t *handle, unsigned int format_bytes,
 			 uint8_t **dst, snd_pcm_uframes_t *offset,
 			 snd_pcm_uframes_t *frames);
 
+/* Checks the access the hardware params were set with.
+ * Args:
+ *    handle - The open PCM, with its hardware params set.
+ * Returns:
+ *    1 if each channel has a buffer of its own, 0 if the channels are
+ *    interleaved, negative error code on failure.
+ */
+int cras_alsa_is_noninterleaved(snd_pcm_t *handle);
+
+/* Like cras_alsa_mmap_begin, for a PCM whose channels each have a buffer of
+ * their own.
+ * Args:
+ *    handle - The open PCM to configure.
+ *    num_channels - The number of channels of the PCM.
+ *    channels - Filled with where the audio of each channel starts.
+ *    offset - Filled with the offset to pass back to commit.
+ *    frames - Passed with the max number of frames to request. Filled with the
+ *        max number to use.
+ * Returns:
+ *    zero on success, negative error code for fatal
+ *    errors.
+ */
+int cras_alsa_mmap_begin_planar(snd_pcm_t *handle, unsigned int num_channels,
+				uint8_t **channels, snd_pcm_uframes_t *offset,
+				snd_pcm_uframes_t *frames);
+
 /* Wrapper for snd_pcm_mmap_commit
  * Args:
  *    handle - The open PCM to configure.
@@ -13,6 +13,9 @@
 #include <sys/time.h>
 #include <syslog.h>
 #include <time.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "audio_thread.h"
 #include "cras_alsa_helpers.h"
@@ -21,6 +24,7 @@
 #include "cras_alsa_mixer.h"
 #include "cras_alsa_ucm.h"
 #include "cras_audio_area.h"
+#include "cras_channel_matrix.h"
 #include "cras_config.h"
 #include "cras_utf8.h"
 #include "cras_hotword_handler.h"
@@ -68,12 +72,12 @@
 #define SEVERE_UNDERRUN_MS 5000
 
 /*
- * When entering no stream state, audio thread needs to fill extra zeros in
- * order to play remaining valid frames. The value indicates how many
- * time will be filled.
+ * Output devices run without period wakeups, so between queries of ALSA the
+ * hw_ptr moves at the estimated device rate. The level is predicted from the
+ * last query for at most this long, then ALSA is queried again to re-sync.
  */
-static const struct timespec no_stream_fill_zeros_duration = {
-	0, 50 * 1000 * 1000 /* 50 msec. */
+static const struct timespec hw_ptr_resync_interval = {
+	0, 100 * 1000 * 1000 /* 100 msec. */
 };
 
 /*
@@ -126,6 +130,8 @@ struct alsa_input_node {
  * ucm - CRAS use case manager, if configuration is found.
  * mmap_offset - offset returned from mmap_begin.
  * poll_fd - Descriptor used to block until data is ready.
+ * hotword_draining - true from a hotword trigger until the history the DSP
+ *                    buffered before it has been read.
  * dma_period_set_microsecs - If non-zero, the value to apply to the dma_period.
  * free_running - true if device is playing zeros in the buffer without
  *                user filling meaningful data. The device buffer is filled
@@ -136,6 +142,28 @@ struct alsa_input_node {
  * default_volume_curve - Default volume curve that converts from an index
  *                        to dBFS.
  * has_dependent_dev - true if this iodev has dependent device.
+ * sync_level - For output, the frames queued at the last query of ALSA.
+ * sync_tstamp - When sync_level was read. Zero if there is no valid query
+ *               to predict the hw_ptr from.
+ * written_since_sync - Frames committed to the device since sync_tstamp.
+ * delay_extra - Frames of delay beyond the queued frames, from the last
+ *               query of the delay.
+ * delay_resync - true if the next delay_frames call must query ALSA.
+ * hw_tstamps - true if ALSA time stamps hardware pointer updates on the
+ *              audio thread clock. Otherwise levels are stamped when read.
+ * uncached_dma - true if the DMA buffer is uncached or write-combined memory,
+ *                where the reads of mixing in place are slow.
+ * mix_buffer - For uncached_dma, a cached copy of the DMA buffer at the same
+ *              offsets. Output is mixed here and streamed to the DMA buffer
+ *              when committed. For noninterleaved, the interleaved audio,
+ *              split to or gathered from the channels of the DMA buffer.
+ * mmap_dst - The DMA area returned by the last mmap_begin.
+ * noninterleaved - true if the hardware only takes planar access, each
+ *                  channel with a buffer of its own.
+ * mmap_channels - For noninterleaved, where each channel of the DMA area
+ *                 returned by the last mmap_begin starts.
+ * probed_rates, probed_channel_counts, probed_formats - Formats probed when
+ *     the card was added, used instead of probing on the first open.
  */
 struct alsa_io {
 	struct cras_iodev base;
@@ -156,6 +184,7 @@ struct alsa_io {
 	struct cras_use_case_mgr *ucm;
 	snd_pcm_uframes_t mmap_offset;
 	int poll_fd;
+	int hotword_draining;
 	unsigned int dma_period_set_microsecs;
 	int free_running;
 	unsigned int filled_zeros_for_draining;
@@ -163,6 +192,20 @@ struct alsa_io {
 	struct cras_volume_curve *default_volume_curve;
 	int hwparams_set;
 	int has_dependent_dev;
+	unsigned int sync_level;
+	struct timespec sync_tstamp;
+	unsigned int written_since_sync;
+	unsigned int delay_extra;
+	int delay_resync;
+	int hw_tstamps;
+	int uncached_dma;
+	uint8_t *mix_buffer;
+	uint8_t *mmap_dst;
+	int noninterleaved;
+	uint8_t **mmap_channels;
+	size_t *probed_rates;
+	size_t *probed_channel_counts;
+	snd_pcm_format_t *probed_formats;
 };
 
 static void init_device_settings(struct alsa_io *aio);
@@ -314,6 +357,70 @@ static int set_hwparams(struct cras_iodev *iodev)
  * iodev callbacks.
  */
 
+/* Forgets the last query of ALSA, so the next level is read from the device.
+ * Called whenever hw_ptr or appl_ptr move other than by playback and
+ * put_buffer. */
+static void invalidate_hw_ptr_prediction(struct alsa_io *aio)
+{
+	aio->sync_tstamp.tv_sec = 0;
+	aio->sync_tstamp.tv_nsec = 0;
+	aio->written_since_sync = 0;
+	aio->delay_resync = 1;
+}
+
+/* Predicts the frames queued in an output device from the last query of
+ * ALSA, the frames written since and the estimated device rate.
+ * Returns:
+ *    The predicted level, or negative if the prediction can't be trusted
+ *    and ALSA must be queried.
+ */
+static int predict_frames_queued(const struct alsa_io *aio)
+{
+	const struct cras_iodev *iodev = &aio->base;
+	struct timespec now, elapsed;
+	double rate;
+	int level;
+
+	if (iodev->direction != CRAS_STREAM_OUTPUT ||
+	    iodev->state != CRAS_IODEV_STATE_NORMAL_RUN || aio->free_running ||
+	    timespec_is_zero(&aio->sync_tstamp))
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	subtract_timespecs(&now, &aio->sync_tstamp, &elapsed);
+	if (timespec_after(&elapsed, &hw_ptr_resync_interval))
+		return -1;
+
+	rate = iodev->format->frame_rate * cras_iodev_get_est_rate_ratio(iodev);
+	level = (int)(aio->sync_level + aio->written_since_sync) -
+		(int)cras_time_to_frames(&elapsed, rate);
+
+	/* The prediction can't see DMA bursts or a stalled device, so only
+	 * trust it while the level is well clear of an underrun. */
+	if (level < (int)(iodev->min_buffer_level + iodev->min_cb_level) ||
+	    level > (int)iodev->buffer_size)
+		return -1;
+	return level;
+}
+
+/* The history arrives as one burst at the trigger, which would look like a
+ * device running far too fast. While it is drained, levels are reported
+ * without a time stamp so they stay out of the rate estimator. Once the
+ * level is down to one callback the device captures in real time again and
+ * the estimator starts over. */
+static void update_hotword_drain(struct alsa_io *aio,
+				 snd_pcm_uframes_t frames,
+				 struct timespec *tstamp)
+{
+	if (frames > aio->base.min_cb_level) {
+		tstamp->tv_sec = 0;
+		tstamp->tv_nsec = 0;
+		return;
+	}
+	aio->hotword_draining = 0;
+	cras_iodev_reset_rate_estimator(&aio->base);
+}
+
 static int frames_queued(const struct cras_iodev *iodev,
 			 struct timespec *tstamp)
 {
@@ -321,32 +428,71 @@ static int frames_queued(const struct cras_iodev *iodev,
 	int rc;
 	snd_pcm_uframes_t frames;
 
+	/* A predicted level has no hardware timestamp, which also keeps it
+	 * out of the rate estimator it is derived from. */
+	rc = predict_frames_queued(aio);
+	if (rc >= 0) {
+		tstamp->tv_sec = 0;
+		tstamp->tv_nsec = 0;
+		return rc;
+	}
+
 	rc = cras_alsa_get_avail_frames(aio->handle, aio->base.buffer_size,
 					aio->severe_underrun_frames,
 					iodev->info.name, &frames, tstamp);
 	if (rc < 0) {
+		invalidate_hw_ptr_prediction(aio);
 		if (rc == -EPIPE)
 			aio->num_severe_underruns++;
 		return rc;
 	}
-	clock_gettime(CLOCK_MONOTONIC_RAW, tstamp);
-	if (iodev->direction == CRAS_STREAM_INPUT)
+	/* The hardware time stamp dates the level to the pointer update
+	 * rather than to when this wake got around to reading it. */
+	if (!aio->hw_tstamps || timespec_is_zero(tstamp))
+		clock_gettime(CLOCK_MONOTONIC_RAW, tstamp);
+	if (iodev->direction == CRAS_STREAM_INPUT) {
+		if (aio->hotword_draining)
+			update_hotword_drain(aio, frames, tstamp);
 		return (int)frames;
+	}
 
 	/* For output, return number of frames that are used. */
-	return iodev->buffer_size - frames;
+	aio->sync_level = iodev->buffer_size - frames;
+	aio->sync_tstamp = *tstamp;
+	aio->written_since_sync = 0;
+	aio->delay_resync = 1;
+	return aio->sync_level;
 }
 
 static int delay_frames(const struct cras_iodev *iodev)
 {
 	struct alsa_io *aio = (struct alsa_io *)iodev;
 	snd_pcm_sframes_t delay;
+	int level;
 	int rc;
 
+	/* The delay is queried once after each query of the level, and
+	 * predicted from the level in between. */
+	level = predict_frames_queued(aio);
+	if (level >= 0 && !aio->delay_resync) {
+		aio->base.delay_tstamp.tv_sec = 0;
+		aio->base.delay_tstamp.tv_nsec = 0;
+		return MIN(level + aio->delay_extra, iodev->buffer_size);
+	}
+
 	rc = cras_alsa_get_delay_frames(aio->handle, iodev->buffer_size,
-					&delay);
+					&delay, &aio->base.delay_tstamp);
 	if (rc < 0)
 		return rc;
+	if (!aio->hw_tstamps) {
+		aio->base.delay_tstamp.tv_sec = 0;
+		aio->base.delay_tstamp.tv_nsec = 0;
+	}
+
+	if (level >= 0) {
+		aio->delay_extra = MAX(delay - level, 0);
+		aio->delay_resync = 0;
+	}
 
 	return (int)delay;
 }
@@ -358,7 +504,8 @@ static int close_dev(struct cras_iodev *iodev)
 	/* Removes audio thread callback from main thread. */
 	if (aio->poll_fd >= 0)
 		audio_thread_rm_callback_sync(
-			cras_iodev_list_get_audio_thread(), aio->poll_fd);
+			cras_iodev_list_get_dev_audio_thread(iodev),
+			aio->poll_fd);
 	if (!aio->handle)
 		return 0;
 	cras_alsa_pcm_close(aio->handle);
@@ -366,6 +513,12 @@ static int close_dev(struct cras_iodev *iodev)
 	aio->free_running = 0;
 	aio->filled_zeros_for_draining = 0;
 	aio->hwparams_set = 0;
+	invalidate_hw_ptr_prediction(aio);
+	free(aio->mix_buffer);
+	aio->mix_buffer = NULL;
+	free(aio->mmap_channels);
+	aio->mmap_channels = NULL;
+	aio->noninterleaved = 0;
 	cras_iodev_free_format(&aio->base);
 	cras_iodev_free_audio_area(&aio->base);
 	return 0;
@@ -375,9 +528,11 @@ static int empty_hotword_cb(void *arg, int revents)
 {
 	/* Only need this once. */
 	struct alsa_io *aio = (struct alsa_io *)arg;
-	audio_thread_rm_callback(aio->poll_fd);
+	audio_thread_rm_callback(
+		cras_iodev_list_get_dev_audio_thread(&aio->base), aio->poll_fd);
 	aio->poll_fd = -1;
 	aio->base.input_streaming = 1;
+	aio->hotword_draining = 1;
 
 	/* Send hotword triggered signal. */
 	cras_hotword_send_triggered_msg();
@@ -385,11 +540,9 @@ static int empty_hotword_cb(void *arg, int revents)
 	return 0;
 }
 
-static int open_dev(struct cras_iodev *iodev)
+/* Returns the name of the PCM to open for the active node. */
+static const char *get_pcm_name(const struct alsa_io *aio)
 {
-	struct alsa_io *aio = (struct alsa_io *)iodev;
-	snd_pcm_t *handle;
-	int rc;
 	const char *pcm_name = NULL;
 
 	if (aio->base.direction == CRAS_STREAM_OUTPUT) {
@@ -405,8 +558,16 @@ static int open_dev(struct cras_iodev *iodev)
 	/* For legacy UCM path which doesn't have PlaybackPCM or CapturePCM. */
 	if (pcm_name == NULL)
 		pcm_name = aio->pcm_name;
+	return pcm_name;
+}
+
+static int open_dev(struct cras_iodev *iodev)
+{
+	struct alsa_io *aio = (struct alsa_io *)iodev;
+	snd_pcm_t *handle;
+	int rc;
 
-	rc = cras_alsa_pcm_open(&handle, pcm_name, aio->alsa_stream);
+	rc = cras_alsa_pcm_open(&handle, get_pcm_name(aio), aio->alsa_stream);
 	if (rc < 0)
 		return rc;
 
@@ -427,6 +588,7 @@ static int configure_dev(struct cras_iodev *iodev)
 		return -EINVAL;
 	aio->free_running = 0;
 	aio->filled_zeros_for_draining = 0;
+	invalidate_hw_ptr_prediction(aio);
 	aio->severe_underrun_frames =
 		SEVERE_UNDERRUN_MS * iodev->format->frame_rate / 1000;
 
@@ -440,13 +602,34 @@ static int configure_dev(struct cras_iodev *iodev)
 	if (rc < 0)
 		return rc;
 
+	rc = cras_alsa_is_noninterleaved(aio->handle);
+	if (rc < 0)
+		return rc;
+	aio->noninterleaved = rc;
+	if (aio->noninterleaved) {
+		free(aio->mmap_channels);
+		aio->mmap_channels = (uint8_t **)calloc(
+			iodev->format->num_channels, sizeof(uint8_t *));
+		if (!aio->mmap_channels)
+			return -ENOMEM;
+	}
+
+	if (aio->uncached_dma || aio->noninterleaved) {
+		free(aio->mix_buffer);
+		aio->mix_buffer =
+			(uint8_t *)calloc(iodev->buffer_size,
+					  cras_get_format_bytes(iodev->format));
+		if (!aio->mix_buffer)
+			return -ENOMEM;
+	}
+
 	/* Set channel map to device */
 	rc = cras_alsa_set_channel_map(aio->handle, iodev->format);
 	if (rc < 0)
 		return rc;
 
 	/* Configure software params. */
-	rc = cras_alsa_set_swparams(aio->handle);
+	rc = cras_alsa_set_swparams(aio->handle, &aio->hw_tstamps);
 	if (rc < 0)
 		return rc;
 
@@ -454,6 +637,7 @@ static int configure_dev(struct cras_iodev *iodev)
 	init_device_settings(aio);
 
 	aio->poll_fd = -1;
+	aio->hotword_draining = 0;
 	if (iodev->active_node->type == CRAS_NODE_TYPE_HOTWORD) {
 		struct pollfd *ufds;
 		int count, i;
@@ -487,6 +671,7 @@ static int configure_dev(struct cras_iodev *iodev)
 
 		if (aio->poll_fd >= 0)
 			audio_thread_add_events_callback(
+				cras_iodev_list_get_dev_audio_thread(iodev),
 				aio->poll_fd, empty_hotword_cb, aio, POLLIN);
 	}
 
@@ -497,6 +682,27 @@ static int configure_dev(struct cras_iodev *iodev)
 	return 0;
 }
 
+static int resume_dev(struct cras_iodev *iodev)
+{
+	struct alsa_io *aio = (struct alsa_io *)iodev;
+	int rc;
+
+	rc = cras_alsa_pcm_reprepare(aio->handle);
+	if (rc < 0) {
+		syslog(LOG_INFO, "Failed to resume %s: %s", aio->pcm_name,
+		       snd_strerror(rc));
+		return rc;
+	}
+	aio->free_running = 0;
+	aio->filled_zeros_for_draining = 0;
+	invalidate_hw_ptr_prediction(aio);
+
+	/* Capture starts right away, playback will wait for samples. */
+	if (aio->alsa_stream == SND_PCM_STREAM_CAPTURE)
+		return cras_alsa_pcm_start(aio->handle);
+	return 0;
+}
+
 /*
  * Check if ALSA device is opened by checking if handle is valid.
  * Note that to fully open a cras_iodev, ALSA device is opened first, then there
@@ -520,6 +726,8 @@ static int start(const struct cras_iodev *iodev)
 	if (snd_pcm_state(handle) == SND_PCM_STATE_RUNNING)
 		return 0;
 
+	invalidate_hw_ptr_prediction(aio);
+
 	if (snd_pcm_state(handle) == SND_PCM_STATE_SUSPENDED) {
 		rc = cras_alsa_attempt_resume(handle);
 		if (rc < 0) {
@@ -538,6 +746,31 @@ static int start(const struct cras_iodev *iodev)
 	return 0;
 }
 
+/* Copies frames between interleaved buf and the channels of a planar DMA
+ * area, in whichever direction from_dma says. */
+static void interleave_channels(uint8_t *buf, uint8_t **channels,
+				const struct cras_audio_format *fmt,
+				unsigned int frames, bool from_dma)
+{
+	size_t sample_bytes = cras_get_format_bytes(fmt) / fmt->num_channels;
+	size_t frame_bytes = cras_get_format_bytes(fmt);
+	unsigned int ch, i;
+
+	for (ch = 0; ch < fmt->num_channels; ch++) {
+		uint8_t *sample = buf + ch * sample_bytes;
+		uint8_t *plane = channels[ch];
+
+		for (i = 0; i < frames; i++) {
+			if (from_dma)
+				memcpy(sample, plane, sample_bytes);
+			else
+				memcpy(plane, sample, sample_bytes);
+			sample += frame_bytes;
+			plane += sample_bytes;
+		}
+	}
+}
+
 static int get_buffer(struct cras_iodev *iodev, struct cras_audio_area **area,
 		      unsigned *frames)
 {
@@ -550,8 +783,43 @@ static int get_buffer(struct cras_iodev *iodev, struct cras_audio_area **area,
 	aio->mmap_offset = 0;
 	format_bytes = cras_get_format_bytes(iodev->format);
 
-	rc = cras_alsa_mmap_begin(aio->handle, format_bytes, &dst,
-				  &aio->mmap_offset, &nframes);
+	/* Without period wakeups ALSA only moves hw_ptr when queried, so the
+	 * room mmap_begin sees is as of the last query. Query again if the
+	 * request doesn't fit in it. */
+	if (iodev->direction == CRAS_STREAM_OUTPUT &&
+	    timespec_is_nonzero(&aio->sync_tstamp) &&
+	    nframes + aio->sync_level + aio->written_since_sync >
+		    iodev->buffer_size) {
+		struct timespec tstamp;
+
+		invalidate_hw_ptr_prediction(aio);
+		rc = frames_queued(iodev, &tstamp);
+		if (rc < 0)
+			return rc;
+	}
+
+	if (aio->noninterleaved) {
+		rc = cras_alsa_mmap_begin_planar(aio->handle,
+						 iodev->format->num_channels,
+						 aio->mmap_channels,
+						 &aio->mmap_offset, &nframes);
+		if (rc == 0) {
+			dst = aio->mix_buffer + aio->mmap_offset * format_bytes;
+			if (iodev->direction == CRAS_STREAM_INPUT)
+				interleave_channels(dst, aio->mmap_channels,
+						    iodev->format, nframes,
+						    true);
+		}
+	} else {
+		rc = cras_alsa_mmap_begin(aio->handle, format_bytes, &dst,
+					  &aio->mmap_offset, &nframes);
+	}
+
+	/* Hand out the cached copy, put_buffer streams it to the device. */
+	if (aio->mix_buffer && !aio->noninterleaved && dst) {
+		aio->mmap_dst = dst;
+		dst = aio->mix_buffer + aio->mmap_offset * format_bytes;
+	}
 
 	iodev->area->frames = nframes;
 	cras_audio_area_config_buf_pointers(iodev->area, iodev->format, dst);
@@ -562,11 +830,53 @@ static int get_buffer(struct cras_iodev *iodev, struct cras_audio_area **area,
 	return rc;
 }
 
+/* Copies mixed output to the DMA buffer. Streaming stores write whole lines
+ * without first reading them, which is slow on uncached memory. */
+static void copy_to_dma(uint8_t *dst, const uint8_t *src, size_t bytes)
+{
+#if defined(__SSE2__)
+	while (bytes && ((uintptr_t)dst & 15)) {
+		*dst++ = *src++;
+		bytes--;
+	}
+	for (; bytes >= 16; bytes -= 16, dst += 16, src += 16)
+		_mm_stream_si128((__m128i *)dst,
+				 _mm_loadu_si128((const __m128i *)src));
+	_mm_sfence();
+#elif defined(__aarch64__)
+	for (; bytes >= 32; bytes -= 32, dst += 32, src += 32)
+		__asm__ volatile("ldp q0, q1, [%1]\n\t"
+				 "stnp q0, q1, [%0]\n\t"
+				 :
+				 : "r"(dst), "r"(src)
+				 : "v0", "v1", "memory");
+#endif
+	memcpy(dst, src, bytes);
+}
+
 static int put_buffer(struct cras_iodev *iodev, unsigned nwritten)
 {
 	struct alsa_io *aio = (struct alsa_io *)iodev;
+	size_t format_bytes = cras_get_format_bytes(iodev->format);
+	uint8_t *mixed;
+	int rc;
+
+	if (aio->mix_buffer) {
+		mixed = aio->mix_buffer + aio->mmap_offset * format_bytes;
+		if (!aio->noninterleaved)
+			copy_to_dma(aio->mmap_dst, mixed,
+				    nwritten * format_bytes);
+		else if (iodev->direction == CRAS_STREAM_OUTPUT)
+			interleave_channels(mixed, aio->mmap_channels,
+					    iodev->format, nwritten, false);
+	}
 
-	return cras_alsa_mmap_commit(aio->handle, aio->mmap_offset, nwritten);
+	rc = cras_alsa_mmap_commit(aio->handle, aio->mmap_offset, nwritten);
+	if (rc < 0)
+		invalidate_hw_ptr_prediction(aio);
+	else
+		aio->written_since_sync += nwritten;
+	return rc;
 }
 
 static int flush_buffer(struct cras_iodev *iodev)
@@ -859,6 +1169,9 @@ static void free_alsa_iodev_resources(struct alsa_io *aio)
 	free(aio->base.supported_rates);
 	free(aio->base.supported_channel_counts);
 	free(aio->base.supported_formats);
+	free(aio->probed_rates);
+	free(aio->probed_channel_counts);
+	free(aio->probed_formats);
 
 	DL_FOREACH (aio->base.nodes, node) {
 		if (aio->base.direction == CRAS_STREAM_OUTPUT) {
@@ -870,7 +1183,8 @@ static void free_alsa_iodev_resources(struct alsa_io *aio)
 			free((void *)ain->pcm_name);
 		}
 		cras_iodev_rm_node(&aio->base, node);
-		free(node->softvol_scalers);
+		cras_channel_matrix_destroy_list(node->channel_matrices);
+		softvol_put_scalers(node->softvol_scalers);
 		free((void *)node->dsp_name);
 		free(node);
 	}
@@ -1179,9 +1493,13 @@ static struct alsa_output_node *new_output(struct alsa_io *aio,
 	output->base.idx = aio->next_ionode_index++;
 	output->base.stable_id =
 		SuperFastHash(name, strlen(name), aio->base.info.stable_id);
-	if (aio->ucm)
+	if (aio->ucm) {
 		output->base.dsp_name =
 			ucm_get_dsp_name_for_dev(aio->ucm, name);
+		ucm_get_adaptive_buffer_levels(
+			aio->ucm, name, &output->base.adaptive_min_buffer_level,
+			&output->base.adaptive_max_buffer_level);
+	}
 
 	if (strcmp(name, "SCO Line Out") == 0)
 		output->base.is_sco_pcm = 1;
@@ -1191,6 +1509,8 @@ static struct alsa_output_node *new_output(struct alsa_io *aio,
 	output->volume_curve = cras_card_config_get_volume_curve_for_control(
 		aio->config,
 		name ? name : cras_alsa_mixer_get_control_name(cras_output));
+	output->base.channel_matrices =
+		cras_card_config_get_channel_matrices(aio->config, name);
 
 	strncpy(output->base.name, name, sizeof(output->base.name) - 1);
 	set_node_initial_state(&output->base, aio->card_type);
@@ -1531,6 +1851,8 @@ static void jack_output_plug_event(const struct cras_alsa_jack *jack,
 
 	cras_alsa_jack_update_monitor_name(jack, node->base.name,
 					   sizeof(node->base.name));
+	node->base.passthrough_supported =
+		plugged && cras_alsa_jack_supports_passthrough(jack);
 
 #ifdef CRAS_DBUS
 	/* The name got from jack might be an invalid UTF8 string. */
@@ -1701,11 +2023,21 @@ static int update_supported_formats(struct cras_iodev *iodev)
 	free(iodev->supported_formats);
 	iodev->supported_formats = NULL;
 
-	err = cras_alsa_fill_properties(aio->handle, &iodev->supported_rates,
-					&iodev->supported_channel_counts,
-					&iodev->supported_formats);
-	if (err)
-		return err;
+	if (aio->probed_rates && !strcmp(get_pcm_name(aio), aio->pcm_name)) {
+		iodev->supported_rates = aio->probed_rates;
+		iodev->supported_channel_counts = aio->probed_channel_counts;
+		iodev->supported_formats = aio->probed_formats;
+		aio->probed_rates = NULL;
+		aio->probed_channel_counts = NULL;
+		aio->probed_formats = NULL;
+	} else {
+		err = cras_alsa_fill_properties(aio->handle,
+						&iodev->supported_rates,
+						&iodev->supported_channel_counts,
+						&iodev->supported_formats);
+		if (err)
+			return err;
+	}
 
 	if (aio->ucm) {
 		/* Allow UCM to override supplied rates. */
@@ -1745,7 +2077,8 @@ static void build_softvol_scalers(struct alsa_io *aio)
 		aout = (struct alsa_output_node *)ionode;
 		curve = get_curve_for_output_node(aio, aout);
 
-		ionode->softvol_scalers = softvol_build_from_curve(curve);
+		softvol_put_scalers(ionode->softvol_scalers);
+		ionode->softvol_scalers = softvol_get_scalers(curve);
 	}
 }
 
@@ -1790,8 +2123,11 @@ static int fill_whole_buffer_with_zeros(struct cras_iodev *iodev)
 		return rc;
 	}
 
+	/* Planar channels share one contiguous mmap area of the same size. */
 	format_bytes = cras_get_format_bytes(iodev->format);
 	memset(dst, 0, iodev->buffer_size * format_bytes);
+	if (aio->mix_buffer)
+		memset(aio->mix_buffer, 0, iodev->buffer_size * format_bytes);
 
 	return 0;
 }
@@ -1806,6 +2142,7 @@ static int adjust_appl_ptr_for_leaving_free_run(struct cras_iodev *odev)
 	snd_pcm_uframes_t ahead;
 
 	ahead = odev->min_buffer_level + odev->min_cb_level;
+	invalidate_hw_ptr_prediction(aio);
 	return cras_alsa_resume_appl_ptr(aio->handle, ahead);
 }
 
@@ -1820,6 +2157,7 @@ static int adjust_appl_ptr_for_underrun(struct cras_iodev *odev)
 
 	ahead = odev->min_buffer_level + odev->min_cb_level +
 		odev->min_cb_level / 2;
+	invalidate_hw_ptr_prediction(aio);
 	return cras_alsa_resume_appl_ptr(aio->handle, ahead);
 }
 
@@ -1861,6 +2199,7 @@ static int adjust_appl_ptr_samples_remaining(struct cras_iodev *odev)
 		if (rc)
 			return rc;
 	}
+	invalidate_hw_ptr_prediction(aio);
 	return cras_alsa_resume_appl_ptr(aio->handle, offset);
 }
 
@@ -1877,6 +2216,20 @@ static int alsa_output_underrun(struct cras_iodev *odev)
 	return adjust_appl_ptr_for_underrun(odev);
 }
 
+static int rewind_output(struct cras_iodev *odev, unsigned int frames)
+{
+	struct alsa_io *aio = (struct alsa_io *)odev;
+	snd_pcm_sframes_t rc;
+
+	/* What's queued while free running is zeros, not worth rewinding. */
+	if (aio->free_running)
+		return 0;
+
+	rc = cras_alsa_rewind(aio->handle, frames);
+	invalidate_hw_ptr_prediction(aio);
+	return rc;
+}
+
 static int possibly_enter_free_run(struct cras_iodev *odev)
 {
 	struct alsa_io *aio = (struct alsa_io *)odev;
@@ -1913,10 +2266,12 @@ static int possibly_enter_free_run(struct cras_iodev *odev)
 		return 0;
 	}
 
-	/* Fill zeros to drain valid samples. */
-	fr_to_write = MIN(cras_time_to_frames(&no_stream_fill_zeros_duration,
-					      odev->format->frame_rate),
-			  odev->buffer_size - real_hw_level);
+	/* Fill the rest of the buffer with zeros to drain valid samples in one
+	 * go. The device wakes once more when they are played, to park in free
+	 * run. */
+	fr_to_write = odev->buffer_size - real_hw_level;
+	if (!fr_to_write)
+		return 0;
 	rc = cras_iodev_fill_odev_zeros(odev, fr_to_write);
 	if (rc)
 		return rc;
@@ -1925,6 +2280,35 @@ static int possibly_enter_free_run(struct cras_iodev *odev)
 	return 0;
 }
 
+/*
+ * While draining to free run, everything queued behind the valid samples is
+ * zeros. Sleep until the valid samples are played instead of waking to top up
+ * the zeros.
+ */
+static unsigned int frames_to_play_in_sleep(struct cras_iodev *odev,
+					    unsigned int *hw_level,
+					    struct timespec *hw_tstamp)
+{
+	struct alsa_io *aio = (struct alsa_io *)odev;
+	unsigned int real_hw_level;
+	int rc;
+
+	if (cras_iodev_state(odev) != CRAS_IODEV_STATE_NO_STREAM_RUN ||
+	    aio->free_running || !aio->filled_zeros_for_draining)
+		return cras_iodev_default_frames_to_play_in_sleep(
+			odev, hw_level, hw_tstamp);
+
+	rc = odev->frames_queued(odev, hw_tstamp);
+	real_hw_level = (rc < 0) ? 0 : rc;
+	*hw_level = (real_hw_level > odev->min_buffer_level) ?
+			    real_hw_level - odev->min_buffer_level :
+			    0;
+
+	if (real_hw_level > aio->filled_zeros_for_draining)
+		return real_hw_level - aio->filled_zeros_for_draining;
+	return 0;
+}
+
 static int leave_free_run(struct cras_iodev *odev)
 {
 	struct alsa_io *aio = (struct alsa_io *)odev;
@@ -2078,6 +2462,8 @@ alsa_iodev_create(size_t card_index, const char *card_name, size_t device_index,
 		aio->base.set_volume = set_alsa_volume;
 		aio->base.set_mute = set_alsa_mute;
 		aio->base.output_underrun = alsa_output_underrun;
+		aio->base.rewind = rewind_output;
+		aio->base.frames_to_play_in_sleep = frames_to_play_in_sleep;
 	}
 	iodev->open_dev = open_dev;
 	iodev->configure_dev = configure_dev;
@@ -2089,6 +2475,7 @@ alsa_iodev_create(size_t card_index, const char *card_name, size_t device_index,
 	iodev->put_buffer = put_buffer;
 	iodev->flush_buffer = flush_buffer;
 	iodev->start = start;
+	iodev->resume = resume_dev;
 	iodev->update_active_node = update_active_node;
 	iodev->update_channel_layout = update_channel_layout;
 	iodev->set_hotword_model = set_hotword_model;
@@ -2099,8 +2486,11 @@ alsa_iodev_create(size_t card_index, const char *card_name, size_t device_index,
 	iodev->get_valid_frames = get_valid_frames;
 	iodev->set_swap_mode_for_node = cras_iodev_dsp_set_swap_mode_for_node;
 
-	if (card_type == ALSA_CARD_TYPE_USB)
+	/* USB devices can take a few hundred ms to open. */
+	if (card_type == ALSA_CARD_TYPE_USB) {
 		iodev->min_buffer_level = USB_EXTRA_BUFFER_FRAMES;
+		iodev->open_off_main = 1;
+	}
 
 	iodev->ramp = cras_ramp_create();
 	if (iodev->ramp == NULL)
@@ -2109,6 +2499,12 @@ alsa_iodev_create(size_t card_index, const char *card_name, size_t device_index,
 
 	aio->mixer = mixer;
 	aio->config = config;
+	/* Keep the devices of a card on one audio thread. */
+	iodev->thread_key = mixer;
+	/* The PCMs of an internal card share its clock. USB cards may clock
+	 * each endpoint on its own, so they keep separate estimates. */
+	if (card_type == ALSA_CARD_TYPE_INTERNAL)
+		iodev->clock_domain = mixer;
 	if (direction == CRAS_STREAM_OUTPUT) {
 		aio->default_volume_curve =
 			cras_card_config_get_volume_curve_for_control(
@@ -2133,6 +2529,14 @@ alsa_iodev_create(size_t card_index, const char *card_name, size_t device_index,
 			iodev->min_buffer_level = level;
 	}
 
+	/* Mix in a cached buffer when UCM says the DMA buffer is uncached, or
+	 * the board does and this is an internal card. */
+	if (direction == CRAS_STREAM_OUTPUT)
+		aio->uncached_dma =
+			(ucm && ucm_get_uncached_dma_buffer(ucm)) ||
+			(card_type == ALSA_CARD_TYPE_INTERNAL &&
+			 cras_system_get_uncached_dma_buffer());
+
 	set_iodev_name(iodev, card_name, dev_name, card_index, device_index,
 		       card_type, usb_vid, usb_pid, usb_serial_number);
 
@@ -2391,6 +2795,20 @@ int alsa_iodev_has_hctl_jacks(struct cras_iodev *iodev)
 	return cras_alsa_jack_list_has_hctl_jacks(aio->jack_list);
 }
 
+void alsa_iodev_set_probed_formats(struct cras_iodev *iodev, size_t *rates,
+				   size_t *channel_counts,
+				   snd_pcm_format_t *formats)
+{
+	struct alsa_io *aio = (struct alsa_io *)iodev;
+
+	free(aio->probed_rates);
+	free(aio->probed_channel_counts);
+	free(aio->probed_formats);
+	aio->probed_rates = rates;
+	aio->probed_channel_counts = channel_counts;
+	aio->probed_formats = formats;
+}
+
 static void alsa_iodev_unmute_node(struct alsa_io *aio,
 				   struct cras_ionode *ionode)
 {
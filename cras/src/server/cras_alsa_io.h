@@ -85,4 +85,16 @@ unsigned alsa_iodev_index(struct cras_iodev *iodev);
 /* Returns whether this IODEV has ALSA hctl jacks. */
 int alsa_iodev_has_hctl_jacks(struct cras_iodev *iodev);
 
+/* Gives the iodev the formats its PCM was probed to support when the card was
+ * added, so the first open doesn't probe them again. Later opens probe as
+ * usual, since e.g. HDMI formats change with the sink.
+ * Args:
+ *    iodev - ALSA io device.
+ *    rates, channel_counts, formats - Zero terminated arrays from
+ *        cras_alsa_fill_properties. The iodev takes ownership of them.
+ */
+void alsa_iodev_set_probed_formats(struct cras_iodev *iodev, size_t *rates,
+				   size_t *channel_counts,
+				   snd_pcm_format_t *formats);
+
 #endif /* CRAS_ALSA_IO_H_ */
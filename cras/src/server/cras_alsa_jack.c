@@ -5,12 +5,16 @@
 
 #include <alsa/asoundlib.h>
 #include <linux/input.h>
+#include <pthread.h>
 #include <regex.h>
 #include <syslog.h>
 
 #include "cras_alsa_jack.h"
 #include "cras_alsa_mixer.h"
 #include "cras_alsa_ucm.h"
+#include "cras_checksum.h"
+#include "cras_iodev_info.h"
+#include "cras_main_message.h"
 #include "cras_system_state.h"
 #include "cras_gpio_jack.h"
 #include "cras_tm.h"
@@ -27,6 +31,69 @@ static const unsigned int ELD_MNL_MASK = 31;
 static const unsigned int ELD_MNL_OFFSET = 4;
 static const unsigned int ELD_MONITOR_NAME_OFFSET = 20;
 
+/* Constants used to walk the Short Audio Descriptors after the monitor name
+ * in the ELD buffer. */
+static const unsigned int ELD_SAD_COUNT_OFFSET = 5;
+static const unsigned int ELD_SAD_COUNT_SHIFT = 4;
+static const unsigned int ELD_SAD_SIZE = 3;
+static const unsigned int SAD_CODING_SHIFT = 3;
+static const unsigned int SAD_CODING_MASK = 15;
+
+/* Audio format codes of the compressed formats sent as IEC 61937 bursts. */
+static const unsigned int SAD_CODING_AC3 = 2;
+static const unsigned int SAD_CODING_EAC3 = 10;
+
+/* Number of monitors whose parsed EDID is remembered. */
+#define EDID_CACHE_SIZE 8
+
+/* What is used from the EDID of a monitor. Cached by the checksum of the EDID
+ * so plugging the same monitor again doesn't parse it again.
+ *    checksum - crc32_checksum of the EDID.
+ *    lpcm - Whether the monitor supports LPCM audio.
+ *    monitor_name - Name from the monitor descriptor, empty if there is none.
+ */
+struct edid_info {
+	uint32_t checksum;
+	int lpcm;
+	char monitor_name[CRAS_NODE_NAME_BUFFER_SIZE];
+};
+
+/* An EDID read queued to the EDID worker. Freed by the main thread when the
+ * result comes back.
+ *    jack - The jack waiting for the result, NULL once the result is no longer
+ *        wanted. Only used on the main thread.
+ *    edid_file - Copy of the file to read.
+ */
+struct edid_request {
+	struct cras_alsa_jack *jack;
+	char *edid_file;
+	struct edid_request *prev, *next;
+};
+
+/* Message from the EDID worker to the main thread.
+ *    request - The request that was served.
+ *    rc - 0 if the EDID was read and is valid, negative error otherwise.
+ *    info - The EDID content when rc is 0.
+ */
+struct edid_result_msg {
+	struct cras_main_message header;
+	struct edid_request *request;
+	int rc;
+	struct edid_info info;
+};
+
+/* Reading EDIDs can block for a while on hotplug, so it is done on a worker
+ * thread started on first use. edid_lock protects the queue and the cache. */
+static pthread_mutex_t edid_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t edid_cond = PTHREAD_COND_INITIALIZER;
+static struct edid_request *edid_queue;
+static struct edid_info edid_cache[EDID_CACHE_SIZE];
+static unsigned int edid_cache_size;
+static unsigned int edid_cache_next;
+/* 0 until the worker is first needed, 1 when running, -1 if it couldn't be
+ * started and EDIDs are read on the main thread. */
+static int edid_worker_state;
+
 /* Keeps an fd that is registered with system settings.  A list of fds must be
  * kept so that they can be removed when the jack list is destroyed. */
 struct jack_poll_fd {
@@ -72,6 +139,9 @@ struct cras_gpio_jack {
  *        This will be null for output jacks.
  *    ucm_device - Name of the ucm device if found, otherwise, NULL.
  *    edid_file - File to read the EDID from (if available, HDMI only).
+ *    edid_request - The EDID read in progress for this jack, if any.
+ *    edid_info_valid - Whether edid_info was read since the last plug event.
+ *    edid_info - The EDID of the plugged monitor.
  *    display_info_timer - Timer used to poll display info for HDMI jacks.
  *    display_info_retries - Number of times to retry reading display info.
  *
@@ -97,6 +167,9 @@ struct cras_alsa_jack {
 	char *ucm_device;
 	const char *override_type_name;
 	const char *edid_file;
+	struct edid_request *edid_request;
+	int edid_info_valid;
+	struct edid_info edid_info;
 	struct cras_timer *display_info_timer;
 	unsigned int display_info_retries;
 	struct cras_alsa_jack *prev, *next;
@@ -188,6 +261,9 @@ static void cras_free_jack(struct cras_alsa_jack *jack, int rm_select_fd)
 	if (!jack)
 		return;
 
+	/* A queued read is freed when its result comes back. */
+	if (jack->edid_request)
+		jack->edid_request->jack = NULL;
 	free(jack->ucm_device);
 	free((void *)jack->edid_file);
 	if (jack->display_info_timer)
@@ -228,46 +304,92 @@ static int get_jack_current_state(struct cras_alsa_jack *jack)
 	return snd_ctl_elem_value_get_boolean(elem_value, 0);
 }
 
-static int read_jack_edid(const struct cras_alsa_jack *jack, uint8_t *edid)
+/* Reads and parses the EDID in edid_file. Parsing is skipped for an EDID
+ * already in the cache. Called from the EDID worker, or from the main thread
+ * when the worker isn't available. */
+static int read_edid_info(const char *edid_file, struct edid_info *info)
 {
+	uint8_t edid[EEDID_SIZE];
+	uint32_t checksum;
+	unsigned int i;
 	int fd, nread;
 
-	fd = open(jack->edid_file, O_RDONLY);
+	fd = open(edid_file, O_RDONLY);
 	if (fd < 0)
-		return -1;
+		return -errno;
 
 	nread = read(fd, edid, EEDID_SIZE);
 	close(fd);
 
 	if (nread < EDID_SIZE || !edid_valid(edid))
-		return -1;
+		return -EAGAIN;
+
+	checksum = crc32_checksum(edid, nread);
+	pthread_mutex_lock(&edid_lock);
+	for (i = 0; i < edid_cache_size; i++) {
+		if (edid_cache[i].checksum == checksum) {
+			*info = edid_cache[i];
+			pthread_mutex_unlock(&edid_lock);
+			return 0;
+		}
+	}
+	pthread_mutex_unlock(&edid_lock);
+
+	memset(info, 0, sizeof(*info));
+	info->checksum = checksum;
+	info->lpcm = edid_lpcm_support(edid, edid[EDID_EXT_FLAG]);
+	if (edid_get_monitor_name(edid, info->monitor_name,
+				  sizeof(info->monitor_name)))
+		info->monitor_name[0] = '\0';
+
+	pthread_mutex_lock(&edid_lock);
+	edid_cache[edid_cache_next] = *info;
+	edid_cache_next = (edid_cache_next + 1) % EDID_CACHE_SIZE;
+	if (edid_cache_size < EDID_CACHE_SIZE)
+		edid_cache_size++;
+	pthread_mutex_unlock(&edid_lock);
 	return 0;
 }
 
-static int check_jack_edid(struct cras_alsa_jack *jack)
+static void set_jack_edid_info(struct cras_alsa_jack *jack,
+			       const struct edid_info *info)
 {
-	uint8_t edid[EEDID_SIZE];
-
-	if (read_jack_edid(jack, edid))
-		return -1;
+	jack->edid_info = *info;
+	jack->edid_info_valid = 1;
 
 	/* If the jack supports EDID, check that it supports audio, clearing
 	 * the plugged state if it doesn't.
 	 */
-	if (!edid_lpcm_support(edid, edid[EDID_EXT_FLAG]))
+	if (!info->lpcm)
 		jack->gpio.current_state = 0;
+}
+
+static int check_jack_edid(struct cras_alsa_jack *jack)
+{
+	struct edid_info info;
+
+	if (read_edid_info(jack->edid_file, &info))
+		return -1;
+	set_jack_edid_info(jack, &info);
 	return 0;
 }
 
 static int get_jack_edid_monitor_name(const struct cras_alsa_jack *jack,
 				      char *buf, unsigned int buf_size)
 {
-	uint8_t edid[EEDID_SIZE];
+	const struct edid_info *edid = &jack->edid_info;
+	struct edid_info info;
 
-	if (read_jack_edid(jack, edid))
+	if (!jack->edid_info_valid) {
+		if (read_edid_info(jack->edid_file, &info))
+			return -1;
+		edid = &info;
+	}
+	if (edid->monitor_name[0] == '\0')
 		return -1;
 
-	return edid_get_monitor_name(edid, buf, buf_size);
+	snprintf(buf, buf_size, "%s", edid->monitor_name);
+	return 0;
 }
 
 /* Checks the ELD control of the jack to see if the ELD buffer
@@ -290,6 +412,136 @@ static int check_jack_eld(struct cras_alsa_jack *jack)
 
 static void display_info_delay_cb(struct cras_timer *timer, void *arg);
 
+static void report_jack_state(struct cras_alsa_jack *jack)
+{
+	jack->jack_list->change_callback(jack, get_jack_current_state(jack),
+					 jack->jack_list->callback_data);
+}
+
+/* Reports the jack state if the display info is ready or the max number of
+ * retries is reached. Otherwise sets the timer to check again later.
+ */
+static void display_info_checked(struct cras_alsa_jack *jack, int ready)
+{
+	if (ready) {
+		report_jack_state(jack);
+		return;
+	}
+
+	if (--jack->display_info_retries == 0) {
+		if (jack->is_gpio)
+			jack->gpio.current_state = 0;
+		if (jack->edid_file)
+			syslog(LOG_ERR, "Timeout to read EDID from %s",
+			       jack->edid_file);
+		report_jack_state(jack);
+		return;
+	}
+
+	jack->display_info_timer =
+		cras_tm_create_timer(cras_system_state_get_tm(),
+				     DISPLAY_INFO_RETRY_DELAY_MS,
+				     display_info_delay_cb, jack);
+}
+
+/* Handles an EDID read by the worker, on the main thread. */
+static void edid_result_cb(struct cras_main_message *msg, void *arg)
+{
+	struct edid_result_msg *result = (struct edid_result_msg *)msg;
+	struct edid_request *request = result->request;
+	struct cras_alsa_jack *jack = request->jack;
+
+	free(request->edid_file);
+	free(request);
+	if (!jack)
+		return;
+
+	jack->edid_request = NULL;
+	if (result->rc == 0) {
+		set_jack_edid_info(jack, &result->info);
+		display_info_checked(jack, 1);
+		return;
+	}
+	display_info_checked(jack,
+			     jack->eld_control && check_jack_eld(jack) == 0);
+}
+
+static void *edid_worker_loop(void *arg)
+{
+	struct edid_request *request;
+	struct edid_result_msg msg;
+
+	pthread_mutex_lock(&edid_lock);
+	while (1) {
+		while (!edid_queue)
+			pthread_cond_wait(&edid_cond, &edid_lock);
+		request = edid_queue;
+		DL_DELETE(edid_queue, request);
+		pthread_mutex_unlock(&edid_lock);
+
+		memset(&msg, 0, sizeof(msg));
+		msg.header.type = CRAS_MAIN_JACK_EDID;
+		msg.header.length = sizeof(msg);
+		msg.request = request;
+		msg.rc = read_edid_info(request->edid_file, &msg.info);
+		/* The main thread frees the request when it gets the result,
+		 * so don't let it drop. */
+		if (cras_main_message_send_blocking(&msg.header))
+			syslog(LOG_ERR, "Failed to report EDID of %s",
+			       request->edid_file);
+
+		pthread_mutex_lock(&edid_lock);
+	}
+	return NULL;
+}
+
+static int start_edid_worker(void)
+{
+	pthread_t tid;
+
+	if (edid_worker_state)
+		return edid_worker_state > 0;
+
+	edid_worker_state = -1;
+	if (cras_main_message_add_handler(CRAS_MAIN_JACK_EDID, edid_result_cb,
+					  NULL))
+		return 0;
+	if (pthread_create(&tid, NULL, edid_worker_loop, NULL)) {
+		syslog(LOG_ERR, "Failed to start EDID worker");
+		return 0;
+	}
+	pthread_detach(tid);
+	edid_worker_state = 1;
+	return 1;
+}
+
+/* Queues a read of the jack EDID to the worker. The jack state is reported
+ * from edid_result_cb once it is done. Returns 0 if the read is queued. */
+static int request_jack_edid(struct cras_alsa_jack *jack)
+{
+	struct edid_request *request;
+
+	if (!start_edid_worker())
+		return -ENOSYS;
+
+	request = (struct edid_request *)calloc(1, sizeof(*request));
+	if (!request)
+		return -ENOMEM;
+	request->edid_file = strdup(jack->edid_file);
+	if (!request->edid_file) {
+		free(request);
+		return -ENOMEM;
+	}
+	request->jack = jack;
+	jack->edid_request = request;
+
+	pthread_mutex_lock(&edid_lock);
+	DL_APPEND(edid_queue, request);
+	pthread_cond_signal(&edid_cond);
+	pthread_mutex_unlock(&edid_lock);
+	return 0;
+}
+
 /* Callback function doing following things:
  * 1. Reset timer and update max number of retries.
  * 2. Check all conditions to see if it's okay or needed to
@@ -297,6 +549,8 @@ static void display_info_delay_cb(struct cras_timer *timer, void *arg);
  *    EDID is not ready for some reason.
  * 3. Check if max number of retries is reached and decide
  *    to set timer for next callback or report jack state.
+ * The EDID is read on the worker, in which case steps 2 and 3 finish in
+ * edid_result_cb.
  */
 static inline void jack_state_change_cb(struct cras_alsa_jack *jack, int retry)
 {
@@ -306,10 +560,16 @@ static inline void jack_state_change_cb(struct cras_alsa_jack *jack, int retry)
 		cras_tm_cancel_timer(tm, jack->display_info_timer);
 		jack->display_info_timer = NULL;
 	}
+	/* The result of a read started before this event is outdated. */
+	if (jack->edid_request) {
+		jack->edid_request->jack = NULL;
+		jack->edid_request = NULL;
+	}
 	if (retry) {
 		jack->display_info_retries =
 			jack->is_gpio ? DISPLAY_INFO_GPIO_MAX_RETRIES :
 					DISPLAY_INFO_MAX_RETRIES;
+		jack->edid_info_valid = 0;
 	}
 
 	if (!get_jack_current_state(jack))
@@ -321,27 +581,18 @@ static inline void jack_state_change_cb(struct cras_alsa_jack *jack, int retry)
 	 */
 	if (jack->edid_file == NULL && jack->eld_control == NULL)
 		goto report_jack_state;
+	if (jack->edid_file && request_jack_edid(jack) == 0)
+		return;
 	if (jack->edid_file && (check_jack_edid(jack) == 0))
 		goto report_jack_state;
 	if (jack->eld_control && (check_jack_eld(jack) == 0))
 		goto report_jack_state;
 
-	if (--jack->display_info_retries == 0) {
-		if (jack->is_gpio)
-			jack->gpio.current_state = 0;
-		if (jack->edid_file)
-			syslog(LOG_ERR, "Timeout to read EDID from %s",
-			       jack->edid_file);
-		goto report_jack_state;
-	}
-
-	jack->display_info_timer = cras_tm_create_timer(
-		tm, DISPLAY_INFO_RETRY_DELAY_MS, display_info_delay_cb, jack);
+	display_info_checked(jack, 0);
 	return;
 
 report_jack_state:
-	jack->jack_list->change_callback(jack, get_jack_current_state(jack),
-					 jack->jack_list->callback_data);
+	report_jack_state(jack);
 }
 
 /* gpio_switch_initial_state
@@ -1226,6 +1477,42 @@ fallback_jack_name:
 	return;
 }
 
+int cras_alsa_jack_supports_passthrough(const struct cras_alsa_jack *jack)
+{
+	snd_ctl_elem_value_t *elem_value;
+	snd_ctl_elem_info_t *elem_info;
+	const uint8_t *buf;
+	unsigned int count, mnl, num_sads, offset, coding, i;
+
+	if (!jack->eld_control)
+		return 0;
+
+	snd_ctl_elem_info_alloca(&elem_info);
+	if (snd_hctl_elem_info(jack->eld_control, elem_info) < 0)
+		return 0;
+
+	count = snd_ctl_elem_info_get_count(elem_info);
+	if (count <= ELD_SAD_COUNT_OFFSET)
+		return 0;
+
+	snd_ctl_elem_value_alloca(&elem_value);
+	if (snd_hctl_elem_read(jack->eld_control, elem_value) < 0)
+		return 0;
+
+	buf = (const uint8_t *)snd_ctl_elem_value_get_bytes(elem_value);
+	mnl = buf[ELD_MNL_OFFSET] & ELD_MNL_MASK;
+	num_sads = buf[ELD_SAD_COUNT_OFFSET] >> ELD_SAD_COUNT_SHIFT;
+	offset = ELD_MONITOR_NAME_OFFSET + mnl;
+
+	for (i = 0; i < num_sads && offset + ELD_SAD_SIZE <= count; i++) {
+		coding = (buf[offset] >> SAD_CODING_SHIFT) & SAD_CODING_MASK;
+		if (coding == SAD_CODING_AC3 || coding == SAD_CODING_EAC3)
+			return 1;
+		offset += ELD_SAD_SIZE;
+	}
+	return 0;
+}
+
 void cras_alsa_jack_update_node_type(const struct cras_alsa_jack *jack,
 				     enum CRAS_NODE_TYPE *type)
 {
@@ -126,6 +126,16 @@ const char *cras_alsa_jack_get_ucm_device(const struct cras_alsa_jack *jack);
 void cras_alsa_jack_update_monitor_name(const struct cras_alsa_jack *jack,
 					char *name_buf, unsigned int buf_size);
 
+/* Checks the Short Audio Descriptors in the ELD of a jack for a compressed
+ * format the sink decodes from IEC 61937 bursts, AC-3 or E-AC-3.
+ * Args:
+ *    jack - The jack to query.
+ * Returns:
+ *    1 if the sink takes compressed audio, 0 if it doesn't or the jack has no
+ *    ELD to tell.
+ */
+int cras_alsa_jack_supports_passthrough(const struct cras_alsa_jack *jack);
+
 /* Updates the node type according to override_type_name in jack.
  * Currently this method only supports updating the node type to
  * CRAS_NODE_TYPE_INTERNAL_SPEAKER when override_type_name is
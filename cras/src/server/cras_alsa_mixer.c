@@ -11,10 +11,16 @@
 #include "cras_alsa_mixer.h"
 #include "cras_alsa_mixer_name.h"
 #include "cras_alsa_ucm.h"
+#include "cras_system_state.h"
+#include "cras_tm.h"
 #include "cras_util.h"
 #include "utlist.h"
 
 #define MIXER_CONTROL_VOLUME_DB_INVALID LONG_MAX
+/* Minimum time between two volume (or gain) writes to the mixer. Changes made
+ * in between, such as while a slider is dragged, are coalesced and only the
+ * last one is written. */
+#define VOLUME_WRITE_INTERVAL_MS 20
 
 /* Represents an ALSA control element. Each device can have several of these,
  * each potentially having independent volume and mute controls.
@@ -67,6 +73,20 @@ struct mixer_control {
 	struct mixer_control *prev, *next;
 };
 
+/* A volume or gain write that can be held back to coalesce it with the ones
+ * following it.
+ * dBFS - The value to write.
+ * control - The node specific control to write it with, or NULL.
+ * last_write - Time of the last write to the mixer.
+ * timer - Set while a write is held back.
+ */
+struct mixer_volume_write {
+	long dBFS;
+	struct mixer_control *control;
+	struct timespec last_write;
+	struct cras_timer *timer;
+};
+
 /* Holds a reference to the opened mixer and the volume controls.
  * mixer - Pointer to the opened alsa mixer.
  * main_volume_controls - List of volume controls (normally 'Master' and 'PCM').
@@ -76,6 +96,8 @@ struct mixer_control {
  * max_volume_dB - Maximum volume available in main volume controls.  The dBFS
  *   value setting will be applied relative to this.
  * min_volume_dB - Minimum volume available in main volume controls.
+ * output_write - Pending write of the output volume.
+ * capture_write - Pending write of the capture gain.
  */
 struct cras_alsa_mixer {
 	snd_mixer_t *mixer;
@@ -87,6 +109,8 @@ struct cras_alsa_mixer {
 	snd_mixer_elem_t *capture_switch;
 	long max_volume_dB;
 	long min_volume_dB;
+	struct mixer_volume_write output_write;
+	struct mixer_volume_write capture_write;
 };
 
 /* Wrapper for snd_mixer_open and helpers.
@@ -915,6 +939,13 @@ void cras_alsa_mixer_destroy(struct cras_alsa_mixer *cras_mixer)
 {
 	assert(cras_mixer);
 
+	if (cras_mixer->output_write.timer)
+		cras_tm_cancel_timer(cras_system_state_get_tm(),
+				     cras_mixer->output_write.timer);
+	if (cras_mixer->capture_write.timer)
+		cras_tm_cancel_timer(cras_system_state_get_tm(),
+				     cras_mixer->capture_write.timer);
+
 	mixer_control_destroy_list(cras_mixer->main_volume_controls);
 	mixer_control_destroy_list(cras_mixer->main_capture_controls);
 	mixer_control_destroy_list(cras_mixer->output_controls);
@@ -934,14 +965,44 @@ int cras_alsa_mixer_has_volume(const struct mixer_control *mixer_control)
 	return mixer_control && mixer_control->has_volume;
 }
 
-void cras_alsa_mixer_set_dBFS(struct cras_alsa_mixer *cras_mixer, long dBFS,
+/* Decides whether a volume write can be done now. Returns 1 if it has to wait
+ * for VOLUME_WRITE_INTERVAL_MS since the last write, in which case it is done
+ * by timer_cb, with the latest values passed here by then. */
+static int hold_volume_write(struct cras_alsa_mixer *cmix,
+			     struct mixer_volume_write *write, long dBFS,
+			     struct mixer_control *control,
+			     void (*timer_cb)(struct cras_timer *, void *))
+{
+	struct timespec now, since;
+	unsigned int since_ms;
+
+	write->dBFS = dBFS;
+	write->control = control;
+	if (write->timer)
+		return 1;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	subtract_timespecs(&now, &write->last_write, &since);
+	if (since.tv_sec == 0) {
+		since_ms = timespec_to_ms(&since);
+		if (since_ms < VOLUME_WRITE_INTERVAL_MS)
+			write->timer = cras_tm_create_timer(
+				cras_system_state_get_tm(),
+				VOLUME_WRITE_INTERVAL_MS - since_ms, timer_cb,
+				cmix);
+		if (write->timer)
+			return 1;
+	}
+	write->last_write = now;
+	return 0;
+}
+
+static void write_output_dBFS(struct cras_alsa_mixer *cras_mixer, long dBFS,
 			      struct mixer_control *mixer_output)
 {
 	struct mixer_control *c;
 	long to_set;
 
-	assert(cras_mixer);
-
 	/* dBFS is normally < 0 to specify the attenuation from max. max is the
 	 * combined max of the master controls and the current output.
 	 */
@@ -968,6 +1029,27 @@ void cras_alsa_mixer_set_dBFS(struct cras_alsa_mixer *cras_mixer, long dBFS,
 		mixer_control_set_dBFS(mixer_output, to_set);
 }
 
+static void output_write_cb(struct cras_timer *timer, void *arg)
+{
+	struct cras_alsa_mixer *cmix = (struct cras_alsa_mixer *)arg;
+
+	cmix->output_write.timer = NULL;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &cmix->output_write.last_write);
+	write_output_dBFS(cmix, cmix->output_write.dBFS,
+			  cmix->output_write.control);
+}
+
+void cras_alsa_mixer_set_dBFS(struct cras_alsa_mixer *cras_mixer, long dBFS,
+			      struct mixer_control *mixer_output)
+{
+	assert(cras_mixer);
+
+	if (hold_volume_write(cras_mixer, &cras_mixer->output_write, dBFS,
+			      mixer_output, output_write_cb))
+		return;
+	write_output_dBFS(cras_mixer, dBFS, mixer_output);
+}
+
 long cras_alsa_mixer_get_dB_range(struct cras_alsa_mixer *cras_mixer)
 {
 	if (!cras_mixer)
@@ -983,14 +1065,12 @@ long cras_alsa_mixer_get_output_dB_range(struct mixer_control *mixer_output)
 	return mixer_output->max_volume_dB - mixer_output->min_volume_dB;
 }
 
-void cras_alsa_mixer_set_capture_dBFS(struct cras_alsa_mixer *cras_mixer,
-				      long dBFS,
-				      struct mixer_control *mixer_input)
+static void write_capture_dBFS(struct cras_alsa_mixer *cras_mixer, long dBFS,
+			       struct mixer_control *mixer_input)
 {
 	struct mixer_control *c;
 	long to_set;
 
-	assert(cras_mixer);
 	to_set = dBFS;
 	/* Go through all the controls, set the gain for each, taking the value
 	 * closest but greater than the desired gain.  If the entire gain can't
@@ -1012,6 +1092,28 @@ void cras_alsa_mixer_set_capture_dBFS(struct cras_alsa_mixer *cras_mixer,
 		mixer_control_set_dBFS(mixer_input, to_set);
 }
 
+static void capture_write_cb(struct cras_timer *timer, void *arg)
+{
+	struct cras_alsa_mixer *cmix = (struct cras_alsa_mixer *)arg;
+
+	cmix->capture_write.timer = NULL;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &cmix->capture_write.last_write);
+	write_capture_dBFS(cmix, cmix->capture_write.dBFS,
+			   cmix->capture_write.control);
+}
+
+void cras_alsa_mixer_set_capture_dBFS(struct cras_alsa_mixer *cras_mixer,
+				      long dBFS,
+				      struct mixer_control *mixer_input)
+{
+	assert(cras_mixer);
+
+	if (hold_volume_write(cras_mixer, &cras_mixer->capture_write, dBFS,
+			      mixer_input, capture_write_cb))
+		return;
+	write_capture_dBFS(cras_mixer, dBFS, mixer_input);
+}
+
 long cras_alsa_mixer_get_minimum_capture_gain(struct cras_alsa_mixer *cmix,
 					      struct mixer_control *mixer_input)
 {
@@ -84,6 +84,8 @@ int cras_alsa_mixer_has_volume(const struct mixer_control *mixer_control);
  *      specifying how much to attenuate.
  *    mixer_output - The mixer output to set if not all attenuation can be
  *      obtained from the main controls.  Can be null.
+ * Calls made less than 20ms after the previous write are coalesced, only the
+ * last one is written when the 20ms have passed.
  */
 void cras_alsa_mixer_set_dBFS(struct cras_alsa_mixer *cras_mixer, long dBFS,
 			      struct mixer_control *mixer_output);
@@ -106,6 +108,7 @@ long cras_alsa_mixer_get_output_dB_range(struct mixer_control *mixer_output);
  *    dBFS - The capture gain level as dB * 100.  dB can be a positive or a
  *    negative quantity specifying how much gain or attenuation to apply.
  *    mixer_input - The specific mixer control for input node, can be null.
+ * Calls are coalesced like for cras_alsa_mixer_set_dBFS.
  */
 void cras_alsa_mixer_set_capture_dBFS(struct cras_alsa_mixer *cras_mixer,
 				      long dBFS,
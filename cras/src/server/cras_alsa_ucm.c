@@ -11,6 +11,7 @@
 
 #include "cras_alsa_ucm.h"
 #include "cras_util.h"
+#include "sfh.h"
 #include "utlist.h"
 
 static const char jack_control_var[] = "JackControl";
@@ -26,6 +27,7 @@ static const char swap_mode_suffix[] = "Swap Mode";
 static const char min_buffer_level_var[] = "MinBufferLevel";
 static const char dma_period_var[] = "DmaPeriodMicrosecs";
 static const char disable_software_volume[] = "DisableSoftwareVolume";
+static const char uncached_dma_buffer[] = "UncachedDmaBuffer";
 static const char playback_device_name_var[] = "PlaybackPCM";
 static const char playback_device_rate_var[] = "PlaybackRate";
 static const char playback_channels_var[] = "PlaybackChannels";
@@ -54,6 +56,14 @@ static const char intrinsic_sensitivity_var[] = "IntrinsicSensitivity";
  * 0.01 dB.
  */
 static const char default_node_gain[] = "DefaultNodeGain";
+
+/*
+ * Set these values in a SectionDevice of an output to let CRAS move the
+ * buffer level of the device between them, in frames. The level is lowered
+ * while the audio thread keeps up and raised after near misses or underruns.
+ */
+static const char adaptive_buffer_min_level_var[] = "AdaptiveBufferMinLevel";
+static const char adaptive_buffer_max_level_var[] = "AdaptiveBufferMaxLevel";
 static const char hotword_model_prefix[] = "Hotword Model";
 static const char fully_specified_ucm_var[] = "FullySpecifiedUCM";
 static const char main_volume_names[] = "MainVolumeNames";
@@ -64,6 +74,23 @@ static const char *use_case_verbs[] = {
 	"Speech", "Pro Audio",	"Accessibility",
 };
 
+/* Number of hash buckets for the UCM values looked up so far. */
+#define UCM_VALUE_BUCKETS 64
+
+/* A UCM value read from alsa-lib. UCM values don't change once the card is
+ * opened, so each one is only looked up the first time it is used.
+ *    id - The identifier passed to snd_use_case_get, "=var/dev/verb".
+ *    rc - Return code of snd_use_case_get, the value doesn't exist if not 0.
+ *    value - The value if rc is 0.
+ *    next - Next value in the same bucket.
+ */
+struct ucm_value {
+	char *id;
+	int rc;
+	char *value;
+	struct ucm_value *next;
+};
+
 /* Represents a list of section names found in UCM. */
 struct section_name {
 	const char *name;
@@ -75,6 +102,7 @@ struct cras_use_case_mgr {
 	const char *name;
 	unsigned int avail_use_cases;
 	enum CRAS_STREAM_TYPE use_case;
+	struct ucm_value *values[UCM_VALUE_BUCKETS];
 };
 
 static inline const char *uc_verb(struct cras_use_case_mgr *mgr)
@@ -121,21 +149,70 @@ static int modifier_enabled(struct cras_use_case_mgr *mgr, const char *mod)
 	return (mod_idx < (unsigned int)num_mods);
 }
 
+static void ucm_free_values(struct cras_use_case_mgr *mgr)
+{
+	struct ucm_value *v;
+	unsigned int i;
+
+	for (i = 0; i < UCM_VALUE_BUCKETS; i++) {
+		while (mgr->values[i]) {
+			v = mgr->values[i];
+			mgr->values[i] = v->next;
+			free(v->id);
+			free(v->value);
+			free(v);
+		}
+	}
+}
+
+/* Gets a UCM value, from alsa-lib the first time it is asked for and from
+ * mgr->values after that. On success *value is a copy for the caller to
+ * free. */
 static int get_var(struct cras_use_case_mgr *mgr, const char *var,
 		   const char *dev, const char *verb, const char **value)
 {
+	struct ucm_value *v;
+	const char *alsa_value = NULL;
 	char *id;
-	int rc;
+	unsigned int bucket;
 	size_t len = strlen(var) + strlen(dev) + strlen(verb) + 4;
 
 	id = (char *)malloc(len);
 	if (!id)
 		return -ENOMEM;
 	snprintf(id, len, "=%s/%s/%s", var, dev, verb);
-	rc = snd_use_case_get(mgr->mgr, id, value);
+	bucket = SuperFastHash(id, len - 1, len - 1) % UCM_VALUE_BUCKETS;
 
-	free((void *)id);
-	return rc;
+	for (v = mgr->values[bucket]; v; v = v->next)
+		if (!strcmp(v->id, id))
+			break;
+	if (v) {
+		free(id);
+	} else {
+		v = (struct ucm_value *)calloc(1, sizeof(*v));
+		if (!v) {
+			free(id);
+			return -ENOMEM;
+		}
+		v->id = id;
+		v->rc = snd_use_case_get(mgr->mgr, id, &alsa_value);
+		if (v->rc == 0) {
+			v->value = strdup(alsa_value);
+			free((void *)alsa_value);
+			if (!v->value) {
+				free(v->id);
+				free(v);
+				return -ENOMEM;
+			}
+		}
+		v->next = mgr->values[bucket];
+		mgr->values[bucket] = v;
+	}
+
+	if (v->rc)
+		return v->rc;
+	*value = strdup(v->value);
+	return *value ? 0 : -ENOMEM;
 }
 
 static int get_int(struct cras_use_case_mgr *mgr, const char *var,
@@ -390,7 +467,7 @@ struct cras_use_case_mgr *ucm_create(const char *name)
 	if (!name)
 		return NULL;
 
-	mgr = (struct cras_use_case_mgr *)malloc(sizeof(*mgr));
+	mgr = (struct cras_use_case_mgr *)calloc(1, sizeof(*mgr));
 	if (!mgr)
 		return NULL;
 
@@ -430,6 +507,7 @@ cleanup:
 
 void ucm_destroy(struct cras_use_case_mgr *mgr)
 {
+	ucm_free_values(mgr);
 	snd_use_case_mgr_close(mgr->mgr);
 	free(mgr);
 }
@@ -633,6 +711,18 @@ unsigned int ucm_get_disable_software_volume(struct cras_use_case_mgr *mgr)
 	return value;
 }
 
+unsigned int ucm_get_uncached_dma_buffer(struct cras_use_case_mgr *mgr)
+{
+	int value;
+	int rc;
+
+	rc = get_int(mgr, uncached_dma_buffer, "", uc_verb(mgr), &value);
+	if (rc)
+		return 0;
+
+	return value;
+}
+
 int ucm_get_default_node_gain(struct cras_use_case_mgr *mgr, const char *dev,
 			      long *gain)
 {
@@ -646,6 +736,28 @@ int ucm_get_default_node_gain(struct cras_use_case_mgr *mgr, const char *dev,
 	return 0;
 }
 
+int ucm_get_adaptive_buffer_levels(struct cras_use_case_mgr *mgr,
+				   const char *dev, unsigned int *min_level,
+				   unsigned int *max_level)
+{
+	int min_value, max_value;
+	int rc;
+
+	rc = get_int(mgr, adaptive_buffer_min_level_var, dev, uc_verb(mgr),
+		     &min_value);
+	if (rc)
+		return rc;
+	rc = get_int(mgr, adaptive_buffer_max_level_var, dev, uc_verb(mgr),
+		     &max_value);
+	if (rc)
+		return rc;
+	if (min_value < 0 || max_value < min_value)
+		return -EINVAL;
+	*min_level = min_value;
+	*max_level = max_value;
+	return 0;
+}
+
 int ucm_get_intrinsic_sensitivity(struct cras_use_case_mgr *mgr,
 				  const char *dev, long *sensitivity)
 {
@@ -176,6 +176,15 @@ int ucm_get_min_buffer_level(struct cras_use_case_mgr *mgr,
  */
 unsigned int ucm_get_disable_software_volume(struct cras_use_case_mgr *mgr);
 
+/* Gets the flag telling the DMA buffers of the card are uncached or
+ * write-combined memory, so output should be mixed in a cached buffer.
+ * Args:
+ *    mgr - The cras_use_case_mgr pointer returned from alsa_ucm_create.
+ * Returns:
+ *    1 if the flag is enabled. 0 otherwise.
+ */
+unsigned int ucm_get_uncached_dma_buffer(struct cras_use_case_mgr *mgr);
+
 /* Gets the value for default node gain.
  * Args:
  *    mgr - The cras_use_case_mgr pointer returned from alsa_ucm_create.
@@ -187,6 +196,20 @@ unsigned int ucm_get_disable_software_volume(struct cras_use_case_mgr *mgr);
 int ucm_get_default_node_gain(struct cras_use_case_mgr *mgr, const char *dev,
 			      long *gain);
 
+/* Gets the range the buffer level of an output may be adapted within.
+ * Args:
+ *    mgr - The cras_use_case_mgr pointer returned from alsa_ucm_create.
+ *    dev - The device to get the range of.
+ *    min_level - The pointer to the returned lowest level in frames.
+ *    max_level - The pointer to the returned highest level in frames.
+ * Returns:
+ *    0 on success, -EINVAL if the range is invalid, other error codes if it
+ *    isn't set.
+ */
+int ucm_get_adaptive_buffer_levels(struct cras_use_case_mgr *mgr,
+				   const char *dev, unsigned int *min_level,
+				   unsigned int *max_level);
+
 /* Gets the value for intrinsic sensitivity.
  * Args:
  *    mgr - The cras_use_case_mgr pointer returned from alsa_ucm_create.
@@ -4,18 +4,24 @@
  */
 
 #include <inttypes.h>
+#include <pthread.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <syslog.h>
+#include <unistd.h>
 
 #include <webrtc-apm/webrtc_apm.h>
 
-#include "byte_buffer.h"
+#include "buffer_share.h"
 #include "cras_apm_list.h"
 #include "cras_audio_area.h"
 #include "cras_audio_format.h"
+#include "cras_config.h"
+#include "cras_dsp_module.h"
 #include "cras_dsp_pipeline.h"
 #include "cras_iodev.h"
 #include "cras_iodev_list.h"
+#include "cras_util.h"
 #include "dsp_util.h"
 #include "dumper.h"
 #include "float_buffer.h"
@@ -25,56 +31,168 @@
 #define AEC_CONFIG_NAME "aec.ini"
 #define APM_CONFIG_NAME "apm.ini"
 
+/* Number of 10ms blocks queued to the APM thread in each direction. */
+#define APM_NUM_BLOCKS 4
+/* The reverse blocks are sized for up to this rate at MAX_EXT_DSP_PORTS
+ * channels. Blocks of an echo reference above it are not analyzed. */
+#define APM_REVERSE_MAX_RATE 96000
+#define APM_REVERSE_MAX_SAMPLES (APM_REVERSE_MAX_RATE / 100 * MAX_EXT_DSP_PORTS)
+
+/*
+ * A 10ms block of echo reference queued for an APM to analyze.
+ * Members:
+ *    num_channels - Number of channels in the block.
+ *    frame_rate - Rate of the output device the block comes from.
+ *    data - Pointer to each channel of the block in samples.
+ *    samples - Storage of the deinterleaved block.
+ */
+struct apm_reverse_block {
+	unsigned int num_channels;
+	unsigned int frame_rate;
+	float *data[MAX_EXT_DSP_PORTS];
+	float *samples;
+};
+
 /*
  * Structure holding a WebRTC audio processing module and necessary
  * info to process and transfer input buffer from device to stream.
+ * Streams which open the same device with the same effects share one, each
+ * through its own cras_apm handle.
  *
  * Below chart describes the buffer structure inside APM and how an input buffer
  * flows from a device through the APM to stream. APM processes audio buffers in
  * fixed 10ms width, and that's the main reason we need two copies of the
  * buffer:
  * (1) to cache input buffer from device until 10ms size is filled.
- * (2) to store the interleaved buffer, of 10ms size also, after APM processing.
+ * (2) to hold the float block, of 10ms size also, after APM processing.
+ *
+ * The processing itself runs on a thread of each APM, off the audio thread.
+ * The audio thread fills the 10ms float blocks and hands them over, and
+ * swaps each one with the output block when the APM thread is done with it.
+ * Streams that take the APM format as is interleave the output block right
+ * into their shm. It is interleaved to a byte buffer only for the streams
+ * that need it converted. The echo reference reaches the APM thread through
+ * its own blocks.
  *
  *  ________   _______     _______________________________
  *  |      |   |     |     |_____________APM ____________|
- *  |input |-> | DSP |---> ||           |    |          || -> stream 1
- *  |device|   |     | |   || float buf | -> | byte buf ||
- *  |______|   |_____| |   ||___________|    |__________||
- *                     |   |_____________________________|
+ *  |input |-> | DSP |---> ||           |    | output   || -> stream 1
+ *  |device|   |     | |   || float    | -> | block    ||
+ *  |______|   |_____| |   || blocks   |    |__________||
+ *                     |   ||__________|                 |
+ *                     |   |      ^ APM thread           |
+ *                     |   |______|______________________|
  *                     |   _______________________________
  *                     |-> |             APM 2           | -> stream 2
+ *                     |   |                             | -> stream 3
  *                     |   |_____________________________|
  *                     |                                       ...
  *                     |
  *                     |------------------------------------> stream N
  *
+ * The block counters only grow. The audio thread owns the forward block
+ * at fwd_filled while it fills it, the APM thread owns the ones from
+ * fwd_processed to fwd_filled, and the audio thread again the ones from
+ * fwd_consumed to fwd_processed. Reverse blocks from rev_processed to
+ * rev_filled wait for the APM thread, the others are free.
+ *
  * Members:
  *    apm_ptr - An APM instance from libwebrtc_audio_processing
  *    dev_ptr - Pointer to the device this APM is associated with.
- *    buffer - Stores the processed/interleaved data ready for stream to read.
- *    fbuffer - Stores the floating pointer buffer from input device waiting
- *        for APM to process.
+ *    effects - The effects bit map this APM applies.
+ *    refcount - Number of cras_apm handles of streams using this APM.
+ *    out_block - The processed block streams read from.
+ *    out_frames - Number of frames in out_block, without padding.
+ *    out_read - Number of frames of out_block all started streams have read.
+ *    interleaved - out_block interleaved in fmt, for the streams that can't
+ *        take the floats.
+ *    interleaved_valid - Set once out_block has been interleaved.
+ *    readers - Read offset of each started stream past out_read, in frames.
+ *    num_readers - Number of streams in readers.
+ *    dev_offset - Number of frames of the device buffer taken by this APM,
+ *        relative to the point all streams have read to.
+ *    fwd_blocks - 10ms blocks of float data from the input device.
+ *    fwd_filled - Number of forward blocks filled by the audio thread.
+ *    fwd_processed - Number of forward blocks processed by the APM thread.
+ *    fwd_consumed - Number of forward blocks moved to out_block.
+ *    fwd_pad - Frames of silence padding each forward block, left out when
+ *        it is read.
+ *    rev_blocks - 10ms blocks of echo reference.
+ *    rev_filled - Number of reverse blocks queued by the audio thread.
+ *    rev_processed - Number of reverse blocks analyzed by the APM thread.
+ *    thread - The thread running the APM.
+ *    wake_fd - Eventfd to wake the APM thread for new blocks.
+ *    stopping - Set to stop the APM thread.
+ *    error - Error returned by the last forward processing, if it failed.
  *    dev_fmt - The format used by the iodev this APM attaches to.
  *    fmt - The audio data format configured for this APM.
+ *    channel_map - The channel of dev_fmt each channel of fmt is copied
+ *        from, or -1 if the device doesn't have it.
  *    area - The cras_audio_area used for copying processed data to client
  *        stream.
+ *    planar_area - The cras_audio_area pointed at the channels of out_block.
  *    work_queue - A task queue instance created and destroyed by
  *        libwebrtc_apm.
  *    use_tuned_settings - True if this APM uses settings tuned specifically
  *        for this hardware in AEC use case. Otherwise it uses the generic
  *        settings like run inside browser.
+ *    process_ns - Time the APM thread spent processing blocks, written by
+ *        the APM thread only.
+ *    mem_bytes - Size of the buffers this APM allocated.
  */
-struct cras_apm {
+struct shared_apm {
 	webrtc_apm apm_ptr;
 	void *dev_ptr;
-	struct byte_buffer *buffer;
-	struct float_buffer *fbuffer;
+	uint64_t effects;
+	unsigned int refcount;
+	struct float_buffer *out_block;
+	unsigned int out_frames;
+	unsigned int out_read;
+	uint8_t *interleaved;
+	bool interleaved_valid;
+	struct buffer_share *readers;
+	unsigned int num_readers;
+	unsigned int dev_offset;
+	struct float_buffer *fwd_blocks[APM_NUM_BLOCKS];
+	unsigned int fwd_filled;
+	unsigned int fwd_processed;
+	unsigned int fwd_consumed;
+	unsigned int fwd_pad[APM_NUM_BLOCKS];
+	struct apm_reverse_block rev_blocks[APM_NUM_BLOCKS];
+	unsigned int rev_filled;
+	unsigned int rev_processed;
+	pthread_t thread;
+	int wake_fd;
+	int stopping;
+	int error;
 	struct cras_audio_format dev_fmt;
 	struct cras_audio_format fmt;
+	int channel_map[CRAS_CH_MAX];
 	struct cras_audio_area *area;
+	struct cras_audio_area *planar_area;
 	void *work_queue;
 	bool use_tuned_settings;
+	uint64_t process_ns;
+	size_t mem_bytes;
+	struct shared_apm *prev, *next;
+};
+
+/*
+ * A stream's handle to the APM it uses on a device.
+ * Members:
+ *    shared - The APM, possibly shared with other streams.
+ *    dev_ptr - Pointer to the device the APM is associated with.
+ *    reader_id - Id of this handle in the readers of shared.
+ *    start_ns - The process_ns of shared when this handle was added.
+ *    draining - Set while the stream reads out the frames shared took for it
+ *        before the stream changed effects.
+ */
+struct cras_apm {
+	struct shared_apm *shared;
+	void *dev_ptr;
+	unsigned int reader_id;
+	uint64_t start_ns;
+	bool draining;
 	struct cras_apm *prev, *next;
 };
 
@@ -87,11 +205,19 @@ struct cras_apm {
  * Note that cras_apm_list is owned and modified in main thread.
  * Only in synchronized audio thread event this cras_apm_list is safe
  * to access for passing single APM instance between threads.
+ *
+ * When the stream changes effects, the APMs for the new ones are staged
+ * beside the current ones, and the two are swapped in audio thread. The
+ * staged list then holds the retired APMs until the stream has drained
+ * them.
  */
 struct cras_apm_list {
 	void *stream_ptr;
 	uint64_t effects;
+	bool background;
 	struct cras_apm *apms;
+	uint64_t staged_effects;
+	struct cras_apm *staged;
 	struct cras_apm_list *prev, *next;
 };
 
@@ -103,41 +229,102 @@ struct cras_apm_list {
  *    apm - The APM for audio data processing.
  *    stream_ptr - Stream pointer from the associated dev/stream pair.
  *    effects - The effecets bit map of APM.
+ *    background - Set if the stream is background capture.
+ *    swap_to - The APM to move to once apm is drained, NULL to read the
+ *        device directly.
+ *    swap_effects - The effects of swap_to.
+ *    drain_until - The forward block of apm the stream reads out up to.
  */
 struct active_apm {
 	struct cras_apm *apm;
 	void *stream_ptr;
 	int effects;
+	bool background;
+	struct cras_apm *swap_to;
+	int swap_effects;
+	unsigned int drain_until;
 	struct active_apm *prev, *next;
 } * active_apms;
 
+/* Number of outputs whose echo can be summed into the reference. */
+#define MAX_REVERSE_TAPS 4
+/* Length of the ring the echo of the outputs is summed in, in 10ms blocks. */
+#define REVERSE_MIX_BLOCKS 10
+/* How far in ms an output may drift from its timeline before it's aligned to
+ * its delay again. */
+#define REVERSE_REALIGN_MS 2
+
+/*
+ * The ext dsp module attached to an output that plays audio as the reverse
+ * stream.
+ * Members:
+ *    ext - The interface run by the dsp pipeline of odev.
+ *    odev - The output iodev tapped, NULL if this tap is free.
+ *    dev_rate - The sample rate odev is opened for, zero until configured.
+ *    num_channels - Number of channels odev runs ext with.
+ *    next_pos - Position in the mix of the next frame from odev, in frames
+ *        at the reference rate since the monotonic clock started.
+ *    anchored - Set once next_pos is derived from the delay of odev.
+ */
+struct reverse_tap {
+	struct ext_dsp_module ext;
+	struct cras_iodev *odev;
+	unsigned int dev_rate;
+	unsigned int num_channels;
+	int64_t next_pos;
+	bool anchored;
+};
+
 /*
- * Object used to analyze playback audio from output iodev. It is responsible
+ * Object used to analyze playback audio from output iodevs. It is responsible
  * to get buffer containing latest output data and provide it to the APM
- * instances which want to analyze reverse stream.
+ * instances which want to analyze reverse stream. When more than one output
+ * plays, their post DSP audio is aligned to when it reaches the hardware and
+ * summed into one reference.
  * Member:
- *    ext - The interface implemented to process reverse(output) stream
- *        data in various formats.
+ *    taps - The outputs tapped. A tap doesn't move while its ext is set to
+ *        the device.
+ *    num_taps - Number of taps in use.
+ *    ref_tap - The tap the reference takes its rate and channels from.
  *    fbuf - Middle buffer holding reverse data for APMs to analyze.
- *    odev - Pointer to the output iodev playing audio as the reverse
- *        stream. NULL if there's no playback stream.
- *    dev_rate - The sample rate odev is opened for.
+ *    dev_rate - The sample rate of the reference.
  *    process_reverse - Flag to indicate if there's APM has effect that
  *        needs to process reverse stream.
+ *    mix - Each channel of the ring summing the taps.
+ *    mix_samples - Storage of mix.
+ *    mix_frames - Size of the ring in frames.
+ *    mix_start - Position of the oldest frame in the ring not passed to
+ *        fbuf yet.
+ *    mix_started - Set once mix_start is anchored.
+ *    mix_taps - The num_taps the mix was started with.
  */
 struct cras_apm_reverse_module {
-	struct ext_dsp_module ext;
+	struct reverse_tap taps[MAX_REVERSE_TAPS];
+	unsigned int num_taps;
+	struct reverse_tap *ref_tap;
 	struct float_buffer *fbuf;
-	struct cras_iodev *odev;
 	unsigned int dev_rate;
 	unsigned process_reverse;
+	float *mix[MAX_EXT_DSP_PORTS];
+	float *mix_samples;
+	unsigned int mix_frames;
+	int64_t mix_start;
+	bool mix_started;
+	unsigned int mix_taps;
 };
 
 static struct cras_apm_reverse_module *rmodule = NULL;
+/* All the APMs created, for streams to look up the one to share. Owned and
+ * modified in main thread. */
+static struct shared_apm *shared_apms = NULL;
+static unsigned int next_reader_id;
 static const char *aec_config_dir = NULL;
 static char ini_name[MAX_INI_NAME_LENGTH + 1];
 static dictionary *aec_ini = NULL;
 static dictionary *apm_ini = NULL;
+/* Number of audio threads at CRAS_OVERLOAD_APM, the echo reference is only
+ * given to APMs with a foreground stream while non zero. */
+static int num_overloaded;
 
 /* Update the global process reverse flag. Should be called when apms are added
  * or removed. */
@@ -154,16 +341,161 @@ static void update_process_reverse_flag()
 	}
 }
 
+/* Returns the first output tapped, or NULL if there's none. */
+static struct reverse_tap *first_tap()
+{
+	int i;
+
+	for (i = 0; i < MAX_REVERSE_TAPS; i++)
+		if (rmodule->taps[i].odev)
+			return &rmodule->taps[i];
+	return NULL;
+}
+
+/* Processes the blocks handed to the APM thread. The echo reference goes
+ * first, so the capture blocks find the playback they may contain. */
+static void apm_process_pending(struct shared_apm *shared)
+{
+	struct apm_reverse_block *block;
+	struct float_buffer *fbuf;
+	struct timespec start, end, elapsed;
+	unsigned int filled, nread;
+	float *const *rp;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+
+	filled = __atomic_load_n(&shared->rev_filled, __ATOMIC_ACQUIRE);
+	while (shared->rev_processed != filled) {
+		block = &shared->rev_blocks[shared->rev_processed %
+					    APM_NUM_BLOCKS];
+		ret = webrtc_apm_process_reverse_stream_f(
+			shared->apm_ptr, block->num_channels, block->frame_rate,
+			block->data);
+		if (ret)
+			syslog(LOG_ERR, "APM process reverse err");
+		__atomic_store_n(&shared->rev_processed,
+				 shared->rev_processed + 1, __ATOMIC_RELEASE);
+	}
+
+	filled = __atomic_load_n(&shared->fwd_filled, __ATOMIC_ACQUIRE);
+	while (shared->fwd_processed != filled) {
+		fbuf = shared->fwd_blocks[shared->fwd_processed %
+					  APM_NUM_BLOCKS];
+		nread = float_buffer_level(fbuf);
+		rp = float_buffer_read_pointer(fbuf, 0, &nread);
+		ret = webrtc_apm_process_stream_f(shared->apm_ptr,
+						  shared->fmt.num_channels,
+						  shared->fmt.frame_rate, rp);
+		if (ret) {
+			syslog(LOG_ERR, "APM process stream f err");
+			__atomic_store_n(&shared->error, ret, __ATOMIC_RELAXED);
+		}
+		__atomic_store_n(&shared->fwd_processed,
+				 shared->fwd_processed + 1, __ATOMIC_RELEASE);
+	}
+
+	/* Streams reading the APM are charged this from the audio thread. */
+	clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+	subtract_timespecs(&end, &start, &elapsed);
+	__atomic_store_n(&shared->process_ns,
+			 shared->process_ns + elapsed.tv_sec * 1000000000ULL +
+				 elapsed.tv_nsec,
+			 __ATOMIC_RELAXED);
+}
+
+static void *apm_thread_loop(void *arg)
+{
+	struct shared_apm *shared = (struct shared_apm *)arg;
+	eventfd_t count;
+
+	/* Run just below the audio thread so it keeps the priority. */
+	if (cras_set_rt_scheduling(CRAS_SERVER_RT_THREAD_PRIORITY) == 0)
+		cras_set_thread_priority(CRAS_SERVER_RT_THREAD_PRIORITY - 1);
+
+	while (!__atomic_load_n(&shared->stopping, __ATOMIC_ACQUIRE)) {
+		apm_process_pending(shared);
+		eventfd_read(shared->wake_fd, &count);
+	}
+	return NULL;
+}
+
+static void wake_apm_thread(struct shared_apm *shared)
+{
+	eventfd_write(shared->wake_fd, 1);
+}
+
+static void shared_apm_destroy(struct shared_apm *shared)
+{
+	int i;
+
+	if (shared->wake_fd >= 0) {
+		__atomic_store_n(&shared->stopping, 1, __ATOMIC_RELEASE);
+		wake_apm_thread(shared);
+		pthread_join(shared->thread, NULL);
+		close(shared->wake_fd);
+	}
+	float_buffer_destroy(&shared->out_block);
+	free(shared->interleaved);
+	buffer_share_destroy(shared->readers);
+	for (i = 0; i < APM_NUM_BLOCKS; i++) {
+		float_buffer_destroy(&shared->fwd_blocks[i]);
+		free(shared->rev_blocks[i].samples);
+	}
+	cras_audio_area_destroy(shared->area);
+	cras_audio_area_destroy(shared->planar_area);
+
+	/* Any unfinished AEC dump handle will be closed. */
+	webrtc_apm_destroy(shared->apm_ptr);
+	free(shared);
+}
+
+/* Releases the processed frames all the started streams have read. The
+ * output block is free for the next processed one once they are all read. */
+static void release_processed(struct shared_apm *shared)
+{
+	shared->out_read += buffer_share_get_new_write_point(shared->readers);
+	if (shared->out_read < shared->out_frames)
+		return;
+	shared->out_read = 0;
+	shared->out_frames = 0;
+	shared->interleaved_valid = false;
+}
+
+/* Lets apm read the processed data of its shared APM. The first stream
+ * started finds the APM at the read point of the device. Later ones catch up
+ * with it as they process. */
+static void add_reader(struct cras_apm *apm)
+{
+	if (apm->shared->num_readers++ == 0)
+		apm->shared->dev_offset = 0;
+	buffer_share_add_id(apm->shared->readers, apm->reader_id, apm);
+}
+
+/* Stops apm from reading the processed data of its shared APM. */
+static void remove_reader(struct cras_apm *apm)
+{
+	struct shared_apm *shared = apm->shared;
+
+	if (buffer_share_rm_id(shared->readers, apm->reader_id))
+		return;
+	shared->num_readers--;
+	release_processed(shared);
+}
+
+/* Destroys the handle of a stream, and the APM once no stream uses it. */
 static void apm_destroy(struct cras_apm **apm)
 {
+	struct shared_apm *shared;
+
 	if (*apm == NULL)
 		return;
-	byte_buffer_destroy(&(*apm)->buffer);
-	float_buffer_destroy(&(*apm)->fbuffer);
-	cras_audio_area_destroy((*apm)->area);
-
-	/* Any unfinished AEC dump handle will be closed. */
-	webrtc_apm_destroy((*apm)->apm_ptr);
+	shared = (*apm)->shared;
+	remove_reader(*apm);
+	if (--shared->refcount == 0) {
+		DL_DELETE(shared_apms, shared);
+		shared_apm_destroy(shared);
+	}
 	free(*apm);
 	*apm = NULL;
 }
@@ -199,12 +531,92 @@ static struct active_apm *get_active_apm(void *stream_ptr, void *dev_ptr)
 	return NULL;
 }
 
+/* Checks if active is the first of the active streams sharing its APM, so
+ * that work done once per APM can skip the others. */
+static bool is_first_active_of_apm(struct active_apm *active)
+{
+	struct active_apm *a;
+
+	DL_FOREACH (active_apms, a)
+		if (a->apm->shared == active->apm->shared)
+			break;
+	return a == active;
+}
+
+/* Checks if the stream of active has read all the frames its APM took for
+ * it before the swap. */
+static bool is_drained(struct active_apm *active)
+{
+	struct shared_apm *shared = active->apm->shared;
+	unsigned int offset, queued;
+	int ahead;
+
+	offset = buffer_share_id_offset(shared->readers,
+					active->apm->reader_id);
+	queued = shared->out_frames - shared->out_read;
+	ahead = shared->fwd_consumed - active->drain_until;
+
+	/* Once the stream has read the last block before the swap, the next
+	 * one may have been collected for the other streams sharing it. */
+	return (ahead == 0 && offset == queued) || (ahead == 1 && offset == 0);
+}
+
+/* Moves the stream of a drained active to the APM it swaps to, or back to
+ * the device if there is none. Returns active, or NULL if it is gone. */
+static struct active_apm *finish_swap(struct active_apm *active)
+{
+	struct cras_apm *drained = active->apm;
+
+	remove_reader(drained);
+	__atomic_store_n(&drained->draining, false, __ATOMIC_RELEASE);
+
+	if (active->swap_to == NULL) {
+		DL_DELETE(active_apms, active);
+		free(active);
+		active = NULL;
+	} else {
+		active->apm = active->swap_to;
+		active->effects = active->swap_effects;
+		active->swap_to = NULL;
+		add_reader(active->apm);
+	}
+	update_process_reverse_flag();
+	return active;
+}
+
 struct cras_apm *cras_apm_list_get_active_apm(void *stream_ptr, void *dev_ptr)
 {
 	struct active_apm *active = get_active_apm(stream_ptr, dev_ptr);
+
+	if (active && active->apm->draining && is_drained(active))
+		active = finish_swap(active);
 	return active ? active->apm : NULL;
 }
 
+uint64_t cras_apm_list_get_process_ns(struct cras_apm_list *list,
+				      void *dev_ptr)
+{
+	struct cras_apm *apm;
+
+	if (list == NULL)
+		return 0;
+	DL_SEARCH_SCALAR(list->apms, apm, dev_ptr, dev_ptr);
+	if (apm == NULL)
+		return 0;
+	return __atomic_load_n(&apm->shared->process_ns, __ATOMIC_RELAXED) -
+	       apm->start_ns;
+}
+
+size_t cras_apm_list_get_mem_bytes(struct cras_apm_list *list, void *dev_ptr)
+{
+	struct cras_apm *apm;
+
+	if (list == NULL)
+		return 0;
+	DL_SEARCH_SCALAR(list->apms, apm, dev_ptr, dev_ptr);
+	return apm ? apm->shared->mem_bytes : 0;
+}
+
 uint64_t cras_apm_list_get_effects(struct cras_apm_list *list)
 {
 	if (list == NULL)
@@ -213,6 +625,18 @@ uint64_t cras_apm_list_get_effects(struct cras_apm_list *list)
 		return list->effects;
 }
 
+void cras_apm_list_set_background(struct cras_apm_list *list, bool background)
+{
+	if (list)
+		list->background = background;
+}
+
+void cras_apm_list_set_overloaded(bool overloaded)
+{
+	__atomic_add_fetch(&num_overloaded, overloaded ? 1 : -1,
+			   __ATOMIC_RELAXED);
+}
+
 void cras_apm_list_remove_apm(struct cras_apm_list *list, void *dev_ptr)
 {
 	struct cras_apm *apm;
@@ -223,6 +647,12 @@ void cras_apm_list_remove_apm(struct cras_apm_list *list, void *dev_ptr)
 			apm_destroy(&apm);
 		}
 	}
+	DL_FOREACH (list->staged, apm) {
+		if (apm->dev_ptr == dev_ptr) {
+			DL_DELETE(list->staged, apm);
+			apm_destroy(&apm);
+		}
+	}
 }
 
 /*
@@ -264,89 +694,236 @@ static void get_best_channels(struct cras_audio_format *apm_fmt)
 		apm_fmt->channel_layout[ch] = layout[ch];
 }
 
-struct cras_apm *cras_apm_list_add_apm(struct cras_apm_list *list,
-				       void *dev_ptr,
-				       const struct cras_audio_format *dev_fmt,
-				       bool is_aec_use_case)
+/* Looks up the position of each APM channel, and the device channel at the
+ * same position. */
+static void get_channel_map(const struct cras_audio_format *fmt,
+			    const struct cras_audio_format *dev_fmt, int *map)
 {
-	struct cras_apm *apm;
+	int ch, i;
+
+	for (i = 0; i < (int)fmt->num_channels; i++) {
+		map[i] = -1;
+		for (ch = 0; ch < CRAS_CH_MAX; ch++)
+			if (fmt->channel_layout[ch] == i)
+				break;
+		if (ch < CRAS_CH_MAX)
+			map[i] = dev_fmt->channel_layout[ch];
+	}
+}
 
-	DL_FOREACH (list->apms, apm)
-		if (apm->dev_ptr == dev_ptr)
-			return apm;
+static bool same_format(const struct cras_audio_format *a,
+			const struct cras_audio_format *b)
+{
+	return a->format == b->format && a->frame_rate == b->frame_rate &&
+	       a->num_channels == b->num_channels &&
+	       !memcmp(a->channel_layout, b->channel_layout,
+		       sizeof(a->channel_layout));
+}
 
-	// TODO(hychao): Remove the check when we enable more effects.
-	if (!(list->effects & APM_ECHO_CANCELLATION))
-		return NULL;
+static struct shared_apm *
+shared_apm_create(void *dev_ptr, const struct cras_audio_format *dev_fmt,
+		  uint64_t effects, bool use_tuned_settings)
+{
+	struct shared_apm *shared;
+	int i;
 
-	apm = (struct cras_apm *)calloc(1, sizeof(*apm));
+	shared = (struct shared_apm *)calloc(1, sizeof(*shared));
 
 	/* Configures APM to the format used by input device. If the channel
 	 * count is larger than stereo, use the standard channel count/layout
 	 * in APM. */
-	apm->dev_fmt = *dev_fmt;
-	apm->fmt = *dev_fmt;
-	get_best_channels(&apm->fmt);
-
-	/* Use tuned settings only when the forward dev(capture) and reverse
-	 * dev(playback) both are in typical AEC use case. */
-	apm->use_tuned_settings = is_aec_use_case;
-	if (rmodule->odev) {
-		apm->use_tuned_settings &=
-			cras_iodev_is_aec_use_case(rmodule->odev->active_node);
-	}
+	shared->dev_fmt = *dev_fmt;
+	shared->fmt = *dev_fmt;
+	get_best_channels(&shared->fmt);
+	get_channel_map(&shared->fmt, &shared->dev_fmt, shared->channel_map);
+	shared->use_tuned_settings = use_tuned_settings;
 
 	/* Use the configs tuned specifically for internal device. Otherwise
 	 * just pass NULL so every other settings will be default. */
-	apm->apm_ptr =
-		apm->use_tuned_settings ?
-			webrtc_apm_create(apm->fmt.num_channels,
-					  apm->fmt.frame_rate, aec_ini,
+	shared->apm_ptr =
+		use_tuned_settings ?
+			webrtc_apm_create(shared->fmt.num_channels,
+					  shared->fmt.frame_rate, aec_ini,
 					  apm_ini) :
-			webrtc_apm_create(apm->fmt.num_channels,
-					  apm->fmt.frame_rate, NULL, NULL);
-	if (apm->apm_ptr == NULL) {
+			webrtc_apm_create(shared->fmt.num_channels,
+					  shared->fmt.frame_rate, NULL, NULL);
+	if (shared->apm_ptr == NULL) {
 		syslog(LOG_ERR,
 		       "Fail to create webrtc apm for ch %zu"
 		       " rate %zu effect %" PRIu64,
-		       dev_fmt->num_channels, dev_fmt->frame_rate,
-		       list->effects);
-		free(apm);
+		       dev_fmt->num_channels, dev_fmt->frame_rate, effects);
+		free(shared);
 		return NULL;
 	}
 
-	apm->dev_ptr = dev_ptr;
-	apm->work_queue = NULL;
+	shared->dev_ptr = dev_ptr;
+	shared->effects = effects;
+	shared->work_queue = NULL;
 
 	/* WebRTC APM wants 10 ms equivalence of data to process. */
-	apm->buffer = byte_buffer_create(10 * apm->fmt.frame_rate / 1000 *
-					 cras_get_format_bytes(&apm->fmt));
-	apm->fbuffer = float_buffer_create(10 * apm->fmt.frame_rate / 1000,
-					   apm->fmt.num_channels);
-	apm->area = cras_audio_area_create(apm->fmt.num_channels);
-	cras_audio_area_config_channels(apm->area, &apm->fmt);
+	shared->out_block = float_buffer_create(10 * shared->fmt.frame_rate /
+							1000,
+						shared->fmt.num_channels);
+	shared->interleaved = (uint8_t *)malloc(
+		10 * shared->fmt.frame_rate / 1000 *
+		cras_get_format_bytes(&shared->fmt));
+	shared->readers =
+		buffer_share_create(10 * shared->fmt.frame_rate / 1000);
+	/* Only the echo canceller reads the echo reference, the rest of the
+	 * APMs never get reverse blocks queued. */
+	for (i = 0; i < APM_NUM_BLOCKS; i++) {
+		shared->fwd_blocks[i] =
+			float_buffer_create(10 * shared->fmt.frame_rate / 1000,
+					    shared->fmt.num_channels);
+		if (effects & APM_ECHO_CANCELLATION)
+			shared->rev_blocks[i].samples = (float *)calloc(
+				APM_REVERSE_MAX_SAMPLES, sizeof(float));
+	}
+	shared->area = cras_audio_area_create(shared->fmt.num_channels);
+	cras_audio_area_config_channels(shared->area, &shared->fmt);
+	shared->planar_area = cras_audio_area_create(shared->fmt.num_channels);
+	cras_audio_area_config_channels(shared->planar_area, &shared->fmt);
+	shared->mem_bytes = 10 * shared->fmt.frame_rate / 1000 *
+			    (cras_get_format_bytes(&shared->fmt) +
+			     (APM_NUM_BLOCKS + 1) * sizeof(float) *
+				     shared->fmt.num_channels);
+	if (effects & APM_ECHO_CANCELLATION)
+		shared->mem_bytes += APM_NUM_BLOCKS * sizeof(float) *
+				     APM_REVERSE_MAX_SAMPLES;
+
+	shared->wake_fd = eventfd(0, EFD_CLOEXEC);
+	if (shared->wake_fd < 0 ||
+	    pthread_create(&shared->thread, NULL, apm_thread_loop, shared)) {
+		syslog(LOG_ERR, "Fail to start APM thread");
+		if (shared->wake_fd >= 0)
+			close(shared->wake_fd);
+		shared->wake_fd = -1;
+		shared_apm_destroy(shared);
+		return NULL;
+	}
 
-	DL_APPEND(list->apms, apm);
+	return shared;
+}
+
+/* Creates the handle of a stream to the APM applying effects on dev_ptr,
+ * sharing it with other streams if there is one already. */
+static struct cras_apm *apm_create(void *dev_ptr,
+				   const struct cras_audio_format *dev_fmt,
+				   uint64_t effects, bool is_aec_use_case)
+{
+	struct cras_apm *apm;
+	struct shared_apm *shared;
+	struct reverse_tap *tap;
+	bool use_tuned_settings;
+
+	/* Use tuned settings only when the forward dev(capture) and reverse
+	 * dev(playback) both are in typical AEC use case. */
+	use_tuned_settings = is_aec_use_case;
+	tap = first_tap();
+	if (tap) {
+		use_tuned_settings &=
+			cras_iodev_is_aec_use_case(tap->odev->active_node);
+	}
+
+	/* Streams processing the same input the same way share one APM. */
+	DL_FOREACH (shared_apms, shared) {
+		if (shared->dev_ptr == dev_ptr && shared->effects == effects &&
+		    shared->use_tuned_settings == use_tuned_settings &&
+		    same_format(&shared->dev_fmt, dev_fmt))
+			break;
+	}
+	if (shared == NULL) {
+		shared = shared_apm_create(dev_ptr, dev_fmt, effects,
+					   use_tuned_settings);
+		if (shared == NULL)
+			return NULL;
+		DL_APPEND(shared_apms, shared);
+	}
+
+	apm = (struct cras_apm *)calloc(1, sizeof(*apm));
+	apm->shared = shared;
+	apm->dev_ptr = dev_ptr;
+	apm->reader_id = next_reader_id++;
+	apm->start_ns = __atomic_load_n(&shared->process_ns, __ATOMIC_RELAXED);
+	shared->refcount++;
 
 	return apm;
 }
 
-void cras_apm_list_start_apm(struct cras_apm_list *list, void *dev_ptr)
+struct cras_apm *cras_apm_list_add_apm(struct cras_apm_list *list,
+				       void *dev_ptr,
+				       const struct cras_audio_format *dev_fmt,
+				       bool is_aec_use_case)
 {
-	struct active_apm *active;
 	struct cras_apm *apm;
 
-	if (list == NULL)
-		return;
+	DL_FOREACH (list->apms, apm)
+		if (apm->dev_ptr == dev_ptr)
+			return apm;
 
-	/* Check if this apm has already been started. */
-	apm = cras_apm_list_get_active_apm(list->stream_ptr, dev_ptr);
+	// TODO(hychao): Remove the check when we enable more effects.
+	if (!(list->effects & APM_ECHO_CANCELLATION))
+		return NULL;
+
+	apm = apm_create(dev_ptr, dev_fmt, list->effects, is_aec_use_case);
 	if (apm)
-		return;
+		DL_APPEND(list->apms, apm);
+	return apm;
+}
+
+int cras_apm_list_stage_effects(struct cras_apm_list *list, uint64_t effects)
+{
+	struct cras_apm *apm;
+
+	DL_FOREACH (list->staged, apm)
+		if (__atomic_load_n(&apm->draining, __ATOMIC_ACQUIRE))
+			return -EBUSY;
+
+	DL_FOREACH (list->staged, apm) {
+		DL_DELETE(list->staged, apm);
+		apm_destroy(&apm);
+	}
+	list->staged_effects = effects;
+	return 0;
+}
+
+int cras_apm_list_stage_apm(struct cras_apm_list *list, void *dev_ptr,
+			    const struct cras_audio_format *dev_fmt,
+			    bool is_aec_use_case)
+{
+	struct cras_audio_format fmt = *dev_fmt, staged_fmt = *dev_fmt;
+	struct cras_apm *apm;
 
 	DL_SEARCH_SCALAR(list->apms, apm, dev_ptr, dev_ptr);
+	if (apm)
+		fmt = apm->shared->fmt;
+
+	// TODO(hychao): Remove the check when we enable more effects.
+	if (list->staged_effects & APM_ECHO_CANCELLATION)
+		get_best_channels(&staged_fmt);
+
+	/* The stream converts from the format it reads, which stays. */
+	if (!same_format(&fmt, &staged_fmt))
+		return -ENOTSUP;
+
+	if (!(list->staged_effects & APM_ECHO_CANCELLATION))
+		return 0;
+	DL_SEARCH_SCALAR(list->staged, apm, dev_ptr, dev_ptr);
+	if (apm)
+		return 0;
+	apm = apm_create(dev_ptr, dev_fmt, list->staged_effects,
+			 is_aec_use_case);
 	if (apm == NULL)
-		return;
+		return -ENOMEM;
+	DL_APPEND(list->staged, apm);
+	return 0;
+}
+
+/* Adds apm of the stream of list to the active APMs. */
+static void activate_apm(struct cras_apm_list *list, struct cras_apm *apm,
+			 uint64_t effects)
+{
+	struct active_apm *active;
 
 	active = (struct active_apm *)calloc(1, sizeof(*active));
 	if (active == NULL) {
@@ -355,12 +932,34 @@ void cras_apm_list_start_apm(struct cras_apm_list *list, void *dev_ptr)
 	}
 	active->apm = apm;
 	active->stream_ptr = list->stream_ptr;
-	active->effects = list->effects;
+	active->effects = effects;
+	active->background = list->background;
 	DL_APPEND(active_apms, active);
 
+	add_reader(apm);
+
 	update_process_reverse_flag();
 }
 
+void cras_apm_list_start_apm(struct cras_apm_list *list, void *dev_ptr)
+{
+	struct cras_apm *apm;
+
+	if (list == NULL)
+		return;
+
+	/* Check if this apm has already been started. */
+	apm = cras_apm_list_get_active_apm(list->stream_ptr, dev_ptr);
+	if (apm)
+		return;
+
+	DL_SEARCH_SCALAR(list->apms, apm, dev_ptr, dev_ptr);
+	if (apm == NULL)
+		return;
+
+	activate_apm(list, apm, list->effects);
+}
+
 void cras_apm_list_stop_apm(struct cras_apm_list *list, void *dev_ptr)
 {
 	struct active_apm *active;
@@ -370,6 +969,9 @@ void cras_apm_list_stop_apm(struct cras_apm_list *list, void *dev_ptr)
 
 	active = get_active_apm(list->stream_ptr, dev_ptr);
 	if (active) {
+		remove_reader(active->apm);
+		__atomic_store_n(&active->apm->draining, false,
+				 __ATOMIC_RELEASE);
 		DL_DELETE(active_apms, active);
 		free(active);
 	}
@@ -377,6 +979,68 @@ void cras_apm_list_stop_apm(struct cras_apm_list *list, void *dev_ptr)
 	update_process_reverse_flag();
 }
 
+/* Hands the forward block being filled to the APM thread padded with
+ * silence, so the frames taken so far come out without waiting for more. */
+static void seal_fwd_block(struct shared_apm *shared)
+{
+	struct float_buffer *fbuf;
+	unsigned int idx, pad, i;
+	float *const *wp;
+
+	if (shared->fwd_filled - shared->fwd_consumed == APM_NUM_BLOCKS)
+		return;
+	idx = shared->fwd_filled % APM_NUM_BLOCKS;
+	fbuf = shared->fwd_blocks[idx];
+	if (float_buffer_level(fbuf) == 0)
+		return;
+
+	pad = float_buffer_writable(fbuf);
+	wp = float_buffer_write_pointer(fbuf);
+	for (i = 0; i < fbuf->num_channels; i++)
+		memset(wp[i], 0, pad * sizeof(float));
+	float_buffer_written(fbuf, pad);
+	shared->fwd_pad[idx] = pad;
+
+	__atomic_store_n(&shared->fwd_filled, shared->fwd_filled + 1,
+			 __ATOMIC_RELEASE);
+	wake_apm_thread(shared);
+}
+
+void cras_apm_list_swap_apm(struct cras_apm_list *list, void *dev_ptr)
+{
+	struct active_apm *active;
+	struct cras_apm *next;
+
+	DL_SEARCH_SCALAR(list->staged, next, dev_ptr, dev_ptr);
+	active = get_active_apm(list->stream_ptr, dev_ptr);
+	if (active == NULL) {
+		/* Nothing to drain, the device frames the stream hasn't read
+		 * yet go to the new APM. */
+		if (next)
+			activate_apm(list, next, list->staged_effects);
+		return;
+	}
+
+	/* The stream keeps reading the current APM until it has handed out
+	 * all the frames it took. Those after go to next from the device. */
+	seal_fwd_block(active->apm->shared);
+	active->drain_until = active->apm->shared->fwd_filled;
+	active->swap_to = next;
+	active->swap_effects = list->staged_effects;
+	__atomic_store_n(&active->apm->draining, true, __ATOMIC_RELEASE);
+}
+
+void cras_apm_list_commit_effects(struct cras_apm_list *list)
+{
+	struct cras_apm *apms = list->apms;
+	uint64_t effects = list->effects;
+
+	list->apms = list->staged;
+	list->effects = list->staged_effects;
+	list->staged = apms;
+	list->staged_effects = effects;
+}
+
 int cras_apm_list_destroy(struct cras_apm_list *list)
 {
 	struct cras_apm *apm;
@@ -385,6 +1049,10 @@ int cras_apm_list_destroy(struct cras_apm_list *list)
 		DL_DELETE(list->apms, apm);
 		apm_destroy(&apm);
 	}
+	DL_FOREACH (list->staged, apm) {
+		DL_DELETE(list->staged, apm);
+		apm_destroy(&apm);
+	}
 	free(list);
 
 	return 0;
@@ -400,111 +1068,191 @@ static struct cras_iodev *get_echo_reference_target(struct cras_iodev *iodev)
 	return iodev->echo_reference_dev ? iodev->echo_reference_dev : iodev;
 }
 
+static void reverse_data_run(struct ext_dsp_module *ext, unsigned int nframes);
+static void reverse_data_configure(struct ext_dsp_module *ext,
+				   unsigned int buffer_size,
+				   unsigned int num_channels, unsigned int rate);
+
+/* Taps echo_ref so the audio it plays is added to the echo reference. */
+static void add_tap(struct cras_iodev *echo_ref)
+{
+	struct reverse_tap *tap = NULL, *first = first_tap();
+	int i;
+
+	for (i = 0; i < MAX_REVERSE_TAPS; i++) {
+		if (rmodule->taps[i].odev == echo_ref)
+			return;
+		if (!tap && !rmodule->taps[i].odev)
+			tap = &rmodule->taps[i];
+	}
+	if (!tap) {
+		syslog(LOG_WARNING, "No echo reference tap left for %s",
+		       echo_ref->info.name);
+		return;
+	}
+
+	/* The taps share the mix, so they must run on the same thread. */
+	if (first && cras_iodev_list_get_dev_audio_thread(first->odev) !=
+			     cras_iodev_list_get_dev_audio_thread(echo_ref)) {
+		syslog(LOG_INFO, "Echo of %s not in reference, other thread",
+		       echo_ref->info.name);
+		return;
+	}
+
+	tap->ext.run = reverse_data_run;
+	tap->ext.configure = reverse_data_configure;
+	tap->dev_rate = 0;
+	tap->anchored = false;
+	tap->odev = echo_ref;
+	__atomic_add_fetch(&rmodule->num_taps, 1, __ATOMIC_RELEASE);
+	cras_iodev_set_ext_dsp_module(echo_ref, &tap->ext);
+}
+
+/* Stops adding the audio echo_ref plays to the echo reference. */
+static void remove_tap(struct cras_iodev *echo_ref)
+{
+	struct reverse_tap *tap;
+	int i;
+
+	for (i = 0; i < MAX_REVERSE_TAPS; i++) {
+		tap = &rmodule->taps[i];
+		if (tap->odev != echo_ref)
+			continue;
+		cras_iodev_set_ext_dsp_module(echo_ref, NULL);
+		tap->odev = NULL;
+		/* The next tap to run takes the reference over. */
+		if (rmodule->ref_tap == tap)
+			rmodule->ref_tap = NULL;
+		__atomic_sub_fetch(&rmodule->num_taps, 1, __ATOMIC_RELEASE);
+	}
+}
+
 /*
- * Updates the first enabled output iodev in the list, determine the echo
- * reference target base on this output iodev, and register rmodule as ext dsp
- * module to this echo reference target.
- * When this echo reference iodev is opened and audio data flows through its
+ * Taps the echo reference target of the first enabled output iodev, so there
+ * is a reverse stream whenever an output is enabled.
+ * When an echo reference iodev is opened and audio data flows through its
  * dsp pipeline, APMs will anaylize the reverse stream. This is expected to be
  * called in main thread when output devices enable/dsiable state changes.
  */
 static void update_first_output_dev_to_process()
 {
-	struct cras_iodev *echo_ref;
 	struct cras_iodev *iodev =
 		cras_iodev_list_get_first_enabled_iodev(CRAS_STREAM_OUTPUT);
 
 	if (iodev == NULL)
 		return;
 
-	echo_ref = get_echo_reference_target(iodev);
+	add_tap(get_echo_reference_target(iodev));
+}
 
-	/* If rmodule is already tracking echo_ref, do nothing. */
-	if (rmodule->odev == echo_ref)
+static void handle_device_enabled(struct cras_iodev *iodev, void *cb_data)
+{
+	if (iodev->direction != CRAS_STREAM_OUTPUT)
 		return;
 
-	/* Detach from the old iodev that rmodule was tracking. */
-	if (rmodule->odev) {
-		cras_iodev_set_ext_dsp_module(rmodule->odev, NULL);
-		rmodule->odev = NULL;
-	}
-
-	rmodule->odev = echo_ref;
-	cras_iodev_set_ext_dsp_module(echo_ref, &rmodule->ext);
+	/* Every enabled output adds its echo to the reference. */
+	add_tap(get_echo_reference_target(iodev));
 }
 
-static void handle_device_enabled(struct cras_iodev *iodev, void *cb_data)
+static void handle_device_disabled(struct cras_iodev *iodev, void *cb_data)
 {
 	if (iodev->direction != CRAS_STREAM_OUTPUT)
 		return;
 
-	/* Register to the first enabled output device. */
+	remove_tap(get_echo_reference_target(iodev));
+
+	/* Outputs sharing the echo reference may still be enabled. */
 	update_first_output_dev_to_process();
 }
 
-static void handle_device_disabled(struct cras_iodev *iodev, void *cb_data)
+/* Queues a 10ms block of echo reference for the APM thread. The block is
+ * dropped if the APM thread is behind by APM_NUM_BLOCKS blocks. */
+static void queue_reverse(struct shared_apm *shared, float *const *rp,
+			  unsigned int num_channels, unsigned int frames,
+			  unsigned int frame_rate)
 {
-	struct cras_iodev *echo_ref;
+	struct apm_reverse_block *block;
+	unsigned int i;
 
-	if (iodev->direction != CRAS_STREAM_OUTPUT)
+	if (!shared->rev_blocks[0].samples)
+		return;
+	if (shared->rev_filled -
+		    __atomic_load_n(&shared->rev_processed, __ATOMIC_ACQUIRE) ==
+	    APM_NUM_BLOCKS)
 		return;
 
-	echo_ref = get_echo_reference_target(iodev);
-
-	if (rmodule->odev == echo_ref) {
-		cras_iodev_set_ext_dsp_module(echo_ref, NULL);
-		rmodule->odev = NULL;
+	block = &shared->rev_blocks[shared->rev_filled % APM_NUM_BLOCKS];
+	block->num_channels = num_channels;
+	block->frame_rate = frame_rate;
+	for (i = 0; i < num_channels; i++) {
+		block->data[i] = block->samples + i * frames;
+		memcpy(block->data[i], rp[i], frames * sizeof(float));
 	}
+	__atomic_store_n(&shared->rev_filled, shared->rev_filled + 1,
+			 __ATOMIC_RELEASE);
+	wake_apm_thread(shared);
+}
 
-	/* Register to the first enabled output device. */
-	update_first_output_dev_to_process();
+/* Checks if a stream that isn't background capture reads from shared. */
+static bool has_foreground_reader(struct shared_apm *shared)
+{
+	struct active_apm *active;
+
+	DL_FOREACH (active_apms, active)
+		if (active->apm->shared == shared && !active->background)
+			return true;
+	return false;
 }
 
 static int process_reverse(struct float_buffer *fbuf, unsigned int frame_rate)
 {
 	struct active_apm *active;
-	int ret;
-	float *const *wp;
+	unsigned int nread;
+	float *const *rp;
+	bool overloaded;
 
 	if (float_buffer_writable(fbuf))
 		return 0;
 
-	wp = float_buffer_write_pointer(fbuf);
+	nread = float_buffer_level(fbuf);
+	if (nread * fbuf->num_channels > APM_REVERSE_MAX_SAMPLES) {
+		float_buffer_reset(fbuf);
+		return -EINVAL;
+	}
+	rp = float_buffer_read_pointer(fbuf, 0, &nread);
+	overloaded = __atomic_load_n(&num_overloaded, __ATOMIC_RELAXED) > 0;
 
 	DL_FOREACH (active_apms, active) {
-		if (!(active->effects & APM_ECHO_CANCELLATION))
+		if (!(active->effects & APM_ECHO_CANCELLATION) ||
+		    !is_first_active_of_apm(active))
 			continue;
-
-		ret = webrtc_apm_process_reverse_stream_f(active->apm->apm_ptr,
-							  fbuf->num_channels,
-							  frame_rate, wp);
-		if (ret) {
-			syslog(LOG_ERR, "APM process reverse err");
-			return ret;
-		}
+		/* Without the reference the echo canceller leaves the capture
+		 * alone, and saves the analysis on the APM thread. */
+		if (overloaded && !has_foreground_reader(active->apm->shared))
+			continue;
+		queue_reverse(active->apm->shared, rp, fbuf->num_channels,
+			      nread, frame_rate);
 	}
 	float_buffer_reset(fbuf);
 	return 0;
 }
 
-void reverse_data_run(struct ext_dsp_module *ext, unsigned int nframes)
+/* Passes nframes of each channel in src from offset to fbuf, and the APMs
+ * each time it fills. */
+static void feed_reverse(struct cras_apm_reverse_module *rmod,
+			 float *const *src, unsigned int offset,
+			 unsigned int nframes)
 {
-	struct cras_apm_reverse_module *rmod =
-		(struct cras_apm_reverse_module *)ext;
-	unsigned int writable;
-	int i, offset = 0;
+	unsigned int writable, i;
 	float *const *wp;
 
-	if (!rmod->process_reverse)
-		return;
-
 	while (nframes) {
 		process_reverse(rmod->fbuf, rmod->dev_rate);
 		writable = float_buffer_writable(rmod->fbuf);
 		writable = MIN(nframes, writable);
 		wp = float_buffer_write_pointer(rmod->fbuf);
 		for (i = 0; i < rmod->fbuf->num_channels; i++)
-			memcpy(wp[i], ext->ports[i] + offset,
+			memcpy(wp[i], src[i] + offset,
 			       writable * sizeof(float));
 
 		offset += writable;
@@ -513,16 +1261,196 @@ void reverse_data_run(struct ext_dsp_module *ext, unsigned int nframes)
 	}
 }
 
-void reverse_data_configure(struct ext_dsp_module *ext,
-			    unsigned int buffer_size, unsigned int num_channels,
-			    unsigned int rate)
+/* Starts the mix over, each tap is aligned again when it next runs. */
+static void reset_mix(struct cras_apm_reverse_module *rmod)
+{
+	int i;
+
+	for (i = 0; i < MAX_REVERSE_TAPS; i++)
+		rmod->taps[i].anchored = false;
+	if (rmod->mix_samples)
+		memset(rmod->mix_samples, 0,
+		       sizeof(float) * rmod->mix_frames *
+			       rmod->fbuf->num_channels);
+	rmod->mix_started = false;
+	rmod->mix_taps = __atomic_load_n(&rmod->num_taps, __ATOMIC_ACQUIRE);
+}
+
+/* Sets the format of the reference to that of tap. */
+static void configure_reference(struct cras_apm_reverse_module *rmod,
+				struct reverse_tap *tap)
 {
-	struct cras_apm_reverse_module *rmod =
-		(struct cras_apm_reverse_module *)ext;
+	unsigned int i;
+
 	if (rmod->fbuf)
 		float_buffer_destroy(&rmod->fbuf);
-	rmod->fbuf = float_buffer_create(rate / 100, num_channels);
-	rmod->dev_rate = rate;
+	rmod->fbuf = float_buffer_create(tap->dev_rate / 100,
+					 tap->num_channels);
+	rmod->dev_rate = tap->dev_rate;
+
+	free(rmod->mix_samples);
+	rmod->mix_frames = REVERSE_MIX_BLOCKS * tap->dev_rate / 100;
+	rmod->mix_samples = (float *)calloc(
+		(size_t)rmod->mix_frames * tap->num_channels, sizeof(float));
+	for (i = 0; i < tap->num_channels; i++)
+		rmod->mix[i] = rmod->mix_samples + i * rmod->mix_frames;
+
+	rmod->ref_tap = tap;
+	reset_mix(rmod);
+}
+
+/* Checks if tap plays audio that can make the reference. */
+static bool tap_is_live(const struct reverse_tap *tap)
+{
+	return tap && tap->odev && tap->dev_rate &&
+	       cras_iodev_is_open(tap->odev);
+}
+
+/* Passes the mix up to position upto to fbuf, and clears it for the frames
+ * to come. */
+static void emit_mix(struct cras_apm_reverse_module *rmod, int64_t upto)
+{
+	int64_t skip_to = upto;
+	unsigned int idx, n, i;
+
+	/* Past a gap longer than the ring there is only silence to pass. */
+	if (upto - rmod->mix_start > rmod->mix_frames)
+		upto = rmod->mix_start + rmod->mix_frames;
+
+	while (rmod->mix_start < upto) {
+		idx = rmod->mix_start % rmod->mix_frames;
+		n = MIN(upto - rmod->mix_start, rmod->mix_frames - idx);
+		feed_reverse(rmod, rmod->mix, idx, n);
+		for (i = 0; i < rmod->fbuf->num_channels; i++)
+			memset(rmod->mix[i] + idx, 0, n * sizeof(float));
+		rmod->mix_start += n;
+	}
+	rmod->mix_start = MAX(rmod->mix_start, skip_to);
+}
+
+/* Returns the position all the taps playing have added their audio up to.
+ * Taps behind the newest by half the ring are taken as stopped. */
+static int64_t mixed_pos(struct cras_apm_reverse_module *rmod)
+{
+	struct reverse_tap *tap;
+	int64_t newest = rmod->mix_start, complete;
+	int i;
+
+	for (i = 0; i < MAX_REVERSE_TAPS; i++) {
+		tap = &rmod->taps[i];
+		if (tap->odev && tap->anchored &&
+		    tap->dev_rate == rmod->dev_rate)
+			newest = MAX(newest, tap->next_pos);
+	}
+
+	complete = newest;
+	for (i = 0; i < MAX_REVERSE_TAPS; i++) {
+		tap = &rmod->taps[i];
+		if (tap->odev && tap->anchored &&
+		    tap->dev_rate == rmod->dev_rate &&
+		    tap->next_pos >= newest - rmod->mix_frames / 2)
+			complete = MIN(complete, tap->next_pos);
+	}
+	return complete;
+}
+
+/* Adds nframes from tap to the mix at the time they reach the hardware, and
+ * passes on what all the taps have added to. */
+static void mix_reverse(struct cras_apm_reverse_module *rmod,
+			struct reverse_tap *tap, unsigned int nframes)
+{
+	struct timespec now;
+	int64_t pos, end;
+	unsigned int done = 0, idx, n, i;
+	int delay;
+
+	/* Summing outputs at other rates would take resampling them. */
+	if (tap->dev_rate != rmod->dev_rate)
+		return;
+	if (rmod->mix_taps !=
+	    __atomic_load_n(&rmod->num_taps, __ATOMIC_ACQUIRE))
+		reset_mix(rmod);
+
+	/* The audio is past the DSP here, only the hardware delay is left. */
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	delay = tap->odev->delay_frames(tap->odev);
+	pos = (int64_t)now.tv_sec * rmod->dev_rate +
+	      (int64_t)now.tv_nsec * rmod->dev_rate / 1000000000 +
+	      MAX(delay, 0);
+	if (!tap->anchored ||
+	    llabs(pos - tap->next_pos) >
+		    rmod->dev_rate * REVERSE_REALIGN_MS / 1000) {
+		tap->next_pos = pos;
+		tap->anchored = true;
+	}
+	if (!rmod->mix_started) {
+		rmod->mix_start = tap->next_pos;
+		rmod->mix_started = true;
+	}
+
+	/* Make room in the ring, taps still behind lose those frames. */
+	end = tap->next_pos + nframes;
+	if (end - rmod->mix_start > rmod->mix_frames)
+		emit_mix(rmod, end - rmod->mix_frames);
+
+	if (tap->next_pos < rmod->mix_start)
+		done = MIN(nframes, rmod->mix_start - tap->next_pos);
+	pos = tap->next_pos + done;
+	while (done < nframes) {
+		idx = pos % rmod->mix_frames;
+		n = MIN(nframes - done, rmod->mix_frames - idx);
+		for (i = 0; i < rmod->fbuf->num_channels; i++)
+			dsp_util_accumulate(
+				rmod->mix[i] + idx,
+				tap->ext.ports[MIN(i, tap->num_channels - 1)] +
+					done,
+				n);
+		done += n;
+		pos += n;
+	}
+	tap->next_pos = end;
+
+	emit_mix(rmod, mixed_pos(rmod));
+}
+
+static void reverse_data_run(struct ext_dsp_module *ext, unsigned int nframes)
+{
+	struct cras_apm_reverse_module *rmod = rmodule;
+	struct reverse_tap *tap = (struct reverse_tap *)ext;
+
+	if (!rmod->process_reverse) {
+		if (rmod->mix_started)
+			reset_mix(rmod);
+		return;
+	}
+
+	if (tap != rmod->ref_tap && tap->dev_rate &&
+	    !tap_is_live(rmod->ref_tap))
+		configure_reference(rmod, tap);
+	if (!rmod->fbuf)
+		return;
+
+	/* A single output is the reference as it is. */
+	if (__atomic_load_n(&rmod->num_taps, __ATOMIC_ACQUIRE) <= 1) {
+		if (tap == rmod->ref_tap)
+			feed_reverse(rmod, ext->ports, 0, nframes);
+		return;
+	}
+	mix_reverse(rmod, tap, nframes);
+}
+
+static void reverse_data_configure(struct ext_dsp_module *ext,
+				   unsigned int buffer_size,
+				   unsigned int num_channels, unsigned int rate)
+{
+	struct cras_apm_reverse_module *rmod = rmodule;
+	struct reverse_tap *tap = (struct reverse_tap *)ext;
+
+	tap->dev_rate = rate;
+	tap->num_channels = num_channels;
+	tap->anchored = false;
+	if (tap == rmod->ref_tap || !tap_is_live(rmod->ref_tap))
+		configure_reference(rmod, tap);
 }
 
 static void get_aec_ini(const char *config_dir)
@@ -557,12 +1485,9 @@ static void get_apm_ini(const char *config_dir)
 
 int cras_apm_list_init(const char *device_config_dir)
 {
-	if (rmodule == NULL) {
+	if (rmodule == NULL)
 		rmodule = (struct cras_apm_reverse_module *)calloc(
 			1, sizeof(*rmodule));
-		rmodule->ext.run = reverse_data_run;
-		rmodule->ext.configure = reverse_data_configure;
-	}
 
 	aec_config_dir = device_config_dir;
 	get_aec_ini(aec_config_dir);
@@ -592,106 +1517,195 @@ int cras_apm_list_deinit()
 	if (rmodule) {
 		if (rmodule->fbuf)
 			float_buffer_destroy(&rmodule->fbuf);
+		free(rmodule->mix_samples);
 		free(rmodule);
 		rmodule = NULL;
 	}
 	return 0;
 }
 
+/* Moves the next block processed by the APM thread to the output block,
+ * once all the streams have read the previous one. The two blocks trade
+ * places, so the frames aren't copied. */
+static void collect_processed(struct shared_apm *shared)
+{
+	struct float_buffer *fbuf;
+	unsigned int idx;
+
+	if (shared->out_frames ||
+	    shared->fwd_consumed ==
+		    __atomic_load_n(&shared->fwd_processed, __ATOMIC_ACQUIRE))
+		return;
+
+	idx = shared->fwd_consumed % APM_NUM_BLOCKS;
+	fbuf = shared->fwd_blocks[idx];
+	shared->fwd_blocks[idx] = shared->out_block;
+	shared->out_block = fbuf;
+	shared->out_frames = float_buffer_level(fbuf) - shared->fwd_pad[idx];
+	float_buffer_reset(shared->fwd_blocks[idx]);
+	shared->fwd_pad[idx] = 0;
+	shared->fwd_consumed++;
+}
+
 int cras_apm_list_process(struct cras_apm *apm, struct float_buffer *input,
 			  unsigned int offset)
 {
-	unsigned int writable, nframes, nread;
-	int ch, i, j, ret;
+	struct shared_apm *shared = apm->shared;
+	unsigned int writable, nframes, nread, dev_offset, i;
+	struct float_buffer *fbuf;
+	int j, ret;
 	float *const *wp;
 	float *const *rp;
 
+	/* A stream swapping away only reads out what was taken for it. */
+	if (apm->draining) {
+		collect_processed(shared);
+		return 0;
+	}
+
+	ret = __atomic_load_n(&shared->error, __ATOMIC_RELAXED);
+	if (ret)
+		return ret;
+
 	nread = float_buffer_level(input);
 	if (nread < offset) {
 		syslog(LOG_ERR, "Process offset exceeds read level");
 		return -EINVAL;
 	}
 
-	writable = float_buffer_writable(apm->fbuffer);
-	writable = MIN(nread - offset, writable);
+	/* Frames before the offset of the APM have been taken already for
+	 * another stream sharing it. */
+	dev_offset = MAX(offset, MIN(shared->dev_offset, nread));
 
-	nframes = writable;
-	while (nframes) {
-		nread = nframes;
-		wp = float_buffer_write_pointer(apm->fbuffer);
-		rp = float_buffer_read_pointer(input, offset, &nread);
-
-		for (i = 0; i < apm->fbuffer->num_channels; i++) {
-			/* Look up the channel position and copy from
-			 * the correct index of |input| buffer.
-			 */
-			for (ch = 0; ch < CRAS_CH_MAX; ch++)
-				if (apm->fmt.channel_layout[ch] == i)
-					break;
-			if (ch == CRAS_CH_MAX)
-				continue;
-
-			j = apm->dev_fmt.channel_layout[ch];
-			if (j == -1)
-				continue;
-
-			memcpy(wp[i], rp[j], nread * sizeof(float));
-		}
+	/* Fill the free blocks, and hand each one to the APM thread as soon
+	 * as it holds 10ms of data. */
+	while (dev_offset < nread &&
+	       shared->fwd_filled - shared->fwd_consumed < APM_NUM_BLOCKS) {
+		fbuf = shared->fwd_blocks[shared->fwd_filled % APM_NUM_BLOCKS];
+		writable = MIN(nread - dev_offset, float_buffer_writable(fbuf));
 
-		nframes -= nread;
-		offset += nread;
+		nframes = writable;
+		while (nframes) {
+			unsigned int n = nframes;
 
-		float_buffer_written(apm->fbuffer, nread);
-	}
+			wp = float_buffer_write_pointer(fbuf);
+			rp = float_buffer_read_pointer(input, dev_offset, &n);
 
-	/* process and move to int buffer */
-	if ((float_buffer_writable(apm->fbuffer) == 0) &&
-	    (buf_queued(apm->buffer) == 0)) {
-		nread = float_buffer_level(apm->fbuffer);
-		rp = float_buffer_read_pointer(apm->fbuffer, 0, &nread);
-		ret = webrtc_apm_process_stream_f(apm->apm_ptr,
-						  apm->fmt.num_channels,
-						  apm->fmt.frame_rate, rp);
-		if (ret) {
-			syslog(LOG_ERR, "APM process stream f err");
-			return ret;
+			for (i = 0; i < fbuf->num_channels; i++) {
+				j = shared->channel_map[i];
+				if (j == -1)
+					continue;
+				memcpy(wp[i], rp[j], n * sizeof(float));
+			}
+
+			nframes -= n;
+			dev_offset += n;
+
+			float_buffer_written(fbuf, n);
 		}
 
-		dsp_util_interleave(rp, buf_write_pointer(apm->buffer),
-				    apm->fbuffer->num_channels, apm->fmt.format,
-				    nread);
-		buf_increment_write(apm->buffer,
-				    nread * cras_get_format_bytes(&apm->fmt));
-		float_buffer_reset(apm->fbuffer);
+		if (float_buffer_writable(fbuf))
+			break;
+		__atomic_store_n(&shared->fwd_filled, shared->fwd_filled + 1,
+				 __ATOMIC_RELEASE);
+		wake_apm_thread(shared);
 	}
+	shared->dev_offset = dev_offset;
+
+	collect_processed(shared);
+
+	return dev_offset - offset;
+}
+
+void cras_apm_list_set_dev_read(void *dev_ptr, unsigned int frames)
+{
+	struct active_apm *active;
+	struct shared_apm *shared;
 
-	return writable;
+	DL_FOREACH (active_apms, active) {
+		shared = active->apm->shared;
+		if (shared->dev_ptr != dev_ptr ||
+		    !is_first_active_of_apm(active))
+			continue;
+		shared->dev_offset -= MIN(shared->dev_offset, frames);
+	}
 }
 
 struct cras_audio_area *cras_apm_list_get_processed(struct cras_apm *apm)
 {
-	uint8_t *buf_ptr;
+	struct shared_apm *shared = apm->shared;
+	unsigned int frame_bytes = cras_get_format_bytes(&shared->fmt);
+	unsigned int offset, nread;
+	float *const *rp;
+
+	collect_processed(shared);
+	if (shared->out_frames && !shared->interleaved_valid) {
+		nread = shared->out_frames;
+		rp = float_buffer_read_pointer(shared->out_block, 0, &nread);
+		dsp_util_interleave(rp, shared->interleaved,
+				    shared->fmt.num_channels,
+				    shared->fmt.format, shared->out_frames);
+		shared->interleaved_valid = true;
+	}
+	offset = shared->out_read +
+		 buffer_share_id_offset(shared->readers, apm->reader_id);
+	shared->area->frames = shared->out_frames - offset;
+	cras_audio_area_config_buf_pointers(
+		shared->area, &shared->fmt,
+		shared->interleaved + offset * frame_bytes);
+	return shared->area;
+}
+
+struct cras_audio_area *
+cras_apm_list_get_processed_planar(struct cras_apm *apm)
+{
+	struct shared_apm *shared = apm->shared;
+	struct cras_audio_area *area = shared->planar_area;
+	unsigned int offset, nread, i;
+	float *const *rp;
 
-	buf_ptr = buf_read_pointer_size(apm->buffer, &apm->area->frames);
-	apm->area->frames /= cras_get_format_bytes(&apm->fmt);
-	cras_audio_area_config_buf_pointers(apm->area, &apm->fmt, buf_ptr);
-	return apm->area;
+	collect_processed(shared);
+	offset = shared->out_read +
+		 buffer_share_id_offset(shared->readers, apm->reader_id);
+	nread = shared->out_frames;
+	rp = float_buffer_read_pointer(shared->out_block, 0, &nread);
+	for (i = 0; i < area->num_channels; i++) {
+		area->channels[i].step_bytes = sizeof(float);
+		area->channels[i].buf = (uint8_t *)(rp[i] + offset);
+	}
+	area->frames = shared->out_frames - offset;
+	return area;
 }
 
 void cras_apm_list_put_processed(struct cras_apm *apm, unsigned int frames)
 {
-	buf_increment_read(apm->buffer,
-			   frames * cras_get_format_bytes(&apm->fmt));
+	buffer_share_offset_update(apm->shared->readers, apm->reader_id,
+				   frames);
+	release_processed(apm->shared);
+}
+
+unsigned int cras_apm_list_get_delay_frames(struct cras_apm *apm)
+{
+	struct shared_apm *shared = apm->shared;
+	unsigned int frames, blocks;
+
+	blocks = shared->fwd_filled - shared->fwd_consumed;
+	frames = blocks * (10 * shared->fmt.frame_rate / 1000);
+	if (blocks < APM_NUM_BLOCKS)
+		frames += float_buffer_level(
+			shared->fwd_blocks[shared->fwd_filled % APM_NUM_BLOCKS]);
+	return frames + shared->out_frames - shared->out_read -
+	       buffer_share_id_offset(shared->readers, apm->reader_id);
 }
 
 struct cras_audio_format *cras_apm_list_get_format(struct cras_apm *apm)
 {
-	return &apm->fmt;
+	return &apm->shared->fmt;
 }
 
 bool cras_apm_list_get_use_tuned_settings(struct cras_apm *apm)
 {
-	return apm->use_tuned_settings;
+	return apm->shared->use_tuned_settings;
 }
 
 void cras_apm_list_set_aec_dump(struct cras_apm_list *list, void *dev_ptr,
@@ -714,14 +1728,15 @@ void cras_apm_list_set_aec_dump(struct cras_apm_list *list, void *dev_ptr,
 			return;
 		}
 		/* webrtc apm will own the FILE handle and close it. */
-		rc = webrtc_apm_aec_dump(apm->apm_ptr, &apm->work_queue, start,
+		rc = webrtc_apm_aec_dump(apm->shared->apm_ptr,
+					 &apm->shared->work_queue, start,
 					 handle);
 		if (rc)
 			syslog(LOG_ERR, "Fail to dump debug file %s, rc %d",
 			       file_name, rc);
 	} else {
-		rc = webrtc_apm_aec_dump(apm->apm_ptr, &apm->work_queue, 0,
-					 NULL);
+		rc = webrtc_apm_aec_dump(apm->shared->apm_ptr,
+					 &apm->shared->work_queue, 0, NULL);
 		if (rc)
 			syslog(LOG_ERR, "Failed to stop apm debug, rc %d", rc);
 	}
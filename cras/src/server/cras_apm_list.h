@@ -6,6 +6,8 @@
 #ifndef CRAS_APM_LIST_H_
 #define CRAS_APM_LIST_H_
 
+#include <errno.h>
+
 #include "cras_types.h"
 
 struct cras_audio_area;
@@ -41,11 +43,19 @@ int cras_apm_list_deinit();
  *                                 cras_apm_list_get_active_apm
  *                                 cras_apm_list_process
  *                                 cras_apm_list_get_processed
+ *                                 cras_apm_list_get_processed_planar
  *                                 cras_apm_list_put_processed
+ *                                 cras_apm_list_set_dev_read
  *
  * cras_apm_list_remove_apm <-     cras_apm_list_stop_apm
  * cras_apm_list_destroy
  *
+ * To change the effects of a running stream:
+ *
+ * cras_apm_list_stage_effects
+ * cras_apm_list_stage_apm  ->     cras_apm_list_swap_apm
+ *                                 cras_apm_list_commit_effects
+ *
  * Args:
  *    stream_ptr - Pointer to the stream.
  *    effects - Bit map specifying the enabled effects on this stream.
@@ -55,8 +65,9 @@ struct cras_apm_list *cras_apm_list_create(void *stream_ptr, uint64_t effects);
 /*
  * Creates a cras_apm associated to given dev_ptr and adds it to the list.
  * If there already exists an APM instance linked to dev_ptr, we assume
- * the open format is unchanged so just return it. This should be called
- * in main thread.
+ * the open format is unchanged so just return it. The returned cras_apm
+ * shares the WebRTC APM of other streams on dev_ptr which have the same
+ * effects, format and tuned settings. This should be called in main thread.
  * Args:
  *    list - The list holding APM instances.
  *    dev_ptr - Pointer to the iodev to add new APM for.
@@ -68,6 +79,57 @@ struct cras_apm *cras_apm_list_add_apm(struct cras_apm_list *list,
 				       const struct cras_audio_format *fmt,
 				       bool is_aec_use_case);
 
+/*
+ * Starts changing the effects of the stream of the list. The APMs retired
+ * by the previous change are released. This should be called in main
+ * thread.
+ * Args:
+ *    list - The list holding APM instances.
+ *    effects - Bit map of the effects to apply from now on.
+ * Returns:
+ *    0 on success, -EBUSY if the stream hasn't drained the APMs of the
+ *    previous change yet.
+ */
+int cras_apm_list_stage_effects(struct cras_apm_list *list, uint64_t effects);
+
+/*
+ * Creates the cras_apm applying the staged effects on dev_ptr, to be
+ * swapped in later. This should be called in main thread, for every device
+ * the stream is on.
+ * Args:
+ *    list - The list holding APM instances.
+ *    dev_ptr - Pointer to the iodev to stage an APM for.
+ *    fmt - Format of the audio data used for this cras_apm.
+ *    is_aec_use_case - If the dev_ptr is for typical AEC use case.
+ * Returns:
+ *    0 on success, -ENOTSUP if the stream would read another format from
+ *    the staged APM than from what it reads now, -ENOMEM if the APM can't
+ *    be created.
+ */
+int cras_apm_list_stage_apm(struct cras_apm_list *list, void *dev_ptr,
+			    const struct cras_audio_format *fmt,
+			    bool is_aec_use_case);
+
+/*
+ * Moves the stream of the list on dev_ptr to the APM staged for it, or to
+ * reading the device directly if there is none. No frame is lost or read
+ * twice: the stream first reads out all the frames its current APM took,
+ * and the staged one takes the device frames from there. This should be
+ * called in audio thread while main thread waits.
+ * Args:
+ *    list - The list holding APM instances.
+ *    dev_ptr - The iodev the stream is attached to.
+ */
+void cras_apm_list_swap_apm(struct cras_apm_list *list, void *dev_ptr);
+
+/*
+ * Makes the staged effects and APMs those of the list, once the stream is
+ * swapped on all its devices. The former ones are kept until the next
+ * change or the list is destroyed. This should be called in audio thread
+ * while main thread waits, or in main thread if the stream isn't attached.
+ */
+void cras_apm_list_commit_effects(struct cras_apm_list *list);
+
 /*
  * Gets the active APM instance that is associated to given stream and dev pair.
  * This should be called in audio thread.
@@ -96,6 +158,42 @@ void cras_apm_list_stop_apm(struct cras_apm_list *list, void *dev_ptr);
  */
 uint64_t cras_apm_list_get_effects(struct cras_apm_list *list);
 
+/*
+ * Gets the time the APM of dev_ptr in the list spent processing since the
+ * stream started using it. An APM shared by streams is charged to each of
+ * them in full.
+ * Args:
+ *    list - The list holding APM instances.
+ *    dev_ptr - The device the APM processes.
+ */
+uint64_t cras_apm_list_get_process_ns(struct cras_apm_list *list,
+				      void *dev_ptr);
+
+/*
+ * Gets the size of the buffers of the APM of dev_ptr in the list.
+ * Args:
+ *    list - The list holding APM instances.
+ *    dev_ptr - The device the APM processes.
+ */
+size_t cras_apm_list_get_mem_bytes(struct cras_apm_list *list, void *dev_ptr);
+
+/*
+ * Marks the stream of the list as background capture, whose echo
+ * cancellation is the first to go when the audio threads are overloaded.
+ * Called in main thread before the APMs are started.
+ * Args:
+ *    list - The list holding APM instances.
+ *    background - True if the stream can do with less processing.
+ */
+void cras_apm_list_set_background(struct cras_apm_list *list, bool background);
+
+/*
+ * Tells the APMs an audio thread entered or left CRAS_OVERLOAD_APM. While
+ * any thread is there, APMs read by background streams only stop getting
+ * the echo reference. Called in audio thread, in pairs.
+ */
+void cras_apm_list_set_overloaded(bool overloaded);
+
 /* Removes a cras_apm from list and destroys it. */
 int cras_apm_list_destroy(struct cras_apm_list *list);
 
@@ -115,10 +213,22 @@ void cras_apm_list_remove_apm(struct cras_apm_list *list, void *dev_ptr);
  *    input - Float buffer from device for apm to process.
  *    offset - Offset in |input| to note the data position to start
  *        reading.
+ * Returns:
+ *    The number of frames to advance offset by, which includes the frames
+ *    already taken for another stream sharing the APM. Negative error code
+ *    on failure.
  */
 int cras_apm_list_process(struct cras_apm *apm, struct float_buffer *input,
 			  unsigned int offset);
 
+/* Tells the APMs of dev_ptr that all streams have read |frames| from the
+ * start of the input buffer passed to cras_apm_list_process.
+ * Args:
+ *    dev_ptr - The input device.
+ *    frames - The number of frames read from the input buffer.
+ */
+void cras_apm_list_set_dev_read(void *dev_ptr, unsigned int frames);
+
 /* Gets the APM processed data in the form of audio area.
  * Args:
  *    apm - The cras_apm instance that owns the audio area pointer and
@@ -129,6 +239,18 @@ int cras_apm_list_process(struct cras_apm *apm, struct float_buffer *input,
  */
 struct cras_audio_area *cras_apm_list_get_processed(struct cras_apm *apm);
 
+/* Gets the APM processed data as it comes out of the APM, one array of
+ * floats per channel, skipping the interleave of cras_apm_list_get_processed.
+ * Frames read from either are marked with cras_apm_list_put_processed.
+ * Args:
+ *    apm - The cras_apm instance that owns the processed data.
+ * Returns:
+ *    An audio area whose channels point at the float samples of each channel
+ *    of the APM format. No need to free by caller.
+ */
+struct cras_audio_area *
+cras_apm_list_get_processed_planar(struct cras_apm *apm);
+
 /* Tells |apm| that |frames| of processed data has been used, so |apm|
  * can allocate space to read more from input device.
  * Args:
@@ -137,6 +259,14 @@ struct cras_audio_area *cras_apm_list_get_processed(struct cras_apm *apm);
  */
 void cras_apm_list_put_processed(struct cras_apm *apm, unsigned int frames);
 
+/* Gets the number of frames |apm| has taken from the input device but not
+ * yet handed to the stream. This includes the blocks still waiting for
+ * the APM thread, so it is the delay APM adds to the capture path.
+ * Args:
+ *    apm - The cras_apm instance.
+ */
+unsigned int cras_apm_list_get_delay_frames(struct cras_apm *apm);
+
 /* Gets the format of the actual data processed by webrtc-apm library.
  * Args:
  *    apm - The cras_apm instance holding audio data and format info.
@@ -188,10 +318,46 @@ static inline struct cras_apm *cras_apm_list_get_active_apm(void *stream_ptr,
 {
 	return NULL;
 }
+static inline int cras_apm_list_stage_effects(struct cras_apm_list *list,
+					      uint64_t effects)
+{
+	return -ENOTSUP;
+}
+static inline int cras_apm_list_stage_apm(struct cras_apm_list *list,
+					  void *dev_ptr,
+					  const struct cras_audio_format *fmt,
+					  bool is_aec_use_case)
+{
+	return -ENOTSUP;
+}
+static inline void cras_apm_list_swap_apm(struct cras_apm_list *list,
+					  void *dev_ptr)
+{
+}
+static inline void cras_apm_list_commit_effects(struct cras_apm_list *list)
+{
+}
 static inline uint64_t cras_apm_list_get_effects(struct cras_apm_list *list)
 {
 	return 0;
 }
+static inline uint64_t cras_apm_list_get_process_ns(struct cras_apm_list *list,
+						    void *dev_ptr)
+{
+	return 0;
+}
+static inline size_t cras_apm_list_get_mem_bytes(struct cras_apm_list *list,
+						 void *dev_ptr)
+{
+	return 0;
+}
+static inline void cras_apm_list_set_background(struct cras_apm_list *list,
+						bool background)
+{
+}
+static inline void cras_apm_list_set_overloaded(bool overloaded)
+{
+}
 static inline int cras_apm_list_destroy(struct cras_apm_list *list)
 {
 	return 0;
@@ -208,16 +374,32 @@ static inline int cras_apm_list_process(struct cras_apm *apm,
 	return 0;
 }
 
+static inline void cras_apm_list_set_dev_read(void *dev_ptr,
+					      unsigned int frames)
+{
+}
+
 static inline struct cras_audio_area *
 cras_apm_list_get_processed(struct cras_apm *apm)
 {
 	return NULL;
 }
 
+static inline struct cras_audio_area *
+cras_apm_list_get_processed_planar(struct cras_apm *apm)
+{
+	return NULL;
+}
+
 static inline void cras_apm_list_put_processed(struct cras_apm *apm,
 					       unsigned int frames)
 {
 }
+
+static inline unsigned int cras_apm_list_get_delay_frames(struct cras_apm *apm)
+{
+	return 0;
+}
 static inline void cras_apm_list_start_apm(struct cras_apm_list *list,
 					   void *dev_ptr)
 {
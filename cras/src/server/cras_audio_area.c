@@ -22,6 +22,22 @@ struct cras_audio_area *cras_audio_area_create(int num_channels)
 	return area;
 }
 
+/* Returns non-zero if the channels of area are interleaved in order with
+ * nothing between them, so all its samples can be walked as one array. */
+static int area_is_packed(const struct cras_audio_area *area,
+			  unsigned int sample_bytes)
+{
+	unsigned int i;
+
+	if (area->channels[0].step_bytes != area->num_channels * sample_bytes)
+		return 0;
+	for (i = 1; i < area->num_channels; i++)
+		if (area->channels[i].buf !=
+		    area->channels[0].buf + i * sample_bytes)
+			return 0;
+	return 1;
+}
+
 unsigned int cras_audio_area_copy(const struct cras_audio_area *dst,
 				  unsigned int dst_offset,
 				  const struct cras_audio_format *dst_fmt,
@@ -30,11 +46,27 @@ unsigned int cras_audio_area_copy(const struct cras_audio_area *dst,
 				  float software_gain_scaler)
 {
 	unsigned int src_idx, dst_idx;
-	unsigned int ncopy;
+	unsigned int ncopy, sample_bytes;
 	uint8_t *schan, *dchan;
 
 	ncopy = MIN(src->frames - src_offset, dst->frames - dst_offset);
 
+	/* Each channel goes to the same place in the same layout, scale and
+	 * mix all the samples in one contiguous pass which vectorizes. */
+	sample_bytes = snd_pcm_format_physical_width(dst_fmt->format) / 8;
+	if (cras_audio_area_layouts_match(dst, src) &&
+	    area_is_packed(dst, sample_bytes)) {
+		cras_mix_add_scale_stride(
+			dst_fmt->format,
+			dst->channels[0].buf +
+				dst_offset * dst->channels[0].step_bytes,
+			src->channels[0].buf +
+				src_offset * src->channels[0].step_bytes,
+			ncopy * dst->num_channels, sample_bytes, sample_bytes,
+			software_gain_scaler);
+		return ncopy;
+	}
+
 	/* TODO(dgreid) - this replaces a memcpy, it needs to be way faster. */
 	for (src_idx = 0; src_idx < src->num_channels; src_idx++) {
 		for (dst_idx = 0; dst_idx < dst->num_channels; dst_idx++) {
@@ -58,6 +90,37 @@ unsigned int cras_audio_area_copy(const struct cras_audio_area *dst,
 	return ncopy;
 }
 
+int cras_audio_area_layouts_match(const struct cras_audio_area *dst,
+				  const struct cras_audio_area *src)
+{
+	unsigned int i, j, step;
+
+	if (dst->num_channels == 0 || dst->num_channels != src->num_channels)
+		return 0;
+
+	step = src->channels[0].step_bytes;
+	for (i = 0; i < src->num_channels; i++) {
+		if (src->channels[i].step_bytes != step ||
+		    dst->channels[i].step_bytes != step)
+			return 0;
+		if (src->channels[i].buf < src->channels[0].buf ||
+		    src->channels[i].buf - src->channels[0].buf !=
+			    dst->channels[i].buf - dst->channels[0].buf)
+			return 0;
+		for (j = 0; j < dst->num_channels; j++) {
+			if (i == j) {
+				if (src->channels[i].ch_set !=
+				    dst->channels[j].ch_set)
+					return 0;
+			} else if (src->channels[i].ch_set &
+				   dst->channels[j].ch_set) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
 void cras_audio_area_destroy(struct cras_audio_area *area)
 {
 	free(area);
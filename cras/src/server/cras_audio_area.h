@@ -73,6 +73,19 @@ unsigned int cras_audio_area_copy(const struct cras_audio_area *dst,
 				  unsigned int src_offset,
 				  float software_gain_scaler);
 
+/*
+ * Checks if src can be copied to dst with a plain memory copy, that is both
+ * areas are interleaved the same way and each channel only maps to the
+ * channel at the same position in the other area.
+ * Args:
+ *    dst - The destination audio area.
+ *    src - The source audio area.
+ * Returns:
+ *    Non-zero if the layouts match.
+ */
+int cras_audio_area_layouts_match(const struct cras_audio_area *dst,
+				  const struct cras_audio_area *src);
+
 /*
  * Destroys a cras_audio_area.
  * Args:
@@ -29,8 +29,7 @@ static void take_snapshot(enum CRAS_AUDIO_THREAD_EVENT_TYPE event_type)
 	clock_gettime(CLOCK_MONOTONIC_RAW, &now_time);
 	snapshot->timestamp = now_time;
 	snapshot->event_type = event_type;
-	audio_thread_dump_thread_info(cras_iodev_list_get_audio_thread(),
-				      &snapshot->audio_debug_info);
+	cras_iodev_list_dump_audio_thread_info(&snapshot->audio_debug_info);
 	cras_system_state_add_snapshot(snapshot);
 }
 
@@ -90,7 +89,21 @@ int cras_audio_thread_event_dev_overrun()
 	return cras_audio_thread_event_send(AUDIO_THREAD_EVENT_DEV_OVERRUN);
 }
 
+int cras_audio_thread_event_underrun_risk()
+{
+	return cras_audio_thread_event_send(AUDIO_THREAD_EVENT_UNDERRUN_RISK);
+}
+
 static struct timespec last_event_snapshot_time[AUDIO_THREAD_EVENT_TYPE_COUNT];
+static unsigned int event_counts[AUDIO_THREAD_EVENT_TYPE_COUNT];
+
+unsigned int
+cras_audio_thread_monitor_get_event_count(enum CRAS_AUDIO_THREAD_EVENT_TYPE type)
+{
+	if (type >= AUDIO_THREAD_EVENT_TYPE_COUNT)
+		return 0;
+	return event_counts[type];
+}
 
 /*
  * Callback function for handling audio thread events in main thread,
@@ -111,6 +124,8 @@ static void handle_audio_thread_event_message(struct cras_main_message *msg,
 	if (audio_thread_msg->event_type >= AUDIO_THREAD_EVENT_TYPE_COUNT)
 		return;
 
+	event_counts[audio_thread_msg->event_type]++;
+
 	struct timespec *last_snapshot_time =
 		&last_event_snapshot_time[audio_thread_msg->event_type];
 
@@ -133,6 +148,7 @@ int cras_audio_thread_monitor_init()
 {
 	memset(last_event_snapshot_time, 0,
 	       sizeof(struct timespec) * AUDIO_THREAD_EVENT_TYPE_COUNT);
+	memset(event_counts, 0, sizeof(event_counts));
 	cras_main_message_add_handler(CRAS_MAIN_AUDIO_THREAD_EVENT,
 				      handle_audio_thread_event_message, NULL);
 	return 0;
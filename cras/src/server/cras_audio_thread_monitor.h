@@ -6,6 +6,8 @@
 #ifndef CRAS_AUDIO_THREAD_MONITOR_H_
 #define CRAS_AUDIO_THREAD_MONITOR_H_
 
+#include "cras_types.h"
+
 /*
  * Notifies the main thread when A2DP buffer overruns.
  */
@@ -46,6 +48,18 @@ int cras_audio_thread_event_drop_samples();
  */
 int cras_audio_thread_event_dev_overrun();
 
+/*
+ * Notifies the main thread when an output device is at risk of underrun.
+ */
+int cras_audio_thread_event_underrun_risk();
+
+/*
+ * Gets the number of events of a type received since the monitor started,
+ * including those too close to the previous one to take a snapshot.
+ */
+unsigned int
+cras_audio_thread_monitor_get_event_count(enum CRAS_AUDIO_THREAD_EVENT_TYPE type);
+
 /*
  * Initializes audio thread monitor and sets main thread callback.
  */
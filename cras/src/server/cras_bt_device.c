@@ -52,6 +52,7 @@ static const unsigned int PROFILE_DROP_SUSPEND_DELAY_MS = 5000;
  * Attemp to connect profiles which haven't been ready every 3 retries.
  */
 static const unsigned int CONN_WATCH_PERIOD_MS = 2000;
+static const unsigned int CONN_WATCH_SLACK_MS = 500;
 static const unsigned int CONN_WATCH_MAX_RETRIES = 30;
 
 /* This is used when a critical SCO failure happens and is worth scheduling a
@@ -396,13 +397,8 @@ void cras_bt_device_append_iodev(struct cras_bt_device *device,
 	}
 }
 
-/*
- * Sets the audio nodes to 'plugged' means UI can select it and open it
- * for streams. Sets to 'unplugged' to hide these nodes from UI, when device
- * disconnects in progress.
- */
-static void bt_device_set_nodes_plugged(struct cras_bt_device *device,
-					int plugged)
+void cras_bt_device_set_nodes_plugged(struct cras_bt_device *device,
+				      int plugged)
 {
 	struct cras_iodev *iodev;
 
@@ -425,7 +421,7 @@ void cras_bt_device_rm_iodev(struct cras_bt_device *device,
 	struct cras_iodev *bt_iodev;
 	int rc;
 
-	bt_device_set_nodes_plugged(device, 0);
+	cras_bt_device_set_nodes_plugged(device, 0);
 
 	bt_iodev = device->bt_iodevs[iodev->direction];
 	if (bt_iodev) {
@@ -668,7 +664,7 @@ static void bt_device_conn_watch_cb(struct cras_timer *timer, void *arg)
 						   HFP_AG_START_FAILURE);
 		}
 	}
-	bt_device_set_nodes_plugged(device, 1);
+	cras_bt_device_set_nodes_plugged(device, 1);
 	return;
 
 arm_retry_timer:
@@ -677,9 +673,9 @@ arm_retry_timer:
 
 	if (--device->conn_watch_retries) {
 		tm = cras_system_state_get_tm();
-		device->conn_watch_timer =
-			cras_tm_create_timer(tm, CONN_WATCH_PERIOD_MS,
-					     bt_device_conn_watch_cb, device);
+		device->conn_watch_timer = cras_tm_create_timer_slack(
+			tm, CONN_WATCH_PERIOD_MS, CONN_WATCH_SLACK_MS,
+			bt_device_conn_watch_cb, device);
 	} else {
 		syslog(LOG_ERR, "Connection watch timeout.");
 		bt_device_schedule_suspend(device, 0, CONN_WATCH_TIME_OUT);
@@ -695,8 +691,9 @@ cras_bt_device_start_new_conn_watch_timer(struct cras_bt_device *device)
 		cras_tm_cancel_timer(tm, device->conn_watch_timer);
 	}
 	device->conn_watch_retries = CONN_WATCH_MAX_RETRIES;
-	device->conn_watch_timer = cras_tm_create_timer(
-		tm, CONN_WATCH_PERIOD_MS, bt_device_conn_watch_cb, device);
+	device->conn_watch_timer = cras_tm_create_timer_slack(
+		tm, CONN_WATCH_PERIOD_MS, CONN_WATCH_SLACK_MS,
+		bt_device_conn_watch_cb, device);
 }
 
 static void bt_device_cancel_suspend(struct cras_bt_device *device);
@@ -132,6 +132,14 @@ void cras_bt_device_append_iodev(struct cras_bt_device *device,
 void cras_bt_device_rm_iodev(struct cras_bt_device *device,
 			     struct cras_iodev *iodev);
 
+/*
+ * Sets the audio nodes to 'plugged' means UI can select it and open it
+ * for streams. Sets to 'unplugged' to hide these nodes from UI, when device
+ * disconnects in progress or its iodevs are being replaced.
+ */
+void cras_bt_device_set_nodes_plugged(struct cras_bt_device *device,
+				      int plugged);
+
 /* Gets the active profile of the bt device. */
 unsigned int
 cras_bt_device_get_active_profile(const struct cras_bt_device *device);
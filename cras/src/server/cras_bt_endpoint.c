@@ -9,6 +9,7 @@
 #include <string.h>
 #include <syslog.h>
 
+#include "cras_a2dp_codec.h"
 #include "cras_bt_constants.h"
 #include "cras_bt_adapter.h"
 #include "cras_bt_endpoint.h"
@@ -133,7 +134,7 @@ cras_bt_endpoint_select_configuration(DBusConnection *conn,
 	DBusError dbus_error;
 	const char *endpoint_path;
 	struct cras_bt_endpoint *endpoint;
-	char buf[4];
+	char buf[A2DP_MAX_CONFIG_LEN];
 	void *capabilities, *configuration = buf;
 	int len;
 	DBusMessage *reply;
@@ -157,9 +158,12 @@ cras_bt_endpoint_select_configuration(DBusConnection *conn,
 		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 	}
 
-	if (len > sizeof(configuration) ||
-	    endpoint->select_configuration(endpoint, capabilities, len,
-					   configuration) < 0) {
+	if (len > sizeof(buf))
+		len = -EINVAL;
+	else
+		len = endpoint->select_configuration(endpoint, capabilities,
+						     len, configuration);
+	if (len < 0) {
 		reply = dbus_message_new_error(
 			message,
 			"org.chromium.Cras.Error.UnsupportedConfiguration",
@@ -338,7 +342,7 @@ int cras_bt_register_endpoint(DBusConnection *conn,
 	DBusMessageIter properties_array_iter, properties_dict_iter;
 	DBusMessageIter variant_iter, bytes_iter;
 	DBusPendingCall *pending_call;
-	char buf[4];
+	char buf[A2DP_MAX_CONFIG_LEN];
 	void *capabilities = buf;
 	int len = sizeof(buf);
 	int error;
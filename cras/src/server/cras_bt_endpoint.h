@@ -20,6 +20,7 @@ struct cras_bt_endpoint {
 
 	int (*get_capabilities)(struct cras_bt_endpoint *endpoint,
 				void *capabilities, int *len);
+	/* Returns the size of configuration, or a negative error code. */
 	int (*select_configuration)(struct cras_bt_endpoint *endpoint,
 				    void *capabilities, int len,
 				    void *configuration);
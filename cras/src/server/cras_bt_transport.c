@@ -34,6 +34,7 @@ struct cras_bt_transport {
 	uint16_t write_mtu;
 	int volume;
 	int removed;
+	DBusPendingCall *acquire_call;
 
 	struct cras_bt_endpoint *endpoint;
 	struct cras_bt_transport *prev, *next;
@@ -98,6 +99,10 @@ void cras_bt_transport_destroy(struct cras_bt_transport *transport)
 
 	dbus_connection_unref(transport->conn);
 
+	if (transport->acquire_call) {
+		dbus_pending_call_cancel(transport->acquire_call);
+		dbus_pending_call_unref(transport->acquire_call);
+	}
 	if (transport->fd >= 0)
 		close(transport->fd);
 
@@ -172,6 +177,11 @@ cras_bt_transport_profile(const struct cras_bt_transport *transport)
 	return transport->profile;
 }
 
+int cras_bt_transport_codec(const struct cras_bt_transport *transport)
+{
+	return transport->codec;
+}
+
 int cras_bt_transport_configuration(const struct cras_bt_transport *transport,
 				    void *configuration, int len)
 {
@@ -181,7 +191,7 @@ int cras_bt_transport_configuration(const struct cras_bt_transport *transport,
 	memcpy(configuration, transport->configuration,
 	       transport->configuration_len);
 
-	return 0;
+	return transport->configuration_len;
 }
 
 enum cras_bt_transport_state
@@ -425,45 +435,21 @@ int cras_bt_transport_set_volume(struct cras_bt_transport *transport,
 	return 0;
 }
 
-int cras_bt_transport_acquire(struct cras_bt_transport *transport)
+/* Takes the fd and MTUs from the reply to Acquire and unrefs it. */
+static int handle_acquire_reply(struct cras_bt_transport *transport,
+				DBusMessage *reply)
 {
-	DBusMessage *method_call, *reply;
 	DBusError dbus_error;
-	int rc = 0;
-
-	if (transport->fd >= 0)
-		return 0;
-
-	method_call = dbus_message_new_method_call(
-		BLUEZ_SERVICE, transport->object_path,
-		BLUEZ_INTERFACE_MEDIA_TRANSPORT, "Acquire");
-	if (!method_call)
-		return -ENOMEM;
-
-	dbus_error_init(&dbus_error);
-
-	reply = dbus_connection_send_with_reply_and_block(
-		transport->conn, method_call, DBUS_TIMEOUT_USE_DEFAULT,
-		&dbus_error);
-	if (!reply) {
-		syslog(LOG_ERR, "Failed to acquire transport %s: %s",
-		       transport->object_path, dbus_error.message);
-		dbus_error_free(&dbus_error);
-		dbus_message_unref(method_call);
-		rc = -EIO;
-		goto acquire_fail;
-	}
-
-	dbus_message_unref(method_call);
+	int rc;
 
 	if (dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_ERROR) {
 		syslog(LOG_ERR, "Acquire returned error: %s",
 		       dbus_message_get_error_name(reply));
-		dbus_message_unref(reply);
 		rc = -EIO;
 		goto acquire_fail;
 	}
 
+	dbus_error_init(&dbus_error);
 	if (!dbus_message_get_args(
 		    reply, &dbus_error, DBUS_TYPE_UNIX_FD, &(transport->fd),
 		    DBUS_TYPE_UINT16, &(transport->read_mtu), DBUS_TYPE_UINT16,
@@ -471,7 +457,6 @@ int cras_bt_transport_acquire(struct cras_bt_transport *transport)
 		syslog(LOG_ERR, "Bad Acquire reply received: %s",
 		       dbus_error.message);
 		dbus_error_free(&dbus_error);
-		dbus_message_unref(reply);
 		rc = -EINVAL;
 		goto acquire_fail;
 	}
@@ -486,9 +471,109 @@ int cras_bt_transport_acquire(struct cras_bt_transport *transport)
 
 acquire_fail:
 	BTLOG(btlog, BT_TRANSPORT_ACQUIRE, 0, 0);
+	dbus_message_unref(reply);
 	return rc;
 }
 
+/* Callback to trigger when the Acquire sent by acquire_async completes. If
+ * it failed, the next cras_bt_transport_acquire tries again. */
+static void on_transport_acquired(DBusPendingCall *pending_call, void *data)
+{
+	struct cras_bt_transport *transport = (struct cras_bt_transport *)data;
+	DBusMessage *reply;
+
+	reply = dbus_pending_call_steal_reply(pending_call);
+	dbus_pending_call_unref(pending_call);
+	transport->acquire_call = NULL;
+
+	handle_acquire_reply(transport, reply);
+}
+
+/* Waits for the Acquire sent by acquire_async to complete. */
+static int complete_acquire(struct cras_bt_transport *transport)
+{
+	DBusPendingCall *pending_call = transport->acquire_call;
+	DBusMessage *reply;
+
+	transport->acquire_call = NULL;
+	dbus_pending_call_set_notify(pending_call, NULL, NULL, NULL);
+	dbus_pending_call_block(pending_call);
+	reply = dbus_pending_call_steal_reply(pending_call);
+	dbus_pending_call_unref(pending_call);
+
+	return handle_acquire_reply(transport, reply);
+}
+
+int cras_bt_transport_acquire_async(struct cras_bt_transport *transport)
+{
+	DBusMessage *method_call;
+	DBusPendingCall *pending_call;
+
+	if (transport->fd >= 0 || transport->acquire_call)
+		return 0;
+
+	method_call = dbus_message_new_method_call(
+		BLUEZ_SERVICE, transport->object_path,
+		BLUEZ_INTERFACE_MEDIA_TRANSPORT, "Acquire");
+	if (!method_call)
+		return -ENOMEM;
+
+	if (!dbus_connection_send_with_reply(transport->conn, method_call,
+					     &pending_call,
+					     DBUS_TIMEOUT_USE_DEFAULT)) {
+		dbus_message_unref(method_call);
+		return -ENOMEM;
+	}
+
+	dbus_message_unref(method_call);
+	if (!pending_call)
+		return -EIO;
+
+	if (!dbus_pending_call_set_notify(pending_call, on_transport_acquired,
+					  transport, NULL)) {
+		dbus_pending_call_cancel(pending_call);
+		dbus_pending_call_unref(pending_call);
+		return -ENOMEM;
+	}
+
+	transport->acquire_call = pending_call;
+	return 0;
+}
+
+int cras_bt_transport_acquire(struct cras_bt_transport *transport)
+{
+	DBusMessage *method_call, *reply;
+	DBusError dbus_error;
+
+	if (transport->fd >= 0)
+		return 0;
+
+	if (transport->acquire_call)
+		return complete_acquire(transport);
+
+	method_call = dbus_message_new_method_call(
+		BLUEZ_SERVICE, transport->object_path,
+		BLUEZ_INTERFACE_MEDIA_TRANSPORT, "Acquire");
+	if (!method_call)
+		return -ENOMEM;
+
+	dbus_error_init(&dbus_error);
+
+	reply = dbus_connection_send_with_reply_and_block(
+		transport->conn, method_call, DBUS_TIMEOUT_USE_DEFAULT,
+		&dbus_error);
+	dbus_message_unref(method_call);
+	if (!reply) {
+		syslog(LOG_ERR, "Failed to acquire transport %s: %s",
+		       transport->object_path, dbus_error.message);
+		dbus_error_free(&dbus_error);
+		BTLOG(btlog, BT_TRANSPORT_ACQUIRE, 0, 0);
+		return -EIO;
+	}
+
+	return handle_acquire_reply(transport, reply);
+}
+
 int cras_bt_transport_try_acquire(struct cras_bt_transport *transport)
 {
 	DBusMessage *method_call, *reply;
@@ -569,6 +654,18 @@ int cras_bt_transport_release(struct cras_bt_transport *transport,
 	DBusPendingCall *pending_call;
 	DBusError dbus_error;
 
+	/* An Acquire still in flight would leave the transport acquired in
+	 * BlueZ, so let it finish and release it below. */
+	if (transport->acquire_call) {
+		if (blocking) {
+			complete_acquire(transport);
+		} else {
+			dbus_pending_call_cancel(transport->acquire_call);
+			dbus_pending_call_unref(transport->acquire_call);
+			transport->acquire_call = NULL;
+		}
+	}
+
 	if (transport->fd < 0)
 		return 0;
 
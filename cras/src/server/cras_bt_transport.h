@@ -50,6 +50,9 @@ struct cras_bt_device *
 cras_bt_transport_device(const struct cras_bt_transport *transport);
 enum cras_bt_device_profile
 cras_bt_transport_profile(const struct cras_bt_transport *transport);
+int cras_bt_transport_codec(const struct cras_bt_transport *transport);
+/* Copies the codec configuration of the transport to configuration. Returns
+ * the size of the configuration, or -ENOSPC if len is too small. */
 int cras_bt_transport_configuration(const struct cras_bt_transport *transport,
 				    void *configuration, int len);
 enum cras_bt_transport_state
@@ -66,6 +69,17 @@ void cras_bt_transport_update_properties(
 int cras_bt_transport_try_acquire(struct cras_bt_transport *transport);
 int cras_bt_transport_acquire(struct cras_bt_transport *transport);
 
+/* Sends Acquire for the transport without waiting for the reply, so the
+ * round trip to BlueZ overlaps with other work. A later call to
+ * cras_bt_transport_acquire only waits for what is left of it.
+ * Args:
+ *    transport - The transport object to acquire.
+ * Returns:
+ *    0 if Acquire is sent or the transport is already acquired, otherwise
+ *    a negative error code.
+ */
+int cras_bt_transport_acquire_async(struct cras_bt_transport *transport);
+
 /* Releases the cras_bt_transport.
  * Args:
  *    transport - The transport object to release
@@ -0,0 +1,235 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cras_audio_format.h"
+#include "cras_channel_matrix.h"
+#include "utlist.h"
+
+/* Where a channel missing from the output layout is mixed to instead.
+ * Members:
+ *    num_ch - Number of output channels fed, 0 ends the list.
+ *    ch - The output channels fed.
+ *    coef - Coefficient applied for each of them.
+ */
+struct channel_fold {
+	unsigned int num_ch;
+	enum CRAS_CHANNEL ch[2];
+	float coef;
+};
+
+/* Folds for each channel in order of preference. A fold is used only when
+ * all of its channels are in the output layout. */
+static const struct channel_fold channel_folds[CRAS_CH_MAX][3] = {
+	[CRAS_CH_FL] = { { 1, { CRAS_CH_FC }, 1.0 } },
+	[CRAS_CH_FR] = { { 1, { CRAS_CH_FC }, 1.0 } },
+	[CRAS_CH_RL] = { { 1, { CRAS_CH_SL }, 1.0 },
+			 { 1, { CRAS_CH_FL }, 0.707 } },
+	[CRAS_CH_RR] = { { 1, { CRAS_CH_SR }, 1.0 },
+			 { 1, { CRAS_CH_FR }, 0.707 } },
+	[CRAS_CH_FC] = { { 2, { CRAS_CH_FL, CRAS_CH_FR }, 0.707 } },
+	[CRAS_CH_LFE] = { { 2, { CRAS_CH_FL, CRAS_CH_FR }, 0.707 },
+			  { 1, { CRAS_CH_FC }, 0.707 } },
+	[CRAS_CH_SL] = { { 1, { CRAS_CH_RL }, 1.0 },
+			 { 1, { CRAS_CH_FL }, 0.707 } },
+	[CRAS_CH_SR] = { { 1, { CRAS_CH_RR }, 1.0 },
+			 { 1, { CRAS_CH_FR }, 0.707 } },
+	[CRAS_CH_RC] = { { 2, { CRAS_CH_RL, CRAS_CH_RR }, 0.707 },
+			 { 2, { CRAS_CH_SL, CRAS_CH_SR }, 0.707 },
+			 { 2, { CRAS_CH_FL, CRAS_CH_FR }, 0.5 } },
+	[CRAS_CH_FLC] = { { 1, { CRAS_CH_FL }, 1.0 },
+			  { 1, { CRAS_CH_FC }, 0.707 } },
+	[CRAS_CH_FRC] = { { 1, { CRAS_CH_FR }, 1.0 },
+			  { 1, { CRAS_CH_FC }, 0.707 } },
+};
+
+/* Returns non-zero if the layout is set and fits in the format. */
+static int layout_valid(const struct cras_audio_format *fmt)
+{
+	unsigned int i;
+	int set = 0;
+
+	if (fmt->num_channels > CRAS_CH_MAX)
+		return 0;
+	for (i = 0; i < CRAS_CH_MAX; i++) {
+		if (fmt->channel_layout[i] >= (int)fmt->num_channels)
+			return 0;
+		if (fmt->channel_layout[i] != -1)
+			set = 1;
+	}
+	return set;
+}
+
+/* Mixes input channel ch into the output channels of its first usable
+ * fold. Drops it if there is none. */
+static void fold_channel(float mtx[CRAS_CH_MAX][CRAS_CH_MAX],
+			 const int8_t *out_layout, unsigned int ch,
+			 unsigned int in_idx)
+{
+	const struct channel_fold *fold;
+	unsigned int i, j;
+
+	for (i = 0; i < 3; i++) {
+		fold = &channel_folds[ch][i];
+		if (fold->num_ch == 0)
+			break;
+		for (j = 0; j < fold->num_ch; j++)
+			if (out_layout[fold->ch[j]] == -1)
+				break;
+		if (j < fold->num_ch)
+			continue;
+		for (j = 0; j < fold->num_ch; j++)
+			mtx[out_layout[fold->ch[j]]][in_idx] += fold->coef;
+		return;
+	}
+}
+
+/*
+ * Exported interface
+ */
+
+struct cras_channel_matrix *cras_channel_matrix_create(float *const *mtx,
+						       size_t num_in_ch,
+						       size_t num_out_ch)
+{
+	struct cras_channel_matrix *m;
+	unsigned int i, o, n = 0;
+
+	for (o = 0; o < num_out_ch; o++)
+		for (i = 0; i < num_in_ch; i++)
+			if (mtx[o][i] != 0)
+				n++;
+
+	m = (struct cras_channel_matrix *)calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+	m->num_in_ch = num_in_ch;
+	m->num_out_ch = num_out_ch;
+	m->row_start = (unsigned int *)calloc(num_out_ch + 1,
+					      sizeof(*m->row_start));
+	m->in_ch = (unsigned int *)calloc(n ?: 1, sizeof(*m->in_ch));
+	m->coef = (float *)calloc(n ?: 1, sizeof(*m->coef));
+	if (!m->row_start || !m->in_ch || !m->coef) {
+		cras_channel_matrix_destroy(m);
+		return NULL;
+	}
+
+	n = 0;
+	for (o = 0; o < num_out_ch; o++) {
+		m->row_start[o] = n;
+		for (i = 0; i < num_in_ch; i++) {
+			if (mtx[o][i] == 0)
+				continue;
+			m->in_ch[n] = i;
+			m->coef[n] = mtx[o][i];
+			n++;
+		}
+	}
+	m->row_start[num_out_ch] = n;
+	return m;
+}
+
+struct cras_channel_matrix *
+cras_channel_matrix_create_from_layouts(const struct cras_audio_format *in,
+					const struct cras_audio_format *out)
+{
+	float mtx[CRAS_CH_MAX][CRAS_CH_MAX] = { { 0 } };
+	float *rows[CRAS_CH_MAX];
+	float sum, max_sum = 0;
+	unsigned int ch, i, o;
+
+	if (!layout_valid(in) || !layout_valid(out))
+		return NULL;
+
+	for (ch = 0; ch < CRAS_CH_MAX; ch++) {
+		if (in->channel_layout[ch] == -1)
+			continue;
+		if (out->channel_layout[ch] != -1)
+			mtx[out->channel_layout[ch]][in->channel_layout[ch]] +=
+				1.0;
+		else
+			fold_channel(mtx, out->channel_layout, ch,
+				     in->channel_layout[ch]);
+	}
+
+	/* Scale down so that no output channel can clip. */
+	for (o = 0; o < out->num_channels; o++) {
+		sum = 0;
+		for (i = 0; i < in->num_channels; i++)
+			sum += fabsf(mtx[o][i]);
+		if (sum > max_sum)
+			max_sum = sum;
+	}
+	for (o = 0; o < out->num_channels; o++) {
+		if (max_sum > 1.0)
+			for (i = 0; i < in->num_channels; i++)
+				mtx[o][i] /= max_sum;
+		rows[o] = mtx[o];
+	}
+
+	return cras_channel_matrix_create(rows, in->num_channels,
+					  out->num_channels);
+}
+
+struct cras_channel_matrix *
+cras_channel_matrix_dup(const struct cras_channel_matrix *m)
+{
+	struct cras_channel_matrix *copy;
+	unsigned int n = m->row_start[m->num_out_ch];
+
+	copy = (struct cras_channel_matrix *)calloc(1, sizeof(*copy));
+	if (!copy)
+		return NULL;
+	copy->num_in_ch = m->num_in_ch;
+	copy->num_out_ch = m->num_out_ch;
+	copy->row_start = (unsigned int *)calloc(m->num_out_ch + 1,
+						 sizeof(*copy->row_start));
+	copy->in_ch = (unsigned int *)calloc(n ?: 1, sizeof(*copy->in_ch));
+	copy->coef = (float *)calloc(n ?: 1, sizeof(*copy->coef));
+	if (!copy->row_start || !copy->in_ch || !copy->coef) {
+		cras_channel_matrix_destroy(copy);
+		return NULL;
+	}
+	memcpy(copy->row_start, m->row_start,
+	       (m->num_out_ch + 1) * sizeof(*m->row_start));
+	memcpy(copy->in_ch, m->in_ch, n * sizeof(*m->in_ch));
+	memcpy(copy->coef, m->coef, n * sizeof(*m->coef));
+	return copy;
+}
+
+const struct cras_channel_matrix *
+cras_channel_matrix_find(const struct cras_channel_matrix *list,
+			 size_t num_in_ch, size_t num_out_ch)
+{
+	const struct cras_channel_matrix *m;
+
+	DL_FOREACH (list, m)
+		if (m->num_in_ch == num_in_ch && m->num_out_ch == num_out_ch)
+			return m;
+	return NULL;
+}
+
+void cras_channel_matrix_destroy(struct cras_channel_matrix *m)
+{
+	if (!m)
+		return;
+	free(m->row_start);
+	free(m->in_ch);
+	free(m->coef);
+	free(m);
+}
+
+void cras_channel_matrix_destroy_list(struct cras_channel_matrix *list)
+{
+	struct cras_channel_matrix *m;
+
+	DL_FOREACH (list, m) {
+		DL_DELETE(list, m);
+		cras_channel_matrix_destroy(m);
+	}
+}
@@ -0,0 +1,85 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Sparse channel conversion matrices, built once when a format converter is
+ * created and applied per buffer by the fmt_conv ops.
+ */
+
+#ifndef CRAS_CHANNEL_MATRIX_H_
+#define CRAS_CHANNEL_MATRIX_H_
+
+#include <stddef.h>
+
+struct cras_audio_format;
+
+/* A channel conversion matrix with only its non-zero coefficients kept.
+ * Entries row_start[o] to row_start[o + 1] - 1 list the input channels
+ * mixed into output channel o.
+ * Members:
+ *    num_in_ch - Number of input channels.
+ *    num_out_ch - Number of output channels.
+ *    row_start - num_out_ch + 1 offsets into in_ch and coef.
+ *    in_ch - Input channel of each entry.
+ *    coef - Coefficient of each entry.
+ *    prev, next - Links when the matrix is in a list, such as the
+ *        matrices configured for a node.
+ */
+struct cras_channel_matrix {
+	size_t num_in_ch;
+	size_t num_out_ch;
+	unsigned int *row_start;
+	unsigned int *in_ch;
+	float *coef;
+	struct cras_channel_matrix *prev, *next;
+};
+
+/* Creates a sparse matrix from a dense one.
+ * Args:
+ *    mtx - num_out_ch rows of num_in_ch coefficients.
+ *    num_in_ch - Number of input channels.
+ *    num_out_ch - Number of output channels.
+ * Returns:
+ *    The matrix, or NULL on error. Free with cras_channel_matrix_destroy().
+ */
+struct cras_channel_matrix *cras_channel_matrix_create(float *const *mtx,
+						       size_t num_in_ch,
+						       size_t num_out_ch);
+
+/* Creates a matrix mixing the channels of in to those of out by position.
+ * Channels missing from the output are folded into their nearest
+ * neighbours, e.g. side to rear or center to front left and right, and
+ * the matrix is scaled down when a row could clip.
+ * Args:
+ *    in - Input format, its channel layout must be set.
+ *    out - Output format, its channel layout must be set.
+ * Returns:
+ *    The matrix, or NULL if a layout is missing or invalid.
+ */
+struct cras_channel_matrix *
+cras_channel_matrix_create_from_layouts(const struct cras_audio_format *in,
+					const struct cras_audio_format *out);
+
+/* Duplicates a matrix. The copy is not linked to any list. */
+struct cras_channel_matrix *
+cras_channel_matrix_dup(const struct cras_channel_matrix *m);
+
+/* Finds the matrix for the given channel counts in a list.
+ * Args:
+ *    list - List of matrices, may be NULL.
+ *    num_in_ch - Number of input channels to match.
+ *    num_out_ch - Number of output channels to match.
+ * Returns:
+ *    The matching matrix or NULL.
+ */
+const struct cras_channel_matrix *
+cras_channel_matrix_find(const struct cras_channel_matrix *list,
+			 size_t num_in_ch, size_t num_out_ch);
+
+/* Frees a matrix. */
+void cras_channel_matrix_destroy(struct cras_channel_matrix *m);
+
+/* Frees every matrix of a list. */
+void cras_channel_matrix_destroy_list(struct cras_channel_matrix *list);
+
+#endif /* CRAS_CHANNEL_MATRIX_H_ */
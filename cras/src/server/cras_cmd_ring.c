@@ -0,0 +1,100 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "cras_cmd_ring.h"
+
+#define CACHE_LINE_SIZE 64
+
+/* Members:
+ *    slots - Memory of all slots, num_slots * slot_size bytes.
+ *    slot_size - Size of each slot, rounded up to keep slots aligned.
+ *    mask - num_slots - 1, to wrap the counters to a slot index.
+ *    write_count - Number of slots committed by the producer. Only written
+ *        by the producer.
+ *    read_count - Number of slots released by the consumer. Only written by
+ *        the consumer.
+ * The two counters are kept on their own cache lines so the threads don't
+ * contend on each other's writes.
+ */
+struct cras_cmd_ring {
+	uint8_t *slots;
+	size_t slot_size;
+	unsigned int mask;
+	unsigned int write_count __attribute__((aligned(CACHE_LINE_SIZE)));
+	unsigned int read_count __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+struct cras_cmd_ring *cras_cmd_ring_create(size_t slot_size,
+					   unsigned int num_slots)
+{
+	struct cras_cmd_ring *ring;
+
+	if (!slot_size || !num_slots || (num_slots & (num_slots - 1)))
+		return NULL;
+
+	ring = (struct cras_cmd_ring *)calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	ring->slot_size = (slot_size + sizeof(void *) - 1) &
+			  ~(sizeof(void *) - 1);
+	ring->mask = num_slots - 1;
+	ring->slots = (uint8_t *)calloc(num_slots, ring->slot_size);
+	if (!ring->slots) {
+		free(ring);
+		return NULL;
+	}
+
+	return ring;
+}
+
+void cras_cmd_ring_destroy(struct cras_cmd_ring *ring)
+{
+	if (!ring)
+		return;
+	free(ring->slots);
+	free(ring);
+}
+
+size_t cras_cmd_ring_slot_size(const struct cras_cmd_ring *ring)
+{
+	return ring->slot_size;
+}
+
+void *cras_cmd_ring_write_slot(struct cras_cmd_ring *ring)
+{
+	unsigned int read_count =
+		__atomic_load_n(&ring->read_count, __ATOMIC_ACQUIRE);
+
+	if (ring->write_count - read_count > ring->mask)
+		return NULL;
+	return ring->slots +
+	       (ring->write_count & ring->mask) * ring->slot_size;
+}
+
+void cras_cmd_ring_commit_write(struct cras_cmd_ring *ring)
+{
+	__atomic_store_n(&ring->write_count, ring->write_count + 1,
+			 __ATOMIC_RELEASE);
+}
+
+void *cras_cmd_ring_read_slot(struct cras_cmd_ring *ring)
+{
+	unsigned int write_count =
+		__atomic_load_n(&ring->write_count, __ATOMIC_ACQUIRE);
+
+	if (write_count == ring->read_count)
+		return NULL;
+	return ring->slots + (ring->read_count & ring->mask) * ring->slot_size;
+}
+
+void cras_cmd_ring_commit_read(struct cras_cmd_ring *ring)
+{
+	__atomic_store_n(&ring->read_count, ring->read_count + 1,
+			 __ATOMIC_RELEASE);
+}
@@ -0,0 +1,53 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * A lock free ring of fixed size command slots with one producer and one
+ * consumer thread. Used to pass commands from the main thread to the audio
+ * thread without copying them through a pipe.
+ */
+
+#ifndef CRAS_CMD_RING_H_
+#define CRAS_CMD_RING_H_
+
+#include <stddef.h>
+
+struct cras_cmd_ring;
+
+/* Creates a command ring.
+ * Args:
+ *    slot_size - Size in bytes of each command slot.
+ *    num_slots - Number of slots, must be a power of two.
+ * Returns:
+ *    A pointer to the ring, or NULL on error. Must be freed with
+ *    cras_cmd_ring_destroy().
+ */
+struct cras_cmd_ring *cras_cmd_ring_create(size_t slot_size,
+					   unsigned int num_slots);
+
+/* Frees a ring created with cras_cmd_ring_create(). */
+void cras_cmd_ring_destroy(struct cras_cmd_ring *ring);
+
+/* Returns the size in bytes of each slot of the ring. */
+size_t cras_cmd_ring_slot_size(const struct cras_cmd_ring *ring);
+
+/* Gets the next free slot for the producer to fill.
+ * Returns:
+ *    A pointer to the slot, or NULL if the ring is full.
+ */
+void *cras_cmd_ring_write_slot(struct cras_cmd_ring *ring);
+
+/* Hands the slot returned by cras_cmd_ring_write_slot() to the consumer. */
+void cras_cmd_ring_commit_write(struct cras_cmd_ring *ring);
+
+/* Gets the oldest slot committed by the producer.
+ * Returns:
+ *    A pointer to the slot, or NULL if the ring is empty.
+ */
+void *cras_cmd_ring_read_slot(struct cras_cmd_ring *ring);
+
+/* Hands the slot returned by cras_cmd_ring_read_slot() back to the producer.
+ * The consumer must not touch the slot after this call. */
+void cras_cmd_ring_commit_read(struct cras_cmd_ring *ring);
+
+#endif /* CRAS_CMD_RING_H_ */
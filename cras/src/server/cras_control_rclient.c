@@ -22,24 +22,35 @@
 #include "cras_rclient.h"
 #include "cras_rclient_util.h"
 #include "cras_rstream.h"
+#include "cras_startup_log.h"
 #include "cras_system_state.h"
 #include "cras_types.h"
 #include "cras_util.h"
 #include "utlist.h"
 
-/* Handles dumping audio thread debug info back to the client. */
-static void dump_audio_thread_info(struct cras_rclient *client)
+/* Tells the client the debug info in the server state is ready. */
+static void send_debug_info_ready(struct cras_rclient *client)
 {
 	struct cras_client_audio_debug_info_ready msg;
-	struct cras_server_state *state;
 
 	cras_fill_client_audio_debug_info_ready(&msg);
-	state = cras_system_state_get_no_lock();
-	audio_thread_dump_thread_info(cras_iodev_list_get_audio_thread(),
-				      &state->audio_debug_info);
 	client->ops->send_message_to_client(client, &msg.header, NULL, 0);
 }
 
+/* Handles dumping audio thread debug info back to the client. A client over
+ * its dump rate gets the last dump without refresh. */
+static void dump_audio_thread_info(struct cras_rclient *client, int refresh)
+{
+	struct cras_server_state *state;
+
+	if (refresh) {
+		state = cras_system_state_get_no_lock();
+		cras_iodev_list_dump_audio_thread_info(
+			&state->audio_debug_info);
+	}
+	send_debug_info_ready(client);
+}
+
 /* Sends shared memory fd for audio thread event log back to the client. */
 static void get_atlog_fd(struct cras_rclient *client)
 {
@@ -52,13 +63,12 @@ static void get_atlog_fd(struct cras_rclient *client)
 }
 
 /* Handles dumping audio snapshots to shared memory for the client. */
-static void dump_audio_thread_snapshots(struct cras_rclient *client)
+static void dump_audio_thread_snapshots(struct cras_rclient *client,
+					int refresh)
 {
-	struct cras_client_audio_debug_info_ready msg;
-
-	cras_fill_client_audio_debug_info_ready(&msg);
-	cras_system_state_dump_snapshots();
-	client->ops->send_message_to_client(client, &msg.header, NULL, 0);
+	if (refresh)
+		cras_system_state_dump_snapshots();
+	send_debug_info_ready(client);
 }
 
 static void handle_get_hotword_models(struct cras_rclient *client,
@@ -284,6 +294,8 @@ static int ccr_handle_message_from_client(struct cras_rclient *client,
 					  const struct cras_server_message *msg,
 					  int *fds, unsigned int num_fds)
 {
+	enum RCLIENT_MSG_CLASS msg_class;
+	int allowed;
 	int rc = 0;
 	assert(client && msg);
 
@@ -296,10 +308,18 @@ static int ccr_handle_message_from_client(struct cras_rclient *client,
 	}
 	int fd = num_fds > 0 ? fds[0] : -1;
 
+	/* Over its rate, a client is answered with the last dump and its
+	 * other limited messages are dropped. No limited message has fds. */
+	msg_class = rclient_message_class(msg->id);
+	allowed = rclient_allow_message(client, msg_class);
+	if (!allowed && msg_class != RCLIENT_MSG_DUMP)
+		return 0;
+
 	switch (msg->id) {
 	case CRAS_SERVER_CONNECT_STREAM: {
 		int client_shm_fd = num_fds > 1 ? fds[1] : -1;
-		if (MSG_LEN_VALID(msg, struct cras_connect_message)) {
+		/* Older clients send the message without num_shm_buffers. */
+		if (msg->length >= CRAS_CONNECT_MESSAGE_V7_SIZE) {
 			rclient_handle_client_stream_connect(
 				client,
 				(const struct cras_connect_message *)msg, fd,
@@ -316,6 +336,32 @@ static int ccr_handle_message_from_client(struct cras_rclient *client,
 			client,
 			(const struct cras_disconnect_stream_message *)msg);
 		break;
+	case CRAS_SERVER_CONNECT_STREAMS:
+		return rclient_handle_client_streams_connect(
+			client,
+			(const struct cras_connect_streams_message *)msg, fds,
+			num_fds);
+	case CRAS_SERVER_DISCONNECT_STREAMS:
+		if (!MSG_LEN_VALID(msg, struct cras_disconnect_streams_message))
+			return -EINVAL;
+		rclient_handle_client_streams_disconnect(
+			client,
+			(const struct cras_disconnect_streams_message *)msg);
+		break;
+	case CRAS_SERVER_SET_STREAM_EFFECTS:
+		if (!MSG_LEN_VALID(msg, struct cras_set_stream_effects_message))
+			return -EINVAL;
+		rclient_handle_client_stream_effects(
+			client,
+			(const struct cras_set_stream_effects_message *)msg);
+		break;
+	case CRAS_SERVER_SET_STREAM_PAUSED:
+		if (!MSG_LEN_VALID(msg, struct cras_set_stream_paused_message))
+			return -EINVAL;
+		rclient_handle_client_stream_paused(
+			client,
+			(const struct cras_set_stream_paused_message *)msg);
+		break;
 	case CRAS_SERVER_SET_SYSTEM_VOLUME:
 		if (!MSG_LEN_VALID(msg, struct cras_set_system_volume))
 			return -EINVAL;
@@ -394,34 +440,42 @@ static int ccr_handle_message_from_client(struct cras_rclient *client,
 		cras_dsp_dump_info();
 		break;
 	case CRAS_SERVER_DUMP_AUDIO_THREAD:
-		dump_audio_thread_info(client);
+		dump_audio_thread_info(client, allowed);
 		break;
 	case CRAS_SERVER_GET_ATLOG_FD:
 		get_atlog_fd(client);
 		break;
 	case CRAS_SERVER_DUMP_MAIN: {
-		struct cras_client_audio_debug_info_ready msg;
 		struct cras_server_state *state;
 
 		state = cras_system_state_get_no_lock();
-		memcpy(&state->main_thread_debug_info.main_log, main_log,
-		       sizeof(struct main_thread_event_log));
-
-		cras_fill_client_audio_debug_info_ready(&msg);
-		client->ops->send_message_to_client(client, &msg.header, NULL,
-						    0);
+		if (allowed) {
+			memcpy(&state->main_thread_debug_info.main_log,
+			       main_log, sizeof(struct main_thread_event_log));
+			cras_startup_log_copy(
+				&state->main_thread_debug_info.startup_log);
+		}
+		send_debug_info_ready(client);
 		break;
 	}
 	case CRAS_SERVER_DUMP_BT: {
-		struct cras_client_audio_debug_info_ready msg;
 		struct cras_server_state *state;
+#ifdef CRAS_DBUS
+		struct packet_status_logger wbs_logger;
+#endif
 
+		if (!allowed) {
+			send_debug_info_ready(client);
+			break;
+		}
 		state = cras_system_state_get_no_lock();
 #ifdef CRAS_DBUS
 		memcpy(&state->bt_debug_info.bt_log, btlog,
 		       sizeof(struct cras_bt_event_log));
-		memcpy(&state->bt_debug_info.wbs_logger,
-		       cras_hfp_ag_get_wbs_logger(),
+		/* The audio thread may be logging, take a consistent copy. */
+		packet_status_logger_copy(&wbs_logger,
+					  cras_hfp_ag_get_wbs_logger());
+		memcpy(&state->bt_debug_info.wbs_logger, &wbs_logger,
 		       sizeof(struct packet_status_logger));
 #else
 		memset(&state->bt_debug_info.bt_log, 0,
@@ -429,10 +483,7 @@ static int ccr_handle_message_from_client(struct cras_rclient *client,
 		memset(&state->bt_debug_info.wbs_logger, 0,
 		       sizeof(struct packet_status_logger));
 #endif
-
-		cras_fill_client_audio_debug_info_ready(&msg);
-		client->ops->send_message_to_client(client, &msg.header, NULL,
-						    0);
+		send_debug_info_ready(client);
 		break;
 	}
 	case CRAS_SERVER_SET_BT_WBS_ENABLED: {
@@ -444,7 +495,7 @@ static int ccr_handle_message_from_client(struct cras_rclient *client,
 		break;
 	}
 	case CRAS_SERVER_DUMP_SNAPSHOTS:
-		dump_audio_thread_snapshots(client);
+		dump_audio_thread_snapshots(client, allowed);
 		break;
 	case CRAS_SERVER_ADD_TEST_DEV: {
 		const struct cras_add_test_dev *m =
@@ -496,9 +547,8 @@ static int ccr_handle_message_from_client(struct cras_rclient *client,
 		memcpy(coefficient, m->coefficient,
 		       coefficient_len * sizeof(coefficient));
 
-		audio_thread_config_global_remix(
-			cras_iodev_list_get_audio_thread(), m->num_channels,
-			coefficient);
+		cras_iodev_list_config_global_remix(m->num_channels,
+						    coefficient);
 		free(coefficient);
 		break;
 	}
@@ -533,8 +583,7 @@ static int ccr_handle_message_from_client(struct cras_rclient *client,
 			(const struct cras_set_aec_dump *)msg;
 		if (!MSG_LEN_VALID(msg, struct cras_set_aec_dump))
 			return -EINVAL;
-		audio_thread_set_aec_dump(cras_iodev_list_get_audio_thread(),
-					  m->stream_id, m->start, fd);
+		cras_iodev_list_set_aec_dump(m->stream_id, m->start, fd);
 		break;
 	}
 	case CRAS_SERVER_RELOAD_AEC_CONFIG:
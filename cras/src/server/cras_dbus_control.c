@@ -11,6 +11,7 @@
 #include <syslog.h>
 
 #include "audio_thread.h"
+#include "cras_audio_thread_monitor.h"
 #include "cras_bt_player.h"
 #include "cras_dbus.h"
 #include "cras_dbus_control.h"
@@ -111,6 +112,12 @@
 	"    <method name=\"GetNumberOfInputStreamsWithPermission\">\n"         \
 	"      <arg name=\"num\" type=\"a{sv}\" direction=\"out\"/>\n"          \
 	"    </method>\n"                                                       \
+	"    <method name=\"GetAudioThreadEventCounts\">\n"                     \
+	"      <arg name=\"counts\" type=\"a{sv}\" direction=\"out\"/>\n"       \
+	"    </method>\n"                                                       \
+	"    <method name=\"GetStreamCosts\">\n"                                \
+	"      <arg name=\"costs\" type=\"a{sv}\" direction=\"out\"/>\n"        \
+	"    </method>\n"                                                       \
 	"    <method name=\"SetGlobalOutputChannelRemix\">\n"                   \
 	"      <arg name=\"num_channels\" type=\"i\" direction=\"in\"/>\n"      \
 	"      <arg name=\"coefficient\" type=\"ad\" direction=\"in\"/>\n"      \
@@ -147,9 +154,19 @@
 	"  </interface>\n"                                                      \
 	"</node>\n"
 
+/* Members:
+ *    conn - The D-Bus connection the control interface is exported on.
+ *    observer - Observer client which turns state changes into signals.
+ *    nodes_reply - The last GetNodes reply built, copied to answer the
+ *        following calls.
+ *    nodes_update_count - The update_count of the server state when
+ *        nodes_reply was built.
+ */
 struct cras_dbus_control {
 	DBusConnection *conn;
 	struct cras_observer_client *observer;
+	DBusMessage *nodes_reply;
+	uint32_t nodes_update_count;
 };
 static struct cras_dbus_control dbus_control;
 
@@ -615,19 +632,47 @@ static dbus_bool_t append_nodes(enum CRAS_STREAM_DIRECTION direction,
 	return TRUE;
 }
 
+/* Builds the GetNodes reply again only if the server state changed since
+ * the last call. All node information comes from the server state, which
+ * bumps update_count on every change, so clients polling the node list do
+ * not walk it each time. */
 static DBusHandlerResult handle_get_nodes(DBusConnection *conn,
 					  DBusMessage *message, void *arg)
 {
 	DBusMessage *reply;
 	DBusMessageIter array;
 	dbus_uint32_t serial = 0;
+	uint32_t update_count;
 
-	reply = dbus_message_new_method_return(message);
-	dbus_message_iter_init_append(reply, &array);
-	if (!append_nodes(CRAS_STREAM_OUTPUT, &array))
+	update_count = cras_system_state_get_no_lock()->update_count;
+	if (!dbus_control.nodes_reply ||
+	    dbus_control.nodes_update_count != update_count ||
+	    (update_count & 1)) {
+		reply = dbus_message_new_method_return(message);
+		if (!reply)
+			return DBUS_HANDLER_RESULT_NEED_MEMORY;
+		dbus_message_iter_init_append(reply, &array);
+		if (!append_nodes(CRAS_STREAM_OUTPUT, &array) ||
+		    !append_nodes(CRAS_STREAM_INPUT, &array)) {
+			dbus_message_unref(reply);
+			return DBUS_HANDLER_RESULT_NEED_MEMORY;
+		}
+		if (dbus_control.nodes_reply)
+			dbus_message_unref(dbus_control.nodes_reply);
+		dbus_control.nodes_reply = reply;
+		dbus_control.nodes_update_count = update_count;
+	}
+
+	reply = dbus_message_copy(dbus_control.nodes_reply);
+	if (!reply)
 		return DBUS_HANDLER_RESULT_NEED_MEMORY;
-	if (!append_nodes(CRAS_STREAM_INPUT, &array))
+	if (!dbus_message_set_reply_serial(reply,
+					   dbus_message_get_serial(message)) ||
+	    !dbus_message_set_destination(reply,
+					  dbus_message_get_sender(message))) {
+		dbus_message_unref(reply);
 		return DBUS_HANDLER_RESULT_NEED_MEMORY;
+	}
 	dbus_connection_send(conn, reply, &serial);
 	dbus_message_unref(reply);
 
@@ -870,6 +915,148 @@ error:
 	return DBUS_HANDLER_RESULT_NEED_MEMORY;
 }
 
+/* Keys of the counts returned by GetAudioThreadEventCounts. */
+static const char *const
+	audio_thread_event_keys[AUDIO_THREAD_EVENT_TYPE_COUNT] = {
+		[AUDIO_THREAD_EVENT_A2DP_OVERRUN] = "A2dpOverrun",
+		[AUDIO_THREAD_EVENT_A2DP_THROTTLE] = "A2dpThrottle",
+		[AUDIO_THREAD_EVENT_BUSYLOOP] = "Busyloop",
+		[AUDIO_THREAD_EVENT_DEBUG] = "Debug",
+		[AUDIO_THREAD_EVENT_SEVERE_UNDERRUN] = "SevereUnderrun",
+		[AUDIO_THREAD_EVENT_UNDERRUN] = "Underrun",
+		[AUDIO_THREAD_EVENT_DROP_SAMPLES] = "DropSamples",
+		[AUDIO_THREAD_EVENT_DEV_OVERRUN] = "DevOverrun",
+		[AUDIO_THREAD_EVENT_UNDERRUN_RISK] = "UnderrunRisk",
+	};
+
+static DBusHandlerResult
+handle_get_audio_thread_event_counts(DBusConnection *conn,
+				     DBusMessage *message, void *arg)
+{
+	DBusMessage *reply;
+	DBusMessageIter array;
+	DBusMessageIter dict;
+	dbus_uint32_t serial = 0;
+	dbus_uint32_t count;
+	unsigned type;
+
+	reply = dbus_message_new_method_return(message);
+
+	dbus_message_iter_init_append(reply, &array);
+	if (!dbus_message_iter_open_container(&array, DBUS_TYPE_ARRAY, "{sv}",
+					      &dict))
+		goto error;
+	for (type = 0; type < AUDIO_THREAD_EVENT_TYPE_COUNT; ++type) {
+		count = cras_audio_thread_monitor_get_event_count(type);
+		if (!append_key_value(&dict, audio_thread_event_keys[type],
+				      DBUS_TYPE_UINT32,
+				      DBUS_TYPE_UINT32_AS_STRING, &count))
+			goto error;
+	}
+	if (!dbus_message_iter_close_container(&array, &dict))
+		goto error;
+
+	dbus_connection_send(conn, reply, &serial);
+	dbus_message_unref(reply);
+	return DBUS_HANDLER_RESULT_HANDLED;
+
+error:
+	dbus_message_unref(reply);
+	return DBUS_HANDLER_RESULT_NEED_MEMORY;
+}
+
+/* Appends one dictionary per attached stream with what it costs the audio
+ * thread: the time spent converting, mixing and running the APM on it and
+ * the bytes of buffers it holds. */
+static bool append_stream_costs(DBusMessage *message,
+				const struct audio_debug_info *info)
+{
+	DBusMessageIter array;
+	DBusMessageIter dict;
+	const struct audio_stream_debug_info *si;
+	const char *client_type_str;
+	dbus_uint64_t stream_id, convert_ns, mix_ns, apm_ns, mem_bytes;
+	dbus_uint32_t dev_idx, direction;
+	unsigned i;
+
+	dbus_message_iter_init_append(message, &array);
+	for (i = 0; i < info->num_streams; i++) {
+		/* The debug info is packed, copy out before taking addresses. */
+		si = &info->streams[i];
+		stream_id = si->stream_id;
+		dev_idx = si->dev_idx;
+		direction = si->direction;
+		convert_ns = si->convert_ns;
+		mix_ns = si->mix_ns;
+		apm_ns = si->apm_ns;
+		mem_bytes = si->mem_bytes;
+		client_type_str = cras_client_type_str(si->client_type);
+		if (!is_utf8_string(client_type_str))
+			client_type_str = "";
+
+		if (!dbus_message_iter_open_container(&array, DBUS_TYPE_ARRAY,
+						      "{sv}", &dict))
+			return false;
+		if (!append_key_value(&dict, "StreamId", DBUS_TYPE_UINT64,
+				      DBUS_TYPE_UINT64_AS_STRING, &stream_id))
+			return false;
+		if (!append_key_value(&dict, "DevIdx", DBUS_TYPE_UINT32,
+				      DBUS_TYPE_UINT32_AS_STRING, &dev_idx))
+			return false;
+		if (!append_key_value(&dict, "Direction", DBUS_TYPE_UINT32,
+				      DBUS_TYPE_UINT32_AS_STRING, &direction))
+			return false;
+		if (!append_key_value(&dict, "ClientType", DBUS_TYPE_STRING,
+				      DBUS_TYPE_STRING_AS_STRING,
+				      &client_type_str))
+			return false;
+		if (!append_key_value(&dict, "ConvertNs", DBUS_TYPE_UINT64,
+				      DBUS_TYPE_UINT64_AS_STRING, &convert_ns))
+			return false;
+		if (!append_key_value(&dict, "MixNs", DBUS_TYPE_UINT64,
+				      DBUS_TYPE_UINT64_AS_STRING, &mix_ns))
+			return false;
+		if (!append_key_value(&dict, "ApmNs", DBUS_TYPE_UINT64,
+				      DBUS_TYPE_UINT64_AS_STRING, &apm_ns))
+			return false;
+		if (!append_key_value(&dict, "MemBytes", DBUS_TYPE_UINT64,
+				      DBUS_TYPE_UINT64_AS_STRING, &mem_bytes))
+			return false;
+		if (!dbus_message_iter_close_container(&array, &dict))
+			return false;
+	}
+	return true;
+}
+
+static DBusHandlerResult handle_get_stream_costs(DBusConnection *conn,
+						 DBusMessage *message,
+						 void *arg)
+{
+	DBusMessage *reply;
+	dbus_uint32_t serial = 0;
+	struct audio_debug_info *info;
+
+	info = calloc(1, sizeof(*info));
+	if (!info)
+		return DBUS_HANDLER_RESULT_NEED_MEMORY;
+
+	reply = dbus_message_new_method_return(message);
+
+	cras_iodev_list_dump_audio_thread_info(info);
+	if (!append_stream_costs(reply, info))
+		goto error;
+
+	dbus_connection_send(conn, reply, &serial);
+	dbus_message_unref(reply);
+	free(info);
+	return DBUS_HANDLER_RESULT_HANDLED;
+
+error:
+	dbus_message_unref(reply);
+	free(info);
+	return DBUS_HANDLER_RESULT_NEED_MEMORY;
+}
+
 static DBusHandlerResult
 handle_set_global_output_channel_remix(DBusConnection *conn,
 				       DBusMessage *message, void *arg)
@@ -900,8 +1087,7 @@ handle_set_global_output_channel_remix(DBusConnection *conn,
 	for (i = 0; i < count; i++)
 		coefficient[i] = coeff_array[i];
 
-	audio_thread_config_global_remix(cras_iodev_list_get_audio_thread(),
-					 num_channels, coefficient);
+	cras_iodev_list_config_global_remix(num_channels, coefficient);
 
 	send_empty_reply(conn, message);
 	free(coefficient);
@@ -1185,6 +1371,12 @@ static DBusHandlerResult handle_control_message(DBusConnection *conn,
 			   "GetNumberOfActiveOutputStreams")) {
 		return handle_get_num_active_streams_use_output_hw(
 			conn, message, arg);
+	} else if (dbus_message_is_method_call(message, CRAS_CONTROL_INTERFACE,
+					       "GetAudioThreadEventCounts")) {
+		return handle_get_audio_thread_event_counts(conn, message, arg);
+	} else if (dbus_message_is_method_call(message, CRAS_CONTROL_INTERFACE,
+					       "GetStreamCosts")) {
+		return handle_get_stream_costs(conn, message, arg);
 	} else if (dbus_message_is_method_call(message, CRAS_CONTROL_INTERFACE,
 					       "SetGlobalOutputChannelRemix")) {
 		return handle_set_global_output_channel_remix(conn, message,
@@ -1445,6 +1637,26 @@ static void signal_hotword_triggered(void *context, int64_t tv_sec,
 	dbus_message_unref(msg);
 }
 
+static void signal_hotword_model_loaded(void *context, cras_node_id_t node_id,
+					const char *model_name, int error)
+{
+	struct cras_dbus_control *control = (struct cras_dbus_control *)context;
+	dbus_uint32_t serial = 0;
+	dbus_uint64_t id = node_id;
+	dbus_int32_t rc = error;
+	DBusMessage *msg;
+
+	msg = create_dbus_message("HotwordModelLoaded");
+	if (!msg)
+		return;
+
+	dbus_message_append_args(msg, DBUS_TYPE_UINT64, &id, DBUS_TYPE_STRING,
+				 &model_name, DBUS_TYPE_INT32, &rc,
+				 DBUS_TYPE_INVALID);
+	dbus_connection_send(control->conn, msg, &serial);
+	dbus_message_unref(msg);
+}
+
 static void signal_non_empty_audio_state_changed(void *context, int non_empty)
 {
 	struct cras_dbus_control *control = (struct cras_dbus_control *)context;
@@ -1521,6 +1733,7 @@ void cras_dbus_control_start(DBusConnection *conn)
 	observer_ops.node_left_right_swapped_changed =
 		signal_node_left_right_swapped_changed;
 	observer_ops.hotword_triggered = signal_hotword_triggered;
+	observer_ops.hotword_model_loaded = signal_hotword_model_loaded;
 	observer_ops.non_empty_audio_state_changed =
 		signal_non_empty_audio_state_changed;
 	observer_ops.bt_battery_changed = signal_bt_battery_changed;
@@ -1540,4 +1753,8 @@ void cras_dbus_control_stop()
 	dbus_control.conn = NULL;
 	cras_observer_remove(dbus_control.observer);
 	dbus_control.observer = NULL;
+	if (dbus_control.nodes_reply) {
+		dbus_message_unref(dbus_control.nodes_reply);
+		dbus_control.nodes_reply = NULL;
+	}
 }
@@ -4,11 +4,24 @@
  */
 
 #include <stdbool.h>
+#include <stdlib.h>
 #include <syslog.h>
+#include <time.h>
 
 #include "cras_device_monitor.h"
 #include "cras_iodev_list.h"
 #include "cras_main_message.h"
+#include "cras_system_state.h"
+#include "cras_tm.h"
+#include "cras_util.h"
+#include "utlist.h"
+
+/* A device reset again waits RESET_BACKOFF_MS after its last reset, doubled
+ * for each further reset up to RESET_BACKOFF_MAX_MS. */
+#define RESET_BACKOFF_MS 1000
+#define RESET_BACKOFF_MAX_MS 32000
+/* A device not reset for this long is reset right away again. */
+#define RESET_FORGET_MS 60000
 
 enum CRAS_DEVICE_MONITOR_MSG_TYPE {
 	RESET_DEVICE,
@@ -21,6 +34,25 @@ struct cras_device_monitor_message {
 	unsigned int dev_idx;
 };
 
+/*
+ * Tracks the resets of a device, to back off when it keeps failing.
+ * Members:
+ *    dev_idx - Index of the device.
+ *    num_resets - Resets since the device last went RESET_FORGET_MS
+ *        without one.
+ *    last_reset - When the device was last reset.
+ *    timer - Set while a reset waits for the backoff delay.
+ */
+struct device_reset {
+	unsigned int dev_idx;
+	unsigned int num_resets;
+	struct timespec last_reset;
+	struct cras_timer *timer;
+	struct device_reset *prev, *next;
+};
+
+static struct device_reset *device_resets;
+
 static void init_device_msg(struct cras_device_monitor_message *msg,
 			    enum CRAS_DEVICE_MONITOR_MSG_TYPE type,
 			    unsigned int dev_idx)
@@ -66,9 +98,91 @@ int cras_device_monitor_set_device_mute_state(unsigned int dev_idx)
  * it might break how audio thread works and cause busy wake up loop.
  * Resetting the device can bring device back to normal state.
  * Let main thread follow the disable/enable sequence in iodev_list
-  * to properly close/open the device while enabling/disabling fallback
+ * to properly close/open the device while enabling/disabling fallback
  * device.
  */
+static void reset_device(struct device_reset *reset)
+{
+	syslog(LOG_ERR, "trying to recover device 0x%x by resetting it",
+	       reset->dev_idx);
+	cras_iodev_list_suspend_dev(reset->dev_idx);
+	cras_iodev_list_resume_dev(reset->dev_idx);
+	reset->num_resets++;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &reset->last_reset);
+}
+
+static void reset_timer_cb(struct cras_timer *timer, void *arg)
+{
+	struct device_reset *reset = (struct device_reset *)arg;
+
+	reset->timer = NULL;
+	reset_device(reset);
+}
+
+static unsigned int ms_since(const struct timespec *now,
+			     const struct timespec *ts)
+{
+	struct timespec diff;
+
+	subtract_timespecs(now, ts, &diff);
+	return timespec_to_ms(&diff);
+}
+
+/* Resets a device, or schedules the reset when the device was reset
+ * recently. The wait doubles with each reset, so a device that keeps
+ * failing doesn't keep the main thread closing and opening it. */
+static void request_device_reset(unsigned int dev_idx)
+{
+	struct device_reset *reset = NULL, *r;
+	struct timespec now;
+	unsigned int since_ms, delay_ms;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	DL_FOREACH (device_resets, r) {
+		if (r->dev_idx == dev_idx) {
+			reset = r;
+		} else if (!r->timer &&
+			   ms_since(&now, &r->last_reset) >= RESET_FORGET_MS) {
+			DL_DELETE(device_resets, r);
+			free(r);
+		}
+	}
+
+	if (reset == NULL) {
+		reset = (struct device_reset *)calloc(1, sizeof(*reset));
+		if (reset == NULL)
+			return;
+		reset->dev_idx = dev_idx;
+		DL_APPEND(device_resets, reset);
+	}
+	/* Requests are coalesced into the reset already scheduled. */
+	if (reset->timer)
+		return;
+
+	since_ms = ms_since(&now, &reset->last_reset);
+	if (since_ms >= RESET_FORGET_MS)
+		reset->num_resets = 0;
+	if (reset->num_resets == 0) {
+		reset_device(reset);
+		return;
+	}
+	delay_ms = RESET_BACKOFF_MAX_MS;
+	if (reset->num_resets <= 5)
+		delay_ms = RESET_BACKOFF_MS << (reset->num_resets - 1);
+	if (since_ms >= delay_ms) {
+		reset_device(reset);
+		return;
+	}
+
+	syslog(LOG_WARNING, "Delay resetting device 0x%x for %u ms", dev_idx,
+	       delay_ms - since_ms);
+	reset->timer = cras_tm_create_timer(cras_system_state_get_tm(),
+					    delay_ms - since_ms, reset_timer_cb,
+					    reset);
+	if (reset->timer == NULL)
+		reset_device(reset);
+}
+
 static void handle_device_message(struct cras_main_message *msg, void *arg)
 {
 	struct cras_device_monitor_message *device_msg =
@@ -76,10 +190,7 @@ static void handle_device_message(struct cras_main_message *msg, void *arg)
 
 	switch (device_msg->message_type) {
 	case RESET_DEVICE:
-		syslog(LOG_ERR, "trying to recover device 0x%x by resetting it",
-		       device_msg->dev_idx);
-		cras_iodev_list_suspend_dev(device_msg->dev_idx);
-		cras_iodev_list_resume_dev(device_msg->dev_idx);
+		request_device_reset(device_msg->dev_idx);
 		break;
 	case SET_MUTE_STATE:
 		cras_iodev_list_set_dev_mute(device_msg->dev_idx);
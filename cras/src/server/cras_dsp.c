@@ -3,8 +3,10 @@
  * found in the LICENSE file.
  */
 
+#include <errno.h>
 #include <pthread.h>
 #include <syslog.h>
+#include <time.h>
 #include "dumper.h"
 #include "cras_expr.h"
 #include "cras_dsp_ini.h"
@@ -20,13 +22,39 @@
  * (1) The client asks to (re-)load it with cras_load_pipeline().
  * (2) The client asks to reload the ini with cras_reload_ini().
  *
- * The pipeline is (re-)loaded asynchronously in an internal thread,
- * so the client needs to use cras_dsp_get_pipeline() and
- * cras_dsp_put_pipeline() to safely access the pipeline.
+ * A new pipeline is fully built before it is published with an atomic
+ * pointer swap, so the audio thread never waits on ini parsing or module
+ * instantiation. Readers use cras_dsp_get_pipeline() and
+ * cras_dsp_put_pipeline(), which only count themselves in and out. A
+ * writer frees the old pipeline once that count drops to zero, after
+ * which no reader can still hold it.
+ *
+ * Control values and the swap of the output channels change without a
+ * reload, the running pipeline picks them up between two blocks. The
+ * control values are kept in the context for the pipelines loaded later.
+ *
+ * Members:
+ *    mutex - Serializes writers: loads, reloads and lock/unlock.
+ *    pipeline - The published pipeline, accessed atomically.
+ *    locked - The pipeline taken by cras_dsp_lock_pipeline().
+ *    readers - The number of readers between get and put.
+ *    cb_level - The callback level hint for the pipeline block size.
+ *    controls - The control values set with cras_dsp_set_control().
  */
+struct dsp_control {
+	char *title;
+	unsigned int port;
+	float value;
+	struct dsp_control *prev, *next;
+};
+
 struct cras_dsp_context {
 	pthread_mutex_t mutex;
 	struct pipeline *pipeline;
+	struct pipeline *locked;
+	unsigned int readers;
+	unsigned int cb_level;
+	struct dsp_control *controls;
 
 	struct cras_expr_env env;
 	int sample_rate;
@@ -36,8 +64,10 @@ struct cras_dsp_context {
 
 static struct dumper *syslog_dumper;
 static const char *ini_filename;
+static const char *ini_cache_filename;
 static struct ini *global_ini;
 static struct cras_dsp_context *context_list;
+static int dsp_overloaded;
 
 static void initialize_environment(struct cras_expr_env *env)
 {
@@ -46,6 +76,7 @@ static void initialize_environment(struct cras_expr_env *env)
 	cras_expr_env_set_variable_boolean(env, "disable_drc", 0);
 	cras_expr_env_set_variable_string(env, "dsp_name", "");
 	cras_expr_env_set_variable_boolean(env, "swap_lr_disabled", 1);
+	cras_expr_env_set_variable_boolean(env, "overloaded", dsp_overloaded);
 }
 
 static void destroy_pipeline(struct pipeline *pipeline)
@@ -64,10 +95,21 @@ static void destroy_pipeline(struct pipeline *pipeline)
 		cras_dsp_ini_free(private_ini);
 }
 
+/* Waits until every reader that may have seen a pipeline before the last
+ * swap has put it. Readers hold a pipeline for one apply_dsp at most. */
+static void wait_for_readers(struct cras_dsp_context *ctx)
+{
+	static const struct timespec wait = { 0, 100 * 1000 };
+
+	while (__atomic_load_n(&ctx->readers, __ATOMIC_SEQ_CST))
+		nanosleep(&wait, NULL);
+}
+
 static struct pipeline *prepare_pipeline(struct cras_dsp_context *ctx,
 					 struct ini *target_ini)
 {
 	struct pipeline *pipeline;
+	struct dsp_control *control;
 	const char *purpose = ctx->purpose;
 
 	pipeline = cras_dsp_pipeline_create(target_ini, &ctx->env, purpose);
@@ -96,6 +138,13 @@ static struct pipeline *prepare_pipeline(struct cras_dsp_context *ctx,
 		goto bail;
 	}
 
+	cras_dsp_pipeline_set_cb_level(pipeline, ctx->cb_level);
+
+	/* Queued before the first block, modules take them at once. */
+	DL_FOREACH (ctx->controls, control)
+		cras_dsp_pipeline_set_control(pipeline, control->title,
+					      control->port, control->value);
+
 	return pipeline;
 
 bail:
@@ -111,10 +160,12 @@ static void cmd_load_pipeline(struct cras_dsp_context *ctx,
 
 	pipeline = target_ini ? prepare_pipeline(ctx, target_ini) : NULL;
 
-	/* This locking is short to avoild blocking audio thread. */
+	/* Readers never take the mutex, it only orders writers. */
 	pthread_mutex_lock(&ctx->mutex);
-	old_pipeline = ctx->pipeline;
-	ctx->pipeline = pipeline;
+	old_pipeline = __atomic_exchange_n(&ctx->pipeline, pipeline,
+					   __ATOMIC_SEQ_CST);
+	if (old_pipeline)
+		wait_for_readers(ctx);
 	pthread_mutex_unlock(&ctx->mutex);
 
 	if (old_pipeline)
@@ -126,7 +177,8 @@ static void cmd_reload_ini()
 	struct ini *old_ini = global_ini;
 	struct cras_dsp_context *ctx;
 
-	struct ini *new_ini = cras_dsp_ini_create(ini_filename);
+	struct ini *new_ini =
+		cras_dsp_ini_create_cached(ini_filename, ini_cache_filename);
 	if (!new_ini) {
 		syslog(LOG_DEBUG, "cannot create dsp ini");
 		return;
@@ -144,10 +196,11 @@ static void cmd_reload_ini()
 
 /* Exported functions */
 
-void cras_dsp_init(const char *filename)
+void cras_dsp_init(const char *filename, const char *cache_filename)
 {
 	dsp_enable_flush_denormal_to_zero();
 	ini_filename = strdup(filename);
+	ini_cache_filename = cache_filename ? strdup(cache_filename) : NULL;
 	syslog_dumper = syslog_dumper_create(LOG_ERR);
 	cmd_reload_ini();
 }
@@ -157,6 +210,10 @@ void cras_dsp_stop()
 	syslog_dumper_free(syslog_dumper);
 	if (ini_filename)
 		free((char *)ini_filename);
+	if (ini_cache_filename) {
+		free((char *)ini_cache_filename);
+		ini_cache_filename = NULL;
+	}
 	if (global_ini) {
 		cras_dsp_ini_free(global_ini);
 		global_ini = NULL;
@@ -179,7 +236,14 @@ struct cras_dsp_context *cras_dsp_context_new(int sample_rate,
 
 void cras_dsp_context_free(struct cras_dsp_context *ctx)
 {
+	struct dsp_control *control;
+
 	DL_DELETE(context_list, ctx);
+	DL_FOREACH (ctx->controls, control) {
+		DL_DELETE(ctx->controls, control);
+		free(control->title);
+		free(control);
+	}
 
 	pthread_mutex_destroy(&ctx->mutex);
 	if (ctx->pipeline) {
@@ -203,6 +267,74 @@ void cras_dsp_set_variable_boolean(struct cras_dsp_context *ctx,
 	cras_expr_env_set_variable_boolean(&ctx->env, key, value);
 }
 
+/* Remembers a control value for the pipelines loaded later. */
+static void save_control(struct cras_dsp_context *ctx, const char *title,
+			 unsigned int port, float value)
+{
+	struct dsp_control *control;
+
+	DL_FOREACH (ctx->controls, control) {
+		if (control->port == port && strcmp(control->title, title) == 0)
+			break;
+	}
+	if (!control) {
+		control = (struct dsp_control *)calloc(1, sizeof(*control));
+		if (!control)
+			return;
+		control->title = strdup(title);
+		control->port = port;
+		DL_APPEND(ctx->controls, control);
+	}
+	control->value = value;
+}
+
+int cras_dsp_set_control(struct cras_dsp_context *ctx, const char *title,
+			 unsigned int port, float value)
+{
+	struct pipeline *pipeline;
+	struct ini *ini = NULL;
+	int rc = 0;
+
+	/* The mutex keeps the pipeline from being swapped out and orders the
+	 * writers of its control queue. */
+	pthread_mutex_lock(&ctx->mutex);
+	pipeline = __atomic_load_n(&ctx->pipeline, __ATOMIC_SEQ_CST);
+	if (pipeline) {
+		rc = cras_dsp_pipeline_set_control(pipeline, title, port,
+						   value);
+		ini = cras_dsp_pipeline_get_ini(pipeline);
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+
+	if (rc == -EINVAL)
+		return rc;
+	save_control(ctx, title, port, value);
+
+	/* A disabled plugin takes the value once it is enabled. For the
+	 * rest, a new pipeline starts with it if the running one can't take
+	 * it. Only pipelines of the global ini are rebuilt. */
+	if (rc && rc != -ENOENT && ini == global_ini)
+		cmd_load_pipeline(ctx, global_ini);
+	return 0;
+}
+
+int cras_dsp_set_swap_lr(struct cras_dsp_context *ctx, int enable)
+{
+	struct pipeline *pipeline;
+	int rc = -ENOTSUP;
+
+	/* For the pipelines loaded later. */
+	cras_expr_env_set_variable_boolean(&ctx->env, "swap_lr_disabled",
+					   !enable);
+
+	pthread_mutex_lock(&ctx->mutex);
+	pipeline = __atomic_load_n(&ctx->pipeline, __ATOMIC_SEQ_CST);
+	if (pipeline)
+		rc = cras_dsp_pipeline_set_swap_lr(pipeline, enable);
+	pthread_mutex_unlock(&ctx->mutex);
+	return rc;
+}
+
 void cras_dsp_load_pipeline(struct cras_dsp_context *ctx)
 {
 	cmd_load_pipeline(ctx, global_ini);
@@ -221,24 +353,87 @@ void cras_dsp_load_mock_pipeline(struct cras_dsp_context *ctx,
 
 struct pipeline *cras_dsp_get_pipeline(struct cras_dsp_context *ctx)
 {
+	struct pipeline *pipeline;
+
+	/* Count in before loading the pointer, so a writer that swapped it
+	 * out either sees this reader or this reader sees the new one. */
+	__atomic_fetch_add(&ctx->readers, 1, __ATOMIC_SEQ_CST);
+	pipeline = __atomic_load_n(&ctx->pipeline, __ATOMIC_SEQ_CST);
+	if (!pipeline)
+		__atomic_fetch_sub(&ctx->readers, 1, __ATOMIC_SEQ_CST);
+	return pipeline;
+}
+
+void cras_dsp_put_pipeline(struct cras_dsp_context *ctx)
+{
+	__atomic_fetch_sub(&ctx->readers, 1, __ATOMIC_SEQ_CST);
+}
+
+struct pipeline *cras_dsp_lock_pipeline(struct cras_dsp_context *ctx)
+{
+	struct pipeline *pipeline;
+
 	pthread_mutex_lock(&ctx->mutex);
-	if (!ctx->pipeline) {
+	pipeline = __atomic_exchange_n(&ctx->pipeline, NULL, __ATOMIC_SEQ_CST);
+	if (!pipeline) {
 		pthread_mutex_unlock(&ctx->mutex);
 		return NULL;
 	}
-	return ctx->pipeline;
+	wait_for_readers(ctx);
+	ctx->locked = pipeline;
+	return pipeline;
 }
 
-void cras_dsp_put_pipeline(struct cras_dsp_context *ctx)
+void cras_dsp_unlock_pipeline(struct cras_dsp_context *ctx)
 {
+	__atomic_store_n(&ctx->pipeline, ctx->locked, __ATOMIC_SEQ_CST);
+	ctx->locked = NULL;
 	pthread_mutex_unlock(&ctx->mutex);
 }
 
+void cras_dsp_set_cb_level(struct cras_dsp_context *ctx, unsigned int cb_level)
+{
+	struct pipeline *pipeline;
+
+	ctx->cb_level = cb_level;
+	pipeline = cras_dsp_lock_pipeline(ctx);
+	if (!pipeline)
+		return;
+	cras_dsp_pipeline_set_cb_level(pipeline, cb_level);
+	cras_dsp_unlock_pipeline(ctx);
+}
+
 void cras_dsp_reload_ini()
 {
 	cmd_reload_ini();
 }
 
+void cras_dsp_set_overloaded(int overloaded)
+{
+	struct cras_dsp_context *ctx;
+	struct pipeline *pipeline;
+	struct ini *ini;
+
+	if (dsp_overloaded == overloaded)
+		return;
+	dsp_overloaded = overloaded;
+
+	DL_FOREACH (context_list, ctx) {
+		cras_expr_env_set_variable_boolean(&ctx->env, "overloaded",
+						   overloaded);
+		/* Only pipelines of the global ini are rebuilt, mock ones
+		 * and private inis are left alone. */
+		ini = global_ini;
+		pipeline = cras_dsp_get_pipeline(ctx);
+		if (pipeline) {
+			ini = cras_dsp_pipeline_get_ini(pipeline);
+			cras_dsp_put_pipeline(ctx);
+		}
+		if (ini == global_ini)
+			cmd_load_pipeline(ctx, global_ini);
+	}
+}
+
 void cras_dsp_dump_info()
 {
 	struct pipeline *pipeline;
@@ -248,18 +443,22 @@ void cras_dsp_dump_info()
 		cras_dsp_ini_dump(syslog_dumper, global_ini);
 	DL_FOREACH (context_list, ctx) {
 		cras_expr_env_dump(syslog_dumper, &ctx->env);
-		pipeline = ctx->pipeline;
-		if (pipeline)
+		pipeline = cras_dsp_get_pipeline(ctx);
+		if (pipeline) {
 			cras_dsp_pipeline_dump(syslog_dumper, pipeline);
+			cras_dsp_put_pipeline(ctx);
+		}
 	}
 }
 
 unsigned int cras_dsp_num_output_channels(const struct cras_dsp_context *ctx)
 {
-	return cras_dsp_pipeline_get_num_output_channels(ctx->pipeline);
+	return cras_dsp_pipeline_get_num_output_channels(
+		__atomic_load_n(&ctx->pipeline, __ATOMIC_SEQ_CST));
 }
 
 unsigned int cras_dsp_num_input_channels(const struct cras_dsp_context *ctx)
 {
-	return cras_dsp_pipeline_get_num_input_channels(ctx->pipeline);
+	return cras_dsp_pipeline_get_num_input_channels(
+		__atomic_load_n(&ctx->pipeline, __ATOMIC_SEQ_CST));
 }
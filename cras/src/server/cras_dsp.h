@@ -18,8 +18,10 @@ struct cras_dsp_context;
  * plugins. This should be called before other functions.
  * Args:
  *    filename - The ini file where the dsp plugin graph should be read from.
+ *    cache_filename - Where the parsed plugin graph is cached between
+ *        starts, or NULL to always parse filename.
  */
-void cras_dsp_init(const char *filename);
+void cras_dsp_init(const char *filename, const char *cache_filename);
 
 /* Stops the dsp subsystem. */
 void cras_dsp_stop();
@@ -27,7 +29,7 @@ void cras_dsp_stop();
 /* Creates a dsp context. The context holds a pipeline and its
  * parameters.  To use the pipeline in the context, first use
  * cras_dsp_load_pipeline() to load it and then use
- * cras_dsp_get_pipeline() to lock it for access.
+ * cras_dsp_get_pipeline() to access it.
  * Args:
  *    sample_rate - The sampling rate of the pipeline.
  *    purpose - The purpose of the pipeline, "playback" or "capture".
@@ -48,6 +50,30 @@ void cras_dsp_set_variable_string(struct cras_dsp_context *ctx, const char *key,
 void cras_dsp_set_variable_boolean(struct cras_dsp_context *ctx,
 				   const char *key, char value);
 
+/* Sets an input control port of a plugin, as it would be set in the ini.
+ * The running pipeline takes the value between two blocks, and the
+ * plugin glides to it if it can. A pipeline which can't take it is
+ * reloaded. The value is kept for the pipelines loaded later.
+ * Args:
+ *    title - The title of the plugin.
+ *    port - The index of the port in the plugin.
+ *    value - The new value of the port.
+ * Returns:
+ *    0 on success, -EINVAL if the port is not an input control port set by
+ *    the ini.
+ */
+int cras_dsp_set_control(struct cras_dsp_context *ctx, const char *title,
+			 unsigned int port, float value);
+
+/* Swaps or unswaps the left and right output channels. The running pipeline
+ * does so without a reload if it can, and the swap_lr_disabled variable is
+ * set for the pipelines loaded later.
+ * Returns:
+ *    0 if the running pipeline swapped its output. -ENOTSUP if it can't,
+ *    the pipeline must be reloaded with cras_dsp_load_pipeline() then.
+ */
+int cras_dsp_set_swap_lr(struct cras_dsp_context *ctx, int enable);
+
 /* Loads the pipeline to the context. This should be called again when
  * new values of configuration variables may change the plugin
  * graph. The actual loading happens in another thread to avoid
@@ -60,8 +86,16 @@ void cras_dsp_load_pipeline(struct cras_dsp_context *ctx);
 void cras_dsp_load_mock_pipeline(struct cras_dsp_context *ctx,
 				 unsigned int num_channels);
 
-/* Locks the pipeline in the context for access. Returns NULL if the
- * pipeline is still being loaded or cannot be loaded. */
+/* Sets the number of frames the device processes per callback, used to
+ * size the blocks the pipeline runs on. Applies to the current pipeline
+ * and the ones loaded later. */
+void cras_dsp_set_cb_level(struct cras_dsp_context *ctx, unsigned int cb_level);
+
+/* Gets the pipeline in the context for reading. This never blocks, a
+ * pipeline swapped out meanwhile is kept alive until it is put. Returns
+ * NULL if the pipeline cannot be loaded or is locked, in which case there
+ * is nothing to put. The caller must not load or lock a pipeline of the
+ * same context before putting it. */
 struct pipeline *cras_dsp_get_pipeline(struct cras_dsp_context *ctx);
 
 /* Releases the pipeline in the context. This must be called in pair
@@ -70,9 +104,23 @@ struct pipeline *cras_dsp_get_pipeline(struct cras_dsp_context *ctx);
  * cras_dsp_get_pipeline() was called. */
 void cras_dsp_put_pipeline(struct cras_dsp_context *ctx);
 
+/* Takes the pipeline in the context for modification. Waits for all
+ * readers to put it, and cras_dsp_get_pipeline() returns NULL until
+ * cras_dsp_unlock_pipeline() is called. Returns NULL if there is no
+ * pipeline, in which case there is nothing to unlock. */
+struct pipeline *cras_dsp_lock_pipeline(struct cras_dsp_context *ctx);
+
+/* Publishes the pipeline taken by cras_dsp_lock_pipeline() again. */
+void cras_dsp_unlock_pipeline(struct cras_dsp_context *ctx);
+
 /* Re-reads the ini file and reloads all pipelines in the system. */
 void cras_dsp_reload_ini();
 
+/* Sets the "overloaded" variable of all contexts and reloads the pipelines
+ * built from the ini file, so plugins disabled by it are bypassed while the
+ * audio threads are short of CPU. */
+void cras_dsp_set_overloaded(int overloaded);
+
 /* Dump current dsp information to syslog. */
 void cras_dsp_dump_info();
 
@@ -3,16 +3,32 @@
  * found in the LICENSE file.
  */
 
+#define _GNU_SOURCE /* for asprintf */
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <syslog.h>
+#include <unistd.h>
+#include "biquad.h"
+#include "cras_checksum.h"
 #include "cras_dsp_ini.h"
+#include "cras_util.h"
+#include "eq2.h"
 #include "iniparser_wrapper.h"
 
 #define MAX_NR_PORT 128 /* the max number of ports for a plugin */
 #define MAX_PORT_NAME_LENGTH 20 /* names like "output_32" */
 #define MAX_MOCK_INI_CH 20 /* Max number of channels to create mock ini */
 
+#if PLUGIN_MAX_BIQUADS != MAX_BIQUADS_PER_EQ2
+#error "PLUGIN_MAX_BIQUADS must match MAX_BIQUADS_PER_EQ2"
+#endif
+
+/* The sample rates eq2 coefficients are computed ahead for. */
+static const unsigned int precomputed_rates[] = { 44100, 48000 };
+
 /* Format of the ini file (See dsp.ini.sample for an example).
 
 - Each section in the ini file specifies a plugin. The section name is
@@ -30,6 +46,12 @@
 
 - Each plugin can have an optional "disable expression", which defines
   under which conditions the plugin is disabled.
+  The variable "overloaded" is true while an audio thread is short of
+  CPU, plugins that can be skipped at such times use "disable=overloaded".
+
+- The builtin "fir" plugin reads its filter from the file named by the
+  "impulse_response" attribute. The file holds raw little endian float
+  samples, interleaved with one channel per audio input of the plugin.
 
 - Each plugin have some ports which specify the parameters for the
   plugin or to specify connections to other plugins. The ports in each
@@ -148,8 +170,9 @@ static int parse_plugin_section(struct ini *ini, const char *sec_name,
 	p->library = getstring(ini, sec_name, "library");
 	p->label = getstring(ini, sec_name, "label");
 	p->purpose = getstring(ini, sec_name, "purpose");
-	p->disable_expr =
-		cras_expr_expression_parse(getstring(ini, sec_name, "disable"));
+	p->disable = getstring(ini, sec_name, "disable");
+	p->disable_expr = cras_expr_expression_parse(p->disable);
+	p->impulse_response = getstring(ini, sec_name, "impulse_response");
 
 	if (p->library == NULL || p->label == NULL) {
 		syslog(LOG_ERR, "A plugin must have library and label: %s",
@@ -215,7 +238,8 @@ static void fill_swap_lr_plugin(struct ini *ini, struct plugin *plugin,
 	plugin->library = "builtin";
 	plugin->label = "swap_lr";
 	plugin->purpose = "playback";
-	plugin->disable_expr = cras_expr_expression_parse("swap_lr_disabled");
+	plugin->disable = "swap_lr_disabled";
+	plugin->disable_expr = cras_expr_expression_parse(plugin->disable);
 
 	add_audio_port(ini, plugin, input_flowid_0, PORT_INPUT);
 	add_audio_port(ini, plugin, input_flowid_1, PORT_INPUT);
@@ -356,6 +380,98 @@ struct ini *create_mock_ini(const char *purpose, unsigned int num_channels)
 	return ini;
 }
 
+/* Returns the number of biquads per channel of an "eq2" plugin whose
+ * coefficients can be computed ahead, or 0 if it isn't one or any of its
+ * parameters comes from a flow. */
+static int eq2_num_biquads(const struct plugin *plugin)
+{
+	const struct port *port;
+	int i, n;
+
+	if (strcmp(plugin->library, "builtin") != 0 ||
+	    strcmp(plugin->label, "eq2") != 0)
+		return 0;
+
+	/* Two audio inputs, two audio outputs and 8 parameters per pair of
+	 * biquads, see eq2_run() in cras_dsp_mod_builtin.c. */
+	n = ARRAY_COUNT(&plugin->ports) - 4;
+	if (n <= 0 || n % 8)
+		return 0;
+	ARRAY_ELEMENT_FOREACH (&plugin->ports, i, port) {
+		if (i < 4)
+			continue;
+		if (port->type != PORT_CONTROL ||
+		    port->flow_id != INVALID_FLOW_ID)
+			return 0;
+	}
+	n /= 8;
+	return n < PLUGIN_MAX_BIQUADS ? n : PLUGIN_MAX_BIQUADS;
+}
+
+/* Computes the coefficients the eq2 module would compute at rate. */
+static void eq2_compute_biquads(const struct plugin *plugin,
+				int num_biquads, unsigned int rate,
+				struct plugin_biquads *biquads)
+{
+	float nyquist = rate / 2;
+	const struct port *p;
+	struct biquad bq;
+	int i, channel;
+
+	biquads->rate = rate;
+	for (channel = 0; channel < 2; channel++) {
+		biquads->num_biquads[channel] = num_biquads;
+		for (i = 0; i < num_biquads; i++) {
+			p = ARRAY_ELEMENT(&plugin->ports,
+					  4 + i * 8 + channel * 4);
+			biquad_set(&bq, (int)p[0].init_value,
+				   p[1].init_value / nyquist, p[2].init_value,
+				   p[3].init_value);
+			biquads->coefs[channel][i].b0 = bq.b0;
+			biquads->coefs[channel][i].b1 = bq.b1;
+			biquads->coefs[channel][i].b2 = bq.b2;
+			biquads->coefs[channel][i].a1 = bq.a1;
+			biquads->coefs[channel][i].a2 = bq.a2;
+		}
+	}
+}
+
+/* Computes the coefficients of the eq2 plugins for precomputed_rates. */
+static void precompute_biquads(struct ini *ini)
+{
+	struct plugin_biquads *biquads;
+	struct plugin *plugin;
+	int i, n;
+	unsigned int r;
+
+	ARRAY_ELEMENT_FOREACH (&ini->plugins, i, plugin) {
+		n = eq2_num_biquads(plugin);
+		if (n == 0)
+			continue;
+		biquads = calloc(ARRAY_SIZE(precomputed_rates),
+				 sizeof(*biquads));
+		if (!biquads)
+			continue;
+		for (r = 0; r < ARRAY_SIZE(precomputed_rates); r++)
+			eq2_compute_biquads(plugin, n, precomputed_rates[r],
+					    &biquads[r]);
+		plugin->biquads = biquads;
+		plugin->num_biquads = ARRAY_SIZE(precomputed_rates);
+	}
+}
+
+const struct plugin_biquads *
+cras_dsp_ini_plugin_biquads(const struct plugin *plugin, unsigned long rate)
+{
+	int i;
+
+	for (i = 0; i < plugin->num_biquads; i++) {
+		if (plugin->biquads[i].rate == rate)
+			return &plugin->biquads[i];
+	}
+	return NULL;
+}
+
 struct ini *cras_dsp_ini_create(const char *ini_filename)
 {
 	struct ini *ini;
@@ -397,12 +513,502 @@ struct ini *cras_dsp_ini_create(const char *ini_filename)
 	/* Fill flow info now because now the plugin array won't change */
 	fill_flow_info(ini);
 
+	precompute_biquads(ini);
+
 	return ini;
 bail:
 	cras_dsp_ini_free(ini);
 	return NULL;
 }
 
+/* The compiled ini cache. The file is laid out as the header, the plugins,
+ * the ports of all plugins in order, the flows, the precomputed biquads of
+ * all plugins in order and finally the string table. Strings are stored as
+ * offsets into the string table, plugins and ports as indexes. Everything
+ * after the header is covered by the checksum.
+ *
+ * A cache written by the server is matched to its ini file by inode, size
+ * and modification time. One compiled ahead by cras_dsp_compile is matched
+ * by the checksum of the ini content instead. */
+
+#define DSP_INI_CACHE_MAGIC 0x43445043 /* "CPDC" */
+#define DSP_INI_CACHE_VERSION 2
+#define DSP_INI_CACHE_NO_STRING UINT32_MAX
+
+struct dsp_ini_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t ini_ino;
+	uint64_t ini_size;
+	int64_t ini_mtime_sec;
+	int64_t ini_mtime_nsec;
+	uint32_t num_plugins;
+	uint32_t num_ports;
+	uint32_t num_flows;
+	uint32_t num_biquads;
+	uint32_t strings_size;
+	uint32_t checksum;
+	uint32_t ini_checksum;
+	uint32_t reserved;
+};
+
+struct dsp_ini_cache_plugin {
+	uint32_t title;
+	uint32_t library;
+	uint32_t label;
+	uint32_t purpose;
+	uint32_t disable;
+	uint32_t impulse_response;
+	uint32_t num_ports;
+	uint32_t num_biquads;
+};
+
+struct dsp_ini_cache_port {
+	int32_t direction;
+	int32_t type;
+	int32_t flow_id;
+	float init_value;
+};
+
+struct dsp_ini_cache_flow {
+	uint32_t name;
+	int32_t type;
+	int32_t from;
+	int32_t to;
+	int32_t from_port;
+	int32_t to_port;
+};
+
+static size_t cache_string_size(const char *str)
+{
+	return str ? strlen(str) + 1 : 0;
+}
+
+static uint32_t cache_add_string(char *strings, uint32_t *used,
+				 const char *str)
+{
+	uint32_t offset = *used;
+
+	if (str == NULL)
+		return DSP_INI_CACHE_NO_STRING;
+	strcpy(strings + offset, str);
+	*used += strlen(str) + 1;
+	return offset;
+}
+
+/* Computes the checksum of the content of the ini file. */
+static int ini_file_checksum(const char *ini_filename, const struct stat *st,
+			     uint32_t *checksum)
+{
+	uint8_t *buf;
+	int fd;
+
+	if (st->st_size == 0) {
+		*checksum = crc32_checksum(NULL, 0);
+		return 0;
+	}
+	fd = open(ini_filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	buf = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED)
+		return -ENOMEM;
+	*checksum = crc32_checksum(buf, st->st_size);
+	munmap(buf, st->st_size);
+	return 0;
+}
+
+static void cache_fill_header(struct dsp_ini_cache_header *header,
+			      const struct stat *st)
+{
+	memset(header, 0, sizeof(*header));
+	header->magic = DSP_INI_CACHE_MAGIC;
+	header->version = DSP_INI_CACHE_VERSION;
+	header->ini_ino = st->st_ino;
+	header->ini_size = st->st_size;
+	header->ini_mtime_sec = st->st_mtim.tv_sec;
+	header->ini_mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+/* Serializes ini into one buffer. Returns the buffer to be freed by the
+ * caller and sets its size, or NULL on failure. */
+static uint8_t *cache_serialize(const struct ini *ini, const struct stat *st,
+				uint32_t ini_checksum, size_t *size)
+{
+	struct dsp_ini_cache_header *header;
+	struct dsp_ini_cache_plugin *cp;
+	struct dsp_ini_cache_port *cport;
+	struct dsp_ini_cache_flow *cf;
+	struct plugin_biquads *cbq;
+	const struct plugin *plugin;
+	const struct port *port;
+	const struct flow *flow;
+	size_t num_ports = 0, num_biquads = 0, strings_size = 0;
+	uint32_t used = 0;
+	char *strings;
+	uint8_t *buf;
+	int i, j;
+
+	ARRAY_ELEMENT_FOREACH (&ini->plugins, i, plugin) {
+		num_ports += ARRAY_COUNT(&plugin->ports);
+		num_biquads += plugin->num_biquads;
+		strings_size += cache_string_size(plugin->title) +
+				cache_string_size(plugin->library) +
+				cache_string_size(plugin->label) +
+				cache_string_size(plugin->purpose) +
+				cache_string_size(plugin->disable) +
+				cache_string_size(plugin->impulse_response);
+	}
+	ARRAY_ELEMENT_FOREACH (&ini->flows, i, flow)
+		strings_size += cache_string_size(flow->name);
+
+	*size = sizeof(*header) +
+		ARRAY_COUNT(&ini->plugins) * sizeof(*cp) +
+		num_ports * sizeof(*cport) +
+		ARRAY_COUNT(&ini->flows) * sizeof(*cf) +
+		num_biquads * sizeof(*cbq) + strings_size;
+	buf = calloc(1, *size);
+	if (!buf)
+		return NULL;
+
+	header = (struct dsp_ini_cache_header *)buf;
+	cp = (struct dsp_ini_cache_plugin *)(header + 1);
+	cport = (struct dsp_ini_cache_port *)(cp + ARRAY_COUNT(&ini->plugins));
+	cf = (struct dsp_ini_cache_flow *)(cport + num_ports);
+	cbq = (struct plugin_biquads *)(cf + ARRAY_COUNT(&ini->flows));
+	strings = (char *)(cbq + num_biquads);
+
+	ARRAY_ELEMENT_FOREACH (&ini->plugins, i, plugin) {
+		cp->title = cache_add_string(strings, &used, plugin->title);
+		cp->library = cache_add_string(strings, &used, plugin->library);
+		cp->label = cache_add_string(strings, &used, plugin->label);
+		cp->purpose = cache_add_string(strings, &used, plugin->purpose);
+		cp->disable = cache_add_string(strings, &used, plugin->disable);
+		cp->impulse_response = cache_add_string(
+			strings, &used, plugin->impulse_response);
+		cp->num_ports = ARRAY_COUNT(&plugin->ports);
+		cp->num_biquads = plugin->num_biquads;
+		cp++;
+		if (plugin->num_biquads) {
+			memcpy(cbq, plugin->biquads,
+			       plugin->num_biquads * sizeof(*cbq));
+			cbq += plugin->num_biquads;
+		}
+		ARRAY_ELEMENT_FOREACH (&plugin->ports, j, port) {
+			cport->direction = port->direction;
+			cport->type = port->type;
+			cport->flow_id = port->flow_id;
+			cport->init_value = port->init_value;
+			cport++;
+		}
+	}
+	ARRAY_ELEMENT_FOREACH (&ini->flows, i, flow) {
+		cf->name = cache_add_string(strings, &used, flow->name);
+		cf->type = flow->type;
+		cf->from = flow->from ? ARRAY_INDEX(&ini->plugins, flow->from) :
+					-1;
+		cf->to = flow->to ? ARRAY_INDEX(&ini->plugins, flow->to) : -1;
+		cf->from_port = flow->from_port;
+		cf->to_port = flow->to_port;
+		cf++;
+	}
+
+	cache_fill_header(header, st);
+	header->num_plugins = ARRAY_COUNT(&ini->plugins);
+	header->num_ports = num_ports;
+	header->num_flows = ARRAY_COUNT(&ini->flows);
+	header->num_biquads = num_biquads;
+	header->strings_size = strings_size;
+	header->ini_checksum = ini_checksum;
+	header->checksum =
+		crc32_checksum(buf + sizeof(*header), *size - sizeof(*header));
+	return buf;
+}
+
+/* Writes the cache to a temporary file and renames it over cache_filename,
+ * so a reader never sees a partial cache. Returns 0 on success. */
+static int cache_store(const struct ini *ini, const char *ini_filename,
+		       const struct stat *st, const char *cache_filename)
+{
+	uint32_t ini_checksum;
+	char *tmp_name;
+	uint8_t *buf;
+	size_t size;
+	ssize_t rc;
+	int fd, err;
+
+	err = ini_file_checksum(ini_filename, st, &ini_checksum);
+	if (err < 0)
+		return err;
+	buf = cache_serialize(ini, st, ini_checksum, &size);
+	if (!buf)
+		return -ENOMEM;
+	if (asprintf(&tmp_name, "%s.XXXXXX", cache_filename) < 0) {
+		free(buf);
+		return -ENOMEM;
+	}
+
+	fd = mkstemp(tmp_name);
+	if (fd < 0) {
+		err = -errno;
+		syslog(LOG_WARNING, "Failed to create dsp ini cache %s: %d",
+		       tmp_name, errno);
+		goto out;
+	}
+	rc = write(fd, buf, size);
+	close(fd);
+	if (rc != (ssize_t)size || rename(tmp_name, cache_filename) < 0) {
+		err = -EIO;
+		syslog(LOG_WARNING, "Failed to write dsp ini cache %s",
+		       cache_filename);
+		unlink(tmp_name);
+	}
+out:
+	free(tmp_name);
+	free(buf);
+	return err;
+}
+
+static int cache_string_valid(const struct dsp_ini_cache_header *header,
+			      uint32_t offset)
+{
+	return offset == DSP_INI_CACHE_NO_STRING ||
+	       offset < header->strings_size;
+}
+
+static const char *cache_string(const char *strings, uint32_t offset)
+{
+	return offset == DSP_INI_CACHE_NO_STRING ? NULL : strings + offset;
+}
+
+/* Checks the cache in buf was compiled from ini_filename, described by st,
+ * and is intact. Returns 0 if it can be used. */
+static int cache_validate(const uint8_t *buf, size_t size,
+			  const char *ini_filename, const struct stat *st)
+{
+	const struct dsp_ini_cache_header *header;
+	const struct dsp_ini_cache_plugin *cp;
+	const struct dsp_ini_cache_port *cport;
+	const struct dsp_ini_cache_flow *cf;
+	const struct plugin_biquads *cbq;
+	struct dsp_ini_cache_header expected;
+	uint64_t expected_size, num_ports = 0, num_biquads = 0;
+	uint32_t ini_checksum;
+	const char *strings;
+	uint32_t i;
+
+	if (size < sizeof(*header))
+		return -EINVAL;
+	header = (const struct dsp_ini_cache_header *)buf;
+	cache_fill_header(&expected, st);
+	if (header->magic != expected.magic ||
+	    header->version != expected.version ||
+	    header->ini_size != expected.ini_size)
+		return -ESTALE;
+	if (header->ini_ino != expected.ini_ino ||
+	    header->ini_mtime_sec != expected.ini_mtime_sec ||
+	    header->ini_mtime_nsec != expected.ini_mtime_nsec) {
+		/* Not written for this very file, maybe compiled ahead from
+		 * the same content. */
+		if (ini_file_checksum(ini_filename, st, &ini_checksum) < 0 ||
+		    header->ini_checksum != ini_checksum)
+			return -ESTALE;
+	}
+
+	expected_size = sizeof(*header) +
+			(uint64_t)header->num_plugins * sizeof(*cp) +
+			(uint64_t)header->num_ports * sizeof(*cport) +
+			(uint64_t)header->num_flows * sizeof(*cf) +
+			(uint64_t)header->num_biquads * sizeof(*cbq) +
+			header->strings_size;
+	if (expected_size != size)
+		return -EINVAL;
+	if (header->checksum !=
+	    crc32_checksum(buf + sizeof(*header), size - sizeof(*header)))
+		return -EINVAL;
+
+	cp = (const struct dsp_ini_cache_plugin *)(header + 1);
+	cport = (const struct dsp_ini_cache_port *)(cp + header->num_plugins);
+	cf = (const struct dsp_ini_cache_flow *)(cport + header->num_ports);
+	cbq = (const struct plugin_biquads *)(cf + header->num_flows);
+	strings = (const char *)(cbq + header->num_biquads);
+	if (header->strings_size && strings[header->strings_size - 1] != '\0')
+		return -EINVAL;
+
+	for (i = 0; i < header->num_plugins; i++, cp++) {
+		if (!cache_string_valid(header, cp->title) ||
+		    !cache_string_valid(header, cp->library) ||
+		    !cache_string_valid(header, cp->label) ||
+		    !cache_string_valid(header, cp->purpose) ||
+		    !cache_string_valid(header, cp->disable) ||
+		    !cache_string_valid(header, cp->impulse_response))
+			return -EINVAL;
+		num_ports += cp->num_ports;
+		num_biquads += cp->num_biquads;
+	}
+	if (num_ports != header->num_ports ||
+	    num_biquads != header->num_biquads)
+		return -EINVAL;
+	for (i = 0; i < header->num_ports; i++, cport++) {
+		if (cport->flow_id < INVALID_FLOW_ID ||
+		    cport->flow_id >= (int64_t)header->num_flows)
+			return -EINVAL;
+	}
+	for (i = 0; i < header->num_flows; i++, cf++) {
+		if (!cache_string_valid(header, cf->name) ||
+		    cf->from < -1 || cf->from >= (int64_t)header->num_plugins ||
+		    cf->to < -1 || cf->to >= (int64_t)header->num_plugins)
+			return -EINVAL;
+	}
+	for (i = 0; i < header->num_biquads; i++, cbq++) {
+		if (cbq->num_biquads[0] > PLUGIN_MAX_BIQUADS ||
+		    cbq->num_biquads[1] > PLUGIN_MAX_BIQUADS)
+			return -EINVAL;
+	}
+	return 0;
+}
+
+/* Maps cache_filename and rebuilds the ini from it. The strings of the
+ * returned ini point into the mapping. Returns NULL if the cache is missing,
+ * stale or damaged. */
+static struct ini *cache_load(const char *cache_filename,
+			      const char *ini_filename, const struct stat *st)
+{
+	const struct dsp_ini_cache_header *header;
+	const struct dsp_ini_cache_plugin *cp;
+	const struct dsp_ini_cache_port *cport;
+	const struct dsp_ini_cache_flow *cf;
+	const struct plugin_biquads *cbq;
+	const char *strings;
+	struct stat cache_st;
+	struct plugin *plugin;
+	struct port *port;
+	struct flow *flow;
+	struct ini *ini;
+	uint8_t *buf;
+	uint32_t i, j;
+	int fd, rc;
+
+	fd = open(cache_filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &cache_st) < 0 || cache_st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	buf = mmap(NULL, cache_st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED)
+		return NULL;
+
+	rc = cache_validate(buf, cache_st.st_size, ini_filename, st);
+	if (rc < 0) {
+		syslog(LOG_DEBUG, "Ignore dsp ini cache %s: %d", cache_filename,
+		       rc);
+		munmap(buf, cache_st.st_size);
+		return NULL;
+	}
+
+	ini = calloc(1, sizeof(struct ini));
+	if (!ini) {
+		munmap(buf, cache_st.st_size);
+		return NULL;
+	}
+	ini->cache = buf;
+	ini->cache_size = cache_st.st_size;
+
+	header = (const struct dsp_ini_cache_header *)buf;
+	cp = (const struct dsp_ini_cache_plugin *)(header + 1);
+	cport = (const struct dsp_ini_cache_port *)(cp + header->num_plugins);
+	cf = (const struct dsp_ini_cache_flow *)(cport + header->num_ports);
+	cbq = (const struct plugin_biquads *)(cf + header->num_flows);
+	strings = (const char *)(cbq + header->num_biquads);
+
+	for (i = 0; i < header->num_plugins; i++, cp++) {
+		plugin = ARRAY_APPEND_ZERO(&ini->plugins);
+		plugin->title = cache_string(strings, cp->title);
+		plugin->library = cache_string(strings, cp->library);
+		plugin->label = cache_string(strings, cp->label);
+		plugin->purpose = cache_string(strings, cp->purpose);
+		plugin->disable = cache_string(strings, cp->disable);
+		plugin->disable_expr =
+			cras_expr_expression_parse(plugin->disable);
+		plugin->impulse_response =
+			cache_string(strings, cp->impulse_response);
+		for (j = 0; j < cp->num_ports; j++, cport++) {
+			port = ARRAY_APPEND_ZERO(&plugin->ports);
+			port->direction = cport->direction;
+			port->type = cport->type;
+			port->flow_id = cport->flow_id;
+			port->init_value = cport->init_value;
+		}
+		if (cp->num_biquads) {
+			plugin->biquads = cbq;
+			plugin->num_biquads = cp->num_biquads;
+			cbq += cp->num_biquads;
+		}
+	}
+
+	/* Flows point at plugins, so add them once the plugin array is done
+	 * growing. */
+	for (i = 0; i < header->num_flows; i++, cf++) {
+		flow = ARRAY_APPEND_ZERO(&ini->flows);
+		flow->name = cache_string(strings, cf->name);
+		flow->type = cf->type;
+		if (cf->from >= 0)
+			flow->from = ARRAY_ELEMENT(&ini->plugins, cf->from);
+		if (cf->to >= 0)
+			flow->to = ARRAY_ELEMENT(&ini->plugins, cf->to);
+		flow->from_port = cf->from_port;
+		flow->to_port = cf->to_port;
+	}
+
+	return ini;
+}
+
+struct ini *cras_dsp_ini_create_cached(const char *ini_filename,
+				       const char *cache_filename)
+{
+	struct stat st;
+	struct ini *ini;
+
+	if (cache_filename == NULL || stat(ini_filename, &st) < 0)
+		return cras_dsp_ini_create(ini_filename);
+
+	ini = cache_load(cache_filename, ini_filename, &st);
+	if (ini) {
+		syslog(LOG_DEBUG, "Loaded dsp ini cache %s", cache_filename);
+		return ini;
+	}
+
+	ini = cras_dsp_ini_create(ini_filename);
+	if (ini)
+		cache_store(ini, ini_filename, &st, cache_filename);
+	return ini;
+}
+
+int cras_dsp_ini_compile(const char *ini_filename, const char *cache_filename)
+{
+	struct stat st, content_st;
+	struct ini *ini;
+	int rc;
+
+	if (stat(ini_filename, &st) < 0)
+		return -errno;
+	ini = cras_dsp_ini_create(ini_filename);
+	if (!ini)
+		return -EINVAL;
+
+	/* Leave out where the ini file was compiled from so the cache is
+	 * matched by content wherever it is installed. */
+	memset(&content_st, 0, sizeof(content_st));
+	content_st.st_size = st.st_size;
+	rc = cache_store(ini, ini_filename, &content_st, cache_filename);
+	cras_dsp_ini_free(ini);
+	return rc;
+}
+
 void cras_dsp_ini_free(struct ini *ini)
 {
 	struct plugin *p;
@@ -412,6 +1018,9 @@ void cras_dsp_ini_free(struct ini *ini)
 	ARRAY_ELEMENT_FOREACH (&ini->plugins, i, p) {
 		cras_expr_expression_free(p->disable_expr);
 		ARRAY_FREE(&p->ports);
+		/* Loaded from the cache they point into the mapping. */
+		if (!ini->cache)
+			free((void *)p->biquads);
 	}
 	ARRAY_FREE(&ini->plugins);
 	ARRAY_FREE(&ini->flows);
@@ -420,6 +1029,10 @@ void cras_dsp_ini_free(struct ini *ini)
 		iniparser_freedict(ini->dict);
 		ini->dict = NULL;
 	}
+	if (ini->cache) {
+		munmap(ini->cache, ini->cache_size);
+		ini->cache = NULL;
+	}
 
 	free(ini);
 }
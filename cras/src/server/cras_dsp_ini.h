@@ -6,6 +6,8 @@
 #ifndef CRAS_DSP_INI_H_
 #define CRAS_DSP_INI_H_
 
+#include <stdint.h>
+
 #include "iniparser_wrapper.h"
 
 #ifdef __cplusplus
@@ -42,14 +44,40 @@ struct port {
 
 DECLARE_ARRAY_TYPE(struct port, port_array)
 
+/* The most biquads per channel an "eq2" plugin has, as in eq2.h. */
+#define PLUGIN_MAX_BIQUADS 10
+
+/*
+ * The biquad coefficients of an "eq2" plugin at one sample rate, computed
+ * when the ini is loaded so the eq2 module doesn't compute them every time a
+ * device opens. They are stored in the compiled ini cache too.
+ * Members:
+ *    rate - The sample rate the coefficients are for.
+ *    num_biquads - Number of biquads of each channel.
+ *    coefs - The coefficients of each biquad of each channel.
+ */
+struct plugin_biquads {
+	uint32_t rate;
+	uint32_t num_biquads[2];
+	struct {
+		float b0, b1, b2;
+		float a1, a2;
+	} coefs[2][PLUGIN_MAX_BIQUADS];
+};
+
 struct plugin {
 	const char *title;
 	const char *library; /* file name like "plugin.so" */
 	const char *label; /* label like "Eq" */
 	const char *purpose; /* like "playback" or "capture" */
+	const char *disable; /* the source text of disable_expr */
 	struct cras_expr_expression *disable_expr; /* the disable expression of
 					     this plugin */
+	const char *impulse_response; /* raw float file, used by "fir" */
 	port_array ports;
+	/* precomputed coefficients of an "eq2" plugin, one per rate */
+	const struct plugin_biquads *biquads;
+	int num_biquads;
 };
 
 struct flow {
@@ -64,8 +92,16 @@ struct flow {
 DECLARE_ARRAY_TYPE(struct plugin, plugin_array)
 DECLARE_ARRAY_TYPE(struct flow, flow_array)
 
+/*
+ * Members:
+ *    dict - The parsed ini file the strings point into, or NULL.
+ *    cache - The mapped cache file the strings point into, or NULL.
+ *    cache_size - The size of the cache mapping.
+ */
 struct ini {
 	dictionary *dict;
+	void *cache;
+	size_t cache_size;
 	plugin_array plugins;
 	flow_array flows;
 };
@@ -90,6 +126,28 @@ struct ini *create_mock_ini(const char *purpose, unsigned int num_channels);
 
 /* Reads the ini file into the ini structure */
 struct ini *cras_dsp_ini_create(const char *ini_filename);
+/*
+ * Like cras_dsp_ini_create(), but first tries the compiled ini stored in
+ * cache_filename. The cache is used only if it was compiled from an ini file
+ * with the same inode, size and modification time, otherwise the ini file is
+ * parsed and the cache rewritten. A NULL cache_filename disables the cache.
+ */
+struct ini *cras_dsp_ini_create_cached(const char *ini_filename,
+				       const char *cache_filename);
+/*
+ * Parses ini_filename and writes its compiled form to cache_filename, for
+ * building the cache ahead of time. A cache compiled this way is accepted for
+ * any ini file with the same content.
+ * Returns:
+ *    0 on success, negative error code otherwise.
+ */
+int cras_dsp_ini_compile(const char *ini_filename, const char *cache_filename);
+/*
+ * Returns the precomputed biquads of an "eq2" plugin for the sample rate, or
+ * NULL if they are not available and have to be computed.
+ */
+const struct plugin_biquads *
+cras_dsp_ini_plugin_biquads(const struct plugin *plugin, unsigned long rate);
 /* Frees the dsp structure. */
 void cras_dsp_ini_free(struct ini *ini);
 /* Dumps the information in the ini structure to syslog. */
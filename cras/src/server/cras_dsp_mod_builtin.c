@@ -3,13 +3,42 @@
  * found in the LICENSE file.
  */
 
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <syslog.h>
 #include "cras_dsp_module.h"
 #include "drc.h"
 #include "dsp_util.h"
 #include "dcblock.h"
 #include "eq.h"
 #include "eq2.h"
+#include "eqn.h"
+#include "fir.h"
+
+/* The number of frames over which a control changed while the module runs
+ * mostly reaches its new value. Filters follow the gliding value instead of
+ * jumping, which would click. */
+#define CONTROL_GLIDE_FRAMES 480
+
+/* Returns the part of the remaining distance a gliding control covers in a
+ * block of sample_count frames. */
+static float glide_step(unsigned long sample_count)
+{
+	return (float)sample_count / (sample_count + CONTROL_GLIDE_FRAMES);
+}
+
+/* Moves a gliding control value by step toward target. Returns non-zero
+ * while it has not arrived. */
+static int glide_control(float *value, float target, float step)
+{
+	*value += (target - *value) * step;
+	if (fabsf(target - *value) > 1e-3f * fmaxf(fabsf(target), 1.0f))
+		return 1;
+	*value = target;
+	return 0;
+}
 
 /*
  *  empty module functions (for source and sink)
@@ -358,20 +387,57 @@ static void eq_init_module(struct dsp_module *module)
  *  eq2 module functions
  */
 struct eq2_data {
+	const struct plugin *plugin;
 	int sample_rate;
-	struct eq2 *eq2; /* Initialized in the first call of eq2_run() */
+	/* Initialized in eq2_instantiate() from the coefficients computed when
+	 * the ini was loaded, or otherwise in the first call of eq2_run() */
+	struct eq2 *eq2;
 
 	/* Two ports for input, two for output, and 8 parameters per eq pair */
 	float *ports[4 + MAX_BIQUADS_PER_EQ2 * 8];
+
+	/* The parameters the filters are set to, one for each parameter port.
+	 * They glide toward the ports after the controls change. */
+	float params[MAX_BIQUADS_PER_EQ2 * 8];
+	int gliding;
+	/* Whether the filters have processed audio. Until then, changed
+	 * controls are taken at once. */
+	int ran;
 };
 
 static int eq2_instantiate(struct dsp_module *module, unsigned long sample_rate)
 {
-	struct eq2_data *data;
+	struct eq2_data *data = (struct eq2_data *)module->data;
+	const struct plugin_biquads *biquads;
+	struct biquad bq;
+	unsigned int i, channel;
 
-	module->data = calloc(1, sizeof(struct eq2_data));
-	data = (struct eq2_data *)module->data;
 	data->sample_rate = (int)sample_rate;
+	data->gliding = 0;
+	data->ran = 0;
+
+	/* The ports start at the values of the ini. */
+	for (i = 4; i < ARRAY_COUNT(&data->plugin->ports) &&
+		    i < 4 + MAX_BIQUADS_PER_EQ2 * 8;
+	     i++)
+		data->params[i - 4] =
+			ARRAY_ELEMENT(&data->plugin->ports, i)->init_value;
+
+	biquads = cras_dsp_ini_plugin_biquads(data->plugin, sample_rate);
+	if (!biquads)
+		return 0;
+	data->eq2 = eq2_new();
+	for (channel = 0; channel < 2; channel++) {
+		for (i = 0; i < biquads->num_biquads[channel]; i++) {
+			memset(&bq, 0, sizeof(bq));
+			bq.b0 = biquads->coefs[channel][i].b0;
+			bq.b1 = biquads->coefs[channel][i].b1;
+			bq.b2 = biquads->coefs[channel][i].b2;
+			bq.a1 = biquads->coefs[channel][i].a1;
+			bq.a2 = biquads->coefs[channel][i].a2;
+			eq2_append_biquad_direct(data->eq2, channel, &bq);
+		}
+	}
 	return 0;
 }
 
@@ -382,9 +448,59 @@ static void eq2_connect_port(struct dsp_module *module, unsigned long port,
 	data->ports[port] = data_location;
 }
 
+static void eq2_controls_changed(struct dsp_module *module)
+{
+	struct eq2_data *data = (struct eq2_data *)module->data;
+	data->gliding = 1;
+}
+
+/* Moves the parameters of the filters toward the ports and updates the
+ * filters whose parameters moved. Returns non-zero while some are still
+ * gliding. */
+static int eq2_glide(struct eq2_data *data, float step)
+{
+	float nyquist = data->sample_rate / 2;
+	int moving = 0;
+	int i, k, channel;
+
+	for (i = 0; i < MAX_BIQUADS_PER_EQ2; i++) {
+		if (!data->ports[4 + i * 8])
+			break;
+		for (channel = 0; channel < 2; channel++) {
+			int base = i * 8 + channel * 4;
+			float *const *port = &data->ports[4 + base];
+			float *param = &data->params[base];
+			int changed = 0;
+
+			/* The filter type doesn't glide. */
+			if (param[0] != *port[0]) {
+				param[0] = *port[0];
+				changed = 1;
+			}
+			for (k = 1; k < 4; k++) {
+				if (param[k] == *port[k])
+					continue;
+				moving |= glide_control(&param[k], *port[k],
+							step);
+				changed = 1;
+			}
+			if (changed)
+				eq2_set_biquad(data->eq2, channel, i,
+					       (int)param[0],
+					       param[1] / nyquist, param[2],
+					       param[3]);
+		}
+	}
+	return moving;
+}
+
 static void eq2_run(struct dsp_module *module, unsigned long sample_count)
 {
 	struct eq2_data *data = (struct eq2_data *)module->data;
+
+	if (data->eq2 && data->gliding)
+		data->gliding = eq2_glide(
+			data, data->ran ? glide_step(sample_count) : 1.0f);
 	if (!data->eq2) {
 		float nyquist = data->sample_rate / 2;
 		int i, channel;
@@ -401,6 +517,10 @@ static void eq2_run(struct dsp_module *module, unsigned long sample_count)
 				float gain = *data->ports[k + 3];
 				eq2_append_biquad(data->eq2, channel, type,
 						  freq / nyquist, Q, gain);
+				data->params[k - 4] = type;
+				data->params[k - 3] = freq;
+				data->params[k - 2] = Q;
+				data->params[k - 1] = gain;
 			}
 		}
 	}
@@ -414,6 +534,7 @@ static void eq2_run(struct dsp_module *module, unsigned long sample_count)
 
 	eq2_process(data->eq2, data->ports[2], data->ports[3],
 		    (int)sample_count);
+	data->ran = 1;
 }
 
 static void eq2_deinstantiate(struct dsp_module *module)
@@ -421,17 +542,138 @@ static void eq2_deinstantiate(struct dsp_module *module)
 	struct eq2_data *data = (struct eq2_data *)module->data;
 	if (data->eq2)
 		eq2_free(data->eq2);
-	free(data);
+	data->eq2 = NULL;
 }
 
-static void eq2_init_module(struct dsp_module *module)
+static void eq2_free_module(struct dsp_module *module)
 {
+	free(module->data);
+	free(module);
+}
+
+/* The coefficients come from the plugin, so the module data is allocated
+ * here and kept across instantiations. */
+static void eq2_init_module(struct dsp_module *module,
+			    const struct plugin *plugin)
+{
+	struct eq2_data *data;
+
+	data = (struct eq2_data *)calloc(1, sizeof(struct eq2_data));
+	data->plugin = plugin;
+	module->data = data;
+
 	module->instantiate = &eq2_instantiate;
 	module->connect_port = &eq2_connect_port;
 	module->get_delay = &empty_get_delay;
 	module->run = &eq2_run;
+	module->controls_changed = &eq2_controls_changed;
 	module->deinstantiate = &eq2_deinstantiate;
-	module->free_module = &empty_free_module;
+	module->free_module = &eq2_free_module;
+	module->get_properties = &empty_get_properties;
+	module->dump = &empty_dump;
+}
+
+/*
+ *  eqn module functions
+ */
+struct eqn_data {
+	int sample_rate;
+	int num_channels;
+	struct eqn *eqn; /* Initialized in the first call of eqn_run() */
+
+	/* num_channels ports for input, num_channels for output, and 4
+	 * parameters per eq of each channel */
+	float *ports[EQN_MAX_CHANNELS * 2 +
+		     MAX_BIQUADS_PER_EQN * EQN_MAX_CHANNELS * 4];
+};
+
+static int eqn_instantiate(struct dsp_module *module, unsigned long sample_rate)
+{
+	struct eqn_data *data = (struct eqn_data *)module->data;
+
+	if (data->num_channels < 1 || data->num_channels > EQN_MAX_CHANNELS)
+		return -EINVAL;
+	data->sample_rate = (int)sample_rate;
+	return 0;
+}
+
+static void eqn_connect_port(struct dsp_module *module, unsigned long port,
+			     float *data_location)
+{
+	struct eqn_data *data = (struct eqn_data *)module->data;
+	data->ports[port] = data_location;
+}
+
+static void eqn_run(struct dsp_module *module, unsigned long sample_count)
+{
+	struct eqn_data *data = (struct eqn_data *)module->data;
+	int n = data->num_channels;
+	int i, channel;
+
+	if (!data->eqn) {
+		float nyquist = data->sample_rate / 2;
+
+		data->eqn = eqn_new(n);
+		for (i = n * 2; i < n * 2 + MAX_BIQUADS_PER_EQN * n * 4;
+		     i += n * 4) {
+			if (!data->ports[i])
+				break;
+			for (channel = 0; channel < n; channel++) {
+				int k = i + channel * 4;
+				int type = (int)*data->ports[k];
+				float freq = *data->ports[k + 1];
+				float Q = *data->ports[k + 2];
+				float gain = *data->ports[k + 3];
+				eqn_append_biquad(data->eqn, channel, type,
+						  freq / nyquist, Q, gain);
+			}
+		}
+	}
+
+	for (channel = 0; channel < n; channel++)
+		if (data->ports[channel] != data->ports[n + channel])
+			memcpy(data->ports[n + channel], data->ports[channel],
+			       sizeof(float) * sample_count);
+
+	eqn_process(data->eqn, &data->ports[n], (int)sample_count);
+}
+
+static void eqn_deinstantiate(struct dsp_module *module)
+{
+	struct eqn_data *data = (struct eqn_data *)module->data;
+	if (data->eqn)
+		eqn_free(data->eqn);
+	data->eqn = NULL;
+}
+
+static void eqn_free_module(struct dsp_module *module)
+{
+	free(module->data);
+	free(module);
+}
+
+/* The channel count comes from the plugin, so the module data is allocated
+ * here and kept across instantiations. */
+static void eqn_init_module(struct dsp_module *module,
+			    const struct plugin *plugin)
+{
+	struct eqn_data *data;
+	const struct port *port;
+	int i;
+
+	data = (struct eqn_data *)calloc(1, sizeof(struct eqn_data));
+	ARRAY_ELEMENT_FOREACH (&plugin->ports, i, port) {
+		if (port->direction == PORT_INPUT && port->type == PORT_AUDIO)
+			data->num_channels++;
+	}
+	module->data = data;
+
+	module->instantiate = &eqn_instantiate;
+	module->connect_port = &eqn_connect_port;
+	module->get_delay = &empty_get_delay;
+	module->run = &eqn_run;
+	module->deinstantiate = &eqn_deinstantiate;
+	module->free_module = &eqn_free_module;
 	module->get_properties = &empty_get_properties;
 	module->dump = &empty_dump;
 }
@@ -446,6 +688,11 @@ struct drc_data {
 	/* Two ports for input, two for output, one for disable_emphasis,
 	 * and 8 parameters each band */
 	float *ports[4 + 1 + 8 * 3];
+
+	/* The parameters the drc is set to, one for each parameter port.
+	 * They glide toward the ports after the controls change. */
+	float params[1 + 8 * 3];
+	int gliding;
 };
 
 static int drc_instantiate(struct dsp_module *module, unsigned long sample_rate)
@@ -471,37 +718,75 @@ static int drc_get_delay(struct dsp_module *module)
 	return DRC_DEFAULT_PRE_DELAY * data->sample_rate;
 }
 
+static void drc_controls_changed(struct dsp_module *module)
+{
+	struct drc_data *data = (struct drc_data *)module->data;
+	data->gliding = 1;
+}
+
+/* Passes the parameters in data->params to the drc. */
+static void drc_set_params(struct drc_data *data)
+{
+	struct drc *drc = data->drc;
+	float nyquist = data->sample_rate / 2;
+	int i;
+
+	drc->emphasis_disabled = (int)data->params[0];
+	for (i = 0; i < 3; i++) {
+		const float *p = &data->params[1 + i * 8];
+		float f = p[0];
+		float enable = p[1];
+		float threshold = p[2];
+		float knee = p[3];
+		float ratio = p[4];
+		float attack = p[5];
+		float release = p[6];
+		float boost = p[7];
+		drc_set_param(drc, i, PARAM_CROSSOVER_LOWER_FREQ, f / nyquist);
+		drc_set_param(drc, i, PARAM_ENABLED, enable);
+		drc_set_param(drc, i, PARAM_THRESHOLD, threshold);
+		drc_set_param(drc, i, PARAM_KNEE, knee);
+		drc_set_param(drc, i, PARAM_RATIO, ratio);
+		drc_set_param(drc, i, PARAM_ATTACK, attack);
+		drc_set_param(drc, i, PARAM_RELEASE, release);
+		drc_set_param(drc, i, PARAM_POST_GAIN, boost);
+	}
+}
+
+/* Moves the parameters of the drc toward the ports. Returns non-zero while
+ * some are still gliding. */
+static int drc_glide(struct drc_data *data, float step)
+{
+	int moving = 0;
+	int i;
+
+	for (i = 0; i < 1 + 8 * 3; i++) {
+		/* disable_emphasis and the enable of each band don't glide */
+		if (i == 0 || i % 8 == 2)
+			data->params[i] = *data->ports[4 + i];
+		else if (data->params[i] != *data->ports[4 + i])
+			moving |= glide_control(&data->params[i],
+						*data->ports[4 + i], step);
+	}
+	drc_set_params(data);
+	drc_update_params(data->drc);
+	return moving;
+}
+
 static void drc_run(struct dsp_module *module, unsigned long sample_count)
 {
 	struct drc_data *data = (struct drc_data *)module->data;
+	int i;
+
+	if (data->drc && data->gliding)
+		data->gliding = drc_glide(data, glide_step(sample_count));
 	if (!data->drc) {
-		int i;
-		float nyquist = data->sample_rate / 2;
-		struct drc *drc = drc_new(data->sample_rate);
-
-		data->drc = drc;
-		drc->emphasis_disabled = (int)*data->ports[4];
-		for (i = 0; i < 3; i++) {
-			int k = 5 + i * 8;
-			float f = *data->ports[k];
-			float enable = *data->ports[k + 1];
-			float threshold = *data->ports[k + 2];
-			float knee = *data->ports[k + 3];
-			float ratio = *data->ports[k + 4];
-			float attack = *data->ports[k + 5];
-			float release = *data->ports[k + 6];
-			float boost = *data->ports[k + 7];
-			drc_set_param(drc, i, PARAM_CROSSOVER_LOWER_FREQ,
-				      f / nyquist);
-			drc_set_param(drc, i, PARAM_ENABLED, enable);
-			drc_set_param(drc, i, PARAM_THRESHOLD, threshold);
-			drc_set_param(drc, i, PARAM_KNEE, knee);
-			drc_set_param(drc, i, PARAM_RATIO, ratio);
-			drc_set_param(drc, i, PARAM_ATTACK, attack);
-			drc_set_param(drc, i, PARAM_RELEASE, release);
-			drc_set_param(drc, i, PARAM_POST_GAIN, boost);
-		}
-		drc_init(drc);
+		for (i = 0; i < 1 + 8 * 3; i++)
+			data->params[i] = *data->ports[4 + i];
+		data->drc = drc_new(data->sample_rate);
+		drc_set_params(data);
+		drc_init(data->drc);
+		data->gliding = 0;
 	}
 	if (data->ports[0] != data->ports[2])
 		memcpy(data->ports[2], data->ports[0],
@@ -527,12 +812,172 @@ static void drc_init_module(struct dsp_module *module)
 	module->connect_port = &drc_connect_port;
 	module->get_delay = &drc_get_delay;
 	module->run = &drc_run;
+	module->controls_changed = &drc_controls_changed;
 	module->deinstantiate = &drc_deinstantiate;
 	module->free_module = &empty_free_module;
 	module->get_properties = &empty_get_properties;
 	module->dump = &empty_dump;
 }
 
+/*
+ *  fir module functions
+ */
+#define FIR_MAX_CHANNELS 8
+
+struct fir_data {
+	char *impulse_response;
+	int num_channels;
+	struct fir *fir[FIR_MAX_CHANNELS];
+
+	/* num_channels ports for input, num_channels for output */
+	float *ports[FIR_MAX_CHANNELS * 2];
+};
+
+/* Reads the interleaved impulse responses of all channels and creates one
+ * filter per channel. */
+static int fir_load(struct fir_data *data)
+{
+	FILE *f;
+	float *ir, *channel_ir;
+	long size;
+	int taps, ch, i, rc = 0;
+
+	f = fopen(data->impulse_response, "rb");
+	if (!f) {
+		syslog(LOG_ERR, "Failed to open impulse response %s",
+		       data->impulse_response);
+		return -errno;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+
+	taps = size / sizeof(float) / data->num_channels;
+	if (taps < 1 || taps > FIR_MAX_TAPS) {
+		syslog(LOG_ERR, "Invalid impulse response %s",
+		       data->impulse_response);
+		fclose(f);
+		return -EINVAL;
+	}
+
+	ir = (float *)malloc(taps * data->num_channels * sizeof(float));
+	channel_ir = (float *)malloc(taps * sizeof(float));
+	if (!ir || !channel_ir) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	if (fread(ir, sizeof(float) * data->num_channels, taps, f) != taps) {
+		rc = -EIO;
+		goto out;
+	}
+
+	for (ch = 0; ch < data->num_channels; ch++) {
+		for (i = 0; i < taps; i++)
+			channel_ir[i] = ir[i * data->num_channels + ch];
+		data->fir[ch] = fir_new(channel_ir, taps);
+		if (!data->fir[ch]) {
+			rc = -ENOMEM;
+			goto out;
+		}
+	}
+
+out:
+	free(ir);
+	free(channel_ir);
+	fclose(f);
+	return rc;
+}
+
+static void fir_deinstantiate(struct dsp_module *module)
+{
+	struct fir_data *data = (struct fir_data *)module->data;
+	int ch;
+
+	for (ch = 0; ch < FIR_MAX_CHANNELS; ch++) {
+		fir_free(data->fir[ch]);
+		data->fir[ch] = NULL;
+	}
+}
+
+static int fir_instantiate(struct dsp_module *module, unsigned long sample_rate)
+{
+	struct fir_data *data = (struct fir_data *)module->data;
+	int rc;
+
+	if (!data->impulse_response || data->num_channels < 1 ||
+	    data->num_channels > FIR_MAX_CHANNELS)
+		return -EINVAL;
+
+	rc = fir_load(data);
+	if (rc)
+		fir_deinstantiate(module);
+	return rc;
+}
+
+static void fir_connect_port(struct dsp_module *module, unsigned long port,
+			     float *data_location)
+{
+	struct fir_data *data = (struct fir_data *)module->data;
+	data->ports[port] = data_location;
+}
+
+static int fir_get_delay(struct dsp_module *module)
+{
+	return FIR_BLOCK_FRAMES;
+}
+
+static void fir_run(struct dsp_module *module, unsigned long sample_count)
+{
+	struct fir_data *data = (struct fir_data *)module->data;
+	int n = data->num_channels;
+	int ch;
+
+	for (ch = 0; ch < n; ch++) {
+		if (data->ports[ch] != data->ports[n + ch])
+			memcpy(data->ports[n + ch], data->ports[ch],
+			       sizeof(float) * sample_count);
+		fir_process(data->fir[ch], data->ports[n + ch],
+			    (int)sample_count);
+	}
+}
+
+static void fir_free_module(struct dsp_module *module)
+{
+	struct fir_data *data = (struct fir_data *)module->data;
+
+	free(data->impulse_response);
+	free(data);
+	free(module);
+}
+
+/* Like eqn, the channel count and the impulse response come from the
+ * plugin, so the module data lives as long as the module. */
+static void fir_init_module(struct dsp_module *module,
+			    const struct plugin *plugin)
+{
+	struct fir_data *data;
+	const struct port *port;
+	int i;
+
+	data = (struct fir_data *)calloc(1, sizeof(struct fir_data));
+	if (plugin->impulse_response)
+		data->impulse_response = strdup(plugin->impulse_response);
+	ARRAY_ELEMENT_FOREACH (&plugin->ports, i, port) {
+		if (port->direction == PORT_INPUT && port->type == PORT_AUDIO)
+			data->num_channels++;
+	}
+	module->data = data;
+
+	module->instantiate = &fir_instantiate;
+	module->connect_port = &fir_connect_port;
+	module->get_delay = &fir_get_delay;
+	module->run = &fir_run;
+	module->deinstantiate = &fir_deinstantiate;
+	module->free_module = &fir_free_module;
+	module->get_properties = &empty_get_properties;
+	module->dump = &empty_dump;
+}
+
 /*
  * sink module functions
  */
@@ -616,9 +1061,13 @@ struct dsp_module *cras_dsp_module_load_builtin(struct plugin *plugin)
 	} else if (strcmp(plugin->label, "eq") == 0) {
 		eq_init_module(module);
 	} else if (strcmp(plugin->label, "eq2") == 0) {
-		eq2_init_module(module);
+		eq2_init_module(module, plugin);
+	} else if (strcmp(plugin->label, "eqn") == 0) {
+		eqn_init_module(module, plugin);
 	} else if (strcmp(plugin->label, "drc") == 0) {
 		drc_init_module(module);
+	} else if (strcmp(plugin->label, "fir") == 0) {
+		fir_init_module(module, plugin);
 	} else if (strcmp(plugin->label, "swap_lr") == 0) {
 		swap_lr_init_module(module);
 	} else if (strcmp(plugin->label, "sink") == 0) {
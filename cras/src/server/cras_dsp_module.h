@@ -54,6 +54,13 @@ struct dsp_module {
 	 */
 	void (*run)(struct dsp_module *mod, unsigned long sample_count);
 
+	/* Tells the module that values of its input control ports changed.
+	 * It is called by the thread running the module, between two calls
+	 * of run(). A module which reads its controls only once leaves it
+	 * NULL, its controls can't be changed once it runs.
+	 */
+	void (*controls_changed)(struct dsp_module *mod);
+
 	/* Free resources used by the module. This module can be used
 	 * again by calling instantiate() */
 	void (*deinstantiate)(struct dsp_module *mod);
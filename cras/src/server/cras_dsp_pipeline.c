@@ -6,10 +6,13 @@
 #include <inttypes.h>
 #include <sys/param.h>
 #include <syslog.h>
+#include <unistd.h>
 
+#include "audio_thread_log.h"
 #include "cras_util.h"
 #include "cras_dsp_module.h"
 #include "cras_dsp_pipeline.h"
+#include "cras_mix_pool.h"
 #include "dsp_util.h"
 
 /* We have a static representation of the dsp graph in a "struct ini",
@@ -43,6 +46,19 @@
  * connect to each other directly, bypassing B.
  */
 
+/* The L2 cache size assumed when the system doesn't report one. */
+#define DEFAULT_L2_CACHE_SIZE (256 * 1024)
+/* The smallest block size picked for a pipeline, in frames. */
+#define MIN_BLOCK_SIZE 64
+/* Pipelines with fewer instances, or blocks with fewer frames, are not
+ * worth waking the worker pool for. */
+#define PARALLEL_MIN_INSTANCES 6
+#define PARALLEL_MIN_FRAMES 256
+
+/* The most control values waiting for the next block of a pipeline. Enough
+ * for every control of an eq2 and a drc. */
+#define CONTROL_QUEUE_SIZE 128
+
 /* This represents an audio port on an instance. */
 struct audio_port {
 	struct audio_port *peer; /* the audio port this port connects to */
@@ -92,10 +108,26 @@ struct instance {
 	/* This is the total buffering delay from source to this instance. It is
 	 * in number of frames. */
 	int total_delay;
+
+	/* The length of the longest path from the source to this instance.
+	 * Instances of the same level don't depend on each other. */
+	int level;
+
+	/* How long the runs of the module took. Only written by the thread
+	 * running the instance. */
+	struct dsp_run_stats run_stats;
 };
 
 DECLARE_ARRAY_TYPE(struct instance, instance_array)
 
+/* A control value waiting for the next block, see
+ * cras_dsp_pipeline_set_control(). */
+struct control_update {
+	struct instance *instance;
+	struct control_port *port;
+	float value;
+};
+
 /* An pipeline is a dynamic representation of a dsp ini file. */
 struct pipeline {
 	/* The purpose of the pipeline. "playback" or "capture" */
@@ -126,6 +158,42 @@ struct pipeline {
 	int input_channels;
 	int output_channels;
 
+	/* The number of frames processed per run, at most DSP_BUFFER_SIZE */
+	unsigned int block_size;
+
+	/* The builtin elementwise stereo instance feeding the sink, if any.
+	 * cras_dsp_pipeline_apply() skips running it and applies fused_op
+	 * on fused_input while interleaving instead. */
+	struct instance *fused_instance;
+	enum dsp_util_stereo_op fused_op;
+	float *fused_input[2];
+
+	/* Whether an ext module reads the sink buffers, which rules out
+	 * skipping the fused instance. */
+	int has_sink_ext;
+
+	/* Control values set by cras_dsp_pipeline_set_control() for the next
+	 * block. Only the setting thread moves control_tail and only the
+	 * thread running the pipeline moves control_head. */
+	struct control_update control_queue[CONTROL_QUEUE_SIZE];
+	unsigned int control_head;
+	unsigned int control_tail;
+
+	/* The swap_lr plugin feeding the sink, if the output channels can be
+	 * swapped without rebuilding the pipeline, and whether it is enabled
+	 * in this pipeline. swap_lr_flip is set while the swap asked for with
+	 * cras_dsp_pipeline_set_swap_lr() differs from swap_lr_built, the
+	 * sink buffers then trade places when they are interleaved. */
+	const struct plugin *swap_lr_plugin;
+	int swap_lr_built;
+	int swap_lr_flip;
+
+	/* Set when instances of the same level run on the worker pool. The
+	 * instances are then sorted by level and don't share buffers with
+	 * other instances of their level. jobs has one entry per instance. */
+	int parallel;
+	struct dsp_job *jobs;
+
 	/* The audio sampling rate for this pipleine. It is zero if
 	 * cras_dsp_pipeline_instantiate() has not been called. */
 	int sample_rate;
@@ -144,6 +212,17 @@ struct pipeline {
 	int64_t total_samples;
 };
 
+/* A module run handed to the worker pool. */
+struct dsp_job {
+	struct instance *instance;
+	int index;
+	unsigned long sample_count;
+};
+
+/* Workers running independent instances of a level, NULL to run serially.
+ * Each audio thread installs its own pool. */
+static __thread struct cras_mix_pool *worker_pool;
+
 static struct instance *find_instance_by_plugin(const instance_array *instances,
 						const struct plugin *plugin)
 {
@@ -399,6 +478,114 @@ static struct plugin *find_enabled_builtin_plugin(struct ini *ini,
 	return found;
 }
 
+static int upstream_level(const instance_array *instances,
+			  const struct plugin *plugin)
+{
+	struct instance *upstream = find_instance_by_plugin(instances, plugin);
+
+	return upstream ? upstream->level + 1 : 0;
+}
+
+/* Assigns each instance its level and decides whether the pipeline is big
+ * and wide enough to run levels on the worker pool. If so, the instances
+ * are stably sorted by level, which keeps them in a dependency order. */
+static int schedule_levels(struct pipeline *pipeline)
+{
+	instance_array *instances = &pipeline->instances;
+	int n = ARRAY_COUNT(instances);
+	struct instance *instance, tmp;
+	struct audio_port *audio_port;
+	struct control_port *control_port;
+	int i, j, width = 0, max_width = 0;
+
+	ARRAY_ELEMENT_FOREACH (instances, i, instance) {
+		instance->level = 0;
+		ARRAY_ELEMENT_FOREACH (&instance->input_audio_ports, j,
+				       audio_port) {
+			instance->level = MAX(
+				instance->level,
+				upstream_level(instances,
+					       audio_port->peer->plugin));
+		}
+		ARRAY_ELEMENT_FOREACH (&instance->input_control_ports, j,
+				       control_port) {
+			if (!control_port->peer)
+				continue;
+			instance->level = MAX(
+				instance->level,
+				upstream_level(instances,
+					       control_port->peer->plugin));
+		}
+	}
+
+	if (n < PARALLEL_MIN_INSTANCES)
+		return 0;
+
+	for (i = 1; i < n; i++) {
+		tmp = *ARRAY_ELEMENT(instances, i);
+		for (j = i; j > 0 && ARRAY_ELEMENT(instances, j - 1)->level >
+					     tmp.level;
+		     j--)
+			*ARRAY_ELEMENT(instances, j) =
+				*ARRAY_ELEMENT(instances, j - 1);
+		*ARRAY_ELEMENT(instances, j) = tmp;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (i && ARRAY_ELEMENT(instances, i)->level ==
+				 ARRAY_ELEMENT(instances, i - 1)->level)
+			width++;
+		else
+			width = 1;
+		max_width = MAX(max_width, width);
+	}
+	if (max_width < 2)
+		return 0;
+
+	pipeline->jobs = (struct dsp_job *)calloc(n, sizeof(struct dsp_job));
+	if (!pipeline->jobs)
+		return -ENOMEM;
+	pipeline->parallel = 1;
+	return 0;
+}
+
+/* Finds the swap_lr plugin the ini puts before a stereo sink, switched by
+ * the swap_lr_disabled variable. It feeds the sink directly, so swapping the
+ * sink buffers does the same as enabling or disabling it. */
+static void find_swap_lr(struct pipeline *pipeline, struct plugin *sink)
+{
+	struct ini *ini = pipeline->ini;
+	struct plugin *plugin;
+	struct port *port;
+	struct flow *flow;
+	int i, j;
+
+	ARRAY_ELEMENT_FOREACH (&ini->plugins, i, plugin) {
+		if (strcmp(plugin->library, "builtin") != 0 ||
+		    strcmp(plugin->label, "swap_lr") != 0 || !plugin->purpose ||
+		    strcmp(plugin->purpose, pipeline->purpose) != 0 ||
+		    !plugin->disable ||
+		    strcmp(plugin->disable, "swap_lr_disabled") != 0)
+			continue;
+
+		/* Outputs 2 and 3 go to sink inputs 0 and 1. */
+		ARRAY_ELEMENT_FOREACH (&plugin->ports, j, port) {
+			if (port->direction != PORT_OUTPUT)
+				continue;
+			if (port->flow_id == INVALID_FLOW_ID)
+				return;
+			flow = ARRAY_ELEMENT(&ini->flows, port->flow_id);
+			if (flow->to != sink || flow->to_port != j - 2)
+				return;
+		}
+		pipeline->swap_lr_plugin = plugin;
+		pipeline->swap_lr_built =
+			find_instance_by_plugin(&pipeline->instances, plugin) !=
+			NULL;
+		return;
+	}
+}
+
 struct pipeline *cras_dsp_pipeline_create(struct ini *ini,
 					  struct cras_expr_env *env,
 					  const char *purpose)
@@ -427,12 +614,16 @@ struct pipeline *cras_dsp_pipeline_create(struct ini *ini,
 
 	pipeline->ini = ini;
 	pipeline->purpose = purpose;
+	pipeline->block_size = DSP_BUFFER_SIZE;
 	/* create instances for needed plugins, in the order of dependency */
 	n = ARRAY_COUNT(&ini->plugins);
 	visited = calloc(1, n);
 	rc = topological_sort(pipeline, env, sink, visited);
 	free(visited);
 
+	if (rc == 0)
+		rc = schedule_levels(pipeline);
+
 	if (rc < 0) {
 		syslog(LOG_ERR, "failed to construct pipeline");
 		cras_dsp_pipeline_free(pipeline);
@@ -462,6 +653,9 @@ struct pipeline *cras_dsp_pipeline_create(struct ini *ini,
 		return NULL;
 	}
 
+	if (pipeline->output_channels == 2)
+		find_swap_lr(pipeline, sink);
+
 	return pipeline;
 }
 
@@ -478,12 +672,49 @@ static int load_module(struct plugin *plugin, struct instance *instance)
 	return 0;
 }
 
-static void use_buffers(char *busy, audio_port_array *audio_ports)
+/* Points output j of the instance at the buffer of its input j when the
+ * module can run in place, so it processes the samples where they are. The
+ * other outputs are left without a buffer. */
+static void alias_buffers(struct instance *instance)
+{
+	int i;
+	int inplace = !(instance->properties & MODULE_INPLACE_BROKEN);
+	int num_inputs = ARRAY_COUNT(&instance->input_audio_ports);
+	struct audio_port *audio_port;
+
+	ARRAY_ELEMENT_FOREACH (&instance->output_audio_ports, i, audio_port) {
+		if (inplace && i < num_inputs)
+			audio_port->buf_index =
+				ARRAY_ELEMENT(&instance->input_audio_ports, i)
+					->buf_index;
+		else
+			audio_port->buf_index = -1;
+	}
+}
+
+static int is_aliased(struct instance *instance, int buf_index)
+{
+	int i;
+	struct audio_port *audio_port;
+
+	ARRAY_ELEMENT_FOREACH (&instance->output_audio_ports, i, audio_port) {
+		if (audio_port->buf_index == buf_index)
+			return 1;
+	}
+	return 0;
+}
+
+/* Takes the lowest free buffer for each output not aliased to an input. */
+static void use_buffers(char *busy, struct instance *instance)
 {
 	int i, k = 0;
 	struct audio_port *audio_port;
 
-	ARRAY_ELEMENT_FOREACH (audio_ports, i, audio_port) {
+	ARRAY_ELEMENT_FOREACH (&instance->output_audio_ports, i, audio_port) {
+		if (audio_port->buf_index >= 0) {
+			busy[audio_port->buf_index] = 1;
+			continue;
+		}
 		while (busy[k])
 			k++;
 		audio_port->buf_index = k;
@@ -491,40 +722,134 @@ static void use_buffers(char *busy, audio_port_array *audio_ports)
 	}
 }
 
-static void unuse_buffers(char *busy, audio_port_array *audio_ports)
+/* Frees the input buffers the outputs didn't take over. */
+static void unuse_buffers(char *busy, struct instance *instance)
 {
 	int i;
 	struct audio_port *audio_port;
 
-	ARRAY_ELEMENT_FOREACH (audio_ports, i, audio_port) {
-		busy[audio_port->buf_index] = 0;
+	ARRAY_ELEMENT_FOREACH (&instance->input_audio_ports, i, audio_port) {
+		if (!is_aliased(instance, audio_port->buf_index))
+			busy[audio_port->buf_index] = 0;
 	}
 }
 
+/* Returns the number of instances starting at index i sharing its level
+ * when the pipeline runs levels in parallel, otherwise 1. */
+static int level_width(struct pipeline *pipeline, int i)
+{
+	int n = ARRAY_COUNT(&pipeline->instances);
+	int level = ARRAY_ELEMENT(&pipeline->instances, i)->level;
+	int j;
+
+	if (!pipeline->parallel)
+		return 1;
+	for (j = i + 1; j < n; j++)
+		if (ARRAY_ELEMENT(&pipeline->instances, j)->level != level)
+			break;
+	return j - i;
+}
+
 /* assign which buffer each audio port on each instance should use */
 static int allocate_buffers(struct pipeline *pipeline)
 {
-	int i;
+	int i, k, width;
 	struct instance *instance;
-	int need_buf = 0, peak_buf = 0;
+	int max_buf = 0, peak_buf = 0;
 	char *busy;
 
-	/* first figure out how many buffers do we need */
+	/* At most every output port holds a buffer at the same time */
 	ARRAY_ELEMENT_FOREACH (&pipeline->instances, i, instance) {
-		int in = ARRAY_COUNT(&instance->input_audio_ports);
-		int out = ARRAY_COUNT(&instance->output_audio_ports);
-
-		if (instance->properties & MODULE_INPLACE_BROKEN) {
-			/* We cannot reuse input buffer as output
-			 * buffer, so we need to use extra buffers */
-			need_buf += out;
-			peak_buf = MAX(peak_buf, need_buf);
-			need_buf -= in;
+		max_buf += ARRAY_COUNT(&instance->output_audio_ports);
+	}
+	busy = calloc(MAX(max_buf, 1), sizeof(*busy));
+	if (!busy)
+		return -1;
+
+	/* Assign buffer index for each instance's input/output ports */
+	for (i = 0; i < ARRAY_COUNT(&pipeline->instances); i += width) {
+		int j;
+		struct audio_port *audio_port;
+
+		width = level_width(pipeline, i);
+
+		/* Collect input buffers from upstream */
+		for (k = i; k < i + width; k++) {
+			instance = ARRAY_ELEMENT(&pipeline->instances, k);
+			ARRAY_ELEMENT_FOREACH (&instance->input_audio_ports, j,
+					       audio_port) {
+				audio_port->buf_index =
+					audio_port->peer->buf_index;
+			}
+		}
+
+		/* Instances of a level run at the same time, so none of them
+		 * may write a buffer another one of them still reads. Each
+		 * input is only read by its own instance, which may still
+		 * process it in place, the rest are kept until the whole level
+		 * is done. */
+		if (width > 1) {
+			for (k = i; k < i + width; k++) {
+				instance = ARRAY_ELEMENT(&pipeline->instances,
+							 k);
+				alias_buffers(instance);
+				use_buffers(busy, instance);
+			}
+			for (k = i; k < i + width; k++) {
+				instance = ARRAY_ELEMENT(&pipeline->instances,
+							 k);
+				unuse_buffers(busy, instance);
+			}
 		} else {
-			need_buf += out - in;
-			peak_buf = MAX(peak_buf, need_buf);
+			instance = ARRAY_ELEMENT(&pipeline->instances, i);
+			/* If the module has the MODULE_INPLACE_BROKEN flag,
+			 * we cannot reuse input buffers as output buffers, so
+			 * we need to use extra buffers. For example, in this
+			 * graph
+			 *
+			 * [A]
+			 * output_0={x}
+			 * output_1={y}
+			 * output_2={z}
+			 * output_3={w}
+			 * [B]
+			 * input_0={x}
+			 * input_1={y}
+			 * input_2={z}
+			 * input_3={w}
+			 * output_4={u}
+			 *
+			 * Then peak_buf for this pipeline is 4. However if
+			 * plugin B has the MODULE_INPLACE_BROKEN flag, then
+			 * peak_buf is 5 because plugin B cannot output to the
+			 * same buffer used for input.
+			 *
+			 * This means if we don't have the flag, we can free
+			 * the input buffers then allocate the output buffers,
+			 * but if we have the flag, we have to allocate the
+			 * output buffers before freeing the input buffers.
+			 * Without the flag output j also takes the buffer of
+			 * input j, so an elementwise module doesn't move the
+			 * samples to another buffer.
+			 */
+			alias_buffers(instance);
+			if (instance->properties & MODULE_INPLACE_BROKEN) {
+				use_buffers(busy, instance);
+				unuse_buffers(busy, instance);
+			} else {
+				unuse_buffers(busy, instance);
+				use_buffers(busy, instance);
+			}
 		}
+
+		/* Buffers are taken lowest index first, so the highest index
+		 * in use tells how many buffers are needed. */
+		for (k = 0; k < max_buf; k++)
+			if (busy[k])
+				peak_buf = MAX(peak_buf, k + 1);
 	}
+	free(busy);
+
 	/*
 	 * cras_dsp_pipeline_create creates pipeline with source and sink and it
 	 * makes sure all ports could be accessed from some sources, which means
@@ -548,7 +873,7 @@ static int allocate_buffers(struct pipeline *pipeline)
 
 	for (i = 0; i < peak_buf; i++) {
 		size_t size = DSP_BUFFER_SIZE * sizeof(float);
-		float *buf = calloc(1, size);
+		float *buf = cras_aligned_calloc(size);
 		if (!buf) {
 			syslog(LOG_ERR, "failed to allocate buf");
 			return -1;
@@ -556,55 +881,63 @@ static int allocate_buffers(struct pipeline *pipeline)
 		pipeline->buffers[i] = buf;
 	}
 
-	/* Now assign buffer index for each instance's input/output ports */
-	busy = calloc(peak_buf, sizeof(*busy));
-	ARRAY_ELEMENT_FOREACH (&pipeline->instances, i, instance) {
-		int j;
-		struct audio_port *audio_port;
+	return 0;
+}
 
-		/* Collect input buffers from upstream */
-		ARRAY_ELEMENT_FOREACH (&instance->input_audio_ports, j,
-				       audio_port) {
-			audio_port->buf_index = audio_port->peer->buf_index;
-		}
+static int stereo_op_from_label(const struct plugin *plugin,
+				enum dsp_util_stereo_op *op)
+{
+	if (strcmp(plugin->library, "builtin") != 0)
+		return -1;
+	if (strcmp(plugin->label, "swap_lr") == 0)
+		*op = DSP_UTIL_STEREO_SWAP;
+	else if (strcmp(plugin->label, "invert_lr") == 0)
+		*op = DSP_UTIL_STEREO_INVERT_LEFT;
+	else if (strcmp(plugin->label, "mix_stereo") == 0)
+		*op = DSP_UTIL_STEREO_MIX;
+	else
+		return -1;
+	return 0;
+}
 
-		/* If the module has the MODULE_INPLACE_BROKEN flag,
-		 * we cannot reuse input buffers as output buffers, so
-		 * we need to use extra buffers. For example, in this graph
-		 *
-		 * [A]
-		 * output_0={x}
-		 * output_1={y}
-		 * output_2={z}
-		 * output_3={w}
-		 * [B]
-		 * input_0={x}
-		 * input_1={y}
-		 * input_2={z}
-		 * input_3={w}
-		 * output_4={u}
-		 *
-		 * Then peak_buf for this pipeline is 4. However if
-		 * plugin B has the MODULE_INPLACE_BROKEN flag, then
-		 * peak_buf is 5 because plugin B cannot output to the
-		 * same buffer used for input.
-		 *
-		 * This means if we don't have the flag, we can free
-		 * the input buffers then allocate the output buffers,
-		 * but if we have the flag, we have to allocate the
-		 * output buffers before freeing the input buffers.
-		 */
-		if (instance->properties & MODULE_INPLACE_BROKEN) {
-			use_buffers(busy, &instance->output_audio_ports);
-			unuse_buffers(busy, &instance->input_audio_ports);
-		} else {
-			unuse_buffers(busy, &instance->input_audio_ports);
-			use_buffers(busy, &instance->output_audio_ports);
-		}
-	}
-	free(busy);
+/* Looks for a swap_lr, invert_lr or mix_stereo instance which is the last
+ * one to run before the sink and feeds it directly. Nothing runs after it
+ * to overwrite its inputs, so it can be folded into the interleave step. */
+static void find_fused_instance(struct pipeline *pipeline)
+{
+	struct instance *sink = pipeline->sink_instance;
+	struct instance *last;
+	struct audio_port *audio_port;
+	int n = ARRAY_COUNT(&pipeline->instances);
+	enum dsp_util_stereo_op op;
+	int i;
 
-	return 0;
+	pipeline->fused_instance = NULL;
+
+	if (n < 3 || ARRAY_ELEMENT(&pipeline->instances, n - 1) != sink ||
+	    pipeline->output_channels != 2)
+		return;
+	last = ARRAY_ELEMENT(&pipeline->instances, n - 2);
+	if (stereo_op_from_label(last->plugin, &op) ||
+	    ARRAY_COUNT(&last->input_audio_ports) != 2 ||
+	    ARRAY_COUNT(&last->output_audio_ports) != 2)
+		return;
+
+	/* Sink channel k must come from output port 2 + k. */
+	ARRAY_ELEMENT_FOREACH (&sink->input_audio_ports, i, audio_port) {
+		if (audio_port->peer->plugin != last->plugin ||
+		    audio_port->peer->original_index !=
+			    audio_port->original_index + 2)
+			return;
+	}
+	ARRAY_ELEMENT_FOREACH (&last->input_audio_ports, i, audio_port) {
+		if (audio_port->original_index > 1)
+			return;
+		pipeline->fused_input[audio_port->original_index] =
+			pipeline->buffers[audio_port->buf_index];
+	}
+	pipeline->fused_instance = last;
+	pipeline->fused_op = op;
 }
 
 int cras_dsp_pipeline_load(struct pipeline *pipeline)
@@ -621,6 +954,9 @@ int cras_dsp_pipeline_load(struct pipeline *pipeline)
 	if (allocate_buffers(pipeline) != 0)
 		return -1;
 
+	find_fused_instance(pipeline);
+	cras_dsp_pipeline_set_cb_level(pipeline, 0);
+
 	return 0;
 }
 
@@ -792,26 +1128,247 @@ float *cras_dsp_pipeline_get_sink_buffer(struct pipeline *pipeline, int index)
 void cras_dsp_pipeline_set_sink_ext_module(struct pipeline *pipeline,
 					   struct ext_dsp_module *ext_module)
 {
+	pipeline->has_sink_ext = ext_module != NULL;
 	cras_dsp_module_set_sink_ext_module(pipeline->sink_instance->module,
 					    ext_module);
 }
 
+int cras_dsp_pipeline_set_control(struct pipeline *pipeline,
+				  const char *title, unsigned int port,
+				  float value)
+{
+	struct instance *instance;
+	struct control_port *control_port, *found = NULL;
+	struct control_update *update;
+	unsigned int tail;
+	int i;
+
+	ARRAY_ELEMENT_FOREACH (&pipeline->instances, i, instance) {
+		if (strcmp(instance->plugin->title, title) == 0)
+			break;
+	}
+	if (i == ARRAY_COUNT(&pipeline->instances))
+		return -ENOENT;
+
+	ARRAY_ELEMENT_FOREACH (&instance->input_control_ports, i,
+			       control_port) {
+		if (control_port->original_index == port)
+			found = control_port;
+	}
+	/* A port fed by another instance takes its value from there. */
+	if (!found || found->peer)
+		return -EINVAL;
+	if (!instance->module->controls_changed)
+		return -ENOTSUP;
+
+	tail = pipeline->control_tail;
+	if (tail - __atomic_load_n(&pipeline->control_head, __ATOMIC_ACQUIRE) >=
+	    CONTROL_QUEUE_SIZE)
+		return -EAGAIN;
+	update = &pipeline->control_queue[tail % CONTROL_QUEUE_SIZE];
+	update->instance = instance;
+	update->port = found;
+	update->value = value;
+	__atomic_store_n(&pipeline->control_tail, tail + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+int cras_dsp_pipeline_set_swap_lr(struct pipeline *pipeline, int enable)
+{
+	/* An ext module on the sink must see the channels swapped, which
+	 * only the swap_lr instance does. */
+	if (!pipeline->swap_lr_plugin || pipeline->has_sink_ext)
+		return -ENOTSUP;
+	__atomic_store_n(&pipeline->swap_lr_flip,
+			 !!enable != pipeline->swap_lr_built, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* Moves the control values queued by cras_dsp_pipeline_set_control() to
+ * their ports, between two blocks. */
+static void apply_controls(struct pipeline *pipeline)
+{
+	unsigned int head = pipeline->control_head;
+	unsigned int tail;
+	struct control_update *update;
+	struct dsp_module *module;
+
+	tail = __atomic_load_n(&pipeline->control_tail, __ATOMIC_ACQUIRE);
+	if (head == tail)
+		return;
+	for (; head != tail; head++) {
+		update = &pipeline->control_queue[head % CONTROL_QUEUE_SIZE];
+		update->port->value = update->value;
+		module = update->instance->module;
+		module->controls_changed(module);
+	}
+	__atomic_store_n(&pipeline->control_head, head, __ATOMIC_RELEASE);
+}
+
+/* Trades the places of the two sink buffers if the output channels are to
+ * be swapped without the swap_lr instance. Returns non-zero if it did. */
+static int flip_sink(struct pipeline *pipeline, float **sink)
+{
+	float *tmp;
+
+	if (!__atomic_load_n(&pipeline->swap_lr_flip, __ATOMIC_RELAXED))
+		return 0;
+	tmp = sink[0];
+	sink[0] = sink[1];
+	sink[1] = tmp;
+	return 1;
+}
+
 struct ini *cras_dsp_pipeline_get_ini(struct pipeline *pipeline)
 {
 	return pipeline->ini;
 }
 
-void cras_dsp_pipeline_run(struct pipeline *pipeline, int sample_count)
+static int64_t run_time_ns(const struct timespec *begin,
+			   const struct timespec *end)
 {
-	int i;
+	struct timespec delta;
+
+	subtract_timespecs(end, begin, &delta);
+	return delta.tv_sec * 1000000000LL + delta.tv_nsec;
+}
+
+/* Adds a run of the instance at index to its histogram, logging the run if
+ * it is the slowest one yet. */
+static void add_run_time(struct instance *instance, int index, int64_t t,
+			 unsigned long sample_count)
+{
+	struct dsp_run_stats *stats = &instance->run_stats;
+	uint64_t us = t / 1000;
+	int bucket = us ? 64 - __builtin_clzll(us) : 0;
+
+	stats->histogram[MIN(bucket, DSP_RUN_TIME_BUCKETS - 1)]++;
+	stats->runs++;
+	stats->total_time += t;
+	if (t > stats->max_time) {
+		stats->max_time = t;
+		ATLOG(atlog, AUDIO_THREAD_DSP_RUN_MAX, index, t, sample_count);
+	}
+}
+
+static void run_job(void *arg)
+{
+	static __thread int denormals_flushed;
+	struct dsp_job *job = (struct dsp_job *)arg;
+	struct dsp_module *module = job->instance->module;
+	struct timespec begin, end;
+
+	/* Workers don't go through cras_dsp_init(). */
+	if (!denormals_flushed) {
+		dsp_enable_flush_denormal_to_zero();
+		denormals_flushed = 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	module->run(module, job->sample_count);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	add_run_time(job->instance, job->index, run_time_ns(&begin, &end),
+		     job->sample_count);
+}
+
+static void run_instances(struct pipeline *pipeline, int sample_count,
+			  const struct instance *skip)
+{
+	int i, k, width, num_jobs;
 	struct instance *instance;
+	struct cras_mix_pool *pool = worker_pool;
+	struct timespec begin, end;
+
+	apply_controls(pipeline);
+
+	if (!pipeline->parallel || !pool ||
+	    sample_count < PARALLEL_MIN_FRAMES) {
+		/* The end of one run is the beginning of the next, one
+		 * clock read per instance. The monotonic clock is read
+		 * without a syscall, unlike the thread CPU time. */
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		ARRAY_ELEMENT_FOREACH (&pipeline->instances, i, instance) {
+			struct dsp_module *module = instance->module;
+			if (instance == skip)
+				continue;
+			module->run(module, sample_count);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			add_run_time(instance, i, run_time_ns(&begin, &end),
+				     sample_count);
+			begin = end;
+		}
+		return;
+	}
 
-	ARRAY_ELEMENT_FOREACH (&pipeline->instances, i, instance) {
-		struct dsp_module *module = instance->module;
-		module->run(module, sample_count);
+	/* Levels run one after the other, the instances of a level run on
+	 * the pool. cras_mix_pool_run() returns when all of them are done,
+	 * which is the barrier before the next level. */
+	for (i = 0; i < ARRAY_COUNT(&pipeline->instances); i += width) {
+		width = level_width(pipeline, i);
+		num_jobs = 0;
+		for (k = i; k < i + width; k++) {
+			instance = ARRAY_ELEMENT(&pipeline->instances, k);
+			if (instance == skip)
+				continue;
+			pipeline->jobs[num_jobs].instance = instance;
+			pipeline->jobs[num_jobs].index = k;
+			pipeline->jobs[num_jobs].sample_count = sample_count;
+			num_jobs++;
+		}
+		if (num_jobs == 1)
+			run_job(&pipeline->jobs[0]);
+		else if (num_jobs > 1)
+			cras_mix_pool_run(pool, run_job, pipeline->jobs,
+					  sizeof(*pipeline->jobs), num_jobs);
 	}
 }
 
+void cras_dsp_pipeline_set_worker_pool(struct cras_mix_pool *pool)
+{
+	worker_pool = pool;
+}
+
+void cras_dsp_pipeline_run(struct pipeline *pipeline, int sample_count)
+{
+	run_instances(pipeline, sample_count, NULL);
+}
+
+void cras_dsp_pipeline_set_cb_level(struct pipeline *pipeline,
+				    unsigned int cb_level)
+{
+	long cache = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	unsigned int max_block;
+
+	if (cache <= 0)
+		cache = DEFAULT_L2_CACHE_SIZE;
+
+	/* Keep the audio buffers within half of L2, leaving the rest for
+	 * module state like filter coefficients and delay lines. */
+	max_block = cache / 2 / (MAX(pipeline->peak_buf, 1) * sizeof(float));
+	max_block = MAX(max_block, MIN_BLOCK_SIZE);
+	max_block = MIN(max_block, DSP_BUFFER_SIZE);
+
+	/* A callback that fits runs in one block. A larger one is split into
+	 * even blocks rather than full ones and a small remainder. */
+	if (cb_level > max_block) {
+		unsigned int blocks = (cb_level + max_block - 1) / max_block;
+		max_block = (cb_level + blocks - 1) / blocks;
+	}
+	pipeline->block_size = max_block;
+}
+
+unsigned int cras_dsp_pipeline_get_block_size(struct pipeline *pipeline)
+{
+	return pipeline->block_size;
+}
+
+const struct dsp_run_stats *
+cras_dsp_pipeline_get_run_stats(struct pipeline *pipeline, int index)
+{
+	if (index < 0 || index >= ARRAY_COUNT(&pipeline->instances))
+		return NULL;
+	return &ARRAY_ELEMENT(&pipeline->instances, index)->run_stats;
+}
+
 void cras_dsp_pipeline_add_statistic(struct pipeline *pipeline,
 				     const struct timespec *time_delta,
 				     int samples)
@@ -835,8 +1392,12 @@ void cras_dsp_pipeline_add_statistic(struct pipeline *pipeline,
 	pipeline->total_time += t;
 }
 
-int cras_dsp_pipeline_apply(struct pipeline *pipeline, uint8_t *buf,
-			    snd_pcm_format_t format, unsigned int frames)
+/* Runs the pipeline over an interleaved buffer, scaling the output along the
+ * ramp described by scaler, increment and target if ramp is set. */
+static int apply_interleaved(struct pipeline *pipeline, uint8_t *buf,
+			     snd_pcm_format_t format, unsigned int frames,
+			     int ramp, float scaler, float increment,
+			     float target)
 {
 	size_t remaining;
 	size_t chunk;
@@ -845,6 +1406,7 @@ int cras_dsp_pipeline_apply(struct pipeline *pipeline, uint8_t *buf,
 	unsigned int output_channels = pipeline->output_channels;
 	float *source[input_channels];
 	float *sink[output_channels];
+	const struct instance *fused;
 	struct timespec begin, end, delta;
 	int rc;
 
@@ -860,10 +1422,15 @@ int cras_dsp_pipeline_apply(struct pipeline *pipeline, uint8_t *buf,
 		sink[i] = cras_dsp_pipeline_get_sink_buffer(pipeline, i);
 
 	remaining = frames;
+	/* The fused stereo op and the ramp both live in the interleave step,
+	 * run the fused instance on its own when ramping. */
+	fused = pipeline->fused_instance;
+	if (pipeline->has_sink_ext || ramp || flip_sink(pipeline, sink))
+		fused = NULL;
 
-	/* process at most DSP_BUFFER_SIZE frames each loop */
+	/* process at most block_size frames each loop */
 	while (remaining > 0) {
-		chunk = MIN(remaining, (size_t)DSP_BUFFER_SIZE);
+		chunk = MIN(remaining, (size_t)pipeline->block_size);
 
 		/* deinterleave and convert to float */
 		rc = dsp_util_deinterleave(buf, source, input_channels, format,
@@ -872,16 +1439,91 @@ int cras_dsp_pipeline_apply(struct pipeline *pipeline, uint8_t *buf,
 			return rc;
 
 		/* Run the pipeline */
-		cras_dsp_pipeline_run(pipeline, chunk);
+		run_instances(pipeline, chunk, fused);
 
 		/* interleave and convert back to int16_t */
-		rc = dsp_util_interleave(sink, buf, output_channels, format,
-					 chunk);
+		if (ramp)
+			rc = dsp_util_interleave_ramp(sink, buf,
+						      output_channels, format,
+						      chunk, scaler, increment,
+						      target);
+		else if (fused)
+			rc = dsp_util_interleave_stereo(pipeline->fused_input,
+							buf, pipeline->fused_op,
+							format, chunk);
+		else
+			rc = dsp_util_interleave(sink, buf, output_channels,
+						 format, chunk);
 		if (rc)
 			return rc;
 
 		buf += chunk * output_channels * PCM_FORMAT_WIDTH(format) / 8;
 		remaining -= chunk;
+		scaler += increment * chunk;
+	}
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+	subtract_timespecs(&end, &begin, &delta);
+	cras_dsp_pipeline_add_statistic(pipeline, &delta, frames);
+	return 0;
+}
+
+int cras_dsp_pipeline_apply(struct pipeline *pipeline, uint8_t *buf,
+			    snd_pcm_format_t format, unsigned int frames)
+{
+	return apply_interleaved(pipeline, buf, format, frames, 0, 1.0f, 0.0f,
+				 1.0f);
+}
+
+int cras_dsp_pipeline_apply_ramp(struct pipeline *pipeline, uint8_t *buf,
+				 snd_pcm_format_t format, unsigned int frames,
+				 float scaler, float increment, float target)
+{
+	return apply_interleaved(pipeline, buf, format, frames, 1, scaler,
+				 increment, target);
+}
+
+int cras_dsp_pipeline_apply_planar(struct pipeline *pipeline,
+				   float *const *input, float *const *output,
+				   unsigned int frames)
+{
+	size_t offset;
+	size_t chunk;
+	size_t i;
+	unsigned int input_channels;
+	unsigned int output_channels;
+	struct timespec begin, end, delta;
+
+	if (!pipeline || frames == 0)
+		return 0;
+
+	input_channels = pipeline->input_channels;
+	output_channels = pipeline->output_channels;
+	float *source[input_channels];
+	float *sink[output_channels];
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
+
+	for (i = 0; i < input_channels; i++)
+		source[i] = cras_dsp_pipeline_get_source_buffer(pipeline, i);
+	for (i = 0; i < output_channels; i++)
+		sink[i] = cras_dsp_pipeline_get_sink_buffer(pipeline, i);
+	flip_sink(pipeline, sink);
+
+	/* The fused stereo op only pays off when interleaving, so the whole
+	 * pipeline runs here. */
+	for (offset = 0; offset < frames; offset += chunk) {
+		chunk = MIN(frames - offset, (size_t)pipeline->block_size);
+
+		for (i = 0; i < input_channels; i++)
+			memcpy(source[i], input[i] + offset,
+			       chunk * sizeof(float));
+
+		run_instances(pipeline, chunk, NULL);
+
+		for (i = 0; i < output_channels; i++)
+			memcpy(output[i] + offset, sink[i],
+			       chunk * sizeof(float));
 	}
 
 	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
@@ -915,6 +1557,7 @@ void cras_dsp_pipeline_free(struct pipeline *pipeline)
 
 	pipeline->ini = NULL;
 	ARRAY_FREE(&pipeline->instances);
+	free(pipeline->jobs);
 
 	for (i = 0; i < pipeline->peak_buf; i++)
 		free(pipeline->buffers[i]);
@@ -958,6 +1601,23 @@ static void dump_control_ports(struct dumper *d, const char *name,
 	}
 }
 
+static void dump_run_stats(struct dumper *d, const struct dsp_run_stats *stats)
+{
+	int i;
+
+	if (!stats->runs)
+		return;
+	dumpf(d, "   runs=%" PRId64 ", avg=%" PRId64 "ns, max=%" PRId64 "ns\n",
+	      stats->runs, stats->total_time / stats->runs, stats->max_time);
+	dumpf(d, "   run time histogram (us):");
+	for (i = 0; i < DSP_RUN_TIME_BUCKETS - 1; i++)
+		if (stats->histogram[i])
+			dumpf(d, " <%d:%u", 1 << i, stats->histogram[i]);
+	if (stats->histogram[i])
+		dumpf(d, " >=%d:%u", 1 << (i - 1), stats->histogram[i]);
+	dumpf(d, "\n");
+}
+
 void cras_dsp_pipeline_dump(struct dumper *d, struct pipeline *pipeline)
 {
 	int i;
@@ -991,6 +1651,7 @@ void cras_dsp_pipeline_dump(struct dumper *d, struct pipeline *pipeline)
 		struct dsp_module *module = instance->module;
 		dumpf(d, "  [%d]%s mod=%p, total delay=%d\n", i,
 		      instance->plugin->title, module, instance->total_delay);
+		dump_run_stats(d, &instance->run_stats);
 		if (module)
 			module->dump(module, d);
 		dump_audio_ports(d, "input_audio_ports",
@@ -32,6 +32,7 @@ extern "C" {
  */
 #define DSP_BUFFER_SIZE 2048
 
+struct cras_mix_pool;
 struct pipeline;
 
 /* Creates a pipeline from the given ini file.
@@ -119,6 +120,32 @@ int cras_dsp_pipeline_get_peak_audio_buffers(struct pipeline *pipeline);
  * or 0 if is has not been called */
 int cras_dsp_pipeline_get_sample_rate(struct pipeline *pipeline);
 
+/* Sets an input control port of an instance while the pipeline runs. The
+ * value reaches the port before the next block, see controls_changed() in
+ * struct dsp_module. Can be called from one thread at a time, after
+ * cras_dsp_pipeline_load().
+ * Args:
+ *    title - The title of the plugin of the instance.
+ *    port - The index of the port in the plugin.
+ *    value - The new value of the port.
+ * Returns:
+ *    0 on success. -ENOENT if no instance has the title, -EINVAL if the
+ *    port is not an input control port set by the ini, -ENOTSUP if the
+ *    module can't change its controls while it runs, -EAGAIN if too many
+ *    values are waiting for the next block.
+ */
+int cras_dsp_pipeline_set_control(struct pipeline *pipeline,
+				  const char *title, unsigned int port,
+				  float value);
+
+/* Swaps the two output channels, as the swap_lr plugin does, without
+ * rebuilding the pipeline. The swap takes effect with the next apply call.
+ * Returns:
+ *    0 on success. -ENOTSUP if the pipeline has no swap_lr plugin feeding
+ *    its sink, or an ext module on its sink, it must be rebuilt then.
+ */
+int cras_dsp_pipeline_set_swap_lr(struct pipeline *pipeline, int enable);
+
 /* Gets the dsp ini that corresponds to the pipeline. */
 struct ini *cras_dsp_pipeline_get_ini(struct pipeline *pipeline);
 
@@ -126,6 +153,51 @@ struct ini *cras_dsp_pipeline_get_ini(struct pipeline *pipeline);
  * than DSP_BUFFER_SIZE */
 void cras_dsp_pipeline_run(struct pipeline *pipeline, int sample_count);
 
+/* Picks the number of frames processed per run by
+ * cras_dsp_pipeline_apply(), for audio coming in callbacks of cb_level
+ * frames. Larger blocks amortize the per run cost of every module, as long
+ * as the pipeline buffers still fit in the L2 cache. Must be called after
+ * cras_dsp_pipeline_load(), which picks a size for a cb_level of 0.
+ */
+void cras_dsp_pipeline_set_cb_level(struct pipeline *pipeline,
+				    unsigned int cb_level);
+
+/* Returns the number of frames processed per run. */
+unsigned int cras_dsp_pipeline_get_block_size(struct pipeline *pipeline);
+
+/* Sets the worker pool pipelines applied from the calling thread use to run
+ * independent instances in parallel from cras_dsp_pipeline_apply(). Pass NULL
+ * to run everything on the calling thread. Each audio thread sets its own. */
+void cras_dsp_pipeline_set_worker_pool(struct cras_mix_pool *pool);
+
+#define DSP_RUN_TIME_BUCKETS 12
+
+/* Run time of an instance of a pipeline, in nanoseconds.
+ * Members:
+ *    runs - The number of times the instance ran.
+ *    total_time - The time all runs took.
+ *    max_time - The time the slowest run took.
+ *    histogram - Bucket i counts the runs under 2^i microseconds which don't
+ *        fit a lower bucket. The last bucket counts the slower runs too.
+ */
+struct dsp_run_stats {
+	int64_t runs;
+	int64_t total_time;
+	int64_t max_time;
+	uint32_t histogram[DSP_RUN_TIME_BUCKETS];
+};
+
+/* Gets the run time of an instance of the pipeline. The time is only
+ * collected while the pipeline runs, so it is cheap enough to keep on.
+ * Args:
+ *    pipeline - The pipeline.
+ *    index - The index of the instance, in the order the dump lists them.
+ * Returns:
+ *    The run time of the instance, or NULL if there is no such instance.
+ */
+const struct dsp_run_stats *
+cras_dsp_pipeline_get_run_stats(struct pipeline *pipeline, int index);
+
 /* Add a statistic of running time for the pipeline.
  *
  * Args:
@@ -138,6 +210,8 @@ void cras_dsp_pipeline_add_statistic(struct pipeline *pipeline,
 				     int samples);
 
 /* Runs the specified pipeline across the given interleaved buffer in place.
+ * A SND_PCM_FORMAT_FLOAT_LE buffer, as the mix of a device opened in float
+ * is, is only copied in and out of the pipeline, without any conversion.
  * Args:
  *    pipeline - The pipeline to run.
  *    buf - The samples to be processed, interleaved.
@@ -149,6 +223,40 @@ void cras_dsp_pipeline_add_statistic(struct pipeline *pipeline,
 int cras_dsp_pipeline_apply(struct pipeline *pipeline, uint8_t *buf,
 			    snd_pcm_format_t format, unsigned int frames);
 
+/* Same as cras_dsp_pipeline_apply(), but also scales the processed samples
+ * along a ramp as they are written back, saving the caller another pass
+ * over the buffer to ramp or apply software volume.
+ * Args:
+ *    pipeline - The pipeline to run.
+ *    buf - The samples to be processed, interleaved.
+ *    format - Sample format of the buffer.
+ *    frames - the number of frames in the buffer.
+ *    scaler - Scaler applied to the first frame.
+ *    increment - The increment(+/-) of scaler at each frame.
+ *    target - The value at which to clip the scaler.
+ * Returns:
+ *    Negative code if error, otherwise 0.
+ */
+int cras_dsp_pipeline_apply_ramp(struct pipeline *pipeline, uint8_t *buf,
+				 snd_pcm_format_t format, unsigned int frames,
+				 float scaler, float increment, float target);
+
+/* Runs the specified pipeline on planar float samples, for callers that
+ * already hold float audio and would otherwise interleave it only to have
+ * cras_dsp_pipeline_apply() deinterleave it again.
+ * Args:
+ *    pipeline - The pipeline to run.
+ *    input - One pointer per input channel of the pipeline.
+ *    output - One pointer per output channel of the pipeline. May be the
+ *        same buffers as input.
+ *    frames - The number of frames in each channel.
+ * Returns:
+ *    Negative code if error, otherwise 0.
+ */
+int cras_dsp_pipeline_apply_planar(struct pipeline *pipeline,
+				   float *const *input, float *const *output,
+				   unsigned int frames);
+
 /* Dumps the current state of the pipeline. For debugging only */
 void cras_dsp_pipeline_dump(struct dumper *d, struct pipeline *pipeline);
 
@@ -13,6 +13,7 @@
 #include "cras_iodev_list.h"
 #include "cras_rstream.h"
 #include "cras_types.h"
+#include "cras_virtual_clock.h"
 #include "utlist.h"
 
 #define EMPTY_BUFFER_SIZE (32 * 1024)
@@ -38,7 +39,7 @@ struct empty_iodev {
 /*
  * Current level of the audio buffer.  This is made up based on what has been
  * read/written and how long it has been since the start. Simulates audio
- * hardware running at the given sample rate.
+ * hardware running at the given sample rate on the audio thread clock.
  */
 static unsigned int current_level(const struct cras_iodev *iodev)
 {
@@ -48,7 +49,7 @@ static unsigned int current_level(const struct cras_iodev *iodev)
 	if (iodev->active_node->type == CRAS_NODE_TYPE_HOTWORD)
 		return 0;
 
-	frames_since_start = cras_frames_since_time(
+	frames_since_start = cras_virtual_clock_frames_since(
 		&empty_iodev->dev_start_time, iodev->format->frame_rate);
 
 	if (iodev->direction == CRAS_STREAM_INPUT) {
@@ -69,7 +70,7 @@ static unsigned int current_level(const struct cras_iodev *iodev)
 static int frames_queued(const struct cras_iodev *iodev,
 			 struct timespec *tstamp)
 {
-	clock_gettime(CLOCK_MONOTONIC_RAW, tstamp);
+	cras_virtual_clock_gettime(tstamp);
 	return current_level(iodev);
 }
 
@@ -100,7 +101,7 @@ static int configure_dev(struct cras_iodev *iodev)
 	empty_iodev->read_frames = 0;
 	empty_iodev->written_frames = 0;
 
-	clock_gettime(CLOCK_MONOTONIC_RAW, &empty_iodev->dev_start_time);
+	cras_virtual_clock_gettime(&empty_iodev->dev_start_time);
 
 	return 0;
 }
@@ -155,7 +156,7 @@ static int flush_buffer(struct cras_iodev *iodev)
 	else
 		empty_iodev->written_frames = 0;
 
-	clock_gettime(CLOCK_MONOTONIC_RAW, &empty_iodev->dev_start_time);
+	cras_virtual_clock_gettime(&empty_iodev->dev_start_time);
 	return 0;
 }
 
@@ -54,7 +54,7 @@ static void cras_expr_value_set_function(struct cras_expr_value *value,
 }
 
 static void copy_value(struct cras_expr_value *value,
-		       struct cras_expr_value *original)
+		       const struct cras_expr_value *original)
 {
 	cras_expr_value_free(value); /* free the original value first */
 	value->type = original->type;
@@ -113,17 +113,27 @@ void cras_expr_value_dump(struct dumper *d, const struct cras_expr_value *value)
 	}
 }
 
-static struct cras_expr_value *find_value(struct cras_expr_env *env,
-					  const char *name)
+/* Returns the slot of the variable in the environment, -1 if not found. */
+static int find_slot(struct cras_expr_env *env, const char *name)
 {
 	int i;
 	const char **key;
 
 	ARRAY_ELEMENT_FOREACH (&env->keys, i, key) {
 		if (strcmp(*key, name) == 0)
-			return ARRAY_ELEMENT(&env->values, i);
+			return i;
 	}
-	return NULL;
+	return -1;
+}
+
+static struct cras_expr_value *find_value(struct cras_expr_env *env,
+					  const char *name)
+{
+	int slot = find_slot(env, name);
+
+	if (slot < 0)
+		return NULL;
+	return ARRAY_ELEMENT(&env->values, slot);
 }
 
 /* Insert a (key, value) pair to the environment. The value is
@@ -474,11 +484,191 @@ static struct cras_expr_expression *parse_one_expr(const char **str)
 	return NULL;
 }
 
+/*
+ * An expression flattened in postfix order. Evaluating it pushes literals and
+ * variables on a value stack and calls a function once all of its operands
+ * are on the stack, instead of walking the tree and allocating an operand
+ * array for every compound expression.
+ */
+enum expr_op_type {
+	EXPR_OP_LITERAL,
+	EXPR_OP_VARIABLE,
+	EXPR_OP_CALL,
+};
+
+/* One step of a program.
+ * Members:
+ *    literal - The value to push, owned by the expression tree.
+ *    variable.name - The name of the variable to push.
+ *    variable.slot - Where the variable was found in the environment last
+ *      time, so it's looked up by index instead of by name. -1 if unknown.
+ *    num_values - Number of values on the stack the call consumes, the
+ *      function itself included.
+ */
+struct expr_op {
+	enum expr_op_type type;
+	union {
+		const struct cras_expr_value *literal;
+		struct {
+			const char *name;
+			int slot;
+		} variable;
+		int num_values;
+	} u;
+};
+
+DECLARE_ARRAY_TYPE(struct expr_op, expr_op_array);
+
+struct cras_expr_program {
+	expr_op_array ops;
+	cras_expr_value_array stack;
+};
+
+/* Appends the ops of expr to ops. Returns the stack depth expr needs. */
+static int compile_one_expr(const struct cras_expr_expression *expr,
+			    expr_op_array *ops)
+{
+	struct expr_op *op;
+	int i, depth, max_depth;
+	struct cras_expr_expression **sub;
+
+	switch (expr->type) {
+	case EXPR_TYPE_NONE:
+		return 0;
+	case EXPR_TYPE_LITERAL:
+		op = ARRAY_APPEND_ZERO(ops);
+		op->type = EXPR_OP_LITERAL;
+		op->u.literal = &expr->u.literal;
+		return 1;
+	case EXPR_TYPE_VARIABLE:
+		op = ARRAY_APPEND_ZERO(ops);
+		op->type = EXPR_OP_VARIABLE;
+		op->u.variable.name = expr->u.variable;
+		op->u.variable.slot = -1;
+		return 1;
+	case EXPR_TYPE_COMPOUND:
+		max_depth = 1;
+		ARRAY_ELEMENT_FOREACH (&expr->u.children, i, sub) {
+			depth = i + compile_one_expr(*sub, ops);
+			if (depth > max_depth)
+				max_depth = depth;
+		}
+		op = ARRAY_APPEND_ZERO(ops);
+		op->type = EXPR_OP_CALL;
+		op->u.num_values = ARRAY_COUNT(&expr->u.children);
+		return max_depth;
+	}
+	return 0;
+}
+
+static struct cras_expr_program *
+compile_expr(const struct cras_expr_expression *expr)
+{
+	struct cras_expr_program *program;
+	int depth, i;
+
+	program = calloc(1, sizeof(*program));
+	if (!program)
+		return NULL;
+	depth = compile_one_expr(expr, &program->ops);
+	for (i = 0; i < depth; i++)
+		ARRAY_APPEND_ZERO(&program->stack);
+	return program;
+}
+
+static void free_program(struct cras_expr_program *program)
+{
+	if (!program)
+		return;
+	ARRAY_FREE(&program->ops);
+	ARRAY_FREE(&program->stack);
+	free(program);
+}
+
+/* Pushes the value of a variable, resolving it to its slot if needed. */
+static void push_variable(struct expr_op *op, struct cras_expr_env *env,
+			  struct cras_expr_value *value)
+{
+	int slot = op->u.variable.slot;
+
+	if (slot < 0 || slot >= ARRAY_COUNT(&env->keys) ||
+	    strcmp(*ARRAY_ELEMENT(&env->keys, slot), op->u.variable.name)) {
+		slot = find_slot(env, op->u.variable.name);
+		op->u.variable.slot = slot;
+	}
+	if (slot < 0) {
+		syslog(LOG_ERR, "cannot find value for %s",
+		       op->u.variable.name);
+		return;
+	}
+	copy_value(value, ARRAY_ELEMENT(&env->values, slot));
+}
+
+static void call_function(cras_expr_value_array *operands,
+			  struct cras_expr_value *result)
+{
+	struct cras_expr_value *f;
+
+	if (ARRAY_COUNT(operands) == 0) {
+		syslog(LOG_ERR, "empty compound expression?");
+		return;
+	}
+	f = ARRAY_ELEMENT(operands, 0);
+	if (f->type == CRAS_EXPR_VALUE_TYPE_FUNCTION)
+		f->u.function(operands, result);
+	else
+		syslog(LOG_ERR, "first element is not a function");
+}
+
+static void run_program(struct cras_expr_program *program,
+			struct cras_expr_env *env,
+			struct cras_expr_value *result)
+{
+	struct cras_expr_value *stack = program->stack.element;
+	struct cras_expr_value call_result;
+	cras_expr_value_array operands;
+	struct expr_op *op;
+	int sp = 0;
+	int i, j;
+
+	ARRAY_ELEMENT_FOREACH (&program->ops, i, op) {
+		switch (op->type) {
+		case EXPR_OP_LITERAL:
+			copy_value(&stack[sp++], op->u.literal);
+			break;
+		case EXPR_OP_VARIABLE:
+			push_variable(op, env, &stack[sp++]);
+			break;
+		case EXPR_OP_CALL:
+			sp -= op->u.num_values;
+			operands.count = op->u.num_values;
+			operands.size = op->u.num_values;
+			operands.element = &stack[sp];
+			memset(&call_result, 0, sizeof(call_result));
+			call_function(&operands, &call_result);
+			for (j = 0; j < op->u.num_values; j++)
+				cras_expr_value_free(&stack[sp + j]);
+			stack[sp++] = call_result;
+			break;
+		}
+	}
+
+	if (sp > 0) {
+		*result = stack[0];
+		stack[0].type = CRAS_EXPR_VALUE_TYPE_NONE;
+	}
+}
+
 struct cras_expr_expression *cras_expr_expression_parse(const char *str)
 {
+	struct cras_expr_expression *expr;
+
 	if (!str)
 		return NULL;
-	return parse_one_expr(&str);
+	expr = parse_one_expr(&str);
+	if (expr)
+		expr->program = compile_expr(expr);
+	return expr;
 }
 
 static void dump_value(struct dumper *d, const struct cras_expr_value *value,
@@ -541,6 +731,7 @@ void cras_expr_expression_free(struct cras_expr_expression *expr)
 	if (!expr)
 		return;
 
+	free_program(expr->program);
 	switch (expr->type) {
 	case EXPR_TYPE_NONE:
 		break;
@@ -569,6 +760,11 @@ void cras_expr_expression_eval(struct cras_expr_expression *expr,
 {
 	cras_expr_value_free(result);
 
+	if (expr->program) {
+		run_program(expr->program, env, result);
+		return;
+	}
+
 	switch (expr->type) {
 	case EXPR_TYPE_NONE:
 		break;
@@ -53,6 +53,8 @@ enum expr_type {
 
 DECLARE_ARRAY_TYPE(struct cras_expr_expression *, expr_array);
 
+struct cras_expr_program;
+
 struct cras_expr_expression {
 	enum expr_type type;
 	union {
@@ -60,6 +62,9 @@ struct cras_expr_expression {
 		const char *variable;
 		expr_array children;
 	} u;
+	/* The expression compiled to a flat program when it is parsed. Only
+	 * set on the outermost expression. */
+	struct cras_expr_program *program;
 };
 
 /* Environment */
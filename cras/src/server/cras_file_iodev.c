@@ -0,0 +1,272 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/param.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "cras_audio_area.h"
+#include "cras_file_iodev.h"
+#include "cras_iodev.h"
+#include "cras_iodev_list.h"
+#include "cras_types.h"
+#include "cras_util.h"
+#include "cras_virtual_clock.h"
+
+#define FILE_BUFFER_SIZE (32 * 1024)
+#define MAX_FILE_FRAME_SIZE 8
+#define FILE_FRAMES (FILE_BUFFER_SIZE / MAX_FILE_FRAME_SIZE)
+
+static size_t file_supported_rates[] = { 44100, 48000, 0 };
+
+static size_t file_supported_channel_counts[] = { 1, 2, 0 };
+
+static snd_pcm_format_t file_supported_formats[] = { SND_PCM_FORMAT_S16_LE,
+						     SND_PCM_FORMAT_S24_LE,
+						     SND_PCM_FORMAT_S32_LE, 0 };
+
+struct file_iodev {
+	struct cras_iodev base;
+	int fd;
+	/* Offset in the input file of the next frame to capture. */
+	off_t read_offset;
+	uint8_t *audio_buffer;
+	unsigned int fmt_bytes;
+	uint64_t read_frames, written_frames;
+	struct timespec dev_start_time;
+};
+
+/*
+ * Current level of the audio buffer. Like the empty iodev it is made up from
+ * what has been read/written and the time since the start, but on the audio
+ * thread clock so offline rendering runs the device faster than real time.
+ */
+static unsigned int current_level(const struct cras_iodev *iodev)
+{
+	struct file_iodev *fileio = (struct file_iodev *)iodev;
+	uint64_t frames_since_start, nframes;
+
+	frames_since_start = cras_virtual_clock_frames_since(
+		&fileio->dev_start_time, iodev->format->frame_rate);
+
+	if (iodev->direction == CRAS_STREAM_INPUT) {
+		nframes = frames_since_start - fileio->read_frames;
+		return MIN(nframes, FILE_FRAMES);
+	}
+
+	/* output */
+	if (fileio->written_frames <= frames_since_start)
+		return 0;
+	return fileio->written_frames - frames_since_start;
+}
+
+/*
+ * iodev callbacks.
+ */
+
+static int frames_queued(const struct cras_iodev *iodev,
+			 struct timespec *tstamp)
+{
+	cras_virtual_clock_gettime(tstamp);
+	return current_level(iodev);
+}
+
+static int delay_frames(const struct cras_iodev *iodev)
+{
+	return 0;
+}
+
+static int close_dev(struct cras_iodev *iodev)
+{
+	struct file_iodev *fileio = (struct file_iodev *)iodev;
+
+	free(fileio->audio_buffer);
+	fileio->audio_buffer = NULL;
+	cras_iodev_free_audio_area(iodev);
+	return 0;
+}
+
+static int configure_dev(struct cras_iodev *iodev)
+{
+	struct file_iodev *fileio = (struct file_iodev *)iodev;
+
+	if (iodev->format == NULL)
+		return -EINVAL;
+
+	cras_iodev_init_audio_area(iodev, iodev->format->num_channels);
+	fileio->audio_buffer = calloc(1, FILE_BUFFER_SIZE);
+	if (!fileio->audio_buffer)
+		return -ENOMEM;
+	fileio->fmt_bytes = cras_get_format_bytes(iodev->format);
+	fileio->read_frames = 0;
+	fileio->written_frames = 0;
+
+	cras_virtual_clock_gettime(&fileio->dev_start_time);
+
+	return 0;
+}
+
+static int get_buffer(struct cras_iodev *iodev, struct cras_audio_area **area,
+		      unsigned *frames)
+{
+	struct file_iodev *fileio = (struct file_iodev *)iodev;
+	size_t bytes;
+	ssize_t nread;
+
+	if (iodev->direction == CRAS_STREAM_OUTPUT) {
+		*frames = MIN(*frames, FILE_FRAMES - current_level(iodev));
+	} else {
+		*frames = MIN(*frames, current_level(iodev));
+
+		/* Past the end of the file the device captures silence. */
+		bytes = (size_t)*frames * fileio->fmt_bytes;
+		nread = pread(fileio->fd, fileio->audio_buffer, bytes,
+			      fileio->read_offset);
+		if (nread < 0)
+			nread = 0;
+		memset(fileio->audio_buffer + nread, 0, bytes - nread);
+	}
+
+	iodev->area->frames = *frames;
+	cras_audio_area_config_buf_pointers(iodev->area, iodev->format,
+					    fileio->audio_buffer);
+	*area = iodev->area;
+	return 0;
+}
+
+/*
+ * Returns -EPIPE if there are not enough frames or spaces in device buffer.
+ * It matches other alsa-based devices.
+ */
+static int put_buffer(struct cras_iodev *iodev, unsigned frames)
+{
+	struct file_iodev *fileio = (struct file_iodev *)iodev;
+	size_t bytes = (size_t)frames * fileio->fmt_bytes;
+
+	if (iodev->direction == CRAS_STREAM_INPUT) {
+		if (current_level(iodev) < frames)
+			return -EPIPE;
+		fileio->read_frames += frames;
+		fileio->read_offset += bytes;
+		return 0;
+	}
+
+	if (FILE_FRAMES - current_level(iodev) < frames)
+		return -EPIPE;
+	if (write(fileio->fd, fileio->audio_buffer, bytes) != (ssize_t)bytes) {
+		syslog(LOG_ERR, "Failed to write %zu bytes to render file",
+		       bytes);
+		return -EIO;
+	}
+	fileio->written_frames += frames;
+	return 0;
+}
+
+static int flush_buffer(struct cras_iodev *iodev)
+{
+	struct file_iodev *fileio = (struct file_iodev *)iodev;
+
+	if (iodev->direction == CRAS_STREAM_INPUT)
+		fileio->read_frames = 0;
+	else
+		fileio->written_frames = 0;
+
+	cras_virtual_clock_gettime(&fileio->dev_start_time);
+	return 0;
+}
+
+static void update_active_node(struct cras_iodev *iodev, unsigned node_idx,
+			       unsigned dev_enabled)
+{
+}
+
+/*
+ * Exported Interface.
+ */
+
+struct cras_iodev *file_iodev_create(enum CRAS_STREAM_DIRECTION direction,
+				     const char *path)
+{
+	struct file_iodev *fileio;
+	struct cras_iodev *iodev;
+	struct cras_ionode *node;
+
+	if (direction != CRAS_STREAM_INPUT && direction != CRAS_STREAM_OUTPUT)
+		return NULL;
+
+	fileio = calloc(1, sizeof(*fileio));
+	if (fileio == NULL)
+		return NULL;
+	if (direction == CRAS_STREAM_INPUT)
+		fileio->fd = open(path, O_RDONLY);
+	else
+		fileio->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fileio->fd < 0) {
+		syslog(LOG_ERR, "Failed to open %s: %d", path, errno);
+		free(fileio);
+		return NULL;
+	}
+	iodev = &fileio->base;
+	iodev->direction = direction;
+
+	iodev->supported_rates = file_supported_rates;
+	iodev->supported_channel_counts = file_supported_channel_counts;
+	iodev->supported_formats = file_supported_formats;
+	iodev->buffer_size = FILE_FRAMES;
+
+	iodev->configure_dev = configure_dev;
+	iodev->close_dev = close_dev;
+	iodev->frames_queued = frames_queued;
+	iodev->delay_frames = delay_frames;
+	iodev->get_buffer = get_buffer;
+	iodev->put_buffer = put_buffer;
+	iodev->flush_buffer = flush_buffer;
+	iodev->update_active_node = update_active_node;
+	iodev->no_stream = cras_iodev_default_no_stream_playback;
+
+	node = (struct cras_ionode *)calloc(1, sizeof(*node));
+	node->dev = iodev;
+	node->type = CRAS_NODE_TYPE_UNKNOWN;
+	node->plugged = 1;
+	node->volume = 100;
+	node->ui_gain_scaler = 1.0f;
+	strcpy(node->name, "(default)");
+	cras_iodev_add_node(iodev, node);
+	cras_iodev_set_active_node(iodev, node);
+
+	/*
+	 * Record max supported channels into cras_iodev_info.
+	 * The value is the max of file_supported_channel_counts.
+	 */
+	iodev->info.max_supported_channels = 2;
+
+	if (direction == CRAS_STREAM_INPUT) {
+		snprintf(iodev->info.name, ARRAY_SIZE(iodev->info.name),
+			 "File record device.");
+		cras_iodev_list_add_input(iodev);
+	} else {
+		snprintf(iodev->info.name, ARRAY_SIZE(iodev->info.name),
+			 "File playback device.");
+		cras_iodev_list_add_output(iodev);
+	}
+
+	return iodev;
+}
+
+void file_iodev_destroy(struct cras_iodev *iodev)
+{
+	struct file_iodev *fileio = (struct file_iodev *)iodev;
+
+	if (iodev->direction == CRAS_STREAM_INPUT)
+		cras_iodev_list_rm_input(iodev);
+	else
+		cras_iodev_list_rm_output(iodev);
+	close(fileio->fd);
+	free(iodev->active_node);
+	cras_iodev_free_resources(iodev);
+	free(fileio);
+}
@@ -0,0 +1,29 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_FILE_IODEV_H_
+#define CRAS_FILE_IODEV_H_
+
+#include "cras_types.h"
+
+struct cras_iodev;
+
+/* Initializes a file iodev for offline rendering. It runs at its sample rate
+ * on the audio thread clock like an empty iodev, but an output appends what
+ * it plays to the file and an input captures raw samples read from the file,
+ * and silence once the file ends.
+ * Args:
+ *    direction - input or output.
+ *    path - The raw audio file to read or create.
+ * Returns:
+ *    A pointer to the newly created iodev if successful, NULL otherwise.
+ */
+struct cras_iodev *file_iodev_create(enum CRAS_STREAM_DIRECTION direction,
+				     const char *path);
+
+/* Destroys a file_iodev created with file_iodev_create. */
+void file_iodev_destroy(struct cras_iodev *iodev);
+
+#endif /* CRAS_FILE_IODEV_H_ */
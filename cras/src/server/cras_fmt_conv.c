@@ -3,7 +3,7 @@
  * found in the LICENSE file.
  */
 
-/* For now just use speex, can add more resamplers later. */
+#include <pthread.h>
 #include <speex/speex_resampler.h>
 #include <sys/param.h>
 #include <syslog.h>
@@ -14,14 +14,16 @@
 #include "cras_fmt_conv.h"
 #include "cras_fmt_conv_ops.h"
 #include "cras_audio_format.h"
+#include "cras_channel_matrix.h"
+#include "cras_mix.h"
 #include "cras_util.h"
 #include "linear_resampler.h"
+#include "polyphase_resampler.h"
 
-/* The quality level is a value between 0 and 10. This is a tradeoff between
- * performance, latency, and quality. */
-#define SPEEX_QUALITY_LEVEL 4
 /* Max number of converters, src, down/up mix, 2xformat, and linear resample. */
 #define MAX_NUM_CONVERTERS 5
+/* Number of destroyed converters kept around for reuse. */
+#define CONV_POOL_SIZE 8
 /* Channel index for stereo. */
 #define STEREO_L 0
 #define STEREO_R 1
@@ -32,22 +34,526 @@ typedef size_t (*channel_converter_t)(struct cras_fmt_conv *conv,
 				      const uint8_t *in, size_t in_frames,
 				      uint8_t *out);
 
+/* A sample rate converter backend.
+ * Members:
+ *    create - Returns the state of a converter from in_rate to out_rate, or
+ *        NULL if the backend can't handle the rates.
+ *    destroy - Frees the state returned by create.
+ *    process_s16 - Converts interleaved S16_LE frames. in_frames and
+ *        out_frames are updated to the frames consumed and produced.
+ *    process_float - Same as process_s16 for float32 frames.
+ *    reset - Drops the buffered input so the next frames start from
+ *        silence, the filter tables are kept.
+ *    set_drift - Stretches the ratio as if the output rate was scaled by
+ *        to / from, keeping the buffered input, for clock drift.
+ */
+struct src_backend {
+	void *(*create)(unsigned int num_channels, unsigned int in_rate,
+			unsigned int out_rate, enum CRAS_SRC_QUALITY quality);
+	void (*destroy)(void *state);
+	void (*process_s16)(void *state, const int16_t *in, uint32_t *in_frames,
+			    int16_t *out, uint32_t *out_frames);
+	void (*process_float)(void *state, const float *in,
+			      uint32_t *in_frames, float *out,
+			      uint32_t *out_frames);
+	void (*reset)(void *state);
+	unsigned int (*get_delay)(void *state);
+	void (*set_drift)(void *state, float from, float to);
+};
+
 /* Member data for the resampler. */
 struct cras_fmt_conv {
-	SpeexResamplerState *speex_state;
+	const struct src_backend *src;
+	void *src_state;
+	enum CRAS_SRC_QUALITY src_quality;
 	channel_converter_t channel_converter;
 	float **ch_conv_mtx; /* Coefficient matrix for mixing channels. */
+	struct cras_channel_matrix *ch_matrix; /* Sparse form of the above. */
+	int pick_channels; /* Output channels may be picked from the input. */
+	unsigned int num_picked; /* Non-zero when picking instead of mixing. */
+	unsigned int picked_ch[CRAS_CH_MAX]; /* Input channel of each output. */
 	sample_format_converter_t in_format_converter;
 	sample_format_converter_t out_format_converter;
 	struct linear_resampler *resampler;
+	float drift_from; /* Output rates the SRC has been stretched by. */
+	float drift_to;
 	struct cras_audio_format in_fmt;
 	struct cras_audio_format out_fmt;
-	uint8_t *tmp_bufs[MAX_NUM_CONVERTERS - 1];
+	uint8_t *remix_buf; /* A frame before and after remixing. */
 	size_t tmp_buf_frames;
+	size_t tmp_buf_bytes; /* Size of each intermediate buffer. */
 	size_t pre_linear_resample;
 	size_t num_converters; /* Incremented once for SRC, channel, format. */
+	int float_path;
+	int reusable; /* Set when the converter can go back to conv_pool. */
+};
+
+/* Copies the input channels in picked_ch out of each frame, keeping the
+ * input sample format. */
+static void pick_channels(const struct cras_fmt_conv *conv, const uint8_t *in,
+			  size_t in_frames, uint8_t *out)
+{
+	size_t sample_bytes =
+		snd_pcm_format_physical_width(conv->in_fmt.format) / 8;
+	size_t in_ch = conv->in_fmt.num_channels;
+	unsigned int ch, n = conv->num_picked;
+	size_t i;
+
+	switch (sample_bytes) {
+	case 2: {
+		const int16_t *src = (const int16_t *)in;
+		int16_t *dst = (int16_t *)out;
+
+		for (i = 0; i < in_frames; i++, src += in_ch)
+			for (ch = 0; ch < n; ch++)
+				*dst++ = src[conv->picked_ch[ch]];
+		break;
+	}
+	case 4: {
+		const int32_t *src = (const int32_t *)in;
+		int32_t *dst = (int32_t *)out;
+
+		for (i = 0; i < in_frames; i++, src += in_ch)
+			for (ch = 0; ch < n; ch++)
+				*dst++ = src[conv->picked_ch[ch]];
+		break;
+	}
+	default:
+		for (i = 0; i < in_frames; i++, in += in_ch * sample_bytes)
+			for (ch = 0; ch < n; ch++, out += sample_bytes)
+				memcpy(out,
+				       in + conv->picked_ch[ch] * sample_bytes,
+				       sample_bytes);
+		break;
+	}
+}
+
+/* Looks up the input channel at the position of each output channel. Fails
+ * unless every output channel is found and all its positions agree. */
+static int get_picked_channels(const struct cras_audio_format *in,
+			       const struct cras_audio_format *out,
+			       unsigned int *picked)
+{
+	int8_t src[CRAS_CH_MAX];
+	unsigned int ch, i;
+
+	if (out->num_channels >= in->num_channels ||
+	    out->num_channels > CRAS_CH_MAX)
+		return -EINVAL;
+
+	for (i = 0; i < out->num_channels; i++)
+		src[i] = -1;
+	for (ch = 0; ch < CRAS_CH_MAX; ch++) {
+		if (out->channel_layout[ch] < 0 ||
+		    out->channel_layout[ch] >= (int)out->num_channels)
+			continue;
+		i = out->channel_layout[ch];
+		if (in->channel_layout[ch] < 0 ||
+		    (src[i] >= 0 && src[i] != in->channel_layout[ch]))
+			return -EINVAL;
+		src[i] = in->channel_layout[ch];
+	}
+	for (i = 0; i < out->num_channels; i++) {
+		if (src[i] < 0)
+			return -EINVAL;
+		picked[i] = src[i];
+	}
+	return 0;
+}
+
+/* Intermediate buffers of the conversions run on this thread. They are
+ * only used inside cras_fmt_conv_convert_frames(), so all the converters a
+ * thread runs share one block, grown to the largest of them, instead of each
+ * converter holding its own. The buffers of a conversion are laid out back
+ * to back from the start of the block, so small conversions touch few cache
+ * lines whatever ran before them.
+ *
+ * Threads converting on the real time path size the block up front with
+ * cras_fmt_conv_reserve_scratch(), to the largest converter created so far
+ * in scratch_needed. The block is also set as the value of scratch_key, so
+ * it is freed when the thread exits. */
+static __thread uint8_t *scratch;
+static __thread size_t scratch_bytes;
+static size_t scratch_needed;
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_key_once = PTHREAD_ONCE_INIT;
+
+static void create_scratch_key()
+{
+	pthread_key_create(&scratch_key, free);
+}
+
+/* Returns count buffers of bytes each, one after the other, in the scratch
+ * of this thread, or NULL if it can't grow to hold them. */
+static uint8_t *get_scratch(size_t bytes, unsigned int count)
+{
+	size_t total = count * bytes;
+	void *buf;
+
+	if (scratch_bytes >= total)
+		return scratch;
+	/* The old contents are dead between conversions, no need to copy. */
+	if (posix_memalign(&buf, CRAS_BUF_ALIGN, total))
+		return NULL;
+	free(scratch);
+	scratch = (uint8_t *)buf;
+	scratch_bytes = total;
+	pthread_once(&scratch_key_once, create_scratch_key);
+	pthread_setspecific(scratch_key, scratch);
+	return scratch;
+}
+
+/* Raises scratch_needed to bytes if it's lower. */
+static void note_scratch_needed(size_t bytes)
+{
+	size_t cur = __atomic_load_n(&scratch_needed, __ATOMIC_RELAXED);
+
+	while (cur < bytes &&
+	       !__atomic_compare_exchange_n(&scratch_needed, &cur, bytes, 0,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/* Converters released by cras_fmt_conv_destroy(), newest first, taken back
+ * by a create call with the same formats, max_frames and pre_linear_resample.
+ * This skips the buffer allocations and the resampler filter design when
+ * streams reattach on a device switch. Streams attach from the main thread
+ * and from the audio threads, so the pool is locked. */
+static struct cras_fmt_conv *conv_pool[CONV_POOL_SIZE];
+static pthread_mutex_t conv_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Polyphase FIR backend, for rate ratios small enough to precompute. */
+static void *polyphase_create(unsigned int num_channels, unsigned int in_rate,
+			      unsigned int out_rate,
+			      enum CRAS_SRC_QUALITY quality)
+{
+	unsigned int taps;
+
+	switch (quality) {
+	case CRAS_SRC_QUALITY_LOW_LATENCY:
+		taps = 16;
+		break;
+	case CRAS_SRC_QUALITY_HIGH:
+		taps = 64;
+		break;
+	default:
+		taps = 32;
+		break;
+	}
+	return polyphase_resampler_create(num_channels, in_rate, out_rate,
+					  taps);
+}
+
+static void polyphase_destroy(void *state)
+{
+	polyphase_resampler_destroy((struct polyphase_resampler *)state);
+}
+
+static void polyphase_process_s16(void *state, const int16_t *in,
+				  uint32_t *in_frames, int16_t *out,
+				  uint32_t *out_frames)
+{
+	polyphase_resampler_process_s16((struct polyphase_resampler *)state,
+					in, in_frames, out, out_frames);
+}
+
+static void polyphase_process_float(void *state, const float *in,
+				    uint32_t *in_frames, float *out,
+				    uint32_t *out_frames)
+{
+	polyphase_resampler_process_float((struct polyphase_resampler *)state,
+					  in, in_frames, out, out_frames);
+}
+
+static void polyphase_reset(void *state)
+{
+	polyphase_resampler_reset((struct polyphase_resampler *)state);
+}
+
+static unsigned int polyphase_get_delay(void *state)
+{
+	return polyphase_resampler_get_delay(
+		(struct polyphase_resampler *)state);
+}
+
+static void polyphase_set_drift(void *state, float from, float to)
+{
+	polyphase_resampler_set_drift((struct polyphase_resampler *)state, from,
+				      to);
+}
+
+/* Speex backend, handles any pair of rates. The quality level is a value
+ * between 0 and 10. This is a tradeoff between performance, latency, and
+ * quality. */
+static void *speex_create(unsigned int num_channels, unsigned int in_rate,
+			  unsigned int out_rate, enum CRAS_SRC_QUALITY quality)
+{
+	SpeexResamplerState *state;
+	int level, rc;
+
+	switch (quality) {
+	case CRAS_SRC_QUALITY_LOW_LATENCY:
+		level = 2;
+		break;
+	case CRAS_SRC_QUALITY_HIGH:
+		level = 7;
+		break;
+	default:
+		level = 4;
+		break;
+	}
+	state = speex_resampler_init(num_channels, in_rate, out_rate, level,
+				     &rc);
+	if (state == NULL)
+		syslog(LOG_ERR, "Fail to create speex:%u %u %u %d",
+		       num_channels, in_rate, out_rate, rc);
+	return state;
+}
+
+static void speex_destroy(void *state)
+{
+	speex_resampler_destroy((SpeexResamplerState *)state);
+}
+
+static void speex_process_s16(void *state, const int16_t *in,
+			      uint32_t *in_frames, int16_t *out,
+			      uint32_t *out_frames)
+{
+	speex_resampler_process_interleaved_int((SpeexResamplerState *)state,
+						in, in_frames, out, out_frames);
+}
+
+static void speex_process_float(void *state, const float *in,
+				uint32_t *in_frames, float *out,
+				uint32_t *out_frames)
+{
+	speex_resampler_process_interleaved_float((SpeexResamplerState *)state,
+						  in, in_frames, out,
+						  out_frames);
+}
+
+static void speex_reset(void *state)
+{
+	speex_resampler_reset_mem((SpeexResamplerState *)state);
+}
+
+static unsigned int speex_get_delay(void *state)
+{
+	return speex_resampler_get_input_latency((SpeexResamplerState *)state);
+}
+
+/* Speex takes the ratio as a fraction of 32 bit integers, the rates are
+ * kept to a hundredth of a Hz like the linear resampler does. */
+static void speex_set_drift(void *state, float from, float to)
+{
+	SpeexResamplerState *st = (SpeexResamplerState *)state;
+	spx_uint32_t in_rate, out_rate;
+	uint64_t num, den, a, b;
+
+	speex_resampler_get_rate(st, &in_rate, &out_rate);
+	num = (uint64_t)in_rate * (uint64_t)(from * 100);
+	den = (uint64_t)out_rate * (uint64_t)(to * 100);
+	for (a = num, b = den; b;) {
+		uint64_t t = a % b;
+		a = b;
+		b = t;
+	}
+	num /= a;
+	den /= a;
+	while (num > UINT32_MAX || den > UINT32_MAX) {
+		num >>= 1;
+		den >>= 1;
+	}
+	speex_resampler_set_rate_frac(st, num, den, in_rate, out_rate);
+}
+
+/* Linear interpolation backend, far cheaper than the filters and far
+ * noisier. Only taken when asked for explicitly, for any pair of rates. */
+struct linear_src {
+	struct linear_resampler *s16;
+	struct linear_resampler *f32;
+	unsigned int in_rate;
+	unsigned int out_rate;
+};
+
+static void linear_destroy(void *state)
+{
+	struct linear_src *src = (struct linear_src *)state;
+
+	linear_resampler_destroy(src->s16);
+	linear_resampler_destroy(src->f32);
+	free(src);
+}
+
+static void *linear_create(unsigned int num_channels, unsigned int in_rate,
+			   unsigned int out_rate, enum CRAS_SRC_QUALITY quality)
+{
+	struct linear_src *src;
+
+	if (quality != CRAS_SRC_QUALITY_LINEAR)
+		return NULL;
+
+	src = (struct linear_src *)calloc(1, sizeof(*src));
+	if (!src)
+		return NULL;
+	src->in_rate = in_rate;
+	src->out_rate = out_rate;
+	src->s16 = linear_resampler_create(
+		num_channels, num_channels * sizeof(int16_t), in_rate,
+		out_rate);
+	src->f32 = linear_resampler_create_float(num_channels, in_rate,
+						 out_rate);
+	if (!src->s16 || !src->f32) {
+		linear_destroy(src);
+		return NULL;
+	}
+	return src;
+}
+
+static void linear_process_s16(void *state, const int16_t *in,
+			       uint32_t *in_frames, int16_t *out,
+			       uint32_t *out_frames)
+{
+	struct linear_src *src = (struct linear_src *)state;
+	unsigned int frames = *in_frames;
+
+	*out_frames = linear_resampler_resample(src->s16, (uint8_t *)in,
+						&frames, (uint8_t *)out,
+						*out_frames);
+	*in_frames = frames;
+}
+
+static void linear_process_float(void *state, const float *in,
+				 uint32_t *in_frames, float *out,
+				 uint32_t *out_frames)
+{
+	struct linear_src *src = (struct linear_src *)state;
+	unsigned int frames = *in_frames;
+
+	*out_frames = linear_resampler_resample(src->f32, (uint8_t *)in,
+						&frames, (uint8_t *)out,
+						*out_frames);
+	*in_frames = frames;
+}
+
+static void linear_reset(void *state)
+{
+	struct linear_src *src = (struct linear_src *)state;
+
+	linear_resampler_set_rates(src->s16, src->in_rate, src->out_rate);
+	linear_resampler_set_rates(src->f32, src->in_rate, src->out_rate);
+}
+
+/* Interpolation looks ahead by a single frame. */
+static unsigned int linear_get_delay(void *state)
+{
+	return 1;
+}
+
+static void linear_set_drift(void *state, float from, float to)
+{
+	struct linear_src *src = (struct linear_src *)state;
+	float out_rate = src->out_rate * to / from;
+
+	linear_resampler_set_rates(src->s16, src->in_rate, out_rate);
+	linear_resampler_set_rates(src->f32, src->in_rate, out_rate);
+}
+
+static const struct src_backend linear_backend = {
+	.create = linear_create,
+	.destroy = linear_destroy,
+	.process_s16 = linear_process_s16,
+	.process_float = linear_process_float,
+	.reset = linear_reset,
+	.get_delay = linear_get_delay,
+	.set_drift = linear_set_drift,
 };
 
+static const struct src_backend polyphase_backend = {
+	.create = polyphase_create,
+	.destroy = polyphase_destroy,
+	.process_s16 = polyphase_process_s16,
+	.process_float = polyphase_process_float,
+	.reset = polyphase_reset,
+	.get_delay = polyphase_get_delay,
+	.set_drift = polyphase_set_drift,
+};
+
+static const struct src_backend speex_backend = {
+	.create = speex_create,
+	.destroy = speex_destroy,
+	.process_s16 = speex_process_s16,
+	.process_float = speex_process_float,
+	.reset = speex_reset,
+	.get_delay = speex_get_delay,
+	.set_drift = speex_set_drift,
+};
+
+/* Backends in order of preference, speex is the catch all. The linear one
+ * declines the qualities other than CRAS_SRC_QUALITY_LINEAR. */
+static const struct src_backend *const src_backends[] = {
+	&linear_backend,
+	&polyphase_backend,
+	&speex_backend,
+};
+
+/* Creates the sample rate converter with the first backend that supports
+ * the rates of conv. Returns 0 on success or -ENOMEM. */
+static int create_src(struct cras_fmt_conv *conv)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(src_backends); i++) {
+		conv->src_state = src_backends[i]->create(
+			conv->out_fmt.num_channels, conv->in_fmt.frame_rate,
+			conv->out_fmt.frame_rate, conv->src_quality);
+		if (conv->src_state) {
+			conv->src = src_backends[i];
+			if (conv->drift_from != conv->drift_to)
+				conv->src->set_drift(conv->src_state,
+						     conv->drift_from,
+						     conv->drift_to);
+			return 0;
+		}
+	}
+	conv->src = NULL;
+	return -ENOMEM;
+}
+
+static void destroy_src(struct cras_fmt_conv *conv)
+{
+	if (conv->src_state)
+		conv->src->destroy(conv->src_state);
+	conv->src = NULL;
+	conv->src_state = NULL;
+}
+
+static const struct cras_fmt_conv_ops *ops = &fmt_conv_ops;
+
+static const struct cras_fmt_conv_ops *
+get_fmt_conv_ops(unsigned int cpu_flags)
+{
+#if defined HAVE_FMA
+	if (cpu_flags & CPU_X86_FMA)
+		return &fmt_conv_ops_fma;
+#endif
+#if defined HAVE_AVX2
+	if (cpu_flags & CPU_X86_AVX2)
+		return &fmt_conv_ops_avx2;
+#endif
+#if defined HAVE_AVX
+	if (cpu_flags & CPU_X86_AVX)
+		return &fmt_conv_ops_avx;
+#endif
+#if defined HAVE_SSE42
+	if (cpu_flags & CPU_X86_SSE4_2)
+		return &fmt_conv_ops_sse42;
+#endif
+
+	/* default C implementation */
+	return &fmt_conv_ops;
+}
+
 static int is_channel_layout_equal(const struct cras_audio_format *a,
 				   const struct cras_audio_format *b)
 {
@@ -174,22 +680,63 @@ static int is_supported_format(const struct cras_audio_format *fmt)
 	case SND_PCM_FORMAT_S24_3LE:
 	case SND_PCM_FORMAT_S24_LE:
 	case SND_PCM_FORMAT_S32_LE:
+	case SND_PCM_FORMAT_FLOAT_LE:
 		return 1;
 	default:
 		return 0;
 	}
 }
 
+static sample_format_converter_t to_f32_converter(snd_pcm_format_t format)
+{
+	switch (format) {
+	case SND_PCM_FORMAT_U8:
+		return ops->convert_u8_to_f32le;
+	case SND_PCM_FORMAT_S16_LE:
+		return ops->convert_s16le_to_f32le;
+	case SND_PCM_FORMAT_S24_LE:
+		return ops->convert_s24le_to_f32le;
+	case SND_PCM_FORMAT_S32_LE:
+		return ops->convert_s32le_to_f32le;
+	case SND_PCM_FORMAT_S24_3LE:
+		return ops->convert_s243le_to_f32le;
+	default:
+		return NULL;
+	}
+}
+
+static sample_format_converter_t from_f32_converter(snd_pcm_format_t format)
+{
+	switch (format) {
+	case SND_PCM_FORMAT_U8:
+		return ops->convert_f32le_to_u8;
+	case SND_PCM_FORMAT_S16_LE:
+		return ops->convert_f32le_to_s16le;
+	case SND_PCM_FORMAT_S24_LE:
+		return ops->convert_f32le_to_s24le;
+	case SND_PCM_FORMAT_S32_LE:
+		return ops->convert_f32le_to_s32le;
+	case SND_PCM_FORMAT_S24_3LE:
+		return ops->convert_f32le_to_s243le;
+	default:
+		return NULL;
+	}
+}
+
 static size_t mono_to_stereo(struct cras_fmt_conv *conv, const uint8_t *in,
 			     size_t in_frames, uint8_t *out)
 {
-	return s16_mono_to_stereo(in, in_frames, out);
+	if (conv->float_path)
+		return ops->f32_mono_to_stereo(in, in_frames, out);
+	return ops->s16_mono_to_stereo(in, in_frames, out);
 }
 
 static size_t stereo_to_mono(struct cras_fmt_conv *conv, const uint8_t *in,
 			     size_t in_frames, uint8_t *out)
 {
-	return s16_stereo_to_mono(in, in_frames, out);
+	if (conv->float_path)
+		return ops->f32_stereo_to_mono(in, in_frames, out);
+	return ops->s16_stereo_to_mono(in, in_frames, out);
 }
 
 static size_t mono_to_51(struct cras_fmt_conv *conv, const uint8_t *in,
@@ -201,7 +748,10 @@ static size_t mono_to_51(struct cras_fmt_conv *conv, const uint8_t *in,
 	right = conv->out_fmt.channel_layout[CRAS_CH_FR];
 	center = conv->out_fmt.channel_layout[CRAS_CH_FC];
 
-	return s16_mono_to_51(left, right, center, in, in_frames, out);
+	if (conv->float_path)
+		return ops->f32_mono_to_51(left, right, center, in, in_frames,
+					   out);
+	return ops->s16_mono_to_51(left, right, center, in, in_frames, out);
 }
 
 static size_t stereo_to_51(struct cras_fmt_conv *conv, const uint8_t *in,
@@ -213,19 +763,26 @@ static size_t stereo_to_51(struct cras_fmt_conv *conv, const uint8_t *in,
 	right = conv->out_fmt.channel_layout[CRAS_CH_FR];
 	center = conv->out_fmt.channel_layout[CRAS_CH_FC];
 
-	return s16_stereo_to_51(left, right, center, in, in_frames, out);
+	if (conv->float_path)
+		return ops->f32_stereo_to_51(left, right, center, in, in_frames,
+					     out);
+	return ops->s16_stereo_to_51(left, right, center, in, in_frames, out);
 }
 
 static size_t _51_to_stereo(struct cras_fmt_conv *conv, const uint8_t *in,
 			    size_t in_frames, uint8_t *out)
 {
-	return s16_51_to_stereo(in, in_frames, out);
+	if (conv->float_path)
+		return ops->f32_51_to_stereo(in, in_frames, out);
+	return ops->s16_51_to_stereo(in, in_frames, out);
 }
 
 static size_t _51_to_quad(struct cras_fmt_conv *conv, const uint8_t *in,
 			  size_t in_frames, uint8_t *out)
 {
-	return s16_51_to_quad(in, in_frames, out);
+	if (conv->float_path)
+		return ops->f32_51_to_quad(in, in_frames, out);
+	return ops->s16_51_to_quad(in, in_frames, out);
 }
 
 static size_t stereo_to_quad(struct cras_fmt_conv *conv, const uint8_t *in,
@@ -238,8 +795,12 @@ static size_t stereo_to_quad(struct cras_fmt_conv *conv, const uint8_t *in,
 	rear_left = conv->out_fmt.channel_layout[CRAS_CH_RL];
 	rear_right = conv->out_fmt.channel_layout[CRAS_CH_RR];
 
-	return s16_stereo_to_quad(front_left, front_right, rear_left,
-				  rear_right, in, in_frames, out);
+	if (conv->float_path)
+		return ops->f32_stereo_to_quad(front_left, front_right,
+					       rear_left, rear_right, in,
+					       in_frames, out);
+	return ops->s16_stereo_to_quad(front_left, front_right, rear_left,
+				       rear_right, in, in_frames, out);
 }
 
 static size_t quad_to_stereo(struct cras_fmt_conv *conv, const uint8_t *in,
@@ -252,8 +813,12 @@ static size_t quad_to_stereo(struct cras_fmt_conv *conv, const uint8_t *in,
 	rear_left = conv->in_fmt.channel_layout[CRAS_CH_RL];
 	rear_right = conv->in_fmt.channel_layout[CRAS_CH_RR];
 
-	return s16_quad_to_stereo(front_left, front_right, rear_left,
-				  rear_right, in, in_frames, out);
+	if (conv->float_path)
+		return ops->f32_quad_to_stereo(front_left, front_right,
+					       rear_left, rear_right, in,
+					       in_frames, out);
+	return ops->s16_quad_to_stereo(front_left, front_right, rear_left,
+				       rear_right, in, in_frames, out);
 }
 
 static size_t default_all_to_all(struct cras_fmt_conv *conv, const uint8_t *in,
@@ -264,8 +829,11 @@ static size_t default_all_to_all(struct cras_fmt_conv *conv, const uint8_t *in,
 	num_in_ch = conv->in_fmt.num_channels;
 	num_out_ch = conv->out_fmt.num_channels;
 
-	return s16_default_all_to_all(&conv->out_fmt, num_in_ch, num_out_ch, in,
-				      in_frames, out);
+	if (conv->float_path)
+		return ops->f32_default_all_to_all(num_in_ch, num_out_ch, in,
+						   in_frames, out);
+	return ops->s16_default_all_to_all(&conv->out_fmt, num_in_ch,
+					   num_out_ch, in, in_frames, out);
 }
 
 // Fill min(in channels, out_channels), leave the rest 0s.
@@ -279,44 +847,207 @@ static size_t default_some_to_some(struct cras_fmt_conv *conv,
 	num_in_ch = conv->in_fmt.num_channels;
 	num_out_ch = conv->out_fmt.num_channels;
 
-	return s16_some_to_some(&conv->out_fmt, num_in_ch, num_out_ch, in,
-				in_frames, out);
+	if (conv->float_path)
+		return ops->f32_some_to_some(num_in_ch, num_out_ch, in,
+					     in_frames, out);
+	return ops->s16_some_to_some(&conv->out_fmt, num_in_ch, num_out_ch, in,
+				     in_frames, out);
 }
 
 static size_t convert_channels(struct cras_fmt_conv *conv, const uint8_t *in,
 			       size_t in_frames, uint8_t *out)
 {
-	float **ch_conv_mtx;
-	size_t num_in_ch, num_out_ch;
-
-	ch_conv_mtx = conv->ch_conv_mtx;
-	num_in_ch = conv->in_fmt.num_channels;
-	num_out_ch = conv->out_fmt.num_channels;
-
-	return s16_convert_channels(ch_conv_mtx, num_in_ch, num_out_ch, in,
-				    in_frames, out);
+	if (conv->float_path)
+		return ops->f32_sparse_convert_channels(conv->ch_matrix, in,
+							in_frames, out);
+	return ops->s16_sparse_convert_channels(conv->ch_matrix, in, in_frames,
+						out);
 }
 
 /*
- * Exported interface
+ * Returns the number of sample format converters that can be skipped. When
+ * the float path has nothing to do between decode and encode the samples can
+ * be passed through in their original format.
  */
+static unsigned int skippable_format_converters(const struct cras_fmt_conv *conv)
+{
+	/* Picking channels keeps the sample format, so it doesn't stop the
+	 * format converters from being skipped. */
+	if (!conv->float_path || conv->in_fmt.format != conv->out_fmt.format ||
+	    conv->channel_converter || conv->src_state ||
+	    linear_resampler_needed(conv->resampler))
+		return 0;
+	return !!conv->in_format_converter + !!conv->out_format_converter;
+}
 
-struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
-					   const struct cras_audio_format *out,
-					   size_t max_frames,
-					   size_t pre_linear_resample)
+/* Runs the pre linear resampler from buffers[buf_idx] into
+ * buffers[buf_idx + 1]. Returns the number of frames resampled. */
+static unsigned int pre_linear_resample_frames(struct cras_fmt_conv *conv,
+					       uint8_t *in, uint8_t *out,
+					       unsigned int *in_frames,
+					       size_t out_frames)
+{
+	unsigned resample_limit = out_frames;
+
+	/* If there is a 2nd fmt conversion we should convert the
+	 * resample limit and round it to the lower bound in order
+	 * not to convert too many frames in the pre linear resampler.
+	 */
+	if (conv->src_state != NULL) {
+		resample_limit = resample_limit * conv->in_fmt.frame_rate /
+				 conv->out_fmt.frame_rate;
+		/*
+		 * However if the limit frames count is less than
+		 * |out_rate / in_rate|, the final limit value could be
+		 * rounded to zero so it confuses linear resampler to
+		 * do nothing. Make sure it's non-zero in that case.
+		 */
+		if (resample_limit == 0)
+			resample_limit = 1;
+	}
+
+	resample_limit = MIN(resample_limit, conv->tmp_buf_frames);
+	return linear_resampler_resample(conv->resampler, in, in_frames, out,
+					 resample_limit);
+}
+
+/* Returns the number of frames the SRC makes of in_frames, including the
+ * drift its ratio is stretched by. */
+static size_t src_frames_to_out(const struct cras_fmt_conv *conv,
+				size_t in_frames)
+{
+	if (conv->drift_from == conv->drift_to)
+		return cras_frames_at_rate(conv->in_fmt.frame_rate, in_frames,
+					   conv->out_fmt.frame_rate);
+	return ceil((double)in_frames * conv->out_fmt.frame_rate *
+		    conv->drift_to /
+		    (conv->in_fmt.frame_rate * conv->drift_from));
+}
+
+/* The inverse of src_frames_to_out(). */
+static size_t src_frames_to_in(const struct cras_fmt_conv *conv,
+			       size_t out_frames)
+{
+	if (conv->drift_from == conv->drift_to)
+		return cras_frames_at_rate(conv->out_fmt.frame_rate,
+					   out_frames, conv->in_fmt.frame_rate);
+	return ceil((double)out_frames * conv->in_fmt.frame_rate *
+		    conv->drift_from /
+		    (conv->out_fmt.frame_rate * conv->drift_to));
+}
+
+static int is_format_equal(const struct cras_audio_format *a,
+			   const struct cras_audio_format *b)
+{
+	return a->format == b->format && a->frame_rate == b->frame_rate &&
+	       a->num_channels == b->num_channels &&
+	       is_channel_layout_equal(a, b);
+}
+
+/* Takes a converter matching the arguments out of conv_pool and rewinds its
+ * resamplers. Returns NULL if there is none. */
+static struct cras_fmt_conv *
+conv_pool_take(const struct cras_audio_format *in,
+	       const struct cras_audio_format *out, size_t max_frames,
+	       size_t pre_linear_resample, enum CRAS_SRC_QUALITY src_quality,
+	       int pick_channels)
+{
+	struct cras_fmt_conv *conv = NULL;
+	unsigned int i;
+
+	pthread_mutex_lock(&conv_pool_mutex);
+	for (i = 0; i < CONV_POOL_SIZE; i++) {
+		struct cras_fmt_conv *c = conv_pool[i];
+
+		if (c && c->tmp_buf_frames == max_frames &&
+		    c->pre_linear_resample == pre_linear_resample &&
+		    c->src_quality == src_quality &&
+		    c->pick_channels == pick_channels &&
+		    is_format_equal(&c->in_fmt, in) &&
+		    is_format_equal(&c->out_fmt, out)) {
+			conv = c;
+			conv_pool[i] = NULL;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&conv_pool_mutex);
+
+	if (!conv)
+		return NULL;
+	if (conv->src_state) {
+		conv->src->reset(conv->src_state);
+		if (conv->drift_from != conv->drift_to)
+			conv->src->set_drift(conv->src_state, out->frame_rate,
+					     out->frame_rate);
+	}
+	conv->drift_from = conv->drift_to = out->frame_rate;
+	linear_resampler_set_rates(conv->resampler, out->frame_rate,
+				   out->frame_rate);
+	return conv;
+}
+
+static void fmt_conv_free(struct cras_fmt_conv *conv)
+{
+	if (conv->ch_conv_mtx)
+		cras_channel_conv_matrix_destroy(conv->ch_conv_mtx,
+						 conv->out_fmt.num_channels);
+	cras_channel_matrix_destroy(conv->ch_matrix);
+	destroy_src(conv);
+	if (conv->resampler)
+		linear_resampler_destroy(conv->resampler);
+	free(conv->remix_buf);
+	free(conv);
+}
+
+/* Puts conv in conv_pool, or frees it if it can't be reused. When the pool
+ * is full the oldest converter in it is freed to make room. */
+static void conv_pool_put(struct cras_fmt_conv *conv)
+{
+	struct cras_fmt_conv *evicted;
+	unsigned int i;
+
+	if (!conv->reusable) {
+		fmt_conv_free(conv);
+		return;
+	}
+
+	pthread_mutex_lock(&conv_pool_mutex);
+	for (i = 0; i < CONV_POOL_SIZE - 1 && conv_pool[i]; i++)
+		;
+	evicted = conv_pool[i];
+	memmove(&conv_pool[1], &conv_pool[0], i * sizeof(conv_pool[0]));
+	conv_pool[0] = conv;
+	pthread_mutex_unlock(&conv_pool_mutex);
+
+	if (evicted)
+		fmt_conv_free(evicted);
+}
+
+
+static struct cras_fmt_conv *
+fmt_conv_create(const struct cras_audio_format *in,
+		const struct cras_audio_format *out, size_t max_frames,
+		size_t pre_linear_resample, enum CRAS_SRC_QUALITY src_quality,
+		int pick_channels)
 {
 	struct cras_fmt_conv *conv;
-	int rc;
 	unsigned i;
 
+	conv = conv_pool_take(in, out, max_frames, pre_linear_resample,
+			      src_quality, pick_channels);
+	if (conv)
+		return conv;
+
 	conv = calloc(1, sizeof(*conv));
 	if (conv == NULL)
 		return NULL;
 	conv->in_fmt = *in;
 	conv->out_fmt = *out;
 	conv->tmp_buf_frames = max_frames;
+	conv->drift_from = conv->drift_to = out->frame_rate;
 	conv->pre_linear_resample = pre_linear_resample;
+	conv->src_quality = src_quality;
+	conv->pick_channels = pick_channels;
 
 	if (!is_supported_format(in)) {
 		syslog(LOG_ERR, "Invalid input format %d", in->format);
@@ -330,52 +1061,21 @@ struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 		return NULL;
 	}
 
-	/* Set up sample format conversion. */
-	/* TODO(dgreid) - modify channel and sample rate conversion so
-	 * converting to s16 isnt necessary. */
-	if (in->format != SND_PCM_FORMAT_S16_LE) {
-		conv->num_converters++;
-		syslog(LOG_DEBUG, "Convert from format %d to %d.", in->format,
-		       out->format);
-		switch (in->format) {
-		case SND_PCM_FORMAT_U8:
-			conv->in_format_converter = convert_u8_to_s16le;
-			break;
-		case SND_PCM_FORMAT_S24_LE:
-			conv->in_format_converter = convert_s24le_to_s16le;
-			break;
-		case SND_PCM_FORMAT_S32_LE:
-			conv->in_format_converter = convert_s32le_to_s16le;
-			break;
-		case SND_PCM_FORMAT_S24_3LE:
-			conv->in_format_converter = convert_s243le_to_s16le;
-			break;
-		default:
-			syslog(LOG_ERR, "Should never reachable");
-			break;
-		}
-	}
-	if (out->format != SND_PCM_FORMAT_S16_LE) {
-		conv->num_converters++;
+	/* Set up sample format conversion. Streams that are S16_LE end to
+	 * end keep the integer path. Anything wider is decoded once to float32,
+	 * converted in the float domain, and encoded once to the output
+	 * format so no precision is lost to an intermediate S16 stage. */
+	conv->float_path = in->format != SND_PCM_FORMAT_S16_LE ||
+			   out->format != SND_PCM_FORMAT_S16_LE;
+	if (conv->float_path) {
 		syslog(LOG_DEBUG, "Convert from format %d to %d.", in->format,
 		       out->format);
-		switch (out->format) {
-		case SND_PCM_FORMAT_U8:
-			conv->out_format_converter = convert_s16le_to_u8;
-			break;
-		case SND_PCM_FORMAT_S24_LE:
-			conv->out_format_converter = convert_s16le_to_s24le;
-			break;
-		case SND_PCM_FORMAT_S32_LE:
-			conv->out_format_converter = convert_s16le_to_s32le;
-			break;
-		case SND_PCM_FORMAT_S24_3LE:
-			conv->out_format_converter = convert_s16le_to_s243le;
-			break;
-		default:
-			syslog(LOG_ERR, "Should never reachable");
-			break;
-		}
+		conv->in_format_converter = to_f32_converter(in->format);
+		if (conv->in_format_converter)
+			conv->num_converters++;
+		conv->out_format_converter = from_f32_converter(out->format);
+		if (conv->out_format_converter)
+			conv->num_converters++;
 	}
 
 	/* Set up channel number conversion. */
@@ -386,7 +1086,11 @@ struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 
 		/* Populate the conversion matrix base on in/out channel count
 		 * and layout. */
-		if (in->num_channels == 1 && out->num_channels == 2) {
+		if (pick_channels &&
+		    get_picked_channels(in, out, conv->picked_ch) == 0) {
+			/* Dropped first, before any other converter. */
+			conv->num_picked = out->num_channels;
+		} else if (in->num_channels == 1 && out->num_channels == 2) {
 			conv->channel_converter = mono_to_stereo;
 		} else if (in->num_channels == 1 && out->num_channels == 6) {
 			conv->channel_converter = mono_to_51;
@@ -435,6 +1139,13 @@ struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 				else
 					conv->channel_converter = _51_to_stereo;
 			}
+		} else if ((conv->ch_matrix =
+				    cras_channel_matrix_create_from_layouts(
+					    in, out))) {
+			/* Both layouts are known, mix channels by position. */
+			syslog(LOG_DEBUG, "Using layout map for %zu to %zu",
+			       in->num_channels, out->num_channels);
+			conv->channel_converter = convert_channels;
 		} else if (in->num_channels <= 8 && out->num_channels <= 8) {
 			// For average channel counts mix from all to all.
 			syslog(LOG_WARNING,
@@ -459,19 +1170,26 @@ struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 			conv->channel_converter = convert_channels;
 		}
 	}
+	/* Apply dense matrices through their sparse form, only the non-zero
+	 * coefficients cost anything per frame. */
+	if (conv->ch_conv_mtx) {
+		conv->ch_matrix = cras_channel_matrix_create(
+			conv->ch_conv_mtx, in->num_channels, out->num_channels);
+		cras_channel_conv_matrix_destroy(conv->ch_conv_mtx,
+						 out->num_channels);
+		conv->ch_conv_mtx = NULL;
+		if (conv->ch_matrix == NULL) {
+			cras_fmt_conv_destroy(&conv);
+			return NULL;
+		}
+	}
+
 	/* Set up sample rate conversion. */
 	if (in->frame_rate != out->frame_rate) {
 		conv->num_converters++;
 		syslog(LOG_DEBUG, "Convert from %zu to %zu Hz.", in->frame_rate,
 		       out->frame_rate);
-		conv->speex_state =
-			speex_resampler_init(out->num_channels, in->frame_rate,
-					     out->frame_rate,
-					     SPEEX_QUALITY_LEVEL, &rc);
-		if (conv->speex_state == NULL) {
-			syslog(LOG_ERR, "Fail to create speex:%zu %zu %zu %d",
-			       out->num_channels, in->frame_rate,
-			       out->frame_rate, rc);
+		if (create_src(conv)) {
 			cras_fmt_conv_destroy(&conv);
 			return NULL;
 		}
@@ -486,10 +1204,13 @@ struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 	 * rate for inaccurate device consumption rate.
 	 */
 	conv->num_converters++;
-	conv->resampler =
-		linear_resampler_create(out->num_channels,
-					cras_get_format_bytes(out),
-					out->frame_rate, out->frame_rate);
+	if (conv->float_path)
+		conv->resampler = linear_resampler_create_float(
+			out->num_channels, out->frame_rate, out->frame_rate);
+	else
+		conv->resampler = linear_resampler_create(
+			out->num_channels, cras_get_format_bytes(out),
+			out->frame_rate, out->frame_rate);
 	if (conv->resampler == NULL) {
 		syslog(LOG_ERR, "Fail to create linear resampler");
 		cras_fmt_conv_destroy(&conv);
@@ -497,37 +1218,59 @@ struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 	}
 
 	/* Need num_converters-1 temp buffers, the final converter renders
-	 * directly into the output. */
-	for (i = 0; i < conv->num_converters - 1; i++) {
-		conv->tmp_bufs[i] = malloc(
-			max_frames * 4 * /* width in bytes largest format. */
-			MAX(in->num_channels, out->num_channels));
-		if (conv->tmp_bufs[i] == NULL) {
-			cras_fmt_conv_destroy(&conv);
-			return NULL;
-		}
-	}
+	 * directly into the output. They come from the scratch of the thread
+	 * converting. */
+	conv->tmp_buf_bytes = CRAS_BUF_ALIGN_UP(
+		max_frames * 4 * /* width of largest format. */
+		MAX(in->num_channels, out->num_channels));
+	note_scratch_needed(conv->tmp_buf_bytes * (conv->num_converters - 1));
 
 	assert(conv->num_converters <= MAX_NUM_CONVERTERS);
 
+	conv->reusable = 1;
 	return conv;
 }
 
-void cras_fmt_conv_destroy(struct cras_fmt_conv **convp)
+/*
+ * Exported interface
+ */
+
+void cras_fmt_conv_init(unsigned int cpu_flags)
 {
-	unsigned i;
-	struct cras_fmt_conv *conv = *convp;
+	ops = get_fmt_conv_ops(cpu_flags);
+}
 
-	if (conv->ch_conv_mtx)
-		cras_channel_conv_matrix_destroy(conv->ch_conv_mtx,
-						 conv->out_fmt.num_channels);
-	if (conv->speex_state)
-		speex_resampler_destroy(conv->speex_state);
-	if (conv->resampler)
-		linear_resampler_destroy(conv->resampler);
-	for (i = 0; i < MAX_NUM_CONVERTERS - 1; i++)
-		free(conv->tmp_bufs[i]);
-	free(conv);
+size_t cras_fmt_conv_get_scratch_bytes()
+{
+	return scratch_bytes;
+}
+
+size_t cras_fmt_conv_get_scratch_needed()
+{
+	return __atomic_load_n(&scratch_needed, __ATOMIC_RELAXED);
+}
+
+int cras_fmt_conv_reserve_scratch()
+{
+	size_t bytes = cras_fmt_conv_get_scratch_needed();
+
+	if (bytes && !get_scratch(bytes, 1))
+		return -ENOMEM;
+	return 0;
+}
+
+struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
+					   const struct cras_audio_format *out,
+					   size_t max_frames,
+					   size_t pre_linear_resample)
+{
+	return fmt_conv_create(in, out, max_frames, pre_linear_resample,
+			       CRAS_SRC_QUALITY_DEFAULT, 0);
+}
+
+void cras_fmt_conv_destroy(struct cras_fmt_conv **convp)
+{
+	conv_pool_put(*convp);
 	*convp = NULL;
 }
 
@@ -552,8 +1295,8 @@ struct cras_fmt_conv *cras_channel_remix_conv_create(unsigned int num_channels,
 				coefficient[in_ch + out_ch * num_channels];
 
 	conv->num_converters = 1;
-	conv->tmp_bufs[0] = malloc(4 * /* width in bytes largest format. */
-				   num_channels);
+	/* Room for one decoded and one remixed float frame. */
+	conv->remix_buf = malloc(2 * sizeof(float) * num_channels);
 	return conv;
 }
 
@@ -562,28 +1305,59 @@ void cras_channel_remix_convert(struct cras_fmt_conv *conv,
 				uint8_t *in_buf, size_t nframes)
 {
 	unsigned ch, fr;
-	int16_t *tmp = (int16_t *)conv->tmp_bufs[0];
-	int16_t *buf = (int16_t *)in_buf;
+	size_t num_channels = conv->in_fmt.num_channels;
+	size_t frame_bytes;
+	sample_format_converter_t decode, encode;
+	float *ftmp;
 
-	/*
-	 * Skip remix for non S16_LE format.
-	 * TODO(tzungbi): support 24 bits remix convert.
-	 */
-	if (fmt->format != SND_PCM_FORMAT_S16_LE)
+	/* Do remix only when input buffer has the same number of channels. */
+	if (fmt->num_channels != num_channels)
 		return;
 
-	/* Do remix only when input buffer has the same number of channels. */
-	if (fmt->num_channels != conv->in_fmt.num_channels)
+	if (fmt->format == SND_PCM_FORMAT_S16_LE) {
+		int16_t *tmp = (int16_t *)conv->remix_buf;
+		int16_t *buf = (int16_t *)in_buf;
+
+		for (fr = 0; fr < nframes; fr++) {
+			for (ch = 0; ch < num_channels; ch++)
+				tmp[ch] = ops->s16_multiply_buf_with_coef(
+					conv->ch_conv_mtx[ch], buf,
+					num_channels);
+			for (ch = 0; ch < num_channels; ch++)
+				buf[ch] = tmp[ch];
+			buf += num_channels;
+		}
+		return;
+	}
+
+	if (!is_supported_format(fmt))
 		return;
 
+	/* Wider formats are remixed in float, one frame at a time. The first
+	 * half of the tmp buffer holds the decoded frame, the second half the
+	 * remixed one. */
+	decode = to_f32_converter(fmt->format);
+	encode = from_f32_converter(fmt->format);
+	frame_bytes = cras_get_format_bytes(fmt);
+	ftmp = (float *)conv->remix_buf;
 	for (fr = 0; fr < nframes; fr++) {
-		for (ch = 0; ch < conv->in_fmt.num_channels; ch++)
-			tmp[ch] = s16_multiply_buf_with_coef(
-				conv->ch_conv_mtx[ch], buf,
-				conv->in_fmt.num_channels);
-		for (ch = 0; ch < conv->in_fmt.num_channels; ch++)
-			buf[ch] = tmp[ch];
-		buf += conv->in_fmt.num_channels;
+		float *frame = ftmp;
+
+		if (decode)
+			decode(in_buf, num_channels, (uint8_t *)ftmp);
+		else
+			frame = (float *)in_buf;
+		for (ch = 0; ch < num_channels; ch++)
+			ftmp[num_channels + ch] =
+				ops->f32_multiply_buf_with_coef(
+					conv->ch_conv_mtx[ch], frame,
+					num_channels);
+		if (encode)
+			encode((uint8_t *)(ftmp + num_channels), num_channels,
+			       in_buf);
+		else
+			memcpy(in_buf, ftmp + num_channels, frame_bytes);
+		in_buf += frame_bytes;
 	}
 }
 
@@ -608,8 +1382,7 @@ size_t cras_fmt_conv_in_frames_to_out(struct cras_fmt_conv *conv,
 	if (conv->pre_linear_resample)
 		in_frames = linear_resampler_in_frames_to_out(conv->resampler,
 							      in_frames);
-	in_frames = cras_frames_at_rate(conv->in_fmt.frame_rate, in_frames,
-					conv->out_fmt.frame_rate);
+	in_frames = src_frames_to_out(conv, in_frames);
 	if (!conv->pre_linear_resample)
 		in_frames = linear_resampler_in_frames_to_out(conv->resampler,
 							      in_frames);
@@ -624,20 +1397,78 @@ size_t cras_fmt_conv_out_frames_to_in(struct cras_fmt_conv *conv,
 	if (!conv->pre_linear_resample)
 		out_frames = linear_resampler_out_frames_to_in(conv->resampler,
 							       out_frames);
-	out_frames = cras_frames_at_rate(conv->out_fmt.frame_rate, out_frames,
-					 conv->in_fmt.frame_rate);
+	out_frames = src_frames_to_in(conv, out_frames);
 	if (conv->pre_linear_resample)
 		out_frames = linear_resampler_out_frames_to_in(conv->resampler,
 							       out_frames);
 	return out_frames;
 }
 
+size_t cras_fmt_conv_get_delay(const struct cras_fmt_conv *conv)
+{
+	if (!conv || !conv->src_state)
+		return 0;
+	return conv->src->get_delay(conv->src_state);
+}
+
 void cras_fmt_conv_set_linear_resample_rates(struct cras_fmt_conv *conv,
 					     float from, float to)
 {
+	/* A stream converting rates has the drift folded into the ratio of
+	 * its SRC, so every frame is filtered once. Steps under a hundredth
+	 * of a Hz are dropped, as the linear resampler would. */
+	if (conv->src_state) {
+		if ((unsigned int)(from * 100) ==
+			    (unsigned int)(conv->drift_from * 100) &&
+		    (unsigned int)(to * 100) ==
+			    (unsigned int)(conv->drift_to * 100))
+			return;
+		conv->drift_from = from;
+		conv->drift_to = to;
+		conv->src->set_drift(conv->src_state, from, to);
+		return;
+	}
 	linear_resampler_set_rates(conv->resampler, from, to);
 }
 
+int cras_fmt_conv_set_src_quality(struct cras_fmt_conv *conv,
+				  enum CRAS_SRC_QUALITY quality)
+{
+	if (conv->src_quality == quality)
+		return 0;
+
+	conv->src_quality = quality;
+	if (!conv->src_state)
+		return 0;
+
+	destroy_src(conv);
+	return create_src(conv);
+}
+
+int cras_fmt_conv_set_channel_matrix(struct cras_fmt_conv *conv,
+				     const struct cras_channel_matrix *list)
+{
+	const struct cras_channel_matrix *m;
+	struct cras_channel_matrix *copy;
+
+	if (!conv->channel_converter)
+		return 0;
+	m = cras_channel_matrix_find(list, conv->in_fmt.num_channels,
+				     conv->out_fmt.num_channels);
+	if (!m)
+		return 0;
+
+	copy = cras_channel_matrix_dup(m);
+	if (!copy)
+		return -ENOMEM;
+	cras_channel_matrix_destroy(conv->ch_matrix);
+	conv->ch_matrix = copy;
+	conv->channel_converter = convert_channels;
+	/* The matrix came from the board config, not from the formats. */
+	conv->reusable = 0;
+	return 0;
+}
+
 size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 				    const uint8_t *in_buf, uint8_t *out_buf,
 				    unsigned int *in_frames, size_t out_frames)
@@ -650,6 +1481,10 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 	unsigned int post_linear_resample = 0;
 	unsigned int pre_linear_resample = 0;
 	unsigned int linear_resample_fr = 0;
+	unsigned int skip_format;
+	size_t in_channels;
+	uint8_t *tmp = NULL;
+	unsigned int i;
 
 	assert(conv);
 	assert(*in_frames <= conv->tmp_buf_frames);
@@ -660,7 +1495,7 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 	}
 
 	/* If no SRC, then in_frames should = out_frames. */
-	if (conv->speex_state == NULL) {
+	if (conv->src_state == NULL) {
 		fr_in = MIN(*in_frames, out_frames);
 		if (out_frames < *in_frames && !logged_frames_dont_fit) {
 			syslog(LOG_INFO, "fmt_conv: %u to %zu no SRC.",
@@ -671,57 +1506,75 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 		fr_in = *in_frames;
 	}
 	fr_out = fr_in;
+	in_channels = conv->num_picked ?: conv->in_fmt.num_channels;
 
 	/* Set up a chain of buffers.  The output buffer of the first conversion
 	 * is used as input to the second and so forth, ending in the output
 	 * buffer. */
 	if (!linear_resampler_needed(conv->resampler))
 		used_converters--;
+	skip_format = skippable_format_converters(conv);
+	used_converters -= skip_format;
+	if (used_converters == 0) {
+		if (out_buf != in_buf)
+			memcpy(out_buf, in_buf,
+			       fr_in * cras_get_format_bytes(&conv->in_fmt));
+		*in_frames = fr_in;
+		return fr_in;
+	}
 
-	buffers[4] = (uint8_t *)conv->tmp_bufs[3];
-	buffers[3] = (uint8_t *)conv->tmp_bufs[2];
-	buffers[2] = (uint8_t *)conv->tmp_bufs[1];
-	buffers[1] = (uint8_t *)conv->tmp_bufs[0];
+	/* A single converter goes straight from the input to the output. */
+	if (used_converters > 1) {
+		tmp = get_scratch(conv->tmp_buf_bytes, used_converters - 1);
+		if (!tmp) {
+			syslog(LOG_ERR,
+			       "fmt_conv: no memory for %zu byte buffers",
+			       conv->tmp_buf_bytes);
+			*in_frames = 0;
+			return 0;
+		}
+	}
+	for (i = 1; i < used_converters; i++)
+		buffers[i] = tmp + (i - 1) * conv->tmp_buf_bytes;
 	buffers[0] = (uint8_t *)in_buf;
 	buffers[used_converters] = out_buf;
 
-	if (pre_linear_resample) {
-		linear_resample_fr = fr_in;
-		unsigned resample_limit = out_frames;
-
-		/* If there is a 2nd fmt conversion we should convert the
-		 * resample limit and round it to the lower bound in order
-		 * not to convert too many frames in the pre linear resampler.
-		 */
-		if (conv->speex_state != NULL) {
-			resample_limit = resample_limit *
-					 conv->in_fmt.frame_rate /
-					 conv->out_fmt.frame_rate;
-			/*
-			 * However if the limit frames count is less than
-			 * |out_rate / in_rate|, the final limit value could be
-			 * rounded to zero so it confuses linear resampler to
-			 * do nothing. Make sure it's non-zero in that case.
-			 */
-			if (resample_limit == 0)
-				resample_limit = 1;
-		}
+	/* Drop the input channels nothing reads, so the converters after
+	 * this only work on the rest. */
+	if (conv->num_picked) {
+		pick_channels(conv, buffers[buf_idx], fr_in,
+			      buffers[buf_idx + 1]);
+		buf_idx++;
+	}
 
-		resample_limit = MIN(resample_limit, conv->tmp_buf_frames);
-		fr_in = linear_resampler_resample(
-			conv->resampler, buffers[buf_idx], &linear_resample_fr,
-			buffers[buf_idx + 1], resample_limit);
+	/* The integer path resamples the raw input, the float path resamples
+	 * after the input has been decoded to float. */
+	if (pre_linear_resample && !conv->float_path) {
+		linear_resample_fr = fr_in;
+		fr_in = pre_linear_resample_frames(conv, buffers[buf_idx],
+						   buffers[buf_idx + 1],
+						   &linear_resample_fr,
+						   out_frames);
 		buf_idx++;
 	}
 
-	/* If the input format isn't S16_LE convert to it. */
-	if (conv->in_fmt.format != SND_PCM_FORMAT_S16_LE) {
+	/* Convert the input to S16_LE or float. */
+	if (conv->in_format_converter && !skip_format) {
 		conv->in_format_converter(buffers[buf_idx],
-					  fr_in * conv->in_fmt.num_channels,
+					  fr_in * in_channels,
 					  (uint8_t *)buffers[buf_idx + 1]);
 		buf_idx++;
 	}
 
+	if (pre_linear_resample && conv->float_path) {
+		linear_resample_fr = fr_in;
+		fr_in = pre_linear_resample_frames(conv, buffers[buf_idx],
+						   buffers[buf_idx + 1],
+						   &linear_resample_fr,
+						   out_frames);
+		buf_idx++;
+	}
+
 	/* Then channel conversion. */
 	if (conv->channel_converter != NULL) {
 		conv->channel_converter(conv, buffers[buf_idx], fr_in,
@@ -730,14 +1583,13 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 	}
 
 	/* Then SRC. */
-	if (conv->speex_state != NULL) {
+	if (conv->src_state != NULL) {
 		unsigned int out_limit = out_frames;
 
 		if (post_linear_resample)
 			out_limit = linear_resampler_out_frames_to_in(
 				conv->resampler, out_limit);
-		fr_out = cras_frames_at_rate(conv->in_fmt.frame_rate, fr_in,
-					     conv->out_fmt.frame_rate);
+		fr_out = src_frames_to_out(conv, fr_in);
 		if (fr_out > out_frames + 1 && !logged_frames_dont_fit) {
 			syslog(LOG_INFO,
 			       "fmt_conv: put %u frames in %zu sized buffer",
@@ -746,9 +1598,18 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 		}
 		/* limit frames to the output size. */
 		fr_out = MIN(fr_out, out_limit);
-		speex_resampler_process_interleaved_int(
-			conv->speex_state, (int16_t *)buffers[buf_idx], &fr_in,
-			(int16_t *)buffers[buf_idx + 1], &fr_out);
+		if (conv->float_path)
+			conv->src->process_float(conv->src_state,
+						 (float *)buffers[buf_idx],
+						 &fr_in,
+						 (float *)buffers[buf_idx + 1],
+						 &fr_out);
+		else
+			conv->src->process_s16(conv->src_state,
+					       (int16_t *)buffers[buf_idx],
+					       &fr_in,
+					       (int16_t *)buffers[buf_idx + 1],
+					       &fr_out);
 		buf_idx++;
 	}
 
@@ -761,8 +1622,8 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 		buf_idx++;
 	}
 
-	/* If the output format isn't S16_LE convert to it. */
-	if (conv->out_fmt.format != SND_PCM_FORMAT_S16_LE) {
+	/* Convert from S16_LE or float to the output format. */
+	if (conv->out_format_converter && !skip_format) {
 		conv->out_format_converter(buffers[buf_idx],
 					   fr_out * conv->out_fmt.num_channels,
 					   (uint8_t *)buffers[buf_idx + 1]);
@@ -781,7 +1642,7 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 		 * leak and, if accumulated, causes delay in multiple devices
 		 * use case.
 		 */
-		if (conv->speex_state && (fr_in == 0))
+		if (conv->src_state && (fr_in == 0))
 			*in_frames = 0;
 	} else {
 		*in_frames = fr_in;
@@ -792,7 +1653,62 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 int cras_fmt_conversion_needed(const struct cras_fmt_conv *conv)
 {
 	return linear_resampler_needed(conv->resampler) ||
-	       (conv->num_converters > 1);
+	       (conv->num_converters - skippable_format_converters(conv) > 1);
+}
+
+static int is_mono_front(const struct cras_audio_format *fmt)
+{
+	return fmt->num_channels == 1 && (fmt->channel_layout[CRAS_CH_FC] == 0 ||
+					  fmt->channel_layout[CRAS_CH_FL] == 0);
+}
+
+void cras_fmt_conv_capture_channels(struct cras_audio_format *fmt,
+				    const struct cras_audio_format *stream_fmt)
+{
+	int8_t new_idx[CRAS_CH_MAX];
+	unsigned int ch, i, kept = 0;
+
+	if (fmt->num_channels <= stream_fmt->num_channels ||
+	    fmt->num_channels > CRAS_CH_MAX)
+		return;
+
+	for (i = 0; i < fmt->num_channels; i++)
+		new_idx[i] = -1;
+	for (ch = 0; ch < CRAS_CH_MAX; ch++) {
+		int wanted;
+
+		if (is_mono_front(stream_fmt))
+			wanted = ch == CRAS_CH_FL || ch == CRAS_CH_FR;
+		else
+			wanted = stream_fmt->channel_layout[ch] >= 0 &&
+				 stream_fmt->channel_layout[ch] <
+					 (int)stream_fmt->num_channels;
+		if (wanted && fmt->channel_layout[ch] >= 0 &&
+		    fmt->channel_layout[ch] < (int)fmt->num_channels)
+			new_idx[fmt->channel_layout[ch]] = 0;
+	}
+	for (i = 0; i < fmt->num_channels; i++)
+		if (new_idx[i] == 0)
+			new_idx[i] = kept++;
+	if (kept == 0 || kept == fmt->num_channels)
+		return;
+
+	/* A single channel left at FL or FC would be read as FL and FR. */
+	if (kept == 1 && !is_mono_front(stream_fmt)) {
+		for (ch = 0; ch < CRAS_CH_MAX; ch++)
+			if ((ch == CRAS_CH_FL || ch == CRAS_CH_FC) &&
+			    fmt->channel_layout[ch] >= 0 &&
+			    fmt->channel_layout[ch] < (int)fmt->num_channels &&
+			    new_idx[(int)fmt->channel_layout[ch]] == 0)
+				return;
+	}
+
+	for (ch = 0; ch < CRAS_CH_MAX; ch++)
+		if (fmt->channel_layout[ch] >= 0 &&
+		    fmt->channel_layout[ch] < (int)fmt->num_channels)
+			fmt->channel_layout[ch] =
+				new_idx[(int)fmt->channel_layout[ch]];
+	fmt->num_channels = kept;
 }
 
 /* If the server cannot provide the requested format, configures an audio format
@@ -802,16 +1718,17 @@ int config_format_converter(struct cras_fmt_conv **conv,
 			    enum CRAS_STREAM_DIRECTION dir,
 			    const struct cras_audio_format *from,
 			    const struct cras_audio_format *to,
-			    unsigned int frames)
+			    unsigned int frames, enum CRAS_SRC_QUALITY quality)
 {
 	struct cras_audio_format target;
 
-	/* For input, preserve the channel count and layout of
-	 * from format */
+	/* For input, preserve the layout of from format on the channels the
+	 * stream reads, the rest are dropped before converting. */
 	if (dir == CRAS_STREAM_INPUT) {
 		target = *from;
 		target.format = to->format;
 		target.frame_rate = to->frame_rate;
+		cras_fmt_conv_capture_channels(&target, to);
 	} else {
 		target = *to;
 	}
@@ -821,8 +1738,9 @@ int config_format_converter(struct cras_fmt_conv **conv,
 	       "frames = %u",
 	       from->format, from->frame_rate, from->num_channels,
 	       target.format, target.frame_rate, target.num_channels, frames);
-	*conv = cras_fmt_conv_create(from, &target, frames,
-				     (dir == CRAS_STREAM_INPUT));
+	*conv = fmt_conv_create(from, &target, frames,
+				(dir == CRAS_STREAM_INPUT), quality,
+				(dir == CRAS_STREAM_INPUT));
 	if (!*conv) {
 		syslog(LOG_ERR, "Failed to create format converter");
 		return -ENOMEM;
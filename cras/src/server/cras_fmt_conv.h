@@ -4,8 +4,9 @@
  */
 
 /*
- * Used to convert from one audio format to another.  Currently only supports
- * sample rate conversion with the speex backend.
+ * Used to convert from one audio format to another.  Sample rate conversion
+ * uses a polyphase FIR for rate ratios that reduce to few phases, e.g.
+ * 44.1kHz <-> 48kHz or 8/16kHz <-> 48kHz, and the speex backend otherwise.
  */
 #ifndef CRAS_FMT_CONV_H_
 #define CRAS_FMT_CONV_H_
@@ -16,8 +17,32 @@
 #include "cras_types.h"
 
 struct cras_audio_format;
+struct cras_channel_matrix;
 struct cras_fmt_conv;
 
+/* Selects the format and channel converter implementation for the CPU.
+ * Converters created afterwards use it.
+ * Args:
+ *    cpu_flags - CPU_X86_* flags reported by the server.
+ */
+void cras_fmt_conv_init(unsigned int cpu_flags);
+
+/* Returns the memory the calling thread holds for the intermediate buffers
+ * of the conversions it ran. Converters share them per thread. */
+size_t cras_fmt_conv_get_scratch_bytes();
+
+/* Returns the scratch memory the largest converter created so far needs. */
+size_t cras_fmt_conv_get_scratch_needed();
+
+/* Grows the scratch of the calling thread to what the converters created so
+ * far need, so its next conversions don't allocate. Real time threads call
+ * this between wakes, after streams or devices are added. The scratch is
+ * freed when the thread exits.
+ * Returns:
+ *    0 on success, or -ENOMEM.
+ */
+int cras_fmt_conv_reserve_scratch();
+
 /* Create and destroy format converters. */
 struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 					   const struct cras_audio_format *out,
@@ -60,9 +85,37 @@ size_t cras_fmt_conv_in_frames_to_out(struct cras_fmt_conv *conv,
 /* Get the number of input frames that will result from converting out_frames */
 size_t cras_fmt_conv_out_frames_to_in(struct cras_fmt_conv *conv,
 				      size_t out_frames);
-/* Sets the input and output rate to the linear resampler. */
+/* Get the delay of the sample rate converter in input frames, 0 if the
+ * converter doesn't change the rate. The linear resampler is not counted,
+ * it holds no more than a frame. */
+size_t cras_fmt_conv_get_delay(const struct cras_fmt_conv *conv);
+/* Adjusts the conversion for clock drift, as if the output rate was scaled
+ * by to / from. A converter that also changes the sample rate stretches
+ * the ratio of its SRC, others run the linear resampler from from to to. */
 void cras_fmt_conv_set_linear_resample_rates(struct cras_fmt_conv *conv,
 					     float from, float to);
+/* Sets the latency and quality trade off of the sample rate converter. The
+ * converter restarts, so this should be called before converting frames.
+ * Args:
+ *    conv - The format converter.
+ *    quality - The new quality setting.
+ * Returns:
+ *    0 on success, negative error code if the converter can't be recreated,
+ *    in which case conv must be destroyed.
+ */
+int cras_fmt_conv_set_src_quality(struct cras_fmt_conv *conv,
+				  enum CRAS_SRC_QUALITY quality);
+/* Replaces the channel conversion matrix with the one of list matching the
+ * converter's channel counts. Nothing changes if the converter doesn't convert
+ * channels or no matrix matches.
+ * Args:
+ *    conv - The format converter.
+ *    list - Matrices to pick from, for example those configured for a node.
+ * Returns:
+ *    0 on success, -ENOMEM if the matrix can't be copied.
+ */
+int cras_fmt_conv_set_channel_matrix(struct cras_fmt_conv *conv,
+				     const struct cras_channel_matrix *list);
 /* Converts in_frames samples from in_buf, storing the results in out_buf.
  * Args:
  *    conv - The format converter returned from cras_fmt_conv_create().
@@ -86,6 +139,19 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
  */
 int cras_fmt_conversion_needed(const struct cras_fmt_conv *conv);
 
+/* Narrows a capture device format to the channels a stream reads from it.
+ * Device channels at none of the positions of the stream's layout are
+ * dropped and the layout renumbered, the rest is left as it was. A mono
+ * stream at FL or FC reads both FL and FR, the same as when its frames are
+ * copied out of the device channels.
+ * Args:
+ *    fmt - The device format, narrowed in place. Left as is when the stream
+ *        reads all of its channels or none of them.
+ *    stream_fmt - The format of the capture stream.
+ */
+void cras_fmt_conv_capture_channels(struct cras_audio_format *fmt,
+				    const struct cras_audio_format *stream_fmt);
+
 /* If the server cannot provide the requested format, configures an audio format
  * converter that handles transforming the input format to the format used by
  * the server.
@@ -95,11 +161,12 @@ int cras_fmt_conversion_needed(const struct cras_fmt_conv *conv);
  *    from - Format to convert from.
  *    to - Format to convert to.
  *    frames - size of buffer.
+ *    quality - Quality setting of the sample rate converter.
  */
 int config_format_converter(struct cras_fmt_conv **conv,
 			    enum CRAS_STREAM_DIRECTION dir,
 			    const struct cras_audio_format *from,
 			    const struct cras_audio_format *to,
-			    unsigned int frames);
+			    unsigned int frames, enum CRAS_SRC_QUALITY quality);
 
 #endif /* CRAS_FMT_CONV_H_ */
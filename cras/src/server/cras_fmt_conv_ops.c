@@ -6,8 +6,27 @@
 #include <limits.h>
 #include <string.h>
 
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
 #include "cras_fmt_conv_ops.h"
 
+/* function suffixes for SIMD ops */
+#ifdef OPS_SSE42
+#define OPS(a) a##_sse42
+#elif OPS_AVX
+#define OPS(a) a##_avx
+#elif OPS_AVX2
+#define OPS(a) a##_avx2
+#elif OPS_FMA
+#define OPS(a) a##_fma
+#else
+#define OPS(a) a
+#endif
+
 #define MAX(a, b)                                                              \
 	({                                                                     \
 		__typeof__(a) _a = (a);                                        \
@@ -39,7 +58,8 @@ static int16_t s16_add_and_clip(int16_t a, int16_t b)
 /*
  * Format converter.
  */
-void convert_u8_to_s16le(const uint8_t *in, size_t in_samples, uint8_t *out)
+void OPS(convert_u8_to_s16le)(const uint8_t *in, size_t in_samples,
+			      uint8_t *out)
 {
 	size_t i;
 	uint16_t *_out = (uint16_t *)out;
@@ -48,40 +68,112 @@ void convert_u8_to_s16le(const uint8_t *in, size_t in_samples, uint8_t *out)
 		*_out = (uint16_t)((int16_t)*in - 0x80) << 8;
 }
 
-void convert_s243le_to_s16le(const uint8_t *in, size_t in_samples, uint8_t *out)
+/*
+ * The conversions between S16 and the wider integer formats only move
+ * bytes around, so they are done with byte shuffles eight samples at a time
+ * on SSSE3, or with the interleaving loads and stores sixteen samples at a
+ * time on NEON. The remaining samples are converted one by one.
+ */
+
+#if defined(__SSSE3__)
+/* Picks four 16 bit samples out of the 16 bytes at in into the low half of
+ * the result. */
+static inline __m128i shuffle_s16_out(const uint8_t *in, __m128i mask)
 {
-	/* find how to calculate in and out size, implement the conversion
-	 * between S24_3LE and S16 */
+	return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)in), mask);
+}
 
-	size_t i;
-	int8_t *_in = (int8_t *)in;
-	uint16_t *_out = (uint16_t *)out;
+/* Stores the samples picked by shuffle_s16_out from lo and hi. */
+static inline void store_s16_out(uint8_t *out, const uint8_t *lo,
+				 const uint8_t *hi, __m128i mask)
+{
+	_mm_storeu_si128((__m128i *)out,
+			 _mm_unpacklo_epi64(shuffle_s16_out(lo, mask),
+					    shuffle_s16_out(hi, mask)));
+}
+#endif
+
+void OPS(convert_s243le_to_s16le)(const uint8_t *in, size_t in_samples,
+				  uint8_t *out)
+{
+	size_t i = 0;
+
+#if defined(__SSSE3__)
+	const __m128i mask = _mm_setr_epi8(1, 2, 4, 5, 7, 8, 10, 11, -1, -1,
+					   -1, -1, -1, -1, -1, -1);
+
+	/* The load of the second group of four reads four bytes past the
+	 * eighth sample. */
+	for (; i + 10 <= in_samples; i += 8, in += 24, out += 16)
+		store_s16_out(out, in, in + 12, mask);
+#elif defined(__ARM_NEON__) || defined(__aarch64__)
+	for (; i + 16 <= in_samples; i += 16, in += 48, out += 32) {
+		uint8x16x3_t s = vld3q_u8(in);
+		uint8x16x2_t d = { { s.val[1], s.val[2] } };
 
-	for (i = 0; i < in_samples; i++, _in += 3, _out++)
-		memcpy(_out, _in + 1, 2);
+		vst2q_u8(out, d);
+	}
+#endif
+	for (; i < in_samples; i++, in += 3, out += 2)
+		memcpy(out, in + 1, 2);
 }
 
-void convert_s24le_to_s16le(const uint8_t *in, size_t in_samples, uint8_t *out)
+void OPS(convert_s24le_to_s16le)(const uint8_t *in, size_t in_samples,
+				 uint8_t *out)
 {
-	size_t i;
-	int32_t *_in = (int32_t *)in;
-	uint16_t *_out = (uint16_t *)out;
+	size_t i = 0;
+	const int32_t *_in;
+	uint16_t *_out;
 
-	for (i = 0; i < in_samples; i++, _in++, _out++)
+#if defined(__SSSE3__)
+	const __m128i mask = _mm_setr_epi8(1, 2, 5, 6, 9, 10, 13, 14, -1, -1,
+					   -1, -1, -1, -1, -1, -1);
+
+	for (; i + 8 <= in_samples; i += 8, in += 32, out += 16)
+		store_s16_out(out, in, in + 16, mask);
+#elif defined(__ARM_NEON__) || defined(__aarch64__)
+	for (; i + 16 <= in_samples; i += 16, in += 64, out += 32) {
+		uint8x16x4_t s = vld4q_u8(in);
+		uint8x16x2_t d = { { s.val[1], s.val[2] } };
+
+		vst2q_u8(out, d);
+	}
+#endif
+	_in = (const int32_t *)in;
+	_out = (uint16_t *)out;
+	for (; i < in_samples; i++, _in++, _out++)
 		*_out = (int16_t)((*_in & 0x00ffffff) >> 8);
 }
 
-void convert_s32le_to_s16le(const uint8_t *in, size_t in_samples, uint8_t *out)
+void OPS(convert_s32le_to_s16le)(const uint8_t *in, size_t in_samples,
+				 uint8_t *out)
 {
-	size_t i;
-	int32_t *_in = (int32_t *)in;
-	uint16_t *_out = (uint16_t *)out;
+	size_t i = 0;
+	const int32_t *_in;
+	uint16_t *_out;
 
-	for (i = 0; i < in_samples; i++, _in++, _out++)
+#if defined(__SSSE3__)
+	const __m128i mask = _mm_setr_epi8(2, 3, 6, 7, 10, 11, 14, 15, -1, -1,
+					   -1, -1, -1, -1, -1, -1);
+
+	for (; i + 8 <= in_samples; i += 8, in += 32, out += 16)
+		store_s16_out(out, in, in + 16, mask);
+#elif defined(__ARM_NEON__) || defined(__aarch64__)
+	for (; i + 16 <= in_samples; i += 16, in += 64, out += 32) {
+		uint8x16x4_t s = vld4q_u8(in);
+		uint8x16x2_t d = { { s.val[2], s.val[3] } };
+
+		vst2q_u8(out, d);
+	}
+#endif
+	_in = (const int32_t *)in;
+	_out = (uint16_t *)out;
+	for (; i < in_samples; i++, _in++, _out++)
 		*_out = (int16_t)(*_in >> 16);
 }
 
-void convert_s16le_to_u8(const uint8_t *in, size_t in_samples, uint8_t *out)
+void OPS(convert_s16le_to_u8)(const uint8_t *in, size_t in_samples,
+			      uint8_t *out)
 {
 	size_t i;
 	int16_t *_in = (int16_t *)in;
@@ -90,19 +182,40 @@ void convert_s16le_to_u8(const uint8_t *in, size_t in_samples, uint8_t *out)
 		*out = (uint8_t)(*_in >> 8) + 128;
 }
 
-void convert_s16le_to_s243le(const uint8_t *in, size_t in_samples, uint8_t *out)
+void OPS(convert_s16le_to_s243le)(const uint8_t *in, size_t in_samples,
+				  uint8_t *out)
 {
-	size_t i;
-	int16_t *_in = (int16_t *)in;
-	uint8_t *_out = (uint8_t *)out;
+	size_t i = 0;
+
+#if defined(__SSSE3__)
+	const __m128i lo_mask = _mm_setr_epi8(-1, 0, 1, -1, 2, 3, -1, 4, 5, -1,
+					      6, 7, -1, 8, 9, -1);
+	const __m128i hi_mask = _mm_setr_epi8(10, 11, -1, 12, 13, -1, 14, 15,
+					      -1, -1, -1, -1, -1, -1, -1, -1);
+	__m128i s;
+
+	for (; i + 8 <= in_samples; i += 8, in += 16, out += 24) {
+		s = _mm_loadu_si128((const __m128i *)in);
+		_mm_storeu_si128((__m128i *)out, _mm_shuffle_epi8(s, lo_mask));
+		_mm_storel_epi64((__m128i *)(out + 16),
+				 _mm_shuffle_epi8(s, hi_mask));
+	}
+#elif defined(__ARM_NEON__) || defined(__aarch64__)
+	for (; i + 16 <= in_samples; i += 16, in += 32, out += 48) {
+		uint8x16x2_t s = vld2q_u8(in);
+		uint8x16x3_t d = { { vdupq_n_u8(0), s.val[0], s.val[1] } };
 
-	for (i = 0; i < in_samples; i++, _in++, _out += 3) {
-		*_out = 0;
-		memcpy(_out + 1, _in, 2);
+		vst3q_u8(out, d);
+	}
+#endif
+	for (; i < in_samples; i++, in += 2, out += 3) {
+		*out = 0;
+		memcpy(out + 1, in, 2);
 	}
 }
 
-void convert_s16le_to_s24le(const uint8_t *in, size_t in_samples, uint8_t *out)
+void OPS(convert_s16le_to_s24le)(const uint8_t *in, size_t in_samples,
+				 uint8_t *out)
 {
 	size_t i;
 	int16_t *_in = (int16_t *)in;
@@ -112,7 +225,8 @@ void convert_s16le_to_s24le(const uint8_t *in, size_t in_samples, uint8_t *out)
 		*_out = ((uint32_t)(int32_t)*_in << 8);
 }
 
-void convert_s16le_to_s32le(const uint8_t *in, size_t in_samples, uint8_t *out)
+void OPS(convert_s16le_to_s32le)(const uint8_t *in, size_t in_samples,
+				 uint8_t *out)
 {
 	size_t i;
 	int16_t *_in = (int16_t *)in;
@@ -122,10 +236,169 @@ void convert_s16le_to_s32le(const uint8_t *in, size_t in_samples, uint8_t *out)
 		*_out = ((uint32_t)(int32_t)*_in << 16);
 }
 
+/*
+ * Float32 format converters.
+ */
+
+/* Scales between integer sample values and the normalized float domain. */
+#define F32_SCALE_8 128.0f
+#define F32_SCALE_16 32768.0f
+#define F32_SCALE_24 8388608.0f
+
+/* Rounds towards negative infinity, matching an arithmetic right shift so
+ * that narrowing through the float domain keeps the same result as the
+ * integer converters above. Caller must clamp v to the int32 range. */
+static inline int32_t f32_floor_to_int(float v)
+{
+	int32_t i = (int32_t)v;
+	return i - (v < (float)i);
+}
+
+static inline int32_t f32_to_int_clip(float v, float scale)
+{
+	v *= scale;
+	if (v >= scale)
+		return (int32_t)scale - 1;
+	if (v < -scale)
+		return -(int32_t)scale;
+	return f32_floor_to_int(v);
+}
+
+void OPS(convert_u8_to_f32le)(const uint8_t *in, size_t in_samples,
+			      uint8_t *out)
+{
+	size_t i;
+	float *_out = (float *)out;
+
+	for (i = 0; i < in_samples; i++)
+		_out[i] = ((int16_t)in[i] - 0x80) / F32_SCALE_8;
+}
+
+void OPS(convert_s16le_to_f32le)(const uint8_t *in, size_t in_samples,
+				 uint8_t *out)
+{
+	size_t i;
+	const int16_t *_in = (const int16_t *)in;
+	float *_out = (float *)out;
+
+	for (i = 0; i < in_samples; i++)
+		_out[i] = _in[i] / F32_SCALE_16;
+}
+
+void OPS(convert_s243le_to_f32le)(const uint8_t *in, size_t in_samples,
+				  uint8_t *out)
+{
+	size_t i;
+	int32_t sample;
+	float *_out = (float *)out;
+
+	/* Assembling the sample with shifts instead of a memcpy per sample
+	 * lets the compiler vectorize the loop. */
+	for (i = 0; i < in_samples; i++, in += 3) {
+		sample = (int32_t)((uint32_t)in[0] << 8 | (uint32_t)in[1] << 16 |
+				   (uint32_t)in[2] << 24);
+		_out[i] = (sample >> 8) / F32_SCALE_24;
+	}
+}
+
+void OPS(convert_s24le_to_f32le)(const uint8_t *in, size_t in_samples,
+				 uint8_t *out)
+{
+	size_t i;
+	const int32_t *_in = (const int32_t *)in;
+	float *_out = (float *)out;
+
+	/* Sign extend from the low 24 bits of each container. */
+	for (i = 0; i < in_samples; i++)
+		_out[i] = ((int32_t)((uint32_t)_in[i] << 8) >> 8) /
+			  F32_SCALE_24;
+}
+
+void OPS(convert_s32le_to_f32le)(const uint8_t *in, size_t in_samples,
+				 uint8_t *out)
+{
+	size_t i;
+	const int32_t *_in = (const int32_t *)in;
+	float *_out = (float *)out;
+
+	/* Float has 24 bits of mantissa, drop the low byte before converting
+	 * so rounding can never carry into the bits that are kept. */
+	for (i = 0; i < in_samples; i++)
+		_out[i] = (_in[i] >> 8) / F32_SCALE_24;
+}
+
+void OPS(convert_f32le_to_u8)(const uint8_t *in, size_t in_samples,
+			      uint8_t *out)
+{
+	size_t i;
+	const float *_in = (const float *)in;
+
+	for (i = 0; i < in_samples; i++)
+		out[i] = (uint8_t)(f32_to_int_clip(_in[i], F32_SCALE_8) + 0x80);
+}
+
+void OPS(convert_f32le_to_s16le)(const uint8_t *in, size_t in_samples,
+				 uint8_t *out)
+{
+	size_t i;
+	const float *_in = (const float *)in;
+	int16_t *_out = (int16_t *)out;
+
+	for (i = 0; i < in_samples; i++)
+		_out[i] = (int16_t)f32_to_int_clip(_in[i], F32_SCALE_16);
+}
+
+void OPS(convert_f32le_to_s243le)(const uint8_t *in, size_t in_samples,
+				  uint8_t *out)
+{
+	size_t i;
+	int32_t sample;
+	const float *_in = (const float *)in;
+
+	for (i = 0; i < in_samples; i++, out += 3) {
+		sample = f32_to_int_clip(_in[i], F32_SCALE_24);
+		out[0] = sample;
+		out[1] = sample >> 8;
+		out[2] = sample >> 16;
+	}
+}
+
+void OPS(convert_f32le_to_s24le)(const uint8_t *in, size_t in_samples,
+				 uint8_t *out)
+{
+	size_t i;
+	const float *_in = (const float *)in;
+	int32_t *_out = (int32_t *)out;
+
+	for (i = 0; i < in_samples; i++)
+		_out[i] = f32_to_int_clip(_in[i], F32_SCALE_24);
+}
+
+void OPS(convert_f32le_to_s32le)(const uint8_t *in, size_t in_samples,
+				 uint8_t *out)
+{
+	size_t i;
+	const float *_in = (const float *)in;
+	int32_t *_out = (int32_t *)out;
+	float v;
+
+	for (i = 0; i < in_samples; i++) {
+		v = _in[i] * F32_SCALE_24;
+		if (v >= F32_SCALE_24)
+			_out[i] = INT32_MAX;
+		else if (v < -F32_SCALE_24)
+			_out[i] = INT32_MIN;
+		else
+			_out[i] = (int32_t)((uint32_t)f32_floor_to_int(v)
+					    << 8);
+	}
+}
+
 /*
  * Channel converter: mono to stereo.
  */
-size_t s16_mono_to_stereo(const uint8_t *_in, size_t in_frames, uint8_t *_out)
+size_t OPS(s16_mono_to_stereo)(const uint8_t *_in, size_t in_frames,
+			       uint8_t *_out)
 {
 	size_t i;
 	const int16_t *in = (const int16_t *)_in;
@@ -141,7 +414,8 @@ size_t s16_mono_to_stereo(const uint8_t *_in, size_t in_frames, uint8_t *_out)
 /*
  * Channel converter: stereo to mono.
  */
-size_t s16_stereo_to_mono(const uint8_t *_in, size_t in_frames, uint8_t *_out)
+size_t OPS(s16_stereo_to_mono)(const uint8_t *_in, size_t in_frames,
+			       uint8_t *_out)
 {
 	size_t i;
 	const int16_t *in = (const int16_t *)_in;
@@ -158,8 +432,8 @@ size_t s16_stereo_to_mono(const uint8_t *_in, size_t in_frames, uint8_t *_out)
  * Fit mono to front center of the output, or split to front left/right
  * if front center is missing from the output channel layout.
  */
-size_t s16_mono_to_51(size_t left, size_t right, size_t center,
-		      const uint8_t *_in, size_t in_frames, uint8_t *_out)
+size_t OPS(s16_mono_to_51)(size_t left, size_t right, size_t center,
+			   const uint8_t *_in, size_t in_frames, uint8_t *_out)
 {
 	size_t i;
 	const int16_t *in = (const int16_t *)_in;
@@ -192,8 +466,9 @@ size_t s16_mono_to_51(size_t left, size_t right, size_t center,
  * and fill others with zero. If any of the front left/right is missed from
  * the output channel layout, mix to front center.
  */
-size_t s16_stereo_to_51(size_t left, size_t right, size_t center,
-			const uint8_t *_in, size_t in_frames, uint8_t *_out)
+size_t OPS(s16_stereo_to_51)(size_t left, size_t right, size_t center,
+			     const uint8_t *_in, size_t in_frames,
+			     uint8_t *_out)
 {
 	size_t i;
 	const int16_t *in = (const int16_t *)_in;
@@ -229,7 +504,8 @@ size_t s16_stereo_to_51(size_t left, size_t right, size_t center,
  * is used as the default behavior when channel layout is not set from the
  * client side.
  */
-size_t s16_51_to_stereo(const uint8_t *_in, size_t in_frames, uint8_t *_out)
+size_t OPS(s16_51_to_stereo)(const uint8_t *_in, size_t in_frames,
+			     uint8_t *_out)
 {
 	const int16_t *in = (const int16_t *)_in;
 	int16_t *out = (int16_t *)_out;
@@ -264,7 +540,7 @@ size_t s16_51_to_stereo(const uint8_t *_in, size_t in_frames, uint8_t *_out)
  * is used as the default behavior when channel layout is not set from the
  * client side.
  */
-size_t s16_51_to_quad(const uint8_t *_in, size_t in_frames, uint8_t *_out)
+size_t OPS(s16_51_to_quad)(const uint8_t *_in, size_t in_frames, uint8_t *_out)
 {
 	const int16_t *in = (const int16_t *)_in;
 	int16_t *out = (int16_t *)_out;
@@ -308,32 +584,39 @@ size_t s16_51_to_quad(const uint8_t *_in, size_t in_frames, uint8_t *_out)
  * Fit left/right of input to the front left/right of output respectively
  * and fill others with zero.
  */
-size_t s16_stereo_to_quad(size_t front_left, size_t front_right,
-			  size_t rear_left, size_t rear_right,
-			  const uint8_t *_in, size_t in_frames, uint8_t *_out)
+size_t OPS(s16_stereo_to_quad)(size_t front_left, size_t front_right,
+			       size_t rear_left, size_t rear_right,
+			       const uint8_t *_in, size_t in_frames,
+			       uint8_t *_out)
 {
 	size_t i;
 	const int16_t *in = (const int16_t *)_in;
 	int16_t *out = (int16_t *)_out;
 
-	if (front_left != -1 && front_right != -1 && rear_left != -1 &&
-	    rear_right != -1)
-		for (i = 0; i < in_frames; i++) {
-			out[4 * i + front_left] = in[2 * i];
-			out[4 * i + front_right] = in[2 * i + 1];
-			out[4 * i + rear_left] = in[2 * i];
-			out[4 * i + rear_right] = in[2 * i + 1];
-		}
-	else
+	if (front_left == -1 || front_right == -1 || rear_left == -1 ||
+	    rear_right == -1 ||
+	    (front_left == 0 && front_right == 1 && rear_left == 2 &&
+	     rear_right == 3)) {
 		/* Select the first four channels to convert to as the
-		 * default behavior.
+		 * default behavior. Both halves of each output frame are the
+		 * input frame, copied as one 32 bit word so it vectorizes.
 		 */
+		const uint32_t *in32 = (const uint32_t *)_in;
+		uint32_t *out32 = (uint32_t *)_out;
+
 		for (i = 0; i < in_frames; i++) {
-			out[4 * i] = in[2 * i];
-			out[4 * i + 1] = in[2 * i + 1];
-			out[4 * i + 2] = in[2 * i];
-			out[4 * i + 3] = in[2 * i + 1];
+			out32[2 * i] = in32[i];
+			out32[2 * i + 1] = in32[i];
 		}
+		return in_frames;
+	}
+
+	for (i = 0; i < in_frames; i++) {
+		out[4 * i + front_left] = in[2 * i];
+		out[4 * i + front_right] = in[2 * i + 1];
+		out[4 * i + rear_left] = in[2 * i];
+		out[4 * i + rear_right] = in[2 * i + 1];
+	}
 
 	return in_frames;
 }
@@ -341,9 +624,10 @@ size_t s16_stereo_to_quad(size_t front_left, size_t front_right,
 /*
  * Channel converter: quad (front L/R, rear L/R) to stereo.
  */
-size_t s16_quad_to_stereo(size_t front_left, size_t front_right,
-			  size_t rear_left, size_t rear_right,
-			  const uint8_t *_in, size_t in_frames, uint8_t *_out)
+size_t OPS(s16_quad_to_stereo)(size_t front_left, size_t front_right,
+			       size_t rear_left, size_t rear_right,
+			       const uint8_t *_in, size_t in_frames,
+			       uint8_t *_out)
 {
 	size_t i;
 	const int16_t *in = (const int16_t *)_in;
@@ -372,10 +656,10 @@ size_t s16_quad_to_stereo(size_t front_left, size_t front_right,
  * The out buffer must have room for M channel. This convert function is used
  * as the default behavior when channel layout is not set from the client side.
  */
-size_t s16_default_all_to_all(struct cras_audio_format *out_fmt,
-			      size_t num_in_ch, size_t num_out_ch,
-			      const uint8_t *_in, size_t in_frames,
-			      uint8_t *_out)
+size_t OPS(s16_default_all_to_all)(struct cras_audio_format *out_fmt,
+				   size_t num_in_ch, size_t num_out_ch,
+				   const uint8_t *_in, size_t in_frames,
+				   uint8_t *_out)
 {
 	unsigned int in_ch, out_ch, i;
 	const int16_t *in = (const int16_t *)_in;
@@ -405,10 +689,10 @@ size_t s16_default_all_to_all(struct cras_audio_format *out_fmt,
  * Copies the input channels across output channels. Drops input channels that
  * don't fit. Ignores output channels greater than the number of input channels.
  */
-size_t s16_some_to_some(const struct cras_audio_format *out_fmt,
-			const size_t num_in_ch, const size_t num_out_ch,
-			const uint8_t *_in, const size_t frame_count,
-			uint8_t *_out)
+size_t OPS(s16_some_to_some)(const struct cras_audio_format *out_fmt,
+			     const size_t num_in_ch, const size_t num_out_ch,
+			     const uint8_t *_in, const size_t frame_count,
+			     uint8_t *_out)
 {
 	unsigned int i;
 	const int16_t *in = (const int16_t *)_in;
@@ -426,7 +710,8 @@ size_t s16_some_to_some(const struct cras_audio_format *out_fmt,
 /*
  * Multiplies buffer vector with coefficient vector.
  */
-int16_t s16_multiply_buf_with_coef(float *coef, const int16_t *buf, size_t size)
+int16_t OPS(s16_multiply_buf_with_coef)(float *coef, const int16_t *buf,
+					size_t size)
 {
 	int32_t sum = 0;
 	int i;
@@ -443,9 +728,9 @@ int16_t s16_multiply_buf_with_coef(float *coef, const int16_t *buf, size_t size)
  *
  * Converts channels based on the channel conversion coefficient matrix.
  */
-size_t s16_convert_channels(float **ch_conv_mtx, size_t num_in_ch,
-			    size_t num_out_ch, const uint8_t *_in,
-			    size_t in_frames, uint8_t *_out)
+size_t OPS(s16_convert_channels)(float **ch_conv_mtx, size_t num_in_ch,
+				 size_t num_out_ch, const uint8_t *_in,
+				 size_t in_frames, uint8_t *_out)
 {
 	unsigned i, fr;
 	unsigned in_idx = 0;
@@ -455,7 +740,7 @@ size_t s16_convert_channels(float **ch_conv_mtx, size_t num_in_ch,
 
 	for (fr = 0; fr < in_frames; fr++) {
 		for (i = 0; i < num_out_ch; i++)
-			out[out_idx + i] = s16_multiply_buf_with_coef(
+			out[out_idx + i] = OPS(s16_multiply_buf_with_coef)(
 				ch_conv_mtx[i], &in[in_idx], num_in_ch);
 		in_idx += num_in_ch;
 		out_idx += num_out_ch;
@@ -463,3 +748,378 @@ size_t s16_convert_channels(float **ch_conv_mtx, size_t num_in_ch,
 
 	return in_frames;
 }
+
+/*
+ * Float32 channel converters.
+ */
+
+static inline float f32_add_and_clip(float a, float b)
+{
+	float sum = a + b;
+
+	if (sum > 1.0f)
+		return 1.0f;
+	if (sum < -1.0f)
+		return -1.0f;
+	return sum;
+}
+
+size_t OPS(f32_mono_to_stereo)(const uint8_t *_in, size_t in_frames,
+			       uint8_t *_out)
+{
+	size_t i;
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+
+	for (i = 0; i < in_frames; i++) {
+		out[2 * i] = in[i];
+		out[2 * i + 1] = in[i];
+	}
+	return in_frames;
+}
+
+size_t OPS(f32_stereo_to_mono)(const uint8_t *_in, size_t in_frames,
+			       uint8_t *_out)
+{
+	size_t i;
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+
+	for (i = 0; i < in_frames; i++)
+		out[i] = f32_add_and_clip(in[2 * i], in[2 * i + 1]);
+	return in_frames;
+}
+
+size_t OPS(f32_mono_to_51)(size_t left, size_t right, size_t center,
+			   const uint8_t *_in, size_t in_frames, uint8_t *_out)
+{
+	size_t i;
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+
+	memset(out, 0, sizeof(*out) * 6 * in_frames);
+
+	if (center != -1)
+		for (i = 0; i < in_frames; i++)
+			out[6 * i + center] = in[i];
+	else if (left != -1 && right != -1)
+		for (i = 0; i < in_frames; i++) {
+			out[6 * i + right] = in[i] / 2;
+			out[6 * i + left] = in[i] / 2;
+		}
+	else
+		for (i = 0; i < in_frames; i++)
+			out[6 * i] = in[i];
+
+	return in_frames;
+}
+
+size_t OPS(f32_stereo_to_51)(size_t left, size_t right, size_t center,
+			     const uint8_t *_in, size_t in_frames,
+			     uint8_t *_out)
+{
+	size_t i;
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+
+	memset(out, 0, sizeof(*out) * 6 * in_frames);
+
+	if (left != -1 && right != -1)
+		for (i = 0; i < in_frames; i++) {
+			out[6 * i + left] = in[2 * i];
+			out[6 * i + right] = in[2 * i + 1];
+		}
+	else if (center != -1)
+		for (i = 0; i < in_frames; i++)
+			out[6 * i + center] =
+				f32_add_and_clip(in[2 * i], in[2 * i + 1]);
+	else
+		for (i = 0; i < in_frames; i++) {
+			out[6 * i] = in[2 * i];
+			out[6 * i + 1] = in[2 * i + 1];
+		}
+
+	return in_frames;
+}
+
+size_t OPS(f32_51_to_stereo)(const uint8_t *_in, size_t in_frames,
+			     uint8_t *_out)
+{
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+	const float normalized_factor = 0.585;
+	float half_center;
+	size_t i;
+
+	for (i = 0; i < in_frames; i++) {
+		half_center = in[6 * i + 2] * 0.707f * normalized_factor;
+		out[2 * i] = in[6 * i] * normalized_factor + half_center;
+		out[2 * i + 1] = in[6 * i + 1] * normalized_factor + half_center;
+	}
+	return in_frames;
+}
+
+size_t OPS(f32_51_to_quad)(const uint8_t *_in, size_t in_frames, uint8_t *_out)
+{
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+	const float normalized_factor = 0.453;
+	float half_center, lfe;
+	size_t i;
+
+	for (i = 0; i < in_frames; i++) {
+		half_center = in[6 * i + 2] * 0.707f * normalized_factor;
+		lfe = in[6 * i + 3] * 0.5f * normalized_factor;
+		out[4 * i] = normalized_factor * in[6 * i] + half_center + lfe;
+		out[4 * i + 1] =
+			normalized_factor * in[6 * i + 1] + half_center + lfe;
+		out[4 * i + 2] = normalized_factor * in[6 * i + 4] + lfe;
+		out[4 * i + 3] = normalized_factor * in[6 * i + 5] + lfe;
+	}
+	return in_frames;
+}
+
+size_t OPS(f32_stereo_to_quad)(size_t front_left, size_t front_right,
+			       size_t rear_left, size_t rear_right,
+			       const uint8_t *_in, size_t in_frames,
+			       uint8_t *_out)
+{
+	size_t i;
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+
+	if (front_left == -1 || front_right == -1 || rear_left == -1 ||
+	    rear_right == -1) {
+		front_left = 0;
+		front_right = 1;
+		rear_left = 2;
+		rear_right = 3;
+	}
+
+	for (i = 0; i < in_frames; i++) {
+		out[4 * i + front_left] = in[2 * i];
+		out[4 * i + front_right] = in[2 * i + 1];
+		out[4 * i + rear_left] = in[2 * i];
+		out[4 * i + rear_right] = in[2 * i + 1];
+	}
+	return in_frames;
+}
+
+size_t OPS(f32_quad_to_stereo)(size_t front_left, size_t front_right,
+			       size_t rear_left, size_t rear_right,
+			       const uint8_t *_in, size_t in_frames,
+			       uint8_t *_out)
+{
+	size_t i;
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+
+	if (front_left == -1 || front_right == -1 || rear_left == -1 ||
+	    rear_right == -1) {
+		front_left = 0;
+		front_right = 1;
+		rear_left = 2;
+		rear_right = 3;
+	}
+
+	for (i = 0; i < in_frames; i++) {
+		out[2 * i] = f32_add_and_clip(in[4 * i + front_left],
+					      in[4 * i + rear_left] / 4);
+		out[2 * i + 1] = f32_add_and_clip(in[4 * i + front_right],
+						  in[4 * i + rear_right] / 4);
+	}
+	return in_frames;
+}
+
+size_t OPS(f32_default_all_to_all)(size_t num_in_ch, size_t num_out_ch,
+				   const uint8_t *_in, size_t in_frames,
+				   uint8_t *_out)
+{
+	unsigned int in_ch, out_ch, i;
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+	float sum;
+
+	for (i = 0; i < in_frames; i++) {
+		sum = 0;
+		for (in_ch = 0; in_ch < num_in_ch; in_ch++)
+			sum += in[in_ch + i * num_in_ch];
+		sum /= num_in_ch;
+		for (out_ch = 0; out_ch < num_out_ch; out_ch++)
+			out[out_ch + i * num_out_ch] = sum;
+	}
+	return in_frames;
+}
+
+size_t OPS(f32_some_to_some)(size_t num_in_ch, size_t num_out_ch,
+			     const uint8_t *_in, size_t frame_count,
+			     uint8_t *_out)
+{
+	unsigned int i;
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+	const size_t num_copy_ch = MIN(num_in_ch, num_out_ch);
+
+	memset(out, 0, frame_count * num_out_ch * sizeof(*out));
+	for (i = 0; i < frame_count; i++, out += num_out_ch, in += num_in_ch)
+		memcpy(out, in, num_copy_ch * sizeof(*out));
+
+	return frame_count;
+}
+
+float OPS(f32_multiply_buf_with_coef)(float *coef, const float *buf,
+				      size_t size)
+{
+	float sum = 0;
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		sum += coef[i] * buf[i];
+	return sum;
+}
+
+size_t OPS(f32_convert_channels)(float **ch_conv_mtx, size_t num_in_ch,
+				 size_t num_out_ch, const uint8_t *_in,
+				 size_t in_frames, uint8_t *_out)
+{
+	unsigned i, fr;
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+
+	for (fr = 0; fr < in_frames; fr++) {
+		for (i = 0; i < num_out_ch; i++)
+			out[i] = OPS(f32_multiply_buf_with_coef)(
+				ch_conv_mtx[i], in, num_in_ch);
+		in += num_in_ch;
+		out += num_out_ch;
+	}
+
+	return in_frames;
+}
+
+/*
+ * Sparse channel layout converters.
+ *
+ * Each output channel is accumulated over a block of frames from only the
+ * non-zero entries of its row, so the cost follows the number of mixed
+ * channel pairs rather than num_in_ch * num_out_ch. The per entry
+ * accumulation order and rounding match s16_convert_channels and
+ * f32_convert_channels.
+ */
+#define SPARSE_BLOCK_FRAMES 64
+
+size_t OPS(s16_sparse_convert_channels)(const struct cras_channel_matrix *m,
+					const uint8_t *_in, size_t in_frames,
+					uint8_t *_out)
+{
+	const int16_t *in = (const int16_t *)_in;
+	int16_t *out = (int16_t *)_out;
+	const size_t num_in_ch = m->num_in_ch;
+	const size_t num_out_ch = m->num_out_ch;
+	int32_t acc[SPARSE_BLOCK_FRAMES];
+	size_t fr, block, n;
+	unsigned int o, k, ch;
+	float coef;
+
+	for (block = 0; block < in_frames; block += n) {
+		n = MIN(in_frames - block, (size_t)SPARSE_BLOCK_FRAMES);
+		for (o = 0; o < num_out_ch; o++) {
+			memset(acc, 0, sizeof(acc));
+			for (k = m->row_start[o]; k < m->row_start[o + 1]; k++) {
+				ch = m->in_ch[k];
+				coef = m->coef[k];
+				for (fr = 0; fr < n; fr++)
+					acc[fr] += coef * in[fr * num_in_ch + ch];
+			}
+			for (fr = 0; fr < n; fr++) {
+				acc[fr] = MAX(acc[fr], -0x8000);
+				acc[fr] = MIN(acc[fr], 0x7fff);
+				out[fr * num_out_ch + o] = (int16_t)acc[fr];
+			}
+		}
+		in += n * num_in_ch;
+		out += n * num_out_ch;
+	}
+
+	return in_frames;
+}
+
+size_t OPS(f32_sparse_convert_channels)(const struct cras_channel_matrix *m,
+					const uint8_t *_in, size_t in_frames,
+					uint8_t *_out)
+{
+	const float *in = (const float *)_in;
+	float *out = (float *)_out;
+	const size_t num_in_ch = m->num_in_ch;
+	const size_t num_out_ch = m->num_out_ch;
+	float acc[SPARSE_BLOCK_FRAMES];
+	size_t fr, block, n;
+	unsigned int o, k, ch;
+	float coef;
+
+	for (block = 0; block < in_frames; block += n) {
+		n = MIN(in_frames - block, (size_t)SPARSE_BLOCK_FRAMES);
+		for (o = 0; o < num_out_ch; o++) {
+			memset(acc, 0, sizeof(acc));
+			for (k = m->row_start[o]; k < m->row_start[o + 1]; k++) {
+				ch = m->in_ch[k];
+				coef = m->coef[k];
+				for (fr = 0; fr < n; fr++)
+					acc[fr] += coef * in[fr * num_in_ch + ch];
+			}
+			for (fr = 0; fr < n; fr++)
+				out[fr * num_out_ch + o] = acc[fr];
+		}
+		in += n * num_in_ch;
+		out += n * num_out_ch;
+	}
+
+	return in_frames;
+}
+
+const struct cras_fmt_conv_ops OPS(fmt_conv_ops) = {
+	.convert_u8_to_s16le = OPS(convert_u8_to_s16le),
+	.convert_s243le_to_s16le = OPS(convert_s243le_to_s16le),
+	.convert_s24le_to_s16le = OPS(convert_s24le_to_s16le),
+	.convert_s32le_to_s16le = OPS(convert_s32le_to_s16le),
+	.convert_s16le_to_u8 = OPS(convert_s16le_to_u8),
+	.convert_s16le_to_s243le = OPS(convert_s16le_to_s243le),
+	.convert_s16le_to_s24le = OPS(convert_s16le_to_s24le),
+	.convert_s16le_to_s32le = OPS(convert_s16le_to_s32le),
+	.convert_u8_to_f32le = OPS(convert_u8_to_f32le),
+	.convert_s16le_to_f32le = OPS(convert_s16le_to_f32le),
+	.convert_s243le_to_f32le = OPS(convert_s243le_to_f32le),
+	.convert_s24le_to_f32le = OPS(convert_s24le_to_f32le),
+	.convert_s32le_to_f32le = OPS(convert_s32le_to_f32le),
+	.convert_f32le_to_u8 = OPS(convert_f32le_to_u8),
+	.convert_f32le_to_s16le = OPS(convert_f32le_to_s16le),
+	.convert_f32le_to_s243le = OPS(convert_f32le_to_s243le),
+	.convert_f32le_to_s24le = OPS(convert_f32le_to_s24le),
+	.convert_f32le_to_s32le = OPS(convert_f32le_to_s32le),
+	.s16_mono_to_stereo = OPS(s16_mono_to_stereo),
+	.s16_stereo_to_mono = OPS(s16_stereo_to_mono),
+	.s16_mono_to_51 = OPS(s16_mono_to_51),
+	.s16_stereo_to_51 = OPS(s16_stereo_to_51),
+	.s16_51_to_stereo = OPS(s16_51_to_stereo),
+	.s16_51_to_quad = OPS(s16_51_to_quad),
+	.s16_stereo_to_quad = OPS(s16_stereo_to_quad),
+	.s16_quad_to_stereo = OPS(s16_quad_to_stereo),
+	.s16_default_all_to_all = OPS(s16_default_all_to_all),
+	.s16_some_to_some = OPS(s16_some_to_some),
+	.s16_multiply_buf_with_coef = OPS(s16_multiply_buf_with_coef),
+	.s16_convert_channels = OPS(s16_convert_channels),
+	.s16_sparse_convert_channels = OPS(s16_sparse_convert_channels),
+	.f32_mono_to_stereo = OPS(f32_mono_to_stereo),
+	.f32_stereo_to_mono = OPS(f32_stereo_to_mono),
+	.f32_mono_to_51 = OPS(f32_mono_to_51),
+	.f32_stereo_to_51 = OPS(f32_stereo_to_51),
+	.f32_51_to_stereo = OPS(f32_51_to_stereo),
+	.f32_51_to_quad = OPS(f32_51_to_quad),
+	.f32_stereo_to_quad = OPS(f32_stereo_to_quad),
+	.f32_quad_to_stereo = OPS(f32_quad_to_stereo),
+	.f32_default_all_to_all = OPS(f32_default_all_to_all),
+	.f32_some_to_some = OPS(f32_some_to_some),
+	.f32_multiply_buf_with_coef = OPS(f32_multiply_buf_with_coef),
+	.f32_convert_channels = OPS(f32_convert_channels),
+	.f32_sparse_convert_channels = OPS(f32_sparse_convert_channels),
+};
@@ -8,6 +8,7 @@
 
 #include <sys/types.h>
 #include "cras_audio_format.h"
+#include "cras_channel_matrix.h"
 
 /*
  * Format converter.
@@ -23,6 +24,29 @@ void convert_s16le_to_s243le(const uint8_t *in, size_t in_samples,
 void convert_s16le_to_s24le(const uint8_t *in, size_t in_samples, uint8_t *out);
 void convert_s16le_to_s32le(const uint8_t *in, size_t in_samples, uint8_t *out);
 
+/*
+ * Format converter to and from the float32 intermediate domain. Float samples
+ * are normalized to the range [-1.0, 1.0).
+ */
+void convert_u8_to_f32le(const uint8_t *in, size_t in_samples, uint8_t *out);
+void convert_s16le_to_f32le(const uint8_t *in, size_t in_samples,
+			    uint8_t *out);
+void convert_s243le_to_f32le(const uint8_t *in, size_t in_samples,
+			     uint8_t *out);
+void convert_s24le_to_f32le(const uint8_t *in, size_t in_samples,
+			    uint8_t *out);
+void convert_s32le_to_f32le(const uint8_t *in, size_t in_samples,
+			    uint8_t *out);
+void convert_f32le_to_u8(const uint8_t *in, size_t in_samples, uint8_t *out);
+void convert_f32le_to_s16le(const uint8_t *in, size_t in_samples,
+			    uint8_t *out);
+void convert_f32le_to_s243le(const uint8_t *in, size_t in_samples,
+			     uint8_t *out);
+void convert_f32le_to_s24le(const uint8_t *in, size_t in_samples,
+			    uint8_t *out);
+void convert_f32le_to_s32le(const uint8_t *in, size_t in_samples,
+			    uint8_t *out);
+
 /*
  * Channel converter: mono to stereo.
  */
@@ -99,4 +123,168 @@ size_t s16_convert_channels(float **ch_conv_mtx, size_t num_in_ch,
 			    size_t num_out_ch, const uint8_t *in,
 			    size_t in_frames, uint8_t *out);
 
+/*
+ * Channel layout converter using a sparse matrix. Produces the same output as
+ * s16_convert_channels with the equivalent dense matrix.
+ */
+size_t s16_sparse_convert_channels(const struct cras_channel_matrix *m,
+				   const uint8_t *in, size_t in_frames,
+				   uint8_t *out);
+
+/*
+ * Float32 channel converters. These take the same arguments and follow the
+ * same channel mapping rules as their s16 counterparts above, operating on
+ * interleaved float samples.
+ */
+size_t f32_mono_to_stereo(const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t f32_stereo_to_mono(const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t f32_mono_to_51(size_t left, size_t right, size_t center,
+		      const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t f32_stereo_to_51(size_t left, size_t right, size_t center,
+			const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t f32_51_to_stereo(const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t f32_51_to_quad(const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t f32_stereo_to_quad(size_t front_left, size_t front_right,
+			  size_t rear_left, size_t rear_right,
+			  const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t f32_quad_to_stereo(size_t front_left, size_t front_right,
+			  size_t rear_left, size_t rear_right,
+			  const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t f32_default_all_to_all(size_t num_in_ch, size_t num_out_ch,
+			      const uint8_t *in, size_t in_frames,
+			      uint8_t *out);
+size_t f32_some_to_some(size_t num_in_ch, size_t num_out_ch,
+			const uint8_t *in, size_t frame_count, uint8_t *out);
+float f32_multiply_buf_with_coef(float *coef, const float *buf, size_t size);
+size_t f32_convert_channels(float **ch_conv_mtx, size_t num_in_ch,
+			    size_t num_out_ch, const uint8_t *in,
+			    size_t in_frames, uint8_t *out);
+size_t f32_sparse_convert_channels(const struct cras_channel_matrix *m,
+				   const uint8_t *in, size_t in_frames,
+				   uint8_t *out);
+
+/* Struct containing the sample format and channel converters. Like
+ * cras_mix_ops, cras_fmt_conv_ops.c is built once per instruction set and
+ * cras_fmt_conv_init() selects the table for the CPU. Each member has the
+ * signature and behavior of the function of the same name above.
+ */
+struct cras_fmt_conv_ops {
+	void (*convert_u8_to_s16le)(const uint8_t *in, size_t in_samples,
+				    uint8_t *out);
+	void (*convert_s243le_to_s16le)(const uint8_t *in, size_t in_samples,
+					uint8_t *out);
+	void (*convert_s24le_to_s16le)(const uint8_t *in, size_t in_samples,
+				       uint8_t *out);
+	void (*convert_s32le_to_s16le)(const uint8_t *in, size_t in_samples,
+				       uint8_t *out);
+	void (*convert_s16le_to_u8)(const uint8_t *in, size_t in_samples,
+				    uint8_t *out);
+	void (*convert_s16le_to_s243le)(const uint8_t *in, size_t in_samples,
+					uint8_t *out);
+	void (*convert_s16le_to_s24le)(const uint8_t *in, size_t in_samples,
+				       uint8_t *out);
+	void (*convert_s16le_to_s32le)(const uint8_t *in, size_t in_samples,
+				       uint8_t *out);
+	void (*convert_u8_to_f32le)(const uint8_t *in, size_t in_samples,
+				    uint8_t *out);
+	void (*convert_s16le_to_f32le)(const uint8_t *in, size_t in_samples,
+				       uint8_t *out);
+	void (*convert_s243le_to_f32le)(const uint8_t *in, size_t in_samples,
+					uint8_t *out);
+	void (*convert_s24le_to_f32le)(const uint8_t *in, size_t in_samples,
+				       uint8_t *out);
+	void (*convert_s32le_to_f32le)(const uint8_t *in, size_t in_samples,
+				       uint8_t *out);
+	void (*convert_f32le_to_u8)(const uint8_t *in, size_t in_samples,
+				    uint8_t *out);
+	void (*convert_f32le_to_s16le)(const uint8_t *in, size_t in_samples,
+				       uint8_t *out);
+	void (*convert_f32le_to_s243le)(const uint8_t *in, size_t in_samples,
+					uint8_t *out);
+	void (*convert_f32le_to_s24le)(const uint8_t *in, size_t in_samples,
+				       uint8_t *out);
+	void (*convert_f32le_to_s32le)(const uint8_t *in, size_t in_samples,
+				       uint8_t *out);
+	size_t (*s16_mono_to_stereo)(const uint8_t *in, size_t in_frames,
+				     uint8_t *out);
+	size_t (*s16_stereo_to_mono)(const uint8_t *in, size_t in_frames,
+				     uint8_t *out);
+	size_t (*s16_mono_to_51)(size_t left, size_t right, size_t center,
+				 const uint8_t *in, size_t in_frames,
+				 uint8_t *out);
+	size_t (*s16_stereo_to_51)(size_t left, size_t right, size_t center,
+				   const uint8_t *in, size_t in_frames,
+				   uint8_t *out);
+	size_t (*s16_51_to_stereo)(const uint8_t *in, size_t in_frames,
+				   uint8_t *out);
+	size_t (*s16_51_to_quad)(const uint8_t *in, size_t in_frames,
+				 uint8_t *out);
+	size_t (*s16_stereo_to_quad)(size_t front_left, size_t front_right,
+				     size_t rear_left, size_t rear_right,
+				     const uint8_t *in, size_t in_frames,
+				     uint8_t *out);
+	size_t (*s16_quad_to_stereo)(size_t front_left, size_t front_right,
+				     size_t rear_left, size_t rear_right,
+				     const uint8_t *in, size_t in_frames,
+				     uint8_t *out);
+	size_t (*s16_default_all_to_all)(struct cras_audio_format *out_fmt,
+					 size_t num_in_ch, size_t num_out_ch,
+					 const uint8_t *in, size_t in_frames,
+					 uint8_t *out);
+	size_t (*s16_some_to_some)(const struct cras_audio_format *out_fmt,
+				   const size_t num_in_ch,
+				   const size_t num_out_ch, const uint8_t *_in,
+				   const size_t frame_count, uint8_t *_out);
+	int16_t (*s16_multiply_buf_with_coef)(float *coef, const int16_t *buf,
+					      size_t size);
+	size_t (*s16_convert_channels)(float **ch_conv_mtx, size_t num_in_ch,
+				       size_t num_out_ch, const uint8_t *in,
+				       size_t in_frames, uint8_t *out);
+	size_t (*s16_sparse_convert_channels)(
+		const struct cras_channel_matrix *m, const uint8_t *in,
+		size_t in_frames, uint8_t *out);
+	size_t (*f32_mono_to_stereo)(const uint8_t *in, size_t in_frames,
+				     uint8_t *out);
+	size_t (*f32_stereo_to_mono)(const uint8_t *in, size_t in_frames,
+				     uint8_t *out);
+	size_t (*f32_mono_to_51)(size_t left, size_t right, size_t center,
+				 const uint8_t *in, size_t in_frames,
+				 uint8_t *out);
+	size_t (*f32_stereo_to_51)(size_t left, size_t right, size_t center,
+				   const uint8_t *in, size_t in_frames,
+				   uint8_t *out);
+	size_t (*f32_51_to_stereo)(const uint8_t *in, size_t in_frames,
+				   uint8_t *out);
+	size_t (*f32_51_to_quad)(const uint8_t *in, size_t in_frames,
+				 uint8_t *out);
+	size_t (*f32_stereo_to_quad)(size_t front_left, size_t front_right,
+				     size_t rear_left, size_t rear_right,
+				     const uint8_t *in, size_t in_frames,
+				     uint8_t *out);
+	size_t (*f32_quad_to_stereo)(size_t front_left, size_t front_right,
+				     size_t rear_left, size_t rear_right,
+				     const uint8_t *in, size_t in_frames,
+				     uint8_t *out);
+	size_t (*f32_default_all_to_all)(size_t num_in_ch, size_t num_out_ch,
+					 const uint8_t *in, size_t in_frames,
+					 uint8_t *out);
+	size_t (*f32_some_to_some)(size_t num_in_ch, size_t num_out_ch,
+				   const uint8_t *in, size_t frame_count,
+				   uint8_t *out);
+	float (*f32_multiply_buf_with_coef)(float *coef, const float *buf,
+					    size_t size);
+	size_t (*f32_convert_channels)(float **ch_conv_mtx, size_t num_in_ch,
+				       size_t num_out_ch, const uint8_t *in,
+				       size_t in_frames, uint8_t *out);
+	size_t (*f32_sparse_convert_channels)(
+		const struct cras_channel_matrix *m, const uint8_t *in,
+		size_t in_frames, uint8_t *out);
+};
+
+extern const struct cras_fmt_conv_ops fmt_conv_ops;
+extern const struct cras_fmt_conv_ops fmt_conv_ops_sse42;
+extern const struct cras_fmt_conv_ops fmt_conv_ops_avx;
+extern const struct cras_fmt_conv_ops fmt_conv_ops_avx2;
+extern const struct cras_fmt_conv_ops fmt_conv_ops_fma;
+
 #endif /* CRAS_FMT_CONV_OPS_H_ */
@@ -20,6 +20,7 @@
 #include "cras_server_metrics.h"
 #include "cras_system_state.h"
 #include "cras_iodev_list.h"
+#include "cras_tm.h"
 #include "cras_observer.h"
 #include "utlist.h"
 #include "packet_status_logger.h"
@@ -90,6 +91,12 @@
  *        the hfp/hsp audio gateway to wait for a2dp connection.
  *    conn - The dbus connection used to send message to bluetoothd.
  *    profile - The profile enum of this audio gateway.
+ *    sco_pcm - 1 if idev and odev route SCO over the PCM of the sco_pcm
+ *        iodevs, 0 if they run it through info on the audio thread.
+ *    sco_pcm_failed - Set when the SCO over PCM path failed to open, so the
+ *        audio gateway stays on hfp_info until it disconnects.
+ *    fallback_timer - Timer to replace the SCO over PCM iodevs once the
+ *        failed open has returned.
  */
 struct audio_gateway {
 	struct cras_iodev *idev;
@@ -100,26 +107,54 @@ struct audio_gateway {
 	int a2dp_delay_retries;
 	DBusConnection *conn;
 	enum cras_bt_device_profile profile;
+	int sco_pcm;
+	int sco_pcm_failed;
+	struct cras_timer *fallback_timer;
 	struct audio_gateway *prev, *next;
 };
 
 static struct audio_gateway *connected_ags;
 static struct packet_status_logger wbs_logger;
 
-static int need_go_sco_pcm(struct cras_bt_device *device)
+/* Offloading SCO to a PCM takes the mSBC codec and the SCO socket off the
+ * audio thread, so it is preferred whenever the board has one and it hasn't
+ * failed on this audio gateway. */
+static int need_go_sco_pcm(struct audio_gateway *ag)
 {
+	if (ag->sco_pcm_failed)
+		return 0;
 	return cras_iodev_list_get_sco_pcm_iodev(CRAS_STREAM_INPUT) ||
 	       cras_iodev_list_get_sco_pcm_iodev(CRAS_STREAM_OUTPUT);
 }
 
-static void destroy_audio_gateway(struct audio_gateway *ag)
+static void create_iodevs(struct audio_gateway *ag)
 {
-	DL_DELETE(connected_ags, ag);
+	ag->sco_pcm = need_go_sco_pcm(ag);
+	if (ag->sco_pcm) {
+		struct cras_iodev *in_aio, *out_aio;
 
-	cras_server_metrics_hfp_battery_indicator(
-		hfp_slc_get_hf_supports_battery_indicator(ag->slc_handle));
+		in_aio = cras_iodev_list_get_sco_pcm_iodev(CRAS_STREAM_INPUT);
+		out_aio = cras_iodev_list_get_sco_pcm_iodev(CRAS_STREAM_OUTPUT);
+
+		ag->idev = hfp_alsa_iodev_create(in_aio, ag->device,
+						 ag->slc_handle, ag->profile);
+		ag->odev = hfp_alsa_iodev_create(out_aio, ag->device,
+						 ag->slc_handle, ag->profile);
+	} else {
+		ag->info = hfp_info_create();
+		hfp_info_set_wbs_logger(ag->info, &wbs_logger);
+		ag->idev =
+			hfp_iodev_create(CRAS_STREAM_INPUT, ag->device,
+					 ag->slc_handle, ag->profile, ag->info);
+		ag->odev =
+			hfp_iodev_create(CRAS_STREAM_OUTPUT, ag->device,
+					 ag->slc_handle, ag->profile, ag->info);
+	}
+}
 
-	if (need_go_sco_pcm(ag->device)) {
+static void destroy_iodevs(struct audio_gateway *ag)
+{
+	if (ag->sco_pcm) {
 		if (ag->idev)
 			hfp_alsa_iodev_destroy(ag->idev);
 		if (ag->odev)
@@ -130,12 +165,29 @@ static void destroy_audio_gateway(struct audio_gateway *ag)
 		if (ag->odev)
 			hfp_iodev_destroy(ag->odev);
 	}
+	ag->idev = NULL;
+	ag->odev = NULL;
 
 	if (ag->info) {
 		if (hfp_info_running(ag->info))
 			hfp_info_stop(ag->info);
 		hfp_info_destroy(ag->info);
+		ag->info = NULL;
 	}
+}
+
+static void destroy_audio_gateway(struct audio_gateway *ag)
+{
+	DL_DELETE(connected_ags, ag);
+
+	cras_server_metrics_hfp_battery_indicator(
+		hfp_slc_get_hf_supports_battery_indicator(ag->slc_handle));
+
+	if (ag->fallback_timer)
+		cras_tm_cancel_timer(cras_system_state_get_tm(),
+				     ag->fallback_timer);
+
+	destroy_iodevs(ag);
 	if (ag->slc_handle)
 		hfp_slc_destroy(ag->slc_handle);
 
@@ -401,26 +453,7 @@ int cras_hfp_ag_start(struct cras_bt_device *device)
 	if (ag->idev)
 		return 0;
 
-	if (need_go_sco_pcm(device)) {
-		struct cras_iodev *in_aio, *out_aio;
-
-		in_aio = cras_iodev_list_get_sco_pcm_iodev(CRAS_STREAM_INPUT);
-		out_aio = cras_iodev_list_get_sco_pcm_iodev(CRAS_STREAM_OUTPUT);
-
-		ag->idev = hfp_alsa_iodev_create(in_aio, ag->device,
-						 ag->slc_handle, ag->profile);
-		ag->odev = hfp_alsa_iodev_create(out_aio, ag->device,
-						 ag->slc_handle, ag->profile);
-	} else {
-		ag->info = hfp_info_create();
-		hfp_info_set_wbs_logger(ag->info, &wbs_logger);
-		ag->idev =
-			hfp_iodev_create(CRAS_STREAM_INPUT, ag->device,
-					 ag->slc_handle, ag->profile, ag->info);
-		ag->odev =
-			hfp_iodev_create(CRAS_STREAM_OUTPUT, ag->device,
-					 ag->slc_handle, ag->profile, ag->info);
-	}
+	create_iodevs(ag);
 
 	if (!ag->idev && !ag->odev) {
 		destroy_audio_gateway(ag);
@@ -430,6 +463,43 @@ int cras_hfp_ag_start(struct cras_bt_device *device)
 	return 0;
 }
 
+/* Replaces the SCO over PCM iodevs of an audio gateway with the ones running
+ * on hfp_info. The service level connection is kept, so the headset and the
+ * call aren't affected other than the audio path being reopened. */
+static void sco_pcm_fallback(struct cras_timer *timer, void *arg)
+{
+	struct audio_gateway *ag = (struct audio_gateway *)arg;
+
+	ag->fallback_timer = NULL;
+	if (!ag->sco_pcm)
+		return;
+
+	syslog(LOG_WARNING, "Fall back from SCO over PCM for %s",
+	       cras_bt_device_name(ag->device));
+	destroy_iodevs(ag);
+	create_iodevs(ag);
+	if (!ag->idev && !ag->odev) {
+		cras_bt_device_notify_profile_dropped(
+			ag->device, CRAS_BT_DEVICE_PROFILE_HFP_HANDSFREE);
+		destroy_audio_gateway(ag);
+		return;
+	}
+	cras_bt_device_set_nodes_plugged(ag->device, 1);
+}
+
+void cras_hfp_ag_sco_pcm_failed(struct cras_bt_device *device)
+{
+	struct audio_gateway *ag;
+
+	DL_SEARCH_SCALAR(connected_ags, ag, device, device);
+	if (!ag || !ag->sco_pcm || ag->sco_pcm_failed)
+		return;
+
+	ag->sco_pcm_failed = 1;
+	ag->fallback_timer = cras_tm_create_timer(cras_system_state_get_tm(),
+						  0, sco_pcm_fallback, ag);
+}
+
 void cras_hfp_ag_suspend_connected_device(struct cras_bt_device *device)
 {
 	struct audio_gateway *ag;
@@ -44,6 +44,12 @@ int cras_hfp_ag_start(struct cras_bt_device *device);
  */
 int cras_hfp_ag_remove_conflict(struct cras_bt_device *device);
 
+/* Notifies the audio gateway of device that its SCO over PCM iodevs failed
+ * to open. The audio gateway switches to running SCO on the audio thread,
+ * without dropping the service level connection.
+ */
+void cras_hfp_ag_sco_pcm_failed(struct cras_bt_device *device);
+
 /* Suspends audio gateway associated with given bt device. */
 void cras_hfp_ag_suspend_connected_device(struct cras_bt_device *device);
 
@@ -8,6 +8,7 @@
 #include <syslog.h>
 
 #include "cras_audio_area.h"
+#include "cras_hfp_ag_profile.h"
 #include "cras_hfp_slc.h"
 #include "cras_iodev.h"
 #include "cras_system_state.h"
@@ -46,8 +47,12 @@ static int hfp_alsa_open_dev(struct cras_iodev *iodev)
 {
 	struct hfp_alsa_io *hfp_alsa_io = (struct hfp_alsa_io *)iodev;
 	struct cras_iodev *aio = hfp_alsa_io->aio;
+	int rc;
 
-	return aio->open_dev(aio);
+	rc = aio->open_dev(aio);
+	if (rc)
+		cras_hfp_ag_sco_pcm_failed(hfp_alsa_io->device);
+	return rc;
 }
 
 static int hfp_alsa_update_supported_formats(struct cras_iodev *iodev)
@@ -97,6 +102,7 @@ static int hfp_alsa_configure_dev(struct cras_iodev *iodev)
 	rc = aio->configure_dev(aio);
 	if (rc) {
 		syslog(LOG_ERR, "Failed to configure aio: %d\n", rc);
+		cras_hfp_ag_sco_pcm_failed(hfp_alsa_io->device);
 		return rc;
 	}
 
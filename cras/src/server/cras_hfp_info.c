@@ -3,11 +3,16 @@
  * found in the LICENSE file.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for sendmmsg and recvmmsg */
+#endif
+
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <syslog.h>
+#include <time.h>
 
 #include "audio_thread.h"
 #include "bluetooth.h"
@@ -44,17 +49,50 @@
 
 #define H2_HEADER_0 0x01
 
+/* The max number of SCO packets read and written in one wakeup of the audio
+ * thread. When the thread is late, the packets queued in the SCO socket are
+ * drained by one recvmmsg and answered by one sendmmsg, instead of being left
+ * behind to add latency one packet per wakeup. */
+#define MAX_SCO_PKTS_PER_WAKEUP 4
+
+/* Size of the control message holding the packet status of a SCO packet. */
+#define SCO_PKT_STATUS_CONTROL_SIZE CMSG_SPACE(sizeof(int))
+
+/* Size of write_buf and read_buf in wideband speech mode. SCO packets are
+ * sent from and received into them in place. Between wakeups less than one
+ * mSBC packet is left in either, and each SCO packet of a batch adds at most
+ * one more mSBC packet. */
+#define MSBC_SCO_BUF_SIZE ((MAX_SCO_PKTS_PER_WAKEUP + 1) * MSBC_PKT_SIZE)
+
+/* Capture jitter buffer in wideband speech mode. Decoded mSBC frames are
+ * released to the audio thread on a steady schedule, jb_depth frames behind
+ * their expected arrival, so bursty SCO delivery doesn't show as an uneven
+ * capture level. A frame not received by the time it is due is concealed by
+ * PLC, and dropped if it arrives later.
+ *    MSBC_FRAME_NSEC - Period of one mSBC frame, MSBC_CODE_SIZE bytes of
+ *        16kHz mono 16 bit PCM.
+ *    JB_MIN_DEPTH, JB_MAX_DEPTH - Bounds of the depth in mSBC frames.
+ *    JB_ANCHOR_FOLLOW - The expected arrival moves 1/JB_ANCHOR_FOLLOW of the
+ *        way towards a late frame, to follow clock drift.
+ *    JB_JITTER_DECAY - The peak lateness decays by 1/JB_JITTER_DECAY per
+ *        frame.
+ *    JB_RESYNC_NSEC - A frame this late restarts the schedule from it.
+ */
+#define MSBC_FRAME_NSEC 7500000LL
+#define JB_MIN_DEPTH 1
+#define JB_MAX_DEPTH 8
+#define JB_ANCHOR_FOLLOW 64
+#define JB_JITTER_DECAY 256
+#define JB_RESYNC_NSEC (4 * JB_MAX_DEPTH * MSBC_FRAME_NSEC)
+
 /* Supported HCI SCO packet sizes. The wideband speech mSBC frame parsing
  * code ties to limited packet size values. Specifically list them out
- * to check against when setting packet size.
- *
- * Temp buffer size should be set to least common multiple of HCI SCO packet
- * size and MSBC_PKT_SIZE for optimizing buffer copy.
+ * to check against when setting packet size. Packets must not be larger than
+ * MSBC_PKT_SIZE.
  * To add a new supported packet size value, add corresponding entry to the
- * lists, test the read/write msbc code, and fix the code if needed.
+ * list, test the read/write msbc code, and fix the code if needed.
  */
 static const size_t wbs_supported_packet_size[] = { 60, 24, 0 };
-static const size_t wbs_hci_sco_buffer_size[] = { 60, 120, 0 };
 
 /* Second octet of H2 header is composed by 4 bits fixed 0x8 and 4 bits
  * sequence number 0000, 0011, 1100, 1111. */
@@ -81,8 +119,13 @@ static const uint8_t h2_header_frames_count[] = { 0x08, 0x38, 0xc8, 0xf8 };
  *     read_cb - Callback to call when SCO socket can read. It returns the
  *         number of PCM bytes read.
  *     write_cb - Callback to call when SCO socket can write.
- *     write_buf - Temp buffer for writeing HCI SCO packet in wideband.
- *     read_buf - Temp buffer for reading HCI SCO packet in wideband.
+ *     num_pkts_read - The number of SCO packets read by the last read_cb in
+ *         wideband speech mode, which is also the number of packets the
+ *         following write_cb sends.
+ *     write_buf - Buffer mSBC packets are encoded into and HCI SCO packets
+ *         sent from in wideband.
+ *     read_buf - Buffer HCI SCO packets are received into and mSBC packets
+ *         decoded from in wideband.
  *     input_format_bytes - The audio format bytes for input device. 0 means
  *         there is no input device for the hfp_info.
  *     output_format_bytes - The audio format bytes for output device. 0 means
@@ -95,6 +138,17 @@ static const uint8_t h2_header_frames_count[] = { 0x08, 0x38, 0xc8, 0xf8 };
  *     msbc_read_current_corrupted - Flag to mark if the current mSBC frame
  *         read is corrupted.
  *     wbs_logger - The logger for packet status in WBS.
+ *     jb_started - If the capture jitter buffer has seen its first frame.
+ *     jb_anchor_ns - Expected arrival time of the first mSBC frame since
+ *         capture started, in CLOCK_MONOTONIC_RAW ns.
+ *     jb_jitter_ns - Decaying peak lateness of mSBC frames against their
+ *         expected arrival.
+ *     jb_depth - Target depth of the capture jitter buffer in mSBC frames.
+ *     jb_frames_in - mSBC frames put in capture_buf since capture started,
+ *         received or concealed.
+ *     jb_concealed - mSBC frames concealed ahead of their arrival. As many
+ *         frames arriving late are dropped.
+ *     thread - The audio thread running the SCO callback.
  */
 struct hfp_info {
 	int fd;
@@ -111,6 +165,7 @@ struct hfp_info {
 	unsigned int msbc_num_lost_frames;
 	int (*read_cb)(struct hfp_info *info);
 	int (*write_cb)(struct hfp_info *info);
+	unsigned int num_pkts_read;
 	uint8_t *write_buf;
 	uint8_t *read_buf;
 	size_t input_format_bytes;
@@ -119,11 +174,90 @@ struct hfp_info {
 	size_t write_rp;
 	size_t read_wp;
 	size_t read_rp;
-	int (*read_align_cb)(uint8_t *buf);
+	int (*read_align_cb)(const uint8_t *buf);
 	bool msbc_read_current_corrupted;
 	struct packet_status_logger *wbs_logger;
+	int jb_started;
+	int64_t jb_anchor_ns;
+	int64_t jb_jitter_ns;
+	unsigned int jb_depth;
+	unsigned int jb_frames_in;
+	unsigned int jb_concealed;
+	struct audio_thread *thread;
 };
 
+static int64_t clock_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void jb_reset(struct hfp_info *info)
+{
+	info->jb_started = 0;
+	info->jb_jitter_ns = 0;
+	info->jb_depth = JB_MIN_DEPTH;
+	info->jb_frames_in = 0;
+	info->jb_concealed = 0;
+}
+
+/* Updates the expected arrival and the depth of the capture jitter buffer
+ * with an mSBC frame received at now_ns.
+ * Returns:
+ *    1 if the frame was concealed already and should be dropped, otherwise
+ *    0.
+ */
+static int jb_frame_arrived(struct hfp_info *info, int64_t now_ns)
+{
+	int64_t late_ns;
+	unsigned int index;
+
+	index = info->jb_frames_in - info->jb_concealed;
+	if (!info->jb_started) {
+		info->jb_started = 1;
+		info->jb_anchor_ns = now_ns - index * MSBC_FRAME_NSEC;
+	}
+
+	late_ns = now_ns - (info->jb_anchor_ns + index * MSBC_FRAME_NSEC);
+	if (late_ns < 0 || late_ns > JB_RESYNC_NSEC) {
+		/* Early, or back from a stall. Expect the following frames
+		 * relative to this one. */
+		info->jb_anchor_ns = now_ns - index * MSBC_FRAME_NSEC;
+		late_ns = 0;
+	} else {
+		info->jb_anchor_ns += late_ns / JB_ANCHOR_FOLLOW;
+	}
+
+	info->jb_jitter_ns -= info->jb_jitter_ns / JB_JITTER_DECAY;
+	if (late_ns > info->jb_jitter_ns)
+		info->jb_jitter_ns = late_ns;
+	info->jb_depth =
+		MIN(info->jb_jitter_ns / MSBC_FRAME_NSEC + 1, JB_MAX_DEPTH);
+	info->jb_depth = MAX(info->jb_depth, JB_MIN_DEPTH);
+
+	if (info->jb_concealed) {
+		info->jb_concealed--;
+		return 1;
+	}
+	info->jb_frames_in++;
+	return 0;
+}
+
+/* Number of mSBC frames due to the audio thread at now_ns. */
+static unsigned int jb_frames_due(struct hfp_info *info, int64_t now_ns)
+{
+	int64_t slots;
+
+	if (!info->jb_started || now_ns < info->jb_anchor_ns)
+		return 0;
+	slots = (now_ns - info->jb_anchor_ns) / MSBC_FRAME_NSEC + 1;
+	if (slots <= info->jb_depth)
+		return 0;
+	return slots - info->jb_depth;
+}
+
 int hfp_info_add_iodev(struct hfp_info *info,
 		       enum CRAS_STREAM_DIRECTION direction,
 		       struct cras_audio_format *format)
@@ -140,6 +274,7 @@ int hfp_info_add_iodev(struct hfp_info *info,
 		info->input_format_bytes = cras_get_format_bytes(format);
 
 		buf_reset(info->capture_buf);
+		jb_reset(info);
 	}
 
 	return 0;
@@ -226,6 +361,58 @@ int hfp_buf_queued(struct hfp_info *info, enum CRAS_STREAM_DIRECTION direction)
 		return 0;
 }
 
+/* Conceals the mSBC frames up to the due one not received yet, as long as
+ * no more than JB_MAX_DEPTH of them are outstanding. */
+static void jb_conceal_overdue(struct hfp_info *info, unsigned int due)
+{
+	unsigned int pcm_avail;
+	uint8_t *in_bytes;
+	int decoded;
+
+	while (info->jb_frames_in < due && info->jb_concealed < JB_MAX_DEPTH) {
+		in_bytes = buf_write_pointer_size(info->capture_buf, &pcm_avail);
+		if (pcm_avail < MSBC_CODE_SIZE)
+			return;
+		decoded = cras_msbc_plc_handle_bad_frames(
+			info->msbc_plc, info->msbc_read, in_bytes);
+		if (decoded < 0)
+			return;
+		buf_increment_write(info->capture_buf, decoded);
+		info->jb_frames_in++;
+		info->jb_concealed++;
+	}
+}
+
+int hfp_capture_frames_due(struct hfp_info *info)
+{
+	unsigned int due, held, queued;
+
+	if (!info->input_format_bytes)
+		return 0;
+	queued = buf_queued(info->capture_buf);
+	if (!info->msbc_read)
+		return queued / info->input_format_bytes;
+
+	due = jb_frames_due(info, clock_ns());
+	jb_conceal_overdue(info, due);
+	queued = buf_queued(info->capture_buf);
+
+	/* Hold back the frames not due yet. */
+	held = 0;
+	if (info->jb_frames_in > due)
+		held = (info->jb_frames_in - due) * MSBC_CODE_SIZE;
+	if (held >= queued)
+		return 0;
+	return (queued - held) / info->input_format_bytes;
+}
+
+unsigned int hfp_capture_jitter_depth(struct hfp_info *info)
+{
+	if (!info->input_format_bytes || !info->msbc_read)
+		return 0;
+	return info->jb_depth * MSBC_CODE_SIZE / info->input_format_bytes;
+}
+
 int hfp_fill_output_with_zeros(struct hfp_info *info, unsigned int nframes)
 {
 	unsigned int buf_avail;
@@ -261,18 +448,16 @@ void hfp_force_output_level(struct hfp_info *info, unsigned int level)
 	}
 }
 
-int hfp_write_msbc(struct hfp_info *info)
+/* Encodes the next MSBC_CODE_SIZE bytes of playback_buf into one mSBC packet
+ * appended to write_buf. */
+static int msbc_encode_packet(struct hfp_info *info)
 {
 	size_t encoded;
-	int err;
 	int pcm_encoded;
 	unsigned int pcm_avail, to_write;
 	uint8_t *samples;
 	uint8_t *wp;
 
-	if (info->write_rp + info->packet_size <= info->write_wp)
-		goto msbc_send_again;
-
 	/* Make sure there are MSBC_CODE_SIZE bytes to encode. */
 	samples = buf_read_pointer_size(info->playback_buf, &pcm_avail);
 	if (pcm_avail < MSBC_CODE_SIZE) {
@@ -302,32 +487,63 @@ int hfp_write_msbc(struct hfp_info *info)
 		return pcm_encoded;
 	}
 	buf_increment_read(info->playback_buf, pcm_encoded);
-	pcm_avail -= pcm_encoded;
 	info->write_wp += MSBC_PKT_SIZE;
 	info->msbc_num_out_frames++;
 
-	if (info->write_rp + info->packet_size > info->write_wp)
-		return 0;
+	return 0;
+}
 
-msbc_send_again:
-	err = send(info->fd, info->write_buf + info->write_rp,
-		   info->packet_size, 0);
-	if (err < 0) {
-		if (errno == EINTR)
-			goto msbc_send_again;
-		return err;
-	}
-	if (err != (int)info->packet_size) {
-		syslog(LOG_ERR, "Partially write %d bytes for mSBC", err);
-		return -1;
+int hfp_write_msbc(struct hfp_info *info)
+{
+	struct mmsghdr msgs[MAX_SCO_PKTS_PER_WAKEUP];
+	struct iovec iovs[MAX_SCO_PKTS_PER_WAKEUP];
+	unsigned int num_pkts, sent;
+	unsigned int i;
+	int err;
+
+	/* Answer each packet read with one packet written. */
+	num_pkts = MAX(info->num_pkts_read, 1);
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < num_pkts; i++) {
+		if (info->write_rp + info->packet_size > info->write_wp) {
+			err = msbc_encode_packet(info);
+			if (err < 0)
+				return err;
+		}
+		iovs[i].iov_base = info->write_buf + info->write_rp;
+		iovs[i].iov_len = info->packet_size;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		info->write_rp += info->packet_size;
 	}
-	info->write_rp += info->packet_size;
-	if (info->write_rp == info->write_wp) {
-		info->write_rp = 0;
-		info->write_wp = 0;
+
+	for (sent = 0; sent < num_pkts; sent += err) {
+		err = sendmmsg(info->fd, msgs + sent, num_pkts - sent, 0);
+		if (err < 0) {
+			if (errno == EINTR) {
+				err = 0;
+				continue;
+			}
+			return err;
+		}
+		for (i = sent; i < sent + err; i++) {
+			if (msgs[i].msg_len != info->packet_size) {
+				syslog(LOG_ERR,
+				       "Partially write %u bytes for mSBC",
+				       msgs[i].msg_len);
+				return -1;
+			}
+		}
 	}
 
-	return err;
+	/* Move the part of an mSBC packet not sent yet to the front. */
+	info->write_wp -= info->write_rp;
+	memmove(info->write_buf, info->write_buf + info->write_rp,
+		info->write_wp);
+	info->write_rp = 0;
+
+	return num_pkts * info->packet_size;
 }
 
 int hfp_write(struct hfp_info *info)
@@ -386,22 +602,31 @@ static int h2_header_get_seq(const uint8_t *p)
 static const uint8_t *extract_msbc_frame(const uint8_t *input, int len,
 					 unsigned int *seq_out)
 {
-	int rp = 0;
-	int seq = -1;
-	while (len - rp >= MSBC_FRAME_SIZE) {
-		if ((input[rp] != H2_HEADER_0) ||
-		    (input[rp + 2] != MSBC_SYNC_WORD)) {
-			rp++;
-			continue;
+	const uint8_t *sync, *end;
+	int seq;
+
+	if (len < MSBC_FRAME_SIZE)
+		return NULL;
+
+	/* Look for the sync word, the third byte of an mSBC frame head, with
+	 * memchr which libc vectorizes, rather than testing the header bytes
+	 * at each position. */
+	sync = input + MSBC_H2_HEADER_LEN;
+	end = input + len - MSBC_FRAME_SIZE + MSBC_H2_HEADER_LEN + 1;
+	while (sync < end) {
+		sync = (const uint8_t *)memchr(sync, MSBC_SYNC_WORD,
+					       end - sync);
+		if (!sync)
+			break;
+		if (sync[-MSBC_H2_HEADER_LEN] == H2_HEADER_0) {
+			seq = h2_header_get_seq(sync - 1);
+			if (seq >= 0) {
+				// `seq` is guaranteed to be positive now.
+				*seq_out = (unsigned int)seq;
+				return sync - MSBC_H2_HEADER_LEN;
+			}
 		}
-		seq = h2_header_get_seq(input + rp + 1);
-		if (seq < 0) {
-			rp++;
-			continue;
-		}
-		// `seq` is guaranteed to be positive now.
-		*seq_out = (unsigned int)seq;
-		return input + rp;
+		sync++;
 	}
 	return NULL;
 }
@@ -438,6 +663,14 @@ static int handle_packet_loss(struct hfp_info *info)
 
 	log_wbs_packet_lost(info);
 
+	/* Already concealed when it was due. */
+	if (info->jb_concealed) {
+		info->jb_concealed--;
+		return 0;
+	}
+	if (info->input_format_bytes)
+		info->jb_frames_in++;
+
 	in_bytes = buf_write_pointer_size(info->capture_buf, &pcm_avail);
 	if (pcm_avail < MSBC_CODE_SIZE)
 		return 0;
@@ -453,7 +686,7 @@ static int handle_packet_loss(struct hfp_info *info)
 }
 
 /* Checks if mSBC frame header aligns with the beginning of buffer. */
-static int msbc_frame_align(uint8_t *buf)
+static int msbc_frame_align(const uint8_t *buf)
 {
 	if ((buf[0] != H2_HEADER_0) || (buf[2] != MSBC_SYNC_WORD)) {
 		syslog(LOG_DEBUG, "Waiting for valid mSBC frame head");
@@ -462,7 +695,19 @@ static int msbc_frame_align(uint8_t *buf)
 	return 1;
 }
 
-int hfp_read_msbc(struct hfp_info *info)
+/*
+ * Parses one SCO packet read in wideband speech mode, and decodes the mSBC
+ * frame it completes if any.
+ * Args:
+ *    info - The hfp_info instance. The packet is received at read_wp of
+ *        read_buf.
+ *    pkt_status - The HCI SCO packet status flag of the packet.
+ *    now_ns - The time the packet was read.
+ * Returns:
+ *    The number of PCM bytes put in capture_buf, or a negative error code.
+ */
+static int msbc_read_packet(struct hfp_info *info, uint8_t pkt_status,
+			    int64_t now_ns)
 {
 	int err = 0;
 	unsigned int pcm_avail = 0;
@@ -473,57 +718,15 @@ int hfp_read_msbc(struct hfp_info *info)
 	const uint8_t *frame_head = NULL;
 	unsigned int seq;
 
-	struct msghdr msg = { 0 };
-	struct iovec iov;
-	struct cmsghdr *cmsg;
-	const unsigned int control_size = CMSG_SPACE(sizeof(int));
-	char control[control_size];
-	uint8_t pkt_status;
-
-	memset(control, 0, sizeof(control));
-recv_msbc_bytes:
-	msg.msg_iov = &iov;
-	msg.msg_iovlen = 1;
-	iov.iov_base = info->read_buf + info->read_wp;
-	iov.iov_len = info->packet_size;
-	msg.msg_control = control;
-	msg.msg_controllen = control_size;
-
-	err = recvmsg(info->fd, &msg, 0);
-	if (err < 0) {
-		syslog(LOG_ERR, "HCI SCO packet read err %s", strerror(errno));
-		if (errno == EINTR)
-			goto recv_msbc_bytes;
-		return err;
-	}
-	/*
-	 * Treat return code 0 (socket shutdown) as error here. BT stack
-	 * shall send signal to main thread for device disconnection.
-	 */
-	if (err != (int)info->packet_size) {
-		syslog(LOG_ERR, "Partially read %d bytes for mSBC packet", err);
-		return -1;
-	}
-
 	/* Offset in input data breaks mSBC frame parsing. Discard this packet
 	 * until read alignment succeed. */
 	if (info->read_align_cb) {
-		if (!info->read_align_cb(info->read_buf))
+		if (!info->read_align_cb(info->read_buf + info->read_wp))
 			return 0;
 		else
 			info->read_align_cb = NULL;
 	}
-	info->read_wp += err;
-
-	pkt_status = 0;
-	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
-	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-		if (cmsg->cmsg_level == SOL_BLUETOOTH &&
-		    cmsg->cmsg_type == BT_SCM_PKT_STATUS) {
-			size_t len = cmsg->cmsg_len - sizeof(*cmsg);
-			memcpy(&pkt_status, CMSG_DATA(cmsg), len);
-		}
-	}
+	info->read_wp += info->packet_size;
 
 	/*
 	 * HCI SCO packet status flag:
@@ -560,10 +763,6 @@ recv_msbc_bytes:
 	 * found, we shall handle it as packet loss.
 	 */
 	info->read_rp += MSBC_PKT_SIZE;
-	if (info->read_rp == info->read_wp) {
-		info->read_rp = 0;
-		info->read_wp = 0;
-	}
 	if (!frame_head)
 		return handle_packet_loss(info);
 
@@ -600,8 +799,10 @@ recv_msbc_bytes:
 	} else {
 		/* Good mSBC frame decoded. */
 		log_wbs_packet_received(info);
-		buf_increment_write(info->capture_buf, pcm_decoded);
 		info->msbc_num_in_frames++;
+		if (info->input_format_bytes && jb_frame_arrived(info, now_ns))
+			return pcm_read;
+		buf_increment_write(info->capture_buf, pcm_decoded);
 		cras_msbc_plc_handle_good_frames(info->msbc_plc, capture_buf,
 						 capture_buf);
 		pcm_read += pcm_decoded;
@@ -609,6 +810,84 @@ recv_msbc_bytes:
 	return pcm_read;
 }
 
+int hfp_read_msbc(struct hfp_info *info)
+{
+	struct mmsghdr msgs[MAX_SCO_PKTS_PER_WAKEUP];
+	struct iovec iovs[MAX_SCO_PKTS_PER_WAKEUP];
+	char controls[MAX_SCO_PKTS_PER_WAKEUP][SCO_PKT_STATUS_CONTROL_SIZE];
+	struct cmsghdr *cmsg;
+	uint8_t pkt_status;
+	int max_pkts, num_pkts, i;
+	int err;
+	int pcm_read = 0;
+	int64_t now_ns;
+
+	info->num_pkts_read = 0;
+
+	/* A packet dropped while aligning would leave a hole in read_buf, so
+	 * take one at a time until aligned. */
+	max_pkts = info->read_align_cb ? 1 : MAX_SCO_PKTS_PER_WAKEUP;
+
+	memset(msgs, 0, sizeof(msgs));
+	memset(controls, 0, sizeof(controls));
+	for (i = 0; i < max_pkts; i++) {
+		iovs[i].iov_base =
+			info->read_buf + info->read_wp + i * info->packet_size;
+		iovs[i].iov_len = info->packet_size;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_control = controls[i];
+		msgs[i].msg_hdr.msg_controllen = SCO_PKT_STATUS_CONTROL_SIZE;
+	}
+
+	/* Wait for the first packet like a plain read, then take the ones
+	 * already queued behind it. */
+recv_msbc_bytes:
+	num_pkts = recvmmsg(info->fd, msgs, max_pkts, MSG_WAITFORONE, NULL);
+	if (num_pkts < 0) {
+		syslog(LOG_ERR, "HCI SCO packet read err %s", strerror(errno));
+		if (errno == EINTR)
+			goto recv_msbc_bytes;
+		return num_pkts;
+	}
+	now_ns = clock_ns();
+
+	for (i = 0; i < num_pkts; i++) {
+		/*
+		 * Treat return code 0 (socket shutdown) as error here. BT stack
+		 * shall send signal to main thread for device disconnection.
+		 */
+		if (msgs[i].msg_len != info->packet_size) {
+			syslog(LOG_ERR, "Partially read %u bytes for mSBC packet",
+			       msgs[i].msg_len);
+			return -1;
+		}
+
+		pkt_status = 0;
+		for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg != NULL;
+		     cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+			if (cmsg->cmsg_level == SOL_BLUETOOTH &&
+			    cmsg->cmsg_type == BT_SCM_PKT_STATUS) {
+				size_t len = cmsg->cmsg_len - sizeof(*cmsg);
+				memcpy(&pkt_status, CMSG_DATA(cmsg), len);
+			}
+		}
+
+		err = msbc_read_packet(info, pkt_status, now_ns);
+		if (err < 0)
+			return err;
+		pcm_read += err;
+		info->num_pkts_read++;
+	}
+
+	/* Move the part of an mSBC packet not parsed yet to the front. */
+	info->read_wp -= info->read_rp;
+	memmove(info->read_buf, info->read_buf + info->read_rp, info->read_wp);
+	info->read_rp = 0;
+
+	return pcm_read;
+}
+
 int hfp_read(struct hfp_info *info)
 {
 	int err = 0;
@@ -657,9 +936,11 @@ recv_sample:
  * there is actual some sample to read while the socket always reports
  * writable even when device buffer is full.
  * The strategy is to synchronize read & write operations:
- * 1. Read one chunk of MTU bytes of data.
+ * 1. Read one chunk of MTU bytes of data. In wideband speech mode, read all
+ *    the packets queued up to MAX_SCO_PKTS_PER_WAKEUP.
  * 2. When input device not attached, ignore the data just read.
- * 3. When output device attached, write one chunk of MTU bytes of data.
+ * 3. When output device attached, write one chunk of MTU bytes of data, or
+ *    as many mSBC packets as were read.
  */
 static int hfp_info_callback(void *arg, int revents)
 {
@@ -707,7 +988,7 @@ read_write_error:
 	 * This callback is executing in audio thread, so it's safe to
 	 * unregister itself by audio_thread_rm_callback().
 	 */
-	audio_thread_rm_callback(info->fd);
+	audio_thread_rm_callback(info->thread, info->fd);
 	close(info->fd);
 	info->fd = 0;
 	info->started = 0;
@@ -754,7 +1035,8 @@ int hfp_info_running(struct hfp_info *info)
 	return info->started;
 }
 
-int hfp_info_start(int fd, unsigned int mtu, int codec, struct hfp_info *info)
+int hfp_info_start(int fd, unsigned int mtu, int codec, struct hfp_info *info,
+		   struct audio_thread *thread)
 {
 	info->fd = fd;
 	info->mtu = mtu;
@@ -778,8 +1060,8 @@ int hfp_info_start(int fd, unsigned int mtu, int codec, struct hfp_info *info)
 			i = 0;
 		}
 		info->packet_size = wbs_supported_packet_size[i];
-		info->write_buf = (uint8_t *)malloc(wbs_hci_sco_buffer_size[i]);
-		info->read_buf = (uint8_t *)malloc(wbs_hci_sco_buffer_size[i]);
+		info->write_buf = (uint8_t *)malloc(MSBC_SCO_BUF_SIZE);
+		info->read_buf = (uint8_t *)malloc(MSBC_SCO_BUF_SIZE);
 
 		info->write_cb = hfp_write_msbc;
 		info->read_cb = hfp_read_msbc;
@@ -793,17 +1075,20 @@ int hfp_info_start(int fd, unsigned int mtu, int codec, struct hfp_info *info)
 		info->read_cb = hfp_read;
 	}
 
-	audio_thread_add_events_callback(info->fd, hfp_info_callback, info,
-					 POLLIN | POLLERR | POLLHUP);
+	info->thread = thread;
+	audio_thread_add_events_callback(thread, info->fd, hfp_info_callback,
+					 info, POLLIN | POLLERR | POLLHUP);
 
 	info->started = 1;
 	info->msbc_num_out_frames = 0;
 	info->msbc_num_in_frames = 0;
 	info->msbc_num_lost_frames = 0;
+	info->num_pkts_read = 0;
 	info->write_rp = 0;
 	info->write_wp = 0;
 	info->read_rp = 0;
 	info->read_wp = 0;
+	jb_reset(info);
 
 	/* Mark as aligned if packet size equals to MSBC_PKT_SIZE. */
 	info->read_align_cb =
@@ -818,8 +1103,7 @@ int hfp_info_stop(struct hfp_info *info)
 	if (!info->started)
 		return 0;
 
-	audio_thread_rm_callback_sync(cras_iodev_list_get_audio_thread(),
-				      info->fd);
+	audio_thread_rm_callback_sync(info->thread, info->fd);
 
 	close(info->fd);
 	info->fd = 0;
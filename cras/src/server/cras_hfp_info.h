@@ -9,6 +9,8 @@
 #include "cras_audio_format.h"
 #include "cras_types.h"
 
+struct audio_thread;
+
 /* Linked list to hold the information of callbacks to trigger
  * when the size of SCO packet has changed.
  */
@@ -41,8 +43,10 @@ int hfp_info_running(struct hfp_info *info);
  * descriptor of a SCO socket. This should be called from main thread.
  * Args:
  *    codec - 1 for CVSD, 2 for mSBC per HFP 1.7 specification.
+ *    thread - The audio thread servicing the HFP iodevs.
  */
-int hfp_info_start(int fd, unsigned int mtu, int codec, struct hfp_info *info);
+int hfp_info_start(int fd, unsigned int mtu, int codec, struct hfp_info *info,
+		   struct audio_thread *thread);
 
 /* Stops given hfp_info. This implies sample transmission will
  * stop and socket be closed. This should be called from main thread.
@@ -57,6 +61,18 @@ int hfp_info_stop(struct hfp_info *info);
  */
 int hfp_buf_queued(struct hfp_info *info, enum CRAS_STREAM_DIRECTION direction);
 
+/* Queries how many captured frames are due for the audio thread to read.
+ * In wideband speech mode the capture jitter buffer holds back the frames
+ * not due yet, and conceals the frames due but not received.
+ * Args:
+ *    info - The hfp_info holding the capture buffer.
+ */
+int hfp_capture_frames_due(struct hfp_info *info);
+
+/* Gets the target depth of the capture jitter buffer in frames, the
+ * latency it adds on top of the frames due. */
+unsigned int hfp_capture_jitter_depth(struct hfp_info *info);
+
 /* Fill output buffer with zero frames.
  * Args:
  *    info - The hfp_info holding the output buffer.
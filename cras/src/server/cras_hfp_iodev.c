@@ -15,6 +15,7 @@
 #include "cras_hfp_info.h"
 #include "cras_hfp_slc.h"
 #include "cras_iodev.h"
+#include "cras_iodev_list.h"
 #include "cras_system_state.h"
 #include "cras_util.h"
 #include "sfh.h"
@@ -120,6 +121,8 @@ static int frames_queued(const struct cras_iodev *iodev,
 	/* Do not enable timestamp mechanism on HFP device because last time
 	 * stamp might be a long time ago and it is not really useful. */
 	clock_gettime(CLOCK_MONOTONIC_RAW, tstamp);
+	if (iodev->direction == CRAS_STREAM_INPUT)
+		return hfp_capture_frames_due(hfpio->info);
 	return hfp_buf_queued(hfpio->info, iodev->direction);
 }
 
@@ -159,7 +162,8 @@ static int configure_dev(struct cras_iodev *iodev)
 
 	/* Start hfp_info */
 	err = hfp_info_start(sk, mtu, hfp_slc_get_selected_codec(hfpio->slc),
-			     hfpio->info);
+			     hfpio->info,
+			     cras_iodev_list_get_dev_audio_thread(iodev));
 	if (err)
 		goto error;
 
@@ -204,9 +208,16 @@ static void set_hfp_volume(struct cras_iodev *iodev)
 
 static int delay_frames(const struct cras_iodev *iodev)
 {
+	struct hfp_io *hfpio = (struct hfp_io *)iodev;
 	struct timespec tstamp;
+	int rc;
+
+	rc = frames_queued(iodev, &tstamp);
+	if (rc < 0 || iodev->direction != CRAS_STREAM_INPUT)
+		return rc;
 
-	return frames_queued(iodev, &tstamp);
+	/* Captured frames wait in the jitter buffer before they are due. */
+	return rc + hfp_capture_jitter_depth(hfpio->info);
 }
 
 static int get_buffer(struct cras_iodev *iodev, struct cras_audio_area **area,
@@ -346,6 +357,10 @@ struct cras_iodev *hfp_iodev_create(enum CRAS_STREAM_DIRECTION dir,
 	cras_bt_device_append_iodev(device, iodev, profile);
 
 	hfpio->info = info;
+	/* The input and output share the SCO socket and its callback, which
+	 * also clocks both of them. */
+	iodev->thread_key = info;
+	iodev->clock_domain = info;
 
 	/* Record max supported channels into cras_iodev_info. */
 	iodev->info.max_supported_channels = 1;
@@ -118,6 +118,32 @@ struct at_command {
 	int (*callback)(struct hfp_slc_handle *handle, const char *cmd);
 };
 
+/* Returns the arguments of an AT command, what follows the first '='. To
+ * be walked with at_next_arg(). */
+static const char *at_args(const char *cmd)
+{
+	const char *args = strchr(cmd, '=');
+
+	return args ? args + 1 : "";
+}
+
+/* Returns the next comma separated argument and moves *args past it, NULL
+ * if there are no more. Like strtok() empty arguments are skipped, but the
+ * command is left as it is so nothing has to be copied. The argument is not
+ * terminated, it ends at the next ',' which atoi() stops at.
+ */
+static const char *at_next_arg(const char **args)
+{
+	const char *arg = *args;
+
+	while (*arg == ',')
+		arg++;
+	if (*arg == '\0')
+		return NULL;
+	*args = arg + strcspn(arg, ",");
+	return arg;
+}
+
 /* Sends a response or command to HF */
 static int hfp_send(struct hfp_slc_handle *handle, const char *buf)
 {
@@ -286,18 +312,16 @@ static int bluetooth_codec_connection(struct hfp_slc_handle *handle,
 static int bluetooth_codec_selection(struct hfp_slc_handle *handle,
 				     const char *cmd)
 {
-	char *tokens = strdup(cmd);
-	char *codec;
-	int id, err;
+	const char *args = at_args(cmd);
+	const char *codec;
+	int id;
 
-	strtok(tokens, "=");
-	codec = strtok(NULL, ",");
+	codec = at_next_arg(&args);
 	if (!codec)
-		goto bcs_cmd_cleanup;
+		goto bcs_cmd_done;
 	id = atoi(codec);
 	if ((id <= HFP_CODEC_UNUSED) || (id >= HFP_MAX_CODECS)) {
 		syslog(LOG_ERR, "%s: invalid codec id: '%s'", __func__, cmd);
-		free(tokens);
 		return hfp_send(handle, AT_CMD("ERROR"));
 	}
 
@@ -308,10 +332,8 @@ static int bluetooth_codec_selection(struct hfp_slc_handle *handle,
 	BTLOG(btlog, BT_CODEC_SELECTION, 1, id);
 	handle->selected_codec = id;
 
-bcs_cmd_cleanup:
-	free(tokens);
-	err = hfp_send(handle, AT_CMD("OK"));
-	return err;
+bcs_cmd_done:
+	return hfp_send(handle, AT_CMD("OK"));
 }
 
 /*
@@ -322,7 +344,8 @@ bcs_cmd_cleanup:
 static int apple_accessory_state_change(struct hfp_slc_handle *handle,
 					const char *cmd)
 {
-	char *tokens, *num, *key, *val;
+	const char *args = at_args(cmd);
+	const char *num, *key, *val;
 	int i, level;
 
 	/* AT+IPHONEACCEV=Number of key/value pairs,key1,val1,key2,val2,...
@@ -334,17 +357,13 @@ static int apple_accessory_state_change(struct hfp_slc_handle *handle,
          * Battery Level: string value between '0' and '9'
          * Dock State: 0 = undocked, 1 = docked
 	 */
-	tokens = strdup(cmd);
-	strtok(tokens, "=");
-	num = strtok(NULL, ",");
-	if (!num) {
-		free(tokens);
+	num = at_next_arg(&args);
+	if (!num)
 		return hfp_send(handle, AT_CMD("ERROR"));
-	}
 
 	for (i = 0; i < atoi(num); i++) {
-		key = strtok(NULL, ",");
-		val = strtok(NULL, ",");
+		key = at_next_arg(&args);
+		val = at_next_arg(&args);
 		if (!key || !val) {
 			syslog(LOG_WARNING,
 			       "IPHONEACCEV: Expected %d kv pairs but got %d",
@@ -372,7 +391,6 @@ static int apple_accessory_state_change(struct hfp_slc_handle *handle,
 			}
 		}
 	}
-	free(tokens);
 	return hfp_send(handle, AT_CMD("OK"));
 }
 
@@ -383,18 +401,16 @@ static int apple_accessory_state_change(struct hfp_slc_handle *handle,
 static int apple_supported_features(struct hfp_slc_handle *handle,
 				    const char *cmd)
 {
-	char *tokens, *features;
+	const char *args = at_args(cmd);
+	const char *features;
 	int apple_features, err;
 	char buf[64];
 
 	/* AT+XAPL=<vendorID>-<productID>-<version>,<features>
 	 * Parse <features>, the only token we care about.
 	 */
-	tokens = strdup(cmd);
-	strtok(tokens, "=");
-
-	strtok(NULL, ",");
-	features = strtok(NULL, ",");
+	at_next_arg(&args);
+	features = at_next_arg(&args);
 	if (!features)
 		goto error_out;
 
@@ -410,35 +426,31 @@ static int apple_supported_features(struct hfp_slc_handle *handle,
 	if (err)
 		goto error_out;
 
-	err = hfp_send(handle, AT_CMD("OK"));
-	free(tokens);
-	return err;
+	return hfp_send(handle, AT_CMD("OK"));
 
 error_out:
 	syslog(LOG_ERR, "%s: malformed command: '%s'", __func__, cmd);
-	free(tokens);
 	return hfp_send(handle, AT_CMD("ERROR"));
 }
 
 /* Handles the event when headset reports its available codecs list. */
 static int available_codecs(struct hfp_slc_handle *handle, const char *cmd)
 {
-	char *tokens, *id_str;
+	const char *args = at_args(cmd);
+	const char *id_str;
 	int id;
 
 	for (id = 0; id < HFP_MAX_CODECS; id++)
 		handle->hf_codec_supported[id] = false;
 
-	tokens = strdup(cmd);
-	strtok(tokens, "=");
-	id_str = strtok(NULL, ",");
+	id_str = at_next_arg(&args);
 	while (id_str) {
 		id = atoi(id_str);
 		if ((id > HFP_CODEC_UNUSED) && (id < HFP_MAX_CODECS)) {
 			handle->hf_codec_supported[id] = true;
 			BTLOG(btlog, BT_AVAILABLE_CODECS, 0, id);
 		}
-		id_str = strtok(NULL, ",");
+		id_str = at_next_arg(&args);
 	}
 
 	for (id = HFP_MAX_CODECS - 1; id > 0; id--) {
@@ -448,7 +460,6 @@ static int available_codecs(struct hfp_slc_handle *handle, const char *cmd)
 		}
 	}
 
-	free(tokens);
 	return hfp_send(handle, AT_CMD("OK"));
 }
 
@@ -458,19 +469,17 @@ static int available_codecs(struct hfp_slc_handle *handle, const char *cmd)
  */
 static int event_reporting(struct hfp_slc_handle *handle, const char *cmd)
 {
-	char *tokens, *mode, *tmp;
+	const char *args = at_args(cmd);
+	const char *mode, *tmp;
 	int err = 0;
 
 	/* AT+CMER=[<mode>[,<keyp>[,<disp>[,<ind> [,<bfr>]]]]]
 	 * Parse <ind>, the only token we care about.
 	 */
-	tokens = strdup(cmd);
-	strtok(tokens, "=");
-
-	mode = strtok(NULL, ",");
-	tmp = strtok(NULL, ",");
-	tmp = strtok(NULL, ",");
-	tmp = strtok(NULL, ",");
+	mode = at_next_arg(&args);
+	tmp = at_next_arg(&args);
+	tmp = at_next_arg(&args);
+	tmp = at_next_arg(&args);
 
 	/* mode = 3 for forward unsolicited result codes.
 	 * AT+CMER=3,0,0,1 activates “indicator events reporting”.
@@ -511,7 +520,6 @@ static int event_reporting(struct hfp_slc_handle *handle, const char *cmd)
 		initialize_slc_handle(NULL, (void *)handle);
 
 event_reporting_done:
-	free(tokens);
 	return err;
 }
 
@@ -688,7 +696,7 @@ static int indicator_activation(struct hfp_slc_handle *handle, const char *cmd)
  */
 static int indicator_support(struct hfp_slc_handle *handle, const char *cmd)
 {
-	char *tokens, *key;
+	const char *args, *key;
 	int err, cmd_len;
 
 	cmd_len = strlen(cmd);
@@ -721,16 +729,14 @@ static int indicator_support(struct hfp_slc_handle *handle, const char *cmd)
 		}
 		/* AT+BIND=<a>,<b>,...,<n>(List HF supported indicators) */
 		else {
-			tokens = strdup(cmd);
-			strtok(tokens, "=");
-			key = strtok(NULL, ",");
+			args = at_args(cmd);
+			key = at_next_arg(&args);
 			while (key != NULL) {
 				if (atoi(key) == 2)
 					handle->hf_supports_battery_indicator |=
 						CRAS_HFP_BATTERY_INDICATOR_HFP;
-				key = strtok(NULL, ",");
+				key = at_next_arg(&args);
 			}
-			free(tokens);
 		}
 	}
 	/* AT+BIND? (Read AG enabled/disabled status of indicators) */
@@ -786,20 +792,19 @@ error_out:
 static int indicator_state_change(struct hfp_slc_handle *handle,
 				  const char *cmd)
 {
-	char *tokens, *key, *val;
+	const char *args = at_args(cmd);
+	const char *key, *val;
 	int level;
 	/* AT+BIEV= <assigned number>,<value> (Update value of indicator)
 	 * CRAS only supports battery level, which is with assigned number 2.
 	 * Battery level should range from 0 to 100 defined by the spec.
 	 */
-	tokens = strdup(cmd);
-	strtok(tokens, "=");
-	key = strtok(NULL, ",");
+	key = at_next_arg(&args);
 	if (!key)
 		goto error_out;
 
 	if (atoi(key) == 2) {
-		val = strtok(NULL, ",");
+		val = at_next_arg(&args);
 		if (!val)
 			goto error_out;
 		level = atoi(val);
@@ -820,12 +825,10 @@ static int indicator_state_change(struct hfp_slc_handle *handle,
 		goto error_out;
 	}
 
-	free(tokens);
 	return hfp_send(handle, AT_CMD("OK"));
 
 error_out:
 	syslog(LOG_WARNING, "%s: invalid command: '%s'", __func__, cmd);
-	free(tokens);
 	return hfp_send(handle, AT_CMD("ERROR"));
 }
 
@@ -875,23 +878,21 @@ static int supported_features(struct hfp_slc_handle *handle, const char *cmd)
 {
 	int err;
 	char response[128];
-	char *tokens, *features;
+	const char *args = at_args(cmd);
+	const char *features;
 
 	if (strlen(cmd) < 9) {
 		syslog(LOG_ERR, "%s: malformed command: '%s'", __func__, cmd);
 		return hfp_send(handle, AT_CMD("ERROR"));
 	}
 
-	tokens = strdup(cmd);
-	strtok(tokens, "=");
-	features = strtok(NULL, ",");
+	features = at_next_arg(&args);
 	if (!features)
 		goto error_out;
 
 	handle->hf_supported_features = atoi(features);
 	BTLOG(btlog, BT_HFP_SUPPORTED_FEATURES, 0,
 	      handle->hf_supported_features);
-	free(tokens);
 
 	/* AT+BRSF=<feature> command received, ignore the HF supported feature
 	 * for now. Respond with +BRSF:<feature> to notify mandatory supported
@@ -908,7 +909,6 @@ static int supported_features(struct hfp_slc_handle *handle, const char *cmd)
 	return hfp_send(handle, AT_CMD("OK"));
 
 error_out:
-	free(tokens);
 	syslog(LOG_ERR, "%s: malformed command: '%s'", __func__, cmd);
 	return hfp_send(handle, AT_CMD("ERROR"));
 }
@@ -974,7 +974,7 @@ static int terminate_call(struct hfp_slc_handle *handle, const char *cmd)
  *                     AT+CMER= -->
  *                 <-- OK
  */
-static struct at_command at_commands[] = {
+static const struct at_command at_commands[] = {
 	{ "ATA", answer_call },
 	{ "ATD", dial_number },
 	{ "AT+BAC", available_codecs },
@@ -996,19 +996,121 @@ static struct at_command at_commands[] = {
 	{ "AT+CNUM", subscriber_number },
 	{ "AT+COPS", operator_selection },
 	{ "AT+IPHONEACCEV", apple_accessory_state_change },
-	{ "AT+VG", signal_gain_setting },
+	{ "AT+VGM", signal_gain_setting },
+	{ "AT+VGS", signal_gain_setting },
 	{ "AT+VTS", dtmf_tone },
 	{ "AT+XAPL", apple_supported_features },
-	{ 0 }
 };
 
+/* Commands are looked up by name in a table of AT_COMMAND_SLOTS slots,
+ * indexed by a hash that is perfect for the commands above. The table holds
+ * the index in at_commands plus one, 0 for an empty slot. It is built on
+ * first use by trying hash seeds until one puts no two commands in the same
+ * slot, so commands can be added without hand tuning.
+ */
+#define AT_COMMAND_SLOT_BITS 6
+#define AT_COMMAND_SLOTS (1 << AT_COMMAND_SLOT_BITS)
+#define AT_COMMAND_MAX_SEED 65536
+static uint8_t at_command_slots[AT_COMMAND_SLOTS];
+static uint32_t at_command_seed;
+static int at_command_slots_ready;
+
+/* Returns the name of an AT command and sets *len to its length, 0 if cmd
+ * isn't one. The name is the letter following "AT", or the letters
+ * following "AT+" for an extended command, e.g. "D" for "ATD1234;" and
+ * "BIEV" for "AT+BIEV=2,50".
+ */
+static const char *at_command_name(const char *cmd, size_t *len)
+{
+	const char *name;
+
+	*len = 0;
+	if (cmd[0] != 'A' || cmd[1] != 'T')
+		return NULL;
+	if (cmd[2] != '+') {
+		name = &cmd[2];
+		if (*name >= 'A' && *name <= 'Z')
+			*len = 1;
+		return name;
+	}
+	name = &cmd[3];
+	while (name[*len] >= 'A' && name[*len] <= 'Z')
+		(*len)++;
+	return name;
+}
+
+/* FNV-1a of the name, keeping the top bits for the slot. */
+static unsigned int at_command_slot(const char *name, size_t len,
+				    uint32_t seed)
+{
+	uint32_t hash = 2166136261u ^ seed;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (uint8_t)name[i];
+		hash *= 16777619u;
+	}
+	return hash >> (32 - AT_COMMAND_SLOT_BITS);
+}
+
+static int build_at_command_slots()
+{
+	const char *name;
+	unsigned int slot;
+	size_t i, len;
+	uint32_t seed;
+
+	for (seed = 0; seed < AT_COMMAND_MAX_SEED; seed++) {
+		memset(at_command_slots, 0, sizeof(at_command_slots));
+		for (i = 0; i < ARRAY_SIZE(at_commands); i++) {
+			name = at_command_name(at_commands[i].cmd, &len);
+			slot = at_command_slot(name, len, seed);
+			if (at_command_slots[slot])
+				break;
+			at_command_slots[slot] = i + 1;
+		}
+		if (i == ARRAY_SIZE(at_commands)) {
+			at_command_seed = seed;
+			at_command_slots_ready = 1;
+			return 0;
+		}
+	}
+	syslog(LOG_ERR, "No perfect hash for the AT commands");
+	return -EINVAL;
+}
+
+static const struct at_command *find_at_command(const char *cmd)
+{
+	const struct at_command *atc;
+	const char *name, *atc_name;
+	size_t len, atc_len;
+	unsigned int idx;
+
+	if (!at_command_slots_ready && build_at_command_slots())
+		return NULL;
+
+	name = at_command_name(cmd, &len);
+	if (!len)
+		return NULL;
+	idx = at_command_slots[at_command_slot(name, len, at_command_seed)];
+	if (!idx)
+		return NULL;
+
+	/* The slot holds the only command that can match, check it does. */
+	atc = &at_commands[idx - 1];
+	atc_name = at_command_name(atc->cmd, &atc_len);
+	if (atc_len != len || memcmp(atc_name, name, len))
+		return NULL;
+	return atc;
+}
+
 static int handle_at_command(struct hfp_slc_handle *slc_handle, const char *cmd)
 {
-	struct at_command *atc;
+	const struct at_command *atc;
 
-	for (atc = at_commands; atc->cmd; atc++)
-		if (!strncmp(cmd, atc->cmd, strlen(atc->cmd)))
-			return atc->callback(slc_handle, cmd);
+	atc = find_at_command(cmd);
+	if (atc)
+		return atc->callback(slc_handle, cmd);
 
 	syslog(LOG_DEBUG, "AT command %s not supported", cmd);
 	return hfp_send(slc_handle, AT_CMD("ERROR"));
@@ -25,10 +25,12 @@
 #include "cras_iodev_list.h"
 #include "cras_mix.h"
 #include "cras_ramp.h"
+#include "cras_ref_ring.h"
 #include "cras_rstream.h"
 #include "cras_server_metrics.h"
 #include "cras_system_state.h"
 #include "cras_util.h"
+#include "cras_wake_heap.h"
 #include "dev_stream.h"
 #include "input_data.h"
 #include "utlist.h"
@@ -42,6 +44,14 @@ static const float RAMP_RESUME_MUTE_DURATION_SECS = 1;
 static const float RAMP_SWITCH_MUTE_DURATION_SECS = 0.5;
 static const float RAMP_VOLUME_CHANGE_DURATION_SECS = 0.1;
 
+/* How long the output DSP keeps running on silence, flushing the tails of
+ * its filters and delays, before silent buffers bypass it. */
+static const float DSP_SILENT_BYPASS_SECS = 0.1;
+
+/* Size of the post DSP reference ring of an output device, enough for 16384
+ * frames of 16 bit stereo. */
+static const size_t POST_DSP_REF_BYTES = 16384 * 4;
+
 /*
  * It is the lastest time for the device to wake up when it is in the normal
  * run state. It represents how many remaining frames in the device buffer.
@@ -67,8 +77,85 @@ static const struct timespec rate_estimation_window_sz = {
 };
 static const double rate_estimation_smooth_factor = 0.3f;
 
+/* The open devices of a clock domain.
+ * Members:
+ *    domain - The clock_domain of the devices.
+ *    leader - The device running the rate estimator of the domain, NULL
+ *             until one of the devices updates its rate.
+ *    rate_ratio - The last rate ratio estimated by the leader.
+ *    generation - Incremented each time rate_ratio changes.
+ *    num_devs - The number of open devices in the domain.
+ */
+struct cras_iodev_clock {
+	const void *domain;
+	const struct cras_iodev *leader;
+	double rate_ratio;
+	unsigned int generation;
+	unsigned int num_devs;
+	struct cras_iodev_clock *prev, *next;
+};
+
+static struct cras_iodev_clock *clocks;
+
 static void cras_iodev_alloc_dsp(struct cras_iodev *iodev);
 
+/* Adds an opening device to the clock of its domain. */
+static void join_clock(struct cras_iodev *iodev)
+{
+	struct cras_iodev_clock *clock;
+
+	if (!iodev->clock_domain)
+		return;
+
+	DL_SEARCH_SCALAR(clocks, clock, domain, iodev->clock_domain);
+	if (!clock) {
+		clock = (struct cras_iodev_clock *)calloc(1, sizeof(*clock));
+		if (!clock)
+			return;
+		clock->domain = iodev->clock_domain;
+		clock->rate_ratio = 1.0;
+		DL_APPEND(clocks, clock);
+	}
+	clock->num_devs++;
+	iodev->clock = clock;
+	iodev->clock_generation = clock->generation;
+}
+
+/* Removes a closing device from its clock. The next device of the domain to
+ * update its rate takes over if this one was leading. */
+static void leave_clock(struct cras_iodev *iodev)
+{
+	struct cras_iodev_clock *clock = iodev->clock;
+
+	if (!clock)
+		return;
+
+	iodev->clock = NULL;
+	if (clock->leader == iodev)
+		clock->leader = NULL;
+	if (--clock->num_devs)
+		return;
+	DL_DELETE(clocks, clock);
+	free(clock);
+}
+
+/* Shares the rate estimated by the leader of a clock with its domain. */
+static void publish_clock_rate(const struct cras_iodev *iodev)
+{
+	struct cras_iodev_clock *clock = iodev->clock;
+	double ratio;
+
+	if (!clock || clock->leader != iodev)
+		return;
+
+	ratio = rate_estimator_get_rate(iodev->rate_est) /
+		iodev->format->frame_rate;
+	if (ratio == clock->rate_ratio)
+		return;
+	clock->rate_ratio = ratio;
+	clock->generation++;
+}
+
 static int default_no_stream_playback(struct cras_iodev *odev)
 {
 	int rc;
@@ -117,6 +204,7 @@ static int cras_iodev_start(struct cras_iodev *iodev)
 		return -EINVAL;
 	}
 	rc = iodev->start(iodev);
+	cras_iodev_invalidate_wake_levels(iodev);
 	if (rc)
 		return rc;
 	iodev->state = CRAS_IODEV_STATE_NORMAL_RUN;
@@ -193,6 +281,7 @@ static int cras_iodev_no_stream_playback_transition(struct cras_iodev *odev,
 	}
 
 	rc = odev->no_stream(odev, enable);
+	cras_iodev_invalidate_wake_levels(odev);
 	if (rc < 0)
 		return rc;
 	if (enable)
@@ -321,6 +410,47 @@ static size_t get_best_rate(struct cras_iodev *iodev, size_t rrate)
 	return iodev->supported_rates[0];
 }
 
+/* Resampling costs about the same for every sample in and out, so this is
+ * how many samples a second would be resampled at rate. */
+static size_t get_rate_cost(const struct cras_iodev *iodev, size_t rate)
+{
+	const struct cras_iodev_rate_demand *demand;
+	size_t cost = 0;
+	unsigned int i;
+
+	for (i = 0; i < iodev->num_rate_demands; i++) {
+		demand = &iodev->rate_demands[i];
+		if (demand->frame_rate != rate)
+			cost += demand->num_channels *
+				(demand->frame_rate + rate);
+	}
+	return cost;
+}
+
+size_t cras_iodev_best_rate(struct cras_iodev *iodev, size_t rate)
+{
+	size_t best, cost, best_cost, candidate;
+	unsigned int i;
+
+	best = get_best_rate(iodev, rate);
+	if (best == 0 || iodev->num_rate_demands < 2)
+		return best;
+
+	/* Only the rates the streams would pick themselves are considered,
+	 * so a single stream gets what it always did. */
+	best_cost = get_rate_cost(iodev, best);
+	for (i = 0; i < iodev->num_rate_demands; i++) {
+		candidate = get_best_rate(iodev,
+					  iodev->rate_demands[i].frame_rate);
+		cost = get_rate_cost(iodev, candidate);
+		if (cost < best_cost) {
+			best = candidate;
+			best_cost = cost;
+		}
+	}
+	return best;
+}
+
 /* Finds the best match for the channel count.  The following match rules
  * will apply in order and return the value once matched:
  * 1. Match the exact given channel count.
@@ -366,8 +496,12 @@ static snd_pcm_format_t get_best_pcm_format(struct cras_iodev *iodev,
 	return iodev->supported_formats[0];
 }
 
-/* Applies the DSP to the samples for the iodev if applicable. */
-static int apply_dsp(struct cras_iodev *iodev, uint8_t *buf, size_t frames)
+/* Applies the DSP to the samples for the iodev if applicable. If scale is
+ * given, the processed samples are also scaled along it as the pipeline
+ * writes them back. Returns 1 if the samples were scaled, 0 if not, or a
+ * negative error code. */
+static int apply_dsp(struct cras_iodev *iodev, uint8_t *buf, size_t frames,
+		     const struct cras_ramp_action *scale)
 {
 	struct cras_dsp_context *ctx;
 	struct pipeline *pipeline;
@@ -381,8 +515,18 @@ static int apply_dsp(struct cras_iodev *iodev, uint8_t *buf, size_t frames)
 	if (!pipeline)
 		return 0;
 
-	rc = cras_dsp_pipeline_apply(pipeline, buf, iodev->format->format,
-				     frames);
+	if (scale) {
+		rc = cras_dsp_pipeline_apply_ramp(pipeline, buf,
+						  iodev->format->format, frames,
+						  scale->scaler,
+						  scale->increment,
+						  scale->target);
+		if (rc == 0)
+			rc = 1;
+	} else {
+		rc = cras_dsp_pipeline_apply(pipeline, buf,
+					     iodev->format->format, frames);
+	}
 
 	cras_dsp_put_pipeline(ctx);
 	return rc;
@@ -471,7 +615,7 @@ int cras_iodev_set_format(struct cras_iodev *iodev,
 		/* Finds the actual rate of device before allocating DSP
 		 * because DSP needs to use the rate of device, not rate of
 		 * stream. */
-		actual_rate = get_best_rate(iodev, fmt->frame_rate);
+		actual_rate = cras_iodev_best_rate(iodev, fmt->frame_rate);
 		iodev->format->frame_rate = actual_rate;
 
 		cras_iodev_alloc_dsp(iodev);
@@ -522,17 +666,17 @@ static void add_ext_dsp_module_to_pipeline(struct cras_iodev *iodev)
 	struct pipeline *pipeline;
 
 	pipeline = iodev->dsp_context ?
-			   cras_dsp_get_pipeline(iodev->dsp_context) :
+			   cras_dsp_lock_pipeline(iodev->dsp_context) :
 			   NULL;
 
 	if (!pipeline) {
 		cras_iodev_alloc_dsp(iodev);
 		cras_dsp_load_mock_pipeline(iodev->dsp_context,
 					    iodev->format->num_channels);
-		pipeline = cras_dsp_get_pipeline(iodev->dsp_context);
+		pipeline = cras_dsp_lock_pipeline(iodev->dsp_context);
 	}
-	/* dsp_context mutex locked. Now it's safe to modify dsp
-	 * pipeline resources. */
+	/* Pipeline locked, the audio thread skips it until unlocked. Now
+	 * it's safe to modify dsp pipeline resources. */
 
 	if (iodev->ext_dsp_module)
 		iodev->ext_dsp_module->configure(iodev->ext_dsp_module,
@@ -542,8 +686,7 @@ static void add_ext_dsp_module_to_pipeline(struct cras_iodev *iodev)
 
 	cras_dsp_pipeline_set_sink_ext_module(pipeline, iodev->ext_dsp_module);
 
-	/* Unlock dsp_context mutex. */
-	cras_dsp_put_pipeline(iodev->dsp_context);
+	cras_dsp_unlock_pipeline(iodev->dsp_context);
 }
 
 /*
@@ -556,15 +699,15 @@ static void release_ext_dsp_module_from_pipeline(struct cras_iodev *iodev)
 	if (iodev->dsp_context == NULL)
 		return;
 
-	pipeline = cras_dsp_get_pipeline(iodev->dsp_context);
+	/* Locking waits for the audio thread to finish with the pipeline,
+	 * so the caller may free the ext module once this returns. */
+	pipeline = cras_dsp_lock_pipeline(iodev->dsp_context);
 	if (pipeline == NULL)
 		return;
-	/* dsp_context mutex locked. */
 
 	cras_dsp_pipeline_set_sink_ext_module(pipeline, NULL);
 
-	/* Unlock dsp_context mutex. */
-	cras_dsp_put_pipeline(iodev->dsp_context);
+	cras_dsp_unlock_pipeline(iodev->dsp_context);
 }
 
 void cras_iodev_set_ext_dsp_module(struct cras_iodev *iodev,
@@ -611,10 +754,15 @@ int cras_iodev_dsp_set_swap_mode_for_node(struct cras_iodev *iodev,
 	node->left_right_swapped = enable;
 
 	/* Possibly updates dsp if the node is active on the device and there
-	 * is dsp context. If dsp context is not created yet,
+	 * is dsp context. The running pipeline swaps its output if it can,
+	 * otherwise it is reloaded. If dsp context is not created yet,
 	 * cras_iodev_update_dsp returns right away. */
-	if (iodev->active_node == node)
-		cras_iodev_update_dsp(iodev);
+	if (iodev->active_node != node)
+		return 0;
+	if (iodev->dsp_context &&
+	    cras_dsp_set_swap_lr(iodev->dsp_context, enable) == 0)
+		return 0;
+	cras_iodev_update_dsp(iodev);
 	return 0;
 }
 
@@ -648,6 +796,8 @@ void cras_iodev_free_resources(struct cras_iodev *iodev)
 	rate_estimator_destroy(iodev->rate_est);
 	if (iodev->ramp)
 		cras_ramp_destroy(iodev->ramp);
+	cras_ref_ring_destroy(iodev->post_dsp_ref);
+	iodev->post_dsp_ref = NULL;
 }
 
 static void cras_iodev_alloc_dsp(struct cras_iodev *iodev)
@@ -761,9 +911,22 @@ int cras_iodev_get_valid_frames(struct cras_iodev *odev,
 		return -EINVAL;
 
 	if (odev->get_valid_frames) {
-		rc = odev->get_valid_frames(odev, hw_tstamp);
-		if (rc < 0)
-			return rc;
+		struct cras_iodev_wake_levels *levels = &odev->wake_levels;
+
+		if (levels->valid & CRAS_IODEV_WAKE_LEVEL_VALID_FRAMES) {
+			rc = levels->valid_frames;
+			*hw_tstamp = levels->valid_tstamp;
+		} else {
+			rc = odev->get_valid_frames(odev, hw_tstamp);
+			if (rc < 0)
+				return rc;
+			if (levels->active) {
+				levels->valid_frames = rc;
+				levels->valid_tstamp = *hw_tstamp;
+				levels->valid |=
+					CRAS_IODEV_WAKE_LEVEL_VALID_FRAMES;
+			}
+		}
 
 		if (rc < odev->min_buffer_level)
 			return 0;
@@ -782,6 +945,7 @@ int cras_iodev_add_stream(struct cras_iodev *iodev, struct dev_stream *stream)
 	 * block other existing streams.
 	 */
 	DL_APPEND(iodev->streams, stream);
+	cras_iodev_update_stream_refs(iodev);
 	if (!iodev->buf_state)
 		iodev->buf_state = buffer_share_create(iodev->buffer_size);
 	if (stream->stream->direction == CRAS_STREAM_INPUT)
@@ -794,21 +958,60 @@ void cras_iodev_start_stream(struct cras_iodev *iodev,
 {
 	unsigned int cb_threshold = dev_stream_cb_threshold(stream);
 
-	if (dev_stream_is_running(stream))
+	if (dev_stream_is_running(stream) || stream->paused)
 		return;
 	/*
 	 * TRIGGER_ONLY streams do not want to receive data, so do not add them
 	 * to buffer_share, otherwise they'll affect other streams to receive.
 	 */
-	if (!(stream->stream->flags & TRIGGER_ONLY))
+	if (!(stream->stream->flags & TRIGGER_ONLY)) {
 		buffer_share_add_id(iodev->buf_state, stream->stream->stream_id,
 				    NULL);
+		stream->dev_buf_slot = buffer_share_id_slot(
+			iodev->buf_state, stream->stream->stream_id);
+		if (iodev->input_data)
+			input_data_add_stream(iodev->input_data,
+					      stream->stream, iodev->format,
+					      iodev->buffer_size);
+	}
 	iodev->min_cb_level = MIN(iodev->min_cb_level, cb_threshold);
 	iodev->max_cb_level = MAX(iodev->max_cb_level, cb_threshold);
 	iodev->largest_cb_level = MAX(iodev->largest_cb_level, cb_threshold);
 	dev_stream_set_running(stream);
 }
 
+/* Returns true if a stream of the device is running. */
+static bool has_running_stream(const struct cras_iodev *iodev)
+{
+	struct dev_stream *stream;
+
+	DL_FOREACH (iodev->streams, stream) {
+		if (dev_stream_is_running(stream))
+			return true;
+	}
+	return false;
+}
+
+void cras_iodev_stop_stream(struct cras_iodev *iodev,
+			    struct dev_stream *stream)
+{
+	if (!dev_stream_is_running(stream))
+		return;
+	if (stream->dev_buf_slot >= 0) {
+		buffer_share_rm_id(iodev->buf_state,
+				   stream->stream->stream_id);
+		stream->dev_buf_slot = -1;
+	}
+	if (iodev->input_data)
+		input_data_rm_stream(iodev->input_data, stream->stream);
+	dev_stream_clear_running(stream);
+
+	if (iodev->direction == CRAS_STREAM_OUTPUT &&
+	    iodev->state == CRAS_IODEV_STATE_NORMAL_RUN &&
+	    !has_running_stream(iodev))
+		cras_iodev_no_stream_playback_transition(iodev, 1);
+}
+
 struct dev_stream *cras_iodev_rm_stream(struct cras_iodev *iodev,
 					const struct cras_rstream *rstream)
 {
@@ -824,6 +1027,10 @@ struct dev_stream *cras_iodev_rm_stream(struct cras_iodev *iodev,
 		if (out->stream == rstream) {
 			buffer_share_rm_id(iodev->buf_state,
 					   rstream->stream_id);
+			out->dev_buf_slot = -1;
+			if (iodev->input_data)
+				input_data_rm_stream(iodev->input_data,
+						     rstream);
 			ret = out;
 			DL_DELETE(iodev->streams, out);
 			continue;
@@ -842,6 +1049,7 @@ struct dev_stream *cras_iodev_rm_stream(struct cras_iodev *iodev,
 			earliest_next_cb_ts = out->stream->next_cb_ts;
 	}
 
+	cras_iodev_update_stream_refs(iodev);
 	if (!iodev->streams) {
 		buffer_share_destroy(iodev->buf_state);
 		iodev->buf_state = NULL;
@@ -859,24 +1067,42 @@ struct dev_stream *cras_iodev_rm_stream(struct cras_iodev *iodev,
 
 	DL_FOREACH (iodev->streams, out) {
 		if (!dev_stream_is_running(out))
-			out->stream->next_cb_ts = earliest_next_cb_ts;
+			cras_wake_heap_set_next_cb_ts(out->stream,
+						      &earliest_next_cb_ts);
 	}
 
 	return ret;
 }
 
+void cras_iodev_update_stream_refs(struct cras_iodev *iodev)
+{
+	struct cras_iodev_stream_ref *ref;
+	struct dev_stream *stream;
+
+	if (!iodev->streams) {
+		ARRAY_FREE(&iodev->stream_refs);
+		return;
+	}
+	iodev->stream_refs.count = 0;
+	DL_FOREACH (iodev->streams, stream) {
+		ref = ARRAY_APPEND_ZERO(&iodev->stream_refs);
+		ref->dev_stream = stream;
+		ref->stream = stream->stream;
+		ref->shm = cras_rstream_shm(stream->stream);
+	}
+}
+
 unsigned int cras_iodev_stream_offset(struct cras_iodev *iodev,
 				      struct dev_stream *stream)
 {
-	return buffer_share_id_offset(iodev->buf_state,
-				      stream->stream->stream_id);
+	return buffer_share_slot_offset(iodev->buf_state, stream->dev_buf_slot);
 }
 
 void cras_iodev_stream_written(struct cras_iodev *iodev,
 			       struct dev_stream *stream, unsigned int nwritten)
 {
-	buffer_share_offset_update(iodev->buf_state, stream->stream->stream_id,
-				   nwritten);
+	buffer_share_slot_offset_update(iodev->buf_state, stream->dev_buf_slot,
+					nwritten);
 }
 
 unsigned int cras_iodev_all_streams_written(struct cras_iodev *iodev)
@@ -896,8 +1122,8 @@ unsigned int cras_iodev_max_stream_offset(const struct cras_iodev *iodev)
 		if (!dev_stream_is_running(curr))
 			continue;
 
-		max = MAX(max, buffer_share_id_offset(iodev->buf_state,
-						      curr->stream->stream_id));
+		max = MAX(max, buffer_share_slot_offset(iodev->buf_state,
+							curr->dev_buf_slot));
 	}
 
 	return max;
@@ -912,6 +1138,11 @@ int cras_iodev_open(struct cras_iodev *iodev, unsigned int cb_level,
 	if (iodev->pre_open_iodev_hook)
 		iodev->pre_open_iodev_hook();
 
+	/* Kept until the device is freed, so receivers started below can hold
+	 * on to it. */
+	if (iodev->direction == CRAS_STREAM_OUTPUT && !iodev->post_dsp_ref)
+		iodev->post_dsp_ref = cras_ref_ring_create(POST_DSP_REF_BYTES);
+
 	DL_FOREACH (iodev->loopbacks, loopback) {
 		if (loopback->hook_control)
 			loopback->hook_control(true, loopback->cb_data);
@@ -937,6 +1168,11 @@ int cras_iodev_open(struct cras_iodev *iodev, unsigned int cb_level,
 		return rc;
 	}
 
+	/* Advertise the format so clients can match it and skip conversion. */
+	iodev->info.preferred_rate = iodev->format->frame_rate;
+	iodev->info.preferred_num_channels = iodev->format->num_channels;
+	iodev->info.preferred_format = iodev->format->format;
+
 	/*
 	 * Convert cb_level from input format to device format
 	 */
@@ -952,8 +1188,11 @@ int cras_iodev_open(struct cras_iodev *iodev, unsigned int cb_level,
 	iodev->state = CRAS_IODEV_STATE_OPEN;
 	iodev->highest_hw_level = 0;
 	iodev->input_dsp_offset = 0;
+	iodev->dsp_silent_frames = 0;
 
-	ewma_power_init(&iodev->ewma, iodev->format->frame_rate);
+	ewma_power_init(&iodev->ewma, iodev->format->format,
+			iodev->format->frame_rate);
+	energy_vad_init(&iodev->vad, iodev->format->frame_rate);
 
 	if (iodev->direction == CRAS_STREAM_OUTPUT) {
 		/* If device supports start ops, device can be in open state.
@@ -987,14 +1226,59 @@ int cras_iodev_open(struct cras_iodev *iodev, unsigned int cb_level,
 		 */
 		iodev->software_gain_scaler =
 			cras_iodev_get_software_gain_scaler(iodev);
+
+		if (iodev->pre_roll_ms)
+			iodev->pre_roll = cras_ref_ring_create(
+				(size_t)iodev->pre_roll_ms *
+				iodev->format->frame_rate / 1000 *
+				cras_get_format_bytes(iodev->format));
 	}
 
 	add_ext_dsp_module_to_pipeline(iodev);
+	cras_dsp_set_cb_level(iodev->dsp_context, iodev->min_cb_level);
+	join_clock(iodev);
 	clock_gettime(CLOCK_MONOTONIC_RAW, &iodev->open_ts);
 
 	return 0;
 }
 
+int cras_iodev_resume(struct cras_iodev *iodev)
+{
+	int rc;
+
+	if (!iodev->resume || !cras_iodev_is_open(iodev))
+		return -ENOTSUP;
+
+	rc = iodev->resume(iodev);
+	if (rc < 0)
+		return rc;
+
+	/* The hardware buffer was dropped, restart as cras_iodev_open left
+	 * the device. */
+	iodev->reset_request_pending = 0;
+	iodev->highest_hw_level = 0;
+	iodev->input_frames_read = 0;
+	iodev->input_dsp_offset = 0;
+	iodev->dsp_silent_frames = 0;
+	ewma_power_init(&iodev->ewma, iodev->format->format,
+			iodev->format->frame_rate);
+	energy_vad_init(&iodev->vad, iodev->format->frame_rate);
+	cras_iodev_reset_rate_estimator(iodev);
+
+	if (iodev->direction == CRAS_STREAM_OUTPUT) {
+		if (iodev->start) {
+			iodev->state = CRAS_IODEV_STATE_OPEN;
+		} else {
+			iodev->state = CRAS_IODEV_STATE_NO_STREAM_RUN;
+			cras_iodev_fill_odev_zeros(iodev, iodev->min_cb_level);
+		}
+	} else {
+		iodev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+		iodev->input_streaming = 0;
+	}
+	return 0;
+}
+
 enum CRAS_IODEV_STATE cras_iodev_state(const struct cras_iodev *iodev)
 {
 	return iodev->state;
@@ -1018,12 +1302,15 @@ int cras_iodev_close(struct cras_iodev *iodev)
 			iodev->ext_dsp_module = NULL;
 		input_data_destroy(&iodev->input_data);
 	}
+	cras_ref_ring_destroy(iodev->pre_roll);
+	iodev->pre_roll = NULL;
 
 	rc = iodev->close_dev(iodev);
 	if (rc)
 		syslog(LOG_ERR, "Error closing dev %s, rc %d", iodev->info.name,
 		       rc);
 	iodev->state = CRAS_IODEV_STATE_CLOSE;
+	leave_clock(iodev);
 	if (iodev->ramp)
 		cras_ramp_reset(iodev->ramp);
 
@@ -1045,7 +1332,8 @@ int cras_iodev_put_input_buffer(struct cras_iodev *iodev)
 	struct input_data *data = iodev->input_data;
 	int rc;
 
-	if (iodev->streams)
+	/* Paused streams don't hold the device back. */
+	if (has_running_stream(iodev))
 		min_frames = buffer_share_get_new_write_point(iodev->buf_state);
 	else
 		min_frames = data->area->frames;
@@ -1057,11 +1345,24 @@ int cras_iodev_put_input_buffer(struct cras_iodev *iodev)
 	input_data_set_all_streams_read(data, min_frames);
 	rate_estimator_add_frames(iodev->rate_est, -min_frames);
 	rc = iodev->put_buffer(iodev, min_frames);
+	cras_iodev_invalidate_wake_levels(iodev);
 	if (rc < 0)
 		return rc;
 	return min_frames;
 }
 
+/* Returns true if the device is playing an EXCLUSIVE or PASSTHROUGH stream. */
+static bool playing_exclusive(const struct cras_iodev *iodev)
+{
+	const struct dev_stream *stream;
+
+	DL_FOREACH (iodev->streams, stream) {
+		if (stream->exclusive)
+			return true;
+	}
+	return false;
+}
+
 int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 				 unsigned int nframes, int *is_non_empty,
 				 struct cras_fmt_conv *remix_converter)
@@ -1073,25 +1374,30 @@ int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 		.increment = 0.0f,
 		.target = 1.0f,
 	};
+	struct cras_ramp_action scale = {
+		.type = CRAS_RAMP_ACTION_NONE,
+		.scaler = 1.0f,
+		.increment = 0.0f,
+		.target = 1.0f,
+	};
 	float software_volume_scaler = 1.0;
 	int software_volume_needed = cras_iodev_software_volume_needed(iodev);
+	const size_t bytes = nframes * cras_get_format_bytes(fmt);
+	int fold_scale;
+	int scaled;
+	int silent, bypass;
+	int write_ref;
 	int rc;
 	struct cras_loopback *loopback;
 
-	/* Calculate whether the final output was non-empty, if requested. */
-	if (is_non_empty) {
-		const size_t bytes = nframes * cras_get_format_bytes(fmt);
+	silent = cras_buffer_is_zero(frames, bytes);
+	if (is_non_empty)
+		*is_non_empty = !silent;
 
-		/*
-		 * Speed up checking frames are all zeros using memcmp.
-		 * frames contains all zeros if both conditions are met:
-		 *  - frames[0] is 0.
-		 *  - frames[i] == frames[i+1] for i in [0, 1, ..., bytes - 2].
-		 */
-		*is_non_empty = bytes ? (*frames || memcmp(frames, frames + 1,
-							   bytes - 1)) :
-					0;
-	}
+	/* Exclusive streams reach the sink bit-exact, compressed bursts would
+	 * be corrupted by anything that touches the samples. */
+	if (playing_exclusive(iodev))
+		goto put_buffer;
 
 	DL_FOREACH (iodev->loopbacks, loopback) {
 		if (loopback->type == LOOPBACK_POST_MIX_PRE_DSP)
@@ -1099,55 +1405,95 @@ int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 					    loopback->cb_data);
 	}
 
-	ewma_power_calculate(&iodev->ewma, (int16_t *)frames,
-			     iodev->format->num_channels, nframes);
+	ewma_power_calculate(&iodev->ewma, frames, iodev->format->num_channels,
+			     nframes);
 
-	rc = apply_dsp(iodev, frames, nframes);
-	if (rc)
-		return rc;
+	if (iodev->ramp) {
+		ramp_action = cras_ramp_get_current_action(iodev->ramp);
+	}
 
+	/* Compute scaler for software volume if needed. */
+	if (software_volume_needed) {
+		software_volume_scaler =
+			cras_iodev_get_software_volume_scaler(iodev);
+	}
+
+	/* The ramp and software volume are applied after DSP. Unless the post
+	 * DSP loopback needs the samples before they are scaled, let the DSP
+	 * pipeline scale them as it writes them back. */
+	if (ramp_action.type == CRAS_RAMP_ACTION_PARTIAL) {
+		scale = ramp_action;
+		if (software_volume_needed) {
+			scale.scaler *= software_volume_scaler;
+			scale.increment *= software_volume_scaler;
+			scale.target *= software_volume_scaler;
+		}
+	} else if (!output_should_mute(iodev) && software_volume_needed) {
+		scale.type = CRAS_RAMP_ACTION_PARTIAL;
+		scale.scaler = software_volume_scaler;
+		scale.target = software_volume_scaler;
+	}
+	fold_scale = scale.type == CRAS_RAMP_ACTION_PARTIAL;
 	DL_FOREACH (iodev->loopbacks, loopback) {
 		if (loopback->type == LOOPBACK_POST_DSP)
-			loopback->hook_data(frames, nframes, iodev->format,
-					    loopback->cb_data);
+			fold_scale = 0;
 	}
 
-	if (iodev->ramp) {
-		ramp_action = cras_ramp_get_current_action(iodev->ramp);
+	/* Once the DSP has turned silence into silence for long enough, its
+	 * state has settled and silent buffers bypass it, along with the APM
+	 * reverse stream it feeds and the scaling and remixing after it. */
+	bypass = silent && iodev->dsp_silent_frames >=
+				   DSP_SILENT_BYPASS_SECS * fmt->frame_rate;
+	if (bypass) {
+		/* Silence is already scaled. */
+		scaled = 1;
+	} else {
+		rc = apply_dsp(iodev, frames, nframes,
+			       fold_scale ? &scale : NULL);
+		if (rc < 0)
+			return rc;
+		scaled = rc;
+		if (silent && cras_buffer_is_zero(frames, bytes))
+			iodev->dsp_silent_frames += nframes;
+		else
+			iodev->dsp_silent_frames = 0;
 	}
 
+	/* Receivers without a data hook read the post DSP reference ring in
+	 * place, so the samples are copied once however many there are. */
+	write_ref = 0;
+	DL_FOREACH (iodev->loopbacks, loopback) {
+		if (loopback->type != LOOPBACK_POST_DSP)
+			continue;
+		if (loopback->hook_data)
+			loopback->hook_data(frames, nframes, iodev->format,
+					    loopback->cb_data);
+		else
+			write_ref = 1;
+	}
+	if (write_ref && iodev->post_dsp_ref)
+		cras_ref_ring_write(iodev->post_dsp_ref, frames, nframes,
+				    cras_get_format_bytes(fmt));
+
 	/* Mute samples if adjusted volume is 0 or system is muted, plus
 	 * that this device is not ramping. */
-	if (output_should_mute(iodev) &&
+	if (output_should_mute(iodev) && !bypass &&
 	    ramp_action.type != CRAS_RAMP_ACTION_PARTIAL) {
 		const unsigned int frame_bytes = cras_get_format_bytes(fmt);
 		cras_mix_mute_buffer(frames, frame_bytes, nframes);
 	}
 
-	/* Compute scaler for software volume if needed. */
-	if (software_volume_needed) {
-		software_volume_scaler =
-			cras_iodev_get_software_volume_scaler(iodev);
-	}
-
 	if (ramp_action.type == CRAS_RAMP_ACTION_PARTIAL) {
 		/* Scale with increment for ramp and possibly
 		 * software volume using cras_scale_buffer_increment.*/
-		float starting_scaler = ramp_action.scaler;
-		float increment = ramp_action.increment;
-		float target = ramp_action.target;
-
-		if (software_volume_needed) {
-			starting_scaler *= software_volume_scaler;
-			increment *= software_volume_scaler;
-			target *= software_volume_scaler;
-		}
-
-		cras_scale_buffer_increment(fmt->format, frames, nframes,
-					    starting_scaler, increment, target,
-					    fmt->num_channels);
+		if (!scaled)
+			cras_scale_buffer_increment(fmt->format, frames,
+						    nframes, scale.scaler,
+						    scale.increment,
+						    scale.target,
+						    fmt->num_channels);
 		cras_ramp_update_ramped_frames(iodev->ramp, nframes);
-	} else if (!output_should_mute(iodev) && software_volume_needed) {
+	} else if (scale.type == CRAS_RAMP_ACTION_PARTIAL && !scaled) {
 		/* Just scale for software volume using
 		 * cras_scale_buffer. */
 		unsigned int nsamples = nframes * fmt->num_channels;
@@ -1155,13 +1501,16 @@ int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 				  software_volume_scaler);
 	}
 
-	if (remix_converter)
+	if (remix_converter && !bypass)
 		cras_channel_remix_convert(remix_converter, iodev->format,
 					   frames, nframes);
+put_buffer:
 	if (iodev->rate_est)
 		rate_estimator_add_frames(iodev->rate_est, nframes);
 
-	return iodev->put_buffer(iodev, nframes);
+	rc = iodev->put_buffer(iodev, nframes);
+	cras_iodev_invalidate_wake_levels(iodev);
+	return rc;
 }
 
 int cras_iodev_get_input_buffer(struct cras_iodev *iodev, unsigned int *frames)
@@ -1202,19 +1551,27 @@ int cras_iodev_get_input_buffer(struct cras_iodev *iodev, unsigned int *frames)
 		rc = apply_dsp(iodev,
 			       hw_buffer +
 				       iodev->input_dsp_offset * frame_bytes,
-			       *frames - iodev->input_dsp_offset);
+			       *frames - iodev->input_dsp_offset, NULL);
 		if (rc)
 			return rc;
 		ewma_power_calculate_area(
 			&iodev->ewma,
-			(int16_t *)(hw_buffer +
-				    iodev->input_dsp_offset * frame_bytes),
+			hw_buffer + iodev->input_dsp_offset * frame_bytes,
 			data->area, *frames - iodev->input_dsp_offset);
+		energy_vad_update(&iodev->vad, &iodev->ewma,
+				  *frames - iodev->input_dsp_offset);
 	}
 
 	if (cras_system_get_capture_mute())
 		cras_mix_mute_buffer(hw_buffer, frame_bytes, *frames);
 
+	/* Frames past input_dsp_offset are seen for the first time. */
+	if (iodev->pre_roll && *frames > iodev->input_dsp_offset)
+		cras_ref_ring_write(
+			iodev->pre_roll,
+			hw_buffer + iodev->input_dsp_offset * frame_bytes,
+			*frames - iodev->input_dsp_offset, frame_bytes);
+
 	return rc;
 }
 
@@ -1239,22 +1596,48 @@ int cras_iodev_get_output_buffer(struct cras_iodev *iodev,
 int cras_iodev_update_rate(struct cras_iodev *iodev, unsigned int level,
 			   struct timespec *level_tstamp)
 {
+	struct cras_iodev_clock *clock = iodev->clock;
+	int rc;
+
+	if (clock && !clock->leader) {
+		/* Take over the clock, starting from the rate estimated so
+		 * far rather than from the stale estimator of this device. */
+		clock->leader = iodev;
+		rate_estimator_reset_rate(
+			iodev->rate_est,
+			iodev->format->frame_rate * clock->rate_ratio + 0.5);
+	}
+	if (clock && clock->leader != iodev) {
+		if (iodev->clock_generation == clock->generation)
+			return 0;
+		iodev->clock_generation = clock->generation;
+		return 1;
+	}
+
 	/* If output underruns, reset to avoid incorrect estimated rate. */
-	if ((iodev->direction == CRAS_STREAM_OUTPUT) && !level)
+	if ((iodev->direction == CRAS_STREAM_OUTPUT) && !level) {
 		rate_estimator_reset_rate(iodev->rate_est,
 					  iodev->format->frame_rate);
+		publish_clock_rate(iodev);
+	}
 
-	return rate_estimator_check(iodev->rate_est, level, level_tstamp);
+	rc = rate_estimator_check(iodev->rate_est, level, level_tstamp);
+	if (rc)
+		publish_clock_rate(iodev);
+	return rc;
 }
 
 int cras_iodev_reset_rate_estimator(const struct cras_iodev *iodev)
 {
 	rate_estimator_reset_rate(iodev->rate_est, iodev->format->frame_rate);
+	publish_clock_rate(iodev);
 	return 0;
 }
 
 double cras_iodev_get_est_rate_ratio(const struct cras_iodev *iodev)
 {
+	if (iodev->clock)
+		return iodev->clock->rate_ratio;
 	return rate_estimator_get_rate(iodev->rate_est) /
 	       iodev->format->frame_rate;
 }
@@ -1279,14 +1662,53 @@ int cras_iodev_get_dsp_delay(const struct cras_iodev *iodev)
 	return delay;
 }
 
+size_t cras_iodev_get_mem_bytes(const struct cras_iodev *iodev)
+{
+	struct cras_dsp_context *ctx;
+	struct pipeline *pipeline;
+	size_t bytes = 0;
+
+	if (iodev->input_data)
+		bytes += input_data_get_mem_bytes(iodev->input_data);
+	if (iodev->pre_roll && iodev->format)
+		bytes += (size_t)iodev->pre_roll_ms *
+			 iodev->format->frame_rate / 1000 *
+			 cras_get_format_bytes(iodev->format);
+
+	ctx = iodev->dsp_context;
+	if (!ctx)
+		return bytes;
+
+	pipeline = cras_dsp_get_pipeline(ctx);
+	if (!pipeline)
+		return bytes;
+
+	bytes += (size_t)cras_dsp_pipeline_get_peak_audio_buffers(pipeline) *
+		 DSP_BUFFER_SIZE * sizeof(float);
+
+	cras_dsp_put_pipeline(ctx);
+	return bytes;
+}
+
 int cras_iodev_frames_queued(struct cras_iodev *iodev,
 			     struct timespec *hw_tstamp)
 {
+	struct cras_iodev_wake_levels *levels = &iodev->wake_levels;
 	int rc;
 
-	rc = iodev->frames_queued(iodev, hw_tstamp);
-	if (rc < 0)
-		return rc;
+	if (levels->valid & CRAS_IODEV_WAKE_LEVEL_QUEUED) {
+		rc = levels->queued;
+		*hw_tstamp = levels->queued_tstamp;
+	} else {
+		rc = iodev->frames_queued(iodev, hw_tstamp);
+		if (rc < 0)
+			return rc;
+		if (levels->active) {
+			levels->queued = rc;
+			levels->queued_tstamp = *hw_tstamp;
+			levels->valid |= CRAS_IODEV_WAKE_LEVEL_QUEUED;
+		}
+	}
 
 	if (iodev->direction == CRAS_STREAM_INPUT) {
 		if (rc > 0)
@@ -1343,17 +1765,40 @@ int cras_iodev_fill_odev_zeros(struct cras_iodev *odev, unsigned int frames)
 	return 0;
 }
 
+int cras_iodev_rewind_output(struct cras_iodev *odev, unsigned int frames)
+{
+	int rc;
+
+	if (odev->direction != CRAS_STREAM_OUTPUT || !odev->rewind ||
+	    cras_iodev_state(odev) != CRAS_IODEV_STATE_NORMAL_RUN)
+		return 0;
+
+	rc = odev->rewind(odev, frames);
+	cras_iodev_invalidate_wake_levels(odev);
+	if (rc <= 0)
+		return rc;
+
+	ATLOG(atlog, AUDIO_THREAD_DEV_REWIND, odev->info.idx, frames, rc);
+	/* The frames will be counted again when they are written. */
+	rate_estimator_add_frames(odev->rate_est, -rc);
+	return rc;
+}
+
 int cras_iodev_output_underrun(struct cras_iodev *odev, unsigned int hw_level,
 			       unsigned int frames_written)
 {
+	int rc;
+
 	ATLOG(atlog, AUDIO_THREAD_UNDERRUN, odev->info.idx, hw_level,
 	      frames_written);
 	odev->num_underruns++;
 	cras_audio_thread_event_underrun();
 	if (odev->output_underrun)
-		return odev->output_underrun(odev);
+		rc = odev->output_underrun(odev);
 	else
-		return cras_iodev_fill_odev_zeros(odev, odev->min_cb_level);
+		rc = cras_iodev_fill_odev_zeros(odev, odev->min_cb_level);
+	cras_iodev_invalidate_wake_levels(odev);
+	return rc;
 }
 
 int cras_iodev_odev_should_wake(const struct cras_iodev *odev)
@@ -1439,6 +1884,7 @@ int cras_iodev_prepare_output_before_write_samples(struct cras_iodev *odev)
 {
 	int may_enter_normal_run;
 	enum CRAS_IODEV_STATE state;
+	int rc;
 
 	if (odev->direction != CRAS_STREAM_OUTPUT)
 		return -EINVAL;
@@ -1452,8 +1898,11 @@ int cras_iodev_prepare_output_before_write_samples(struct cras_iodev *odev)
 		return cras_iodev_output_event_sample_ready(odev);
 
 	/* no_stream ops is called every cycle in no_stream state. */
-	if (state == CRAS_IODEV_STATE_NO_STREAM_RUN)
-		return odev->no_stream(odev, 1);
+	if (state == CRAS_IODEV_STATE_NO_STREAM_RUN) {
+		rc = odev->no_stream(odev, 1);
+		cras_iodev_invalidate_wake_levels(odev);
+		return rc;
+	}
 
 	return 0;
 }
@@ -1463,6 +1912,36 @@ unsigned int cras_iodev_get_num_underruns(const struct cras_iodev *iodev)
 	return iodev->num_underruns;
 }
 
+bool cras_iodev_supports_low_latency(const struct cras_iodev *iodev,
+				     const struct cras_rstream *stream)
+{
+	if (!iodev->format)
+		return false;
+	if (iodev->format->format != stream->format.format ||
+	    iodev->format->frame_rate != stream->format.frame_rate ||
+	    iodev->format->num_channels != stream->format.num_channels)
+		return false;
+	return stream->cb_threshold >= iodev->min_buffer_level;
+}
+
+bool cras_iodev_supports_exclusive(const struct cras_iodev *iodev,
+				   const struct cras_rstream *stream)
+{
+	if (!iodev->format)
+		return false;
+	return iodev->format->format == stream->format.format &&
+	       iodev->format->frame_rate == stream->format.frame_rate &&
+	       iodev->format->num_channels == stream->format.num_channels;
+}
+
+bool cras_iodev_supports_passthrough(const struct cras_iodev *iodev,
+				     const struct cras_rstream *stream)
+{
+	if (!iodev->active_node || !iodev->active_node->passthrough_supported)
+		return false;
+	return cras_iodev_supports_exclusive(iodev, stream);
+}
+
 unsigned int cras_iodev_get_num_severe_underruns(const struct cras_iodev *iodev)
 {
 	if (iodev->get_num_severe_underruns)
@@ -1665,6 +2144,7 @@ static int cras_iodev_drop_frames(struct cras_iodev *iodev, unsigned int frames)
 			return rc;
 
 		rc = iodev->put_buffer(iodev, frames);
+		cras_iodev_invalidate_wake_levels(iodev);
 		if (rc < 0)
 			return rc;
 		dropped_frames += frames;
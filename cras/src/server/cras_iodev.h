@@ -16,20 +16,26 @@
 
 #include <stdbool.h>
 
+#include "array.h"
 #include "cras_dsp.h"
 #include "cras_iodev_info.h"
 #include "cras_messages.h"
+#include "energy_vad.h"
 #include "ewma_power.h"
 
 struct buffer_share;
 struct cras_fmt_conv;
 struct cras_ramp;
+struct cras_ref_ring;
 struct cras_rstream;
+struct cras_audio_shm;
 struct cras_audio_area;
 struct cras_audio_format;
+struct cras_channel_matrix;
 struct audio_thread;
 struct cras_iodev;
 struct rate_estimator;
+struct cras_iodev_clock;
 
 /*
  * Type of callback function to execute when loopback sender transfers audio
@@ -66,7 +72,8 @@ typedef int (*iodev_hook_t)();
  *    type - Pre-dsp loopback can be used for system loopback. Post-dsp
  *        loopback can be used for echo reference.
  *    hook_data - Callback used for playback samples after mixing, before or
- *        after applying DSP depends on the value of |type|.
+ *        after applying DSP depends on the value of |type|. A post DSP
+ *        receiver can leave it NULL and read the sender's post_dsp_ref.
  *    hook_control - Callback to notify receiver that loopback starts or stops.
  *    cb_data - Pointer to the loopback receiver, will be passing to hook functions.
  */
@@ -78,6 +85,16 @@ struct cras_loopback {
 	struct cras_loopback *prev, *next;
 };
 
+/* The most streams the rate of a device is chosen for. */
+#define CRAS_IODEV_MAX_RATE_DEMANDS 8
+
+/* The rate and channel count of a stream a device is about to serve, weighing
+ * how much resampling each device rate would cost. */
+struct cras_iodev_rate_demand {
+	size_t frame_rate;
+	size_t num_channels;
+};
+
 /* State of an iodev.
  * no_stream state is only supported on output device.
  * Open state is only supported for device supporting start ops.
@@ -115,6 +132,16 @@ enum CRAS_IODEV_STATE {
  *    specified in the ucm config.
  *    stable_id - id for node that doesn't change after unplug/plug.
  *    is_sco_pcm - Bool to indicate whether the ionode is for SCO over PCM.
+ *    channel_matrices - Channel conversion matrices configured for the node,
+ *      used in place of the default ones for streams of matching channel
+ *      counts. Owned by the node.
+ *    adaptive_min_buffer_level - For output: The lowest the audio thread may
+ *      lower the min_buffer_level of the device to while this node is active.
+ *    adaptive_max_buffer_level - For output: The highest the audio thread may
+ *      raise the min_buffer_level to. Both are 0 to only raise it, up to the
+ *      board's adaptive buffer limit.
+ *    passthrough_supported - For output: True if the sink behind the node
+ *      decodes compressed audio sent as IEC 61937 bursts.
  */
 struct cras_ionode {
 	struct cras_iodev *dev;
@@ -130,14 +157,59 @@ struct cras_ionode {
 	char name[CRAS_NODE_NAME_BUFFER_SIZE];
 	const char *dsp_name;
 	char active_hotword_model[CRAS_NODE_HOTWORD_MODEL_BUFFER_SIZE];
-	float *softvol_scalers;
+	const float *softvol_scalers;
 	int software_volume_needed;
 	long intrinsic_sensitivity;
 	unsigned int stable_id;
 	int is_sco_pcm;
+	struct cras_channel_matrix *channel_matrices;
+	unsigned int adaptive_min_buffer_level;
+	unsigned int adaptive_max_buffer_level;
+	int passthrough_supported;
 	struct cras_ionode *prev, *next;
 };
 
+/* A stream attached to a device, with the pointers the audio thread follows
+ * to reach its state on every wake.
+ * dev_stream - The stream's state for this device.
+ * stream - The stream serviced.
+ * shm - The shared memory of the stream.
+ */
+struct cras_iodev_stream_ref {
+	struct dev_stream *dev_stream;
+	struct cras_rstream *stream;
+	struct cras_audio_shm *shm;
+};
+
+DECLARE_ARRAY_TYPE(struct cras_iodev_stream_ref, cras_iodev_stream_refs);
+
+/* Bits of the values held in cras_iodev_wake_levels. */
+enum CRAS_IODEV_WAKE_LEVEL {
+	CRAS_IODEV_WAKE_LEVEL_QUEUED = 1 << 0,
+	CRAS_IODEV_WAKE_LEVEL_DELAY = 1 << 1,
+	CRAS_IODEV_WAKE_LEVEL_VALID_FRAMES = 1 << 2,
+};
+
+/* The level and delay of a device, read from it once per wake of the audio
+ * thread and shared by all the stages of the wake. They are read again once
+ * frames are put to or taken from the device.
+ * active - Set from cras_iodev_begin_wake() to cras_iodev_end_wake(), the
+ *          device is asked on every query outside of a wake.
+ * valid - The CRAS_IODEV_WAKE_LEVEL bits of the values below that hold.
+ * queued, queued_tstamp - What frames_queued returned.
+ * delay - What delay_frames returned.
+ * valid_frames, valid_tstamp - What get_valid_frames returned.
+ */
+struct cras_iodev_wake_levels {
+	int active;
+	unsigned int valid;
+	int queued;
+	struct timespec queued_tstamp;
+	int delay;
+	int valid_frames;
+	struct timespec valid_tstamp;
+};
+
 /* An input or output device, that can have audio routed to/from it.
  * set_volume - Function to call if the system volume changes.
  * set_capture_gain - Function to call if active node's capture_gain changes.
@@ -184,8 +256,19 @@ struct cras_ionode {
  *        audio thread can sleep before serving this playback dev the next time.
  *        Not implementing this ops means fall back to default behavior in
  *        cras_iodev_default_frames_to_play_in_sleep().
+ * resume - (Optional) Brings the hardware of a device kept open across a
+ *          system suspend back to the state of a freshly configured device,
+ *          keeping its configuration. Returns a negative error when the
+ *          hardware lost its state and the device has to be reopened.
+ * rewind - (Optional) Moves the write position of an output device back by
+ *          up to the given frames, so audio queued but not played yet is
+ *          written again. Returns the frames it moved back.
  * format - The audio format being rendered or captured to hardware.
  * rate_est - Rate estimator to estimate the actual device rate.
+ * delay_tstamp - When the hardware measured the last result of delay_frames,
+ *                zero if it is the delay at the time it was read.
+ * wake_levels - The level and delay read in the current wake of the audio
+ *               thread.
  * area - Information about how the samples are stored.
  * info - Unique identifier for this device (index and name).
  * nodes - The output or input nodes available for this device.
@@ -207,6 +290,9 @@ struct cras_ionode {
  *     be different when active node changes. Configured when there's no
  *     hardware gain control.
  * streams - List of audio streams serviced by dev.
+ * stream_refs - The streams in list order, packed in one array so the audio
+ *               thread walks them linearly. Rebuilt when a stream is added
+ *               or removed.
  * state - Device is in one of close, open, normal, or no_stream state defined
  *         in enum CRAS_IODEV_STATE.
  * min_cb_level - min callback level of any stream attached.
@@ -219,9 +305,24 @@ struct cras_ionode {
  * buf_state - If multiple streams are writing to this device, then this
  *     keeps track of how much each stream has written.
  * idle_timeout - The timestamp when to close the dev after being idle.
+ * idle_start - When the last stream left the device, zero if it isn't idle.
+ * idle_gap_ms - Average time from the device going idle to a stream using it
+ *     again, 0 before the first reuse.
+ * open_cost_ms - How long the last open of the device took.
+ * open_off_main - Set for devices slow to open, whose open and configure can
+ *    run on the open worker instead of the main thread.
+ * opening - Set while the open worker opens the device. The device reads as
+ *    closed to the main thread until the open completes there.
  * open_ts - The time when the device opened.
  * loopbacks - List of registered cras_loopback objects representing the
  *    receivers who wants a copy of the audio sending through this iodev.
+ * post_dsp_ref - For playback only. Ring of the post DSP samples, read in
+ *    place by the post DSP receivers registered without a data hook.
+ * pre_roll_ms - For capture only. How much of the latest captured audio to
+ *    keep while the device is open, for input streams asking for pre-roll.
+ *    Zero to keep none.
+ * pre_roll - For capture only. Ring of the latest frames captured after DSP,
+ *    allocated on open when pre_roll_ms is set.
  * pre_open_iodev_hook - Optional callback to call before iodev open.
  * post_close_iodev_hook - Optional callback to call after iodev close.
  * ext_dsp_module - External dsp module to process audio data in stream level
@@ -234,11 +335,31 @@ struct cras_ionode {
  *                     haven't been "put" yet.
  * input_dsp_offset - The number of frames in the HW buffer that have already
  *                    been processed by the input DSP.
+ * dsp_silent_frames - For playback only. The number of silent frames in a
+ *                     row the DSP has turned into silence. Silent buffers
+ *                     bypass the DSP once this covers its tail.
  * input_data - Used to pass audio input data to streams with or without
  *              stream side processing.
  * initial_ramp_request - The value indicates which type of ramp the device
  * should perform when some samples are ready for playback.
  * ewma - The ewma instance to calculate iodev volume.
+ * vad - Voice activity detected from ewma on input devices, gates VAD_GATED
+ *       streams.
+ * thread - The audio thread servicing the device while it is open, set by
+ *          cras_iodev_list before the device is opened.
+ * thread_key - Devices sharing a non-NULL key, such as the devices of one
+ *              card, are serviced by the same audio thread.
+ * clock_domain - Devices sharing a non-NULL domain run from the same clock,
+ *                so one rate estimate serves all of them while they are
+ *                open. They must share their thread_key too.
+ * clock - The open devices of clock_domain, NULL when there is none.
+ * clock_generation - The rate of clock last seen by this device.
+ * kept_on_suspend - Set while the device is kept open, off its audio thread,
+ *                   across a system suspend.
+ * rate_demands - The streams the device is about to serve, set by
+ *                cras_iodev_list before the device is opened so that its rate
+ *                suits all of them.
+ * num_rate_demands - The number of entries in rate_demands.
  */
 struct cras_iodev {
 	void (*set_volume)(struct cras_iodev *iodev);
@@ -274,8 +395,12 @@ struct cras_iodev {
 	unsigned int (*frames_to_play_in_sleep)(struct cras_iodev *iodev,
 						unsigned int *hw_level,
 						struct timespec *hw_tstamp);
+	int (*resume)(struct cras_iodev *iodev);
+	int (*rewind)(struct cras_iodev *odev, unsigned int frames);
 	struct cras_audio_format *format;
 	struct rate_estimator *rate_est;
+	struct timespec delay_tstamp;
+	struct cras_iodev_wake_levels wake_levels;
 	struct cras_audio_area *area;
 	struct cras_iodev_info info;
 	struct cras_ionode *nodes;
@@ -293,6 +418,7 @@ struct cras_iodev {
 	int software_volume_needed;
 	float software_gain_scaler;
 	struct dev_stream *streams;
+	cras_iodev_stream_refs stream_refs;
 	enum CRAS_IODEV_STATE state;
 	unsigned int min_cb_level;
 	unsigned int max_cb_level;
@@ -301,8 +427,16 @@ struct cras_iodev {
 	unsigned int num_underruns;
 	struct buffer_share *buf_state;
 	struct timespec idle_timeout;
+	struct timespec idle_start;
+	unsigned int idle_gap_ms;
+	unsigned int open_cost_ms;
+	int open_off_main;
+	int opening;
 	struct timespec open_ts;
 	struct cras_loopback *loopbacks;
+	struct cras_ref_ring *post_dsp_ref;
+	unsigned int pre_roll_ms;
+	struct cras_ref_ring *pre_roll;
 	iodev_hook_t pre_open_iodev_hook;
 	iodev_hook_t post_close_iodev_hook;
 	struct ext_dsp_module *ext_dsp_module;
@@ -311,9 +445,19 @@ struct cras_iodev {
 	int input_streaming;
 	unsigned int input_frames_read;
 	unsigned int input_dsp_offset;
+	unsigned int dsp_silent_frames;
 	unsigned int initial_ramp_request;
 	struct input_data *input_data;
 	struct ewma_power ewma;
+	struct energy_vad vad;
+	struct audio_thread *thread;
+	const void *thread_key;
+	const void *clock_domain;
+	struct cras_iodev_clock *clock;
+	unsigned int clock_generation;
+	int kept_on_suspend;
+	struct cras_iodev_rate_demand rate_demands[CRAS_IODEV_MAX_RATE_DEMANDS];
+	unsigned int num_rate_demands;
 	struct cras_iodev *prev, *next;
 };
 
@@ -375,6 +519,18 @@ enum CRAS_IODEV_RAMP_REQUEST {
 int cras_iodev_set_format(struct cras_iodev *iodev,
 			  const struct cras_audio_format *fmt);
 
+/* Finds the supported rate to run the iodev at for the streams in its
+ * rate_demands. The rate that best suits the stream opening the device is
+ * kept unless another rate one of the streams would pick resamples less
+ * audio overall.
+ * Args:
+ *    iodev - The iodev, with its supported rates up to date.
+ *    rate - The rate of the stream opening the device.
+ * Returns:
+ *    The rate, 0 if the device supports none.
+ */
+size_t cras_iodev_best_rate(struct cras_iodev *iodev, size_t rate);
+
 /* Clear the format previously set for this iodev.
  *
  * Args:
@@ -524,14 +680,23 @@ int cras_iodev_add_stream(struct cras_iodev *iodev, struct dev_stream *stream);
 
 /* Indicate that a stream is taken into consideration of device's I/O. This
  * function is for output stream only. For input stream, it is already included
- * by add_stream function. */
+ * by add_stream function. A paused stream isn't started. */
 void cras_iodev_start_stream(struct cras_iodev *iodev,
 			     struct dev_stream *stream);
 
+/* Takes a stream out of the device's I/O while it stays attached, the
+ * reverse of cras_iodev_start_stream. An output device left without a
+ * running stream plays as if it had no stream. */
+void cras_iodev_stop_stream(struct cras_iodev *iodev,
+			    struct dev_stream *stream);
+
 /* Indicate that a stream has been removed from the device. */
 struct dev_stream *cras_iodev_rm_stream(struct cras_iodev *iodev,
 					const struct cras_rstream *stream);
 
+/* Rebuilds stream_refs from the streams list of the device. */
+void cras_iodev_update_stream_refs(struct cras_iodev *iodev);
+
 /* Get the offset of this stream into the dev's buffer. */
 unsigned int cras_iodev_stream_offset(struct cras_iodev *iodev,
 				      struct dev_stream *stream);
@@ -560,6 +725,20 @@ int cras_iodev_open(struct cras_iodev *iodev, unsigned int cb_level,
 /* Open an iodev, does teardown and invokes the close_dev callback. */
 int cras_iodev_close(struct cras_iodev *iodev);
 
+/* Brings an iodev kept open across a system suspend back to the state it had
+ * after cras_iodev_open, keeping its format, DSP and converters.
+ * Also used by the audio thread to recover a device from a severe underrun
+ * in place.
+ * Args:
+ *    iodev - The open device, either not attached to an audio thread or
+ *        called from the audio thread it is attached to.
+ * Returns:
+ *    0 on success, -ENOTSUP if the device can't resume, or a negative error
+ *    if its hardware lost its state. The device must be closed and opened
+ *    again on failure.
+ */
+int cras_iodev_resume(struct cras_iodev *iodev);
+
 /* Gets the available buffer to write/read audio.*/
 int cras_iodev_buffer_avail(struct cras_iodev *iodev, unsigned hw_level);
 
@@ -593,7 +772,13 @@ int cras_iodev_get_output_buffer(struct cras_iodev *iodev,
 				 struct cras_audio_area **area,
 				 unsigned *frames);
 
-/* Update the estimated sample rate of the device. */
+/* Update the estimated sample rate of the device. A device in a clock
+ * domain only runs its estimator while it leads the domain, the others
+ * follow the rate it estimates.
+ * Returns:
+ *    Non-zero if the rate returned by cras_iodev_get_est_rate_ratio may have
+ *    changed since the last call.
+ */
 int cras_iodev_update_rate(struct cras_iodev *iodev, unsigned int level,
 			   struct timespec *level_tstamp);
 
@@ -607,6 +792,11 @@ double cras_iodev_get_est_rate_ratio(const struct cras_iodev *iodev);
 /* Get the delay from DSP processing in frames. */
 int cras_iodev_get_dsp_delay(const struct cras_iodev *iodev);
 
+/* Returns the bytes of the buffers the device holds besides its hardware
+ * buffer: the DSP pipeline, the pre-roll ring and the shared capture
+ * conversions. */
+size_t cras_iodev_get_mem_bytes(const struct cras_iodev *iodev);
+
 /* Returns the number of frames in the hardware buffer.
  * Args:
  *    iodev - The device.
@@ -617,10 +807,45 @@ int cras_iodev_get_dsp_delay(const struct cras_iodev *iodev);
  */
 int cras_iodev_frames_queued(struct cras_iodev *iodev, struct timespec *tstamp);
 
-/* Get the delay for input/output in frames. */
-static inline int cras_iodev_delay_frames(const struct cras_iodev *iodev)
+/* Starts sharing the level and delay read from iodev between the stages of
+ * a wake of the audio thread. */
+static inline void cras_iodev_begin_wake(struct cras_iodev *iodev)
 {
-	return iodev->delay_frames(iodev) + cras_iodev_get_dsp_delay(iodev);
+	iodev->wake_levels.active = 1;
+	iodev->wake_levels.valid = 0;
+}
+
+/* Stops sharing the level and delay of iodev, at the end of a wake. */
+static inline void cras_iodev_end_wake(struct cras_iodev *iodev)
+{
+	iodev->wake_levels.active = 0;
+	iodev->wake_levels.valid = 0;
+}
+
+/* Makes the next queries of the wake read the level and delay from iodev
+ * again, after frames were put to or taken from it. */
+static inline void cras_iodev_invalidate_wake_levels(struct cras_iodev *iodev)
+{
+	iodev->wake_levels.valid = 0;
+}
+
+/* Get the delay for input/output in frames. The device is asked once per
+ * wake of the audio thread. */
+static inline int cras_iodev_delay_frames(struct cras_iodev *iodev)
+{
+	struct cras_iodev_wake_levels *levels = &iodev->wake_levels;
+	int delay;
+
+	if (levels->valid & CRAS_IODEV_WAKE_LEVEL_DELAY) {
+		delay = levels->delay;
+	} else {
+		delay = iodev->delay_frames(iodev);
+		if (delay >= 0 && levels->active) {
+			levels->delay = delay;
+			levels->valid |= CRAS_IODEV_WAKE_LEVEL_DELAY;
+		}
+	}
+	return delay + cras_iodev_get_dsp_delay(iodev);
 }
 
 /* Returns if input iodev has started streaming. */
@@ -632,7 +857,7 @@ static inline int cras_iodev_input_streaming(const struct cras_iodev *iodev)
 /* Returns true if the device is open. */
 static inline int cras_iodev_is_open(const struct cras_iodev *iodev)
 {
-	if (iodev && iodev->state != CRAS_IODEV_STATE_CLOSE)
+	if (iodev && !iodev->opening && iodev->state != CRAS_IODEV_STATE_CLOSE)
 		return 1;
 	return 0;
 }
@@ -658,6 +883,18 @@ void cras_iodev_set_ext_dsp_module(struct cras_iodev *iodev,
 /* Put 'frames' worth of zero samples into odev. */
 int cras_iodev_fill_odev_zeros(struct cras_iodev *odev, unsigned int frames);
 
+/*
+ * Moves the write position of an output device back, so the frames queued
+ * last are written again.
+ * Args:
+ *    odev - The output device, running with streams.
+ *    frames - The most frames to move back.
+ * Returns:
+ *    The frames moved back, 0 if the device can't rewind. Negative error code
+ *    on failure.
+ */
+int cras_iodev_rewind_output(struct cras_iodev *odev, unsigned int frames);
+
 /*
  * The default implementation of frames_to_play_in_sleep ops, used when an
  * iodev doesn't have its own logic.
@@ -729,6 +966,42 @@ int cras_iodev_prepare_output_before_write_samples(struct cras_iodev *odev);
  */
 unsigned int cras_iodev_get_num_underruns(const struct cras_iodev *iodev);
 
+/* Checks if an open device can run a LOW_LATENCY stream. The stream must use
+ * the format of the device, so it never needs converting, and its period must
+ * be at least the min_buffer_level the device keeps queued.
+ * Args:
+ *    iodev[in] - The open device.
+ *    stream[in] - The stream to run on it.
+ * Returns:
+ *    True if the stream can run on the device with low latency.
+ */
+bool cras_iodev_supports_low_latency(const struct cras_iodev *iodev,
+				     const struct cras_rstream *stream);
+
+/* Checks if an open device can play an EXCLUSIVE stream. The stream must use
+ * the format of the device, so its frames are never converted.
+ * Args:
+ *    iodev[in] - The open device.
+ *    stream[in] - The stream to play on it.
+ * Returns:
+ *    True if the frames of the stream can be written to the device as they
+ *    are.
+ */
+bool cras_iodev_supports_exclusive(const struct cras_iodev *iodev,
+				   const struct cras_rstream *stream);
+
+/* Checks if an open device can play a PASSTHROUGH stream. The active node must
+ * decode compressed audio, and the device must support the stream as an
+ * EXCLUSIVE one so its bursts are never converted.
+ * Args:
+ *    iodev[in] - The open device.
+ *    stream[in] - The stream to play on it.
+ * Returns:
+ *    True if the bursts of the stream reach the sink unchanged.
+ */
+bool cras_iodev_supports_passthrough(const struct cras_iodev *iodev,
+				     const struct cras_rstream *stream);
+
 /* Get number of severe underruns recorded so far.
  * Args:
  *    iodev[in] - The device.
@@ -3,21 +3,27 @@
  * found in the LICENSE file.
  */
 
+#include <pthread.h>
 #include <syslog.h>
 
 #include "audio_thread.h"
+#include "cras_aggregate_iodev.h"
+#include "cras_config.h"
 #include "cras_empty_iodev.h"
 #include "cras_iodev.h"
 #include "cras_iodev_info.h"
 #include "cras_iodev_list.h"
 #include "cras_loopback_iodev.h"
+#include "cras_main_message.h"
 #include "cras_main_thread_log.h"
 #include "cras_observer.h"
+#include "cras_overload.h"
 #include "cras_rstream.h"
 #include "cras_server.h"
 #include "cras_tm.h"
 #include "cras_types.h"
 #include "cras_system_state.h"
+#include "cras_virtual_clock.h"
 #include "server_stream.h"
 #include "softvol_curve.h"
 #include "stream_list.h"
@@ -26,6 +32,28 @@
 
 const struct timespec idle_timeout_interval = { .tv_sec = 10, .tv_nsec = 0 };
 
+/* An idle output that is slow to open and usually reused within
+ * MAX_IDLE_KEEP_ALIVE_MS stays open for twice its usual idle gap, instead of
+ * idle_timeout_interval, so that periodic sounds don't reopen it each time. */
+static const unsigned int MAX_IDLE_KEEP_ALIVE_MS = 60000;
+static const unsigned int MIN_COSTLY_OPEN_MS = 10;
+
+/* An input keeping pre-roll history that is usually reused within
+ * MAX_INPUT_WARM_MS stays open for twice its usual idle gap, instead of
+ * closing with its last stream, so the next stream finds history to start
+ * from. Pre-roll is kept for at most MAX_PRE_ROLL_MS. */
+static const unsigned int MAX_INPUT_WARM_MS = 30000;
+static const unsigned int MAX_PRE_ROLL_MS = 2000;
+
+/* An idle output is reopened at the rate that suits a new stream better only
+ * after it ran at its rate this long, so that streams coming and going don't
+ * reopen it back and forth. */
+static const unsigned int MIN_RATE_HOLD_MS = 10000;
+
+/* At most this many LOW_LATENCY streams run in each direction, to bound the
+ * time the audio thread spends servicing them. */
+static const unsigned int MAX_LOW_LATENCY_STREAMS = 2;
+
 /* Linked list of available devices. */
 struct iodev_list {
 	struct cras_iodev *iodevs;
@@ -47,6 +75,61 @@ struct dev_init_retry {
 	struct dev_init_retry *next, *prev;
 };
 
+enum DEV_OPEN_STATE {
+	DEV_OPEN_QUEUED,
+	DEV_OPEN_RUNNING,
+	DEV_OPEN_DONE,
+};
+
+/* An open of a device handed to the open worker. Freed by the main thread
+ * when the result comes back.
+ *    dev - The device to open, NULL once the main thread gave up on it.
+ *    cb_level - The callback level to open it with.
+ *    fmt - The format of the stream that asked to open it.
+ *    state - How far the worker got, protected by open_lock.
+ *    rc - The result of cras_iodev_open, valid once done.
+ *    cost - How long the open took.
+ */
+struct dev_open_job {
+	struct cras_iodev *dev;
+	unsigned int cb_level;
+	struct cras_audio_format fmt;
+	enum DEV_OPEN_STATE state;
+	int rc;
+	struct timespec cost;
+	struct dev_open_job *prev, *next;
+};
+
+/* Message from the open worker to the main thread. */
+struct dev_open_msg {
+	struct cras_main_message header;
+	struct dev_open_job *job;
+};
+
+/* A hotword model loaded by a worker thread, the UCM and control writes that
+ * load it to the DSP can take seconds. Only one load runs at a time, the
+ * hotword streams stay suspended until the last one asked for is done.
+ *    dev - The device loading the model, NULL when no load is in progress.
+ *    node_id - The node the model was set on.
+ *    model - The model being loaded.
+ *    next_node_id - The node of next_model.
+ *    next_model - The model asked for during the load, empty if none.
+ *    resume - Resume the hotword streams when the loads are done.
+ *    done - Set by the worker when the load is done, protected by
+ *        hotword_load_lock.
+ *    rc - The result of set_hotword_model, valid once done.
+ */
+struct hotword_model_load {
+	struct cras_iodev *dev;
+	cras_node_id_t node_id;
+	char model[CRAS_MAX_HOTWORD_MODEL_NAME_SIZE + 1];
+	cras_node_id_t next_node_id;
+	char next_model[CRAS_MAX_HOTWORD_MODEL_NAME_SIZE + 1];
+	int resume;
+	int done;
+	int rc;
+};
+
 struct device_enabled_cb {
 	device_enabled_callback_t enabled_cb;
 	device_disabled_callback_t disabled_cb;
@@ -69,8 +152,23 @@ static struct cras_iodev *empty_hotword_dev;
 /* Loopback devices. */
 static struct cras_iodev *loopdev_post_mix;
 static struct cras_iodev *loopdev_post_dsp;
+/* Output device playing to several others, NULL when there is none. */
+static struct cras_iodev *aggregate_dev;
 /* List of pending device init retries. */
 static struct dev_init_retry *init_retries;
+/* Devices with open_off_main set are opened on a worker thread started on
+ * first use, their streams are attached when the open is back on the main
+ * thread. open_lock protects open_jobs, the opens not yet completed. */
+static pthread_mutex_t open_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t open_queued_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t open_done_cond = PTHREAD_COND_INITIALIZER;
+static struct dev_open_job *open_jobs;
+/* 1 once the open worker runs, -1 if it failed to start, in which case
+ * devices are opened on the main thread. */
+static int open_worker_state;
+/* The EXCLUSIVE or PASSTHROUGH stream playing on the enabled outputs, NULL
+ * when there is none. Other output streams are paused while it plays. */
+static struct cras_rstream *exclusive_stream;
 
 /* Keep a constantly increasing index for iodevs. Index 0 is reserved
  * to mean "no device". */
@@ -79,8 +177,10 @@ static uint32_t next_iodev_idx = MAX_SPECIAL_DEVICE_IDX;
 /* Call when a device is enabled or disabled. */
 struct device_enabled_cb *device_enable_cbs;
 
-/* Thread that handles audio input and output. */
-static struct audio_thread *audio_thread;
+/* Threads that handle audio input and output. The first one services the
+ * enabled devices, the others the devices only opened for pinned streams. */
+static struct audio_thread *audio_threads[CRAS_MAX_AUDIO_THREADS];
+static unsigned int num_audio_threads;
 /* List of all streams. */
 static struct stream_list *stream_list;
 /* Idle device timer. */
@@ -89,8 +189,39 @@ static struct cras_timer *idle_timer;
 static int stream_list_suspended = 0;
 /* If init device failed, retry after 1 second. */
 static const unsigned int INIT_DEV_DELAY_MS = 1000;
+/* How late the idle check and the init retries may run, to share a wake up
+ * with other timers. */
+static const unsigned int IDLE_CHECK_SLACK_MS = 500;
+static const unsigned int INIT_DEV_SLACK_MS = 200;
 /* Flag to indicate that hotword streams are suspended. */
 static int hotword_suspended = 0;
+/* The hotword model load in progress. */
+static struct hotword_model_load hotword_load;
+static pthread_mutex_t hotword_load_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hotword_load_cond = PTHREAD_COND_INITIALIZER;
+/* 1 once the handler of loaded models is added, -1 if that failed, in which
+ * case models are loaded on the main thread. */
+static int hotword_load_handler_state;
+
+/* Maximum number of stream attaches held back while a batch is open. */
+#define MAX_BATCH_ATTACHES 32
+/* Maximum number of devices a stream is attached to at once. */
+#define MAX_ATTACH_DEVS 10
+
+/* Streams waiting to be attached to the audio thread in one command.
+ *    depth - Number of cras_iodev_list_begin_stream_batch() calls not yet
+ *        ended, attaches are held back while it's non-zero.
+ *    num - Number of entries used in attaches.
+ *    attaches - The pending attaches, their devs point to the matching
+ *        row of devs.
+ *    devs - Device storage for attaches.
+ */
+static struct {
+	unsigned int depth;
+	unsigned int num;
+	struct audio_thread_stream_attach attaches[MAX_BATCH_ATTACHES];
+	struct cras_iodev *devs[MAX_BATCH_ATTACHES][MAX_ATTACH_DEVS];
+} stream_batch;
 
 static void idle_dev_check(struct cras_timer *timer, void *data);
 
@@ -155,6 +286,9 @@ static int add_dev_to_list(struct cras_iodev *dev)
 	return 0;
 }
 
+static void cancel_dev_open(struct cras_iodev *dev);
+static void cancel_hotword_model_load(struct cras_iodev *dev);
+
 /* Removes a device to the list.  Used from rm_input and rm_output. */
 static int rm_dev_from_list(struct cras_iodev *dev)
 {
@@ -162,6 +296,10 @@ static int rm_dev_from_list(struct cras_iodev *dev)
 
 	DL_FOREACH (devs[dev->direction].iodevs, tmp)
 		if (tmp == dev) {
+			/* The worker must be done with it before it's freed. */
+			if (dev->opening)
+				cancel_dev_open(dev);
+			cancel_hotword_model_load(dev);
 			if (cras_iodev_is_open(dev))
 				return -EBUSY;
 			DL_DELETE(devs[dev->direction].iodevs, dev);
@@ -328,7 +466,8 @@ static void sys_mute_change(void *context, int muted, int user_muted,
 			cras_iodev_set_mute(dev);
 		} else {
 			audio_thread_dev_start_ramp(
-				audio_thread, dev->info.idx,
+				cras_iodev_list_get_dev_audio_thread(dev),
+				dev->info.idx,
 				(should_mute ?
 					 CRAS_IODEV_RAMP_REQUEST_DOWN_MUTE :
 					 CRAS_IODEV_RAMP_REQUEST_UP_UNMUTE));
@@ -336,11 +475,119 @@ static void sys_mute_change(void *context, int muted, int user_muted,
 	}
 }
 
+/* Removes dev from the pending batch attaches. Attaches left without a device
+ * are dropped when the batch is flushed.
+ * Args:
+ *    dev - The device going away.
+ *    keep_pinned - Non-zero to leave the attaches of pinned streams alone.
+ */
+static void batch_remove_dev(struct cras_iodev *dev, int keep_pinned)
+{
+	struct audio_thread_stream_attach *a;
+	unsigned int i, j, k;
+
+	for (i = 0; i < stream_batch.num; i++) {
+		a = &stream_batch.attaches[i];
+		if (keep_pinned && a->stream->is_pinned)
+			continue;
+		for (j = 0, k = 0; j < a->num_devs; j++)
+			if (a->devs[j] != dev)
+				a->devs[k++] = a->devs[j];
+		a->num_devs = k;
+	}
+}
+
+/* Removes the pending batch attach of a stream that goes away. */
+static void batch_remove_stream(const struct cras_rstream *stream)
+{
+	unsigned int i, j;
+
+	for (i = 0, j = 0; i < stream_batch.num; i++) {
+		if (stream_batch.attaches[i].stream == stream)
+			continue;
+		if (i != j) {
+			stream_batch.attaches[j] = stream_batch.attaches[i];
+			memcpy(stream_batch.devs[j], stream_batch.devs[i],
+			       sizeof(stream_batch.devs[j]));
+			stream_batch.attaches[j].devs = stream_batch.devs[j];
+		}
+		j++;
+	}
+	stream_batch.num = j;
+}
+
+/* Sends the pending batch attaches to the audio threads, one command per
+ * thread. All devices of a stream are serviced by the same thread. A stream
+ * that fails to attach stays in the stream list without a device, the same
+ * as when its devices fail to init. */
+static void batch_flush()
+{
+	struct audio_thread_stream_attach attaches[MAX_BATCH_ATTACHES];
+	struct audio_thread_stream_attach *a;
+	struct audio_thread *thread;
+	unsigned int i, t, num;
+	int rc;
+
+	for (t = 0; t < num_audio_threads; t++) {
+		thread = audio_threads[t];
+		num = 0;
+		for (i = 0; i < stream_batch.num; i++) {
+			a = &stream_batch.attaches[i];
+			if (a->num_devs == 0 ||
+			    cras_iodev_list_get_dev_audio_thread(a->devs[0]) !=
+				    thread)
+				continue;
+			attaches[num++] = *a;
+		}
+		if (num == 0)
+			continue;
+
+		rc = audio_thread_add_streams(thread, attaches, num);
+		if (rc) {
+			syslog(LOG_ERR, "adding %u streams to thread fail, rc %d",
+			       num, rc);
+			continue;
+		}
+		for (i = 0; i < num; i++) {
+			a = &attaches[i];
+			if (a->rc)
+				syslog(LOG_ERR,
+				       "adding stream %x to thread fail, rc %d",
+				       a->stream->stream_id, a->rc);
+		}
+	}
+	stream_batch.num = 0;
+}
+
+/* Queues a stream attach to be sent with the rest of the batch. */
+static int batch_add_stream(struct cras_rstream *stream,
+			    struct cras_iodev **iodevs, unsigned int num_iodevs)
+{
+	struct audio_thread_stream_attach *a;
+
+	if (num_iodevs > MAX_ATTACH_DEVS)
+		return -EINVAL;
+	if (stream_batch.num == MAX_BATCH_ATTACHES)
+		batch_flush();
+
+	a = &stream_batch.attaches[stream_batch.num];
+	memcpy(stream_batch.devs[stream_batch.num], iodevs,
+	       num_iodevs * sizeof(*iodevs));
+	a->stream = stream;
+	a->devs = stream_batch.devs[stream_batch.num];
+	a->num_devs = num_iodevs;
+	a->rc = 0;
+	stream_batch.num++;
+	return 0;
+}
+
 static void remove_all_streams_from_dev(struct cras_iodev *dev)
 {
 	struct cras_rstream *rstream;
 
-	audio_thread_rm_open_dev(audio_thread, dev->direction, dev->info.idx);
+	batch_remove_dev(dev, 0);
+	audio_thread_rm_open_dev(cras_iodev_list_get_dev_audio_thread(dev),
+				 dev->direction, dev->info.idx);
 
 	DL_FOREACH (stream_list_get(stream_list), rstream) {
 		if (rstream->apm_list == NULL)
@@ -377,45 +624,211 @@ static void possibly_disable_echo_reference(struct cras_iodev *dev)
 	server_stream_destroy(stream_list, dev->echo_reference_dev->info.idx);
 }
 
+static void dev_open_done(struct cras_main_message *msg, void *arg);
+
+static struct dev_open_job *next_queued_open()
+{
+	struct dev_open_job *job;
+
+	DL_FOREACH (open_jobs, job)
+		if (job->state == DEV_OPEN_QUEUED)
+			return job;
+	return NULL;
+}
+
+static void *open_worker_loop(void *arg)
+{
+	struct dev_open_job *job;
+	struct dev_open_msg msg;
+	struct timespec start, end;
+	int rc;
+
+	pthread_mutex_lock(&open_lock);
+	while (1) {
+		job = next_queued_open();
+		if (!job) {
+			pthread_cond_wait(&open_queued_cond, &open_lock);
+			continue;
+		}
+		job->state = DEV_OPEN_RUNNING;
+		pthread_mutex_unlock(&open_lock);
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+		rc = cras_iodev_open(job->dev, job->cb_level, &job->fmt);
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+
+		memset(&msg, 0, sizeof(msg));
+		msg.header.type = CRAS_MAIN_DEV_OPEN;
+		msg.header.length = sizeof(msg);
+		msg.job = job;
+
+		pthread_mutex_lock(&open_lock);
+		job->rc = rc;
+		subtract_timespecs(&end, &start, &job->cost);
+		job->state = DEV_OPEN_DONE;
+		pthread_cond_broadcast(&open_done_cond);
+		pthread_mutex_unlock(&open_lock);
+
+		/* The main thread owns the job from here and clears
+		 * dev->opening when it gets this, so don't let it drop. */
+		if (cras_main_message_send_blocking(&msg.header))
+			syslog(LOG_ERR, "Failed to report device open");
+
+		pthread_mutex_lock(&open_lock);
+	}
+	return NULL;
+}
+
+static int start_open_worker()
+{
+	pthread_t tid;
+
+	if (open_worker_state)
+		return open_worker_state > 0;
+
+	open_worker_state = -1;
+	if (cras_main_message_add_handler(CRAS_MAIN_DEV_OPEN, dev_open_done,
+					  NULL))
+		return 0;
+	if (pthread_create(&tid, NULL, open_worker_loop, NULL)) {
+		syslog(LOG_ERR, "Failed to start device open worker");
+		return 0;
+	}
+	pthread_detach(tid);
+	open_worker_state = 1;
+	return 1;
+}
+
+/* Queues the open of dev for rstream to the open worker. Returns 0 if the
+ * open is queued, the device is then opening until dev_open_done. */
+static int queue_dev_open(struct cras_iodev *dev,
+			  const struct cras_rstream *rstream)
+{
+	struct dev_open_job *job;
+
+	if (!start_open_worker())
+		return -ENOSYS;
+
+	job = (struct dev_open_job *)calloc(1, sizeof(*job));
+	if (!job)
+		return -ENOMEM;
+	job->dev = dev;
+	job->cb_level = rstream->cb_threshold;
+	job->fmt = rstream->format;
+	dev->opening = 1;
+
+	pthread_mutex_lock(&open_lock);
+	DL_APPEND(open_jobs, job);
+	pthread_cond_signal(&open_queued_cond);
+	pthread_mutex_unlock(&open_lock);
+	return 0;
+}
+
+/* Gives up on the open of dev by the worker, for a device closed or removed
+ * before the open completed. Waits for an open already running to finish and
+ * closes the device again. */
+static void cancel_dev_open(struct cras_iodev *dev)
+{
+	struct dev_open_job *job;
+	int rc = -ECANCELED;
+
+	pthread_mutex_lock(&open_lock);
+	DL_FOREACH (open_jobs, job)
+		if (job->dev == dev)
+			break;
+	if (job && job->state == DEV_OPEN_QUEUED) {
+		DL_DELETE(open_jobs, job);
+		free(job);
+	} else if (job) {
+		while (job->state != DEV_OPEN_DONE)
+			pthread_cond_wait(&open_done_cond, &open_lock);
+		/* dev_open_done frees the job when its message comes. */
+		job->dev = NULL;
+		rc = job->rc;
+	}
+	pthread_mutex_unlock(&open_lock);
+
+	dev->opening = 0;
+	if (rc == 0)
+		cras_iodev_close(dev);
+	dev->thread = NULL;
+}
+
 /*
  * Removes all attached streams and close dev if it's opened.
  */
 static void close_dev(struct cras_iodev *dev)
 {
+	if (dev->opening)
+		cancel_dev_open(dev);
 	if (!cras_iodev_is_open(dev))
 		return;
 
 	MAINLOG(main_log, MAIN_THREAD_DEV_CLOSE, dev->info.idx, 0, 0);
 	remove_all_streams_from_dev(dev);
 	dev->idle_timeout.tv_sec = 0;
+	dev->kept_on_suspend = 0;
 	cras_iodev_close(dev);
+	dev->thread = NULL;
 	possibly_disable_echo_reference(dev);
 }
 
+/* Returns true if dev is a disabled output device kept open in standby. */
+static bool dev_in_standby(const struct cras_iodev *dev)
+{
+	return !dev->is_enabled && dev->idle_timeout.tv_sec &&
+	       cras_iodev_is_open(dev);
+}
+
+/* Closes a device in standby, as disable_device would have. */
+static void close_standby_dev(struct cras_iodev *dev)
+{
+	close_dev(dev);
+	dev->update_active_node(dev, dev->active_node->idx, 0);
+}
+
 static void idle_dev_check(struct cras_timer *timer, void *data)
 {
 	struct enabled_dev *edev;
+	struct cras_iodev *dev;
 	struct timespec now;
 	struct timespec min_idle_expiration;
 	unsigned int num_idle_devs = 0;
 	unsigned int min_idle_timeout_ms;
+	int dir;
 
 	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 	min_idle_expiration.tv_sec = 0;
 	min_idle_expiration.tv_nsec = 0;
 
-	DL_FOREACH (enabled_devs[CRAS_STREAM_OUTPUT], edev) {
-		if (edev->dev->idle_timeout.tv_sec == 0)
+	for (dir = CRAS_STREAM_OUTPUT; dir <= CRAS_STREAM_INPUT; dir++) {
+		DL_FOREACH (enabled_devs[dir], edev) {
+			dev = edev->dev;
+			if (dev->idle_timeout.tv_sec == 0)
+				continue;
+			if (timespec_after(&now, &dev->idle_timeout)) {
+				close_dev(dev);
+				continue;
+			}
+			num_idle_devs++;
+			if (min_idle_expiration.tv_sec == 0 ||
+			    timespec_after(&min_idle_expiration,
+					   &dev->idle_timeout))
+				min_idle_expiration = dev->idle_timeout;
+		}
+	}
+
+	DL_FOREACH (devs[CRAS_STREAM_OUTPUT].iodevs, dev) {
+		if (!dev_in_standby(dev))
 			continue;
-		if (timespec_after(&now, &edev->dev->idle_timeout)) {
-			close_dev(edev->dev);
+		if (timespec_after(&now, &dev->idle_timeout)) {
+			close_standby_dev(dev);
 			continue;
 		}
 		num_idle_devs++;
 		if (min_idle_expiration.tv_sec == 0 ||
-		    timespec_after(&min_idle_expiration,
-				   &edev->dev->idle_timeout))
-			min_idle_expiration = edev->dev->idle_timeout;
+		    timespec_after(&min_idle_expiration, &dev->idle_timeout))
+			min_idle_expiration = dev->idle_timeout;
 	}
 
 	idle_timer = NULL;
@@ -430,9 +843,10 @@ static void idle_dev_check(struct cras_timer *timer, void *data)
 	}
 	/* Wake up when it is time to close the next idle device.  Sleep for a
 	 * minimum of 10 milliseconds. */
-	idle_timer = cras_tm_create_timer(cras_system_state_get_tm(),
-					  MAX(min_idle_timeout_ms, 10),
-					  idle_dev_check, NULL);
+	idle_timer = cras_tm_create_timer_slack(cras_system_state_get_tm(),
+						MAX(min_idle_timeout_ms, 10),
+						IDLE_CHECK_SLACK_MS,
+						idle_dev_check, NULL);
 }
 
 /*
@@ -453,36 +867,258 @@ static void cancel_pending_init_retries(unsigned int dev_idx)
 	}
 }
 
-/* Open the device potentially filling the output with a pre buffer. */
+/* Returns true if two devices must be serviced by the same audio thread. */
+static bool same_thread_key(const struct cras_iodev *a,
+			    const struct cras_iodev *b)
+{
+	return a == b || (a->thread_key && a->thread_key == b->thread_key);
+}
+
+/* Returns true if dev or a device sharing its thread key is enabled. */
+static bool thread_key_enabled(const struct cras_iodev *dev)
+{
+	struct enabled_dev *edev;
+	unsigned int dir;
+
+	for (dir = 0; dir < CRAS_NUM_DIRECTIONS; dir++) {
+		DL_FOREACH (enabled_devs[dir], edev)
+			if (same_thread_key(edev->dev, dev))
+				return true;
+	}
+	return false;
+}
+
+/* Picks the audio thread to service dev once it is open. Enabled devices,
+ * the devices sharing their thread key, and the fallback and loopback devices
+ * stay on the first thread, so that a stream attached to several devices, and
+ * the loopback hooks of the enabled output, never span threads. Other devices
+ * join an open device with the same thread key, or else the least busy of the
+ * other threads. */
+static struct audio_thread *pick_audio_thread(const struct cras_iodev *dev)
+{
+	unsigned int num_devs[CRAS_MAX_AUDIO_THREADS] = { 0 };
+	struct cras_iodev *odev;
+	unsigned int dir, i, best;
+
+	if (num_audio_threads == 1 || thread_key_enabled(dev) ||
+	    dev == fallback_devs[dev->direction] || dev == loopdev_post_mix ||
+	    dev == loopdev_post_dsp)
+		return audio_threads[0];
+	/* Pinned streams may be on the fallback device too. */
+	if (fallback_devs[dev->direction] &&
+	    cras_iodev_list_dev_is_enabled(fallback_devs[dev->direction]))
+		return audio_threads[0];
+
+	for (dir = 0; dir < CRAS_NUM_DIRECTIONS; dir++) {
+		DL_FOREACH (devs[dir].iodevs, odev) {
+			if (odev == dev || !odev->thread)
+				continue;
+			if (same_thread_key(odev, dev))
+				return odev->thread;
+			for (i = 1; i < num_audio_threads; i++)
+				if (odev->thread == audio_threads[i])
+					num_devs[i]++;
+		}
+	}
+
+	best = 1;
+	for (i = 2; i < num_audio_threads; i++)
+		if (num_devs[i] < num_devs[best])
+			best = i;
+	return audio_threads[best];
+}
+
+/* Takes dev out of idle, accounting the time it was idle in its history. */
+static void dev_exit_idle(struct cras_iodev *dev)
+{
+	struct timespec now, gap;
+	unsigned int gap_ms;
+
+	cras_iodev_exit_idle(dev);
+	if (dev->idle_start.tv_sec == 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	subtract_timespecs(&now, &dev->idle_start, &gap);
+	/* Any gap well past the keep alive limit counts the same. */
+	gap_ms = MIN(gap.tv_sec, MAX_IDLE_KEEP_ALIVE_MS / 100) * 1000 +
+		 gap.tv_nsec / 1000000;
+	dev->idle_gap_ms = dev->idle_gap_ms ?
+				   (3 * dev->idle_gap_ms + gap_ms) / 4 :
+				   gap_ms;
+	dev->idle_start.tv_sec = 0;
+	dev->idle_start.tv_nsec = 0;
+}
+
+/* Gets how long dev stays open once idle, from its open cost and how soon it
+ * was used again after its previous idle times. */
+static void get_idle_timeout(const struct cras_iodev *dev,
+			     struct timespec *timeout)
+{
+	unsigned int keep_alive_ms;
+
+	*timeout = idle_timeout_interval;
+	if (dev->open_cost_ms < MIN_COSTLY_OPEN_MS || !dev->idle_gap_ms ||
+	    dev->idle_gap_ms > MAX_IDLE_KEEP_ALIVE_MS)
+		return;
+
+	keep_alive_ms = MIN(2 * dev->idle_gap_ms, MAX_IDLE_KEEP_ALIVE_MS);
+	if (keep_alive_ms > timespec_to_ms(&idle_timeout_interval))
+		ms_to_timespec(keep_alive_ms, timeout);
+}
+
+/* Gets how long an idle input stays open to keep its pre-roll history
+ * going. Returns false if it should close right away. */
+static bool get_input_warm_timeout(const struct cras_iodev *dev,
+				   struct timespec *timeout)
+{
+	if (!dev->pre_roll_ms || !dev->idle_gap_ms ||
+	    dev->idle_gap_ms > MAX_INPUT_WARM_MS)
+		return false;
+	ms_to_timespec(MIN(2 * dev->idle_gap_ms, MAX_INPUT_WARM_MS), timeout);
+	return true;
+}
+
+/* Lists the streams dev is about to serve, for its rate to suit them all. */
+static void set_rate_demands(struct cras_iodev *dev)
+{
+	struct cras_rstream *stream;
+	struct cras_iodev_rate_demand *demand;
+	int dev_enabled = cras_iodev_list_dev_is_enabled(dev);
+
+	dev->num_rate_demands = 0;
+	DL_FOREACH (stream_list_get(stream_list), stream) {
+		if (dev->num_rate_demands == CRAS_IODEV_MAX_RATE_DEMANDS)
+			break;
+		if (stream->direction != dev->direction)
+			continue;
+		if (stream->is_pinned ? stream->pinned_dev_idx != dev->info.idx :
+					!dev_enabled)
+			continue;
+		demand = &dev->rate_demands[dev->num_rate_demands++];
+		demand->frame_rate = stream->format.frame_rate;
+		demand->num_channels = stream->format.num_channels;
+	}
+}
+
+/* Returns true if dev is open but idle, has held its rate for long enough,
+ * and would run at another rate for the streams about to use it. */
+static bool idle_rate_change_due(struct cras_iodev *dev,
+				 const struct cras_rstream *rstream)
+{
+	struct timespec now, held;
+
+	if (!cras_iodev_is_open(dev) || dev->idle_start.tv_sec == 0 ||
+	    dev->streams)
+		return false;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	subtract_timespecs(&now, &dev->open_ts, &held);
+	if (timespec_to_ms(&held) < MIN_RATE_HOLD_MS)
+		return false;
+
+	set_rate_demands(dev);
+	return cras_iodev_best_rate(dev, rstream->format.frame_rate) !=
+	       dev->format->frame_rate;
+}
+
+/* Hands an open device to its audio thread. */
+static int add_open_dev(struct cras_iodev *dev)
+{
+	int rc;
+
+	/* Publishes the format the device opened with, if it changed. */
+	cras_iodev_list_update_device_list();
+
+	rc = audio_thread_add_open_dev(dev->thread, dev);
+	if (rc) {
+		cras_iodev_close(dev);
+		dev->thread = NULL;
+	}
+
+	possibly_enable_echo_reference(dev);
+
+	return rc;
+}
+
+/*
+ * Open the device potentially filling the output with a pre buffer. Returns
+ * -EINPROGRESS if the device opens on the open worker, its streams are then
+ * attached by dev_open_done.
+ */
 static int init_device(struct cras_iodev *dev, struct cras_rstream *rstream)
 {
+	struct timespec open_start, open_end, open_cost;
 	int rc;
 
-	cras_iodev_exit_idle(dev);
+	dev_exit_idle(dev);
 
 	if (cras_iodev_is_open(dev))
 		return 0;
+	if (dev->opening)
+		return -EINPROGRESS;
 	cancel_pending_init_retries(dev->info.idx);
 	MAINLOG(main_log, MAIN_THREAD_DEV_INIT, dev->info.idx,
 		rstream->format.num_channels, rstream->format.frame_rate);
 
+	/* Set before opening, devices register their callbacks on open. */
+	dev->thread = pick_audio_thread(dev);
+	set_rate_demands(dev);
+	if (dev->open_off_main && queue_dev_open(dev, rstream) == 0)
+		return -EINPROGRESS;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &open_start);
 	rc = cras_iodev_open(dev, rstream->cb_threshold, &rstream->format);
-	if (rc)
+	if (rc) {
+		dev->thread = NULL;
 		return rc;
+	}
+	clock_gettime(CLOCK_MONOTONIC_RAW, &open_end);
+	subtract_timespecs(&open_end, &open_start, &open_cost);
+	dev->open_cost_ms = timespec_to_ms(&open_cost);
 
-	rc = audio_thread_add_open_dev(audio_thread, dev);
-	if (rc)
-		cras_iodev_close(dev);
+	return add_open_dev(dev);
+}
 
-	possibly_enable_echo_reference(dev);
+/*
+ * Takes an open device off its audio thread for a system suspend, keeping its
+ * hardware parameters, DSP, converters and the APMs of its streams, so that
+ * resume_open_dev doesn't have to open it again. Returns false if the device
+ * can't resume and has to be closed instead.
+ */
+static bool suspend_open_dev(struct cras_iodev *dev)
+{
+	if (!dev->resume || !cras_iodev_is_open(dev))
+		return false;
 
-	return rc;
+	batch_remove_dev(dev, 0);
+	audio_thread_rm_open_dev(cras_iodev_list_get_dev_audio_thread(dev),
+				 dev->direction, dev->info.idx);
+	dev->kept_on_suspend = 1;
+	return true;
+}
+
+/* Brings back a device suspend_open_dev kept open. When its hardware lost
+ * its state, closes it instead so that its streams open it again. */
+static void resume_open_dev(struct cras_iodev *dev)
+{
+	int rc;
+
+	dev->kept_on_suspend = 0;
+	rc = cras_iodev_resume(dev);
+	if (rc == 0)
+		rc = audio_thread_add_open_dev(dev->thread, dev);
+	if (rc) {
+		syslog(LOG_INFO, "Reopening %s after resume: %d",
+		       dev->info.name, rc);
+		close_dev(dev);
+	}
 }
 
 static void suspend_devs()
 {
 	struct enabled_dev *edev;
 	struct cras_rstream *rstream;
+	struct cras_iodev *iodev;
 
 	MAINLOG(main_log, MAIN_THREAD_SUSPEND_DEVS, 0, 0, 0);
 
@@ -495,27 +1131,35 @@ static void suspend_devs()
 
 			dev = find_dev(rstream->pinned_dev_idx);
 			if (dev) {
-				audio_thread_disconnect_stream(audio_thread,
-							       rstream, dev);
+				audio_thread_disconnect_stream(
+					cras_iodev_list_get_dev_audio_thread(
+						dev),
+					rstream, dev);
 				if (!cras_iodev_list_dev_is_enabled(dev))
 					close_dev(dev);
 			}
 		} else {
-			audio_thread_disconnect_stream(audio_thread, rstream,
-						       NULL);
+			audio_thread_disconnect_stream(audio_threads[0],
+						       rstream, NULL);
 		}
 	}
 	stream_list_suspended = 1;
 
 	DL_FOREACH (enabled_devs[CRAS_STREAM_OUTPUT], edev) {
-		close_dev(edev->dev);
+		if (!suspend_open_dev(edev->dev))
+			close_dev(edev->dev);
 	}
 	DL_FOREACH (enabled_devs[CRAS_STREAM_INPUT], edev) {
-		close_dev(edev->dev);
+		if (!suspend_open_dev(edev->dev))
+			close_dev(edev->dev);
+	}
+	DL_FOREACH (devs[CRAS_STREAM_OUTPUT].iodevs, iodev) {
+		if (dev_in_standby(iodev))
+			close_standby_dev(iodev);
 	}
 }
 
-static int stream_added_cb(struct cras_rstream *rstream);
+static int add_stream(struct cras_rstream *rstream, bool check_admission);
 
 static void resume_devs()
 {
@@ -543,10 +1187,19 @@ static void resume_devs()
 		}
 	}
 
+	DL_FOREACH (enabled_devs[CRAS_STREAM_OUTPUT], edev) {
+		if (edev->dev->kept_on_suspend)
+			resume_open_dev(edev->dev);
+	}
+	DL_FOREACH (enabled_devs[CRAS_STREAM_INPUT], edev) {
+		if (edev->dev->kept_on_suspend)
+			resume_open_dev(edev->dev);
+	}
+
 	DL_FOREACH (stream_list_get(stream_list), rstream) {
 		if ((rstream->flags & HOTWORD_STREAM) == HOTWORD_STREAM)
 			continue;
-		stream_added_cb(rstream);
+		add_stream(rstream, false);
 	}
 }
 
@@ -622,7 +1275,18 @@ static int add_stream_to_open_devs(struct cras_rstream *stream,
 				   struct cras_iodev **iodevs,
 				   unsigned int num_iodevs)
 {
+	unsigned int pre_roll_ms;
 	int i;
+
+	/* The devices keep history from their next open on. */
+	if (stream->pre_roll_frames) {
+		pre_roll_ms = cras_frames_to_ms(stream->pre_roll_frames,
+						stream->format.frame_rate);
+		pre_roll_ms = MIN(pre_roll_ms + 1, MAX_PRE_ROLL_MS);
+		for (i = 0; i < num_iodevs; i++)
+			iodevs[i]->pre_roll_ms =
+				MAX(iodevs[i]->pre_roll_ms, pre_roll_ms);
+	}
 	if (stream->apm_list) {
 		for (i = 0; i < num_iodevs; i++)
 			cras_apm_list_add_apm(stream->apm_list, iodevs[i],
@@ -630,8 +1294,44 @@ static int add_stream_to_open_devs(struct cras_rstream *stream,
 					      cras_iodev_is_aec_use_case(
 						      iodevs[i]->active_node));
 	}
-	return audio_thread_add_stream(audio_thread, stream, iodevs,
-				       num_iodevs);
+	if (stream_batch.depth)
+		return batch_add_stream(stream, iodevs, num_iodevs);
+	return audio_thread_add_stream(
+		cras_iodev_list_get_dev_audio_thread(iodevs[0]), stream, iodevs,
+		num_iodevs);
+}
+
+/* Returns true if the device stream is pinned to is open on another audio
+ * thread than dev, a stream is never attached on two threads at once. */
+static bool pinned_on_other_thread(const struct cras_rstream *stream,
+				   const struct cras_iodev *dev)
+{
+	struct cras_iodev *pinned_dev = find_dev(stream->pinned_dev_idx);
+
+	return pinned_dev && pinned_dev != dev && pinned_dev->thread &&
+	       pinned_dev->thread != cras_iodev_list_get_dev_audio_thread(dev);
+}
+
+static bool stream_is_exclusive(const struct cras_rstream *stream)
+{
+	return stream->flags & (EXCLUSIVE | PASSTHROUGH);
+}
+
+/* Returns true if the exclusive stream can play on the open dev. */
+static bool dev_supports_exclusive(const struct cras_iodev *dev,
+				   const struct cras_rstream *stream)
+{
+	if (stream->flags & PASSTHROUGH)
+		return cras_iodev_supports_passthrough(dev, stream);
+	return cras_iodev_supports_exclusive(dev, stream);
+}
+
+/* Returns true if the stream waits for the exclusive stream to finish before
+ * it is attached. Pinned streams keep playing on their devices. */
+static bool stream_paused(const struct cras_rstream *stream)
+{
+	return exclusive_stream && stream != exclusive_stream &&
+	       stream->direction == CRAS_STREAM_OUTPUT && !stream->is_pinned;
 }
 
 static int init_and_attach_streams(struct cras_iodev *dev)
@@ -651,7 +1351,7 @@ static int init_and_attach_streams(struct cras_iodev *dev)
 	DL_FOREACH (stream_list_get(stream_list), stream) {
 		bool can_attach = 0;
 
-		if (stream->direction != dir)
+		if (stream->direction != dir || stream_paused(stream))
 			continue;
 		/*
 		 * For normal stream, if device is enabled by UI then it can
@@ -671,7 +1371,7 @@ static int init_and_attach_streams(struct cras_iodev *dev)
 		else if ((stream->pinned_dev_idx == dev->info.idx) ||
 			 (SILENT_PLAYBACK_DEVICE == dev->info.idx) ||
 			 (SILENT_RECORD_DEVICE == dev->info.idx)) {
-			can_attach = 1;
+			can_attach = !pinned_on_other_thread(stream, dev);
 		}
 
 		if (!can_attach)
@@ -683,11 +1383,18 @@ static int init_and_attach_streams(struct cras_iodev *dev)
 		 * the highest channel count.
 		 */
 		rc = init_device(dev, stream);
+		if (rc == -EINPROGRESS)
+			return rc;
 		if (rc) {
 			syslog(LOG_ERR, "Enable %s failed, rc = %d",
 			       dev->info.name, rc);
 			return rc;
 		}
+		/* Never convert an exclusive stream, or send compressed
+		 * bursts to a sink that can't decode them. */
+		if (stream_is_exclusive(stream) &&
+		    !dev_supports_exclusive(dev, stream))
+			continue;
 		add_stream_to_open_devs(stream, &dev, 1);
 	}
 	return 0;
@@ -710,6 +1417,8 @@ static void init_device_cb(struct cras_timer *timer, void *arg)
 		return;
 
 	rc = init_and_attach_streams(dev);
+	if (rc == -EINPROGRESS)
+		return;
 	if (rc < 0)
 		syslog(LOG_ERR, "Init device retry failed");
 	else
@@ -726,21 +1435,69 @@ static int schedule_init_device_retry(struct cras_iodev *dev)
 		return -ENOMEM;
 
 	retry->dev_idx = dev->info.idx;
-	retry->init_timer = cras_tm_create_timer(tm, INIT_DEV_DELAY_MS,
-						 init_device_cb, retry);
+	retry->init_timer = cras_tm_create_timer_slack(tm, INIT_DEV_DELAY_MS,
+						       INIT_DEV_SLACK_MS,
+						       init_device_cb, retry);
 	DL_APPEND(init_retries, retry);
 	return 0;
 }
 
+/* Completes on the main thread an open done by the open worker, attaching
+ * the streams that wait for the device. */
+static void dev_open_done(struct cras_main_message *msg, void *arg)
+{
+	struct dev_open_job *job = ((struct dev_open_msg *)msg)->job;
+	struct cras_iodev *dev;
+	int rc;
+
+	pthread_mutex_lock(&open_lock);
+	DL_DELETE(open_jobs, job);
+	pthread_mutex_unlock(&open_lock);
+
+	dev = job->dev;
+	rc = job->rc;
+	if (dev)
+		dev->open_cost_ms = timespec_to_ms(&job->cost);
+	free(job);
+	if (!dev)
+		return;
+
+	dev->opening = 0;
+	if (rc) {
+		syslog(LOG_ERR, "Open %s failed, rc = %d", dev->info.name, rc);
+		dev->thread = NULL;
+		schedule_init_device_retry(dev);
+		return;
+	}
+
+	/* Volume and mute changes skipped the device while it opened. */
+	if (dev->direction == CRAS_STREAM_OUTPUT) {
+		if (dev->set_volume)
+			dev->set_volume(dev);
+		cras_iodev_set_mute(dev);
+	} else if (dev->set_capture_mute) {
+		dev->set_capture_mute(dev);
+	}
+
+	if (add_open_dev(dev))
+		return;
+	rc = init_and_attach_streams(dev);
+	if (rc == 0 && cras_iodev_list_dev_is_enabled(dev))
+		possibly_disable_fallback(dev->direction);
+}
+
 static int init_pinned_device(struct cras_iodev *dev,
 			      struct cras_rstream *rstream)
 {
 	int rc;
 
-	cras_iodev_exit_idle(dev);
+	dev_exit_idle(dev);
 
-	if (audio_thread_is_dev_open(audio_thread, dev))
+	if (audio_thread_is_dev_open(cras_iodev_list_get_dev_audio_thread(dev),
+				     dev))
 		return 0;
+	if (dev->opening)
+		return -EINPROGRESS;
 
 	/* Make sure the active node is configured properly, it could be
 	 * disabled when last normal stream removed. */
@@ -786,32 +1543,153 @@ static struct cras_iodev *find_pinned_device(struct cras_rstream *rstream)
 	return hotword_suspended ? empty_hotword_dev : dev;
 }
 
-static int pinned_stream_added(struct cras_rstream *rstream)
+/*
+ * Checks if an EXCLUSIVE or PASSTHROUGH stream can play on the open iodevs.
+ * It has the enabled outputs to itself, so there is one at most, and each of
+ * them has to take its frames unchanged.
+ */
+static bool exclusive_admitted(const struct cras_rstream *rstream,
+			       struct cras_iodev **iodevs,
+			       unsigned int num_iodevs)
+{
+	unsigned int i;
+
+	if (rstream->direction != CRAS_STREAM_OUTPUT || rstream->is_pinned ||
+	    num_iodevs == 0 ||
+	    (exclusive_stream && exclusive_stream != rstream)) {
+		syslog(LOG_WARNING, "Can't play exclusive stream %x",
+		       rstream->stream_id);
+		return false;
+	}
+
+	for (i = 0; i < num_iodevs; i++) {
+		if (dev_supports_exclusive(iodevs[i], rstream))
+			continue;
+		syslog(LOG_WARNING, "%s can't play exclusive stream %x",
+		       iodevs[i]->info.name, rstream->stream_id);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Checks if a stream can run on the open iodevs. Only LOW_LATENCY and
+ * exclusive streams are limited: there is room for a few LOW_LATENCY streams
+ * in each direction, and every device has to support them.
+ */
+static bool stream_admitted(const struct cras_rstream *rstream,
+			    struct cras_iodev **iodevs, unsigned int num_iodevs)
+{
+	const struct cras_rstream *s;
+	unsigned int num_streams = 0;
+	unsigned int i;
+
+	if (stream_is_exclusive(rstream) &&
+	    !exclusive_admitted(rstream, iodevs, num_iodevs))
+		return false;
+	if (!(rstream->flags & LOW_LATENCY))
+		return true;
+
+	DL_FOREACH (stream_list_get(stream_list), s) {
+		if (s != rstream && s->direction == rstream->direction &&
+		    (s->flags & LOW_LATENCY))
+			num_streams++;
+	}
+	if (num_streams >= MAX_LOW_LATENCY_STREAMS) {
+		syslog(LOG_WARNING, "Too many low latency streams, refuse %x",
+		       rstream->stream_id);
+		return false;
+	}
+
+	for (i = 0; i < num_iodevs; i++) {
+		if (cras_iodev_supports_low_latency(iodevs[i], rstream))
+			continue;
+		syslog(LOG_WARNING, "%s can't run low latency stream %x",
+		       iodevs[i]->info.name, rstream->stream_id);
+		return false;
+	}
+	return true;
+}
+
+static int pinned_stream_added(struct cras_rstream *rstream,
+			       bool check_admission)
+{
+	struct cras_iodev *dev;
+	bool was_open;
+	int rc;
+
+	/* Check that the target device is valid for pinned streams. */
+	dev = find_pinned_device(rstream);
+	if (!dev)
+		return -EINVAL;
+
+	was_open = cras_iodev_is_open(dev);
+	rc = init_pinned_device(dev, rstream);
+	/* The stream is attached once the device opened. */
+	if (rc == -EINPROGRESS)
+		return 0;
+	if (rc) {
+		syslog(LOG_INFO, "init_pinned_device failed, rc %d", rc);
+		return schedule_init_device_retry(dev);
+	}
+
+	if (check_admission && !stream_admitted(rstream, &dev, 1)) {
+		/* Don't leave the device open only for the refused stream. */
+		if (!was_open) {
+			if (cras_iodev_list_dev_is_enabled(dev))
+				close_dev(dev);
+			else
+				close_pinned_device(dev);
+		}
+		return -ENOTSUP;
+	}
+
+	return add_stream_to_open_devs(rstream, &dev, 1);
+}
+
+/* Detaches the output streams that wait for the exclusive stream rstream to
+ * finish. */
+static void pause_output_streams(struct cras_rstream *rstream)
+{
+	struct cras_rstream *s;
+
+	exclusive_stream = rstream;
+	DL_FOREACH (stream_list_get(stream_list), s) {
+		if (!stream_paused(s))
+			continue;
+		batch_remove_stream(s);
+		audio_thread_disconnect_stream(audio_threads[0], s, NULL);
+	}
+}
+
+/* Attaches back the output streams paused for the exclusive stream. */
+static void resume_output_streams()
 {
-	struct cras_iodev *dev;
-	int rc;
-
-	/* Check that the target device is valid for pinned streams. */
-	dev = find_pinned_device(rstream);
-	if (!dev)
-		return -EINVAL;
+	struct cras_rstream *s;
 
-	rc = init_pinned_device(dev, rstream);
-	if (rc) {
-		syslog(LOG_INFO, "init_pinned_device failed, rc %d", rc);
-		return schedule_init_device_retry(dev);
+	exclusive_stream = NULL;
+	DL_FOREACH (stream_list_get(stream_list), s) {
+		if (s->direction == CRAS_STREAM_OUTPUT && !s->is_pinned)
+			add_stream(s, false);
 	}
-
-	return add_stream_to_open_devs(rstream, &dev, 1);
 }
 
-static int stream_added_cb(struct cras_rstream *rstream)
+/*
+ * Adds a stream to the devices it's routed to, opening them as needed.
+ * check_admission is set for new streams, which are refused when the devices
+ * can't run them. Streams added back after a suspend are always taken, except
+ * an exclusive stream the devices can no longer play as it is.
+ */
+static int add_stream(struct cras_rstream *rstream, bool check_admission)
 {
 	struct enabled_dev *edev;
 	struct cras_iodev *iodevs[10];
+	bool opened[10] = {};
 	unsigned int num_iodevs;
+	unsigned int i;
 	int rc;
 	bool iodev_reopened;
+	bool iodev_opening = false;
 
 	if (stream_list_suspended)
 		return 0;
@@ -820,7 +1698,12 @@ static int stream_added_cb(struct cras_rstream *rstream)
 		rstream->direction, rstream->buffer_frames);
 
 	if (rstream->is_pinned)
-		return pinned_stream_added(rstream);
+		return pinned_stream_added(rstream, check_admission);
+
+	if (stream_paused(rstream))
+		return 0;
+	if (stream_is_exclusive(rstream))
+		check_admission = true;
 
 	/* Add the new stream to all enabled iodevs at once to avoid offset
 	 * in shm level between different ouput iodevs. */
@@ -856,7 +1739,23 @@ static int stream_added_cb(struct cras_rstream *rstream)
 			possibly_disable_fallback(rstream->direction);
 			iodev_reopened = true;
 		} else {
+			if (idle_rate_change_due(edev->dev, rstream)) {
+				/* Nothing plays on it, reopening is seamless. */
+				MAINLOG(main_log, MAIN_THREAD_DEV_REOPEN,
+					edev->dev->format->num_channels,
+					edev->dev->format->num_channels,
+					rstream->format.frame_rate);
+				syslog(LOG_INFO, "re-open %s for stream rate",
+				       edev->dev->info.name);
+				close_dev(edev->dev);
+			}
+			opened[num_iodevs] = !cras_iodev_is_open(edev->dev);
 			rc = init_device(edev->dev, rstream);
+			if (rc == -EINPROGRESS) {
+				/* Attached when the open completes. */
+				iodev_opening = true;
+				continue;
+			}
 			if (rc) {
 				/* Error log but don't return error here, because
 				 * stopping audio could block video playback.
@@ -870,12 +1769,21 @@ static int stream_added_cb(struct cras_rstream *rstream)
 			iodevs[num_iodevs++] = edev->dev;
 		}
 	}
+	if (check_admission && !stream_admitted(rstream, iodevs, num_iodevs)) {
+		/* Don't leave devices open only for the refused stream. */
+		for (i = 0; i < num_iodevs; i++)
+			if (opened[i])
+				close_dev(iodevs[i]);
+		return -ENOTSUP;
+	}
 	if (num_iodevs) {
 		rc = add_stream_to_open_devs(rstream, iodevs, num_iodevs);
 		if (rc) {
 			syslog(LOG_ERR, "adding stream to thread fail");
 			return rc;
 		}
+		if (stream_is_exclusive(rstream) && !exclusive_stream)
+			pause_output_streams(rstream);
 	} else if (!iodev_reopened) {
 		/* Enable fallback device if no other iodevs can be initialized
 		 * or re-opened successfully.
@@ -887,15 +1795,21 @@ static int stream_added_cb(struct cras_rstream *rstream)
 		 * cras_iodev_list_select_node() is called to re-select the
 		 * active node.
 		 */
-		possibly_enable_fallback(rstream->direction, true);
+		possibly_enable_fallback(rstream->direction, !iodev_opening);
 	}
 	return 0;
 }
 
+static int stream_added_cb(struct cras_rstream *rstream)
+{
+	return add_stream(rstream, true);
+}
+
 static int possibly_close_enabled_devs(enum CRAS_STREAM_DIRECTION dir)
 {
 	struct enabled_dev *edev;
 	const struct cras_rstream *s;
+	struct timespec timeout;
 
 	/* Check if there are still default streams attached. */
 	DL_FOREACH (stream_list_get(stream_list), s) {
@@ -909,13 +1823,32 @@ static int possibly_close_enabled_devs(enum CRAS_STREAM_DIRECTION dir)
 		if (stream_list_has_pinned_stream(stream_list,
 						  edev->dev->info.idx))
 			continue;
+		/* Inputs close right away, unless their pre-roll history
+		 * is usually wanted again soon. */
 		if (dir == CRAS_STREAM_INPUT) {
-			close_dev(edev->dev);
+			if (!edev->dev->pre_roll_ms) {
+				close_dev(edev->dev);
+				continue;
+			}
+			clock_gettime(CLOCK_MONOTONIC_RAW,
+				      &edev->dev->idle_start);
+			if (!cras_iodev_is_open(edev->dev) ||
+			    !get_input_warm_timeout(edev->dev, &timeout)) {
+				close_dev(edev->dev);
+				continue;
+			}
+			edev->dev->idle_timeout = edev->dev->idle_start;
+			add_timespecs(&edev->dev->idle_timeout, &timeout);
+			idle_dev_check(NULL, NULL);
 			continue;
 		}
-		/* Allow output devs to drain before closing. */
+		/* Allow output devs to drain before closing, and keep those
+		 * reused often open for longer. */
 		clock_gettime(CLOCK_MONOTONIC_RAW, &edev->dev->idle_timeout);
-		add_timespecs(&edev->dev->idle_timeout, &idle_timeout_interval);
+		if (cras_iodev_is_open(edev->dev))
+			edev->dev->idle_start = edev->dev->idle_timeout;
+		get_idle_timeout(edev->dev, &timeout);
+		add_timespecs(&edev->dev->idle_timeout, &timeout);
 		idle_dev_check(NULL, NULL);
 	}
 
@@ -939,9 +1872,16 @@ static void pinned_stream_removed(struct cras_rstream *rstream)
 static int stream_removed_cb(struct cras_rstream *rstream)
 {
 	enum CRAS_STREAM_DIRECTION direction = rstream->direction;
-	int rc;
+	unsigned int i;
+	int rc = 0;
+	int drain;
 
-	rc = audio_thread_drain_stream(audio_thread, rstream);
+	/* Only the thread holding the stream has anything to drain. */
+	batch_remove_stream(rstream);
+	for (i = 0; i < num_audio_threads; i++) {
+		drain = audio_thread_drain_stream(audio_threads[i], rstream);
+		rc = MAX(rc, drain);
+	}
 	if (rc)
 		return rc;
 
@@ -950,11 +1890,35 @@ static int stream_removed_cb(struct cras_rstream *rstream)
 	if (rstream->is_pinned)
 		pinned_stream_removed(rstream);
 
+	if (rstream == exclusive_stream)
+		resume_output_streams();
+
 	possibly_close_enabled_devs(direction);
 
 	return 0;
 }
 
+/* Enabled devices and the devices sharing their thread key run on the first
+ * audio thread. Closes the ones open on another thread for pinned streams and
+ * attaches their streams back, which reopens them on the first thread. dev
+ * itself is left closed for the caller to attach its streams. */
+static void move_to_first_thread(struct cras_iodev *dev)
+{
+	struct cras_iodev *odev;
+	unsigned int dir;
+
+	for (dir = 0; dir < CRAS_NUM_DIRECTIONS; dir++) {
+		DL_FOREACH (devs[dir].iodevs, odev) {
+			if (!odev->thread || odev->thread == audio_threads[0] ||
+			    !same_thread_key(odev, dev))
+				continue;
+			close_dev(odev);
+			if (odev != dev)
+				init_and_attach_streams(odev);
+		}
+	}
+}
+
 static int enable_device(struct cras_iodev *dev)
 {
 	int rc;
@@ -972,8 +1936,10 @@ static int enable_device(struct cras_iodev *dev)
 	DL_APPEND(enabled_devs[dir], edev);
 	dev->is_enabled = 1;
 
+	move_to_first_thread(dev);
+
 	rc = init_and_attach_streams(dev);
-	if (rc < 0) {
+	if (rc < 0 && rc != -EINPROGRESS) {
 		syslog(LOG_INFO, "Enable device fail, rc %d", rc);
 		schedule_init_device_retry(dev);
 		return rc;
@@ -986,6 +1952,41 @@ static int enable_device(struct cras_iodev *dev)
 }
 
 /* Set `force to true to flush any pinned streams before closing the device. */
+/*
+ * Keeps a disabled output device open, running without streams, for the
+ * standby time of the board. Enabling it again within that time skips the
+ * open, its streams are attached on the next wake. Returns true if dev was
+ * put in standby.
+ */
+static bool standby_dev(struct cras_iodev *dev)
+{
+	unsigned int standby_ms = cras_system_get_output_standby_ms();
+	struct cras_rstream *stream;
+	struct timespec standby;
+
+	if (!standby_ms || dev->direction != CRAS_STREAM_OUTPUT ||
+	    dev == fallback_devs[dev->direction] || !cras_iodev_is_open(dev) ||
+	    dev->kept_on_suspend)
+		return false;
+
+	MAINLOG(main_log, MAIN_THREAD_DEV_STANDBY, dev->info.idx, standby_ms,
+		0);
+	batch_remove_dev(dev, 0);
+	DL_FOREACH (stream_list_get(stream_list), stream) {
+		if (stream->direction != dev->direction)
+			continue;
+		audio_thread_disconnect_stream(
+			cras_iodev_list_get_dev_audio_thread(dev), stream, dev);
+	}
+	dev->update_active_node(dev, dev->active_node->idx, 0);
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &dev->idle_timeout);
+	ms_to_timespec(standby_ms, &standby);
+	add_timespecs(&dev->idle_timeout, &standby);
+	idle_dev_check(NULL, NULL);
+	return true;
+}
+
 static int disable_device(struct enabled_dev *edev, bool force)
 {
 	struct cras_iodev *dev = edev->dev;
@@ -1001,25 +2002,32 @@ static int disable_device(struct enabled_dev *edev, bool force)
 	DL_DELETE(enabled_devs[dir], edev);
 	free(edev);
 	dev->is_enabled = 0;
+	/* Idle time after a disable says nothing about how it is used. */
+	dev->idle_start.tv_sec = 0;
+	dev->idle_start.tv_nsec = 0;
 	if (force) {
 		cancel_pending_init_retries(dev->info.idx);
 	}
 	/* If there's a pinned stream exists, simply disconnect all the normal
 	 * streams off this device and return. */
 	else if (stream_list_has_pinned_stream(stream_list, dev->info.idx)) {
+		batch_remove_dev(dev, 1);
 		DL_FOREACH (stream_list_get(stream_list), stream) {
 			if (stream->direction != dev->direction)
 				continue;
 			if (stream->is_pinned)
 				continue;
-			audio_thread_disconnect_stream(audio_thread, stream,
-						       dev);
+			audio_thread_disconnect_stream(
+				cras_iodev_list_get_dev_audio_thread(dev),
+				stream, dev);
 		}
 		return 0;
 	}
 
 	DL_FOREACH (device_enable_cbs, callback)
 		callback->disabled_cb(dev, callback->cb_data);
+	if (!force && standby_dev(dev))
+		return 0;
 	close_dev(dev);
 	dev->update_active_node(dev, dev->active_node->idx, 0);
 
@@ -1030,9 +2038,22 @@ static int disable_device(struct enabled_dev *edev, bool force)
  * Exported Interface.
  */
 
+static void destroy_aggregate_output()
+{
+	struct cras_iodev *dev = aggregate_dev;
+
+	if (!dev)
+		return;
+	/* Cleared first, destroying it removes it from the output list. */
+	aggregate_dev = NULL;
+	aggregate_iodev_destroy(dev);
+}
+
 void cras_iodev_list_init()
 {
 	struct cras_observer_ops observer_ops;
+	unsigned long cpu_mask;
+	unsigned int i;
 
 	memset(&observer_ops, 0, sizeof(observer_ops));
 	observer_ops.output_volume_changed = sys_vol_change;
@@ -1066,19 +2087,38 @@ void cras_iodev_list_init()
 	loopdev_post_mix = loopback_iodev_create(LOOPBACK_POST_MIX_PRE_DSP);
 	loopdev_post_dsp = loopback_iodev_create(LOOPBACK_POST_DSP);
 
-	audio_thread = audio_thread_create();
-	if (!audio_thread) {
-		syslog(LOG_ERR, "Fatal: audio thread init");
-		exit(-ENOMEM);
+	/* Every audio thread would advance the one virtual clock. */
+	num_audio_threads = cras_virtual_clock_enabled() ?
+				    1 :
+				    cras_system_get_num_audio_threads();
+	for (i = 0; i < num_audio_threads; i++) {
+		audio_threads[i] = audio_thread_create();
+		if (!audio_threads[i]) {
+			syslog(LOG_ERR, "Fatal: audio thread init");
+			exit(-ENOMEM);
+		}
+		audio_thread_set_perf_stats(
+			audio_threads[i], cras_system_state_get_perf_stats(i));
+		audio_thread_start(audio_threads[i]);
+		cpu_mask = cras_system_get_audio_thread_cpu_mask(i);
+		if (cpu_mask)
+			audio_thread_set_cpu_affinity(audio_threads[i],
+						      cpu_mask);
 	}
-	audio_thread_start(audio_thread);
 
 	cras_iodev_list_update_device_list();
 }
 
 void cras_iodev_list_deinit()
 {
-	audio_thread_destroy(audio_thread);
+	unsigned int i;
+
+	destroy_aggregate_output();
+	for (i = 0; i < num_audio_threads; i++) {
+		audio_thread_destroy(audio_threads[i]);
+		audio_threads[i] = NULL;
+	}
+	num_audio_threads = 0;
 	loopback_iodev_destroy(loopdev_post_dsp);
 	loopback_iodev_destroy(loopdev_post_mix);
 	empty_iodev_destroy(empty_hotword_dev);
@@ -1201,6 +2241,8 @@ void cras_iodev_list_resume_dev(unsigned int dev_idx)
 
 	dev->update_active_node(dev, dev->active_node->idx, 1);
 	rc = init_and_attach_streams(dev);
+	if (rc == -EINPROGRESS)
+		return;
 	if (rc == 0) {
 		/* If dev initialize succeeded and this is not a pinned device,
 		 * disable the silent fallback device because it's just
@@ -1272,6 +2314,11 @@ int cras_iodev_list_rm_output(struct cras_iodev *dev)
 {
 	int res;
 
+	/* The aggregate output can't play without all of its members. */
+	if (aggregate_dev && dev != aggregate_dev &&
+	    aggregate_iodev_has_member(aggregate_dev, dev))
+		destroy_aggregate_output();
+
 	/* Retire the current active output device before removing it from
 	 * list, otherwise it could be busy and remain in the list.
 	 */
@@ -1296,6 +2343,30 @@ int cras_iodev_list_rm_input(struct cras_iodev *dev)
 	return res;
 }
 
+int cras_iodev_list_set_aggregate_output(const uint32_t *dev_idxs,
+					 unsigned int num_devs)
+{
+	struct cras_iodev *members[MAX_AGGREGATE_MEMBERS];
+	unsigned int i;
+
+	destroy_aggregate_output();
+	if (num_devs < 2)
+		return 0;
+	if (num_devs > MAX_AGGREGATE_MEMBERS)
+		return -EINVAL;
+
+	for (i = 0; i < num_devs; i++) {
+		members[i] = find_dev(dev_idxs[i]);
+		if (!members[i] || members[i]->direction != CRAS_STREAM_OUTPUT)
+			return -EINVAL;
+	}
+
+	aggregate_dev = aggregate_iodev_create(members, num_devs);
+	if (!aggregate_dev)
+		return -ENOMEM;
+	return aggregate_dev->info.idx;
+}
+
 int cras_iodev_list_get_outputs(struct cras_iodev_info **list_out)
 {
 	return get_dev_list(&devs[CRAS_STREAM_OUTPUT], list_out);
@@ -1342,6 +2413,41 @@ cras_iodev_list_get_active_node_id(enum CRAS_STREAM_DIRECTION direction)
 				 edev->dev->active_node->idx);
 }
 
+/* Rewrites the devices and nodes of one direction in the shared state, only
+ * when they differ from what clients already see. Clients keep their copy of
+ * a section as long as its update count doesn't move. */
+static void update_dev_section(struct cras_server_state *state,
+			       enum CRAS_SERVER_STATE_SECTION section,
+			       struct iodev_list *list, uint32_t *num_devs,
+			       struct cras_iodev_info *dev_infos,
+			       uint32_t *num_nodes,
+			       struct cras_ionode_info *node_infos)
+{
+	static struct cras_iodev_info new_devs[CRAS_MAX_IODEVS];
+	static struct cras_ionode_info new_nodes[CRAS_MAX_IONODES];
+	size_t dev_bytes = MIN(list->size, CRAS_MAX_IODEVS) * sizeof(*new_devs);
+	size_t node_bytes;
+	uint32_t new_num_nodes;
+
+	memset(new_devs, 0, sizeof(new_devs));
+	memset(new_nodes, 0, sizeof(new_nodes));
+	fill_dev_list(list, new_devs, CRAS_MAX_IODEVS);
+	new_num_nodes = fill_node_list(list, new_nodes, CRAS_MAX_IONODES);
+	node_bytes = new_num_nodes * sizeof(*new_nodes);
+
+	if (*num_devs == list->size && *num_nodes == new_num_nodes &&
+	    !memcmp(dev_infos, new_devs, dev_bytes) &&
+	    !memcmp(node_infos, new_nodes, node_bytes))
+		return;
+
+	cras_system_state_section_begin(state, section);
+	*num_devs = list->size;
+	memcpy(dev_infos, new_devs, dev_bytes);
+	*num_nodes = new_num_nodes;
+	memcpy(node_infos, new_nodes, node_bytes);
+	cras_system_state_section_complete(state, section);
+}
+
 void cras_iodev_list_update_device_list()
 {
 	struct cras_server_state *state;
@@ -1350,19 +2456,14 @@ void cras_iodev_list_update_device_list()
 	if (!state)
 		return;
 
-	state->num_output_devs = devs[CRAS_STREAM_OUTPUT].size;
-	state->num_input_devs = devs[CRAS_STREAM_INPUT].size;
-	fill_dev_list(&devs[CRAS_STREAM_OUTPUT], &state->output_devs[0],
-		      CRAS_MAX_IODEVS);
-	fill_dev_list(&devs[CRAS_STREAM_INPUT], &state->input_devs[0],
-		      CRAS_MAX_IODEVS);
-
-	state->num_output_nodes =
-		fill_node_list(&devs[CRAS_STREAM_OUTPUT],
-			       &state->output_nodes[0], CRAS_MAX_IONODES);
-	state->num_input_nodes =
-		fill_node_list(&devs[CRAS_STREAM_INPUT], &state->input_nodes[0],
-			       CRAS_MAX_IONODES);
+	update_dev_section(state, CRAS_STATE_OUTPUT_DEVS,
+			   &devs[CRAS_STREAM_OUTPUT], &state->num_output_devs,
+			   state->output_devs, &state->num_output_nodes,
+			   state->output_nodes);
+	update_dev_section(state, CRAS_STATE_INPUT_DEVS,
+			   &devs[CRAS_STREAM_INPUT], &state->num_input_devs,
+			   state->input_devs, &state->num_input_nodes,
+			   state->input_nodes);
 
 	cras_system_state_update_complete();
 }
@@ -1396,6 +2497,12 @@ int cras_iodev_list_suspend_hotword_streams()
 	struct cras_rstream *stream = NULL;
 	int rc;
 
+	/* Already suspended for the model load, stay so once it's done. */
+	if (hotword_load.dev) {
+		hotword_load.resume = 0;
+		return 0;
+	}
+
 	rc = find_hotword_stream_dev(&hotword_dev, &stream);
 	if (rc)
 		return rc;
@@ -1416,10 +2523,12 @@ int cras_iodev_list_suspend_hotword_streams()
 			continue;
 		}
 
-		audio_thread_disconnect_stream(audio_thread, stream,
-					       hotword_dev);
-		audio_thread_add_stream(audio_thread, stream,
-					&empty_hotword_dev, 1);
+		audio_thread_disconnect_stream(
+			cras_iodev_list_get_dev_audio_thread(hotword_dev),
+			stream, hotword_dev);
+		audio_thread_add_stream(
+			cras_iodev_list_get_dev_audio_thread(empty_hotword_dev),
+			stream, &empty_hotword_dev, 1);
 	}
 	close_pinned_device(hotword_dev);
 	hotword_suspended = 1;
@@ -1432,6 +2541,12 @@ int cras_iodev_list_resume_hotword_stream()
 	struct cras_rstream *stream = NULL;
 	int rc;
 
+	/* The DSP can't be re-armed before the model load is done. */
+	if (hotword_load.dev) {
+		hotword_load.resume = 1;
+		return 0;
+	}
+
 	rc = find_hotword_stream_dev(&hotword_dev, &stream);
 	if (rc)
 		return rc;
@@ -1452,9 +2567,12 @@ int cras_iodev_list_resume_hotword_stream()
 			continue;
 		}
 
-		audio_thread_disconnect_stream(audio_thread, stream,
-					       empty_hotword_dev);
-		audio_thread_add_stream(audio_thread, stream, &hotword_dev, 1);
+		audio_thread_disconnect_stream(
+			cras_iodev_list_get_dev_audio_thread(empty_hotword_dev),
+			stream, empty_hotword_dev);
+		audio_thread_add_stream(
+			cras_iodev_list_get_dev_audio_thread(hotword_dev),
+			stream, &hotword_dev, 1);
 	}
 	close_pinned_device(empty_hotword_dev);
 	hotword_suspended = 0;
@@ -1473,20 +2591,185 @@ char *cras_iodev_list_get_hotword_models(cras_node_id_t node_id)
 	return dev->get_hotword_models(dev);
 }
 
+/* Checks that model is in the hotword models dev supports. */
+static int hotword_model_supported(struct cras_iodev *dev, const char *model)
+{
+	char *models, *name, *saveptr;
+	int found = 0;
+
+	models = dev->get_hotword_models(dev);
+	if (!models)
+		return 0;
+	for (name = strtok_r(models, ",", &saveptr); name && !found;
+	     name = strtok_r(NULL, ",", &saveptr))
+		found = !strcmp(name, model);
+	free(models);
+	return found;
+}
+
+static void start_hotword_model_load(struct cras_iodev *dev,
+				     cras_node_id_t node_id, const char *model);
+
+/* Completes the load of hotword_load.model on the main thread. Starts the
+ * model asked for meanwhile, or resumes the hotword streams. */
+static void finish_hotword_model_load()
+{
+	struct cras_iodev *dev = hotword_load.dev;
+	char model[CRAS_MAX_HOTWORD_MODEL_NAME_SIZE + 1];
+
+	if (hotword_load.rc)
+		syslog(LOG_ERR, "Failed to load hotword model %s on %s: %d",
+		       hotword_load.model, dev->info.name, hotword_load.rc);
+	else
+		strncpy(dev->active_node->active_hotword_model,
+			hotword_load.model,
+			sizeof(dev->active_node->active_hotword_model) - 1);
+	cras_observer_notify_hotword_model_loaded(
+		hotword_load.node_id, hotword_load.model, hotword_load.rc);
+	hotword_load.dev = NULL;
+
+	if (hotword_load.next_model[0]) {
+		strcpy(model, hotword_load.next_model);
+		hotword_load.next_model[0] = '\0';
+		dev = find_dev(dev_index_of(hotword_load.next_node_id));
+		if (dev) {
+			start_hotword_model_load(dev, hotword_load.next_node_id,
+						 model);
+			return;
+		}
+	}
+
+	if (hotword_load.resume) {
+		hotword_load.resume = 0;
+		cras_iodev_list_resume_hotword_stream();
+	}
+	cras_iodev_list_update_device_list();
+}
+
+static void *hotword_model_worker(void *arg)
+{
+	struct cras_iodev *dev = hotword_load.dev;
+	struct cras_main_message msg;
+	int rc;
+
+	rc = dev->set_hotword_model(dev, hotword_load.model);
+
+	pthread_mutex_lock(&hotword_load_lock);
+	hotword_load.rc = rc;
+	hotword_load.done = 1;
+	pthread_cond_broadcast(&hotword_load_cond);
+	pthread_mutex_unlock(&hotword_load_lock);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.type = CRAS_MAIN_HOTWORD_MODEL;
+	msg.length = sizeof(msg);
+	/* Only this message finishes the load on the main thread, so don't
+	 * let it drop. */
+	if (cras_main_message_send_blocking(&msg))
+		syslog(LOG_ERR, "Failed to report hotword model load");
+	return NULL;
+}
+
+static void hotword_model_loaded(struct cras_main_message *msg, void *arg)
+{
+	int done;
+
+	pthread_mutex_lock(&hotword_load_lock);
+	done = hotword_load.done;
+	pthread_mutex_unlock(&hotword_load_lock);
+
+	/* Ignore the message of a load dropped with its device. */
+	if (!hotword_load.dev || !done)
+		return;
+	finish_hotword_model_load();
+}
+
+/* Loads model to dev on a worker thread, or on the main thread if the worker
+ * can't be started. */
+static void start_hotword_model_load(struct cras_iodev *dev,
+				     cras_node_id_t node_id, const char *model)
+{
+	pthread_t tid;
+
+	hotword_load.dev = dev;
+	hotword_load.node_id = node_id;
+	memset(hotword_load.model, 0, sizeof(hotword_load.model));
+	strncpy(hotword_load.model, model, sizeof(hotword_load.model) - 1);
+	hotword_load.done = 0;
+	hotword_load.rc = 0;
+
+	if (!hotword_load_handler_state)
+		hotword_load_handler_state =
+			cras_main_message_add_handler(CRAS_MAIN_HOTWORD_MODEL,
+						      hotword_model_loaded,
+						      NULL) ?
+				-1 :
+				1;
+	if (hotword_load_handler_state > 0 &&
+	    pthread_create(&tid, NULL, hotword_model_worker, NULL) == 0) {
+		pthread_detach(tid);
+		return;
+	}
+
+	syslog(LOG_WARNING, "Loading hotword model %s on the main thread",
+	       hotword_load.model);
+	hotword_load.rc = dev->set_hotword_model(dev, hotword_load.model);
+	hotword_load.done = 1;
+	finish_hotword_model_load();
+}
+
+/* Drops the model loads of dev, for a device being removed. Waits for a load
+ * already running since the worker uses dev. */
+static void cancel_hotword_model_load(struct cras_iodev *dev)
+{
+	if (hotword_load.next_model[0] &&
+	    dev_index_of(hotword_load.next_node_id) == dev->info.idx)
+		hotword_load.next_model[0] = '\0';
+	if (hotword_load.dev != dev)
+		return;
+
+	pthread_mutex_lock(&hotword_load_lock);
+	while (!hotword_load.done)
+		pthread_cond_wait(&hotword_load_cond, &hotword_load_lock);
+	pthread_mutex_unlock(&hotword_load_lock);
+
+	cras_observer_notify_hotword_model_loaded(hotword_load.node_id,
+						  hotword_load.model,
+						  -ENODEV);
+	hotword_load.dev = NULL;
+	hotword_load.next_model[0] = '\0';
+	/* The device the hotword streams are pinned to is going away. */
+	if (hotword_load.resume) {
+		hotword_load.resume = 0;
+		hotword_suspended = 0;
+	}
+}
+
 int cras_iodev_list_set_hotword_model(cras_node_id_t node_id,
 				      const char *model_name)
 {
-	int ret;
 	struct cras_iodev *dev = find_dev(dev_index_of(node_id));
 	if (!dev || !dev->get_hotword_models ||
 	    (dev->active_node->type != CRAS_NODE_TYPE_HOTWORD))
 		return -EINVAL;
+	if (!hotword_model_supported(dev, model_name))
+		return -EINVAL;
 
-	ret = dev->set_hotword_model(dev, model_name);
-	if (!ret)
-		strncpy(dev->active_node->active_hotword_model, model_name,
-			sizeof(dev->active_node->active_hotword_model) - 1);
-	return ret;
+	/* Loaded when the load in progress is done. */
+	if (hotword_load.dev) {
+		hotword_load.next_node_id = node_id;
+		memset(hotword_load.next_model, 0,
+		       sizeof(hotword_load.next_model));
+		strncpy(hotword_load.next_model, model_name,
+			sizeof(hotword_load.next_model) - 1);
+		return 0;
+	}
+
+	/* The DSP can't listen while its model changes. */
+	hotword_load.resume = !hotword_suspended &&
+			      cras_iodev_list_suspend_hotword_streams() == 0;
+	start_hotword_model_load(dev, node_id, model_name);
+	return 0;
 }
 
 void cras_iodev_list_notify_nodes_changed()
@@ -1501,6 +2784,42 @@ void cras_iodev_list_notify_active_node_changed(
 		direction, cras_iodev_list_get_active_node_id(direction));
 }
 
+/*
+ * With output standby, an open output device switches to another of its
+ * nodes without being closed and its streams stay attached. Other enabled
+ * devices are disabled as for a regular selection. Returns true if the node
+ * was switched.
+ */
+static bool switch_node_in_place(struct cras_iodev *dev, unsigned int node_idx)
+{
+	struct enabled_dev *edev;
+	struct cras_rstream *rstream;
+
+	if (!cras_system_get_output_standby_ms() ||
+	    dev->direction != CRAS_STREAM_OUTPUT || !dev->is_enabled ||
+	    !cras_iodev_is_open(dev) ||
+	    stream_list_has_pinned_stream(stream_list, dev->info.idx))
+		return false;
+
+	DL_FOREACH (enabled_devs[dev->direction], edev) {
+		if (edev->dev != dev &&
+		    edev->dev != fallback_devs[dev->direction])
+			disable_device(edev, false);
+	}
+
+	/* Mute across the route change, as a reopened device would be. */
+	DL_FOREACH (stream_list_get(stream_list), rstream) {
+		if (rstream->direction != CRAS_STREAM_OUTPUT)
+			continue;
+		audio_thread_dev_start_ramp(
+			cras_iodev_list_get_dev_audio_thread(dev),
+			dev->info.idx, CRAS_IODEV_RAMP_REQUEST_SWITCH_MUTE);
+		break;
+	}
+	dev->update_active_node(dev, node_idx, 1);
+	return true;
+}
+
 void cras_iodev_list_select_node(enum CRAS_STREAM_DIRECTION direction,
 				 cras_node_id_t node_id)
 {
@@ -1535,12 +2854,20 @@ void cras_iodev_list_select_node(enum CRAS_STREAM_DIRECTION direction,
 		}
 	}
 
+	if (new_dev && !new_node_already_enabled &&
+	    switch_node_in_place(new_dev, node_index_of(node_id))) {
+		cras_iodev_list_notify_active_node_changed(direction);
+		return;
+	}
+
 	/* Enable fallback device during the transition so client will not be
 	 * blocked in this duration, which is as long as 300 ms on some boards
 	 * before new device is opened.
 	 * Note that the fallback node is not needed if the new node is already
-	 * enabled - the new node will remain enabled. */
-	if (!new_node_already_enabled)
+	 * enabled - the new node will remain enabled - or if the new device is
+	 * disabled but open, from standby or for a pinned stream. */
+	if (!new_node_already_enabled &&
+	    !(new_dev && !new_dev->is_enabled && cras_iodev_is_open(new_dev)))
 		possibly_enable_fallback(direction, false);
 
 	DL_FOREACH (enabled_devs[direction], edev) {
@@ -1757,7 +3084,189 @@ void cras_iodev_list_test_dev_command(unsigned int iodev_idx,
 
 struct audio_thread *cras_iodev_list_get_audio_thread()
 {
-	return audio_thread;
+	return audio_threads[0];
+}
+
+struct audio_thread *
+cras_iodev_list_get_dev_audio_thread(const struct cras_iodev *dev)
+{
+	if (dev && dev->thread)
+		return dev->thread;
+	return audio_threads[0];
+}
+
+int cras_iodev_list_dump_audio_thread_info(struct audio_debug_info *info)
+{
+	unsigned int i;
+	int rc;
+
+	rc = audio_thread_dump_thread_info(audio_threads[0], info);
+	for (i = 1; i < num_audio_threads && !rc; i++)
+		rc = audio_thread_append_thread_info(audio_threads[i], info);
+	return rc;
+}
+
+int cras_iodev_list_config_global_remix(unsigned int num_channels,
+					const float *coefficient)
+{
+	unsigned int i;
+	int rc = 0;
+
+	for (i = 0; i < num_audio_threads && !rc; i++)
+		rc = audio_thread_config_global_remix(
+			audio_threads[i], num_channels, coefficient);
+	return rc;
+}
+
+int cras_iodev_list_set_aec_dump(cras_stream_id_t stream_id,
+				 unsigned int start, int fd)
+{
+	unsigned int i;
+	int rc = 0;
+
+	/* Only the thread holding the stream acts on it. */
+	for (i = 0; i < num_audio_threads && !rc; i++)
+		rc = audio_thread_set_aec_dump(audio_threads[i], stream_id,
+					       start, fd);
+	return rc;
+}
+
+/* Stages the APMs for the new effects of rstream on the open devices it
+ * is attached to. */
+static int stage_stream_apms(struct cras_rstream *rstream)
+{
+	struct enabled_dev *edev;
+	struct cras_iodev *dev;
+	int rc;
+
+	if (rstream->is_pinned) {
+		dev = find_dev(rstream->pinned_dev_idx);
+		if (dev == NULL || !cras_iodev_is_open(dev))
+			return 0;
+		return cras_apm_list_stage_apm(
+			rstream->apm_list, dev, dev->format,
+			cras_iodev_is_aec_use_case(dev->active_node));
+	}
+
+	DL_FOREACH (enabled_devs[CRAS_STREAM_INPUT], edev) {
+		if (!cras_iodev_is_open(edev->dev))
+			continue;
+		rc = cras_apm_list_stage_apm(
+			rstream->apm_list, edev->dev, edev->dev->format,
+			cras_iodev_is_aec_use_case(edev->dev->active_node));
+		if (rc)
+			return rc;
+	}
+	return 0;
+}
+
+int cras_iodev_list_set_stream_effects(cras_stream_id_t stream_id,
+				       uint64_t effects)
+{
+	struct cras_rstream *rstream;
+	unsigned int i;
+	int rc;
+
+	DL_FOREACH (stream_list_get(stream_list), rstream)
+		if (rstream->stream_id == stream_id)
+			break;
+	if (rstream == NULL || rstream->direction != CRAS_STREAM_INPUT)
+		return -EINVAL;
+	if (cras_rstream_get_effects(rstream) == effects)
+		return 0;
+
+	if (rstream->apm_list == NULL) {
+		rstream->apm_list = cras_apm_list_create(rstream, effects);
+		if (rstream->apm_list == NULL)
+			return -ENOTSUP;
+		cras_apm_list_set_background(
+			rstream->apm_list,
+			!cras_overload_stream_is_critical(rstream->stream_type));
+	}
+
+	rc = cras_apm_list_stage_effects(rstream->apm_list, effects);
+	if (rc)
+		return rc;
+	rc = stage_stream_apms(rstream);
+	if (rc)
+		return rc;
+
+	/* The thread the stream runs on swaps the APMs between two wakes.
+	 * Otherwise the stream picks them up as it's attached. */
+	for (i = 0; i < num_audio_threads; i++) {
+		rc = audio_thread_swap_stream_apms(audio_threads[i], rstream);
+		if (rc)
+			break;
+	}
+	if (rc < 0)
+		return rc;
+	if (rc == 0)
+		cras_apm_list_commit_effects(rstream->apm_list);
+
+	MAINLOG(main_log, MAIN_THREAD_STREAM_EFFECTS, stream_id,
+		(uint32_t)effects, 0);
+	return 0;
+}
+
+int cras_iodev_list_set_stream_paused(cras_stream_id_t stream_id, int paused,
+				      unsigned int fade_in_ms)
+{
+	struct cras_rstream *rstream;
+	unsigned int i;
+	int rc, ret = 0;
+
+	DL_FOREACH (stream_list_get(stream_list), rstream)
+		if (rstream->stream_id == stream_id)
+			break;
+	if (rstream == NULL)
+		return -EINVAL;
+	paused = !!paused;
+	if (rstream->paused == paused)
+		return 0;
+
+	/* The devices it's attached to later pick the flag up as well. */
+	rstream->paused = paused;
+	for (i = 0; i < num_audio_threads; i++) {
+		rc = audio_thread_set_stream_paused(audio_threads[i], rstream,
+						    fade_in_ms);
+		if (rc < 0)
+			ret = rc;
+	}
+
+	MAINLOG(main_log, MAIN_THREAD_STREAM_PAUSED, stream_id, paused,
+		fade_in_ms);
+	return ret;
+}
+
+int cras_iodev_list_add_route(unsigned int in_idx, unsigned int out_idx,
+			      unsigned int latency_ms, uint64_t effects)
+{
+	struct cras_iodev *in = find_dev(in_idx);
+	struct cras_iodev *out = find_dev(out_idx);
+	struct cras_audio_format fmt = {
+		.format = SND_PCM_FORMAT_S16_LE,
+		.frame_rate = 48000,
+		.num_channels = 2,
+	};
+
+	if (!in || in->direction != CRAS_STREAM_INPUT || !out ||
+	    out->direction != CRAS_STREAM_OUTPUT)
+		return -EINVAL;
+
+	/* In the format the output plays, the frames are converted once on
+	 * the way in and mixed as they are. */
+	if (cras_iodev_is_open(out) && out->format)
+		fmt = *out->format;
+	else
+		cras_audio_format_set_default_channel_layout(&fmt);
+
+	return server_stream_create_route(stream_list, in_idx, out_idx, &fmt,
+					  latency_ms, effects);
+}
+
+int cras_iodev_list_rm_route(unsigned int route_id)
+{
+	return server_stream_destroy_route(stream_list, route_id);
 }
 
 struct stream_list *cras_iodev_list_get_stream_list()
@@ -1856,6 +3365,28 @@ void cras_iodev_list_unregister_loopback(enum CRAS_LOOPBACK_TYPE type,
 	}
 }
 
+struct cras_ref_ring *
+cras_iodev_list_get_post_dsp_ref(unsigned int output_dev_idx)
+{
+	struct cras_iodev *iodev = find_dev(output_dev_idx);
+
+	if (iodev == NULL || iodev->direction != CRAS_STREAM_OUTPUT)
+		return NULL;
+	return iodev->post_dsp_ref;
+}
+
+void cras_iodev_list_begin_stream_batch()
+{
+	stream_batch.depth++;
+}
+
+void cras_iodev_list_end_stream_batch()
+{
+	if (stream_batch.depth == 0 || --stream_batch.depth)
+		return;
+	batch_flush();
+}
+
 void cras_iodev_list_reset()
 {
 	struct enabled_dev *edev;
@@ -1874,4 +3405,9 @@ void cras_iodev_list_reset()
 	devs[CRAS_STREAM_INPUT].iodevs = NULL;
 	devs[CRAS_STREAM_OUTPUT].size = 0;
 	devs[CRAS_STREAM_INPUT].size = 0;
+	stream_batch.depth = 0;
+	stream_batch.num = 0;
+	aggregate_dev = NULL;
+	exclusive_stream = NULL;
+	memset(&hotword_load, 0, sizeof(hotword_load));
 }
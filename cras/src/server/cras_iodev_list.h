@@ -62,6 +62,20 @@ int cras_iodev_list_rm_output(struct cras_iodev *output);
  */
 int cras_iodev_list_rm_input(struct cras_iodev *input);
 
+/* Replaces the aggregate output with one playing to the given output devices
+ * in sync, the first of them being the master clock. Selecting its node plays
+ * to all of them. With fewer than two devices the aggregate output is removed.
+ * It is also removed along with any of its devices.
+ * Args:
+ *    dev_idxs - The indexes of the output devices to play to.
+ *    num_devs - The number of indexes in dev_idxs.
+ * Returns:
+ *    The index of the aggregate output, 0 if it was removed, or a negative
+ *    error code.
+ */
+int cras_iodev_list_set_aggregate_output(const uint32_t *dev_idxs,
+					 unsigned int num_devs);
+
 /* Gets a list of outputs. Callee must free the list when finished.  If list_out
  * is NULL, this function can be used to return the number of outputs.
  * Args:
@@ -123,7 +137,10 @@ void cras_iodev_list_update_node_list();
  * the returned string after use. */
 char *cras_iodev_list_get_hotword_models(cras_node_id_t node_id);
 
-/* Sets the desired hotword model to an ionode. */
+/* Sets the desired hotword model to an ionode. The model is loaded by a
+ * worker thread with the hotword streams suspended, observers are notified
+ * when it's done. Returns 0 if the load is started, -EINVAL if the node or the
+ * model is not supported. */
 int cras_iodev_list_set_hotword_model(cras_node_id_t id,
 				      const char *model_name);
 
@@ -230,9 +247,72 @@ void cras_iodev_list_test_dev_command(unsigned int iodev_idx,
 				      unsigned int data_len,
 				      const uint8_t *data);
 
-/* Gets the audio thread used by the devices. */
+/* Gets the first audio thread, which services the enabled devices. */
 struct audio_thread *cras_iodev_list_get_audio_thread();
 
+/* Gets the audio thread servicing dev, the first one if dev isn't open. */
+struct audio_thread *
+cras_iodev_list_get_dev_audio_thread(const struct cras_iodev *dev);
+
+/* Dumps the devices and streams of all audio threads into info. */
+int cras_iodev_list_dump_audio_thread_info(struct audio_debug_info *info);
+
+/* Sets the global remix converter of all audio threads.
+ * Args:
+ *    num_channels - Number of output channels.
+ *    coefficient - The remix coefficients, num_channels^2 of them.
+ */
+int cras_iodev_list_config_global_remix(unsigned int num_channels,
+					const float *coefficient);
+
+/* Starts or stops the aec dump of a stream, on whichever audio thread it
+ * runs. */
+int cras_iodev_list_set_aec_dump(cras_stream_id_t stream_id,
+				 unsigned int start, int fd);
+
+/* Changes the effects of a running input stream, without detaching it
+ * from its devices or dropping the frames its APMs hold.
+ * Args:
+ *    stream_id - The stream to change.
+ *    effects - Bit map of the effects to apply from now on.
+ * Returns:
+ *    0 on success, -EINVAL if there's no such input stream, -ENOTSUP if the
+ *    effects would change the format the stream reads, -EBUSY if the
+ *    previous change is still in progress.
+ */
+int cras_iodev_list_set_stream_effects(cras_stream_id_t stream_id,
+				       uint64_t effects);
+
+/* Pauses or resumes a stream without detaching it from its devices. A paused
+ * stream keeps its shm, converters and APMs, but isn't fetched, mixed or
+ * captured to until resumed.
+ * Args:
+ *    stream_id - The stream to pause or resume.
+ *    paused - Non-zero to pause the stream, zero to resume it.
+ *    fade_in_ms - How long a resumed output stream fades in, 0 not to fade.
+ * Returns:
+ *    0 on success, -EINVAL if there's no such stream.
+ */
+int cras_iodev_list_set_stream_paused(cras_stream_id_t stream_id, int paused,
+				      unsigned int fade_in_ms);
+
+/* Plays what an input device captures on an output device, without a client
+ * in between.
+ * Args:
+ *    in_idx - The input device to capture from.
+ *    out_idx - The output device to play to.
+ *    latency_ms - How long captured frames wait before they are played.
+ *    effects - Bit map of the effects to apply to the captured frames.
+ * Returns:
+ *    The id of the route, -EINVAL if the devices don't exist or don't go
+ *    that way, or another negative error code.
+ */
+int cras_iodev_list_add_route(unsigned int in_idx, unsigned int out_idx,
+			      unsigned int latency_ms, uint64_t effects);
+
+/* Stops a route cras_iodev_list_add_route made. */
+int cras_iodev_list_rm_route(unsigned int route_id);
+
 /* Gets the list of all active audio streams attached to devices. */
 struct stream_list *cras_iodev_list_get_stream_list();
 
@@ -268,12 +348,32 @@ void cras_iodev_list_unregister_loopback(enum CRAS_LOOPBACK_TYPE loopback_type,
 					 unsigned int output_dev_idx,
 					 unsigned int loopback_dev_idx);
 
+/* Gets the post DSP reference ring of an output device.
+ * Args:
+ *    output_dev_idx - Index of the output device.
+ * Returns:
+ *    The ring, or NULL if the device doesn't exist or has never been opened.
+ */
+struct cras_ref_ring *
+cras_iodev_list_get_post_dsp_ref(unsigned int output_dev_idx);
+
 /* Suspends all hotwording streams. */
 int cras_iodev_list_suspend_hotword_streams();
 
 /* Resumes all hotwording streams. */
 int cras_iodev_list_resume_hotword_stream();
 
+/* Starts holding back the streams added to the stream list from the audio
+ * thread, so that a group of streams connected together is attached with a
+ * single audio thread command. Calls can nest.
+ */
+void cras_iodev_list_begin_stream_batch();
+
+/* Ends a batch started by cras_iodev_list_begin_stream_batch(). When the
+ * outermost batch ends the streams held back are attached to their devices.
+ */
+void cras_iodev_list_end_stream_batch();
+
 /* For unit test only. */
 void cras_iodev_list_reset();
 
@@ -13,12 +13,17 @@
 #include "cras_config.h"
 #include "cras_iodev.h"
 #include "cras_iodev_list.h"
+#include "cras_ref_ring.h"
 #include "cras_types.h"
 #include "cras_util.h"
 #include "sfh.h"
 #include "utlist.h"
 
 #define LOOPBACK_BUFFER_SIZE 8192
+/* The sample ring holds at most this many frames of the largest supported
+ * format, 16 bit stereo. */
+#define LOOPBACK_RING_MAX_FRAMES 16384
+#define LOOPBACK_RING_MAX_FRAME_BYTES 4
 
 static const char *loopdev_names[LOOPBACK_NUM_TYPES] = {
 	"Post Mix Pre DSP Loopback",
@@ -39,8 +44,15 @@ static snd_pcm_format_t loopback_supported_formats[] = {
  *    read_frames - Frames of audio data read since last dev start.
  *    started - True to indicate the target device is running, otherwise false.
  *    dev_start_time - The timestamp of the last call to configure_dev.
- *    sample_buffer - Pointer to sample buffer.
+ *    sample_buffer - Ring of the samples put by the sender. Capture streams
+ *        read it in place. When a slow reader lets it fill up, the oldest
+ *        samples are overwritten so readers always get the latest audio.
+ *        The post DSP loopback only uses it for the silence filled before
+ *        the sender starts.
  *    sender_idx - Index of the output device to read loopback audio.
+ *    ref - For post DSP loopback, the sender's post DSP reference ring, read
+ *        in place while the sender runs.
+ *    ref_offset - Offset of the next frame to read from ref.
  */
 struct loopback_iodev {
 	struct cras_iodev base;
@@ -50,12 +62,23 @@ struct loopback_iodev {
 	struct timespec dev_start_time;
 	struct byte_buffer *sample_buffer;
 	unsigned int sender_idx;
+	struct cras_ref_ring *ref;
+	uint64_t ref_offset;
 };
 
 static int sample_hook_start(bool start, void *cb_data)
 {
 	struct loopback_iodev *loopdev = (struct loopback_iodev *)cb_data;
 	loopdev->started = start;
+
+	if (loopdev->loopback_type != LOOPBACK_POST_DSP)
+		return 0;
+	loopdev->ref = NULL;
+	if (start)
+		loopdev->ref = cras_iodev_list_get_post_dsp_ref(
+			loopdev->sender_idx);
+	if (loopdev->ref)
+		loopdev->ref_offset = cras_ref_ring_write_pos(loopdev->ref);
 	return 0;
 }
 
@@ -71,9 +94,27 @@ static int sample_hook(const uint8_t *frames, unsigned int nframes,
 	struct loopback_iodev *loopdev = (struct loopback_iodev *)cb_data;
 	struct byte_buffer *sbuf = loopdev->sample_buffer;
 	unsigned int frame_bytes = cras_get_format_bytes(fmt);
+	unsigned int ring_frames = sbuf->used_size / frame_bytes;
 	unsigned int frames_to_copy, bytes_to_copy, frames_copied = 0;
+	unsigned int dropped = 0;
 	int i;
 
+	/* Only the latest ring_frames frames can be kept. */
+	if (nframes > ring_frames) {
+		dropped = nframes - ring_frames;
+		frames += dropped * frame_bytes;
+		nframes = ring_frames;
+	}
+
+	/* Make room by overwriting the oldest frames nobody has read yet. */
+	if (nframes > buf_available(sbuf) / frame_bytes) {
+		unsigned int overwritten =
+			nframes - buf_available(sbuf) / frame_bytes;
+
+		buf_increment_read(sbuf, overwritten * frame_bytes);
+		dropped += overwritten;
+	}
+
 	for (i = 0; i < 2; i++) {
 		frames_to_copy = MIN(buf_writable(sbuf) / frame_bytes, nframes);
 		if (!frames_to_copy)
@@ -88,23 +129,62 @@ static int sample_hook(const uint8_t *frames, unsigned int nframes,
 	}
 
 	ATLOG(atlog, AUDIO_THREAD_LOOPBACK_SAMPLE_HOOK, nframes + frames_copied,
-	      frames_copied, 0);
+	      frames_copied, dropped);
 
 	return frames_copied;
 }
 
+/* Sizes the sample ring to hold two buffers of the sender, so it can take a
+ * full buffer while the previous one is read. Whole frames only, so a frame
+ * never wraps around the end of the ring. */
+static void set_ring_size(struct loopback_iodev *loopdev,
+			  const struct cras_iodev *sender)
+{
+	unsigned int frame_bytes = cras_get_format_bytes(loopdev->base.format);
+	unsigned int ring_frames = LOOPBACK_BUFFER_SIZE;
+
+	if (sender)
+		ring_frames = MAX(ring_frames, 2 * sender->buffer_size);
+	ring_frames = MIN(ring_frames, loopdev->sample_buffer->max_size /
+					       frame_bytes);
+	byte_buffer_set_used_size(loopdev->sample_buffer,
+				  ring_frames * frame_bytes);
+	buf_reset(loopdev->sample_buffer);
+}
+
+/* The post DSP loopback reads the sender's reference ring instead of taking
+ * a copy of each buffer in sample_hook. */
+static void register_to_sender(struct loopback_iodev *loopdev,
+			       const struct cras_iodev *sender)
+{
+	loopback_hook_data_t hook_data = sample_hook;
+
+	if (loopdev->loopback_type == LOOPBACK_POST_DSP)
+		hook_data = NULL;
+
+	loopdev->sender_idx = sender->info.idx;
+	cras_iodev_list_register_loopback(loopdev->loopback_type,
+					  loopdev->sender_idx, hook_data,
+					  sample_hook_start,
+					  loopdev->base.info.idx);
+}
+
+static void unregister_from_sender(struct loopback_iodev *loopdev)
+{
+	cras_iodev_list_unregister_loopback(loopdev->loopback_type,
+					    loopdev->sender_idx,
+					    loopdev->base.info.idx);
+	loopdev->ref = NULL;
+}
+
 static void update_first_output_to_loopback(struct loopback_iodev *loopdev)
 {
 	struct cras_iodev *edev;
 
 	/* Register loopback hook onto first enabled iodev. */
 	edev = cras_iodev_list_get_first_enabled_iodev(CRAS_STREAM_OUTPUT);
-	if (edev) {
-		loopdev->sender_idx = edev->info.idx;
-		cras_iodev_list_register_loopback(
-			loopdev->loopback_type, loopdev->sender_idx,
-			sample_hook, sample_hook_start, loopdev->base.info.idx);
-	}
+	if (edev)
+		register_to_sender(loopdev, edev);
 }
 
 static void device_enabled_hook(struct cras_iodev *iodev, void *cb_data)
@@ -125,12 +205,18 @@ static void device_disabled_hook(struct cras_iodev *iodev, void *cb_data)
 		return;
 
 	/* Unregister loopback hook from disabled iodev. */
-	cras_iodev_list_unregister_loopback(loopdev->loopback_type,
-					    loopdev->sender_idx,
-					    loopdev->base.info.idx);
+	unregister_from_sender(loopdev);
 	update_first_output_to_loopback(loopdev);
 }
 
+/* Number of frames the post DSP loopback can read from the reference ring. */
+static unsigned int ref_frames_queued(struct loopback_iodev *loopdev)
+{
+	if (!loopdev->ref)
+		return 0;
+	return cras_ref_ring_readable(loopdev->ref, &loopdev->ref_offset);
+}
+
 /*
  * iodev callbacks.
  */
@@ -160,7 +246,7 @@ static int frames_queued(const struct cras_iodev *iodev,
 		}
 	}
 	clock_gettime(CLOCK_MONOTONIC_RAW, hw_tstamp);
-	return buf_queued(sbuf) / frame_bytes;
+	return buf_queued(sbuf) / frame_bytes + ref_frames_queued(loopdev);
 }
 
 static int delay_frames(const struct cras_iodev *iodev)
@@ -179,9 +265,7 @@ static int close_record_dev(struct cras_iodev *iodev)
 	cras_iodev_free_audio_area(iodev);
 	buf_reset(sbuf);
 
-	cras_iodev_list_unregister_loopback(loopdev->loopback_type,
-					    loopdev->sender_idx,
-					    loopdev->base.info.idx);
+	unregister_from_sender(loopdev);
 	loopdev->sender_idx = NO_DEVICE;
 	cras_iodev_list_set_device_enabled_callback(NULL, NULL, (void *)iodev);
 
@@ -199,12 +283,9 @@ static int configure_record_dev(struct cras_iodev *iodev)
 	loopdev->started = 0;
 
 	edev = cras_iodev_list_get_first_enabled_iodev(CRAS_STREAM_OUTPUT);
-	if (edev) {
-		loopdev->sender_idx = edev->info.idx;
-		cras_iodev_list_register_loopback(
-			loopdev->loopback_type, loopdev->sender_idx,
-			sample_hook, sample_hook_start, iodev->info.idx);
-	}
+	set_ring_size(loopdev, edev);
+	if (edev)
+		register_to_sender(loopdev, edev);
 	cras_iodev_list_set_device_enabled_callback(
 		device_enabled_hook, device_disabled_hook, (void *)iodev);
 
@@ -218,13 +299,22 @@ static int get_record_buffer(struct cras_iodev *iodev,
 	struct byte_buffer *sbuf = loopdev->sample_buffer;
 	unsigned int frame_bytes = cras_get_format_bytes(iodev->format);
 	unsigned int avail_frames = buf_readable(sbuf) / frame_bytes;
+	const uint8_t *src = buf_read_pointer(sbuf);
+
+	/* Silence filled before the sender started is read first. */
+	if (!avail_frames && loopdev->ref) {
+		avail_frames = ref_frames_queued(loopdev);
+		src = cras_ref_ring_read_pointer(loopdev->ref,
+						 loopdev->ref_offset,
+						 &avail_frames);
+	}
 
 	ATLOG(atlog, AUDIO_THREAD_LOOPBACK_GET, *frames, avail_frames, 0);
 
 	*frames = MIN(avail_frames, *frames);
 	iodev->area->frames = *frames;
 	cras_audio_area_config_buf_pointers(iodev->area, iodev->format,
-					    buf_read_pointer(sbuf));
+					    (uint8_t *)src);
 	*area = iodev->area;
 
 	return 0;
@@ -236,7 +326,11 @@ static int put_record_buffer(struct cras_iodev *iodev, unsigned nframes)
 	struct byte_buffer *sbuf = loopdev->sample_buffer;
 	unsigned int frame_bytes = cras_get_format_bytes(iodev->format);
 
-	buf_increment_read(sbuf, (size_t)nframes * (size_t)frame_bytes);
+	if (buf_queued(sbuf))
+		buf_increment_read(sbuf,
+				   (size_t)nframes * (size_t)frame_bytes);
+	else if (loopdev->ref)
+		loopdev->ref_offset += nframes;
 	loopdev->read_frames += nframes;
 	ATLOG(atlog, AUDIO_THREAD_LOOPBACK_PUT, nframes, 0, 0);
 	return 0;
@@ -248,6 +342,8 @@ static int flush_record_buffer(struct cras_iodev *iodev)
 	struct byte_buffer *sbuf = loopdev->sample_buffer;
 	unsigned int queued_bytes = buf_queued(sbuf);
 	buf_increment_read(sbuf, queued_bytes);
+	if (loopdev->ref)
+		loopdev->ref_offset = cras_ref_ring_write_pos(loopdev->ref);
 	loopdev->read_frames = 0;
 	return 0;
 }
@@ -266,7 +362,8 @@ static struct cras_iodev *create_loopback_iodev(enum CRAS_LOOPBACK_TYPE type)
 	if (loopback_iodev == NULL)
 		return NULL;
 
-	loopback_iodev->sample_buffer = byte_buffer_create(1024 * 16 * 4);
+	loopback_iodev->sample_buffer = byte_buffer_create(
+		LOOPBACK_RING_MAX_FRAMES * LOOPBACK_RING_MAX_FRAME_BYTES);
 	if (loopback_iodev->sample_buffer == NULL) {
 		free(loopback_iodev);
 		return NULL;
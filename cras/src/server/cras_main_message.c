@@ -4,11 +4,18 @@
  */
 
 #include <errno.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
 #include <syslog.h>
+#include <unistd.h>
 
 #include "cras_main_message.h"
+#include "cras_msg_ring.h"
 #include "cras_system_state.h"
 #include "cras_util.h"
 
@@ -20,8 +27,29 @@ struct cras_main_msg_callback {
 	struct cras_main_msg_callback *prev, *next;
 };
 
-static int main_msg_fds[2];
+/* Largest message that can be sent, and how many can be queued before the
+ * main thread gets to them. */
+#define MAIN_MSG_MAX_SIZE 256
+#define MAIN_MSG_NUM_SLOTS 256
+/* How long a blocking sender sleeps before retrying a full ring. */
+#define MAIN_MSG_RETRY_NS 1000000
+/* How many messages each thread keeps to resend when the ring is full. */
+#define MAIN_MSG_BACKLOG 4
+
+static struct cras_msg_ring *main_msg_ring;
+/* Eventfd to wake the main thread, written once per batch of messages. */
+static int main_msg_event_fd = -1;
+/* Drop count already reported to syslog. */
+static unsigned int main_msg_reported_drops;
 static struct cras_main_msg_callback *main_msg_callbacks;
+/* The thread draining the ring, which a blocking send must not wait on. */
+static pthread_t main_msg_thread;
+/* Messages of the calling thread that didn't fit in the ring, oldest
+ * first. They are sent ahead of its later messages to keep the order. */
+static __thread uint8_t backlog[MAIN_MSG_BACKLOG][MAIN_MSG_MAX_SIZE];
+static __thread unsigned int backlog_len;
+/* Messages dropped because the backlog of their thread was full too. */
+static unsigned int backlog_drops;
 
 int cras_main_message_add_handler(enum CRAS_MAIN_MESSAGE_TYPE type,
 				  cras_message_callback callback,
@@ -46,49 +74,94 @@ int cras_main_message_add_handler(enum CRAS_MAIN_MESSAGE_TYPE type,
 	return 0;
 }
 
-int cras_main_message_send(struct cras_main_message *msg)
+static int wake_main_thread()
 {
-	int err;
+	uint64_t one = 1;
 
-	err = write(main_msg_fds[1], msg, msg->length);
-	if (err < 0) {
-		syslog(LOG_ERR, "Failed to send main message, type %u",
-		       msg->type);
-		return err;
-	}
+	if (cras_msg_ring_need_wake(main_msg_ring) &&
+	    write(main_msg_event_fd, &one, sizeof(one)) < 0)
+		return -errno;
 	return 0;
 }
 
-static int read_main_message(int msg_fd, uint8_t *buf, size_t max_len)
+int cras_main_message_retry()
 {
-	int to_read, nread, rc;
-	struct cras_main_message *msg = (struct cras_main_message *)buf;
+	unsigned int sent = 0;
 
-	nread = read(msg_fd, buf, sizeof(msg->length));
-	if (nread < 0)
-		return nread;
-	if (msg->length > max_len)
-		return -ENOMEM;
+	while (sent < backlog_len) {
+		struct cras_main_message *msg =
+			(struct cras_main_message *)backlog[sent];
 
-	to_read = msg->length - nread;
-	rc = read(msg_fd, &buf[0] + nread, to_read);
-	if (rc < 0)
-		return rc;
+		if (cras_msg_ring_try_write(main_msg_ring, msg, msg->length))
+			break;
+		sent++;
+	}
+	if (!sent)
+		return backlog_len;
+
+	backlog_len -= sent;
+	memmove(backlog[0], backlog[sent], backlog_len * sizeof(backlog[0]));
+	/* A failed wake is retried by the next message. */
+	wake_main_thread();
+	return backlog_len;
+}
+
+int cras_main_message_send(struct cras_main_message *msg)
+{
+	uint64_t one = 1;
+	int rc;
+
+	if (msg->length > MAIN_MSG_MAX_SIZE)
+		return -EMSGSIZE;
+
+	/* Never blocks, so it is safe from the audio thread. What doesn't fit
+	 * in the ring waits in the backlog of the thread. */
+	if (!cras_main_message_retry()) {
+		rc = cras_msg_ring_try_write(main_msg_ring, msg, msg->length);
+		if (rc != -EAGAIN)
+			return rc ? rc : wake_main_thread();
+	}
+
+	if (backlog_len == MAIN_MSG_BACKLOG) {
+		/* The main thread reports the drops. */
+		__atomic_add_fetch(&backlog_drops, 1, __ATOMIC_RELAXED);
+		return -EAGAIN;
+	}
+	memcpy(backlog[backlog_len++], msg, msg->length);
+
+	/* The main thread resends its own backlog once it drained the ring. */
+	if (pthread_equal(pthread_self(), main_msg_thread) &&
+	    write(main_msg_event_fd, &one, sizeof(one)) < 0)
+		return -errno;
 	return 0;
 }
 
-static void handle_main_messages(void *arg, int revents)
+int cras_main_message_send_blocking(struct cras_main_message *msg)
 {
-	uint8_t buf[256];
+	struct timespec wait = { 0, MAIN_MSG_RETRY_NS };
 	int rc;
-	struct cras_main_msg_callback *main_msg_cb;
-	struct cras_main_message *msg = (struct cras_main_message *)buf;
 
-	rc = read_main_message(main_msg_fds[0], buf, sizeof(buf));
-	if (rc < 0) {
-		syslog(LOG_ERR, "Failed to read main message");
-		return;
+	/* Only the main thread frees slots, it would wait forever. */
+	if (pthread_equal(pthread_self(), main_msg_thread))
+		return -EDEADLK;
+
+	while ((rc = cras_msg_ring_try_write(main_msg_ring, msg,
+					     msg->length)) == -EAGAIN) {
+		/* Make sure the main thread is draining while we wait. */
+		rc = wake_main_thread();
+		if (rc < 0)
+			return rc;
+		nanosleep(&wait, NULL);
 	}
+	if (rc < 0)
+		return rc;
+
+	return wake_main_thread();
+}
+
+static void dispatch_main_message(struct cras_main_message *msg)
+{
+	struct cras_main_msg_callback *main_msg_cb;
 
 	DL_FOREACH (main_msg_callbacks, main_msg_cb) {
 		if (main_msg_cb->type == msg->type) {
@@ -98,20 +171,58 @@ static void handle_main_messages(void *arg, int revents)
 	}
 }
 
-void cras_main_message_init()
+static void drain_main_messages()
 {
-	int rc;
+	struct cras_main_message *msg;
+
+	while ((msg = (struct cras_main_message *)cras_msg_ring_read_slot(
+			main_msg_ring))) {
+		dispatch_main_message(msg);
+		cras_msg_ring_commit_read(main_msg_ring);
+	}
+}
 
-	rc = pipe(main_msg_fds);
-	if (rc < 0) {
+static void handle_main_messages(void *arg, int revents)
+{
+	unsigned int dropped;
+	uint64_t count;
+
+	if (read(main_msg_event_fd, &count, sizeof(count)) < 0 &&
+	    errno != EAGAIN)
+		syslog(LOG_ERR, "Failed to read main message event");
+
+	/* Re-arm the doorbell before draining so a message committed after
+	 * the drain ends always wakes us again. */
+	cras_msg_ring_ack_wake(main_msg_ring);
+
+	drain_main_messages();
+	/* The ring has room now for what the main thread itself couldn't
+	 * queue. */
+	if (backlog_len) {
+		cras_main_message_retry();
+		drain_main_messages();
+	}
+
+	dropped = cras_msg_ring_dropped(main_msg_ring) +
+		  __atomic_load_n(&backlog_drops, __ATOMIC_RELAXED);
+	if (dropped != main_msg_reported_drops) {
+		syslog(LOG_WARNING, "Main message ring full, %u dropped",
+		       dropped - main_msg_reported_drops);
+		main_msg_reported_drops = dropped;
+	}
+}
+
+void cras_main_message_init()
+{
+	main_msg_ring =
+		cras_msg_ring_create(MAIN_MSG_MAX_SIZE, MAIN_MSG_NUM_SLOTS);
+	main_msg_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (!main_msg_ring || main_msg_event_fd < 0) {
 		syslog(LOG_ERR, "Fatal: main message init");
 		exit(-ENOMEM);
 	}
 
-	/* When full it's preferred to get error instead of blocked. */
-	cras_make_fd_nonblocking(main_msg_fds[0]);
-	cras_make_fd_nonblocking(main_msg_fds[1]);
-
-	cras_system_add_select_fd(main_msg_fds[0], handle_main_messages, NULL,
-				  POLLIN);
+	main_msg_thread = pthread_self();
+	cras_system_add_select_fd(main_msg_event_fd, handle_main_messages,
+				  NULL, POLLIN);
 }
@@ -16,10 +16,17 @@ enum CRAS_MAIN_MESSAGE_TYPE {
 	CRAS_MAIN_A2DP,
 	CRAS_MAIN_AUDIO_THREAD_EVENT,
 	CRAS_MAIN_BT,
-	CRAS_MAIN_METRICS,
 	CRAS_MAIN_MONITOR_DEVICE,
 	CRAS_MAIN_HOTWORD_TRIGGERED,
 	CRAS_MAIN_NON_EMPTY_AUDIO_STATE,
+	CRAS_MAIN_AUDIO_THREAD_REPLY,
+	CRAS_MAIN_OVERLOAD_DSP,
+	/* Jack EDID worker -> main thread */
+	CRAS_MAIN_JACK_EDID,
+	/* Device open worker -> main thread */
+	CRAS_MAIN_DEV_OPEN,
+	/* Hotword model worker -> main thread */
+	CRAS_MAIN_HOTWORD_MODEL,
 };
 
 /* Structure of the header of the message handled by main thread.
@@ -35,9 +42,24 @@ struct cras_main_message {
 /* Callback function to handle main thread message. */
 typedef void (*cras_message_callback)(struct cras_main_message *msg, void *arg);
 
-/* Sends a message to main thread. */
+/* Sends a message to main thread. Never blocks, so it is safe to call from
+ * the audio thread and from the main thread itself. When the main thread is
+ * too far behind, the message waits in a small backlog of the calling
+ * thread and is only dropped once that is full too. */
 int cras_main_message_send(struct cras_main_message *msg);
 
+/* Resends the backlog of the calling thread. The main thread does this on
+ * its own, the audio thread calls it on each wake.
+ * Returns:
+ *    The number of messages still waiting in the backlog.
+ */
+int cras_main_message_retry();
+
+/* Sends a message to main thread, waiting for room if too many are queued.
+ * For worker threads whose message must not be lost. Must not be called
+ * from the main thread itself or from the audio thread. */
+int cras_main_message_send_blocking(struct cras_main_message *msg);
+
 /* Registers the handler function for specific type of message. */
 int cras_main_message_add_handler(enum CRAS_MAIN_MESSAGE_TYPE type,
 				  cras_message_callback callback,
@@ -64,6 +64,22 @@ void cras_mix_add(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
 	ops->add(fmt, dst, src, count, index, mute, mix_vol);
 }
 
+void cras_mix_add_multi(snd_pcm_format_t fmt, uint8_t *dst,
+			const struct cras_mix_src *srcs, unsigned int num_srcs,
+			unsigned int count)
+{
+	ops->add_multi(fmt, dst, srcs, num_srcs, count);
+}
+
+void cras_mix_add_ramp(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
+		       unsigned int frames, unsigned int channels,
+		       unsigned int index, float scaler, float increment,
+		       float target)
+{
+	ops->add_ramp(fmt, dst, src, frames, channels, index, scaler,
+		      increment, target);
+}
+
 void cras_mix_add_scale_stride(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
 			       unsigned int count, unsigned int dst_stride,
 			       unsigned int src_stride, float scaler)
@@ -58,6 +58,53 @@ void cras_mix_add(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
 		  unsigned int count, unsigned int index, int mute,
 		  float mix_vol);
 
+/* Add src buffer to dst, scaling each frame along a ramp. This is the same
+ * as cras_mix_add() followed by cras_scale_buffer_increment() on src, done in
+ * the mixing pass so ramping a stream doesn't cost another sweep over it.
+ * Args:
+ *    fmt - The format (SND_PCM_FORMAT_*)
+ *    dst - Buffer of samples to mix to.
+ *    src - Buffer of samples to mix from.
+ *    frames - The number of frames to mix.
+ *    channels - Number of samples in a frame.
+ *    index - If zero this is the first buffer written to dst.
+ *    scaler - Scaler applied to the first frame.
+ *    increment - The increment(+/-) of scaler at each frame.
+ *    target - The value at which to clip the scaler.
+ */
+void cras_mix_add_ramp(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
+		       unsigned int frames, unsigned int channels,
+		       unsigned int index, float scaler, float increment,
+		       float target);
+
+/* A buffer of samples summed into the destination by cras_mix_add_multi().
+ *    buf - Samples to add, in the format of the destination.
+ *    offset - Sample of the destination buf[0] is added to.
+ *    count - The number of samples in buf.
+ *    vol - Scaler for the samples.
+ */
+struct cras_mix_src {
+	const uint8_t *buf;
+	unsigned int offset;
+	unsigned int count;
+	float vol;
+};
+
+/* Add several buffers to dst at once. Each sample of dst is read, summed with
+ * all the buffers covering it and clipped once, a block at a time so the
+ * block of dst stays in the cache while every buffer is added to it.
+ * Args:
+ *    fmt - The format (SND_PCM_FORMAT_*)
+ *    dst - Buffer of samples to mix to.
+ *    srcs - The buffers to mix from.
+ *    num_srcs - Number of buffers in srcs.
+ *    count - The number of samples of dst to mix, at least the offset plus
+ *        count of every buffer.
+ */
+void cras_mix_add_multi(snd_pcm_format_t fmt, uint8_t *dst,
+			const struct cras_mix_src *srcs, unsigned int num_srcs,
+			unsigned int count);
+
 /* Add src buffer to dst with independent channel strides.
  * Args:
  *    fmt - The format (SND_PCM_FORMAT_*)
@@ -4,8 +4,10 @@
  */
 
 #include <stdint.h>
+#include <sys/param.h>
 
 #include "cras_system_state.h"
+#include "cras_mix.h"
 #include "cras_mix_ops.h"
 
 #define MAX_VOLUME_TO_SCALE 0.9999999
@@ -33,6 +35,20 @@ static inline int need_to_scale(float scaler)
 	return (scaler < 0.99 || scaler > 1.01);
 }
 
+/* Returns the scaler a ramp starting at scaler and moving by increment every
+ * frame applies to the given frame, clipped at target. Computed from the frame
+ * index rather than accumulated so long ramps don't drift. */
+static inline float ramp_scaler(float scaler, float increment, float target,
+				unsigned int frame)
+{
+	float applied_scaler = scaler + increment * frame;
+
+	if ((applied_scaler > target && increment > 0) ||
+	    (applied_scaler < target && increment < 0))
+		return target;
+	return applied_scaler;
+}
+
 /*
  * Signed 16 bit little endian functions.
  */
@@ -158,6 +174,26 @@ static void cras_mix_add_s16_le(uint8_t *dst, uint8_t *src, unsigned int count,
 	scale_add_clip_s16_le(out, in, count, mix_vol);
 }
 
+static void cras_mix_add_ramp_s16_le(uint8_t *dst, uint8_t *src,
+				     unsigned int frames,
+				     unsigned int channels,
+				     unsigned int index, float scaler,
+				     float increment, float target)
+{
+	int16_t *out = (int16_t *)dst;
+	const int16_t *in = (const int16_t *)src;
+	unsigned int i;
+
+	for (i = 0; i < frames; i++, out += channels, in += channels) {
+		float vol = ramp_scaler(scaler, increment, target, i);
+
+		if (index == 0)
+			copy_scaled_s16_le(out, in, channels, vol);
+		else
+			scale_add_clip_s16_le(out, in, channels, vol);
+	}
+}
+
 static void cras_mix_add_scale_stride_s16_le(uint8_t *dst, uint8_t *src,
 					     unsigned int dst_stride,
 					     unsigned int src_stride,
@@ -349,6 +385,26 @@ static void cras_mix_add_s24_le(uint8_t *dst, uint8_t *src, unsigned int count,
 	scale_add_clip_s24_le(out, in, count, mix_vol);
 }
 
+static void cras_mix_add_ramp_s24_le(uint8_t *dst, uint8_t *src,
+				     unsigned int frames,
+				     unsigned int channels,
+				     unsigned int index, float scaler,
+				     float increment, float target)
+{
+	int32_t *out = (int32_t *)dst;
+	const int32_t *in = (const int32_t *)src;
+	unsigned int i;
+
+	for (i = 0; i < frames; i++, out += channels, in += channels) {
+		float vol = ramp_scaler(scaler, increment, target, i);
+
+		if (index == 0)
+			copy_scaled_s24_le(out, in, channels, vol);
+		else
+			scale_add_clip_s24_le(out, in, channels, vol);
+	}
+}
+
 static void cras_mix_add_scale_stride_s24_le(uint8_t *dst, uint8_t *src,
 					     unsigned int dst_stride,
 					     unsigned int src_stride,
@@ -517,6 +573,26 @@ static void cras_mix_add_s32_le(uint8_t *dst, uint8_t *src, unsigned int count,
 	scale_add_clip_s32_le(out, in, count, mix_vol);
 }
 
+static void cras_mix_add_ramp_s32_le(uint8_t *dst, uint8_t *src,
+				     unsigned int frames,
+				     unsigned int channels,
+				     unsigned int index, float scaler,
+				     float increment, float target)
+{
+	int32_t *out = (int32_t *)dst;
+	const int32_t *in = (const int32_t *)src;
+	unsigned int i;
+
+	for (i = 0; i < frames; i++, out += channels, in += channels) {
+		float vol = ramp_scaler(scaler, increment, target, i);
+
+		if (index == 0)
+			copy_scaled_s32_le(out, in, channels, vol);
+		else
+			scale_add_clip_s32_le(out, in, channels, vol);
+	}
+}
+
 static void cras_mix_add_scale_stride_s32_le(uint8_t *dst, uint8_t *src,
 					     unsigned int dst_stride,
 					     unsigned int src_stride,
@@ -565,18 +641,21 @@ static void cras_mix_add_scale_stride_s32_le(uint8_t *dst, uint8_t *src,
  */
 
 /* Convert 3bytes Signed 24bit integer to a Signed 32bit integer.
- * Just a helper function. */
+ * Just a helper function. The bytes are moved with shifts rather than a
+ * memcpy into the middle of the word, so the loops below vectorize. */
 static inline void convert_single_s243le_to_s32le(int32_t *dst,
 						  const uint8_t *src)
 {
-	*dst = 0;
-	memcpy((uint8_t *)dst + 1, src, 3);
+	*dst = (int32_t)((uint32_t)src[0] << 8 | (uint32_t)src[1] << 16 |
+			 (uint32_t)src[2] << 24);
 }
 
 static inline void convert_single_s32le_to_s243le(uint8_t *dst,
 						  const int32_t *src)
 {
-	memcpy(dst, (uint8_t *)src + 1, 3);
+	dst[0] = *src >> 8;
+	dst[1] = *src >> 16;
+	dst[2] = *src >> 24;
 }
 
 static void cras_mix_add_clip_s24_3le(uint8_t *dst, const uint8_t *src,
@@ -723,6 +802,26 @@ static void cras_mix_add_s24_3le(uint8_t *dst, uint8_t *src, unsigned int count,
 	scale_add_clip_s24_3le(out, in, count, mix_vol);
 }
 
+static void cras_mix_add_ramp_s24_3le(uint8_t *dst, uint8_t *src,
+				      unsigned int frames,
+				      unsigned int channels,
+				      unsigned int index, float scaler,
+				      float increment, float target)
+{
+	uint8_t *out = (uint8_t *)dst;
+	const uint8_t *in = (const uint8_t *)src;
+	unsigned int i;
+
+	for (i = 0; i < frames; i++, out += channels * 3, in += channels * 3) {
+		float vol = ramp_scaler(scaler, increment, target, i);
+
+		if (index == 0)
+			copy_scaled_s24_3le(out, in, channels, vol);
+		else
+			scale_add_clip_s24_3le(out, in, channels, vol);
+	}
+}
+
 static void cras_mix_add_scale_stride_s24_3le(uint8_t *dst, uint8_t *src,
 					      unsigned int dst_stride,
 					      unsigned int src_stride,
@@ -751,6 +850,354 @@ static void cras_mix_add_scale_stride_s24_3le(uint8_t *dst, uint8_t *src,
 	}
 }
 
+/*
+ * 32 bit float little endian functions.
+ */
+
+static inline float clip_f32(float value)
+{
+	if (value > 1.0f)
+		return 1.0f;
+	if (value < -1.0f)
+		return -1.0f;
+	return value;
+}
+
+/* Adds src into dst, after scaling by vol.
+ * Hard limits to the [-1.0, 1.0] range. */
+static void scale_add_clip_f32_le(float *dst, const float *src, size_t count,
+				  float vol)
+{
+	size_t i;
+
+	if (vol > MAX_VOLUME_TO_SCALE) {
+		for (i = 0; i < count; i++)
+			dst[i] = clip_f32(dst[i] + src[i]);
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+		dst[i] = clip_f32(dst[i] + src[i] * vol);
+}
+
+/* Adds the first stream to the mix.  Don't need to mix, just setup to the new
+ * values. If volume is 1.0, just memcpy. */
+static void copy_scaled_f32_le(float *dst, const float *src, size_t count,
+			       float volume_scaler)
+{
+	size_t i;
+
+	if (volume_scaler > MAX_VOLUME_TO_SCALE) {
+		memcpy(dst, src, count * sizeof(*src));
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+		dst[i] = src[i] * volume_scaler;
+}
+
+static void cras_scale_buffer_inc_f32_le(uint8_t *buffer, unsigned int count,
+					 float scaler, float increment,
+					 float target, int step)
+{
+	int i = 0, j;
+	float *out = (float *)buffer;
+
+	if (scaler < MIN_VOLUME_TO_SCALE && increment < 0) {
+		memset(out, 0, count * sizeof(*out));
+		return;
+	}
+
+	while (i + step <= count) {
+		for (j = 0; j < step; j++) {
+			float applied_scaler = scaler;
+
+			if ((applied_scaler > target && increment > 0) ||
+			    (applied_scaler < target && increment < 0))
+				applied_scaler = target;
+
+			if (applied_scaler > MAX_VOLUME_TO_SCALE) {
+			} else if (applied_scaler < MIN_VOLUME_TO_SCALE) {
+				out[i] = 0;
+			} else {
+				out[i] *= applied_scaler;
+			}
+			i++;
+		}
+		scaler += increment;
+	}
+}
+
+static void cras_scale_buffer_f32_le(uint8_t *buffer, unsigned int count,
+				     float scaler)
+{
+	int i;
+	float *out = (float *)buffer;
+
+	if (scaler > MAX_VOLUME_TO_SCALE)
+		return;
+
+	if (scaler < MIN_VOLUME_TO_SCALE) {
+		memset(out, 0, count * sizeof(*out));
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+		out[i] *= scaler;
+}
+
+static void cras_mix_add_f32_le(uint8_t *dst, uint8_t *src, unsigned int count,
+				unsigned int index, int mute, float mix_vol)
+{
+	float *out = (float *)dst;
+	float *in = (float *)src;
+
+	if (mute || (mix_vol < MIN_VOLUME_TO_SCALE)) {
+		if (index == 0)
+			memset(out, 0, count * sizeof(*out));
+		return;
+	}
+
+	if (index == 0)
+		return copy_scaled_f32_le(out, in, count, mix_vol);
+
+	scale_add_clip_f32_le(out, in, count, mix_vol);
+}
+
+static void cras_mix_add_ramp_f32_le(uint8_t *dst, uint8_t *src,
+				     unsigned int frames,
+				     unsigned int channels,
+				     unsigned int index, float scaler,
+				     float increment, float target)
+{
+	float *out = (float *)dst;
+	const float *in = (const float *)src;
+	unsigned int i;
+
+	for (i = 0; i < frames; i++, out += channels, in += channels) {
+		float vol = ramp_scaler(scaler, increment, target, i);
+
+		if (index == 0)
+			copy_scaled_f32_le(out, in, channels, vol);
+		else
+			scale_add_clip_f32_le(out, in, channels, vol);
+	}
+}
+
+static void cras_mix_add_scale_stride_f32_le(uint8_t *dst, uint8_t *src,
+					     unsigned int dst_stride,
+					     unsigned int src_stride,
+					     unsigned int count, float scaler)
+{
+	unsigned int i;
+
+	/* optimise the loops for vectorization */
+	if (dst_stride == src_stride && dst_stride == 4) {
+		float *out = (float *)dst;
+		const float *in = (const float *)src;
+
+		if (!need_to_scale(scaler))
+			scaler = 1.0f;
+		for (i = 0; i < count; i++)
+			out[i] = clip_f32(out[i] + in[i] * scaler);
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		float sum;
+		if (need_to_scale(scaler))
+			sum = *(float *)dst + *(float *)src * scaler;
+		else
+			sum = *(float *)dst + *(float *)src;
+		*(float *)dst = clip_f32(sum);
+		dst += dst_stride;
+		src += src_stride;
+	}
+}
+
+/*
+ * Multi buffer mixing.
+ */
+
+/* Number of samples of the destination summed at a time. Small enough for
+ * the block and its accumulators to stay in L1 while every source is added. */
+#define MIX_MULTI_BLOCK 256
+
+/* Finds the samples of src that land in the block of dst starting at start
+ * and n samples long. Returns how many there are, and sets dst_idx to where
+ * they go in the block and src_idx to the first of them in src. */
+static inline unsigned int mix_src_overlap(const struct cras_mix_src *src,
+					   unsigned int start, unsigned int n,
+					   unsigned int *dst_idx,
+					   unsigned int *src_idx)
+{
+	unsigned int first = MAX(src->offset, start);
+	unsigned int last = MIN(src->offset + src->count, start + n);
+
+	if (src->vol < MIN_VOLUME_TO_SCALE || first >= last)
+		return 0;
+	*dst_idx = first - start;
+	*src_idx = first - src->offset;
+	return last - first;
+}
+
+static void cras_mix_add_multi_s16_le(int16_t *dst,
+				      const struct cras_mix_src *srcs,
+				      unsigned int num_srcs, unsigned int count)
+{
+	int32_t acc[MIX_MULTI_BLOCK];
+	const int16_t *src;
+	unsigned int start, n, i, k, len, d, o;
+	float vol;
+
+	for (start = 0; start < count; start += n) {
+		n = MIN(count - start, MIX_MULTI_BLOCK);
+		for (k = 0; k < n; k++)
+			acc[k] = dst[start + k];
+		for (i = 0; i < num_srcs; i++) {
+			len = mix_src_overlap(&srcs[i], start, n, &d, &o);
+			src = (const int16_t *)srcs[i].buf + o;
+			vol = srcs[i].vol;
+			if (vol > MAX_VOLUME_TO_SCALE)
+				for (k = 0; k < len; k++)
+					acc[d + k] += src[k];
+			else
+				for (k = 0; k < len; k++)
+					acc[d + k] += (int32_t)(src[k] * vol);
+		}
+		for (k = 0; k < n; k++)
+			dst[start + k] = MAX(MIN(acc[k], INT16_MAX), INT16_MIN);
+	}
+}
+
+static void cras_mix_add_multi_s24_le(int32_t *dst,
+				      const struct cras_mix_src *srcs,
+				      unsigned int num_srcs, unsigned int count)
+{
+	int32_t acc[MIX_MULTI_BLOCK];
+	const int32_t *src;
+	unsigned int start, n, i, k, len, d, o;
+	float vol;
+
+	/* 32 bits hold the sum of the destination and 255 sources of 24 bit
+	 * samples. */
+	for (start = 0; start < count; start += n) {
+		n = MIN(count - start, MIX_MULTI_BLOCK);
+		for (k = 0; k < n; k++)
+			acc[k] = dst[start + k];
+		for (i = 0; i < num_srcs; i++) {
+			len = mix_src_overlap(&srcs[i], start, n, &d, &o);
+			src = (const int32_t *)srcs[i].buf + o;
+			vol = srcs[i].vol;
+			if (vol > MAX_VOLUME_TO_SCALE)
+				for (k = 0; k < len; k++)
+					acc[d + k] += src[k];
+			else
+				for (k = 0; k < len; k++)
+					acc[d + k] += (int32_t)(src[k] * vol);
+		}
+		for (k = 0; k < n; k++)
+			dst[start + k] = MAX(MIN(acc[k], 0x007fffff),
+					     (int32_t)0xff800000);
+	}
+}
+
+static void cras_mix_add_multi_s32_le(int32_t *dst,
+				      const struct cras_mix_src *srcs,
+				      unsigned int num_srcs, unsigned int count)
+{
+	int64_t acc[MIX_MULTI_BLOCK];
+	const int32_t *src;
+	unsigned int start, n, i, k, len, d, o;
+	float vol;
+
+	for (start = 0; start < count; start += n) {
+		n = MIN(count - start, MIX_MULTI_BLOCK);
+		for (k = 0; k < n; k++)
+			acc[k] = dst[start + k];
+		for (i = 0; i < num_srcs; i++) {
+			len = mix_src_overlap(&srcs[i], start, n, &d, &o);
+			src = (const int32_t *)srcs[i].buf + o;
+			vol = srcs[i].vol;
+			if (vol > MAX_VOLUME_TO_SCALE)
+				for (k = 0; k < len; k++)
+					acc[d + k] += src[k];
+			else
+				for (k = 0; k < len; k++)
+					acc[d + k] += (int64_t)(src[k] * vol);
+		}
+		for (k = 0; k < n; k++)
+			dst[start + k] = MAX(MIN(acc[k], INT32_MAX), INT32_MIN);
+	}
+}
+
+static void cras_mix_add_multi_s24_3le(uint8_t *dst,
+				       const struct cras_mix_src *srcs,
+				       unsigned int num_srcs,
+				       unsigned int count)
+{
+	int64_t acc[MIX_MULTI_BLOCK];
+	const uint8_t *src;
+	unsigned int start, n, i, k, len, d, o;
+	int32_t frame;
+	float vol;
+
+	for (start = 0; start < count; start += n) {
+		n = MIN(count - start, MIX_MULTI_BLOCK);
+		for (k = 0; k < n; k++) {
+			convert_single_s243le_to_s32le(&frame,
+						       dst + 3 * (start + k));
+			acc[k] = frame;
+		}
+		for (i = 0; i < num_srcs; i++) {
+			len = mix_src_overlap(&srcs[i], start, n, &d, &o);
+			src = srcs[i].buf + 3 * o;
+			vol = srcs[i].vol;
+			for (k = 0; k < len; k++, src += 3) {
+				convert_single_s243le_to_s32le(&frame, src);
+				if (vol > MAX_VOLUME_TO_SCALE)
+					acc[d + k] += frame;
+				else
+					acc[d + k] += (int64_t)(frame * vol);
+			}
+		}
+		for (k = 0; k < n; k++) {
+			frame = MAX(MIN(acc[k], INT32_MAX), INT32_MIN);
+			convert_single_s32le_to_s243le(dst + 3 * (start + k),
+						       &frame);
+		}
+	}
+}
+
+static void cras_mix_add_multi_f32_le(float *dst,
+				      const struct cras_mix_src *srcs,
+				      unsigned int num_srcs, unsigned int count)
+{
+	float acc[MIX_MULTI_BLOCK];
+	const float *src;
+	unsigned int start, n, i, k, len, d, o;
+	float vol;
+
+	for (start = 0; start < count; start += n) {
+		n = MIN(count - start, MIX_MULTI_BLOCK);
+		for (k = 0; k < n; k++)
+			acc[k] = dst[start + k];
+		for (i = 0; i < num_srcs; i++) {
+			len = mix_src_overlap(&srcs[i], start, n, &d, &o);
+			src = (const float *)srcs[i].buf + o;
+			vol = srcs[i].vol;
+			if (vol > MAX_VOLUME_TO_SCALE)
+				for (k = 0; k < len; k++)
+					acc[d + k] += src[k];
+			else
+				for (k = 0; k < len; k++)
+					acc[d + k] += src[k] * vol;
+		}
+		for (k = 0; k < n; k++)
+			dst[start + k] = clip_f32(acc[k]);
+	}
+}
+
 static void scale_buffer_increment(snd_pcm_format_t fmt, uint8_t *buff,
 				   unsigned int count, float scaler,
 				   float increment, float target, int step)
@@ -768,6 +1215,9 @@ static void scale_buffer_increment(snd_pcm_format_t fmt, uint8_t *buff,
 	case SND_PCM_FORMAT_S24_3LE:
 		return cras_scale_buffer_inc_s24_3le(buff, count, scaler,
 						     increment, target, step);
+	case SND_PCM_FORMAT_FLOAT_LE:
+		return cras_scale_buffer_inc_f32_le(buff, count, scaler,
+						    increment, target, step);
 	default:
 		break;
 	}
@@ -785,6 +1235,8 @@ static void scale_buffer(snd_pcm_format_t fmt, uint8_t *buff,
 		return cras_scale_buffer_s32_le(buff, count, scaler);
 	case SND_PCM_FORMAT_S24_3LE:
 		return cras_scale_buffer_s24_3le(buff, count, scaler);
+	case SND_PCM_FORMAT_FLOAT_LE:
+		return cras_scale_buffer_f32_le(buff, count, scaler);
 	default:
 		break;
 	}
@@ -807,6 +1259,64 @@ static void mix_add(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
 	case SND_PCM_FORMAT_S24_3LE:
 		return cras_mix_add_s24_3le(dst, src, count, index, mute,
 					    mix_vol);
+	case SND_PCM_FORMAT_FLOAT_LE:
+		return cras_mix_add_f32_le(dst, src, count, index, mute,
+					   mix_vol);
+	default:
+		break;
+	}
+}
+
+static void mix_add_multi(snd_pcm_format_t fmt, uint8_t *dst,
+			  const struct cras_mix_src *srcs,
+			  unsigned int num_srcs, unsigned int count)
+{
+	switch (fmt) {
+	case SND_PCM_FORMAT_S16_LE:
+		return cras_mix_add_multi_s16_le((int16_t *)dst, srcs,
+						 num_srcs, count);
+	case SND_PCM_FORMAT_S24_LE:
+		return cras_mix_add_multi_s24_le((int32_t *)dst, srcs,
+						 num_srcs, count);
+	case SND_PCM_FORMAT_S32_LE:
+		return cras_mix_add_multi_s32_le((int32_t *)dst, srcs,
+						 num_srcs, count);
+	case SND_PCM_FORMAT_S24_3LE:
+		return cras_mix_add_multi_s24_3le(dst, srcs, num_srcs, count);
+	case SND_PCM_FORMAT_FLOAT_LE:
+		return cras_mix_add_multi_f32_le((float *)dst, srcs, num_srcs,
+						 count);
+	default:
+		break;
+	}
+}
+
+static void mix_add_ramp(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
+			 unsigned int frames, unsigned int channels,
+			 unsigned int index, float scaler, float increment,
+			 float target)
+{
+	switch (fmt) {
+	case SND_PCM_FORMAT_S16_LE:
+		return cras_mix_add_ramp_s16_le(
+			dst, src, frames, channels, index, scaler, increment,
+			target);
+	case SND_PCM_FORMAT_S24_LE:
+		return cras_mix_add_ramp_s24_le(
+			dst, src, frames, channels, index, scaler, increment,
+			target);
+	case SND_PCM_FORMAT_S32_LE:
+		return cras_mix_add_ramp_s32_le(
+			dst, src, frames, channels, index, scaler, increment,
+			target);
+	case SND_PCM_FORMAT_S24_3LE:
+		return cras_mix_add_ramp_s24_3le(
+			dst, src, frames, channels, index, scaler, increment,
+			target);
+	case SND_PCM_FORMAT_FLOAT_LE:
+		return cras_mix_add_ramp_f32_le(
+			dst, src, frames, channels, index, scaler, increment,
+			target);
 	default:
 		break;
 	}
@@ -830,6 +1340,9 @@ static void mix_add_scale_stride(snd_pcm_format_t fmt, uint8_t *dst,
 	case SND_PCM_FORMAT_S24_3LE:
 		return cras_mix_add_scale_stride_s24_3le(
 			dst, src, dst_stride, src_stride, count, scaler);
+	case SND_PCM_FORMAT_FLOAT_LE:
+		return cras_mix_add_scale_stride_f32_le(
+			dst, src, dst_stride, src_stride, count, scaler);
 	default:
 		break;
 	}
@@ -845,6 +1358,8 @@ const struct cras_mix_ops OPS(mixer_ops) = {
 	.scale_buffer = scale_buffer,
 	.scale_buffer_increment = scale_buffer_increment,
 	.add = mix_add,
+	.add_multi = mix_add_multi,
+	.add_ramp = mix_add_ramp,
 	.add_scale_stride = mix_add_scale_stride,
 	.mute_buffer = mix_mute_buffer,
 };
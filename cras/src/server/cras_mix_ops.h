@@ -10,6 +10,8 @@
 
 #include "cras_system_state.h"
 
+struct cras_mix_src;
+
 extern const struct cras_mix_ops mixer_ops;
 extern const struct cras_mix_ops mixer_ops_sse42;
 extern const struct cras_mix_ops mixer_ops_avx;
@@ -26,6 +28,8 @@ extern const struct cras_mix_ops mixer_ops_fma;
  *   scale_buffer_increment: See cras_scale_buffer_increment.
  *   scale_buffer: See cras_scale_buffer.
  *   add: See cras_mix_add.
+ *   add_multi: See cras_mix_add_multi.
+ *   add_ramp: See cras_mix_add_ramp.
  *   add_scale_stride: See cras_mix_add_scale_stride.
  *   mute_buffer: cras_mix_mute_buffer.
  */
@@ -38,6 +42,13 @@ struct cras_mix_ops {
 	void (*add)(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
 		    unsigned int count, unsigned int index, int mute,
 		    float mix_vol);
+	void (*add_multi)(snd_pcm_format_t fmt, uint8_t *dst,
+			  const struct cras_mix_src *srcs,
+			  unsigned int num_srcs, unsigned int count);
+	void (*add_ramp)(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
+			 unsigned int frames, unsigned int channels,
+			 unsigned int index, float scaler, float increment,
+			 float target);
 	void (*add_scale_stride)(snd_pcm_format_t fmt, uint8_t *dst,
 				 uint8_t *src, unsigned int count,
 				 unsigned int dst_stride,
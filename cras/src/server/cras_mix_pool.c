@@ -0,0 +1,253 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for pthread_setaffinity_np */
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "cras_config.h"
+#include "cras_mix_pool.h"
+#include "cras_util.h"
+
+/* Pool of workers sharing one batch of jobs at a time.
+ * Members:
+ *    threads - The worker threads.
+ *    num_workers - Number of started worker threads.
+ *    mutex - Protects the members below it, except the two job counters.
+ *    work_cond - Signaled when a new batch is posted or the pool stops.
+ *    done_cond - Signaled when the last busy worker leaves a batch.
+ *    generation - Incremented for every posted batch.
+ *    busy_workers - Number of workers currently processing a batch.
+ *    stopping - Set when the pool is being destroyed.
+ *    fn - Function to call on each job of the current batch.
+ *    jobs - Jobs of the current batch.
+ *    job_size - Size of each job in bytes.
+ *    num_jobs - Number of jobs in the current batch.
+ *    next_job - Index of the next job to claim, atomically incremented.
+ *    jobs_done - Number of completed jobs, atomically incremented.
+ *    worker_generation - Incremented every time worker_fn is posted.
+ *    worker_fn - Function each worker runs once per worker_generation.
+ *    worker_arg - Argument of worker_fn.
+ *    workers_done - Number of workers that ran the current worker_fn.
+ */
+struct cras_mix_pool {
+	pthread_t *threads;
+	unsigned int num_workers;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	unsigned int generation;
+	unsigned int busy_workers;
+	int stopping;
+	cras_mix_pool_job_fn fn;
+	uint8_t *jobs;
+	size_t job_size;
+	unsigned int num_jobs;
+	unsigned int next_job;
+	unsigned int jobs_done;
+	unsigned int worker_generation;
+	cras_mix_pool_job_fn worker_fn;
+	void *worker_arg;
+	unsigned int workers_done;
+};
+
+struct worker_args {
+	struct cras_mix_pool *pool;
+	unsigned int index;
+};
+
+/* Claims and runs jobs from the current batch until none are left. */
+static void run_jobs(struct cras_mix_pool *pool)
+{
+	unsigned int i;
+
+	for (;;) {
+		i = __atomic_fetch_add(&pool->next_job, 1, __ATOMIC_ACQ_REL);
+		if (i >= pool->num_jobs)
+			break;
+		pool->fn(pool->jobs + i * pool->job_size);
+		__atomic_fetch_add(&pool->jobs_done, 1, __ATOMIC_RELEASE);
+	}
+}
+
+static void pin_to_cpu(unsigned int index)
+{
+	long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	cpu_set_t cpus;
+	int rc;
+
+	if (num_cpus <= 1)
+		return;
+
+	/* Leave the first CPU to the audio thread where possible. */
+	CPU_ZERO(&cpus);
+	CPU_SET((index + 1) % num_cpus, &cpus);
+	rc = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	if (rc)
+		syslog(LOG_WARNING, "Failed to pin mix worker %u: %d", index,
+		       rc);
+}
+
+static void *worker_thread(void *arg)
+{
+	struct worker_args *args = (struct worker_args *)arg;
+	struct cras_mix_pool *pool = args->pool;
+	unsigned int seen;
+	/* From 0 so a worker started after a post still runs it. */
+	unsigned int worker_seen = 0;
+
+	pin_to_cpu(args->index);
+	free(args);
+
+	if (cras_set_rt_scheduling(CRAS_SERVER_RT_THREAD_PRIORITY) == 0)
+		cras_set_thread_priority(CRAS_SERVER_RT_THREAD_PRIORITY);
+
+	pthread_mutex_lock(&pool->mutex);
+	seen = pool->generation;
+	for (;;) {
+		while (!pool->stopping && pool->generation == seen &&
+		       pool->worker_generation == worker_seen)
+			pthread_cond_wait(&pool->work_cond, &pool->mutex);
+		if (pool->stopping)
+			break;
+		if (pool->worker_generation != worker_seen) {
+			worker_seen = pool->worker_generation;
+			pthread_mutex_unlock(&pool->mutex);
+			pool->worker_fn(pool->worker_arg);
+			pthread_mutex_lock(&pool->mutex);
+			if (++pool->workers_done == pool->num_workers)
+				pthread_cond_signal(&pool->done_cond);
+			continue;
+		}
+		seen = pool->generation;
+		pool->busy_workers++;
+		pthread_mutex_unlock(&pool->mutex);
+
+		run_jobs(pool);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (--pool->busy_workers == 0)
+			pthread_cond_signal(&pool->done_cond);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	return NULL;
+}
+
+/*
+ * Exported interface
+ */
+
+struct cras_mix_pool *cras_mix_pool_create(unsigned int num_workers)
+{
+	struct cras_mix_pool *pool;
+	struct worker_args *args;
+	unsigned int i;
+	int rc;
+
+	if (num_workers == 0)
+		return NULL;
+
+	pool = (struct cras_mix_pool *)calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+	pool->threads = (pthread_t *)calloc(num_workers, sizeof(pthread_t));
+	if (!pool->threads) {
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+
+	for (i = 0; i < num_workers; i++) {
+		args = (struct worker_args *)malloc(sizeof(*args));
+		if (!args)
+			break;
+		args->pool = pool;
+		args->index = i;
+		rc = pthread_create(&pool->threads[i], NULL, worker_thread,
+				    args);
+		if (rc) {
+			syslog(LOG_ERR, "Failed to start mix worker: %d", rc);
+			free(args);
+			break;
+		}
+		pool->num_workers++;
+	}
+
+	if (pool->num_workers == 0) {
+		cras_mix_pool_destroy(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+void cras_mix_pool_destroy(struct cras_mix_pool *pool)
+{
+	unsigned int i;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stopping = 1;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->num_workers; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->threads);
+	free(pool);
+}
+
+void cras_mix_pool_run(struct cras_mix_pool *pool, cras_mix_pool_job_fn fn,
+		       void *jobs, size_t job_size, unsigned int num_jobs)
+{
+	pthread_mutex_lock(&pool->mutex);
+	pool->fn = fn;
+	pool->jobs = (uint8_t *)jobs;
+	pool->job_size = job_size;
+	pool->num_jobs = num_jobs;
+	pool->next_job = 0;
+	pool->jobs_done = 0;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	/* The caller takes its share of the jobs instead of idling. */
+	run_jobs(pool);
+
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->busy_workers ||
+	       __atomic_load_n(&pool->jobs_done, __ATOMIC_ACQUIRE) < num_jobs)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+void cras_mix_pool_run_on_workers(struct cras_mix_pool *pool,
+				  cras_mix_pool_job_fn fn, void *arg)
+{
+	pthread_mutex_lock(&pool->mutex);
+	pool->worker_fn = fn;
+	pool->worker_arg = arg;
+	pool->workers_done = 0;
+	pool->worker_generation++;
+	pthread_cond_broadcast(&pool->work_cond);
+	while (pool->workers_done < pool->num_workers)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+}
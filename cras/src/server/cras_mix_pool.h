@@ -0,0 +1,59 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * A small pool of real time worker threads used by the audio thread to fan
+ * out per stream work, such as format conversion and resampling, when a
+ * device has many streams attached.
+ */
+
+#ifndef CRAS_MIX_POOL_H_
+#define CRAS_MIX_POOL_H_
+
+#include <stddef.h>
+
+struct cras_mix_pool;
+
+/* Function run for each job handed to the pool.
+ * Args:
+ *    job - Pointer to the job to process.
+ */
+typedef void (*cras_mix_pool_job_fn)(void *job);
+
+/* Creates a pool of worker threads. Each worker is pinned to a CPU and runs
+ * with real time priority when the system allows it.
+ * Args:
+ *    num_workers - Number of worker threads to start.
+ * Returns:
+ *    A pointer to the pool, or NULL on error. Must be freed with
+ *    cras_mix_pool_destroy().
+ */
+struct cras_mix_pool *cras_mix_pool_create(unsigned int num_workers);
+
+/* Stops all workers and frees the pool. */
+void cras_mix_pool_destroy(struct cras_mix_pool *pool);
+
+/* Runs fn on every job in the array, spread over the workers and the calling
+ * thread. Returns after all jobs have completed.
+ * Args:
+ *    pool - The pool to run the jobs on.
+ *    fn - Function to call for each job.
+ *    jobs - Array of jobs.
+ *    job_size - Size in bytes of each element in jobs.
+ *    num_jobs - Number of elements in jobs.
+ */
+void cras_mix_pool_run(struct cras_mix_pool *pool, cras_mix_pool_job_fn fn,
+		       void *jobs, size_t job_size, unsigned int num_jobs);
+
+/* Runs fn once on each worker thread and returns when all of them are done.
+ * Used to set up per thread state of the workers between batches, so the
+ * batches don't have to.
+ * Args:
+ *    pool - The pool whose workers run fn.
+ *    fn - Function to call on each worker.
+ *    arg - Passed to every call of fn.
+ */
+void cras_mix_pool_run_on_workers(struct cras_mix_pool *pool,
+				  cras_mix_pool_job_fn fn, void *arg);
+
+#endif /* CRAS_MIX_POOL_H_ */
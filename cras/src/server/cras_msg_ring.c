@@ -0,0 +1,152 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cras_msg_ring.h"
+
+#define CACHE_LINE_SIZE 64
+
+/* Members:
+ *    slots - Memory of all slots, num_slots * slot_size bytes.
+ *    seqs - Sequence number of each slot. A slot is free for the producer
+ *        that claimed write position p when its sequence is p, and ready for
+ *        the consumer when it is p + 1.
+ *    slot_size - Size of each slot, rounded up to keep slots aligned.
+ *    mask - num_slots - 1, to wrap the counters to a slot index.
+ *    write_count - Next write position, claimed by producers with CAS.
+ *    wake_pending - Set by the first producer after the consumer's last
+ *        wake up, so only that one rings the doorbell.
+ *    dropped - Number of messages dropped because the ring was full.
+ *    read_count - Next position to read. Only touched by the consumer.
+ * Shared counters are kept on their own cache lines so producers and the
+ * consumer don't contend on each other's writes.
+ */
+struct cras_msg_ring {
+	uint8_t *slots;
+	unsigned int *seqs;
+	size_t slot_size;
+	unsigned int mask;
+	unsigned int write_count __attribute__((aligned(CACHE_LINE_SIZE)));
+	int wake_pending __attribute__((aligned(CACHE_LINE_SIZE)));
+	unsigned int dropped;
+	unsigned int read_count __attribute__((aligned(CACHE_LINE_SIZE)));
+};
+
+struct cras_msg_ring *cras_msg_ring_create(size_t slot_size,
+					   unsigned int num_slots)
+{
+	struct cras_msg_ring *ring;
+	unsigned int i;
+
+	if (!slot_size || !num_slots || (num_slots & (num_slots - 1)))
+		return NULL;
+
+	ring = (struct cras_msg_ring *)calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	ring->slot_size = (slot_size + sizeof(void *) - 1) &
+			  ~(sizeof(void *) - 1);
+	ring->mask = num_slots - 1;
+	ring->slots = (uint8_t *)calloc(num_slots, ring->slot_size);
+	ring->seqs = (unsigned int *)calloc(num_slots, sizeof(*ring->seqs));
+	if (!ring->slots || !ring->seqs) {
+		cras_msg_ring_destroy(ring);
+		return NULL;
+	}
+	for (i = 0; i < num_slots; i++)
+		ring->seqs[i] = i;
+
+	return ring;
+}
+
+void cras_msg_ring_destroy(struct cras_msg_ring *ring)
+{
+	if (!ring)
+		return;
+	free(ring->seqs);
+	free(ring->slots);
+	free(ring);
+}
+
+int cras_msg_ring_try_write(struct cras_msg_ring *ring, const void *msg,
+			    size_t len)
+{
+	unsigned int pos, seq;
+	int diff;
+
+	if (len > ring->slot_size)
+		return -EMSGSIZE;
+
+	pos = __atomic_load_n(&ring->write_count, __ATOMIC_RELAXED);
+	for (;;) {
+		seq = __atomic_load_n(&ring->seqs[pos & ring->mask],
+				      __ATOMIC_ACQUIRE);
+		diff = (int)(seq - pos);
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(
+				    &ring->write_count, &pos, pos + 1, 1,
+				    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/* The consumer hasn't released this slot yet. */
+			return -EAGAIN;
+		} else {
+			pos = __atomic_load_n(&ring->write_count,
+					      __ATOMIC_RELAXED);
+		}
+	}
+
+	memcpy(ring->slots + (pos & ring->mask) * ring->slot_size, msg, len);
+	__atomic_store_n(&ring->seqs[pos & ring->mask], pos + 1,
+			 __ATOMIC_RELEASE);
+	return 0;
+}
+
+int cras_msg_ring_write(struct cras_msg_ring *ring, const void *msg,
+			size_t len)
+{
+	int rc = cras_msg_ring_try_write(ring, msg, len);
+
+	if (rc == -EAGAIN)
+		__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+	return rc;
+}
+
+int cras_msg_ring_need_wake(struct cras_msg_ring *ring)
+{
+	return !__atomic_exchange_n(&ring->wake_pending, 1, __ATOMIC_SEQ_CST);
+}
+
+void cras_msg_ring_ack_wake(struct cras_msg_ring *ring)
+{
+	__atomic_store_n(&ring->wake_pending, 0, __ATOMIC_SEQ_CST);
+}
+
+void *cras_msg_ring_read_slot(struct cras_msg_ring *ring)
+{
+	unsigned int seq = __atomic_load_n(
+		&ring->seqs[ring->read_count & ring->mask], __ATOMIC_ACQUIRE);
+
+	if (seq != ring->read_count + 1)
+		return NULL;
+	return ring->slots + (ring->read_count & ring->mask) * ring->slot_size;
+}
+
+void cras_msg_ring_commit_read(struct cras_msg_ring *ring)
+{
+	__atomic_store_n(&ring->seqs[ring->read_count & ring->mask],
+			 ring->read_count + ring->mask + 1, __ATOMIC_RELEASE);
+	ring->read_count++;
+}
+
+unsigned int cras_msg_ring_dropped(const struct cras_msg_ring *ring)
+{
+	return __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,71 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * A bounded lock free ring of fixed size message slots with many producer
+ * threads and one consumer thread. Used to pass messages from the audio
+ * thread and other workers to the main thread without a syscall per message.
+ * Producers never block: a message that doesn't fit is dropped and counted,
+ * unless the producer chooses to retry it.
+ */
+
+#ifndef CRAS_MSG_RING_H_
+#define CRAS_MSG_RING_H_
+
+#include <stddef.h>
+
+struct cras_msg_ring;
+
+/* Creates a message ring.
+ * Args:
+ *    slot_size - Maximum size in bytes of one message.
+ *    num_slots - Number of slots, must be a power of two.
+ * Returns:
+ *    A pointer to the ring, or NULL on error. Must be freed with
+ *    cras_msg_ring_destroy().
+ */
+struct cras_msg_ring *cras_msg_ring_create(size_t slot_size,
+					   unsigned int num_slots);
+
+/* Frees a ring created with cras_msg_ring_create(). */
+void cras_msg_ring_destroy(struct cras_msg_ring *ring);
+
+/* Copies a message into the next free slot. Safe to call from any thread.
+ * Args:
+ *    ring - The ring to write to.
+ *    msg - The message to copy.
+ *    len - Size of the message in bytes.
+ * Returns:
+ *    0 on success, -EMSGSIZE if len is larger than a slot, or -EAGAIN if the
+ *    ring is full, in which case the message is counted as dropped.
+ */
+int cras_msg_ring_write(struct cras_msg_ring *ring, const void *msg,
+			size_t len);
+
+/* Same as cras_msg_ring_write(), except that a full ring doesn't count the
+ * message as dropped. For producers that retry until the message fits. */
+int cras_msg_ring_try_write(struct cras_msg_ring *ring, const void *msg,
+			    size_t len);
+
+/* Called by a producer after a successful write to find out if the consumer
+ * has to be woken up. Only the first producer since the last call to
+ * cras_msg_ring_ack_wake() gets a non-zero return, so wakeups coalesce. */
+int cras_msg_ring_need_wake(struct cras_msg_ring *ring);
+
+/* Called by the consumer when it wakes up, before draining the ring. */
+void cras_msg_ring_ack_wake(struct cras_msg_ring *ring);
+
+/* Gets the oldest message committed by a producer. Consumer only.
+ * Returns:
+ *    A pointer to the message, or NULL if there is none ready.
+ */
+void *cras_msg_ring_read_slot(struct cras_msg_ring *ring);
+
+/* Hands the slot returned by cras_msg_ring_read_slot() back to the
+ * producers. The consumer must not touch the slot after this call. */
+void cras_msg_ring_commit_read(struct cras_msg_ring *ring);
+
+/* Returns the number of messages dropped because the ring was full. */
+unsigned int cras_msg_ring_dropped(const struct cras_msg_ring *ring);
+
+#endif /* CRAS_MSG_RING_H_ */
@@ -28,6 +28,7 @@ struct cras_observer_alerts {
 	struct cras_alert *input_node_gain;
 	struct cras_alert *suspend_changed;
 	struct cras_alert *hotword_triggered;
+	struct cras_alert *hotword_model_loaded;
 	/* If all events for active streams went through a single alert then
          * we might miss some because the alert code does not send every
          * alert message. To ensure that the event sent contains the correct
@@ -87,6 +88,12 @@ struct cras_observer_alert_data_hotword_triggered {
 	int64_t tv_nsec;
 };
 
+struct cras_observer_alert_data_hotword_model_loaded {
+	cras_node_id_t node_id;
+	char model_name[CRAS_MAX_HOTWORD_MODEL_NAME_SIZE + 1];
+	int error;
+};
+
 struct cras_observer_non_empty_audio_state {
 	int non_empty;
 };
@@ -96,6 +103,10 @@ struct cras_observer_alert_data_bt_battery_changed {
 	uint32_t level;
 };
 
+/* Volume and gain notifications are sent at most this often, so dragging a
+ * slider doesn't flood the clients. The last value is always sent. */
+static const unsigned int VOLUME_ALERT_MIN_INTERVAL_MS = 50;
+
 /* Global observer instance. */
 static struct cras_observer_server *g_observer;
 
@@ -287,6 +298,20 @@ static void hotword_triggered_alert(void *arg, void *data)
 	}
 }
 
+static void hotword_model_loaded_alert(void *arg, void *data)
+{
+	struct cras_observer_client *client;
+	struct cras_observer_alert_data_hotword_model_loaded *loaded_data =
+		(struct cras_observer_alert_data_hotword_model_loaded *)data;
+
+	DL_FOREACH (g_observer->clients, client) {
+		if (client->ops.hotword_model_loaded)
+			client->ops.hotword_model_loaded(
+				client->context, loaded_data->node_id,
+				loaded_data->model_name, loaded_data->error);
+	}
+}
+
 static void non_empty_audio_state_changed_alert(void *arg, void *data)
 {
 	struct cras_observer_client *client;
@@ -371,6 +396,8 @@ int cras_observer_server_init()
 	CRAS_OBSERVER_SET_ALERT(input_node_gain, NULL, 0);
 	CRAS_OBSERVER_SET_ALERT(suspend_changed, NULL, 0);
 	CRAS_OBSERVER_SET_ALERT(hotword_triggered, NULL, 0);
+	CRAS_OBSERVER_SET_ALERT(hotword_model_loaded, NULL,
+				CRAS_ALERT_FLAG_KEEP_ALL_DATA);
 	CRAS_OBSERVER_SET_ALERT(non_empty_audio_state_changed, NULL, 0);
 	CRAS_OBSERVER_SET_ALERT(bt_battery_changed, NULL, 0);
 	CRAS_OBSERVER_SET_ALERT(num_input_streams_with_permission, NULL, 0);
@@ -382,6 +409,20 @@ int cras_observer_server_init()
 	CRAS_OBSERVER_SET_ALERT_WITH_DIRECTION(num_active_streams,
 					       CRAS_STREAM_POST_MIX_PRE_DSP);
 
+	cras_alert_set_rate_limit(g_observer->alerts.output_volume,
+				  VOLUME_ALERT_MIN_INTERVAL_MS);
+	cras_alert_set_rate_limit(g_observer->alerts.capture_gain,
+				  VOLUME_ALERT_MIN_INTERVAL_MS);
+	cras_alert_set_rate_limit(g_observer->alerts.output_node_volume,
+				  VOLUME_ALERT_MIN_INTERVAL_MS);
+	cras_alert_set_rate_limit(g_observer->alerts.input_node_gain,
+				  VOLUME_ALERT_MIN_INTERVAL_MS);
+	/* Held back changes of different nodes are all sent. */
+	cras_alert_set_data_key_size(g_observer->alerts.output_node_volume,
+				     sizeof(cras_node_id_t));
+	cras_alert_set_data_key_size(g_observer->alerts.input_node_gain,
+				     sizeof(cras_node_id_t));
+
 	return 0;
 
 error:
@@ -404,6 +445,7 @@ void cras_observer_server_free()
 	cras_alert_destroy(g_observer->alerts.input_node_gain);
 	cras_alert_destroy(g_observer->alerts.suspend_changed);
 	cras_alert_destroy(g_observer->alerts.hotword_triggered);
+	cras_alert_destroy(g_observer->alerts.hotword_model_loaded);
 	cras_alert_destroy(g_observer->alerts.non_empty_audio_state_changed);
 	cras_alert_destroy(g_observer->alerts.bt_battery_changed);
 	cras_alert_destroy(
@@ -610,6 +652,20 @@ void cras_observer_notify_hotword_triggered(int64_t tv_sec, int64_t tv_nsec)
 				sizeof(data));
 }
 
+void cras_observer_notify_hotword_model_loaded(cras_node_id_t node_id,
+					       const char *model_name,
+					       int error)
+{
+	struct cras_observer_alert_data_hotword_model_loaded data;
+
+	memset(&data, 0, sizeof(data));
+	data.node_id = node_id;
+	strncpy(data.model_name, model_name, sizeof(data.model_name) - 1);
+	data.error = error;
+	cras_alert_pending_data(g_observer->alerts.hotword_model_loaded, &data,
+				sizeof(data));
+}
+
 void cras_observer_notify_non_empty_audio_state_changed(int non_empty)
 {
 	struct cras_observer_non_empty_audio_state data;
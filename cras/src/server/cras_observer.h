@@ -99,6 +99,11 @@ void cras_observer_notify_input_streams_with_permission(
 /* Notify observers of the timestamp when hotword triggered. */
 void cras_observer_notify_hotword_triggered(int64_t tv_sec, int64_t tv_nsec);
 
+/* Notify observers that a hotword model load is done. */
+void cras_observer_notify_hotword_model_loaded(cras_node_id_t node_id,
+					       const char *model_name,
+					       int error);
+
 /* Notify observers the non-empty audio state changed. */
 void cras_observer_notify_non_empty_audio_state_changed(int active);
 
@@ -0,0 +1,137 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "cras_dsp.h"
+#include "cras_main_message.h"
+#include "cras_overload.h"
+
+/* Average load, in thousandths, above which the thread is under pressure
+ * and below which it has headroom. */
+#define HIGH_LOAD 700
+#define LOW_LOAD 350
+/* Consecutive wakes under pressure before stepping down a level, and with
+ * headroom before stepping back up. Restoring is slower so the levels don't
+ * flap on a load that hovers around the thresholds. */
+#define WAKES_TO_DEGRADE 50
+#define WAKES_TO_RESTORE 500
+/* The weight of the newest wake in the average is 1/2^LOAD_SHIFT. */
+#define LOAD_SHIFT 3
+
+/* Members:
+ *    level - The current processing level.
+ *    load - Moving average of the load, in thousandths scaled by
+ *        2^LOAD_SHIFT.
+ *    high_wakes - Consecutive wakes with the average over HIGH_LOAD.
+ *    low_wakes - Consecutive wakes with the average under LOW_LOAD.
+ */
+struct cras_overload {
+	enum CRAS_OVERLOAD_LEVEL level;
+	uint64_t load;
+	unsigned int high_wakes;
+	unsigned int low_wakes;
+};
+
+struct cras_overload *cras_overload_create()
+{
+	return (struct cras_overload *)calloc(1, sizeof(struct cras_overload));
+}
+
+void cras_overload_destroy(struct cras_overload *ol)
+{
+	free(ol);
+}
+
+int cras_overload_update(struct cras_overload *ol, uint64_t cpu_ns,
+			 uint64_t wall_ns)
+{
+	uint64_t load;
+
+	if (wall_ns == 0)
+		return 0;
+
+	load = cpu_ns >= wall_ns ? 1000 : cpu_ns * 1000 / wall_ns;
+	ol->load += load - (ol->load >> LOAD_SHIFT);
+	load = ol->load >> LOAD_SHIFT;
+
+	ol->high_wakes = load > HIGH_LOAD ? ol->high_wakes + 1 : 0;
+	ol->low_wakes = load < LOW_LOAD ? ol->low_wakes + 1 : 0;
+
+	if (ol->high_wakes >= WAKES_TO_DEGRADE &&
+	    ol->level < CRAS_OVERLOAD_NUM_LEVELS - 1) {
+		ol->level++;
+		ol->high_wakes = 0;
+		return 1;
+	}
+	if (ol->low_wakes >= WAKES_TO_RESTORE &&
+	    ol->level > CRAS_OVERLOAD_NONE) {
+		ol->level--;
+		ol->low_wakes = 0;
+		return 1;
+	}
+	return 0;
+}
+
+enum CRAS_OVERLOAD_LEVEL
+cras_overload_get_level(const struct cras_overload *ol)
+{
+	return ol->level;
+}
+
+unsigned int cras_overload_get_load(const struct cras_overload *ol)
+{
+	return ol->load >> LOAD_SHIFT;
+}
+
+struct overload_dsp_msg {
+	struct cras_main_message header;
+	int32_t overloaded;
+};
+
+/* The following functions are called from audio thread. */
+
+int cras_overload_send_dsp_msg(int overloaded)
+{
+	struct overload_dsp_msg msg;
+	int rc;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.header.type = CRAS_MAIN_OVERLOAD_DSP;
+	msg.header.length = sizeof(msg);
+	msg.overloaded = overloaded;
+
+	rc = cras_main_message_send((struct cras_main_message *)&msg);
+	if (rc < 0)
+		syslog(LOG_ERR, "Failed to send overload DSP message");
+	return rc;
+}
+
+/* The following functions are called from main thread. */
+
+/* Number of audio threads at CRAS_OVERLOAD_DSP or above. */
+static unsigned int num_overloaded;
+
+static void handle_overload_dsp_message(struct cras_main_message *msg,
+					void *arg)
+{
+	struct overload_dsp_msg *dsp_msg = (struct overload_dsp_msg *)msg;
+
+	if (dsp_msg->overloaded)
+		num_overloaded++;
+	else if (num_overloaded)
+		num_overloaded--;
+	cras_dsp_set_overloaded(num_overloaded > 0);
+}
+
+int cras_overload_handler_init()
+{
+	num_overloaded = 0;
+	cras_main_message_add_handler(CRAS_MAIN_OVERLOAD_DSP,
+				      handle_overload_dsp_message, NULL);
+	return 0;
+}
@@ -0,0 +1,97 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * The overload governor of an audio thread. It watches the share of the
+ * wall time the thread spends on the CPU and, when that stays too high,
+ * steps the processing down one level at a time. Each level keeps the
+ * savings of the ones below it. Once the thread has headroom again for a
+ * while the levels are restored one by one.
+ *
+ * cras_overload_send_dsp_msg() is called from the audio thread when it
+ * enters or leaves CRAS_OVERLOAD_DSP, the main thread then reloads the DSP
+ * pipelines with the "overloaded" variable set accordingly.
+ */
+
+#ifndef CRAS_OVERLOAD_H_
+#define CRAS_OVERLOAD_H_
+
+#include <stdint.h>
+
+#include "cras_types.h"
+
+/* Processing levels, from full quality to the cheapest.
+ * CRAS_OVERLOAD_NONE - Everything runs as configured.
+ * CRAS_OVERLOAD_SRC - Sample rate converters use the shortest filters.
+ * CRAS_OVERLOAD_LINEAR_SRC - Streams that aren't critical resample with
+ *     linear interpolation.
+ * CRAS_OVERLOAD_DSP - DSP plugins disabled by "overloaded" in the ini are
+ *     bypassed.
+ * CRAS_OVERLOAD_APM - Echo cancellation of background capture streams stops
+ *     analyzing the playback.
+ */
+enum CRAS_OVERLOAD_LEVEL {
+	CRAS_OVERLOAD_NONE,
+	CRAS_OVERLOAD_SRC,
+	CRAS_OVERLOAD_LINEAR_SRC,
+	CRAS_OVERLOAD_DSP,
+	CRAS_OVERLOAD_APM,
+	CRAS_OVERLOAD_NUM_LEVELS,
+};
+
+struct cras_overload;
+
+/* Creates a governor at CRAS_OVERLOAD_NONE. Returns NULL on failure. */
+struct cras_overload *cras_overload_create();
+
+/* Destroys a governor created by cras_overload_create(). */
+void cras_overload_destroy(struct cras_overload *ol);
+
+/* Feeds the CPU time of the thread and the wall time passed since the
+ * previous call, in nanoseconds.
+ * Returns:
+ *    1 if the level changed, 0 otherwise.
+ */
+int cras_overload_update(struct cras_overload *ol, uint64_t cpu_ns,
+			 uint64_t wall_ns);
+
+/* Gets the current processing level. */
+enum CRAS_OVERLOAD_LEVEL
+cras_overload_get_level(const struct cras_overload *ol);
+
+/* Gets the average load, in thousandths of the wall time on the CPU. */
+unsigned int cras_overload_get_load(const struct cras_overload *ol);
+
+/* Sends whether the thread entered or left CRAS_OVERLOAD_DSP to the main
+ * thread. Called from the audio thread. */
+int cras_overload_send_dsp_msg(int overloaded);
+
+/* Initializes the handler of the DSP messages in the main thread. */
+int cras_overload_handler_init();
+
+/* Checks if a stream of type is kept at its quality whatever the load. Voice
+ * calls and speech recognition suffer from the artifacts of linear
+ * interpolation, pro audio clients ask for the best explicitly. */
+static inline int cras_overload_stream_is_critical(enum CRAS_STREAM_TYPE type)
+{
+	return type == CRAS_STREAM_TYPE_VOICE_COMMUNICATION ||
+	       type == CRAS_STREAM_TYPE_SPEECH_RECOGNITION ||
+	       type == CRAS_STREAM_TYPE_PRO_AUDIO;
+}
+
+/* Gets the sample rate converter quality to use at level for a stream of
+ * type asking for quality. */
+static inline enum CRAS_SRC_QUALITY
+cras_overload_src_quality(enum CRAS_OVERLOAD_LEVEL level,
+			  enum CRAS_STREAM_TYPE type,
+			  enum CRAS_SRC_QUALITY quality)
+{
+	if (level >= CRAS_OVERLOAD_LINEAR_SRC &&
+	    !cras_overload_stream_is_critical(type))
+		return CRAS_SRC_QUALITY_LINEAR;
+	if (level >= CRAS_OVERLOAD_SRC)
+		return CRAS_SRC_QUALITY_LOW_LATENCY;
+	return quality;
+}
+
+#endif /* CRAS_OVERLOAD_H_ */
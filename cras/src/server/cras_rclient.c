@@ -20,6 +20,7 @@
 #include "cras_observer.h"
 #include "cras_playback_rclient.h"
 #include "cras_rclient.h"
+#include "cras_rclient_util.h"
 #include "cras_rstream.h"
 #include "cras_server_metrics.h"
 #include "cras_system_state.h"
@@ -59,6 +60,16 @@ int cras_rclient_send_message(const struct cras_rclient *client,
 	return client->ops->send_message_to_client(client, msg, fds, num_fds);
 }
 
+int cras_rclient_hold_messages(struct cras_rclient *client)
+{
+	return rclient_hold_messages(client);
+}
+
+int cras_rclient_flush_messages(struct cras_rclient *client)
+{
+	return rclient_flush_messages(client);
+}
+
 static void cras_rclient_set_client_type(struct cras_rclient *client,
 					 enum CRAS_CLIENT_TYPE client_type)
 {
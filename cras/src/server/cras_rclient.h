@@ -9,12 +9,40 @@
 #ifndef CRAS_RCLIENT_H_
 #define CRAS_RCLIENT_H_
 
+#include <time.h>
+
 #include "cras_types.h"
 
 struct cras_client_message;
 struct cras_message;
 struct cras_server_message;
 
+/* Classes of control messages, each limited to a rate per client so that one
+ * client can't keep the main thread busy. See rclient_allow_message.
+ *  RCLIENT_MSG_NODE - Node selection and attributes.
+ *  RCLIENT_MSG_DUMP - Debug dumps, answered with the last dump when limited.
+ *  RCLIENT_MSG_RELOAD - DSP and AEC config reloads and the DSP dump.
+ *  RCLIENT_MSG_UNLIMITED - Everything else.
+ */
+enum RCLIENT_MSG_CLASS {
+	RCLIENT_MSG_NODE,
+	RCLIENT_MSG_DUMP,
+	RCLIENT_MSG_RELOAD,
+	RCLIENT_NUM_MSG_CLASSES,
+	RCLIENT_MSG_UNLIMITED = RCLIENT_NUM_MSG_CLASSES,
+};
+
+/* A token bucket limiting the rate of a class of messages.
+ *  tokens - Messages allowed right now, refilled over time up to a burst.
+ *  last - When tokens was last refilled.
+ *  limited - Set while messages are refused, to log once.
+ */
+struct rclient_bucket {
+	float tokens;
+	struct timespec last;
+	int limited;
+};
+
 /* An attached client.
  *  id - The id of the client.
  *  fd - Connection for client communication.
@@ -23,6 +51,9 @@ struct cras_server_message;
  *  client_type - Client type of this rclient. If this is set to value other
  *                than CRAS_CLIENT_TYPE_UNKNOWN, rclient will overwrite incoming
  *                messages' client type.
+ *  out_queue - Messages held back until the next flush, NULL if messages are
+ *              sent as soon as they are generated.
+ *  buckets - Rate limits of the message classes.
  */
 struct cras_rclient {
 	struct cras_observer_client *observer;
@@ -31,6 +62,8 @@ struct cras_rclient {
 	const struct cras_rclient_ops *ops;
 	int supported_directions;
 	enum CRAS_CLIENT_TYPE client_type;
+	struct rclient_out_queue *out_queue;
+	struct rclient_bucket buckets[RCLIENT_NUM_MSG_CLASSES];
 };
 
 /* Operations for cras_rclient.
@@ -95,4 +128,22 @@ int cras_rclient_send_message(const struct cras_rclient *client,
 			      const struct cras_client_message *msg, int *fds,
 			      unsigned int num_fds);
 
+/* Holds messages without file descriptors sent to the client from now on, so
+ * that they can be written together by cras_rclient_flush_messages. Messages
+ * carrying file descriptors flush the held ones and are sent right away.
+ * Args:
+ *    client - The client to hold messages for.
+ * Returns:
+ *    0 on success, otherwise a negative error code.
+ */
+int cras_rclient_hold_messages(struct cras_rclient *client);
+
+/* Sends all the messages held for the client.
+ * Args:
+ *    client - The client to flush.
+ * Returns:
+ *    0 on success, otherwise a negative error code.
+ */
+int cras_rclient_flush_messages(struct cras_rclient *client);
+
 #endif /* CRAS_RCLIENT_H_ */
@@ -3,6 +3,7 @@
  * found in the LICENSE file.
  */
 
+#include <string.h>
 #include <syslog.h>
 
 #include "cras_iodev_list.h"
@@ -12,25 +13,159 @@
 #include "cras_rclient_util.h"
 #include "cras_rstream.h"
 #include "cras_server_metrics.h"
+#include "cras_shm_pool.h"
 #include "cras_system_state.h"
 #include "cras_tm.h"
 #include "cras_types.h"
 #include "cras_util.h"
 #include "stream_list.h"
 
+/* Most messages held in one batch, a full queue is flushed early. */
+#define RCLIENT_MAX_HELD_MSGS 32
+
+/* The burst and the sustained rate per second allowed in each message class.
+ * Node changes follow sliders dragged in the UI, dumps and reloads come from
+ * people debugging. */
+static const struct {
+	float burst;
+	float per_sec;
+} msg_class_limits[RCLIENT_NUM_MSG_CLASSES] = {
+	[RCLIENT_MSG_NODE] = { 64, 100 },
+	[RCLIENT_MSG_DUMP] = { 4, 1 },
+	[RCLIENT_MSG_RELOAD] = { 2, 0.5 },
+};
+
+/* Messages waiting to be sent to a client.
+ *  buf - Storage for the held messages, packed back to back.
+ *  used - Bytes of buf in use.
+ *  num_msgs - Number of messages held.
+ *  msgs - Location of each held message in buf.
+ */
+struct rclient_out_queue {
+	uint8_t buf[RCLIENT_MAX_HELD_MSGS * CRAS_CLIENT_MAX_MSG_SIZE];
+	size_t used;
+	unsigned int num_msgs;
+	struct iovec msgs[RCLIENT_MAX_HELD_MSGS];
+};
+
+enum RCLIENT_MSG_CLASS rclient_message_class(enum CRAS_SERVER_MESSAGE_ID id)
+{
+	switch (id) {
+	case CRAS_SERVER_SET_NODE_ATTR:
+	case CRAS_SERVER_SELECT_NODE:
+	case CRAS_SERVER_ADD_ACTIVE_NODE:
+	case CRAS_SERVER_RM_ACTIVE_NODE:
+		return RCLIENT_MSG_NODE;
+	case CRAS_SERVER_DUMP_AUDIO_THREAD:
+	case CRAS_SERVER_DUMP_MAIN:
+	case CRAS_SERVER_DUMP_BT:
+	case CRAS_SERVER_DUMP_SNAPSHOTS:
+		return RCLIENT_MSG_DUMP;
+	case CRAS_SERVER_RELOAD_DSP:
+	case CRAS_SERVER_DUMP_DSP_INFO:
+	case CRAS_SERVER_RELOAD_AEC_CONFIG:
+		return RCLIENT_MSG_RELOAD;
+	default:
+		return RCLIENT_MSG_UNLIMITED;
+	}
+}
+
+int rclient_allow_message(struct cras_rclient *client,
+			  enum RCLIENT_MSG_CLASS msg_class)
+{
+	struct rclient_bucket *bucket;
+	struct timespec now, elapsed;
+	float burst, tokens;
+
+	if (msg_class >= RCLIENT_NUM_MSG_CLASSES)
+		return 1;
+
+	/* A new bucket was last refilled at time zero, so it starts full. */
+	bucket = &client->buckets[msg_class];
+	burst = msg_class_limits[msg_class].burst;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	subtract_timespecs(&now, &bucket->last, &elapsed);
+	tokens = bucket->tokens +
+		 (elapsed.tv_sec + elapsed.tv_nsec / 1000000000.0f) *
+			 msg_class_limits[msg_class].per_sec;
+	bucket->tokens = tokens < burst ? tokens : burst;
+	bucket->last = now;
+
+	if (bucket->tokens < 1.0f) {
+		if (!bucket->limited)
+			syslog(LOG_WARNING,
+			       "Client %zu over the rate of message class %d",
+			       client->id, msg_class);
+		bucket->limited = 1;
+		return 0;
+	}
+	bucket->tokens -= 1.0f;
+	bucket->limited = 0;
+	return 1;
+}
+
+int rclient_hold_messages(struct cras_rclient *client)
+{
+	if (client->out_queue)
+		return 0;
+	client->out_queue = (struct rclient_out_queue *)calloc(
+		1, sizeof(*client->out_queue));
+	if (!client->out_queue)
+		return -ENOMEM;
+	return 0;
+}
+
+int rclient_flush_messages(const struct cras_rclient *client)
+{
+	struct rclient_out_queue *queue = client->out_queue;
+	int rc;
+
+	if (!queue || !queue->num_msgs)
+		return 0;
+
+	rc = cras_send_messages(client->fd, queue->msgs, queue->num_msgs);
+	if (rc >= 0 && (unsigned int)rc < queue->num_msgs)
+		syslog(LOG_ERR, "Dropped %u messages to client %zu",
+		       queue->num_msgs - rc, client->id);
+	queue->used = 0;
+	queue->num_msgs = 0;
+	return rc < 0 ? rc : 0;
+}
+
 int rclient_send_message_to_client(const struct cras_rclient *client,
 				   const struct cras_client_message *msg,
 				   int *fds, unsigned int num_fds)
 {
-	return cras_send_with_fds(client->fd, (const void *)msg, msg->length,
-				  fds, num_fds);
+	struct rclient_out_queue *queue = client->out_queue;
+	struct iovec *iov;
+
+	/* Messages with fds are usually replies the client is waiting for,
+	 * send them now but keep the order with the held ones. */
+	if (!queue || num_fds || msg->length > sizeof(queue->buf)) {
+		rclient_flush_messages(client);
+		return cras_send_with_fds(client->fd, (const void *)msg,
+					  msg->length, fds, num_fds);
+	}
+
+	if (queue->num_msgs == RCLIENT_MAX_HELD_MSGS ||
+	    queue->used + msg->length > sizeof(queue->buf))
+		rclient_flush_messages(client);
+
+	iov = &queue->msgs[queue->num_msgs++];
+	iov->iov_base = queue->buf + queue->used;
+	iov->iov_len = msg->length;
+	memcpy(iov->iov_base, msg, msg->length);
+	queue->used += msg->length;
+	return msg->length;
 }
 
 void rclient_destroy(struct cras_rclient *client)
 {
+	free(client->out_queue);
 	cras_observer_remove(client->observer);
 	stream_list_rm_all_client_streams(cras_iodev_list_get_stream_list(),
 					  client);
+	cras_shm_pool_remove_client(client->id);
 	free(client);
 }
 
@@ -42,6 +177,10 @@ int rclient_validate_message_fds(const struct cras_server_message *msg,
 		if (num_fds > 2)
 			goto error;
 		break;
+	case CRAS_SERVER_CONNECT_STREAMS:
+		if (num_fds > CRAS_MAX_BATCH_STREAMS)
+			goto error;
+		break;
 	case CRAS_SERVER_SET_AEC_DUMP:
 		if (num_fds > 1)
 			goto error;
@@ -242,6 +381,94 @@ int rclient_handle_client_stream_disconnect(
 			      msg->stream_id);
 }
 
+int rclient_handle_client_streams_connect(
+	struct cras_rclient *client,
+	const struct cras_connect_streams_message *msg, int *fds,
+	unsigned int num_fds)
+{
+	const struct cras_connect_message *stream;
+	unsigned int i;
+
+	if (msg->header.length < CRAS_CONNECT_STREAMS_MESSAGE_SIZE(0) ||
+	    msg->num_streams > CRAS_MAX_BATCH_STREAMS ||
+	    msg->header.length !=
+		    CRAS_CONNECT_STREAMS_MESSAGE_SIZE(msg->num_streams) ||
+	    num_fds != msg->num_streams)
+		goto invalid;
+	for (i = 0; i < msg->num_streams; i++) {
+		stream = &msg->streams[i];
+		if (stream->header.id != CRAS_SERVER_CONNECT_STREAM ||
+		    stream->header.length != sizeof(*stream))
+			goto invalid;
+	}
+
+	cras_iodev_list_begin_stream_batch();
+	for (i = 0; i < msg->num_streams; i++)
+		rclient_handle_client_stream_connect(client, &msg->streams[i],
+						     fds[i], -1);
+	cras_iodev_list_end_stream_batch();
+	return 0;
+
+invalid:
+	syslog(LOG_ERR, "stream_connect: malformed batch of streams.\n");
+	for (i = 0; i < num_fds; i++)
+		if (fds[i] >= 0)
+			close(fds[i]);
+	return -EINVAL;
+}
+
+int rclient_handle_client_streams_disconnect(
+	struct cras_rclient *client,
+	const struct cras_disconnect_streams_message *msg)
+{
+	struct cras_disconnect_stream_message stream_msg;
+	unsigned int i;
+	int rc, ret = 0;
+
+	if (msg->num_streams > CRAS_MAX_BATCH_STREAMS)
+		return -EINVAL;
+
+	for (i = 0; i < msg->num_streams; i++) {
+		cras_fill_disconnect_stream_message(&stream_msg,
+						    msg->stream_ids[i]);
+		rc = rclient_handle_client_stream_disconnect(client,
+							     &stream_msg);
+		if (rc && !ret)
+			ret = rc;
+	}
+	return ret;
+}
+
+int rclient_handle_client_stream_effects(
+	struct cras_rclient *client,
+	const struct cras_set_stream_effects_message *msg)
+{
+	if (!cras_valid_stream_id(msg->stream_id, client->id)) {
+		syslog(LOG_ERR,
+		       "stream_effects: invalid stream_id: %x for "
+		       "client: %zx.\n",
+		       msg->stream_id, client->id);
+		return -EINVAL;
+	}
+	return cras_iodev_list_set_stream_effects(msg->stream_id,
+						  msg->effects);
+}
+
+int rclient_handle_client_stream_paused(
+	struct cras_rclient *client,
+	const struct cras_set_stream_paused_message *msg)
+{
+	if (!cras_valid_stream_id(msg->stream_id, client->id)) {
+		syslog(LOG_ERR,
+		       "stream_paused: invalid stream_id: %x for "
+		       "client: %zx.\n",
+		       msg->stream_id, client->id);
+		return -EINVAL;
+	}
+	return cras_iodev_list_set_stream_paused(msg->stream_id, msg->paused,
+						 msg->fade_in_ms);
+}
+
 /* Creates a client structure and sends a message back informing the client that
  * the connection has succeeded. */
 struct cras_rclient *rclient_generic_create(int fd, size_t id,
@@ -289,7 +516,8 @@ int rclient_handle_message_from_client(struct cras_rclient *client,
 	switch (msg->id) {
 	case CRAS_SERVER_CONNECT_STREAM: {
 		int client_shm_fd = num_fds > 1 ? fds[1] : -1;
-		if (MSG_LEN_VALID(msg, struct cras_connect_message)) {
+		/* Older clients send the message without num_shm_buffers. */
+		if (msg->length >= CRAS_CONNECT_MESSAGE_V7_SIZE) {
 			rclient_handle_client_stream_connect(
 				client,
 				(const struct cras_connect_message *)msg, fd,
@@ -306,6 +534,32 @@ int rclient_handle_message_from_client(struct cras_rclient *client,
 			client,
 			(const struct cras_disconnect_stream_message *)msg);
 		break;
+	case CRAS_SERVER_CONNECT_STREAMS:
+		return rclient_handle_client_streams_connect(
+			client,
+			(const struct cras_connect_streams_message *)msg, fds,
+			num_fds);
+	case CRAS_SERVER_DISCONNECT_STREAMS:
+		if (!MSG_LEN_VALID(msg, struct cras_disconnect_streams_message))
+			return -EINVAL;
+		rclient_handle_client_streams_disconnect(
+			client,
+			(const struct cras_disconnect_streams_message *)msg);
+		break;
+	case CRAS_SERVER_SET_STREAM_EFFECTS:
+		if (!MSG_LEN_VALID(msg, struct cras_set_stream_effects_message))
+			return -EINVAL;
+		rclient_handle_client_stream_effects(
+			client,
+			(const struct cras_set_stream_effects_message *)msg);
+		break;
+	case CRAS_SERVER_SET_STREAM_PAUSED:
+		if (!MSG_LEN_VALID(msg, struct cras_set_stream_paused_message))
+			return -EINVAL;
+		rclient_handle_client_stream_paused(
+			client,
+			(const struct cras_set_stream_paused_message *)msg);
+		break;
 	default:
 		break;
 	}
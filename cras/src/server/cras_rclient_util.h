@@ -22,9 +22,31 @@ int rclient_send_message_to_client(const struct cras_rclient *client,
 				   const struct cras_client_message *msg,
 				   int *fds, unsigned int num_fds);
 
+/* Starts holding messages for the client, see cras_rclient_hold_messages. */
+int rclient_hold_messages(struct cras_rclient *client);
+
+/* Sends the messages held for the client in one batch. */
+int rclient_flush_messages(const struct cras_rclient *client);
+
 /* Removes all streams that the client owns and destroys it. */
 void rclient_destroy(struct cras_rclient *client);
 
+/* Returns the class a message is rate limited in. */
+enum RCLIENT_MSG_CLASS rclient_message_class(enum CRAS_SERVER_MESSAGE_ID id);
+
+/* Takes a token from the bucket of a message class, refilled at the rate of
+ * the class since the last message.
+ *
+ * Args:
+ *   client - The cras_rclient which gets the message.
+ *   msg_class - The class of the message.
+ *
+ * Returns:
+ *   1 if the message can be handled, 0 if the client is over the limit.
+ */
+int rclient_allow_message(struct cras_rclient *client,
+			  enum RCLIENT_MSG_CLASS msg_class);
+
 /* Checks if the number of incoming fds matches the needs of the message from
  * client.
  *
@@ -86,6 +108,66 @@ int rclient_handle_client_stream_disconnect(
 	struct cras_rclient *client,
 	const struct cras_disconnect_stream_message *msg);
 
+/* Handles a message from the client to connect several streams at once. The
+ * streams are attached to the audio thread together once all of them are
+ * added, and each one gets its own stream connected reply.
+ *
+ * Args:
+ *   client - The cras_rclient which gets the message.
+ *   msg - The cras_connect_streams_message from client.
+ *   fds - The audio fds of the streams, in order. Their ownership is taken.
+ *   num_fds - The number of fds, must match the number of streams.
+ *
+ * Returns:
+ *   0 if the message is well formed, negative error otherwise. Failures of
+ *   single streams are sent to the client in their replies.
+ */
+int rclient_handle_client_streams_connect(
+	struct cras_rclient *client,
+	const struct cras_connect_streams_message *msg, int *fds,
+	unsigned int num_fds);
+
+/* Handles messages from the client requesting that several streams be
+ * removed from the server.
+ *
+ * Args:
+ *   client - The cras_rclient which gets the message.
+ *   msg - The cras_disconnect_streams_message from client.
+ *
+ * Returns:
+ *   0 on success, the first error if any of the streams fails to be removed.
+ */
+int rclient_handle_client_streams_disconnect(
+	struct cras_rclient *client,
+	const struct cras_disconnect_streams_message *msg);
+
+/* Handles messages from the client changing the effects of a running
+ * input stream.
+ *
+ * Args:
+ *   client - The cras_rclient which gets the message.
+ *   msg - The cras_set_stream_effects_message from client.
+ *
+ * Returns:
+ *   0 on success, negative error on failure.
+ */
+int rclient_handle_client_stream_effects(
+	struct cras_rclient *client,
+	const struct cras_set_stream_effects_message *msg);
+
+/* Handles messages from the client pausing or resuming a stream.
+ *
+ * Args:
+ *   client - The cras_rclient which gets the message.
+ *   msg - The cras_set_stream_paused_message from client.
+ *
+ * Returns:
+ *   0 on success, negative error on failure.
+ */
+int rclient_handle_client_stream_paused(
+	struct cras_rclient *client,
+	const struct cras_set_stream_paused_message *msg);
+
 /* Generic rclient create function for different types of rclients.
  * Creates a client structure and sends a message back informing the client
  * that the connection has succeeded.
@@ -103,7 +185,8 @@ struct cras_rclient *rclient_generic_create(int fd, size_t id,
 					    int supported_directions);
 
 /* Generic handle_message_from_client function for different types of rlicnets.
- * Supports only stream connect and stream disconnect messages.
+ * Supports only stream connect and stream disconnect messages, single or
+ * batched.
  *
  * If the message from clients has incorrect length (truncated message), return
  * an error up to CRAS server.
@@ -0,0 +1,123 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "cras_ref_ring.h"
+
+/* Members:
+ *    buf - Storage of the ring, max_size bytes.
+ *    max_size - Size of buf.
+ *    frame_bytes - Size of the frames written last.
+ *    num_frames - Number of whole frames of frame_bytes that fit in buf.
+ *    valid_frames - Number of frames in the ring that can still be read.
+ *    write_pos - Total number of frames written. The frame at offset n is
+ *        stored in slot n % num_frames.
+ */
+struct cras_ref_ring {
+	uint8_t *buf;
+	size_t max_size;
+	unsigned int frame_bytes;
+	unsigned int num_frames;
+	unsigned int valid_frames;
+	uint64_t write_pos;
+};
+
+struct cras_ref_ring *cras_ref_ring_create(size_t max_size)
+{
+	struct cras_ref_ring *ring;
+
+	if (!max_size)
+		return NULL;
+
+	ring = (struct cras_ref_ring *)calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	ring->buf = (uint8_t *)malloc(max_size);
+	if (!ring->buf) {
+		free(ring);
+		return NULL;
+	}
+	ring->max_size = max_size;
+
+	return ring;
+}
+
+void cras_ref_ring_destroy(struct cras_ref_ring *ring)
+{
+	if (!ring)
+		return;
+	free(ring->buf);
+	free(ring);
+}
+
+void cras_ref_ring_write(struct cras_ref_ring *ring, const uint8_t *frames,
+			 unsigned int nframes, unsigned int frame_bytes)
+{
+	unsigned int slot, to_copy;
+
+	if (!frame_bytes || frame_bytes > ring->max_size)
+		return;
+
+	if (frame_bytes != ring->frame_bytes) {
+		ring->frame_bytes = frame_bytes;
+		ring->num_frames = ring->max_size / frame_bytes;
+		ring->valid_frames = 0;
+	}
+
+	/* Only the latest num_frames frames can be kept. */
+	if (nframes > ring->num_frames) {
+		ring->write_pos += nframes - ring->num_frames;
+		frames += (nframes - ring->num_frames) * frame_bytes;
+		nframes = ring->num_frames;
+	}
+
+	ring->valid_frames = MIN(ring->valid_frames + nframes,
+				 ring->num_frames);
+	while (nframes) {
+		slot = ring->write_pos % ring->num_frames;
+		to_copy = MIN(nframes, ring->num_frames - slot);
+		memcpy(ring->buf + slot * frame_bytes, frames,
+		       to_copy * frame_bytes);
+		frames += to_copy * frame_bytes;
+		nframes -= to_copy;
+		ring->write_pos += to_copy;
+	}
+}
+
+uint64_t cras_ref_ring_write_pos(const struct cras_ref_ring *ring)
+{
+	return ring->write_pos;
+}
+
+unsigned int cras_ref_ring_readable(const struct cras_ref_ring *ring,
+				    uint64_t *offset)
+{
+	uint64_t oldest = ring->write_pos - ring->valid_frames;
+
+	if (*offset < oldest || *offset > ring->write_pos)
+		*offset = oldest;
+	return ring->write_pos - *offset;
+}
+
+const uint8_t *cras_ref_ring_read_pointer(const struct cras_ref_ring *ring,
+					  uint64_t offset,
+					  unsigned int *frames)
+{
+	unsigned int slot;
+
+	if (!ring->num_frames) {
+		*frames = 0;
+		return ring->buf;
+	}
+
+	slot = offset % ring->num_frames;
+	*frames = MIN(*frames, ring->num_frames - slot);
+	*frames = MIN(*frames, ring->write_pos - offset);
+	return ring->buf + slot * ring->frame_bytes;
+}
@@ -0,0 +1,72 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * A ring of the latest frames played by an output device, written once by
+ * the device and read in place by any number of consumers. Each consumer
+ * keeps its own read offset, counted in frames since the ring was created,
+ * so adding a consumer costs no extra copy of the output. The writer never
+ * waits for readers, a reader that falls behind loses the oldest frames.
+ * The writer and all readers must run on the same thread.
+ */
+
+#ifndef CRAS_REF_RING_H_
+#define CRAS_REF_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct cras_ref_ring;
+
+/* Creates a reference ring.
+ * Args:
+ *    max_size - Size in bytes of the ring storage.
+ * Returns:
+ *    A pointer to the ring, or NULL on error. Must be freed with
+ *    cras_ref_ring_destroy().
+ */
+struct cras_ref_ring *cras_ref_ring_create(size_t max_size);
+
+/* Frees a ring created with cras_ref_ring_create(). */
+void cras_ref_ring_destroy(struct cras_ref_ring *ring);
+
+/* Appends frames to the ring, overwriting the oldest ones if needed.
+ * Args:
+ *    ring - The ring to write to.
+ *    frames - The frames to append.
+ *    nframes - Number of frames to append.
+ *    frame_bytes - Size of one frame. When it differs from the previous
+ *        write, the frames already in the ring are discarded.
+ */
+void cras_ref_ring_write(struct cras_ref_ring *ring, const uint8_t *frames,
+			 unsigned int nframes, unsigned int frame_bytes);
+
+/* Returns the offset of the next frame to be written. A new reader starts
+ * here to get only frames written from now on. */
+uint64_t cras_ref_ring_write_pos(const struct cras_ref_ring *ring);
+
+/* Gets the number of frames a reader can read.
+ * Args:
+ *    ring - The ring to read from.
+ *    offset - The reader's offset. Moved forward to the oldest frame still
+ *        in the ring if the frames at it were overwritten.
+ * Returns:
+ *    Number of frames written after |offset|.
+ */
+unsigned int cras_ref_ring_readable(const struct cras_ref_ring *ring,
+				    uint64_t *offset);
+
+/* Gets the frames at a reader's offset, in place.
+ * Args:
+ *    ring - The ring to read from.
+ *    offset - The reader's offset, as updated by cras_ref_ring_readable().
+ *    frames - In: the maximum number of frames wanted. Out: the number of
+ *        written frames stored contiguously at the returned pointer.
+ * Returns:
+ *    A pointer to the frame at |offset|.
+ */
+const uint8_t *cras_ref_ring_read_pointer(const struct cras_ref_ring *ring,
+					  uint64_t offset,
+					  unsigned int *frames);
+
+#endif /* CRAS_REF_RING_H_ */
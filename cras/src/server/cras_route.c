@@ -0,0 +1,179 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "cras_route.h"
+
+/* Room for this many blocks besides the latency, so the jitter of the two
+ * audio threads doesn't overrun the ring. */
+static const unsigned int ROUTE_SLACK_BLOCKS = 4;
+
+/* Members:
+ *    id - The id of the route.
+ *    refs - References held, by the owner and by each stream of the route.
+ *    frame_bytes - Size of a frame in the format of the route.
+ *    latency_frames - Frames queued before playback starts.
+ *    block_frames - The most frames written or read at once.
+ *    buf - Storage of the ring.
+ *    num_frames - Number of frames buf holds.
+ *    write_pos - Total frames written, stored only by the writer.
+ *    read_pos - Total frames read or skipped, stored only by the reader.
+ *    playing - Set by the reader once latency_frames are queued, cleared
+ *        when the route runs dry.
+ *    num_underruns - Times the route ran dry while playing.
+ *    num_overruns - Times written frames didn't fit.
+ */
+struct cras_route {
+	unsigned int id;
+	unsigned int refs;
+	unsigned int frame_bytes;
+	unsigned int latency_frames;
+	unsigned int block_frames;
+	uint8_t *buf;
+	unsigned int num_frames;
+	uint64_t write_pos;
+	uint64_t read_pos;
+	int playing;
+	unsigned int num_underruns;
+	unsigned int num_overruns;
+};
+
+struct cras_route *cras_route_create(unsigned int id,
+				     const struct cras_audio_format *fmt,
+				     unsigned int latency_frames,
+				     unsigned int block_frames)
+{
+	struct cras_route *route;
+
+	if (!block_frames)
+		return NULL;
+
+	route = (struct cras_route *)calloc(1, sizeof(*route));
+	if (!route)
+		return NULL;
+
+	route->id = id;
+	route->refs = 1;
+	route->frame_bytes = cras_get_format_bytes(fmt);
+	route->latency_frames = latency_frames;
+	route->block_frames = block_frames;
+	route->num_frames = latency_frames + ROUTE_SLACK_BLOCKS * block_frames;
+	route->buf = (uint8_t *)calloc(route->num_frames, route->frame_bytes);
+	if (!route->buf) {
+		free(route);
+		return NULL;
+	}
+
+	return route;
+}
+
+void cras_route_get(struct cras_route *route)
+{
+	route->refs++;
+}
+
+void cras_route_put(struct cras_route *route)
+{
+	if (--route->refs)
+		return;
+	free(route->buf);
+	free(route);
+}
+
+unsigned int cras_route_id(const struct cras_route *route)
+{
+	return route->id;
+}
+
+unsigned int cras_route_write(struct cras_route *route, const uint8_t *frames,
+			      unsigned int nframes)
+{
+	uint64_t read_pos = __atomic_load_n(&route->read_pos, __ATOMIC_ACQUIRE);
+	uint64_t write_pos = route->write_pos;
+	unsigned int avail, slot, n, done = 0;
+
+	avail = route->num_frames - (unsigned int)(write_pos - read_pos);
+	if (nframes > avail) {
+		route->num_overruns++;
+		nframes = avail;
+	}
+
+	while (done < nframes) {
+		slot = (write_pos + done) % route->num_frames;
+		n = MIN(nframes - done, route->num_frames - slot);
+		memcpy(route->buf + slot * route->frame_bytes,
+		       frames + done * route->frame_bytes,
+		       n * route->frame_bytes);
+		done += n;
+	}
+
+	/* Publishes the frames to the reader. */
+	__atomic_store_n(&route->write_pos, write_pos + nframes,
+			 __ATOMIC_RELEASE);
+	return nframes;
+}
+
+unsigned int cras_route_read(struct cras_route *route, uint8_t *dst,
+			     unsigned int nframes)
+{
+	uint64_t write_pos =
+		__atomic_load_n(&route->write_pos, __ATOMIC_ACQUIRE);
+	uint64_t read_pos = route->read_pos;
+	unsigned int queued = write_pos - read_pos;
+	unsigned int avail, slot, n, done = 0;
+
+	if (!route->playing) {
+		if (queued < route->latency_frames) {
+			memset(dst, 0, nframes * route->frame_bytes);
+			return 0;
+		}
+		route->playing = 1;
+	}
+
+	/* A capture clock faster than the playback one builds up latency,
+	 * drop the oldest frames to get back to what was asked for. */
+	if (queued > route->latency_frames + 2 * route->block_frames) {
+		read_pos += queued - route->latency_frames;
+		queued = route->latency_frames;
+	}
+
+	avail = MIN(nframes, queued);
+	while (done < avail) {
+		slot = (read_pos + done) % route->num_frames;
+		n = MIN(avail - done, route->num_frames - slot);
+		memcpy(dst + done * route->frame_bytes,
+		       route->buf + slot * route->frame_bytes,
+		       n * route->frame_bytes);
+		done += n;
+	}
+	if (done < nframes) {
+		memset(dst + done * route->frame_bytes, 0,
+		       (nframes - done) * route->frame_bytes);
+		route->num_underruns++;
+		route->playing = 0;
+	}
+
+	__atomic_store_n(&route->read_pos, read_pos + done, __ATOMIC_RELEASE);
+	return done;
+}
+
+unsigned int cras_route_queued(const struct cras_route *route)
+{
+	return __atomic_load_n(&route->write_pos, __ATOMIC_ACQUIRE) -
+	       __atomic_load_n(&route->read_pos, __ATOMIC_ACQUIRE);
+}
+
+unsigned int cras_route_num_underruns(const struct cras_route *route)
+{
+	return route->num_underruns;
+}
+
+unsigned int cras_route_num_overruns(const struct cras_route *route)
+{
+	return route->num_overruns;
+}
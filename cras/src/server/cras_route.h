@@ -0,0 +1,85 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * A route plays what an input device captures on an output device without a
+ * client in between. It joins a server only input stream, which captures in
+ * the format of the route, to a server only output stream playing that
+ * format. The input stream writes each block it captures into the ring of
+ * the route, and the output stream fills its shm from the ring when the
+ * audio thread fetches it, all inside the audio threads. With the route in
+ * the format of the output device the frames are converted once.
+ *
+ * The two sides may run on different audio threads: the ring has one writer,
+ * the input side, and one reader, the output side. The reader holds playback
+ * until latency_frames are queued, and plays silence to fill up again after
+ * running dry.
+ */
+
+#ifndef CRAS_ROUTE_H_
+#define CRAS_ROUTE_H_
+
+#include <stdint.h>
+
+#include "cras_audio_format.h"
+
+struct cras_route;
+
+/* Creates a route.
+ * Args:
+ *    id - The id of the route.
+ *    fmt - The format of the frames routed.
+ *    latency_frames - Frames queued in the route before they are played.
+ *    block_frames - The most frames written or read at once.
+ * Returns:
+ *    A pointer to the route holding one reference, or NULL on error.
+ */
+struct cras_route *cras_route_create(unsigned int id,
+				     const struct cras_audio_format *fmt,
+				     unsigned int latency_frames,
+				     unsigned int block_frames);
+
+/* Takes a reference on a route. Called on the main thread. */
+void cras_route_get(struct cras_route *route);
+
+/* Drops a reference on a route, freeing it with the last one. Called on the
+ * main thread. */
+void cras_route_put(struct cras_route *route);
+
+/* Returns the id of a route. */
+unsigned int cras_route_id(const struct cras_route *route);
+
+/* Queues frames captured for the route. Frames that don't fit are dropped
+ * and counted as an overrun.
+ * Args:
+ *    route - The route.
+ *    frames - The frames to queue, in the format of the route.
+ *    nframes - Number of frames.
+ * Returns:
+ *    The number of frames queued.
+ */
+unsigned int cras_route_write(struct cras_route *route, const uint8_t *frames,
+			      unsigned int nframes);
+
+/* Takes frames to play from the route. Silence fills what the route can't
+ * provide.
+ * Args:
+ *    route - The route.
+ *    dst - Where to put nframes frames, in the format of the route.
+ *    nframes - Number of frames wanted.
+ * Returns:
+ *    The number of frames taken from the route, the rest of dst is silent.
+ */
+unsigned int cras_route_read(struct cras_route *route, uint8_t *dst,
+			     unsigned int nframes);
+
+/* Gets the number of frames queued in the route. */
+unsigned int cras_route_queued(const struct cras_route *route);
+
+/* Gets the times the route ran dry while playing. */
+unsigned int cras_route_num_underruns(const struct cras_route *route);
+
+/* Gets the times captured frames didn't fit in the route. */
+unsigned int cras_route_num_overruns(const struct cras_route *route);
+
+#endif /* CRAS_ROUTE_H_ */
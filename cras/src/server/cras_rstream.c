@@ -12,12 +12,17 @@
 #include "cras_audio_area.h"
 #include "cras_config.h"
 #include "cras_messages.h"
+#include "cras_overload.h"
 #include "cras_rclient.h"
+#include "cras_route.h"
 #include "cras_rstream.h"
 #include "cras_server_metrics.h"
 #include "cras_shm.h"
+#include "cras_shm_pool.h"
 #include "cras_types.h"
 #include "cras_system_state.h"
+#include "cras_wake_heap.h"
+#include "utlist.h"
 
 static bool cras_rstream_config_is_client_shm_stream(
 	const struct cras_rstream_config *config)
@@ -26,6 +31,12 @@ static bool cras_rstream_config_is_client_shm_stream(
 	       config->client_shm_size > 0;
 }
 
+/* The client a stream belongs to, from the upper half of its id. */
+static inline unsigned int stream_client_id(const struct cras_rstream *stream)
+{
+	return stream->stream_id >> 16;
+}
+
 /* Setup the shared memory area used for audio samples. config->client_shm_fd
  * must be closed after calling this function.
  */
@@ -34,7 +45,6 @@ static inline int setup_shm_area(struct cras_rstream *stream,
 {
 	const struct cras_audio_format *fmt = &stream->format;
 	char header_name[NAME_MAX];
-	char samples_name[NAME_MAX];
 	struct cras_shm_info header_info, samples_info;
 	uint32_t frame_bytes, used_size;
 	int rc;
@@ -46,54 +56,61 @@ static inline int setup_shm_area(struct cras_rstream *stream,
 		return -EEXIST;
 	}
 
-	snprintf(header_name, sizeof(header_name),
-		 "/cras-%d-stream-%08x-header", getpid(), stream->stream_id);
-
-	rc = cras_shm_info_init(header_name, cras_shm_header_size(),
-				&header_info);
-	if (rc)
-		return rc;
-
 	frame_bytes = snd_pcm_format_physical_width(fmt->format) / 8 *
 		      fmt->num_channels;
 	used_size = stream->buffer_frames * frame_bytes;
 
+	/* The server fills the samples of server only playback streams. */
+	int samples_prot = 0;
+	if (stream->direction == CRAS_STREAM_OUTPUT &&
+	    !stream_is_server_only(stream))
+		samples_prot = PROT_READ;
+	else
+		samples_prot = PROT_WRITE;
+
 	if (client_shm_stream) {
+		snprintf(header_name, sizeof(header_name),
+			 "/cras-%d-stream-%08x-header", getpid(),
+			 stream->stream_id);
+
+		rc = cras_shm_info_init(header_name, cras_shm_header_size(),
+					&header_info);
+		if (rc)
+			return rc;
+
 		rc = cras_shm_info_init_with_fd(config->client_shm_fd,
 						config->client_shm_size,
 						&samples_info);
+		if (rc) {
+			cras_shm_info_cleanup(&header_info);
+			return rc;
+		}
+
+		rc = cras_audio_shm_create(&header_info, &samples_info,
+					   samples_prot, &stream->shm);
 	} else {
-		snprintf(samples_name, sizeof(samples_name),
-			 "/cras-%d-stream-%08x-samples", getpid(),
-			 stream->stream_id);
-		rc = cras_shm_info_init(
-			samples_name,
-			cras_shm_calculate_samples_size(used_size),
-			&samples_info);
+		rc = cras_shm_pool_get(stream_client_id(stream),
+				       cras_shm_calculate_samples_size(
+					       used_size,
+					       config->num_shm_buffers),
+				       samples_prot, &stream->shm);
 	}
-	if (rc) {
-		cras_shm_info_cleanup(&header_info);
-		return rc;
-	}
-
-	int samples_prot = 0;
-	if (stream->direction == CRAS_STREAM_OUTPUT)
-		samples_prot = PROT_READ;
-	else
-		samples_prot = PROT_WRITE;
-
-	rc = cras_audio_shm_create(&header_info, &samples_info, samples_prot,
-				   &stream->shm);
 	if (rc)
 		return rc;
 
 	cras_shm_set_frame_bytes(stream->shm, frame_bytes);
+	cras_shm_set_num_buffers(stream->shm, config->num_shm_buffers);
 	cras_shm_set_used_size(stream->shm, used_size);
 	if (client_shm_stream) {
 		for (int i = 0; i < 2; i++)
 			cras_shm_set_buffer_offset(stream->shm, i,
 						   config->buffer_offsets[i]);
 	}
+	if ((stream->flags & SHM_WAKE) && !stream_is_server_only(stream))
+		cras_shm_enable_wake(stream->shm);
+	/* Gated streams start open, as the detector does. */
+	if (stream->flags & VAD_GATED)
+		cras_shm_set_vad_active(stream->shm, 1);
 
 	stream->audio_area =
 		cras_audio_area_create(stream->format.num_channels);
@@ -152,7 +169,8 @@ static int verify_rstream_parameters(const struct cras_rstream_config *config,
 	if ((format->format != SND_PCM_FORMAT_S16_LE) &&
 	    (format->format != SND_PCM_FORMAT_S32_LE) &&
 	    (format->format != SND_PCM_FORMAT_U8) &&
-	    (format->format != SND_PCM_FORMAT_S24_LE)) {
+	    (format->format != SND_PCM_FORMAT_S24_LE) &&
+	    (format->format != SND_PCM_FORMAT_FLOAT_LE)) {
 		syslog(LOG_ERR, "rstream: format %d not supported\n",
 		       format->format);
 		return -EINVAL;
@@ -162,6 +180,28 @@ static int verify_rstream_parameters(const struct cras_rstream_config *config,
 		syslog(LOG_ERR, "rstream: Invalid direction.\n");
 		return -EINVAL;
 	}
+	if ((config->flags & DEEP_BUFFER) &&
+	    config->direction != CRAS_STREAM_OUTPUT) {
+		syslog(LOG_ERR, "rstream: deep buffer is for output only\n");
+		return -EINVAL;
+	}
+	if (timespec_is_nonzero(&config->scheduled_ts) &&
+	    config->direction != CRAS_STREAM_OUTPUT) {
+		syslog(LOG_ERR, "rstream: scheduled start is for output only\n");
+		return -EINVAL;
+	}
+	if (config->pre_roll_frames &&
+	    (config->direction != CRAS_STREAM_INPUT ||
+	     config->pre_roll_frames > config->buffer_frames)) {
+		syslog(LOG_ERR, "rstream: invalid pre-roll %u\n",
+		       config->pre_roll_frames);
+		return -EINVAL;
+	}
+	if ((config->flags & VAD_GATED) &&
+	    config->direction != CRAS_STREAM_INPUT) {
+		syslog(LOG_ERR, "rstream: VAD gating is for input only\n");
+		return -EINVAL;
+	}
 	if (config->stream_type < CRAS_STREAM_TYPE_DEFAULT ||
 	    config->stream_type >= CRAS_STREAM_NUM_TYPES) {
 		syslog(LOG_ERR, "rstream: Invalid stream type.\n");
@@ -179,6 +219,14 @@ static int verify_rstream_parameters(const struct cras_rstream_config *config,
 		       "rstream: initial buffer offsets are outside shm area\n");
 		return -EINVAL;
 	}
+	/* A client-provided shm only carries offsets for a double buffer. */
+	if (!cras_shm_num_buffers_valid(config->num_shm_buffers) ||
+	    (cras_rstream_config_is_client_shm_stream(config) &&
+	     config->num_shm_buffers > CRAS_NUM_SHM_BUFFERS)) {
+		syslog(LOG_ERR, "rstream: invalid num_shm_buffers %u\n",
+		       config->num_shm_buffers);
+		return -EINVAL;
+	}
 
 	return 0;
 }
@@ -261,6 +309,18 @@ static int read_and_handle_client_message(struct cras_rstream *stream)
 	return rc;
 }
 
+/* Picks the sample rate converter setting from the kind of stream. Voice
+ * calls favor latency, streams taking bulk audio can afford long filters. */
+static enum CRAS_SRC_QUALITY
+stream_src_quality(const struct cras_rstream_config *config)
+{
+	if (config->stream_type == CRAS_STREAM_TYPE_VOICE_COMMUNICATION)
+		return CRAS_SRC_QUALITY_LOW_LATENCY;
+	if (config->flags & BULK_AUDIO_OK)
+		return CRAS_SRC_QUALITY_HIGH;
+	return CRAS_SRC_QUALITY_DEFAULT;
+}
+
 /* Exported functions */
 
 int cras_rstream_create(struct cras_rstream_config *config,
@@ -292,7 +352,12 @@ int cras_rstream_create(struct cras_rstream_config *config,
 	stream->num_missed_cb = 0;
 	stream->is_pinned = (config->dev_idx != NO_DEVICE);
 	stream->pinned_dev_idx = config->dev_idx;
-	ewma_power_init(&stream->ewma, stream->format.frame_rate);
+	stream->scheduled_ts = config->scheduled_ts;
+	stream->pre_roll_frames = config->pre_roll_frames;
+	stream->route = config->route;
+	stream->src_quality = stream_src_quality(config);
+	ewma_power_init(&stream->ewma, stream->format.format,
+			stream->format.frame_rate);
 
 	rc = setup_shm_area(stream, config);
 	if (rc < 0) {
@@ -308,6 +373,12 @@ int cras_rstream_create(struct cras_rstream_config *config,
 		(stream->direction == CRAS_STREAM_INPUT) ?
 			cras_apm_list_create(stream, config->effects) :
 			NULL;
+	cras_apm_list_set_background(
+		stream->apm_list,
+		!cras_overload_stream_is_critical(stream->stream_type));
+
+	if (stream->route)
+		cras_route_get(stream->route);
 
 	syslog(LOG_DEBUG, "stream %x frames %zu, cb_thresh %zu",
 	       config->stream_id, config->buffer_frames, config->cb_threshold);
@@ -324,15 +395,23 @@ int cras_rstream_create(struct cras_rstream_config *config,
 
 void cras_rstream_destroy(struct cras_rstream *stream)
 {
+	struct cras_rstream_tap *tap;
+
 	cras_server_metrics_stream_destroy(stream);
 	cras_system_state_stream_removed(stream->direction,
 					 stream->client_type);
 	close(stream->fd);
-	cras_audio_shm_destroy(stream->shm);
+	cras_shm_pool_put(stream_client_id(stream), stream->shm);
 	cras_audio_area_destroy(stream->audio_area);
 	buffer_share_destroy(stream->buf_state);
 	if (stream->apm_list)
 		cras_apm_list_destroy(stream->apm_list);
+	DL_FOREACH (stream->taps, tap) {
+		DL_DELETE(stream->taps, tap);
+		free(tap);
+	}
+	if (stream->route)
+		cras_route_put(stream->route);
 	free(stream);
 }
 
@@ -354,6 +433,44 @@ cras_rstream_post_processing_format(const struct cras_rstream *stream,
 	return cras_apm_list_get_format(apm);
 }
 
+/* Stretches the fetch lead to cover a client that has taken ts to reply so
+ * far. The lead is at most half the callback interval, so a stream is never
+ * fetched twice in one period. */
+static void stretch_fetch_lead(struct cras_rstream *rstream,
+			       const struct timespec *ts)
+{
+	struct timespec max_lead, lead;
+	uint64_t ns;
+
+	ns = rstream->sleep_interval_ts.tv_sec * 1000000000ULL +
+	     rstream->sleep_interval_ts.tv_nsec;
+	ns /= 2;
+	max_lead.tv_sec = ns / 1000000000;
+	max_lead.tv_nsec = ns % 1000000000;
+
+	lead = rstream->fetch_lead;
+	if (timespec_after(ts, &lead))
+		lead = *ts;
+	if (timespec_after(&lead, &max_lead))
+		lead = max_lead;
+	cras_wake_heap_set_fetch_lead(rstream, &lead);
+}
+
+/* Lets the fetch lead shrink back by 1/16 on each fetch, for clients that
+ * got faster. */
+static void decay_fetch_lead(struct cras_rstream *rstream)
+{
+	struct timespec lead;
+	uint64_t ns;
+
+	ns = rstream->fetch_lead.tv_sec * 1000000000ULL +
+	     rstream->fetch_lead.tv_nsec;
+	ns -= ns / 16;
+	lead.tv_sec = ns / 1000000000;
+	lead.tv_nsec = ns % 1000000000;
+	cras_wake_heap_set_fetch_lead(rstream, &lead);
+}
+
 void cras_rstream_record_fetch_interval(struct cras_rstream *rstream,
 					const struct timespec *now)
 {
@@ -363,6 +480,7 @@ void cras_rstream_record_fetch_interval(struct cras_rstream *rstream,
 		subtract_timespecs(now, &rstream->last_fetch_ts, &ts);
 		if (timespec_after(&ts, &rstream->longest_fetch_interval))
 			rstream->longest_fetch_interval = ts;
+		stretch_fetch_lead(rstream, &ts);
 	}
 }
 
@@ -374,6 +492,34 @@ static void init_audio_message(struct audio_message *msg,
 	msg->frames = frames;
 }
 
+/* Fills the shm of a routed playback stream with a block from its route. */
+static void fill_from_route(struct cras_rstream *stream)
+{
+	unsigned int frames;
+	uint8_t *buf;
+
+	if (!cras_shm_is_buffer_available(stream->shm))
+		return;
+
+	buf = cras_shm_get_writeable_frames(stream->shm, stream->cb_threshold,
+					    &frames);
+	cras_route_read(stream->route, buf, frames);
+	cras_shm_buffer_written(stream->shm, frames);
+	cras_shm_buffer_write_complete(stream->shm);
+}
+
+/* Queues the frames a routed capture stream got into its route, what doesn't
+ * fit is dropped. */
+static void drain_to_route(struct cras_rstream *stream, size_t count)
+{
+	size_t frames;
+	uint8_t *buf;
+
+	buf = cras_shm_get_readable_frames(stream->shm, 0, &frames);
+	if (buf)
+		cras_route_write(stream->route, buf, MIN(frames, count));
+}
+
 int cras_rstream_request_audio(struct cras_rstream *stream,
 			       const struct timespec *now)
 {
@@ -385,6 +531,20 @@ int cras_rstream_request_audio(struct cras_rstream *stream,
 		return 0;
 
 	stream->last_fetch_ts = *now;
+	decay_fetch_lead(stream);
+
+	/* A routed stream is filled from its route right here. */
+	if (stream->route && stream_is_server_only(stream)) {
+		fill_from_route(stream);
+		return 0;
+	}
+
+	/* Pending goes first, the client clears it as soon as it is woken. */
+	if (cras_rstream_uses_shm_wake(stream)) {
+		set_pending_reply(stream);
+		cras_shm_wake(stream->shm, stream->cb_threshold);
+		return 0;
+	}
 
 	init_audio_message(&msg, AUDIO_MESSAGE_REQUEST_DATA,
 			   stream->cb_threshold);
@@ -406,10 +566,18 @@ int cras_rstream_audio_ready(struct cras_rstream *stream, size_t count)
 
 	/* Mark shm as used. */
 	if (stream_is_server_only(stream)) {
+		if (stream->route)
+			drain_to_route(stream, count);
 		cras_shm_buffer_read_current(stream->shm, count);
 		return 0;
 	}
 
+	if (cras_rstream_uses_shm_wake(stream)) {
+		set_pending_reply(stream);
+		cras_shm_wake(stream->shm, count);
+		return 0;
+	}
+
 	init_audio_message(&msg, AUDIO_MESSAGE_DATA_READY, count);
 	rc = write(stream->fd, &msg, sizeof(msg));
 	if (rc < 0)
@@ -466,9 +634,14 @@ void cras_rstream_dev_offset_update(struct cras_rstream *rstream,
 
 void cras_rstream_update_input_write_pointer(struct cras_rstream *rstream)
 {
+	uint8_t *dst;
 	unsigned int nwritten =
 		buffer_share_get_new_write_point(rstream->buf_state);
 
+	/* The frames just captured start at the current write pointer. */
+	dst = cras_shm_get_writeable_frames(rstream->shm, 0, NULL);
+	ewma_power_calculate(&rstream->ewma, dst, rstream->format.num_channels,
+			     nwritten);
 	cras_shm_buffer_written(rstream->shm, nwritten);
 }
 
@@ -482,8 +655,8 @@ void cras_rstream_update_output_read_pointer(struct cras_rstream *rstream)
 	/* Retrieve the read pointer |src| start from which to calculate
 	 * the EWMA power. */
 	src = cras_shm_get_readable_frames(rstream->shm, 0, &nfr);
-	ewma_power_calculate(&rstream->ewma, (int16_t *)src,
-			     rstream->format.num_channels, nwritten);
+	ewma_power_calculate(&rstream->ewma, src, rstream->format.num_channels,
+			     nwritten);
 	cras_shm_buffer_read(rstream->shm, nwritten);
 }
 
@@ -495,8 +668,13 @@ unsigned int cras_rstream_dev_offset(const struct cras_rstream *rstream,
 
 void cras_rstream_update_queued_frames(struct cras_rstream *rstream)
 {
+	/* A deeper ring lets the client queue more than one buffer ahead of
+	 * the one being played. */
+	size_t max_frames = rstream->buffer_frames *
+			    (cras_shm_num_buffers(rstream->shm) - 1);
+
 	rstream->queued_frames =
-		MIN(cras_shm_get_frames(rstream->shm), rstream->buffer_frames);
+		MIN(cras_shm_get_frames(rstream->shm), max_frames);
 }
 
 unsigned int cras_rstream_playable_frames(struct cras_rstream *rstream,
@@ -522,6 +700,47 @@ int cras_rstream_get_mute(const struct cras_rstream *rstream)
 	return cras_shm_get_mute(rstream->shm);
 }
 
+int cras_rstream_add_tap(struct cras_rstream *rstream,
+			 cras_rstream_tap_t hook_data, void *cb_data)
+{
+	struct cras_rstream_tap *tap;
+
+	DL_FOREACH (rstream->taps, tap)
+		if (tap->cb_data == cb_data)
+			return -EEXIST;
+
+	tap = (struct cras_rstream_tap *)calloc(1, sizeof(*tap));
+	if (!tap)
+		return -ENOMEM;
+	tap->hook_data = hook_data;
+	tap->cb_data = cb_data;
+	DL_APPEND(rstream->taps, tap);
+	return 0;
+}
+
+void cras_rstream_rm_tap(struct cras_rstream *rstream, void *cb_data)
+{
+	struct cras_rstream_tap *tap;
+
+	DL_FOREACH (rstream->taps, tap) {
+		if (tap->cb_data == cb_data) {
+			DL_DELETE(rstream->taps, tap);
+			free(tap);
+			return;
+		}
+	}
+}
+
+void cras_rstream_tap_frames(struct cras_rstream *rstream,
+			     const uint8_t *frames, unsigned int nframes,
+			     const struct cras_audio_format *fmt)
+{
+	struct cras_rstream_tap *tap;
+
+	DL_FOREACH (rstream->taps, tap)
+		tap->hook_data(frames, nframes, fmt, tap->cb_data);
+}
+
 int cras_rstream_is_pending_reply(const struct cras_rstream *stream)
 {
 	return cras_shm_callback_pending(stream->shm);
@@ -535,7 +754,8 @@ int cras_rstream_flush_old_audio_messages(struct cras_rstream *stream)
 	if (!stream->fd)
 		return 0;
 
-	if (stream_is_server_only(stream))
+	/* Replies of these come through the shm, nothing to read. */
+	if (stream_is_server_only(stream) || cras_rstream_uses_shm_wake(stream))
 		return 0;
 
 	pollfd.fd = stream->fd;
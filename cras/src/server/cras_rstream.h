@@ -20,6 +20,42 @@ struct cras_connect_message;
 struct cras_rclient;
 struct dev_mix;
 
+/* Type of callback receiving the frames of a stream, converted to the format
+ * of a device it plays to, before they are scaled by the stream volume and
+ * mixed. It has the signature of loopback_hook_data_t so the sample hook of
+ * a loopback device can be used as is.
+ * Args:
+ *    frames - The converted frames.
+ *    nframes - The number of frames.
+ *    fmt - The format of the device.
+ *    cb_data - The receiver of the tap.
+ */
+typedef int (*cras_rstream_tap_t)(const uint8_t *frames, unsigned int nframes,
+				  const struct cras_audio_format *fmt,
+				  void *cb_data);
+
+/* A receiver of the frames of a single stream.
+ * Members:
+ *    hook_data - Called with the frames of the stream each time it is mixed.
+ *        It may run on a mix worker, so a receiver must not be shared by
+ *        streams that are mixed in parallel.
+ *    cb_data - The receiver, passed to hook_data.
+ */
+struct cras_rstream_tap {
+	cras_rstream_tap_t hook_data;
+	void *cb_data;
+	struct cras_rstream_tap *prev, *next;
+};
+
+/* The indexes a stream_list keeps its streams in, besides the list itself.
+ * A stream is only in the pinned device index while it is pinned. */
+enum CRAS_RSTREAM_INDEX {
+	CRAS_RSTREAM_INDEX_ID,
+	CRAS_RSTREAM_INDEX_CLIENT,
+	CRAS_RSTREAM_INDEX_PINNED_DEV,
+	CRAS_RSTREAM_NUM_INDEXES,
+};
+
 /* Holds informations about the master active device.
  * Members:
  *    dev_id - id of the master device.
@@ -44,6 +80,9 @@ struct master_dev_info {
  *    cb_threshold - Callback client when this much is left.
  *    master_dev_info - The info of the master device this stream attaches to.
  *    is_draining - The stream is draining and waiting to be removed.
+ *    paused - Set by the main thread while the client has the stream paused.
+ *        The audio thread reads it when told the stream was paused or
+ *        resumed, and when it attaches the stream to a device.
  *    client - The client who uses this stream.
  *    shm - shared memory
  *    audio_area - space for playback/capture audio
@@ -52,7 +91,17 @@ struct master_dev_info {
  *    sleep_interval_ts - Time between audio callbacks.
  *    last_fetch_ts - The time of the last stream fetch.
  *    longest_fetch_interval_ts - Longest interval between two fetches.
+ *    fetch_lead - How much ahead of next_cb_ts a playback stream may be
+ *        fetched, learned from how long its client takes to reply.
+ *    wake_heap_refs - Number of devices of the audio thread the stream wakes
+ *        at its next_cb_ts, see cras_wake_heap.h.
+ *    wake_heap_pos - One past the index of the stream in the wake heap, 0
+ *        when it isn't in it.
  *    start_ts - The time when the stream started.
+ *    scheduled_ts - The time the first frame of a playback stream should
+ *        play at, zero to play right away.
+ *    pre_roll_frames - Frames captured before an input stream was attached
+ *        that it starts with, as far as its devices kept them.
  *    first_missed_cb_ts - The time when the first missed callback happens.
  *    buf_state - State of the buffer from all devices for this stream.
  *    apm_list - List of audio processing module instances.
@@ -63,7 +112,30 @@ struct master_dev_info {
  *    is_pinned - True if the stream is a pinned stream, false otherwise.
  *    pinned_dev_idx - device the stream is pinned, 0 if none.
  *    triggered - True if already notified TRIGGER_ONLY stream, false otherwise.
+ *    src_quality - Quality setting of the sample rate converters of this
+ *        stream.
+ *    taps - Receivers of the converted frames of this playback stream.
+ *    cost - What the stream cost on the devices it was detached from, with
+ *        the memory of the most expensive of them. Updated in audio thread.
+ *    route - The route a server only stream captures into or plays from, if
+ *        any. The stream holds a reference on it.
+ *    index_next - Next stream in the same bucket of each stream_list index.
  */
+/* CPU time and memory a stream costs the server.
+ *    convert_ns - Time spent converting its format and rate.
+ *    mix_ns - Time spent mixing it into outputs, or copying captured frames
+ *        to it.
+ *    apm_ns - Time the APMs it reads spent processing, on their threads.
+ *    mem_bytes - Memory held for it: its shm, the conversion and mix buffers
+ *        and the APM buffers.
+ */
+struct cras_rstream_cost {
+	uint64_t convert_ns;
+	uint64_t mix_ns;
+	uint64_t apm_ns;
+	uint64_t mem_bytes;
+};
+
 struct cras_rstream {
 	cras_stream_id_t stream_id;
 	enum CRAS_STREAM_TYPE stream_type;
@@ -74,6 +146,7 @@ struct cras_rstream {
 	size_t buffer_frames;
 	size_t cb_threshold;
 	int is_draining;
+	int paused;
 	struct master_dev_info master_dev;
 	struct cras_rclient *client;
 	struct cras_audio_shm *shm;
@@ -83,7 +156,12 @@ struct cras_rstream {
 	struct timespec sleep_interval_ts;
 	struct timespec last_fetch_ts;
 	struct timespec longest_fetch_interval;
+	struct timespec fetch_lead;
+	unsigned int wake_heap_refs;
+	unsigned int wake_heap_pos;
 	struct timespec start_ts;
+	struct timespec scheduled_ts;
+	uint32_t pre_roll_frames;
 	struct timespec first_missed_cb_ts;
 	struct buffer_share *buf_state;
 	struct cras_apm_list *apm_list;
@@ -94,6 +172,11 @@ struct cras_rstream {
 	int is_pinned;
 	uint32_t pinned_dev_idx;
 	int triggered;
+	enum CRAS_SRC_QUALITY src_quality;
+	struct cras_rstream_tap *taps;
+	struct cras_rstream_cost cost;
+	struct cras_route *route;
+	struct cras_rstream *index_next[CRAS_RSTREAM_NUM_INDEXES];
 	struct cras_rstream *prev, *next;
 };
 
@@ -235,6 +318,13 @@ static inline int stream_is_server_only(const struct cras_rstream *s)
 	return s->flags & SERVER_ONLY;
 }
 
+/* Checks if requests and replies of the stream go through its shm. */
+static inline int
+cras_rstream_uses_shm_wake(const struct cras_rstream *stream)
+{
+	return cras_shm_wake_enabled(stream->shm);
+}
+
 /* Gets the enabled effects of this stream. */
 unsigned int cras_rstream_get_effects(const struct cras_rstream *stream);
 
@@ -244,7 +334,8 @@ cras_rstream_post_processing_format(const struct cras_rstream *stream,
 				    void *dev_ptr);
 
 /* Checks how much time has passed since last stream fetch and records
- * the longest fetch interval. */
+ * the longest fetch interval. Called while the client has not replied, the
+ * time so far also stretches the fetch lead of the stream. */
 void cras_rstream_record_fetch_interval(struct cras_rstream *rstream,
 					const struct timespec *now);
 
@@ -260,7 +351,7 @@ void cras_rstream_dev_attach(struct cras_rstream *rstream, unsigned int dev_id,
 			     void *dev_ptr);
 void cras_rstream_dev_detach(struct cras_rstream *rstream, unsigned int dev_id);
 
-static inline void *cras_rstream_dev_ptr(struct cras_rstream *rstream,
+static inline void *cras_rstream_dev_ptr(const struct cras_rstream *rstream,
 					 unsigned int dev_id)
 {
 	return buffer_share_get_data(rstream->buf_state, dev_id);
@@ -308,6 +399,27 @@ uint8_t *cras_rstream_get_readable_frames(struct cras_rstream *rstream,
 /* Returns non-zero if the stream is muted. */
 int cras_rstream_get_mute(const struct cras_rstream *rstream);
 
+/* Attaches a tap to a playback stream, so hook_data gets the frames of this
+ * stream alone without a pass over the whole mix. Nothing is done for the
+ * stream while it has no tap.
+ * Args:
+ *    rstream - The stream to tap.
+ *    hook_data - Called with the converted frames of the stream.
+ *    cb_data - The receiver, passed to hook_data.
+ * Returns:
+ *    0 on success, -EEXIST if cb_data already taps the stream, or -ENOMEM.
+ */
+int cras_rstream_add_tap(struct cras_rstream *rstream,
+			 cras_rstream_tap_t hook_data, void *cb_data);
+
+/* Detaches the tap of cb_data from a stream. */
+void cras_rstream_rm_tap(struct cras_rstream *rstream, void *cb_data);
+
+/* Hands the frames of a stream converted to fmt to its taps, if any. */
+void cras_rstream_tap_frames(struct cras_rstream *rstream,
+			     const uint8_t *frames, unsigned int nframes,
+			     const struct cras_audio_format *fmt);
+
 /*
  * Returns non-zero if the stream is pending a reply from client.
  * - For playback, stream is waiting for AUDIO_MESSAGE_DATA_READY message from
@@ -19,6 +19,7 @@
 #include "cras_shm.h"
 #include "cras_types.h"
 #include "cras_system_state.h"
+#include "cras_util.h"
 
 void cras_rstream_config_init(
 	struct cras_rclient *client, cras_stream_id_t stream_id,
@@ -47,7 +48,12 @@ void cras_rstream_config_init(
 	stream_config->client_shm_size = client_shm_size;
 	stream_config->buffer_offsets[0] = buffer_offsets[0];
 	stream_config->buffer_offsets[1] = buffer_offsets[1];
+	stream_config->num_shm_buffers = 0;
+	stream_config->scheduled_ts.tv_sec = 0;
+	stream_config->scheduled_ts.tv_nsec = 0;
+	stream_config->pre_roll_frames = 0;
 	stream_config->client = client;
+	stream_config->route = NULL;
 }
 
 struct cras_rstream_config cras_rstream_config_init_with_message(
@@ -65,6 +71,13 @@ struct cras_rstream_config cras_rstream_config_init_with_message(
 				 msg->buffer_frames, msg->cb_threshold, aud_fd,
 				 client_shm_fd, msg->client_shm_size,
 				 buffer_offsets, &stream_config);
+	if (msg->header.length >= CRAS_CONNECT_MESSAGE_V9_SIZE)
+		stream_config.num_shm_buffers = msg->num_shm_buffers;
+	if (msg->header.length >= CRAS_CONNECT_MESSAGE_V10_SIZE)
+		cras_timespec_to_timespec(&stream_config.scheduled_ts,
+					  &msg->scheduled_ts);
+	if (msg->header.length >= sizeof(*msg))
+		stream_config.pre_roll_frames = msg->pre_roll_frames;
 	return stream_config;
 }
 
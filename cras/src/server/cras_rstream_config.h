@@ -14,6 +14,7 @@
 #include "cras_types.h"
 
 struct cras_connect_message;
+struct cras_route;
 struct dev_mix;
 
 /* Config for creating an rstream.
@@ -33,7 +34,15 @@ struct dev_mix;
  *                    Some functions may dup this fd while borrowing the config.
  *    client_shm_size - The size of shm area backed by client_shm_fd.
  *    buffer_offsets - Initial values for buffer_offset for a client shm stream.
+ *    num_shm_buffers - Number of buffers in the samples shm, 0 for the
+ *                      default.
+ *    scheduled_ts - CLOCK_MONOTONIC_RAW time the first frame of a playback
+ *                   stream should play at, zero to play right away.
+ *    pre_roll_frames - Frames captured before an input stream connected to
+ *                      start it with, if the device kept them.
  *    client - The client that owns this stream.
+ *    route - The route a server only stream captures into or plays from, if
+ *            any.
  */
 struct cras_rstream_config {
 	cras_stream_id_t stream_id;
@@ -50,7 +59,11 @@ struct cras_rstream_config {
 	int client_shm_fd;
 	size_t client_shm_size;
 	uint32_t buffer_offsets[2];
+	uint32_t num_shm_buffers;
+	struct timespec scheduled_ts;
+	uint32_t pre_roll_frames;
 	struct cras_rclient *client;
+	struct cras_route *route;
 };
 
 /* Fills cras_rstream_config with given parameters.
@@ -0,0 +1,632 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for recvmmsg */
+#endif
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cras_audio_area.h"
+#include "cras_iodev.h"
+#include "cras_iodev_list.h"
+#include "cras_rtp_iodev.h"
+#include "cras_types.h"
+#include "cras_util.h"
+#include "rate_estimator.h"
+#include "rtp.h"
+
+/* Audio is sent as 48kHz stereo L16, 16 bit samples in network byte order. */
+#define RTP_RATE 48000
+#define RTP_FRAME_BYTES 4
+/* 5ms of audio per packet keeps the packet delay low and its payload well
+ * within an ethernet MTU. */
+#define RTP_PACKET_FRAMES 240
+#define RTP_PAYLOAD_BYTES (RTP_PACKET_FRAMES * RTP_FRAME_BYTES)
+#define RTP_MAX_PACKET_BYTES 1500
+/* Dynamic payload type used for the L16 audio. */
+#define RTP_PAYLOAD_TYPE 96
+/* Packets sent or received with one system call. */
+#define RTP_BATCH_PACKETS 16
+/* Size in frames of the device buffer and of the jitter buffer. */
+#define RTP_BUFFER_FRAMES 4096
+/* Frames the jitter buffer fills up with before capture starts, enough to
+ * absorb 20ms of network jitter. */
+#define JITTER_TARGET_FRAMES 960
+
+/* Same rate estimation tuning as cras_iodev. */
+static const struct timespec rate_estimation_window_sz = {
+	5, 0 /* 5 sec. */
+};
+static const double rate_estimation_smooth_factor = 0.3f;
+
+static size_t rtp_supported_rates[] = { RTP_RATE, 0 };
+
+static size_t rtp_supported_channel_counts[] = { 2, 0 };
+
+static snd_pcm_format_t rtp_supported_formats[] = { SND_PCM_FORMAT_S16_LE,
+						    0 };
+
+/* Structure holding an RTP iodev.
+ *    addr - Address sent to by an output, received on by an input.
+ *    fd - The UDP socket, -1 while the device is closed.
+ *    audio_buffer - The buffer handed out by get_buffer.
+ *    packets - Packets sent or received in one batch.
+ *    dev_start_time - For output: when the device started playing.
+ *    written_frames - For output: frames played since dev_start_time.
+ *    pending - For output: frames waiting to fill the next packet.
+ *    pending_frames - For output: the number of frames in pending.
+ *    sequence_number, timestamp, ssrc - For output: RTP header of the next
+ *        packet.
+ *    send_failed - For output: set while packets fail to be sent, to only
+ *        log once.
+ *    jitter_buf - For input: ring of frames received, indexed by their RTP
+ *        timestamp. Frames not received yet are silent.
+ *    read_pos - For input: index in jitter_buf of the next frame to capture.
+ *    read_ts, end_ts - For input: RTP timestamp of the next frame to capture
+ *        and the one past the latest frame received.
+ *    receiving - For input: set once read_ts follows a sender.
+ *    playing - For input: set once the jitter buffer filled up, frames are
+ *        captured at playout_rate from then on.
+ *    playout_start - For input: when playout_rate was last changed.
+ *    playout_frames - For input: frames to capture up to playout_start.
+ *    playout_rate - For input: rate frames are captured at.
+ *    read_frames - For input: frames captured since the device opened.
+ *    rate_est - For input: estimates the rate the sender's clock runs at
+ *        from the level of the jitter buffer.
+ */
+struct rtp_iodev {
+	struct cras_iodev base;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int fd;
+	uint8_t *audio_buffer;
+	uint8_t packets[RTP_BATCH_PACKETS][RTP_MAX_PACKET_BYTES];
+	struct timespec dev_start_time;
+	uint64_t written_frames;
+	uint8_t pending[RTP_PAYLOAD_BYTES];
+	unsigned int pending_frames;
+	uint16_t sequence_number;
+	uint32_t timestamp;
+	uint32_t ssrc;
+	int send_failed;
+	uint8_t *jitter_buf;
+	unsigned int read_pos;
+	uint32_t read_ts, end_ts;
+	int receiving;
+	int playing;
+	struct timespec playout_start;
+	uint64_t playout_frames;
+	double playout_rate;
+	uint64_t read_frames;
+	struct rate_estimator *rate_est;
+};
+
+/* Copies 16 bit samples between host and network byte order. The format of
+ * the device is S16_LE whatever the host is. */
+static void swap_samples(uint8_t *dst, const uint8_t *src, size_t bytes)
+{
+	size_t i;
+
+	for (i = 0; i + 1 < bytes; i += 2) {
+		dst[i] = src[i + 1];
+		dst[i + 1] = src[i];
+	}
+}
+
+/*
+ * Output.
+ */
+
+static unsigned int output_level(const struct rtp_iodev *rtpio)
+{
+	uint64_t frames_since_start;
+
+	frames_since_start =
+		cras_frames_since_time(&rtpio->dev_start_time, RTP_RATE);
+	if (rtpio->written_frames <= frames_since_start)
+		return 0;
+	return rtpio->written_frames - frames_since_start;
+}
+
+/* Builds a packet from the pending frames. Returns its size. */
+static size_t fill_packet(struct rtp_iodev *rtpio, uint8_t *packet)
+{
+	struct rtp_header *header = (struct rtp_header *)packet;
+
+	memset(header, 0, sizeof(*header));
+	header->v = 2;
+	header->pt = RTP_PAYLOAD_TYPE;
+	header->sequence_number = htons(rtpio->sequence_number++);
+	header->timestamp = htonl(rtpio->timestamp);
+	header->ssrc = htonl(rtpio->ssrc);
+	swap_samples(packet + sizeof(*header), rtpio->pending,
+		     RTP_PAYLOAD_BYTES);
+	rtpio->timestamp += RTP_PACKET_FRAMES;
+	rtpio->pending_frames = 0;
+	return sizeof(*header) + RTP_PAYLOAD_BYTES;
+}
+
+/* Sends a batch of packets. A packet the network can't take is dropped, the
+ * sink conceals it. */
+static void send_packets(struct rtp_iodev *rtpio, const struct iovec *iovs,
+			 unsigned int num_packets)
+{
+	int rc;
+
+	rc = cras_send_messages(rtpio->fd, iovs, num_packets);
+	if (rc == (int)num_packets) {
+		rtpio->send_failed = 0;
+		return;
+	}
+	if (!rtpio->send_failed)
+		syslog(LOG_WARNING, "RTP dropped %d packets, rc %d",
+		       num_packets - MAX(rc, 0), rc);
+	rtpio->send_failed = 1;
+}
+
+/* Packs frames into packets, sending the full ones in batches. */
+static void output_frames(struct rtp_iodev *rtpio, const uint8_t *frames,
+			  unsigned int num_frames)
+{
+	struct iovec iovs[RTP_BATCH_PACKETS];
+	unsigned int num_packets = 0;
+	unsigned int n;
+
+	while (num_frames) {
+		n = MIN(num_frames, RTP_PACKET_FRAMES - rtpio->pending_frames);
+		memcpy(rtpio->pending + rtpio->pending_frames * RTP_FRAME_BYTES,
+		       frames, n * RTP_FRAME_BYTES);
+		rtpio->pending_frames += n;
+		frames += n * RTP_FRAME_BYTES;
+		num_frames -= n;
+		if (rtpio->pending_frames < RTP_PACKET_FRAMES)
+			break;
+
+		iovs[num_packets].iov_base = rtpio->packets[num_packets];
+		iovs[num_packets].iov_len =
+			fill_packet(rtpio, rtpio->packets[num_packets]);
+		if (++num_packets == RTP_BATCH_PACKETS) {
+			send_packets(rtpio, iovs, num_packets);
+			num_packets = 0;
+		}
+	}
+	if (num_packets)
+		send_packets(rtpio, iovs, num_packets);
+}
+
+/*
+ * Input.
+ */
+
+/* Forgets what was received, the next packet starts the jitter buffer over. */
+static void reset_jitter_buffer(struct rtp_iodev *rtpio)
+{
+	memset(rtpio->jitter_buf, 0, RTP_BUFFER_FRAMES * RTP_FRAME_BYTES);
+	rtpio->read_pos = 0;
+	rtpio->receiving = 0;
+	rtpio->playing = 0;
+}
+
+/* Puts the frames of a packet in the jitter buffer at their timestamp. */
+static void insert_packet(struct rtp_iodev *rtpio, const uint8_t *packet,
+			  unsigned int len)
+{
+	const struct rtp_header *header = (const struct rtp_header *)packet;
+	unsigned int offset = sizeof(*header);
+	unsigned int num_frames, pos, n;
+	uint16_t ext_words;
+	uint32_t ts;
+	int32_t ahead;
+
+	if (len < offset || header->v != 2 || header->pt != RTP_PAYLOAD_TYPE)
+		return;
+	offset += header->cc * sizeof(uint32_t);
+	if (header->x) {
+		if (len < offset + 2 * sizeof(uint16_t))
+			return;
+		memcpy(&ext_words, packet + offset + sizeof(uint16_t),
+		       sizeof(ext_words));
+		offset += 2 * sizeof(uint16_t) +
+			  ntohs(ext_words) * sizeof(uint32_t);
+	}
+	if (header->p && len > offset)
+		len -= MIN(packet[len - 1], len - offset);
+	if (len <= offset)
+		return;
+	num_frames = (len - offset) / RTP_FRAME_BYTES;
+	ts = ntohl(header->timestamp);
+
+	if (!rtpio->receiving) {
+		rtpio->receiving = 1;
+		rtpio->read_ts = ts;
+		rtpio->end_ts = ts;
+	}
+
+	/* Frames this late were already captured as silence. */
+	ahead = (int32_t)(ts - rtpio->read_ts);
+	if (ahead < 0)
+		return;
+
+	/* The sender restarted or ran too far ahead, follow it from here. */
+	if (ahead + num_frames > RTP_BUFFER_FRAMES) {
+		reset_jitter_buffer(rtpio);
+		if (num_frames > RTP_BUFFER_FRAMES)
+			return;
+		rtpio->receiving = 1;
+		rtpio->read_ts = ts;
+		rtpio->end_ts = ts;
+		ahead = 0;
+	}
+
+	pos = (rtpio->read_pos + ahead) % RTP_BUFFER_FRAMES;
+	n = MIN(num_frames, RTP_BUFFER_FRAMES - pos);
+	swap_samples(rtpio->jitter_buf + pos * RTP_FRAME_BYTES,
+		     packet + offset, n * RTP_FRAME_BYTES);
+	swap_samples(rtpio->jitter_buf, packet + offset + n * RTP_FRAME_BYTES,
+		     (num_frames - n) * RTP_FRAME_BYTES);
+
+	if ((int32_t)(ts + num_frames - rtpio->end_ts) > 0)
+		rtpio->end_ts = ts + num_frames;
+}
+
+/* Drains the socket into the jitter buffer, a batch of packets at a time. */
+static void receive_packets(struct rtp_iodev *rtpio)
+{
+	struct mmsghdr msgs[RTP_BATCH_PACKETS];
+	struct iovec iovs[RTP_BATCH_PACKETS];
+	int num_packets, i;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < RTP_BATCH_PACKETS; i++) {
+		iovs[i].iov_base = rtpio->packets[i];
+		iovs[i].iov_len = RTP_MAX_PACKET_BYTES;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	do {
+		num_packets = recvmmsg(rtpio->fd, msgs, RTP_BATCH_PACKETS,
+				       MSG_DONTWAIT, NULL);
+		for (i = 0; i < num_packets; i++)
+			insert_packet(rtpio, rtpio->packets[i],
+				      msgs[i].msg_len);
+	} while (num_packets == RTP_BATCH_PACKETS);
+}
+
+/* Frames to capture from the start of playout until now. */
+static uint64_t frames_to_capture(const struct rtp_iodev *rtpio,
+				  const struct timespec *now)
+{
+	struct timespec elapsed;
+
+	if (!timespec_after(now, &rtpio->playout_start))
+		return rtpio->playout_frames;
+	subtract_timespecs(now, &rtpio->playout_start, &elapsed);
+	return rtpio->playout_frames +
+	       (uint64_t)((elapsed.tv_sec + elapsed.tv_nsec / 1000000000.0) *
+			  rtpio->playout_rate);
+}
+
+/*
+ * Starts capturing once the jitter buffer is full enough, and keeps the
+ * capture rate at the estimated rate of the sender. The buffer level then
+ * stays at the jitter target, and the streams follow the sender's clock as
+ * they resample from the rate the device runs at.
+ */
+static void update_playout(struct rtp_iodev *rtpio, const struct timespec *now)
+{
+	uint32_t buffered = rtpio->end_ts - rtpio->read_ts;
+
+	if (!rtpio->receiving)
+		return;
+
+	if (!rtpio->playing) {
+		if (buffered < JITTER_TARGET_FRAMES)
+			return;
+		rtpio->playing = 1;
+		rtpio->playout_start = *now;
+		rtpio->playout_frames = rtpio->read_frames;
+		return;
+	}
+
+	if (rate_estimator_check(rtpio->rate_est, buffered, now)) {
+		rtpio->playout_frames = frames_to_capture(rtpio, now);
+		rtpio->playout_start = *now;
+		rtpio->playout_rate = rate_estimator_get_rate(rtpio->rate_est);
+	}
+}
+
+static unsigned int input_level(const struct rtp_iodev *rtpio,
+				const struct timespec *now)
+{
+	uint64_t frames;
+
+	if (!rtpio->playing)
+		return 0;
+	frames = frames_to_capture(rtpio, now);
+	if (frames <= rtpio->read_frames)
+		return 0;
+	return MIN(frames - rtpio->read_frames, RTP_BUFFER_FRAMES);
+}
+
+/* Moves captured frames out of the jitter buffer. Frames that never arrived
+ * are captured as silence. */
+static void consume_frames(struct rtp_iodev *rtpio, unsigned int num_frames)
+{
+	unsigned int n;
+
+	n = MIN(num_frames, RTP_BUFFER_FRAMES - rtpio->read_pos);
+	memset(rtpio->jitter_buf + rtpio->read_pos * RTP_FRAME_BYTES, 0,
+	       n * RTP_FRAME_BYTES);
+	memset(rtpio->jitter_buf, 0, (num_frames - n) * RTP_FRAME_BYTES);
+	rtpio->read_pos = (rtpio->read_pos + num_frames) % RTP_BUFFER_FRAMES;
+	rtpio->read_ts += num_frames;
+	rtpio->read_frames += num_frames;
+	rate_estimator_add_frames(rtpio->rate_est, -(int)num_frames);
+
+	/* Ran dry, wait for the buffer to fill up again. */
+	if ((int32_t)(rtpio->end_ts - rtpio->read_ts) <= 0) {
+		rtpio->end_ts = rtpio->read_ts;
+		rtpio->playing = 0;
+	}
+}
+
+/*
+ * iodev callbacks.
+ */
+
+static int frames_queued(const struct cras_iodev *iodev,
+			 struct timespec *tstamp)
+{
+	struct rtp_iodev *rtpio = (struct rtp_iodev *)iodev;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, tstamp);
+	if (iodev->direction == CRAS_STREAM_OUTPUT)
+		return output_level(rtpio);
+
+	receive_packets(rtpio);
+	update_playout(rtpio, tstamp);
+	return input_level(rtpio, tstamp);
+}
+
+static int delay_frames(const struct cras_iodev *iodev)
+{
+	struct timespec tstamp;
+
+	return frames_queued(iodev, &tstamp);
+}
+
+static int close_dev(struct cras_iodev *iodev)
+{
+	struct rtp_iodev *rtpio = (struct rtp_iodev *)iodev;
+
+	if (rtpio->fd >= 0)
+		close(rtpio->fd);
+	rtpio->fd = -1;
+	free(rtpio->audio_buffer);
+	rtpio->audio_buffer = NULL;
+	free(rtpio->jitter_buf);
+	rtpio->jitter_buf = NULL;
+	rate_estimator_destroy(rtpio->rate_est);
+	rtpio->rate_est = NULL;
+	cras_iodev_free_audio_area(iodev);
+	return 0;
+}
+
+static int configure_dev(struct cras_iodev *iodev)
+{
+	struct rtp_iodev *rtpio = (struct rtp_iodev *)iodev;
+	const struct sockaddr *addr = (const struct sockaddr *)&rtpio->addr;
+	int rc;
+
+	if (iodev->format == NULL)
+		return -EINVAL;
+
+	rtpio->fd = socket(addr->sa_family,
+			   SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (rtpio->fd < 0)
+		return -errno;
+	if (iodev->direction == CRAS_STREAM_OUTPUT)
+		rc = connect(rtpio->fd, addr, rtpio->addrlen);
+	else
+		rc = bind(rtpio->fd, addr, rtpio->addrlen);
+	if (rc < 0) {
+		rc = -errno;
+		syslog(LOG_ERR, "Failed to set up RTP socket, rc %d", rc);
+		close_dev(iodev);
+		return rc;
+	}
+
+	cras_iodev_init_audio_area(iodev, iodev->format->num_channels);
+	rtpio->audio_buffer = calloc(RTP_BUFFER_FRAMES, RTP_FRAME_BYTES);
+	if (!rtpio->audio_buffer)
+		goto no_mem;
+
+	if (iodev->direction == CRAS_STREAM_OUTPUT) {
+		rtpio->written_frames = 0;
+		rtpio->pending_frames = 0;
+		rtpio->send_failed = 0;
+		clock_gettime(CLOCK_MONOTONIC_RAW, &rtpio->dev_start_time);
+		return 0;
+	}
+
+	rtpio->jitter_buf = calloc(RTP_BUFFER_FRAMES, RTP_FRAME_BYTES);
+	rtpio->rate_est = rate_estimator_create(RTP_RATE,
+						&rate_estimation_window_sz,
+						rate_estimation_smooth_factor);
+	if (!rtpio->jitter_buf || !rtpio->rate_est)
+		goto no_mem;
+	reset_jitter_buffer(rtpio);
+	rtpio->playout_rate = RTP_RATE;
+	rtpio->read_frames = 0;
+	return 0;
+
+no_mem:
+	close_dev(iodev);
+	return -ENOMEM;
+}
+
+static int get_buffer(struct cras_iodev *iodev, struct cras_audio_area **area,
+		      unsigned *frames)
+{
+	struct rtp_iodev *rtpio = (struct rtp_iodev *)iodev;
+	struct timespec now;
+	unsigned int n;
+
+	if (iodev->direction == CRAS_STREAM_OUTPUT) {
+		*frames = MIN(*frames, RTP_BUFFER_FRAMES - output_level(rtpio));
+	} else {
+		clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+		*frames = MIN(*frames, input_level(rtpio, &now));
+		n = MIN(*frames, RTP_BUFFER_FRAMES - rtpio->read_pos);
+		memcpy(rtpio->audio_buffer,
+		       rtpio->jitter_buf + rtpio->read_pos * RTP_FRAME_BYTES,
+		       n * RTP_FRAME_BYTES);
+		memcpy(rtpio->audio_buffer + n * RTP_FRAME_BYTES,
+		       rtpio->jitter_buf, (*frames - n) * RTP_FRAME_BYTES);
+	}
+
+	iodev->area->frames = *frames;
+	cras_audio_area_config_buf_pointers(iodev->area, iodev->format,
+					    rtpio->audio_buffer);
+	*area = iodev->area;
+	return 0;
+}
+
+/*
+ * Returns -EPIPE if there are not enough frames or spaces in device buffer.
+ * It matches other alsa-based devices.
+ */
+static int put_buffer(struct cras_iodev *iodev, unsigned frames)
+{
+	struct rtp_iodev *rtpio = (struct rtp_iodev *)iodev;
+	struct timespec now;
+
+	if (iodev->direction == CRAS_STREAM_INPUT) {
+		clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+		if (input_level(rtpio, &now) < frames)
+			return -EPIPE;
+		consume_frames(rtpio, frames);
+		return 0;
+	}
+
+	if (RTP_BUFFER_FRAMES - output_level(rtpio) < frames)
+		return -EPIPE;
+	output_frames(rtpio, rtpio->audio_buffer, frames);
+	rtpio->written_frames += frames;
+	return 0;
+}
+
+static int flush_buffer(struct cras_iodev *iodev)
+{
+	struct rtp_iodev *rtpio = (struct rtp_iodev *)iodev;
+
+	if (iodev->direction == CRAS_STREAM_INPUT) {
+		reset_jitter_buffer(rtpio);
+		rate_estimator_reset_rate(rtpio->rate_est, RTP_RATE);
+		rtpio->playout_rate = RTP_RATE;
+		return 0;
+	}
+
+	rtpio->written_frames = 0;
+	rtpio->pending_frames = 0;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &rtpio->dev_start_time);
+	return 0;
+}
+
+static void update_active_node(struct cras_iodev *iodev, unsigned node_idx,
+			       unsigned dev_enabled)
+{
+}
+
+/*
+ * Exported Interface.
+ */
+
+struct cras_iodev *rtp_iodev_create(enum CRAS_STREAM_DIRECTION direction,
+				    const struct sockaddr *addr,
+				    socklen_t addrlen)
+{
+	struct rtp_iodev *rtpio;
+	struct cras_iodev *iodev;
+	struct cras_ionode *node;
+
+	if (direction != CRAS_STREAM_INPUT && direction != CRAS_STREAM_OUTPUT)
+		return NULL;
+	if (addrlen > sizeof(rtpio->addr))
+		return NULL;
+
+	rtpio = calloc(1, sizeof(*rtpio));
+	if (rtpio == NULL)
+		return NULL;
+	memcpy(&rtpio->addr, addr, addrlen);
+	rtpio->addrlen = addrlen;
+	rtpio->fd = -1;
+	rtpio->ssrc = rand();
+	iodev = &rtpio->base;
+	iodev->direction = direction;
+
+	iodev->supported_rates = rtp_supported_rates;
+	iodev->supported_channel_counts = rtp_supported_channel_counts;
+	iodev->supported_formats = rtp_supported_formats;
+	iodev->buffer_size = RTP_BUFFER_FRAMES;
+
+	iodev->configure_dev = configure_dev;
+	iodev->close_dev = close_dev;
+	iodev->frames_queued = frames_queued;
+	iodev->delay_frames = delay_frames;
+	iodev->get_buffer = get_buffer;
+	iodev->put_buffer = put_buffer;
+	iodev->flush_buffer = flush_buffer;
+	iodev->update_active_node = update_active_node;
+	iodev->no_stream = cras_iodev_default_no_stream_playback;
+
+	node = (struct cras_ionode *)calloc(1, sizeof(*node));
+	node->dev = iodev;
+	node->type = CRAS_NODE_TYPE_UNKNOWN;
+	node->plugged = 1;
+	node->volume = 100;
+	node->ui_gain_scaler = 1.0f;
+	strcpy(node->name, "(default)");
+	cras_iodev_add_node(iodev, node);
+	cras_iodev_set_active_node(iodev, node);
+
+	iodev->info.max_supported_channels = 2;
+
+	if (direction == CRAS_STREAM_INPUT) {
+		snprintf(iodev->info.name, ARRAY_SIZE(iodev->info.name),
+			 "RTP record device.");
+		cras_iodev_list_add_input(iodev);
+	} else {
+		snprintf(iodev->info.name, ARRAY_SIZE(iodev->info.name),
+			 "RTP playback device.");
+		cras_iodev_list_add_output(iodev);
+	}
+
+	return iodev;
+}
+
+void rtp_iodev_destroy(struct cras_iodev *iodev)
+{
+	struct rtp_iodev *rtpio = (struct rtp_iodev *)iodev;
+
+	if (iodev->direction == CRAS_STREAM_INPUT)
+		cras_iodev_list_rm_input(iodev);
+	else
+		cras_iodev_list_rm_output(iodev);
+	free(iodev->active_node);
+	cras_iodev_free_resources(iodev);
+	free(rtpio);
+}
@@ -0,0 +1,36 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_RTP_IODEV_H_
+#define CRAS_RTP_IODEV_H_
+
+#include <sys/socket.h>
+
+#include "cras_types.h"
+
+struct cras_iodev;
+
+/* Initializes an RTP iodev streaming 48kHz stereo L16 audio over UDP.
+ *
+ * An output sends what it plays to a remote sink, paced by the local clock.
+ * An input receives from a remote sender into a jitter buffer, and captures
+ * at the rate the sender's clock is estimated to run at so that streams
+ * follow its drift.
+ * Args:
+ *    direction - input or output.
+ *    addr - For output: the address to send to. For input: the local
+ *        address to receive on.
+ *    addrlen - The size of addr.
+ * Returns:
+ *    A pointer to the newly created iodev if successful, NULL otherwise.
+ */
+struct cras_iodev *rtp_iodev_create(enum CRAS_STREAM_DIRECTION direction,
+				    const struct sockaddr *addr,
+				    socklen_t addrlen);
+
+/* Destroys an rtp_iodev created with rtp_iodev_create. */
+void rtp_iodev_destroy(struct cras_iodev *iodev);
+
+#endif /* CRAS_RTP_IODEV_H_ */
@@ -9,11 +9,11 @@
 #include <dbus/dbus.h>
 #endif
 #include <errno.h>
-#include <poll.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/param.h>
 #include <sys/select.h>
 #include <sys/socket.h>
@@ -37,6 +37,7 @@
 #include "cras_audio_thread_monitor.h"
 #include "cras_config.h"
 #include "cras_device_monitor.h"
+#include "cras_fmt_conv.h"
 #include "cras_hotword_handler.h"
 #include "cras_iodev_list.h"
 #include "cras_main_message.h"
@@ -44,31 +45,57 @@
 #include "cras_metrics.h"
 #include "cras_non_empty_audio_handler.h"
 #include "cras_observer.h"
+#include "cras_overload.h"
 #include "cras_rclient.h"
 #include "cras_server.h"
 #include "cras_server_metrics.h"
+#include "cras_startup_log.h"
 #include "cras_system_state.h"
 #include "cras_tm.h"
 #include "cras_types.h"
 #include "cras_udev.h"
 #include "cras_util.h"
 #include "cras_mix.h"
+#include "drc_kernel.h"
+#include "drc_kernel_ops.h"
+#include "dsp_ops.h"
+#include "linear_resampler.h"
 #include "utlist.h"
 
+/* The maximum number of ready fds handled per main loop iteration. The rest
+ * are reported again by the next epoll_wait. */
+#define MAX_EPOLL_EVENTS 32
+/* Most messages read from one client each time its socket is ready. */
+#define MAX_MSGS_PER_WAKE 16
+
+/* The kinds of objects whose fd is registered to the epoll of the main loop.
+ */
+enum server_poll_type {
+	SERVER_POLL_SOCKET,
+	SERVER_POLL_CLIENT,
+	SERVER_POLL_CALLBACK,
+};
+
+/* First member of every object registered to the epoll of the main loop. The
+ * epoll data points to it, so a ready fd leads straight to its object. */
+struct server_poll_entry {
+	enum server_poll_type type;
+};
+
 /* Store a list of clients that are attached to the server.
  * Members:
+ *    poll_entry - Registration of fd in the main loop.
  *    id - Unique identifier for this client.
  *    fd - socket file descriptor used to communicate with client.
  *    ucred - Process, user, and group ID of the client.
  *    client - rclient to handle messages from this client.
- *    pollfd - Pointer to struct pollfd for this callback.
  */
 struct attached_client {
+	struct server_poll_entry poll_entry;
 	size_t id;
 	int fd;
 	struct ucred ucred;
 	struct cras_rclient *client;
-	struct pollfd *pollfd;
 	struct attached_client *next, *prev;
 };
 
@@ -78,17 +105,19 @@ struct attached_client {
  * it.  This allows the use of the main server loop instead of spawning a thread
  * to watch file descriptors.  The client can then read or write the fd.
  * Members:
+ *    poll_entry - Registration of select_fd in the main loop.
  *    fd - The file descriptor passed to select.
  *    callback - The funciton to call when fd is ready.
  *    callback_data - Pointer passed to the callback.
- *    pollfd - Pointer to struct pollfd for this callback.
+ *    deleted - Set once removed. The callback is freed at the end of the main
+ *        loop iteration, as ready events may still point to it.
  *    events - The events to poll for.
  */
 struct client_callback {
+	struct server_poll_entry poll_entry;
 	int select_fd;
 	void (*callback)(void *data, int revents);
 	void *callback_data;
-	struct pollfd *pollfd;
 	int deleted;
 	int events;
 	struct client_callback *prev, *next;
@@ -103,26 +132,50 @@ struct system_task {
 
 /* A structure wraps data related to server socket. */
 struct server_socket {
+	struct server_poll_entry poll_entry;
 	struct sockaddr_un addr;
 	int fd;
 	enum CRAS_CONNECTION_TYPE type;
 };
 
-/* Local server data. */
+/* Local server data.
+ * clients_changed - Set when clients attached or left since the list of
+ *     clients was last published.
+ */
 struct server_data {
+	int epoll_fd;
 	struct attached_client *clients_head;
 	size_t num_clients;
+	int clients_changed;
 	struct client_callback *client_callbacks;
 	struct system_task *system_tasks;
-	size_t num_client_callbacks;
 	size_t next_client_id;
 	struct server_socket server_sockets[CRAS_NUM_CONN_TYPE];
 } server_instance;
 
+/* Registers fd to the epoll of the main loop. The ready events of fd are
+ * reported with entry. */
+static int server_poll_add(int fd, int events, struct server_poll_entry *entry)
+{
+	struct epoll_event ev;
+
+	ev.events = events;
+	ev.data.ptr = entry;
+	if (epoll_ctl(server_instance.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		return -errno;
+	return 0;
+}
+
+static void server_poll_rm(int fd)
+{
+	epoll_ctl(server_instance.epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
 /* Cleanup a given server_socket */
 static void server_socket_cleanup(struct server_socket *socket)
 {
 	if (socket && socket->fd >= 0) {
+		server_poll_rm(socket->fd);
 		close(socket->fd);
 		socket->fd = -1;
 		unlink(socket->addr.sun_path);
@@ -130,32 +183,47 @@ static void server_socket_cleanup(struct server_socket *socket)
 }
 
 /* Remove a client from the list and destroy it.  Calling rclient_destroy will
- * also free all the streams owned by the client */
+ * also free all the streams owned by the client. The client is freed right
+ * away, so this must only be called from its own message handler; a ready
+ * event of the current epoll batch would otherwise point to freed memory. */
 static void remove_client(struct attached_client *client)
 {
+	server_poll_rm(client->fd);
 	close(client->fd);
 	DL_DELETE(server_instance.clients_head, client);
 	server_instance.num_clients--;
+	server_instance.clients_changed = 1;
 	cras_rclient_destroy(client->client);
 	free(client);
 }
 
 /* This is called when "select" indicates that the client has written data to
- * the socket.  Read out one message and pass it to the client message handler.
+ * the socket.  Read out the queued messages, up to MAX_MSGS_PER_WAKE, and pass
+ * them to the client message handler. Anything left is reported again by the
+ * next epoll_wait, so one busy client can't starve the others.
  */
 static void handle_message_from_client(struct attached_client *client)
 {
 	uint8_t buf[CRAS_SERV_MAX_MSG_SIZE];
 	int nread;
-	unsigned int num_fds = 2;
-	int fds[num_fds];
-
-	nread = cras_recv_with_fds(client->fd, buf, sizeof(buf), fds, &num_fds);
-	if (nread < 0)
-		goto read_error;
-	if (cras_rclient_buffer_from_client(client->client, buf, nread, fds,
-					    num_fds) < 0)
-		goto read_error;
+	unsigned int num_fds;
+	/* Enough for the audio fds of a batch of streams. */
+	int fds[CRAS_MAX_BATCH_STREAMS];
+	unsigned int i;
+
+	for (i = 0; i < MAX_MSGS_PER_WAKE; i++) {
+		num_fds = CRAS_MAX_BATCH_STREAMS;
+		nread = cras_recv_with_fds_nonblocking(client->fd, buf,
+						       sizeof(buf), fds,
+						       &num_fds);
+		if (nread == -EAGAIN || nread == -EWOULDBLOCK)
+			return;
+		if (nread < 0)
+			goto read_error;
+		if (cras_rclient_buffer_from_client(client->client, buf, nread,
+						    fds, num_fds) < 0)
+			goto read_error;
+	}
 	return;
 
 read_error:
@@ -184,6 +252,15 @@ static void fill_client_info(struct attached_client *client)
 		syslog(LOG_INFO, "Failed to get client socket info\n");
 }
 
+/* Sends the messages held for each client during this main loop iteration. */
+static void flush_client_messages(struct server_data *serv)
+{
+	struct attached_client *c;
+
+	DL_FOREACH (serv->clients_head, c)
+		cras_rclient_flush_messages(c->client);
+}
+
 /* Fills the server_state with the current list of attached clients. */
 static void send_client_list_to_clients(struct server_data *serv)
 {
@@ -196,6 +273,7 @@ static void send_client_list_to_clients(struct server_data *serv)
 	if (!state)
 		return;
 
+	cras_system_state_section_begin(state, CRAS_STATE_CLIENTS);
 	state->num_attached_clients =
 		MIN(CRAS_MAX_ATTACHED_CLIENTS, serv->num_clients);
 
@@ -210,10 +288,24 @@ static void send_client_list_to_clients(struct server_data *serv)
 		if (++i == CRAS_MAX_ATTACHED_CLIENTS)
 			break;
 	}
+	cras_system_state_section_complete(state, CRAS_STATE_CLIENTS);
 
 	cras_system_state_update_complete();
 }
 
+/* Sends a current list of available inputs and outputs and of the attached
+ * clients, once for all the clients which attached or left during a main loop
+ * iteration. A client connecting in a loop can't make every other client
+ * handle an update per connection. */
+static void publish_client_changes(struct server_data *serv)
+{
+	if (!serv->clients_changed)
+		return;
+	serv->clients_changed = 0;
+	cras_iodev_list_update_device_list();
+	send_client_list_to_clients(serv);
+}
+
 /* Handles requests from a client to attach to the server.  Create a local
  * structure to track the client, assign it a unique id and let it attach */
 static void handle_new_connection(struct server_socket *server_socket)
@@ -252,9 +344,9 @@ static void handle_new_connection(struct server_socket *server_socket)
 	/* When full, getting an error is preferable to blocking. */
 	cras_make_fd_nonblocking(connection_fd);
 
+	poll_client->poll_entry.type = SERVER_POLL_CLIENT;
 	poll_client->fd = connection_fd;
 	poll_client->next = NULL;
-	poll_client->pollfd = NULL;
 	fill_client_info(poll_client);
 
 	poll_client->client = cras_rclient_create(
@@ -264,11 +356,22 @@ static void handle_new_connection(struct server_socket *server_socket)
 		goto error;
 	}
 
+	/* Notifications are sent in one batch per main loop iteration. */
+	if (cras_rclient_hold_messages(poll_client->client))
+		syslog(LOG_WARNING, "Client %zu messages are sent unbatched",
+		       poll_client->id);
+
+	if (server_poll_add(connection_fd, EPOLLIN, &poll_client->poll_entry)) {
+		syslog(LOG_ERR, "failed to poll client");
+		cras_rclient_destroy(poll_client->client);
+		goto error;
+	}
+
 	DL_APPEND(server_instance.clients_head, poll_client);
 	server_instance.num_clients++;
-	/* Send a current list of available inputs and outputs. */
-	cras_iodev_list_update_device_list();
-	send_client_list_to_clients(&server_instance);
+	/* The lists are published before the next wait, see
+	 * publish_client_changes. */
+	server_instance.clients_changed = 1;
 	return;
 error:
 	close(connection_fd);
@@ -285,6 +388,7 @@ static int add_select_fd(int fd, void (*cb)(void *data, int events),
 	struct client_callback *new_cb;
 	struct client_callback *client_cb;
 	struct server_data *serv;
+	int rc;
 
 	serv = (struct server_data *)server_data;
 	if (serv == NULL)
@@ -299,15 +403,21 @@ static int add_select_fd(int fd, void (*cb)(void *data, int events),
 	if (new_cb == NULL)
 		return -ENOMEM;
 
+	new_cb->poll_entry.type = SERVER_POLL_CALLBACK;
 	new_cb->select_fd = fd;
 	new_cb->callback = cb;
 	new_cb->callback_data = callback_data;
 	new_cb->deleted = 0;
 	new_cb->events = events;
-	new_cb->pollfd = NULL;
+
+	/* The POLL* event bits have the same values as the EPOLL* ones. */
+	rc = server_poll_add(fd, events, &new_cb->poll_entry);
+	if (rc) {
+		free(new_cb);
+		return rc;
+	}
 
 	DL_APPEND(serv->client_callbacks, new_cb);
-	server_instance.num_client_callbacks++;
 	return 0;
 }
 
@@ -324,8 +434,12 @@ static void rm_select_fd(int fd, void *server_data)
 		return;
 
 	DL_FOREACH (serv->client_callbacks, client_cb)
-		if (client_cb->select_fd == fd)
+		if (client_cb->select_fd == fd && !client_cb->deleted) {
+			/* Unregister now, the fd may be closed once we return.
+			 */
+			server_poll_rm(fd);
 			client_cb->deleted = 1;
+		}
 }
 
 /* Creates a new task entry and append to system_tasks list, which will be
@@ -366,7 +480,6 @@ static void cleanup_select_fds(void *server_data)
 	DL_FOREACH (serv->client_callbacks, client_cb)
 		if (client_cb->deleted) {
 			DL_DELETE(serv->client_callbacks, client_cb);
-			server_instance.num_client_callbacks--;
 			free(client_cb);
 		}
 }
@@ -435,6 +548,52 @@ int cpu_get_flags(void)
 	return 0;
 }
 
+static const struct drc_kernel_ops *get_drc_kernel_ops(unsigned int cpu_flags)
+{
+#if defined HAVE_FMA
+	if (cpu_flags & CPU_X86_FMA)
+		return &drc_kernel_ops_fma;
+#endif
+#if defined HAVE_AVX2
+	if (cpu_flags & CPU_X86_AVX2)
+		return &drc_kernel_ops_avx2;
+#endif
+#if defined HAVE_AVX
+	if (cpu_flags & CPU_X86_AVX)
+		return &drc_kernel_ops_avx;
+#endif
+#if defined HAVE_SSE42
+	if (cpu_flags & CPU_X86_SSE4_2)
+		return &drc_kernel_ops_sse42;
+#endif
+
+	/* default NEON, SSE or C implementation */
+	return &drc_kernel_ops;
+}
+
+static const struct dsp_ops *get_dsp_ops(unsigned int cpu_flags)
+{
+#if defined HAVE_FMA
+	if (cpu_flags & CPU_X86_FMA)
+		return &dsp_ops_fma;
+#endif
+#if defined HAVE_AVX2
+	if (cpu_flags & CPU_X86_AVX2)
+		return &dsp_ops_avx2;
+#endif
+#if defined HAVE_AVX
+	if (cpu_flags & CPU_X86_AVX)
+		return &dsp_ops_avx;
+#endif
+#if defined HAVE_SSE42
+	if (cpu_flags & CPU_X86_SSE4_2)
+		return &dsp_ops_sse42;
+#endif
+
+	/* default NEON, SSE or C implementation */
+	return &dsp_ops;
+}
+
 /*
  * Exported Interface.
  */
@@ -446,11 +605,21 @@ int cras_server_init()
 
 	server_instance.next_client_id = RESERVED_CLIENT_IDS;
 
+	server_instance.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (server_instance.epoll_fd < 0) {
+		syslog(LOG_ERR, "Failed to create epoll fd.");
+		return -errno;
+	}
+
 	/* Initialize global observer. */
 	cras_observer_server_init();
 
-	/* init mixer with CPU capabilities */
+	/* init mixer and converters with CPU capabilities */
 	cras_mix_init(cpu_get_flags());
+	cras_fmt_conv_init(cpu_get_flags());
+	linear_resampler_init(cpu_get_flags());
+	dk_set_ops(get_drc_kernel_ops(cpu_get_flags()));
+	dsp_set_ops(get_dsp_ops(cpu_get_flags()));
 
 	/* Allow clients to register callbacks for file descriptors.
 	 * add_select_fd and rm_select_fd will add and remove file descriptors
@@ -526,6 +695,11 @@ static int create_and_listen_server_socket(enum CRAS_CONNECTION_TYPE conn_type,
 		goto error;
 	}
 
+	server_socket->poll_entry.type = SERVER_POLL_SOCKET;
+	rc = server_poll_add(socket_fd, EPOLLIN, &server_socket->poll_entry);
+	if (rc < 0)
+		goto error;
+
 	server_socket->fd = socket_fd;
 	server_socket->type = conn_type;
 	return 0;
@@ -549,24 +723,26 @@ static void cleanup_server_sockets()
 int cras_server_run(unsigned int profile_disable_mask)
 {
 	static const unsigned int OUTPUT_CHECK_MS = 5 * 1000;
+	static const unsigned int OUTPUT_CHECK_SLACK_MS = 1000;
+	/* Timer callbacks and dbus timeouts don't need better than a
+	 * millisecond, let the kernel batch the main thread wake ups. The
+	 * real time threads drop it when they start. */
+	static const unsigned long MAIN_THREAD_TIMER_SLACK_NS = 1000000;
 #ifdef CRAS_DBUS
 	DBusConnection *dbus_conn;
 #endif
 	int rc = 0;
-	struct attached_client *elm;
-	struct client_callback *client_cb;
 	struct system_task *tasks;
 	struct system_task *system_task;
 	struct cras_tm *tm;
-	struct timespec ts, *poll_timeout;
-	int timers_active;
-	struct pollfd *pollfds;
-	unsigned int pollfds_size = 32;
-	unsigned int num_pollfds, poll_size_needed;
-
-	pollfds = malloc(sizeof(*pollfds) * pollfds_size);
+	struct timespec ts;
+	int timers_active, poll_timeout_ms;
+	struct epoll_event events[MAX_EPOLL_EVENTS];
+	int i, phase;
 
+	phase = cras_startup_log_begin(STARTUP_UDEV_ENUMERATE, 0, 0);
 	cras_udev_start_sound_subsystem_monitor();
+	cras_startup_log_end(phase);
 #ifdef CRAS_DBUS
 	cras_bt_device_start_monitor();
 #endif
@@ -581,7 +757,10 @@ int cras_server_run(unsigned int profile_disable_mask)
 
 	cras_audio_thread_monitor_init();
 
+	cras_overload_handler_init();
+
 #ifdef CRAS_DBUS
+	phase = cras_startup_log_begin(STARTUP_BT_INIT, 0, 0);
 	dbus_threads_init_default();
 	dbus_conn = cras_dbus_connect_system_bus();
 	if (dbus_conn) {
@@ -596,6 +775,7 @@ int cras_server_run(unsigned int profile_disable_mask)
 		cras_bt_player_create(dbus_conn);
 		cras_dbus_control_start(dbus_conn);
 	}
+	cras_startup_log_end(phase);
 #endif
 
 	for (int conn_type = 0; conn_type < CRAS_NUM_CONN_TYPE; conn_type++) {
@@ -613,42 +793,14 @@ int cras_server_run(unsigned int profile_disable_mask)
 	}
 
 	/* After a delay, make sure there is at least one real output device. */
-	cras_tm_create_timer(tm, OUTPUT_CHECK_MS, check_output_exists, 0);
+	cras_tm_create_timer_slack(tm, OUTPUT_CHECK_MS, OUTPUT_CHECK_SLACK_MS,
+				   check_output_exists, 0);
+
+	cras_set_timer_slack(MAIN_THREAD_TIMER_SLACK_NS);
+	cras_startup_log_mark(STARTUP_READY, 0, 0);
 
 	/* Main server loop - client callbacks are run from this context. */
 	while (1) {
-		poll_size_needed = CRAS_NUM_CONN_TYPE +
-				   server_instance.num_clients +
-				   server_instance.num_client_callbacks;
-		if (poll_size_needed > pollfds_size) {
-			pollfds_size = 2 * poll_size_needed;
-			pollfds = realloc(pollfds,
-					  sizeof(*pollfds) * pollfds_size);
-		}
-
-		for (int conn_type = 0; conn_type < CRAS_NUM_CONN_TYPE;
-		     conn_type++) {
-			pollfds[conn_type].fd =
-				server_instance.server_sockets[conn_type].fd;
-			pollfds[conn_type].events = POLLIN;
-		}
-		num_pollfds = CRAS_NUM_CONN_TYPE;
-
-		DL_FOREACH (server_instance.clients_head, elm) {
-			pollfds[num_pollfds].fd = elm->fd;
-			pollfds[num_pollfds].events = POLLIN;
-			elm->pollfd = &pollfds[num_pollfds];
-			num_pollfds++;
-		}
-		DL_FOREACH (server_instance.client_callbacks, client_cb) {
-			if (client_cb->deleted)
-				continue;
-			pollfds[num_pollfds].fd = client_cb->select_fd;
-			pollfds[num_pollfds].events = client_cb->events;
-			client_cb->pollfd = &pollfds[num_pollfds];
-			num_pollfds++;
-		}
-
 		tasks = server_instance.system_tasks;
 		server_instance.system_tasks = NULL;
 		DL_FOREACH (tasks, system_task) {
@@ -662,38 +814,60 @@ int cras_server_run(unsigned int profile_disable_mask)
 		/*
 		 * If new client task has been scheduled, no need to wait
 		 * for timeout, just do another loop to execute them.
+		 * Round the timeout up so that the next timer has expired when
+		 * epoll_wait returns.
 		 */
-		if (server_instance.system_tasks)
-			poll_timeout = NULL;
+		if (!server_instance.system_tasks && timers_active)
+			poll_timeout_ms = ts.tv_sec * 1000 +
+					  (ts.tv_nsec + 999999) / 1000000;
 		else
-			poll_timeout = timers_active ? &ts : NULL;
+			poll_timeout_ms = -1;
 
-		rc = ppoll(pollfds, num_pollfds, poll_timeout, NULL);
+		publish_client_changes(&server_instance);
+		flush_client_messages(&server_instance);
+
+		rc = epoll_wait(server_instance.epoll_fd, events,
+				MAX_EPOLL_EVENTS, poll_timeout_ms);
 		if (rc < 0)
 			continue;
 
 		cras_tm_call_callbacks(tm);
 
-		/* Check for new connections. */
-		for (int conn_type = 0; conn_type < CRAS_NUM_CONN_TYPE;
-		     conn_type++) {
-			if (pollfds[conn_type].revents & POLLIN)
-				handle_new_connection(
-					&server_instance
-						 .server_sockets[conn_type]);
+		/* Only the ready fds are visited. A client is only removed
+		 * from its own handler, after its last event of this batch,
+		 * so it can be freed right away. Callbacks can be deleted
+		 * from any handler and stay allocated until
+		 * cleanup_select_fds. */
+		for (i = 0; i < rc; i++) {
+			struct server_poll_entry *entry = events[i].data.ptr;
+			struct client_callback *client_cb;
+
+			switch (entry->type) {
+			case SERVER_POLL_SOCKET:
+				/* Check for new connections. */
+				if (events[i].events & EPOLLIN)
+					handle_new_connection(
+						(struct server_socket *)entry);
+				break;
+			case SERVER_POLL_CLIENT:
+				/* Messages pending for a client. */
+				if (events[i].events & EPOLLIN)
+					handle_message_from_client(
+						(struct attached_client *)
+							entry);
+				break;
+			case SERVER_POLL_CALLBACK:
+				/* A client-registered fd/callback pair. */
+				client_cb = (struct client_callback *)entry;
+				if (!client_cb->deleted &&
+				    (events[i].events & client_cb->events))
+					client_cb->callback(
+						client_cb->callback_data,
+						events[i].events);
+				break;
+			}
 		}
 
-		/* Check if there are messages pending for any clients. */
-		DL_FOREACH (server_instance.clients_head, elm)
-			if (elm->pollfd && elm->pollfd->revents & POLLIN)
-				handle_message_from_client(elm);
-		/* Check any client-registered fd/callback pairs. */
-		DL_FOREACH (server_instance.client_callbacks, client_cb)
-			if (!client_cb->deleted && client_cb->pollfd &&
-			    (client_cb->pollfd->revents & client_cb->events))
-				client_cb->callback(client_cb->callback_data,
-						    client_cb->pollfd->revents);
-
 		cleanup_select_fds(&server_instance);
 
 #ifdef CRAS_DBUS
@@ -706,8 +880,8 @@ int cras_server_run(unsigned int profile_disable_mask)
 
 bail:
 	cleanup_server_sockets();
-	free(pollfds);
 	cras_observer_server_free();
+	cras_server_metrics_deinit();
 	return rc;
 }
 
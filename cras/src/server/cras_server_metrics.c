@@ -5,6 +5,8 @@
 
 #include <errno.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 #include <syslog.h>
@@ -14,12 +16,15 @@
 #endif
 #include "cras_iodev.h"
 #include "cras_metrics.h"
-#include "cras_main_message.h"
 #include "cras_rstream.h"
 #include "cras_server_metrics.h"
-#include "cras_system_state.h"
+#include "cras_util.h"
 
 #define METRICS_NAME_BUFFER_SIZE 100
+/* Number of messages queued between two flushes. */
+#define METRICS_QUEUE_SIZE 256
+/* Number of distinct samples accumulated before they are sent. */
+#define METRICS_MAX_SAMPLES 128
 
 const char kBusyloop[] = "Cras.Busyloop";
 const char kBusyloopLength[] = "Cras.BusyloopLength";
@@ -74,6 +79,12 @@ const double MISSED_CB_FREQUENCY_SECONDS_MIN = 10.0;
 const time_t CRAS_METRICS_SHORT_PERIOD_THRESHOLD_SECONDS = 600;
 const time_t CRAS_METRICS_LONG_PERIOD_THRESHOLD_SECONDS = 3600;
 
+/* How often the queued metrics are sent, unless the queue fills up first. */
+static const unsigned int METRICS_FLUSH_INTERVAL_SEC = 30;
+
+/* Nice level of the thread sending the metrics, so it yields to audio work. */
+static const int METRICS_THREAD_NICE_LEVEL = 10;
+
 static const char *get_timespec_period_str(struct timespec ts)
 {
 	if (ts.tv_sec < CRAS_METRICS_SHORT_PERIOD_THRESHOLD_SECONDS)
@@ -166,6 +177,8 @@ struct cras_server_metrics_stream_data {
 	enum CRAS_CLIENT_TYPE type;
 	enum CRAS_STREAM_DIRECTION direction;
 	struct timespec runtime;
+	unsigned cpu_permille;
+	unsigned mem_kb;
 };
 
 struct cras_server_metrics_timespec_data {
@@ -182,40 +195,90 @@ union cras_server_metrics_data {
 };
 
 /*
- * Make sure the size of message in the acceptable range. Otherwise, it may
- * be split into mutiple packets while sending.
+ * Make sure the size of message in the acceptable range. Every slot of the
+ * message queues takes the size of the largest data.
  */
 static_assert(sizeof(union cras_server_metrics_data) <= 256,
 	      "The size is too large.");
 
 struct cras_server_metrics_message {
-	struct cras_main_message header;
 	enum CRAS_SERVER_METRICS_TYPE metrics_type;
 	union cras_server_metrics_data data;
 };
 
+/*
+ * Messages waiting to be handled by the metrics thread.
+ *    msgs - The queued messages.
+ *    num - The number of messages in msgs.
+ */
+struct metrics_queue {
+	struct cras_server_metrics_message msgs[METRICS_QUEUE_SIZE];
+	unsigned int num;
+};
+
+/*
+ * Identical samples of a histogram, sent together.
+ *    name - The name of the histogram.
+ *    sample - The sample, the lower bound of its bucket for a histogram which
+ *        is not sparse.
+ *    min, max, nbuckets - The layout of the histogram, nbuckets is 0 for a
+ *        sparse histogram.
+ *    count - The number of samples.
+ */
+struct metrics_sample {
+	char name[METRICS_NAME_BUFFER_SIZE];
+	int sample;
+	int min;
+	int max;
+	int nbuckets;
+	unsigned int count;
+};
+
+/*
+ * Messages are queued in pending by any thread. The metrics thread swaps the
+ * queues under queue_mutex and handles the other one without holding it.
+ */
+static struct metrics_queue queues[2];
+static struct metrics_queue *pending = &queues[0];
+static unsigned int num_dropped;
+static int stop_metrics_thread;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t metrics_thread;
+static int metrics_thread_started;
+
+/* Samples accumulated by the metrics thread. */
+static struct metrics_sample samples[METRICS_MAX_SAMPLES];
+static unsigned int num_samples;
+
 static void init_server_metrics_msg(struct cras_server_metrics_message *msg,
 				    enum CRAS_SERVER_METRICS_TYPE type,
 				    union cras_server_metrics_data data)
 {
 	memset(msg, 0, sizeof(*msg));
-	msg->header.type = CRAS_MAIN_METRICS;
-	msg->header.length = sizeof(*msg);
 	msg->metrics_type = type;
 	msg->data = data;
 }
 
-static void handle_metrics_message(struct cras_main_message *msg, void *arg);
-
-/* The wrapper function of cras_main_message_send. */
-static int cras_server_metrics_message_send(struct cras_main_message *msg)
+/* Queues a message for the metrics thread. This is all the work done on the
+ * calling thread. Returns -ENOSPC if the queue is full. */
+static int queue_metrics_message(const struct cras_server_metrics_message *msg)
 {
-	/* If current function is in the main thread, call handler directly. */
-	if (cras_system_state_in_main_thread()) {
-		handle_metrics_message(msg, NULL);
-		return 0;
+	int rc = 0;
+
+	pthread_mutex_lock(&queue_mutex);
+	if (pending->num == METRICS_QUEUE_SIZE) {
+		num_dropped++;
+		rc = -ENOSPC;
+	} else {
+		pending->msgs[pending->num++] = *msg;
+		/* Flush early rather than drop messages. */
+		if (pending->num == METRICS_QUEUE_SIZE / 2)
+			pthread_cond_signal(&queue_cond);
 	}
-	return cras_main_message_send(msg);
+	pthread_mutex_unlock(&queue_mutex);
+
+	return rc;
 }
 
 static inline const char *
@@ -404,8 +467,7 @@ int cras_server_metrics_hfp_sco_connection_error(
 	data.value = type;
 	init_server_metrics_msg(&msg, BT_SCO_CONNECTION_ERROR, data);
 
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR, "Failed to send metrics message: "
 				"BT_SCO_CONNECTION_ERROR");
@@ -423,8 +485,7 @@ int cras_server_metrics_hfp_battery_indicator(int battery_indicator_support)
 	data.value = battery_indicator_support;
 	init_server_metrics_msg(&msg, BT_BATTERY_INDICATOR_SUPPORTED, data);
 
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR, "Failed to send metrics message: "
 				"BT_BATTERY_INDICATOR_SUPPORTED");
@@ -442,8 +503,7 @@ int cras_server_metrics_hfp_battery_report(int battery_report)
 	data.value = battery_report;
 	init_server_metrics_msg(&msg, BT_BATTERY_REPORT, data);
 
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR, "Failed to send metrics message: "
 				"BT_BATTERY_REPORT");
@@ -463,8 +523,7 @@ int cras_server_metrics_hfp_packet_loss(float packet_loss_ratio)
 	data.value = (unsigned)(round(packet_loss_ratio * 1000));
 	init_server_metrics_msg(&msg, BT_WIDEBAND_PACKET_LOSS, data);
 
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR,
 		       "Failed to send metrics message: BT_WIDEBAND_PACKET_LOSS");
@@ -482,8 +541,7 @@ int cras_server_metrics_hfp_wideband_support(bool supported)
 	data.value = supported;
 	init_server_metrics_msg(&msg, BT_WIDEBAND_SUPPORTED, data);
 
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR,
 		       "Failed to send metrics message: BT_WIDEBAND_SUPPORTED");
@@ -501,8 +559,7 @@ int cras_server_metrics_hfp_wideband_selected_codec(int codec)
 	data.value = codec;
 	init_server_metrics_msg(&msg, BT_WIDEBAND_SELECTED_CODEC, data);
 
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR, "Failed to send metrics message: "
 				"BT_WIDEBAND_SELECTED_CODEC");
@@ -525,8 +582,7 @@ int cras_server_metrics_device_runtime(struct cras_iodev *iodev)
 
 	init_server_metrics_msg(&msg, DEVICE_RUNTIME, data);
 
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR,
 		       "Failed to send metrics message: DEVICE_RUNTIME");
@@ -550,8 +606,7 @@ int cras_server_metrics_device_volume(struct cras_iodev *iodev)
 
 	init_server_metrics_msg(&msg, DEVICE_VOLUME, data);
 
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR,
 		       "Failed to send metrics message: DEVICE_VOLUME");
@@ -598,8 +653,7 @@ int cras_server_metrics_highest_device_delay(
 		return 0;
 	}
 
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR,
 		       "Failed to send metrics message: HIGHEST_DEVICE_DELAY");
@@ -629,8 +683,7 @@ int cras_server_metrics_highest_hw_level(unsigned hw_level,
 		return 0;
 	}
 
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR,
 		       "Failed to send metrics message: HIGHEST_HW_LEVEL");
@@ -648,8 +701,7 @@ int cras_server_metrics_longest_fetch_delay(unsigned delay_msec)
 
 	data.value = delay_msec;
 	init_server_metrics_msg(&msg, LONGEST_FETCH_DELAY, data);
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR,
 		       "Failed to send metrics message: LONGEST_FETCH_DELAY");
@@ -667,8 +719,7 @@ int cras_server_metrics_num_underruns(unsigned num_underruns)
 
 	data.value = num_underruns;
 	init_server_metrics_msg(&msg, NUM_UNDERRUNS, data);
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR,
 		       "Failed to send metrics message: NUM_UNDERRUNS");
@@ -705,8 +756,7 @@ cras_server_metrics_missed_cb_frequency(const struct cras_rstream *stream)
 	else
 		init_server_metrics_msg(&msg, MISSED_CB_FREQUENCY_OUTPUT, data);
 
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR,
 		       "Failed to send metrics message: MISSED_CB_FREQUENCY");
@@ -737,8 +787,7 @@ cras_server_metrics_missed_cb_frequency(const struct cras_rstream *stream)
 			data);
 	}
 
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR,
 		       "Failed to send metrics message: MISSED_CB_FREQUENCY");
@@ -770,8 +819,7 @@ cras_server_metrics_missed_cb_first_time(const struct cras_rstream *stream)
 		init_server_metrics_msg(&msg, MISSED_CB_FIRST_TIME_OUTPUT,
 					data);
 	}
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR, "Failed to send metrics message: "
 				"MISSED_CB_FIRST_TIME");
@@ -801,8 +849,7 @@ cras_server_metrics_missed_cb_second_time(const struct cras_rstream *stream)
 		init_server_metrics_msg(&msg, MISSED_CB_SECOND_TIME_OUTPUT,
 					data);
 	}
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR, "Failed to send metrics message: "
 				"MISSED_CB_SECOND_TIME");
@@ -850,8 +897,7 @@ cras_server_metrics_stream_config(const struct cras_rstream_config *config)
 	data.stream_config.client_type = config->client_type;
 
 	init_server_metrics_msg(&msg, STREAM_CONFIG, data);
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR,
 		       "Failed to send metrics message: STREAM_CONFIG");
@@ -867,6 +913,7 @@ int cras_server_metrics_stream_runtime(const struct cras_rstream *stream)
 	struct cras_server_metrics_message msg;
 	union cras_server_metrics_data data;
 	struct timespec now;
+	uint64_t runtime_ns, cost_ns;
 	int err;
 
 	data.stream_data.type = stream->client_type;
@@ -874,10 +921,18 @@ int cras_server_metrics_stream_runtime(const struct cras_rstream *stream)
 	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 	subtract_timespecs(&now, &stream->start_ts, &data.stream_data.runtime);
 
+	/* Share of the audio thread time spent on this stream, in 1/1000. */
+	runtime_ns = (uint64_t)data.stream_data.runtime.tv_sec * 1000000000 +
+		     data.stream_data.runtime.tv_nsec;
+	cost_ns = stream->cost.convert_ns + stream->cost.mix_ns +
+		  stream->cost.apm_ns;
+	data.stream_data.cpu_permille =
+		runtime_ns ? (unsigned)(cost_ns * 1000 / runtime_ns) : 0;
+	data.stream_data.mem_kb = (unsigned)(stream->cost.mem_bytes / 1024);
+
 	init_server_metrics_msg(&msg, STREAM_RUNTIME, data);
 
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR,
 		       "Failed to send metrics message: STREAM_RUNTIME");
@@ -913,8 +968,7 @@ int cras_server_metrics_busyloop(struct timespec *ts, unsigned count)
 
 	init_server_metrics_msg(&msg, BUSYLOOP, data);
 
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR, "Failed to send metrics message: BUSYLOOP");
 		return err;
@@ -932,8 +986,7 @@ int cras_server_metrics_busyloop_length(unsigned length)
 
 	init_server_metrics_msg(&msg, BUSYLOOP_LENGTH, data);
 
-	err = cras_server_metrics_message_send(
-		(struct cras_main_message *)&msg);
+	err = queue_metrics_message(&msg);
 	if (err < 0) {
 		syslog(LOG_ERR,
 		       "Failed to send metrics message: BUSYLOOP_LENGTH");
@@ -942,6 +995,97 @@ int cras_server_metrics_busyloop_length(unsigned length)
 	return 0;
 }
 
+/*
+ * Gets the lower bound of the bucket of sample, in a histogram of nbuckets
+ * buckets between min and max laid out like UMA does: an underflow bucket, then
+ * exponentially growing buckets, then an overflow bucket from max. UMA counts
+ * every sample of a bucket the same, so samples are accumulated as the lower
+ * bound of their bucket.
+ */
+static int histogram_bucket_min(int sample, int min, int max, int nbuckets)
+{
+	double log_max, log_current;
+	int current, next, bucket;
+
+	if (min < 1)
+		min = 1;
+	if (sample < min)
+		return 0;
+
+	log_max = log(max);
+	current = min;
+	for (bucket = 2; bucket < nbuckets; bucket++) {
+		log_current = log(current);
+		next = (int)round(exp(log_current + (log_max - log_current) /
+							   (nbuckets - bucket)));
+		if (next <= current)
+			next = current + 1;
+		if (sample < next)
+			return current;
+		current = next;
+	}
+	return current;
+}
+
+/* Sends the accumulated samples to UMA. */
+static void send_samples()
+{
+	struct metrics_sample *s;
+	unsigned int i;
+
+	for (i = 0; i < num_samples; i++) {
+		s = &samples[i];
+		if (s->nbuckets)
+			cras_metrics_log_histogram_repeated(s->name, s->sample,
+							    s->min, s->max,
+							    s->nbuckets,
+							    s->count);
+		else
+			cras_metrics_log_sparse_histogram_repeated(
+				s->name, s->sample, s->count);
+	}
+	num_samples = 0;
+}
+
+static void add_sample(const char *name, int sample, int min, int max,
+		       int nbuckets)
+{
+	struct metrics_sample *s;
+	unsigned int i;
+
+	for (i = 0; i < num_samples; i++) {
+		s = &samples[i];
+		if (s->sample == sample && s->min == min && s->max == max &&
+		    s->nbuckets == nbuckets && !strcmp(s->name, name)) {
+			s->count++;
+			return;
+		}
+	}
+
+	if (num_samples == METRICS_MAX_SAMPLES)
+		send_samples();
+
+	s = &samples[num_samples++];
+	snprintf(s->name, sizeof(s->name), "%s", name);
+	s->sample = sample;
+	s->min = min;
+	s->max = max;
+	s->nbuckets = nbuckets;
+	s->count = 1;
+}
+
+static void accumulate_histogram(const char *name, int sample, int min,
+				 int max, int nbuckets)
+{
+	add_sample(name, histogram_bucket_min(sample, min, max, nbuckets), min,
+		   max, nbuckets);
+}
+
+static void accumulate_sparse_histogram(const char *name, int sample)
+{
+	add_sample(name, sample, 0, 0, 0);
+}
+
 static void metrics_device_runtime(struct cras_server_metrics_device_data data)
 {
 	char metrics_name[METRICS_NAME_BUFFER_SIZE];
@@ -950,14 +1094,14 @@ static void metrics_device_runtime(struct cras_server_metrics_device_data data)
 		 "Cras.%sDevice%sRuntime",
 		 data.direction == CRAS_STREAM_INPUT ? "Input" : "Output",
 		 metrics_device_type_str(data.type));
-	cras_metrics_log_histogram(metrics_name, (unsigned)data.runtime.tv_sec,
+	accumulate_histogram(metrics_name, (unsigned)data.runtime.tv_sec,
 				   0, 10000, 20);
 
 	/* Logs the usage of each device. */
 	if (data.direction == CRAS_STREAM_INPUT)
-		cras_metrics_log_sparse_histogram(kDeviceTypeInput, data.type);
+		accumulate_sparse_histogram(kDeviceTypeInput, data.type);
 	else
-		cras_metrics_log_sparse_histogram(kDeviceTypeOutput, data.type);
+		accumulate_sparse_histogram(kDeviceTypeOutput, data.type);
 }
 
 static void metrics_device_volume(struct cras_server_metrics_device_data data)
@@ -966,7 +1110,7 @@ static void metrics_device_volume(struct cras_server_metrics_device_data data)
 
 	snprintf(metrics_name, METRICS_NAME_BUFFER_SIZE, "%s.%s", kDeviceVolume,
 		 metrics_device_type_str(data.type));
-	cras_metrics_log_histogram(metrics_name, data.value, 0, 100, 20);
+	accumulate_histogram(metrics_name, data.value, 0, 100, 20);
 }
 
 static void metrics_stream_runtime(struct cras_server_metrics_stream_data data)
@@ -975,15 +1119,27 @@ static void metrics_stream_runtime(struct cras_server_metrics_stream_data data)
 
 	snprintf(metrics_name, METRICS_NAME_BUFFER_SIZE, "Cras.%sStreamRuntime",
 		 data.direction == CRAS_STREAM_INPUT ? "Input" : "Output");
-	cras_metrics_log_histogram(metrics_name, (unsigned)data.runtime.tv_sec,
+	accumulate_histogram(metrics_name, (unsigned)data.runtime.tv_sec,
 				   0, 10000, 20);
 
 	snprintf(metrics_name, METRICS_NAME_BUFFER_SIZE,
 		 "Cras.%sStreamRuntime.%s",
 		 data.direction == CRAS_STREAM_INPUT ? "Input" : "Output",
 		 metrics_client_type_str(data.type));
-	cras_metrics_log_histogram(metrics_name, (unsigned)data.runtime.tv_sec,
+	accumulate_histogram(metrics_name, (unsigned)data.runtime.tv_sec,
 				   0, 10000, 20);
+
+	snprintf(metrics_name, METRICS_NAME_BUFFER_SIZE,
+		 "Cras.%sStreamCpuUsage.%s",
+		 data.direction == CRAS_STREAM_INPUT ? "Input" : "Output",
+		 metrics_client_type_str(data.type));
+	accumulate_histogram(metrics_name, data.cpu_permille, 0, 1000, 20);
+
+	snprintf(metrics_name, METRICS_NAME_BUFFER_SIZE,
+		 "Cras.%sStreamMemoryKB.%s",
+		 data.direction == CRAS_STREAM_INPUT ? "Input" : "Output",
+		 metrics_client_type_str(data.type));
+	accumulate_histogram(metrics_name, data.mem_kb, 0, 10000, 20);
 }
 
 static void metrics_busyloop(struct cras_server_metrics_timespec_data data)
@@ -993,7 +1149,7 @@ static void metrics_busyloop(struct cras_server_metrics_timespec_data data)
 	snprintf(metrics_name, METRICS_NAME_BUFFER_SIZE, "%s.%s", kBusyloop,
 		 get_timespec_period_str(data.runtime));
 
-	cras_metrics_log_histogram(metrics_name, data.count, 0, 1000, 20);
+	accumulate_histogram(metrics_name, data.count, 0, 1000, 20);
 }
 
 /*
@@ -1024,7 +1180,7 @@ static void log_sparse_histogram_each_level(int num, int sample, ...)
 		if (metric_len < 0 || metric_len > METRICS_NAME_BUFFER_SIZE - len)
 			break;
 		len += metric_len;
-		cras_metrics_log_sparse_histogram(metrics_name, sample);
+		accumulate_sparse_histogram(metrics_name, sample);
 	}
 
 	va_end(valist);
@@ -1067,41 +1223,40 @@ metrics_stream_config(struct cras_server_metrics_stream_config config)
 
 	/* Logs stream client type. */
 	if (config.direction == CRAS_STREAM_INPUT)
-		cras_metrics_log_sparse_histogram(kStreamClientTypeInput,
+		accumulate_sparse_histogram(kStreamClientTypeInput,
 						  config.client_type);
 	else
-		cras_metrics_log_sparse_histogram(kStreamClientTypeOutput,
+		accumulate_sparse_histogram(kStreamClientTypeOutput,
 						  config.client_type);
 }
 
-static void handle_metrics_message(struct cras_main_message *msg, void *arg)
+static void
+handle_metrics_message(const struct cras_server_metrics_message *metrics_msg)
 {
-	struct cras_server_metrics_message *metrics_msg =
-		(struct cras_server_metrics_message *)msg;
 	switch (metrics_msg->metrics_type) {
 	case BT_SCO_CONNECTION_ERROR:
-		cras_metrics_log_sparse_histogram(kHfpScoConnectionError,
+		accumulate_sparse_histogram(kHfpScoConnectionError,
 						  metrics_msg->data.value);
 		break;
 	case BT_BATTERY_INDICATOR_SUPPORTED:
-		cras_metrics_log_sparse_histogram(kHfpBatteryIndicatorSupported,
+		accumulate_sparse_histogram(kHfpBatteryIndicatorSupported,
 						  metrics_msg->data.value);
 		break;
 	case BT_BATTERY_REPORT:
-		cras_metrics_log_sparse_histogram(kHfpBatteryReport,
+		accumulate_sparse_histogram(kHfpBatteryReport,
 						  metrics_msg->data.value);
 		break;
 	case BT_WIDEBAND_PACKET_LOSS:
-		cras_metrics_log_histogram(kHfpWidebandSpeechPacketLoss,
+		accumulate_histogram(kHfpWidebandSpeechPacketLoss,
 					   metrics_msg->data.value, 0, 1000,
 					   20);
 		break;
 	case BT_WIDEBAND_SUPPORTED:
-		cras_metrics_log_sparse_histogram(kHfpWidebandSpeechSupported,
+		accumulate_sparse_histogram(kHfpWidebandSpeechSupported,
 						  metrics_msg->data.value);
 		break;
 	case BT_WIDEBAND_SELECTED_CODEC:
-		cras_metrics_log_sparse_histogram(
+		accumulate_sparse_histogram(
 			kHfpWidebandSpeechSelectedCodec,
 			metrics_msg->data.value);
 		break;
@@ -1112,72 +1267,72 @@ static void handle_metrics_message(struct cras_main_message *msg, void *arg)
 		metrics_device_volume(metrics_msg->data.device_data);
 		break;
 	case HIGHEST_DEVICE_DELAY_INPUT:
-		cras_metrics_log_histogram(kHighestDeviceDelayInput,
+		accumulate_histogram(kHighestDeviceDelayInput,
 					   metrics_msg->data.value, 1, 10000,
 					   20);
 		break;
 	case HIGHEST_DEVICE_DELAY_OUTPUT:
-		cras_metrics_log_histogram(kHighestDeviceDelayOutput,
+		accumulate_histogram(kHighestDeviceDelayOutput,
 					   metrics_msg->data.value, 1, 10000,
 					   20);
 		break;
 	case HIGHEST_INPUT_HW_LEVEL:
-		cras_metrics_log_histogram(kHighestInputHardwareLevel,
+		accumulate_histogram(kHighestInputHardwareLevel,
 					   metrics_msg->data.value, 1, 10000,
 					   20);
 		break;
 	case HIGHEST_OUTPUT_HW_LEVEL:
-		cras_metrics_log_histogram(kHighestOutputHardwareLevel,
+		accumulate_histogram(kHighestOutputHardwareLevel,
 					   metrics_msg->data.value, 1, 10000,
 					   20);
 		break;
 	case LONGEST_FETCH_DELAY:
-		cras_metrics_log_histogram(kStreamTimeoutMilliSeconds,
+		accumulate_histogram(kStreamTimeoutMilliSeconds,
 					   metrics_msg->data.value, 1, 20000,
 					   10);
 		break;
 	case MISSED_CB_FIRST_TIME_INPUT:
-		cras_metrics_log_histogram(kMissedCallbackFirstTimeInput,
+		accumulate_histogram(kMissedCallbackFirstTimeInput,
 					   metrics_msg->data.value, 0, 90000,
 					   20);
 		break;
 	case MISSED_CB_FIRST_TIME_OUTPUT:
-		cras_metrics_log_histogram(kMissedCallbackFirstTimeOutput,
+		accumulate_histogram(kMissedCallbackFirstTimeOutput,
 					   metrics_msg->data.value, 0, 90000,
 					   20);
 		break;
 	case MISSED_CB_FREQUENCY_INPUT:
-		cras_metrics_log_histogram(kMissedCallbackFrequencyInput,
+		accumulate_histogram(kMissedCallbackFrequencyInput,
 					   metrics_msg->data.value, 0, 90000,
 					   20);
 		break;
 	case MISSED_CB_FREQUENCY_OUTPUT:
-		cras_metrics_log_histogram(kMissedCallbackFrequencyOutput,
+		accumulate_histogram(kMissedCallbackFrequencyOutput,
 					   metrics_msg->data.value, 0, 90000,
 					   20);
 		break;
 	case MISSED_CB_FREQUENCY_AFTER_RESCHEDULING_INPUT:
-		cras_metrics_log_histogram(
+		accumulate_histogram(
 			kMissedCallbackFrequencyAfterReschedulingInput,
 			metrics_msg->data.value, 0, 90000, 20);
 		break;
 	case MISSED_CB_FREQUENCY_AFTER_RESCHEDULING_OUTPUT:
-		cras_metrics_log_histogram(
+		accumulate_histogram(
 			kMissedCallbackFrequencyAfterReschedulingOutput,
 			metrics_msg->data.value, 0, 90000, 20);
 		break;
 	case MISSED_CB_SECOND_TIME_INPUT:
-		cras_metrics_log_histogram(kMissedCallbackSecondTimeInput,
+		accumulate_histogram(kMissedCallbackSecondTimeInput,
 					   metrics_msg->data.value, 0, 90000,
 					   20);
 		break;
 	case MISSED_CB_SECOND_TIME_OUTPUT:
-		cras_metrics_log_histogram(kMissedCallbackSecondTimeOutput,
+		accumulate_histogram(kMissedCallbackSecondTimeOutput,
 					   metrics_msg->data.value, 0, 90000,
 					   20);
 		break;
 	case NUM_UNDERRUNS:
-		cras_metrics_log_histogram(kUnderrunsPerDevice,
+		accumulate_histogram(kUnderrunsPerDevice,
 					   metrics_msg->data.value, 0, 1000,
 					   10);
 		break;
@@ -1191,7 +1346,7 @@ static void handle_metrics_message(struct cras_main_message *msg, void *arg)
 		metrics_busyloop(metrics_msg->data.timespec_data);
 		break;
 	case BUSYLOOP_LENGTH:
-		cras_metrics_log_histogram(
+		accumulate_histogram(
 			kBusyloopLength, metrics_msg->data.value, 0, 1000, 50);
 		break;
 	default:
@@ -1201,9 +1356,81 @@ static void handle_metrics_message(struct cras_main_message *msg, void *arg)
 	}
 }
 
+/* Handles the queued messages and sends their samples. */
+static void flush_metrics()
+{
+	struct metrics_queue *queue;
+	unsigned int dropped, i;
+
+	pthread_mutex_lock(&queue_mutex);
+	queue = pending;
+	pending = (pending == &queues[0]) ? &queues[1] : &queues[0];
+	dropped = num_dropped;
+	num_dropped = 0;
+	pthread_mutex_unlock(&queue_mutex);
+
+	if (dropped)
+		syslog(LOG_WARNING, "Dropped %u metrics messages", dropped);
+
+	for (i = 0; i < queue->num; i++)
+		handle_metrics_message(&queue->msgs[i]);
+	queue->num = 0;
+
+	send_samples();
+}
+
+static void *metrics_thread_loop(void *arg)
+{
+	struct timespec deadline;
+	int stop = 0;
+
+	cras_set_nice_level(METRICS_THREAD_NICE_LEVEL);
+
+	while (!stop) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += METRICS_FLUSH_INTERVAL_SEC;
+
+		pthread_mutex_lock(&queue_mutex);
+		while (!stop_metrics_thread &&
+		       pending->num < METRICS_QUEUE_SIZE / 2) {
+			if (pthread_cond_timedwait(&queue_cond, &queue_mutex,
+						   &deadline) == ETIMEDOUT)
+				break;
+		}
+		stop = stop_metrics_thread;
+		pthread_mutex_unlock(&queue_mutex);
+
+		flush_metrics();
+	}
+
+	return NULL;
+}
+
 int cras_server_metrics_init()
 {
-	cras_main_message_add_handler(CRAS_MAIN_METRICS, handle_metrics_message,
-				      NULL);
+	int rc;
+
+	stop_metrics_thread = 0;
+	rc = pthread_create(&metrics_thread, NULL, metrics_thread_loop, NULL);
+	if (rc) {
+		syslog(LOG_ERR, "Failed to create metrics thread: %d", rc);
+		return -rc;
+	}
+	metrics_thread_started = 1;
+
 	return 0;
 }
+
+void cras_server_metrics_deinit()
+{
+	if (!metrics_thread_started)
+		return;
+
+	pthread_mutex_lock(&queue_mutex);
+	stop_metrics_thread = 1;
+	pthread_cond_signal(&queue_cond);
+	pthread_mutex_unlock(&queue_mutex);
+
+	pthread_join(metrics_thread, NULL);
+	metrics_thread_started = 0;
+}
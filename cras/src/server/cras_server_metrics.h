@@ -82,7 +82,11 @@ int cras_server_metrics_busyloop(struct timespec *ts, unsigned count);
 /* Logs the length of busyloops. */
 int cras_server_metrics_busyloop_length(unsigned length);
 
-/* Initialize metrics logging stuff. */
+/* Initialize metrics logging stuff. Starts the thread which sends the
+ * metrics to UMA in batches. */
 int cras_server_metrics_init();
 
+/* Sends the metrics still queued and stops the metrics thread. */
+void cras_server_metrics_deinit();
+
 #endif /* CRAS_SERVER_METRICS_H_ */
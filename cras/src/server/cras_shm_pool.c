@@ -0,0 +1,205 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for memfd_create and file seals */
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "cras_shm.h"
+#include "cras_shm_pool.h"
+#include "utlist.h"
+
+/* A stream shm area and how its samples are mapped. */
+struct shm_pool_area {
+	struct cras_audio_shm *shm;
+	int samples_prot;
+	struct shm_pool_area *prev, *next;
+};
+
+/* The areas of a client.
+ * Members:
+ *    client_id - The client owning the areas.
+ *    free - Areas ready to be used by a new stream, oldest first.
+ *    num_free - Number of areas in free.
+ *    used - Areas used by streams of the client.
+ */
+struct shm_pool {
+	unsigned int client_id;
+	struct shm_pool_area *free;
+	unsigned int num_free;
+	struct shm_pool_area *used;
+	struct shm_pool *prev, *next;
+};
+
+static struct shm_pool *pools;
+
+static struct shm_pool *find_pool(unsigned int client_id)
+{
+	struct shm_pool *pool;
+
+	DL_FOREACH (pools, pool)
+		if (pool->client_id == client_id)
+			return pool;
+	return NULL;
+}
+
+/* Creates a memfd of the given length that can't be shrunk or grown, so a
+ * client can't make the server fault on its mapping. */
+static int shm_info_init_sealed(const char *name, size_t length,
+				struct cras_shm_info *info)
+{
+	int fd, rc;
+
+	fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		rc = -errno;
+		syslog(LOG_ERR, "shm_pool: memfd_create failed: %s",
+		       strerror(-rc));
+		return rc;
+	}
+	if (ftruncate(fd, length) ||
+	    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)) {
+		rc = -errno;
+		syslog(LOG_ERR, "shm_pool: failed to size and seal %s: %s",
+		       name, strerror(-rc));
+		close(fd);
+		return rc;
+	}
+
+	info->fd = fd;
+	info->name[0] = '\0';
+	info->length = length;
+	return 0;
+}
+
+static int area_create(uint64_t samples_size, int samples_prot,
+		       struct cras_audio_shm **shm_out)
+{
+	struct cras_shm_info header_info, samples_info;
+	int rc;
+
+	rc = shm_info_init_sealed("cras-stream-header", cras_shm_header_size(),
+				  &header_info);
+	if (rc)
+		return rc;
+	rc = shm_info_init_sealed("cras-stream-samples", samples_size,
+				  &samples_info);
+	if (rc) {
+		cras_shm_info_cleanup(&header_info);
+		return rc;
+	}
+	return cras_audio_shm_create(&header_info, &samples_info, samples_prot,
+				     shm_out);
+}
+
+/*
+ * Exported interface
+ */
+
+int cras_shm_pool_get(unsigned int client_id, uint64_t samples_size,
+		      int samples_prot, struct cras_audio_shm **shm_out)
+{
+	struct shm_pool *pool;
+	struct shm_pool_area *area;
+	uint64_t page_size = sysconf(_SC_PAGESIZE);
+	int rc;
+
+	samples_size = (samples_size + page_size - 1) / page_size * page_size;
+
+	pool = find_pool(client_id);
+	if (!pool) {
+		pool = (struct shm_pool *)calloc(1, sizeof(*pool));
+		if (!pool)
+			return -ENOMEM;
+		pool->client_id = client_id;
+		DL_APPEND(pools, pool);
+	}
+
+	DL_FOREACH (pool->free, area) {
+		if (area->samples_prot != samples_prot ||
+		    cras_shm_samples_size(area->shm) != samples_size)
+			continue;
+		DL_DELETE(pool->free, area);
+		pool->num_free--;
+		memset(area->shm->header, 0, area->shm->header_info.length);
+		DL_APPEND(pool->used, area);
+		*shm_out = area->shm;
+		return 0;
+	}
+
+	area = (struct shm_pool_area *)calloc(1, sizeof(*area));
+	if (!area)
+		return -ENOMEM;
+	rc = area_create(samples_size, samples_prot, &area->shm);
+	if (rc) {
+		free(area);
+		return rc;
+	}
+	area->samples_prot = samples_prot;
+	DL_APPEND(pool->used, area);
+	*shm_out = area->shm;
+	return 0;
+}
+
+void cras_shm_pool_put(unsigned int client_id, struct cras_audio_shm *shm)
+{
+	struct shm_pool *pool;
+	struct shm_pool_area *area, *oldest;
+
+	pool = find_pool(client_id);
+	if (pool) {
+		DL_SEARCH_SCALAR(pool->used, area, shm, shm);
+	} else {
+		area = NULL;
+	}
+	/* Not from the pool, or its client is gone. */
+	if (!area) {
+		cras_audio_shm_destroy(shm);
+		return;
+	}
+
+	DL_DELETE(pool->used, area);
+	if (pool->num_free == CRAS_SHM_POOL_MAX_FREE) {
+		oldest = pool->free;
+		DL_DELETE(pool->free, oldest);
+		cras_audio_shm_destroy(oldest->shm);
+		free(oldest);
+		pool->num_free--;
+	}
+	DL_APPEND(pool->free, area);
+	pool->num_free++;
+}
+
+void cras_shm_pool_remove_client(unsigned int client_id)
+{
+	struct shm_pool *pool;
+	struct shm_pool_area *area;
+
+	pool = find_pool(client_id);
+	if (!pool)
+		return;
+
+	DL_FOREACH (pool->free, area) {
+		DL_DELETE(pool->free, area);
+		cras_audio_shm_destroy(area->shm);
+		free(area);
+	}
+	/* Streams still in use, e.g. draining, destroy their shm when they
+	 * are put back. */
+	DL_FOREACH (pool->used, area) {
+		DL_DELETE(pool->used, area);
+		free(area);
+	}
+	DL_DELETE(pools, pool);
+	free(pool);
+}
@@ -0,0 +1,42 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Pool of mapped stream shm areas kept per client, so that a client opening
+ * and closing streams over and over doesn't create and map new shm for each
+ * of them. Areas are never handed to another client, the previous owner may
+ * still have them mapped.
+ */
+
+#ifndef CRAS_SHM_POOL_H_
+#define CRAS_SHM_POOL_H_
+
+#include <stdint.h>
+
+struct cras_audio_shm;
+
+/* Max areas kept free for a client. */
+#define CRAS_SHM_POOL_MAX_FREE 4
+
+/* Gets a stream shm area for a client, reusing one it freed if there is one
+ * of the right size. New areas are backed by sealed memfds so clients can't
+ * resize them under the server.
+ * Args:
+ *    client_id - The client the stream belongs to.
+ *    samples_size - Minimum size of the samples area, rounded up to pages.
+ *    samples_prot - PROT_READ or PROT_WRITE, how the server maps samples.
+ *    shm_out - Filled with the area, its header is zeroed.
+ * Returns:
+ *    0 on success, negative error code otherwise.
+ */
+int cras_shm_pool_get(unsigned int client_id, uint64_t samples_size,
+		      int samples_prot, struct cras_audio_shm **shm_out);
+
+/* Gives a stream shm area back to the pool of its client. It's destroyed if
+ * the client is gone or already has CRAS_SHM_POOL_MAX_FREE areas free. */
+void cras_shm_pool_put(unsigned int client_id, struct cras_audio_shm *shm);
+
+/* Destroys the free areas of a client, called when it disconnects. */
+void cras_shm_pool_remove_client(unsigned int client_id);
+
+#endif /* CRAS_SHM_POOL_H_ */
@@ -0,0 +1,71 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cras_startup_log.h"
+
+static struct main_thread_startup_log startup_log;
+/* Number of slots taken, phases past the size of the log are dropped. */
+static uint32_t num_phases;
+
+int cras_startup_log_begin(enum MAIN_THREAD_STARTUP_PHASE phase,
+			   uint32_t data1, uint32_t data2)
+{
+	struct main_thread_startup_phase *entry;
+	struct timespec now;
+	uint32_t slot;
+
+	slot = __atomic_fetch_add(&num_phases, 1, __ATOMIC_RELAXED);
+	if (slot >= MAIN_THREAD_STARTUP_LOG_SIZE)
+		return -1;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	entry = &startup_log.phases[slot];
+	entry->phase = phase;
+	entry->data1 = data1;
+	entry->data2 = data2;
+	entry->thread = syscall(SYS_gettid);
+	entry->sec = now.tv_sec;
+	entry->nsec = now.tv_nsec;
+	entry->duration_us = STARTUP_PHASE_RUNNING;
+	return slot;
+}
+
+void cras_startup_log_end(int slot)
+{
+	struct main_thread_startup_phase *entry;
+	struct timespec now;
+	uint64_t us;
+
+	if (slot < 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	entry = &startup_log.phases[slot];
+	us = ((uint64_t)now.tv_sec - entry->sec) * 1000000 +
+	     ((int64_t)now.tv_nsec - entry->nsec) / 1000;
+	entry->duration_us = us < STARTUP_PHASE_RUNNING ?
+				     us :
+				     STARTUP_PHASE_RUNNING - 1;
+}
+
+void cras_startup_log_mark(enum MAIN_THREAD_STARTUP_PHASE phase,
+			   uint32_t data1, uint32_t data2)
+{
+	int slot = cras_startup_log_begin(phase, data1, data2);
+
+	if (slot >= 0)
+		startup_log.phases[slot].duration_us = 0;
+}
+
+void cras_startup_log_copy(struct main_thread_startup_log *out)
+{
+	memcpy(out, &startup_log, sizeof(*out));
+	out->num_phases = __atomic_load_n(&num_phases, __ATOMIC_RELAXED);
+}
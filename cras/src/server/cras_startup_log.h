@@ -0,0 +1,36 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Times the phases of the server startup and of each card and device init.
+ * Always on: a phase costs two clock reads and a slot of a static log, so
+ * slow boots can be looked at after the fact. The log is exported with the
+ * main thread debug info.
+ */
+
+#ifndef CRAS_STARTUP_LOG_H_
+#define CRAS_STARTUP_LOG_H_
+
+#include <stdint.h>
+
+#include "cras_types.h"
+
+/* Marks the start of a phase, data1 and data2 tell its instances apart. Safe
+ * to call from any thread.
+ * Returns:
+ *    The slot to pass to cras_startup_log_end(), -1 if the log is full.
+ */
+int cras_startup_log_begin(enum MAIN_THREAD_STARTUP_PHASE phase,
+			   uint32_t data1, uint32_t data2);
+
+/* Marks the end of the phase cras_startup_log_begin() returned slot for. */
+void cras_startup_log_end(int slot);
+
+/* Logs a phase that takes no time, an instant in the timeline. */
+void cras_startup_log_mark(enum MAIN_THREAD_STARTUP_PHASE phase,
+			   uint32_t data1, uint32_t data2);
+
+/* Copies the log to out. */
+void cras_startup_log_copy(struct main_thread_startup_log *out);
+
+#endif /* CRAS_STARTUP_LOG_H_ */
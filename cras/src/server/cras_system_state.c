@@ -25,6 +25,9 @@
 #include "cras_util.h"
 #include "utlist.h"
 
+/* The most cards probed at the same time at startup. */
+#define MAX_CARD_PROBE_THREADS 4
+
 struct card_list {
 	struct cras_alsa_card *card;
 	struct card_list *prev, *next;
@@ -56,6 +59,28 @@ struct name_list {
  *    main_thread_tid - The thread id of the main thread.
  *    bt_fix_a2dp_packet_size - The flag to override A2DP packet size set by
  *      Blueetoh peer devices to a smaller default value.
+ *    mix_worker_threads - Number of worker threads used to render playback
+ *      streams in parallel, 0 to mix everything on the audio thread.
+ *    mix_worker_min_streams - Minimum number of streams on an output device
+ *      before the mix workers are used.
+ *    uncached_dma_buffer - The DMA buffers of the internal cards are
+ *      uncached or write-combined memory.
+ *    input_wake_slack_us - How long the audio thread may delay waking for
+ *      captured data so that the wakes of several devices coincide.
+ *    adaptive_buffer_max_ms - How much the buffer level of an output device
+ *      may be raised when it is at risk of underrun, 0 to never raise it.
+ *    output_standby_ms - How long a deselected output device stays open, 0
+ *      to close it right away.
+ *    stream_ramp_ms - How long the gain of a playback stream takes to
+ *      change, 0 to not fade streams.
+ *    num_audio_threads - Number of audio threads servicing the devices.
+ *    audio_thread_cpu_mask - CPUs each audio thread may run on, 0 for any.
+ *    lock_rt_memory - The audio threads lock the memory of the server so
+ *      they don't take major page faults.
+ *    sched_deadline - The audio threads run under SCHED_DEADLINE with a
+ *      budget sized to the open devices, instead of a fixed RT priority.
+ *    deep_buffer - Output devices playing only DEEP_BUFFER streams keep the
+ *      audio they queue so it can be rewound when another stream starts.
  */
 static struct {
 	struct cras_server_state *exp_state;
@@ -81,6 +106,18 @@ static struct {
 	struct cras_audio_thread_snapshot_buffer snapshot_buffer;
 	pthread_t main_thread_tid;
 	bool bt_fix_a2dp_packet_size;
+	unsigned int mix_worker_threads;
+	unsigned int mix_worker_min_streams;
+	bool uncached_dma_buffer;
+	unsigned int input_wake_slack_us;
+	unsigned int adaptive_buffer_max_ms;
+	unsigned int output_standby_ms;
+	unsigned int stream_ramp_ms;
+	unsigned int num_audio_threads;
+	unsigned long audio_thread_cpu_mask[CRAS_MAX_AUDIO_THREADS];
+	bool lock_rt_memory;
+	bool sched_deadline;
+	bool deep_buffer;
 } state;
 
 /* The string format is CARD1,CARD2,CARD3. Divide it into a list. */
@@ -126,6 +163,7 @@ void cras_system_state_init(const char *device_config_dir, const char *shm_name,
 			    size_t exp_state_size)
 {
 	struct cras_board_config board_config;
+	unsigned int i;
 	int rc;
 
 	assert(sizeof(*exp_state) == exp_state_size);
@@ -158,6 +196,23 @@ void cras_system_state_init(const char *device_config_dir, const char *shm_name,
 	exp_state->bt_wbs_enabled = board_config.bt_wbs_enabled;
 	exp_state->deprioritize_bt_wbs_mic =
 		board_config.deprioritize_bt_wbs_mic;
+	state.mix_worker_threads = MAX(board_config.mix_worker_threads, 0);
+	state.mix_worker_min_streams =
+		MAX(board_config.mix_worker_min_streams, 1);
+	state.uncached_dma_buffer = !!board_config.uncached_dma_buffer;
+	state.input_wake_slack_us = MAX(board_config.input_wake_slack_us, 0);
+	state.adaptive_buffer_max_ms =
+		MAX(board_config.adaptive_buffer_max_ms, 0);
+	state.output_standby_ms = MAX(board_config.output_standby_ms, 0);
+	state.stream_ramp_ms = MAX(board_config.stream_ramp_ms, 0);
+	state.num_audio_threads = MIN(MAX(board_config.num_audio_threads, 1),
+				      CRAS_MAX_AUDIO_THREADS);
+	for (i = 0; i < CRAS_MAX_AUDIO_THREADS; i++)
+		state.audio_thread_cpu_mask[i] =
+			(uint32_t)board_config.audio_thread_cpu_mask[i];
+	state.lock_rt_memory = !!board_config.lock_rt_memory;
+	state.sched_deadline = !!board_config.sched_deadline;
+	state.deep_buffer = !!board_config.deep_buffer;
 
 	if ((rc = pthread_mutex_init(&state.update_lock, 0) != 0)) {
 		syslog(LOG_ERR, "Fatal: system state mutex init");
@@ -374,6 +429,68 @@ int cras_system_get_aec_group_id()
 	return state.exp_state->aec_group_id;
 }
 
+unsigned int cras_system_get_mix_worker_threads()
+{
+	return state.mix_worker_threads;
+}
+
+unsigned int cras_system_get_mix_worker_min_streams()
+{
+	return state.mix_worker_min_streams;
+}
+
+bool cras_system_get_uncached_dma_buffer()
+{
+	return state.uncached_dma_buffer;
+}
+
+unsigned int cras_system_get_input_wake_slack_us()
+{
+	return state.input_wake_slack_us;
+}
+
+unsigned int cras_system_get_adaptive_buffer_max_ms()
+{
+	return state.adaptive_buffer_max_ms;
+}
+
+unsigned int cras_system_get_output_standby_ms()
+{
+	return state.output_standby_ms;
+}
+
+unsigned int cras_system_get_stream_ramp_ms()
+{
+	return state.stream_ramp_ms;
+}
+
+unsigned int cras_system_get_num_audio_threads()
+{
+	return state.num_audio_threads;
+}
+
+unsigned long cras_system_get_audio_thread_cpu_mask(unsigned int idx)
+{
+	if (idx >= CRAS_MAX_AUDIO_THREADS)
+		return 0;
+	return state.audio_thread_cpu_mask[idx];
+}
+
+bool cras_system_get_lock_rt_memory()
+{
+	return state.lock_rt_memory;
+}
+
+bool cras_system_get_sched_deadline()
+{
+	return state.sched_deadline;
+}
+
+bool cras_system_get_deep_buffer()
+{
+	return state.deep_buffer;
+}
+
 void cras_system_set_bt_wbs_enabled(bool enabled)
 {
 	state.exp_state->bt_wbs_enabled = enabled;
@@ -443,6 +560,108 @@ int cras_system_add_alsa_card(struct cras_alsa_card_info *alsa_card_info)
 	return 0;
 }
 
+/* Probes the cards of a cras_system_add_alsa_cards call. Workers take the
+ * next card to probe from next_job.
+ * Members:
+ *    info - The cards to probe.
+ *    cards - The probed cards, NULL for cards that failed or were skipped.
+ *    skip - Non-zero for cards that already exist.
+ *    num_cards - The number of entries in the arrays.
+ *    next_job - Index of the next card to probe.
+ */
+struct card_probe {
+	struct cras_alsa_card_info *info;
+	struct cras_alsa_card **cards;
+	int *skip;
+	size_t num_cards;
+	size_t next_job;
+};
+
+static void *card_probe_worker(void *arg)
+{
+	struct card_probe *probe = (struct card_probe *)arg;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&probe->next_job, 1,
+				       __ATOMIC_RELAXED)) < probe->num_cards) {
+		if (probe->skip[i])
+			continue;
+		probe->cards[i] = cras_alsa_card_probe(
+			&probe->info[i], state.device_config_dir,
+			state.internal_ucm_suffix);
+		if (probe->cards[i])
+			cras_alsa_card_probe_formats(probe->cards[i]);
+	}
+	return NULL;
+}
+
+int cras_system_add_alsa_cards(struct cras_alsa_card_info *alsa_card_info,
+			       size_t num_cards)
+{
+	pthread_t tids[MAX_CARD_PROBE_THREADS];
+	struct card_probe probe;
+	struct card_list *card;
+	size_t i, j, max_threads, num_threads = 0;
+	int added = 0;
+
+	if (alsa_card_info == NULL || num_cards == 0)
+		return 0;
+
+	probe.info = alsa_card_info;
+	probe.num_cards = num_cards;
+	probe.next_job = 0;
+	probe.cards = calloc(num_cards, sizeof(*probe.cards));
+	probe.skip = calloc(num_cards, sizeof(*probe.skip));
+	if (!probe.cards || !probe.skip) {
+		free(probe.cards);
+		free(probe.skip);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < num_cards; i++) {
+		probe.skip[i] = cras_system_alsa_card_exists(
+			alsa_card_info[i].card_index);
+		for (j = 0; j < i; j++)
+			if (alsa_card_info[j].card_index ==
+			    alsa_card_info[i].card_index)
+				probe.skip[i] = 1;
+	}
+
+	/* The calling thread probes too, so a failure to start workers only
+	 * costs time. */
+	max_threads = num_cards < MAX_CARD_PROBE_THREADS ?
+			      num_cards :
+			      MAX_CARD_PROBE_THREADS;
+	while (num_threads + 1 < max_threads &&
+	       !pthread_create(&tids[num_threads], NULL, card_probe_worker,
+			       &probe))
+		num_threads++;
+	card_probe_worker(&probe);
+	for (i = 0; i < num_threads; i++)
+		pthread_join(tids[i], NULL);
+
+	/* Devices are added here on the main thread, in the given order. */
+	for (i = 0; i < num_cards; i++) {
+		if (!probe.cards[i])
+			continue;
+		card = calloc(1, sizeof(*card));
+		if (card == NULL ||
+		    cras_alsa_card_commit(probe.cards[i], &alsa_card_info[i],
+					  state.device_blocklist)) {
+			free(card);
+			cras_alsa_card_destroy(probe.cards[i]);
+			continue;
+		}
+		card->card = probe.cards[i];
+		DL_APPEND(state.cards, card);
+		added++;
+	}
+
+	free(probe.cards);
+	free(probe.skip);
+	return added;
+}
+
 int cras_system_remove_alsa_card(size_t alsa_card_index)
 {
 	struct card_list *card;
@@ -527,13 +746,16 @@ void cras_system_state_stream_added(enum CRAS_STREAM_DIRECTION direction,
 	if (!s)
 		return;
 
+	cras_system_state_section_begin(s, CRAS_STATE_STREAMS);
 	s->num_active_streams[direction]++;
 	s->num_streams_attached++;
-	if (direction == CRAS_STREAM_INPUT) {
+	if (direction == CRAS_STREAM_INPUT)
 		s->num_input_streams_with_permission[client_type]++;
+	cras_system_state_section_complete(s, CRAS_STATE_STREAMS);
+
+	if (direction == CRAS_STREAM_INPUT)
 		cras_observer_notify_input_streams_with_permission(
 			s->num_input_streams_with_permission);
-	}
 
 	cras_system_state_update_complete();
 	cras_observer_notify_num_active_streams(
@@ -554,16 +776,19 @@ void cras_system_state_stream_removed(enum CRAS_STREAM_DIRECTION direction,
 	for (i = 0; i < CRAS_NUM_DIRECTIONS; i++)
 		sum += s->num_active_streams[i];
 
+	cras_system_state_section_begin(s, CRAS_STATE_STREAMS);
 	/* Set the last active time when removing the final stream. */
 	if (sum == 1)
 		cras_clock_gettime(CLOCK_MONOTONIC_RAW,
 				   &s->last_active_stream_time);
 	s->num_active_streams[direction]--;
-	if (direction == CRAS_STREAM_INPUT) {
+	if (direction == CRAS_STREAM_INPUT)
 		s->num_input_streams_with_permission[client_type]--;
+	cras_system_state_section_complete(s, CRAS_STATE_STREAMS);
+
+	if (direction == CRAS_STREAM_INPUT)
 		cras_observer_notify_input_streams_with_permission(
 			s->num_input_streams_with_permission);
-	}
 
 	cras_system_state_update_complete();
 	cras_observer_notify_num_active_streams(
@@ -650,6 +875,13 @@ void cras_system_state_update_complete()
 	pthread_mutex_unlock(&state.update_lock);
 }
 
+struct cras_perf_stats *cras_system_state_get_perf_stats(unsigned int idx)
+{
+	if (idx >= CRAS_MAX_PERF_STATS)
+		return NULL;
+	return &state.exp_state->perf_stats[idx];
+}
+
 struct cras_server_state *cras_system_state_get_no_lock()
 {
 	return state.exp_state;
@@ -116,6 +116,52 @@ int cras_system_get_aec_supported();
 /* Returns the system aec group id is available. */
 int cras_system_get_aec_group_id();
 
+/* Returns the number of threads used to render playback streams in
+ * parallel, 0 if disabled. */
+unsigned int cras_system_get_mix_worker_threads();
+
+/* Returns the number of streams an output device needs before the mix
+ * worker threads are used. */
+unsigned int cras_system_get_mix_worker_min_streams();
+
+/* Returns true if the DMA buffers of the internal cards are uncached or
+ * write-combined, so output is mixed in a cached buffer first. */
+bool cras_system_get_uncached_dma_buffer();
+
+/* Returns how long in microseconds the audio thread may delay a wake for
+ * captured data to service several devices at once. */
+unsigned int cras_system_get_input_wake_slack_us();
+
+/* Returns how much in milliseconds the buffer level of an output device may
+ * be raised when it is at risk of underrun, 0 if it is never raised. */
+unsigned int cras_system_get_adaptive_buffer_max_ms();
+
+/* Returns how long a deselected output device stays open in standby, 0 if it
+ * is closed right away. */
+unsigned int cras_system_get_output_standby_ms();
+
+/* Returns how long playback streams fade in and out in milliseconds, 0 if
+ * they start and stop at full volume. */
+unsigned int cras_system_get_stream_ramp_ms();
+
+/* Returns the number of audio threads devices are spread over, at least 1. */
+unsigned int cras_system_get_num_audio_threads();
+
+/* Returns the mask of CPUs audio thread idx may run on, 0 if unrestricted. */
+unsigned long cras_system_get_audio_thread_cpu_mask(unsigned int idx);
+
+/* Returns true if the audio threads lock memory to avoid major page
+ * faults. */
+bool cras_system_get_lock_rt_memory();
+
+/* Returns true if the audio threads should try SCHED_DEADLINE before falling
+ * back to a fixed real time priority. */
+bool cras_system_get_sched_deadline();
+
+/* Returns true if output devices playing only DEEP_BUFFER streams may be
+ * rewound when another stream starts. */
+bool cras_system_get_deep_buffer();
+
 /* Sets the flag to enable or disable bluetooth wideband speech feature. */
 void cras_system_set_bt_wbs_enabled(bool enabled);
 
@@ -148,6 +194,18 @@ bool cras_system_check_ignore_ucm_suffix(const char *card_name);
  */
 int cras_system_add_alsa_card(struct cras_alsa_card_info *alsa_card_info);
 
+/* Adds several cards to the system, e.g. the cards found at startup. The
+ * cards are probed concurrently on worker threads, then their devices are
+ * added in the given order.
+ * Args:
+ *    alsa_card_info - Array of info about the alsa cards.
+ *    num_cards - The number of entries in alsa_card_info.
+ * Returns:
+ *    The number of cards added, or negative error if out of memory.
+ */
+int cras_system_add_alsa_cards(struct cras_alsa_card_info *alsa_card_info,
+			       size_t num_cards);
+
 /* Removes a card.  When a device is removed this will do the cleanup.  Device
  * at index must have been added using cras_system_add_alsa_card().
  * Args:
@@ -325,6 +383,31 @@ struct cras_server_state *cras_system_state_update_begin();
  */
 void cras_system_state_update_complete();
 
+/* Marks a section of the state returned by cras_system_state_update_begin as
+ * being rewritten, so readers of that section retry. Only call this when the
+ * section content really changes, readers that see the same count keep their
+ * copy.
+ */
+static inline void
+cras_system_state_section_begin(struct cras_server_state *state,
+				enum CRAS_SERVER_STATE_SECTION section)
+{
+	__sync_fetch_and_add(&state->section_update_count[section], 1);
+}
+
+/* Ends the rewrite of a section started by cras_system_state_section_begin. */
+static inline void
+cras_system_state_section_complete(struct cras_server_state *state,
+				   enum CRAS_SERVER_STATE_SECTION section)
+{
+	__sync_fetch_and_add(&state->section_update_count[section], 1);
+}
+
+/* Gets the perf stats entry audio thread idx publishes to. The thread writes
+ * it without the state lock, under the entry's own seq. Returns NULL if idx is
+ * out of range. */
+struct cras_perf_stats *cras_system_state_get_perf_stats(unsigned int idx);
+
 /* Gets a pointer to the system state without locking it.  Only used for debug
  * log.  Don't add calls to this function. */
 struct cras_server_state *cras_system_state_get_no_lock();
@@ -3,28 +3,50 @@
  * found in the LICENSE file.
  */
 
+#include "cras_tm.h"
 #include "cras_types.h"
 #include "cras_util.h"
-#include "utlist.h"
 
 #include <time.h>
 
+/* The number of released timers kept for reuse. */
+#define MAX_FREE_TIMERS 16
+
 /* Represents an armed timer.
  * Members:
  *    ts - timespec at which the timer should fire.
+ *    latest - timespec by which the timer must have fired, ts plus the slack.
  *    cb - Callback to call when the timer expires.
  *    cb_data - Data passed to the callback.
+ *    idx - Position of the timer in the heap of the timer manager.
+ *    next_free - Next timer in the free list once released.
  */
 struct cras_timer {
 	struct timespec ts;
+	struct timespec latest;
 	void (*cb)(struct cras_timer *t, void *data);
 	void *cb_data;
-	struct cras_timer *next, *prev;
+	unsigned int idx;
+	struct cras_timer *next_free;
 };
 
-/* Timer Manager, keeps a list of active timers. */
+/* Timer Manager, keeps the active timers in a binary min-heap ordered by the
+ * end of their slack, so the next wake up is always for heap[0].
+ * Members:
+ *    heap - The active timers.
+ *    num_timers - The number of active timers.
+ *    num_slack - The number of active timers allowing some slack.
+ *    heap_size - The number of entries allocated in heap.
+ *    free_timers - Released timers kept to avoid an allocation per timer.
+ *    num_free - The number of timers in free_timers.
+ */
 struct cras_tm {
-	struct cras_timer *timers;
+	struct cras_timer **heap;
+	unsigned int num_timers;
+	unsigned int num_slack;
+	unsigned int heap_size;
+	struct cras_timer *free_timers;
+	unsigned int num_free;
 };
 
 /* Local Functions. */
@@ -51,34 +73,170 @@ static inline int timespec_sooner(const struct timespec *a,
 		(a->tv_sec == b->tv_sec && a->tv_nsec <= b->tv_nsec));
 }
 
+static inline void heap_set(struct cras_tm *tm, unsigned int idx,
+			    struct cras_timer *t)
+{
+	tm->heap[idx] = t;
+	t->idx = idx;
+}
+
+/* Moves the timer at idx toward the root until its parent fires sooner. */
+static void heap_sift_up(struct cras_tm *tm, unsigned int idx)
+{
+	struct cras_timer *t = tm->heap[idx];
+	unsigned int parent;
+
+	while (idx > 0) {
+		parent = (idx - 1) / 2;
+		if (timespec_sooner(&tm->heap[parent]->latest, &t->latest))
+			break;
+		heap_set(tm, idx, tm->heap[parent]);
+		idx = parent;
+	}
+	heap_set(tm, idx, t);
+}
+
+/* Moves the timer at idx toward the leaves until it fires sooner than both
+ * children. */
+static void heap_sift_down(struct cras_tm *tm, unsigned int idx)
+{
+	struct cras_timer *t = tm->heap[idx];
+	unsigned int child;
+
+	for (;;) {
+		child = idx * 2 + 1;
+		if (child >= tm->num_timers)
+			break;
+		if (child + 1 < tm->num_timers &&
+		    !timespec_sooner(&tm->heap[child]->latest,
+				     &tm->heap[child + 1]->latest))
+			child++;
+		if (timespec_sooner(&t->latest, &tm->heap[child]->latest))
+			break;
+		heap_set(tm, idx, tm->heap[child]);
+		idx = child;
+	}
+	heap_set(tm, idx, t);
+}
+
+/* Takes t out of the heap, filling its place with the last timer. */
+static void heap_remove(struct cras_tm *tm, struct cras_timer *t)
+{
+	unsigned int idx = t->idx;
+	struct cras_timer *last = tm->heap[--tm->num_timers];
+
+	if (t->ts.tv_sec != t->latest.tv_sec ||
+	    t->ts.tv_nsec != t->latest.tv_nsec)
+		tm->num_slack--;
+	if (last == t)
+		return;
+	heap_set(tm, idx, last);
+	if (idx > 0 &&
+	    timespec_sooner(&last->latest, &tm->heap[(idx - 1) / 2]->latest))
+		heap_sift_up(tm, idx);
+	else
+		heap_sift_down(tm, idx);
+}
+
+/* Frees t, or keeps it for the next cras_tm_create_timer. */
+static void release_timer(struct cras_tm *tm, struct cras_timer *t)
+{
+	if (tm->num_free >= MAX_FREE_TIMERS) {
+		free(t);
+		return;
+	}
+	t->next_free = tm->free_timers;
+	tm->free_timers = t;
+	tm->num_free++;
+}
+
+/* Returns the expired timer which should have fired first, or NULL. A timer
+ * with slack expires before the end of its slack, so when some have slack
+ * every timer is looked at. There are few timers on the main thread. */
+static struct cras_timer *next_expired(const struct cras_tm *tm,
+				       const struct timespec *now)
+{
+	struct cras_timer *expired = NULL;
+	struct cras_timer *t;
+	unsigned int i;
+
+	if (!tm->num_slack) {
+		if (tm->num_timers && timespec_sooner(&tm->heap[0]->ts, now))
+			return tm->heap[0];
+		return NULL;
+	}
+
+	for (i = 0; i < tm->num_timers; i++) {
+		t = tm->heap[i];
+		if (timespec_sooner(&t->ts, now) &&
+		    (!expired || timespec_sooner(&t->ts, &expired->ts)))
+			expired = t;
+	}
+	return expired;
+}
+
 /* Exported Interface. */
 
 struct cras_timer *cras_tm_create_timer(struct cras_tm *tm, unsigned int ms,
 					void (*cb)(struct cras_timer *t,
 						   void *data),
 					void *cb_data)
+{
+	return cras_tm_create_timer_slack(tm, ms, 0, cb, cb_data);
+}
+
+struct cras_timer *cras_tm_create_timer_slack(struct cras_tm *tm,
+					      unsigned int ms,
+					      unsigned int slack_ms,
+					      void (*cb)(struct cras_timer *t,
+							 void *data),
+					      void *cb_data)
 {
 	struct cras_timer *t;
 
-	t = calloc(1, sizeof(*t));
-	if (!t)
-		return NULL;
+	if (tm->num_timers == tm->heap_size) {
+		unsigned int size = tm->heap_size ? tm->heap_size * 2 : 16;
+		struct cras_timer **heap;
+
+		heap = realloc(tm->heap, size * sizeof(*heap));
+		if (!heap)
+			return NULL;
+		tm->heap = heap;
+		tm->heap_size = size;
+	}
+
+	if (tm->free_timers) {
+		t = tm->free_timers;
+		tm->free_timers = t->next_free;
+		tm->num_free--;
+	} else {
+		t = malloc(sizeof(*t));
+		if (!t)
+			return NULL;
+	}
 
 	t->cb = cb;
 	t->cb_data = cb_data;
+	t->next_free = NULL;
 
 	clock_gettime(CLOCK_MONOTONIC_RAW, &t->ts);
 	add_ms_ts(&t->ts, ms);
+	t->latest = t->ts;
+	if (slack_ms) {
+		add_ms_ts(&t->latest, slack_ms);
+		tm->num_slack++;
+	}
 
-	DL_APPEND(tm->timers, t);
+	tm->heap[tm->num_timers++] = t;
+	heap_sift_up(tm, tm->num_timers - 1);
 
 	return t;
 }
 
 void cras_tm_cancel_timer(struct cras_tm *tm, struct cras_timer *t)
 {
-	DL_DELETE(tm->timers, t);
-	free(t);
+	heap_remove(tm, t);
+	release_timer(tm, t);
 }
 
 struct cras_tm *cras_tm_init()
@@ -89,27 +247,28 @@ struct cras_tm *cras_tm_init()
 void cras_tm_deinit(struct cras_tm *tm)
 {
 	struct cras_timer *t;
+	unsigned int i;
 
-	DL_FOREACH (tm->timers, t) {
-		DL_DELETE(tm->timers, t);
+	for (i = 0; i < tm->num_timers; i++)
+		free(tm->heap[i]);
+	while (tm->free_timers) {
+		t = tm->free_timers;
+		tm->free_timers = t->next_free;
 		free(t);
 	}
+	free(tm->heap);
 	free(tm);
 }
 
 int cras_tm_get_next_timeout(const struct cras_tm *tm, struct timespec *ts)
 {
-	struct cras_timer *t;
 	struct timespec now;
 	struct timespec *min;
 
-	if (!tm->timers)
+	if (!tm->num_timers)
 		return 0;
 
-	min = &tm->timers->ts;
-	DL_FOREACH (tm->timers, t)
-		if (timespec_sooner(&t->ts, min))
-			min = &t->ts;
+	min = &tm->heap[0]->latest;
 
 	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 
@@ -126,24 +285,17 @@ int cras_tm_get_next_timeout(const struct cras_tm *tm, struct timespec *ts)
 void cras_tm_call_callbacks(struct cras_tm *tm)
 {
 	struct timespec now;
-	struct cras_timer *t, *next;
+	struct cras_timer *t;
 
 	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 
-	/* Don't use DL_FOREACH to iterate timers because in each loop the
-	 * next timer pointer is stored for later access but it could be
-	 * cancelled and freed in current timer's callback causing invalid
-	 * memory access. */
-	t = tm->timers;
-	while (t) {
-		next = t->next;
-		if (timespec_sooner(&t->ts, &now)) {
-			t->cb(t, t->cb_data);
-			/* Update next timer because it could have been modified
-			 * in t->cb(). */
-			next = t->next;
-			cras_tm_cancel_timer(tm, t);
-		}
-		t = next;
+	/* Take each expired timer out of the heap before running its
+	 * callback, which may create or cancel other timers. Timers with
+	 * slack fire now if they have expired, rather than wake the thread
+	 * again later. */
+	while ((t = next_expired(tm, &now))) {
+		heap_remove(tm, t);
+		t->cb(t, t->cb_data);
+		release_timer(tm, t);
 	}
 }
@@ -6,9 +6,15 @@
 #ifndef CRAS_TM_H_
 #define CRAS_TM_H_
 
+#include <time.h>
+
 /* cras_timer provides an interface to register a function to be called at a
  * later time.  This interface should be used from the main thread only, it is
  * not thread safe.
+ *
+ * A timer may allow some slack, it then fires anywhere from its timeout to
+ * its timeout plus the slack. Timers whose windows overlap fire together in
+ * one wake up of the main thread.
  */
 
 struct cras_tm; /* timer manager */
@@ -29,6 +35,16 @@ struct cras_timer *cras_tm_create_timer(struct cras_tm *tm, unsigned int ms,
 						   void *data),
 					void *cb_data);
 
+/* Creates a timer which may fire up to slack_ms late, so that it shares a
+ * wake up with other timers. Otherwise the same as cras_tm_create_timer.
+ */
+struct cras_timer *cras_tm_create_timer_slack(struct cras_tm *tm,
+					      unsigned int ms,
+					      unsigned int slack_ms,
+					      void (*cb)(struct cras_timer *t,
+							 void *data),
+					      void *cb_data);
+
 /* Deletes a timer returned from cras_tm_create_timer. */
 void cras_tm_cancel_timer(struct cras_tm *tm, struct cras_timer *t);
 
@@ -40,6 +56,7 @@ void cras_tm_deinit(struct cras_tm *tm);
 
 /* Get the amount of time before the next timer expires. ts is set to an
  * the amount of time before the next timer expires (0 if already past due).
+ * That is the end of the slack of the timer which must fire first.
  * Args:
  *    tm - Timer manager.
  *    ts - Filled with time before next event.
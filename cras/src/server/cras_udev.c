@@ -4,6 +4,7 @@
  */
 #include <assert.h>
 #include <libudev.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,12 +20,42 @@
 #include "cras_util.h"
 #include "cras_checksum.h"
 
+/* Maximum number of cards added or removed together, by the startup
+ * enumeration or by a batch of udev events. */
+#define MAX_BATCHED_CARDS 32
+/* Maximum number of udev events handled in one wakeup of the main loop.
+ * Those left are handled on the next one. */
+#define MAX_BATCHED_EVENTS 64
+
 struct udev_callback_data {
 	struct udev_monitor *mon;
 	struct udev *udev;
 	int fd;
 };
 
+/*
+ * A card to add or remove, from the udev events of a batch.
+ * Members:
+ *    card_number - Index ALSA uses to refer to the card.
+ *    remove - True to remove the card the system has now.
+ *    dev - The card device to add the card from, or NULL. A reference is
+ *        held until the batch is committed.
+ *    internal - True if the card to add is internal.
+ */
+struct card_event {
+	unsigned card_number;
+	bool remove;
+	struct udev_device *dev;
+	unsigned internal;
+};
+
+/* Cards collected from udev events, so a storm of them coalesces and the
+ * cards are probed together. */
+struct card_batch {
+	struct card_event cards[MAX_BATCHED_CARDS];
+	size_t num_cards;
+};
+
 static unsigned is_action(const char *desired, const char *actual)
 	__attribute__((nonnull(1)));
 
@@ -278,28 +309,18 @@ static void fill_usb_card_info(struct cras_alsa_card_info *card_info,
 	       card_info->usb_serial_number, card_info->usb_desc_checksum);
 }
 
-static void device_add_alsa(struct udev_device *dev, const char *sysname,
-			    unsigned card, unsigned internal)
+static void fill_card_info(struct cras_alsa_card_info *card_info,
+			   struct udev_device *dev, unsigned card,
+			   unsigned internal)
 {
-	struct cras_alsa_card_info card_info;
-	memset(&card_info, 0, sizeof(card_info));
-
-	udev_delay_for_alsa();
-	card_info.card_index = card;
+	memset(card_info, 0, sizeof(*card_info));
+	card_info->card_index = card;
 	if (internal) {
-		card_info.card_type = ALSA_CARD_TYPE_INTERNAL;
+		card_info->card_type = ALSA_CARD_TYPE_INTERNAL;
 	} else {
-		card_info.card_type = ALSA_CARD_TYPE_USB;
-		fill_usb_card_info(&card_info, dev);
+		card_info->card_type = ALSA_CARD_TYPE_USB;
+		fill_usb_card_info(card_info, dev);
 	}
-
-	cras_system_add_alsa_card(&card_info);
-}
-
-void device_remove_alsa(const char *sysname, unsigned card)
-{
-	udev_delay_for_alsa();
-	cras_system_remove_alsa_card(card);
 }
 
 static int udev_sound_initialized(struct udev_device *dev)
@@ -317,40 +338,117 @@ static int udev_sound_initialized(struct udev_device *dev)
 	return 0;
 }
 
-static void change_udev_device_if_alsa_device(struct udev_device *dev)
+/* Finds the entry of a card in the batch, or makes one. Returns NULL if the
+ * batch is full. */
+static struct card_event *batch_card(struct card_batch *batch,
+				     unsigned card_number)
 {
-	/* If the device, 'dev' is an alsa device, add it to the set of
-	 * devices available for I/O.  Mark it as the active device.
-	 */
+	struct card_event *ev;
+	size_t i;
+
+	for (i = 0; i < batch->num_cards; i++)
+		if (batch->cards[i].card_number == card_number)
+			return &batch->cards[i];
+	if (batch->num_cards == MAX_BATCHED_CARDS)
+		return NULL;
+	ev = &batch->cards[batch->num_cards++];
+	memset(ev, 0, sizeof(*ev));
+	ev->card_number = card_number;
+	return ev;
+}
+
+/* Adds the card of an alsa card device to the batch, unless the system
+ * already has it and it isn't being removed, or the batch already adds it.
+ * Returns false if the batch is full. */
+static bool batch_add_card(struct card_batch *batch, struct udev_device *dev)
+{
+	struct card_event *ev;
 	unsigned internal;
 	unsigned card_number;
 	const char *sysname;
 
-	if (is_card_device(dev, &internal, &card_number, &sysname) &&
-	    udev_sound_initialized(dev) &&
-	    !cras_system_alsa_card_exists(card_number)) {
-		if (internal)
-			set_factory_default(card_number);
-		device_add_alsa(dev, sysname, card_number, internal);
-	}
+	if (!is_card_device(dev, &internal, &card_number, &sysname) ||
+	    !udev_sound_initialized(dev))
+		return true;
+	ev = batch_card(batch, card_number);
+	if (ev == NULL)
+		return false;
+	if (ev->dev ||
+	    (!ev->remove && cras_system_alsa_card_exists(card_number)))
+		return true;
+	ev->dev = udev_device_ref(dev);
+	ev->internal = internal;
+	return true;
 }
 
-static void remove_device_if_card(struct udev_device *dev)
+/* Removes the card of an alsa card device in the batch. This cancels an add
+ * of the card earlier in the batch. Returns false if the batch is full. */
+static bool batch_remove_card(struct card_batch *batch,
+			      struct udev_device *dev)
 {
+	struct card_event *ev;
 	unsigned internal;
 	unsigned card_number;
 	const char *sysname;
 
-	if (is_card_device(dev, &internal, &card_number, &sysname))
-		device_remove_alsa(sysname, card_number);
+	if (!is_card_device(dev, &internal, &card_number, &sysname))
+		return true;
+	ev = batch_card(batch, card_number);
+	if (ev == NULL)
+		return false;
+	if (ev->dev) {
+		udev_device_unref(ev->dev);
+		ev->dev = NULL;
+	}
+	ev->remove = cras_system_alsa_card_exists(card_number);
+	return true;
 }
 
+/* Removes and adds the cards of the batch, then empties it. The cards added
+ * are probed concurrently by cras_system_add_alsa_cards. */
+static void commit_card_batch(struct card_batch *batch)
+{
+	struct cras_alsa_card_info cards[MAX_BATCHED_CARDS];
+	struct card_event *ev;
+	size_t i, num_cards = 0;
+	bool changed = false;
+
+	for (i = 0; i < batch->num_cards; i++) {
+		ev = &batch->cards[i];
+		if (ev->dev && ev->internal)
+			set_factory_default(ev->card_number);
+		changed |= ev->remove || ev->dev;
+	}
+	/* One delay for ALSA to catch up covers the whole batch. */
+	if (changed)
+		udev_delay_for_alsa();
+
+	for (i = 0; i < batch->num_cards; i++) {
+		ev = &batch->cards[i];
+		if (ev->remove)
+			cras_system_remove_alsa_card(ev->card_number);
+		if (ev->dev) {
+			fill_card_info(&cards[num_cards++], ev->dev,
+				       ev->card_number, ev->internal);
+			udev_device_unref(ev->dev);
+		}
+	}
+	batch->num_cards = 0;
+
+	if (num_cards)
+		cras_system_add_alsa_cards(cards, num_cards);
+}
+
+/* Adds the cards present at startup. They are collected first so that
+ * cras_system_add_alsa_cards can probe them concurrently. */
 static void enumerate_devices(struct udev_callback_data *data)
 {
 	struct udev_enumerate *enumerate = udev_enumerate_new(data->udev);
 	struct udev_list_entry *dl;
 	struct udev_list_entry *dev_list_entry;
+	struct card_batch batch;
 
+	batch.num_cards = 0;
 	udev_enumerate_add_match_subsystem(enumerate, subsystem);
 	udev_enumerate_scan_devices(enumerate);
 	dl = udev_enumerate_get_list_entry(enumerate);
@@ -361,31 +459,53 @@ static void enumerate_devices(struct udev_callback_data *data)
 		struct udev_device *dev =
 			udev_device_new_from_syspath(data->udev, path);
 
-		change_udev_device_if_alsa_device(dev);
+		if (!batch_add_card(&batch, dev)) {
+			commit_card_batch(&batch);
+			batch_add_card(&batch, dev);
+		}
 		udev_device_unref(dev);
 	}
 	udev_enumerate_unref(enumerate);
+
+	commit_card_batch(&batch);
 }
 
+/* Drains the pending udev events, so that the cards of a hotplug storm,
+ * e.g. a dock with several audio devices, are added together. */
 static void udev_sound_subsystem_callback(void *arg, int revents)
 {
 	struct udev_callback_data *data = (struct udev_callback_data *)arg;
 	struct udev_device *dev;
-
-	dev = udev_monitor_receive_device(data->mon);
-	if (dev) {
-		const char *action = udev_device_get_action(dev);
-
+	struct card_batch batch;
+	const char *action;
+	bool (*batch_event)(struct card_batch *, struct udev_device *);
+	int num_events = 0;
+
+	batch.num_cards = 0;
+	/* The monitor socket is non-blocking, receive returns NULL once the
+	 * events are drained. */
+	while (num_events < MAX_BATCHED_EVENTS &&
+	       (dev = udev_monitor_receive_device(data->mon))) {
+		action = udev_device_get_action(dev);
+		batch_event = NULL;
 		if (is_action_change(action))
-			change_udev_device_if_alsa_device(dev);
+			batch_event = batch_add_card;
 		else if (is_action_remove(action))
-			remove_device_if_card(dev);
+			batch_event = batch_remove_card;
+		if (batch_event && !batch_event(&batch, dev)) {
+			commit_card_batch(&batch);
+			batch_event(&batch, dev);
+		}
 		udev_device_unref(dev);
-	} else
+		num_events++;
+	}
+
+	if (num_events == 0)
 		syslog(LOG_WARNING,
 		       "%s (internal error): "
 		       "No device obtained",
 		       __FUNCTION__);
+	commit_card_batch(&batch);
 }
 
 static void compile_regex(regex_t *regex, const char *str)
@@ -0,0 +1,63 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdint.h>
+
+#include "cras_util.h"
+#include "cras_virtual_clock.h"
+
+/* Virtual time in nanoseconds, kept in one word so readers on other threads
+ * never see a torn timespec. */
+static uint64_t virtual_ns;
+static int virtual_enabled;
+
+void cras_virtual_clock_enable()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	__atomic_store_n(&virtual_ns,
+			 now.tv_sec * 1000000000ULL + now.tv_nsec,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&virtual_enabled, 1, __ATOMIC_RELEASE);
+}
+
+int cras_virtual_clock_enabled()
+{
+	return __atomic_load_n(&virtual_enabled, __ATOMIC_ACQUIRE);
+}
+
+void cras_virtual_clock_gettime(struct timespec *ts)
+{
+	uint64_t ns;
+
+	if (!cras_virtual_clock_enabled()) {
+		clock_gettime(CLOCK_MONOTONIC_RAW, ts);
+		return;
+	}
+	ns = __atomic_load_n(&virtual_ns, __ATOMIC_RELAXED);
+	ts->tv_sec = ns / 1000000000ULL;
+	ts->tv_nsec = ns % 1000000000ULL;
+}
+
+void cras_virtual_clock_advance(const struct timespec *delta)
+{
+	__atomic_add_fetch(&virtual_ns,
+			   delta->tv_sec * 1000000000ULL + delta->tv_nsec,
+			   __ATOMIC_RELAXED);
+}
+
+uint64_t cras_virtual_clock_frames_since(const struct timespec *beg,
+					 unsigned int rate)
+{
+	struct timespec now, time_since;
+
+	cras_virtual_clock_gettime(&now);
+	if (!timespec_after(&now, beg))
+		return 0;
+
+	subtract_timespecs(&now, beg, &time_since);
+	return cras_time_to_frames(&time_since, rate);
+}
@@ -0,0 +1,34 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * The clock the audio thread schedules against. It reads CLOCK_MONOTONIC_RAW
+ * unless offline rendering enabled the virtual clock, which only moves when
+ * the audio thread advances it past a sleep instead of waiting it out.
+ */
+
+#ifndef CRAS_VIRTUAL_CLOCK_H_
+#define CRAS_VIRTUAL_CLOCK_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/* Switches to the virtual clock, starting at the current CLOCK_MONOTONIC_RAW
+ * time. Call before the audio thread starts. */
+void cras_virtual_clock_enable();
+
+/* Returns non-zero if the virtual clock is enabled. */
+int cras_virtual_clock_enabled();
+
+/* Fills ts with the virtual time if enabled, CLOCK_MONOTONIC_RAW otherwise. */
+void cras_virtual_clock_gettime(struct timespec *ts);
+
+/* Moves the virtual clock forward by delta. Only the audio thread advances
+ * the clock, other threads may read it at any time. */
+void cras_virtual_clock_advance(const struct timespec *delta);
+
+/* Like cras_frames_since_time(), but on the virtual clock when enabled. */
+uint64_t cras_virtual_clock_frames_since(const struct timespec *beg,
+					 unsigned int rate);
+
+#endif /* CRAS_VIRTUAL_CLOCK_H_ */
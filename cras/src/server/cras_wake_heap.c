@@ -0,0 +1,152 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdlib.h>
+#include <syslog.h>
+#include <sys/param.h>
+
+#include "cras_rstream.h"
+#include "cras_util.h"
+#include "cras_wake_heap.h"
+
+/* The heap of the thread. A stream in it is at index wake_heap_pos - 1. The
+ * array is freed when the last stream leaves, the audio thread doesn't
+ * keep it while it has no playback. */
+static __thread struct cras_rstream **heap;
+static __thread unsigned int heap_size;
+static __thread unsigned int heap_alloc;
+
+void cras_wake_heap_key(const struct cras_rstream *stream,
+			struct timespec *key)
+{
+	if (timespec_after(&stream->next_cb_ts, &stream->fetch_lead)) {
+		subtract_timespecs(&stream->next_cb_ts, &stream->fetch_lead,
+				   key);
+	} else {
+		key->tv_sec = 0;
+		key->tv_nsec = 0;
+	}
+}
+
+static int orders_before(const struct cras_rstream *a,
+			 const struct cras_rstream *b)
+{
+	struct timespec ka, kb;
+
+	cras_wake_heap_key(a, &ka);
+	cras_wake_heap_key(b, &kb);
+	return timespec_after(&kb, &ka);
+}
+
+static void place(struct cras_rstream *stream, unsigned int i)
+{
+	heap[i] = stream;
+	stream->wake_heap_pos = i + 1;
+}
+
+static void sift_up(unsigned int i)
+{
+	struct cras_rstream *stream = heap[i];
+
+	while (i && orders_before(stream, heap[(i - 1) / 2])) {
+		place(heap[(i - 1) / 2], i);
+		i = (i - 1) / 2;
+	}
+	place(stream, i);
+}
+
+static void sift_down(unsigned int i)
+{
+	struct cras_rstream *stream = heap[i];
+	unsigned int child;
+
+	while ((child = 2 * i + 1) < heap_size) {
+		if (child + 1 < heap_size &&
+		    orders_before(heap[child + 1], heap[child]))
+			child++;
+		if (!orders_before(heap[child], stream))
+			break;
+		place(heap[child], i);
+		i = child;
+	}
+	place(stream, i);
+}
+
+static void reorder(struct cras_rstream *stream)
+{
+	unsigned int i;
+
+	if (!stream->wake_heap_pos)
+		return;
+	i = stream->wake_heap_pos - 1;
+	if (i && orders_before(stream, heap[(i - 1) / 2]))
+		sift_up(i);
+	else
+		sift_down(i);
+}
+
+void cras_wake_heap_add(struct cras_rstream *stream)
+{
+	struct cras_rstream **grown;
+
+	if (stream->wake_heap_refs++)
+		return;
+
+	if (heap_size == heap_alloc) {
+		grown = (struct cras_rstream **)realloc(
+			heap, 2 * MAX(heap_alloc, 4) * sizeof(*heap));
+		if (!grown) {
+			syslog(LOG_ERR, "No memory to schedule stream %x",
+			       stream->stream_id);
+			stream->wake_heap_refs--;
+			return;
+		}
+		heap = grown;
+		heap_alloc = 2 * MAX(heap_alloc, 4);
+	}
+	place(stream, heap_size++);
+	sift_up(heap_size - 1);
+}
+
+void cras_wake_heap_rm(struct cras_rstream *stream)
+{
+	unsigned int i;
+
+	if (!stream->wake_heap_refs || --stream->wake_heap_refs)
+		return;
+	if (!stream->wake_heap_pos)
+		return;
+
+	i = stream->wake_heap_pos - 1;
+	stream->wake_heap_pos = 0;
+	if (i != --heap_size) {
+		place(heap[heap_size], i);
+		reorder(heap[i]);
+	}
+	if (!heap_size) {
+		free(heap);
+		heap = NULL;
+		heap_alloc = 0;
+	}
+}
+
+void cras_wake_heap_set_next_cb_ts(struct cras_rstream *stream,
+				   const struct timespec *next_cb_ts)
+{
+	stream->next_cb_ts = *next_cb_ts;
+	reorder(stream);
+}
+
+void cras_wake_heap_set_fetch_lead(struct cras_rstream *stream,
+				   const struct timespec *fetch_lead)
+{
+	stream->fetch_lead = *fetch_lead;
+	reorder(stream);
+}
+
+struct cras_rstream *cras_wake_heap_at(unsigned int i)
+{
+	return i < heap_size ? heap[i] : NULL;
+}
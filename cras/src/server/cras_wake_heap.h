@@ -0,0 +1,47 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * A min-heap, one per audio thread, of the playback streams that wake the
+ * thread at their next_cb_ts. It is ordered on the earliest time each stream
+ * may be fetched, next_cb_ts less its fetch_lead, so the thread finds its
+ * next stream wake from the top of the heap instead of going over all the
+ * streams of all its devices. Once a stream is in the heap, its next_cb_ts
+ * and fetch_lead must only be changed through the setters below, on the
+ * thread that added it.
+ */
+
+#ifndef CRAS_WAKE_HEAP_H_
+#define CRAS_WAKE_HEAP_H_
+
+#include <time.h>
+
+struct cras_rstream;
+
+/* Takes a reference on the place of a stream in the heap of the calling
+ * thread, the first one adds the stream to it. */
+void cras_wake_heap_add(struct cras_rstream *stream);
+
+/* Drops a reference taken with cras_wake_heap_add(), the last one removes
+ * the stream from the heap. */
+void cras_wake_heap_rm(struct cras_rstream *stream);
+
+/* Sets the next callback time of a stream and moves it to its place in the
+ * heap. */
+void cras_wake_heap_set_next_cb_ts(struct cras_rstream *stream,
+				   const struct timespec *next_cb_ts);
+
+/* Sets the fetch lead of a stream and moves it to its place in the heap. */
+void cras_wake_heap_set_fetch_lead(struct cras_rstream *stream,
+				   const struct timespec *fetch_lead);
+
+/* Gets the time a stream orders on, its next_cb_ts less its fetch_lead. */
+void cras_wake_heap_key(const struct cras_rstream *stream,
+			struct timespec *key);
+
+/* Gets the stream at an index of the heap of the calling thread, NULL past
+ * its end. The stream at index 0 has the earliest key, and the children of
+ * index i, at 2i + 1 and 2i + 2, have keys no earlier than it. */
+struct cras_rstream *cras_wake_heap_at(unsigned int i);
+
+#endif /* CRAS_WAKE_HEAP_H_ */
@@ -3,6 +3,8 @@
  * found in the LICENSE file.
  */
 
+#include <errno.h>
+#include <math.h>
 #include <poll.h>
 #include <stdbool.h>
 #include <syslog.h>
@@ -10,10 +12,16 @@
 #include "audio_thread_log.h"
 #include "cras_audio_area.h"
 #include "cras_audio_thread_monitor.h"
+#include "cras_fmt_conv.h"
 #include "cras_iodev.h"
+#include "cras_mix.h"
+#include "cras_mix_pool.h"
 #include "cras_non_empty_audio_handler.h"
+#include "cras_ref_ring.h"
 #include "cras_rstream.h"
 #include "cras_server_metrics.h"
+#include "cras_virtual_clock.h"
+#include "cras_wake_heap.h"
 #include "dev_stream.h"
 #include "input_data.h"
 #include "polled_interval_checker.h"
@@ -44,8 +52,101 @@ static const int MIN_EMPTY_PERIOD_SEC = 30;
  */
 static const int DROP_FRAMES_THRESHOLD_MS = 50;
 
-/* The number of devices playing/capturing non-empty stream(s). */
-static int non_empty_device_count = 0;
+/*
+ * How much faster than the device rate the streams of an input device consume
+ * frames while they catch up on a backlog. Small enough that the pitch change
+ * of resampling is not audible.
+ */
+static const double CAPTURE_CATCH_UP_RATIO = 0.02;
+
+/*
+ * A device that recovered in place from a severe underrun is reset by the
+ * main thread instead if it has another one within this time.
+ */
+static const struct timespec in_place_recovery_interval = { 1, 0 };
+
+/* A group of output streams that has had too few members to mix for this
+ * many writes in a row is freed. */
+static const unsigned int STREAM_GROUP_IDLE_WRITES = 16;
+
+/* The number of devices of the calling audio thread playing/capturing
+ * non-empty stream(s). */
+static __thread int non_empty_device_count = 0;
+
+/* The number of audio threads with at least one non-empty device. */
+static int non_empty_thread_count = 0;
+
+/*
+ * Optional worker pool to render playback streams in parallel, used once an
+ * output device has at least mix_pool_min_streams running streams. Each audio
+ * thread has its own.
+ */
+static __thread struct cras_mix_pool *mix_pool;
+static __thread unsigned int mix_pool_min_streams;
+
+/* How long input wakes may be put off to coincide with other wakes. */
+static struct timespec input_wake_slack;
+
+/*
+ * The health averages weigh each new wake by 1 / (1 << HEALTH_EWMA_SHIFT).
+ * Underrun risk is only predicted after HEALTH_MIN_WAKES wakes, and the
+ * expected lateness covers HEALTH_LATENESS_STDDEVS standard deviations.
+ */
+static const unsigned int HEALTH_EWMA_SHIFT = 4;
+static const unsigned int HEALTH_MIN_WAKES = 16;
+static const unsigned int HEALTH_LATENESS_STDDEVS = 4;
+
+/*
+ * The buffer level is lowered after HEALTH_LOWER_WAKES consecutive wakes with
+ * more than twice the budget left, by a quarter of the excess.
+ */
+static const unsigned int HEALTH_LOWER_WAKES = 256;
+
+/* The most an output buffer level may be raised when at risk, 0 for never. */
+static unsigned int adaptive_buffer_max_ms;
+
+/* How long playback streams fade in and out, 0 for not at all. */
+static unsigned int stream_ramp_ms;
+
+/* Whether devices playing only DEEP_BUFFER streams are rewound when another
+ * stream starts. */
+static int deep_buffer_enabled;
+
+/*
+ * A stream to be rendered by the mix pool.
+ *    stream - The dev_stream to render.
+ *    fmt - The format of the output device.
+ *    frames - Maximum number of frames to render.
+ *    written - Number of frames rendered, or negative error code.
+ */
+struct mix_job {
+	struct dev_stream *stream;
+	const struct cras_audio_format *fmt;
+	unsigned int frames;
+	int written;
+};
+
+/* Jobs of the current write and the rendered buffers to sum, grown when
+ * streams are added, never on a wake. */
+static __thread struct mix_job *mix_jobs;
+static __thread struct cras_mix_src *mix_srcs;
+static __thread unsigned int mix_jobs_size;
+
+/* Gets the current time in nanoseconds, to time the stages of a wake. */
+static inline uint64_t stage_clock_ns()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Adds the time since start to the current wake's time in a stage. */
+static inline void add_stage_time(struct open_dev *adev,
+				  enum CRAS_DEV_IO_STAGE stage, uint64_t start)
+{
+	adev->stage_ns[stage] += stage_clock_ns() - start;
+}
 
 /* Gets the master device which the stream is attached to. */
 static inline struct cras_iodev *get_master_dev(const struct dev_stream *stream)
@@ -73,7 +174,8 @@ static void update_estimated_rate(struct open_dev *adev)
 			dev_stream, dev->format->frame_rate,
 			cras_iodev_get_est_rate_ratio(dev),
 			cras_iodev_get_est_rate_ratio(master_dev),
-			adev->coarse_rate_adjust);
+			adev->coarse_rate_adjust,
+			adev->capture_catch_up ? CAPTURE_CATCH_UP_RATIO : 0);
 	}
 }
 
@@ -95,20 +197,31 @@ static inline int count_non_empty_dev(struct open_dev *adevs)
 int dev_io_check_non_empty_state_transition(struct open_dev *adevs)
 {
 	int new_non_empty_dev_count = count_non_empty_dev(adevs);
-
-	// If we have transitioned to or from a state with 0 non-empty devices,
-	// notify the main thread to update system state.
-	if ((non_empty_device_count == 0) != (new_non_empty_dev_count == 0))
-		cras_non_empty_audio_send_msg(new_non_empty_dev_count > 0 ? 1 :
-									    0);
+	int threads;
+
+	// If all audio threads together have transitioned to or from a state
+	// with 0 non-empty devices, notify the main thread to update system
+	// state.
+	if (non_empty_device_count == 0 && new_non_empty_dev_count > 0) {
+		threads = __atomic_add_fetch(&non_empty_thread_count, 1,
+					     __ATOMIC_ACQ_REL);
+		if (threads == 1)
+			cras_non_empty_audio_send_msg(1);
+	} else if (non_empty_device_count > 0 && new_non_empty_dev_count == 0) {
+		threads = __atomic_sub_fetch(&non_empty_thread_count, 1,
+					     __ATOMIC_ACQ_REL);
+		if (threads == 0)
+			cras_non_empty_audio_send_msg(0);
+	}
 
 	non_empty_device_count = new_non_empty_dev_count;
 	return non_empty_device_count > 0;
 }
 
-/* Checks whether it is time to fetch. */
-static bool is_time_to_fetch(const struct dev_stream *dev_stream,
-			     struct timespec now)
+/* Checks whether the scheduled fetch of a stream is due. With with_lead the
+ * fetch lead of the stream counts too. */
+static bool is_fetch_due(const struct dev_stream *dev_stream,
+			 struct timespec now, bool with_lead)
 {
 	const struct timespec *next_cb_ts;
 	next_cb_ts = dev_stream_next_cb_ts(dev_stream);
@@ -117,15 +230,27 @@ static bool is_time_to_fetch(const struct dev_stream *dev_stream,
 
 	/*
 	 * Check if it's time to get more data from this stream.
-	 * Allow for waking up a little early.
+	 * Allow for waking up a little early, except for low latency streams
+	 * which are fetched exactly once per period.
 	 */
-	add_timespecs(&now, &playback_wake_fuzz_ts);
+	if (!(dev_stream->stream->flags & LOW_LATENCY))
+		add_timespecs(&now, &playback_wake_fuzz_ts);
+	if (with_lead)
+		add_timespecs(&now, &dev_stream->stream->fetch_lead);
 	if (timespec_after(&now, next_cb_ts))
 		return 1;
 
 	return 0;
 }
 
+/* Checks whether it is time to fetch. Streams whose client is slow to
+ * reply are fetched their fetch lead ahead of schedule. */
+static bool is_time_to_fetch(const struct dev_stream *dev_stream,
+			     struct timespec now)
+{
+	return is_fetch_due(dev_stream, now, true);
+}
+
 /* The log only accepts uint32 arguments, so the float power
  * must be written as bits and assumed to have a float when
  * parsing the log.
@@ -139,47 +264,80 @@ static uint32_t get_ewma_power_as_int(struct ewma_power *ewma)
 	return pow_as_int;
 }
 
+/* Publishes the timing of dev to the client of stream.
+ * Args:
+ *    stream - The stream attached to dev.
+ *    dev - The device the stream is attached to.
+ *    delay - The delay of dev, including its DSP delay.
+ */
+static void set_stream_telemetry(const struct dev_stream *stream,
+				 const struct cras_iodev *dev, int delay)
+{
+	int dsp_delay = cras_iodev_get_dsp_delay(dev);
+
+	dev_stream_set_telemetry(stream, MAX(delay - dsp_delay, 0), dsp_delay,
+				 cras_iodev_get_est_rate_ratio(dev),
+				 cras_iodev_get_num_underruns(dev), &dev->ewma);
+}
+
 /* Asks any stream with room for more data. Sets the time stamp for all streams.
  * Args:
  *    adev - The output device streams are attached to.
+ *    now - The time of the wake, shared by all streams.
  * Returns:
  *    0 on success, negative error on failure. If failed, can assume that all
  *    streams have been removed from the device.
  */
-static int fetch_streams(struct open_dev *adev)
+/* Logs how long the client of rstream took to reply to the last fetch, once
+ * the reply is in, for the workload recording. */
+static void log_stream_reply(const struct cras_rstream *rstream,
+			     const struct timespec *now)
 {
-	struct dev_stream *dev_stream;
+	struct timespec ts;
+
+	if (!atlog_workload || cras_rstream_is_pending_reply(rstream))
+		return;
+	if (!rstream->last_fetch_ts.tv_sec && !rstream->last_fetch_ts.tv_nsec)
+		return;
+	subtract_timespecs(now, &rstream->last_fetch_ts, &ts);
+	ATLOG(atlog, AUDIO_THREAD_STREAM_REPLY, rstream->stream_id,
+	      ts.tv_sec * 1000000 + ts.tv_nsec / 1000, 0);
+}
+
+static int fetch_streams(struct open_dev *adev, const struct timespec *now)
+{
+	struct cras_iodev_stream_ref *ref;
 	struct cras_iodev *odev = adev->dev;
 	int rc;
 	int delay;
+	int i;
 
 	delay = cras_iodev_delay_frames(odev);
 	if (delay < 0)
 		return delay;
+	ATLOG_WORKLOAD(atlog, AUDIO_THREAD_DEV_DELAY, odev->info.idx, delay, 0);
 
-	DL_FOREACH (adev->dev->streams, dev_stream) {
-		struct cras_rstream *rstream = dev_stream->stream;
-		struct cras_audio_shm *shm = cras_rstream_shm(rstream);
-		struct timespec now;
-
-		clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	ARRAY_ELEMENT_FOREACH (&odev->stream_refs, i, ref) {
+		struct dev_stream *dev_stream = ref->dev_stream;
+		struct cras_rstream *rstream = ref->stream;
+		struct cras_audio_shm *shm = ref->shm;
 
 		if (dev_stream_is_pending_reply(dev_stream)) {
 			dev_stream_flush_old_audio_messages(dev_stream);
-			cras_rstream_record_fetch_interval(dev_stream->stream,
-							   &now);
+			cras_rstream_record_fetch_interval(rstream, now);
+			log_stream_reply(rstream, now);
 		}
 
 		if (!dev_stream_is_running(dev_stream))
 			continue;
 
-		if (!is_time_to_fetch(dev_stream, now))
+		if (!is_time_to_fetch(dev_stream, *now))
 			continue;
 
 		if (cras_shm_get_frames(shm) < 0)
 			cras_rstream_set_is_draining(rstream, 1);
 
-		if (cras_rstream_get_is_draining(dev_stream->stream))
+		if (cras_rstream_get_is_draining(rstream))
 			continue;
 
 		/*
@@ -193,24 +351,29 @@ static int fetch_streams(struct open_dev *adev)
 
 		/*
 		 * Skip fetching if there are enough frames in shared memory.
+		 * A fetch ahead of schedule waits for the buffer to drain,
+		 * the shm buffer bounds how far ahead the client can write.
 		 */
 		if (!cras_shm_is_buffer_available(shm)) {
+			if (!is_fetch_due(dev_stream, *now, false))
+				continue;
 			ATLOG(atlog, AUDIO_THREAD_STREAM_SKIP_CB,
 			      cras_rstream_id(rstream),
 			      shm->header->write_offset[0],
 			      shm->header->write_offset[1]);
 			dev_stream_update_next_wake_time(dev_stream);
-			cras_server_metrics_missed_cb_event(dev_stream->stream);
+			cras_server_metrics_missed_cb_event(rstream);
 			continue;
 		}
 
-		dev_stream_set_delay(dev_stream, delay);
+		dev_stream_set_delay(dev_stream, delay, &odev->delay_tstamp);
+		set_stream_telemetry(dev_stream, odev, delay);
 
 		ATLOG(atlog, AUDIO_THREAD_FETCH_STREAM, rstream->stream_id,
 		      cras_rstream_get_cb_threshold(rstream),
 		      get_ewma_power_as_int(&rstream->ewma));
 
-		rc = dev_stream_request_playback_samples(dev_stream, &now);
+		rc = dev_stream_request_playback_samples(dev_stream, now);
 		if (rc < 0) {
 			syslog(LOG_ERR, "fetch err: %d for %x", rc,
 			       cras_rstream_id(rstream));
@@ -221,21 +384,26 @@ static int fetch_streams(struct open_dev *adev)
 	return 0;
 }
 
-/* Gets the max delay frames of open input devices. */
-static int input_delay_frames(struct open_dev *adevs)
+/* Gets the max delay frames of open input devices, and when the device with
+ * the max delay measured it in tstamp. */
+static int input_delay_frames(struct open_dev *adevs, struct timespec *tstamp)
 {
 	struct open_dev *adev;
 	int delay;
 	int max_delay = 0;
 
+	tstamp->tv_sec = 0;
+	tstamp->tv_nsec = 0;
 	DL_FOREACH (adevs, adev) {
 		if (!cras_iodev_is_open(adev->dev))
 			continue;
 		delay = cras_iodev_delay_frames(adev->dev);
 		if (delay < 0)
 			return delay;
-		if (delay > max_delay)
+		if (delay > max_delay) {
 			max_delay = delay;
+			*tstamp = adev->dev->delay_tstamp;
+		}
 	}
 	return max_delay;
 }
@@ -246,17 +414,22 @@ static int input_delay_frames(struct open_dev *adevs)
  */
 static unsigned int set_stream_delay(struct open_dev *adev)
 {
-	struct dev_stream *stream;
+	struct cras_iodev_stream_ref *ref;
+	struct timespec delay_tstamp;
 	int delay;
+	int i;
 
 	/* TODO(dgreid) - Setting delay from last dev only. */
-	delay = input_delay_frames(adev);
+	delay = input_delay_frames(adev, &delay_tstamp);
+	ATLOG_WORKLOAD(atlog, AUDIO_THREAD_DEV_DELAY, adev->dev->info.idx,
+		       delay, 0);
 
-	DL_FOREACH (adev->dev->streams, stream) {
-		if (stream->stream->flags & TRIGGER_ONLY)
+	ARRAY_ELEMENT_FOREACH (&adev->dev->stream_refs, i, ref) {
+		if (ref->stream->flags & TRIGGER_ONLY)
 			continue;
 
-		dev_stream_set_delay(stream, delay);
+		dev_stream_set_delay(ref->dev_stream, delay, &delay_tstamp);
+		set_stream_telemetry(ref->dev_stream, adev->dev, delay);
 	}
 
 	return 0;
@@ -275,27 +448,28 @@ static unsigned int get_stream_limit(struct open_dev *adev,
 				     unsigned int write_limit,
 				     struct dev_stream **limit_stream)
 {
+	struct cras_iodev_stream_ref *ref;
 	struct cras_rstream *rstream;
 	struct cras_audio_shm *shm;
-	struct dev_stream *stream;
 	unsigned int avail;
+	int i;
 
 	*limit_stream = NULL;
 
-	DL_FOREACH (adev->dev->streams, stream) {
-		rstream = stream->stream;
-		if (rstream->flags & TRIGGER_ONLY)
+	ARRAY_ELEMENT_FOREACH (&adev->dev->stream_refs, i, ref) {
+		rstream = ref->stream;
+		if ((rstream->flags & TRIGGER_ONLY) || ref->dev_stream->paused)
 			continue;
 
-		shm = cras_rstream_shm(rstream);
+		shm = ref->shm;
 		if (cras_shm_check_write_overrun(shm))
 			ATLOG(atlog, AUDIO_THREAD_READ_OVERRUN,
 			      adev->dev->info.idx, rstream->stream_id,
 			      shm->header->num_overruns);
-		avail = dev_stream_capture_avail(stream);
+		avail = dev_stream_capture_avail(ref->dev_stream);
 		if (avail < write_limit) {
 			write_limit = avail;
-			*limit_stream = stream;
+			*limit_stream = ref->dev_stream;
 		}
 	}
 
@@ -321,9 +495,10 @@ static const struct timespec min_input_dev_wake_ts = {
  */
 static int get_input_dev_max_wake_ts(struct open_dev *adev,
 				     unsigned int curr_level,
+				     const struct timespec *now,
 				     struct timespec *res_ts)
 {
-	struct timespec dev_wake_ts, now;
+	struct timespec dev_wake_ts;
 	unsigned int dev_rate, half_buffer_size, target_frames;
 
 	if (!adev || !adev->dev || !adev->dev->format ||
@@ -345,11 +520,36 @@ static int get_input_dev_max_wake_ts(struct open_dev *adev,
 		*res_ts = dev_wake_ts;
 	}
 
-	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
-	add_timespecs(res_ts, &now);
+	add_timespecs(res_ts, now);
 	return 0;
 }
 
+/* Gets the time the wake of an input device may be put off, the configured
+ * slack capped to a quarter of its smallest callback. Devices running a low
+ * latency stream get no slack. */
+static void get_input_wake_slack(const struct cras_iodev *dev,
+				 struct timespec *slack)
+{
+	const struct dev_stream *stream;
+	struct timespec cb_slack;
+
+	DL_FOREACH (dev->streams, stream) {
+		if (stream->stream->flags & LOW_LATENCY) {
+			slack->tv_sec = 0;
+			slack->tv_nsec = 0;
+			return;
+		}
+	}
+
+	*slack = input_wake_slack;
+	if (!dev->format || !dev->format->frame_rate)
+		return;
+	cras_frames_to_time(dev->min_cb_level / 4, dev->format->frame_rate,
+			    &cb_slack);
+	if (timespec_after(slack, &cb_slack))
+		*slack = cb_slack;
+}
+
 /* Returns whether a device can drop samples. */
 static bool input_devices_can_drop_samples(struct cras_iodev *iodev)
 {
@@ -373,44 +573,53 @@ static bool input_devices_can_drop_samples(struct cras_iodev *iodev)
  *    adev - The input device.
  *    need_to_drop - The pointer to store whether we need to drop samples from
  *                   a device in order to keep the lower hw_level.
+ *    need_to_catch_up - The pointer to store whether the streams need to
+ *                       catch up on the frames queued in a device.
  * Returns:
  *    0 on success. Negative error code on failure.
  */
-static int set_input_dev_wake_ts(struct open_dev *adev, bool *need_to_drop)
+static int set_input_dev_wake_ts(struct open_dev *adev, bool *need_to_drop,
+				 bool *need_to_catch_up)
 {
 	int rc;
 	struct timespec level_tstamp, wake_time_out, min_ts, now, dev_wake_ts;
+	struct timespec latest_ts, slack;
 	unsigned int curr_level, cap_limit;
-	struct dev_stream *stream;
+	struct cras_iodev_stream_ref *ref;
 	struct dev_stream *cap_limit_stream;
+	int i;
 
 	/* Limit the sleep time to 20 seconds. */
 	min_ts.tv_sec = 20;
 	min_ts.tv_nsec = 0;
-	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	cras_virtual_clock_gettime(&now);
 	add_timespecs(&min_ts, &now);
 	/* Set default value for device wake_ts. */
 	adev->wake_ts = min_ts;
+	adev->wake_latest_ts = min_ts;
 
 	rc = cras_iodev_frames_queued(adev->dev, &level_tstamp);
 	if (rc < 0)
 		return rc;
 	curr_level = rc;
 	if (!timespec_is_nonzero(&level_tstamp))
-		clock_gettime(CLOCK_MONOTONIC_RAW, &level_tstamp);
+		cras_virtual_clock_gettime(&level_tstamp);
 
 	/*
-	 * Drop frames from all devices if any device meets these requirements:
-	 * 1. The hw_level is larger than largest_cb_level * 1.5 or larger than
-	 *    buffer_size * 0.5.
-	 * 2. The time of those frames is larger than DROP_FRAMES_THRESHOLD_MS.
+	 * When the time of the queued frames is larger than
+	 * DROP_FRAMES_THRESHOLD_MS, the streams of all devices catch up if the
+	 * hw_level is larger than largest_cb_level * 1.5. Dropping frames is
+	 * kept for when the hw_level is larger than buffer_size * 0.5 and the
+	 * device is about to overrun.
 	 */
 	if (input_devices_can_drop_samples(adev->dev) &&
-	    (rc >= adev->dev->largest_cb_level * 1.5 ||
-	     rc >= adev->dev->buffer_size * 0.5) &&
 	    cras_frames_to_ms(rc, adev->dev->format->frame_rate) >=
-		    DROP_FRAMES_THRESHOLD_MS)
-		*need_to_drop = true;
+		    DROP_FRAMES_THRESHOLD_MS) {
+		if (rc >= adev->dev->buffer_size * 0.5)
+			*need_to_drop = true;
+		else if (rc >= adev->dev->largest_cb_level * 1.5)
+			*need_to_catch_up = true;
+	}
 
 	cap_limit = get_stream_limit(adev, UINT_MAX, &cap_limit_stream);
 
@@ -418,10 +627,14 @@ static int set_input_dev_wake_ts(struct open_dev *adev, bool *need_to_drop)
 	 * Loop through streams to find the earliest time audio thread
 	 * should wake up.
 	 */
-	DL_FOREACH (adev->dev->streams, stream) {
+	ARRAY_ELEMENT_FOREACH (&adev->dev->stream_refs, i, ref) {
+		if (ref->dev_stream->paused)
+			continue;
+
 		wake_time_out = min_ts;
-		rc = dev_stream_wake_time(stream, curr_level, &level_tstamp,
-					  cap_limit, cap_limit_stream == stream,
+		rc = dev_stream_wake_time(ref->dev_stream, curr_level,
+					  &level_tstamp, cap_limit,
+					  cap_limit_stream == ref->dev_stream,
 					  &wake_time_out);
 
 		/*
@@ -439,26 +652,66 @@ static int set_input_dev_wake_ts(struct open_dev *adev, bool *need_to_drop)
 		}
 	}
 
+	/* Streams only wait for data, so their wake can slip a little. */
+	get_input_wake_slack(adev->dev, &slack);
+	latest_ts = min_ts;
+	add_timespecs(&latest_ts, &slack);
+
 	/* If there's no room in streams, don't bother schedule wake for more
 	 * input data. */
 	if (adev->dev->active_node &&
 	    adev->dev->active_node->type != CRAS_NODE_TYPE_HOTWORD &&
 	    cap_limit) {
-		rc = get_input_dev_max_wake_ts(adev, curr_level, &dev_wake_ts);
+		rc = get_input_dev_max_wake_ts(adev, curr_level, &now,
+					       &dev_wake_ts);
 		if (rc < 0) {
 			syslog(LOG_ERR,
 			       "Failed to call get_input_dev_max_wake_ts."
 			       "rc = %d",
 			       rc);
-		} else if (timespec_after(&min_ts, &dev_wake_ts)) {
-			min_ts = dev_wake_ts;
+		} else {
+			if (timespec_after(&min_ts, &dev_wake_ts))
+				min_ts = dev_wake_ts;
+			if (timespec_after(&latest_ts, &dev_wake_ts))
+				latest_ts = dev_wake_ts;
 		}
 	}
 
 	adev->wake_ts = min_ts;
+	adev->wake_latest_ts = latest_ts;
 	return rc;
 }
 
+/* Drops the frames of the input buffer a VAD_GATED stream hasn't read while
+ * no voice is heard. They never reach the stream's APM or shm, so neither
+ * the processing nor the client wake up for them. */
+static void drop_gated_frames(struct cras_iodev *idev,
+			      struct dev_stream *stream, unsigned int nread)
+{
+	unsigned int offset = cras_iodev_stream_offset(idev, stream);
+
+	if (offset < nread)
+		cras_iodev_stream_written(idev, stream, nread - offset);
+}
+
+/* Publishes the voice activity of the device to its VAD_GATED streams. */
+static void publish_vad(struct cras_iodev *idev)
+{
+	struct cras_iodev_stream_ref *ref;
+	int active = energy_vad_active(&idev->vad);
+	int i;
+
+	ARRAY_ELEMENT_FOREACH (&idev->stream_refs, i, ref) {
+		if (!(ref->stream->flags & VAD_GATED))
+			continue;
+		if (cras_shm_set_vad_active(cras_rstream_shm(ref->stream),
+					    active))
+			ATLOG(atlog, AUDIO_THREAD_STREAM_VAD,
+			      ref->stream->stream_id, active,
+			      idev->vad.num_transitions);
+	}
+}
+
 /* Read samples from an input device to the specified stream.
  * Args:
  *    adev - The device to capture samples from.
@@ -471,10 +724,11 @@ static int capture_to_streams(struct open_dev *adev)
 	struct timespec hw_tstamp;
 	int rc;
 	struct dev_stream *cap_limit_stream;
-	struct dev_stream *stream;
+	struct cras_iodev_stream_ref *ref;
+	int i;
 
-	DL_FOREACH (adev->dev->streams, stream)
-		dev_stream_flush_old_audio_messages(stream);
+	ARRAY_ELEMENT_FOREACH (&idev->stream_refs, i, ref)
+		dev_stream_flush_old_audio_messages(ref->dev_stream);
 
 	rc = cras_iodev_frames_queued(idev, &hw_tstamp);
 	if (rc < 0)
@@ -510,26 +764,34 @@ static int capture_to_streams(struct open_dev *adev)
 	while (remainder > 0) {
 		struct cras_audio_area *area = NULL;
 		unsigned int nread, total_read;
+		uint64_t start;
 
 		nread = remainder;
 
+		start = stage_clock_ns();
 		rc = cras_iodev_get_input_buffer(idev, &nread);
+		add_stage_time(adev, CRAS_DEV_IO_STAGE_CAPTURE_READ, start);
 		if (rc < 0 || nread == 0)
 			return rc;
 
-		DL_FOREACH (adev->dev->streams, stream) {
+		start = stage_clock_ns();
+		ARRAY_ELEMENT_FOREACH (&idev->stream_refs, i, ref) {
+			struct dev_stream *stream = ref->dev_stream;
 			unsigned int this_read;
 			unsigned int area_offset;
 			float software_gain_scaler;
+			int converted;
 
-			if ((stream->stream->flags & TRIGGER_ONLY) &&
-			    stream->stream->triggered)
+			if ((ref->stream->flags & TRIGGER_ONLY) &&
+			    ref->stream->triggered)
 				continue;
-
-			input_data_get_for_stream(idev->input_data,
-						  stream->stream,
-						  idev->buf_state, &area,
-						  &area_offset);
+			if (stream->paused)
+				continue;
+			if ((ref->stream->flags & VAD_GATED) &&
+			    !energy_vad_active(&idev->vad)) {
+				drop_gated_frames(idev, stream, nread);
+				continue;
+			}
 
 			/*
 			 * The UI gain scaler should always take effect.
@@ -542,18 +804,46 @@ static int capture_to_streams(struct open_dev *adev)
 				input_data_get_software_gain_scaler(
 					idev->input_data,
 					idev->software_gain_scaler,
-					stream->stream);
+					ref->stream);
+
+			/* APM output the stream takes as is is interleaved
+			 * only once, into the stream shm. */
+			if (dev_stream_can_capture_planar(
+				    stream, software_gain_scaler) &&
+			    input_data_get_planar_for_stream(
+				    idev->input_data, ref->stream,
+				    idev->buf_state, &area)) {
+				this_read = dev_stream_capture_planar(stream,
+								      area);
+				input_data_put_for_stream(idev->input_data,
+							  ref->stream,
+							  idev->buf_state,
+							  this_read);
+				continue;
+			}
+
+			converted = input_data_get_for_stream(
+				idev->input_data, ref->stream,
+				idev->buf_state, &area, &area_offset);
 
-			this_read =
-				dev_stream_capture(stream, area, area_offset,
-						   software_gain_scaler);
+			if (converted)
+				this_read = dev_stream_capture_converted(
+					stream, area, area_offset,
+					software_gain_scaler);
+			else
+				this_read = dev_stream_capture(
+					stream, area, area_offset,
+					software_gain_scaler);
 
 			input_data_put_for_stream(idev->input_data,
-						  stream->stream,
+						  ref->stream,
 						  idev->buf_state, this_read);
 		}
+		add_stage_time(adev, CRAS_DEV_IO_STAGE_CAPTURE_STREAMS, start);
 
+		start = stage_clock_ns();
 		rc = cras_iodev_put_input_buffer(idev);
+		add_stage_time(adev, CRAS_DEV_IO_STAGE_CAPTURE_READ, start);
 		if (rc < 0)
 			return rc;
 
@@ -564,12 +854,331 @@ static int capture_to_streams(struct open_dev *adev)
 			break;
 	}
 
+	publish_vad(idev);
+
 	ATLOG(atlog, AUDIO_THREAD_READ_AUDIO_DONE, remainder,
 	      get_ewma_power_as_int(&idev->ewma), 0);
 
 	return 0;
 }
 
+/* Mixes each running stream directly into dst, one after another. */
+static void write_streams_serial(struct open_dev **odevs,
+				 struct open_dev *adev, uint8_t *dst,
+				 size_t write_limit)
+{
+	struct cras_iodev *odev = adev->dev;
+	struct dev_stream *curr;
+	unsigned int frame_bytes = cras_get_format_bytes(odev->format);
+
+	DL_FOREACH (adev->dev->streams, curr) {
+		unsigned int offset;
+		int nwritten;
+
+		if (!dev_stream_is_running(curr) || curr->grouped)
+			continue;
+
+		offset = cras_iodev_stream_offset(odev, curr);
+		if (offset >= write_limit)
+			continue;
+		nwritten = dev_stream_mix(curr, odev->format,
+					  dst + frame_bytes * offset,
+					  write_limit - offset);
+
+		if (nwritten < 0) {
+			dev_io_remove_stream(odevs, curr->stream, NULL);
+			continue;
+		}
+
+		cras_iodev_stream_written(odev, curr, nwritten);
+	}
+}
+
+/* Makes room to render the streams of a device on the mix pool, so a wake
+ * never allocates. Called on the audio thread as a stream is added. */
+static void reserve_parallel_mix(struct cras_iodev *odev,
+				 struct dev_stream *out)
+{
+	unsigned int num_jobs = ARRAY_COUNT(&odev->stream_refs);
+
+	if (!mix_pool)
+		return;
+
+	if (num_jobs > mix_jobs_size) {
+		struct mix_job *jobs =
+			realloc(mix_jobs, num_jobs * sizeof(*mix_jobs));
+		struct cras_mix_src *srcs;
+
+		if (!jobs)
+			return;
+		mix_jobs = jobs;
+		srcs = realloc(mix_srcs, num_jobs * sizeof(*mix_srcs));
+		if (!srcs)
+			return;
+		mix_srcs = srcs;
+		mix_jobs_size = num_jobs;
+	}
+
+	if (dev_stream_reserve_mix_buffer(out, odev->format,
+					  odev->buffer_size))
+		syslog(LOG_WARNING, "No mix buffer for stream %x, mix serially",
+		       out->stream->stream_id);
+}
+
+static void render_mix_job(void *arg)
+{
+	struct mix_job *job = (struct mix_job *)arg;
+
+	job->written = dev_stream_render(job->stream, job->fmt, job->frames);
+}
+
+/*
+ * Renders each running stream into its own buffer on the mix pool, then sums
+ * the rendered frames into dst on the calling thread in a single pass.
+ * Returns the number of streams handled, or negative error code if the jobs
+ * can't be set up, in which case the caller falls back to serial mixing.
+ */
+static int write_streams_parallel(struct open_dev **odevs,
+				  struct open_dev *adev, uint8_t *dst,
+				  size_t write_limit)
+{
+	struct cras_iodev *odev = adev->dev;
+	struct dev_stream *curr;
+	unsigned int num_jobs;
+	unsigned int num_srcs = 0;
+	unsigned int mix_limit = 0;
+	unsigned int offset;
+	unsigned int i;
+
+	/* What wasn't made room for when the streams were added is mixed
+	 * serially, rather than allocated on the wake. */
+	if (ARRAY_COUNT(&odev->stream_refs) > mix_jobs_size)
+		return -ENOSPC;
+
+	num_jobs = 0;
+	DL_FOREACH (adev->dev->streams, curr) {
+		if (!dev_stream_is_running(curr) || curr->grouped)
+			continue;
+		offset = cras_iodev_stream_offset(odev, curr);
+		if (offset >= write_limit)
+			continue;
+		if (write_limit - offset > curr->mix_buffer_size_frames)
+			return -ENOSPC;
+		mix_jobs[num_jobs].stream = curr;
+		mix_jobs[num_jobs].fmt = odev->format;
+		mix_jobs[num_jobs].frames = write_limit - offset;
+		num_jobs++;
+	}
+
+	cras_mix_pool_run(mix_pool, render_mix_job, mix_jobs, sizeof(*mix_jobs),
+			  num_jobs);
+
+	for (i = 0; i < num_jobs; i++) {
+		struct mix_job *job = &mix_jobs[i];
+
+		curr = job->stream;
+		if (job->written < 0) {
+			dev_io_remove_stream(odevs, curr->stream, NULL);
+			continue;
+		}
+		ATLOG(atlog, AUDIO_THREAD_DEV_STREAM_MIX, job->written, 0, 0);
+		if (curr->mix_silent)
+			continue;
+
+		offset = cras_iodev_stream_offset(odev, curr);
+		mix_srcs[num_srcs].buf = curr->mix_buffer;
+		mix_srcs[num_srcs].offset = offset * odev->format->num_channels;
+		mix_srcs[num_srcs].count =
+			job->written * odev->format->num_channels;
+		mix_srcs[num_srcs].vol = 1.0f;
+		mix_limit = MAX(mix_limit, mix_srcs[num_srcs].offset +
+						   mix_srcs[num_srcs].count);
+		num_srcs++;
+	}
+
+	/* Sum every rendered buffer in one pass over dst, instead of reading
+	 * and writing it again for each stream. */
+	cras_mix_add_multi(odev->format->format, dst, mix_srcs, num_srcs,
+			   mix_limit);
+
+	for (i = 0; i < num_jobs; i++) {
+		if (mix_jobs[i].written >= 0)
+			cras_iodev_stream_written(odev, mix_jobs[i].stream,
+						  mix_jobs[i].written);
+	}
+
+	return num_jobs;
+}
+
+/* Lets the node's configured matrices replace the default channel mixing of
+ * a converter to the device. */
+static void set_node_channel_matrix(struct cras_iodev *dev,
+				    struct cras_fmt_conv *conv)
+{
+	if (conv && dev->active_node && dev->active_node->channel_matrices &&
+	    cras_fmt_conv_set_channel_matrix(conv,
+					     dev->active_node->channel_matrices))
+		syslog(LOG_ERR, "Failed to set node channel matrix");
+}
+
+/* Returns non-zero if curr can be mixed by a group in a write of write_limit
+ * frames. */
+static int stream_groupable(struct cras_iodev *odev, struct dev_stream *curr,
+			    size_t write_limit)
+{
+	return dev_stream_is_running(curr) && dev_stream_can_group(curr) &&
+	       cras_iodev_stream_offset(odev, curr) < write_limit;
+}
+
+/* Finds the group of adev that curr can join, creating one if a stream after
+ * curr could join it too. Returns NULL if curr is mixed on its own. */
+static struct dev_stream_group *join_stream_group(struct open_dev *adev,
+						  struct dev_stream *curr,
+						  size_t write_limit)
+{
+	struct cras_iodev *odev = adev->dev;
+	struct dev_stream_group *group;
+	struct dev_stream *other;
+	unsigned int offset = cras_iodev_stream_offset(odev, curr);
+
+	/* Members are mixed to the same place of the device. */
+	DL_FOREACH (adev->stream_groups, group) {
+		if (group->num_members == DEV_STREAM_GROUP_MAX_MEMBERS)
+			continue;
+		if (group->num_members &&
+		    cras_iodev_stream_offset(odev, group->members[0]) != offset)
+			continue;
+		if (dev_stream_group_matches(group, curr))
+			return group;
+	}
+
+	for (other = curr->next; other; other = other->next) {
+		if (stream_groupable(odev, other, write_limit) &&
+		    cras_iodev_stream_offset(odev, other) == offset &&
+		    dev_stream_convert_alike(curr, other))
+			break;
+	}
+	if (!other)
+		return NULL;
+
+	group = dev_stream_group_create(curr, odev->format, odev->buffer_size);
+	if (!group)
+		return NULL;
+	set_node_channel_matrix(odev, group->conv);
+	DL_APPEND(adev->stream_groups, group);
+	return group;
+}
+
+/*
+ * Mixes the running streams that convert alike through one converter per
+ * group, instead of each through its own. The streams mixed are marked
+ * grouped so they are skipped by the serial and parallel mixing. A group
+ * that can't be mixed leaves its members to those.
+ */
+static void write_streams_grouped(struct open_dev *adev, uint8_t *dst,
+				  size_t write_limit)
+{
+	struct cras_iodev *odev = adev->dev;
+	struct dev_stream_group *group;
+	struct dev_stream *curr;
+	unsigned int frame_bytes = cras_get_format_bytes(odev->format);
+	unsigned int offset, i;
+	int nwritten;
+
+	DL_FOREACH (odev->streams, curr) {
+		curr->grouped = 0;
+		if (!stream_groupable(odev, curr, write_limit))
+			continue;
+		group = join_stream_group(adev, curr, write_limit);
+		if (group)
+			group->members[group->num_members++] = curr;
+	}
+
+	DL_FOREACH (adev->stream_groups, group) {
+		if (group->num_members < 2) {
+			group->num_members = 0;
+			if (++group->idle_writes >= STREAM_GROUP_IDLE_WRITES) {
+				DL_DELETE(adev->stream_groups, group);
+				dev_stream_group_destroy(group);
+			}
+			continue;
+		}
+		group->idle_writes = 0;
+
+		offset = cras_iodev_stream_offset(odev, group->members[0]);
+		nwritten = dev_stream_group_mix(group, odev->format,
+						dst + frame_bytes * offset,
+						write_limit - offset);
+		for (i = 0; nwritten >= 0 && i < group->num_members; i++) {
+			group->members[i]->grouped = 1;
+			cras_iodev_stream_written(odev, group->members[i],
+						  nwritten);
+		}
+		group->num_members = 0;
+	}
+}
+
+/* Frees the stream groups of an output device. */
+static void free_stream_groups(struct open_dev *adev)
+{
+	struct dev_stream_group *group;
+
+	DL_FOREACH (adev->stream_groups, group) {
+		DL_DELETE(adev->stream_groups, group);
+		dev_stream_group_destroy(group);
+	}
+}
+
+/* Places the first frame of a scheduled stream on the timeline of the
+ * device. The frame written at the write point of the device plays once the
+ * delay of the device has played out, so the stream skips the device frames
+ * between then and the requested time. They are left to the other streams
+ * and silence. A stream that is already late plays right away. */
+static void place_scheduled_stream(struct cras_iodev *odev,
+				   struct dev_stream *dev_stream)
+{
+	const struct timespec *scheduled_ts = &dev_stream->stream->scheduled_ts;
+	struct timespec now, lead_ts;
+	double rate, lead;
+	int delay;
+
+	dev_stream->scheduled = 0;
+	delay = cras_iodev_delay_frames(odev);
+	if (delay < 0)
+		return;
+
+	cras_virtual_clock_gettime(&now);
+	if (!timespec_after(scheduled_ts, &now))
+		return;
+	subtract_timespecs(scheduled_ts, &now, &lead_ts);
+	rate = odev->format->frame_rate * cras_iodev_get_est_rate_ratio(odev);
+	lead = (lead_ts.tv_sec + lead_ts.tv_nsec / 1000000000.0) * rate;
+	lead -= delay + cras_iodev_stream_offset(odev, dev_stream);
+	if (lead > 0)
+		dev_stream->lead_frames = (unsigned int)(lead + 0.5);
+	ATLOG(atlog, AUDIO_THREAD_STREAM_SCHEDULED_START,
+	      dev_stream->stream->stream_id, delay, dev_stream->lead_frames);
+}
+
+/* Moves the streams still waiting for their scheduled first frame past the
+ * device frames mixed before it, up to write_limit. */
+static void skip_lead_frames(struct cras_iodev *odev, size_t write_limit)
+{
+	struct dev_stream *curr;
+	unsigned int offset, skip;
+
+	DL_FOREACH (odev->streams, curr) {
+		if (!dev_stream_is_running(curr) || !curr->lead_frames)
+			continue;
+		offset = cras_iodev_stream_offset(odev, curr);
+		if (offset >= write_limit)
+			continue;
+		skip = MIN(curr->lead_frames, write_limit - offset);
+		cras_iodev_stream_written(odev, curr, skip);
+		curr->lead_frames -= skip;
+	}
+}
+
 /* Fill the buffer with samples from the attached streams.
  * Args:
  *    odevs - The list of open output devices, provided so streams can be
@@ -609,11 +1218,17 @@ static int write_streams(struct open_dev **odevs, struct open_dev *adev,
 		if (dev_stream_attached_devs(curr) == 1)
 			dev_stream_update_frames(curr);
 
+		if (curr->scheduled)
+			place_scheduled_stream(odev, curr);
+
 		dev_frames = dev_stream_playback_frames(curr);
 		if (dev_frames < 0) {
 			dev_io_remove_stream(odevs, curr->stream, NULL);
 			continue;
 		}
+		/* The device frames before a scheduled first frame are as good
+		 * as written by the stream. */
+		dev_frames += curr->lead_frames;
 		ATLOG(atlog, AUDIO_THREAD_WRITE_STREAMS_STREAM,
 		      curr->stream->stream_id, dev_frames,
 		      dev_stream_is_pending_reply(curr));
@@ -633,31 +1248,15 @@ static int write_streams(struct open_dev **odevs, struct open_dev *adev,
 	if (write_limit > max_offset)
 		memset(dst + max_offset * frame_bytes, 0,
 		       (write_limit - max_offset) * frame_bytes);
+	skip_lead_frames(odev, write_limit);
 
 	ATLOG(atlog, AUDIO_THREAD_WRITE_STREAMS_MIX, write_limit, max_offset,
 	      0);
 
-	DL_FOREACH (adev->dev->streams, curr) {
-		unsigned int offset;
-		int nwritten;
-
-		if (!dev_stream_is_running(curr))
-			continue;
-
-		offset = cras_iodev_stream_offset(odev, curr);
-		if (offset >= write_limit)
-			continue;
-		nwritten = dev_stream_mix(curr, odev->format,
-					  dst + frame_bytes * offset,
-					  write_limit - offset);
-
-		if (nwritten < 0) {
-			dev_io_remove_stream(odevs, curr->stream, NULL);
-			continue;
-		}
-
-		cras_iodev_stream_written(odev, curr, nwritten);
-	}
+	write_streams_grouped(adev, dst, write_limit);
+	if (!mix_pool || num_playing < mix_pool_min_streams ||
+	    write_streams_parallel(odevs, adev, dst, write_limit) < 0)
+		write_streams_serial(odevs, adev, dst, write_limit);
 
 	write_limit = cras_iodev_all_streams_written(odev);
 
@@ -678,7 +1277,7 @@ void update_dev_wakeup_time(struct open_dev *adev, unsigned int *hw_level)
 	double est_rate;
 	unsigned int frames_to_play_in_sleep;
 
-	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	cras_virtual_clock_gettime(&now);
 
 	frames_to_play_in_sleep = cras_iodev_frames_to_play_in_sleep(
 		adev->dev, hw_level, &adev->wake_ts);
@@ -703,6 +1302,130 @@ void update_dev_wakeup_time(struct open_dev *adev, unsigned int *hw_level)
 	      adev->wake_ts.tv_sec, adev->wake_ts.tv_nsec);
 }
 
+/* Whether adev plays only DEEP_BUFFER streams and could be rewound, so its
+ * committed frames are worth keeping. */
+static bool deep_buffer_only(struct open_dev *adev)
+{
+	struct dev_stream *curr;
+	bool running = false;
+
+	if (!deep_buffer_enabled || !adev->dev->rewind)
+		return false;
+
+	DL_FOREACH (adev->dev->streams, curr) {
+		if (!dev_stream_is_running(curr))
+			continue;
+		if (!(curr->stream->flags & DEEP_BUFFER) ||
+		    (curr->stream->flags & EXCLUSIVE))
+			return false;
+		running = true;
+	}
+	return running;
+}
+
+/* Copies frames between dst and the deep history ring starting at idx,
+ * wrapping around the end of the ring. */
+static void deep_history_copy(struct open_dev *adev, uint8_t *dst,
+			      unsigned int idx, unsigned int frames,
+			      bool to_history)
+{
+	unsigned int frame_bytes = cras_get_format_bytes(adev->dev->format);
+
+	while (frames) {
+		unsigned int n = MIN(frames, adev->deep_history_frames - idx);
+		uint8_t *hist = adev->deep_history + idx * frame_bytes;
+
+		if (to_history)
+			memcpy(hist, dst, n * frame_bytes);
+		else
+			memcpy(dst, hist, n * frame_bytes);
+		dst += n * frame_bytes;
+		frames -= n;
+		idx = (idx + n) % adev->deep_history_frames;
+	}
+}
+
+/* Keeps the frames about to be committed while only DEEP_BUFFER streams
+ * play, and forgets them as soon as another stream does. */
+static void deep_history_record(struct open_dev *adev, uint8_t *dst,
+				unsigned int frames)
+{
+	struct cras_iodev *odev = adev->dev;
+
+	if (!deep_buffer_only(adev)) {
+		adev->deep_history_valid = 0;
+		return;
+	}
+
+	if (!adev->deep_history ||
+	    adev->deep_history_frames != odev->buffer_size) {
+		free(adev->deep_history);
+		adev->deep_history_frames = odev->buffer_size;
+		adev->deep_history =
+			malloc(odev->buffer_size *
+			       cras_get_format_bytes(odev->format));
+		adev->deep_history_end = 0;
+		adev->deep_history_valid = 0;
+		if (!adev->deep_history)
+			return;
+	}
+
+	/* Only the latest frames fit. */
+	if (frames > adev->deep_history_frames) {
+		dst += (frames - adev->deep_history_frames) *
+		       cras_get_format_bytes(odev->format);
+		frames = adev->deep_history_frames;
+	}
+	deep_history_copy(adev, dst, adev->deep_history_end, frames, true);
+	adev->deep_history_end =
+		(adev->deep_history_end + frames) % adev->deep_history_frames;
+	adev->deep_history_valid =
+		MIN(adev->deep_history_valid + frames,
+		    adev->deep_history_frames);
+}
+
+/* Takes back what the device has queued from DEEP_BUFFER streams beyond what
+ * stream needs to start without underrun, so stream is heard after that
+ * instead of after the whole deep buffer. The running streams skip ahead over
+ * the frames taken back, which are replayed from the history. */
+static void deep_buffer_rewind(struct open_dev *adev,
+			       const struct dev_stream *stream)
+{
+	struct cras_iodev *odev = adev->dev;
+	struct dev_stream *curr;
+	struct timespec hw_tstamp;
+	unsigned int keep, valid;
+	int hw_level;
+	int rc;
+
+	valid = adev->deep_history_valid;
+	if (!valid || (stream->stream->flags & DEEP_BUFFER))
+		return;
+
+	/* Whatever happens, what's held is stale once stream starts. */
+	adev->deep_history_valid = 0;
+	adev->deep_replay_frames = 0;
+
+	hw_level = cras_iodev_frames_queued(odev, &hw_tstamp);
+	keep = dev_stream_cb_threshold(stream);
+	if (hw_level <= (int)keep)
+		return;
+
+	rc = cras_iodev_rewind_output(
+		odev, MIN(hw_level - keep, valid));
+	if (rc <= 0)
+		return;
+
+	DL_FOREACH (odev->streams, curr) {
+		if (dev_stream_is_running(curr))
+			cras_iodev_stream_written(odev, curr, rc);
+	}
+	adev->deep_replay_frames = rc;
+	adev->deep_replay_idx =
+		(adev->deep_history_end + adev->deep_history_frames - rc) %
+		adev->deep_history_frames;
+}
+
 /* Returns 0 on success negative error on device failure. */
 int write_output_samples(struct open_dev **odevs, struct open_dev *adev,
 			 struct cras_fmt_conv *output_converter)
@@ -710,7 +1433,7 @@ int write_output_samples(struct open_dev **odevs, struct open_dev *adev,
 	struct cras_iodev *odev = adev->dev;
 	unsigned int hw_level;
 	struct timespec hw_tstamp;
-	unsigned int frames, fr_to_req;
+	unsigned int frames, fr_to_req, replay;
 	snd_pcm_sframes_t written;
 	snd_pcm_uframes_t total_written = 0;
 	int rc;
@@ -727,8 +1450,11 @@ int write_output_samples(struct open_dev **odevs, struct open_dev *adev,
 		return rc;
 	}
 
-	if (cras_iodev_state(odev) != CRAS_IODEV_STATE_NORMAL_RUN)
+	if (cras_iodev_state(odev) != CRAS_IODEV_STATE_NORMAL_RUN) {
+		adev->deep_history_valid = 0;
+		adev->deep_replay_frames = 0;
 		return 0;
+	}
 
 	rc = cras_iodev_frames_queued(odev, &hw_tstamp);
 	if (rc < 0)
@@ -751,6 +1477,13 @@ int write_output_samples(struct open_dev **odevs, struct open_dev *adev,
 	ATLOG(atlog, AUDIO_THREAD_FILL_AUDIO, adev->dev->info.idx, hw_level,
 	      odev->min_cb_level);
 
+	if (odev->streams) {
+		struct timespec now;
+
+		cras_virtual_clock_gettime(&now);
+		dev_io_update_health(adev, hw_level, &now);
+	}
+
 	/* Don't request more than hardware can hold. Note that min_buffer_level
 	 * has been subtracted from the actual hw_level so we need to take it
 	 * into account here. */
@@ -760,17 +1493,34 @@ int write_output_samples(struct open_dev **odevs, struct open_dev *adev,
 	 * only happens when the circular buffer is at the end and returns us a
 	 * partial area to write to from mmap_begin */
 	while (total_written < fr_to_req) {
+		uint64_t start;
+
 		frames = fr_to_req - total_written;
 		rc = cras_iodev_get_output_buffer(odev, &area, &frames);
 		if (rc < 0)
 			return rc;
+		/* The device may take less than it has room for, for example
+		 * to keep its queue short. */
+		if (frames == 0)
+			break;
 
 		/* TODO(dgreid) - This assumes interleaved audio. */
 		dst = area->channels[0].buf;
+
+		/* The running streams mix on top of what was rewound. */
+		replay = MIN(frames, adev->deep_replay_frames);
+		if (replay)
+			deep_history_copy(adev, dst, adev->deep_replay_idx,
+					  replay, false);
+
+		start = stage_clock_ns();
 		written = write_streams(odevs, adev, dst, frames);
+		add_stage_time(adev, CRAS_DEV_IO_STAGE_MIX, start);
 		if (written < 0) /* pcm has been closed */
 			return (int)written;
 
+		deep_history_record(adev, dst, written);
+
 		if (written < (snd_pcm_sframes_t)frames)
 			/* Got all the samples from client that we can, but it
 			 * won't fill the request. */
@@ -792,13 +1542,20 @@ int write_output_samples(struct open_dev **odevs, struct open_dev *adev,
 			pic_interval_reset(adev->non_empty_check_pi);
 		}
 
+		start = stage_clock_ns();
 		rc = cras_iodev_put_output_buffer(
 			odev, dst, written, non_empty_ptr, output_converter);
+		add_stage_time(adev, CRAS_DEV_IO_STAGE_WRITE, start);
 
 		if (rc < 0)
 			return rc;
 		total_written += written;
 
+		replay = MIN((unsigned int)written, adev->deep_replay_frames);
+		adev->deep_replay_frames -= replay;
+		adev->deep_replay_idx = (adev->deep_replay_idx + replay) %
+					MAX(adev->deep_history_frames, 1);
+
 		if (non_empty && adev->empty_pi) {
 			// We're not empty, but we were previously.
 			// Reset the empty period.
@@ -897,6 +1654,37 @@ static void dev_io_drop_samples(struct open_dev *idev_list)
 	return;
 }
 
+/*
+ * Starts or stops the catch up of all input devices. Once started, the streams
+ * keep consuming frames faster than the devices capture them until the device
+ * with the fewest excess frames is back to min_cb_level, so the devices stay
+ * aligned in time.
+ */
+static void update_capture_catch_up(struct open_dev *idev_list, bool start)
+{
+	struct open_dev *adev;
+	struct timespec backlog = {};
+	bool catch_up = start;
+
+	DL_FOREACH (idev_list, adev)
+		catch_up = catch_up || adev->capture_catch_up;
+	if (!catch_up)
+		return;
+
+	get_input_devices_drop_time(idev_list, &backlog);
+	catch_up = timespec_is_nonzero(&backlog);
+
+	DL_FOREACH (idev_list, adev) {
+		bool dev_catch_up =
+			catch_up && input_devices_can_drop_samples(adev->dev);
+
+		if (adev->capture_catch_up == dev_catch_up)
+			continue;
+		adev->capture_catch_up = dev_catch_up;
+		update_estimated_rate(adev);
+	}
+}
+
 /*
  * Public funcitons.
  */
@@ -905,32 +1693,60 @@ int dev_io_send_captured_samples(struct open_dev *idev_list)
 {
 	struct open_dev *adev;
 	bool need_to_drop = false;
+	bool need_to_catch_up = false;
 	int rc;
 
 	// TODO(dgreid) - once per rstream, not once per dev_stream.
 	DL_FOREACH (idev_list, adev) {
 		struct dev_stream *stream;
+		uint64_t start;
 
 		if (!cras_iodev_is_open(adev->dev))
 			continue;
 
 		/* Post samples to rstream if there are enough samples. */
+		start = stage_clock_ns();
 		DL_FOREACH (adev->dev->streams, stream) {
-			dev_stream_capture_update_rstream(stream);
+			if (!stream->paused)
+				dev_stream_capture_update_rstream(stream);
 		}
+		add_stage_time(adev, CRAS_DEV_IO_STAGE_SEND_CAPTURED, start);
 
 		/* Set wake_ts for this device. */
-		rc = set_input_dev_wake_ts(adev, &need_to_drop);
+		rc = set_input_dev_wake_ts(adev, &need_to_drop,
+					   &need_to_catch_up);
 		if (rc < 0)
 			return rc;
 	}
 
 	if (need_to_drop)
 		dev_io_drop_samples(idev_list);
+	update_capture_catch_up(idev_list, need_to_catch_up && !need_to_drop);
 
 	return 0;
 }
 
+/* Recovers a device from a severe underrun by preparing its hardware again
+ * in place, keeping it open with its streams. Returns false if it can't, or
+ * if it already did so recently, and has to be reset by the main thread. */
+static bool recover_dev_in_place(struct open_dev *adev)
+{
+	struct timespec now, since;
+
+	cras_virtual_clock_gettime(&now);
+	if (adev->last_recovery_ts.tv_sec || adev->last_recovery_ts.tv_nsec) {
+		subtract_timespecs(&now, &adev->last_recovery_ts, &since);
+		if (timespec_after(&in_place_recovery_interval, &since))
+			return false;
+	}
+	if (cras_iodev_resume(adev->dev))
+		return false;
+
+	adev->last_recovery_ts = now;
+	adev->wake_ts = now;
+	return true;
+}
+
 static void handle_dev_err(int err_rc, struct open_dev **odevs,
 			   struct open_dev *adev)
 {
@@ -938,8 +1754,10 @@ static void handle_dev_err(int err_rc, struct open_dev **odevs,
 		/* Handle severe underrun. */
 		ATLOG(atlog, AUDIO_THREAD_SEVERE_UNDERRUN, adev->dev->info.idx,
 		      0, 0);
-		cras_iodev_reset_request(adev->dev);
 		cras_audio_thread_event_severe_underrun();
+		if (recover_dev_in_place(adev))
+			return;
+		cras_iodev_reset_request(adev->dev);
 	}
 	/* Device error, remove it. */
 	dev_io_rm_open_dev(odevs, adev);
@@ -962,22 +1780,69 @@ int dev_io_capture(struct open_dev **list)
 	return 0;
 }
 
+/* Holds back a stream with a scheduled start until its first frame is two
+ * callback periods from playing, so the client has time to reply before the
+ * frame is due. Until then the next callback of the stream is moved to that
+ * moment, as far as the current delay of the device tells. */
+static bool scheduled_start_due(struct cras_iodev *odev,
+				struct dev_stream *dev_stream,
+				const struct timespec *now)
+{
+	struct cras_rstream *stream = dev_stream->stream;
+	struct timespec start_ts, delay_ts, due_ts;
+	int delay, i;
+
+	if (!dev_stream->scheduled)
+		return true;
+	delay = cras_iodev_delay_frames(odev);
+	if (delay < 0)
+		return true;
+
+	cras_frames_to_time(delay, odev->format->frame_rate, &delay_ts);
+	start_ts = stream->scheduled_ts;
+	if (!timespec_after(&start_ts, &delay_ts))
+		return true;
+	subtract_timespecs(&start_ts, &delay_ts, &start_ts);
+	for (i = 0; i < 2; i++) {
+		if (!timespec_after(&start_ts, &stream->sleep_interval_ts))
+			return true;
+		subtract_timespecs(&start_ts, &stream->sleep_interval_ts,
+				   &start_ts);
+	}
+
+	/* Starting is as early as fetching may be, see is_fetch_due. */
+	due_ts = *now;
+	add_timespecs(&due_ts, &playback_wake_fuzz_ts);
+	add_timespecs(&due_ts, &stream->fetch_lead);
+	if (!timespec_after(&start_ts, &due_ts))
+		return true;
+
+	cras_wake_heap_set_next_cb_ts(stream, &start_ts);
+	return false;
+}
+
 /* If it is the time to fetch, start dev_stream. */
-static void dev_io_check_dev_stream_start(struct open_dev *adev)
+static void dev_io_check_dev_stream_start(struct open_dev *adev,
+					  const struct timespec *now)
 {
 	struct dev_stream *dev_stream;
-	struct timespec now;
-	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 
 	DL_FOREACH (adev->dev->streams, dev_stream) {
-		if (!is_time_to_fetch(dev_stream, now))
+		if (!is_time_to_fetch(dev_stream, *now))
 			continue;
-		if (!dev_stream_is_running(dev_stream))
-			cras_iodev_start_stream(adev->dev, dev_stream);
+		if (dev_stream_is_running(dev_stream) || dev_stream->paused)
+			continue;
+		if (!scheduled_start_due(adev->dev, dev_stream, now))
+			continue;
+		deep_buffer_rewind(adev, dev_stream);
+		cras_iodev_start_stream(adev->dev, dev_stream);
 	}
 }
 
-void dev_io_playback_fetch(struct open_dev *odev_list)
+/* Fetches the streams of all output devices against the time of the wake,
+ * the clock is read once for the whole fetch. */
+static void playback_fetch(struct open_dev *odev_list,
+			   const struct timespec *now)
 {
 	struct open_dev *adev;
 
@@ -985,16 +1850,28 @@ void dev_io_playback_fetch(struct open_dev *odev_list)
 	DL_FOREACH (odev_list, adev) {
 		if (!cras_iodev_is_open(adev->dev))
 			continue;
-		dev_io_check_dev_stream_start(adev);
+		dev_io_check_dev_stream_start(adev, now);
 	}
 
 	DL_FOREACH (odev_list, adev) {
+		uint64_t start;
+
 		if (!cras_iodev_is_open(adev->dev))
 			continue;
-		fetch_streams(adev);
+		start = stage_clock_ns();
+		fetch_streams(adev, now);
+		add_stage_time(adev, CRAS_DEV_IO_STAGE_FETCH, start);
 	}
 }
 
+void dev_io_playback_fetch(struct open_dev *odev_list)
+{
+	struct timespec now;
+
+	cras_virtual_clock_gettime(&now);
+	playback_fetch(odev_list, &now);
+}
+
 int dev_io_playback_write(struct open_dev **odevs,
 			  struct cras_fmt_conv *output_converter)
 {
@@ -1094,20 +1971,222 @@ static void update_longest_wake(struct open_dev *dev_list,
 	}
 }
 
+/* Records how late each device with streams was serviced, if it was due. */
+static void update_lateness(struct open_dev *dev_list,
+			    const struct timespec *ts)
+{
+	struct open_dev *adev;
+	struct timespec late;
+
+	DL_FOREACH (dev_list, adev) {
+		if (adev->dev->streams == NULL ||
+		    !timespec_is_nonzero(&adev->wake_ts) ||
+		    timespec_after(&adev->wake_ts, ts))
+			continue;
+		subtract_timespecs(ts, &adev->wake_ts, &late);
+		adev->late_us = MIN(late.tv_sec * 1000000ULL +
+					    late.tv_nsec / 1000,
+				    UINT32_MAX);
+		if (adev->late_us > adev->max_late_us)
+			adev->max_late_us = adev->late_us;
+	}
+}
+
+/* Moves avg toward sample, weighing the sample by 1 / 2^HEALTH_EWMA_SHIFT. */
+static inline int64_t health_ewma(int64_t avg, int64_t sample)
+{
+	return avg + (sample - avg) / (1 << HEALTH_EWMA_SHIFT);
+}
+
+static inline unsigned int health_us_to_frames(uint32_t us, unsigned int rate)
+{
+	return (uint64_t)us * rate / 1000000;
+}
+
+/*
+ * Moves the min_buffer_level of an output device toward level, within the
+ * bounds of its active node. Nodes without bounds only allow raising the level
+ * by the board's adaptive_buffer_max_ms.
+ */
+static void set_buffer_level(struct open_dev *adev, unsigned int level)
+{
+	struct cras_iodev *odev = adev->dev;
+	const struct cras_ionode *node = odev->active_node;
+	unsigned int base = odev->min_buffer_level - adev->health.adjust_frames;
+	unsigned int low, high;
+
+	if (node && node->adaptive_max_buffer_level) {
+		low = node->adaptive_min_buffer_level;
+		high = node->adaptive_max_buffer_level;
+	} else {
+		low = base;
+		high = base + (uint64_t)adaptive_buffer_max_ms *
+				      odev->format->frame_rate / 1000;
+	}
+	/* Keep room to write at least half a buffer each wake. */
+	high = MIN(high, odev->buffer_size / 2);
+	level = MIN(MAX(level, low), high);
+	if (level == odev->min_buffer_level)
+		return;
+
+	ATLOG(atlog, AUDIO_THREAD_BUFFER_LEVEL_ADJUST, odev->info.idx,
+	      odev->min_buffer_level, level);
+	adev->health.adjust_frames += (int)level - (int)odev->min_buffer_level;
+	odev->min_buffer_level = level;
+}
+
+void dev_io_update_health(struct open_dev *adev, unsigned int hw_level,
+			  const struct timespec *now)
+{
+	struct dev_io_health *health = &adev->health;
+	struct cras_iodev *odev = adev->dev;
+	unsigned int rate = odev->format->frame_rate;
+	unsigned int num_underruns;
+	struct timespec late;
+	int64_t late_us, dev;
+	uint32_t budget_us, shortfall_us, excess_us;
+	unsigned int frames;
+
+	/* Frames below min_buffer_level are still left to play. */
+	health->margin_us = (uint64_t)(hw_level + odev->min_buffer_level) *
+			    1000000 / rate;
+	if (!health->num_wakes || health->margin_us < health->min_margin_us)
+		health->min_margin_us = health->margin_us;
+
+	late_us = 0;
+	if (timespec_after(now, &adev->wake_ts)) {
+		subtract_timespecs(now, &adev->wake_ts, &late);
+		late_us = late.tv_sec * 1000000LL + late.tv_nsec / 1000;
+	}
+	dev = late_us - health->lateness_us;
+	health->lateness_us = health_ewma(health->lateness_us, late_us);
+	health->lateness_var = health_ewma(health->lateness_var, dev * dev);
+	if (++health->num_wakes < HEALTH_MIN_WAKES)
+		return;
+
+	budget_us = health->lateness_us + health->cpu_us +
+		    HEALTH_LATENESS_STDDEVS * sqrt(health->lateness_var);
+
+	/* The budget wasn't enough, make room for another one. */
+	num_underruns = cras_iodev_get_num_underruns(odev);
+	if (num_underruns != health->num_underruns) {
+		health->num_underruns = num_underruns;
+		health->safe_wakes = 0;
+		frames = health_us_to_frames(budget_us, rate);
+		set_buffer_level(adev, odev->min_buffer_level + frames);
+	}
+
+	if (health->at_risk) {
+		/* Leave some hysteresis before clearing the risk. */
+		if (health->margin_us > budget_us + budget_us / 2)
+			health->at_risk = false;
+		return;
+	}
+
+	if (health->margin_us >= budget_us) {
+		if (health->margin_us <= 2 * budget_us) {
+			health->safe_wakes = 0;
+			return;
+		}
+		if (++health->safe_wakes < HEALTH_LOWER_WAKES)
+			return;
+		health->safe_wakes = 0;
+		excess_us = (health->margin_us - 2 * budget_us) / 4;
+		frames = MIN(health_us_to_frames(excess_us, rate) + 1,
+			     odev->min_buffer_level);
+		set_buffer_level(adev, odev->min_buffer_level - frames);
+		return;
+	}
+
+	health->at_risk = true;
+	health->num_risks++;
+	health->safe_wakes = 0;
+	ATLOG(atlog, AUDIO_THREAD_UNDERRUN_RISK, odev->info.idx,
+	      health->margin_us, budget_us);
+	cras_audio_thread_event_underrun_risk();
+
+	shortfall_us = budget_us - health->margin_us;
+	frames = health_us_to_frames(shortfall_us, rate) + 1;
+	set_buffer_level(adev, odev->min_buffer_level + frames);
+}
+
+/* Adds the time each device spent in each stage of this wake to its stats. */
+static void update_stage_stats(struct open_dev *dev_list)
+{
+	struct open_dev *adev;
+	struct audio_stage_debug_info *info;
+	uint32_t usec, wake_usec;
+	unsigned int stage, bin;
+
+	DL_FOREACH (dev_list, adev) {
+		wake_usec = 0;
+		for (stage = 0; stage < CRAS_NUM_DEV_IO_STAGES; stage++) {
+			if (!adev->stage_ns[stage])
+				continue;
+			usec = adev->stage_ns[stage] / 1000;
+			wake_usec += usec;
+			adev->stage_ns[stage] = 0;
+
+			for (bin = 0; bin < CRAS_DEV_IO_STAGE_HIST_BINS - 1;
+			     bin++)
+				if (usec < (32U << bin))
+					break;
+
+			info = &adev->stages[stage];
+			info->count++;
+			info->total_usec += usec;
+			info->hist[bin]++;
+			if (usec > info->max_usec) {
+				info->max_usec = usec;
+				ATLOG(atlog, AUDIO_THREAD_DEV_IO_STAGE_MAX,
+				      adev->dev->info.idx, stage, usec);
+			}
+		}
+		if (wake_usec)
+			adev->health.cpu_us =
+				health_ewma(adev->health.cpu_us, wake_usec);
+	}
+}
+
+/* Shares the level and delay read from each device between the stages of
+ * this wake, until dev_io_end_wake(). */
+static void begin_wake(struct open_dev *dev_list)
+{
+	struct open_dev *adev;
+
+	DL_FOREACH (dev_list, adev)
+		cras_iodev_begin_wake(adev->dev);
+}
+
+void dev_io_end_wake(struct open_dev *dev_list)
+{
+	struct open_dev *adev;
+
+	DL_FOREACH (dev_list, adev)
+		cras_iodev_end_wake(adev->dev);
+}
+
 void dev_io_run(struct open_dev **odevs, struct open_dev **idevs,
 		struct cras_fmt_conv *output_converter)
 {
 	struct timespec now;
 
-	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	begin_wake(*odevs);
+	begin_wake(*idevs);
+	cras_virtual_clock_gettime(&now);
 	pic_update_current_time();
 	update_longest_wake(*odevs, &now);
 	update_longest_wake(*idevs, &now);
+	update_lateness(*odevs, &now);
+	update_lateness(*idevs, &now);
 
-	dev_io_playback_fetch(*odevs);
+	playback_fetch(*odevs, &now);
 	dev_io_capture(idevs);
 	dev_io_send_captured_samples(*idevs);
 	dev_io_playback_write(odevs, output_converter);
+
+	update_stage_stats(*odevs);
+	update_stage_stats(*idevs);
 }
 
 static int input_adev_ignore_wake(const struct open_dev *adev)
@@ -1128,60 +2207,83 @@ static int input_adev_ignore_wake(const struct open_dev *adev)
 int dev_io_next_input_wake(struct open_dev **idevs, struct timespec *min_ts)
 {
 	struct open_dev *adev;
+	struct timespec latest = *min_ts;
+	struct timespec wake = *min_ts;
 	int ret = 0; /* The total number of devices to wait on. */
 
+	/* No device can be put off past its latest wake, nor the output. */
 	DL_FOREACH (*idevs, adev) {
 		if (input_adev_ignore_wake(adev))
 			continue;
 		ret++;
 		ATLOG(atlog, AUDIO_THREAD_DEV_SLEEP_TIME, adev->dev->info.idx,
 		      adev->wake_ts.tv_sec, adev->wake_ts.tv_nsec);
-		if (timespec_after(min_ts, &adev->wake_ts))
-			*min_ts = adev->wake_ts;
+		if (timespec_after(&latest, &adev->wake_latest_ts))
+			latest = adev->wake_latest_ts;
 	}
+	if (!ret)
+		return 0;
+
+	/* Wake when the last device due by then is, so that every device due
+	 * before is serviced by the same wake. The device which set latest is
+	 * due no later than that, so there is always one. */
+	if (timespec_after(&wake, &latest))
+		wake.tv_sec = wake.tv_nsec = 0;
+	DL_FOREACH (*idevs, adev) {
+		if (input_adev_ignore_wake(adev))
+			continue;
+		if (timespec_after(&adev->wake_ts, &wake) &&
+		    !timespec_after(&adev->wake_ts, &latest))
+			wake = adev->wake_ts;
+	}
+	*min_ts = wake;
 
 	return ret;
 }
 
-/* Fills the time that the next stream needs to be serviced. */
-static int get_next_stream_wake_from_list(struct dev_stream *streams,
+/* Fills the time that the next stream in the wake heap under index i needs
+ * to be serviced, if earlier than min_ts. The heap orders streams on the
+ * earliest time they may be fetched, so a subtree that starts no earlier
+ * than min_ts is skipped whole. It counts as one stream to wait on, it may
+ * hold streams to service later. */
+static int get_next_stream_wake_from_heap(unsigned int i,
 					  struct timespec *min_ts)
 {
-	struct dev_stream *dev_stream;
+	struct cras_rstream *stream = cras_wake_heap_at(i);
+	struct timespec fetch_ts;
 	int ret = 0; /* The total number of streams to wait on. */
 
-	DL_FOREACH (streams, dev_stream) {
-		const struct timespec *next_cb_ts;
-
-		if (cras_rstream_get_is_draining(dev_stream->stream))
-			continue;
-
-		if (cras_rstream_is_pending_reply(dev_stream->stream))
-			continue;
+	if (!stream)
+		return 0;
 
-		next_cb_ts = dev_stream_next_cb_ts(dev_stream);
-		if (!next_cb_ts)
-			continue;
+	cras_wake_heap_key(stream, &fetch_ts);
+	if (!timespec_after(min_ts, &fetch_ts))
+		return 1;
 
-		ATLOG(atlog, AUDIO_THREAD_STREAM_SLEEP_TIME,
-		      dev_stream->stream->stream_id, next_cb_ts->tv_sec,
-		      next_cb_ts->tv_nsec);
-		if (timespec_after(min_ts, next_cb_ts))
-			*min_ts = *next_cb_ts;
+	if (!cras_rstream_get_is_draining(stream) &&
+	    !cras_rstream_is_pending_reply(stream)) {
+		ATLOG(atlog, AUDIO_THREAD_STREAM_SLEEP_TIME, stream->stream_id,
+		      stream->next_cb_ts.tv_sec, stream->next_cb_ts.tv_nsec);
+		/* Wake for an early fetch only if the client has room to
+		 * write, the fetch would be put off otherwise. */
+		if (!cras_shm_is_buffer_available(stream->shm))
+			fetch_ts = stream->next_cb_ts;
+		if (timespec_after(min_ts, &fetch_ts))
+			*min_ts = fetch_ts;
 		ret++;
 	}
 
+	ret += get_next_stream_wake_from_heap(2 * i + 1, min_ts);
+	ret += get_next_stream_wake_from_heap(2 * i + 2, min_ts);
 	return ret;
 }
 
 int dev_io_next_output_wake(struct open_dev **odevs, struct timespec *min_ts)
 {
 	struct open_dev *adev;
-	int ret = 0;
+	int ret;
 
-	DL_FOREACH (*odevs, adev)
-		ret += get_next_stream_wake_from_list(adev->dev->streams,
-						      min_ts);
+	ret = get_next_stream_wake_from_heap(0, min_ts);
 
 	DL_FOREACH (*odevs, adev) {
 		if (!cras_iodev_odev_should_wake(adev->dev))
@@ -1195,6 +2297,21 @@ int dev_io_next_output_wake(struct open_dev **odevs, struct timespec *min_ts)
 	return ret;
 }
 
+int dev_io_has_pending_reply(struct open_dev *adevs)
+{
+	struct open_dev *adev;
+	struct cras_iodev_stream_ref *ref;
+	int i;
+
+	DL_FOREACH (adevs, adev) {
+		ARRAY_ELEMENT_FOREACH (&adev->dev->stream_refs, i, ref) {
+			if (dev_stream_is_pending_reply(ref->dev_stream))
+				return 1;
+		}
+	}
+	return 0;
+}
+
 struct open_dev *dev_io_find_open_dev(struct open_dev *odev_list,
 				      unsigned int dev_idx)
 {
@@ -1219,6 +2336,7 @@ void dev_io_rm_open_dev(struct open_dev **odev_list, struct open_dev *dev_to_rm)
 		return;
 
 	DL_DELETE(*odev_list, dev_to_rm);
+	cras_iodev_end_wake(dev_to_rm->dev);
 
 	/* Metrics logs the number of underruns of this device. */
 	cras_server_metrics_num_underruns(
@@ -1242,10 +2360,18 @@ void dev_io_rm_open_dev(struct open_dev **odev_list, struct open_dev *dev_to_rm)
 		dev_stream_destroy(dev_stream);
 	}
 
+	/* Restore the buffer level the device was opened with. */
+	if ((int)dev_to_rm->dev->min_buffer_level >=
+	    dev_to_rm->health.adjust_frames)
+		dev_to_rm->dev->min_buffer_level -=
+			dev_to_rm->health.adjust_frames;
+
 	if (dev_to_rm->empty_pi)
 		pic_polled_interval_destroy(&dev_to_rm->empty_pi);
 	if (dev_to_rm->non_empty_check_pi)
 		pic_polled_interval_destroy(&dev_to_rm->non_empty_check_pi);
+	free_stream_groups(dev_to_rm);
+	free(dev_to_rm->deep_history);
 	free(dev_to_rm);
 }
 
@@ -1259,6 +2385,60 @@ static void delete_stream_from_dev(struct cras_iodev *dev,
 		dev_stream_destroy(out);
 }
 
+/* Starts a new input stream with the frames its device captured before it
+ * was attached, up to the pre-roll it asked for. The history ends where the
+ * stream starts reading the device buffer, so no frame is repeated. Streams
+ * with APMs start without it, the APM would see the frames out of order. */
+static void capture_pre_roll(struct cras_iodev *dev, struct dev_stream *out)
+{
+	struct cras_rstream *stream = out->stream;
+	struct cras_audio_area *area;
+	const uint8_t *src;
+	uint64_t start, pos, end;
+	unsigned int frames, behind, n, nread;
+	float gain;
+
+	if (!stream->pre_roll_frames || !dev->pre_roll || stream->apm_list)
+		return;
+
+	/* Frames read past the offset of the stream are in the history and
+	 * still in the device buffer. */
+	behind = dev->input_dsp_offset -
+		 MIN(cras_iodev_stream_offset(dev, out), dev->input_dsp_offset);
+	end = cras_ref_ring_write_pos(dev->pre_roll);
+	end -= MIN(behind, end);
+	frames = cras_frames_at_rate(stream->format.frame_rate,
+				     stream->pre_roll_frames,
+				     dev->format->frame_rate);
+	pos = end - MIN(frames, end);
+	cras_ref_ring_readable(dev->pre_roll, &pos);
+	start = pos;
+
+	area = cras_audio_area_create(dev->format->num_channels);
+	if (!area)
+		return;
+	cras_audio_area_config_channels(area, dev->format);
+	gain = cras_iodev_get_ui_gain_scaler(dev) *
+	       input_data_get_software_gain_scaler(
+		       dev->input_data, dev->software_gain_scaler, stream);
+
+	while (pos < end) {
+		n = end - pos;
+		src = cras_ref_ring_read_pointer(dev->pre_roll, pos, &n);
+		cras_audio_area_config_buf_pointers(area, dev->format,
+						    (uint8_t *)src);
+		area->frames = n;
+		nread = dev_stream_capture(out, area, 0, gain);
+		pos += nread;
+		if (nread < n)
+			break;
+	}
+	cras_audio_area_destroy(area);
+
+	ATLOG(atlog, AUDIO_THREAD_STREAM_PRE_ROLL, stream->stream_id,
+	      dev->info.idx, pos - start);
+}
+
 int dev_io_append_stream(struct open_dev **dev_list,
 			 struct cras_rstream *stream,
 			 struct cras_iodev **iodevs, unsigned int num_iodevs)
@@ -1298,10 +2478,13 @@ int dev_io_append_stream(struct open_dev **dev_list,
 		/*
 		 * When the first input stream is added, flush the input buffer
 		 * so that we can read from multiple input devices of the same
-		 * buffer level.
+		 * buffer level. A stream starting from the pre-roll history
+		 * keeps the frames that follow it.
 		 */
-		if ((stream->direction == CRAS_STREAM_INPUT) && !dev->streams) {
+		if ((stream->direction == CRAS_STREAM_INPUT) && !dev->streams &&
+		    !(stream->pre_roll_frames && dev->pre_roll)) {
 			int num_flushed = dev->flush_buffer(dev);
+			cras_iodev_invalidate_wake_levels(dev);
 			if (num_flushed < 0) {
 				rc = num_flushed;
 				break;
@@ -1371,7 +2554,19 @@ int dev_io_append_stream(struct open_dev **dev_list,
 			break;
 		}
 
+		set_node_channel_matrix(dev, out->conv);
+
+		/* Only fade in a stream joining others that already play,
+		 * the device ramps up by itself for the first one. */
+		if (stream->direction == CRAS_STREAM_OUTPUT && stream_ramp_ms)
+			dev_stream_set_ramp(
+				out,
+				stream_ramp_ms * dev->format->frame_rate / 1000,
+				dev->streams != NULL);
+
 		cras_iodev_add_stream(dev, out);
+		if (stream->direction == CRAS_STREAM_OUTPUT)
+			reserve_parallel_mix(dev, out);
 
 		/*
 		 * For multiple inputs case, if the new stream is not the first
@@ -1395,6 +2590,8 @@ int dev_io_append_stream(struct open_dev **dev_list,
 			cras_rstream_dev_offset_update(stream, offset,
 						       dev->info.idx);
 		}
+		if (stream->direction == CRAS_STREAM_INPUT)
+			capture_pre_roll(dev, out);
 		ATLOG(atlog, AUDIO_THREAD_STREAM_ADDED, stream->stream_id,
 		      dev->info.idx, 0);
 	}
@@ -1414,6 +2611,90 @@ int dev_io_append_stream(struct open_dev **dev_list,
 	return rc;
 }
 
+int dev_io_set_stream_paused(struct open_dev *dev_list,
+			     struct cras_rstream *stream,
+			     unsigned int fade_in_ms)
+{
+	struct open_dev *open_dev;
+	struct cras_iodev *dev;
+	struct dev_stream *out;
+	struct timespec next_cb_ts;
+	int found = 0;
+
+	DL_FOREACH (dev_list, open_dev) {
+		dev = open_dev->dev;
+		DL_SEARCH_SCALAR(dev->streams, out, stream, stream);
+		if (!out)
+			continue;
+		found = 1;
+		if (out->paused == stream->paused)
+			continue;
+
+		dev_stream_set_paused(out, stream->paused);
+		if (out->paused) {
+			cras_iodev_stop_stream(dev, out);
+			ATLOG(atlog, AUDIO_THREAD_STREAM_PAUSED,
+			      stream->stream_id, dev->info.idx, 1);
+			continue;
+		}
+
+		/* An output stream starts over at the next wake, as if it was
+		 * just added. An input stream reads from the frames the device
+		 * captures next, it is posted once it has a block of them. */
+		if (stream->direction == CRAS_STREAM_OUTPUT) {
+			cras_virtual_clock_gettime(&next_cb_ts);
+			cras_wake_heap_set_next_cb_ts(stream, &next_cb_ts);
+			if (fade_in_ms)
+				dev_stream_fade_in(
+					out, (uint64_t)fade_in_ms *
+						     dev->format->frame_rate /
+						     1000);
+		} else {
+			next_cb_ts.tv_sec = 0;
+			next_cb_ts.tv_nsec = 0;
+			cras_wake_heap_set_next_cb_ts(stream, &next_cb_ts);
+			cras_iodev_start_stream(dev, out);
+		}
+		ATLOG(atlog, AUDIO_THREAD_STREAM_PAUSED, stream->stream_id,
+		      dev->info.idx, 0);
+	}
+	return found;
+}
+
+void dev_io_set_mix_pool(struct cras_mix_pool *pool, unsigned int min_streams)
+{
+	mix_pool = pool;
+	mix_pool_min_streams = min_streams;
+	if (!pool) {
+		free(mix_jobs);
+		free(mix_srcs);
+		mix_jobs = NULL;
+		mix_srcs = NULL;
+		mix_jobs_size = 0;
+	}
+}
+
+void dev_io_set_input_wake_slack(unsigned int slack_us)
+{
+	input_wake_slack.tv_sec = slack_us / 1000000;
+	input_wake_slack.tv_nsec = (slack_us % 1000000) * 1000;
+}
+
+void dev_io_set_adaptive_buffer_max_ms(unsigned int max_ms)
+{
+	adaptive_buffer_max_ms = max_ms;
+}
+
+void dev_io_set_stream_ramp_ms(unsigned int ramp_ms)
+{
+	stream_ramp_ms = ramp_ms;
+}
+
+void dev_io_set_deep_buffer(int enabled)
+{
+	deep_buffer_enabled = enabled;
+}
+
 int dev_io_remove_stream(struct open_dev **dev_list,
 			 struct cras_rstream *stream, struct cras_iodev *dev)
 {
@@ -13,6 +13,39 @@
 #include "cras_types.h"
 #include "polled_interval_checker.h"
 
+struct cras_mix_pool;
+struct dev_stream_group;
+
+/*
+ * Rolling health of an output device, used to predict underruns.
+ *    lateness_us - Average of how late the wakes are, in microseconds.
+ *    lateness_var - Average squared deviation of the wake lateness.
+ *    cpu_us - Average time spent servicing the device in a wake.
+ *    margin_us - Time left in the hardware buffer at the last wake.
+ *    min_margin_us - The lowest margin_us since the device was opened.
+ *    num_wakes - Number of wakes that updated the averages.
+ *    at_risk - Set while the margin doesn't cover the expected lateness
+ *        and servicing time.
+ *    num_risks - Number of times the device became at risk.
+ *    safe_wakes - Number of consecutive wakes with plenty of margin.
+ *    num_underruns - Underruns of the device seen by the last wake.
+ *    adjust_frames - Frames added to (or, if negative, removed from) the
+ *        device's min_buffer_level while it was open.
+ */
+struct dev_io_health {
+	uint32_t lateness_us;
+	uint64_t lateness_var;
+	uint32_t cpu_us;
+	uint32_t margin_us;
+	uint32_t min_margin_us;
+	uint32_t num_wakes;
+	bool at_risk;
+	uint32_t num_risks;
+	uint32_t safe_wakes;
+	unsigned int num_underruns;
+	int adjust_frames;
+};
+
 /*
  * Open input/output devices.
  *    dev - The device.
@@ -21,18 +54,57 @@
  *    longest_wake - The longest time between consecutive audio thread wakes
  *        in this open_dev's life cycle.
  *    wake_ts - When callback is needed to avoid xrun.
+ *    wake_latest_ts - For input, how late the callback can be put off to
+ *        share a wake with other devices. The streams are delayed by at
+ *        most the wake slack and the hardware buffer stays below half full.
  *    last_non_empty_ts - The last time we know the device played/captured
  *        non-empty (zero) audio.
  *    coarse_rate_adjust - Hack for when the sample rate needs heavy correction.
+ *    capture_catch_up - For input, set while the streams consume frames
+ *        slightly faster than the device captures them, to drain a backlog
+ *        without dropping samples.
+ *    stage_ns - The time spent in each CRAS_DEV_IO_STAGE in the current wake.
+ *    stages - The time spent in each CRAS_DEV_IO_STAGE, over all the wakes.
+ *    health - For output, the rolling health of the device.
+ *    late_us - How late the device was serviced in the last wake it was due,
+ *        in microseconds.
+ *    max_late_us - The largest late_us since the device was opened.
+ *    deep_history - For output, the frames last committed while only
+ *        DEEP_BUFFER streams played, as mixed before the DSP. Lets the device
+ *        be rewound and the frames played again once another stream starts.
+ *    deep_history_frames - The size of deep_history in frames.
+ *    deep_history_end - Where the next frame goes in deep_history.
+ *    deep_history_valid - How many frames before deep_history_end are held.
+ *    deep_replay_idx - Where in deep_history the next frame to replay is.
+ *    deep_replay_frames - How many frames are left to replay after a rewind.
+ *    last_recovery_ts - When the device last recovered in place from a
+ *        severe underrun, zero if it never did.
+ *    stream_groups - For output, the groups of streams that share a
+ *        converter.
  */
 struct open_dev {
 	struct cras_iodev *dev;
 	struct timespec last_wake;
 	struct timespec longest_wake;
 	struct timespec wake_ts;
+	struct timespec wake_latest_ts;
 	struct polled_interval *non_empty_check_pi;
 	struct polled_interval *empty_pi;
 	int coarse_rate_adjust;
+	bool capture_catch_up;
+	uint64_t stage_ns[CRAS_NUM_DEV_IO_STAGES];
+	struct audio_stage_debug_info stages[CRAS_NUM_DEV_IO_STAGES];
+	struct dev_io_health health;
+	uint32_t late_us;
+	uint32_t max_late_us;
+	uint8_t *deep_history;
+	unsigned int deep_history_frames;
+	unsigned int deep_history_end;
+	unsigned int deep_history_valid;
+	unsigned int deep_replay_idx;
+	unsigned int deep_replay_frames;
+	struct timespec last_recovery_ts;
+	struct dev_stream_group *stream_groups;
 	struct open_dev *prev, *next;
 };
 
@@ -54,6 +126,22 @@ int dev_io_playback_write(struct open_dev **odevs,
 int write_output_samples(struct open_dev **odevs, struct open_dev *adev,
 			 struct cras_fmt_conv *output_converter);
 
+/*
+ * Updates the health of an output device with the current wake. The device
+ * is at risk of underrun when the time left in its buffer doesn't cover how
+ * late the wakes may be and how long servicing it takes. Entering that state
+ * is reported to the audio thread monitor.
+ * The health also drives the device's min_buffer_level, within the bounds of
+ * its active node or the board: it is raised by the missing time when at
+ * risk and by a whole budget after an underrun, and slowly lowered while the
+ * margin stays well above the budget. Only public for testing.
+ *    adev - The open output device.
+ *    hw_level - Frames queued above min_buffer_level.
+ *    now - The current time.
+ */
+void dev_io_update_health(struct open_dev *adev, unsigned int hw_level,
+			  const struct timespec *now);
+
 /*
  * Captures samples from each device in the list.
  *    list - Pointer to the list of input devices.  Devices that fail to read
@@ -66,10 +154,16 @@ int dev_io_capture(struct open_dev **list);
  */
 int dev_io_send_captured_samples(struct open_dev *idev_list);
 
-/* Reads and/or writes audio samples from/to the devices. */
+/* Reads and/or writes audio samples from/to the devices. The level and delay
+ * of each device are read once and shared by the stages of the wake, up to
+ * the next wake time, until dev_io_end_wake() is called. */
 void dev_io_run(struct open_dev **odevs, struct open_dev **idevs,
 		struct cras_fmt_conv *output_converter);
 
+/* Ends the wake dev_io_run() started for the devices in dev_list, queries of
+ * their level and delay go to the devices again. */
+void dev_io_end_wake(struct open_dev *dev_list);
+
 /*
  * Checks the non-empty device state in active output lists and return
  * if there's at least one non-empty device.
@@ -78,16 +172,27 @@ int dev_io_check_non_empty_state_transition(struct open_dev *adevs);
 
 /*
  * Fills min_ts with the next time the system should wake to service input.
+ * Call it after min_ts holds the next output wake. Input wakes are moved to
+ * the latest time any device or the output is due, as long as none is put
+ * off past its wake_latest_ts, so one wake services all of them.
  * Returns the number of devices waiting.
  */
 int dev_io_next_input_wake(struct open_dev **idevs, struct timespec *min_ts);
 
 /*
- * Fills min_ts with the next time the system should wake to service output.
+ * Fills min_ts with the next time the system should wake to service output,
+ * for the devices in odevs and the streams in the wake heap of the calling
+ * thread, see cras_wake_heap.h.
  * Returns the number of devices waiting.
  */
 int dev_io_next_output_wake(struct open_dev **odevs, struct timespec *min_ts);
 
+/*
+ * Returns non-zero if a stream on any device in the list still waits for its
+ * client to reply to the last audio request.
+ */
+int dev_io_has_pending_reply(struct open_dev *adevs);
+
 /*
  * Removes a device from a list of devices.
  *    odev_list - A pointer to the list to modify.
@@ -109,4 +214,63 @@ int dev_io_append_stream(struct open_dev **dev_list,
 int dev_io_remove_stream(struct open_dev **dev_list,
 			 struct cras_rstream *stream, struct cras_iodev *dev);
 
+/*
+ * Pauses or resumes a stream on the devices of a list, as its paused flag
+ * says. A paused stream stays attached but stops running: it isn't fetched,
+ * mixed or captured to. A resumed output stream is fetched at the next wake,
+ * and a resumed input stream captures from the frames the device reads next.
+ * Args:
+ *    dev_list - The open devices of the stream's direction.
+ *    stream - The stream to pause or resume.
+ *    fade_in_ms - How long a resumed output stream fades in, 0 not to fade.
+ * Returns:
+ *    1 if the stream is attached to a device of the list, 0 otherwise.
+ */
+int dev_io_set_stream_paused(struct open_dev *dev_list,
+			     struct cras_rstream *stream,
+			     unsigned int fade_in_ms);
+
+/*
+ * Sets the worker pool used to render playback streams in parallel.
+ * Args:
+ *    pool - The worker pool, or NULL to always mix on the calling thread.
+ *    min_streams - Only use the pool when an output device has at least
+ *        this many running streams.
+ */
+void dev_io_set_mix_pool(struct cras_mix_pool *pool, unsigned int min_streams);
+
+/*
+ * Sets how long input wakes may be put off to coincide with other wakes.
+ * The slack of a device is also kept under a quarter of its smallest
+ * callback, so low latency streams are barely delayed.
+ * Args:
+ *    slack_us - The slack in microseconds, 0 to wake as early as possible.
+ */
+void dev_io_set_input_wake_slack(unsigned int slack_us);
+
+/*
+ * Sets how much an output device's buffer level may be raised when it is at
+ * risk of underrun.
+ * Args:
+ *    max_ms - The most that is added in milliseconds, 0 to never raise it.
+ */
+void dev_io_set_adaptive_buffer_max_ms(unsigned int max_ms);
+
+/*
+ * Sets how long playback streams fade in when added to a device and out when
+ * they drain.
+ * Args:
+ *    ramp_ms - The length of the fades in milliseconds, 0 to not fade.
+ */
+void dev_io_set_stream_ramp_ms(unsigned int ramp_ms);
+
+/*
+ * Sets whether output devices playing only DEEP_BUFFER streams keep a copy
+ * of the audio they queue, to rewind and mix it again with a stream that
+ * starts on them.
+ * Args:
+ *    enabled - Non-zero to rewind deep buffers, 0 to leave them be.
+ */
+void dev_io_set_deep_buffer(int enabled);
+
 #endif /* DEV_IO_H_ */
@@ -3,6 +3,10 @@
  * found in the LICENSE file.
  */
 
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
 #include <syslog.h>
 
 #include "audio_thread_log.h"
@@ -13,12 +17,32 @@
 #include "cras_mix.h"
 #include "cras_server_metrics.h"
 #include "cras_shm.h"
+#include "cras_virtual_clock.h"
+#include "cras_wake_heap.h"
+#include "dsp_util.h"
 
 /* Adjust device's sample rate by this step faster or slower. Used
  * to make sure multiple active device has stable buffer level.
  */
 static const int coarse_rate_adjust_step = 3;
 
+/* Resample rate changes smaller than this fraction of the device rate are
+ * within the noise of the rate estimate, and aren't applied. */
+static const double resample_rate_threshold = 1e-6;
+
+/* Number of destroyed dev_streams each thread keeps for reuse. */
+#define DEV_STREAM_CACHE_SIZE 4
+
+/* Destroyed dev_streams with their conversion buffer, area and mix buffer
+ * still allocated. Streams are attached and removed on the audio thread, so
+ * each thread keeps its own and a stream attach reuses memory that has
+ * already been touched instead of calling into malloc. A thread that cached
+ * a stream sets dev_stream_cache_key, which frees the cache when it exits. */
+static __thread struct dev_stream *dev_stream_cache[DEV_STREAM_CACHE_SIZE];
+static __thread unsigned int dev_stream_cache_len;
+static pthread_key_t dev_stream_cache_key;
+static pthread_once_t dev_stream_cache_key_once = PTHREAD_ONCE_INIT;
+
 /*
  * Allow capture callback to fire this much earlier than the scheduled
  * next_cb_ts to avoid an extra wake of audio thread.
@@ -28,6 +52,15 @@ static const struct timespec capture_callback_fuzz_ts = {
 	.tv_nsec = 1000000, /* 1 ms. */
 };
 
+/* Reads the clock the time spent on each stream is measured with. */
+static inline uint64_t cost_clock_ns()
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
 /*
  * Returns the size in frames that a format converter must allocate for its
  * temporary buffers to be able to convert the specified number of stream
@@ -60,30 +93,119 @@ unsigned int max_frames_for_conversion(unsigned int stream_frames,
 	       + 1;
 }
 
+static void dev_stream_free(struct dev_stream *dev_stream)
+{
+	cras_audio_area_destroy(dev_stream->conv_area);
+	byte_buffer_destroy(&dev_stream->conv_buffer);
+	free(dev_stream->mix_buffer);
+	free(dev_stream);
+}
+
+/* Takes a cached dev_stream whose buffers can hold buf_bytes and
+ * num_channels, and clears everything but the buffers. Returns NULL if there
+ * is none. */
+static struct dev_stream *dev_stream_cache_take(unsigned int buf_bytes,
+						unsigned int num_channels)
+{
+	struct dev_stream *ds;
+	struct byte_buffer *conv_buffer;
+	struct cras_audio_area *conv_area;
+	uint8_t *mix_buffer;
+	unsigned int i, conv_area_channels;
+
+	for (i = 0; i < dev_stream_cache_len; i++) {
+		ds = dev_stream_cache[i];
+		if (ds->conv_buffer->max_size >= buf_bytes &&
+		    ds->conv_area_channels >= num_channels)
+			break;
+	}
+	if (i == dev_stream_cache_len)
+		return NULL;
+
+	dev_stream_cache[i] = dev_stream_cache[--dev_stream_cache_len];
+
+	conv_buffer = ds->conv_buffer;
+	conv_area = ds->conv_area;
+	conv_area_channels = ds->conv_area_channels;
+	mix_buffer = ds->mix_buffer;
+	memset(ds, 0, sizeof(*ds));
+	ds->conv_buffer = conv_buffer;
+	ds->conv_area = conv_area;
+	ds->conv_area_channels = conv_area_channels;
+	/* The mix buffer is sized in frames of the device format, which may
+	 * differ for this stream. Keep the allocation for
+	 * dev_stream_reserve_mix_buffer() to size again. */
+	ds->mix_buffer = mix_buffer;
+
+	byte_buffer_set_used_size(conv_buffer, buf_bytes);
+	buf_reset(conv_buffer);
+	conv_area->num_channels = num_channels;
+	return ds;
+}
+
+static void free_cache_on_exit(void *cache)
+{
+	dev_stream_free_cached();
+}
+
+static void create_dev_stream_cache_key()
+{
+	pthread_key_create(&dev_stream_cache_key, free_cache_on_exit);
+}
+
+/* Keeps dev_stream for reuse, evicting the oldest one when the cache is
+ * full. */
+static void dev_stream_cache_put(struct dev_stream *dev_stream)
+{
+	if (!dev_stream->conv_buffer || !dev_stream->conv_area) {
+		dev_stream_free(dev_stream);
+		return;
+	}
+	if (dev_stream_cache_len == DEV_STREAM_CACHE_SIZE) {
+		dev_stream_free(dev_stream_cache[0]);
+		memmove(&dev_stream_cache[0], &dev_stream_cache[1],
+			--dev_stream_cache_len * sizeof(dev_stream_cache[0]));
+	}
+	dev_stream_cache[dev_stream_cache_len++] = dev_stream;
+	pthread_once(&dev_stream_cache_key_once, create_dev_stream_cache_key);
+	pthread_setspecific(dev_stream_cache_key, dev_stream_cache);
+}
+
+void dev_stream_free_cached()
+{
+	while (dev_stream_cache_len)
+		dev_stream_free(dev_stream_cache[--dev_stream_cache_len]);
+}
+
+/* Playback streams that run on a device wake the audio thread at their
+ * next_cb_ts, unless they follow the timing of the device. */
+static int wakes_at_next_cb_ts(const struct dev_stream *dev_stream)
+{
+	return dev_stream->stream->direction == CRAS_STREAM_OUTPUT &&
+	       !dev_stream->paused &&
+	       !(dev_stream->stream->flags & USE_DEV_TIMING);
+}
+
 struct dev_stream *dev_stream_create(struct cras_rstream *stream,
 				     unsigned int dev_id,
 				     const struct cras_audio_format *dev_fmt,
 				     void *dev_ptr, struct timespec *cb_ts)
 {
 	struct dev_stream *out;
+	struct cras_fmt_conv *conv;
 	struct cras_audio_format *stream_fmt = &stream->format;
 	int rc = 0;
-	unsigned int max_frames, dev_frames, buf_bytes;
+	unsigned int max_frames, dev_frames, buf_bytes, size_frames;
 	const struct cras_audio_format *ofmt;
 
-	out = calloc(1, sizeof(*out));
-	out->dev_id = dev_id;
-	out->stream = stream;
-	out->dev_rate = dev_fmt->frame_rate;
-	out->is_running = 0;
-
 	max_frames = max_frames_for_conversion(stream->buffer_frames,
 					       stream_fmt->frame_rate,
 					       dev_fmt->frame_rate);
 
 	if (stream->direction == CRAS_STREAM_OUTPUT) {
-		rc = config_format_converter(&out->conv, stream->direction,
-					     stream_fmt, dev_fmt, max_frames);
+		rc = config_format_converter(&conv, stream->direction,
+					     stream_fmt, dev_fmt, max_frames,
+					     stream->src_quality);
 	} else {
 		/*
 		 * For input, take into account the stream specific processing
@@ -95,36 +217,60 @@ struct dev_stream *dev_stream_create(struct cras_rstream *stream,
 		cras_apm_list_start_apm(stream->apm_list, dev_ptr);
 		ofmt = cras_rstream_post_processing_format(stream, dev_ptr) ?:
 			       dev_fmt,
-		rc = config_format_converter(&out->conv, stream->direction,
-					     ofmt, stream_fmt, max_frames);
+		rc = config_format_converter(&conv, stream->direction, ofmt,
+					     stream_fmt, max_frames,
+					     stream->src_quality);
 	}
-	if (rc) {
-		free(out);
+	if (rc)
 		return NULL;
-	}
 
-	ofmt = cras_fmt_conv_out_format(out->conv);
+	ofmt = cras_fmt_conv_out_format(conv);
 
 	dev_frames =
 		(stream->direction == CRAS_STREAM_OUTPUT) ?
-			cras_fmt_conv_in_frames_to_out(out->conv,
+			cras_fmt_conv_in_frames_to_out(conv,
 						       stream->buffer_frames) :
-			cras_fmt_conv_out_frames_to_in(out->conv,
+			cras_fmt_conv_out_frames_to_in(conv,
 						       stream->buffer_frames);
 
-	out->conv_buffer_size_frames =
-		2 * MAX(dev_frames, stream->buffer_frames);
+	/* Playback converts into the buffer and mixes it right away, so it
+	 * holds one conversion at most. Capture queues what the stream can't
+	 * take yet. */
+	if (stream->direction == CRAS_STREAM_OUTPUT)
+		size_frames = max_frames;
+	else
+		size_frames = 2 * MAX(dev_frames, stream->buffer_frames);
 
 	/* Create conversion buffer and area using the output format
 	 * of the format converter. Note that this format might not be
 	 * identical to stream_fmt for capture. */
-	buf_bytes = out->conv_buffer_size_frames * cras_get_format_bytes(ofmt);
-	out->conv_buffer = byte_buffer_create(buf_bytes);
-	out->conv_area = cras_audio_area_create(ofmt->num_channels);
+	buf_bytes = size_frames * cras_get_format_bytes(ofmt);
+	out = dev_stream_cache_take(buf_bytes, ofmt->num_channels);
+	if (!out) {
+		out = calloc(1, sizeof(*out));
+		out->conv_buffer = byte_buffer_create(buf_bytes);
+		out->conv_area = cras_audio_area_create(ofmt->num_channels);
+		out->conv_area_channels = ofmt->num_channels;
+	}
+	out->conv = conv;
+	out->conv_buffer_size_frames = size_frames;
+	out->dev_id = dev_id;
+	out->stream = stream;
+	out->exclusive = !!(stream->flags & (EXCLUSIVE | PASSTHROUGH));
+	out->dev_rate = dev_fmt->frame_rate;
+	out->is_running = 0;
+	out->paused = stream->paused;
+	out->dev_buf_slot = -1;
+	out->scheduled = stream->direction == CRAS_STREAM_OUTPUT &&
+			 timespec_is_nonzero(&stream->scheduled_ts);
+	out->lead_frames = 0;
+	out->src_quality = stream->src_quality;
 
 	cras_frames_to_time(cras_rstream_get_cb_threshold(stream),
 			    stream_fmt->frame_rate, &stream->sleep_interval_ts);
-	stream->next_cb_ts = *cb_ts;
+	cras_wake_heap_set_next_cb_ts(stream, cb_ts);
+	if (wakes_at_next_cb_ts(out))
+		cras_wake_heap_add(stream);
 
 	/* Sets up the stream & dev pair. */
 	cras_rstream_dev_attach(stream, dev_id, dev_ptr);
@@ -132,28 +278,89 @@ struct dev_stream *dev_stream_create(struct cras_rstream *stream,
 	return out;
 }
 
+void dev_stream_set_paused(struct dev_stream *dev_stream, int paused)
+{
+	if (wakes_at_next_cb_ts(dev_stream))
+		cras_wake_heap_rm(dev_stream->stream);
+	dev_stream->paused = paused;
+	if (wakes_at_next_cb_ts(dev_stream))
+		cras_wake_heap_add(dev_stream->stream);
+}
+
+void dev_stream_get_cost(const struct dev_stream *dev_stream,
+			 struct cras_rstream_cost *cost)
+{
+	const struct cras_rstream *rstream = dev_stream->stream;
+	void *dev_ptr = cras_rstream_dev_ptr(rstream, dev_stream->dev_id);
+
+	cost->convert_ns = rstream->cost.convert_ns + dev_stream->convert_ns;
+	cost->mix_ns = rstream->cost.mix_ns + dev_stream->mix_ns;
+	cost->apm_ns = rstream->cost.apm_ns +
+		       cras_apm_list_get_process_ns(rstream->apm_list, dev_ptr);
+
+	cost->mem_bytes = dev_stream->conv_buffer->max_size +
+			  cras_apm_list_get_mem_bytes(rstream->apm_list,
+						      dev_ptr);
+	if (rstream->shm)
+		cost->mem_bytes += cras_shm_header_size() +
+				   cras_shm_samples_size(rstream->shm);
+	if (dev_stream->mix_buffer)
+		cost->mem_bytes +=
+			dev_stream->mix_buffer_size_frames *
+			cras_get_format_bytes(
+				cras_fmt_conv_out_format(dev_stream->conv));
+}
+
 void dev_stream_destroy(struct dev_stream *dev_stream)
 {
 	void *dev_ptr =
 		cras_rstream_dev_ptr(dev_stream->stream, dev_stream->dev_id);
+	struct cras_rstream_cost cost;
+
+	/* The stream keeps what it cost here, for its metrics. */
+	dev_stream_get_cost(dev_stream, &cost);
+	cost.mem_bytes = MAX(cost.mem_bytes, dev_stream->stream->cost.mem_bytes);
+	dev_stream->stream->cost = cost;
+
+	if (wakes_at_next_cb_ts(dev_stream))
+		cras_wake_heap_rm(dev_stream->stream);
+
 	/* Stops the APM and then unlink the dev stream pair. */
 	cras_apm_list_stop_apm(dev_stream->stream->apm_list, dev_ptr);
 	cras_rstream_dev_detach(dev_stream->stream, dev_stream->dev_id);
-	if (dev_stream->conv) {
-		cras_audio_area_destroy(dev_stream->conv_area);
+	if (dev_stream->conv)
 		cras_fmt_conv_destroy(&dev_stream->conv);
-		byte_buffer_destroy(&dev_stream->conv_buffer);
-	}
-	free(dev_stream);
+	dev_stream_cache_put(dev_stream);
+}
+
+/* Points the drift correction of the stream at a new rate, done by the SRC
+ * when the stream converts rates and by the linear resampler otherwise.
+ * Setting the rates restarts the interpolation of the linear resampler, so
+ * it is skipped when the rate barely moved. Going back to the device rate
+ * is always applied, so the resampler can be bypassed. */
+static void set_resample_rate(struct dev_stream *dev_stream,
+			      unsigned int dev_rate, double rate)
+{
+	double last = dev_stream->resample_rate;
+
+	if (last && rate == last)
+		return;
+	if (last && rate != dev_rate &&
+	    fabs(rate - last) < dev_rate * resample_rate_threshold)
+		return;
+	cras_fmt_conv_set_linear_resample_rates(dev_stream->conv, dev_rate,
+						rate);
+	dev_stream->resample_rate = rate;
 }
 
 void dev_stream_set_dev_rate(struct dev_stream *dev_stream,
 			     unsigned int dev_rate, double dev_rate_ratio,
-			     double master_rate_ratio, int coarse_rate_adjust)
+			     double master_rate_ratio, int coarse_rate_adjust,
+			     double catch_up)
 {
 	if (dev_stream->dev_id == dev_stream->stream->master_dev.dev_id) {
-		cras_fmt_conv_set_linear_resample_rates(dev_stream->conv,
-							dev_rate, dev_rate);
+		set_resample_rate(dev_stream, dev_rate,
+				  dev_rate / (1 + catch_up));
 		cras_frames_to_time_precise(
 			cras_rstream_get_cb_threshold(dev_stream->stream),
 			dev_stream->stream->format.frame_rate * dev_rate_ratio,
@@ -162,14 +369,106 @@ void dev_stream_set_dev_rate(struct dev_stream *dev_stream,
 		double new_rate =
 			dev_rate * dev_rate_ratio / master_rate_ratio +
 			coarse_rate_adjust_step * coarse_rate_adjust;
-		cras_fmt_conv_set_linear_resample_rates(dev_stream->conv,
-							dev_rate, new_rate);
+		set_resample_rate(dev_stream, dev_rate,
+				  new_rate / (1 + catch_up));
 	}
 }
 
-int dev_stream_mix(struct dev_stream *dev_stream,
-		   const struct cras_audio_format *fmt, uint8_t *dst,
-		   unsigned int num_to_write)
+/* Starts fading the scaler of the stream from its current value to target
+ * over the given number of frames. */
+static void start_ramp(struct dev_stream *dev_stream, float target,
+		       unsigned int frames)
+{
+	if (frames == 0) {
+		dev_stream->ramp_scaler = target;
+		dev_stream->ramp_left = 0;
+	} else {
+		dev_stream->ramp_increment =
+			(target - dev_stream->ramp_scaler) / frames;
+		dev_stream->ramp_left = frames;
+	}
+	dev_stream->ramp_target = target;
+}
+
+/* Moves the fade of the stream forward by the given number of frames. */
+static void update_ramp(struct dev_stream *dev_stream, unsigned int frames)
+{
+	if (frames >= dev_stream->ramp_left) {
+		dev_stream->ramp_scaler = dev_stream->ramp_target;
+		dev_stream->ramp_left = 0;
+		return;
+	}
+	dev_stream->ramp_scaler += dev_stream->ramp_increment * frames;
+	dev_stream->ramp_left -= frames;
+}
+
+/* Returns the gain the stream should settle at. */
+static float stream_gain(struct cras_rstream *rstream)
+{
+	if (cras_rstream_get_mute(rstream) ||
+	    cras_rstream_get_is_draining(rstream))
+		return 0.0f;
+	return cras_rstream_get_volume_scaler(rstream);
+}
+
+void dev_stream_set_ramp(struct dev_stream *dev_stream,
+			 unsigned int ramp_frames, int fade_in)
+{
+	float gain = fade_in ? 0.0f : stream_gain(dev_stream->stream);
+
+	dev_stream->ramp_frames = ramp_frames;
+	dev_stream->ramp_left = 0;
+	dev_stream->ramp_scaler = gain;
+	dev_stream->ramp_target = gain;
+}
+
+void dev_stream_fade_in(struct dev_stream *dev_stream, unsigned int frames)
+{
+	dev_stream->ramp_scaler = 0.0f;
+	start_ramp(dev_stream, stream_gain(dev_stream->stream), frames);
+}
+
+void dev_stream_set_overload_level(struct dev_stream *dev_stream,
+				   enum CRAS_OVERLOAD_LEVEL level)
+{
+	const struct cras_rstream *stream = dev_stream->stream;
+	enum CRAS_SRC_QUALITY quality;
+
+	if (!dev_stream->conv)
+		return;
+	quality = cras_overload_src_quality(level, stream->stream_type,
+					    stream->src_quality);
+	cras_fmt_conv_set_src_quality(dev_stream->conv, quality);
+	dev_stream->src_quality = quality;
+}
+
+/* Starts a fade if the gain of the stream changed, fr_in_buf being the
+ * device frames the stream has queued. */
+static void update_gain(struct dev_stream *dev_stream, unsigned int fr_in_buf)
+{
+	struct cras_rstream *rstream = dev_stream->stream;
+	float gain;
+	unsigned int ramp_frames = dev_stream->ramp_frames;
+
+	if (!ramp_frames)
+		return;
+	gain = stream_gain(rstream);
+	if (cras_rstream_get_is_draining(rstream))
+		ramp_frames = MIN(ramp_frames, fr_in_buf);
+	if (gain != dev_stream->ramp_target)
+		start_ramp(dev_stream, gain, ramp_frames);
+}
+
+/*
+ * Converts frames from shm and mixes them into dst. With index 0 the first
+ * frames are copied instead of added, zeroing dst if muted. The converted
+ * frames are handed to the taps of the stream before they are mixed.
+ * Returns the number of frames written, or negative error code.
+ */
+static int mix_frames(struct dev_stream *dev_stream,
+		      const struct cras_audio_format *fmt, uint8_t *dst,
+		      unsigned int num_to_write, unsigned int index,
+		      unsigned int *frames_read, int *silent)
 {
 	struct cras_rstream *rstream = dev_stream->stream;
 	uint8_t *src;
@@ -179,9 +478,13 @@ int dev_stream_mix(struct dev_stream *dev_stream,
 	int fr_in_buf;
 	unsigned int num_samples;
 	size_t frames = 0;
+	size_t bytes;
 	unsigned int dev_frames;
 	float mix_vol;
+	int mute;
 
+	*frames_read = 0;
+	*silent = 1;
 	fr_in_buf = dev_stream_playback_frames(dev_stream);
 	if (fr_in_buf <= 0)
 		return fr_in_buf;
@@ -192,40 +495,349 @@ int dev_stream_mix(struct dev_stream *dev_stream,
 
 	/* Stream volume scaler. */
 	mix_vol = cras_rstream_get_volume_scaler(dev_stream->stream);
+	mute = cras_rstream_get_mute(rstream);
+
+	/* Glide to a new gain instead of jumping to it. What is left once the
+	 * client has stopped the stream is faded out. */
+	update_gain(dev_stream, fr_in_buf);
 
 	fr_written = 0;
 	fr_read = 0;
 	while (fr_written < num_to_write) {
 		unsigned int read_frames;
+		uint64_t start, now;
+
 		src = cras_rstream_get_readable_frames(
 			rstream, buffer_offset + fr_read, &frames);
 		if (frames == 0)
 			break;
+		start = cost_clock_ns();
 		if (cras_fmt_conversion_needed(dev_stream->conv)) {
 			read_frames = frames;
 			dev_frames = cras_fmt_conv_convert_frames(
 				dev_stream->conv, src,
 				dev_stream->conv_buffer->bytes, &read_frames,
-				num_to_write - fr_written);
+				MIN(num_to_write - fr_written,
+				    dev_stream->conv_buffer_size_frames));
 			src = dev_stream->conv_buffer->bytes;
+			now = cost_clock_ns();
+			dev_stream->convert_ns += now - start;
+			start = now;
 		} else {
 			dev_frames = MIN(frames, num_to_write - fr_written);
 			read_frames = dev_frames;
 		}
+		cras_rstream_tap_frames(rstream, src, dev_frames, fmt);
 		num_samples = dev_frames * fmt->num_channels;
-		cras_mix_add(fmt->format, target, src, num_samples, 1,
-			     cras_rstream_get_mute(rstream), mix_vol);
-		target += dev_frames * cras_get_format_bytes(fmt);
+		bytes = dev_frames * cras_get_format_bytes(fmt);
+		/* Exclusive streams are copied bit-exact, they have the device
+		 * to themselves. Adding silence changes nothing, so a muted or
+		 * silent stream only clears the destination it would
+		 * overwrite. */
+		if (dev_stream->exclusive) {
+			memcpy(target, src, bytes);
+			*silent = 0;
+		} else if ((mute && !dev_stream->ramp_frames) ||
+		    cras_buffer_is_zero(src, bytes)) {
+			if (index == 0)
+				memset(target, 0, bytes);
+		} else {
+			*silent = 0;
+			if (dev_stream->ramp_left)
+				cras_mix_add_ramp(fmt->format, target, src,
+						  dev_frames, fmt->num_channels,
+						  index, dev_stream->ramp_scaler,
+						  dev_stream->ramp_increment,
+						  dev_stream->ramp_target);
+			else if (dev_stream->ramp_frames)
+				cras_mix_add(fmt->format, target, src,
+					     num_samples, index, 0,
+					     dev_stream->ramp_scaler);
+			else
+				cras_mix_add(fmt->format, target, src,
+					     num_samples, index, mute, mix_vol);
+		}
+		if (dev_stream->ramp_left)
+			update_ramp(dev_stream, dev_frames);
+		dev_stream->mix_ns += cost_clock_ns() - start;
+		target += bytes;
 		fr_written += dev_frames;
 		fr_read += read_frames;
 	}
 
 	cras_rstream_dev_offset_update(rstream, fr_read, dev_stream->dev_id);
+	*frames_read = fr_read;
+
+	return fr_written;
+}
+
+int dev_stream_mix(struct dev_stream *dev_stream,
+		   const struct cras_audio_format *fmt, uint8_t *dst,
+		   unsigned int num_to_write)
+{
+	unsigned int fr_read;
+	int fr_written, silent;
+
+	fr_written = mix_frames(dev_stream, fmt, dst, num_to_write, 1, &fr_read,
+				&silent);
+	if (fr_written < 0)
+		return fr_written;
+
 	ATLOG(atlog, AUDIO_THREAD_DEV_STREAM_MIX, fr_written, fr_read, 0);
 
 	return fr_written;
 }
 
+int dev_stream_reserve_mix_buffer(struct dev_stream *dev_stream,
+				  const struct cras_audio_format *fmt,
+				  unsigned int frames)
+{
+	uint8_t *buf;
+
+	if (frames <= dev_stream->mix_buffer_size_frames)
+		return 0;
+
+	buf = realloc(dev_stream->mix_buffer,
+		      frames * cras_get_format_bytes(fmt));
+	if (!buf)
+		return -ENOMEM;
+	dev_stream->mix_buffer = buf;
+	dev_stream->mix_buffer_size_frames = frames;
+	return 0;
+}
+
+int dev_stream_render(struct dev_stream *dev_stream,
+		      const struct cras_audio_format *fmt,
+		      unsigned int num_to_write)
+{
+	unsigned int fr_read;
+
+	/* Nothing is allocated on a wake, see
+	 * dev_stream_reserve_mix_buffer(). */
+	num_to_write = MIN(num_to_write, dev_stream->mix_buffer_size_frames);
+
+	/* Audio thread log isn't safe to write from the mix workers, the
+	 * caller logs the result instead. */
+	return mix_frames(dev_stream, fmt, dev_stream->mix_buffer, num_to_write,
+			  0, &fr_read, &dev_stream->mix_silent);
+}
+
+int dev_stream_can_group(const struct dev_stream *dev_stream)
+{
+	const struct cras_rstream *rstream = dev_stream->stream;
+
+	return rstream->direction == CRAS_STREAM_OUTPUT &&
+	       !dev_stream->exclusive && dev_stream->conv &&
+	       cras_fmt_conversion_needed(dev_stream->conv) && !rstream->taps &&
+	       !dev_stream->scheduled && !dev_stream->lead_frames &&
+	       !cras_rstream_get_is_draining(rstream) &&
+	       rstream->num_attached_devs == 1;
+}
+
+/* Returns non-zero if two audio formats are the same. */
+static int formats_equal(const struct cras_audio_format *a,
+			 const struct cras_audio_format *b)
+{
+	return a->format == b->format && a->frame_rate == b->frame_rate &&
+	       a->num_channels == b->num_channels &&
+	       !memcmp(a->channel_layout, b->channel_layout,
+		       sizeof(a->channel_layout));
+}
+
+int dev_stream_convert_alike(const struct dev_stream *a,
+			     const struct dev_stream *b)
+{
+	return formats_equal(&a->stream->format, &b->stream->format) &&
+	       a->src_quality == b->src_quality &&
+	       a->resample_rate == b->resample_rate;
+}
+
+int dev_stream_group_matches(const struct dev_stream_group *group,
+			     const struct dev_stream *dev_stream)
+{
+	/* The linear resampler is shared too, its rate follows the members. */
+	if (group->num_members)
+		return dev_stream_convert_alike(group->members[0], dev_stream);
+	return formats_equal(&group->fmt, &dev_stream->stream->format) &&
+	       group->src_quality == dev_stream->src_quality;
+}
+
+struct dev_stream_group *
+dev_stream_group_create(const struct dev_stream *dev_stream,
+			const struct cras_audio_format *dev_fmt,
+			unsigned int max_frames)
+{
+	const struct cras_audio_format *fmt = &dev_stream->stream->format;
+	struct dev_stream_group *group;
+	unsigned int frames;
+
+	group = calloc(1, sizeof(*group));
+	if (!group)
+		return NULL;
+	group->fmt = *fmt;
+	group->src_quality = dev_stream->src_quality;
+
+	frames = max_frames_for_conversion(max_frames, dev_fmt->frame_rate,
+					   fmt->frame_rate);
+	if (config_format_converter(&group->conv, CRAS_STREAM_OUTPUT, fmt,
+				    dev_fmt, frames, group->src_quality))
+		goto error;
+	group->mix_buffer = malloc(frames * cras_get_format_bytes(fmt));
+	group->mix_buffer_size_frames = frames;
+	group->conv_buffer = malloc(max_frames * cras_get_format_bytes(dev_fmt));
+	group->conv_buffer_size_frames = max_frames;
+	if (!group->mix_buffer || !group->conv_buffer)
+		goto error;
+	return group;
+
+error:
+	dev_stream_group_destroy(group);
+	return NULL;
+}
+
+void dev_stream_group_destroy(struct dev_stream_group *group)
+{
+	if (group->conv)
+		cras_fmt_conv_destroy(&group->conv);
+	free(group->mix_buffer);
+	free(group->conv_buffer);
+	free(group);
+}
+
+/*
+ * Sums num_frames frames of a group member from shm into dst, in the format
+ * of the stream. With index 0 the frames are copied instead of added, zeroing
+ * dst if muted. The ramp of the stream is followed with increment per stream
+ * frame, but isn't moved forward until the group knows how many frames were
+ * converted.
+ */
+static void group_add_stream(struct dev_stream *dev_stream,
+			     const struct cras_audio_format *fmt, uint8_t *dst,
+			     unsigned int num_frames, float increment,
+			     unsigned int index)
+{
+	struct cras_rstream *rstream = dev_stream->stream;
+	unsigned int offset =
+		cras_rstream_dev_offset(rstream, dev_stream->dev_id);
+	unsigned int frame_bytes = cras_get_format_bytes(fmt);
+	float scaler = dev_stream->ramp_scaler;
+	float mix_vol = cras_rstream_get_volume_scaler(rstream);
+	int mute = cras_rstream_get_mute(rstream);
+	unsigned int done = 0;
+	size_t frames, bytes;
+	uint8_t *src;
+
+	while (done < num_frames) {
+		src = cras_rstream_get_readable_frames(rstream, offset + done,
+						       &frames);
+		if (frames == 0)
+			break;
+		frames = MIN(frames, num_frames - done);
+		bytes = frames * frame_bytes;
+		if ((mute && !dev_stream->ramp_frames) ||
+		    cras_buffer_is_zero(src, bytes)) {
+			if (index == 0)
+				memset(dst, 0, bytes);
+		} else if (dev_stream->ramp_left) {
+			cras_mix_add_ramp(fmt->format, dst, src, frames,
+					  fmt->num_channels, index, scaler,
+					  increment, dev_stream->ramp_target);
+		} else if (dev_stream->ramp_frames) {
+			cras_mix_add(fmt->format, dst, src,
+				     frames * fmt->num_channels, index, 0,
+				     dev_stream->ramp_scaler);
+		} else {
+			cras_mix_add(fmt->format, dst, src,
+				     frames * fmt->num_channels, index, mute,
+				     mix_vol);
+		}
+		scaler += increment * frames;
+		dst += bytes;
+		done += frames;
+	}
+	if (index == 0 && done < num_frames)
+		memset(dst, 0, (num_frames - done) * frame_bytes);
+}
+
+int dev_stream_group_mix(struct dev_stream_group *group,
+			 const struct cras_audio_format *fmt, uint8_t *dst,
+			 unsigned int num_to_write)
+{
+	struct dev_stream *member;
+	unsigned int in_frames, read_frames, dev_frames, i;
+	uint64_t start, now, convert_ns, mix_ns;
+	double resample_rate;
+	float frame_ratio;
+	int avail;
+
+	if (!group->num_members)
+		return 0;
+
+	resample_rate = group->members[0]->resample_rate;
+	if (resample_rate && resample_rate != group->resample_rate) {
+		cras_fmt_conv_set_linear_resample_rates(
+			group->conv, fmt->frame_rate, resample_rate);
+		group->resample_rate = resample_rate;
+	}
+
+	num_to_write = MIN(num_to_write, group->conv_buffer_size_frames);
+	in_frames = MIN(cras_fmt_conv_out_frames_to_in(group->conv,
+						       num_to_write),
+			group->mix_buffer_size_frames);
+	for (i = 0; i < group->num_members; i++) {
+		member = group->members[i];
+		avail = cras_rstream_playable_frames(member->stream,
+						     member->dev_id);
+		if (avail < 0)
+			return avail;
+		in_frames = MIN(in_frames, (unsigned int)avail);
+		update_gain(member,
+			    cras_fmt_conv_in_frames_to_out(group->conv, avail));
+	}
+	if (in_frames == 0)
+		return 0;
+
+	/* Ramps are kept in device frames, the sum is in stream frames. */
+	frame_ratio =
+		(float)cras_fmt_conv_in_frames_to_out(group->conv, in_frames) /
+		in_frames;
+	for (i = 0; i < group->num_members; i++) {
+		member = group->members[i];
+		start = cost_clock_ns();
+		group_add_stream(member, &group->fmt, group->mix_buffer,
+				 in_frames, member->ramp_increment * frame_ratio,
+				 i);
+		member->mix_ns += cost_clock_ns() - start;
+	}
+
+	start = cost_clock_ns();
+	read_frames = in_frames;
+	dev_frames = cras_fmt_conv_convert_frames(group->conv,
+						  group->mix_buffer,
+						  group->conv_buffer,
+						  &read_frames, num_to_write);
+	now = cost_clock_ns();
+	cras_mix_add(fmt->format, dst, group->conv_buffer,
+		     dev_frames * fmt->num_channels, 1, 0, 1.0f);
+
+	/* Each member is charged its share of the work done once. */
+	convert_ns = (now - start) / group->num_members;
+	mix_ns = (cost_clock_ns() - now) / group->num_members;
+	for (i = 0; i < group->num_members; i++) {
+		member = group->members[i];
+		member->convert_ns += convert_ns;
+		member->mix_ns += mix_ns;
+		if (member->ramp_left)
+			update_ramp(member, dev_frames);
+		cras_rstream_dev_offset_update(member->stream, read_frames,
+					       member->dev_id);
+		ATLOG(atlog, AUDIO_THREAD_DEV_STREAM_MIX, dev_frames,
+		      read_frames, 0);
+	}
+
+	return dev_frames;
+}
+
 /* Copy from the captured buffer to the temporary format converted buffer. */
 static unsigned int capture_with_fmt_conv(struct dev_stream *dev_stream,
 					  const uint8_t *source_samples,
@@ -332,6 +944,89 @@ capture_copy_converted_to_stream(struct dev_stream *dev_stream,
 	return total_written;
 }
 
+/* Returns non-zero if captured frames can be written over the stream shm
+ * instead of being mixed into it by cras_audio_area_copy(). The shm buffer is
+ * zeroed before it's written, so this holds for a stream reading only from
+ * this device at unity gain. */
+static int capture_can_write_shm(const struct dev_stream *dev_stream,
+				 float software_gain_scaler)
+{
+	return dev_stream->stream->num_attached_devs == 1 &&
+	       software_gain_scaler == 1.0f;
+}
+
+/* Converts captured frames straight into the stream shm, skipping the
+ * conversion buffer. Only used when the converter output is laid out like the
+ * stream. Returns the number of source frames consumed. */
+static unsigned int capture_convert_to_shm(struct dev_stream *dev_stream,
+					   struct cras_rstream *rstream,
+					   uint8_t *stream_samples,
+					   const uint8_t *source_samples,
+					   unsigned int num_frames)
+{
+	unsigned int offset, write_frames, read_frames;
+
+	offset = cras_rstream_dev_offset(rstream, dev_stream->dev_id);
+	if (offset >= rstream->audio_area->frames)
+		return 0;
+
+	read_frames = num_frames;
+	write_frames = cras_fmt_conv_convert_frames(
+		dev_stream->conv, source_samples,
+		stream_samples + offset * cras_get_format_bytes(&rstream->format),
+		&read_frames, rstream->audio_area->frames - offset);
+
+	ATLOG(atlog, AUDIO_THREAD_CAPTURE_WRITE, rstream->stream_id,
+	      write_frames, cras_shm_frames_written(cras_rstream_shm(rstream)));
+	cras_rstream_dev_offset_update(rstream, write_frames,
+				       dev_stream->dev_id);
+	return read_frames;
+}
+
+/* Copies frames already in the stream sample format and rate into the stream
+ * shm. Returns the number of frames copied. */
+static unsigned int capture_copy_to_shm(struct dev_stream *dev_stream,
+					struct cras_rstream *rstream,
+					const struct cras_audio_area *area,
+					unsigned int area_offset,
+					float software_gain_scaler,
+					int write_shm)
+{
+	struct cras_audio_shm *shm;
+	uint8_t *stream_samples;
+	unsigned int nread;
+	unsigned int offset =
+		cras_rstream_dev_offset(rstream, dev_stream->dev_id);
+
+	/* Set up the shm area and copy to it. */
+	shm = cras_rstream_shm(rstream);
+	stream_samples = cras_shm_get_writeable_frames(
+		shm, cras_rstream_get_cb_threshold(rstream),
+		&rstream->audio_area->frames);
+	cras_audio_area_config_buf_pointers(rstream->audio_area,
+					    &rstream->format, stream_samples);
+
+	if (write_shm &&
+	    cras_audio_area_layouts_match(rstream->audio_area, area)) {
+		nread = MIN(area->frames - area_offset,
+			    rstream->audio_area->frames - offset);
+		memcpy(rstream->audio_area->channels[0].buf +
+			       offset * area->channels[0].step_bytes,
+		       area->channels[0].buf +
+			       area_offset * area->channels[0].step_bytes,
+		       (size_t)nread * area->channels[0].step_bytes);
+	} else {
+		nread = cras_audio_area_copy(rstream->audio_area, offset,
+					     &rstream->format, area,
+					     area_offset, software_gain_scaler);
+	}
+
+	ATLOG(atlog, AUDIO_THREAD_CAPTURE_WRITE, rstream->stream_id, nread,
+	      cras_shm_frames_written(shm));
+	cras_rstream_dev_offset_update(rstream, nread, dev_stream->dev_id);
+	return nread;
+}
+
 unsigned int dev_stream_capture(struct dev_stream *dev_stream,
 				const struct cras_audio_area *area,
 				unsigned int area_offset,
@@ -341,45 +1036,137 @@ unsigned int dev_stream_capture(struct dev_stream *dev_stream,
 	struct cras_audio_shm *shm;
 	uint8_t *stream_samples;
 	unsigned int nread;
+	int write_shm = capture_can_write_shm(dev_stream, software_gain_scaler);
+	uint64_t start = cost_clock_ns();
 
 	/* Check if format conversion is needed. */
 	if (cras_fmt_conversion_needed(dev_stream->conv)) {
 		unsigned int format_bytes, fr_to_capture;
+		const struct cras_audio_format *ofmt;
+		const uint8_t *source_samples;
 
 		fr_to_capture = dev_stream_capture_avail(dev_stream);
 		fr_to_capture = MIN(fr_to_capture, area->frames - area_offset);
 
 		format_bytes = cras_get_format_bytes(
 			cras_fmt_conv_in_format(dev_stream->conv));
-		nread = capture_with_fmt_conv(
-			dev_stream,
-			area->channels[0].buf + area_offset * format_bytes,
-			fr_to_capture);
+		source_samples =
+			area->channels[0].buf + area_offset * format_bytes;
+
+		/* Nothing is left over from the last capture, convert right
+		 * into the shm if the stream takes the converter output
+		 * as is. */
+		if (write_shm && buf_queued(dev_stream->conv_buffer) == 0) {
+			ofmt = cras_fmt_conv_out_format(dev_stream->conv);
+			shm = cras_rstream_shm(rstream);
+			stream_samples = cras_shm_get_writeable_frames(
+				shm, cras_rstream_get_cb_threshold(rstream),
+				&rstream->audio_area->frames);
+			cras_audio_area_config_buf_pointers(
+				rstream->audio_area, &rstream->format,
+				stream_samples);
+			dev_stream->conv_area->num_channels =
+				ofmt->num_channels;
+			cras_audio_area_config_buf_pointers(
+				dev_stream->conv_area, ofmt, stream_samples);
+			cras_audio_area_config_channels(dev_stream->conv_area,
+							ofmt);
+			if (cras_audio_area_layouts_match(
+				    rstream->audio_area,
+				    dev_stream->conv_area)) {
+				nread = capture_convert_to_shm(
+					dev_stream, rstream, stream_samples,
+					source_samples, fr_to_capture);
+				dev_stream->convert_ns +=
+					cost_clock_ns() - start;
+				return nread;
+			}
+		}
+
+		nread = capture_with_fmt_conv(dev_stream, source_samples,
+					      fr_to_capture);
 
 		capture_copy_converted_to_stream(dev_stream, rstream,
 						 software_gain_scaler);
+		dev_stream->convert_ns += cost_clock_ns() - start;
 	} else {
-		unsigned int offset =
-			cras_rstream_dev_offset(rstream, dev_stream->dev_id);
+		nread = capture_copy_to_shm(dev_stream, rstream, area,
+					    area_offset, software_gain_scaler,
+					    write_shm);
+		dev_stream->mix_ns += cost_clock_ns() - start;
+	}
 
-		/* Set up the shm area and copy to it. */
-		shm = cras_rstream_shm(rstream);
-		stream_samples = cras_shm_get_writeable_frames(
-			shm, cras_rstream_get_cb_threshold(rstream),
-			&rstream->audio_area->frames);
-		cras_audio_area_config_buf_pointers(
-			rstream->audio_area, &rstream->format, stream_samples);
+	return nread;
+}
 
-		nread = cras_audio_area_copy(rstream->audio_area, offset,
-					     &rstream->format, area,
-					     area_offset, software_gain_scaler);
+unsigned int dev_stream_capture_converted(struct dev_stream *dev_stream,
+					  const struct cras_audio_area *area,
+					  unsigned int area_offset,
+					  float software_gain_scaler)
+{
+	uint64_t start = cost_clock_ns();
+	unsigned int nread;
 
-		ATLOG(atlog, AUDIO_THREAD_CAPTURE_WRITE, rstream->stream_id,
-		      nread, cras_shm_frames_written(shm));
-		cras_rstream_dev_offset_update(rstream, nread,
-					       dev_stream->dev_id);
-	}
+	nread = capture_copy_to_shm(
+		dev_stream, dev_stream->stream, area, area_offset,
+		software_gain_scaler,
+		capture_can_write_shm(dev_stream, software_gain_scaler));
+	dev_stream->mix_ns += cost_clock_ns() - start;
+	return nread;
+}
+
+int dev_stream_can_capture_planar(const struct dev_stream *dev_stream,
+				  float software_gain_scaler)
+{
+	const struct cras_audio_format *ifmt, *sfmt;
+
+	if (!dev_stream->conv ||
+	    !capture_can_write_shm(dev_stream, software_gain_scaler))
+		return 0;
+
+	ifmt = cras_fmt_conv_in_format(dev_stream->conv);
+	sfmt = &dev_stream->stream->format;
+	return ifmt->format == sfmt->format &&
+	       ifmt->frame_rate == sfmt->frame_rate &&
+	       ifmt->num_channels == sfmt->num_channels &&
+	       !memcmp(ifmt->channel_layout, sfmt->channel_layout,
+		       sizeof(ifmt->channel_layout));
+}
+
+unsigned int dev_stream_capture_planar(struct dev_stream *dev_stream,
+				       const struct cras_audio_area *area)
+{
+	struct cras_rstream *rstream = dev_stream->stream;
+	struct cras_audio_shm *shm;
+	uint8_t *stream_samples;
+	float *channels[CRAS_CH_MAX];
+	unsigned int nread, i;
+	unsigned int offset =
+		cras_rstream_dev_offset(rstream, dev_stream->dev_id);
+	uint64_t start = cost_clock_ns();
+
+	shm = cras_rstream_shm(rstream);
+	stream_samples = cras_shm_get_writeable_frames(
+		shm, cras_rstream_get_cb_threshold(rstream),
+		&rstream->audio_area->frames);
+	if (offset >= rstream->audio_area->frames)
+		return 0;
 
+	nread = MIN(area->frames, rstream->audio_area->frames - offset);
+	for (i = 0; i < area->num_channels; i++)
+		channels[i] = (float *)area->channels[i].buf;
+	if (dsp_util_interleave(channels,
+				stream_samples +
+					offset * cras_get_format_bytes(
+							 &rstream->format),
+				area->num_channels, rstream->format.format,
+				nread))
+		return 0;
+
+	ATLOG(atlog, AUDIO_THREAD_CAPTURE_WRITE, rstream->stream_id, nread,
+	      cras_shm_frames_written(shm));
+	cras_rstream_dev_offset_update(rstream, nread, dev_stream->dev_id);
+	dev_stream->mix_ns += cost_clock_ns() - start;
 	return nread;
 }
 
@@ -465,11 +1252,10 @@ static void check_next_wake_time(struct dev_stream *dev_stream)
 	struct cras_rstream *rstream = dev_stream->stream;
 	struct timespec now;
 
-	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	cras_virtual_clock_gettime(&now);
 	if (timespec_after(&now, &rstream->next_cb_ts)) {
-		rstream->next_cb_ts = now;
-		add_timespecs(&rstream->next_cb_ts,
-			      &rstream->sleep_interval_ts);
+		add_timespecs(&now, &rstream->sleep_interval_ts);
+		cras_wake_heap_set_next_cb_ts(rstream, &now);
 		ATLOG(atlog, AUDIO_THREAD_STREAM_RESCHEDULE, rstream->stream_id,
 		      rstream->next_cb_ts.tv_sec, rstream->next_cb_ts.tv_nsec);
 		cras_server_metrics_missed_cb_event(rstream);
@@ -479,6 +1265,7 @@ static void check_next_wake_time(struct dev_stream *dev_stream)
 void dev_stream_update_next_wake_time(struct dev_stream *dev_stream)
 {
 	struct cras_rstream *rstream = dev_stream->stream;
+	struct timespec next_cb_ts;
 
 	/*
 	 * The empty next_cb_ts means it is the first time update for input stream.
@@ -486,13 +1273,15 @@ void dev_stream_update_next_wake_time(struct dev_stream *dev_stream)
 	 */
 	if (rstream->direction == CRAS_STREAM_INPUT &&
 	    !timespec_is_nonzero(&rstream->next_cb_ts)) {
-		clock_gettime(CLOCK_MONOTONIC_RAW, &rstream->next_cb_ts);
-		add_timespecs(&rstream->next_cb_ts,
-			      &rstream->sleep_interval_ts);
+		cras_virtual_clock_gettime(&next_cb_ts);
+		add_timespecs(&next_cb_ts, &rstream->sleep_interval_ts);
+		cras_wake_heap_set_next_cb_ts(rstream, &next_cb_ts);
 		return;
 	}
 	/* Update next callback time according to perfect schedule. */
-	add_timespecs(&rstream->next_cb_ts, &rstream->sleep_interval_ts);
+	next_cb_ts = rstream->next_cb_ts;
+	add_timespecs(&next_cb_ts, &rstream->sleep_interval_ts);
+	cras_wake_heap_set_next_cb_ts(rstream, &next_cb_ts);
 	/* Reset schedule if the schedule is missed. */
 	check_next_wake_time(dev_stream);
 }
@@ -507,7 +1296,7 @@ static int late_enough_for_capture_callback(struct dev_stream *dev_stream)
 {
 	struct timespec now;
 	struct cras_rstream *rstream = dev_stream->stream;
-	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	cras_virtual_clock_gettime(&now);
 	add_timespecs(&now, &capture_callback_fuzz_ts);
 	return timespec_after(&now, &rstream->next_cb_ts);
 }
@@ -555,10 +1344,26 @@ int dev_stream_capture_update_rstream(struct dev_stream *dev_stream)
 	return 0;
 }
 
+/* Fills a cras_timespec with tstamp, or with the time of the audio thread
+ * clock if tstamp is NULL or zero. */
+static void get_cras_timestamp(const struct timespec *tstamp,
+			       struct cras_timespec *ts)
+{
+	struct timespec now;
+
+	if (tstamp && timespec_is_nonzero(tstamp))
+		now = *tstamp;
+	else
+		cras_virtual_clock_gettime(&now);
+	ts->tv_sec = now.tv_sec;
+	ts->tv_nsec = now.tv_nsec;
+}
+
 void cras_set_playback_timestamp(size_t frame_rate, size_t frames,
+				 const struct timespec *tstamp,
 				 struct cras_timespec *ts)
 {
-	cras_clock_gettime(CLOCK_MONOTONIC_RAW, ts);
+	get_cras_timestamp(tstamp, ts);
 
 	/* For playback, want now + samples left to be played.
 	 * ts = time next written sample will be played to DAC,
@@ -571,11 +1376,12 @@ void cras_set_playback_timestamp(size_t frame_rate, size_t frames,
 }
 
 void cras_set_capture_timestamp(size_t frame_rate, size_t frames,
+				const struct timespec *tstamp,
 				struct cras_timespec *ts)
 {
 	long tmp;
 
-	cras_clock_gettime(CLOCK_MONOTONIC_RAW, ts);
+	get_cras_timestamp(tstamp, ts);
 
 	/* For capture, now - samples left to be read.
 	 * ts = time next sample to be read was captured at ADC.
@@ -595,10 +1401,12 @@ void cras_set_capture_timestamp(size_t frame_rate, size_t frames,
 }
 
 void dev_stream_set_delay(const struct dev_stream *dev_stream,
-			  unsigned int delay_frames)
+			  unsigned int delay_frames,
+			  const struct timespec *delay_tstamp)
 {
 	struct cras_rstream *rstream = dev_stream->stream;
 	struct cras_audio_shm *shm;
+	struct cras_apm *apm;
 	unsigned int stream_frames;
 
 	if (rstream->direction == CRAS_STREAM_OUTPUT) {
@@ -608,18 +1416,58 @@ void dev_stream_set_delay(const struct dev_stream *dev_stream,
 		cras_set_playback_timestamp(rstream->format.frame_rate,
 					    stream_frames +
 						    cras_shm_get_frames(shm),
-					    &shm->header->ts);
+					    delay_tstamp, &shm->header->ts);
 	} else {
 		shm = cras_rstream_shm(rstream);
+		/* Frames held in APM were captured before the ones still
+		 * in the device. */
+		apm = cras_apm_list_get_active_apm(
+			rstream,
+			cras_rstream_dev_ptr(rstream, dev_stream->dev_id));
+		if (apm)
+			delay_frames += cras_apm_list_get_delay_frames(apm);
 		stream_frames = cras_fmt_conv_in_frames_to_out(dev_stream->conv,
 							       delay_frames);
 		if (cras_shm_frames_written(shm) == 0)
 			cras_set_capture_timestamp(rstream->format.frame_rate,
-						   stream_frames,
+						   stream_frames, delay_tstamp,
 						   &shm->header->ts);
 	}
 }
 
+void dev_stream_set_telemetry(const struct dev_stream *dev_stream,
+			      unsigned int dev_delay, unsigned int dsp_delay,
+			      double rate_ratio, unsigned int num_underruns,
+			      const struct ewma_power *dev_ewma)
+{
+	struct cras_rstream *rstream = dev_stream->stream;
+	struct cras_audio_shm *shm = cras_rstream_shm(rstream);
+	struct cras_audio_shm_telemetry telemetry;
+	size_t src_delay;
+
+	/* The converter runs at the stream rate for playback and at the
+	 * device rate for capture. */
+	src_delay = cras_fmt_conv_get_delay(dev_stream->conv);
+	if (rstream->direction != CRAS_STREAM_OUTPUT)
+		src_delay = cras_fmt_conv_in_frames_to_out(dev_stream->conv,
+							   src_delay);
+
+	memset(&telemetry, 0, sizeof(telemetry));
+	telemetry.dev_delay_frames = dev_delay;
+	telemetry.dsp_delay_frames = dsp_delay;
+	telemetry.src_delay_frames = src_delay;
+	telemetry.dev_rate = dev_stream->dev_rate;
+	telemetry.rate_ratio = rate_ratio;
+	telemetry.num_overruns = cras_shm_num_overruns(shm);
+	telemetry.num_underruns = num_underruns;
+	get_cras_timestamp(NULL, &telemetry.ts);
+	telemetry.stream_power = ewma_power_get(&rstream->ewma);
+	telemetry.stream_peak = ewma_power_get_peak(&rstream->ewma);
+	telemetry.dev_power = ewma_power_get(dev_ewma);
+	telemetry.dev_peak = ewma_power_get_peak(dev_ewma);
+	cras_shm_set_telemetry(shm, &telemetry);
+}
+
 int dev_stream_request_playback_samples(struct dev_stream *dev_stream,
 					const struct timespec *now)
 {
@@ -638,6 +1486,10 @@ int dev_stream_poll_stream_fd(const struct dev_stream *dev_stream)
 {
 	const struct cras_rstream *stream = dev_stream->stream;
 
+	/* Replies through the shm leave nothing on the fd. */
+	if (cras_rstream_uses_shm_wake(stream))
+		return -1;
+
 	/* For streams which rely on dev level timing, we should
 	 * let client response wake audio thread up. */
 	if (stream_uses_input(stream) && (stream->flags & USE_DEV_TIMING) &&
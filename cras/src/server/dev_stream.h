@@ -12,6 +12,7 @@
 #include <stdint.h>
 #include <sys/time.h>
 
+#include "cras_overload.h"
 #include "cras_types.h"
 #include "cras_rstream.h"
 
@@ -27,12 +28,41 @@ struct cras_iodev;
  *    conv - Sample rate or format converter.
  *    conv_buffer - The buffer for converter if needed.
  *    conv_buffer_size_frames - Size of conv_buffer in frames.
+ *    conv_area_channels - Number of channels conv_area has room for.
+ *    mix_buffer - Per stream buffer holding frames rendered in the device
+ *                 format when streams are mixed in parallel.
+ *    mix_buffer_size_frames - Size of mix_buffer in frames.
+ *    mix_silent - Set when the frames last rendered to mix_buffer are all
+ *                 silent, so they don't need to be mixed.
+ *    exclusive - Set for an EXCLUSIVE or PASSTHROUGH stream, whose frames are
+ *                copied to the device unchanged.
  *    dev_rate - Sampling rate of device. This is set when dev_stream is
  *               created.
+ *    resample_rate - The rate the linear resampler converts dev_rate to, 0
+ *                    until dev_stream_set_dev_rate first sets it.
  *    is_running - For input stream, it should be set to true after it is added
  *                 into device. For output stream, it should be set to true
  *                 just before its first fetch to avoid affecting other existing
  *                 streams.
+ *    paused - Set while the stream is paused on this device. It doesn't run
+ *             until resumed.
+ *    dev_buf_slot - Slot of the stream in the buf_state of the device, -1 if
+ *                   the stream isn't in it.
+ *    ramp_frames - Length of the gain changes of an output stream, 0 to
+ *                  apply volume, mute and draining right away.
+ *    ramp_left - Frames left in the current gain change, 0 when not fading.
+ *    ramp_scaler - Gain applied to the next frame mixed.
+ *    ramp_increment - Change of ramp_scaler every frame while fading.
+ *    ramp_target - Gain the current change ends at.
+ *    convert_ns - Time spent converting the stream on this device.
+ *    mix_ns - Time spent mixing or copying the stream on this device.
+ *    scheduled - Set until an output stream with a scheduled start is
+ *                placed on the timeline of the device.
+ *    lead_frames - Frames of the device left to play before the first frame
+ *                  of a scheduled stream.
+ *    src_quality - Quality the sample rate converter of the stream runs at.
+ *    grouped - Set while an output stream is mixed by a dev_stream_group in
+ *              the current write instead of through its own converter.
  */
 struct dev_stream {
 	unsigned int dev_id;
@@ -41,9 +71,64 @@ struct dev_stream {
 	struct byte_buffer *conv_buffer;
 	struct cras_audio_area *conv_area;
 	unsigned int conv_buffer_size_frames;
+	unsigned int conv_area_channels;
+	uint8_t *mix_buffer;
+	unsigned int mix_buffer_size_frames;
+	int mix_silent;
+	int exclusive;
 	size_t dev_rate;
+	double resample_rate;
 	struct dev_stream *prev, *next;
 	int is_running;
+	int paused;
+	int dev_buf_slot;
+	unsigned int ramp_frames;
+	unsigned int ramp_left;
+	float ramp_scaler;
+	float ramp_increment;
+	float ramp_target;
+	uint64_t convert_ns;
+	uint64_t mix_ns;
+	int scheduled;
+	unsigned int lead_frames;
+	enum CRAS_SRC_QUALITY src_quality;
+	int grouped;
+};
+
+/* Most streams a dev_stream_group mixes in a write. */
+#define DEV_STREAM_GROUP_MAX_MEMBERS 16
+
+/*
+ * Output streams of a device that have the same format and converter
+ * settings. They are summed in their own format and converted to the device
+ * format once, so converting costs per distinct format instead of per stream.
+ * Members:
+ *    fmt - The format of the streams.
+ *    src_quality - Quality of the sample rate converter.
+ *    resample_rate - The rate the linear resampler converts the device rate
+ *                    to, 0 if it was never set.
+ *    conv - Converter from fmt to the device format.
+ *    mix_buffer - Frames of the streams summed in fmt.
+ *    mix_buffer_size_frames - Size of mix_buffer in frames.
+ *    conv_buffer - Summed frames converted to the device format.
+ *    conv_buffer_size_frames - Size of conv_buffer in frames.
+ *    members - The streams mixed by the group in the current write.
+ *    num_members - Number of streams in members.
+ *    idle_writes - Writes in a row the group had too few members to mix.
+ */
+struct dev_stream_group {
+	struct cras_audio_format fmt;
+	enum CRAS_SRC_QUALITY src_quality;
+	double resample_rate;
+	struct cras_fmt_conv *conv;
+	uint8_t *mix_buffer;
+	unsigned int mix_buffer_size_frames;
+	uint8_t *conv_buffer;
+	unsigned int conv_buffer_size_frames;
+	struct dev_stream *members[DEV_STREAM_GROUP_MAX_MEMBERS];
+	unsigned int num_members;
+	unsigned int idle_writes;
+	struct dev_stream_group *prev, *next;
 };
 
 struct dev_stream *dev_stream_create(struct cras_rstream *stream,
@@ -52,11 +137,29 @@ struct dev_stream *dev_stream_create(struct cras_rstream *stream,
 				     void *dev_ptr, struct timespec *cb_ts);
 void dev_stream_destroy(struct dev_stream *dev_stream);
 
+/* Frees the destroyed dev_streams the calling thread keeps for reuse. The
+ * cache of a thread is also freed when it exits. */
+void dev_stream_free_cached();
+
+/* Pauses or resumes a stream on its device, see the paused member. */
+void dev_stream_set_paused(struct dev_stream *dev_stream, int paused);
+
+/*
+ * Gets what the stream of dev_stream cost since it started, counting the
+ * memory held on this device only. Called in audio thread.
+ * Args:
+ *    dev_stream - The stream on a device.
+ *    cost - Filled with the cost.
+ */
+void dev_stream_get_cost(const struct dev_stream *dev_stream,
+			 struct cras_rstream_cost *cost);
+
 /*
  * Update the estimated sample rate of the device. For multiple active
  * devices case, the linear resampler will be configured by the estimated
  * rate ration of the master device and the current active device the
- * rstream attaches to.
+ * rstream attaches to. Changes of the resample rate below the noise of the
+ * estimate are not applied.
  *
  * Args:
  *    dev_stream - The structure holding the stream.
@@ -66,10 +169,47 @@ void dev_stream_destroy(struct dev_stream *dev_stream);
  *        master device.
  *    coarse_rate_adjust - The flag to indicate the direction device
  *        sample rate should adjust to.
+ *    catch_up - The fraction by which input frames are consumed faster than
+ *        the device produces them, to drain a capture backlog. 0 to keep in
+ *        step with the device.
  */
 void dev_stream_set_dev_rate(struct dev_stream *dev_stream,
 			     unsigned int dev_rate, double dev_rate_ratio,
-			     double master_rate_ratio, int coarse_rate_adjust);
+			     double master_rate_ratio, int coarse_rate_adjust,
+			     double catch_up);
+
+/*
+ * Makes the gain of an output stream glide instead of jump. Changes of the
+ * stream volume or mute take ramp_frames frames, and the frames left when
+ * the stream drains are faded out. The gain is applied while the stream is
+ * mixed, so it only affects this stream and costs no extra pass over the
+ * device buffer.
+ * Args:
+ *    dev_stream - The struct holding the stream to fade.
+ *    ramp_frames - The length of the gain changes in device frames.
+ *    fade_in - Non-zero to also fade the stream in from silence.
+ */
+void dev_stream_set_ramp(struct dev_stream *dev_stream,
+			 unsigned int ramp_frames, int fade_in);
+
+/*
+ * Fades an output stream in from silence, once, without changing how its
+ * later gain changes are ramped.
+ * Args:
+ *    dev_stream - The struct holding the stream to fade in.
+ *    frames - The length of the fade in device frames.
+ */
+void dev_stream_fade_in(struct dev_stream *dev_stream, unsigned int frames);
+
+/*
+ * Picks the sample rate converter of the stream for the overload level of
+ * its audio thread. Does nothing if the quality doesn't change.
+ * Args:
+ *    dev_stream - The struct holding the stream.
+ *    level - The processing level of the audio thread.
+ */
+void dev_stream_set_overload_level(struct dev_stream *dev_stream,
+				   enum CRAS_OVERLOAD_LEVEL level);
 
 /*
  * Renders count frames from shm into dst.  Updates count if anything is
@@ -84,6 +224,91 @@ int dev_stream_mix(struct dev_stream *dev_stream,
 		   const struct cras_audio_format *fmt, uint8_t *dst,
 		   unsigned int num_to_write);
 
+/*
+ * Makes the mix_buffer of a stream hold frames frames of the device format,
+ * so rendering it on a wake doesn't allocate. Called when the stream is added
+ * to a device whose streams may be rendered on the mix pool.
+ * Args:
+ *    dev_stream - The struct holding the stream.
+ *    fmt - The format of the audio device.
+ *    frames - The most frames rendered at once, the device buffer size.
+ * Returns:
+ *    0 on success, or -ENOMEM.
+ */
+int dev_stream_reserve_mix_buffer(struct dev_stream *dev_stream,
+				  const struct cras_audio_format *fmt,
+				  unsigned int frames);
+
+/*
+ * Renders up to num_to_write frames from shm into the stream's own
+ * mix_buffer, converted to the device format with the stream volume and mute
+ * applied. The result can be summed into the device buffer later, unless
+ * mix_silent says it is all silent. Doesn't touch any state shared with
+ * other streams so streams of the same device can be rendered concurrently.
+ * Args:
+ *    dev_stream - The struct holding the stream to render.
+ *    format - The format of the audio device.
+ *    num_to_write - The maximum number of frames to render, no more than
+ *        what dev_stream_reserve_mix_buffer() made room for is rendered.
+ * Returns:
+ *    The number of frames rendered into mix_buffer, or negative error code.
+ */
+int dev_stream_render(struct dev_stream *dev_stream,
+		      const struct cras_audio_format *fmt,
+		      unsigned int num_to_write);
+
+/*
+ * Returns non-zero if the output stream can be mixed by a dev_stream_group.
+ * That needs a converter and nothing specific to the stream between the
+ * converter and the device: no exclusive copy, no taps of the converted
+ * frames, no scheduled start and no fade out on drain. The stream must also
+ * play on this device only, as the group moves its offset.
+ */
+int dev_stream_can_group(const struct dev_stream *dev_stream);
+
+/* Returns non-zero if streams a and b are converted the same way, so they
+ * can share a converter. */
+int dev_stream_convert_alike(const struct dev_stream *a,
+			     const struct dev_stream *b);
+
+/* Returns non-zero if dev_stream converts the way the streams of group do. */
+int dev_stream_group_matches(const struct dev_stream_group *group,
+			     const struct dev_stream *dev_stream);
+
+/*
+ * Creates a group for streams converting like dev_stream, with no members.
+ * Args:
+ *    dev_stream - A stream the group will mix.
+ *    dev_fmt - The format of the device.
+ *    max_frames - The most device frames mixed in a write.
+ * Returns:
+ *    The new group, or NULL on error.
+ */
+struct dev_stream_group *
+dev_stream_group_create(const struct dev_stream *dev_stream,
+			const struct cras_audio_format *dev_fmt,
+			unsigned int max_frames);
+void dev_stream_group_destroy(struct dev_stream_group *group);
+
+/*
+ * Sums the frames of the members of group in their own format, applying the
+ * volume, mute and ramp of each, converts the sum once and mixes it into
+ * dst. The members must all be at the same offset of the device. They all
+ * read the same number of frames from shm and write the same number of
+ * device frames.
+ * Args:
+ *    group - The group to mix.
+ *    fmt - The format of the audio device.
+ *    dst - The destination buffer for mixing.
+ *    num_to_write - The maximum number of frames to write.
+ * Returns:
+ *    The number of frames written for each member, or negative error code if
+ *    a member can't be read, in which case nothing is mixed.
+ */
+int dev_stream_group_mix(struct dev_stream_group *group,
+			 const struct cras_audio_format *fmt, uint8_t *dst,
+			 unsigned int num_to_write);
+
 /*
  * Reads froms from the source into the dev_stream.
  * Args:
@@ -97,6 +322,45 @@ unsigned int dev_stream_capture(struct dev_stream *dev_stream,
 				unsigned int area_offset,
 				float software_gain_scaler);
 
+/*
+ * Like dev_stream_capture() for frames that are already converted to the
+ * sample format and rate of the stream, such as the frames input_data
+ * converts once for several streams.
+ * Args:
+ *    dev_stream - The struct holding the stream to copy to.
+ *    area - The area to copy audio from.
+ *    area_offset - The offset at which to start reading from area.
+ *    software_gain_scaler - The software gain scaler.
+ * Returns:
+ *    The number of frames copied from area.
+ */
+unsigned int dev_stream_capture_converted(struct dev_stream *dev_stream,
+					  const struct cras_audio_area *area,
+					  unsigned int area_offset,
+					  float software_gain_scaler);
+
+/*
+ * Returns non-zero if the stream can take the frames of its input, which are
+ * already post processed, as planar floats interleaved right into its shm.
+ * This holds when the stream reads the post processing format as is at
+ * unity gain, from this device only.
+ */
+int dev_stream_can_capture_planar(const struct dev_stream *dev_stream,
+				  float software_gain_scaler);
+
+/*
+ * Interleaves planar float frames, as input_data_get_planar_for_stream()
+ * hands them out, into the stream shm. Only for streams that
+ * dev_stream_can_capture_planar() allows.
+ * Args:
+ *    dev_stream - The struct holding the stream to copy to.
+ *    area - The area of float channels to copy audio from.
+ * Returns:
+ *    The number of frames copied from area.
+ */
+unsigned int dev_stream_capture_planar(struct dev_stream *dev_stream,
+				       const struct cras_audio_area *area);
+
 /* Returns the number of iodevs this stream has attached to. */
 int dev_stream_attached_devs(const struct dev_stream *dev_stream);
 
@@ -134,12 +398,16 @@ int dev_stream_capture_update_rstream(struct dev_stream *dev_stream);
 /* Updates the read buffer pointers for the stream. */
 int dev_stream_playback_update_rstream(struct dev_stream *dev_stream);
 
-/* Fill ts with the time the playback sample will be played. */
+/* Fill ts with the time the playback sample will be played, frames after
+ * tstamp. A NULL or zero tstamp means now. */
 void cras_set_playback_timestamp(size_t frame_rate, size_t frames,
+				 const struct timespec *tstamp,
 				 struct cras_timespec *ts);
 
-/* Fill ts with the time the capture sample was recorded. */
+/* Fill ts with the time the capture sample was recorded, frames before
+ * tstamp. A NULL or zero tstamp means now. */
 void cras_set_capture_timestamp(size_t frame_rate, size_t frames,
+				const struct timespec *tstamp,
 				struct cras_timespec *ts);
 
 /* Fill shm ts with the time the playback sample will be played or the capture
@@ -147,9 +415,26 @@ void cras_set_capture_timestamp(size_t frame_rate, size_t frames,
  * Args:
  *    delay_frames - The delay reproted by the device, in frames at the device's
  *      sample rate.
+ *    delay_tstamp - When the device measured delay_frames, zero for now.
  */
 void dev_stream_set_delay(const struct dev_stream *dev_stream,
-			  unsigned int delay_frames);
+			  unsigned int delay_frames,
+			  const struct timespec *delay_tstamp);
+
+/* Publishes the timing of the device and the stream converter, and the
+ * levels of the stream and the device, to the client through the shm
+ * telemetry.
+ * Args:
+ *    dev_delay - The delay of the device hardware, in device frames.
+ *    dsp_delay - The delay of the device DSP pipeline, in device frames.
+ *    rate_ratio - The estimated rate of the device over its nominal rate.
+ *    num_underruns - The underruns of the device so far.
+ *    dev_ewma - The power meter of the device.
+ */
+void dev_stream_set_telemetry(const struct dev_stream *dev_stream,
+			      unsigned int dev_delay, unsigned int dsp_delay,
+			      double rate_ratio, unsigned int num_underruns,
+			      const struct ewma_power *dev_ewma);
 
 /* Ask the client for cb_threshold samples of audio to play. */
 int dev_stream_request_playback_samples(struct dev_stream *dev_stream,
@@ -192,6 +477,11 @@ static inline void dev_stream_set_running(struct dev_stream *dev_stream)
 	dev_stream->is_running = 1;
 }
 
+static inline void dev_stream_clear_running(struct dev_stream *dev_stream)
+{
+	dev_stream->is_running = 0;
+}
+
 static inline const struct timespec *
 dev_stream_next_cb_ts(const struct dev_stream *dev_stream)
 {
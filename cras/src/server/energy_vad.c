@@ -0,0 +1,70 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <sys/param.h>
+
+#include "energy_vad.h"
+
+/* Voice must be this many times above the noise floor, 6 dB. */
+#define VAD_SNR 4.0f
+/* Power under which nothing counts as voice, -60 dBFS. */
+#define VAD_MIN_POWER 1.0e-6f
+/* How long voice is held after the power falls back, in ms. */
+#define VAD_HANGOVER_MS 300
+/* How fast the noise floor rises toward louder power, per second. */
+#define VAD_FLOOR_RISE 0.1f
+
+void energy_vad_init(struct energy_vad *vad, unsigned int rate)
+{
+	vad->active = true;
+	vad->noise_floor = 0.0f;
+	vad->rate = rate ?: 1;
+	vad->hangover_frames = vad->rate * VAD_HANGOVER_MS / 1000;
+	vad->quiet_frames = 0;
+	vad->num_transitions = 0;
+}
+
+/* Moves the noise floor toward power, down at once and up slowly. */
+static void update_noise_floor(struct energy_vad *vad, float power,
+			       unsigned int frames)
+{
+	float rise;
+
+	if (vad->noise_floor == 0.0f || power < vad->noise_floor) {
+		vad->noise_floor = power;
+		return;
+	}
+	rise = MIN(1.0f, VAD_FLOOR_RISE * frames / vad->rate);
+	vad->noise_floor += (power - vad->noise_floor) * rise;
+}
+
+bool energy_vad_update(struct energy_vad *vad, const struct ewma_power *ewma,
+		       unsigned int frames)
+{
+	bool was_active = vad->active;
+	float power;
+
+	if (!ewma->enabled) {
+		vad->active = true;
+	} else {
+		power = ewma_power_get(ewma);
+		update_noise_floor(vad, power, frames);
+		if (power > MAX(vad->noise_floor * VAD_SNR, VAD_MIN_POWER)) {
+			vad->quiet_frames = 0;
+			vad->active = true;
+		} else {
+			vad->quiet_frames =
+				MIN(vad->quiet_frames + frames,
+				    vad->hangover_frames);
+			if (vad->quiet_frames >= vad->hangover_frames)
+				vad->active = false;
+		}
+	}
+
+	if (vad->active == was_active)
+		return false;
+	vad->num_transitions++;
+	return true;
+}
@@ -0,0 +1,66 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef ENERGY_VAD_H_
+#define ENERGY_VAD_H_
+
+#include <stdbool.h>
+
+#include "ewma_power.h"
+
+/*
+ * A voice activity detector cheap enough to run on every capture buffer.
+ * It compares the power metered by an ewma_power against a noise floor
+ * that drops at once to quieter power and creeps up slowly under steady
+ * noise. Voice is detected when the power is well above the floor, and
+ * held for a hangover period after it falls back so pauses between words
+ * don't end it.
+ * Members:
+ *    active - True while voice is detected.
+ *    noise_floor - Tracked power of the background noise, 0 until the first
+ *        power is seen.
+ *    rate - Frame rate of the metered audio.
+ *    hangover_frames - Frames of quiet after which voice ends.
+ *    quiet_frames - Frames seen since the power was last above threshold.
+ *    num_transitions - Times active has changed.
+ */
+struct energy_vad {
+	bool active;
+	float noise_floor;
+	unsigned int rate;
+	unsigned int hangover_frames;
+	unsigned int quiet_frames;
+	unsigned int num_transitions;
+};
+
+/*
+ * Initializes the detector. It starts active, so nothing is held back
+ * before the noise floor has been learnt.
+ * Args:
+ *    vad - The detector to initialize.
+ *    rate - The frame rate of the audio metered.
+ */
+void energy_vad_init(struct energy_vad *vad, unsigned int rate);
+
+/*
+ * Updates the detector with the power of the latest buffer.
+ * Args:
+ *    vad - The detector.
+ *    ewma - The power meter the buffer was fed to. If it is disabled the
+ *        detector stays active.
+ *    frames - Length of the buffer in frames.
+ * Returns:
+ *    True if active changed.
+ */
+bool energy_vad_update(struct energy_vad *vad, const struct ewma_power *ewma,
+		       unsigned int frames);
+
+/* Returns true while voice is detected. */
+static inline bool energy_vad_active(const struct energy_vad *vad)
+{
+	return vad->active;
+}
+
+#endif /* ENERGY_VAD_H_ */
@@ -3,6 +3,8 @@
  * found in the LICENSE file.
  */
 
+#include <string.h>
+
 #include "ewma_power.h"
 #include "math.h"
 
@@ -18,64 +20,129 @@
  */
 const static float smooth_factor = 0.095;
 
+/* Reads one sample as a float in [-1, 1). Samples of the integer formats
+ * are first moved to the top bits of an int32_t so they share one scale. */
+static inline float get_sample(const struct ewma_power *ewma, const uint8_t *p)
+{
+	int16_t s16;
+	int32_t s32;
+	float f;
+
+	switch (ewma->format) {
+	case SND_PCM_FORMAT_S16_LE:
+		memcpy(&s16, p, sizeof(s16));
+		return s16 / 32768.0f;
+	case SND_PCM_FORMAT_FLOAT_LE:
+		memcpy(&f, p, sizeof(f));
+		return f;
+	case SND_PCM_FORMAT_S24_LE:
+		memcpy(&s32, p, sizeof(s32));
+		s32 = (int32_t)((uint32_t)s32 << 8);
+		break;
+	case SND_PCM_FORMAT_S24_3LE:
+		s32 = (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 |
+				(uint32_t)p[2] << 24);
+		break;
+	default:
+		memcpy(&s32, p, sizeof(s32));
+		break;
+	}
+	return s32 / 2147483648.0f;
+}
+
+/* Folds the power of one frame into the moving average. */
+static void update_power(struct ewma_power *ewma, float power)
+{
+	if (!ewma->power_set) {
+		ewma->power = power;
+		ewma->power_set = 1;
+	} else {
+		ewma->power = smooth_factor * power +
+			      (1 - smooth_factor) * ewma->power;
+	}
+}
+
 void ewma_power_disable(struct ewma_power *ewma)
 {
 	ewma->enabled = 0;
 }
 
-void ewma_power_init(struct ewma_power *ewma, unsigned int rate)
+void ewma_power_init(struct ewma_power *ewma, snd_pcm_format_t format,
+		     unsigned int rate)
 {
-	ewma->enabled = 1;
+	switch (format) {
+	case SND_PCM_FORMAT_S16_LE:
+	case SND_PCM_FORMAT_S24_LE:
+	case SND_PCM_FORMAT_S24_3LE:
+	case SND_PCM_FORMAT_S32_LE:
+	case SND_PCM_FORMAT_FLOAT_LE:
+		ewma->enabled = 1;
+		break;
+	default:
+		ewma->enabled = 0;
+		break;
+	}
 	ewma->power_set = 0;
+	ewma->power = 0.0f;
+	ewma->peak = 0.0f;
+	ewma->format = format;
+	ewma->sample_bytes = snd_pcm_format_physical_width(format) / 8;
 	ewma->step_fr = rate / EWMA_SAMPLE_RATE;
+	if (ewma->step_fr == 0)
+		ewma->step_fr = 1;
 }
 
-void ewma_power_calculate(struct ewma_power *ewma, const int16_t *buf,
+void ewma_power_calculate(struct ewma_power *ewma, const uint8_t *buf,
 			  unsigned int channels, unsigned int size)
 {
-	int i, ch;
-	float power, f;
+	unsigned int i, ch;
+	const unsigned int frame_bytes = ewma->sample_bytes * channels;
+	float power, f, peak = 0.0f;
+	float scale;
 
-	if (!ewma->enabled)
+	if (!ewma->enabled || channels == 0)
 		return;
-	for (i = 0; i < size; i += ewma->step_fr * channels) {
+	scale = 1.0f / channels;
+	for (i = 0; i < size; i += ewma->step_fr) {
+		const uint8_t *frame = buf + i * frame_bytes;
+
 		power = 0.0f;
 		for (ch = 0; ch < channels; ch++) {
-			f = buf[i + ch] / 32768.0f;
-			power += f * f / channels;
-		}
-		if (!ewma->power_set) {
-			ewma->power = power;
-			ewma->power_set = 1;
-		} else {
-			ewma->power = smooth_factor * power +
-				      (1 - smooth_factor) * ewma->power;
+			f = get_sample(ewma, frame + ch * ewma->sample_bytes);
+			power += f * f;
+			peak = fmaxf(peak, fabsf(f));
 		}
+		update_power(ewma, power * scale);
 	}
+	if (size)
+		ewma->peak = peak;
 }
 
-void ewma_power_calculate_area(struct ewma_power *ewma, const int16_t *buf,
+void ewma_power_calculate_area(struct ewma_power *ewma, const uint8_t *buf,
 			       struct cras_audio_area *area, unsigned int size)
 {
-	int i, ch;
-	float power, f;
+	unsigned int i, ch;
+	const unsigned int frame_bytes =
+		ewma->sample_bytes * area->num_channels;
+	float power, f, peak = 0.0f;
+	float scale;
 
-	if (!ewma->enabled)
+	if (!ewma->enabled || area->num_channels == 0)
 		return;
-	for (i = 0; i < size; i += ewma->step_fr * area->num_channels) {
+	scale = 1.0f / area->num_channels;
+	for (i = 0; i < size; i += ewma->step_fr) {
+		const uint8_t *frame = buf + i * frame_bytes;
+
 		power = 0.0f;
 		for (ch = 0; ch < area->num_channels; ch++) {
 			if (area->channels[ch].ch_set == 0)
 				continue;
-			f = buf[i + ch] / 32768.0f;
-			power += f * f / area->num_channels;
-		}
-		if (!ewma->power_set) {
-			ewma->power = power;
-			ewma->power_set = 1;
-		} else {
-			ewma->power = smooth_factor * power +
-				      (1 - smooth_factor) * ewma->power;
+			f = get_sample(ewma, frame + ch * ewma->sample_bytes);
+			power += f * f;
+			peak = fmaxf(peak, fabsf(f));
 		}
+		update_power(ewma, power * scale);
 	}
+	if (size)
+		ewma->peak = peak;
 }
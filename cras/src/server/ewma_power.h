@@ -19,13 +19,20 @@
  *    enabled - Flag to enable ewma calculation. Set to false to
  *        make all calculations no-ops.
  *    power - The power value.
+ *    peak - The largest sample magnitude, in [0, 1], among the frames
+ *        sampled from the latest buffer.
  *    step_fr - How many frames to sample one for EWMA calculation.
+ *    format - The sample format of the audio data.
+ *    sample_bytes - The size in bytes of one sample of format.
  */
 struct ewma_power {
 	bool power_set;
 	bool enabled;
 	float power;
+	float peak;
 	unsigned int step_fr;
+	snd_pcm_format_t format;
+	unsigned int sample_bytes;
 };
 
 /*
@@ -34,24 +41,27 @@ struct ewma_power {
 void ewma_power_disable(struct ewma_power *ewma);
 
 /*
- * Initializes the ewma_power object.
+ * Initializes the ewma_power object. The object is left disabled if
+ * format is not one of S16_LE, S24_LE, S24_3LE or S32_LE.
  * Args:
  *    ewma - The ewma_power object to initialize.
+ *    format - The sample format of the audio data.
  *    rate - The sample rate of the audio data that the ewma object
  *        will calculate power from.
  */
-void ewma_power_init(struct ewma_power *ewma, unsigned int rate);
+void ewma_power_init(struct ewma_power *ewma, snd_pcm_format_t format,
+		     unsigned int rate);
 
 /*
  * Feeds an audio buffer to ewma_power object to calculate the
  * latest power value.
  * Args:
  *    ewma - The ewma_power object to calculate power.
- *    buf - Pointer to the audio data.
+ *    buf - Pointer to the interleaved audio data.
  *    channels - Number of channels of the audio data.
  *    size - Length in frames of the audio data.
  */
-void ewma_power_calculate(struct ewma_power *ewma, const int16_t *buf,
+void ewma_power_calculate(struct ewma_power *ewma, const uint8_t *buf,
 			  unsigned int channels, unsigned int size);
 
 /*
@@ -59,7 +69,19 @@ void ewma_power_calculate(struct ewma_power *ewma, const int16_t *buf,
  * latest power value. This is similar to ewma_power_calculate but
  * accepts cras_audio_area.
  */
-void ewma_power_calculate_area(struct ewma_power *ewma, const int16_t *buf,
+void ewma_power_calculate_area(struct ewma_power *ewma, const uint8_t *buf,
 			       struct cras_audio_area *area, unsigned int size);
 
+/* Gets the power value, 0 until the first buffer is fed. */
+static inline float ewma_power_get(const struct ewma_power *ewma)
+{
+	return ewma->enabled && ewma->power_set ? ewma->power : 0.0f;
+}
+
+/* Gets the peak of the latest buffer, 0 until the first buffer is fed. */
+static inline float ewma_power_get_peak(const struct ewma_power *ewma)
+{
+	return ewma->enabled && ewma->power_set ? ewma->peak : 0.0f;
+}
+
 #endif /* EWMA_POWER_H_ */
@@ -8,6 +8,7 @@
 #include "buffer_share.h"
 #include "cras_audio_area.h"
 #include "cras_dsp_pipeline.h"
+#include "cras_fmt_conv.h"
 #include "cras_mix.h"
 #include "cras_rstream.h"
 #include "cras_system_state.h"
@@ -15,6 +16,185 @@
 #include "input_data.h"
 #include "utlist.h"
 
+/*
+ * Frames of the input device converted once for all the streams that want
+ * them in the same sample format and rate. The converter keeps the device
+ * channels the stream reads, so streams that read the same ones share it
+ * whatever their channel counts.
+ * Members:
+ *    format - Sample format converted to.
+ *    frame_rate - Rate converted to.
+ *    src_quality - Quality of the sample rate converter.
+ *    conv - Converter from the device format.
+ *    max_conv_frames - Max frames the converter takes at once.
+ *    area - Audio area pointed at the converted frames for a stream.
+ *    buf - The converted frames.
+ *    buf_frames - Size of buf in frames.
+ *    read_frame - Frames before read_frame have been read by all streams.
+ *    write_frame - Frames after write_frame aren't written yet.
+ *    readers - Read offset of each stream, relative to read_frame.
+ *    num_readers - Number of streams in readers.
+ *    dev_offset - Number of frames of the device buffer converted, relative
+ *        to the point all streams have read to.
+ */
+struct input_data_cache {
+	snd_pcm_format_t format;
+	size_t frame_rate;
+	enum CRAS_SRC_QUALITY src_quality;
+	struct cras_fmt_conv *conv;
+	unsigned int max_conv_frames;
+	struct cras_audio_area *area;
+	uint8_t *buf;
+	unsigned int buf_frames;
+	unsigned int read_frame;
+	unsigned int write_frame;
+	struct buffer_share *readers;
+	unsigned int num_readers;
+	unsigned int dev_offset;
+	struct input_data_cache *prev, *next;
+};
+
+static void cache_destroy(struct input_data_cache *cache)
+{
+	cras_fmt_conv_destroy(&cache->conv);
+	cras_audio_area_destroy(cache->area);
+	buffer_share_destroy(cache->readers);
+	free(cache->buf);
+	free(cache);
+}
+
+static struct input_data_cache *
+cache_create(const struct cras_rstream *stream,
+	     const struct cras_audio_format *dev_fmt,
+	     unsigned int buffer_frames)
+{
+	struct input_data_cache *cache;
+	const struct cras_audio_format *ofmt;
+
+	cache = (struct input_data_cache *)calloc(1, sizeof(*cache));
+	if (!cache)
+		return NULL;
+	cache->format = stream->format.format;
+	cache->frame_rate = stream->format.frame_rate;
+	cache->src_quality = stream->src_quality;
+
+	/* Room for two device buffers of converted frames. */
+	cache->buf_frames = 2 * (cras_frames_at_rate(dev_fmt->frame_rate,
+						     buffer_frames,
+						     cache->frame_rate) +
+				 1);
+	cache->max_conv_frames = MAX(buffer_frames, cache->buf_frames);
+	if (config_format_converter(&cache->conv, CRAS_STREAM_INPUT, dev_fmt,
+				    &stream->format, cache->max_conv_frames,
+				    stream->src_quality))
+		goto error;
+
+	ofmt = cras_fmt_conv_out_format(cache->conv);
+	cache->area = cras_audio_area_create(ofmt->num_channels);
+	cache->buf = (uint8_t *)calloc(cache->buf_frames,
+				       cras_get_format_bytes(ofmt));
+	cache->readers = buffer_share_create(cache->buf_frames);
+	if (!cache->area || !cache->buf || !cache->readers)
+		goto error;
+	cras_audio_area_config_channels(cache->area, ofmt);
+	return cache;
+
+error:
+	if (cache->conv)
+		cras_fmt_conv_destroy(&cache->conv);
+	cras_audio_area_destroy(cache->area);
+	buffer_share_destroy(cache->readers);
+	free(cache->buf);
+	free(cache);
+	return NULL;
+}
+
+static struct input_data_cache *cache_for_stream(struct input_data *data,
+						 unsigned int stream_id)
+{
+	struct input_data_cache *cache;
+
+	DL_FOREACH (data->caches, cache)
+		if (buffer_share_get_data(cache->readers, stream_id))
+			return cache;
+	return NULL;
+}
+
+/* Drops the frames every reader of the cache is done with. */
+static void cache_release(struct input_data_cache *cache)
+{
+	cache->read_frame += buffer_share_get_new_write_point(cache->readers);
+	if (cache->read_frame > cache->write_frame)
+		cache->read_frame = cache->write_frame;
+}
+
+static void cache_rm_reader(struct input_data *data,
+			    struct input_data_cache *cache,
+			    unsigned int stream_id)
+{
+	buffer_share_rm_id(cache->readers, stream_id);
+	if (--cache->num_readers) {
+		cache_release(cache);
+		return;
+	}
+	DL_DELETE(data->caches, cache);
+	cache_destroy(cache);
+}
+
+/* Converts the device frames in area the cache doesn't hold yet. */
+static void cache_fill(struct input_data_cache *cache,
+		       const struct cras_audio_area *area)
+{
+	const struct cras_audio_format *ifmt, *ofmt;
+	unsigned int in_bytes, out_bytes;
+	unsigned int in_frames, written;
+
+	if (cache->dev_offset >= area->frames)
+		return;
+
+	ifmt = cras_fmt_conv_in_format(cache->conv);
+	ofmt = cras_fmt_conv_out_format(cache->conv);
+	in_bytes = cras_get_format_bytes(ifmt);
+	out_bytes = cras_get_format_bytes(ofmt);
+
+	/* Move the unread frames to the front once the tail runs short. */
+	if (cache->read_frame &&
+	    cache->buf_frames - cache->write_frame < cache->buf_frames / 2) {
+		memmove(cache->buf, cache->buf + cache->read_frame * out_bytes,
+			(cache->write_frame - cache->read_frame) * out_bytes);
+		cache->write_frame -= cache->read_frame;
+		cache->read_frame = 0;
+	}
+
+	while (cache->dev_offset < area->frames &&
+	       cache->write_frame < cache->buf_frames) {
+		in_frames = MIN(area->frames - cache->dev_offset,
+				cache->max_conv_frames);
+		written = cras_fmt_conv_convert_frames(
+			cache->conv,
+			area->channels[0].buf + cache->dev_offset * in_bytes,
+			cache->buf + cache->write_frame * out_bytes, &in_frames,
+			cache->buf_frames - cache->write_frame);
+		if (in_frames == 0)
+			break;
+		cache->dev_offset += in_frames;
+		cache->write_frame += written;
+	}
+}
+
+/* Points the cache area at the frames not read by all streams yet. */
+static struct cras_audio_area *cache_get_area(struct input_data_cache *cache)
+{
+	const struct cras_audio_format *ofmt;
+
+	ofmt = cras_fmt_conv_out_format(cache->conv);
+	cras_audio_area_config_buf_pointers(
+		cache->area, ofmt,
+		cache->buf + cache->read_frame * cras_get_format_bytes(ofmt));
+	cache->area->frames = cache->write_frame - cache->read_frame;
+	return cache->area;
+}
+
 void input_data_run(struct ext_dsp_module *ext, unsigned int nframes)
 {
 	struct input_data *data = (struct input_data *)ext;
@@ -66,6 +246,12 @@ struct input_data *input_data_create(void *dev_ptr)
 
 void input_data_destroy(struct input_data **data)
 {
+	struct input_data_cache *cache;
+
+	DL_FOREACH ((*data)->caches, cache) {
+		DL_DELETE((*data)->caches, cache);
+		cache_destroy(cache);
+	}
 	if ((*data)->fbuffer)
 		float_buffer_destroy(&(*data)->fbuffer);
 	free(*data);
@@ -75,6 +261,12 @@ void input_data_destroy(struct input_data **data)
 void input_data_set_all_streams_read(struct input_data *data,
 				     unsigned int nframes)
 {
+	struct input_data_cache *cache;
+
+	DL_FOREACH (data->caches, cache)
+		cache->dev_offset -= MIN(cache->dev_offset, nframes);
+	cras_apm_list_set_dev_read(data->dev_ptr, nframes);
+
 	if (!data->fbuffer)
 		return;
 
@@ -89,6 +281,79 @@ void input_data_set_all_streams_read(struct input_data *data,
 	float_buffer_read(data->fbuffer, nframes);
 }
 
+static int same_channels(const struct cras_audio_format *a,
+			 const struct cras_audio_format *b)
+{
+	return a->num_channels == b->num_channels &&
+	       !memcmp(a->channel_layout, b->channel_layout,
+		       sizeof(a->channel_layout));
+}
+
+void input_data_add_stream(struct input_data *data,
+			   struct cras_rstream *stream,
+			   const struct cras_audio_format *dev_fmt,
+			   unsigned int buffer_frames)
+{
+	struct input_data_cache *cache;
+	struct cras_audio_format channels;
+
+	if (stream->format.format == dev_fmt->format &&
+	    stream->format.frame_rate == dev_fmt->frame_rate)
+		return;
+	if (stream->master_dev.dev_ptr != data->dev_ptr ||
+	    cras_apm_list_get_active_apm(stream, data->dev_ptr))
+		return;
+	/* Gated streams skip frames the others read. */
+	if (stream->flags & VAD_GATED)
+		return;
+	if (cache_for_stream(data, stream->stream_id))
+		return;
+
+	channels = *dev_fmt;
+	cras_fmt_conv_capture_channels(&channels, &stream->format);
+	DL_FOREACH (data->caches, cache)
+		if (cache->format == stream->format.format &&
+		    cache->frame_rate == stream->format.frame_rate &&
+		    cache->src_quality == stream->src_quality &&
+		    same_channels(cras_fmt_conv_out_format(cache->conv),
+				  &channels))
+			break;
+	if (!cache) {
+		cache = cache_create(stream, dev_fmt, buffer_frames);
+		if (!cache)
+			return;
+		DL_APPEND(data->caches, cache);
+	}
+
+	/* Start with the frames converted after this point. */
+	buffer_share_add_id(cache->readers, stream->stream_id, cache);
+	buffer_share_offset_update(cache->readers, stream->stream_id,
+				   cache->write_frame - cache->read_frame);
+	cache->num_readers++;
+}
+
+void input_data_rm_stream(struct input_data *data,
+			  const struct cras_rstream *stream)
+{
+	struct input_data_cache *cache;
+
+	cache = cache_for_stream(data, stream->stream_id);
+	if (cache)
+		cache_rm_reader(data, cache, stream->stream_id);
+}
+
+void input_data_set_overload_level(struct input_data *data,
+				   enum CRAS_OVERLOAD_LEVEL level)
+{
+	struct input_data_cache *cache;
+
+	DL_FOREACH (data->caches, cache)
+		cras_fmt_conv_set_src_quality(
+			cache->conv, level >= CRAS_OVERLOAD_SRC ?
+					     CRAS_SRC_QUALITY_LOW_LATENCY :
+					     cache->src_quality);
+}
+
 /*
  * The logic is not trivial to return the cras_audio_area and offset for
  * a input stream to read. The buffer position and length of a bunch of
@@ -141,18 +406,55 @@ void input_data_set_all_streams_read(struct input_data *data,
  * Don't bother clip read offset in this case, because fbuffer contains
  * the deepest deinterleaved audio data ever read from idev.
  */
+/* Lets the APM of |stream| process the float frames it hasn't taken yet.
+ * Returns 0, or a negative error code if the APM failed and was removed. */
+static int process_for_stream(struct input_data *data,
+			      struct cras_rstream *stream,
+			      struct cras_apm *apm,
+			      struct buffer_share *offsets)
+{
+	int apm_processed;
+
+	apm_processed = cras_apm_list_process(
+		apm, data->fbuffer,
+		buffer_share_id_offset(offsets, stream->stream_id));
+	if (apm_processed < 0) {
+		cras_apm_list_remove_apm(stream->apm_list, apm);
+		return apm_processed;
+	}
+	buffer_share_offset_update(offsets, stream->stream_id, apm_processed);
+	return 0;
+}
+
 int input_data_get_for_stream(struct input_data *data,
 			      struct cras_rstream *stream,
 			      struct buffer_share *offsets,
 			      struct cras_audio_area **area,
 			      unsigned int *offset)
 {
-	int apm_processed;
 	struct cras_apm *apm;
+	struct input_data_cache *cache;
 	int stream_offset = buffer_share_id_offset(offsets, stream->stream_id);
 
 	apm = cras_apm_list_get_active_apm(stream, data->dev_ptr);
-	if (apm == NULL) {
+	cache = cache_for_stream(data, stream->stream_id);
+	if (cache && (apm || stream->master_dev.dev_ptr != data->dev_ptr)) {
+		cache_rm_reader(data, cache, stream->stream_id);
+		cache = NULL;
+	}
+
+	if (cache) {
+		/*
+		 * Only the first stream of the cache has frames to convert,
+		 * the others read what has been converted for it.
+		 */
+		cache_fill(cache, data->area);
+		*area = cache_get_area(cache);
+		*offset = MIN(buffer_share_id_offset(cache->readers,
+						     stream->stream_id),
+			      (*area)->frames);
+		return 1;
+	} else if (apm == NULL) {
 		/*
 		 * Case 1 and 2 from above example.
 		 */
@@ -162,14 +464,8 @@ int input_data_get_for_stream(struct input_data *data,
 		/*
 		 * Case 3 from above example.
 		 */
-		apm_processed = cras_apm_list_process(apm, data->fbuffer,
-						      stream_offset);
-		if (apm_processed < 0) {
-			cras_apm_list_remove_apm(stream->apm_list, apm);
+		if (process_for_stream(data, stream, apm, offsets))
 			return 0;
-		}
-		buffer_share_offset_update(offsets, stream->stream_id,
-					   apm_processed);
 		*area = cras_apm_list_get_processed(apm);
 		*offset = 0;
 	}
@@ -177,12 +473,52 @@ int input_data_get_for_stream(struct input_data *data,
 	return 0;
 }
 
+int input_data_get_planar_for_stream(struct input_data *data,
+				     struct cras_rstream *stream,
+				     struct buffer_share *offsets,
+				     struct cras_audio_area **area)
+{
+	struct cras_apm *apm;
+	struct input_data_cache *cache;
+
+	apm = cras_apm_list_get_active_apm(stream, data->dev_ptr);
+	if (apm == NULL || data->fbuffer == NULL)
+		return 0;
+
+	cache = cache_for_stream(data, stream->stream_id);
+	if (cache)
+		cache_rm_reader(data, cache, stream->stream_id);
+
+	/* The device frames are read again through the interleaved path
+	 * once the APM is gone. */
+	if (process_for_stream(data, stream, apm, offsets))
+		return 0;
+	*area = cras_apm_list_get_processed_planar(apm);
+	return 1;
+}
+
 int input_data_put_for_stream(struct input_data *data,
 			      struct cras_rstream *stream,
 			      struct buffer_share *offsets, unsigned int frames)
 {
 	struct cras_apm *apm =
 		cras_apm_list_get_active_apm(stream, data->dev_ptr);
+	struct input_data_cache *cache;
+
+	cache = cache_for_stream(data, stream->stream_id);
+	if (cache) {
+		buffer_share_offset_update(cache->readers, stream->stream_id,
+					   frames);
+		cache_release(cache);
+		/* Keep the stream in step with the device frames converted. */
+		buffer_share_offset_update(
+			offsets, stream->stream_id,
+			cache->dev_offset -
+				MIN(cache->dev_offset,
+				    buffer_share_id_offset(offsets,
+							   stream->stream_id)));
+		return 0;
+	}
 
 	if (apm)
 		cras_apm_list_put_processed(apm, frames);
@@ -208,3 +544,17 @@ float input_data_get_software_gain_scaler(struct input_data *data,
 
 	return idev_sw_gain_scaler * cras_rstream_get_volume_scaler(stream);
 }
+
+size_t input_data_get_mem_bytes(const struct input_data *data)
+{
+	struct input_data_cache *cache;
+	size_t bytes = 0;
+
+	if (data->fbuffer)
+		bytes += data->fbuffer->buf->max_size;
+	DL_FOREACH (data->caches, cache)
+		bytes += (size_t)cache->buf_frames *
+			 cras_get_format_bytes(
+				 cras_fmt_conv_out_format(cache->conv));
+	return bytes;
+}
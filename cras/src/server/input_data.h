@@ -7,8 +7,11 @@
 #define INPUT_DATA_H_
 
 #include "cras_dsp_pipeline.h"
+#include "cras_overload.h"
 #include "float_buffer.h"
 
+struct input_data_cache;
+
 /*
  * Structure holding the information used when a chunk of input buffer
  * is accessed by multiple streams with different properties and
@@ -18,12 +21,14 @@
  *    dev_ptr - Pointer to the associated input iodev.
  *    area - The audio area used for deinterleaved data copy.
  *    fbuffer - Floating point buffer from input device.
+ *    caches - Frames converted once for all streams of the same format.
  */
 struct input_data {
 	struct ext_dsp_module ext;
 	void *dev_ptr;
 	struct cras_audio_area *area;
 	struct float_buffer *fbuffer;
+	struct input_data_cache *caches;
 };
 
 /*
@@ -40,6 +45,34 @@ void input_data_destroy(struct input_data **data);
 void input_data_set_all_streams_read(struct input_data *data,
 				     unsigned int nframes);
 
+/*
+ * Lets |stream| read frames converted once for every stream that wants the
+ * same sample format and rate, instead of converting them itself. Only done
+ * for streams that need conversion, read from this device as their master
+ * device and have no APM or VAD gating.
+ * Args:
+ *    data - The input data of the device.
+ *    stream - The stream starting to read from the device.
+ *    dev_fmt - The format of the device.
+ *    buffer_frames - Size of the device buffer in frames.
+ */
+void input_data_add_stream(struct input_data *data,
+			   struct cras_rstream *stream,
+			   const struct cras_audio_format *dev_fmt,
+			   unsigned int buffer_frames);
+
+/* Stops |stream| reading shared converted frames, if it did. */
+void input_data_rm_stream(struct input_data *data,
+			  const struct cras_rstream *stream);
+
+/*
+ * Picks the sample rate converters of the shared converted frames for the
+ * overload level of the audio thread. The frames may be read by critical
+ * streams, so the converters go down to low latency at most.
+ */
+void input_data_set_overload_level(struct input_data *data,
+				   enum CRAS_OVERLOAD_LEVEL level);
+
 /*
  * Gets an audio area for |stream| to read data from. An input_data may be
  * accessed by multiple streams while some requires processing, the
@@ -54,6 +87,9 @@ void input_data_set_all_streams_read(struct input_data *data,
  *        read data.
  *    offset - To be filled with the samples offset in |area| that |stream|
  *        should start reading.
+ * Returns:
+ *    1 if |area| holds frames already converted to the format of |stream|,
+ *    0 if it holds frames in the device format.
  */
 int input_data_get_for_stream(struct input_data *data,
 			      struct cras_rstream *stream,
@@ -61,6 +97,26 @@ int input_data_get_for_stream(struct input_data *data,
 			      struct cras_audio_area **area,
 			      unsigned int *offset);
 
+/*
+ * Gets the APM processed frames for |stream| as the APM left them, one array
+ * of floats per channel, so they are interleaved once on the copy to the
+ * stream. Frames read are marked by input_data_put_for_stream() as usual.
+ * Args:
+ *    data - The input data to get audio area from.
+ *    stream - The stream that reads data.
+ *    offsets - Structure holding the mapping from stream to the offset value
+ *        of how many frames each stream has read into input buffer.
+ *    area - To be filled with a pointer to the planar float audio area, to
+ *        read from its start.
+ * Returns:
+ *    1 if |area| is filled, 0 if |stream| has no working APM on this device
+ *    and should read through input_data_get_for_stream().
+ */
+int input_data_get_planar_for_stream(struct input_data *data,
+				     struct cras_rstream *stream,
+				     struct buffer_share *offsets,
+				     struct cras_audio_area **area);
+
 /*
  * Marks |frames| of audio data as read by |stream|.
  * Args:
@@ -68,7 +124,8 @@ int input_data_get_for_stream(struct input_data *data,
  *    stream - The stream that has read audio data.
  *    offsets - Structure holding the mapping from stream to the offset value
  *        of how many frames each stream has read into input buffer.
- *    frames - Number of frames |stream| has read.
+ *    frames - Number of frames |stream| has read, in the format of the
+ *        area returned by input_data_get_for_stream().
  */
 int input_data_put_for_stream(struct input_data *data,
 			      struct cras_rstream *stream,
@@ -92,4 +149,8 @@ float input_data_get_software_gain_scaler(struct input_data *data,
 					  float idev_sw_gain_scaler,
 					  struct cras_rstream *stream);
 
+/* Returns the bytes of the float buffer handed to the APMs and of the shared
+ * conversions of the streams. */
+size_t input_data_get_mem_bytes(const struct input_data *data);
+
 #endif /* INPUT_DATA_H_ */
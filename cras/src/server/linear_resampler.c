@@ -3,9 +3,13 @@
  * found in the LICENSE file.
  */
 
+#include <string.h>
+
 #include "cras_audio_area.h"
+#include "cras_mix.h"
 #include "cras_util.h"
 #include "linear_resampler.h"
+#include "linear_resampler_ops.h"
 
 /* A linear resampler.
  * Members:
@@ -16,6 +20,7 @@
  *    to_times_100 - The numerator of the rate factor used for SRC.
  *    from_times_100 - The denominator of the rate factor used for SRC.
  *    f - The rate factor used for linear resample.
+ *    is_float - Non-zero if samples are float32, otherwise S16_LE.
  */
 struct linear_resampler {
 	unsigned int num_channels;
@@ -25,8 +30,35 @@ struct linear_resampler {
 	unsigned int to_times_100;
 	unsigned int from_times_100;
 	float f;
+	int is_float;
 };
 
+static const struct linear_resampler_ops *ops = &linear_resampler_ops;
+
+static const struct linear_resampler_ops *
+get_linear_resampler_ops(unsigned int cpu_flags)
+{
+#if defined HAVE_FMA
+	if (cpu_flags & CPU_X86_FMA)
+		return &linear_resampler_ops_fma;
+#endif
+#if defined HAVE_AVX2
+	if (cpu_flags & CPU_X86_AVX2)
+		return &linear_resampler_ops_avx2;
+#endif
+#if defined HAVE_AVX
+	if (cpu_flags & CPU_X86_AVX)
+		return &linear_resampler_ops_avx;
+#endif
+#if defined HAVE_SSE42
+	if (cpu_flags & CPU_X86_SSE4_2)
+		return &linear_resampler_ops_sse42;
+#endif
+
+	/* default C implementation */
+	return &linear_resampler_ops;
+}
+
 struct linear_resampler *linear_resampler_create(unsigned int num_channels,
 						 unsigned int format_bytes,
 						 float src_rate, float dst_rate)
@@ -44,6 +76,19 @@ struct linear_resampler *linear_resampler_create(unsigned int num_channels,
 	return lr;
 }
 
+struct linear_resampler *linear_resampler_create_float(unsigned int num_channels,
+						       float src_rate,
+						       float dst_rate)
+{
+	struct linear_resampler *lr;
+
+	lr = linear_resampler_create(num_channels, num_channels * sizeof(float),
+				     src_rate, dst_rate);
+	if (lr)
+		lr->is_float = 1;
+	return lr;
+}
+
 void linear_resampler_destroy(struct linear_resampler *lr)
 {
 	if (lr)
@@ -106,66 +151,97 @@ int linear_resampler_needed(struct linear_resampler *lr)
 	return lr->from_times_100 != lr->to_times_100;
 }
 
+/* Returns the input position of output frame dst_idx, relative to the first
+ * frame of the current input buffer. */
+static inline float src_pos_at(const struct linear_resampler *lr,
+			       unsigned int dst_idx)
+{
+	float src_pos = (float)(lr->dst_offset + dst_idx) / lr->f;
+
+	return src_pos > lr->src_offset ? src_pos - lr->src_offset : 0;
+}
+
+/* Counts the leading output frames, at most max_frames, whose input
+ * position is before limit, or at limit if inclusive is set. The input
+ * position only grows with the output index, so this starts from the
+ * estimate given by the rate and walks to the exact boundary. */
+static unsigned int frames_before(const struct linear_resampler *lr,
+				  float limit, int inclusive,
+				  unsigned int max_frames)
+{
+	float est = (limit + lr->src_offset) * lr->f - lr->dst_offset;
+	unsigned int n;
+
+	if (est <= 0)
+		n = 0;
+	else if (est >= max_frames)
+		n = max_frames;
+	else
+		n = (unsigned int)est;
+
+	while (n > 0 && (inclusive ? src_pos_at(lr, n - 1) > limit :
+				     src_pos_at(lr, n - 1) >= limit))
+		n--;
+	while (n < max_frames && (inclusive ? src_pos_at(lr, n) <= limit :
+					      src_pos_at(lr, n) < limit))
+		n++;
+	return n;
+}
+
+void linear_resampler_init(unsigned int cpu_flags)
+{
+	ops = get_linear_resampler_ops(cpu_flags);
+}
+
 unsigned int linear_resampler_resample(struct linear_resampler *lr,
 				       uint8_t *src, unsigned int *src_frames,
 				       uint8_t *dst, unsigned dst_frames)
 {
-	int ch;
-	unsigned int src_idx = 0;
-	unsigned int dst_idx = 0;
+	unsigned int last, num_interp, num_out, i;
 	float src_pos;
-	int16_t *in, *out;
 
 	/* Check for corner cases so that we can assume both src_idx and
-	 * dst_idx are valid with value 0 in the loop below. */
+	 * dst_idx are valid with value 0 below. */
 	if (dst_frames == 0 || *src_frames == 0) {
 		*src_frames = 0;
 		return 0;
 	}
 
-	for (dst_idx = 0; dst_idx <= dst_frames; dst_idx++) {
-		src_pos = (float)(lr->dst_offset + dst_idx) / lr->f;
-		if (src_pos > lr->src_offset)
-			src_pos -= lr->src_offset;
-		else
-			src_pos = 0;
-		src_idx = (unsigned int)src_pos;
-
-		if (src_pos > *src_frames - 1 || dst_idx >= dst_frames) {
-			if (src_pos > *src_frames - 1)
-				src_idx = *src_frames - 1;
-			/* When this loop stops, dst_idx is always at the last
-			 * used index incremented by 1. */
-			break;
-		}
-
-		in = (int16_t *)(src + src_idx * lr->format_bytes);
-		out = (int16_t *)(dst + dst_idx * lr->format_bytes);
-
-		/* Don't do linear interpolcation if src_pos falls on the
-		 * last index. */
-		if (src_idx == *src_frames - 1) {
-			for (ch = 0; ch < lr->num_channels; ch++)
-				out[ch] = in[ch];
-		} else {
-			for (ch = 0; ch < lr->num_channels; ch++) {
-				out[ch] = in[ch] +
-					  (src_pos - src_idx) *
-						  (in[lr->num_channels + ch] -
-						   in[ch]);
-			}
-		}
-	}
-
-	*src_frames = src_idx + 1;
+	/* Output frames positioned before the last input frame are
+	 * interpolated between two input frames. Those landing exactly on
+	 * the last input frame are copies of it. */
+	last = *src_frames - 1;
+	num_interp = frames_before(lr, last, 0, dst_frames);
+	num_out = frames_before(lr, last, 1, dst_frames);
+
+	/* num_interp is zero when there is a single input frame, so last - 1
+	 * is only used when valid. */
+	if (lr->is_float)
+		ops->interpolate_f32((const float *)src, (float *)dst,
+				     lr->num_channels, num_interp,
+				     lr->dst_offset, lr->f, lr->src_offset,
+				     last - 1);
+	else
+		ops->interpolate_s16((const int16_t *)src, (int16_t *)dst,
+				     lr->num_channels, num_interp,
+				     lr->dst_offset, lr->f, lr->src_offset,
+				     last - 1);
+	for (i = num_interp; i < num_out; i++)
+		memcpy(dst + i * lr->format_bytes, src + last * lr->format_bytes,
+		       lr->format_bytes);
+
+	/* Input is consumed up to the frame the next output would start
+	 * from. */
+	src_pos = num_out < dst_frames ? *src_frames : src_pos_at(lr, num_out);
+	*src_frames = src_pos > last ? last + 1 : (unsigned int)src_pos + 1;
 
 	lr->src_offset += *src_frames;
-	lr->dst_offset += dst_idx;
+	lr->dst_offset += num_out;
 	while ((lr->src_offset > lr->from_times_100) &&
 	       (lr->dst_offset > lr->to_times_100)) {
 		lr->src_offset -= lr->from_times_100;
 		lr->dst_offset -= lr->to_times_100;
 	}
 
-	return dst_idx;
+	return num_out;
 }
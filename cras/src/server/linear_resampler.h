@@ -20,6 +20,16 @@ struct linear_resampler *linear_resampler_create(unsigned int num_channels,
 						 float src_rate,
 						 float dst_rate);
 
+/* Creates a linear resampler that works on interleaved float32 samples.
+ * Args:
+ *    num_channels - The number of channels in each frames.
+ *    src_rate - The source rate to resample from.
+ *    dst_rate - The destination rate to resample to.
+ */
+struct linear_resampler *linear_resampler_create_float(unsigned int num_channels,
+						       float src_rate,
+						       float dst_rate);
+
 /* Sets the rates for the linear resampler.
  * Args:
  *    from - The rate to resample from.
@@ -36,6 +46,12 @@ unsigned int linear_resampler_out_frames_to_in(struct linear_resampler *lr,
 unsigned int linear_resampler_in_frames_to_out(struct linear_resampler *lr,
 					       unsigned int frames);
 
+/* Selects the interpolation kernels for the CPU.
+ * Args:
+ *    cpu_flags - CPU_X86_* flags reported by the server.
+ */
+void linear_resampler_init(unsigned int cpu_flags);
+
 /* Returns true if SRC is needed, otherwise return false. */
 int linear_resampler_needed(struct linear_resampler *lr);
 
@@ -0,0 +1,167 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdint.h>
+
+#include "linear_resampler_ops.h"
+
+/* function suffixes for SIMD ops */
+#ifdef OPS_SSE42
+#define OPS(a) a##_sse42
+#elif OPS_AVX
+#define OPS(a) a##_avx
+#elif OPS_AVX2
+#define OPS(a) a##_avx2
+#elif OPS_FMA
+#define OPS(a) a##_fma
+#else
+#define OPS(a) a
+#endif
+
+/* Output frames handled per pass of the kernels. */
+#define BLOCK_FRAMES 64
+
+/* Fills the input positions of frames output frames starting at dst_start,
+ * split into the index of the frame before each and the fraction toward the
+ * next one. Kept separate from the interpolation so it vectorizes. The
+ * index is clamped to max_idx in case the vector division rounds the last
+ * position past the boundary found by the caller. */
+static inline void src_positions(unsigned int frames, unsigned int dst_start,
+				 float f, float src_offset, int max_idx,
+				 int *idx, float *frac)
+{
+	unsigned int i;
+	float pos;
+
+	for (i = 0; i < frames; i++) {
+		pos = (float)(int)(dst_start + i) / f - src_offset;
+		pos = pos > 0 ? pos : 0;
+		idx[i] = (int)pos;
+		idx[i] = idx[i] < max_idx ? idx[i] : max_idx;
+		frac[i] = pos - idx[i];
+	}
+}
+
+/* The kernels below are called with a constant num_channels from the
+ * dispatchers, so the compiler unrolls the channel loop for the common
+ * layouts. */
+static inline void interpolate_s16_channels(const int16_t *in, int16_t *out,
+					    unsigned int num_channels,
+					    unsigned int frames,
+					    unsigned int dst_start, float f,
+					    float src_offset,
+					    unsigned int max_idx)
+{
+	int idx[BLOCK_FRAMES];
+	float frac[BLOCK_FRAMES];
+	const int16_t *a;
+	unsigned int i, n, ch;
+
+	while (frames) {
+		n = frames < BLOCK_FRAMES ? frames : BLOCK_FRAMES;
+		src_positions(n, dst_start, f, src_offset, max_idx, idx,
+			      frac);
+		for (i = 0; i < n; i++) {
+			a = in + idx[i] * num_channels;
+			for (ch = 0; ch < num_channels; ch++)
+				out[ch] = a[ch] + frac[i] * (a[num_channels + ch] -
+							     a[ch]);
+			out += num_channels;
+		}
+		frames -= n;
+		dst_start += n;
+	}
+}
+
+static inline void interpolate_f32_channels(const float *in, float *out,
+					    unsigned int num_channels,
+					    unsigned int frames,
+					    unsigned int dst_start, float f,
+					    float src_offset,
+					    unsigned int max_idx)
+{
+	int idx[BLOCK_FRAMES];
+	float frac[BLOCK_FRAMES];
+	const float *a;
+	unsigned int i, n, ch;
+
+	while (frames) {
+		n = frames < BLOCK_FRAMES ? frames : BLOCK_FRAMES;
+		src_positions(n, dst_start, f, src_offset, max_idx, idx,
+			      frac);
+		for (i = 0; i < n; i++) {
+			a = in + idx[i] * num_channels;
+			for (ch = 0; ch < num_channels; ch++)
+				out[ch] = a[ch] + frac[i] * (a[num_channels + ch] -
+							     a[ch]);
+			out += num_channels;
+		}
+		frames -= n;
+		dst_start += n;
+	}
+}
+
+static void interpolate_s16(const int16_t *in, int16_t *out,
+			    unsigned int num_channels, unsigned int frames,
+			    unsigned int dst_start, float f, float src_offset,
+			    unsigned int max_idx)
+{
+	switch (num_channels) {
+	case 1:
+		interpolate_s16_channels(in, out, 1, frames, dst_start, f,
+					 src_offset, max_idx);
+		break;
+	case 2:
+		interpolate_s16_channels(in, out, 2, frames, dst_start, f,
+					 src_offset, max_idx);
+		break;
+	case 6:
+		interpolate_s16_channels(in, out, 6, frames, dst_start, f,
+					 src_offset, max_idx);
+		break;
+	case 8:
+		interpolate_s16_channels(in, out, 8, frames, dst_start, f,
+					 src_offset, max_idx);
+		break;
+	default:
+		interpolate_s16_channels(in, out, num_channels, frames,
+					 dst_start, f, src_offset, max_idx);
+		break;
+	}
+}
+
+static void interpolate_f32(const float *in, float *out,
+			    unsigned int num_channels, unsigned int frames,
+			    unsigned int dst_start, float f, float src_offset,
+			    unsigned int max_idx)
+{
+	switch (num_channels) {
+	case 1:
+		interpolate_f32_channels(in, out, 1, frames, dst_start, f,
+					 src_offset, max_idx);
+		break;
+	case 2:
+		interpolate_f32_channels(in, out, 2, frames, dst_start, f,
+					 src_offset, max_idx);
+		break;
+	case 6:
+		interpolate_f32_channels(in, out, 6, frames, dst_start, f,
+					 src_offset, max_idx);
+		break;
+	case 8:
+		interpolate_f32_channels(in, out, 8, frames, dst_start, f,
+					 src_offset, max_idx);
+		break;
+	default:
+		interpolate_f32_channels(in, out, num_channels, frames,
+					 dst_start, f, src_offset, max_idx);
+		break;
+	}
+}
+
+const struct linear_resampler_ops OPS(linear_resampler_ops) = {
+	.interpolate_s16 = interpolate_s16,
+	.interpolate_f32 = interpolate_f32,
+};
@@ -0,0 +1,42 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef LINEAR_RESAMPLER_OPS_H_
+#define LINEAR_RESAMPLER_OPS_H_
+
+#include <stdint.h>
+
+extern const struct linear_resampler_ops linear_resampler_ops;
+extern const struct linear_resampler_ops linear_resampler_ops_sse42;
+extern const struct linear_resampler_ops linear_resampler_ops_avx;
+extern const struct linear_resampler_ops linear_resampler_ops_avx2;
+extern const struct linear_resampler_ops linear_resampler_ops_fma;
+
+/* Struct containing the interpolation kernels of the linear resampler.
+ * Like cras_mix_ops, the same source is built once per instruction set and
+ * linear_resampler_init() picks the best one for the CPU.
+ *
+ * Each kernel writes frames output frames. Output frame i is interpolated
+ * at input position (dst_start + i) / f - src_offset, clamped at zero, and
+ * every such position must fall before the last input frame. max_idx is
+ * the last input frame an interpolation may start from, the kernels never
+ * read past frame max_idx + 1.
+ *
+ * Members:
+ *   interpolate_s16: Kernel for interleaved S16_LE frames.
+ *   interpolate_f32: Kernel for interleaved float32 frames.
+ */
+struct linear_resampler_ops {
+	void (*interpolate_s16)(const int16_t *in, int16_t *out,
+				unsigned int num_channels, unsigned int frames,
+				unsigned int dst_start, float f,
+				float src_offset, unsigned int max_idx);
+	void (*interpolate_f32)(const float *in, float *out,
+				unsigned int num_channels, unsigned int frames,
+				unsigned int dst_start, float f,
+				float src_offset, unsigned int max_idx);
+};
+
+#endif /* LINEAR_RESAMPLER_OPS_H_ */
@@ -0,0 +1,367 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "polyphase_resampler.h"
+
+/* Input frames buffered per call on top of the filter history. */
+#define BLOCK_FRAMES 512
+/* Dot products are unrolled by this many lanes, so taps must be a multiple
+ * of it. The independent accumulators let the compiler vectorize the loop
+ * for the target ISA without reassociating float math. */
+#define LANES 8
+/* Fraction of the Nyquist rate kept by the filter, and the Kaiser window
+ * shape. */
+#define ROLLOFF 0.94
+#define KAISER_BETA 8.0
+
+/* A polyphase FIR resampler converting by the ratio up / down.
+ * Members:
+ *    num_channels - The number of channels in each frame.
+ *    up - The interpolation factor, also the number of filter phases.
+ *    down - The decimation factor.
+ *    num_taps - The number of taps in each phase.
+ *    coefs - (up + 1) * num_taps coefficients, phase after phase. Taps of a
+ *        phase are stored oldest input first so they line up with the
+ *        history. The extra phase is the first one a frame later, for
+ *        interpolating past the last phase.
+ *    interp - num_taps coefficients interpolated between two phases.
+ *    hist - Per channel input history, capacity frames each.
+ *    capacity - The size of each channel of hist in frames.
+ *    hist_frames - The number of valid frames in hist.
+ *    pos - Index in hist of the newest input frame of the next output.
+ *    phase - Filter phase of the next output, fractional while the ratio
+ *        is off its nominal value.
+ *    step - Phases advanced per output, down at the nominal ratio.
+ */
+struct polyphase_resampler {
+	unsigned int num_channels;
+	unsigned int up;
+	unsigned int down;
+	unsigned int num_taps;
+	float *coefs;
+	float *interp;
+	float **hist;
+	unsigned int capacity;
+	unsigned int hist_frames;
+	unsigned int pos;
+	double phase;
+	double step;
+};
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+	while (b) {
+		unsigned int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/* Zeroth order modified Bessel function of the first kind. */
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	unsigned int k;
+
+	for (k = 1; k < 64 && term > sum * 1e-12; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+/* Designs a Kaiser windowed sinc low pass filter at the up sampled rate and
+ * splits it into up phases, plus the extra one. Each phase is normalized to
+ * unity DC gain. */
+static void design_filter(struct polyphase_resampler *pr)
+{
+	unsigned int len = pr->up * pr->num_taps;
+	unsigned int phase, tap;
+	double center = (len - 1) / 2.0;
+	double cutoff = ROLLOFF * 0.5 /
+			(pr->up > pr->down ? pr->up : pr->down);
+	double i0_beta = bessel_i0(KAISER_BETA);
+
+	for (phase = 0; phase <= pr->up; phase++) {
+		float *c = pr->coefs + phase * pr->num_taps;
+		double sum = 0;
+
+		for (tap = 0; tap < pr->num_taps; tap++) {
+			/* The newest input frame is multiplied by h[phase]. */
+			unsigned int k = phase + (pr->num_taps - 1 - tap) *
+							 pr->up;
+			double t = k - center;
+			double r = t / center;
+			double x = 2 * M_PI * cutoff * t;
+			double h = t == 0 ? 1.0 : sin(x) / x;
+
+			/* Only the extra phase reaches past the window. */
+			if (k >= len) {
+				c[tap] = 0;
+				continue;
+			}
+			h *= bessel_i0(KAISER_BETA * sqrt(fmax(0, 1 - r * r))) /
+			     i0_beta;
+			c[tap] = h;
+			sum += h;
+		}
+		for (tap = 0; tap < pr->num_taps; tap++)
+			c[tap] /= sum;
+	}
+}
+
+static inline float dot(const float *c, const float *x, unsigned int n)
+{
+	float acc[LANES] = { 0 };
+	unsigned int i, l;
+
+	for (i = 0; i < n; i += LANES)
+		for (l = 0; l < LANES; l++)
+			acc[l] += c[i + l] * x[i + l];
+
+	return ((acc[0] + acc[1]) + (acc[2] + acc[3])) +
+	       ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+}
+
+/* Drops history that no future output depends on. */
+static void compact_history(struct polyphase_resampler *pr)
+{
+	unsigned int drop = pr->pos + 1 - pr->num_taps;
+	unsigned int ch;
+
+	if (drop > pr->hist_frames)
+		drop = pr->hist_frames;
+	if (drop == 0)
+		return;
+
+	for (ch = 0; ch < pr->num_channels; ch++)
+		memmove(pr->hist[ch], pr->hist[ch] + drop,
+			(pr->hist_frames - drop) * sizeof(float));
+	pr->hist_frames -= drop;
+	pr->pos -= drop;
+}
+
+/* Makes sure the history holds the input frame at pos, appending frames from
+ * the input. Returns the number of input frames appended. */
+static unsigned int fill_history(struct polyphase_resampler *pr,
+				 const void *in, int is_float,
+				 unsigned int in_frames)
+{
+	unsigned int count, fr, ch;
+	unsigned int nch = pr->num_channels;
+
+	if (pr->pos >= pr->capacity)
+		compact_history(pr);
+
+	count = pr->pos + 1 - pr->hist_frames;
+	if (count > in_frames)
+		count = in_frames;
+
+	for (fr = 0; fr < count; fr++) {
+		for (ch = 0; ch < nch; ch++) {
+			float v;
+
+			if (is_float)
+				v = ((const float *)in)[fr * nch + ch];
+			else
+				v = ((const int16_t *)in)[fr * nch + ch] /
+				    32768.0f;
+			pr->hist[ch][pr->hist_frames + fr] = v;
+		}
+	}
+	pr->hist_frames += count;
+	return count;
+}
+
+/* Returns the taps of the current phase, interpolated between the two
+ * nearest phases of the bank when it falls between them. */
+static const float *filter_at_phase(struct polyphase_resampler *pr)
+{
+	unsigned int phase = (unsigned int)pr->phase;
+	float frac = pr->phase - phase;
+	const float *c0 = pr->coefs + phase * pr->num_taps;
+	const float *c1 = c0 + pr->num_taps;
+	unsigned int tap;
+
+	if (frac == 0)
+		return c0;
+	for (tap = 0; tap < pr->num_taps; tap++)
+		pr->interp[tap] = c0[tap] + frac * (c1[tap] - c0[tap]);
+	return pr->interp;
+}
+
+static void process(struct polyphase_resampler *pr, const void *in,
+		    int is_float, unsigned int *in_frames, void *out,
+		    unsigned int *out_frames)
+{
+	unsigned int consumed = 0, produced = 0, advance;
+	unsigned int nch = pr->num_channels;
+	size_t in_step = is_float ? sizeof(float) : sizeof(int16_t);
+	unsigned int ch;
+
+	while (produced < *out_frames) {
+		const float *c;
+
+		if (pr->pos >= pr->hist_frames) {
+			consumed += fill_history(
+				pr, (const uint8_t *)in + consumed * nch * in_step,
+				is_float, *in_frames - consumed);
+			if (pr->pos >= pr->hist_frames)
+				break;
+		}
+
+		c = filter_at_phase(pr);
+		for (ch = 0; ch < nch; ch++) {
+			float v = dot(c, pr->hist[ch] + pr->pos + 1 -
+						 pr->num_taps,
+				      pr->num_taps);
+
+			if (is_float) {
+				((float *)out)[produced * nch + ch] = v;
+			} else {
+				long s = lrintf(v * 32768.0f);
+
+				if (s > INT16_MAX)
+					s = INT16_MAX;
+				else if (s < INT16_MIN)
+					s = INT16_MIN;
+				((int16_t *)out)[produced * nch + ch] = s;
+			}
+		}
+		produced++;
+
+		pr->phase += pr->step;
+		advance = (unsigned int)(pr->phase / pr->up);
+		pr->pos += advance;
+		pr->phase -= (double)advance * pr->up;
+	}
+
+	*in_frames = consumed;
+	*out_frames = produced;
+}
+
+/*
+ * Exported interface
+ */
+
+struct polyphase_resampler *polyphase_resampler_create(unsigned int num_channels,
+						       unsigned int src_rate,
+						       unsigned int dst_rate,
+						       unsigned int taps)
+{
+	struct polyphase_resampler *pr;
+	unsigned int g, ch;
+
+	if (!num_channels || !src_rate || !dst_rate || taps < LANES ||
+	    taps > 128 || taps % LANES)
+		return NULL;
+
+	g = gcd(src_rate, dst_rate);
+	if (dst_rate / g > POLYPHASE_MAX_PHASES)
+		return NULL;
+
+	pr = (struct polyphase_resampler *)calloc(1, sizeof(*pr));
+	if (!pr)
+		return NULL;
+
+	pr->num_channels = num_channels;
+	pr->up = dst_rate / g;
+	pr->down = src_rate / g;
+	/* When decimating, widen the filter so it keeps the same number of
+	 * zero crossings at the lower cutoff. */
+	pr->num_taps = taps;
+	if (pr->down > pr->up) {
+		pr->num_taps = (taps * pr->down + pr->up - 1) / pr->up;
+		pr->num_taps = (pr->num_taps + LANES - 1) / LANES * LANES;
+	}
+	pr->capacity = pr->num_taps + BLOCK_FRAMES;
+
+	pr->coefs =
+		(float *)calloc((pr->up + 1) * pr->num_taps, sizeof(float));
+	pr->interp = (float *)calloc(pr->num_taps, sizeof(float));
+	pr->hist = (float **)calloc(num_channels, sizeof(float *));
+	if (!pr->coefs || !pr->interp || !pr->hist) {
+		polyphase_resampler_destroy(pr);
+		return NULL;
+	}
+	for (ch = 0; ch < num_channels; ch++) {
+		pr->hist[ch] = (float *)calloc(pr->capacity, sizeof(float));
+		if (!pr->hist[ch]) {
+			polyphase_resampler_destroy(pr);
+			return NULL;
+		}
+	}
+
+	design_filter(pr);
+	pr->step = pr->down;
+	polyphase_resampler_reset(pr);
+
+	return pr;
+}
+
+void polyphase_resampler_reset(struct polyphase_resampler *pr)
+{
+	unsigned int ch;
+
+	for (ch = 0; ch < pr->num_channels; ch++)
+		memset(pr->hist[ch], 0, pr->capacity * sizeof(float));
+
+	/* Start with a silent history, the first input frame is the newest
+	 * one of the first output. */
+	pr->hist_frames = pr->num_taps - 1;
+	pr->pos = pr->num_taps - 1;
+	pr->phase = 0;
+}
+
+void polyphase_resampler_destroy(struct polyphase_resampler *pr)
+{
+	unsigned int ch;
+
+	if (!pr)
+		return;
+	if (pr->hist) {
+		for (ch = 0; ch < pr->num_channels; ch++)
+			free(pr->hist[ch]);
+		free(pr->hist);
+	}
+	free(pr->coefs);
+	free(pr->interp);
+	free(pr);
+}
+
+void polyphase_resampler_set_drift(struct polyphase_resampler *pr,
+				   float from, float to)
+{
+	pr->step = from == to ? pr->down : (double)pr->down * from / to;
+}
+
+unsigned int
+polyphase_resampler_get_delay(const struct polyphase_resampler *pr)
+{
+	/* The filter is symmetric around the middle of its up * num_taps
+	 * coefficients, at the up sampled rate. */
+	return (pr->up * pr->num_taps - 1) / 2 / pr->up;
+}
+
+void polyphase_resampler_process_float(struct polyphase_resampler *pr,
+				       const float *in,
+				       unsigned int *in_frames, float *out,
+				       unsigned int *out_frames)
+{
+	process(pr, in, 1, in_frames, out, out_frames);
+}
+
+void polyphase_resampler_process_s16(struct polyphase_resampler *pr,
+				     const int16_t *in,
+				     unsigned int *in_frames, int16_t *out,
+				     unsigned int *out_frames)
+{
+	process(pr, in, 0, in_frames, out, out_frames);
+}
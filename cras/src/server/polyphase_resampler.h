@@ -0,0 +1,77 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef POLYPHASE_RESAMPLER_H_
+#define POLYPHASE_RESAMPLER_H_
+
+#include <stdint.h>
+
+/* Largest interpolation factor, after reducing the rates by their GCD, that
+ * gets a precomputed filter bank. 160 covers 44.1kHz <-> 48kHz. */
+#define POLYPHASE_MAX_PHASES 320
+
+struct polyphase_resampler;
+
+/* Creates a polyphase FIR resampler for a fixed rational rate ratio.
+ * Args:
+ *    num_channels - The number of channels in each frame.
+ *    src_rate - The source rate to resample from.
+ *    dst_rate - The destination rate to resample to.
+ *    taps - Filter taps per input sample of the cutoff, 8 to 128 and a
+ *        multiple of 8. More taps give a sharper filter at the cost of
+ *        latency and CPU.
+ * Returns:
+ *    The resampler, or NULL if the ratio needs more phases than
+ *    POLYPHASE_MAX_PHASES or on error.
+ */
+struct polyphase_resampler *polyphase_resampler_create(unsigned int num_channels,
+						       unsigned int src_rate,
+						       unsigned int dst_rate,
+						       unsigned int taps);
+
+/* Destroys a polyphase resampler. */
+void polyphase_resampler_destroy(struct polyphase_resampler *pr);
+
+/* Clears the history so the next input starts from silence, as after
+ * polyphase_resampler_create(). The filter bank is kept. */
+void polyphase_resampler_reset(struct polyphase_resampler *pr);
+
+/* Stretches the ratio for clock drift, as if the output rate was scaled by
+ * to / from. Outputs between two phases of the bank use taps interpolated
+ * from both, so the ratio can change by any amount between calls without
+ * resetting the history.
+ * Args:
+ *    pr - The polyphase resampler.
+ *    from - The nominal rate of the output.
+ *    to - The rate the output is actually consumed at.
+ */
+void polyphase_resampler_set_drift(struct polyphase_resampler *pr,
+				   float from, float to);
+
+/* Returns the group delay of the filter in input frames, rounded down. */
+unsigned int
+polyphase_resampler_get_delay(const struct polyphase_resampler *pr);
+
+/* Resamples interleaved float32 frames. Reads only as much input as needed
+ * to fill the output.
+ * Args:
+ *    pr - The polyphase resampler.
+ *    in - The input frames.
+ *    in_frames - The number of input frames, set to the number consumed.
+ *    out - The output buffer.
+ *    out_frames - The room in out in frames, set to the number written.
+ */
+void polyphase_resampler_process_float(struct polyphase_resampler *pr,
+				       const float *in,
+				       unsigned int *in_frames, float *out,
+				       unsigned int *out_frames);
+
+/* Same as polyphase_resampler_process_float() for S16_LE frames. */
+void polyphase_resampler_process_s16(struct polyphase_resampler *pr,
+				     const int16_t *in,
+				     unsigned int *in_frames, int16_t *out,
+				     unsigned int *out_frames);
+
+#endif /* POLYPHASE_RESAMPLER_H_ */
@@ -28,6 +28,40 @@ type Result<T> = std::result::Result<T, Error>;
 
 const MAX_RATE_SKEW: f64 = 100.0;
 
+/// Samples kept per window for outlier rejection. Windows with more samples
+/// are fitted on all of them, without rejection.
+const MAX_WINDOW_SAMPLES: usize = 1024;
+
+/// Windows need at least this many samples for outliers to be told apart
+/// from the trend.
+const MIN_SAMPLES_FOR_REJECTION: usize = 8;
+
+/// A sample is an outlier when it is further from the fitted line than this
+/// many standard deviations, estimated from the median absolute residual.
+const OUTLIER_SIGMAS: f64 = 4.0;
+
+/// Residuals within this many frames are never outliers, they are within
+/// the granularity of the hardware pointer of most devices.
+const MIN_OUTLIER_FRAMES: f64 = 32.0;
+
+/// Frames processed between two checks may differ from those expected at the
+/// estimated rate by this much, plus MAX_RATE_SKEW over the interval, before
+/// they count as a discontinuity, e.g. frames dropped by a USB hiccup or a
+/// bad read of the hardware pointer.
+const MAX_STEP_FRAMES: f64 = 64.0;
+
+/// Segments kept per window for outlier rejection. Windows broken by more
+/// discontinuities are fitted without rejection.
+const MAX_WINDOW_SEGMENTS: usize = 32;
+
+/// After a reset, the first window is this many times shorter when an
+/// earlier estimate tells what rate to expect.
+const RELOCK_WINDOW_DIVISOR: u32 = 4;
+
+/// A short window after a reset confirms the earlier estimate when its rate
+/// is within this fraction of it.
+const RELOCK_TOLERANCE: f64 = 0.000_2;
+
 /// Hold information to calculate linear least square from
 /// several (x, y) samples.
 #[derive(Debug, Default)]
@@ -52,39 +86,206 @@ impl LeastSquares {
         self.num_samples += 1;
     }
 
+    /// Sum of the products of the deviations of x and y from their means.
+    fn centered_xy(&self) -> f64 {
+        if self.num_samples == 0 {
+            return 0.0;
+        }
+        self.sum_xy - self.sum_x * self.sum_y / self.num_samples as f64
+    }
+
+    /// Sum of the squared deviations of x from its mean.
+    fn centered_x2(&self) -> f64 {
+        if self.num_samples == 0 {
+            return 0.0;
+        }
+        self.sum_x2 - self.sum_x * self.sum_x / self.num_samples as f64
+    }
+
+    fn best_fit_intercept(&self, slope: f64) -> f64 {
+        (self.sum_y - slope * self.sum_x) / self.num_samples as f64
+    }
+}
+
+/// Least squares fit of one slope over segments of samples, each with its own
+/// intercept. The level jumps between segments don't affect the slope.
+///
+/// # Members
+///    * `done_xy` - centered_xy of the finished segments.
+///    * `done_x2` - centered_x2 of the finished segments.
+///    * `segment` - The samples of the current segment.
+///    * `num_samples` - The number of samples of all segments.
+#[derive(Debug, Default)]
+struct SegmentedFit {
+    done_xy: f64,
+    done_x2: f64,
+    segment: LeastSquares,
+    num_samples: u32,
+}
+
+impl SegmentedFit {
+    fn new() -> Self {
+        Self::default()
+    }
+
+    fn start_segment(&mut self) {
+        self.done_xy += self.segment.centered_xy();
+        self.done_x2 += self.segment.centered_x2();
+        self.segment = LeastSquares::new();
+    }
+
+    fn add_sample(&mut self, x: f64, y: f64) {
+        self.segment.add_sample(x, y);
+        self.num_samples += 1;
+    }
+
     fn best_fit_slope(&self) -> f64 {
-        let num = self.num_samples as f64 * self.sum_xy - self.sum_x * self.sum_y;
-        let den = self.num_samples as f64 * self.sum_x2 - self.sum_x * self.sum_x;
-        num / den
+        (self.done_xy + self.segment.centered_xy()) / (self.done_x2 + self.segment.centered_x2())
+    }
+}
+
+/// The samples of a window, kept to fit them again without their outliers.
+///
+/// # Members
+///    * `samples` - The (x, y, segment) of the samples added to the window, up
+///                  to MAX_WINDOW_SAMPLES.
+///    * `segments` - The sums of each segment of the window.
+///    * `residuals` - Scratch space to find the median residual.
+///    * `overflowed` - True if the window had more samples or segments than
+///                     kept.
+struct WindowSamples {
+    samples: Vec<(f64, f64, usize)>,
+    segments: Vec<LeastSquares>,
+    residuals: Vec<f64>,
+    overflowed: bool,
+}
+
+impl WindowSamples {
+    fn new() -> Self {
+        let mut segments = Vec::with_capacity(MAX_WINDOW_SEGMENTS);
+        segments.push(LeastSquares::new());
+        WindowSamples {
+            samples: Vec::with_capacity(MAX_WINDOW_SAMPLES),
+            segments,
+            residuals: Vec::with_capacity(MAX_WINDOW_SAMPLES),
+            overflowed: false,
+        }
+    }
+
+    fn clear(&mut self) {
+        self.samples.clear();
+        self.segments.truncate(1);
+        self.segments[0] = LeastSquares::new();
+        self.overflowed = false;
+    }
+
+    fn start_segment(&mut self) {
+        if self.segments.len() < MAX_WINDOW_SEGMENTS {
+            self.segments.push(LeastSquares::new());
+        } else {
+            self.overflowed = true;
+        }
+    }
+
+    fn add_sample(&mut self, x: f64, y: f64) {
+        if self.overflowed || self.samples.len() == MAX_WINDOW_SAMPLES {
+            self.overflowed = true;
+            return;
+        }
+        let segment = self.segments.len() - 1;
+        self.segments[segment].add_sample(x, y);
+        self.samples.push((x, y, segment));
+    }
+
+    fn residual(&self, sample: &(f64, f64, usize), slope: f64) -> f64 {
+        let (x, y, segment) = *sample;
+        (y - self.segments[segment].best_fit_intercept(slope) - slope * x).abs()
+    }
+
+    /// Fits the samples again without those far from the line fitted on all
+    /// of them, and returns the new slope. Returns `slope` when there are
+    /// too few samples to tell, or none of them is an outlier.
+    fn robust_slope(&mut self, slope: f64) -> f64 {
+        if self.overflowed || self.samples.len() < MIN_SAMPLES_FOR_REJECTION {
+            return slope;
+        }
+
+        let mut residuals = std::mem::take(&mut self.residuals);
+        residuals.clear();
+        residuals.extend(self.samples.iter().map(|s| self.residual(s, slope)));
+        residuals.sort_unstable_by(|a, b| a.partial_cmp(b).unwrap_or(std::cmp::Ordering::Equal));
+        // 1.4826 scales the median absolute deviation of normally
+        // distributed residuals to their standard deviation.
+        let sigma = 1.4826 * residuals[residuals.len() / 2];
+        self.residuals = residuals;
+        let threshold = (OUTLIER_SIGMAS * sigma).max(MIN_OUTLIER_FRAMES);
+
+        let mut inliers = SegmentedFit::new();
+        let mut segment = 0;
+        for sample in self.samples.iter() {
+            if self.residual(sample, slope) > threshold {
+                continue;
+            }
+            if sample.2 != segment {
+                inliers.start_segment();
+                segment = sample.2;
+            }
+            inliers.add_sample(sample.0, sample.1);
+        }
+        if inliers.num_samples as usize == self.samples.len() || inliers.num_samples < 2 {
+            return slope;
+        }
+        inliers.best_fit_slope()
     }
 }
 
 /// An estimator holding the required information to determine the actual frame
 /// rate of an audio device.
 ///
+/// Each window is fitted by least squares, then refitted without the samples
+/// that stray from the line. A jump of the level between two checks starts a
+/// new segment of the window, which shares the slope but not the intercept of
+/// the others. After a reset, a shorter first window that confirms the
+/// earlier estimate restores it.
+///
 /// # Members
 ///    * `last_level` - Buffer level of the audio device at last check time.
 ///    * `level_diff` - Number of frames written to or read from audio device
 ///                     since the last check time. Rate estimator will use this
 ///                     change plus the difference of buffer level to derive the
 ///                     number of frames audio device has actually processed.
+///    * `last_check` - The time of the last sample in the current window.
 ///    * `window_start` - The start time of the current window.
 ///    * `window_size` - The size of the window.
 ///    * `window_frames` - The number of frames accumulated in current window.
 ///    * `lsq` - The helper used to estimate sample rate.
+///    * `samples` - The samples of the current window.
 ///    * `smooth_factor` - A scaling factor used to average the previous and new
 ///                        rate estimates to ensure that estimates do not change
 ///                        too quickly.
 ///    * `estimated_rate` - The estimated rate at which samples are consumed.
+///    * `nominal_rate` - The rate the estimator was last created or reset with.
+///    * `locked_ratio` - The ratio of the last estimate from a window to the
+///                       nominal rate, None until there is one.
+///    * `relocking` - True while the first window after a reset is shortened.
 pub struct RateEstimator {
     last_level: i32,
     level_diff: i32,
+    last_check: Duration,
     window_start: Option<Duration>,
     window_size: Duration,
-    window_frames: u32,
-    lsq: LeastSquares,
+    window_frames: f64,
+    lsq: SegmentedFit,
+    samples: WindowSamples,
     smooth_factor: f64,
     estimated_rate: f64,
+    nominal_rate: f64,
+    locked_ratio: Option<f64>,
+    relocking: bool,
+}
+
+fn duration_secs(d: Duration) -> f64 {
+    (d.as_secs() as f64) + d.subsec_nanos() as f64 / 1_000_000_000.0
 }
 
 impl RateEstimator {
@@ -107,25 +308,32 @@ impl RateEstimator {
         Ok(RateEstimator {
             last_level: 0,
             level_diff: 0,
+            last_check: Duration::default(),
             window_start: None,
             window_size,
-            window_frames: 0,
-            lsq: LeastSquares::new(),
+            window_frames: 0.0,
+            lsq: SegmentedFit::new(),
+            samples: WindowSamples::new(),
             smooth_factor,
             estimated_rate: rate as f64,
+            nominal_rate: rate as f64,
+            locked_ratio: None,
+            relocking: false,
         })
     }
 
     /// Resets the estimated rate
     ///
-    /// Reset the estimated rate to `rate`, and erase all collected data.
+    /// Reset the estimated rate to `rate`, and erase all collected data. The
+    /// ratio of the last estimate to the nominal rate is kept, to be restored
+    /// if the shorter window that follows confirms it.
     pub fn reset_rate(&mut self, rate: u32) {
         self.last_level = 0;
         self.level_diff = 0;
-        self.window_start = None;
-        self.window_frames = 0;
-        self.lsq = LeastSquares::new();
+        self.start_window(None);
         self.estimated_rate = rate as f64;
+        self.nominal_rate = rate as f64;
+        self.relocking = self.locked_ratio.is_some();
     }
 
     /// Adds additional frames transmitted to/from audio device.
@@ -143,6 +351,45 @@ impl RateEstimator {
         self.estimated_rate
     }
 
+    fn start_window(&mut self, start: Option<Duration>) {
+        self.window_start = start;
+        if let Some(t) = start {
+            self.last_check = t;
+        }
+        self.window_frames = 0.0;
+        self.lsq = SegmentedFit::new();
+        self.samples.clear();
+    }
+
+    fn current_window_size(&self) -> Duration {
+        if self.relocking {
+            self.window_size / RELOCK_WINDOW_DIVISOR
+        } else {
+            self.window_size
+        }
+    }
+
+    /// Folds the rate fitted on a finished window into the estimate.
+    fn update_from_window(&mut self, rate: f64) {
+        if self.relocking {
+            self.relocking = false;
+            if let Some(ratio) = self.locked_ratio {
+                // The short window is too noisy to replace the earlier
+                // estimate, only to confirm it still holds.
+                let expected = self.nominal_rate * ratio;
+                if (rate - expected).abs() < expected * RELOCK_TOLERANCE {
+                    self.estimated_rate = expected;
+                    return;
+                }
+            }
+        }
+        if (self.estimated_rate - rate).abs() < MAX_RATE_SKEW {
+            self.estimated_rate =
+                rate * (1.0 - self.smooth_factor) + self.estimated_rate * self.smooth_factor;
+            self.locked_ratio = Some(self.estimated_rate / self.nominal_rate);
+        }
+    }
+
     /// Check the timestamp and buffer level difference since last check time,
     /// and use them as a new sample to update the estimated rate.
     ///
@@ -156,7 +403,7 @@ impl RateEstimator {
     pub fn update_estimated_rate(&mut self, level: i32, now: Duration) -> bool {
         let start = match self.window_start {
             None => {
-                self.window_start = Some(now);
+                self.start_window(Some(now));
                 return false;
             }
             Some(t) => t,
@@ -166,21 +413,28 @@ impl RateEstimator {
             Some(d) => d,
             None => return false,
         };
-        self.window_frames += (self.last_level - level + self.level_diff).abs() as u32;
+        let interval = duration_secs(now.checked_sub(self.last_check).unwrap_or_default());
+        let frames = (self.last_level - level + self.level_diff).abs() as f64;
         self.level_diff = 0;
         self.last_level = level;
+        self.last_check = now;
 
-        let secs = (delta.as_secs() as f64) + delta.subsec_nanos() as f64 / 1_000_000_000.0;
-        self.lsq.add_sample(secs, self.window_frames as f64);
-        if delta > self.window_size && self.lsq.num_samples > 1 {
-            let rate = self.lsq.best_fit_slope();
-            if (self.estimated_rate - rate).abs() < MAX_RATE_SKEW {
-                self.estimated_rate =
-                    rate * (1.0 - self.smooth_factor) + self.estimated_rate * self.smooth_factor;
-            }
-            self.lsq = LeastSquares::new();
-            self.window_start = Some(now);
-            self.window_frames = 0;
+        // Fit the samples after a jump of the level on their own intercept.
+        let expected = self.estimated_rate * interval;
+        if (frames - expected).abs() > MAX_STEP_FRAMES + MAX_RATE_SKEW * interval {
+            self.lsq.start_segment();
+            self.samples.start_segment();
+        }
+        self.window_frames += frames;
+
+        let secs = duration_secs(delta);
+        self.lsq.add_sample(secs, self.window_frames);
+        self.samples.add_sample(secs, self.window_frames);
+        if delta > self.current_window_size() && self.lsq.num_samples > 1 {
+            let slope = self.lsq.best_fit_slope();
+            let rate = self.samples.robust_slope(slope);
+            self.update_from_window(rate);
+            self.start_window(Some(now));
             return true;
         }
         false
@@ -3,14 +3,17 @@
  * found in the LICENSE file.
  */
 
+#include <errno.h>
 #include <syslog.h>
 
+#include "cras_route.h"
 #include "cras_rstream.h"
 #include "cras_server.h"
 #include "cras_system_state.h"
 #include "cras_types.h"
 #include "server_stream.h"
 #include "stream_list.h"
+#include "utlist.h"
 
 /* Parameters used for server stream. */
 static unsigned int server_stream_block_size = 480;
@@ -21,6 +24,28 @@ static unsigned int server_stream_block_size = 480;
  */
 static struct cras_rstream_config *stream_config;
 
+/*
+ * A route and the ids of its two streams.
+ *    route - The route, the reference of the owner.
+ *    format - The format of the route.
+ *    in_id - The input stream capturing into the route.
+ *    out_id - The output stream playing from the route.
+ */
+struct server_route {
+	struct cras_route *route;
+	struct cras_audio_format format;
+	cras_stream_id_t in_id;
+	cras_stream_id_t out_id;
+	struct server_route *prev, *next;
+};
+
+static struct server_route *routes;
+static unsigned int next_route_id = 1;
+
+/* Stream ids of route streams follow the one of the echo reference stream,
+ * two of them for each route. */
+#define ROUTE_MAX_ID 0x7fff
+
 /* Actually create the server stream and add to stream list. */
 static void server_stream_add_cb(void *data)
 {
@@ -86,3 +111,107 @@ void server_stream_destroy(struct stream_list *stream_list,
 	/* Schedule remove stream in next main thread loop. */
 	cras_system_add_task(server_stream_rm_cb, stream_list);
 }
+
+static struct server_route *find_route(unsigned int route_id)
+{
+	struct server_route *r;
+
+	DL_FOREACH (routes, r)
+		if (cras_route_id(r->route) == route_id)
+			return r;
+	return NULL;
+}
+
+/* Adds a server only stream of a route to the stream list. */
+static int add_route_stream(struct stream_list *stream_list,
+			    struct server_route *r, cras_stream_id_t id,
+			    enum CRAS_STREAM_DIRECTION direction,
+			    unsigned int dev_idx, uint64_t effects,
+			    size_t buffer_frames, size_t block_frames)
+{
+	struct cras_rstream_config config;
+	struct cras_rstream *stream;
+	int audio_fd = -1;
+	int client_shm_fd = -1;
+	uint64_t buffer_offsets[2] = { 0, 0 };
+
+	cras_rstream_config_init(
+		/*client=*/NULL, id, CRAS_STREAM_TYPE_DEFAULT,
+		CRAS_CLIENT_TYPE_SERVER_STREAM, direction, dev_idx,
+		/*flags=*/SERVER_ONLY, effects, &r->format, buffer_frames,
+		block_frames, &audio_fd, &client_shm_fd,
+		/*client_shm_size=*/0, buffer_offsets, &config);
+	config.route = r->route;
+
+	return stream_list_add(stream_list, &config, &stream);
+}
+
+int server_stream_create_route(struct stream_list *stream_list,
+			       unsigned int in_idx, unsigned int out_idx,
+			       const struct cras_audio_format *format,
+			       unsigned int latency_ms, uint64_t effects)
+{
+	struct server_route *r;
+	unsigned int id, block_frames, latency_frames;
+	int rc;
+
+	id = next_route_id;
+	while (find_route(id))
+		id = id % ROUTE_MAX_ID + 1;
+	next_route_id = id % ROUTE_MAX_ID + 1;
+
+	/* Blocks of 10ms, the output stream buffers two of them. */
+	block_frames = format->frame_rate / 100;
+	latency_frames = (uint64_t)latency_ms * format->frame_rate / 1000;
+
+	r = (struct server_route *)calloc(1, sizeof(*r));
+	if (!r)
+		return -ENOMEM;
+	r->format = *format;
+	r->route = cras_route_create(id, format, latency_frames, block_frames);
+	if (!r->route) {
+		free(r);
+		return -ENOMEM;
+	}
+	r->in_id = cras_get_stream_id(SERVER_STREAM_CLIENT_ID, 2 * id - 1);
+	r->out_id = cras_get_stream_id(SERVER_STREAM_CLIENT_ID, 2 * id);
+
+	rc = add_route_stream(stream_list, r, r->in_id, CRAS_STREAM_INPUT,
+			      in_idx, effects, block_frames, block_frames);
+	if (rc)
+		goto error;
+	rc = add_route_stream(stream_list, r, r->out_id, CRAS_STREAM_OUTPUT,
+			      out_idx, 0, 2 * block_frames, block_frames);
+	if (rc) {
+		stream_list_rm(stream_list, r->in_id);
+		goto error;
+	}
+
+	DL_APPEND(routes, r);
+	syslog(LOG_DEBUG, "route %u from dev %u to dev %u, %u ms", id, in_idx,
+	       out_idx, latency_ms);
+	return id;
+
+error:
+	syslog(LOG_ERR, "Failed to create route from dev %u to dev %u: %d",
+	       in_idx, out_idx, rc);
+	cras_route_put(r->route);
+	free(r);
+	return rc;
+}
+
+int server_stream_destroy_route(struct stream_list *stream_list,
+				unsigned int route_id)
+{
+	struct server_route *r = find_route(route_id);
+
+	if (!r)
+		return -EINVAL;
+
+	DL_DELETE(routes, r);
+	stream_list_rm(stream_list, r->in_id);
+	stream_list_rm(stream_list, r->out_id);
+	cras_route_put(r->route);
+	free(r);
+	return 0;
+}
@@ -6,6 +6,9 @@
 #ifndef SERVER_STREAM_H_
 #define SERVER_STREAM_H_
 
+#include <stdint.h>
+
+struct cras_audio_format;
 struct stream_list;
 
 /*
@@ -26,4 +29,34 @@ void server_stream_create(struct stream_list *stream_list, unsigned int dev_idx,
 void server_stream_destroy(struct stream_list *stream_list,
 			   unsigned int dev_idx);
 
+/*
+ * Routes what an input device captures to an output device, with a pair of
+ * server streams pinned to them that share a cras_route. Called on the main
+ * thread, the streams are added right away.
+ * Args:
+ *    stream_list - List of stream to add the route streams to.
+ *    in_idx - The id of the device to capture from.
+ *    out_idx - The id of the device to play to.
+ *    format - The format of the route, the frames are captured in it.
+ *    latency_ms - How long frames stay in the route before they are played.
+ *    effects - Bit map of the effects to apply to the captured frames.
+ * Returns:
+ *    The id of the route, or a negative error code.
+ */
+int server_stream_create_route(struct stream_list *stream_list,
+			       unsigned int in_idx, unsigned int out_idx,
+			       const struct cras_audio_format *format,
+			       unsigned int latency_ms, uint64_t effects);
+
+/*
+ * Removes the streams of a route and drops it. Called on the main thread.
+ * Args:
+ *    stream_list - List of stream to remove the route streams from.
+ *    route_id - The id server_stream_create_route returned.
+ * Returns:
+ *    0 on success, -EINVAL if there's no such route.
+ */
+int server_stream_destroy_route(struct stream_list *stream_list,
+				unsigned int route_id);
+
 #endif /* SERVER_STREAM_H_ */
@@ -5,9 +5,26 @@
 
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "cras_volume_curve.h"
 #include "softvol_curve.h"
+#include "utlist.h"
+
+/* A table of scalers shared by the volume curves that give its dBFS values.
+ * Members:
+ *    dBFS - The dBFS value of each volume step the scalers are built from.
+ *    scalers - The software volume scaler of each volume step.
+ *    num_users - Number of users holding the table.
+ */
+struct softvol_table {
+	long dBFS[NUM_VOLUME_STEPS];
+	float scalers[NUM_VOLUME_STEPS];
+	unsigned int num_users;
+	struct softvol_table *prev, *next;
+};
+
+static struct softvol_table *softvol_tables;
 
 /* This is a ramp that increases 0.5dB per step, for a total range of 50dB. */
 const float softvol_scalers[101] = {
@@ -29,34 +46,71 @@ const float softvol_scalers[101] = {
 	0.944061, 1.000000, /* volume 100 */
 };
 
-float *softvol_build_from_curve(const struct cras_volume_curve *curve)
+/* Converts the dBFS value of a volume step to its software volume scaler. */
+static float scaler_from_curve_dB(long dBFS)
 {
-	float *scalers;
-	unsigned int volume;
-
-	if (!curve)
-		return NULL;
-
-	scalers = (float *)malloc(NUM_VOLUME_STEPS * sizeof(float));
-	if (!scalers)
-		return NULL;
+	float scaler = convert_softvol_scaler_from_dB(dBFS);
 
 	/* When software volume is used, it is assumed all volume curve values
 	 * are relative to 0 dBFS when converting to scale. If a positive dBFS
 	 * value is specified in curve config, it will be treated as invalid
 	 * and clip to 1.0 in scale.
 	 */
-	for (volume = 0; volume <= MAX_VOLUME; volume++) {
-		scalers[volume] = convert_softvol_scaler_from_dB(
-			curve->get_dBFS(curve, volume));
-		if (scalers[volume] > 1.0)
-			scalers[volume] = 1.0;
-		/* Clip scalers so that all values are non-zero to make volume
-		 * ramping simpler. Because of how mix_ops treats small values,
-		 * this should be effectively the same as a 0 value. */
-		else if (scalers[volume] < 1e-7)
-			scalers[volume] = 1e-7;
+	if (scaler > 1.0)
+		return 1.0;
+	/* Clip scalers so that all values are non-zero to make volume
+	 * ramping simpler. Because of how mix_ops treats small values,
+	 * this should be effectively the same as a 0 value. */
+	if (scaler < 1e-7)
+		return 1e-7;
+	return scaler;
+}
+
+const float *softvol_get_scalers(const struct cras_volume_curve *curve)
+{
+	struct softvol_table *table;
+	long dBFS[NUM_VOLUME_STEPS];
+	unsigned int volume;
+
+	if (!curve)
+		return NULL;
+
+	for (volume = 0; volume <= MAX_VOLUME; volume++)
+		dBFS[volume] = curve->get_dBFS(curve, volume);
+
+	DL_FOREACH (softvol_tables, table) {
+		if (memcmp(table->dBFS, dBFS, sizeof(dBFS)) == 0) {
+			table->num_users++;
+			return table->scalers;
+		}
 	}
 
-	return scalers;
+	table = (struct softvol_table *)calloc(1, sizeof(*table));
+	if (!table)
+		return NULL;
+	memcpy(table->dBFS, dBFS, sizeof(dBFS));
+	for (volume = 0; volume <= MAX_VOLUME; volume++)
+		table->scalers[volume] = scaler_from_curve_dB(dBFS[volume]);
+	table->num_users = 1;
+	DL_APPEND(softvol_tables, table);
+
+	return table->scalers;
+}
+
+void softvol_put_scalers(const float *scalers)
+{
+	struct softvol_table *table;
+
+	if (!scalers)
+		return;
+
+	DL_FOREACH (softvol_tables, table) {
+		if (table->scalers != scalers)
+			continue;
+		if (--table->num_users == 0) {
+			DL_DELETE(softvol_tables, table);
+			free(table);
+		}
+		return;
+	}
 }
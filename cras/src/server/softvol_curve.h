@@ -26,7 +26,22 @@ static inline float convert_softvol_scaler_from_dB(long dBFS)
 	return expf(LOG_10 * dBFS / 2000);
 }
 
-/* Builds software volume scalers from volume curve. */
-float *softvol_build_from_curve(const struct cras_volume_curve *curve);
+/* Gets the software volume scalers for a volume curve. Curves that give the
+ * same dBFS values share one table, so nodes with the same curve don't each
+ * build and hold their own copy.
+ * Args:
+ *    curve - The volume curve to build the scalers from.
+ * Returns:
+ *    The table of NUM_VOLUME_STEPS scalers, to be released with
+ *    softvol_put_scalers(). NULL if curve is NULL or on error.
+ */
+const float *softvol_get_scalers(const struct cras_volume_curve *curve);
+
+/* Releases a table from softvol_get_scalers(). The table is freed when no
+ * node uses it anymore.
+ * Args:
+ *    scalers - The table to release, can be NULL.
+ */
+void softvol_put_scalers(const float *scalers);
 
 #endif /* SOFTVOL_CURVE_H_ */
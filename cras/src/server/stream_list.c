@@ -9,9 +9,19 @@
 #include "stream_list.h"
 #include "utlist.h"
 
+/* Number of buckets in each stream index, must be a power of two. */
+#define STREAM_INDEX_BUCKETS 64
+
+/* An index of the streams in the list, hashing them into buckets chained
+ * through the index_next member of cras_rstream. */
+struct stream_index {
+	struct cras_rstream *buckets[STREAM_INDEX_BUCKETS];
+};
+
 struct stream_list {
 	struct cras_rstream *streams;
 	struct cras_rstream *streams_to_delete;
+	struct stream_index indexes[CRAS_RSTREAM_NUM_INDEXES];
 	stream_callback *stream_added_cb;
 	stream_callback *stream_removed_cb;
 	stream_create_func *stream_create_cb;
@@ -20,6 +30,77 @@ struct stream_list {
 	struct cras_timer *drain_timer;
 };
 
+static unsigned int stream_id_key(cras_stream_id_t id)
+{
+	/* The client id is in the upper half of the stream id. */
+	return id ^ (id >> 16);
+}
+
+static unsigned int client_key(const struct cras_rclient *rclient)
+{
+	uintptr_t client = (uintptr_t)rclient;
+
+	return client ^ (client >> 6) ^ (client >> 16);
+}
+
+static unsigned int stream_index_key(const struct cras_rstream *stream,
+				     enum CRAS_RSTREAM_INDEX index)
+{
+	switch (index) {
+	case CRAS_RSTREAM_INDEX_ID:
+		return stream_id_key(stream->stream_id);
+	case CRAS_RSTREAM_INDEX_CLIENT:
+		return client_key(stream->client);
+	case CRAS_RSTREAM_INDEX_PINNED_DEV:
+	default:
+		return stream->pinned_dev_idx;
+	}
+}
+
+static struct cras_rstream **
+stream_index_bucket(struct stream_list *list, enum CRAS_RSTREAM_INDEX index,
+		    unsigned int key)
+{
+	return &list->indexes[index].buckets[key & (STREAM_INDEX_BUCKETS - 1)];
+}
+
+/* Adds the stream to the indexes it belongs in. */
+static void index_stream(struct stream_list *list, struct cras_rstream *stream)
+{
+	struct cras_rstream **bucket;
+	int i;
+
+	for (i = 0; i < CRAS_RSTREAM_NUM_INDEXES; i++) {
+		stream->index_next[i] = NULL;
+		if (i == CRAS_RSTREAM_INDEX_PINNED_DEV && !stream->is_pinned)
+			continue;
+		bucket = stream_index_bucket(list, i,
+					     stream_index_key(stream, i));
+		stream->index_next[i] = *bucket;
+		*bucket = stream;
+	}
+}
+
+/* Removes the stream from all the indexes it was added to. */
+static void unindex_stream(struct stream_list *list,
+			   struct cras_rstream *stream)
+{
+	struct cras_rstream **link;
+	int i;
+
+	for (i = 0; i < CRAS_RSTREAM_NUM_INDEXES; i++) {
+		if (i == CRAS_RSTREAM_INDEX_PINNED_DEV && !stream->is_pinned)
+			continue;
+		link = stream_index_bucket(list, i,
+					   stream_index_key(stream, i));
+		while (*link && *link != stream)
+			link = &(*link)->index_next[i];
+		if (*link)
+			*link = stream->index_next[i];
+		stream->index_next[i] = NULL;
+	}
+}
+
 static void delete_streams(struct cras_timer *timer, void *data)
 {
 	struct cras_rstream *to_delete;
@@ -94,8 +175,10 @@ int stream_list_add(struct stream_list *list,
 			break;
 	}
 	DL_INSERT(list->streams, next_stream, *stream);
+	index_stream(list, *stream);
 	rc = list->stream_added_cb(*stream);
 	if (rc) {
+		unindex_stream(list, *stream);
 		DL_DELETE(list->streams, *stream);
 		list->stream_destroy_cb(*stream);
 	}
@@ -107,9 +190,13 @@ int stream_list_rm(struct stream_list *list, cras_stream_id_t id)
 {
 	struct cras_rstream *to_remove;
 
-	DL_SEARCH_SCALAR(list->streams, to_remove, stream_id, id);
+	to_remove = *stream_index_bucket(list, CRAS_RSTREAM_INDEX_ID,
+					 stream_id_key(id));
+	while (to_remove && to_remove->stream_id != id)
+		to_remove = to_remove->index_next[CRAS_RSTREAM_INDEX_ID];
 	if (!to_remove)
 		return -EINVAL;
+	unindex_stream(list, to_remove);
 	DL_DELETE(list->streams, to_remove);
 	DL_APPEND(list->streams_to_delete, to_remove);
 	if (list->drain_timer) {
@@ -124,14 +211,18 @@ int stream_list_rm(struct stream_list *list, cras_stream_id_t id)
 int stream_list_rm_all_client_streams(struct stream_list *list,
 				      struct cras_rclient *rclient)
 {
-	struct cras_rstream *to_remove;
+	struct cras_rstream *to_remove, *next;
 	int rc = 0;
 
-	DL_FOREACH (list->streams, to_remove) {
-		if (to_remove->client == rclient) {
-			DL_DELETE(list->streams, to_remove);
-			DL_APPEND(list->streams_to_delete, to_remove);
-		}
+	to_remove = *stream_index_bucket(list, CRAS_RSTREAM_INDEX_CLIENT,
+					 client_key(rclient));
+	for (; to_remove; to_remove = next) {
+		next = to_remove->index_next[CRAS_RSTREAM_INDEX_CLIENT];
+		if (to_remove->client != rclient)
+			continue;
+		unindex_stream(list, to_remove);
+		DL_DELETE(list->streams, to_remove);
+		DL_APPEND(list->streams_to_delete, to_remove);
 	}
 	if (list->drain_timer) {
 		cras_tm_cancel_timer(list->timer_manager, list->drain_timer);
@@ -146,9 +237,11 @@ bool stream_list_has_pinned_stream(struct stream_list *list,
 				   unsigned int dev_idx)
 {
 	struct cras_rstream *rstream;
-	DL_FOREACH (list->streams, rstream) {
-		if (!rstream->is_pinned)
-			continue;
+
+	rstream = *stream_index_bucket(list, CRAS_RSTREAM_INDEX_PINNED_DEV,
+				       dev_idx);
+	for (; rstream;
+	     rstream = rstream->index_next[CRAS_RSTREAM_INDEX_PINNED_DEV]) {
 		if (rstream->pinned_dev_idx == dev_idx)
 			return true;
 	}
@@ -126,7 +126,9 @@ static int get_buffer_fd_read(struct cras_iodev *iodev,
 	nread = read(testio->fd, write_ptr, avail);
 	if (nread <= 0) {
 		*frames = 0;
-		audio_thread_rm_callback(testio->fd);
+		audio_thread_rm_callback(
+			cras_iodev_list_get_dev_audio_thread(iodev),
+			testio->fd);
 		close(testio->fd);
 		testio->fd = -1;
 		return 0;
@@ -150,7 +152,8 @@ static void play_file_as_hotword(struct test_iodev *testio, const char *path)
 	if (testio->fd >= 0) {
 		/* Remove audio thread callback from main thread. */
 		audio_thread_rm_callback_sync(
-			cras_iodev_list_get_audio_thread(), testio->fd);
+			cras_iodev_list_get_dev_audio_thread(&testio->base),
+			testio->fd);
 		close(testio->fd);
 	}
 
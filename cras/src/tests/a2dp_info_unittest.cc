@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <gtest/gtest.h>
+#include <arpa/inet.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <sys/socket.h>
@@ -11,8 +12,10 @@
 extern "C" {
 #include <sbc/sbc.h>
 
+#include "cras_a2dp_codec.h"
 #include "cras_a2dp_info.h"
 #include "cras_sbc_codec.h"
+#include "rtp.h"
 #include "sbc_codec_stub.h"
 }
 
@@ -42,7 +45,7 @@ namespace {
 
 TEST(A2dpInfoInit, InitA2dp) {
   ResetStubData();
-  init_a2dp(&a2dp, &sbc);
+  init_a2dp(&a2dp, A2DP_CODEC_SBC, &sbc, sizeof(sbc));
 
   ASSERT_EQ(1, get_sbc_codec_create_called());
   ASSERT_EQ(SBC_FREQ_48000, get_sbc_codec_create_freq_val());
@@ -65,16 +68,25 @@ TEST(A2dpInfoInit, InitA2dpFail) {
   ResetStubData();
   int err;
   set_sbc_codec_create_fail(1);
-  err = init_a2dp(&a2dp, &sbc);
+  err = init_a2dp(&a2dp, A2DP_CODEC_SBC, &sbc, sizeof(sbc));
 
   ASSERT_EQ(1, get_sbc_codec_create_called());
   ASSERT_NE(0, err);
   ASSERT_EQ(a2dp.codec, (void*)NULL);
 }
 
+TEST(A2dpInfoInit, InitA2dpUnregisteredCodec) {
+  ResetStubData();
+  int err;
+  err = init_a2dp(&a2dp, A2DP_CODEC_MPEG24, &sbc, sizeof(sbc));
+
+  ASSERT_EQ(0, get_sbc_codec_create_called());
+  ASSERT_NE(0, err);
+}
+
 TEST(A2dpInfoInit, DestroyA2dp) {
   ResetStubData();
-  init_a2dp(&a2dp, &sbc);
+  init_a2dp(&a2dp, A2DP_CODEC_SBC, &sbc, sizeof(sbc));
   destroy_a2dp(&a2dp);
 
   ASSERT_EQ(1, get_sbc_codec_destroy_called());
@@ -82,7 +94,7 @@ TEST(A2dpInfoInit, DestroyA2dp) {
 
 TEST(A2dpInfoInit, ResetA2dp) {
   ResetStubData();
-  init_a2dp(&a2dp, &sbc);
+  init_a2dp(&a2dp, A2DP_CODEC_SBC, &sbc, sizeof(sbc));
   a2dp.a2dp_buf_used = 99;
   a2dp.samples = 10;
   a2dp.seq_num = 11;
@@ -102,7 +114,7 @@ TEST(A2dpEncode, WriteA2dp) {
   unsigned int processed;
 
   ResetStubData();
-  init_a2dp(&a2dp, &sbc);
+  init_a2dp(&a2dp, A2DP_CODEC_SBC, &sbc, sizeof(sbc));
 
   set_sbc_codec_encoded_out(4);
   processed = a2dp_encode(&a2dp, NULL, 20, 4, (size_t)40);
@@ -125,6 +137,170 @@ TEST(A2dpEncode, WriteA2dp) {
   ASSERT_EQ(0, a2dp.seq_num);
 }
 
+TEST(A2dpEncode, SetBitpool) {
+  ResetStubData();
+  sbc.min_bitpool = 2;
+  init_a2dp(&a2dp, A2DP_CODEC_SBC, &sbc, sizeof(sbc));
+  ASSERT_EQ(50, a2dp.bitpool);
+
+  set_sbc_codec_frame_length(3);
+  EXPECT_EQ(30, a2dp_set_bitpool(&a2dp, 30));
+  EXPECT_EQ(30, get_sbc_set_bitpool_val());
+  EXPECT_EQ(3, a2dp.frame_length);
+
+  /* Clamped to the negotiated range. */
+  EXPECT_EQ(50, a2dp_set_bitpool(&a2dp, 100));
+  EXPECT_EQ(2, a2dp_set_bitpool(&a2dp, -4));
+
+  destroy_a2dp(&a2dp);
+}
+
+TEST(A2dpEncode, SetFramesPerPacket) {
+  ResetStubData();
+  init_a2dp(&a2dp, A2DP_CODEC_SBC, &sbc, sizeof(sbc));
+
+  /* frame_length 5, codesize 5. */
+  EXPECT_EQ(15 * 5, a2dp_block_size(&a2dp, 1000));
+  a2dp_set_frames_per_packet(&a2dp, 2);
+  EXPECT_EQ(2 * 5, a2dp_block_size(&a2dp, 1000));
+  a2dp_set_frames_per_packet(&a2dp, 0);
+  EXPECT_EQ(15 * 5, a2dp_block_size(&a2dp, 1000));
+
+  destroy_a2dp(&a2dp);
+}
+
+/* A codec which packs one frame per packet and has no payload header. It
+ * consumes FAKE_CODESIZE bytes and produces FAKE_FRAME_LENGTH bytes per
+ * frame. */
+#define FAKE_CODESIZE 8
+#define FAKE_FRAME_LENGTH 10
+
+static int fake_encode(struct cras_audio_codec* codec,
+                       const void* input,
+                       size_t input_len,
+                       void* output,
+                       size_t output_len,
+                       size_t* count) {
+  size_t frames = input_len / FAKE_CODESIZE;
+
+  if (frames > output_len / FAKE_FRAME_LENGTH)
+    frames = output_len / FAKE_FRAME_LENGTH;
+  *count = frames * FAKE_FRAME_LENGTH;
+  return frames * FAKE_CODESIZE;
+}
+
+static struct cras_audio_codec fake_audio_codec;
+
+static int fake_init(struct a2dp_info* a2dp, const void* config, int len) {
+  fake_audio_codec.encode = fake_encode;
+  a2dp->codec = &fake_audio_codec;
+  a2dp->codesize = FAKE_CODESIZE;
+  a2dp->frame_length = FAKE_FRAME_LENGTH;
+  return 0;
+}
+
+static void fake_destroy(struct a2dp_info* a2dp) {}
+
+static const struct cras_a2dp_codec fake_codec = {
+    .id = A2DP_CODEC_MPEG24,
+    .name = "fake",
+    .payload_type = 96,
+    .payload_header_len = 0,
+    .max_frames_per_packet = 1,
+    .init = fake_init,
+    .destroy = fake_destroy,
+};
+
+TEST(A2dpEncode, OneFramePerPacketCodec) {
+  uint8_t pcm[4 * FAKE_CODESIZE];
+  uint8_t packet[A2DP_BUF_SIZE_BYTES];
+  struct rtp_header* header = (struct rtp_header*)packet;
+  int sock[2];
+  int processed;
+  unsigned int packets;
+
+  ResetStubData();
+  ASSERT_EQ(0, cras_a2dp_codec_register(&fake_codec));
+  ASSERT_EQ(-EEXIST, cras_a2dp_codec_register(&fake_codec));
+  ASSERT_EQ(&fake_codec, cras_a2dp_codec_get(A2DP_CODEC_MPEG24));
+  ASSERT_EQ(0, init_a2dp(&a2dp, A2DP_CODEC_MPEG24, NULL, 0));
+  ASSERT_EQ(0, get_sbc_codec_create_called());
+
+  /* Only the RTP header, no media payload header. */
+  EXPECT_EQ(sizeof(struct rtp_header), a2dp.a2dp_buf_used);
+  /* Room for many frames in the MTU, but one frame per packet. */
+  EXPECT_EQ(FAKE_CODESIZE, a2dp_block_size(&a2dp, 100));
+
+  processed = a2dp_encode(&a2dp, pcm, sizeof(pcm), 4, (size_t)100);
+  EXPECT_EQ(FAKE_CODESIZE, processed);
+  EXPECT_EQ(1, a2dp.frame_count);
+  EXPECT_EQ(0, a2dp_encode(&a2dp, pcm, sizeof(pcm), 4, (size_t)100));
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM, 0, sock));
+  EXPECT_EQ(FAKE_CODESIZE / 4, a2dp_write(&a2dp, sock[0], 100, &packets));
+  EXPECT_EQ(1, packets);
+  EXPECT_EQ(sizeof(struct rtp_header) + FAKE_FRAME_LENGTH,
+            recv(sock[1], packet, sizeof(packet), 0));
+  EXPECT_EQ(96, header->pt);
+  EXPECT_EQ(0, a2dp.frame_count);
+  close(sock[0]);
+  close(sock[1]);
+
+  destroy_a2dp(&a2dp);
+  cras_a2dp_codec_unregister(&fake_codec);
+  EXPECT_EQ(NULL, cras_a2dp_codec_get(A2DP_CODEC_MPEG24));
+}
+
+TEST(A2dpEncode, BatchedPackets) {
+  uint8_t pcm[8 * FAKE_CODESIZE];
+  uint8_t packet[A2DP_BUF_SIZE_BYTES];
+  struct rtp_header* header = (struct rtp_header*)packet;
+  int sock[2];
+  unsigned int packets;
+  int processed = 0;
+
+  ResetStubData();
+  ASSERT_EQ(0, cras_a2dp_codec_register(&fake_codec));
+  ASSERT_EQ(0, init_a2dp(&a2dp, A2DP_CODEC_MPEG24, NULL, 0));
+
+  /* Clamped to the packet slots there are. */
+  a2dp_set_max_packets(&a2dp, 0);
+  EXPECT_EQ(1, a2dp.max_packets);
+  a2dp_set_max_packets(&a2dp, A2DP_MAX_BATCH_PACKETS + 1);
+  EXPECT_EQ(A2DP_MAX_BATCH_PACKETS, a2dp.max_packets);
+
+  /* Encoding moves on to the next packet until three are queued. */
+  a2dp_set_max_packets(&a2dp, 3);
+  for (int i = 0; i < 4; i++)
+    processed += a2dp_encode(&a2dp, pcm + processed, sizeof(pcm) - processed,
+                             4, (size_t)100);
+  EXPECT_EQ(3 * FAKE_CODESIZE, processed);
+  EXPECT_EQ(2, a2dp.num_packets);
+  EXPECT_EQ(3 * FAKE_CODESIZE / 4, a2dp_queued_frames(&a2dp));
+
+  /* All of them go out in one write, in order. */
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM, 0, sock));
+  EXPECT_EQ(3 * FAKE_CODESIZE / 4,
+            a2dp_write(&a2dp, sock[0], 100, &packets));
+  EXPECT_EQ(3, packets);
+  EXPECT_EQ(0, a2dp_queued_frames(&a2dp));
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(sizeof(struct rtp_header) + FAKE_FRAME_LENGTH,
+              recv(sock[1], packet, sizeof(packet), 0));
+    EXPECT_EQ(i, ntohs(header->sequence_number));
+    EXPECT_EQ((i + 1) * FAKE_CODESIZE / 4, ntohl(header->timestamp));
+  }
+
+  /* Nothing left to write. */
+  EXPECT_EQ(0, a2dp_write(&a2dp, sock[0], 100, &packets));
+  EXPECT_EQ(0, packets);
+  close(sock[0]);
+  close(sock[1]);
+
+  destroy_a2dp(&a2dp);
+  cras_a2dp_codec_unregister(&fake_codec);
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -9,7 +9,6 @@
 extern "C" {
 #include "cras_a2dp_iodev.c"
 
-#include "audio_thread.h"
 #include "audio_thread_log.h"
 #include "cras_audio_area.h"
 #include "cras_bt_transport.h"
@@ -24,6 +23,7 @@ extern "C" {
 /* Fake the codec to encode (512/4) frames into 128 bytes. */
 #define FAKE_A2DP_CODE_SIZE 512
 #define FAKE_A2DP_FRAME_LENGTH 128
+#define FAKE_A2DP_BITPOOL 53
 
 static struct cras_bt_transport* fake_transport;
 static cras_audio_format format;
@@ -33,6 +33,11 @@ static size_t cras_iodev_add_node_called;
 static size_t cras_iodev_rm_node_called;
 static size_t cras_iodev_set_active_node_called;
 static size_t cras_bt_transport_acquire_called;
+static size_t cras_bt_transport_acquire_async_called;
+static int cras_bt_transport_acquire_async_ret;
+static int rate_estimator_add_frames_num_frames;
+static int32_t rate_estimator_check_ret;
+static double rate_estimator_rate;
 static size_t cras_bt_transport_configuration_called;
 static size_t cras_bt_transport_release_called;
 static size_t init_a2dp_called;
@@ -44,17 +49,18 @@ static size_t cras_iodev_free_resources_called;
 static int a2dp_write_return_val[MAX_A2DP_WRITE_CALLS];
 static unsigned int a2dp_write_index;
 static int a2dp_encode_called;
+static unsigned int a2dp_set_max_packets_val;
+static unsigned int a2dp_max_batch_packets;
 static cras_audio_area* mock_audio_area;
-static thread_callback write_callback;
-static void* write_callback_data;
 static const char* fake_device_name = "fake device name";
 static const char* cras_bt_device_name_ret;
 static unsigned int cras_bt_transport_write_mtu_ret;
 static int cras_iodev_fill_odev_zeros_called;
 static unsigned int cras_iodev_fill_odev_zeros_frames;
-static int audio_thread_config_events_callback_called;
-static enum AUDIO_THREAD_EVENTS_CB_TRIGGER
-    audio_thread_config_events_callback_trigger;
+static size_t pthread_create_called;
+static size_t pthread_join_called;
+static size_t cras_audio_thread_event_a2dp_overrun_called;
+static bool bt_fix_a2dp_packet_size_enabled;
 
 void ResetStubData() {
   cras_bt_device_append_iodev_called = 0;
@@ -63,6 +69,8 @@ void ResetStubData() {
   cras_iodev_rm_node_called = 0;
   cras_iodev_set_active_node_called = 0;
   cras_bt_transport_acquire_called = 0;
+  cras_bt_transport_acquire_async_called = 0;
+  cras_bt_transport_acquire_async_ret = 0;
   cras_bt_transport_configuration_called = 0;
   cras_bt_transport_release_called = 0;
   init_a2dp_called = 0;
@@ -73,9 +81,18 @@ void ResetStubData() {
   cras_iodev_free_resources_called = 0;
   a2dp_write_index = 0;
   a2dp_encode_called = 0;
+  a2dp_set_max_packets_val = 1;
+  a2dp_max_batch_packets = 1;
   /* Fake the MTU value. min_buffer_level will be derived from this value. */
   cras_bt_transport_write_mtu_ret = 950;
   cras_iodev_fill_odev_zeros_called = 0;
+  pthread_create_called = 0;
+  pthread_join_called = 0;
+  cras_audio_thread_event_a2dp_overrun_called = 0;
+  bt_fix_a2dp_packet_size_enabled = false;
+  rate_estimator_add_frames_num_frames = 0;
+  rate_estimator_check_ret = 0;
+  rate_estimator_rate = 0;
 
   fake_transport = reinterpret_cast<struct cras_bt_transport*>(0x123);
 
@@ -83,8 +100,6 @@ void ResetStubData() {
     mock_audio_area = (cras_audio_area*)calloc(
         1, sizeof(*mock_audio_area) + sizeof(cras_channel_area) * 2);
   }
-
-  write_callback = NULL;
 }
 
 int iodev_set_format(struct cras_iodev* iodev, struct cras_audio_format* fmt) {
@@ -98,6 +113,19 @@ int iodev_set_format(struct cras_iodev* iodev, struct cras_audio_format* fmt) {
 namespace {
 
 static struct timespec time_now;
+
+/* The encoder thread isn't started in the test, so its passes are run
+ * directly after the audio thread side calls. */
+static void put_and_encode(struct cras_iodev* iodev, unsigned int frames) {
+  iodev->put_buffer(iodev, frames);
+  encode_and_flush((struct a2dp_io*)iodev);
+}
+
+static void no_stream_and_encode(struct cras_iodev* iodev, int enable) {
+  iodev->no_stream(iodev, enable);
+  encode_and_flush((struct a2dp_io*)iodev);
+}
+
 class A2dpIodev : public testing::Test {
  protected:
   virtual void SetUp() {
@@ -173,8 +201,10 @@ TEST_F(A2dpIodev, OpenIodev) {
   iodev->state = CRAS_IODEV_STATE_NORMAL_RUN;
 
   ASSERT_EQ(1, cras_bt_transport_acquire_called);
+  ASSERT_EQ(1, pthread_create_called);
 
   iodev->close_dev(iodev);
+  ASSERT_EQ(1, pthread_join_called);
   ASSERT_EQ(1, cras_bt_transport_release_called);
   ASSERT_EQ(1, a2dp_reset_called);
   ASSERT_EQ(1, cras_iodev_free_format_called);
@@ -182,6 +212,28 @@ TEST_F(A2dpIodev, OpenIodev) {
   a2dp_iodev_destroy(iodev);
 }
 
+TEST_F(A2dpIodev, OpenDevAcquiresTransportAhead) {
+  struct cras_iodev* iodev;
+
+  iodev = a2dp_iodev_create(fake_transport);
+
+  ASSERT_EQ(0, iodev->open_dev(iodev));
+  ASSERT_EQ(1, cras_bt_transport_acquire_async_called);
+  ASSERT_EQ(0, cras_bt_transport_acquire_called);
+
+  iodev_set_format(iodev, &format);
+  iodev->configure_dev(iodev);
+  ASSERT_EQ(1, cras_bt_transport_acquire_called);
+  iodev->close_dev(iodev);
+
+  /* Failing to send Acquire early leaves it to configure_dev. */
+  cras_bt_transport_acquire_async_ret = -ENOMEM;
+  ASSERT_EQ(0, iodev->open_dev(iodev));
+  ASSERT_EQ(2, cras_bt_transport_acquire_async_called);
+
+  a2dp_iodev_destroy(iodev);
+}
+
 TEST_F(A2dpIodev, GetPutBuffer) {
   struct cras_iodev* iodev;
   struct cras_audio_area *area1, *area2, *area3;
@@ -195,7 +247,6 @@ TEST_F(A2dpIodev, GetPutBuffer) {
 
   iodev_set_format(iodev, &format);
   iodev->configure_dev(iodev);
-  ASSERT_NE(write_callback, (void*)NULL);
 
   iodev->start(iodev);
   iodev->state = CRAS_IODEV_STATE_NORMAL_RUN;
@@ -208,7 +259,7 @@ TEST_F(A2dpIodev, GetPutBuffer) {
   ASSERT_EQ(1500, frames);
   ASSERT_EQ(1500, area1->frames);
   last_buf_head = area1->channels[0].buf;
-  iodev->put_buffer(iodev, 1000);
+  put_and_encode(iodev, 1000);
   /* 1000 frames takes 8 encode call, FAKE_A2DP_CODE_SIZE / 4 = 128
    * and 7 * 128 < 1000 < 8 * 128
    */
@@ -227,7 +278,7 @@ TEST_F(A2dpIodev, GetPutBuffer) {
   ASSERT_EQ(4000, area2->channels[0].buf - last_buf_head);
   last_buf_head = area2->channels[0].buf;
 
-  iodev->put_buffer(iodev, 700);
+  put_and_encode(iodev, 700);
   EXPECT_EQ(804, iodev->frames_queued(iodev, &tstamp));
   /* Assert that even next_flush_time is not met, pcm data still processed.
    * Expect to takes 7 more encode calls to process the 804 frames of data.
@@ -243,7 +294,7 @@ TEST_F(A2dpIodev, GetPutBuffer) {
   /* Assert buffer possition shifted 700 * 4 bytes */
   EXPECT_EQ(2800, area3->channels[0].buf - last_buf_head);
 
-  iodev->put_buffer(iodev, 50);
+  put_and_encode(iodev, 50);
   /* 804 + 50 = 854 queued, 768 of them are encoded. */
   EXPECT_EQ(854, iodev->frames_queued(iodev, &tstamp));
   EXPECT_EQ(768, a2dpio->a2dp.samples);
@@ -272,7 +323,6 @@ TEST_F(A2dpIodev, FramesQueued) {
   time_now.tv_sec = 0;
   time_now.tv_nsec = 0;
   iodev->configure_dev(iodev);
-  ASSERT_NE(write_callback, (void*)NULL);
   /* a2dp_block_size(mtu) / format_bytes
    * (950 - 13) / 128 * 512 / 4 = 896 */
   EXPECT_EQ(896, a2dpio->write_block);
@@ -286,7 +336,7 @@ TEST_F(A2dpIodev, FramesQueued) {
   ASSERT_EQ(256, area->frames);
 
   /* Data less than write_block hence not written. */
-  iodev->put_buffer(iodev, 200);
+  put_and_encode(iodev, 200);
   EXPECT_EQ(200, iodev->frames_queued(iodev, &tstamp));
   EXPECT_EQ(tstamp.tv_sec, time_now.tv_sec);
   EXPECT_EQ(tstamp.tv_nsec, time_now.tv_nsec);
@@ -295,26 +345,26 @@ TEST_F(A2dpIodev, FramesQueued) {
   a2dp_write_return_val[0] = 0;
   frames = 800;
   iodev->get_buffer(iodev, &area, &frames);
-  iodev->put_buffer(iodev, 800);
+  put_and_encode(iodev, 800);
   EXPECT_EQ(104, iodev->frames_queued(iodev, &tstamp));
 
   /* Some time has passed, same amount of frames are queued. */
   time_now.tv_nsec = 15000000;
-  write_callback(write_callback_data, POLLOUT);
+  EXPECT_EQ(A2DP_ENCODER_WAIT_TIME, encode_and_flush(a2dpio));
   EXPECT_EQ(104, iodev->frames_queued(iodev, &tstamp));
 
   /* Put 900 more frames. next_flush_time not yet passed so expect
    * total 900 + 104 = 1004 are queued. */
   frames = 900;
   iodev->get_buffer(iodev, &area, &frames);
-  iodev->put_buffer(iodev, 900);
+  put_and_encode(iodev, 900);
   EXPECT_EQ(1004, iodev->frames_queued(iodev, &tstamp));
 
   /* Time passes next_flush_time, 1004 + 300 - 896 = 408 */
   time_now.tv_nsec = 25000000;
   frames = 300;
   iodev->get_buffer(iodev, &area, &frames);
-  iodev->put_buffer(iodev, 300);
+  put_and_encode(iodev, 300);
   EXPECT_EQ(408, iodev->frames_queued(iodev, &tstamp));
 
   iodev->close_dev(iodev);
@@ -326,7 +376,6 @@ TEST_F(A2dpIodev, SleepTimeWithWriteThrottle) {
   struct cras_audio_area* area;
   unsigned frames;
   unsigned int level;
-  unsigned long target;
   struct timespec tstamp;
   struct a2dp_io* a2dpio;
 
@@ -335,7 +384,6 @@ TEST_F(A2dpIodev, SleepTimeWithWriteThrottle) {
 
   iodev_set_format(iodev, &format);
   iodev->configure_dev(iodev);
-  ASSERT_NE(write_callback, (void*)NULL);
   /* a2dp_block_size(mtu) / format_bytes
    * 900 / 128 * 512 / 4 = 896 */
   EXPECT_EQ(896, a2dpio->write_block);
@@ -343,88 +391,85 @@ TEST_F(A2dpIodev, SleepTimeWithWriteThrottle) {
   iodev->start(iodev);
   iodev->state = CRAS_IODEV_STATE_NORMAL_RUN;
 
-  /* Both time now and next_flush_time are at 0. Expect write_block of
-   * time to sleep */
+  /* Nothing queued. Expect write_block of time to sleep. */
   EXPECT_EQ(a2dpio->write_block,
             iodev->frames_to_play_in_sleep(iodev, &level, &tstamp));
 
-  /* Fake that 1000 frames are put and one block got flushed.
-   * Expect next_wake_time be fast forward by one flush_period. */
-  frames = 1000;
+  /* Put 3000 frames, the first block is flushed at time 0 and the next
+   * one is encoded ahead of its flush time. */
+  frames = 3000;
   iodev->get_buffer(iodev, &area, &frames);
-  ASSERT_EQ(1000, frames);
-  ASSERT_EQ(1000, area->frames);
-
-  /* Expect the first block be flushed at time 0. */
+  ASSERT_EQ(3000, frames);
+  iodev->put_buffer(iodev, 3000);
   time_now.tv_nsec = 0;
   a2dp_write_return_val[0] = 0;
-  EXPECT_EQ(0, iodev->put_buffer(iodev, 1000));
-  EXPECT_EQ(104, iodev->frames_queued(iodev, &tstamp)); /* 1000 - 896 */
-
-  /* Same amount of frames are queued after some time has passed. */
-  time_now.tv_nsec = 10000000;
-  EXPECT_EQ(104, iodev->frames_queued(iodev, &tstamp));
+  EXPECT_EQ(A2DP_ENCODER_WAIT_TIME, encode_and_flush(a2dpio));
+  EXPECT_EQ(1, a2dp_write_index);
+  EXPECT_EQ(2104, iodev->frames_queued(iodev, &tstamp)); /* 3000 - 896 */
 
-  /* Expect to sleep the time between now(10ms) and next_flush_time(~20.3ms). */
-  frames = iodev->frames_to_play_in_sleep(iodev, &level, &tstamp);
-  target =
-      a2dpio->write_block - time_now.tv_nsec * format.frame_rate / 1000000000;
-  EXPECT_GE(frames + 1, target);
-  EXPECT_GE(target + 1, frames);
+  /* Expect to sleep until the level, less the block being sent, drops to
+   * min_buffer_level: 2104 - 896 - 896. */
+  EXPECT_EQ(312, iodev->frames_to_play_in_sleep(iodev, &level, &tstamp));
+  EXPECT_EQ(1208, level);
 
-  /* Time now has passed the next flush time(~20.3ms), expect to return
-   * write_block of time to sleep. */
+  /* Time passes the next flush time but the socket throttles. Expect the
+   * encoder to wait for the socket and nothing drained. */
   time_now.tv_nsec = 25000000;
-  EXPECT_EQ(a2dpio->write_block,
-            iodev->frames_to_play_in_sleep(iodev, &level, &tstamp));
+  a2dp_write_return_val[1] = -EAGAIN;
+  EXPECT_EQ(A2DP_ENCODER_WAIT_SOCKET, encode_and_flush(a2dpio));
+  EXPECT_EQ(2104, iodev->frames_queued(iodev, &tstamp));
 
-  a2dp_write_return_val[1] = 0;
-  frames = 1000;
-  iodev->get_buffer(iodev, &area, &frames);
-  EXPECT_EQ(0, iodev->put_buffer(iodev, 1000));
-  EXPECT_EQ(208, iodev->frames_queued(iodev, &tstamp)); /* 104 + 1000 - 896 */
-
-  /* Flush another write_block of data, next_wake_time fast forward by
-   * another flush_period. Expect to sleep the time between now(25ms)
-   * and next_flush_time(~40.6ms). */
-  frames = iodev->frames_to_play_in_sleep(iodev, &level, &tstamp);
-  target = a2dpio->write_block * 2 -
-           time_now.tv_nsec * format.frame_rate / 1000000000;
-  EXPECT_GE(frames + 1, target);
-  EXPECT_GE(target + 1, frames);
-
-  /* Put 1000 more frames, and make a fake failure to this flush. */
-  time_now.tv_nsec = 45000000;
-  a2dp_write_return_val[2] = -EAGAIN;
-  frames = 1000;
-  iodev->get_buffer(iodev, &area, &frames);
-  EXPECT_EQ(0, iodev->put_buffer(iodev, 1000));
+  /* The socket becomes writable so data continues to flush. */
+  a2dp_write_return_val[2] = 0;
+  EXPECT_EQ(A2DP_ENCODER_WAIT_TIME, encode_and_flush(a2dpio));
+  EXPECT_EQ(3, a2dp_write_index);
+  EXPECT_EQ(1208, iodev->frames_queued(iodev, &tstamp)); /* 2104 - 896 */
 
-  /* Last a2dp write call failed with -EAGAIN, time now(45ms) is after
-   * next_flush_time. Expect to return exact |write_block| equivalant
-   * of time to sleep. */
-  EXPECT_EQ(1208, iodev->frames_queued(iodev, &tstamp)); /* 208 + 1000 */
+  /* Level is at min_buffer_level. Expect write_block of time to sleep. */
   EXPECT_EQ(a2dpio->write_block,
             iodev->frames_to_play_in_sleep(iodev, &level, &tstamp));
 
-  /* Fake the event that socket becomes writable so data continues to flush.
-   * next_flush_time fast forwards by another flush_period. */
-  a2dp_write_return_val[3] = 0;
-  write_callback(write_callback_data, POLLOUT);
-  EXPECT_EQ(312, iodev->frames_queued(iodev, &tstamp)); /* 1208 - 896 */
+  iodev->close_dev(iodev);
+  a2dp_iodev_destroy(iodev);
+}
+
+TEST_F(A2dpIodev, LateFlushBatchesPackets) {
+  struct cras_iodev* iodev;
+  struct cras_audio_area* area;
+  unsigned frames;
+  struct a2dp_io* a2dpio;
+
+  iodev = a2dp_iodev_create(fake_transport);
+  a2dpio = (struct a2dp_io*)iodev;
+
+  iodev_set_format(iodev, &format);
+  iodev->configure_dev(iodev);
+  rate_estimator_rate = 44100;
+  iodev->start(iodev);
+  iodev->state = CRAS_IODEV_STATE_NORMAL_RUN;
 
-  /* Expect to sleep the time between now and next_flush_time(~60.9ms). */
-  frames = iodev->frames_to_play_in_sleep(iodev, &level, &tstamp);
-  target = a2dpio->write_block * 3 -
-           time_now.tv_nsec * format.frame_rate / 1000000000;
-  EXPECT_GE(frames + 1, target);
-  EXPECT_GE(target + 1, frames);
+  frames = 4000;
+  iodev->get_buffer(iodev, &area, &frames);
+  ASSERT_EQ(4000, frames);
+  iodev->put_buffer(iodev, 4000);
+  time_now.tv_nsec = 0;
+  a2dp_write_return_val[0] = 0;
+  EXPECT_EQ(A2DP_ENCODER_WAIT_TIME, encode_and_flush(a2dpio));
+  EXPECT_EQ(1, a2dp_max_batch_packets);
+
+  /* Two flush periods late, but only one block above min_buffer_level is
+   * encoded ahead to catch up. */
+  time_now.tv_nsec = 60000000;
+  a2dp_write_return_val[1] = 0;
+  encode_and_flush(a2dpio);
+  EXPECT_EQ(2, a2dp_max_batch_packets);
+  EXPECT_EQ(1, a2dp_set_max_packets_val);
 
   iodev->close_dev(iodev);
   a2dp_iodev_destroy(iodev);
 }
 
-TEST_F(A2dpIodev, EnableThreadCallbackAtBufferFull) {
+TEST_F(A2dpIodev, ReportOverrunAtBufferFull) {
   struct cras_iodev* iodev;
   struct cras_audio_area* area;
   struct timespec tstamp;
@@ -438,39 +483,257 @@ TEST_F(A2dpIodev, EnableThreadCallbackAtBufferFull) {
   time_now.tv_sec = 0;
   time_now.tv_nsec = 0;
   iodev->configure_dev(iodev);
-  ASSERT_NE(write_callback, (void*)NULL);
 
   iodev->start(iodev);
   iodev->state = CRAS_IODEV_STATE_NORMAL_RUN;
 
-  audio_thread_config_events_callback_called = 0;
-  a2dp_write_return_val[0] = 0;
+  /* Cram into iodev as much data as possible. */
   frames = iodev->buffer_size;
   iodev->get_buffer(iodev, &area, &frames);
   EXPECT_LE(frames, iodev->buffer_size);
   EXPECT_EQ(0, iodev->put_buffer(iodev, frames));
+  EXPECT_EQ(1, cras_audio_thread_event_a2dp_overrun_called);
+
+  /* The encoder flushes one block and encodes the next one ahead, which
+   * makes room for two blocks of PCM. */
+  a2dp_write_return_val[0] = 0;
+  EXPECT_EQ(A2DP_ENCODER_WAIT_TIME, encode_and_flush(a2dpio));
   EXPECT_EQ(1, a2dp_write_index);
   EXPECT_EQ(a2dpio->flush_period.tv_nsec, a2dpio->next_flush_time.tv_nsec);
-  EXPECT_EQ(1, audio_thread_config_events_callback_called);
-  EXPECT_EQ(TRIGGER_NONE, audio_thread_config_events_callback_trigger);
-
-  /* Fastfoward time 1ms, not yet reaches the next flush time. */
-  time_now.tv_nsec = 1000000;
-
-  /* Cram into iodev as much data as possible. Expect its buffer to
-   * be full because flush time does not yet met. */
   frames = iodev->buffer_size;
   iodev->get_buffer(iodev, &area, &frames);
-  EXPECT_LE(frames, iodev->buffer_size);
+  EXPECT_EQ(2 * a2dpio->write_block, frames);
   EXPECT_EQ(0, iodev->put_buffer(iodev, frames));
+  EXPECT_EQ(2, cras_audio_thread_event_a2dp_overrun_called);
   frames = iodev->frames_queued(iodev, &tstamp);
   EXPECT_EQ(frames, iodev->buffer_size);
 
-  /* Expect a2dp_write didn't get called in last get/put buffer. And
-   * audio thread callback has been enabled. */
-  EXPECT_EQ(1, a2dp_write_index);
-  EXPECT_EQ(2, audio_thread_config_events_callback_called);
-  EXPECT_EQ(TRIGGER_WAKEUP, audio_thread_config_events_callback_trigger);
+  iodev->close_dev(iodev);
+  a2dp_iodev_destroy(iodev);
+}
+
+TEST_F(A2dpIodev, PutBufferWakesEncoderWaitingForData) {
+  struct cras_iodev* iodev;
+  struct cras_audio_area* area;
+  unsigned frames;
+  eventfd_t count;
+  struct a2dp_io* a2dpio;
+
+  iodev = a2dp_iodev_create(fake_transport);
+  a2dpio = (struct a2dp_io*)iodev;
+
+  iodev_set_format(iodev, &format);
+  iodev->configure_dev(iodev);
+  iodev->start(iodev);
+  iodev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+  /* Drain the wake up from start(). */
+  eventfd_read(a2dpio->wake_fd, &count);
+
+  /* Not enough for a packet, the encoder waits for data. */
+  frames = 200;
+  iodev->get_buffer(iodev, &area, &frames);
+  put_and_encode(iodev, 200);
+  EXPECT_EQ(0, a2dp_write_index);
+  EXPECT_EQ(1, a2dpio->need_data);
+
+  /* Queuing more PCM wakes the encoder once. */
+  frames = 100;
+  iodev->get_buffer(iodev, &area, &frames);
+  iodev->put_buffer(iodev, 100);
+  EXPECT_EQ(0, a2dpio->need_data);
+  EXPECT_EQ(0, eventfd_read(a2dpio->wake_fd, &count));
+  EXPECT_EQ(1, count);
+
+  iodev->close_dev(iodev);
+  a2dp_iodev_destroy(iodev);
+}
+
+TEST_F(A2dpIodev, BitpoolFollowsBackpressure) {
+  struct cras_iodev* iodev;
+  struct cras_audio_area* area;
+  unsigned frames;
+  struct a2dp_io* a2dpio;
+  int i;
+
+  iodev = a2dp_iodev_create(fake_transport);
+  a2dpio = (struct a2dp_io*)iodev;
+
+  iodev_set_format(iodev, &format);
+  iodev->configure_dev(iodev);
+  iodev->start(iodev);
+  iodev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+  EXPECT_EQ(FAKE_A2DP_BITPOOL, a2dpio->a2dp.bitpool);
+  /* 900 / 128 frames of 512 bytes per packet. */
+  EXPECT_EQ(7, a2dpio->a2dp.max_frames_per_packet);
+
+  frames = 3000;
+  iodev->get_buffer(iodev, &area, &frames);
+  iodev->put_buffer(iodev, 3000);
+  time_now.tv_nsec = 0;
+  a2dp_write_return_val[0] = 0;
+  EXPECT_EQ(A2DP_ENCODER_WAIT_TIME, encode_and_flush(a2dpio));
+  EXPECT_EQ(FAKE_A2DP_BITPOOL, a2dpio->a2dp.bitpool);
+
+  /* The socket backs up, expect the bitpool to step down once. */
+  time_now.tv_nsec = 25000000;
+  a2dp_write_return_val[1] = -EAGAIN;
+  EXPECT_EQ(A2DP_ENCODER_WAIT_SOCKET, encode_and_flush(a2dpio));
+  EXPECT_EQ(FAKE_A2DP_BITPOOL - BITPOOL_DECREASE_STEP,
+            a2dpio->a2dp.bitpool);
+  a2dp_write_return_val[2] = -EAGAIN;
+  EXPECT_EQ(A2DP_ENCODER_WAIT_SOCKET, encode_and_flush(a2dpio));
+  EXPECT_EQ(FAKE_A2DP_BITPOOL - BITPOOL_DECREASE_STEP,
+            a2dpio->a2dp.bitpool);
+
+  /* Packets on time bring it back up by one. */
+  for (i = 0; i < BITPOOL_RECOVER_PACKETS; i++)
+    handle_packet_written(a2dpio, 0);
+  EXPECT_EQ(FAKE_A2DP_BITPOOL - BITPOOL_DECREASE_STEP + 1,
+            a2dpio->a2dp.bitpool);
+
+  /* A late packet once the hold off expired steps it down again. */
+  handle_packet_written(a2dpio, 1);
+  EXPECT_EQ(FAKE_A2DP_BITPOOL - 2 * BITPOOL_DECREASE_STEP + 1,
+            a2dpio->a2dp.bitpool);
+
+  /* Reopening starts over from the negotiated bitpool. */
+  iodev->close_dev(iodev);
+  iodev->configure_dev(iodev);
+  EXPECT_EQ(FAKE_A2DP_BITPOOL, a2dpio->a2dp.bitpool);
+
+  iodev->close_dev(iodev);
+  a2dp_iodev_destroy(iodev);
+}
+
+TEST_F(A2dpIodev, LowLatencyTargetLevel) {
+  struct cras_iodev* iodev;
+  struct cras_audio_area* area;
+  struct cras_rstream rstream;
+  struct dev_stream stream;
+  unsigned frames;
+  struct a2dp_io* a2dpio;
+  int i;
+
+  iodev = a2dp_iodev_create(fake_transport);
+  a2dpio = (struct a2dp_io*)iodev;
+
+  iodev_set_format(iodev, &format);
+  iodev->configure_dev(iodev);
+  iodev->start(iodev);
+  iodev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+  ASSERT_EQ(896, iodev->min_buffer_level);
+
+  /* Without a voice communication stream the queue isn't limited. */
+  frames = 5000;
+  iodev->get_buffer(iodev, &area, &frames);
+  EXPECT_EQ(5000, frames);
+
+  memset(&rstream, 0, sizeof(rstream));
+  memset(&stream, 0, sizeof(stream));
+  rstream.stream_type = CRAS_STREAM_TYPE_VOICE_COMMUNICATION;
+  stream.stream = &rstream;
+  DL_APPEND(iodev->streams, &stream);
+
+  /* Two write blocks above min_buffer_level to start with. */
+  frames = 5000;
+  iodev->get_buffer(iodev, &area, &frames);
+  EXPECT_EQ(3 * 896, frames);
+  iodev->put_buffer(iodev, 2000);
+  frames = 5000;
+  iodev->get_buffer(iodev, &area, &frames);
+  EXPECT_EQ(3 * 896 - 2000, frames);
+  iodev->put_buffer(iodev, frames);
+  frames = 5000;
+  iodev->get_buffer(iodev, &area, &frames);
+  EXPECT_EQ(0, frames);
+
+  /* Backpressure widens the target by a block. */
+  handle_backpressure(a2dpio);
+  frames = 5000;
+  iodev->get_buffer(iodev, &area, &frames);
+  EXPECT_EQ(896, frames);
+
+  /* It narrows again after packets go out on time, but never below one
+   * block above min_buffer_level. */
+  a2dpio->sock_depth_bytes = 0; /* Nothing left in the socket. */
+  for (i = 0; i < 4 * LL_TARGET_SHRINK_PACKETS; i++)
+    handle_packet_written(a2dpio, 0);
+  EXPECT_EQ(LL_TARGET_MIN_BLOCKS, a2dpio->target_blocks);
+
+  /* The target widens up to LL_TARGET_MAX_BLOCKS. */
+  for (i = 0; i < 2 * LL_TARGET_MAX_BLOCKS; i++)
+    handle_packet_written(a2dpio, 1);
+  EXPECT_EQ(LL_TARGET_MAX_BLOCKS, a2dpio->target_blocks);
+
+  DL_DELETE(iodev->streams, &stream);
+  iodev->close_dev(iodev);
+  a2dp_iodev_destroy(iodev);
+}
+
+TEST_F(A2dpIodev, FlushPeriodFollowsDrainRate) {
+  struct cras_iodev* iodev;
+  struct cras_audio_area* area;
+  unsigned frames;
+  struct a2dp_io* a2dpio;
+  struct timespec period;
+
+  iodev = a2dp_iodev_create(fake_transport);
+  a2dpio = (struct a2dp_io*)iodev;
+
+  iodev_set_format(iodev, &format);
+  iodev->configure_dev(iodev);
+  iodev->start(iodev);
+  iodev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+  cras_frames_to_time(a2dpio->write_block, 44100, &period);
+  EXPECT_EQ(period.tv_sec, a2dpio->flush_period.tv_sec);
+  EXPECT_EQ(period.tv_nsec, a2dpio->flush_period.tv_nsec);
+
+  /* The headset drains slower than 44100, packets go out less often. */
+  frames = 3000;
+  iodev->get_buffer(iodev, &area, &frames);
+  iodev->put_buffer(iodev, 3000);
+  time_now.tv_nsec = 0;
+  a2dp_write_return_val[0] = 0;
+  rate_estimator_check_ret = 1;
+  rate_estimator_rate = 44000;
+  EXPECT_EQ(A2DP_ENCODER_WAIT_TIME, encode_and_flush(a2dpio));
+  EXPECT_EQ(a2dpio->write_block, rate_estimator_add_frames_num_frames);
+  cras_frames_to_time_precise(a2dpio->write_block, 44000, &period);
+  EXPECT_EQ(period.tv_nsec, a2dpio->flush_period.tv_nsec);
+  EXPECT_EQ(period.tv_nsec, a2dpio->next_flush_time.tv_nsec);
+
+  /* Reopening starts over from the nominal rate. */
+  iodev->close_dev(iodev);
+  iodev->configure_dev(iodev);
+  cras_frames_to_time(a2dpio->write_block, 44100, &period);
+  EXPECT_EQ(period.tv_nsec, a2dpio->flush_period.tv_nsec);
+
+  iodev->close_dev(iodev);
+  a2dp_iodev_destroy(iodev);
+}
+
+TEST_F(A2dpIodev, FixedPacketSizeKeepsBitpool) {
+  struct cras_iodev* iodev;
+  struct cras_audio_area* area;
+  unsigned frames;
+  struct a2dp_io* a2dpio;
+
+  iodev = a2dp_iodev_create(fake_transport);
+  a2dpio = (struct a2dp_io*)iodev;
+
+  bt_fix_a2dp_packet_size_enabled = true;
+  iodev_set_format(iodev, &format);
+  iodev->configure_dev(iodev);
+  iodev->start(iodev);
+  iodev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+
+  frames = 3000;
+  iodev->get_buffer(iodev, &area, &frames);
+  iodev->put_buffer(iodev, 3000);
+  time_now.tv_nsec = 0;
+  a2dp_write_return_val[0] = -EAGAIN;
+  EXPECT_EQ(A2DP_ENCODER_WAIT_SOCKET, encode_and_flush(a2dpio));
+  EXPECT_EQ(FAKE_A2DP_BITPOOL, a2dpio->a2dp.bitpool);
 
   iodev->close_dev(iodev);
   a2dp_iodev_destroy(iodev);
@@ -486,7 +749,6 @@ TEST_F(A2dpIodev, FlushAtLowBufferLevel) {
 
   iodev_set_format(iodev, &format);
   iodev->configure_dev(iodev);
-  ASSERT_NE(write_callback, (void*)NULL);
 
   /* (950 - 13)/ 128 * 512 / 4 */
   ASSERT_EQ(iodev->min_buffer_level, 896);
@@ -505,6 +767,7 @@ TEST_F(A2dpIodev, FlushAtLowBufferLevel) {
    */
   a2dp_write_return_val[0] = 0;
   EXPECT_EQ(0, iodev->put_buffer(iodev, 1500));
+  encode_and_flush((struct a2dp_io*)iodev);
   EXPECT_EQ(1, a2dp_write_index);
 
   /* 1500 - 896 */
@@ -541,7 +804,7 @@ TEST_F(A2dpIodev, HandleUnderrun) {
   a2dp_write_return_val[0] = -EAGAIN;
 
   time_now.tv_nsec = 10000000;
-  iodev->put_buffer(iodev, 300);
+  put_and_encode(iodev, 300);
 
   time_now.tv_nsec = 20000000;
   EXPECT_EQ(300, iodev->frames_queued(iodev, &tstamp));
@@ -571,7 +834,6 @@ TEST_F(A2dpIodev, LeavingNoStreamStateWithSmallStreamDoesntUnderrun) {
   time_now.tv_sec = 0;
   time_now.tv_nsec = 0;
   iodev->configure_dev(iodev);
-  ASSERT_NE(write_callback, (void*)NULL);
   /* (950 - 13)/ 128 * 512 / 4 */
   ASSERT_EQ(896, iodev->min_buffer_level);
 
@@ -581,7 +843,7 @@ TEST_F(A2dpIodev, LeavingNoStreamStateWithSmallStreamDoesntUnderrun) {
   /* Put iodev in no_stream state. Verify it doesn't underrun after each
    * call of no_stream ops. */
   a2dp_write_return_val[0] = 0;
-  iodev->no_stream(iodev, 1);
+  no_stream_and_encode(iodev, 1);
   EXPECT_EQ(1, a2dp_write_index);
   EXPECT_EQ(a2dpio->flush_period.tv_nsec, a2dpio->next_flush_time.tv_nsec);
   frames = iodev->frames_queued(iodev, &tstamp);
@@ -590,7 +852,7 @@ TEST_F(A2dpIodev, LeavingNoStreamStateWithSmallStreamDoesntUnderrun) {
   /* Some time has passed and a small stream of 200 frames block is added.
    * Verify leaving no_stream state doesn't underrun immediately. */
   time_now.tv_nsec = 20000000;
-  iodev->no_stream(iodev, 1);
+  no_stream_and_encode(iodev, 1);
   frames = 200;
   iodev->get_buffer(iodev, &area, &frames);
   iodev->put_buffer(iodev, 200);
@@ -615,7 +877,6 @@ TEST_F(A2dpIodev, NoStreamStateFillZerosToTargetLevel) {
   time_now.tv_sec = 0;
   time_now.tv_nsec = 0;
   iodev->configure_dev(iodev);
-  ASSERT_NE(write_callback, (void*)NULL);
   /* (950 - 13)/ 128 * 512 / 4 */
   ASSERT_EQ(896, iodev->min_buffer_level);
 
@@ -625,24 +886,24 @@ TEST_F(A2dpIodev, NoStreamStateFillZerosToTargetLevel) {
   iodev->min_cb_level = 480;
   frames = 200;
   iodev->get_buffer(iodev, &area, &frames);
-  iodev->put_buffer(iodev, 200);
+  put_and_encode(iodev, 200);
 
   a2dp_write_return_val[0] = 0;
-  iodev->no_stream(iodev, 1);
+  no_stream_and_encode(iodev, 1);
   EXPECT_EQ(1, a2dp_write_index);
   EXPECT_EQ(a2dpio->flush_period.tv_nsec, a2dpio->next_flush_time.tv_nsec);
 
   /* Some time has passed but not yet reach next flush. Entering no_stream
    * fills buffer to 3 times of min_buffer_level. */
   time_now.tv_nsec = 10000000;
-  iodev->no_stream(iodev, 1);
+  no_stream_and_encode(iodev, 1);
   frames = iodev->frames_queued(iodev, &tstamp);
   EXPECT_EQ(3 * iodev->min_buffer_level, frames);
 
   /* Time has passed next flush time, expect one block is flushed.  */
   a2dp_write_return_val[1] = 0;
   time_now.tv_nsec = 25000000;
-  iodev->no_stream(iodev, 1);
+  no_stream_and_encode(iodev, 1);
   frames = iodev->frames_queued(iodev, &tstamp);
   ASSERT_EQ(2 * iodev->min_buffer_level, frames);
   EXPECT_EQ(2, a2dp_write_index);
@@ -674,7 +935,6 @@ TEST_F(A2dpIodev, EnterNoStreamStateAtHighBufferLevelDoesntFillMore) {
   time_now.tv_sec = 0;
   time_now.tv_nsec = 0;
   iodev->configure_dev(iodev);
-  ASSERT_NE(write_callback, (void*)NULL);
   /* (950 - 13)/ 128 * 512 / 4 */
   ASSERT_EQ(896, iodev->min_buffer_level);
 
@@ -685,7 +945,7 @@ TEST_F(A2dpIodev, EnterNoStreamStateAtHighBufferLevelDoesntFillMore) {
   start_level = 6000;
   frames = start_level;
   iodev->get_buffer(iodev, &area, &frames);
-  iodev->put_buffer(iodev, frames);
+  put_and_encode(iodev, frames);
   frames = iodev->frames_queued(iodev, &tstamp);
   /* Assert one block has fluxhed */
   EXPECT_EQ(start_level - iodev->min_buffer_level, frames);
@@ -694,14 +954,14 @@ TEST_F(A2dpIodev, EnterNoStreamStateAtHighBufferLevelDoesntFillMore) {
 
   a2dp_write_return_val[1] = 0;
   time_now.tv_nsec = 25000000;
-  iodev->no_stream(iodev, 1);
+  no_stream_and_encode(iodev, 1);
   frames = iodev->frames_queued(iodev, &tstamp);
   /* Next flush time meets requirement so another block is flushed. */
   ASSERT_EQ(start_level - 2 * iodev->min_buffer_level, frames);
 
   a2dp_write_return_val[2] = 0;
   time_now.tv_nsec = 50000000;
-  iodev->no_stream(iodev, 1);
+  no_stream_and_encode(iodev, 1);
   frames = iodev->frames_queued(iodev, &tstamp);
   /* Another block flushed at leaving no stream state. No more data
    * filled because level is high. */
@@ -724,7 +984,11 @@ int cras_bt_transport_configuration(const struct cras_bt_transport* transport,
                                     int len) {
   memset(configuration, 0, len);
   cras_bt_transport_configuration_called++;
-  return 0;
+  return len;
+}
+
+int cras_bt_transport_codec(const struct cras_bt_transport* transport) {
+  return A2DP_CODEC_SBC;
 }
 
 int cras_bt_transport_acquire(struct cras_bt_transport* transport) {
@@ -732,6 +996,11 @@ int cras_bt_transport_acquire(struct cras_bt_transport* transport) {
   return 0;
 }
 
+int cras_bt_transport_acquire_async(struct cras_bt_transport* transport) {
+  cras_bt_transport_acquire_async_called++;
+  return cras_bt_transport_acquire_async_ret;
+}
+
 int cras_bt_transport_release(struct cras_bt_transport* transport,
                               unsigned int blocking) {
   cras_bt_transport_release_called++;
@@ -829,11 +1098,17 @@ int cras_bt_device_schedule_suspend(
   return 0;
 }
 
-int init_a2dp(struct a2dp_info* a2dp, a2dp_sbc_t* sbc) {
+int init_a2dp(struct a2dp_info* a2dp,
+              uint8_t codec_id,
+              const void* config,
+              int len) {
   init_a2dp_called++;
   memset(a2dp, 0, sizeof(*a2dp));
   a2dp->frame_length = FAKE_A2DP_FRAME_LENGTH;
   a2dp->codesize = FAKE_A2DP_CODE_SIZE;
+  a2dp->bitpool = FAKE_A2DP_BITPOOL;
+  a2dp->min_bitpool = 2;
+  a2dp->max_bitpool = FAKE_A2DP_BITPOOL;
   return init_a2dp_return_val;
 }
 
@@ -845,6 +1120,27 @@ int a2dp_codesize(struct a2dp_info* a2dp) {
   return a2dp->codesize;
 }
 
+void a2dp_set_frames_per_packet(struct a2dp_info* a2dp, int frames) {
+  a2dp->max_frames_per_packet = frames;
+}
+
+int a2dp_set_bitpool(struct a2dp_info* a2dp, int bitpool) {
+  if (bitpool < a2dp->min_bitpool)
+    bitpool = a2dp->min_bitpool;
+  if (bitpool > a2dp->max_bitpool)
+    bitpool = a2dp->max_bitpool;
+  a2dp->bitpool = bitpool;
+  return bitpool;
+}
+
+int a2dp_get_format(struct a2dp_info* a2dp,
+                    size_t* rate,
+                    size_t* num_channels) {
+  *rate = 44100;
+  *num_channels = 2;
+  return 0;
+}
+
 int a2dp_block_size(struct a2dp_info* a2dp, int encoded_bytes) {
   return encoded_bytes / a2dp->frame_length * a2dp->codesize;
 }
@@ -878,8 +1174,18 @@ int a2dp_encode(struct a2dp_info* a2dp,
   return processed;
 }
 
-int a2dp_write(struct a2dp_info* a2dp, int stream_fd, size_t link_mtu) {
+void a2dp_set_max_packets(struct a2dp_info* a2dp, unsigned int packets) {
+  a2dp_set_max_packets_val = packets;
+  if (packets > a2dp_max_batch_packets)
+    a2dp_max_batch_packets = packets;
+}
+
+int a2dp_write(struct a2dp_info* a2dp,
+               int stream_fd,
+               size_t link_mtu,
+               unsigned int* packets) {
   int ret, samples;
+  *packets = 0;
   if (a2dp->frame_length + a2dp->a2dp_buf_used < link_mtu)
     return 0;
 
@@ -890,6 +1196,7 @@ int a2dp_write(struct a2dp_info* a2dp, int stream_fd, size_t link_mtu) {
   samples = a2dp->samples;
   a2dp->samples = 0;
   a2dp->a2dp_buf_used = 0;
+  *packets = 1;
   return samples;
 }
 
@@ -920,36 +1227,70 @@ void cras_audio_area_config_buf_pointers(struct cras_audio_area* area,
   mock_audio_area->channels[0].buf = base_buffer;
 }
 
-struct audio_thread* cras_iodev_list_get_audio_thread() {
-  return NULL;
-}
 // From ewma_power
 void ewma_power_disable(struct ewma_power* ewma) {}
 
 // From audio_thread
 struct audio_thread_event_log* atlog;
 
-void audio_thread_add_events_callback(int fd,
-                                      thread_callback cb,
-                                      void* data,
-                                      int events) {
-  write_callback = cb;
-  write_callback_data = data;
 }
 
-int audio_thread_rm_callback_sync(struct audio_thread* thread, int fd) {
+bool cras_system_get_bt_fix_a2dp_packet_size_enabled() {
+  return bt_fix_a2dp_packet_size_enabled;
+}
+
+int cras_audio_thread_event_a2dp_overrun() {
+  cras_audio_thread_event_a2dp_overrun_called++;
   return 0;
 }
 
-void audio_thread_config_events_callback(
-    int fd,
-    enum AUDIO_THREAD_EVENTS_CB_TRIGGER trigger) {
-  audio_thread_config_events_callback_called++;
-  audio_thread_config_events_callback_trigger = trigger;
+// From rate_estimator
+struct rate_estimator* rate_estimator_create(unsigned int rate,
+                                             const struct timespec* window_size,
+                                             double smooth_factor) {
+  return reinterpret_cast<struct rate_estimator*>(0x456);
 }
+
+void rate_estimator_destroy(struct rate_estimator* re) {}
+
+void rate_estimator_add_frames(struct rate_estimator* re, int frames) {
+  rate_estimator_add_frames_num_frames += frames;
 }
 
-int cras_audio_thread_event_a2dp_overrun() {
+int32_t rate_estimator_check(struct rate_estimator* re,
+                             int level,
+                             const struct timespec* now) {
+  return rate_estimator_check_ret;
+}
+
+double rate_estimator_get_rate(const struct rate_estimator* re) {
+  return rate_estimator_rate;
+}
+
+void rate_estimator_reset_rate(struct rate_estimator* re, unsigned int rate) {
+  rate_estimator_rate = rate;
+}
+
+//  From libpthread.
+int pthread_create(pthread_t* thread,
+                   const pthread_attr_t* attr,
+                   void* (*start_routine)(void*),
+                   void* arg) {
+  pthread_create_called++;
+  return 0;
+}
+
+int pthread_join(pthread_t thread, void** value_ptr) {
+  pthread_join_called++;
+  return 0;
+}
+
+// From cras_util
+int cras_set_rt_scheduling(int rt_lim) {
+  return 0;
+}
+
+int cras_set_thread_priority(int priority) {
   return 0;
 }
 
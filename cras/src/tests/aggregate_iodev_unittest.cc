@@ -0,0 +1,413 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+extern "C" {
+#include "cras_aggregate_iodev.h"
+#include "cras_audio_area.h"
+#include "cras_iodev.h"
+#include "linear_resampler.h"
+#include "rate_estimator.h"
+}
+
+#define FAKE_FRAMES 1024
+
+static unsigned int iodev_list_add_output_called;
+static unsigned int iodev_list_rm_output_called;
+static int rate_estimator_check_ret;
+static double rate_estimator_rate;
+static unsigned int resampler_created;
+static float resampler_from, resampler_to;
+static unsigned int resampler_set_rates_called;
+static unsigned int resample_called;
+
+// An output device playing into a plain array.
+struct fake_dev {
+  struct cras_iodev base;
+  int16_t buf[FAKE_FRAMES * 2];
+  size_t rates[3];
+  size_t channel_counts[3];
+  snd_pcm_format_t formats[2];
+  unsigned int written;
+  int open_called;
+  int configure_called;
+  int close_called;
+  int start_called;
+  int flush_called;
+  // Room for the one channel area the frames are interleaved in.
+  union {
+    struct cras_audio_area area;
+    uint8_t area_storage[sizeof(struct cras_audio_area) +
+                         sizeof(struct cras_channel_area)];
+  };
+};
+
+static int fake_open_dev(struct cras_iodev* iodev) {
+  ((struct fake_dev*)iodev)->open_called++;
+  return 0;
+}
+
+static int fake_configure_dev(struct cras_iodev* iodev) {
+  ((struct fake_dev*)iodev)->configure_called++;
+  return 0;
+}
+
+static int fake_close_dev(struct cras_iodev* iodev) {
+  ((struct fake_dev*)iodev)->close_called++;
+  return 0;
+}
+
+static int fake_frames_queued(const struct cras_iodev* iodev,
+                              struct timespec* tstamp) {
+  tstamp->tv_sec = 1;
+  tstamp->tv_nsec = 0;
+  return ((struct fake_dev*)iodev)->written;
+}
+
+static int fake_delay_frames(const struct cras_iodev* iodev) {
+  return 17;
+}
+
+static int fake_get_buffer(struct cras_iodev* iodev,
+                           struct cras_audio_area** area,
+                           unsigned* frames) {
+  struct fake_dev* fake = (struct fake_dev*)iodev;
+
+  *frames = std::min(*frames, FAKE_FRAMES - fake->written);
+  fake->area.frames = *frames;
+  fake->area.channels[0].buf =
+      (uint8_t*)&fake->buf[fake->written * fake->base.format->num_channels];
+  *area = &fake->area;
+  return 0;
+}
+
+static int fake_put_buffer(struct cras_iodev* iodev, unsigned nwritten) {
+  ((struct fake_dev*)iodev)->written += nwritten;
+  return 0;
+}
+
+static int fake_flush_buffer(struct cras_iodev* iodev) {
+  ((struct fake_dev*)iodev)->flush_called++;
+  return 0;
+}
+
+static int fake_start(const struct cras_iodev* iodev) {
+  ((struct fake_dev*)iodev)->start_called++;
+  return 0;
+}
+
+namespace {
+
+class AggregateIodevTest : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    iodev_list_add_output_called = 0;
+    iodev_list_rm_output_called = 0;
+    rate_estimator_check_ret = 0;
+    rate_estimator_rate = 48000;
+    resampler_created = 0;
+    resampler_set_rates_called = 0;
+    resample_called = 0;
+
+    for (int i = 0; i < 2; i++) {
+      struct fake_dev* fake = &fakes_[i];
+
+      memset(fake, 0, sizeof(*fake));
+      fake->base.direction = CRAS_STREAM_OUTPUT;
+      fake->base.buffer_size = FAKE_FRAMES;
+      fake->base.min_buffer_level = 10;
+      fake->rates[0] = 48000;
+      fake->rates[1] = 44100;
+      fake->channel_counts[0] = 2;
+      fake->formats[0] = SND_PCM_FORMAT_S16_LE;
+      fake->base.supported_rates = fake->rates;
+      fake->base.supported_channel_counts = fake->channel_counts;
+      fake->base.supported_formats = fake->formats;
+      fake->base.open_dev = fake_open_dev;
+      fake->base.configure_dev = fake_configure_dev;
+      fake->base.close_dev = fake_close_dev;
+      fake->base.frames_queued = fake_frames_queued;
+      fake->base.delay_frames = fake_delay_frames;
+      fake->base.get_buffer = fake_get_buffer;
+      fake->base.put_buffer = fake_put_buffer;
+      fake->base.flush_buffer = fake_flush_buffer;
+      fake->base.start = fake_start;
+      members_[i] = &fake->base;
+    }
+    fakes_[0].channel_counts[1] = 1;
+  }
+
+  // Opens the aggregate iodev the way cras_iodev_open does.
+  int Open(struct cras_iodev* iodev) {
+    int rc = iodev->open_dev(iodev);
+    if (rc)
+      return rc;
+    rc = iodev->update_supported_formats(iodev);
+    if (rc)
+      return rc;
+    iodev->format =
+        (struct cras_audio_format*)calloc(1, sizeof(*iodev->format));
+    iodev->format->format = SND_PCM_FORMAT_S16_LE;
+    iodev->format->frame_rate = iodev->supported_rates[0];
+    iodev->format->num_channels = iodev->supported_channel_counts[0];
+    iodev->rate_est = reinterpret_cast<rate_estimator*>(0x123);
+    return iodev->configure_dev(iodev);
+  }
+
+  struct fake_dev fakes_[2];
+  struct cras_iodev* members_[2];
+};
+
+TEST_F(AggregateIodevTest, CreateChecksMembers) {
+  EXPECT_EQ(NULL, aggregate_iodev_create(members_, 0));
+  fakes_[1].base.direction = CRAS_STREAM_INPUT;
+  EXPECT_EQ(NULL, aggregate_iodev_create(members_, 2));
+  EXPECT_EQ(0, iodev_list_add_output_called);
+}
+
+TEST_F(AggregateIodevTest, OpenConfiguresAllMembers) {
+  struct cras_iodev* iodev = aggregate_iodev_create(members_, 2);
+
+  ASSERT_NE((void*)NULL, iodev);
+  EXPECT_EQ(1, iodev_list_add_output_called);
+  EXPECT_TRUE(aggregate_iodev_has_member(iodev, members_[1]));
+  EXPECT_FALSE(aggregate_iodev_has_member(iodev, iodev));
+
+  fakes_[1].base.buffer_size = 512;
+  ASSERT_EQ(0, Open(iodev));
+  // Rates of the master, channel counts every member supports.
+  EXPECT_EQ(48000, iodev->supported_rates[0]);
+  EXPECT_EQ(44100, iodev->supported_rates[1]);
+  EXPECT_EQ(0, iodev->supported_rates[2]);
+  EXPECT_EQ(2, iodev->supported_channel_counts[0]);
+  EXPECT_EQ(0, iodev->supported_channel_counts[1]);
+  for (int i = 0; i < 2; i++) {
+    EXPECT_EQ(1, fakes_[i].open_called);
+    EXPECT_EQ(1, fakes_[i].configure_called);
+    ASSERT_NE((void*)NULL, members_[i]->format);
+    EXPECT_EQ(48000, members_[i]->format->frame_rate);
+    EXPECT_EQ(2, members_[i]->format->num_channels);
+  }
+  // Only the other members follow the master clock.
+  EXPECT_EQ(1, resampler_created);
+  EXPECT_EQ(512, iodev->buffer_size);
+  EXPECT_EQ(10, iodev->min_buffer_level);
+  EXPECT_EQ(17, iodev->delay_frames(iodev));
+
+  EXPECT_EQ(0, iodev->start(iodev));
+  EXPECT_EQ(1, fakes_[0].start_called);
+  EXPECT_EQ(1, fakes_[1].start_called);
+
+  iodev->close_dev(iodev);
+  for (int i = 0; i < 2; i++) {
+    EXPECT_EQ(1, fakes_[i].close_called);
+    EXPECT_EQ(NULL, members_[i]->format);
+  }
+  aggregate_iodev_destroy(iodev);
+  EXPECT_EQ(1, iodev_list_rm_output_called);
+}
+
+TEST_F(AggregateIodevTest, OpenFailsOnBusyMember) {
+  struct cras_iodev* iodev = aggregate_iodev_create(members_, 2);
+
+  members_[1]->state = CRAS_IODEV_STATE_NORMAL_RUN;
+  EXPECT_EQ(-EBUSY, iodev->open_dev(iodev));
+  EXPECT_EQ(1, fakes_[0].close_called);
+  EXPECT_EQ(0, fakes_[1].open_called);
+  aggregate_iodev_destroy(iodev);
+}
+
+TEST_F(AggregateIodevTest, OpenFailsWithoutCommonChannels) {
+  struct cras_iodev* iodev = aggregate_iodev_create(members_, 2);
+
+  fakes_[1].channel_counts[0] = 6;
+  ASSERT_EQ(0, iodev->open_dev(iodev));
+  EXPECT_EQ(-EINVAL, iodev->update_supported_formats(iodev));
+  iodev->close_dev(iodev);
+  aggregate_iodev_destroy(iodev);
+}
+
+TEST_F(AggregateIodevTest, MixedOnceIntoMaster) {
+  struct cras_iodev* iodev = aggregate_iodev_create(members_, 2);
+  struct cras_audio_area* area;
+  unsigned int frames = 100;
+
+  ASSERT_EQ(0, Open(iodev));
+
+  // Streams are mixed straight into the master's buffer.
+  ASSERT_EQ(0, iodev->get_buffer(iodev, &area, &frames));
+  EXPECT_EQ(100, frames);
+  EXPECT_EQ((uint8_t*)fakes_[0].buf, area->channels[0].buf);
+  for (int i = 0; i < 200; i++)
+    fakes_[0].buf[i] = i + 1;
+
+  // And copied to the others while their clocks agree.
+  ASSERT_EQ(0, iodev->put_buffer(iodev, frames));
+  EXPECT_EQ(100, fakes_[0].written);
+  EXPECT_EQ(100, fakes_[1].written);
+  EXPECT_EQ(0, resample_called);
+  for (int i = 0; i < 200; i++)
+    ASSERT_EQ(i + 1, fakes_[1].buf[i]);
+
+  struct timespec ts;
+  EXPECT_EQ(100, iodev->frames_queued(iodev, &ts));
+
+  iodev->flush_buffer(iodev);
+  EXPECT_EQ(1, fakes_[0].flush_called);
+  EXPECT_EQ(1, fakes_[1].flush_called);
+
+  iodev->close_dev(iodev);
+  aggregate_iodev_destroy(iodev);
+}
+
+TEST_F(AggregateIodevTest, MemberFollowsDriftingClock) {
+  struct cras_iodev* iodev = aggregate_iodev_create(members_, 2);
+  struct cras_audio_area* area;
+  unsigned int frames = 100;
+
+  ASSERT_EQ(0, Open(iodev));
+
+  // A new estimate of the member's rate retunes its resampler.
+  rate_estimator_check_ret = 1;
+  rate_estimator_rate = 48048;
+  ASSERT_EQ(0, iodev->get_buffer(iodev, &area, &frames));
+  ASSERT_EQ(0, iodev->put_buffer(iodev, frames));
+  EXPECT_EQ(1, resampler_set_rates_called);
+  EXPECT_FLOAT_EQ(48048, resampler_to);
+  EXPECT_EQ(1, resample_called);
+  EXPECT_EQ(100, fakes_[0].written);
+  EXPECT_EQ(100, fakes_[1].written);
+
+  iodev->close_dev(iodev);
+  aggregate_iodev_destroy(iodev);
+}
+
+TEST_F(AggregateIodevTest, MemberAtOtherRate) {
+  struct cras_iodev* iodev = aggregate_iodev_create(members_, 2);
+
+  fakes_[1].rates[0] = 44100;
+  fakes_[1].rates[1] = 0;
+  fakes_[1].base.buffer_size = 512;
+  ASSERT_EQ(0, Open(iodev));
+  EXPECT_EQ(48000, members_[0]->format->frame_rate);
+  EXPECT_EQ(44100, members_[1]->format->frame_rate);
+  EXPECT_FLOAT_EQ(48000, resampler_from);
+  EXPECT_FLOAT_EQ(44100, resampler_to);
+  // The smaller member buffer in frames of the aggregate.
+  EXPECT_EQ(558, iodev->buffer_size);
+
+  iodev->close_dev(iodev);
+  aggregate_iodev_destroy(iodev);
+}
+
+}  // namespace
+
+extern "C" {
+
+void cras_iodev_free_format(struct cras_iodev* iodev) {
+  free(iodev->format);
+  iodev->format = NULL;
+}
+
+int cras_iodev_default_no_stream_playback(struct cras_iodev* odev, int enable) {
+  return 0;
+}
+
+void cras_iodev_free_resources(struct cras_iodev* iodev) {}
+
+void cras_iodev_add_node(struct cras_iodev* iodev, struct cras_ionode* node) {
+  iodev->nodes = node;
+}
+
+void cras_iodev_set_active_node(struct cras_iodev* iodev,
+                                struct cras_ionode* node) {
+  iodev->active_node = node;
+}
+
+int cras_iodev_list_add_output(struct cras_iodev* output) {
+  iodev_list_add_output_called++;
+  return 0;
+}
+
+int cras_iodev_list_rm_output(struct cras_iodev* output) {
+  iodev_list_rm_output_called++;
+  return 0;
+}
+
+// Resamples by copying, the tests only check how the rates are followed.
+struct linear_resampler* linear_resampler_create(unsigned int num_channels,
+                                                 unsigned int format_bytes,
+                                                 float src_rate,
+                                                 float dst_rate) {
+  resampler_created++;
+  resampler_from = src_rate;
+  resampler_to = dst_rate;
+  return reinterpret_cast<struct linear_resampler*>(0x456);
+}
+
+void linear_resampler_set_rates(struct linear_resampler* lr,
+                                float from,
+                                float to) {
+  resampler_set_rates_called++;
+  resampler_from = from;
+  resampler_to = to;
+}
+
+int linear_resampler_needed(struct linear_resampler* lr) {
+  return resampler_from != resampler_to;
+}
+
+unsigned int linear_resampler_in_frames_to_out(struct linear_resampler* lr,
+                                               unsigned int frames) {
+  return frames;
+}
+
+unsigned int linear_resampler_resample(struct linear_resampler* lr,
+                                       uint8_t* src,
+                                       unsigned int* src_frames,
+                                       uint8_t* dst,
+                                       unsigned dst_frames) {
+  resample_called++;
+  *src_frames = std::min(*src_frames, dst_frames);
+  memcpy(dst, src, *src_frames * 4);
+  return *src_frames;
+}
+
+void linear_resampler_destroy(struct linear_resampler* lr) {}
+
+// The master follows the aggregate's estimator, stuck at 48000.
+void rate_estimator_add_frames(rate_estimator* re, int frames) {}
+
+int32_t rate_estimator_check(rate_estimator* re,
+                             int level,
+                             const struct timespec* now) {
+  return rate_estimator_check_ret;
+}
+
+rate_estimator* rate_estimator_create(unsigned int rate,
+                                      const struct timespec* window_size,
+                                      double smooth_factor) {
+  return reinterpret_cast<rate_estimator*>(0x789);
+}
+
+void rate_estimator_destroy(rate_estimator* re) {}
+
+double rate_estimator_get_rate(const rate_estimator* re) {
+  if (re == reinterpret_cast<rate_estimator*>(0x123))
+    return 48000;
+  return rate_estimator_rate;
+}
+
+void rate_estimator_reset_rate(rate_estimator* re, unsigned int rate) {}
+
+}  // extern "C"
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -7,10 +7,18 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <vector>
+
 #include "cras_alert.h"
 
 namespace {
 
+static struct timespec time_now;
+static struct cras_timer* rate_limit_timer;
+static unsigned int rate_limit_timer_ms;
+static void (*rate_limit_timer_cb)(struct cras_timer* t, void* data);
+static void* rate_limit_timer_data;
+
 void callback1(void* arg, void* data);
 void callback2(void* arg, void* data);
 void prepare(struct cras_alert* alert);
@@ -200,6 +208,83 @@ TEST_F(Alert, TwoAlerts) {
   cras_alert_destroy_all();
 }
 
+struct key_data_struct {
+  int key;
+  int data;
+};
+
+static std::vector<key_data_struct> cb_key_data;
+
+void key_callback(void* arg, void* data) {
+  cb_key_data.push_back(*(struct key_data_struct*)data);
+}
+
+TEST_F(Alert, RateLimit) {
+  struct cras_alert* alert = cras_alert_create(NULL, 0);
+  struct cb_data_struct data;
+
+  cras_alert_add_callback(alert, &callback1, NULL);
+  cras_alert_set_rate_limit(alert, 50);
+  ResetStub();
+  rate_limit_timer = NULL;
+  time_now.tv_sec = 1;
+  time_now.tv_nsec = 0;
+
+  // The first change is sent right away.
+  data.data = 1;
+  cras_alert_pending_data(alert, (void*)&data, sizeof(struct cb_data_struct));
+  cras_alert_process_all_pending_alerts();
+  EXPECT_EQ(1, cb1_called);
+  EXPECT_EQ(1, cb1_data.data);
+
+  // Changes within the limit are held back and merged.
+  time_now.tv_nsec = 20000000;
+  data.data = 2;
+  cras_alert_pending_data(alert, (void*)&data, sizeof(struct cb_data_struct));
+  cras_alert_process_all_pending_alerts();
+  EXPECT_EQ(1, cb1_called);
+  ASSERT_TRUE(rate_limit_timer);
+  EXPECT_EQ(30, rate_limit_timer_ms);
+  data.data = 3;
+  cras_alert_pending_data(alert, (void*)&data, sizeof(struct cb_data_struct));
+  cras_alert_process_all_pending_alerts();
+  EXPECT_EQ(1, cb1_called);
+
+  time_now.tv_nsec = 50000000;
+  rate_limit_timer_cb(rate_limit_timer, rate_limit_timer_data);
+  cras_alert_process_all_pending_alerts();
+  EXPECT_EQ(2, cb1_called);
+  EXPECT_EQ(3, cb1_data.data);
+
+  cras_alert_destroy(alert);
+}
+
+TEST_F(Alert, DataKey) {
+  struct cras_alert* alert = cras_alert_create(NULL, 0);
+  struct key_data_struct data;
+
+  cras_alert_add_callback(alert, &key_callback, NULL);
+  cras_alert_set_data_key_size(alert, sizeof(data.key));
+  cb_key_data.clear();
+
+  data = {1, 10};
+  cras_alert_pending_data(alert, (void*)&data, sizeof(data));
+  data = {2, 20};
+  cras_alert_pending_data(alert, (void*)&data, sizeof(data));
+  data = {1, 11};
+  cras_alert_pending_data(alert, (void*)&data, sizeof(data));
+  cras_alert_process_all_pending_alerts();
+
+  // The latest data of each key, in the order the keys first changed.
+  ASSERT_EQ(2, cb_key_data.size());
+  EXPECT_EQ(1, cb_key_data[0].key);
+  EXPECT_EQ(11, cb_key_data[0].data);
+  EXPECT_EQ(2, cb_key_data[1].key);
+  EXPECT_EQ(20, cb_key_data[1].data);
+
+  cras_alert_destroy(alert);
+}
+
 void callback1(void* arg, void* data) {
   cb1_called++;
   if (data)
@@ -219,6 +304,33 @@ void prepare(struct cras_alert* alert) {
   return;
 }
 
+extern "C" {
+
+struct cras_tm* cras_system_state_get_tm() {
+  return reinterpret_cast<struct cras_tm*>(0x1);
+}
+
+struct cras_timer* cras_tm_create_timer(struct cras_tm* tm,
+                                        unsigned int ms,
+                                        void (*cb)(struct cras_timer* t,
+                                                   void* data),
+                                        void* cb_data) {
+  rate_limit_timer = reinterpret_cast<struct cras_timer*>(0x2);
+  rate_limit_timer_ms = ms;
+  rate_limit_timer_cb = cb;
+  rate_limit_timer_data = cb_data;
+  return rate_limit_timer;
+}
+
+void cras_tm_cancel_timer(struct cras_tm* tm, struct cras_timer* t) {}
+
+int clock_gettime(clockid_t clk_id, struct timespec* tp) {
+  *tp = time_now;
+  return 0;
+}
+
+}  // extern "C"
+
 }  // namespace
 
 int main(int argc, char** argv) {
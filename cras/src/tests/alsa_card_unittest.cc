@@ -97,6 +97,10 @@ static int cras_alsa_mixer_add_main_volume_control_by_name_called;
 static int cras_alsa_mixer_add_main_volume_control_by_name_return_value;
 static int ucm_get_echo_reference_dev_name_for_dev_called;
 static size_t cras_system_check_ignore_ucm_suffix_called;
+static size_t cras_alsa_pcm_open_called;
+static size_t cras_alsa_fill_properties_called;
+static size_t alsa_iodev_set_probed_formats_called;
+static struct cras_iodev* alsa_iodev_set_probed_formats_iodev;
 static bool cras_system_check_ignore_ucm_suffix_value;
 static const char* ucm_get_echo_reference_dev_name_for_dev_return_value[4];
 
@@ -171,6 +175,10 @@ static void ResetStubData() {
   ucm_get_echo_reference_dev_name_for_dev_called = 0;
   cras_system_check_ignore_ucm_suffix_called = 0;
   cras_system_check_ignore_ucm_suffix_value = 0;
+  cras_alsa_pcm_open_called = 0;
+  cras_alsa_fill_properties_called = 0;
+  alsa_iodev_set_probed_formats_called = 0;
+  alsa_iodev_set_probed_formats_iodev = NULL;
   fake_dev1.nodes = NULL;
   fake_dev2.nodes = NULL;
   fake_dev3.nodes = NULL;
@@ -436,6 +444,43 @@ TEST(AlsaCard, CreateOneOutput) {
   EXPECT_EQ(iniparser_load_called, iniparser_freedict_called);
 }
 
+TEST(AlsaCard, ProbeThenCommitOneOutput) {
+  struct cras_alsa_card* c;
+  int dev_nums[] = {0};
+  int info_rets[] = {0, -1};
+  cras_alsa_card_info card_info;
+
+  ResetStubData();
+  snd_ctl_pcm_next_device_set_devs_size = ARRAY_SIZE(dev_nums);
+  snd_ctl_pcm_next_device_set_devs = dev_nums;
+  snd_ctl_pcm_info_rets_size = ARRAY_SIZE(info_rets);
+  snd_ctl_pcm_info_rets = info_rets;
+  card_info.card_type = ALSA_CARD_TYPE_USB;
+  card_info.card_index = 0;
+  c = cras_alsa_card_probe(&card_info, device_config_dir, NULL);
+  ASSERT_NE(static_cast<struct cras_alsa_card*>(NULL), c);
+  EXPECT_EQ(0, snd_ctl_close_called);
+  EXPECT_EQ(0, cras_alsa_iodev_create_called);
+
+  // Only the playback stream of device 0 exists.
+  cras_alsa_card_probe_formats(c);
+  EXPECT_EQ(1, cras_alsa_pcm_open_called);
+  EXPECT_EQ(1, cras_alsa_fill_properties_called);
+
+  snd_ctl_pcm_next_device_set_devs_index = 0;
+  snd_ctl_pcm_info_rets_index = 0;
+  EXPECT_EQ(0, cras_alsa_card_commit(c, &card_info, fake_blocklist));
+  EXPECT_EQ(1, snd_ctl_close_called);
+  EXPECT_EQ(1, cras_alsa_iodev_create_called);
+  EXPECT_EQ(1, alsa_iodev_set_probed_formats_called);
+  EXPECT_EQ(cras_alsa_iodev_create_return[0],
+            alsa_iodev_set_probed_formats_iodev);
+
+  cras_alsa_card_destroy(c);
+  EXPECT_EQ(1, snd_ctl_close_called);
+  EXPECT_EQ(1, cras_alsa_iodev_destroy_called);
+}
+
 TEST(AlsaCard, CreateOneOutputBlocklisted) {
   struct cras_alsa_card* c;
   int dev_nums[] = {0};
@@ -1269,6 +1314,40 @@ bool cras_system_check_ignore_ucm_suffix(const char* card_name) {
   return cras_system_check_ignore_ucm_suffix_value;
 }
 
+int cras_alsa_pcm_open(snd_pcm_t** handle,
+                       const char* dev,
+                       snd_pcm_stream_t stream) {
+  cras_alsa_pcm_open_called++;
+  *handle = reinterpret_cast<snd_pcm_t*>(0x44);
+  return 0;
+}
+
+int cras_alsa_pcm_close(snd_pcm_t* handle) {
+  return 0;
+}
+
+int cras_alsa_fill_properties(snd_pcm_t* handle,
+                              size_t** rates,
+                              size_t** channel_counts,
+                              snd_pcm_format_t** formats) {
+  cras_alsa_fill_properties_called++;
+  *rates = (size_t*)calloc(2, sizeof(**rates));
+  *channel_counts = (size_t*)calloc(2, sizeof(**channel_counts));
+  *formats = (snd_pcm_format_t*)calloc(2, sizeof(**formats));
+  return 0;
+}
+
+void alsa_iodev_set_probed_formats(struct cras_iodev* iodev,
+                                   size_t* rates,
+                                   size_t* channel_counts,
+                                   snd_pcm_format_t* formats) {
+  alsa_iodev_set_probed_formats_called++;
+  alsa_iodev_set_probed_formats_iodev = iodev;
+  free(rates);
+  free(channel_counts);
+  free(formats);
+}
+
 void ucm_free_mixer_names(struct mixer_name* names) {
   struct mixer_name* m;
   DL_FOREACH (names, m) {
@@ -28,9 +28,16 @@ static int cras_alsa_open_called;
 static int cras_iodev_append_stream_ret;
 static int cras_alsa_get_avail_frames_ret;
 static int cras_alsa_get_avail_frames_avail;
+static unsigned cras_alsa_get_avail_frames_called;
+static unsigned cras_alsa_get_delay_frames_called;
+static snd_pcm_sframes_t cras_alsa_get_delay_frames_delay;
+static struct timespec cras_alsa_hw_tstamp;
 static int cras_alsa_start_called;
 static uint8_t* cras_alsa_mmap_begin_buffer;
 static size_t cras_alsa_mmap_begin_frames;
+static bool sys_get_uncached_dma_buffer_return_value;
+static uint8_t* cras_audio_area_config_buf_pointers_base;
+static unsigned int ucm_get_uncached_dma_buffer_return_value;
 static size_t cras_alsa_fill_properties_called;
 static bool cras_alsa_support_8_channels;
 static size_t alsa_mixer_set_dBFS_called;
@@ -124,6 +131,8 @@ static long cras_alsa_mixer_get_minimum_capture_gain_ret_value;
 static long cras_alsa_mixer_get_maximum_capture_gain_ret_value;
 static snd_pcm_state_t snd_pcm_state_ret;
 static int cras_alsa_attempt_resume_called;
+static int cras_alsa_pcm_reprepare_called;
+static int cras_alsa_pcm_reprepare_ret;
 static snd_hctl_t* fake_hctl = (snd_hctl_t*)2;
 static size_t ucm_get_dma_period_for_dev_called;
 static unsigned int ucm_get_dma_period_for_dev_ret;
@@ -152,6 +161,14 @@ void ResetStubData() {
   cras_iodev_append_stream_ret = 0;
   cras_alsa_get_avail_frames_ret = 0;
   cras_alsa_get_avail_frames_avail = 0;
+  cras_alsa_get_avail_frames_called = 0;
+  cras_alsa_get_delay_frames_called = 0;
+  cras_alsa_get_delay_frames_delay = 0;
+  cras_alsa_hw_tstamp.tv_sec = 0;
+  cras_alsa_hw_tstamp.tv_nsec = 0;
+  sys_get_uncached_dma_buffer_return_value = false;
+  ucm_get_uncached_dma_buffer_return_value = 0;
+  cras_audio_area_config_buf_pointers_base = NULL;
   cras_alsa_start_called = 0;
   cras_alsa_fill_properties_called = 0;
   cras_alsa_support_8_channels = false;
@@ -210,6 +227,8 @@ void ResetStubData() {
   cras_alsa_mixer_get_maximum_capture_gain_ret_value = 0;
   snd_pcm_state_ret = SND_PCM_STATE_RUNNING;
   cras_alsa_attempt_resume_called = 0;
+  cras_alsa_pcm_reprepare_called = 0;
+  cras_alsa_pcm_reprepare_ret = 0;
   ucm_get_dma_period_for_dev_called = 0;
   ucm_get_dma_period_for_dev_ret = 0;
   cras_alsa_mmap_get_whole_buffer_called = 0;
@@ -260,6 +279,38 @@ TEST(AlsaIoInit, InitializeInvalidDirection) {
   ASSERT_EQ(aio, (void*)NULL);
 }
 
+TEST(AlsaIoInit, UpdateSupportedFormatsUsesProbedFormatsOnce) {
+  struct alsa_io* aio;
+  size_t* rates = (size_t*)calloc(2, sizeof(*rates));
+  size_t* channel_counts = (size_t*)calloc(2, sizeof(*channel_counts));
+  snd_pcm_format_t* formats =
+      (snd_pcm_format_t*)calloc(2, sizeof(*formats));
+
+  ResetStubData();
+  aio = (struct alsa_io*)alsa_iodev_create_with_default_parameters(
+      0, test_dev_id, ALSA_CARD_TYPE_INTERNAL, 1, fake_mixer, fake_config, NULL,
+      CRAS_STREAM_OUTPUT);
+  ASSERT_EQ(0, alsa_iodev_legacy_complete_init((struct cras_iodev*)aio));
+  rates[0] = 96000;
+  channel_counts[0] = 2;
+  formats[0] = SND_PCM_FORMAT_S32_LE;
+  alsa_iodev_set_probed_formats((struct cras_iodev*)aio, rates,
+                                channel_counts, formats);
+
+  cras_alsa_fill_properties_called = 0;
+  EXPECT_EQ(0, aio->base.update_supported_formats(&aio->base));
+  EXPECT_EQ(0, cras_alsa_fill_properties_called);
+  EXPECT_EQ(96000, aio->base.supported_rates[0]);
+  EXPECT_EQ(SND_PCM_FORMAT_S32_LE, aio->base.supported_formats[0]);
+
+  // Later updates probe the device again.
+  EXPECT_EQ(0, aio->base.update_supported_formats(&aio->base));
+  EXPECT_EQ(1, cras_alsa_fill_properties_called);
+  EXPECT_EQ(44100, aio->base.supported_rates[0]);
+
+  alsa_iodev_destroy((struct cras_iodev*)aio);
+}
+
 TEST(AlsaIoInit, InitializePlayback) {
   struct alsa_io* aio;
   struct cras_alsa_mixer* const fake_mixer = (struct cras_alsa_mixer*)2;
@@ -777,6 +828,28 @@ TEST(AlsaIoInit, ResumeDevice) {
   alsa_iodev_destroy(iodev);
 }
 
+TEST(AlsaIoInit, ResumeKeptOpenDevice) {
+  struct cras_iodev* iodev;
+
+  ResetStubData();
+  iodev = alsa_iodev_create_with_default_parameters(
+      0, NULL, ALSA_CARD_TYPE_INTERNAL, 0, NULL, fake_config, NULL,
+      CRAS_STREAM_INPUT);
+  ASSERT_EQ(0, alsa_iodev_legacy_complete_init(iodev));
+
+  // Capture is prepared again and restarted right away.
+  EXPECT_EQ(0, iodev->resume(iodev));
+  EXPECT_EQ(1, cras_alsa_pcm_reprepare_called);
+  EXPECT_EQ(1, cras_alsa_start_called);
+
+  // A disconnected PCM has to be reopened.
+  cras_alsa_pcm_reprepare_ret = -ENODEV;
+  EXPECT_EQ(-ENODEV, iodev->resume(iodev));
+  EXPECT_EQ(1, cras_alsa_start_called);
+
+  alsa_iodev_destroy(iodev);
+}
+
 TEST(AlsaIoInit, DspNameDefault) {
   struct alsa_io* aio;
   struct cras_alsa_mixer* const fake_mixer = (struct cras_alsa_mixer*)2;
@@ -2104,9 +2177,8 @@ TEST_F(AlsaFreeRunTestSuite, EnterFreeRunAlreadyFreeRunning) {
 TEST_F(AlsaFreeRunTestSuite, EnterFreeRunNotDrainedYetNeedToFillZeros) {
   int rc, real_hw_level;
   struct timespec hw_tstamp;
-  int fill_zeros_duration = 50;
   // Device is not in free run state. There are still valid samples to play.
-  // In cras_alsa_io.c, we defined there are 50ms zeros to be filled.
+  // The rest of the buffer is filled with zeros at once.
   real_hw_level = 200;
   cras_alsa_get_avail_frames_avail = BUFFER_SIZE - real_hw_level;
 
@@ -2118,10 +2190,8 @@ TEST_F(AlsaFreeRunTestSuite, EnterFreeRunNotDrainedYetNeedToFillZeros) {
   EXPECT_EQ(0, rc);
   EXPECT_EQ(0, cras_alsa_mmap_get_whole_buffer_called);
   EXPECT_EQ(1, cras_iodev_fill_odev_zeros_called);
-  EXPECT_EQ(fmt_.frame_rate / 1000 * fill_zeros_duration,
-            cras_iodev_fill_odev_zeros_frames);
-  EXPECT_EQ(fmt_.frame_rate / 1000 * fill_zeros_duration,
-            aio.filled_zeros_for_draining);
+  EXPECT_EQ(BUFFER_SIZE - real_hw_level, cras_iodev_fill_odev_zeros_frames);
+  EXPECT_EQ(BUFFER_SIZE - real_hw_level, aio.filled_zeros_for_draining);
   EXPECT_EQ(0, aio.free_running);
 }
 
@@ -2179,6 +2249,25 @@ TEST_F(AlsaFreeRunTestSuite, EnterFreeRunNoSamples) {
   EXPECT_EQ(1, aio.free_running);
 }
 
+TEST_F(AlsaFreeRunTestSuite, DrainingSleepsUntilValidSamplesPlayed) {
+  unsigned int hw_level;
+  struct timespec hw_tstamp;
+
+  aio.base.state = CRAS_IODEV_STATE_NO_STREAM_RUN;
+  aio.base.min_buffer_level = 100;
+  cras_alsa_get_avail_frames_avail = BUFFER_SIZE - 1000;
+  aio.filled_zeros_for_draining = 700;
+
+  // Wakes once the 300 valid frames are played, not to fill more zeros.
+  EXPECT_EQ(300, frames_to_play_in_sleep(&aio.base, &hw_level, &hw_tstamp));
+  EXPECT_EQ(900, hw_level);
+
+  // Played already, wake now to enter free run.
+  cras_alsa_get_avail_frames_avail = BUFFER_SIZE - 600;
+  EXPECT_EQ(0, frames_to_play_in_sleep(&aio.base, &hw_level, &hw_tstamp));
+  EXPECT_EQ(500, hw_level);
+}
+
 TEST_F(AlsaFreeRunTestSuite, IsFreeRunning) {
   aio.free_running = 1;
   EXPECT_EQ(1, is_free_running(&aio.base));
@@ -2311,6 +2400,310 @@ TEST(AlsaHotwordNode, HotwordTriggeredSendMessage) {
   alsa_iodev_destroy(iodev);
 }
 
+TEST(AlsaHotwordNode, HistoryDrainSkipsRateEstimation) {
+  struct cras_iodev* iodev;
+  struct cras_audio_format format;
+  struct alsa_input_node alsa_node;
+  struct cras_ionode* node = &alsa_node.base;
+  struct timespec tstamp;
+
+  ResetStubData();
+  iodev = alsa_iodev_create_with_default_parameters(
+      0, NULL, ALSA_CARD_TYPE_INTERNAL, 0, fake_mixer, fake_config, NULL,
+      CRAS_STREAM_INPUT);
+  format.frame_rate = 16000;
+  format.num_channels = 1;
+  cras_iodev_set_format(iodev, &format);
+
+  memset(&alsa_node, 0, sizeof(alsa_node));
+  node->dev = iodev;
+  strcpy(node->name, HOTWORD_DEV);
+  set_node_initial_state(node, ALSA_CARD_TYPE_INTERNAL);
+
+  iodev->active_node = node;
+  iodev->open_dev(iodev);
+  ASSERT_EQ(0, iodev->configure_dev(iodev));
+  free(fake_format);
+  iodev->min_cb_level = 160;
+  clock_gettime_retspec.tv_sec = 100;
+  clock_gettime_retspec.tv_nsec = 0;
+
+  // Before the trigger levels are time stamped as usual.
+  cras_alsa_get_avail_frames_avail = 16000;
+  EXPECT_EQ(16000, iodev->frames_queued(iodev, &tstamp));
+  EXPECT_TRUE(timespec_is_nonzero(&tstamp));
+
+  // The history burst after the trigger has no time stamp.
+  ASSERT_NE(reinterpret_cast<thread_callback>(NULL), audio_thread_cb);
+  audio_thread_cb(audio_thread_cb_data, POLLIN);
+  EXPECT_EQ(16000, iodev->frames_queued(iodev, &tstamp));
+  EXPECT_FALSE(timespec_is_nonzero(&tstamp));
+  EXPECT_EQ(0, cras_iodev_reset_rate_estimator_called);
+
+  // Down to one callback, the drain is over and rate estimation restarts.
+  cras_alsa_get_avail_frames_avail = 100;
+  EXPECT_EQ(100, iodev->frames_queued(iodev, &tstamp));
+  EXPECT_TRUE(timespec_is_nonzero(&tstamp));
+  EXPECT_EQ(1, cras_iodev_reset_rate_estimator_called);
+
+  cras_alsa_get_avail_frames_avail = 1000;
+  EXPECT_EQ(1000, iodev->frames_queued(iodev, &tstamp));
+  EXPECT_TRUE(timespec_is_nonzero(&tstamp));
+  EXPECT_EQ(1, cras_iodev_reset_rate_estimator_called);
+
+  alsa_iodev_destroy(iodev);
+}
+
+//  Test hw_ptr prediction.
+class AlsaHwPtrPredictionSuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    ResetStubData();
+    memset(&aio, 0, sizeof(aio));
+    fmt_.format = SND_PCM_FORMAT_S16_LE;
+    fmt_.frame_rate = 48000;
+    fmt_.num_channels = 2;
+    aio.base.direction = CRAS_STREAM_OUTPUT;
+    aio.base.state = CRAS_IODEV_STATE_NORMAL_RUN;
+    aio.base.format = &fmt_;
+    aio.base.buffer_size = BUFFER_SIZE;
+    aio.base.min_cb_level = 240;
+    aio.base.min_buffer_level = 0;
+    clock_gettime_retspec.tv_sec = 100;
+    clock_gettime_retspec.tv_nsec = 0;
+  }
+
+  struct alsa_io aio;
+  struct cras_audio_format fmt_;
+};
+
+TEST_F(AlsaHwPtrPredictionSuite, PredictBetweenQueries) {
+  struct timespec tstamp;
+
+  cras_alsa_get_avail_frames_avail = BUFFER_SIZE - 1000;
+  EXPECT_EQ(1000, frames_queued(&aio.base, &tstamp));
+  EXPECT_EQ(1, cras_alsa_get_avail_frames_called);
+  EXPECT_EQ(100, tstamp.tv_sec);
+
+  // 10ms later, 480 frames are played and 480 frames are written.
+  clock_gettime_retspec.tv_nsec = 10000000;
+  EXPECT_EQ(520, frames_queued(&aio.base, &tstamp));
+  EXPECT_EQ(1, cras_alsa_get_avail_frames_called);
+  EXPECT_EQ(0, tstamp.tv_sec);
+  EXPECT_EQ(0, tstamp.tv_nsec);
+  EXPECT_EQ(0, put_buffer(&aio.base, 480));
+  EXPECT_EQ(1000, frames_queued(&aio.base, &tstamp));
+  EXPECT_EQ(1, cras_alsa_get_avail_frames_called);
+
+  // Re-sync once the resync interval has passed.
+  clock_gettime_retspec.tv_nsec = 200000000;
+  cras_alsa_get_avail_frames_avail = BUFFER_SIZE - 900;
+  EXPECT_EQ(900, frames_queued(&aio.base, &tstamp));
+  EXPECT_EQ(2, cras_alsa_get_avail_frames_called);
+  EXPECT_EQ(100, tstamp.tv_sec);
+}
+
+TEST_F(AlsaHwPtrPredictionSuite, QueryWhenLevelIsLow) {
+  struct timespec tstamp;
+
+  cras_alsa_get_avail_frames_avail = BUFFER_SIZE - 500;
+  EXPECT_EQ(500, frames_queued(&aio.base, &tstamp));
+
+  // The predicted 20 frames is too close to an underrun to trust.
+  clock_gettime_retspec.tv_nsec = 10000000;
+  cras_alsa_get_avail_frames_avail = BUFFER_SIZE - 30;
+  EXPECT_EQ(30, frames_queued(&aio.base, &tstamp));
+  EXPECT_EQ(2, cras_alsa_get_avail_frames_called);
+}
+
+TEST_F(AlsaHwPtrPredictionSuite, QueryAfterApplPtrMoves) {
+  struct timespec tstamp;
+
+  cras_alsa_get_avail_frames_avail = BUFFER_SIZE - 1000;
+  EXPECT_EQ(1000, frames_queued(&aio.base, &tstamp));
+  EXPECT_EQ(0, adjust_appl_ptr_for_underrun(&aio.base));
+  frames_queued(&aio.base, &tstamp);
+  EXPECT_EQ(2, cras_alsa_get_avail_frames_called);
+}
+
+TEST_F(AlsaHwPtrPredictionSuite, NoPredictionForInput) {
+  struct timespec tstamp;
+
+  aio.base.direction = CRAS_STREAM_INPUT;
+  cras_alsa_get_avail_frames_avail = 1000;
+  EXPECT_EQ(1000, frames_queued(&aio.base, &tstamp));
+  EXPECT_EQ(1000, frames_queued(&aio.base, &tstamp));
+  EXPECT_EQ(2, cras_alsa_get_avail_frames_called);
+}
+
+TEST_F(AlsaHwPtrPredictionSuite, DelayPredictedFromLevel) {
+  struct timespec tstamp;
+
+  cras_alsa_get_avail_frames_avail = BUFFER_SIZE - 1000;
+  cras_alsa_get_delay_frames_delay = 1100;
+  EXPECT_EQ(1000, frames_queued(&aio.base, &tstamp));
+  EXPECT_EQ(1100, delay_frames(&aio.base));
+  EXPECT_EQ(1, cras_alsa_get_delay_frames_called);
+
+  clock_gettime_retspec.tv_nsec = 10000000;
+  EXPECT_EQ(620, delay_frames(&aio.base));
+  EXPECT_EQ(1, cras_alsa_get_delay_frames_called);
+}
+
+TEST_F(AlsaHwPtrPredictionSuite, HardwareTimeStamps) {
+  struct timespec tstamp;
+
+  // The level and delay keep the time the hardware pointer moved, not the
+  // time they were read.
+  aio.hw_tstamps = 1;
+  cras_alsa_hw_tstamp.tv_sec = 99;
+  cras_alsa_hw_tstamp.tv_nsec = 998000000;
+  cras_alsa_get_avail_frames_avail = BUFFER_SIZE - 1000;
+  cras_alsa_get_delay_frames_delay = 1100;
+  EXPECT_EQ(1000, frames_queued(&aio.base, &tstamp));
+  EXPECT_EQ(99, tstamp.tv_sec);
+  EXPECT_EQ(998000000, tstamp.tv_nsec);
+  EXPECT_EQ(1100, delay_frames(&aio.base));
+  EXPECT_EQ(99, aio.base.delay_tstamp.tv_sec);
+  EXPECT_EQ(998000000, aio.base.delay_tstamp.tv_nsec);
+
+  // A predicted delay is the delay now.
+  delay_frames(&aio.base);
+  EXPECT_EQ(1, cras_alsa_get_delay_frames_called);
+  EXPECT_EQ(0, aio.base.delay_tstamp.tv_sec);
+
+  // Time stamps on another clock are not used.
+  aio.hw_tstamps = 0;
+  invalidate_hw_ptr_prediction(&aio);
+  EXPECT_EQ(1000, frames_queued(&aio.base, &tstamp));
+  EXPECT_EQ(100, tstamp.tv_sec);
+  EXPECT_EQ(0, tstamp.tv_nsec);
+}
+
+//  Test mixing in a cached copy of an uncached DMA buffer.
+TEST(AlsaUncachedDma, SelectedByBoardForInternalCard) {
+  struct cras_iodev* iodev;
+
+  ResetStubData();
+  sys_get_uncached_dma_buffer_return_value = true;
+  iodev = alsa_iodev_create_with_default_parameters(
+      0, NULL, ALSA_CARD_TYPE_INTERNAL, 0, fake_mixer, fake_config, NULL,
+      CRAS_STREAM_OUTPUT);
+  EXPECT_EQ(1, ((struct alsa_io*)iodev)->uncached_dma);
+  alsa_iodev_destroy(iodev);
+
+  iodev = alsa_iodev_create_with_default_parameters(
+      0, NULL, ALSA_CARD_TYPE_USB, 0, fake_mixer, fake_config, NULL,
+      CRAS_STREAM_OUTPUT);
+  EXPECT_EQ(0, ((struct alsa_io*)iodev)->uncached_dma);
+  alsa_iodev_destroy(iodev);
+}
+
+TEST(AlsaUncachedDma, SelectedByUcm) {
+  struct cras_use_case_mgr* const fake_ucm = (struct cras_use_case_mgr*)3;
+  struct cras_iodev* iodev;
+
+  ResetStubData();
+  ucm_get_uncached_dma_buffer_return_value = 1;
+  iodev = alsa_iodev_create_with_default_parameters(
+      0, NULL, ALSA_CARD_TYPE_USB, 0, fake_mixer, fake_config, fake_ucm,
+      CRAS_STREAM_OUTPUT);
+  EXPECT_EQ(1, ((struct alsa_io*)iodev)->uncached_dma);
+  alsa_iodev_destroy(iodev);
+}
+
+TEST(AlsaUncachedDma, MixInCachedBuffer) {
+  struct alsa_io aio;
+  struct cras_audio_format fmt;
+  struct cras_audio_area* area;
+  unsigned int frames = 16;
+  uint8_t mix_buffer[BUFFER_SIZE * 4];
+  uint8_t dma[BUFFER_SIZE * 4];
+
+  ResetStubData();
+  memset(&aio, 0, sizeof(aio));
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  aio.base.direction = CRAS_STREAM_OUTPUT;
+  aio.base.format = &fmt;
+  aio.base.buffer_size = BUFFER_SIZE;
+  aio.base.area = (struct cras_audio_area*)calloc(
+      1, sizeof(struct cras_audio_area) + 2 * sizeof(struct cras_channel_area));
+  aio.mix_buffer = mix_buffer;
+  memset(mix_buffer, 0, sizeof(mix_buffer));
+  memset(dma, 0, sizeof(dma));
+  cras_alsa_mmap_begin_buffer = dma;
+  cras_alsa_mmap_begin_frames = frames;
+
+  // Output is mixed in the cached buffer and only reaches the DMA buffer
+  // when committed.
+  EXPECT_EQ(0, get_buffer(&aio.base, &area, &frames));
+  EXPECT_EQ(16, frames);
+  EXPECT_EQ(mix_buffer, cras_audio_area_config_buf_pointers_base);
+  memset(mix_buffer, 0x55, frames * 4);
+  EXPECT_EQ(0, dma[0]);
+
+  EXPECT_EQ(0, put_buffer(&aio.base, frames));
+  for (unsigned int i = 0; i < frames * 4; i++)
+    EXPECT_EQ(0x55, dma[i]);
+  EXPECT_EQ(0, dma[frames * 4]);
+
+  free(aio.base.area);
+}
+
+TEST(AlsaNonInterleaved, SplitMixToChannels) {
+  struct alsa_io aio;
+  struct cras_audio_format fmt;
+  struct cras_audio_area* area;
+  unsigned int frames = 16;
+  uint8_t mix_buffer[BUFFER_SIZE * 4];
+  uint8_t dma[BUFFER_SIZE * 4];
+  uint8_t* channels[2];
+  int16_t* mixed = (int16_t*)mix_buffer;
+  int16_t* left = (int16_t*)dma;
+  int16_t* right = (int16_t*)(dma + BUFFER_SIZE * 2);
+
+  ResetStubData();
+  memset(&aio, 0, sizeof(aio));
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  aio.base.direction = CRAS_STREAM_OUTPUT;
+  aio.base.format = &fmt;
+  aio.base.buffer_size = BUFFER_SIZE;
+  aio.base.area = (struct cras_audio_area*)calloc(
+      1, sizeof(struct cras_audio_area) + 2 * sizeof(struct cras_channel_area));
+  aio.noninterleaved = 1;
+  aio.mmap_channels = channels;
+  aio.mix_buffer = mix_buffer;
+  memset(mix_buffer, 0, sizeof(mix_buffer));
+  memset(dma, 0, sizeof(dma));
+  cras_alsa_mmap_begin_buffer = dma;
+  cras_alsa_mmap_begin_frames = frames;
+
+  // Streams mix into the interleaved buffer, each channel is split out to
+  // its own plane on commit.
+  EXPECT_EQ(0, get_buffer(&aio.base, &area, &frames));
+  EXPECT_EQ(16, frames);
+  EXPECT_EQ(mix_buffer, cras_audio_area_config_buf_pointers_base);
+  for (unsigned int i = 0; i < frames; i++) {
+    mixed[2 * i] = i + 1;
+    mixed[2 * i + 1] = -(int)(i + 1);
+  }
+  EXPECT_EQ(0, left[0]);
+
+  EXPECT_EQ(0, put_buffer(&aio.base, frames));
+  for (unsigned int i = 0; i < frames; i++) {
+    EXPECT_EQ(i + 1, left[i]);
+    EXPECT_EQ(-(int)(i + 1), right[i]);
+  }
+  EXPECT_EQ(0, left[frames]);
+  EXPECT_EQ(0, right[frames]);
+
+  free(aio.base.area);
+}
+
 TEST(AlsaGetValidFrames, GetValidFramesNormalState) {
   struct cras_iodev* iodev;
   struct alsa_io* aio;
@@ -2404,7 +2797,8 @@ int cras_iodev_list_resume_hotword_stream() {
   return 0;
 }
 
-struct audio_thread* cras_iodev_list_get_audio_thread() {
+struct audio_thread* cras_iodev_list_get_dev_audio_thread(
+    const struct cras_iodev* dev) {
   return NULL;
 }
 
@@ -2434,6 +2828,10 @@ int cras_alsa_pcm_start(snd_pcm_t* handle) {
 int cras_alsa_pcm_drain(snd_pcm_t* handle) {
   return 0;
 }
+int cras_alsa_pcm_reprepare(snd_pcm_t* handle) {
+  cras_alsa_pcm_reprepare_called++;
+  return cras_alsa_pcm_reprepare_ret;
+}
 int cras_alsa_fill_properties(snd_pcm_t* handle,
                               size_t** rates,
                               size_t** channel_counts,
@@ -2471,7 +2869,8 @@ int cras_alsa_set_hwparams(snd_pcm_t* handle,
                            unsigned int dma_period_time) {
   return 0;
 }
-int cras_alsa_set_swparams(snd_pcm_t* handle) {
+int cras_alsa_set_swparams(snd_pcm_t* handle, int* hw_tstamps) {
+  *hw_tstamps = 1;
   return 0;
 }
 int cras_alsa_get_avail_frames(snd_pcm_t* handle,
@@ -2480,14 +2879,21 @@ int cras_alsa_get_avail_frames(snd_pcm_t* handle,
                                const char* dev_name,
                                snd_pcm_uframes_t* used,
                                struct timespec* tstamp) {
+  cras_alsa_get_avail_frames_called++;
   *used = cras_alsa_get_avail_frames_avail;
-  clock_gettime(CLOCK_MONOTONIC_RAW, tstamp);
+  if (timespec_is_nonzero(&cras_alsa_hw_tstamp))
+    *tstamp = cras_alsa_hw_tstamp;
+  else
+    clock_gettime(CLOCK_MONOTONIC_RAW, tstamp);
   return cras_alsa_get_avail_frames_ret;
 }
 int cras_alsa_get_delay_frames(snd_pcm_t* handle,
                                snd_pcm_uframes_t buf_size,
-                               snd_pcm_sframes_t* delay) {
-  *delay = 0;
+                               snd_pcm_sframes_t* delay,
+                               struct timespec* tstamp) {
+  cras_alsa_get_delay_frames_called++;
+  *delay = cras_alsa_get_delay_frames_delay;
+  *tstamp = cras_alsa_hw_tstamp;
   return 0;
 }
 int cras_alsa_mmap_begin(snd_pcm_t* handle,
@@ -2499,6 +2905,21 @@ int cras_alsa_mmap_begin(snd_pcm_t* handle,
   *frames = cras_alsa_mmap_begin_frames;
   return 0;
 }
+int cras_alsa_is_noninterleaved(snd_pcm_t* handle) {
+  return 0;
+}
+// Planes of BUFFER_SIZE 16 bit samples, back to back.
+int cras_alsa_mmap_begin_planar(snd_pcm_t* handle,
+                                unsigned int num_channels,
+                                uint8_t** channels,
+                                snd_pcm_uframes_t* offset,
+                                snd_pcm_uframes_t* frames) {
+  for (unsigned int i = 0; i < num_channels; i++)
+    channels[i] = cras_alsa_mmap_begin_buffer + i * BUFFER_SIZE * 2;
+  *offset = 0;
+  *frames = cras_alsa_mmap_begin_frames;
+  return 0;
+}
 int cras_alsa_mmap_commit(snd_pcm_t* handle,
                           snd_pcm_uframes_t offset,
                           snd_pcm_uframes_t frames) {
@@ -2555,6 +2976,10 @@ int cras_system_get_capture_mute() {
   return sys_get_capture_mute_return_value;
 }
 
+bool cras_system_get_uncached_dma_buffer() {
+  return sys_get_uncached_dma_buffer_return_value;
+}
+
 void cras_system_set_volume_limits(long min, long max) {
   sys_set_volume_limits_called++;
 }
@@ -2770,6 +3195,10 @@ unsigned int ucm_get_disable_software_volume(struct cras_use_case_mgr* mgr) {
   return 0;
 }
 
+unsigned int ucm_get_uncached_dma_buffer(struct cras_use_case_mgr* mgr) {
+  return ucm_get_uncached_dma_buffer_return_value;
+}
+
 char* ucm_get_hotword_models(struct cras_use_case_mgr* mgr) {
   return NULL;
 }
@@ -2824,6 +3253,14 @@ struct cras_volume_curve* cras_card_config_get_volume_curve_for_control(
   return it->second;
 }
 
+struct cras_channel_matrix* cras_card_config_get_channel_matrices(
+    const struct cras_card_config* card_config,
+    const char* node_name) {
+  return NULL;
+}
+
+void cras_channel_matrix_destroy_list(struct cras_channel_matrix* list) {}
+
 void cras_iodev_free_format(struct cras_iodev* iodev) {}
 
 int cras_iodev_set_format(struct cras_iodev* iodev,
@@ -2879,6 +3316,10 @@ void cras_alsa_jack_update_monitor_name(const struct cras_alsa_jack* jack,
     strcpy(name_buf, cras_alsa_jack_update_monitor_fake_name);
 }
 
+int cras_alsa_jack_supports_passthrough(const struct cras_alsa_jack* jack) {
+  return 0;
+}
+
 void cras_alsa_jack_update_node_type(const struct cras_alsa_jack* jack,
                                      enum CRAS_NODE_TYPE* type) {
   cras_alsa_jack_update_node_type_called++;
@@ -2899,6 +3340,13 @@ int ucm_get_default_node_gain(struct cras_use_case_mgr* mgr,
   return 0;
 }
 
+int ucm_get_adaptive_buffer_levels(struct cras_use_case_mgr* mgr,
+                                   const char* dev,
+                                   unsigned int* min_level,
+                                   unsigned int* max_level) {
+  return -ENOENT;
+}
+
 int ucm_get_intrinsic_sensitivity(struct cras_use_case_mgr* mgr,
                                   const char* dev,
                                   long* vol) {
@@ -2919,6 +3367,10 @@ int cras_iodev_reset_rate_estimator(const struct cras_iodev* iodev) {
   return 0;
 }
 
+double cras_iodev_get_est_rate_ratio(const struct cras_iodev* iodev) {
+  return 1.0;
+}
+
 int cras_iodev_frames_queued(struct cras_iodev* iodev,
                              struct timespec* tstamp) {
   clock_gettime(CLOCK_MONOTONIC_RAW, tstamp);
@@ -2937,9 +3389,12 @@ int cras_iodev_fill_odev_zeros(struct cras_iodev* odev, unsigned int frames) {
 
 void cras_audio_area_config_buf_pointers(struct cras_audio_area* area,
                                          const struct cras_audio_format* fmt,
-                                         uint8_t* base_buffer) {}
+                                         uint8_t* base_buffer) {
+  cras_audio_area_config_buf_pointers_base = base_buffer;
+}
 
-void audio_thread_add_events_callback(int fd,
+void audio_thread_add_events_callback(struct audio_thread* thread,
+                                      int fd,
                                       thread_callback cb,
                                       void* data,
                                       int events) {
@@ -2947,7 +3402,7 @@ void audio_thread_add_events_callback(int fd,
   audio_thread_cb_data = data;
 }
 
-void audio_thread_rm_callback(int fd) {}
+void audio_thread_rm_callback(struct audio_thread* thread, int fd) {}
 
 int audio_thread_rm_callback_sync(struct audio_thread* thread, int fd) {
   return 0;
@@ -2989,6 +3444,18 @@ int cras_alsa_resume_appl_ptr(snd_pcm_t* handle, snd_pcm_uframes_t ahead) {
   return 0;
 }
 
+snd_pcm_sframes_t cras_alsa_rewind(snd_pcm_t* handle,
+                                   snd_pcm_uframes_t frames) {
+  return frames;
+}
+
+unsigned int cras_iodev_default_frames_to_play_in_sleep(
+    struct cras_iodev* odev,
+    unsigned int* hw_level,
+    struct timespec* hw_tstamp) {
+  return 0;
+}
+
 int cras_iodev_default_no_stream_playback(struct cras_iodev* odev, int enable) {
   return 0;
 }
@@ -5,6 +5,7 @@
 #include <gtest/gtest.h>
 #include <linux/input.h>
 #include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <sys/param.h>
 #include <syslog.h>
@@ -18,6 +19,7 @@ extern "C" {
 #include "cras_alsa_jack.h"
 #include "cras_alsa_ucm_section.h"
 #include "cras_gpio_jack.h"
+#include "cras_main_message.h"
 #include "cras_tm.h"
 #include "cras_types.h"
 #include "cras_util.h"
@@ -35,6 +37,7 @@ namespace {
 
 static int fake_jack_cb_plugged;
 static void* fake_jack_cb_data;
+static const struct cras_alsa_jack* fake_jack_cb_jack;
 static size_t fake_jack_cb_called;
 unsigned int snd_hctl_elem_get_device_return_val;
 unsigned int snd_hctl_elem_get_device_called;
@@ -88,6 +91,14 @@ static const char* edid_file_ret;
 static unsigned ucm_get_override_type_name_called;
 static int ucm_get_alsa_dev_idx_for_dev_value;
 static snd_hctl_t* fake_hctl = (snd_hctl_t*)2;
+static int edid_valid_return;
+static int edid_lpcm_support_return;
+static size_t edid_lpcm_support_called;
+static const char* edid_get_monitor_name_value;
+static cras_message_callback main_message_callback;
+static pthread_mutex_t main_message_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t main_message_cond = PTHREAD_COND_INITIALIZER;
+static std::deque<std::vector<uint8_t>> main_messages;
 
 static void ResetStubData() {
   gpio_switch_list_for_each_called = 0;
@@ -136,6 +147,10 @@ static void ResetStubData() {
   ucm_get_cap_control_value = NULL;
   ucm_get_dev_for_jack_return = false;
   edid_file_ret = NULL;
+  edid_valid_return = 0;
+  edid_lpcm_support_return = 0;
+  edid_lpcm_support_called = 0;
+  edid_get_monitor_name_value = NULL;
   ucm_get_override_type_name_called = 0;
   ucm_get_alsa_dev_idx_for_dev_value = -1;
 
@@ -148,6 +163,7 @@ static void fake_jack_cb(const struct cras_alsa_jack* jack,
   fake_jack_cb_called++;
   fake_jack_cb_plugged = plugged;
   fake_jack_cb_data = data;
+  fake_jack_cb_jack = jack;
 
   // Check that jack enable callback is called if there is a ucm device.
   ucm_set_enabled_value = !plugged;
@@ -554,6 +570,31 @@ TEST(AlsaJacks, CreateGPIOMicNoUCMFirstDeviceHeadsetJack) {
                      should_create_jack, "c1 Headset Jack");
 }
 
+// Waits for the EDID worker to post a message and runs it as the main thread
+// would. Returns false on timeout.
+static bool RunMainMessage() {
+  struct timespec deadline;
+  std::vector<uint8_t> msg;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += 5;
+  pthread_mutex_lock(&main_message_lock);
+  while (main_messages.empty()) {
+    if (pthread_cond_timedwait(&main_message_cond, &main_message_lock,
+                               &deadline)) {
+      pthread_mutex_unlock(&main_message_lock);
+      return false;
+    }
+  }
+  msg = main_messages.front();
+  main_messages.pop_front();
+  pthread_mutex_unlock(&main_message_lock);
+
+  main_message_callback(
+      reinterpret_cast<struct cras_main_message*>(msg.data()), NULL);
+  return true;
+}
+
 TEST(AlsaJacks, GPIOHdmiWithEdid) {
   cras_alsa_jack_list* jack_list;
 
@@ -575,6 +616,7 @@ TEST(AlsaJacks, GPIOHdmiWithEdid) {
   // EDID shouldn't open, callback should be skipped until re-try.
   fake_jack_cb_called = 0;
   cras_alsa_jack_list_report(jack_list);
+  ASSERT_TRUE(RunMainMessage());
   EXPECT_EQ(0, fake_jack_cb_called);
 
   cras_alsa_jack_list_destroy(jack_list);
@@ -585,6 +627,61 @@ TEST(AlsaJacks, GPIOHdmiWithEdid) {
   EXPECT_EQ(1, cras_system_rm_select_fd_called);
 }
 
+TEST(AlsaJacks, GPIOHdmiEdidReadOnWorker) {
+  cras_alsa_jack_list* jack_list;
+  char edid_path[] = "/tmp/cras_edid_XXXXXX";
+  uint8_t edid[256] = {0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00};
+  char name[CRAS_NODE_NAME_BUFFER_SIZE];
+  static uint8_t serial;
+  int fd;
+
+  ResetStubData();
+  // EDIDs are cached by checksum for the life of the process, use a new one
+  // each run.
+  edid[12] = ++serial;
+  fd = mkstemp(edid_path);
+  ASSERT_GE(fd, 0);
+  ASSERT_EQ(sizeof(edid), write(fd, edid, sizeof(edid)));
+  close(fd);
+
+  ucm_get_dev_for_jack_return = 1;
+  edid_file_ret = strdup(edid_path);  // Freed in destroy.
+  edid_valid_return = 1;
+  edid_lpcm_support_return = 1;
+  edid_get_monitor_name_value = "Monitor";
+  gpio_switch_list_for_each_dev_names.push_back("c1 HDMI Jack");
+  eviocbit_ret[LONG(SW_LINEOUT_INSERT)] |= 1 << OFF(SW_LINEOUT_INSERT);
+  gpio_switch_eviocgbit_fd = 3;
+  snd_hctl_first_elem_return_val = NULL;
+  jack_list = cras_alsa_jack_list_create(
+      0, "c1", 0, 1, fake_mixer,
+      reinterpret_cast<struct cras_use_case_mgr*>(0x55), fake_hctl,
+      CRAS_STREAM_OUTPUT, fake_jack_cb, fake_jack_cb_arg);
+  ASSERT_NE(static_cast<cras_alsa_jack_list*>(NULL), jack_list);
+  EXPECT_EQ(0, cras_alsa_jack_list_find_jacks_by_name_matching(jack_list));
+
+  // The state is reported once the worker has read the EDID.
+  fake_jack_cb_called = 0;
+  cras_alsa_jack_list_report(jack_list);
+  EXPECT_EQ(0, fake_jack_cb_called);
+  ASSERT_TRUE(RunMainMessage());
+  EXPECT_EQ(1, fake_jack_cb_called);
+  EXPECT_EQ(1, fake_jack_cb_plugged);
+  EXPECT_EQ(1, edid_lpcm_support_called);
+
+  cras_alsa_jack_update_monitor_name(fake_jack_cb_jack, name, sizeof(name));
+  EXPECT_STREQ("Monitor", name);
+
+  // Plugging the same monitor again uses the cached EDID.
+  cras_alsa_jack_list_report(jack_list);
+  ASSERT_TRUE(RunMainMessage());
+  EXPECT_EQ(2, fake_jack_cb_called);
+  EXPECT_EQ(1, edid_lpcm_support_called);
+
+  cras_alsa_jack_list_destroy(jack_list);
+  unlink(edid_path);
+}
+
 TEST(AlsaJacks, CreateGPIOHpNoNameMatch) {
   struct cras_alsa_jack_list* jack_list;
 
@@ -1074,19 +1171,44 @@ cras_tm* cras_system_state_get_tm() {
 }
 
 int edid_valid(const unsigned char* edid_data) {
-  return 0;
+  return edid_valid_return;
 }
 
 int edid_lpcm_support(const unsigned char* edid_data, int ext) {
-  return 0;
+  edid_lpcm_support_called++;
+  return edid_lpcm_support_return;
 }
 
 int edid_get_monitor_name(const unsigned char* edid_data,
                           char* buf,
                           unsigned int buf_size) {
+  if (!edid_get_monitor_name_value)
+    return -1;
+  snprintf(buf, buf_size, "%s", edid_get_monitor_name_value);
+  return 0;
+}
+
+int cras_main_message_add_handler(enum CRAS_MAIN_MESSAGE_TYPE type,
+                                  cras_message_callback callback,
+                                  void* callback_data) {
+  main_message_callback = callback;
+  return 0;
+}
+
+int cras_main_message_send(struct cras_main_message* msg) {
+  uint8_t* bytes = reinterpret_cast<uint8_t*>(msg);
+
+  pthread_mutex_lock(&main_message_lock);
+  main_messages.push_back(std::vector<uint8_t>(bytes, bytes + msg->length));
+  pthread_cond_signal(&main_message_cond);
+  pthread_mutex_unlock(&main_message_lock);
   return 0;
 }
 
+int cras_main_message_send_blocking(struct cras_main_message* msg) {
+  return cras_main_message_send(msg);
+}
+
 // Overwrite this function so unittest can run without 2 seconds of wait
 // in find_gpio_jacks.
 int wait_for_dev_input_access() {
@@ -87,6 +87,12 @@ static char** iniparser_getstring_returns;
 static size_t snd_mixer_find_selem_called;
 static std::map<std::string, snd_mixer_elem_t*> snd_mixer_find_elem_map;
 static std::string snd_mixer_find_elem_id_name;
+static size_t cras_tm_create_timer_called;
+static struct cras_timer* cras_tm_create_timer_return;
+static unsigned int cras_tm_create_timer_ms;
+static void (*cras_tm_create_timer_cb)(struct cras_timer* t, void* data);
+static void* cras_tm_create_timer_cb_data;
+static size_t cras_tm_cancel_timer_called;
 
 static void ResetStubData() {
   iniparser_getstring_return_index = 0;
@@ -148,6 +154,12 @@ static void ResetStubData() {
   snd_mixer_find_selem_called = 0;
   snd_mixer_find_elem_map.clear();
   snd_mixer_find_elem_id_name.clear();
+  cras_tm_create_timer_called = 0;
+  cras_tm_create_timer_return = NULL;
+  cras_tm_create_timer_ms = 0;
+  cras_tm_create_timer_cb = NULL;
+  cras_tm_create_timer_cb_data = NULL;
+  cras_tm_cancel_timer_called = 0;
 }
 
 struct cras_alsa_mixer* create_mixer_and_add_controls_by_name_matching(
@@ -592,6 +604,75 @@ TEST(AlsaMixer, CreateTwoMainVolumeElements) {
   mixer_control_destroy(mixer_output);
 }
 
+TEST(AlsaMixer, SetdBFSCoalescesWritesWithinInterval) {
+  struct cras_alsa_mixer* c;
+  snd_mixer_elem_t* elements[] = {
+      reinterpret_cast<snd_mixer_elem_t*>(2),
+  };
+  int element_playback_volume[] = {
+      1,
+      1,
+  };
+  int element_playback_switches[] = {
+      1,
+      1,
+  };
+  const char* element_names[] = {
+      "Master",
+      "PCM",
+  };
+  static const long min_volumes[] = {-500, -1250};
+  static const long max_volumes[] = {40, 40};
+  long set_dB_values[2];
+
+  ResetStubData();
+  snd_mixer_first_elem_return_value = reinterpret_cast<snd_mixer_elem_t*>(1);
+  snd_mixer_elem_next_return_values = elements;
+  snd_mixer_elem_next_return_values_length = ARRAY_SIZE(elements);
+  snd_mixer_selem_has_playback_volume_return_values = element_playback_volume;
+  snd_mixer_selem_has_playback_volume_return_values_length =
+      ARRAY_SIZE(element_playback_volume);
+  snd_mixer_selem_has_playback_switch_return_values = element_playback_switches;
+  snd_mixer_selem_has_playback_switch_return_values_length =
+      ARRAY_SIZE(element_playback_switches);
+  snd_mixer_selem_get_name_return_values = element_names;
+  snd_mixer_selem_get_name_return_values_length = ARRAY_SIZE(element_names);
+  snd_mixer_selem_get_playback_dB_range_min_values = min_volumes;
+  snd_mixer_selem_get_playback_dB_range_max_values = max_volumes;
+  snd_mixer_selem_get_playback_dB_range_values_length = ARRAY_SIZE(min_volumes);
+  snd_mixer_selem_set_playback_dB_all_values = set_dB_values;
+  snd_mixer_selem_set_playback_dB_all_values_length = ARRAY_SIZE(set_dB_values);
+  c = create_mixer_and_add_controls_by_name_matching("hw:0", NULL, NULL);
+  ASSERT_NE(static_cast<struct cras_alsa_mixer*>(NULL), c);
+  cras_tm_create_timer_return = reinterpret_cast<struct cras_timer*>(0x33);
+
+  /* The first change is written right away. */
+  cras_alsa_mixer_set_dBFS(c, -50, NULL);
+  EXPECT_EQ(2, snd_mixer_selem_set_playback_dB_all_called);
+  EXPECT_EQ(0, cras_tm_create_timer_called);
+  EXPECT_EQ(30, set_dB_values[0]);
+
+  /* Changes right after are held back, only the last one is written. */
+  cras_alsa_mixer_set_dBFS(c, -100, NULL);
+  cras_alsa_mixer_set_dBFS(c, -200, NULL);
+  EXPECT_EQ(2, snd_mixer_selem_set_playback_dB_all_called);
+  EXPECT_EQ(1, cras_tm_create_timer_called);
+  EXPECT_GT(cras_tm_create_timer_ms, 0);
+  EXPECT_LE(cras_tm_create_timer_ms, VOLUME_WRITE_INTERVAL_MS);
+  cras_tm_create_timer_cb(cras_tm_create_timer_return,
+                          cras_tm_create_timer_cb_data);
+  EXPECT_EQ(4, snd_mixer_selem_set_playback_dB_all_called);
+  EXPECT_EQ(-120, set_dB_values[0]);
+  EXPECT_EQ(-120, set_dB_values[1]);
+
+  /* A held back write is dropped with the mixer. */
+  cras_alsa_mixer_set_dBFS(c, -300, NULL);
+  EXPECT_EQ(2, cras_tm_create_timer_called);
+  cras_alsa_mixer_destroy(c);
+  EXPECT_EQ(1, cras_tm_cancel_timer_called);
+  EXPECT_EQ(4, snd_mixer_selem_set_playback_dB_all_called);
+}
+
 TEST(AlsaMixer, CreateTwoMainCaptureElements) {
   struct cras_alsa_mixer* c;
   snd_mixer_elem_t* elements[] = {
@@ -1623,6 +1704,26 @@ void cras_volume_curve_destroy(struct cras_volume_curve* curve) {
   free(curve);
 }
 
+struct cras_tm* cras_system_state_get_tm() {
+  return NULL;
+}
+
+struct cras_timer* cras_tm_create_timer(struct cras_tm* tm,
+                                        unsigned int ms,
+                                        void (*cb)(struct cras_timer* t,
+                                                   void* data),
+                                        void* cb_data) {
+  cras_tm_create_timer_called++;
+  cras_tm_create_timer_ms = ms;
+  cras_tm_create_timer_cb = cb;
+  cras_tm_create_timer_cb_data = cb_data;
+  return cras_tm_create_timer_return;
+}
+
+void cras_tm_cancel_timer(struct cras_tm* tm, struct cras_timer* t) {
+  cras_tm_cancel_timer_called++;
+}
+
 // From libiniparser.
 struct cras_volume_curve* cras_card_config_get_volume_curve_for_control(
     const struct cras_card_config* card_config,
@@ -57,6 +57,7 @@ static void ResetStubData() {
   list_devices_callback_args.clear();
   snd_use_case_mgr_open_mgr_ptr = reinterpret_cast<snd_use_case_mgr_t*>(0x55);
   cras_ucm_mgr.use_case = CRAS_STREAM_TYPE_DEFAULT;
+  ucm_free_values(&cras_ucm_mgr);
 }
 
 static void list_devices_callback(const char* section_name, void* arg) {
@@ -179,6 +180,34 @@ TEST(AlsaUcm, GetEdidForDev) {
   EXPECT_EQ(snd_use_case_get_id[0], id);
 }
 
+TEST(AlsaUcm, ValuesReadFromAlsaOnce) {
+  struct cras_use_case_mgr* mgr = &cras_ucm_mgr;
+  std::string id = "=EDIDFile/Dev1/HiFi";
+  std::string value = "EdidFileName";
+  const char* file_name;
+
+  ResetStubData();
+
+  snd_use_case_get_value[id] = value;
+
+  for (int i = 0; i < 2; i++) {
+    file_name = ucm_get_edid_file_for_dev(mgr, "Dev1");
+    ASSERT_TRUE(file_name);
+    EXPECT_EQ(0, strcmp(file_name, value.c_str()));
+    free((void*)file_name);
+    EXPECT_EQ(NULL, ucm_get_edid_file_for_dev(mgr, "Dev2"));
+  }
+  ASSERT_EQ(2, snd_use_case_get_called);
+  EXPECT_EQ(snd_use_case_get_id[0], id);
+  EXPECT_EQ(snd_use_case_get_id[1], "=EDIDFile/Dev2/HiFi");
+
+  // Values are per verb.
+  mgr->avail_use_cases |= 1 << CRAS_STREAM_TYPE_VOICE_COMMUNICATION;
+  ucm_set_use_case(mgr, CRAS_STREAM_TYPE_VOICE_COMMUNICATION);
+  EXPECT_EQ(NULL, ucm_get_edid_file_for_dev(mgr, "Dev1"));
+  EXPECT_EQ(3, snd_use_case_get_called);
+}
+
 TEST(AlsaUcm, GetCapControlForDev) {
   struct cras_use_case_mgr* mgr = &cras_ucm_mgr;
   char* cap_control;
@@ -732,6 +761,23 @@ TEST(AlsaUcm, DisableSoftwareVolume) {
   EXPECT_EQ(snd_use_case_get_id[0], id);
 }
 
+TEST(AlsaUcm, UncachedDmaBuffer) {
+  struct cras_use_case_mgr* mgr = &cras_ucm_mgr;
+  std::string id = "=UncachedDmaBuffer//HiFi";
+  std::string value = "1";
+
+  ResetStubData();
+
+  EXPECT_EQ(0, ucm_get_uncached_dma_buffer(mgr));
+
+  snd_use_case_get_value[id] = value;
+  /* UCM values are read once, forget them to read the new value. */
+  ucm_free_values(mgr);
+  EXPECT_EQ(1, ucm_get_uncached_dma_buffer(mgr));
+  ASSERT_EQ(2, snd_use_case_get_called);
+  EXPECT_EQ(snd_use_case_get_id[1], id);
+}
+
 TEST(AlsaUcm, GetCoupledMixersForDevice) {
   struct cras_use_case_mgr* mgr = &cras_ucm_mgr;
   struct mixer_name *mixer_names_1, *mixer_names_2, *c;
@@ -815,6 +861,42 @@ TEST(AlsaUcm, DefaultNodeGain) {
   ASSERT_TRUE(ret);
 }
 
+TEST(AlsaUcm, AdaptiveBufferLevels) {
+  struct cras_use_case_mgr* mgr = &cras_ucm_mgr;
+  unsigned int min_level, max_level;
+  int ret;
+  std::string min_id = "=AdaptiveBufferMinLevel/Speaker/HiFi";
+  std::string max_id = "=AdaptiveBufferMaxLevel/Speaker/HiFi";
+
+  ResetStubData();
+
+  /* Both values can be found in UCM. */
+  snd_use_case_get_value[min_id] = "96";
+  snd_use_case_get_value[max_id] = "480";
+
+  ret = ucm_get_adaptive_buffer_levels(mgr, "Speaker", &min_level, &max_level);
+
+  EXPECT_EQ(0, ret);
+  EXPECT_EQ(96, min_level);
+  EXPECT_EQ(480, max_level);
+
+  /* The range is invalid. */
+  snd_use_case_get_value[max_id] = "48";
+  /* UCM values are read once, forget them to read the new value. */
+  ucm_free_values(mgr);
+  ret = ucm_get_adaptive_buffer_levels(mgr, "Speaker", &min_level, &max_level);
+
+  EXPECT_EQ(-EINVAL, ret);
+
+  ResetStubData();
+
+  /* Only one of the values is in UCM. */
+  snd_use_case_get_value[min_id] = "96";
+  ret = ucm_get_adaptive_buffer_levels(mgr, "Speaker", &min_level, &max_level);
+
+  ASSERT_TRUE(ret);
+}
+
 TEST(AlsaUcm, IntrinsicSensitivity) {
   struct cras_use_case_mgr* mgr = &cras_ucm_mgr;
   long intrinsic_vol;
@@ -853,11 +935,15 @@ TEST(AlsaUcm, UseFullySpecifiedUCMConfig) {
 
   /* Flag is set to "1". */
   snd_use_case_get_value[id] = std::string("1");
+  /* UCM values are read once, forget them to read the new value. */
+  ucm_free_values(mgr);
   fully_specified_flag = ucm_has_fully_specified_ucm_flag(mgr);
   ASSERT_TRUE(fully_specified_flag);
 
   /* Flag is set to "0". */
   snd_use_case_get_value[id] = std::string("0");
+  /* UCM values are read once, forget them to read the new value. */
+  ucm_free_values(mgr);
   fully_specified_flag = ucm_has_fully_specified_ucm_flag(mgr);
   ASSERT_FALSE(fully_specified_flag);
 }
@@ -6,7 +6,8 @@
 #include <stdio.h>
 
 extern "C" {
-#include "cras_apm_list.h"
+#include "cras_apm_list.c"
+
 #include "cras_audio_area.h"
 #include "cras_dsp_pipeline.h"
 #include "cras_iodev.h"
@@ -21,21 +22,30 @@ extern "C" {
 namespace {
 
 static void* stream_ptr = reinterpret_cast<void*>(0x123);
+static void* stream_ptr2 = reinterpret_cast<void*>(0x234);
 static void* dev_ptr = reinterpret_cast<void*>(0x345);
 static void* dev_ptr2 = reinterpret_cast<void*>(0x678);
 static struct cras_apm_list* list;
 static struct cras_audio_area fake_audio_area;
 static unsigned int dsp_util_interleave_frames;
 static unsigned int webrtc_apm_process_stream_f_called;
+static int webrtc_apm_process_stream_f_ret;
 static unsigned int webrtc_apm_process_reverse_stream_f_called;
 static device_enabled_callback_t device_enabled_callback_val;
+static device_disabled_callback_t device_disabled_callback_val;
 static struct ext_dsp_module* ext_dsp_module_value;
 static struct cras_ionode fake_node;
 static struct cras_iodev fake_iodev;
+static struct cras_iodev fake_iodev2;
+static int fake_delay_frames;
+static float webrtc_apm_process_reverse_stream_f_sample;
+static struct timespec clock_gettime_retspec;
 static int webrtc_apm_create_called;
 static bool cras_iodev_is_aec_use_case_ret;
 static dictionary* webrtc_apm_create_aec_ini_val = NULL;
 static dictionary* webrtc_apm_create_apm_ini_val = NULL;
+static size_t pthread_create_called;
+static size_t pthread_join_called;
 
 TEST(ApmList, ApmListCreate) {
   list = cras_apm_list_create(stream_ptr, 0);
@@ -176,42 +186,186 @@ TEST(ApmList, ApmProcessForwardBuffer) {
   list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
   EXPECT_NE((void*)NULL, list);
 
+  pthread_create_called = 0;
   apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+  EXPECT_EQ(1, pthread_create_called);
+  cras_apm_list_start_apm(list, dev_ptr);
 
   buf = float_buffer_create(500, 2);
   float_buffer_written(buf, 300);
   webrtc_apm_process_stream_f_called = 0;
-  cras_apm_list_process(apm, buf, 0);
+  EXPECT_EQ(300, cras_apm_list_process(apm, buf, 0));
+  apm_process_pending(apm->shared);
   EXPECT_EQ(0, webrtc_apm_process_stream_f_called);
 
   area = cras_apm_list_get_processed(apm);
   EXPECT_EQ(0, area->frames);
 
+  /* The 10ms block is handed to the APM thread once it is filled, and
+   * the processed frames show up after the thread is done with it. */
+  cras_apm_list_set_dev_read(dev_ptr, 300);
   float_buffer_reset(buf);
   float_buffer_written(buf, 200);
-  cras_apm_list_process(apm, buf, 0);
+  EXPECT_EQ(200, cras_apm_list_process(apm, buf, 0));
   area = cras_apm_list_get_processed(apm);
+  EXPECT_EQ(0, area->frames);
+
+  apm_process_pending(apm->shared);
   EXPECT_EQ(1, webrtc_apm_process_stream_f_called);
+
+  /* The planar output is read without interleaving the block. */
+  dsp_util_interleave_frames = 0;
+  area = cras_apm_list_get_processed_planar(apm);
+  EXPECT_EQ(480, area->frames);
+  EXPECT_EQ(0, dsp_util_interleave_frames);
+
+  area = cras_apm_list_get_processed(apm);
   EXPECT_EQ(480, dsp_util_interleave_frames);
   EXPECT_EQ(480, area->frames);
 
-  /* Put some processed frames. Another apm_list process will not call
-   * into webrtc_apm because the processed buffer is not yet empty.
-   */
+  /* Blocks keep being processed while the stream has not read all
+   * the frames already interleaved. */
   cras_apm_list_put_processed(apm, 200);
+  cras_apm_list_set_dev_read(dev_ptr, 200);
   float_buffer_reset(buf);
   float_buffer_written(buf, 500);
-  cras_apm_list_process(apm, buf, 0);
-  EXPECT_EQ(1, webrtc_apm_process_stream_f_called);
+  EXPECT_EQ(500, cras_apm_list_process(apm, buf, 0));
+  apm_process_pending(apm->shared);
+  EXPECT_EQ(2, webrtc_apm_process_stream_f_called);
+  area = cras_apm_list_get_processed(apm);
+  EXPECT_EQ(280, area->frames);
 
-  /* Put another 280 processed frames, so it's now ready for webrtc_apm
-   * to process another chunk of 480 frames (10ms) data.
-   */
+  /* Read the other 280 frames, so the next processed block can be
+   * interleaved. */
   cras_apm_list_put_processed(apm, 280);
-  cras_apm_list_process(apm, buf, 0);
-  EXPECT_EQ(2, webrtc_apm_process_stream_f_called);
+  area = cras_apm_list_get_processed(apm);
+  EXPECT_EQ(480, area->frames);
+
+  float_buffer_destroy(&buf);
+  cras_apm_list_stop_apm(list, dev_ptr);
+  pthread_join_called = 0;
+  cras_apm_list_destroy(list);
+  EXPECT_EQ(1, pthread_join_called);
+  cras_apm_list_deinit();
+}
+
+TEST(ApmList, ApmProcessBlocksFull) {
+  struct cras_apm* apm;
+  struct cras_audio_format fmt;
+  struct float_buffer* buf;
+
+  fmt.num_channels = 2;
+  fmt.frame_rate = 48000;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+
+  cras_apm_list_init("");
+
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  EXPECT_NE((void*)NULL, list);
+  apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+  cras_apm_list_start_apm(list, dev_ptr);
+
+  /* Only APM_NUM_BLOCKS blocks can be queued before the stream reads. */
+  buf = float_buffer_create(480 * (APM_NUM_BLOCKS + 1), 2);
+  float_buffer_written(buf, 480 * (APM_NUM_BLOCKS + 1));
+  EXPECT_EQ(480 * APM_NUM_BLOCKS, cras_apm_list_process(apm, buf, 0));
+  EXPECT_EQ(480 * APM_NUM_BLOCKS, cras_apm_list_get_delay_frames(apm));
+
+  webrtc_apm_process_stream_f_called = 0;
+  apm_process_pending(apm->shared);
+  EXPECT_EQ(APM_NUM_BLOCKS, webrtc_apm_process_stream_f_called);
+
+  /* The first processed block moves to the byte buffer, which frees
+   * one block for the remaining input. */
+  EXPECT_EQ(480, cras_apm_list_get_processed(apm)->frames);
+  EXPECT_EQ(480, cras_apm_list_process(apm, buf, 480 * APM_NUM_BLOCKS));
+  EXPECT_EQ(480 * (APM_NUM_BLOCKS + 1), cras_apm_list_get_delay_frames(apm));
+
+  cras_apm_list_put_processed(apm, 480);
+  EXPECT_EQ(480 * APM_NUM_BLOCKS, cras_apm_list_get_delay_frames(apm));
 
   float_buffer_destroy(&buf);
+  cras_apm_list_stop_apm(list, dev_ptr);
+  cras_apm_list_destroy(list);
+  cras_apm_list_deinit();
+}
+
+TEST(ApmList, ApmProcessError) {
+  struct cras_apm* apm;
+  struct cras_audio_format fmt;
+  struct float_buffer* buf;
+
+  fmt.num_channels = 2;
+  fmt.frame_rate = 48000;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+
+  cras_apm_list_init("");
+
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  EXPECT_NE((void*)NULL, list);
+  apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+  cras_apm_list_start_apm(list, dev_ptr);
+
+  buf = float_buffer_create(480, 2);
+  float_buffer_written(buf, 480);
+  EXPECT_EQ(480, cras_apm_list_process(apm, buf, 0));
+
+  /* An error from the APM thread is returned on the next process. */
+  webrtc_apm_process_stream_f_ret = -EINVAL;
+  apm_process_pending(apm->shared);
+  EXPECT_EQ(-EINVAL, cras_apm_list_process(apm, buf, 0));
+  webrtc_apm_process_stream_f_ret = 0;
+
+  float_buffer_destroy(&buf);
+  cras_apm_list_stop_apm(list, dev_ptr);
+  cras_apm_list_destroy(list);
+  cras_apm_list_deinit();
+}
+
+TEST(ApmList, ApmProcessChannelMap) {
+  struct cras_apm* apm;
+  struct cras_audio_format fmt;
+  struct float_buffer *buf, *block;
+  float* const* wp;
+  float* const* rp;
+  unsigned int nread = 480;
+
+  /* Four channels of FL, FR, RL and FC. APM takes FL, FR and FC. */
+  fmt.num_channels = 4;
+  fmt.frame_rate = 48000;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  for (int i = 0; i < CRAS_CH_MAX; i++)
+    fmt.channel_layout[i] = -1;
+  fmt.channel_layout[CRAS_CH_FL] = 0;
+  fmt.channel_layout[CRAS_CH_FR] = 1;
+  fmt.channel_layout[CRAS_CH_RL] = 2;
+  fmt.channel_layout[CRAS_CH_FC] = 3;
+
+  cras_apm_list_init("");
+
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  EXPECT_NE((void*)NULL, list);
+  apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+  cras_apm_list_start_apm(list, dev_ptr);
+  EXPECT_EQ(3, cras_apm_list_get_format(apm)->num_channels);
+
+  buf = float_buffer_create(480, 4);
+  wp = float_buffer_write_pointer(buf);
+  for (int ch = 0; ch < 4; ch++)
+    for (int i = 0; i < 480; i++)
+      wp[ch][i] = ch;
+  float_buffer_written(buf, 480);
+  EXPECT_EQ(480, cras_apm_list_process(apm, buf, 0));
+
+  block = apm->shared->fwd_blocks[0];
+  rp = float_buffer_read_pointer(block, 0, &nread);
+  EXPECT_EQ(480, nread);
+  EXPECT_EQ(0, rp[0][479]);
+  EXPECT_EQ(1, rp[1][479]);
+  EXPECT_EQ(3, rp[2][479]);
+
+  float_buffer_destroy(&buf);
+  cras_apm_list_stop_apm(list, dev_ptr);
   cras_apm_list_destroy(list);
   cras_apm_list_deinit();
 }
@@ -222,7 +376,6 @@ TEST(ApmList, ApmProcessReverseData) {
   struct float_buffer* buf;
   float* const* rp;
   unsigned int nread;
-  struct cras_iodev fake_iodev;
 
   fmt.num_channels = 2;
   fmt.frame_rate = 48000;
@@ -245,7 +398,7 @@ TEST(ApmList, ApmProcessReverseData) {
   nread = 500;
   rp = float_buffer_read_pointer(buf, 0, &nread);
 
-  for (int i = 0; i < buf->num_channels; i++)
+  for (unsigned int i = 0; i < buf->num_channels; i++)
     ext_dsp_module_value->ports[i] = rp[i];
 
   ext_dsp_module_value->configure(ext_dsp_module_value, 800, 2, 48000);
@@ -262,13 +415,147 @@ TEST(ApmList, ApmProcessReverseData) {
   EXPECT_EQ(0, webrtc_apm_process_reverse_stream_f_called);
 
   ext_dsp_module_value->run(ext_dsp_module_value, 250);
+  EXPECT_EQ(0, webrtc_apm_process_reverse_stream_f_called);
+
+  /* The echo reference is analyzed on the APM thread. */
+  apm_process_pending(apm->shared);
   EXPECT_EQ(1, webrtc_apm_process_reverse_stream_f_called);
 
   float_buffer_destroy(&buf);
+  cras_apm_list_stop_apm(list, dev_ptr);
   cras_apm_list_destroy(list);
   cras_apm_list_deinit();
 }
 
+TEST(ApmList, OverloadedSkipsReverseOfBackgroundStreams) {
+  struct cras_apm* apm;
+  struct cras_audio_format fmt;
+  struct float_buffer* buf;
+  float* const* rp;
+  unsigned int nread;
+
+  fmt.num_channels = 2;
+  fmt.frame_rate = 48000;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+
+  fake_iodev.direction = CRAS_STREAM_OUTPUT;
+  device_enabled_callback_val = NULL;
+  ext_dsp_module_value = NULL;
+  webrtc_apm_process_reverse_stream_f_called = 0;
+
+  cras_apm_list_init("");
+  device_enabled_callback_val(&fake_iodev, NULL);
+  ASSERT_NE((void*)NULL, ext_dsp_module_value);
+
+  buf = float_buffer_create(500, 2);
+  float_buffer_written(buf, 500);
+  nread = 500;
+  rp = float_buffer_read_pointer(buf, 0, &nread);
+  for (unsigned int i = 0; i < buf->num_channels; i++)
+    ext_dsp_module_value->ports[i] = rp[i];
+  ext_dsp_module_value->configure(ext_dsp_module_value, 800, 2, 48000);
+
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  cras_apm_list_set_background(list, true);
+  apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+  cras_apm_list_start_apm(list, dev_ptr);
+
+  cras_apm_list_set_overloaded(true);
+  ext_dsp_module_value->run(ext_dsp_module_value, 500);
+  ext_dsp_module_value->run(ext_dsp_module_value, 500);
+  apm_process_pending(apm->shared);
+  EXPECT_EQ(0, webrtc_apm_process_reverse_stream_f_called);
+
+  cras_apm_list_set_overloaded(false);
+  ext_dsp_module_value->run(ext_dsp_module_value, 500);
+  apm_process_pending(apm->shared);
+  EXPECT_EQ(1, webrtc_apm_process_reverse_stream_f_called);
+
+  float_buffer_destroy(&buf);
+  cras_apm_list_stop_apm(list, dev_ptr);
+  cras_apm_list_destroy(list);
+  cras_apm_list_deinit();
+}
+
+static int delay_frames_stub(const struct cras_iodev* iodev) {
+  return fake_delay_frames;
+}
+
+TEST(ApmList, MixesReverseOfAllOutputs) {
+  struct cras_apm* apm;
+  struct cras_audio_format fmt;
+  struct ext_dsp_module *ext1, *ext2;
+  float samples1[2][480], samples2[2][480];
+
+  fmt.num_channels = 2;
+  fmt.frame_rate = 48000;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+
+  for (int i = 0; i < 480; i++) {
+    samples1[0][i] = samples1[1][i] = 1.0f;
+    samples2[0][i] = samples2[1][i] = 2.0f;
+  }
+  fake_iodev.direction = CRAS_STREAM_OUTPUT;
+  fake_iodev.state = CRAS_IODEV_STATE_NORMAL_RUN;
+  fake_iodev.delay_frames = delay_frames_stub;
+  fake_iodev2.direction = CRAS_STREAM_OUTPUT;
+  fake_iodev2.state = CRAS_IODEV_STATE_NORMAL_RUN;
+  fake_iodev2.delay_frames = delay_frames_stub;
+  fake_delay_frames = 100;
+  clock_gettime_retspec.tv_sec = 1;
+  clock_gettime_retspec.tv_nsec = 0;
+  ext_dsp_module_value = NULL;
+  webrtc_apm_process_reverse_stream_f_called = 0;
+
+  cras_apm_list_init("");
+  ext1 = ext_dsp_module_value;
+  ASSERT_NE((void*)NULL, ext1);
+
+  /* Each enabled output gets its own tap. */
+  device_enabled_callback_val(&fake_iodev2, NULL);
+  ext2 = ext_dsp_module_value;
+  ASSERT_NE((void*)NULL, ext2);
+  EXPECT_NE(ext1, ext2);
+
+  for (int i = 0; i < 2; i++) {
+    ext1->ports[i] = samples1[i];
+    ext2->ports[i] = samples2[i];
+  }
+  ext1->configure(ext1, 480, 2, 48000);
+  ext2->configure(ext2, 480, 2, 48000);
+
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+  cras_apm_list_start_apm(list, dev_ptr);
+
+  /* The second output joins the mix from its next block on, the
+   * reference then carries the echo of both. */
+  for (int i = 0; i < 3; i++) {
+    ext1->run(ext1, 480);
+    ext2->run(ext2, 480);
+    clock_gettime_retspec.tv_nsec += 10000000;
+  }
+  apm_process_pending(apm->shared);
+  EXPECT_EQ(2, webrtc_apm_process_reverse_stream_f_called);
+  EXPECT_FLOAT_EQ(3.0f, webrtc_apm_process_reverse_stream_f_sample);
+
+  /* Back to the first output alone once the second is disabled. */
+  device_disabled_callback_val(&fake_iodev2, NULL);
+  EXPECT_EQ((void*)NULL, ext_dsp_module_value);
+  for (int i = 0; i < 2; i++) {
+    ext1->run(ext1, 480);
+    clock_gettime_retspec.tv_nsec += 10000000;
+  }
+  apm_process_pending(apm->shared);
+  EXPECT_EQ(4, webrtc_apm_process_reverse_stream_f_called);
+  EXPECT_FLOAT_EQ(1.0f, webrtc_apm_process_reverse_stream_f_sample);
+
+  cras_apm_list_stop_apm(list, dev_ptr);
+  cras_apm_list_destroy(list);
+  cras_apm_list_deinit();
+  fake_iodev.state = CRAS_IODEV_STATE_CLOSE;
+}
+
 TEST(ApmList, StreamAddToAlreadyOpenedDev) {
   struct cras_audio_format fmt;
   struct cras_apm *apm1, *apm2;
@@ -295,14 +582,224 @@ TEST(ApmList, StreamAddToAlreadyOpenedDev) {
   cras_apm_list_deinit();
 }
 
+TEST(ApmList, StreamsShareApm) {
+  struct cras_audio_format fmt;
+  struct cras_apm_list *list2, *list3;
+  struct cras_apm *apm1, *apm2, *apm3;
+  struct float_buffer* buf;
+
+  fmt.num_channels = 2;
+  fmt.frame_rate = 48000;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+
+  cras_apm_list_init("");
+
+  webrtc_apm_create_called = 0;
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  list2 = cras_apm_list_create(stream_ptr2, APM_ECHO_CANCELLATION);
+  list3 = cras_apm_list_create(
+      stream_ptr, APM_ECHO_CANCELLATION | APM_NOISE_SUPRESSION);
+
+  /* Streams of the same effects on the same device share one APM. */
+  apm1 = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+  apm2 = cras_apm_list_add_apm(list2, dev_ptr, &fmt, 1);
+  EXPECT_EQ(1, webrtc_apm_create_called);
+  EXPECT_NE(apm1, apm2);
+  EXPECT_EQ(apm1->shared, apm2->shared);
+
+  /* Other effects need an APM of their own. */
+  apm3 = cras_apm_list_add_apm(list3, dev_ptr, &fmt, 1);
+  EXPECT_EQ(2, webrtc_apm_create_called);
+  EXPECT_NE(apm1->shared, apm3->shared);
+  cras_apm_list_destroy(list3);
+
+  cras_apm_list_start_apm(list, dev_ptr);
+  cras_apm_list_start_apm(list2, dev_ptr);
+
+  /* The second stream skips the input already taken for the first. */
+  buf = float_buffer_create(480, 2);
+  float_buffer_written(buf, 480);
+  EXPECT_EQ(480, cras_apm_list_process(apm1, buf, 0));
+  EXPECT_EQ(480, cras_apm_list_process(apm2, buf, 0));
+  webrtc_apm_process_stream_f_called = 0;
+  apm_process_pending(apm1->shared);
+  EXPECT_EQ(1, webrtc_apm_process_stream_f_called);
+  cras_apm_list_set_dev_read(dev_ptr, 480);
+  EXPECT_EQ(0, apm1->shared->dev_offset);
+
+  /* Each stream reads the processed data at its own pace. */
+  EXPECT_EQ(480, cras_apm_list_get_processed(apm1)->frames);
+  cras_apm_list_put_processed(apm1, 480);
+  EXPECT_EQ(0, cras_apm_list_get_processed(apm1)->frames);
+  EXPECT_EQ(480, cras_apm_list_get_processed(apm2)->frames);
+  cras_apm_list_put_processed(apm2, 200);
+  EXPECT_EQ(280, cras_apm_list_get_processed(apm2)->frames);
+  EXPECT_EQ(280, cras_apm_list_get_delay_frames(apm2));
+
+  /* The APM stays until the last stream using it goes away. */
+  cras_apm_list_stop_apm(list, dev_ptr);
+  cras_apm_list_destroy(list);
+  EXPECT_EQ(280, cras_apm_list_get_processed(apm2)->frames);
+  pthread_join_called = 0;
+  cras_apm_list_stop_apm(list2, dev_ptr);
+  cras_apm_list_destroy(list2);
+  EXPECT_EQ(1, pthread_join_called);
+
+  float_buffer_destroy(&buf);
+  cras_apm_list_deinit();
+}
+
+static void fill_stereo_format(struct cras_audio_format* fmt) {
+  int i;
+
+  fmt->num_channels = 2;
+  fmt->frame_rate = 48000;
+  fmt->format = SND_PCM_FORMAT_S16_LE;
+  for (i = 0; i < CRAS_CH_MAX; i++)
+    fmt->channel_layout[i] = -1;
+  fmt->channel_layout[CRAS_CH_FL] = 0;
+  fmt->channel_layout[CRAS_CH_FR] = 1;
+}
+
+TEST(ApmList, SwapEffectsDrainsCurrentApm) {
+  struct cras_audio_format fmt;
+  struct cras_apm *apm, *next;
+  struct float_buffer* buf;
+
+  fill_stereo_format(&fmt);
+  cras_apm_list_init("");
+
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+  cras_apm_list_start_apm(list, dev_ptr);
+
+  buf = float_buffer_create(500, 2);
+  float_buffer_written(buf, 300);
+  EXPECT_EQ(300, cras_apm_list_process(apm, buf, 0));
+
+  EXPECT_EQ(0, cras_apm_list_stage_effects(
+                   list, APM_ECHO_CANCELLATION | APM_NOISE_SUPRESSION));
+  EXPECT_EQ(0, cras_apm_list_stage_apm(list, dev_ptr, &fmt, 1));
+  cras_apm_list_swap_apm(list, dev_ptr);
+  cras_apm_list_commit_effects(list);
+  EXPECT_EQ(APM_ECHO_CANCELLATION | APM_NOISE_SUPRESSION,
+            cras_apm_list_get_effects(list));
+
+  /* The partial block is handed over, and no more input is taken. */
+  EXPECT_EQ(apm, cras_apm_list_get_active_apm(stream_ptr, dev_ptr));
+  float_buffer_written(buf, 200);
+  EXPECT_EQ(0, cras_apm_list_process(apm, buf, 300));
+  webrtc_apm_process_stream_f_called = 0;
+  apm_process_pending(apm->shared);
+  EXPECT_EQ(1, webrtc_apm_process_stream_f_called);
+
+  /* The padding is left out of what the stream reads. */
+  dsp_util_interleave_frames = 0;
+  EXPECT_EQ(300, cras_apm_list_get_processed(apm)->frames);
+  EXPECT_EQ(300, dsp_util_interleave_frames);
+  EXPECT_EQ(-EBUSY, cras_apm_list_stage_effects(list, 0));
+  cras_apm_list_put_processed(apm, 200);
+  EXPECT_EQ(apm, cras_apm_list_get_active_apm(stream_ptr, dev_ptr));
+  cras_apm_list_put_processed(apm, 100);
+
+  /* Once drained, the new APM takes the input from where the old one
+   * stopped. */
+  next = cras_apm_list_get_active_apm(stream_ptr, dev_ptr);
+  EXPECT_NE(apm, next);
+  EXPECT_NE(apm->shared, next->shared);
+  EXPECT_EQ(200, cras_apm_list_process(next, buf, 300));
+
+  cras_apm_list_stop_apm(list, dev_ptr);
+  pthread_join_called = 0;
+  EXPECT_EQ(0, cras_apm_list_stage_effects(list, 0));
+  EXPECT_EQ(1, pthread_join_called);
+  cras_apm_list_destroy(list);
+  EXPECT_EQ(2, pthread_join_called);
+
+  float_buffer_destroy(&buf);
+  cras_apm_list_deinit();
+}
+
+TEST(ApmList, SwapEffectsOffReadsDevice) {
+  struct cras_audio_format fmt;
+  struct cras_apm* apm;
+  struct float_buffer* buf;
+
+  fill_stereo_format(&fmt);
+  cras_apm_list_init("");
+
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+  cras_apm_list_start_apm(list, dev_ptr);
+
+  buf = float_buffer_create(960, 2);
+  float_buffer_written(buf, 960);
+  EXPECT_EQ(960, cras_apm_list_process(apm, buf, 0));
+  apm_process_pending(apm->shared);
+
+  EXPECT_EQ(0, cras_apm_list_stage_effects(list, 0));
+  EXPECT_EQ(0, cras_apm_list_stage_apm(list, dev_ptr, &fmt, 1));
+  cras_apm_list_swap_apm(list, dev_ptr);
+  cras_apm_list_commit_effects(list);
+  EXPECT_EQ(0, cras_apm_list_get_effects(list));
+
+  /* Both full blocks are read out before the device. */
+  EXPECT_EQ(480, cras_apm_list_get_processed(apm)->frames);
+  cras_apm_list_put_processed(apm, 480);
+  EXPECT_EQ(apm, cras_apm_list_get_active_apm(stream_ptr, dev_ptr));
+  EXPECT_EQ(480, cras_apm_list_get_processed(apm)->frames);
+  cras_apm_list_put_processed(apm, 480);
+  EXPECT_EQ((void*)NULL, cras_apm_list_get_active_apm(stream_ptr, dev_ptr));
+
+  cras_apm_list_stop_apm(list, dev_ptr);
+  cras_apm_list_destroy(list);
+  float_buffer_destroy(&buf);
+  cras_apm_list_deinit();
+}
+
+TEST(ApmList, StageEffectsKeepsFormat) {
+  struct cras_audio_format fmt;
+  struct cras_apm* apm;
+
+  fill_stereo_format(&fmt);
+  fmt.num_channels = 4;
+  fmt.channel_layout[CRAS_CH_RL] = 2;
+  fmt.channel_layout[CRAS_CH_RR] = 3;
+  cras_apm_list_init("");
+
+  /* A stream reading all four channels can't move to the stereo APM. */
+  list = cras_apm_list_create(stream_ptr, APM_NOISE_SUPRESSION);
+  EXPECT_EQ(0, cras_apm_list_stage_effects(list, APM_ECHO_CANCELLATION));
+  EXPECT_EQ(-ENOTSUP, cras_apm_list_stage_apm(list, dev_ptr, &fmt, 1));
+  cras_apm_list_destroy(list);
+
+  /* Nor back from it. */
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+  EXPECT_EQ(2, cras_apm_list_get_format(apm)->num_channels);
+  EXPECT_EQ(0, cras_apm_list_stage_effects(
+                   list, APM_ECHO_CANCELLATION | APM_GAIN_CONTROL));
+  EXPECT_EQ(0, cras_apm_list_stage_apm(list, dev_ptr, &fmt, 1));
+  EXPECT_EQ(0, cras_apm_list_stage_effects(list, 0));
+  EXPECT_EQ(-ENOTSUP, cras_apm_list_stage_apm(list, dev_ptr, &fmt, 1));
+  cras_apm_list_destroy(list);
+
+  cras_apm_list_deinit();
+}
+
 extern "C" {
 int cras_iodev_list_set_device_enabled_callback(
     device_enabled_callback_t enabled_cb,
     device_disabled_callback_t disabled_cb,
     void* cb_data) {
   device_enabled_callback_val = enabled_cb;
+  device_disabled_callback_val = disabled_cb;
   return 0;
 }
+struct audio_thread* cras_iodev_list_get_dev_audio_thread(
+    const struct cras_iodev* dev) {
+  return NULL;
+}
 struct cras_iodev* cras_iodev_list_get_first_enabled_iodev(
     enum CRAS_STREAM_DIRECTION direction) {
   return &fake_iodev;
@@ -324,12 +821,17 @@ void cras_audio_area_config_channels(struct cras_audio_area* area,
 void cras_audio_area_config_buf_pointers(struct cras_audio_area* area,
                                          const struct cras_audio_format* fmt,
                                          uint8_t* base_buffer) {}
-void dsp_util_interleave(float* const* input,
-                         int16_t* output,
-                         int channels,
-                         snd_pcm_format_t format,
-                         int frames) {
+int dsp_util_interleave(float* const* input,
+                        uint8_t* output,
+                        int channels,
+                        snd_pcm_format_t format,
+                        int frames) {
   dsp_util_interleave_frames = frames;
+  return 0;
+}
+void dsp_util_accumulate(float* dst, const float* src, int frames) {
+  for (int i = 0; i < frames; i++)
+    dst[i] += src[i];
 }
 struct aec_config* aec_config_get(const char* device_config_dir) {
   return NULL;
@@ -357,7 +859,7 @@ int webrtc_apm_process_stream_f(webrtc_apm ptr,
                                 int rate,
                                 float* const* data) {
   webrtc_apm_process_stream_f_called++;
-  return 0;
+  return webrtc_apm_process_stream_f_ret;
 }
 
 int webrtc_apm_process_reverse_stream_f(webrtc_apm ptr,
@@ -365,6 +867,7 @@ int webrtc_apm_process_reverse_stream_f(webrtc_apm ptr,
                                         int rate,
                                         float* const* data) {
   webrtc_apm_process_reverse_stream_f_called++;
+  webrtc_apm_process_reverse_stream_f_sample = data[0][0];
   return 0;
 }
 int webrtc_apm_aec_dump(webrtc_apm ptr,
@@ -374,6 +877,35 @@ int webrtc_apm_aec_dump(webrtc_apm ptr,
   return 0;
 }
 
+//  From libpthread.
+int pthread_create(pthread_t* thread,
+                   const pthread_attr_t* attr,
+                   void* (*start_routine)(void*),
+                   void* arg) {
+  pthread_create_called++;
+  return 0;
+}
+
+int pthread_join(pthread_t thread, void** value_ptr) {
+  pthread_join_called++;
+  return 0;
+}
+
+// From cras_util
+int cras_set_rt_scheduling(int rt_lim) {
+  return 0;
+}
+
+int cras_set_thread_priority(int priority) {
+  return 0;
+}
+
+//  From librt.
+int clock_gettime(clockid_t clk_id, struct timespec* tp) {
+  *tp = clock_gettime_retspec;
+  return 0;
+}
+
 }  // extern "C"
 }  // namespace
 
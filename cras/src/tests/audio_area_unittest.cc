@@ -24,6 +24,8 @@ static uint16_t buf1[32];
 static uint16_t buf2[32];
 struct cras_audio_area* a1;
 struct cras_audio_area* a2;
+static unsigned int mix_add_scale_stride_called;
+static unsigned int mix_add_scale_stride_count;
 
 namespace {
 
@@ -306,6 +308,92 @@ TEST(AudioArea, KeyboardMicCopyFrontCenter) {
   cras_audio_area_destroy(a2);
 }
 
+TEST(AudioArea, LayoutsMatch) {
+  struct cras_audio_format fmt, swapped_fmt, mono_fmt;
+  struct cras_audio_area* a3;
+  int i;
+
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  for (i = 0; i < CRAS_CH_MAX; i++)
+    fmt.channel_layout[i] = stereo[i];
+  swapped_fmt = fmt;
+  swapped_fmt.channel_layout[0] = 1;
+  swapped_fmt.channel_layout[1] = 0;
+  mono_fmt.num_channels = 1;
+  mono_fmt.format = SND_PCM_FORMAT_S16_LE;
+  for (i = 0; i < CRAS_CH_MAX; i++)
+    mono_fmt.channel_layout[i] = mono[i];
+
+  a1 = cras_audio_area_create(2);
+  a2 = cras_audio_area_create(2);
+  a3 = cras_audio_area_create(1);
+  cras_audio_area_config_channels(a1, &fmt);
+  cras_audio_area_config_buf_pointers(a1, &fmt, (uint8_t*)buf1);
+  cras_audio_area_config_channels(a2, &fmt);
+  cras_audio_area_config_buf_pointers(a2, &fmt, (uint8_t*)buf2);
+  cras_audio_area_config_channels(a3, &mono_fmt);
+  cras_audio_area_config_buf_pointers(a3, &mono_fmt, (uint8_t*)buf2);
+
+  EXPECT_TRUE(cras_audio_area_layouts_match(a1, a2));
+  EXPECT_FALSE(cras_audio_area_layouts_match(a1, a3));
+
+  cras_audio_area_config_channels(a2, &swapped_fmt);
+  EXPECT_FALSE(cras_audio_area_layouts_match(a1, a2));
+
+  cras_audio_area_destroy(a1);
+  cras_audio_area_destroy(a2);
+  cras_audio_area_destroy(a3);
+}
+
+TEST(AudioArea, CopyMatchingLayoutsInOnePass) {
+  struct cras_audio_format fmt, swapped_fmt;
+  int i;
+
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  for (i = 0; i < CRAS_CH_MAX; i++)
+    fmt.channel_layout[i] = stereo[i];
+  swapped_fmt = fmt;
+  swapped_fmt.channel_layout[0] = 1;
+  swapped_fmt.channel_layout[1] = 0;
+
+  a1 = cras_audio_area_create(2);
+  a2 = cras_audio_area_create(2);
+  cras_audio_area_config_channels(a1, &fmt);
+  cras_audio_area_config_channels(a2, &fmt);
+  cras_audio_area_config_buf_pointers(a1, &fmt, (uint8_t*)buf1);
+  cras_audio_area_config_buf_pointers(a2, &fmt, (uint8_t*)buf2);
+  a1->frames = 16;
+  a2->frames = 16;
+
+  memset(buf1, 0, 32 * 2);
+  for (i = 0; i < 32; i++)
+    buf2[i] = rand() % 3000;
+  mix_add_scale_stride_called = 0;
+  EXPECT_EQ(14, cras_audio_area_copy(a1, 2, &fmt, a2, 0, 2.0f));
+  EXPECT_EQ(1, mix_add_scale_stride_called);
+  EXPECT_EQ(28, mix_add_scale_stride_count);
+  for (i = 0; i < 4; i++)
+    EXPECT_EQ(0, buf1[i]);
+  for (i = 4; i < 32; i++)
+    EXPECT_EQ(buf2[i - 4] * 2, buf1[i]);
+
+  // Swapped channels are still copied one channel at a time.
+  memset(buf1, 0, 32 * 2);
+  cras_audio_area_config_channels(a2, &swapped_fmt);
+  mix_add_scale_stride_called = 0;
+  EXPECT_EQ(16, cras_audio_area_copy(a1, 0, &fmt, a2, 0, 1.0f));
+  EXPECT_EQ(2, mix_add_scale_stride_called);
+  for (i = 0; i < 16; i++) {
+    EXPECT_EQ(buf2[i * 2 + 1], buf1[i * 2]);
+    EXPECT_EQ(buf2[i * 2], buf1[i * 2 + 1]);
+  }
+
+  cras_audio_area_destroy(a1);
+  cras_audio_area_destroy(a2);
+}
+
 }  //  namespace
 
 extern "C" {
@@ -319,6 +407,8 @@ void cras_mix_add_scale_stride(snd_pcm_format_t fmt,
                                float scaler) {
   unsigned int i;
 
+  mix_add_scale_stride_called++;
+  mix_add_scale_stride_count = count;
   for (i = 0; i < count; i++) {
     int32_t sum;
     sum = *(int16_t*)dst + *(int16_t*)src * scaler;
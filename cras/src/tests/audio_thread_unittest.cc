@@ -37,6 +37,18 @@ static unsigned int cras_iodev_put_output_buffer_nframes;
 static unsigned int cras_iodev_fill_odev_zeros_frames;
 static int dev_stream_playback_frames_ret;
 static int dev_stream_mix_called;
+static int dev_stream_render_called;
+static int dev_stream_can_group_ret;
+static int dev_stream_group_create_called;
+static int dev_stream_group_destroy_called;
+static int dev_stream_group_mix_called;
+static unsigned int dev_stream_group_mix_num_members;
+static int cras_main_message_send_called;
+static struct audio_thread_async_reply_msg cras_main_message_send_msg;
+static int cras_mix_pool_run_called;
+static int cras_mix_add_called;
+static int cras_mix_add_multi_called;
+static unsigned int cras_mix_add_multi_num_srcs;
 static unsigned int dev_stream_update_next_wake_time_called;
 static unsigned int dev_stream_request_playback_samples_called;
 static unsigned int cras_iodev_prepare_output_before_write_samples_called;
@@ -47,6 +59,8 @@ static unsigned int cras_iodev_frames_to_play_in_sleep_called;
 static int cras_iodev_prepare_output_before_write_samples_ret;
 static int cras_iodev_reset_request_called;
 static struct cras_iodev* cras_iodev_reset_request_iodev;
+static int cras_iodev_resume_called;
+static int cras_iodev_resume_ret;
 static int cras_iodev_get_valid_frames_ret;
 static int cras_iodev_output_underrun_called;
 static int cras_iodev_start_stream_called;
@@ -60,6 +74,13 @@ static std::map<const struct dev_stream*, struct timespec>
     dev_stream_wake_time_val;
 static int cras_device_monitor_set_device_mute_state_called;
 static int cras_iodev_is_zero_volume_ret;
+static int cras_set_thread_priority_called;
+static int cras_set_deadline_scheduling_called;
+static int cras_set_deadline_scheduling_ret;
+static uint64_t cras_set_deadline_scheduling_runtime;
+static uint64_t cras_set_deadline_scheduling_deadline;
+static uint64_t cras_set_deadline_scheduling_period;
+static bool cras_system_get_sched_deadline_ret;
 
 void ResetGlobalStubData() {
   cras_rstream_dev_offset_called = 0;
@@ -85,6 +106,16 @@ void ResetGlobalStubData() {
   cras_iodev_frames_to_play_in_sleep_called = 0;
   dev_stream_playback_frames_ret = 0;
   dev_stream_mix_called = 0;
+  dev_stream_render_called = 0;
+  dev_stream_can_group_ret = 0;
+  dev_stream_group_create_called = 0;
+  dev_stream_group_destroy_called = 0;
+  dev_stream_group_mix_called = 0;
+  dev_stream_group_mix_num_members = 0;
+  cras_mix_pool_run_called = 0;
+  cras_mix_add_called = 0;
+  cras_mix_add_multi_called = 0;
+  cras_mix_add_multi_num_srcs = 0;
   dev_stream_request_playback_samples_called = 0;
   dev_stream_update_next_wake_time_called = 0;
   cras_iodev_prepare_output_before_write_samples_called = 0;
@@ -93,6 +124,8 @@ void ResetGlobalStubData() {
   cras_iodev_prepare_output_before_write_samples_ret = 0;
   cras_iodev_reset_request_called = 0;
   cras_iodev_reset_request_iodev = NULL;
+  cras_iodev_resume_called = 0;
+  cras_iodev_resume_ret = -ENOTSUP;
   cras_iodev_get_valid_frames_ret = 0;
   cras_iodev_output_underrun_called = 0;
   cras_iodev_start_stream_called = 0;
@@ -105,6 +138,13 @@ void ResetGlobalStubData() {
   clock_gettime_retspec.tv_sec = 0;
   clock_gettime_retspec.tv_nsec = 0;
   dev_stream_wake_time_val.clear();
+  cras_set_thread_priority_called = 0;
+  cras_set_deadline_scheduling_called = 0;
+  cras_set_deadline_scheduling_ret = 0;
+  cras_set_deadline_scheduling_runtime = 0;
+  cras_set_deadline_scheduling_deadline = 0;
+  cras_set_deadline_scheduling_period = 0;
+  cras_system_get_sched_deadline_ret = false;
 }
 
 void SetupRstream(struct cras_rstream* rstream,
@@ -122,7 +162,7 @@ void SetupRstream(struct cras_rstream* rstream,
       calloc(1, sizeof(*rstream->shm->header)));
 
   rstream->shm->samples = static_cast<uint8_t*>(
-      calloc(1, cras_shm_calculate_samples_size(used_size)));
+      calloc(1, cras_shm_calculate_samples_size(used_size, 0)));
 
   cras_shm_set_frame_bytes(rstream->shm, frame_bytes);
   cras_shm_set_used_size(rstream->shm, used_size);
@@ -484,6 +524,78 @@ TEST_F(StreamDeviceSuite, InputStreamsSetInputDeviceWakeTime) {
   TearDownRstream(&rstream2);
 }
 
+TEST_F(StreamDeviceSuite, InputDeviceWakesCoalesceWithinSlack) {
+  struct cras_iodev iodev1, iodev2;
+  struct cras_iodev* iodevs1[] = {&iodev1};
+  struct cras_iodev* iodevs2[] = {&iodev2};
+  struct cras_ionode node;
+  struct cras_rstream rstream1, rstream2;
+  struct timespec ts_wake_1 = {.tv_sec = 1, .tv_nsec = 0};
+  struct timespec ts_wake_2 = {.tv_sec = 1, .tv_nsec = 600000};
+  struct timespec ts_output = {.tv_sec = 1, .tv_nsec = 800000};
+  struct timespec min_ts;
+
+  memset(&node, 0, sizeof(node));
+  node.type = CRAS_NODE_TYPE_MIC;
+  SetupDevice(&iodev1, CRAS_STREAM_INPUT);
+  SetupDevice(&iodev2, CRAS_STREAM_INPUT);
+  iodev1.active_node = &node;
+  iodev2.active_node = &node;
+  SetupRstream(&rstream1, CRAS_STREAM_INPUT);
+  SetupRstream(&rstream2, CRAS_STREAM_INPUT);
+
+  thread_add_open_dev(thread_, &iodev1);
+  thread_add_open_dev(thread_, &iodev2);
+  thread_add_stream(thread_, &rstream1, iodevs1, 1);
+  thread_add_stream(thread_, &rstream2, iodevs2, 1);
+
+  // 1ms slack, less than a quarter of the 10ms callbacks.
+  dev_io_set_input_wake_slack(1000);
+  dev_stream_wake_time_val[iodev1.streams] = ts_wake_1;
+  dev_stream_wake_time_val[iodev2.streams] = ts_wake_2;
+  dev_io_send_captured_samples(thread_->open_devs[CRAS_STREAM_INPUT]);
+
+  // Both devices are serviced when the second one is due.
+  min_ts.tv_sec = 20;
+  min_ts.tv_nsec = 0;
+  EXPECT_EQ(2, dev_io_next_input_wake(&thread_->open_devs[CRAS_STREAM_INPUT],
+                                      &min_ts));
+  EXPECT_EQ(ts_wake_2.tv_sec, min_ts.tv_sec);
+  EXPECT_EQ(ts_wake_2.tv_nsec, min_ts.tv_nsec);
+
+  // An output wake within the slack takes both devices along.
+  min_ts = ts_output;
+  dev_io_next_input_wake(&thread_->open_devs[CRAS_STREAM_INPUT], &min_ts);
+  EXPECT_EQ(ts_output.tv_sec, min_ts.tv_sec);
+  EXPECT_EQ(ts_output.tv_nsec, min_ts.tv_nsec);
+
+  // Too far apart to share a wake, the first device is not put off.
+  ts_wake_2.tv_nsec = 2000000;
+  dev_stream_wake_time_val[iodev2.streams] = ts_wake_2;
+  dev_io_send_captured_samples(thread_->open_devs[CRAS_STREAM_INPUT]);
+  min_ts.tv_sec = 20;
+  min_ts.tv_nsec = 0;
+  dev_io_next_input_wake(&thread_->open_devs[CRAS_STREAM_INPUT], &min_ts);
+  EXPECT_EQ(ts_wake_1.tv_sec, min_ts.tv_sec);
+  EXPECT_EQ(ts_wake_1.tv_nsec, min_ts.tv_nsec);
+
+  // Without slack every wake is as early as possible.
+  dev_io_set_input_wake_slack(0);
+  ts_wake_2.tv_nsec = 600000;
+  dev_stream_wake_time_val[iodev2.streams] = ts_wake_2;
+  dev_io_send_captured_samples(thread_->open_devs[CRAS_STREAM_INPUT]);
+  min_ts.tv_sec = 20;
+  min_ts.tv_nsec = 0;
+  dev_io_next_input_wake(&thread_->open_devs[CRAS_STREAM_INPUT], &min_ts);
+  EXPECT_EQ(ts_wake_1.tv_sec, min_ts.tv_sec);
+  EXPECT_EQ(ts_wake_1.tv_nsec, min_ts.tv_nsec);
+
+  thread_rm_open_dev(thread_, CRAS_STREAM_INPUT, iodev1.info.idx);
+  thread_rm_open_dev(thread_, CRAS_STREAM_INPUT, iodev2.info.idx);
+  TearDownRstream(&rstream1);
+  TearDownRstream(&rstream2);
+}
+
 TEST_F(StreamDeviceSuite, AddOutputStream) {
   struct cras_iodev iodev, *piodev = &iodev;
   struct cras_rstream rstream;
@@ -524,6 +636,94 @@ TEST_F(StreamDeviceSuite, AddOutputStream) {
   TearDownRstream(&rstream);
 }
 
+TEST_F(StreamDeviceSuite, DumpReadsPublishedSnapshot) {
+  struct cras_iodev iodev, *piodev = &iodev;
+  struct cras_rstream rstream;
+  struct audio_debug_info* info;
+
+  ResetGlobalStubData();
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream, CRAS_STREAM_OUTPUT);
+  info = (struct audio_debug_info*)calloc(1, sizeof(*info));
+
+  thread_add_open_dev(thread_, &iodev);
+  thread_add_stream(thread_, &rstream, &piodev, 1);
+
+  // Nothing is published until the audio thread takes a snapshot.
+  EXPECT_EQ(0, audio_thread_dump_thread_info(thread_, info));
+  EXPECT_EQ(0, info->num_devs);
+  EXPECT_EQ(0, info->num_streams);
+
+  publish_snapshot(thread_);
+  EXPECT_EQ(0, audio_thread_dump_thread_info(thread_, info));
+  EXPECT_EQ(1, info->num_devs);
+  EXPECT_EQ(CRAS_STREAM_OUTPUT, info->devs[0].direction);
+  ASSERT_EQ(1, info->num_streams);
+  EXPECT_EQ(rstream.stream_id, info->streams[0].stream_id);
+
+  // Another thread's snapshot goes after the devices already dumped.
+  EXPECT_EQ(0, audio_thread_append_thread_info(thread_, info));
+  EXPECT_EQ(2, info->num_devs);
+  EXPECT_EQ(2, info->num_streams);
+
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev.info.idx);
+  publish_snapshot(thread_);
+  EXPECT_EQ(0, audio_thread_dump_thread_info(thread_, info));
+  EXPECT_EQ(0, info->num_devs);
+  EXPECT_EQ(0, info->num_streams);
+
+  free(info);
+  TearDownRstream(&rstream);
+}
+
+TEST_F(StreamDeviceSuite, PublishPerfStats) {
+  struct cras_iodev iodev, *piodev = &iodev;
+  struct cras_rstream rstream;
+  struct cras_perf_stats stats;
+  struct open_dev* adev;
+
+  ResetGlobalStubData();
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream, CRAS_STREAM_OUTPUT);
+  memset(&stats, 0, sizeof(stats));
+
+  // Nothing is written until the thread is given its entry.
+  update_perf_stats(thread_);
+  audio_thread_set_perf_stats(thread_, &stats);
+
+  thread_add_open_dev(thread_, &iodev);
+  thread_add_stream(thread_, &rstream, &piodev, 1);
+  adev = thread_->open_devs[CRAS_STREAM_OUTPUT];
+  adev->max_late_us = 1500;
+  adev->stages[CRAS_DEV_IO_STAGE_MIX].count = 3;
+  adev->stages[CRAS_DEV_IO_STAGE_MIX].total_usec = 90;
+  rstream.num_missed_cb = 2;
+
+  update_perf_stats(thread_);
+  EXPECT_EQ(2, stats.seq);
+  ASSERT_EQ(1, stats.num_devs);
+  EXPECT_EQ(iodev.info.idx, stats.devs[0].dev_idx);
+  EXPECT_EQ(1500, stats.devs[0].max_late_us);
+  EXPECT_EQ(3, stats.devs[0].stage_count[CRAS_DEV_IO_STAGE_MIX]);
+  EXPECT_EQ(90, stats.devs[0].stage_total_usec[CRAS_DEV_IO_STAGE_MIX]);
+  ASSERT_EQ(1, stats.num_streams);
+  EXPECT_EQ(rstream.stream_id, stats.streams[0].stream_id);
+  EXPECT_EQ(2, stats.streams[0].num_missed_cb);
+
+  // Not due again until the period has passed.
+  update_perf_stats(thread_);
+  EXPECT_EQ(2, stats.seq);
+
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev.info.idx);
+  publish_perf_stats(thread_);
+  EXPECT_EQ(4, stats.seq);
+  EXPECT_EQ(0, stats.num_devs);
+  EXPECT_EQ(0, stats.num_streams);
+
+  audio_thread_set_perf_stats(thread_, NULL);
+  TearDownRstream(&rstream);
+}
+
 TEST_F(StreamDeviceSuite, OutputStreamFetchTime) {
   struct cras_iodev iodev, *piodev = &iodev;
   struct cras_rstream rstream1, rstream2;
@@ -655,6 +855,71 @@ TEST_F(StreamDeviceSuite, AddRemoveMultipleStreamsOnMultipleDevices) {
   TearDownRstream(&rstream3);
 }
 
+TEST_F(StreamDeviceSuite, AddStreamsMessage) {
+  struct cras_iodev iodev, *piodev = &iodev;
+  struct cras_rstream rstream, rstream2;
+  struct audio_thread_stream_attach attaches[2];
+  struct audio_thread_add_streams_msg msg;
+  struct dev_stream* dev_stream;
+
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream2, CRAS_STREAM_OUTPUT);
+  thread_add_open_dev(thread_, &iodev);
+
+  attaches[0] = {&rstream, &piodev, 1, -1};
+  attaches[1] = {&rstream2, &piodev, 1, -1};
+  memset(&msg, 0, sizeof(msg));
+  msg.header.id = AUDIO_THREAD_ADD_STREAMS;
+  msg.header.length = sizeof(msg);
+  msg.attaches = attaches;
+  msg.num = 2;
+  EXPECT_EQ(0, handle_audio_thread_message(thread_, &msg.header));
+  EXPECT_EQ(0, attaches[0].rc);
+  EXPECT_EQ(0, attaches[1].rc);
+
+  dev_stream = iodev.streams;
+  ASSERT_NE((void*)NULL, dev_stream);
+  EXPECT_EQ(&rstream, dev_stream->stream);
+  ASSERT_NE((void*)NULL, dev_stream->next);
+  EXPECT_EQ(&rstream2, dev_stream->next->stream);
+
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev.info.idx);
+  TearDownRstream(&rstream);
+  TearDownRstream(&rstream2);
+}
+
+TEST_F(StreamDeviceSuite, StreamFdInWakeSet) {
+  struct cras_iodev iodev, *piodev = &iodev;
+  struct cras_rstream rstream;
+  struct epoll_event ev;
+  int fds[2];
+
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream, CRAS_STREAM_OUTPUT);
+  ASSERT_EQ(0, pipe(fds));
+  rstream.fd = fds[0];
+
+  thread_add_open_dev(thread_, &iodev);
+  thread_add_stream(thread_, &rstream, &piodev, 1);
+
+  // A reply from the client wakes the thread once.
+  ASSERT_EQ(1, write(fds[1], "r", 1));
+  EXPECT_EQ(1, epoll_wait(thread_->wake_epoll_fd, &ev, 1, 0));
+  EXPECT_EQ(fds[0], ev.data.fd);
+  EXPECT_EQ(0, epoll_wait(thread_->wake_epoll_fd, &ev, 1, 0));
+
+  // Removed streams no longer wake the thread.
+  thread_disconnect_stream(thread_, &rstream, NULL);
+  ASSERT_EQ(1, write(fds[1], "r", 1));
+  EXPECT_EQ(0, epoll_wait(thread_->wake_epoll_fd, &ev, 1, 0));
+
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev.info.idx);
+  close(fds[0]);
+  close(fds[1]);
+  TearDownRstream(&rstream);
+}
+
 TEST_F(StreamDeviceSuite, FetchStreams) {
   struct cras_iodev iodev, *piodev = &iodev;
   struct open_dev* adev;
@@ -811,6 +1076,115 @@ TEST_F(StreamDeviceSuite, WriteOutputSamplesLeaveNoStream) {
   thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev.info.idx);
 }
 
+TEST_F(StreamDeviceSuite, MixOutputSamplesOnMixPool) {
+  struct cras_iodev iodev, *piodev = &iodev;
+  struct cras_rstream rstream1;
+  struct cras_rstream rstream2;
+  struct open_dev* adev;
+
+  ResetGlobalStubData();
+
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream1, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream2, CRAS_STREAM_OUTPUT);
+  cras_iodev_get_output_buffer_area = cras_audio_area_create(2);
+
+  // Streams added while the pool is set get room to render on it.
+  dev_io_set_mix_pool(reinterpret_cast<struct cras_mix_pool*>(0x55), 3);
+  thread_add_open_dev(thread_, &iodev);
+  thread_add_stream(thread_, &rstream1, &piodev, 1);
+  thread_add_stream(thread_, &rstream2, &piodev, 1);
+  adev = thread_->open_devs[CRAS_STREAM_OUTPUT];
+  dev_stream_set_running(iodev.streams);
+  dev_stream_set_running(iodev.streams->next);
+  EXPECT_EQ(BUFFER_SIZE, iodev.streams->mix_buffer_size_frames);
+
+  iodev.state = CRAS_IODEV_STATE_NORMAL_RUN;
+  cras_iodev_prepare_output_before_write_samples_state =
+      CRAS_IODEV_STATE_NORMAL_RUN;
+  frames_queued_ = 0;
+  dev_stream_playback_frames_ret = 100;
+
+  // Two running streams is below the threshold, mix on the audio thread.
+  write_output_samples(&thread_->open_devs[CRAS_STREAM_OUTPUT], adev, nullptr);
+  EXPECT_EQ(2, dev_stream_mix_called);
+  EXPECT_EQ(0, cras_mix_pool_run_called);
+
+  // Render each stream on the pool and sum the results.
+  dev_io_set_mix_pool(reinterpret_cast<struct cras_mix_pool*>(0x55), 2);
+  write_output_samples(&thread_->open_devs[CRAS_STREAM_OUTPUT], adev, nullptr);
+  EXPECT_EQ(2, dev_stream_mix_called);
+  EXPECT_EQ(1, cras_mix_pool_run_called);
+  EXPECT_EQ(2, dev_stream_render_called);
+  EXPECT_EQ(0, cras_mix_add_called);
+  EXPECT_EQ(1, cras_mix_add_multi_called);
+  EXPECT_EQ(2, cras_mix_add_multi_num_srcs);
+
+  // A stream without room to render mixes serially, nothing is allocated.
+  iodev.streams->mix_buffer_size_frames = 0;
+  write_output_samples(&thread_->open_devs[CRAS_STREAM_OUTPUT], adev, nullptr);
+  EXPECT_EQ(4, dev_stream_mix_called);
+  EXPECT_EQ(1, cras_mix_pool_run_called);
+
+  dev_io_set_mix_pool(NULL, 0);
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev.info.idx);
+  TearDownRstream(&rstream1);
+  TearDownRstream(&rstream2);
+}
+
+TEST_F(StreamDeviceSuite, MixOutputSamplesGrouped) {
+  struct cras_iodev iodev, *piodev = &iodev;
+  struct cras_rstream rstream1;
+  struct cras_rstream rstream2;
+  struct open_dev* adev;
+
+  ResetGlobalStubData();
+
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream1, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream2, CRAS_STREAM_OUTPUT);
+  cras_iodev_get_output_buffer_area = cras_audio_area_create(2);
+
+  thread_add_open_dev(thread_, &iodev);
+  thread_add_stream(thread_, &rstream1, &piodev, 1);
+  thread_add_stream(thread_, &rstream2, &piodev, 1);
+  adev = thread_->open_devs[CRAS_STREAM_OUTPUT];
+  dev_stream_set_running(iodev.streams);
+  dev_stream_set_running(iodev.streams->next);
+
+  iodev.state = CRAS_IODEV_STATE_NORMAL_RUN;
+  cras_iodev_prepare_output_before_write_samples_state =
+      CRAS_IODEV_STATE_NORMAL_RUN;
+  frames_queued_ = 0;
+  dev_stream_playback_frames_ret = 100;
+
+  // Streams that convert alike share one conversion.
+  dev_stream_can_group_ret = 1;
+  write_output_samples(&thread_->open_devs[CRAS_STREAM_OUTPUT], adev, nullptr);
+  EXPECT_EQ(1, dev_stream_group_create_called);
+  EXPECT_EQ(1, dev_stream_group_mix_called);
+  EXPECT_EQ(2, dev_stream_group_mix_num_members);
+  EXPECT_EQ(0, dev_stream_mix_called);
+
+  // The group is kept for the next write.
+  write_output_samples(&thread_->open_devs[CRAS_STREAM_OUTPUT], adev, nullptr);
+  EXPECT_EQ(1, dev_stream_group_create_called);
+  EXPECT_EQ(2, dev_stream_group_mix_called);
+
+  // Streams that can't be grouped any more are mixed on their own.
+  dev_stream_can_group_ret = 0;
+  write_output_samples(&thread_->open_devs[CRAS_STREAM_OUTPUT], adev, nullptr);
+  EXPECT_EQ(2, dev_stream_group_mix_called);
+  EXPECT_EQ(2, dev_stream_mix_called);
+  EXPECT_EQ(0, dev_stream_group_destroy_called);
+
+  // Freed with the device.
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev.info.idx);
+  EXPECT_EQ(1, dev_stream_group_destroy_called);
+  TearDownRstream(&rstream1);
+  TearDownRstream(&rstream2);
+}
+
 TEST_F(StreamDeviceSuite, MixOutputSamples) {
   struct cras_iodev iodev, *piodev = &iodev;
   struct cras_rstream rstream1;
@@ -983,6 +1357,119 @@ TEST_F(StreamDeviceSuite, DoPlaybackSevereUnderrun) {
   TearDownRstream(&rstream);
 }
 
+TEST_F(StreamDeviceSuite, DoPlaybackSevereUnderrunRecoversInPlace) {
+  struct cras_iodev iodev, *piodev = &iodev;
+  struct cras_rstream rstream;
+
+  ResetGlobalStubData();
+
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream, CRAS_STREAM_OUTPUT);
+  cras_iodev_get_output_buffer_area = cras_audio_area_create(2);
+
+  thread_add_open_dev(thread_, &iodev);
+  thread_add_stream(thread_, &rstream, &piodev, 1);
+
+  cras_audio_thread_event_severe_underrun_called = 0;
+  clock_gettime_retspec.tv_sec = 10;
+  iodev.state = CRAS_IODEV_STATE_NORMAL_RUN;
+  frames_queued_ = -EPIPE;
+  cras_iodev_prepare_output_before_write_samples_state =
+      CRAS_IODEV_STATE_NORMAL_RUN;
+  cras_iodev_resume_ret = 0;
+
+  // The device recovers in place and stays open with its stream.
+  dev_io_playback_write(&thread_->open_devs[CRAS_STREAM_OUTPUT], nullptr);
+  EXPECT_EQ(1, cras_iodev_resume_called);
+  EXPECT_EQ(0, cras_iodev_reset_request_called);
+  EXPECT_EQ(1, cras_audio_thread_event_severe_underrun_called);
+  ASSERT_NE((void*)NULL, thread_->open_devs[CRAS_STREAM_OUTPUT]);
+  EXPECT_EQ(&iodev, thread_->open_devs[CRAS_STREAM_OUTPUT]->dev);
+
+  // Another underrun right after needs a reset by the main thread.
+  dev_io_playback_write(&thread_->open_devs[CRAS_STREAM_OUTPUT], nullptr);
+  EXPECT_EQ(1, cras_iodev_resume_called);
+  EXPECT_EQ(1, cras_iodev_reset_request_called);
+  EXPECT_EQ((void*)NULL, thread_->open_devs[CRAS_STREAM_OUTPUT]);
+
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev.info.idx);
+  TearDownRstream(&rstream);
+}
+
+TEST_F(StreamDeviceSuite, SchedDeadlineFollowsOpenDevices) {
+  struct cras_iodev odev, idev;
+
+  audio_thread_destroy(thread_);
+  cras_system_get_sched_deadline_ret = true;
+  thread_ = audio_thread_create();
+  SetupDevice(&odev, CRAS_STREAM_OUTPUT);
+  SetupDevice(&idev, CRAS_STREAM_INPUT);
+  idev.min_cb_level = FIRST_CB_LEVEL / 2;
+
+  // 480 frames at 48kHz, with the minimum runtime.
+  thread_add_open_dev(thread_, &odev);
+  EXPECT_EQ(1, cras_set_deadline_scheduling_called);
+  EXPECT_EQ(10000000, cras_set_deadline_scheduling_period);
+  EXPECT_EQ(10000000, cras_set_deadline_scheduling_deadline);
+  EXPECT_EQ(500000, cras_set_deadline_scheduling_runtime);
+
+  // The shortest period of the open devices wins.
+  thread_add_open_dev(thread_, &idev);
+  EXPECT_EQ(2, cras_set_deadline_scheduling_called);
+  EXPECT_EQ(5000000, cras_set_deadline_scheduling_period);
+
+  // Wakes taking longer grow the runtime, up to half the period.
+  update_wake_cpu_peak(thread_, 1000000);
+  EXPECT_EQ(3, cras_set_deadline_scheduling_called);
+  EXPECT_EQ(2000000, cras_set_deadline_scheduling_runtime);
+  update_wake_cpu_peak(thread_, 900000);
+  EXPECT_EQ(3, cras_set_deadline_scheduling_called);
+  update_wake_cpu_peak(thread_, 4000000);
+  EXPECT_EQ(4, cras_set_deadline_scheduling_called);
+  EXPECT_EQ(2500000, cras_set_deadline_scheduling_runtime);
+
+  thread_rm_open_dev(thread_, CRAS_STREAM_INPUT, idev.info.idx);
+  EXPECT_EQ(5, cras_set_deadline_scheduling_called);
+  EXPECT_EQ(10000000, cras_set_deadline_scheduling_period);
+
+  // Back to the RT priority with nothing open.
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, odev.info.idx);
+  EXPECT_EQ(5, cras_set_deadline_scheduling_called);
+  EXPECT_EQ(1, cras_set_thread_priority_called);
+  EXPECT_EQ(0, thread_->deadline_period_ns);
+}
+
+TEST_F(StreamDeviceSuite, SchedDeadlineRefusedFallsBackToPriority) {
+  struct cras_iodev odev, idev;
+
+  audio_thread_destroy(thread_);
+  cras_system_get_sched_deadline_ret = true;
+  cras_set_deadline_scheduling_ret = -EPERM;
+  thread_ = audio_thread_create();
+  SetupDevice(&odev, CRAS_STREAM_OUTPUT);
+  SetupDevice(&idev, CRAS_STREAM_INPUT);
+
+  thread_add_open_dev(thread_, &odev);
+  EXPECT_EQ(1, cras_set_deadline_scheduling_called);
+  EXPECT_EQ(1, cras_set_thread_priority_called);
+
+  // Not tried again.
+  thread_add_open_dev(thread_, &idev);
+  EXPECT_EQ(1, cras_set_deadline_scheduling_called);
+
+  thread_rm_open_dev(thread_, CRAS_STREAM_INPUT, idev.info.idx);
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, odev.info.idx);
+}
+
+TEST_F(StreamDeviceSuite, SchedDeadlineDisabled) {
+  struct cras_iodev odev;
+
+  SetupDevice(&odev, CRAS_STREAM_OUTPUT);
+  thread_add_open_dev(thread_, &odev);
+  EXPECT_EQ(0, cras_set_deadline_scheduling_called);
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, odev.info.idx);
+}
+
 TEST(AudioThreadStreams, DrainStream) {
   struct cras_rstream rstream;
   struct cras_audio_shm_header* shm_header;
@@ -1006,6 +1493,29 @@ TEST(AudioThreadStreams, DrainStream) {
   TearDownRstream(&rstream);
 }
 
+TEST(AudioThreadMessages, AsyncFailureSentToMain) {
+  struct audio_thread* thread;
+  struct cras_iodev iodev;
+
+  memset(&iodev, 0, sizeof(iodev));
+  cras_main_message_send_called = 0;
+  thread = audio_thread_create();
+  ASSERT_EQ(0, audio_thread_start(thread));
+
+  // Ramping a device that isn't open fails in the audio thread only.
+  EXPECT_EQ(0, audio_thread_dev_start_ramp(thread, 123,
+                                           CRAS_IODEV_RAMP_REQUEST_DOWN_MUTE));
+  // Messages are handled in order, so the failure is reported by now.
+  EXPECT_EQ(0, audio_thread_is_dev_open(thread, &iodev));
+  EXPECT_EQ(1, cras_main_message_send_called);
+  EXPECT_EQ(CRAS_MAIN_AUDIO_THREAD_REPLY,
+            cras_main_message_send_msg.header.type);
+  EXPECT_EQ(AUDIO_THREAD_DEV_START_RAMP, cras_main_message_send_msg.id);
+  EXPECT_EQ(-EINVAL, cras_main_message_send_msg.rc);
+
+  audio_thread_destroy(thread);
+}
+
 TEST(BusyloopDetectSuite, CheckerTest) {
   continuous_zero_sleep_count = 0;
   cras_audio_thread_event_busyloop_called = 0;
@@ -1031,8 +1541,20 @@ TEST(BusyloopDetectSuite, CheckerTest) {
 
 extern "C" {
 
+void cras_iodev_update_stream_refs(struct cras_iodev* iodev) {
+  struct dev_stream* stream;
+
+  iodev->stream_refs.count = 0;
+  DL_FOREACH (iodev->streams, stream) {
+    struct cras_iodev_stream_ref ref = {stream, stream->stream,
+                                        stream->stream->shm};
+    ARRAY_APPEND(&iodev->stream_refs, ref);
+  }
+}
+
 int cras_iodev_add_stream(struct cras_iodev* iodev, struct dev_stream* stream) {
   DL_APPEND(iodev->streams, stream);
+  cras_iodev_update_stream_refs(iodev);
   return 0;
 }
 
@@ -1042,6 +1564,15 @@ void cras_iodev_start_stream(struct cras_iodev* iodev,
   cras_iodev_start_stream_called++;
 }
 
+void cras_iodev_stop_stream(struct cras_iodev* iodev,
+                            struct dev_stream* stream) {
+  dev_stream_clear_running(stream);
+}
+
+int cras_iodev_rewind_output(struct cras_iodev* odev, unsigned int frames) {
+  return 0;
+}
+
 unsigned int cras_iodev_all_streams_written(struct cras_iodev* iodev) {
   return cras_iodev_all_streams_written_ret;
 }
@@ -1078,6 +1609,7 @@ struct dev_stream* cras_iodev_rm_stream(struct cras_iodev* iodev,
   DL_FOREACH (iodev->streams, out) {
     if (out->stream == stream) {
       DL_DELETE(iodev->streams, out);
+      cras_iodev_update_stream_refs(iodev);
       return out;
     }
   }
@@ -1142,8 +1674,29 @@ int cras_iodev_get_dsp_delay(const struct cras_iodev* iodev) {
   return 0;
 }
 
+size_t cras_iodev_get_mem_bytes(const struct cras_iodev* iodev) {
+  return 0;
+}
+
 void cras_fmt_conv_destroy(struct cras_fmt_conv** conv) {}
 
+size_t cras_fmt_conv_get_scratch_bytes() {
+  return 0;
+}
+
+size_t cras_fmt_conv_get_scratch_needed() {
+  return 0;
+}
+
+int cras_fmt_conv_reserve_scratch() {
+  return 0;
+}
+
+int cras_fmt_conv_set_channel_matrix(struct cras_fmt_conv* conv,
+                                     const struct cras_channel_matrix* list) {
+  return 0;
+}
+
 struct cras_fmt_conv* cras_channel_remix_conv_create(unsigned int num_channels,
                                                      const float* coefficient) {
   return NULL;
@@ -1185,6 +1738,10 @@ unsigned int cras_rstream_dev_offset(const struct cras_rstream* rstream,
 void cras_rstream_record_fetch_interval(struct cras_rstream* rstream,
                                         const struct timespec* now) {}
 
+unsigned int cras_rstream_get_effects(const struct cras_rstream* stream) {
+  return 0;
+}
+
 int cras_rstream_is_pending_reply(const struct cras_rstream* stream) {
   return cras_rstream_is_pending_reply_ret;
 }
@@ -1198,6 +1755,21 @@ int cras_set_rt_scheduling(int rt_lim) {
 }
 
 int cras_set_thread_priority(int priority) {
+  cras_set_thread_priority_called++;
+  return 0;
+}
+
+int cras_set_deadline_scheduling(uint64_t runtime_ns,
+                                 uint64_t deadline_ns,
+                                 uint64_t period_ns) {
+  cras_set_deadline_scheduling_called++;
+  cras_set_deadline_scheduling_runtime = runtime_ns;
+  cras_set_deadline_scheduling_deadline = deadline_ns;
+  cras_set_deadline_scheduling_period = period_ns;
+  return cras_set_deadline_scheduling_ret;
+}
+
+int cras_lock_rt_memory() {
   return 0;
 }
 
@@ -1210,6 +1782,23 @@ unsigned int dev_stream_capture(struct dev_stream* dev_stream,
   return 0;
 }
 
+unsigned int dev_stream_capture_converted(struct dev_stream* dev_stream,
+                                          const struct cras_audio_area* area,
+                                          unsigned int area_offset,
+                                          float software_gain_scaler) {
+  return 0;
+}
+
+int dev_stream_can_capture_planar(const struct dev_stream* dev_stream,
+                                  float software_gain_scaler) {
+  return 0;
+}
+
+unsigned int dev_stream_capture_planar(struct dev_stream* dev_stream,
+                                       const struct cras_audio_area* area) {
+  return 0;
+}
+
 unsigned int dev_stream_capture_avail(const struct dev_stream* dev_stream) {
   return 0;
 }
@@ -1232,10 +1821,16 @@ struct dev_stream* dev_stream_create(struct cras_rstream* stream,
   return out;
 }
 
+void dev_stream_free_cached() {}
+
 void dev_stream_destroy(struct dev_stream* dev_stream) {
   free(dev_stream);
 }
 
+void dev_stream_set_paused(struct dev_stream* dev_stream, int paused) {
+  dev_stream->paused = paused;
+}
+
 int dev_stream_mix(struct dev_stream* dev_stream,
                    const struct cras_audio_format* fmt,
                    uint8_t* dst,
@@ -1263,13 +1858,36 @@ int dev_stream_request_playback_samples(struct dev_stream* dev_stream,
 }
 
 void dev_stream_set_delay(const struct dev_stream* dev_stream,
-                          unsigned int delay_frames) {}
+                          unsigned int delay_frames,
+                          const struct timespec* delay_tstamp) {}
+
+void dev_stream_get_cost(const struct dev_stream* dev_stream,
+                         struct cras_rstream_cost* cost) {
+  memset(cost, 0, sizeof(*cost));
+}
+
+void dev_stream_set_telemetry(const struct dev_stream* dev_stream,
+                              unsigned int dev_delay,
+                              unsigned int dsp_delay,
+                              double rate_ratio,
+                              unsigned int num_underruns,
+                              const struct ewma_power* dev_ewma) {}
 
 void dev_stream_set_dev_rate(struct dev_stream* dev_stream,
                              unsigned int dev_rate,
                              double dev_rate_ratio,
                              double master_rate_ratio,
-                             int coarse_rate_adjust) {}
+                             int coarse_rate_adjust,
+                             double catch_up) {}
+
+void dev_stream_set_ramp(struct dev_stream* dev_stream,
+                         unsigned int ramp_frames,
+                         int fade_in) {}
+
+void dev_stream_fade_in(struct dev_stream* dev_stream, unsigned int frames) {}
+
+void dev_stream_set_overload_level(struct dev_stream* dev_stream,
+                                   enum CRAS_OVERLOAD_LEVEL level) {}
 
 void dev_stream_update_frames(const struct dev_stream* dev_stream) {}
 
@@ -1355,6 +1973,18 @@ struct cras_audio_area* cras_audio_area_create(int num_channels) {
   return area;
 }
 
+void cras_audio_area_config_channels(struct cras_audio_area* area,
+                                     const struct cras_audio_format* fmt) {}
+
+void cras_audio_area_config_buf_pointers(struct cras_audio_area* area,
+                                         const struct cras_audio_format* fmt,
+                                         uint8_t* base_buffer) {}
+
+void cras_audio_area_destroy(struct cras_audio_area* area) {
+  free(area->channels[0].buf);
+  free(area);
+}
+
 enum CRAS_IODEV_STATE cras_iodev_state(const struct cras_iodev* iodev) {
   return iodev->state;
 }
@@ -1375,6 +2005,11 @@ int cras_iodev_reset_request(struct cras_iodev* iodev) {
   return 0;
 }
 
+int cras_iodev_resume(struct cras_iodev* iodev) {
+  cras_iodev_resume_called++;
+  return cras_iodev_resume_ret;
+}
+
 unsigned int cras_iodev_get_num_severe_underruns(
     const struct cras_iodev* iodev) {
   return 0;
@@ -1398,6 +2033,13 @@ int input_data_get_for_stream(struct input_data* data,
   return 0;
 }
 
+int input_data_get_planar_for_stream(struct input_data* data,
+                                     struct cras_rstream* stream,
+                                     struct buffer_share* offsets,
+                                     struct cras_audio_area** area) {
+  return 0;
+}
+
 int input_data_put_for_stream(struct input_data* data,
                               struct cras_rstream* stream,
                               struct buffer_share* offsets,
@@ -1405,6 +2047,11 @@ int input_data_put_for_stream(struct input_data* data,
   return 0;
 }
 
+void input_data_set_overload_level(struct input_data* data,
+                                   enum CRAS_OVERLOAD_LEVEL level) {}
+
+void cras_dsp_set_overloaded(int overloaded) {}
+
 int cras_device_monitor_set_device_mute_state(unsigned int dev_idx) {
   cras_device_monitor_set_device_mute_state_called++;
   return 0;
@@ -1436,6 +2083,12 @@ void cras_apm_list_set_aec_dump(struct cras_apm_list* list,
                                 int start,
                                 int fd) {}
 
+void cras_apm_list_set_overloaded(bool overloaded) {}
+
+void cras_apm_list_swap_apm(struct cras_apm_list* list, void* dev_ptr) {}
+
+void cras_apm_list_commit_effects(struct cras_apm_list* list) {}
+
 #endif
 
 int cras_audio_thread_event_busyloop() {
@@ -1452,11 +2105,155 @@ int cras_audio_thread_event_severe_underrun() {
   return 0;
 }
 
+int cras_audio_thread_event_underrun_risk() {
+  return 0;
+}
+
 float input_data_get_software_gain_scaler(struct input_data* data,
                                           float idev_sw_gain_scaler,
                                           struct cras_rstream* stream) {
   return 1.0;
 }
+
+unsigned int cras_system_get_mix_worker_threads() {
+  return 0;
+}
+
+unsigned int cras_system_get_mix_worker_min_streams() {
+  return 1;
+}
+
+bool cras_system_get_lock_rt_memory() {
+  return false;
+}
+
+bool cras_system_get_sched_deadline() {
+  return cras_system_get_sched_deadline_ret;
+}
+
+unsigned int cras_system_get_input_wake_slack_us() {
+  return 0;
+}
+
+unsigned int cras_system_get_adaptive_buffer_max_ms() {
+  return 0;
+}
+
+unsigned int cras_system_get_stream_ramp_ms() {
+  return 0;
+}
+
+bool cras_system_get_deep_buffer() {
+  return false;
+}
+
+struct cras_mix_pool* cras_mix_pool_create(unsigned int num_workers) {
+  return NULL;
+}
+
+void cras_mix_pool_destroy(struct cras_mix_pool* pool) {}
+
+void cras_dsp_pipeline_set_worker_pool(struct cras_mix_pool* pool) {}
+
+void cras_mix_pool_run(struct cras_mix_pool* pool,
+                       cras_mix_pool_job_fn fn,
+                       void* jobs,
+                       size_t job_size,
+                       unsigned int num_jobs) {
+  cras_mix_pool_run_called++;
+  for (unsigned int i = 0; i < num_jobs; i++)
+    fn((uint8_t*)jobs + i * job_size);
+}
+
+void cras_mix_pool_run_on_workers(struct cras_mix_pool* pool,
+                                  cras_mix_pool_job_fn fn,
+                                  void* arg) {}
+
+int dev_stream_reserve_mix_buffer(struct dev_stream* dev_stream,
+                                  const struct cras_audio_format* fmt,
+                                  unsigned int frames) {
+  dev_stream->mix_buffer_size_frames = frames;
+  return 0;
+}
+
+int dev_stream_render(struct dev_stream* dev_stream,
+                      const struct cras_audio_format* fmt,
+                      unsigned int num_to_write) {
+  dev_stream_render_called++;
+  return num_to_write;
+}
+
+int dev_stream_can_group(const struct dev_stream* dev_stream) {
+  return dev_stream_can_group_ret;
+}
+
+int dev_stream_convert_alike(const struct dev_stream* a,
+                             const struct dev_stream* b) {
+  return 1;
+}
+
+int dev_stream_group_matches(const struct dev_stream_group* group,
+                             const struct dev_stream* dev_stream) {
+  return 1;
+}
+
+struct dev_stream_group* dev_stream_group_create(
+    const struct dev_stream* dev_stream,
+    const struct cras_audio_format* dev_fmt,
+    unsigned int max_frames) {
+  dev_stream_group_create_called++;
+  return (struct dev_stream_group*)calloc(1, sizeof(struct dev_stream_group));
+}
+
+void dev_stream_group_destroy(struct dev_stream_group* group) {
+  dev_stream_group_destroy_called++;
+  free(group);
+}
+
+int dev_stream_group_mix(struct dev_stream_group* group,
+                         const struct cras_audio_format* fmt,
+                         uint8_t* dst,
+                         unsigned int num_to_write) {
+  dev_stream_group_mix_called++;
+  dev_stream_group_mix_num_members = group->num_members;
+  return num_to_write;
+}
+
+void cras_mix_add(snd_pcm_format_t fmt,
+                  uint8_t* dst,
+                  uint8_t* src,
+                  unsigned int count,
+                  unsigned int index,
+                  int mute,
+                  float mix_vol) {
+  cras_mix_add_called++;
+}
+
+void cras_mix_add_multi(snd_pcm_format_t fmt,
+                        uint8_t* dst,
+                        const struct cras_mix_src* srcs,
+                        unsigned int num_srcs,
+                        unsigned int count) {
+  cras_mix_add_multi_called++;
+  cras_mix_add_multi_num_srcs = num_srcs;
+}
+
+int cras_main_message_send(struct cras_main_message* msg) {
+  cras_main_message_send_called++;
+  memcpy(&cras_main_message_send_msg, msg,
+         std::min(msg->length, sizeof(cras_main_message_send_msg)));
+  return 0;
+}
+
+int cras_main_message_retry() {
+  return 0;
+}
+
+int cras_main_message_add_handler(enum CRAS_MAIN_MESSAGE_TYPE type,
+                                  cras_message_callback callback,
+                                  void* callback_data) {
+  return 0;
+}
 }  // extern "C"
 
 int main(int argc, char** argv) {
@@ -698,6 +698,15 @@ struct cras_timer* cras_tm_create_timer(struct cras_tm* tm,
   return cras_tm_create_timer_ret;
 }
 
+struct cras_timer* cras_tm_create_timer_slack(struct cras_tm* tm,
+                                              unsigned int ms,
+                                              unsigned int slack_ms,
+                                              void (*cb)(struct cras_timer* t,
+                                                         void* data),
+                                              void* cb_data) {
+  return cras_tm_create_timer(tm, ms, cb, cb_data);
+}
+
 void cras_tm_cancel_timer(struct cras_tm* tm, struct cras_timer* t) {
   cras_tm_cancel_timer_called++;
   cras_tm_cancel_timer_arg = t;
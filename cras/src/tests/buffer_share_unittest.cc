@@ -106,6 +106,57 @@ TEST_F(BufferShareTestSuite, TwoDevs) {
   buffer_share_destroy(dm);
 }
 
+TEST_F(BufferShareTestSuite, SlotOffsets) {
+  buffer_share* dm = buffer_share_create(1024);
+  int slot0, slot1;
+
+  EXPECT_EQ(-ENOENT, buffer_share_id_slot(dm, 0xf00));
+  EXPECT_EQ(0, buffer_share_add_id(dm, 0xf00, NULL));
+  EXPECT_EQ(0, buffer_share_add_id(dm, 0xf02, NULL));
+  slot0 = buffer_share_id_slot(dm, 0xf00);
+  slot1 = buffer_share_id_slot(dm, 0xf02);
+  EXPECT_LE(0, slot0);
+  EXPECT_LE(0, slot1);
+  EXPECT_NE(slot0, slot1);
+
+  buffer_share_slot_offset_update(dm, slot0, 300);
+  buffer_share_slot_offset_update(dm, slot1, 200);
+  EXPECT_EQ(300, buffer_share_id_offset(dm, 0xf00));
+  EXPECT_EQ(200, buffer_share_slot_offset(dm, slot1));
+  EXPECT_EQ(200, buffer_share_get_new_write_point(dm));
+  EXPECT_EQ(100, buffer_share_slot_offset(dm, slot0));
+  EXPECT_EQ(0, buffer_share_slot_offset(dm, slot1));
+
+  // Removing a user keeps the slots of the others.
+  EXPECT_EQ(0, buffer_share_rm_id(dm, 0xf02));
+  EXPECT_EQ(slot0, buffer_share_id_slot(dm, 0xf00));
+  EXPECT_EQ(100, buffer_share_get_new_write_point(dm));
+  EXPECT_EQ(0, buffer_share_slot_offset(dm, -ENOENT));
+
+  buffer_share_destroy(dm);
+}
+
+TEST_F(BufferShareTestSuite, ManyDevsMinimum) {
+  const unsigned int num_ids = 4 * INITIAL_ID_SIZE;
+  buffer_share* dm = buffer_share_create(1024);
+
+  for (unsigned int i = 0; i < num_ids; i++)
+    EXPECT_EQ(0, buffer_share_add_id(dm, 0xf00 + i, NULL));
+  for (unsigned int i = 0; i < num_ids; i++)
+    buffer_share_offset_update(dm, 0xf00 + i, 100 + (i * 7) % num_ids);
+  EXPECT_EQ(100, buffer_share_get_new_write_point(dm));
+
+  // Remove the users at the minimum, the next smallest becomes it.
+  for (unsigned int i = 0; i < num_ids; i++) {
+    if (buffer_share_id_offset(dm, 0xf00 + i) == 0) {
+      EXPECT_EQ(0, buffer_share_rm_id(dm, 0xf00 + i));
+    }
+  }
+  EXPECT_EQ(1, buffer_share_get_new_write_point(dm));
+
+  buffer_share_destroy(dm);
+}
+
 }  //  namespace
 
 int main(int argc, char** argv) {
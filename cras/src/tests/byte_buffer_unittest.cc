@@ -8,6 +8,16 @@
 
 namespace {
 
+TEST(ByteBuffer, BytesAligned) {
+  struct byte_buffer* b;
+
+  b = byte_buffer_create(100);
+  ASSERT_NE((void*)NULL, b);
+  EXPECT_EQ(0, (uintptr_t)b->bytes % CRAS_BUF_ALIGN);
+  EXPECT_EQ(0, b->bytes[99]);
+  byte_buffer_destroy(&b);
+}
+
 TEST(ByteBuffer, ReadWrite) {
   struct byte_buffer* b;
   uint8_t* data;
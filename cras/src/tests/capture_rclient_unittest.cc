@@ -23,6 +23,11 @@ static unsigned int cras_observer_remove_called;
 static int stream_list_add_called;
 static int stream_list_add_return;
 static unsigned int stream_list_rm_called;
+static unsigned int set_stream_effects_called;
+static uint64_t set_stream_effects_effects;
+static unsigned int set_stream_paused_called;
+static int set_stream_paused_paused;
+static unsigned int set_stream_paused_fade_in_ms;
 static struct cras_audio_shm mock_shm;
 static struct cras_rstream mock_rstream;
 
@@ -32,6 +37,11 @@ void ResetStubData() {
   stream_list_add_called = 0;
   stream_list_add_return = 0;
   stream_list_rm_called = 0;
+  set_stream_effects_called = 0;
+  set_stream_effects_effects = 0;
+  set_stream_paused_called = 0;
+  set_stream_paused_paused = 0;
+  set_stream_paused_fade_in_ms = 0;
 }
 
 namespace {
@@ -196,6 +206,40 @@ TEST_F(CCRMessageSuite, StreamDisconnectMessageInvalidClientId) {
   EXPECT_EQ(0, stream_list_add_called);
   EXPECT_EQ(0, stream_list_rm_called);
 }
+
+TEST_F(CCRMessageSuite, SetStreamEffectsMessage) {
+  struct cras_set_stream_effects_message msg;
+
+  cras_fill_set_stream_effects_message(&msg, 0x10002, APM_NOISE_SUPRESSION);
+  rclient_->ops->handle_message_from_client(rclient_, &msg.header, NULL, 0);
+  EXPECT_EQ(1, set_stream_effects_called);
+  EXPECT_EQ(APM_NOISE_SUPRESSION, set_stream_effects_effects);
+
+  // Streams of other clients are left alone.
+  cras_fill_set_stream_effects_message(&msg, 0x20002, 0);
+  rclient_->ops->handle_message_from_client(rclient_, &msg.header, NULL, 0);
+  EXPECT_EQ(1, set_stream_effects_called);
+}
+
+TEST_F(CCRMessageSuite, SetStreamPausedMessage) {
+  struct cras_set_stream_paused_message msg;
+
+  cras_fill_set_stream_paused_message(&msg, 0x10002, 1, 0);
+  rclient_->ops->handle_message_from_client(rclient_, &msg.header, NULL, 0);
+  EXPECT_EQ(1, set_stream_paused_called);
+  EXPECT_EQ(1, set_stream_paused_paused);
+
+  cras_fill_set_stream_paused_message(&msg, 0x10002, 0, 20);
+  rclient_->ops->handle_message_from_client(rclient_, &msg.header, NULL, 0);
+  EXPECT_EQ(2, set_stream_paused_called);
+  EXPECT_EQ(0, set_stream_paused_paused);
+  EXPECT_EQ(20, set_stream_paused_fade_in_ms);
+
+  // Streams of other clients are left alone.
+  cras_fill_set_stream_paused_message(&msg, 0x20002, 1, 0);
+  rclient_->ops->handle_message_from_client(rclient_, &msg.header, NULL, 0);
+  EXPECT_EQ(2, set_stream_paused_called);
+}
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -210,6 +254,26 @@ struct stream_list* cras_iodev_list_get_stream_list() {
   return NULL;
 }
 
+void cras_iodev_list_begin_stream_batch() {}
+
+int cras_iodev_list_set_stream_effects(cras_stream_id_t stream_id,
+                                       uint64_t effects) {
+  set_stream_effects_called++;
+  set_stream_effects_effects = effects;
+  return 0;
+}
+
+int cras_iodev_list_set_stream_paused(cras_stream_id_t stream_id,
+                                      int paused,
+                                      unsigned int fade_in_ms) {
+  set_stream_paused_called++;
+  set_stream_paused_paused = paused;
+  set_stream_paused_fade_in_ms = fade_in_ms;
+  return 0;
+}
+
+void cras_iodev_list_end_stream_batch() {}
+
 int cras_make_fd_nonblocking(int fd) {
   cras_make_fd_nonblocking_called++;
   return 0;
@@ -231,12 +295,22 @@ int cras_send_with_fds(int sockfd,
   return write(sockfd, buf, len);
 }
 
+int cras_send_messages(int sockfd,
+                       const struct iovec* msgs,
+                       unsigned int num_msgs) {
+  for (unsigned int i = 0; i < num_msgs; i++)
+    write(sockfd, msgs[i].iov_base, msgs[i].iov_len);
+  return num_msgs;
+}
+
 key_t cras_sys_state_shm_fd() {
   return 1;
 }
 
 void cras_system_set_suspended(int suspended) {}
 
+void cras_shm_pool_remove_client(unsigned int client_id) {}
+
 int stream_list_rm_all_client_streams(struct stream_list* list,
                                       struct cras_rclient* rclient) {
   return 0;
@@ -7,6 +7,7 @@
 
 extern "C" {
 #include "cras_card_config.h"
+#include "cras_channel_matrix.h"
 #include "cras_types.h"
 }
 
@@ -251,6 +252,48 @@ TEST_F(CardConfigTestSuite, ExplicitCurveConfig) {
   cras_card_config_destroy(config);
 }
 
+// Test reading the channel matrices of a node.
+TEST_F(CardConfigTestSuite, ChannelMatrixConfig) {
+  static const char matrix_config_name[] = "channel_matrix";
+  static const char matrix_config_text[] =
+      "[Speaker]\n"
+      "channel_matrix_8_2 = 1 0 0.5 0 0 0 0.5 0, 0 1 0.5 0 0 0 0 0.5\n"
+      "channel_matrix_2_1 = 0.5 0.5 0.5\n";
+  struct cras_card_config* config;
+  struct cras_channel_matrix* list;
+  const struct cras_channel_matrix* m;
+
+  CreateConfigFile(matrix_config_name, matrix_config_text);
+
+  config = cras_card_config_create(CONFIG_PATH, matrix_config_name);
+  ASSERT_NE(static_cast<struct cras_card_config*>(NULL), config);
+
+  EXPECT_EQ(NULL, cras_card_config_get_channel_matrices(config, "Headphone"));
+
+  // The 2 to 1 matrix has a value too many and is skipped.
+  list = cras_card_config_get_channel_matrices(config, "Speaker");
+  ASSERT_NE(static_cast<struct cras_channel_matrix*>(NULL), list);
+  EXPECT_EQ(NULL, cras_channel_matrix_find(list, 2, 1));
+  m = cras_channel_matrix_find(list, 8, 2);
+  ASSERT_NE(static_cast<const struct cras_channel_matrix*>(NULL), m);
+  EXPECT_EQ(list, m);
+  EXPECT_EQ(NULL, m->next);
+
+  // Only the non-zero coefficients are kept.
+  ASSERT_EQ(6, m->row_start[2]);
+  EXPECT_EQ(3, m->row_start[1]);
+  EXPECT_EQ(0, m->in_ch[0]);
+  EXPECT_EQ(2, m->in_ch[1]);
+  EXPECT_EQ(6, m->in_ch[2]);
+  EXPECT_EQ(1, m->in_ch[3]);
+  EXPECT_EQ(2, m->in_ch[4]);
+  EXPECT_EQ(7, m->in_ch[5]);
+  EXPECT_FLOAT_EQ(0.5, m->coef[2]);
+
+  cras_channel_matrix_destroy_list(list);
+  cras_card_config_destroy(config);
+}
+
 // Stubs.
 extern "C" {
 
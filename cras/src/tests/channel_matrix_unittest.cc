@@ -0,0 +1,153 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "cras_audio_format.h"
+#include "cras_channel_matrix.h"
+#include "utlist.h"
+}
+
+namespace {
+
+// FL, FR, RL, RR, FC, LFE, SL, SR
+static const int8_t surround71_layout[CRAS_CH_MAX] = {0, 1, 2,  3,  4, 5,
+                                                      6, 7, -1, -1, -1};
+static const int8_t stereo_layout[CRAS_CH_MAX] = {0,  1,  -1, -1, -1, -1,
+                                                  -1, -1, -1, -1, -1};
+// FL, FR, FC, LFE, SL, SR
+static const int8_t surround51_side_layout[CRAS_CH_MAX] = {
+    0, 1, -1, -1, 2, 3, 4, 5, -1, -1, -1};
+
+static void SetFormat(struct cras_audio_format* fmt,
+                      size_t num_channels,
+                      const int8_t* layout) {
+  fmt->format = SND_PCM_FORMAT_S16_LE;
+  fmt->frame_rate = 48000;
+  fmt->num_channels = num_channels;
+  for (int i = 0; i < CRAS_CH_MAX; i++)
+    fmt->channel_layout[i] = layout ? layout[i] : -1;
+}
+
+// Returns the coefficient of in_ch in row out_ch, 0 if it isn't stored.
+static float Coef(const struct cras_channel_matrix* m,
+                  unsigned int out_ch,
+                  unsigned int in_ch) {
+  for (unsigned int k = m->row_start[out_ch]; k < m->row_start[out_ch + 1];
+       k++)
+    if (m->in_ch[k] == in_ch)
+      return m->coef[k];
+  return 0;
+}
+
+TEST(ChannelMatrixTest, CreateKeepsNonZero) {
+  float row0[3] = {1.0, 0, 0.5};
+  float row1[3] = {0, 0, 0};
+  float* rows[2] = {row0, row1};
+  struct cras_channel_matrix* m;
+
+  m = cras_channel_matrix_create(rows, 3, 2);
+  ASSERT_NE((void*)NULL, m);
+  EXPECT_EQ(3, m->num_in_ch);
+  EXPECT_EQ(2, m->num_out_ch);
+  EXPECT_EQ(0, m->row_start[0]);
+  EXPECT_EQ(2, m->row_start[1]);
+  EXPECT_EQ(2, m->row_start[2]);
+  EXPECT_EQ(0, m->in_ch[0]);
+  EXPECT_EQ(2, m->in_ch[1]);
+  EXPECT_FLOAT_EQ(0.5, m->coef[1]);
+  cras_channel_matrix_destroy(m);
+}
+
+TEST(ChannelMatrixTest, FromLayoutsNeedsLayouts) {
+  struct cras_audio_format in, out;
+
+  SetFormat(&in, 8, NULL);
+  SetFormat(&out, 2, stereo_layout);
+  EXPECT_EQ(NULL, cras_channel_matrix_create_from_layouts(&in, &out));
+
+  // Layout pointing past the channel count.
+  SetFormat(&in, 4, surround71_layout);
+  EXPECT_EQ(NULL, cras_channel_matrix_create_from_layouts(&in, &out));
+}
+
+TEST(ChannelMatrixTest, FromLayouts71ToStereo) {
+  struct cras_audio_format in, out;
+  struct cras_channel_matrix* m;
+  float scale = 1 + 4 * 0.707;
+
+  SetFormat(&in, 8, surround71_layout);
+  SetFormat(&out, 2, stereo_layout);
+  m = cras_channel_matrix_create_from_layouts(&in, &out);
+  ASSERT_NE((void*)NULL, m);
+
+  // FL, RL, FC, LFE and SL go left, scaled so the row can't clip.
+  EXPECT_EQ(5, m->row_start[1]);
+  EXPECT_FLOAT_EQ(1 / scale, Coef(m, 0, 0));
+  EXPECT_FLOAT_EQ(0, Coef(m, 0, 1));
+  EXPECT_FLOAT_EQ(0.707 / scale, Coef(m, 0, 2));
+  EXPECT_FLOAT_EQ(0.707 / scale, Coef(m, 0, 4));
+  EXPECT_FLOAT_EQ(0.707 / scale, Coef(m, 0, 5));
+  EXPECT_FLOAT_EQ(0.707 / scale, Coef(m, 0, 6));
+  EXPECT_FLOAT_EQ(0, Coef(m, 0, 7));
+  EXPECT_FLOAT_EQ(1 / scale, Coef(m, 1, 1));
+  EXPECT_FLOAT_EQ(0.707 / scale, Coef(m, 1, 7));
+  EXPECT_EQ(10, m->row_start[2]);
+  cras_channel_matrix_destroy(m);
+}
+
+TEST(ChannelMatrixTest, FromLayoutsFoldsRearToSide) {
+  struct cras_audio_format in, out;
+  struct cras_channel_matrix* m;
+
+  SetFormat(&in, 8, surround71_layout);
+  SetFormat(&out, 6, surround51_side_layout);
+  m = cras_channel_matrix_create_from_layouts(&in, &out);
+  ASSERT_NE((void*)NULL, m);
+
+  // Side channels carry both side and rear at half gain each.
+  EXPECT_FLOAT_EQ(0.5, Coef(m, 4, 2));
+  EXPECT_FLOAT_EQ(0.5, Coef(m, 4, 6));
+  EXPECT_FLOAT_EQ(0.5, Coef(m, 5, 3));
+  EXPECT_FLOAT_EQ(0.5, Coef(m, 5, 7));
+  EXPECT_FLOAT_EQ(0.5, Coef(m, 2, 4));
+  EXPECT_FLOAT_EQ(0.5, Coef(m, 0, 0));
+  EXPECT_EQ(1, m->row_start[1] - m->row_start[0]);
+  cras_channel_matrix_destroy(m);
+}
+
+TEST(ChannelMatrixTest, DupAndFind) {
+  float row[2] = {0.25, 0.75};
+  float* rows[1] = {row};
+  struct cras_channel_matrix *list = NULL, *m, *copy;
+
+  m = cras_channel_matrix_create(rows, 2, 1);
+  ASSERT_NE((void*)NULL, m);
+  DL_APPEND(list, m);
+  m = cras_channel_matrix_create(rows, 1, 1);
+  ASSERT_NE((void*)NULL, m);
+  DL_APPEND(list, m);
+
+  EXPECT_EQ(NULL, cras_channel_matrix_find(list, 2, 2));
+  EXPECT_EQ(list->next, cras_channel_matrix_find(list, 1, 1));
+  EXPECT_EQ(list, cras_channel_matrix_find(list, 2, 1));
+
+  copy = cras_channel_matrix_dup(list);
+  ASSERT_NE((void*)NULL, copy);
+  EXPECT_EQ(NULL, copy->next);
+  EXPECT_EQ(2, copy->num_in_ch);
+  EXPECT_EQ(2, copy->row_start[1]);
+  EXPECT_FLOAT_EQ(0.75, Coef(copy, 0, 1));
+  cras_channel_matrix_destroy(copy);
+
+  cras_channel_matrix_destroy_list(list);
+}
+
+}  //  namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
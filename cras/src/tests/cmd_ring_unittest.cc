@@ -0,0 +1,104 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+
+extern "C" {
+#include "cras_cmd_ring.h"
+}
+
+namespace {
+
+#define NUM_MESSAGES 100000
+
+TEST(CmdRingTest, CreateInvalid) {
+  EXPECT_EQ(NULL, cras_cmd_ring_create(0, 4));
+  EXPECT_EQ(NULL, cras_cmd_ring_create(16, 0));
+  EXPECT_EQ(NULL, cras_cmd_ring_create(16, 3));
+}
+
+TEST(CmdRingTest, FillAndDrain) {
+  struct cras_cmd_ring* ring;
+  unsigned int* slot;
+
+  ring = cras_cmd_ring_create(sizeof(unsigned int), 4);
+  ASSERT_NE((void*)NULL, ring);
+  EXPECT_EQ(NULL, cras_cmd_ring_read_slot(ring));
+
+  for (unsigned int i = 0; i < 4; i++) {
+    slot = (unsigned int*)cras_cmd_ring_write_slot(ring);
+    ASSERT_NE((void*)NULL, slot);
+    *slot = i;
+    cras_cmd_ring_commit_write(ring);
+  }
+  EXPECT_EQ(NULL, cras_cmd_ring_write_slot(ring));
+
+  for (unsigned int i = 0; i < 4; i++) {
+    slot = (unsigned int*)cras_cmd_ring_read_slot(ring);
+    ASSERT_NE((void*)NULL, slot);
+    EXPECT_EQ(i, *slot);
+    cras_cmd_ring_commit_read(ring);
+  }
+  EXPECT_EQ(NULL, cras_cmd_ring_read_slot(ring));
+  EXPECT_NE((void*)NULL, cras_cmd_ring_write_slot(ring));
+
+  cras_cmd_ring_destroy(ring);
+}
+
+TEST(CmdRingTest, SlotSizeAligned) {
+  struct cras_cmd_ring* ring;
+
+  ring = cras_cmd_ring_create(3, 2);
+  ASSERT_NE((void*)NULL, ring);
+  EXPECT_EQ(0, cras_cmd_ring_slot_size(ring) % sizeof(void*));
+  EXPECT_LE(3, cras_cmd_ring_slot_size(ring));
+  cras_cmd_ring_destroy(ring);
+}
+
+static void* consumer(void* arg) {
+  struct cras_cmd_ring* ring = (struct cras_cmd_ring*)arg;
+  unsigned int expected = 0;
+  unsigned int* slot;
+
+  while (expected < NUM_MESSAGES) {
+    slot = (unsigned int*)cras_cmd_ring_read_slot(ring);
+    if (!slot)
+      continue;
+    if (*slot != expected)
+      return (void*)1;
+    cras_cmd_ring_commit_read(ring);
+    expected++;
+  }
+  return NULL;
+}
+
+TEST(CmdRingTest, OrderedAcrossThreads) {
+  struct cras_cmd_ring* ring;
+  pthread_t tid;
+  unsigned int* slot;
+  void* result;
+
+  ring = cras_cmd_ring_create(sizeof(unsigned int), 8);
+  ASSERT_NE((void*)NULL, ring);
+  ASSERT_EQ(0, pthread_create(&tid, NULL, consumer, ring));
+
+  for (unsigned int i = 0; i < NUM_MESSAGES; i++) {
+    while (!(slot = (unsigned int*)cras_cmd_ring_write_slot(ring)))
+      ;
+    *slot = i;
+    cras_cmd_ring_commit_write(ring);
+  }
+
+  pthread_join(tid, &result);
+  EXPECT_EQ(NULL, result);
+  cras_cmd_ring_destroy(ring);
+}
+
+}  //  namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <fcntl.h>
 #include <gtest/gtest.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -21,9 +22,9 @@ extern "C" {
 }
 
 //  Stub data.
-static int audio_thread_config_global_remix_called;
-static float audio_thread_config_global_remix_copy[CRAS_MAX_REMIX_CHANNELS *
-                                                   CRAS_MAX_REMIX_CHANNELS];
+static int iodev_list_config_global_remix_called;
+static float iodev_list_config_global_remix_copy[CRAS_MAX_REMIX_CHANNELS *
+                                                 CRAS_MAX_REMIX_CHANNELS];
 static int cras_rstream_create_return;
 static struct cras_rstream* cras_rstream_create_stream_out;
 static int cras_iodev_attach_stream_retval;
@@ -41,7 +42,8 @@ static size_t cras_system_set_capture_mute_locked_value;
 static int cras_system_set_capture_mute_locked_called;
 static int cras_system_state_dump_snapshots_called;
 static size_t cras_make_fd_nonblocking_called;
-static audio_thread* iodev_get_thread_return;
+static unsigned int cras_send_messages_called;
+static unsigned int cras_iodev_list_set_node_attr_called;
 static int stream_list_add_stream_return;
 static unsigned int stream_list_add_stream_called;
 static unsigned int stream_list_disconnect_stream_called;
@@ -62,9 +64,11 @@ static struct cras_observer_ops cras_observer_ops_are_empty_empty_ops;
 static size_t cras_observer_remove_called;
 
 void ResetStubData() {
-  audio_thread_config_global_remix_called = 0;
-  memset(audio_thread_config_global_remix_copy, 0,
-         sizeof(audio_thread_config_global_remix_copy));
+  cras_send_messages_called = 0;
+  cras_iodev_list_set_node_attr_called = 0;
+  iodev_list_config_global_remix_called = 0;
+  memset(iodev_list_config_global_remix_copy, 0,
+         sizeof(iodev_list_config_global_remix_copy));
   cras_rstream_create_return = 0;
   cras_rstream_create_stream_out = (struct cras_rstream*)NULL;
   cras_iodev_attach_stream_retval = 0;
@@ -82,7 +86,6 @@ void ResetStubData() {
   cras_system_set_capture_mute_locked_called = 0;
   cras_system_state_dump_snapshots_called = 0;
   cras_make_fd_nonblocking_called = 0;
-  iodev_get_thread_return = reinterpret_cast<audio_thread*>(0xad);
   stream_list_add_stream_return = 0;
   stream_list_add_stream_called = 0;
   stream_list_disconnect_stream_called = 0;
@@ -418,6 +421,38 @@ TEST_F(RClientMessagesSuite, DumpSnapshots) {
   EXPECT_EQ(1, cras_system_state_dump_snapshots_called);
 }
 
+TEST_F(RClientMessagesSuite, DumpsOverRateGetLastDump) {
+  struct cras_dump_snapshots msg;
+  struct cras_client_audio_debug_info_ready ready;
+  int rc;
+
+  cras_fill_dump_snapshots(&msg);
+  for (int i = 0; i < 6; i++) {
+    rc = rclient_->ops->handle_message_from_client(rclient_, &msg.header, NULL,
+                                                   0);
+    EXPECT_EQ(0, rc);
+    // Every request is answered.
+    rc = read(pipe_fds_[0], &ready, sizeof(ready));
+    ASSERT_EQ(sizeof(ready), rc);
+    EXPECT_EQ(CRAS_CLIENT_AUDIO_DEBUG_INFO_READY, ready.header.id);
+  }
+  // Only the burst refreshed the dump.
+  EXPECT_EQ(4, cras_system_state_dump_snapshots_called);
+}
+
+TEST_F(RClientMessagesSuite, NodeAttrFloodDropped) {
+  struct cras_set_node_attr msg;
+  int rc;
+
+  cras_fill_set_node_attr(&msg, 0x100000001, IONODE_ATTR_VOLUME, 50);
+  for (int i = 0; i < 70; i++) {
+    rc = rclient_->ops->handle_message_from_client(rclient_, &msg.header, NULL,
+                                                   0);
+    EXPECT_EQ(0, rc);
+  }
+  EXPECT_EQ(64, cras_iodev_list_set_node_attr_called);
+}
+
 TEST_F(RClientMessagesSuite, ConfigGlobalRemix) {
   int rc;
   struct cras_config_global_remix msg;
@@ -429,9 +464,9 @@ TEST_F(RClientMessagesSuite, ConfigGlobalRemix) {
   rc =
       rclient_->ops->handle_message_from_client(rclient_, &msg.header, NULL, 0);
   EXPECT_EQ(0, rc);
-  EXPECT_EQ(1, audio_thread_config_global_remix_called);
+  EXPECT_EQ(1, iodev_list_config_global_remix_called);
   for (unsigned i = 0; i < (unsigned)num_channels * num_channels; i++) {
-    EXPECT_EQ(audio_thread_config_global_remix_copy[i], coefficient[i]);
+    EXPECT_EQ(iodev_list_config_global_remix_copy[i], coefficient[i]);
   }
 }
 
@@ -702,6 +737,58 @@ TEST_F(RClientMessagesSuite, SendNumActiveStreamsChanged) {
   EXPECT_EQ(msg->num_active_streams, num_active_streams);
 }
 
+TEST_F(RClientMessagesSuite, HeldMessagesSentInOneBatch) {
+  void* void_client = reinterpret_cast<void*>(rclient_);
+  struct cras_client_volume_changed volume_msg;
+  struct cras_client_nodes_changed nodes_msg;
+  ssize_t rc;
+
+  fcntl(pipe_fds_[0], F_SETFL, O_NONBLOCK);
+  ASSERT_EQ(0, rclient_hold_messages(rclient_));
+
+  send_output_volume_changed(void_client, 90);
+  send_nodes_changed(void_client);
+  rc = read(pipe_fds_[0], &volume_msg, sizeof(volume_msg));
+  EXPECT_EQ(-1, rc);
+  EXPECT_EQ(0, cras_send_messages_called);
+
+  EXPECT_EQ(0, rclient_flush_messages(rclient_));
+  EXPECT_EQ(1, cras_send_messages_called);
+  rc = read(pipe_fds_[0], &volume_msg, sizeof(volume_msg));
+  ASSERT_EQ(rc, (ssize_t)sizeof(volume_msg));
+  EXPECT_EQ(volume_msg.header.id, CRAS_CLIENT_OUTPUT_VOLUME_CHANGED);
+  EXPECT_EQ(volume_msg.volume, 90);
+  rc = read(pipe_fds_[0], &nodes_msg, sizeof(nodes_msg));
+  ASSERT_EQ(rc, (ssize_t)sizeof(nodes_msg));
+  EXPECT_EQ(nodes_msg.header.id, CRAS_CLIENT_NODES_CHANGED);
+
+  /* Nothing left to send. */
+  EXPECT_EQ(0, rclient_flush_messages(rclient_));
+  EXPECT_EQ(1, cras_send_messages_called);
+}
+
+TEST_F(RClientMessagesSuite, MessageWithFdFlushesHeldMessages) {
+  void* void_client = reinterpret_cast<void*>(rclient_);
+  struct cras_client_volume_changed volume_msg;
+  struct cras_client_nodes_changed nodes_msg;
+  int fd = 0;
+  ssize_t rc;
+
+  ASSERT_EQ(0, rclient_hold_messages(rclient_));
+  send_output_volume_changed(void_client, 40);
+
+  /* The message carrying an fd goes out right after the held one. */
+  cras_fill_client_nodes_changed(&nodes_msg);
+  rclient_->ops->send_message_to_client(rclient_, &nodes_msg.header, &fd, 1);
+  EXPECT_EQ(1, cras_send_messages_called);
+  rc = read(pipe_fds_[0], &volume_msg, sizeof(volume_msg));
+  ASSERT_EQ(rc, (ssize_t)sizeof(volume_msg));
+  EXPECT_EQ(volume_msg.header.id, CRAS_CLIENT_OUTPUT_VOLUME_CHANGED);
+  rc = read(pipe_fds_[0], &nodes_msg, sizeof(nodes_msg));
+  ASSERT_EQ(rc, (ssize_t)sizeof(nodes_msg));
+  EXPECT_EQ(nodes_msg.header.id, CRAS_CLIENT_NODES_CHANGED);
+}
+
 }  //  namespace
 
 int main(int argc, char** argv) {
@@ -715,8 +802,22 @@ extern "C" {
 struct cras_bt_event_log* btlog;
 struct main_thread_event_log* main_log;
 
-struct audio_thread* cras_iodev_list_get_audio_thread() {
-  return iodev_get_thread_return;
+int cras_iodev_list_dump_audio_thread_info(struct audio_debug_info* info) {
+  return 0;
+}
+
+int cras_iodev_list_config_global_remix(unsigned int num_channels,
+                                        const float* coefficient) {
+  iodev_list_config_global_remix_called++;
+  memcpy(iodev_list_config_global_remix_copy, coefficient,
+         num_channels * num_channels * sizeof(coefficient));
+  return 0;
+}
+
+int cras_iodev_list_set_aec_dump(cras_stream_id_t stream_id,
+                                 unsigned int start,
+                                 int fd) {
+  return 0;
 }
 
 void cras_iodev_list_add_active_node(enum CRAS_STREAM_DIRECTION dir,
@@ -732,11 +833,6 @@ int audio_thread_rm_stream(audio_thread* thread, cras_rstream* stream) {
 void audio_thread_add_output_dev(struct audio_thread* thread,
                                  struct cras_iodev* odev) {}
 
-int audio_thread_dump_thread_info(struct audio_thread* thread,
-                                  struct audio_debug_info* info) {
-  return 0;
-}
-
 int audio_thread_suspend(struct audio_thread* thread) {
   return 0;
 }
@@ -745,22 +841,6 @@ int audio_thread_resume(struct audio_thread* thread) {
   return 0;
 }
 
-int audio_thread_config_global_remix(struct audio_thread* thread,
-                                     unsigned int num_channels,
-                                     const float* coefficient) {
-  audio_thread_config_global_remix_called++;
-  memcpy(audio_thread_config_global_remix_copy, coefficient,
-         num_channels * num_channels * sizeof(coefficient));
-  return 0;
-}
-
-int audio_thread_set_aec_dump(struct audio_thread* thread,
-                              cras_stream_id_t stream_id,
-                              unsigned int start,
-                              int fd) {
-  return 0;
-}
-
 int audio_thread_event_log_shm_fd() {
   return -1;
 }
@@ -860,6 +940,7 @@ void cras_dsp_dump_info() {}
 int cras_iodev_list_set_node_attr(cras_node_id_t id,
                                   enum ionode_attr attr,
                                   int value) {
+  cras_iodev_list_set_node_attr_called++;
   return 0;
 }
 
@@ -868,10 +949,25 @@ void cras_iodev_list_select_node(enum CRAS_STREAM_DIRECTION direction,
 
 void cras_iodev_list_add_test_dev(enum TEST_IODEV_TYPE type) {}
 
+int cras_iodev_list_set_stream_effects(cras_stream_id_t stream_id,
+                                       uint64_t effects) {
+  return 0;
+}
+
+int cras_iodev_list_set_stream_paused(cras_stream_id_t stream_id,
+                                      int paused,
+                                      unsigned int fade_in_ms) {
+  return 0;
+}
+
 struct stream_list* cras_iodev_list_get_stream_list() {
   return NULL;
 }
 
+void cras_iodev_list_begin_stream_batch() {}
+
+void cras_iodev_list_end_stream_batch() {}
+
 /* Handles sending a command to a test iodev. */
 void cras_iodev_list_test_dev_command(unsigned int iodev_idx,
                                       enum CRAS_TEST_IODEV_CMD command,
@@ -906,6 +1002,8 @@ int stream_list_rm(struct stream_list* list, cras_stream_id_t id) {
   return 0;
 }
 
+void cras_shm_pool_remove_client(unsigned int client_id) {}
+
 int stream_list_rm_all_client_streams(struct stream_list* list,
                                       struct cras_rclient* rclient) {
   return 0;
@@ -919,6 +1017,15 @@ int cras_send_with_fds(int sockfd,
   return write(sockfd, buf, len);
 }
 
+int cras_send_messages(int sockfd,
+                       const struct iovec* msgs,
+                       unsigned int num_msgs) {
+  cras_send_messages_called++;
+  for (unsigned int i = 0; i < num_msgs; i++)
+    write(sockfd, msgs[i].iov_base, msgs[i].iov_len);
+  return num_msgs;
+}
+
 char* cras_iodev_list_get_hotword_models(cras_node_id_t node_id) {
   return NULL;
 }
@@ -967,4 +1074,7 @@ struct packet_status_logger* cras_hfp_ag_get_wbs_logger() {
   return NULL;
 }
 
+void packet_status_logger_copy(struct packet_status_logger* dst,
+                               const struct packet_status_logger* src) {}
+
 }  // extern "C"
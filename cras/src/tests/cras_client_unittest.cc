@@ -20,6 +20,7 @@ static int pthread_cond_timedwait_called;
 static int pthread_cond_timedwait_retval;
 static int close_called;
 static int sendmsg_called;
+static size_t sendmsg_len;
 static void* mmap_return_value;
 static int samples_ready_called;
 static int samples_ready_frames_value;
@@ -36,6 +37,7 @@ void InitStaticVariables() {
   pthread_cond_timedwait_retval = 0;
   close_called = 0;
   sendmsg_called = 0;
+  sendmsg_len = 0;
   pthread_create_returned_value = 0;
   mmap_return_value = NULL;
   samples_ready_called = 0;
@@ -185,6 +187,7 @@ void CrasClientTestSuite::StreamConnected(CRAS_STREAM_DIRECTION direction) {
   header = (struct cras_audio_shm_header*)calloc(1, sizeof(*header));
   header->config.frame_bytes = format_bytes;
   header->config.used_size = shm_writable_frames_ * format_bytes;
+  header->config.layout_version = CRAS_SHM_LAYOUT_VERSION;
 
   mmap_return_value = header;
 
@@ -251,6 +254,79 @@ TEST_F(CrasClientTestSuite, OutputStreamConnectedFail) {
   StreamConnectedFail(CRAS_STREAM_OUTPUT);
 }
 
+TEST_F(CrasClientTestSuite, StreamConnectedUnknownShmLayout) {
+  struct cras_client_stream_connected msg;
+  int shm_fds[2] = {0, 1};
+  struct cras_audio_shm_header header;
+  int rc;
+
+  stream_.direction = CRAS_STREAM_OUTPUT;
+  set_audio_format(&stream_.config->format, SND_PCM_FORMAT_S16_LE, 48000, 2);
+  struct cras_audio_format server_format;
+  set_audio_format(&server_format, SND_PCM_FORMAT_S16_LE, 48000, 2);
+
+  rc = pipe(stream_.wake_fds);
+  ASSERT_EQ(0, rc);
+  stream_.thread.state = CRAS_THREAD_WARMUP;
+
+  memset(&header, 0, sizeof(header));
+  header.config.frame_bytes = 4;
+  header.config.used_size = shm_writable_frames_ * 4;
+  header.config.layout_version = CRAS_SHM_LAYOUT_VERSION + 1;
+  mmap_return_value = &header;
+
+  cras_fill_client_stream_connected(&msg, 0, stream_.id, &server_format, 600,
+                                    0);
+  rc = stream_connected(&stream_, &msg, shm_fds, 2);
+
+  EXPECT_EQ(-EINVAL, rc);
+  EXPECT_EQ(CRAS_THREAD_STOP, stream_.thread.state);
+  EXPECT_EQ(NULL, stream_.shm);
+}
+
+TEST_F(CrasClientTestSuite, SetNumShmBuffers) {
+  struct cras_stream_params* params = stream_.config;
+
+  EXPECT_EQ(0, cras_client_stream_params_set_num_shm_buffers(params, 4));
+  EXPECT_EQ(4, params->num_shm_buffers);
+  EXPECT_EQ(-EINVAL, cras_client_stream_params_set_num_shm_buffers(params, 6));
+  EXPECT_EQ(4, params->num_shm_buffers);
+}
+
+TEST_F(CrasClientTestSuite, SetScheduledStart) {
+  struct cras_stream_params* params = stream_.config;
+  struct timespec start = {12, 500000000};
+  struct timespec bad = {13, 1000000000};
+
+  params->direction = CRAS_STREAM_OUTPUT;
+  EXPECT_EQ(0, cras_client_stream_params_set_scheduled_start(params, &start));
+  EXPECT_EQ(12, params->scheduled_ts.tv_sec);
+  EXPECT_EQ(500000000, params->scheduled_ts.tv_nsec);
+  EXPECT_EQ(-EINVAL,
+            cras_client_stream_params_set_scheduled_start(params, &bad));
+  EXPECT_EQ(12, params->scheduled_ts.tv_sec);
+
+  // Only playback can be scheduled.
+  params->direction = CRAS_STREAM_INPUT;
+  EXPECT_EQ(-EINVAL,
+            cras_client_stream_params_set_scheduled_start(params, &start));
+}
+
+TEST_F(CrasClientTestSuite, SetPreRoll) {
+  struct cras_stream_params* params = stream_.config;
+
+  params->direction = CRAS_STREAM_INPUT;
+  params->buffer_frames = 960;
+  EXPECT_EQ(0, cras_client_stream_params_set_pre_roll(params, 960));
+  EXPECT_EQ(960, params->pre_roll_frames);
+  EXPECT_EQ(-EINVAL, cras_client_stream_params_set_pre_roll(params, 961));
+  EXPECT_EQ(960, params->pre_roll_frames);
+
+  // Only capture starts with past frames.
+  params->direction = CRAS_STREAM_OUTPUT;
+  EXPECT_EQ(-EINVAL, cras_client_stream_params_set_pre_roll(params, 480));
+}
+
 TEST_F(CrasClientTestSuite, AddAndRemoveStream) {
   cras_stream_id_t stream_id;
   struct cras_disconnect_stream_message msg;
@@ -302,6 +378,259 @@ TEST_F(CrasClientTestSuite, AddAndRemoveStream) {
   EXPECT_EQ(NULL, stream_from_id(&client_, stream_id));
 }
 
+TEST_F(CrasClientTestSuite, AddAndRemoveStreams) {
+  cras_stream_id_t stream_ids[3];
+  struct client_stream* streams[2];
+  struct cras_disconnect_streams_message msg;
+  int serv_fds[2];
+  int rc;
+
+  for (int i = 0; i < 2; i++) {
+    streams[i] = (struct client_stream*)malloc(sizeof(*streams[i]));
+    memcpy(streams[i], &stream_, sizeof(client_stream));
+    streams[i]->config =
+        (struct cras_stream_params*)malloc(sizeof(*(streams[i]->config)));
+    memcpy(streams[i]->config, stream_.config, sizeof(*(stream_.config)));
+    streams[i]->wake_fds[0] = -1;
+    streams[i]->wake_fds[1] = -1;
+  }
+
+  EXPECT_EQ(0, client_thread_add_streams(&client_, streams, stream_ids, 2));
+  EXPECT_EQ(2, pthread_create_called);
+  // Both streams are connected with a single message.
+  EXPECT_EQ(1, sendmsg_called);
+  EXPECT_EQ(CRAS_CONNECT_STREAMS_MESSAGE_SIZE(2), sendmsg_len);
+  EXPECT_NE(stream_ids[0], stream_ids[1]);
+  EXPECT_EQ(streams[0], stream_from_id(&client_, stream_ids[0]));
+  EXPECT_EQ(streams[1], stream_from_id(&client_, stream_ids[1]));
+
+  for (int i = 0; i < 2; i++)
+    streams[i]->thread.state = CRAS_THREAD_RUNNING;
+
+  rc = pipe(serv_fds);
+  EXPECT_EQ(0, rc);
+  client_.server_fd = serv_fds[1];
+  client_.server_fd_state = CRAS_SOCKET_STATE_CONNECTED;
+  // Unknown ids are left out of the message.
+  stream_ids[2] = stream_ids[1] + 1;
+  EXPECT_EQ(0, client_thread_rm_streams(&client_, stream_ids, 3));
+
+  rc = read(serv_fds[0], &msg, sizeof(msg));
+  EXPECT_EQ(sizeof(msg), rc);
+  EXPECT_EQ(CRAS_SERVER_DISCONNECT_STREAMS, msg.header.id);
+  EXPECT_EQ(2, msg.num_streams);
+  EXPECT_EQ(stream_ids[0], msg.stream_ids[0]);
+  EXPECT_EQ(stream_ids[1], msg.stream_ids[1]);
+  EXPECT_EQ(2, pthread_join_called);
+
+  EXPECT_EQ(NULL, stream_from_id(&client_, stream_ids[0]));
+  EXPECT_EQ(NULL, stream_from_id(&client_, stream_ids[1]));
+}
+
+TEST_F(CrasClientTestSuite, AddStreamsRejectsHotword) {
+  cras_stream_id_t stream_id;
+  struct client_stream* stream_ptr = &stream_;
+
+  stream_.flags = HOTWORD_STREAM;
+  EXPECT_EQ(-EINVAL,
+            client_thread_add_streams(&client_, &stream_ptr, &stream_id, 1));
+  EXPECT_EQ(0, pthread_create_called);
+  EXPECT_EQ(0, sendmsg_called);
+  EXPECT_EQ(NULL, client_.streams);
+}
+
+TEST_F(CrasClientTestSuite, AddExternalPollStream) {
+  cras_stream_id_t stream_id;
+  struct client_stream* stream;
+
+  stream_.config->flags = SHM_WAKE;
+  cras_client_stream_params_enable_external_poll(stream_.config);
+  stream = client_stream_create(stream_.config);
+  ASSERT_NE((void*)NULL, stream);
+  EXPECT_EQ(1, stream->external_poll);
+  // The stream can only be woken through aud_fd.
+  EXPECT_EQ(0, stream->flags & SHM_WAKE);
+
+  EXPECT_EQ(0,
+            client_thread_add_stream(&client_, stream, &stream_id, NO_DEVICE));
+  EXPECT_EQ(0, pthread_create_called);
+  EXPECT_EQ(1, sendmsg_called);
+  EXPECT_EQ(CRAS_THREAD_WARMUP, stream->thread.state);
+  EXPECT_EQ(stream->aud_fd, cras_client_stream_get_fd(&client_, stream_id));
+  EXPECT_EQ(-EINVAL, cras_client_stream_get_fd(&client_, stream_id + 1));
+
+  client_.server_fd_state = CRAS_SOCKET_STATE_DISCONNECTED;
+  EXPECT_EQ(0, client_thread_rm_stream(&client_, stream_id));
+  EXPECT_EQ(0, pthread_join_called);
+  EXPECT_EQ(-EINVAL, cras_client_stream_get_fd(&client_, stream_id));
+}
+
+TEST_F(CrasClientTestSuite, ProcessExternalPollStream) {
+  struct audio_message aud_msg;
+  int sock[2];
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sock));
+  stream_.direction = CRAS_STREAM_INPUT;
+  stream_.aud_fd = sock[0];
+  stream_.client = &client_;
+  stream_.external_poll = 1;
+  stream_.thread.state = CRAS_THREAD_WARMUP;
+  shm_writable_frames_ = 480;
+  stream_.shm = InitShm();
+  stream_.shm->header->write_offset[0] = 480 * 4;
+  stream_.config->cb_threshold = 480;
+  stream_.config->aud_cb = capture_samples_ready;
+  DL_APPEND(client_.streams, &stream_);
+
+  aud_msg.id = AUDIO_MESSAGE_DATA_READY;
+  aud_msg.frames = 480;
+  aud_msg.error = 0;
+  ASSERT_EQ(sizeof(aud_msg), write(sock[1], &aud_msg, sizeof(aud_msg)));
+
+  // The request waits until the stream is connected.
+  EXPECT_EQ(0, cras_client_stream_process(&client_, stream_.id));
+  EXPECT_EQ(0, samples_ready_called);
+
+  stream_.thread.state = CRAS_THREAD_RUNNING;
+  EXPECT_EQ(1, cras_client_stream_process(&client_, stream_.id));
+  EXPECT_EQ(1, samples_ready_called);
+  EXPECT_EQ(480, samples_ready_frames_value);
+  ASSERT_EQ(sizeof(aud_msg), read(sock[1], &aud_msg, sizeof(aud_msg)));
+  EXPECT_EQ(AUDIO_MESSAGE_DATA_CAPTURED, aud_msg.id);
+  EXPECT_EQ(480, aud_msg.frames);
+
+  // Nothing pending, doesn't block.
+  EXPECT_EQ(0, cras_client_stream_process(&client_, stream_.id));
+  EXPECT_EQ(1, samples_ready_called);
+
+  EXPECT_EQ(-EINVAL, cras_client_stream_process(&client_, stream_.id + 1));
+  stream_.external_poll = 0;
+  EXPECT_EQ(-EINVAL, cras_client_stream_process(&client_, stream_.id));
+  EXPECT_EQ(-EINVAL, cras_client_stream_get_fd(&client_, stream_.id));
+  DL_DELETE(client_.streams, &stream_);
+}
+
+TEST_F(CrasClientTestSuite, AddStreamsSharingAudioThread) {
+  struct client_stream* streams[4];
+  cras_stream_id_t stream_ids[4];
+  int serv_fds[2];
+
+  client_.aud_wake_fds[0] = -1;
+  client_.aud_wake_fds[1] = -1;
+  cras_client_share_audio_thread(&client_);
+  for (int i = 0; i < 4; i++) {
+    streams[i] = client_stream_create(stream_.config);
+    ASSERT_NE((void*)NULL, streams[i]);
+  }
+  // Asks for a thread of its own.
+  streams[1]->config->own_thread = 1;
+  // Waits on the shm wake word.
+  streams[2]->flags = SHM_WAKE;
+
+  for (int i = 0; i < 4; i++)
+    EXPECT_EQ(0, client_thread_add_stream(&client_, streams[i],
+                                          &stream_ids[i], NO_DEVICE));
+  // One thread shared by the first and last streams, one each for the
+  // others.
+  EXPECT_EQ(3, pthread_create_called);
+  EXPECT_EQ(1, streams[0]->shared_thread);
+  EXPECT_EQ(0, streams[1]->shared_thread);
+  EXPECT_EQ(0, streams[2]->shared_thread);
+  EXPECT_EQ(1, streams[3]->shared_thread);
+  EXPECT_EQ(2, client_.num_aud_streams);
+  EXPECT_EQ(CRAS_THREAD_RUNNING, client_.aud_thread.state);
+  EXPECT_NE(-1, client_.aud_wake_fds[0]);
+
+  ASSERT_EQ(0, pipe(serv_fds));
+  client_.server_fd = serv_fds[1];
+  EXPECT_EQ(0, client_thread_rm_stream(&client_, stream_ids[1]));
+  EXPECT_EQ(0, client_thread_rm_stream(&client_, stream_ids[2]));
+  EXPECT_EQ(2, pthread_join_called);
+  EXPECT_EQ(0, client_thread_rm_stream(&client_, stream_ids[0]));
+  EXPECT_EQ(2, pthread_join_called);
+  // The thread stops with its last stream.
+  EXPECT_EQ(0, client_thread_rm_stream(&client_, stream_ids[3]));
+  EXPECT_EQ(3, pthread_join_called);
+  EXPECT_EQ(0, client_.num_aud_streams);
+  EXPECT_EQ(CRAS_THREAD_STOP, client_.aud_thread.state);
+  EXPECT_EQ(-1, client_.aud_wake_fds[0]);
+}
+
+TEST_F(CrasClientTestSuite, ServiceSharedStreams) {
+  struct audio_message aud_msg;
+  struct pollfd pollfd;
+  cras_stream_id_t id;
+  int sock[2];
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sock));
+  stream_.direction = CRAS_STREAM_INPUT;
+  stream_.aud_fd = sock[0];
+  stream_.client = &client_;
+  stream_.shared_thread = 1;
+  stream_.thread.state = CRAS_THREAD_RUNNING;
+  shm_writable_frames_ = 480;
+  stream_.shm = InitShm();
+  stream_.shm->header->write_offset[0] = 480 * 4;
+  stream_.config->cb_threshold = 480;
+  stream_.config->aud_cb = capture_samples_ready;
+  DL_APPEND(client_.streams, &stream_);
+
+  aud_msg.id = AUDIO_MESSAGE_DATA_READY;
+  aud_msg.frames = 480;
+  aud_msg.error = 0;
+  ASSERT_EQ(sizeof(aud_msg), write(sock[1], &aud_msg, sizeof(aud_msg)));
+  pollfd.fd = sock[0];
+  pollfd.events = POLLIN;
+  pollfd.revents = POLLIN;
+
+  // A stream removed since the poll set was built is left alone.
+  id = stream_.id + 1;
+  service_shared_streams(&client_, &pollfd, &id, 1);
+  EXPECT_EQ(0, samples_ready_called);
+
+  id = stream_.id;
+  service_shared_streams(&client_, &pollfd, &id, 1);
+  EXPECT_EQ(1, samples_ready_called);
+  EXPECT_EQ(480, samples_ready_frames_value);
+  ASSERT_EQ(sizeof(aud_msg), read(sock[1], &aud_msg, sizeof(aud_msg)));
+  EXPECT_EQ(AUDIO_MESSAGE_DATA_CAPTURED, aud_msg.id);
+  EXPECT_EQ(CRAS_THREAD_RUNNING, stream_.thread.state);
+
+  // The stream isn't polled again once the server hangs up.
+  shutdown(sock[1], SHUT_WR);
+  service_shared_streams(&client_, &pollfd, &id, 1);
+  EXPECT_EQ(1, samples_ready_called);
+  EXPECT_EQ(CRAS_THREAD_STOP, stream_.thread.state);
+  DL_DELETE(client_.streams, &stream_);
+}
+
+TEST_F(CrasClientTestSuite, GetStreamTelemetry) {
+  struct cras_audio_shm_telemetry telemetry;
+
+  memset(&telemetry, 0, sizeof(telemetry));
+  DL_APPEND(client_.streams, &stream_);
+
+  // Not connected yet.
+  EXPECT_EQ(-ENODATA, cras_client_get_stream_telemetry(&client_, stream_.id,
+                                                       &telemetry));
+  stream_.shm = InitShm();
+  EXPECT_EQ(-ENODATA, cras_client_get_stream_telemetry(&client_, stream_.id,
+                                                       &telemetry));
+
+  telemetry.dev_delay_frames = 480;
+  telemetry.rate_ratio = 0.999;
+  cras_shm_set_telemetry(stream_.shm, &telemetry);
+  memset(&telemetry, 0, sizeof(telemetry));
+  EXPECT_EQ(0, cras_client_get_stream_telemetry(&client_, stream_.id,
+                                                &telemetry));
+  EXPECT_EQ(480, telemetry.dev_delay_frames);
+  EXPECT_DOUBLE_EQ(0.999, telemetry.rate_ratio);
+
+  EXPECT_EQ(-EINVAL, cras_client_get_stream_telemetry(
+                         &client_, stream_.id + 1, &telemetry));
+  DL_DELETE(client_.streams, &stream_);
+}
+
 TEST_F(CrasClientTestSuite, SetOutputStreamVolume) {
   cras_stream_id_t stream_id;
 
@@ -334,6 +663,64 @@ TEST_F(CrasClientTestSuite, SetInputStreamVolume) {
   EXPECT_EQ(0.6f, cras_shm_get_volume_scaler(stream_.shm));
 }
 
+TEST_F(CrasClientTestSuite, SetStreamEffects) {
+  struct cras_set_stream_effects_message msg;
+  int pipe_fds[2];
+
+  ASSERT_EQ(0, pipe(pipe_fds));
+  client_.server_fd = pipe_fds[1];
+  DL_APPEND(client_.streams, &stream_);
+
+  /* Output streams have no effects. */
+  stream_.direction = CRAS_STREAM_OUTPUT;
+  EXPECT_EQ(-EINVAL, client_thread_set_stream_effects(
+                         &client_, stream_.id, APM_ECHO_CANCELLATION));
+
+  /* The new effects are kept for reconnecting, and sent to the server. */
+  stream_.direction = CRAS_STREAM_INPUT;
+  EXPECT_EQ(0, client_thread_set_stream_effects(&client_, stream_.id,
+                                                APM_NOISE_SUPRESSION));
+  EXPECT_EQ(APM_NOISE_SUPRESSION, stream_.config->effects);
+  ASSERT_EQ(sizeof(msg), read(pipe_fds[0], &msg, sizeof(msg)));
+  EXPECT_EQ(CRAS_SERVER_SET_STREAM_EFFECTS, msg.header.id);
+  EXPECT_EQ(stream_.id, msg.stream_id);
+  EXPECT_EQ(APM_NOISE_SUPRESSION, msg.effects);
+
+  DL_DELETE(client_.streams, &stream_);
+  close(pipe_fds[0]);
+  close(pipe_fds[1]);
+}
+
+TEST_F(CrasClientTestSuite, SetStreamPaused) {
+  struct cras_set_stream_paused_message msg;
+  int pipe_fds[2];
+
+  ASSERT_EQ(0, pipe(pipe_fds));
+  client_.server_fd = pipe_fds[1];
+
+  EXPECT_EQ(-EINVAL,
+            client_thread_set_stream_paused(&client_, stream_.id, 1, 0));
+
+  /* The pause is kept for reconnecting, and sent to the server. */
+  DL_APPEND(client_.streams, &stream_);
+  EXPECT_EQ(0, client_thread_set_stream_paused(&client_, stream_.id, 1, 0));
+  EXPECT_EQ(1, stream_.paused);
+  ASSERT_EQ(sizeof(msg), read(pipe_fds[0], &msg, sizeof(msg)));
+  EXPECT_EQ(CRAS_SERVER_SET_STREAM_PAUSED, msg.header.id);
+  EXPECT_EQ(stream_.id, msg.stream_id);
+  EXPECT_EQ(1, msg.paused);
+
+  EXPECT_EQ(0, client_thread_set_stream_paused(&client_, stream_.id, 0, 20));
+  EXPECT_EQ(0, stream_.paused);
+  ASSERT_EQ(sizeof(msg), read(pipe_fds[0], &msg, sizeof(msg)));
+  EXPECT_EQ(0, msg.paused);
+  EXPECT_EQ(20, msg.fade_in_ms);
+
+  DL_DELETE(client_.streams, &stream_);
+  close(pipe_fds[0]);
+  close(pipe_fds[1]);
+}
+
 TEST(CrasClientTest, InitStreamVolume) {
   cras_stream_id_t stream_id;
   struct cras_stream_params config;
@@ -367,6 +754,121 @@ TEST(CrasClientTest, InitStreamVolume) {
   free(cmd_msg.stream);
 }
 
+TEST(CrasClientTest, DevicesReadAgainOnlyWhenSectionChanges) {
+  struct client_int* client_int =
+      static_cast<struct client_int*>(calloc(1, sizeof(*client_int)));
+  struct cras_client* client = &client_int->client;
+  struct cras_server_state* state =
+      static_cast<struct cras_server_state*>(calloc(1, sizeof(*state)));
+  struct cras_iodev_info devs[CRAS_MAX_IODEVS];
+  struct cras_ionode_info nodes[CRAS_MAX_IONODES];
+  size_t num_devs, num_nodes;
+
+  pthread_rwlock_init(&client_int->server_state_rwlock, NULL);
+  pthread_mutex_init(&client_int->dev_cache_lock, NULL);
+  invalidate_dev_cache(client_int);
+  client->server_state = state;
+
+  state->num_output_devs = 1;
+  state->output_devs[0].idx = 5;
+  state->num_output_nodes = 1;
+  state->output_nodes[0].iodev_idx = 5;
+  num_devs = CRAS_MAX_IODEVS;
+  num_nodes = CRAS_MAX_IONODES;
+  EXPECT_EQ(0, cras_client_get_output_devices(client, devs, nodes, &num_devs,
+                                              &num_nodes));
+  EXPECT_EQ(1, num_devs);
+  EXPECT_EQ(5, devs[0].idx);
+  EXPECT_EQ(1, num_nodes);
+
+  // Updates of other parts of the state don't invalidate the local copy.
+  state->output_devs[0].idx = 6;
+  state->update_count += 2;
+  state->section_update_count[CRAS_STATE_STREAMS] += 2;
+  state->section_update_count[CRAS_STATE_INPUT_DEVS] += 2;
+  num_devs = CRAS_MAX_IODEVS;
+  num_nodes = CRAS_MAX_IONODES;
+  EXPECT_EQ(0, cras_client_get_output_devices(client, devs, nodes, &num_devs,
+                                              &num_nodes));
+  EXPECT_EQ(5, devs[0].idx);
+
+  state->section_update_count[CRAS_STATE_OUTPUT_DEVS] += 2;
+  num_devs = 1;
+  num_nodes = 0;
+  EXPECT_EQ(0, cras_client_get_output_devices(client, devs, nodes, &num_devs,
+                                              &num_nodes));
+  EXPECT_EQ(1, num_devs);
+  EXPECT_EQ(6, devs[0].idx);
+  EXPECT_EQ(0, num_nodes);
+
+  num_devs = CRAS_MAX_IODEVS;
+  num_nodes = CRAS_MAX_IONODES;
+  EXPECT_EQ(0, cras_client_get_input_devices(client, devs, nodes, &num_devs,
+                                             &num_nodes));
+  EXPECT_EQ(0, num_devs);
+  EXPECT_EQ(0, num_nodes);
+
+  pthread_mutex_destroy(&client_int->dev_cache_lock);
+  pthread_rwlock_destroy(&client_int->server_state_rwlock);
+  free(state);
+  free(client_int);
+}
+
+TEST(CrasClientTest, StreamParamsMatchDeviceFormat) {
+  struct client_int* client_int =
+      static_cast<struct client_int*>(calloc(1, sizeof(*client_int)));
+  struct cras_client* client = &client_int->client;
+  struct cras_server_state* state =
+      static_cast<struct cras_server_state*>(calloc(1, sizeof(*state)));
+  struct cras_audio_format fmt = {SND_PCM_FORMAT_S16_LE, 44100, 2};
+  struct cras_audio_format matched;
+  struct cras_stream_params* params;
+
+  pthread_rwlock_init(&client_int->server_state_rwlock, NULL);
+  pthread_mutex_init(&client_int->dev_cache_lock, NULL);
+  invalidate_dev_cache(client_int);
+  client->server_state = state;
+  params = cras_client_stream_params_create(
+      CRAS_STREAM_OUTPUT, 480, 240, 0, CRAS_STREAM_TYPE_DEFAULT, 0, NULL, NULL,
+      NULL, &fmt);
+
+  state->num_output_devs = 2;
+  state->output_devs[0].idx = 5;
+  state->output_devs[1].idx = 6;
+  state->num_output_nodes = 2;
+  state->output_nodes[0].iodev_idx = 5;
+  state->output_nodes[1].iodev_idx = 6;
+  state->output_nodes[1].active = 1;
+
+  // The active device hasn't opened yet, the stream keeps its format.
+  EXPECT_EQ(-ENODATA, cras_client_stream_params_match_device(
+                          client, params, NO_DEVICE, &matched));
+  EXPECT_EQ(44100, matched.frame_rate);
+
+  state->output_devs[1].preferred_rate = 48000;
+  state->output_devs[1].preferred_num_channels = 6;
+  state->output_devs[1].preferred_format = SND_PCM_FORMAT_S32_LE;
+  state->section_update_count[CRAS_STATE_OUTPUT_DEVS] += 2;
+  EXPECT_EQ(0, cras_client_stream_params_match_device(client, params,
+                                                      NO_DEVICE, &matched));
+  EXPECT_EQ(48000, matched.frame_rate);
+  EXPECT_EQ(6, matched.num_channels);
+  EXPECT_EQ(SND_PCM_FORMAT_S32_LE, matched.format);
+  EXPECT_EQ(5, matched.channel_layout[CRAS_CH_LFE]);
+  EXPECT_EQ(-1, matched.channel_layout[CRAS_CH_RC]);
+
+  EXPECT_EQ(-ENODATA, cras_client_get_preferred_format(
+                          client, CRAS_STREAM_OUTPUT, 5, &matched));
+  EXPECT_EQ(-ENODEV, cras_client_get_preferred_format(
+                         client, CRAS_STREAM_OUTPUT, 7, &matched));
+
+  cras_client_stream_params_destroy(params);
+  pthread_mutex_destroy(&client_int->dev_cache_lock);
+  pthread_rwlock_destroy(&client_int->server_state_rwlock);
+  free(state);
+  free(client_int);
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -379,6 +881,7 @@ extern "C" {
 
 ssize_t sendmsg(int sockfd, const struct msghdr* msg, int flags) {
   ++sendmsg_called;
+  sendmsg_len = msg->msg_iov->iov_len;
   return msg->msg_iov->iov_len;
 }
 
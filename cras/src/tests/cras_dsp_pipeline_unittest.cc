@@ -9,6 +9,11 @@
 #include "cras_config.h"
 #include "cras_dsp_module.h"
 
+extern "C" {
+#include "audio_thread_log.h"
+#include "cras_mix_pool.h"
+}
+
 #define MAX_MODULES 10
 #define MAX_MOCK_PORTS 30
 #define FILENAME_TEMPLATE "DspIniTest.XXXXXX"
@@ -60,6 +65,7 @@ struct data {
   int deinstantiate_called;
   int free_module_called;
   int get_properties_called;
+  int controls_changed_called;
 };
 
 static int instantiate(struct dsp_module* module, unsigned long sample_rate) {
@@ -137,6 +143,11 @@ static int get_properties(struct dsp_module* module) {
 }
 static void dump(struct dsp_module* module, struct dumper* d) {}
 
+static void controls_changed(struct dsp_module* module) {
+  struct data* data = (struct data*)module->data;
+  data->controls_changed_called++;
+}
+
 static struct dsp_module* create_mock_module(struct plugin* plugin) {
   struct data* data;
   struct dsp_module* module;
@@ -176,12 +187,15 @@ static struct dsp_module* create_mock_module(struct plugin* plugin) {
   module->free_module = &free_module;
   module->get_properties = &get_properties;
   module->dump = &dump;
+  module->controls_changed = &controls_changed;
   return module;
 }
 
 static struct dsp_module* modules[MAX_MODULES];
 static struct dsp_module* cras_dsp_module_set_sink_ext_module_val;
 static int num_modules;
+static int cras_mix_pool_run_called;
+static unsigned int cras_mix_pool_run_jobs;
 static struct dsp_module* find_module(const char* name) {
   for (int i = 0; i < num_modules; i++) {
     struct data* data = (struct data*)modules[i]->data;
@@ -204,6 +218,19 @@ void cras_dsp_module_set_sink_ext_module(struct dsp_module* module,
                                          struct ext_dsp_module* ext_module) {
   cras_dsp_module_set_sink_ext_module_val = module;
 }
+struct audio_thread_event_log* atlog;
+
+void cras_mix_pool_run(struct cras_mix_pool* pool,
+                       cras_mix_pool_job_fn fn,
+                       void* jobs,
+                       size_t job_size,
+                       unsigned int num_jobs) {
+  cras_mix_pool_run_called++;
+  cras_mix_pool_run_jobs += num_jobs;
+  /* Run backwards, jobs of a level must not depend on each other. */
+  for (unsigned int i = num_jobs; i > 0; i--)
+    fn((uint8_t*)jobs + (i - 1) * job_size);
+}
 }
 
 namespace {
@@ -212,6 +239,10 @@ class DspPipelineTestSuite : public testing::Test {
  protected:
   virtual void SetUp() {
     num_modules = 0;
+    cras_mix_pool_run_called = 0;
+    cras_mix_pool_run_jobs = 0;
+    atlog = static_cast<struct audio_thread_event_log*>(
+        calloc(1, sizeof(*atlog)));
     strcpy(filename, FILENAME_TEMPLATE);
     int fd = mkstemp(filename);
     fp = fdopen(fd, "w");
@@ -220,6 +251,7 @@ class DspPipelineTestSuite : public testing::Test {
   virtual void TearDown() {
     CloseFile();
     unlink(filename);
+    free(atlog);
   }
 
   virtual void CloseFile() {
@@ -350,6 +382,75 @@ TEST_F(DspPipelineTestSuite, Simple) {
   really_free_module(m2);
 }
 
+TEST_F(DspPipelineTestSuite, SetControl) {
+  const char* content =
+      "[M1]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=capture\n"
+      "output_0={audio}\n"
+      "output_1=<control>\n"
+      "input_2=3.0\n"
+      "[M2]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=capture\n"
+      "input_0=<control>\n"
+      "input_1={audio}\n"
+      "\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  struct cras_expr_env env = CRAS_EXPR_ENV_INIT;
+  struct ini* ini = cras_dsp_ini_create(filename);
+  ASSERT_TRUE(ini);
+  struct pipeline* p = cras_dsp_pipeline_create(ini, &env, "capture");
+  ASSERT_TRUE(p);
+  ASSERT_EQ(0, cras_dsp_pipeline_load(p));
+  ASSERT_EQ(0, cras_dsp_pipeline_instantiate(p, 48000));
+
+  struct dsp_module* m1 = find_module("m1");
+  struct dsp_module* m2 = find_module("m2");
+  struct data* d1 = (struct data*)m1->data;
+  struct data* d2 = (struct data*)m2->data;
+
+  /* The value waits for the next block. */
+  EXPECT_EQ(0, cras_dsp_pipeline_set_control(p, "m1", 2, 5.0));
+  EXPECT_EQ(0, d1->controls_changed_called);
+  cras_dsp_pipeline_run(p, DSP_BUFFER_SIZE);
+  EXPECT_EQ(1, d1->controls_changed_called);
+  EXPECT_EQ(5, d1->input[2]);
+  EXPECT_EQ(5, d2->input[0]);
+  cras_dsp_pipeline_run(p, DSP_BUFFER_SIZE);
+  EXPECT_EQ(1, d1->controls_changed_called);
+
+  /* Unknown plugin, output port and port fed by another plugin. */
+  EXPECT_EQ(-ENOENT, cras_dsp_pipeline_set_control(p, "m3", 2, 1.0));
+  EXPECT_EQ(-EINVAL, cras_dsp_pipeline_set_control(p, "m1", 1, 1.0));
+  EXPECT_EQ(-EINVAL, cras_dsp_pipeline_set_control(p, "m2", 0, 1.0));
+
+  /* The queue holds a bounded number of values between blocks. */
+  int queued = 0;
+  while (cras_dsp_pipeline_set_control(p, "m1", 2, queued) == 0)
+    queued++;
+  EXPECT_GT(queued, 0);
+  EXPECT_EQ(-EAGAIN, cras_dsp_pipeline_set_control(p, "m1", 2, 7.0));
+  cras_dsp_pipeline_run(p, DSP_BUFFER_SIZE);
+  EXPECT_EQ(queued - 1, d1->input[2]);
+  EXPECT_EQ(0, cras_dsp_pipeline_set_control(p, "m1", 2, 7.0));
+
+  /* Modules without the hook must be reloaded instead. */
+  m1->controls_changed = NULL;
+  EXPECT_EQ(-ENOTSUP, cras_dsp_pipeline_set_control(p, "m1", 2, 1.0));
+
+  cras_dsp_pipeline_free(p);
+  cras_dsp_ini_free(ini);
+  cras_expr_env_free(&env);
+
+  really_free_module(m1);
+  really_free_module(m2);
+}
+
 TEST_F(DspPipelineTestSuite, Complex) {
   /*
    *                   / --(b)-- 2 --(c)-- \
@@ -457,6 +558,10 @@ TEST_F(DspPipelineTestSuite, Complex) {
   ASSERT_EQ(d1->data_location[2], d2->data_location[0]);
   ASSERT_EQ(d1->data_location[3], d3->data_location[0]);
   ASSERT_NE(d2->data_location[0], d2->data_location[1]); /* inplace-broken */
+  /* The others write their outputs over their inputs. */
+  ASSERT_EQ(d1->data_location[0], d1->data_location[2]);
+  ASSERT_EQ(d1->data_location[1], d1->data_location[3]);
+  ASSERT_EQ(d3->data_location[0], d3->data_location[1]);
   ASSERT_EQ(d2->data_location[1], d5->data_location[0]); /* m4 is disabled */
   ASSERT_EQ(d3->data_location[1], d5->data_location[1]);
 
@@ -510,6 +615,405 @@ TEST_F(DspPipelineTestSuite, Complex) {
   really_free_module(m5);
 }
 
+TEST_F(DspPipelineTestSuite, FusedStereoOp) {
+  const char* content =
+      "[M0]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=playback\n"
+      "output_0={a0}\n"
+      "output_1={a1}\n"
+      "[M1]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=playback\n"
+      "input_0={a0}\n"
+      "input_1={a1}\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  /* The ini inserts a swap_lr plugin in front of the playback sink. */
+  struct cras_expr_env env = CRAS_EXPR_ENV_INIT;
+  cras_expr_env_install_builtins(&env);
+  cras_expr_env_set_variable_boolean(&env, "swap_lr_disabled", 0);
+  struct ini* ini = cras_dsp_ini_create(filename);
+  ASSERT_TRUE(ini);
+  struct pipeline* p = cras_dsp_pipeline_create(ini, &env, "playback");
+  ASSERT_TRUE(p);
+  ASSERT_EQ(0, cras_dsp_pipeline_load(p));
+  ASSERT_EQ(0, cras_dsp_pipeline_instantiate(p, 48000));
+
+  struct data* d1 = (struct data*)find_module("swap_lr")->data;
+  int16_t samples[200];
+  fill_test_data(samples, 200);
+
+  /* swap_lr feeds the sink, so it is applied while interleaving. */
+  cras_dsp_pipeline_apply(p, (uint8_t*)samples, SND_PCM_FORMAT_S16_LE, 100);
+  EXPECT_EQ(0, d1->run_called);
+  for (int i = 0; i < 200; i += 2) {
+    EXPECT_EQ(i + 1, samples[i]);
+    EXPECT_EQ(i, samples[i + 1]);
+  }
+
+  /* The ext module reads the sink buffers, so the module must run. */
+  cras_dsp_pipeline_set_sink_ext_module(p, &ext_mod);
+  fill_test_data(samples, 200);
+  cras_dsp_pipeline_apply(p, (uint8_t*)samples, SND_PCM_FORMAT_S16_LE, 100);
+  EXPECT_EQ(1, d1->run_called);
+  verify_processed_data(samples, 200, 1);
+
+  cras_dsp_pipeline_free(p);
+  cras_dsp_ini_free(ini);
+  cras_expr_env_free(&env);
+
+  for (int i = 0; i < num_modules; i++)
+    really_free_module(modules[i]);
+}
+
+TEST_F(DspPipelineTestSuite, SetSwapLr) {
+  const char* content =
+      "[M0]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=playback\n"
+      "output_0={a0}\n"
+      "output_1={a1}\n"
+      "[M1]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=playback\n"
+      "input_0={a0}\n"
+      "input_1={a1}\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  /* Built without the swap_lr instance. */
+  struct cras_expr_env env = CRAS_EXPR_ENV_INIT;
+  cras_expr_env_install_builtins(&env);
+  cras_expr_env_set_variable_boolean(&env, "swap_lr_disabled", 1);
+  struct ini* ini = cras_dsp_ini_create(filename);
+  ASSERT_TRUE(ini);
+  struct pipeline* p = cras_dsp_pipeline_create(ini, &env, "playback");
+  ASSERT_TRUE(p);
+  ASSERT_EQ(0, cras_dsp_pipeline_load(p));
+  ASSERT_EQ(0, cras_dsp_pipeline_instantiate(p, 48000));
+  EXPECT_EQ(NULL, find_module("swap_lr"));
+
+  int16_t samples[200];
+  fill_test_data(samples, 200);
+  EXPECT_EQ(0, cras_dsp_pipeline_set_swap_lr(p, 1));
+  cras_dsp_pipeline_apply(p, (uint8_t*)samples, SND_PCM_FORMAT_S16_LE, 100);
+  for (int i = 0; i < 200; i += 2) {
+    EXPECT_EQ(i + 1, samples[i]);
+    EXPECT_EQ(i, samples[i + 1]);
+  }
+
+  fill_test_data(samples, 200);
+  EXPECT_EQ(0, cras_dsp_pipeline_set_swap_lr(p, 0));
+  cras_dsp_pipeline_apply(p, (uint8_t*)samples, SND_PCM_FORMAT_S16_LE, 100);
+  verify_processed_data(samples, 200, 0);
+
+  /* The ext module must see the swapped channels, needs a reload. */
+  cras_dsp_pipeline_set_sink_ext_module(p, &ext_mod);
+  EXPECT_EQ(-ENOTSUP, cras_dsp_pipeline_set_swap_lr(p, 1));
+
+  cras_dsp_pipeline_free(p);
+  cras_dsp_ini_free(ini);
+  cras_expr_env_free(&env);
+
+  for (int i = 0; i < num_modules; i++)
+    really_free_module(modules[i]);
+}
+
+TEST_F(DspPipelineTestSuite, FloatHandoff) {
+  const char* content =
+      "[M0]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=playback\n"
+      "output_0={a0}\n"
+      "output_1={a1}\n"
+      "[M1]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=playback\n"
+      "input_0={a0}\n"
+      "input_1={a1}\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  struct cras_expr_env env = CRAS_EXPR_ENV_INIT;
+  cras_expr_env_install_builtins(&env);
+  cras_expr_env_set_variable_boolean(&env, "swap_lr_disabled", 0);
+  struct ini* ini = cras_dsp_ini_create(filename);
+  ASSERT_TRUE(ini);
+  struct pipeline* p = cras_dsp_pipeline_create(ini, &env, "playback");
+  ASSERT_TRUE(p);
+  ASSERT_EQ(0, cras_dsp_pipeline_load(p));
+  ASSERT_EQ(0, cras_dsp_pipeline_instantiate(p, 48000));
+
+  struct data* d1 = (struct data*)find_module("swap_lr")->data;
+
+  /* Interleaved float is passed through untouched but for the fused swap. */
+  float samples[200];
+  for (int i = 0; i < 200; i++)
+    samples[i] = i / 256.0f;
+  EXPECT_EQ(0, cras_dsp_pipeline_apply(p, (uint8_t*)samples,
+                                       SND_PCM_FORMAT_FLOAT_LE, 100));
+  EXPECT_EQ(0, d1->run_called);
+  for (int i = 0; i < 200; i += 2) {
+    EXPECT_EQ((i + 1) / 256.0f, samples[i]);
+    EXPECT_EQ(i / 256.0f, samples[i + 1]);
+  }
+
+  /* So is a float mix ramped on the way out. Ramping runs the module, which
+   * doubles, and the ramp halves it back. */
+  EXPECT_EQ(0, cras_dsp_pipeline_apply_ramp(p, (uint8_t*)samples,
+                                            SND_PCM_FORMAT_FLOAT_LE, 100, 0.5f,
+                                            0.0f, 0.5f));
+  EXPECT_EQ(1, d1->run_called);
+  for (int i = 0; i < 200; i += 2) {
+    EXPECT_EQ((i + 1) / 256.0f, samples[i]);
+    EXPECT_EQ(i / 256.0f, samples[i + 1]);
+  }
+
+  /* Planar float runs every module, in place across blocks. */
+  cras_dsp_pipeline_set_cb_level(p, DSP_BUFFER_SIZE * 4);
+  unsigned int frames = cras_dsp_pipeline_get_block_size(p) * 2 + 3;
+  float* left = (float*)calloc(frames, sizeof(float));
+  float* right = (float*)calloc(frames, sizeof(float));
+  for (unsigned int i = 0; i < frames; i++) {
+    left[i] = i;
+    right[i] = -(float)i;
+  }
+  float* planes[2] = {left, right};
+  EXPECT_EQ(0, cras_dsp_pipeline_apply_planar(p, planes, planes, frames));
+  EXPECT_EQ(4, d1->run_called);
+  for (unsigned int i = 0; i < frames; i++) {
+    EXPECT_EQ(i * 2.0f, left[i]);
+    EXPECT_EQ(i * -2.0f, right[i]);
+  }
+  free(left);
+  free(right);
+
+  cras_dsp_pipeline_free(p);
+  cras_dsp_ini_free(ini);
+  cras_expr_env_free(&env);
+
+  for (int i = 0; i < num_modules; i++)
+    really_free_module(modules[i]);
+}
+
+TEST_F(DspPipelineTestSuite, ApplyRamp) {
+  const char* content =
+      "[M0]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=playback\n"
+      "output_0={a0}\n"
+      "output_1={a1}\n"
+      "[M1]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=playback\n"
+      "input_0={a0}\n"
+      "input_1={a1}\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  struct cras_expr_env env = CRAS_EXPR_ENV_INIT;
+  cras_expr_env_install_builtins(&env);
+  cras_expr_env_set_variable_boolean(&env, "swap_lr_disabled", 0);
+  struct ini* ini = cras_dsp_ini_create(filename);
+  ASSERT_TRUE(ini);
+  struct pipeline* p = cras_dsp_pipeline_create(ini, &env, "playback");
+  ASSERT_TRUE(p);
+  ASSERT_EQ(0, cras_dsp_pipeline_load(p));
+  ASSERT_EQ(0, cras_dsp_pipeline_instantiate(p, 48000));
+
+  struct data* d1 = (struct data*)find_module("swap_lr")->data;
+
+  /* The output is scaled along the ramp as it is interleaved, which takes
+   * the place of the fused swap, so the module runs. */
+  float samples[200];
+  for (int i = 0; i < 200; i++)
+    samples[i] = i / 256.0f;
+  EXPECT_EQ(0, cras_dsp_pipeline_apply_ramp(p, (uint8_t*)samples,
+                                            SND_PCM_FORMAT_FLOAT_LE, 100, 0.25f,
+                                            0.001f, 0.3f));
+  EXPECT_EQ(1, d1->run_called);
+  for (int i = 0; i < 100; i++) {
+    float scaler = std::min(0.25f + 0.001f * i, 0.3f);
+    EXPECT_FLOAT_EQ(i * 2 / 256.0f * 2 * scaler, samples[i * 2]);
+    EXPECT_FLOAT_EQ((i * 2 + 1) / 256.0f * 2 * scaler, samples[i * 2 + 1]);
+  }
+
+  cras_dsp_pipeline_free(p);
+  cras_dsp_ini_free(ini);
+  cras_expr_env_free(&env);
+
+  for (int i = 0; i < num_modules; i++)
+    really_free_module(modules[i]);
+}
+
+TEST_F(DspPipelineTestSuite, BlockSize) {
+  const char* content =
+      "[M0]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=playback\n"
+      "output_0={a0}\n"
+      "output_1={a1}\n"
+      "[M1]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=playback\n"
+      "input_0={a0}\n"
+      "input_1={a1}\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  struct cras_expr_env env = CRAS_EXPR_ENV_INIT;
+  struct ini* ini = cras_dsp_ini_create(filename);
+  ASSERT_TRUE(ini);
+  struct pipeline* p = cras_dsp_pipeline_create(ini, &env, "playback");
+  ASSERT_TRUE(p);
+  ASSERT_EQ(0, cras_dsp_pipeline_load(p));
+
+  unsigned int max_block = cras_dsp_pipeline_get_block_size(p);
+  EXPECT_GE(max_block, 64);
+  EXPECT_LE(max_block, DSP_BUFFER_SIZE);
+
+  /* Callbacks that fit are processed in one block. */
+  cras_dsp_pipeline_set_cb_level(p, 32);
+  EXPECT_EQ(max_block, cras_dsp_pipeline_get_block_size(p));
+
+  /* Larger callbacks are split into blocks of about the same size. */
+  unsigned int cb_level = max_block * 2 + 10;
+  cras_dsp_pipeline_set_cb_level(p, cb_level);
+  EXPECT_EQ((cb_level + 2) / 3, cras_dsp_pipeline_get_block_size(p));
+
+  cras_dsp_pipeline_free(p);
+  cras_dsp_ini_free(ini);
+  cras_expr_env_free(&env);
+
+  for (int i = 0; i < num_modules; i++)
+    really_free_module(modules[i]);
+}
+
+TEST_F(DspPipelineTestSuite, ParallelLevels) {
+  /*
+   *        / --(a0)-- 1 --(b0)-- 3 --(c0)-- \
+   *   0 ==                                    5
+   *        \ --(a1)-- 2 --(b1)-- 4 --(c1)-- /
+   */
+  const char* content =
+      "[M0]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=playback\n"
+      "output_0={a0}\n"
+      "output_1={a1}\n"
+      "[M1]\n"
+      "library=builtin\n"
+      "label=foo\n"
+      "input_0={a0}\n"
+      "output_1={b0}\n"
+      "[M2]\n"
+      "library=builtin\n"
+      "label=foo\n"
+      "input_0={a1}\n"
+      "output_1={b1}\n"
+      "[M3]\n"
+      "library=builtin\n"
+      "label=foo\n"
+      "input_0={b0}\n"
+      "output_1={c0}\n"
+      "[M4]\n"
+      "library=builtin\n"
+      "label=foo\n"
+      "input_0={b1}\n"
+      "output_1={c1}\n"
+      "[M5]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=playback\n"
+      "input_0={c0}\n"
+      "input_1={c1}\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  struct cras_expr_env env = CRAS_EXPR_ENV_INIT;
+  cras_expr_env_install_builtins(&env);
+  cras_expr_env_set_variable_boolean(&env, "swap_lr_disabled", 1);
+  struct ini* ini = cras_dsp_ini_create(filename);
+  ASSERT_TRUE(ini);
+  struct pipeline* p = cras_dsp_pipeline_create(ini, &env, "playback");
+  ASSERT_TRUE(p);
+  ASSERT_EQ(0, cras_dsp_pipeline_load(p));
+  ASSERT_EQ(0, cras_dsp_pipeline_instantiate(p, 48000));
+
+  /* Instances of a level don't reuse each other's buffers, but each one
+   * runs in place on its own. */
+  ASSERT_EQ(2, cras_dsp_pipeline_get_peak_audio_buffers(p));
+  for (int i = 1; i <= 4; i++) {
+    char name[3] = {'m', (char)('0' + i), 0};
+    struct data* d = (struct data*)find_module(name)->data;
+    ASSERT_EQ(d->data_location[0], d->data_location[1]);
+  }
+  ASSERT_NE(((struct data*)find_module("m1")->data)->data_location[0],
+            ((struct data*)find_module("m2")->data)->data_location[0]);
+
+  cras_dsp_pipeline_set_worker_pool(
+      reinterpret_cast<struct cras_mix_pool*>(0x55));
+
+  int16_t* samples = new int16_t[1024];
+  fill_test_data(samples, 1024);
+  cras_dsp_pipeline_apply(p, (uint8_t*)samples, SND_PCM_FORMAT_S16_LE, 512);
+  verify_processed_data(samples, 1024, 2);
+  /* Levels 1 and 2 have two instances each. */
+  EXPECT_EQ(2, cras_mix_pool_run_called);
+  EXPECT_EQ(4, cras_mix_pool_run_jobs);
+
+  /* Small blocks run serially with the same result. */
+  fill_test_data(samples, 1024);
+  cras_dsp_pipeline_apply(p, (uint8_t*)samples, SND_PCM_FORMAT_S16_LE, 64);
+  verify_processed_data(samples, 128, 2);
+  EXPECT_EQ(2, cras_mix_pool_run_called);
+  delete[] samples;
+
+  for (int i = 1; i <= 4; i++) {
+    char name[3] = {'m', (char)('0' + i), 0};
+    EXPECT_EQ(2, ((struct data*)find_module(name)->data)->run_called);
+  }
+
+  /* Runs on the pool and on this thread both count. */
+  for (int i = 0; i < 6; i++) {
+    const struct dsp_run_stats* stats = cras_dsp_pipeline_get_run_stats(p, i);
+    uint32_t sum = 0;
+
+    ASSERT_TRUE(stats);
+    EXPECT_EQ(2, stats->runs);
+    for (int k = 0; k < DSP_RUN_TIME_BUCKETS; k++)
+      sum += stats->histogram[k];
+    EXPECT_EQ(2, sum);
+    EXPECT_LE(stats->max_time, stats->total_time);
+  }
+  EXPECT_EQ((void*)NULL, cras_dsp_pipeline_get_run_stats(p, 6));
+  EXPECT_EQ((void*)NULL, cras_dsp_pipeline_get_run_stats(p, -1));
+  /* New slowest runs are logged. */
+  EXPECT_LT(0, atlog->write_pos);
+
+  cras_dsp_pipeline_set_worker_pool(NULL);
+
+  cras_dsp_pipeline_free(p);
+  cras_dsp_ini_free(ini);
+  cras_expr_env_free(&env);
+
+  for (int i = 0; i < num_modules; i++)
+    really_free_module(modules[i]);
+}
+
 }  //  namespace
 
 int main(int argc, char** argv) {
@@ -180,6 +180,96 @@ TEST_F(TimerTestSuite, AddTwoTimers) {
   cras_tm_cancel_timer(tm_, t1);
 }
 
+static unsigned int fired_order[16];
+static unsigned int num_fired;
+
+void record_cb(struct cras_timer* t, void* data) {
+  fired_order[num_fired++] = (uintptr_t)data;
+}
+
+TEST_F(TimerTestSuite, ManyTimersFireInOrder) {
+  static const unsigned int timeouts[] = {50, 10, 80, 30, 20, 70, 60, 40};
+  static const unsigned int num = sizeof(timeouts) / sizeof(timeouts[0]);
+  struct cras_timer* timers[num];
+  struct timespec ts;
+  unsigned int i;
+
+  time_now.tv_sec = 0;
+  time_now.tv_nsec = 0;
+  for (i = 0; i < num; i++) {
+    timers[i] = cras_tm_create_timer(tm_, timeouts[i], record_cb,
+                                     (void*)(uintptr_t)timeouts[i]);
+    ASSERT_TRUE(timers[i]);
+  }
+
+  // Cancel the soonest and one in the middle.
+  cras_tm_cancel_timer(tm_, timers[1]);
+  cras_tm_cancel_timer(tm_, timers[3]);
+
+  ASSERT_TRUE(cras_tm_get_next_timeout(tm_, &ts));
+  EXPECT_EQ(0, ts.tv_sec);
+  EXPECT_EQ(20 * 1000000, ts.tv_nsec);
+
+  num_fired = 0;
+  time_now.tv_nsec = 55 * 1000000;
+  cras_tm_call_callbacks(tm_);
+  ASSERT_EQ(3, num_fired);
+  EXPECT_EQ(20, fired_order[0]);
+  EXPECT_EQ(40, fired_order[1]);
+  EXPECT_EQ(50, fired_order[2]);
+
+  ASSERT_TRUE(cras_tm_get_next_timeout(tm_, &ts));
+  EXPECT_EQ(5 * 1000000, ts.tv_nsec);
+
+  time_now.tv_sec = 1;
+  cras_tm_call_callbacks(tm_);
+  ASSERT_EQ(6, num_fired);
+  EXPECT_EQ(60, fired_order[3]);
+  EXPECT_EQ(70, fired_order[4]);
+  EXPECT_EQ(80, fired_order[5]);
+  EXPECT_FALSE(cras_tm_get_next_timeout(tm_, &ts));
+}
+
+TEST_F(TimerTestSuite, SlackTimersShareWakeUps) {
+  struct timespec ts;
+
+  time_now.tv_sec = 0;
+  time_now.tv_nsec = 0;
+  ASSERT_TRUE(cras_tm_create_timer(tm_, 10, record_cb, (void*)10));
+  ASSERT_TRUE(cras_tm_create_timer_slack(tm_, 5, 20, record_cb, (void*)5));
+  ASSERT_TRUE(cras_tm_create_timer(tm_, 30, record_cb, (void*)30));
+
+  // The slack timer doesn't need its own wake up.
+  ASSERT_TRUE(cras_tm_get_next_timeout(tm_, &ts));
+  EXPECT_EQ(0, ts.tv_sec);
+  EXPECT_EQ(10 * 1000000, ts.tv_nsec);
+
+  // It fires along with the next timer, in the order they expired.
+  num_fired = 0;
+  time_now.tv_nsec = 10 * 1000000;
+  cras_tm_call_callbacks(tm_);
+  ASSERT_EQ(2, num_fired);
+  EXPECT_EQ(5, fired_order[0]);
+  EXPECT_EQ(10, fired_order[1]);
+
+  // Alone, a slack timer wakes up at the end of its slack.
+  ASSERT_TRUE(cras_tm_create_timer_slack(tm_, 30, 15, record_cb, (void*)40));
+  ASSERT_TRUE(cras_tm_get_next_timeout(tm_, &ts));
+  EXPECT_EQ(20 * 1000000, ts.tv_nsec);
+  time_now.tv_nsec = 30 * 1000000;
+  cras_tm_call_callbacks(tm_);
+  ASSERT_EQ(3, num_fired);
+  EXPECT_EQ(30, fired_order[2]);
+  ASSERT_TRUE(cras_tm_get_next_timeout(tm_, &ts));
+  EXPECT_EQ(25 * 1000000, ts.tv_nsec);
+
+  time_now.tv_nsec = 40 * 1000000;
+  cras_tm_call_callbacks(tm_);
+  ASSERT_EQ(4, num_fired);
+  EXPECT_EQ(40, fired_order[3]);
+  EXPECT_FALSE(cras_tm_get_next_timeout(tm_, &ts));
+}
+
 /* Stubs */
 extern "C" {
 
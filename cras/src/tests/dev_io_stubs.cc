@@ -34,7 +34,7 @@ ShmPtr create_shm(size_t cb_threshold) {
   shm->header->config.frame_bytes = frame_bytes;
   shm->config = shm->header->config;
 
-  uint32_t samples_size = cras_shm_calculate_samples_size(used_size);
+  uint32_t samples_size = cras_shm_calculate_samples_size(used_size, 0);
   shm->samples = reinterpret_cast<uint8_t*>(calloc(1, samples_size));
   shm->samples_info.length = samples_size;
   return shm;
@@ -145,6 +145,10 @@ DevicePtr create_device(CRAS_STREAM_DIRECTION direction,
 
 void add_stream_to_dev(IodevPtr& dev, const StreamPtr& stream) {
   DL_APPEND(dev->streams, stream->dstream.get());
+  cras_iodev_update_stream_refs(dev.get());
+  if (dev->direction == CRAS_STREAM_OUTPUT &&
+      !(stream->rstream->flags & USE_DEV_TIMING))
+    cras_wake_heap_add(stream->rstream.get());
   dev->min_cb_level = std::min(stream->rstream->cb_threshold,
                                static_cast<size_t>(dev->min_cb_level));
   dev->max_cb_level = std::max(stream->rstream->cb_threshold,
@@ -13,6 +13,7 @@ extern "C" {
 #include "cras_rstream.h"
 #include "cras_shm.h"
 #include "cras_types.h"
+#include "cras_wake_heap.h"
 #include "dev_io.h"
 #include "dev_stream.h"
 #include "utlist.h"
@@ -39,6 +40,10 @@ struct Stream {
       : shm(std::move(shm)),
         rstream(std::move(rstream)),
         dstream(std::move(dstream)) {}
+  ~Stream() {
+    while (rstream && rstream->wake_heap_refs)
+      cras_wake_heap_rm(rstream.get());
+  }
   ShmPtr shm;
   RstreamPtr rstream;
   DevStreamPtr dstream;
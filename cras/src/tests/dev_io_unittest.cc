@@ -11,6 +11,8 @@
 
 extern "C" {
 #include "cras_iodev.h"    // stubbed
+#include "cras_mix.h"      // stubbed
+#include "cras_mix_pool.h"  // stubbed
 #include "cras_rstream.h"  // stubbed
 #include "cras_shm.h"
 #include "cras_types.h"
@@ -19,6 +21,7 @@ extern "C" {
 #include "utlist.h"
 
 struct audio_thread_event_log* atlog;
+int atlog_workload;
 }
 
 #include "dev_io_stubs.h"
@@ -28,7 +31,17 @@ struct audio_thread_event_log* atlog;
 
 static float dev_stream_capture_software_gain_scaler_val;
 static float input_data_get_software_gain_scaler_val;
+static int input_data_get_for_stream_ret;
+static int input_data_get_planar_for_stream_ret;
+static int dev_stream_can_capture_planar_ret;
+static unsigned int dev_stream_capture_called;
+static unsigned int dev_stream_capture_converted_called;
+static unsigned int dev_stream_capture_planar_called;
 static unsigned int dev_stream_capture_avail_ret = 480;
+static unsigned int dev_stream_set_dev_rate_called;
+static double dev_stream_set_dev_rate_catch_up;
+static unsigned int cras_audio_thread_event_underrun_risk_called;
+static unsigned int dev_stream_fade_in_frames;
 
 namespace {
 
@@ -36,8 +49,19 @@ class DevIoSuite : public testing::Test {
  protected:
   virtual void SetUp() {
     atlog = static_cast<audio_thread_event_log*>(calloc(1, sizeof(*atlog)));
+    atlog_workload = 0;
     iodev_stub_reset();
     rstream_stub_reset();
+    input_data_get_for_stream_ret = 0;
+    input_data_get_planar_for_stream_ret = 0;
+    dev_stream_can_capture_planar_ret = 0;
+    dev_stream_capture_called = 0;
+    dev_stream_capture_converted_called = 0;
+    dev_stream_capture_planar_called = 0;
+    dev_stream_set_dev_rate_called = 0;
+    dev_stream_set_dev_rate_catch_up = 0;
+    cras_audio_thread_event_underrun_risk_called = 0;
+    dev_stream_fade_in_frames = 0;
     fill_audio_format(&format, 48000);
     stream = create_stream(1, 1, CRAS_STREAM_INPUT, cb_threshold, &format);
   }
@@ -95,9 +119,355 @@ TEST_F(DevIoSuite, CaptureGain) {
   EXPECT_FLOAT_EQ(0.42f, dev_stream_capture_software_gain_scaler_val);
 }
 
+static unsigned int count_atlog_events(enum AUDIO_THREAD_LOG_EVENTS event) {
+  unsigned int count = 0;
+
+  for (uint64_t i = 0; i < atlog->write_pos; i++)
+    if ((atlog->log[i].tag_sec >> 24) == event)
+      count++;
+  return count;
+}
+
+TEST_F(DevIoSuite, WorkloadRecordsInputDelay) {
+  struct open_dev* dev_list = NULL;
+  struct timespec ts;
+  DevicePtr dev = create_device(CRAS_STREAM_INPUT, cb_threshold, &format,
+                                CRAS_NODE_TYPE_MIC);
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  dev->dev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+  iodev_stub_frames_queued(dev->dev.get(), 20, ts);
+  DL_APPEND(dev_list, dev->odev.get());
+  add_stream_to_dev(dev->dev, stream);
+
+  // Not logged unless the workload is recorded.
+  dev_io_capture(&dev_list);
+  EXPECT_EQ(0, count_atlog_events(AUDIO_THREAD_DEV_DELAY));
+
+  atlog_workload = 1;
+  dev_io_capture(&dev_list);
+  EXPECT_EQ(1, count_atlog_events(AUDIO_THREAD_DEV_DELAY));
+}
+
+TEST_F(DevIoSuite, PausedStreamSkipsCapture) {
+  struct open_dev* dev_list = NULL;
+  struct timespec ts;
+  DevicePtr dev = create_device(CRAS_STREAM_INPUT, cb_threshold, &format,
+                                CRAS_NODE_TYPE_MIC);
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  dev->dev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+  iodev_stub_frames_queued(dev->dev.get(), 20, ts);
+  DL_APPEND(dev_list, dev->odev.get());
+  add_stream_to_dev(dev->dev, stream);
+
+  // Not attached to any device in the list.
+  StreamPtr other = create_stream(2, 1, CRAS_STREAM_INPUT, cb_threshold,
+                                  &format);
+  other->rstream->paused = 1;
+  EXPECT_EQ(0, dev_io_set_stream_paused(dev_list, other->rstream.get(), 0));
+
+  stream->rstream->paused = 1;
+  EXPECT_EQ(1, dev_io_set_stream_paused(dev_list, stream->rstream.get(), 0));
+  EXPECT_EQ(1, stream->dstream->paused);
+  dev_io_capture(&dev_list);
+  EXPECT_EQ(0, dev_stream_capture_called);
+
+  // Resuming an input stream reads from the next captured frames.
+  stream->rstream->paused = 0;
+  stream->rstream->next_cb_ts = ts;
+  EXPECT_EQ(1, dev_io_set_stream_paused(dev_list, stream->rstream.get(), 10));
+  EXPECT_EQ(0, stream->dstream->paused);
+  EXPECT_EQ(0, stream->rstream->next_cb_ts.tv_sec);
+  EXPECT_EQ(0, dev_stream_fade_in_frames);
+  dev_io_capture(&dev_list);
+  EXPECT_EQ(1, dev_stream_capture_called);
+}
+
+TEST_F(DevIoSuite, CaptureStageStats) {
+  struct open_dev* odev_list = NULL;
+  struct open_dev* idev_list = NULL;
+  struct timespec ts;
+  DevicePtr dev = create_device(CRAS_STREAM_INPUT, cb_threshold, &format,
+                                CRAS_NODE_TYPE_MIC);
+  struct audio_stage_debug_info* stages = dev->odev->stages;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  dev->dev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+  iodev_stub_frames_queued(dev->dev.get(), 20, ts);
+  DL_APPEND(idev_list, dev->odev.get());
+  add_stream_to_dev(dev->dev, stream);
+
+  dev_io_run(&odev_list, &idev_list, NULL);
+  dev_io_run(&odev_list, &idev_list, NULL);
+
+  EXPECT_EQ(2, stages[CRAS_DEV_IO_STAGE_CAPTURE_READ].count);
+  EXPECT_EQ(2, stages[CRAS_DEV_IO_STAGE_CAPTURE_STREAMS].count);
+  EXPECT_EQ(2, stages[CRAS_DEV_IO_STAGE_SEND_CAPTURED].count);
+  EXPECT_EQ(0, stages[CRAS_DEV_IO_STAGE_FETCH].count);
+  EXPECT_EQ(0, stages[CRAS_DEV_IO_STAGE_MIX].count);
+  EXPECT_EQ(0, stages[CRAS_DEV_IO_STAGE_WRITE].count);
+  for (int i = 0; i < CRAS_NUM_DEV_IO_STAGES; i++) {
+    uint32_t binned = 0;
+    for (int j = 0; j < CRAS_DEV_IO_STAGE_HIST_BINS; j++)
+      binned += stages[i].hist[j];
+    EXPECT_EQ(stages[i].count, binned);
+    EXPECT_GE(stages[i].count * stages[i].max_usec, stages[i].total_usec);
+    EXPECT_EQ(0, dev->odev->stage_ns[i]);
+  }
+}
+
+// Wakes on time with 10ms buffered, then wakes 15ms late.
+static void run_late_wake(struct open_dev* adev, unsigned int late_level) {
+  struct timespec now = {.tv_sec = 100, .tv_nsec = 0};
+
+  for (int i = 0; i < 16; i++) {
+    adev->wake_ts = now;
+    dev_io_update_health(adev, 480, &now);
+  }
+  EXPECT_FALSE(adev->health.at_risk);
+  EXPECT_EQ(10000, adev->health.margin_us);
+
+  adev->wake_ts = now;
+  now.tv_nsec = 15000000;
+  dev_io_update_health(adev, late_level, &now);
+}
+
+TEST_F(DevIoSuite, UnderrunRiskDetected) {
+  DevicePtr dev = create_device(CRAS_STREAM_OUTPUT, cb_threshold, &format,
+                                CRAS_NODE_TYPE_INTERNAL_SPEAKER);
+  struct dev_io_health* health = &dev->odev->health;
+
+  run_late_wake(dev->odev.get(), 480);
+  EXPECT_TRUE(health->at_risk);
+  EXPECT_EQ(1, health->num_risks);
+  EXPECT_EQ(1, cras_audio_thread_event_underrun_risk_called);
+  EXPECT_GT(health->lateness_us, 0);
+  // Raising the buffer level isn't enabled.
+  EXPECT_EQ(0, dev->dev->min_buffer_level);
+  EXPECT_EQ(0, health->adjust_frames);
+
+  // Still at risk, don't report it again.
+  dev_io_update_health(dev->odev.get(), 480, &dev->odev->wake_ts);
+  EXPECT_TRUE(health->at_risk);
+  EXPECT_EQ(1, cras_audio_thread_event_underrun_risk_called);
+
+  // Plenty of margin clears the risk.
+  dev_io_update_health(dev->odev.get(), 4800, &dev->odev->wake_ts);
+  EXPECT_FALSE(health->at_risk);
+  EXPECT_EQ(1, health->num_risks);
+}
+
+TEST_F(DevIoSuite, UnderrunRiskRaisesBufferLevel) {
+  DevicePtr dev = create_device(CRAS_STREAM_OUTPUT, cb_threshold, &format,
+                                CRAS_NODE_TYPE_INTERNAL_SPEAKER);
+
+  dev_io_set_adaptive_buffer_max_ms(5);
+  run_late_wake(dev->odev.get(), 100);
+  dev_io_set_adaptive_buffer_max_ms(0);
+
+  EXPECT_TRUE(dev->odev->health.at_risk);
+  // Limited to 5ms of frames.
+  EXPECT_EQ(240, dev->odev->health.adjust_frames);
+  EXPECT_EQ(240, dev->dev->min_buffer_level);
+}
+
+TEST_F(DevIoSuite, UnderrunRaisesBufferLevel) {
+  DevicePtr dev = create_device(CRAS_STREAM_OUTPUT, cb_threshold, &format,
+                                CRAS_NODE_TYPE_INTERNAL_SPEAKER);
+  struct open_dev* adev = dev->odev.get();
+  struct timespec now = {.tv_sec = 100, .tv_nsec = 0};
+
+  dev_io_set_adaptive_buffer_max_ms(5);
+  adev->health.cpu_us = 1000;
+  adev->wake_ts = now;
+  for (int i = 0; i < 16; i++)
+    dev_io_update_health(adev, 480, &now);
+  EXPECT_EQ(0, dev->dev->min_buffer_level);
+
+  // Raised by the 1ms budget.
+  dev->dev->num_underruns = 1;
+  dev_io_update_health(adev, 480, &now);
+  dev_io_set_adaptive_buffer_max_ms(0);
+
+  EXPECT_FALSE(adev->health.at_risk);
+  EXPECT_EQ(48, dev->dev->min_buffer_level);
+  EXPECT_EQ(48, adev->health.adjust_frames);
+}
+
+TEST_F(DevIoSuite, OnTimeWakesLowerBufferLevel) {
+  DevicePtr dev = create_device(CRAS_STREAM_OUTPUT, cb_threshold, &format,
+                                CRAS_NODE_TYPE_INTERNAL_SPEAKER);
+  struct open_dev* adev = dev->odev.get();
+  struct timespec now = {.tv_sec = 100, .tv_nsec = 0};
+
+  dev->dev->min_buffer_level = 240;
+  dev->dev->active_node->adaptive_min_buffer_level = 48;
+  dev->dev->active_node->adaptive_max_buffer_level = 480;
+  adev->health.cpu_us = 1000;
+  adev->wake_ts = now;
+
+  // 15ms of margin for a 1ms budget, lowered by a quarter of the 13ms excess
+  // after 256 wakes.
+  for (int i = 0; i < 300; i++)
+    dev_io_update_health(adev, 480, &now);
+  EXPECT_EQ(83, dev->dev->min_buffer_level);
+  EXPECT_EQ(-157, adev->health.adjust_frames);
+
+  // Never below the bounds of the node.
+  for (int i = 0; i < 1000; i++)
+    dev_io_update_health(adev, 480, &now);
+  EXPECT_EQ(48, dev->dev->min_buffer_level);
+}
+
+TEST_F(DevIoSuite, DeepBufferRewoundWhenStreamStarts) {
+  DevicePtr dev = create_device(CRAS_STREAM_OUTPUT, cb_threshold, &format,
+                                CRAS_NODE_TYPE_INTERNAL_SPEAKER);
+  struct open_dev* adev = dev->odev.get();
+  StreamPtr deep =
+      create_stream(1, 1, CRAS_STREAM_OUTPUT, cb_threshold, &format);
+  StreamPtr other =
+      create_stream(2, 1, CRAS_STREAM_OUTPUT, cb_threshold, &format);
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+  deep->rstream->flags = DEEP_BUFFER;
+  deep->rstream->next_cb_ts = now;
+  deep->rstream->next_cb_ts.tv_sec += 1;
+  other->rstream->next_cb_ts = now;
+  other->dstream->is_running = 0;
+  add_stream_to_dev(dev->dev, deep);
+  add_stream_to_dev(dev->dev, other);
+
+  adev->deep_history_frames = 4800;
+  adev->deep_history_end = 1000;
+  adev->deep_history_valid = 3000;
+  iodev_stub_frames_queued(dev->dev.get(), 4000, now);
+  iodev_stub_rewind_output(dev->dev.get(), 2000);
+
+  dev_io_playback_fetch(adev);
+
+  // Asked for all that's held, the device keeps only 2000.
+  EXPECT_EQ(3000, iodev_stub_get_rewind_frames(dev->dev.get()));
+  EXPECT_EQ(0, adev->deep_history_valid);
+  EXPECT_EQ(2000, adev->deep_replay_frames);
+  EXPECT_EQ(3800, adev->deep_replay_idx);
+}
+
+TEST_F(DevIoSuite, DeepBufferKeepsCallbackForNewStream) {
+  DevicePtr dev = create_device(CRAS_STREAM_OUTPUT, cb_threshold, &format,
+                                CRAS_NODE_TYPE_INTERNAL_SPEAKER);
+  struct open_dev* adev = dev->odev.get();
+  StreamPtr other =
+      create_stream(2, 1, CRAS_STREAM_OUTPUT, cb_threshold, &format);
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+  other->rstream->next_cb_ts = now;
+  other->dstream->is_running = 0;
+  add_stream_to_dev(dev->dev, other);
+
+  adev->deep_history_frames = 4800;
+  adev->deep_history_valid = 3000;
+  iodev_stub_frames_queued(dev->dev.get(), 1000, now);
+  iodev_stub_rewind_output(dev->dev.get(), 520);
+
+  dev_io_playback_fetch(adev);
+
+  // 1000 queued less a 480 callback.
+  EXPECT_EQ(520, iodev_stub_get_rewind_frames(dev->dev.get()));
+  EXPECT_EQ(520, adev->deep_replay_frames);
+  EXPECT_EQ(4280, adev->deep_replay_idx);
+}
+
+TEST_F(DevIoSuite, CaptureConvertedByInputData) {
+  struct open_dev* dev_list = NULL;
+  struct timespec ts;
+  DevicePtr dev = create_device(CRAS_STREAM_INPUT, cb_threshold, &format,
+                                CRAS_NODE_TYPE_MIC);
+
+  dev->dev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+  iodev_stub_frames_queued(dev->dev.get(), 20, ts);
+  DL_APPEND(dev_list, dev->odev.get());
+  add_stream_to_dev(dev->dev, stream);
+
+  dev_io_capture(&dev_list);
+  EXPECT_EQ(1, dev_stream_capture_called);
+  EXPECT_EQ(0, dev_stream_capture_converted_called);
+
+  // Frames input_data has converted are copied without another conversion.
+  input_data_get_for_stream_ret = 1;
+  dev_io_capture(&dev_list);
+  EXPECT_EQ(1, dev_stream_capture_called);
+  EXPECT_EQ(1, dev_stream_capture_converted_called);
+}
+
+TEST_F(DevIoSuite, CapturePlanarApmOutput) {
+  struct open_dev* dev_list = NULL;
+  struct timespec ts;
+  DevicePtr dev = create_device(CRAS_STREAM_INPUT, cb_threshold, &format,
+                                CRAS_NODE_TYPE_MIC);
+
+  dev->dev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+  iodev_stub_frames_queued(dev->dev.get(), 20, ts);
+  DL_APPEND(dev_list, dev->odev.get());
+  add_stream_to_dev(dev->dev, stream);
+
+  // No APM output for the stream, read through the interleaved path.
+  dev_stream_can_capture_planar_ret = 1;
+  dev_io_capture(&dev_list);
+  EXPECT_EQ(0, dev_stream_capture_planar_called);
+  EXPECT_EQ(1, dev_stream_capture_called);
+
+  // The stream can't take the APM output as is.
+  dev_stream_can_capture_planar_ret = 0;
+  input_data_get_planar_for_stream_ret = 1;
+  dev_io_capture(&dev_list);
+  EXPECT_EQ(0, dev_stream_capture_planar_called);
+  EXPECT_EQ(2, dev_stream_capture_called);
+
+  dev_stream_can_capture_planar_ret = 1;
+  dev_io_capture(&dev_list);
+  EXPECT_EQ(1, dev_stream_capture_planar_called);
+  EXPECT_EQ(2, dev_stream_capture_called);
+}
+
+TEST_F(DevIoSuite, CaptureGatedByVad) {
+  struct open_dev* dev_list = NULL;
+  struct timespec ts;
+  struct cras_audio_shm* shm = stream->rstream->shm;
+  DevicePtr dev = create_device(CRAS_STREAM_INPUT, cb_threshold, &format,
+                                CRAS_NODE_TYPE_MIC);
+
+  dev->dev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+  iodev_stub_frames_queued(dev->dev.get(), 20, ts);
+  DL_APPEND(dev_list, dev->odev.get());
+  stream->rstream->flags = VAD_GATED;
+  add_stream_to_dev(dev->dev, stream);
+
+  // No voice, the stream isn't given the frames.
+  dev->dev->vad.active = false;
+  dev_io_capture(&dev_list);
+  EXPECT_EQ(0, dev_stream_capture_called);
+  EXPECT_EQ(0, cras_shm_vad_active(shm));
+
+  dev->dev->vad.active = true;
+  dev_io_capture(&dev_list);
+  EXPECT_EQ(1, dev_stream_capture_called);
+  EXPECT_EQ(1, cras_shm_vad_active(shm));
+  EXPECT_EQ(1, shm->header->vad_seq);
+
+  dev->dev->vad.active = false;
+  dev_io_capture(&dev_list);
+  EXPECT_EQ(1, dev_stream_capture_called);
+  EXPECT_EQ(0, cras_shm_vad_active(shm));
+  EXPECT_EQ(2, shm->header->vad_seq);
+}
+
 /*
- * If any hw_level is larger than 1.5 * largest_cb_level and
- * DROP_FRAMES_THRESHOLD_MS, reset all input devices.
+ * If any hw_level is larger than 0.5 * buffer_size and
+ * DROP_FRAMES_THRESHOLD_MS, reset all input devices, even the ones with
+ * room left in their buffer.
  */
 TEST_F(DevIoSuite, SendCapturedNeedToResetDevices) {
   struct timespec start;
@@ -179,6 +549,61 @@ TEST_F(DevIoSuite, SendCapturedNeedToResetDevices2) {
   EXPECT_EQ(10000000, drop_time.tv_nsec);
 }
 
+/*
+ * If any hw_level is larger than 1.5 * largest_cb_level and
+ * DROP_FRAMES_THRESHOLD_MS but less than 0.5 * buffer_size, the streams of all
+ * input devices catch up instead of dropping frames. The catch up stops once
+ * any device is back to min_cb_level.
+ */
+TEST_F(DevIoSuite, SendCapturedCatchUpDevices) {
+  struct timespec start;
+  struct timespec drop_time;
+  struct open_dev* dev_list = NULL;
+  bool rc;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+  AddFakeDataToStream(stream.get(), 0);
+  StreamPtr stream2 =
+      create_stream(1, 1, CRAS_STREAM_INPUT, cb_threshold, &format);
+  AddFakeDataToStream(stream2.get(), 0);
+
+  DevicePtr dev1 =
+      create_device(CRAS_STREAM_INPUT, 10000, &format, CRAS_NODE_TYPE_MIC);
+  DevicePtr dev2 =
+      create_device(CRAS_STREAM_INPUT, 10000, &format, CRAS_NODE_TYPE_MIC);
+  DL_APPEND(dev_list, dev1->odev.get());
+  DL_APPEND(dev_list, dev2->odev.get());
+  add_stream_to_dev(dev1->dev, stream);
+  add_stream_to_dev(dev2->dev, stream2);
+  stream->rstream->master_dev.dev_ptr = dev1->dev.get();
+  stream2->rstream->master_dev.dev_ptr = dev1->dev.get();
+
+  iodev_stub_frames_queued(dev1->dev.get(), 2880, start);
+  iodev_stub_frames_queued(dev2->dev.get(), 4800, start);
+  EXPECT_EQ(0, dev_io_send_captured_samples(dev_list));
+
+  rc = iodev_stub_get_drop_time(dev1->dev.get(), &drop_time);
+  EXPECT_EQ(false, rc);
+  rc = iodev_stub_get_drop_time(dev2->dev.get(), &drop_time);
+  EXPECT_EQ(false, rc);
+  EXPECT_EQ(2, dev_stream_set_dev_rate_called);
+  EXPECT_GT(dev_stream_set_dev_rate_catch_up, 0);
+  EXPECT_TRUE(dev1->odev->capture_catch_up);
+  EXPECT_TRUE(dev2->odev->capture_catch_up);
+
+  // Still behind, keep catching up without touching the rates.
+  iodev_stub_frames_queued(dev1->dev.get(), 1000, start);
+  EXPECT_EQ(0, dev_io_send_captured_samples(dev_list));
+  EXPECT_EQ(2, dev_stream_set_dev_rate_called);
+
+  iodev_stub_frames_queued(dev1->dev.get(), 400, start);
+  EXPECT_EQ(0, dev_io_send_captured_samples(dev_list));
+  EXPECT_EQ(4, dev_stream_set_dev_rate_called);
+  EXPECT_EQ(0, dev_stream_set_dev_rate_catch_up);
+  EXPECT_FALSE(dev1->odev->capture_catch_up);
+  EXPECT_FALSE(dev2->odev->capture_catch_up);
+}
+
 /*
  * If the hw_level is larger than 1.5 * largest_cb_level but less than
  * DROP_FRAMES_THRESHOLD_MS, do nothing.
@@ -289,7 +714,14 @@ int input_data_get_for_stream(struct input_data* data,
                               struct buffer_share* offsets,
                               struct cras_audio_area** area,
                               unsigned int* offset) {
-  return 0;
+  return input_data_get_for_stream_ret;
+}
+
+int input_data_get_planar_for_stream(struct input_data* data,
+                                     struct cras_rstream* stream,
+                                     struct buffer_share* offsets,
+                                     struct cras_audio_area** area) {
+  return input_data_get_planar_for_stream_ret;
 }
 
 int input_data_put_for_stream(struct input_data* data,
@@ -313,6 +745,11 @@ int cras_audio_thread_event_severe_underrun() {
   return 0;
 }
 
+int cras_audio_thread_event_underrun_risk() {
+  cras_audio_thread_event_underrun_risk_called++;
+  return 0;
+}
+
 int dev_stream_attached_devs(const struct dev_stream* dev_stream) {
   return 0;
 }
@@ -320,6 +757,9 @@ void dev_stream_update_frames(const struct dev_stream* dev_stream) {}
 int dev_stream_playback_frames(const struct dev_stream* dev_stream) {
   return 0;
 }
+unsigned int dev_stream_cb_threshold(const struct dev_stream* dev_stream) {
+  return dev_stream->stream->cb_threshold;
+}
 int dev_stream_is_pending_reply(const struct dev_stream* dev_stream) {
   return 0;
 }
@@ -333,7 +773,17 @@ void dev_stream_set_dev_rate(struct dev_stream* dev_stream,
                              unsigned int dev_rate,
                              double dev_rate_ratio,
                              double master_rate_ratio,
-                             int coarse_rate_adjust) {}
+                             int coarse_rate_adjust,
+                             double catch_up) {
+  dev_stream_set_dev_rate_called++;
+  dev_stream_set_dev_rate_catch_up = catch_up;
+}
+void dev_stream_set_ramp(struct dev_stream* dev_stream,
+                         unsigned int ramp_frames,
+                         int fade_in) {}
+void dev_stream_fade_in(struct dev_stream* dev_stream, unsigned int frames) {
+  dev_stream_fade_in_frames = frames;
+}
 int dev_stream_capture_update_rstream(struct dev_stream* dev_stream) {
   return 0;
 }
@@ -349,12 +799,37 @@ int dev_stream_flush_old_audio_messages(struct dev_stream* dev_stream) {
   return 0;
 }
 void dev_stream_set_delay(const struct dev_stream* dev_stream,
-                          unsigned int delay_frames) {}
+                          unsigned int delay_frames,
+                          const struct timespec* delay_tstamp) {}
+void dev_stream_set_telemetry(const struct dev_stream* dev_stream,
+                              unsigned int dev_delay,
+                              unsigned int dsp_delay,
+                              double rate_ratio,
+                              unsigned int num_underruns,
+                              const struct ewma_power* dev_ewma) {}
 unsigned int dev_stream_capture(struct dev_stream* dev_stream,
                                 const struct cras_audio_area* area,
                                 unsigned int area_offset,
                                 float software_gain_scaler) {
   dev_stream_capture_software_gain_scaler_val = software_gain_scaler;
+  dev_stream_capture_called++;
+  return 0;
+}
+unsigned int dev_stream_capture_converted(struct dev_stream* dev_stream,
+                                          const struct cras_audio_area* area,
+                                          unsigned int area_offset,
+                                          float software_gain_scaler) {
+  dev_stream_capture_software_gain_scaler_val = software_gain_scaler;
+  dev_stream_capture_converted_called++;
+  return 0;
+}
+int dev_stream_can_capture_planar(const struct dev_stream* dev_stream,
+                                  float software_gain_scaler) {
+  return dev_stream_can_capture_planar_ret;
+}
+unsigned int dev_stream_capture_planar(struct dev_stream* dev_stream,
+                                       const struct cras_audio_area* area) {
+  dev_stream_capture_planar_called++;
   return 0;
 }
 void dev_stream_update_next_wake_time(struct dev_stream* dev_stream) {}
@@ -366,6 +841,9 @@ int dev_stream_playback_update_rstream(struct dev_stream* dev_stream) {
   return 0;
 }
 void dev_stream_destroy(struct dev_stream* dev_stream) {}
+void dev_stream_set_paused(struct dev_stream* dev_stream, int paused) {
+  dev_stream->paused = paused;
+}
 unsigned int dev_stream_capture_avail(const struct dev_stream* dev_stream) {
   return dev_stream_capture_avail_ret;
 }
@@ -376,6 +854,67 @@ struct dev_stream* dev_stream_create(struct cras_rstream* stream,
                                      struct timespec* cb_ts) {
   return 0;
 }
+int cras_fmt_conv_set_channel_matrix(struct cras_fmt_conv* conv,
+                                     const struct cras_channel_matrix* list) {
+  return 0;
+}
+int dev_stream_reserve_mix_buffer(struct dev_stream* dev_stream,
+                                  const struct cras_audio_format* fmt,
+                                  unsigned int frames) {
+  return 0;
+}
+int dev_stream_render(struct dev_stream* dev_stream,
+                      const struct cras_audio_format* fmt,
+                      unsigned int num_to_write) {
+  return 0;
+}
+int dev_stream_can_group(const struct dev_stream* dev_stream) {
+  return 0;
+}
+int dev_stream_convert_alike(const struct dev_stream* a,
+                             const struct dev_stream* b) {
+  return 0;
+}
+int dev_stream_group_matches(const struct dev_stream_group* group,
+                             const struct dev_stream* dev_stream) {
+  return 0;
+}
+struct dev_stream_group* dev_stream_group_create(
+    const struct dev_stream* dev_stream,
+    const struct cras_audio_format* dev_fmt,
+    unsigned int max_frames) {
+  return NULL;
+}
+void dev_stream_group_destroy(struct dev_stream_group* group) {}
+int dev_stream_group_mix(struct dev_stream_group* group,
+                         const struct cras_audio_format* fmt,
+                         uint8_t* dst,
+                         unsigned int num_to_write) {
+  return 0;
+}
+void cras_mix_pool_run(struct cras_mix_pool* pool,
+                       cras_mix_pool_job_fn fn,
+                       void* jobs,
+                       size_t job_size,
+                       unsigned int num_jobs) {}
+void cras_mix_add_multi(snd_pcm_format_t fmt,
+                        uint8_t* dst,
+                        const struct cras_mix_src* srcs,
+                        unsigned int num_srcs,
+                        unsigned int count) {}
+struct cras_audio_area* cras_audio_area_create(int num_channels) {
+  return (struct cras_audio_area*)calloc(
+      1, sizeof(struct cras_audio_area) +
+             num_channels * sizeof(struct cras_channel_area));
+}
+void cras_audio_area_config_channels(struct cras_audio_area* area,
+                                     const struct cras_audio_format* fmt) {}
+void cras_audio_area_config_buf_pointers(struct cras_audio_area* area,
+                                         const struct cras_audio_format* fmt,
+                                         uint8_t* base_buffer) {}
+void cras_audio_area_destroy(struct cras_audio_area* area) {
+  free(area);
+}
 }  // extern "C"
 
 }  //  namespace
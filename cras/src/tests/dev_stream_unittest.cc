@@ -12,6 +12,7 @@ extern "C" {
 #include "cras_rstream.h"
 #include "cras_shm.h"
 #include "cras_types.h"
+#include "cras_wake_heap.h"
 #include "dev_stream.h"
 }
 
@@ -78,6 +79,15 @@ struct mix_add_call {
   float mix_vol;
 };
 
+struct mix_add_ramp_call {
+  unsigned int frames;
+  unsigned int index;
+  float scaler;
+  float increment;
+  float target;
+  unsigned int num_called;
+};
+
 struct rstream_get_readable_call {
   struct cras_rstream* rstream;
   unsigned int offset;
@@ -94,22 +104,35 @@ static struct cras_audio_area_copy_call copy_area_call;
 static struct fmt_conv_call conv_frames_call;
 static int cras_audio_area_create_num_channels_val;
 static int cras_fmt_conversion_needed_val;
+static int cras_audio_area_layouts_match_val;
 static int cras_fmt_conv_set_linear_resample_rates_called;
 static float cras_fmt_conv_set_linear_resample_rates_from;
 static float cras_fmt_conv_set_linear_resample_rates_to;
+static size_t cras_fmt_conv_get_delay_val;
+static int cras_fmt_conv_set_src_quality_called;
+static enum CRAS_SRC_QUALITY cras_fmt_conv_set_src_quality_val;
 
 static unsigned int rstream_playable_frames_ret;
 static struct mix_add_call mix_add_call;
+static struct mix_add_ramp_call mix_add_ramp_call;
+static unsigned int rstream_tap_frames_called;
+static const uint8_t* rstream_tap_frames_frames;
+static unsigned int rstream_tap_frames_nframes;
 static struct rstream_get_readable_call rstream_get_readable_call;
 static unsigned int rstream_get_readable_num;
 static uint8_t* rstream_get_readable_ptr;
+static int16_t mix_src_buf[kBufferFrames * 2];
 
 static struct cras_audio_format* cras_rstream_post_processing_format_val;
 static int cras_rstream_audio_ready_called;
 static int cras_rstream_audio_ready_count;
 static int cras_rstream_is_pending_reply_ret;
 static int cras_rstream_flush_old_audio_messages_called;
+static float cras_rstream_get_volume_scaler_ret;
+static int cras_rstream_get_mute_ret;
 static int cras_server_metrics_missed_cb_event_called;
+static unsigned int dsp_util_interleave_frames;
+static uint8_t* dsp_util_interleave_output;
 
 static char* atlog_name;
 
@@ -123,6 +146,9 @@ class CreateSuite : public testing::Test {
 
     SetupShm(&rstream_.shm);
 
+    for (unsigned int i = 0; i < kBufferFrames * 2; i++)
+      mix_src_buf[i] = 1;
+
     rstream_.stream_id = 0x10001;
     rstream_.buffer_frames = kBufferFrames;
     rstream_.cb_threshold = kBufferFrames / 2;
@@ -134,17 +160,25 @@ class CreateSuite : public testing::Test {
     rstream_.format = fmt_s16le_44_1;
     rstream_.flags = 0;
     rstream_.num_missed_cb = 0;
+    rstream_.num_attached_devs = 0;
 
     config_format_converter_from_fmt = NULL;
     config_format_converter_called = 0;
     cras_fmt_conversion_needed_val = 0;
+    cras_audio_area_layouts_match_val = 0;
     cras_fmt_conv_set_linear_resample_rates_called = 0;
+    cras_fmt_conv_get_delay_val = 0;
+    cras_fmt_conv_set_src_quality_called = 0;
 
     cras_rstream_audio_ready_called = 0;
     cras_rstream_audio_ready_count = 0;
     cras_rstream_is_pending_reply_ret = 0;
+    cras_rstream_get_volume_scaler_ret = 1.0;
+    cras_rstream_get_mute_ret = 0;
     cras_rstream_flush_old_audio_messages_called = 0;
     cras_server_metrics_missed_cb_event_called = 0;
+    dsp_util_interleave_frames = 0;
+    dsp_util_interleave_output = NULL;
 
     memset(&copy_area_call, 0xff, sizeof(copy_area_call));
     memset(&conv_frames_call, 0xff, sizeof(conv_frames_call));
@@ -182,6 +216,7 @@ class CreateSuite : public testing::Test {
   }
 
   virtual void TearDown() {
+    dev_stream_free_cached();
     free(area);
     free(stream_area);
     free(rstream_.shm->header);
@@ -206,8 +241,8 @@ class CreateSuite : public testing::Test {
     cras_shm_set_used_size(shm, used_size);
 
     shm->samples = static_cast<uint8_t*>(
-        calloc(1, cras_shm_calculate_samples_size(used_size)));
-    shm->samples_info.length = cras_shm_calculate_samples_size(used_size);
+        calloc(1, cras_shm_calculate_samples_size(used_size, 0)));
+    shm->samples_info.length = cras_shm_calculate_samples_size(used_size, 0);
 
     buf = (int16_t*)shm->samples;
     for (size_t i = 0; i < kBufferFrames * 2; i++)
@@ -326,6 +361,97 @@ TEST_F(CreateSuite, CaptureSRCLargeConverterBuffer) {
   byte_buffer_destroy(&devstr.conv_buffer);
 }
 
+TEST_F(CreateSuite, CaptureNoSRCSingleDevUnityGainCopiesToShm) {
+  int16_t* shm_samples = (int16_t*)rstream_.shm->samples;
+  unsigned int nread;
+
+  for (size_t i = 0; i < kBufferFrames * 2; i++)
+    cap_buf[i] = 1000 + i;
+  rstream_.num_attached_devs = 1;
+  cras_audio_area_layouts_match_val = 1;
+
+  nread = dev_stream_capture(&devstr, area, 0, 1.0f);
+
+  // Bound by the writable part of shm, which is cb_threshold.
+  EXPECT_EQ(kBufferFrames / 2, nread);
+  EXPECT_NE(stream_area, copy_area_call.dst);
+  for (size_t i = 0; i < nread * 2; i++)
+    EXPECT_EQ(1000 + i, shm_samples[i]);
+}
+
+TEST_F(CreateSuite, CaptureNoSRCMultiDevMixes) {
+  rstream_.num_attached_devs = 2;
+  cras_audio_area_layouts_match_val = 1;
+
+  dev_stream_capture(&devstr, area, 0, 1.0f);
+
+  EXPECT_EQ(stream_area, copy_area_call.dst);
+  EXPECT_EQ(area, copy_area_call.src);
+}
+
+TEST_F(CreateSuite, CaptureSRCSingleDevConvertsToShm) {
+  unsigned int stream_avail_at_input_rate;
+  int nread;
+
+  SetUpFmtConv(44100, 32000, kBufferFrames * 2);
+  rstream_.num_attached_devs = 1;
+  cras_audio_area_layouts_match_val = 1;
+
+  nread = dev_stream_capture(&devstr, area, 0, 1.0f);
+
+  stream_avail_at_input_rate = cras_frames_at_rate(
+      out_fmt.frame_rate, (kBufferFrames / 2), in_fmt.frame_rate);
+  EXPECT_EQ(stream_avail_at_input_rate, nread);
+  EXPECT_EQ((uint8_t*)cap_buf, conv_frames_call.in_buf);
+  // Converted right into shm with nothing queued in the conv buffer.
+  EXPECT_EQ(rstream_.shm->samples, conv_frames_call.out_buf);
+  EXPECT_EQ(kBufferFrames / 2, conv_frames_call.out_frames);
+  EXPECT_EQ(0, buf_queued(devstr.conv_buffer));
+  EXPECT_NE(stream_area, copy_area_call.dst);
+
+  free(devstr.conv_area);
+  byte_buffer_destroy(&devstr.conv_buffer);
+}
+
+TEST_F(CreateSuite, CapturePlanarInterleavesToShm) {
+  float planar[2][kBufferFrames];
+  struct cras_audio_area* planar_area;
+  unsigned int nread;
+
+  devstr.conv = (struct cras_fmt_conv*)0xdead;
+  in_fmt = rstream_.format;
+  rstream_.num_attached_devs = 1;
+
+  // Only at unity gain, from a single device.
+  EXPECT_EQ(0, dev_stream_can_capture_planar(&devstr, 0.5f));
+  rstream_.num_attached_devs = 2;
+  EXPECT_EQ(0, dev_stream_can_capture_planar(&devstr, 1.0f));
+  rstream_.num_attached_devs = 1;
+  EXPECT_NE(0, dev_stream_can_capture_planar(&devstr, 1.0f));
+  in_fmt.frame_rate = 48000;
+  EXPECT_EQ(0, dev_stream_can_capture_planar(&devstr, 1.0f));
+  in_fmt = rstream_.format;
+
+  planar_area = (struct cras_audio_area*)calloc(
+      1, sizeof(*planar_area) + 2 * sizeof(struct cras_channel_area));
+  planar_area->num_channels = 2;
+  planar_area->frames = kBufferFrames;
+  for (int i = 0; i < 2; i++) {
+    planar_area->channels[i].step_bytes = sizeof(float);
+    planar_area->channels[i].buf = (uint8_t*)planar[i];
+  }
+
+  nread = dev_stream_capture_planar(&devstr, planar_area);
+
+  // Bound by the writable part of shm, which is cb_threshold.
+  EXPECT_EQ(kBufferFrames / 2, nread);
+  EXPECT_EQ(kBufferFrames / 2, dsp_util_interleave_frames);
+  EXPECT_EQ(rstream_.shm->samples, dsp_util_interleave_output);
+  EXPECT_NE(stream_area, copy_area_call.dst);
+
+  free(planar_area);
+}
+
 TEST_F(CreateSuite, CreateSRC44to48) {
   struct dev_stream* dev_stream;
 
@@ -346,6 +472,46 @@ TEST_F(CreateSuite, CreateSRC44to48) {
   dev_stream_destroy(dev_stream);
 }
 
+TEST_F(CreateSuite, DestroyKeepsCostOnStream) {
+  struct dev_stream* dev_stream;
+
+  rstream_.format = fmt_s16le_44_1;
+  rstream_.cost.convert_ns = 10;
+  rstream_.cost.mem_bytes = 1;
+  in_fmt.frame_rate = 44100;
+  out_fmt.frame_rate = 48000;
+  config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
+  dev_stream =
+      dev_stream_create(&rstream_, 0, &fmt_s16le_48, (void*)0x55, &cb_ts);
+  dev_stream->convert_ns = 100;
+  dev_stream->mix_ns = 50;
+  unsigned int conv_bytes = dev_stream->conv_buffer->max_size;
+  dev_stream_destroy(dev_stream);
+
+  // Time adds up over the devices the stream ran on, memory is the peak.
+  EXPECT_EQ(110, rstream_.cost.convert_ns);
+  EXPECT_EQ(50, rstream_.cost.mix_ns);
+  EXPECT_EQ(0, rstream_.cost.apm_ns);
+  EXPECT_LE(conv_bytes, rstream_.cost.mem_bytes);
+}
+
+// A playback stream wakes the thread at its next_cb_ts while it runs on a
+// device, not while it is paused.
+TEST_F(CreateSuite, PlaybackStreamInWakeHeapWhileRunning) {
+  struct dev_stream* dev_stream;
+
+  config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
+  dev_stream =
+      dev_stream_create(&rstream_, 0, &fmt_s16le_48, (void*)0x55, &cb_ts);
+  EXPECT_EQ(&rstream_, cras_wake_heap_at(0));
+  dev_stream_set_paused(dev_stream, 1);
+  EXPECT_EQ(NULL, cras_wake_heap_at(0));
+  dev_stream_set_paused(dev_stream, 0);
+  EXPECT_EQ(&rstream_, cras_wake_heap_at(0));
+  dev_stream_destroy(dev_stream);
+  EXPECT_EQ(NULL, cras_wake_heap_at(0));
+}
+
 TEST_F(CreateSuite, CreateSRC44from48Input) {
   struct dev_stream* dev_stream;
   struct cras_audio_format processed_fmt = fmt_s16le_48;
@@ -529,6 +695,39 @@ TEST_F(CreateSuite, CaptureAvailConvBufHasSamples) {
   dev_stream_destroy(dev_stream);
 }
 
+TEST_F(CreateSuite, ReuseBuffersOfDestroyedStream) {
+  struct dev_stream* dev_stream;
+  struct byte_buffer* conv_buffer;
+  struct cras_audio_area* conv_area;
+
+  rstream_.format = fmt_s16le_48;
+  config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
+  dev_stream =
+      dev_stream_create(&rstream_, 0, &fmt_s16le_48, (void*)0x55, &cb_ts);
+  conv_buffer = dev_stream->conv_buffer;
+  conv_area = dev_stream->conv_area;
+  buf_increment_write(conv_buffer, 50 * 4);
+  dev_stream->is_running = 1;
+  dev_stream_destroy(dev_stream);
+
+  // A mono stream fits in the buffers of the stereo one.
+  rstream_.format = fmt_s16le_48_mono;
+  out_fmt.num_channels = 1;
+  cras_audio_area_create_num_channels_val = 0;
+  dev_stream =
+      dev_stream_create(&rstream_, 0, &fmt_s16le_48, (void*)0x55, &cb_ts);
+  EXPECT_EQ(conv_buffer, dev_stream->conv_buffer);
+  EXPECT_EQ(conv_area, dev_stream->conv_area);
+  EXPECT_EQ(0, cras_audio_area_create_num_channels_val);
+  EXPECT_EQ(1, dev_stream->conv_area->num_channels);
+  EXPECT_EQ(dev_stream->conv_buffer_size_frames * 2,
+            dev_stream->conv_buffer->used_size);
+  EXPECT_EQ(0, buf_queued(dev_stream->conv_buffer));
+  EXPECT_EQ(0, dev_stream->is_running);
+  EXPECT_EQ(&rstream_, dev_stream->stream);
+  dev_stream_destroy(dev_stream);
+}
+
 TEST_F(CreateSuite, SetDevRateNotMasterDev) {
   struct dev_stream* dev_stream;
   unsigned int dev_id = 9;
@@ -540,23 +739,54 @@ TEST_F(CreateSuite, SetDevRateNotMasterDev) {
   dev_stream = dev_stream_create(&rstream_, dev_id, &fmt_s16le_44_1,
                                  (void*)0x55, &cb_ts);
 
-  dev_stream_set_dev_rate(dev_stream, 44100, 1.01, 1.0, 0);
+  dev_stream_set_dev_rate(dev_stream, 44100, 1.01, 1.0, 0, 0);
   EXPECT_EQ(1, cras_fmt_conv_set_linear_resample_rates_called);
   EXPECT_EQ(44100, cras_fmt_conv_set_linear_resample_rates_from);
   EXPECT_EQ(44541, cras_fmt_conv_set_linear_resample_rates_to);
 
-  dev_stream_set_dev_rate(dev_stream, 44100, 1.01, 1.0, 1);
+  dev_stream_set_dev_rate(dev_stream, 44100, 1.01, 1.0, 1, 0);
   EXPECT_EQ(2, cras_fmt_conv_set_linear_resample_rates_called);
   EXPECT_EQ(44100, cras_fmt_conv_set_linear_resample_rates_from);
   EXPECT_LE(44541, cras_fmt_conv_set_linear_resample_rates_to);
 
-  dev_stream_set_dev_rate(dev_stream, 44100, 1.0, 1.01, -1);
+  dev_stream_set_dev_rate(dev_stream, 44100, 1.0, 1.01, -1, 0);
   EXPECT_EQ(3, cras_fmt_conv_set_linear_resample_rates_called);
   EXPECT_EQ(44100, cras_fmt_conv_set_linear_resample_rates_from);
   EXPECT_GE(43663, cras_fmt_conv_set_linear_resample_rates_to);
   dev_stream_destroy(dev_stream);
 }
 
+TEST_F(CreateSuite, SetDevRateSkipsTinyChanges) {
+  struct dev_stream* dev_stream;
+  unsigned int dev_id = 9;
+
+  rstream_.format = fmt_s16le_48;
+  rstream_.direction = CRAS_STREAM_INPUT;
+  rstream_.master_dev.dev_id = 4;
+  config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
+  dev_stream = dev_stream_create(&rstream_, dev_id, &fmt_s16le_44_1,
+                                 (void*)0x55, &cb_ts);
+
+  dev_stream_set_dev_rate(dev_stream, 44100, 1.0001, 1.0, 0, 0);
+  EXPECT_EQ(1, cras_fmt_conv_set_linear_resample_rates_called);
+
+  // Well below one ppm of the device rate.
+  dev_stream_set_dev_rate(dev_stream, 44100, 1.0001001, 1.0, 0, 0);
+  EXPECT_EQ(1, cras_fmt_conv_set_linear_resample_rates_called);
+
+  dev_stream_set_dev_rate(dev_stream, 44100, 1.0002, 1.0, 0, 0);
+  EXPECT_EQ(2, cras_fmt_conv_set_linear_resample_rates_called);
+  EXPECT_FLOAT_EQ(44100 * 1.0002, cras_fmt_conv_set_linear_resample_rates_to);
+
+  // Returning to the device rate lets the resampler be bypassed.
+  dev_stream_set_dev_rate(dev_stream, 44100, 1.0, 1.0, 0, 0);
+  EXPECT_EQ(3, cras_fmt_conv_set_linear_resample_rates_called);
+  EXPECT_EQ(44100, cras_fmt_conv_set_linear_resample_rates_to);
+  dev_stream_set_dev_rate(dev_stream, 44100, 1.0, 1.0, 0, 0);
+  EXPECT_EQ(3, cras_fmt_conv_set_linear_resample_rates_called);
+  dev_stream_destroy(dev_stream);
+}
+
 TEST_F(CreateSuite, SetDevRateMasterDev) {
   struct dev_stream* dev_stream;
   unsigned int dev_id = 9;
@@ -569,7 +799,7 @@ TEST_F(CreateSuite, SetDevRateMasterDev) {
   dev_stream = dev_stream_create(&rstream_, dev_id, &fmt_s16le_44_1,
                                  (void*)0x55, &cb_ts);
 
-  dev_stream_set_dev_rate(dev_stream, 44100, 1.01, 1.0, 0);
+  dev_stream_set_dev_rate(dev_stream, 44100, 1.01, 1.0, 0, 0);
   EXPECT_EQ(1, cras_fmt_conv_set_linear_resample_rates_called);
   EXPECT_EQ(44100, cras_fmt_conv_set_linear_resample_rates_from);
   EXPECT_EQ(44100, cras_fmt_conv_set_linear_resample_rates_to);
@@ -577,16 +807,17 @@ TEST_F(CreateSuite, SetDevRateMasterDev) {
   EXPECT_EQ(0, rstream_.sleep_interval_ts.tv_sec);
   EXPECT_EQ(expected_ts_nsec, rstream_.sleep_interval_ts.tv_nsec);
 
-  dev_stream_set_dev_rate(dev_stream, 44100, 1.01, 1.0, 1);
-  EXPECT_EQ(2, cras_fmt_conv_set_linear_resample_rates_called);
+  // The resample rate of the master doesn't change, so it isn't set again.
+  dev_stream_set_dev_rate(dev_stream, 44100, 1.01, 1.0, 1, 0);
+  EXPECT_EQ(1, cras_fmt_conv_set_linear_resample_rates_called);
   EXPECT_EQ(44100, cras_fmt_conv_set_linear_resample_rates_from);
   EXPECT_LE(44100, cras_fmt_conv_set_linear_resample_rates_to);
   expected_ts_nsec = 1000000000.0 * kBufferFrames / 2.0 / 48000.0 / 1.01;
   EXPECT_EQ(0, rstream_.sleep_interval_ts.tv_sec);
   EXPECT_EQ(expected_ts_nsec, rstream_.sleep_interval_ts.tv_nsec);
 
-  dev_stream_set_dev_rate(dev_stream, 44100, 1.0, 1.33, -1);
-  EXPECT_EQ(3, cras_fmt_conv_set_linear_resample_rates_called);
+  dev_stream_set_dev_rate(dev_stream, 44100, 1.0, 1.33, -1, 0);
+  EXPECT_EQ(1, cras_fmt_conv_set_linear_resample_rates_called);
   EXPECT_EQ(44100, cras_fmt_conv_set_linear_resample_rates_from);
   EXPECT_GE(44100, cras_fmt_conv_set_linear_resample_rates_to);
   expected_ts_nsec = 1000000000.0 * kBufferFrames / 2.0 / 48000.0;
@@ -595,8 +826,114 @@ TEST_F(CreateSuite, SetDevRateMasterDev) {
   dev_stream_destroy(dev_stream);
 }
 
+TEST_F(CreateSuite, SetOverloadLevel) {
+  struct dev_stream* dev_stream;
+
+  rstream_.format = fmt_s16le_48;
+  rstream_.src_quality = CRAS_SRC_QUALITY_HIGH;
+  config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
+  dev_stream = dev_stream_create(&rstream_, 0, &fmt_s16le_44_1, (void*)0x55,
+                                 &cb_ts);
+
+  dev_stream_set_overload_level(dev_stream, CRAS_OVERLOAD_SRC);
+  EXPECT_EQ(1, cras_fmt_conv_set_src_quality_called);
+  EXPECT_EQ(CRAS_SRC_QUALITY_LOW_LATENCY, cras_fmt_conv_set_src_quality_val);
+
+  dev_stream_set_overload_level(dev_stream, CRAS_OVERLOAD_LINEAR_SRC);
+  EXPECT_EQ(CRAS_SRC_QUALITY_LINEAR, cras_fmt_conv_set_src_quality_val);
+
+  dev_stream_set_overload_level(dev_stream, CRAS_OVERLOAD_NONE);
+  EXPECT_EQ(CRAS_SRC_QUALITY_HIGH, cras_fmt_conv_set_src_quality_val);
+  dev_stream_destroy(dev_stream);
+
+  // Voice calls never go linear.
+  rstream_.stream_type = CRAS_STREAM_TYPE_VOICE_COMMUNICATION;
+  rstream_.src_quality = CRAS_SRC_QUALITY_LOW_LATENCY;
+  dev_stream = dev_stream_create(&rstream_, 0, &fmt_s16le_44_1, (void*)0x55,
+                                 &cb_ts);
+  dev_stream_set_overload_level(dev_stream, CRAS_OVERLOAD_APM);
+  EXPECT_EQ(CRAS_SRC_QUALITY_LOW_LATENCY, cras_fmt_conv_set_src_quality_val);
+  dev_stream_destroy(dev_stream);
+}
+
+TEST_F(CreateSuite, SetDevRateCatchUp) {
+  struct dev_stream* dev_stream;
+  unsigned int dev_id = 9;
+
+  rstream_.format = fmt_s16le_48;
+  rstream_.direction = CRAS_STREAM_INPUT;
+  rstream_.master_dev.dev_id = dev_id;
+  config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
+  dev_stream = dev_stream_create(&rstream_, dev_id, &fmt_s16le_44_1,
+                                 (void*)0x55, &cb_ts);
+
+  // Fewer frames out per device frame, so the stream drains the device.
+  dev_stream_set_dev_rate(dev_stream, 44100, 1.0, 1.0, 0, 0.02);
+  EXPECT_EQ(1, cras_fmt_conv_set_linear_resample_rates_called);
+  EXPECT_EQ(44100, cras_fmt_conv_set_linear_resample_rates_from);
+  EXPECT_FLOAT_EQ(44100 / 1.02, cras_fmt_conv_set_linear_resample_rates_to);
+
+  rstream_.master_dev.dev_id = 4;
+  dev_stream_set_dev_rate(dev_stream, 44100, 1.01, 1.0, 0, 0.02);
+  EXPECT_EQ(2, cras_fmt_conv_set_linear_resample_rates_called);
+  EXPECT_FLOAT_EQ(44541 / 1.02, cras_fmt_conv_set_linear_resample_rates_to);
+  dev_stream_destroy(dev_stream);
+}
+
+TEST_F(CreateSuite, SetTelemetry) {
+  struct cras_audio_shm_telemetry telemetry = {};
+  struct ewma_power dev_ewma;
+
+  EXPECT_EQ(-ENODATA, cras_shm_get_telemetry(rstream_.shm, &telemetry));
+
+  devstr.dev_rate = 48000;
+  cras_fmt_conv_get_delay_val = 16;
+  rstream_.shm->header->num_overruns = 3;
+  clock_gettime_retspec.tv_sec = 1;
+  clock_gettime_retspec.tv_nsec = 500;
+  memset(&rstream_.ewma, 0, sizeof(rstream_.ewma));
+  rstream_.ewma.enabled = 1;
+  rstream_.ewma.power_set = 1;
+  rstream_.ewma.power = 0.25f;
+  rstream_.ewma.peak = 0.5f;
+  memset(&dev_ewma, 0, sizeof(dev_ewma));
+  dev_ewma.enabled = 1;
+  dev_stream_set_telemetry(&devstr, 200, 40, 1.001, 2, &dev_ewma);
+
+  ASSERT_EQ(0, cras_shm_get_telemetry(rstream_.shm, &telemetry));
+  EXPECT_EQ(2, telemetry.seq);
+  EXPECT_EQ(CRAS_SHM_TELEMETRY_VERSION, telemetry.version);
+  EXPECT_EQ(200, telemetry.dev_delay_frames);
+  EXPECT_EQ(40, telemetry.dsp_delay_frames);
+  EXPECT_EQ(16, telemetry.src_delay_frames);
+  EXPECT_EQ(48000, telemetry.dev_rate);
+  EXPECT_DOUBLE_EQ(1.001, telemetry.rate_ratio);
+  EXPECT_EQ(3, telemetry.num_overruns);
+  EXPECT_EQ(2, telemetry.num_underruns);
+  EXPECT_EQ(1, telemetry.ts.tv_sec);
+  EXPECT_EQ(500, telemetry.ts.tv_nsec);
+  EXPECT_FLOAT_EQ(0.25f, telemetry.stream_power);
+  EXPECT_FLOAT_EQ(0.5f, telemetry.stream_peak);
+  // The device has not been fed any samples yet.
+  EXPECT_EQ(0.0f, telemetry.dev_power);
+  EXPECT_EQ(0.0f, telemetry.dev_peak);
+
+  // For capture the converter runs at the device rate.
+  rstream_.direction = CRAS_STREAM_INPUT;
+  in_fmt.frame_rate = 96000;
+  out_fmt.frame_rate = 48000;
+  dev_stream_set_telemetry(&devstr, 200, 40, 1.0, 0, &dev_ewma);
+  ASSERT_EQ(0, cras_shm_get_telemetry(rstream_.shm, &telemetry));
+  EXPECT_EQ(4, telemetry.seq);
+  EXPECT_EQ(8, telemetry.src_delay_frames);
+
+  // A reader never copies a block in the middle of an update.
+  rstream_.shm->header->telemetry.seq++;
+  EXPECT_EQ(-EAGAIN, cras_shm_get_telemetry(rstream_.shm, &telemetry));
+}
+
 TEST_F(CreateSuite, StreamMixNoFrames) {
-  struct dev_stream dev_stream;
+  struct dev_stream dev_stream = {};
   struct cras_audio_format fmt;
 
   dev_stream.conv = NULL;
@@ -607,7 +944,7 @@ TEST_F(CreateSuite, StreamMixNoFrames) {
 }
 
 TEST_F(CreateSuite, StreamMixNoConv) {
-  struct dev_stream dev_stream;
+  struct dev_stream dev_stream = {};
   const unsigned int nfr = 100;
   struct cras_audio_format fmt;
 
@@ -615,22 +952,27 @@ TEST_F(CreateSuite, StreamMixNoConv) {
   dev_stream.stream = reinterpret_cast<cras_rstream*>(0x5446);
   rstream_playable_frames_ret = nfr;
   rstream_get_readable_num = nfr;
-  rstream_get_readable_ptr = reinterpret_cast<uint8_t*>(0x4000);
+  rstream_get_readable_ptr = reinterpret_cast<uint8_t*>(mix_src_buf);
   rstream_get_readable_call.num_called = 0;
+  rstream_tap_frames_called = 0;
   fmt.num_channels = 2;
   fmt.format = SND_PCM_FORMAT_S16_LE;
   EXPECT_EQ(nfr, dev_stream_mix(&dev_stream, &fmt, (uint8_t*)0x5000, nfr));
   EXPECT_EQ((int16_t*)0x5000, mix_add_call.dst);
-  EXPECT_EQ((int16_t*)0x4000, mix_add_call.src);
+  EXPECT_EQ(mix_src_buf, mix_add_call.src);
   EXPECT_EQ(200, mix_add_call.count);
   EXPECT_EQ(1, mix_add_call.index);
   EXPECT_EQ(dev_stream.stream, rstream_get_readable_call.rstream);
   EXPECT_EQ(0, rstream_get_readable_call.offset);
   EXPECT_EQ(1, rstream_get_readable_call.num_called);
+  // The taps get the frames which are mixed.
+  EXPECT_EQ(1, rstream_tap_frames_called);
+  EXPECT_EQ((uint8_t*)mix_src_buf, rstream_tap_frames_frames);
+  EXPECT_EQ(nfr, rstream_tap_frames_nframes);
 }
 
 TEST_F(CreateSuite, StreamMixNoConvTwoPass) {
-  struct dev_stream dev_stream;
+  struct dev_stream dev_stream = {};
   const unsigned int nfr = 100;
   const unsigned int bytes_per_sample = 2;
   const unsigned int num_channels = 2;
@@ -641,14 +983,14 @@ TEST_F(CreateSuite, StreamMixNoConvTwoPass) {
   dev_stream.stream = reinterpret_cast<cras_rstream*>(0x5446);
   rstream_playable_frames_ret = nfr;
   rstream_get_readable_num = nfr / 2;
-  rstream_get_readable_ptr = reinterpret_cast<uint8_t*>(0x4000);
+  rstream_get_readable_ptr = reinterpret_cast<uint8_t*>(mix_src_buf);
   rstream_get_readable_call.num_called = 0;
   fmt.num_channels = 2;
   fmt.format = SND_PCM_FORMAT_S16_LE;
   EXPECT_EQ(nfr, dev_stream_mix(&dev_stream, &fmt, (uint8_t*)0x5000, nfr));
   const unsigned int half_offset = nfr / 2 * bytes_per_frame;
   EXPECT_EQ((int16_t*)(0x5000 + half_offset), mix_add_call.dst);
-  EXPECT_EQ((int16_t*)0x4000, mix_add_call.src);
+  EXPECT_EQ(mix_src_buf, mix_add_call.src);
   EXPECT_EQ(nfr / 2 * num_channels, mix_add_call.count);
   EXPECT_EQ(1, mix_add_call.index);
   EXPECT_EQ(dev_stream.stream, rstream_get_readable_call.rstream);
@@ -656,6 +998,235 @@ TEST_F(CreateSuite, StreamMixNoConvTwoPass) {
   EXPECT_EQ(2, rstream_get_readable_call.num_called);
 }
 
+TEST_F(CreateSuite, StreamMixSkipsSilence) {
+  struct dev_stream dev_stream = {};
+  const unsigned int nfr = 100;
+  struct cras_audio_format fmt;
+
+  dev_stream.conv = NULL;
+  dev_stream.stream = reinterpret_cast<cras_rstream*>(0x5446);
+  rstream_playable_frames_ret = nfr;
+  rstream_get_readable_num = nfr;
+  memset(mix_src_buf, 0, sizeof(mix_src_buf));
+  rstream_get_readable_ptr = reinterpret_cast<uint8_t*>(mix_src_buf);
+  memset(&mix_add_call, 0, sizeof(mix_add_call));
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+
+  // Silence is consumed from the stream but never added to the output.
+  EXPECT_EQ(nfr, dev_stream_mix(&dev_stream, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(NULL, mix_add_call.dst);
+  EXPECT_EQ(NULL, mix_add_call.src);
+}
+
+TEST_F(CreateSuite, StreamMixCopiesExclusive) {
+  struct dev_stream dev_stream = {};
+  const unsigned int nfr = 100;
+  struct cras_audio_format fmt;
+  int16_t dst[nfr * 2] = {};
+
+  dev_stream.conv = NULL;
+  dev_stream.stream = reinterpret_cast<cras_rstream*>(0x5446);
+  dev_stream.exclusive = 1;
+  rstream_playable_frames_ret = nfr;
+  rstream_get_readable_num = nfr;
+  rstream_get_readable_ptr = reinterpret_cast<uint8_t*>(mix_src_buf);
+  memset(&mix_add_call, 0, sizeof(mix_add_call));
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+
+  // The frames are copied as they are, never scaled or added.
+  EXPECT_EQ(nfr, dev_stream_mix(&dev_stream, &fmt, (uint8_t*)dst, nfr));
+  EXPECT_EQ(NULL, mix_add_call.dst);
+  EXPECT_EQ(0, memcmp(dst, mix_src_buf, sizeof(dst)));
+}
+
+TEST_F(CreateSuite, StreamMixRampIn) {
+  struct dev_stream dev_stream = {};
+  const unsigned int nfr = 100;
+  struct cras_audio_format fmt;
+
+  dev_stream.stream = &rstream_;
+  dev_stream_set_ramp(&dev_stream, 160, 1);
+  rstream_playable_frames_ret = nfr;
+  rstream_get_readable_num = nfr;
+  rstream_get_readable_ptr = reinterpret_cast<uint8_t*>(mix_src_buf);
+  mix_add_ramp_call.num_called = 0;
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+
+  // The stream fades in from silence while it is mixed.
+  EXPECT_EQ(nfr, dev_stream_mix(&dev_stream, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(1, mix_add_ramp_call.num_called);
+  EXPECT_EQ(nfr, mix_add_ramp_call.frames);
+  EXPECT_EQ(1, mix_add_ramp_call.index);
+  EXPECT_FLOAT_EQ(0.0, mix_add_ramp_call.scaler);
+  EXPECT_FLOAT_EQ(1.0 / 160, mix_add_ramp_call.increment);
+  EXPECT_FLOAT_EQ(1.0, mix_add_ramp_call.target);
+
+  // It picks up where the last mix stopped.
+  EXPECT_EQ(nfr, dev_stream_mix(&dev_stream, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(2, mix_add_ramp_call.num_called);
+  EXPECT_FLOAT_EQ(100.0 / 160, mix_add_ramp_call.scaler);
+
+  // Then it's mixed at full volume.
+  EXPECT_EQ(nfr, dev_stream_mix(&dev_stream, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(2, mix_add_ramp_call.num_called);
+  EXPECT_FLOAT_EQ(1.0, mix_add_call.mix_vol);
+  EXPECT_EQ(200, mix_add_call.count);
+}
+
+TEST_F(CreateSuite, StreamMixFadeInAfterResume) {
+  struct dev_stream dev_stream = {};
+  const unsigned int nfr = 100;
+  struct cras_audio_format fmt;
+
+  dev_stream.stream = &rstream_;
+  dev_stream_set_ramp(&dev_stream, 0, 0);
+  rstream_playable_frames_ret = nfr;
+  rstream_get_readable_num = nfr;
+  rstream_get_readable_ptr = reinterpret_cast<uint8_t*>(mix_src_buf);
+  mix_add_ramp_call.num_called = 0;
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+
+  // A resumed stream starts from silence again.
+  dev_stream_fade_in(&dev_stream, 200);
+  EXPECT_EQ(nfr, dev_stream_mix(&dev_stream, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(1, mix_add_ramp_call.num_called);
+  EXPECT_FLOAT_EQ(0.0, mix_add_ramp_call.scaler);
+  EXPECT_FLOAT_EQ(1.0 / 200, mix_add_ramp_call.increment);
+  EXPECT_FLOAT_EQ(1.0, mix_add_ramp_call.target);
+}
+
+TEST_F(CreateSuite, StreamMixRampOutOnDrain) {
+  struct dev_stream dev_stream = {};
+  const unsigned int nfr = 100;
+  struct cras_audio_format fmt;
+
+  dev_stream.stream = &rstream_;
+  dev_stream_set_ramp(&dev_stream, 40, 1);
+  rstream_playable_frames_ret = 60;
+  rstream_get_readable_num = nfr;
+  rstream_get_readable_ptr = reinterpret_cast<uint8_t*>(mix_src_buf);
+  mix_add_ramp_call.num_called = 0;
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+
+  // Fades in within the first mix.
+  EXPECT_EQ(60, dev_stream_mix(&dev_stream, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(1, mix_add_ramp_call.num_called);
+
+  // The frames left when the stream drains are faded out.
+  rstream_.is_draining = 1;
+  EXPECT_EQ(60, dev_stream_mix(&dev_stream, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(2, mix_add_ramp_call.num_called);
+  EXPECT_EQ(60, mix_add_ramp_call.frames);
+  EXPECT_FLOAT_EQ(1.0, mix_add_ramp_call.scaler);
+  EXPECT_FLOAT_EQ(-1.0 / 40, mix_add_ramp_call.increment);
+  EXPECT_FLOAT_EQ(0.0, mix_add_ramp_call.target);
+
+  // Anything mixed after that is silent.
+  EXPECT_EQ(60, dev_stream_mix(&dev_stream, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(2, mix_add_ramp_call.num_called);
+  EXPECT_FLOAT_EQ(0.0, mix_add_call.mix_vol);
+}
+
+TEST_F(CreateSuite, StreamMixRampVolumeAndMute) {
+  struct dev_stream dev_stream = {};
+  const unsigned int nfr = 100;
+  struct cras_audio_format fmt;
+
+  dev_stream.stream = &rstream_;
+  cras_rstream_get_volume_scaler_ret = 0.5;
+  dev_stream_set_ramp(&dev_stream, 200, 0);
+  rstream_playable_frames_ret = nfr;
+  rstream_get_readable_num = nfr;
+  rstream_get_readable_ptr = reinterpret_cast<uint8_t*>(mix_src_buf);
+  mix_add_ramp_call.num_called = 0;
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+
+  // Without fade in the stream starts at its volume.
+  EXPECT_EQ(nfr, dev_stream_mix(&dev_stream, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(0, mix_add_ramp_call.num_called);
+  EXPECT_FLOAT_EQ(0.5, mix_add_call.mix_vol);
+
+  // A volume change glides to the new gain.
+  cras_rstream_get_volume_scaler_ret = 1.0;
+  EXPECT_EQ(nfr, dev_stream_mix(&dev_stream, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(1, mix_add_ramp_call.num_called);
+  EXPECT_FLOAT_EQ(0.5, mix_add_ramp_call.scaler);
+  EXPECT_FLOAT_EQ(0.5 / 200, mix_add_ramp_call.increment);
+  EXPECT_FLOAT_EQ(1.0, mix_add_ramp_call.target);
+
+  // Muting fades out from wherever the last change got to.
+  cras_rstream_get_mute_ret = 1;
+  EXPECT_EQ(nfr, dev_stream_mix(&dev_stream, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(2, mix_add_ramp_call.num_called);
+  EXPECT_FLOAT_EQ(0.75, mix_add_ramp_call.scaler);
+  EXPECT_FLOAT_EQ(-0.75 / 200, mix_add_ramp_call.increment);
+  EXPECT_FLOAT_EQ(0.0, mix_add_ramp_call.target);
+}
+
+TEST_F(CreateSuite, GroupMixConvertsOnce) {
+  struct dev_stream first = {}, second = {};
+  struct dev_stream_group* group;
+  int16_t dst[480 * 2];
+
+  SetUpFmtConv(44100, 48000, kBufferFrames);
+  first.stream = &rstream_;
+  first.conv = devstr.conv;
+  second = first;
+  rstream_.num_attached_devs = 1;
+  ASSERT_TRUE(dev_stream_can_group(&first));
+  ASSERT_TRUE(dev_stream_convert_alike(&first, &second));
+
+  config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x44);
+  group = dev_stream_group_create(&first, &fmt_s16le_48, kBufferFrames);
+  ASSERT_NE(nullptr, group);
+  EXPECT_TRUE(dev_stream_group_matches(group, &second));
+  group->members[0] = &first;
+  group->members[1] = &second;
+  group->num_members = 2;
+
+  // The first stream fades in, the ramp is followed in stream frames.
+  dev_stream_set_ramp(&first, 960, 1);
+  rstream_playable_frames_ret = kBufferFrames;
+  rstream_get_readable_num = kBufferFrames;
+  rstream_get_readable_ptr = reinterpret_cast<uint8_t*>(mix_src_buf);
+  rstream_get_readable_call.num_called = 0;
+  mix_add_ramp_call.num_called = 0;
+  EXPECT_EQ(480, dev_stream_group_mix(group, &fmt_s16le_48, (uint8_t*)dst,
+                                      480));
+  EXPECT_EQ(2, rstream_get_readable_call.num_called);
+  EXPECT_EQ(1, mix_add_ramp_call.num_called);
+  EXPECT_EQ(441, mix_add_ramp_call.frames);
+  EXPECT_EQ(0, mix_add_ramp_call.index);
+  EXPECT_FLOAT_EQ(480.0 / 441 / 960, mix_add_ramp_call.increment);
+  EXPECT_FLOAT_EQ(0.5, first.ramp_scaler);
+
+  // The sum is converted once and added to the device buffer.
+  EXPECT_EQ(group->conv, conv_frames_call.conv);
+  EXPECT_EQ(group->mix_buffer, conv_frames_call.in_buf);
+  EXPECT_EQ(441, conv_frames_call.in_frames);
+  EXPECT_EQ(dst, mix_add_call.dst);
+  EXPECT_EQ((int16_t*)group->conv_buffer, mix_add_call.src);
+  EXPECT_EQ(960, mix_add_call.count);
+  EXPECT_EQ(1, mix_add_call.index);
+  EXPECT_FLOAT_EQ(1.0, mix_add_call.mix_vol);
+
+  // A stream converted at another quality needs its own converter.
+  second.src_quality = CRAS_SRC_QUALITY_LINEAR;
+  group->num_members = 0;
+  EXPECT_FALSE(dev_stream_group_matches(group, &second));
+  EXPECT_FALSE(dev_stream_convert_alike(&first, &second));
+  dev_stream_group_destroy(group);
+
+  byte_buffer_destroy(&devstr.conv_buffer);
+  free(devstr.conv_area);
+}
+
 TEST_F(CreateSuite, DevStreamFlushAudioMessages) {
   struct dev_stream* dev_stream;
   unsigned int dev_id = 9;
@@ -1030,7 +1601,7 @@ TEST(DevStreamTimimg, SetPlaybackTimeStampSimple) {
 
   clock_gettime_retspec.tv_sec = 1;
   clock_gettime_retspec.tv_nsec = 0;
-  cras_set_playback_timestamp(48000, 24000, &ts);
+  cras_set_playback_timestamp(48000, 24000, NULL, &ts);
   EXPECT_EQ(1, ts.tv_sec);
   EXPECT_GE(ts.tv_nsec, 499900000);
   EXPECT_LE(ts.tv_nsec, 500100000);
@@ -1041,7 +1612,7 @@ TEST(DevStreamTimimg, SetPlaybackTimeStampWrap) {
 
   clock_gettime_retspec.tv_sec = 1;
   clock_gettime_retspec.tv_nsec = 750000000;
-  cras_set_playback_timestamp(48000, 24000, &ts);
+  cras_set_playback_timestamp(48000, 24000, NULL, &ts);
   EXPECT_EQ(2, ts.tv_sec);
   EXPECT_GE(ts.tv_nsec, 249900000);
   EXPECT_LE(ts.tv_nsec, 250100000);
@@ -1052,19 +1623,34 @@ TEST(DevStreamTimimg, SetPlaybackTimeStampWrapTwice) {
 
   clock_gettime_retspec.tv_sec = 1;
   clock_gettime_retspec.tv_nsec = 750000000;
-  cras_set_playback_timestamp(48000, 72000, &ts);
+  cras_set_playback_timestamp(48000, 72000, NULL, &ts);
   EXPECT_EQ(3, ts.tv_sec);
   EXPECT_GE(ts.tv_nsec, 249900000);
   EXPECT_LE(ts.tv_nsec, 250100000);
 }
 
+TEST(DevStreamTimimg, SetPlaybackTimeStampFromHardware) {
+  struct cras_timespec ts;
+  struct timespec tstamp;
+
+  // The delay was measured by the hardware 2ms before the wake.
+  clock_gettime_retspec.tv_sec = 1;
+  clock_gettime_retspec.tv_nsec = 2000000;
+  tstamp.tv_sec = 1;
+  tstamp.tv_nsec = 0;
+  cras_set_playback_timestamp(48000, 24000, &tstamp, &ts);
+  EXPECT_EQ(1, ts.tv_sec);
+  EXPECT_GE(ts.tv_nsec, 499900000);
+  EXPECT_LE(ts.tv_nsec, 500100000);
+}
+
 //  Test set_capture_timestamp.
 TEST(DevStreamTimimg, SetCaptureTimeStampSimple) {
   struct cras_timespec ts;
 
   clock_gettime_retspec.tv_sec = 1;
   clock_gettime_retspec.tv_nsec = 750000000;
-  cras_set_capture_timestamp(48000, 24000, &ts);
+  cras_set_capture_timestamp(48000, 24000, NULL, &ts);
   EXPECT_EQ(1, ts.tv_sec);
   EXPECT_GE(ts.tv_nsec, 249900000);
   EXPECT_LE(ts.tv_nsec, 250100000);
@@ -1075,7 +1661,7 @@ TEST(DevStreamTimimg, SetCaptureTimeStampWrap) {
 
   clock_gettime_retspec.tv_sec = 1;
   clock_gettime_retspec.tv_nsec = 0;
-  cras_set_capture_timestamp(48000, 24000, &ts);
+  cras_set_capture_timestamp(48000, 24000, NULL, &ts);
   EXPECT_EQ(0, ts.tv_sec);
   EXPECT_GE(ts.tv_nsec, 499900000);
   EXPECT_LE(ts.tv_nsec, 500100000);
@@ -1086,7 +1672,7 @@ TEST(DevStreamTimimg, SetCaptureTimeStampWrapPartial) {
 
   clock_gettime_retspec.tv_sec = 2;
   clock_gettime_retspec.tv_nsec = 750000000;
-  cras_set_capture_timestamp(48000, 72000, &ts);
+  cras_set_capture_timestamp(48000, 72000, NULL, &ts);
   EXPECT_EQ(1, ts.tv_sec);
   EXPECT_GE(ts.tv_nsec, 249900000);
   EXPECT_LE(ts.tv_nsec, 250100000);
@@ -1147,7 +1733,7 @@ unsigned int cras_rstream_playable_frames(struct cras_rstream* rstream,
 }
 
 float cras_rstream_get_volume_scaler(struct cras_rstream* rstream) {
-  return 1.0;
+  return cras_rstream_get_volume_scaler_ret;
 }
 
 uint8_t* cras_rstream_get_readable_frames(struct cras_rstream* rstream,
@@ -1161,7 +1747,16 @@ uint8_t* cras_rstream_get_readable_frames(struct cras_rstream* rstream,
 }
 
 int cras_rstream_get_mute(const struct cras_rstream* rstream) {
-  return 0;
+  return cras_rstream_get_mute_ret;
+}
+
+void cras_rstream_tap_frames(struct cras_rstream* rstream,
+                             const uint8_t* frames,
+                             unsigned int nframes,
+                             const struct cras_audio_format* fmt) {
+  rstream_tap_frames_called++;
+  rstream_tap_frames_frames = frames;
+  rstream_tap_frames_nframes = nframes;
 }
 void cras_rstream_update_queued_frames(struct cras_rstream* rstream) {}
 
@@ -1175,12 +1770,26 @@ void* buffer_share_get_data(const struct buffer_share* mix, unsigned int id) {
 };
 void cras_apm_list_start_apm(struct cras_apm_list* list, void* dev_ptr){};
 void cras_apm_list_stop_apm(struct cras_apm_list* list, void* dev_ptr){};
+struct cras_apm* cras_apm_list_get_active_apm(void* stream_ptr, void* dev_ptr) {
+  return NULL;
+}
+unsigned int cras_apm_list_get_delay_frames(struct cras_apm* apm) {
+  return 0;
+}
+uint64_t cras_apm_list_get_process_ns(struct cras_apm_list* list,
+                                      void* dev_ptr) {
+  return 0;
+}
+size_t cras_apm_list_get_mem_bytes(struct cras_apm_list* list, void* dev_ptr) {
+  return 0;
+}
 
 int config_format_converter(struct cras_fmt_conv** conv,
                             enum CRAS_STREAM_DIRECTION dir,
                             const struct cras_audio_format* from,
                             const struct cras_audio_format* to,
-                            unsigned int frames) {
+                            unsigned int frames,
+                            enum CRAS_SRC_QUALITY quality) {
   config_format_converter_called++;
   config_format_converter_from_fmt = from;
   config_format_converter_frames = frames;
@@ -1226,12 +1835,36 @@ void cras_mix_add(snd_pcm_format_t fmt,
   mix_add_call.mix_vol = mix_vol;
 }
 
+void cras_mix_add_ramp(snd_pcm_format_t fmt,
+                       uint8_t* dst,
+                       uint8_t* src,
+                       unsigned int frames,
+                       unsigned int channels,
+                       unsigned int index,
+                       float scaler,
+                       float increment,
+                       float target) {
+  mix_add_ramp_call.frames = frames;
+  mix_add_ramp_call.index = index;
+  mix_add_ramp_call.scaler = scaler;
+  mix_add_ramp_call.increment = increment;
+  mix_add_ramp_call.target = target;
+  mix_add_ramp_call.num_called++;
+}
+
 struct cras_audio_area* cras_audio_area_create(int num_channels) {
+  struct cras_audio_area* area;
+
   cras_audio_area_create_num_channels_val = num_channels;
-  return NULL;
+  area = static_cast<cras_audio_area*>(calloc(
+      1, sizeof(*area) + num_channels * sizeof(struct cras_channel_area)));
+  area->num_channels = num_channels;
+  return area;
 }
 
-void cras_audio_area_destroy(struct cras_audio_area* area) {}
+void cras_audio_area_destroy(struct cras_audio_area* area) {
+  free(area);
+}
 
 void cras_audio_area_config_buf_pointers(struct cras_audio_area* area,
                                          const struct cras_audio_format* fmt,
@@ -1255,6 +1888,11 @@ unsigned int cras_audio_area_copy(const struct cras_audio_area* dst,
   return src->frames;
 }
 
+int cras_audio_area_layouts_match(const struct cras_audio_area* dst,
+                                  const struct cras_audio_area* src) {
+  return cras_audio_area_layouts_match_val;
+}
+
 size_t cras_fmt_conv_in_frames_to_out(struct cras_fmt_conv* conv,
                                       size_t in_frames) {
   return cras_frames_at_rate(in_fmt.frame_rate, in_frames, out_fmt.frame_rate);
@@ -1265,6 +1903,10 @@ size_t cras_fmt_conv_out_frames_to_in(struct cras_fmt_conv* conv,
   return cras_frames_at_rate(out_fmt.frame_rate, out_frames, in_fmt.frame_rate);
 }
 
+size_t cras_fmt_conv_get_delay(const struct cras_fmt_conv* conv) {
+  return cras_fmt_conv_get_delay_val;
+}
+
 const struct cras_audio_format* cras_fmt_conv_in_format(
     const struct cras_fmt_conv* conv) {
   return &in_fmt;
@@ -1287,6 +1929,13 @@ void cras_fmt_conv_set_linear_resample_rates(struct cras_fmt_conv* conv,
   cras_fmt_conv_set_linear_resample_rates_called++;
 }
 
+int cras_fmt_conv_set_src_quality(struct cras_fmt_conv* conv,
+                                  enum CRAS_SRC_QUALITY quality) {
+  cras_fmt_conv_set_src_quality_called++;
+  cras_fmt_conv_set_src_quality_val = quality;
+  return 0;
+}
+
 int cras_rstream_is_pending_reply(const struct cras_rstream* stream) {
   return cras_rstream_is_pending_reply_ret;
 }
@@ -1301,6 +1950,16 @@ int cras_server_metrics_missed_cb_event(struct cras_rstream* stream) {
   return 0;
 }
 
+int dsp_util_interleave(float* const* input,
+                        uint8_t* output,
+                        int channels,
+                        snd_pcm_format_t format,
+                        int frames) {
+  dsp_util_interleave_output = output;
+  dsp_util_interleave_frames = frames;
+  return 0;
+}
+
 //  From librt.
 int clock_gettime(clockid_t clk_id, struct timespec* tp) {
   tp->tv_sec = clock_gettime_retspec.tv_sec;
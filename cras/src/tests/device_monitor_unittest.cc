@@ -20,6 +20,11 @@ unsigned int suspend_dev_idx;
 static int set_mute_called;
 unsigned int mute_dev_idx;
 unsigned int fake_dev_idx = 123;
+static struct cras_timer* cras_tm_timer_return;
+static unsigned int cras_tm_create_timer_called;
+static unsigned int cras_tm_create_timer_ms;
+static void (*cras_tm_create_timer_cb)(struct cras_timer* t, void* data);
+static void* cras_tm_create_timer_cb_data;
 
 void ResetStubData() {
   type_set = (enum CRAS_MAIN_MESSAGE_TYPE)0;
@@ -29,6 +34,11 @@ void ResetStubData() {
   suspend_dev_idx = 0;
   set_mute_called = 0;
   mute_dev_idx = 0;
+  cras_tm_timer_return = reinterpret_cast<struct cras_timer*>(0x55);
+  cras_tm_create_timer_called = 0;
+  cras_tm_create_timer_ms = 0;
+  cras_tm_create_timer_cb = NULL;
+  cras_tm_create_timer_cb_data = NULL;
 }
 
 namespace {
@@ -76,6 +86,40 @@ TEST(DeviceMonitorTestSuite, HandleResetDevice) {
   EXPECT_EQ(suspend_dev_idx, fake_dev_idx);
 }
 
+TEST(DeviceMonitorTestSuite, HandleResetDeviceBacksOff) {
+  struct cras_device_monitor_message msg;
+  struct cras_main_message* main_message =
+      reinterpret_cast<struct cras_main_message*>(&msg);
+  unsigned int dev_idx = 456;
+
+  ResetStubData();
+  init_device_msg(&msg, RESET_DEVICE, dev_idx);
+
+  // The first reset happens right away.
+  handle_device_message(main_message, NULL);
+  EXPECT_EQ(1, suspend_dev_called);
+  EXPECT_EQ(1, resume_dev_called);
+
+  // The next one waits, and requests meanwhile are coalesced.
+  handle_device_message(main_message, NULL);
+  handle_device_message(main_message, NULL);
+  EXPECT_EQ(1, suspend_dev_called);
+  ASSERT_EQ(1, cras_tm_create_timer_called);
+  EXPECT_NEAR(1000, cras_tm_create_timer_ms, 10);
+
+  cras_tm_create_timer_cb(NULL, cras_tm_create_timer_cb_data);
+  EXPECT_EQ(2, suspend_dev_called);
+  EXPECT_EQ(dev_idx, suspend_dev_idx);
+  EXPECT_EQ(2, resume_dev_called);
+
+  // The wait doubles after each reset.
+  handle_device_message(main_message, NULL);
+  ASSERT_EQ(2, cras_tm_create_timer_called);
+  EXPECT_NEAR(2000, cras_tm_create_timer_ms, 10);
+  cras_tm_create_timer_cb(NULL, cras_tm_create_timer_cb_data);
+  EXPECT_EQ(3, suspend_dev_called);
+}
+
 TEST(DeviceMonitorTestSuite, MuteDevice) {
   ResetStubData();
   // sent_msg will be filled with message content in cras_main_message_send.
@@ -139,6 +183,22 @@ void cras_iodev_list_set_dev_mute(unsigned int dev_idx) {
   mute_dev_idx = dev_idx;
 }
 
+struct cras_tm* cras_system_state_get_tm() {
+  return NULL;
+}
+
+struct cras_timer* cras_tm_create_timer(struct cras_tm* tm,
+                                        unsigned int ms,
+                                        void (*cb)(struct cras_timer* t,
+                                                   void* data),
+                                        void* cb_data) {
+  cras_tm_create_timer_called++;
+  cras_tm_create_timer_ms = ms;
+  cras_tm_create_timer_cb = cb;
+  cras_tm_create_timer_cb_data = cb_data;
+  return cras_tm_timer_return;
+}
+
 }  // extern "C"
 }  // namespace
 
@@ -4,13 +4,21 @@
 
 #include <gtest/gtest.h>
 #include <math.h>
+#include <string.h>
+
+#include <vector>
 
 #include "crossover.h"
 #include "crossover2.h"
 #include "drc.h"
+#include "drc_kernel.h"
+#include "drc_kernel_ops.h"
+#include "dsp_ops.h"
 #include "dsp_util.h"
 #include "eq.h"
 #include "eq2.h"
+#include "eqn.h"
+#include "fir.h"
 
 namespace {
 
@@ -95,6 +103,95 @@ TEST(InterleaveTest, All) {
   }
 }
 
+/* Reads sample i of an interleaved buffer of format, scaled to [-1.0, 1.0]
+ * the same way dsp_util_deinterleave() does. */
+static float sample_at(const uint8_t* buf, snd_pcm_format_t format, int i) {
+  int32_t s = 0;
+  float f;
+
+  switch (format) {
+    case SND_PCM_FORMAT_S16_LE:
+      return ((const int16_t*)buf)[i] / 32768.0f;
+    case SND_PCM_FORMAT_S24_LE:
+      EXPECT_EQ(0, ((const int32_t*)buf)[i] & 0xff000000);
+      return (((const int32_t*)buf)[i] << 8) / 2147483648.0f;
+    case SND_PCM_FORMAT_S24_3LE:
+      memcpy((uint8_t*)&s + 1, buf + i * 3, 3);
+      return s / 2147483648.0f;
+    case SND_PCM_FORMAT_S32_LE:
+      return ((const int32_t*)buf)[i] / 2147483648.0f;
+    default:
+      memcpy(&f, buf + i * 4, 4);
+      return f;
+  }
+}
+
+static size_t sample_bytes(snd_pcm_format_t format) {
+  switch (format) {
+    case SND_PCM_FORMAT_S16_LE:
+      return 2;
+    case SND_PCM_FORMAT_S24_3LE:
+      return 3;
+    default:
+      return 4;
+  }
+}
+
+TEST(InterleaveTest, MultichannelFormats) {
+  const snd_pcm_format_t formats[] = {
+      SND_PCM_FORMAT_S16_LE, SND_PCM_FORMAT_S24_LE, SND_PCM_FORMAT_S24_3LE,
+      SND_PCM_FORMAT_S32_LE, SND_PCM_FORMAT_FLOAT_LE};
+  /* Not a multiple of the frames converted at a time, to cover the tail. */
+  const int FRAMES = 37;
+
+  for (snd_pcm_format_t format : formats) {
+    /* Up to DSP_OPS_MAX_CHANNELS + 1 to cover the generic loop too. */
+    for (int channels = 1; channels <= DSP_OPS_MAX_CHANNELS + 1;
+         channels++) {
+      SCOPED_TRACE(testing::Message() << "format " << format << " channels "
+                                      << channels);
+      std::vector<float> in(channels * FRAMES), out(channels * FRAMES);
+      std::vector<uint8_t> buf(channels * FRAMES * 4 + 1, 0xa5);
+      std::vector<float*> in_ptr(channels), out_ptr(channels);
+      size_t bytes = channels * FRAMES * sample_bytes(format);
+
+      /* Multiples of 1/32768 survive the round trip in all formats. */
+      for (int c = 0; c < channels; c++) {
+        in_ptr[c] = &in[c * FRAMES];
+        out_ptr[c] = &out[c * FRAMES];
+        for (int i = 0; i < FRAMES; i++)
+          in_ptr[c][i] = ((i * 997 + c * 131) % 65536 - 32768) / 32768.0f;
+      }
+
+      ASSERT_EQ(0, dsp_util_interleave(in_ptr.data(), buf.data(), channels,
+                                       format, FRAMES));
+      EXPECT_EQ(0xa5, buf[bytes]);
+      for (int i = 0; i < FRAMES; i++)
+        for (int c = 0; c < channels; c++)
+          ASSERT_EQ(in_ptr[c][i], sample_at(buf.data(), format,
+                                            i * channels + c));
+
+      ASSERT_EQ(0, dsp_util_deinterleave(buf.data(), out_ptr.data(),
+                                         channels, format, FRAMES));
+      for (size_t i = 0; i < in.size(); i++)
+        ASSERT_EQ(in[i], out[i]) << i;
+    }
+  }
+}
+
+TEST(InterleaveTest, MultichannelClamp) {
+  float in[3][8] = {{1.0f, 1.5f, -1.0f, -1.5f, 0.5f, 0, 1.0f, -1.0f},
+                    {1.0f, 1.5f, -1.0f, -1.5f, 0.5f, 0, 1.0f, -1.0f},
+                    {1.0f, 1.5f, -1.0f, -1.5f, 0.5f, 0, 1.0f, -1.0f}};
+  float* in_ptr[] = {in[0], in[1], in[2]};
+  int16_t expected[] = {32767, 32767, -32768, -32768, 16384, 0, 32767, -32768};
+  int16_t s16[3 * 8];
+
+  dsp_util_interleave(in_ptr, (uint8_t*)s16, 3, SND_PCM_FORMAT_S16_LE, 8);
+  for (int i = 0; i < 3 * 8; i++)
+    EXPECT_EQ(expected[i / 3], s16[i]) << i;
+}
+
 TEST(EqTest, All) {
   struct eq* eq;
   size_t len = 44100;
@@ -229,6 +326,145 @@ TEST(Eq2Test, All) {
   eq2_free(eq2);
 }
 
+TEST(Eq2Test, SetBiquad) {
+  size_t len = 4096;
+  float f = 0.05;
+  std::vector<float> ref0(len, 0), ref1(len, 0);
+  std::vector<float> out0, out1;
+  struct eq2 *eq2, *ref;
+
+  add_sine(ref0.data(), len, 0.01, 0, 1);
+  add_sine(ref1.data(), len, 0.2, 0, 1);
+  out0 = ref0;
+  out1 = ref1;
+
+  ref = eq2_new();
+  eq2_append_biquad(ref, 0, BQ_PEAKING, f, 2, 6);
+  eq2_append_biquad(ref, 1, BQ_LOWPASS, f, 0, 0);
+  eq2_process(ref, ref0.data(), ref1.data(), len);
+
+  /* Setting the same biquads half way keeps the filter history. */
+  eq2 = eq2_new();
+  EXPECT_EQ(0, eq2_set_biquad(eq2, 0, 0, BQ_PEAKING, f, 2, 6));
+  EXPECT_EQ(0, eq2_set_biquad(eq2, 1, 0, BQ_LOWPASS, f, 0, 0));
+  eq2_process(eq2, out0.data(), out1.data(), len / 2);
+  EXPECT_EQ(0, eq2_set_biquad(eq2, 0, 0, BQ_PEAKING, f, 2, 6));
+  EXPECT_EQ(0, eq2_set_biquad(eq2, 1, 0, BQ_LOWPASS, f, 0, 0));
+  eq2_process(eq2, &out0[len / 2], &out1[len / 2], len - len / 2);
+  for (size_t i = 0; i < len; i++) {
+    EXPECT_EQ(ref0[i], out0[i]);
+    EXPECT_EQ(ref1[i], out1[i]);
+  }
+
+  EXPECT_EQ(-1, eq2_set_biquad(eq2, 0, MAX_BIQUADS_PER_EQ2, BQ_PEAKING, f,
+                               2, 6));
+  eq2_free(eq2);
+  eq2_free(ref);
+}
+
+TEST(EqnTest, All) {
+  struct eqn* eqn;
+  struct eq* eq[EQN_MAX_CHANNELS];
+  float* data[EQN_MAX_CHANNELS];
+  float* expected[EQN_MAX_CHANNELS];
+  size_t len = 4410;
+  float NQ = 44100 / 2;
+  float f_mid = 100 / NQ;
+  float f_high = 1000 / NQ;
+
+  dsp_enable_flush_denormal_to_zero();
+
+  /* Invalid channel counts */
+  EXPECT_EQ(NULL, eqn_new(0));
+  EXPECT_EQ(NULL, eqn_new(EQN_MAX_CHANNELS + 1));
+
+  /* Each channel matches a plain EQ with the same biquads, for both lane
+   * widths and for channels with different numbers of biquads. */
+  for (int channels = 1; channels <= EQN_MAX_CHANNELS; channels++) {
+    eqn = eqn_new(channels);
+    ASSERT_TRUE(eqn);
+    for (int ch = 0; ch < channels; ch++) {
+      eq[ch] = eq_new();
+      data[ch] = (float*)calloc(len, sizeof(float));
+      expected[ch] = (float*)calloc(len, sizeof(float));
+      add_sine(data[ch], len, f_mid * (ch + 1), ch, 1);
+      add_sine(data[ch], len, f_high, 0, 0.5);
+      memcpy(expected[ch], data[ch], len * sizeof(float));
+
+      EXPECT_EQ(0, eqn_append_biquad(eqn, ch, BQ_LOWPASS, f_high, 0, 0));
+      EXPECT_EQ(0, eq_append_biquad(eq[ch], BQ_LOWPASS, f_high, 0, 0));
+      for (int k = 0; k < ch % 3; k++) {
+        EXPECT_EQ(0,
+                  eqn_append_biquad(eqn, ch, BQ_PEAKING, f_mid * 2, 5, 6));
+        EXPECT_EQ(0, eq_append_biquad(eq[ch], BQ_PEAKING, f_mid * 2, 5, 6));
+      }
+    }
+
+    /* Uneven chunks carry the filter state across calls. */
+    eqn_process(eqn, data, 100);
+    float* rest[EQN_MAX_CHANNELS];
+    for (int ch = 0; ch < channels; ch++)
+      rest[ch] = data[ch] + 100;
+    eqn_process(eqn, rest, len - 100);
+
+    for (int ch = 0; ch < channels; ch++) {
+      eq_process(eq[ch], expected[ch], len);
+      for (size_t i = 0; i < len; i++)
+        ASSERT_NEAR(expected[ch][i], data[ch][i], 1e-5) << ch << " " << i;
+      eq_free(eq[ch]);
+      free(data[ch]);
+      free(expected[ch]);
+    }
+
+    /* Test for empty input */
+    eqn_process(eqn, NULL, 0);
+    eqn_free(eqn);
+  }
+
+  /* Too many biquads or a bad channel */
+  eqn = eqn_new(2);
+  for (int i = 0; i < MAX_BIQUADS_PER_EQN; i++)
+    EXPECT_EQ(0, eqn_append_biquad(eqn, 1, BQ_PEAKING, f_high, 5, 6));
+  EXPECT_EQ(-1, eqn_append_biquad(eqn, 1, BQ_PEAKING, f_high, 5, 6));
+  EXPECT_EQ(0, eqn_append_biquad(eqn, 0, BQ_PEAKING, f_high, 5, 6));
+  EXPECT_EQ(-1, eqn_append_biquad(eqn, 2, BQ_PEAKING, f_high, 5, 6));
+  eqn_free(eqn);
+}
+
+TEST(FirTest, All) {
+  int taps = FIR_BLOCK_FRAMES * 2 + 45;
+  size_t len = 2000;
+  std::vector<float> ir(taps), input(len), data(len);
+
+  /* Invalid tap counts */
+  EXPECT_EQ(NULL, fir_new(ir.data(), 0));
+  EXPECT_EQ(NULL, fir_new(ir.data(), FIR_MAX_TAPS + 1));
+
+  for (int i = 0; i < taps; i++)
+    ir[i] = sinf(i * 0.7f) * expf(-i / 100.0f);
+  for (size_t i = 0; i < len; i++)
+    input[i] = data[i] = sinf(i * 0.01f) + 0.3f * cosf(i * 1.3f);
+
+  struct fir* fir = fir_new(ir.data(), taps);
+  ASSERT_TRUE(fir);
+
+  /* Chunks that do not line up with the blocks. */
+  for (size_t start = 0; start < len; start += 77)
+    fir_process(fir, data.data() + start, std::min(len - start, (size_t)77));
+
+  /* The output is the direct convolution, FIR_BLOCK_FRAMES frames late. */
+  for (size_t n = 0; n < len; n++) {
+    float expected = 0;
+    for (size_t k = 0; k < (size_t)taps && n >= FIR_BLOCK_FRAMES + k; k++)
+      expected += ir[k] * input[n - FIR_BLOCK_FRAMES - k];
+    ASSERT_NEAR(expected, data[n], 1e-4) << n;
+  }
+
+  /* Test for empty input */
+  fir_process(fir, NULL, 0);
+  fir_free(fir);
+}
+
 TEST(CrossoverTest, All) {
   struct crossover xo;
   size_t len = 44100;
@@ -346,6 +582,41 @@ TEST(Crossover2Test, All) {
   free(data2R);
 }
 
+TEST(Crossover2Test, SetFreqs) {
+  size_t len = 4096;
+  struct crossover2 xo2, ref;
+  std::vector<float> refL(len, 0), refR(len, 0);
+  std::vector<float> outL, outR;
+  std::vector<float> band[8];
+
+  for (int i = 0; i < 8; i++)
+    band[i].resize(len);
+  add_sine(refL.data(), len, 0.005, 0, 1);
+  add_sine(refL.data(), len, 0.3, 0, 1);
+  add_sine(refR.data(), len, 0.05, 0, 1);
+  outL = refL;
+  outR = refR;
+
+  crossover2_init(&ref, 0.01, 0.1);
+  crossover2_process(&ref, len, refL.data(), refR.data(), band[0].data(),
+                     band[1].data(), band[2].data(), band[3].data());
+
+  /* Setting the same frequencies half way keeps the filter state. */
+  crossover2_init(&xo2, 0.01, 0.1);
+  crossover2_process(&xo2, len / 2, outL.data(), outR.data(), band[4].data(),
+                     band[5].data(), band[6].data(), band[7].data());
+  crossover2_set_freqs(&xo2, 0.01, 0.1);
+  crossover2_process(&xo2, len - len / 2, &outL[len / 2], &outR[len / 2],
+                     &band[4][len / 2], &band[5][len / 2], &band[6][len / 2],
+                     &band[7][len / 2]);
+  for (size_t i = 0; i < len; i++) {
+    EXPECT_EQ(refL[i], outL[i]);
+    EXPECT_EQ(refR[i], outR[i]);
+    for (int j = 0; j < 4; j++)
+      EXPECT_EQ(band[j][i], band[j + 4][i]);
+  }
+}
+
 TEST(DrcTest, All) {
   size_t len = 44100;
   float NQ = len / 2;
@@ -425,6 +696,187 @@ TEST(DrcTest, All) {
   free(data_right);
 }
 
+/* Runs a kernel with the given ops over a signal that alternates between
+ * loud and quiet sections, so both attack and release are exercised. */
+static void run_drc_kernel(const struct drc_kernel_ops* ops,
+                           int gain_table,
+                           float* left,
+                           float* right,
+                           size_t len) {
+  struct drc_kernel dk;
+  float* data[] = {left, right};
+
+  for (size_t i = 0; i < len; i++) {
+    float amplitude = (i / 4410) % 2 ? 0.05 : 1;
+    left[i] = amplitude * sinf(i * 0.05f);
+    right[i] = amplitude * cosf(i * 0.03f);
+  }
+
+  dk_set_ops(ops);
+  dk_init(&dk, 44100);
+  dk_set_gain_table(&dk, gain_table);
+  dk_set_parameters(&dk, -24, 30, 12, 0.003f, 0.250f, 0.006f, 0, 0.09f,
+                    0.16f, 0.42f, 0.98f);
+  dk_set_enabled(&dk, 1);
+  for (size_t start = 0; start < len; start += 300)
+    dk_process(&dk, data, std::min(len - start, (size_t)300));
+  dk_free(&dk);
+  dk_set_ops(NULL);
+}
+
+#if defined HAVE_SSE42 || defined HAVE_AVX || defined HAVE_AVX2 || \
+    defined HAVE_FMA
+static void expect_drc_kernel_ops_match(const struct drc_kernel_ops* ops) {
+  size_t len = 44100;
+  std::vector<float> left(len), right(len), ref_left(len), ref_right(len);
+
+  for (int gain_table = 0; gain_table < 2; gain_table++) {
+    run_drc_kernel(NULL, gain_table, ref_left.data(), ref_right.data(), len);
+    run_drc_kernel(ops, gain_table, left.data(), right.data(), len);
+    for (size_t i = 0; i < len; i++) {
+      ASSERT_NEAR(ref_left[i], left[i], 1e-4) << i;
+      ASSERT_NEAR(ref_right[i], right[i], 1e-4) << i;
+    }
+  }
+}
+#endif
+
+TEST(DrcKernelTest, GainTableMatchesCurve) {
+  size_t len = 44100;
+  std::vector<float> left(len), right(len), ref_left(len), ref_right(len);
+
+  dsp_enable_flush_denormal_to_zero();
+  run_drc_kernel(NULL, 0, ref_left.data(), ref_right.data(), len);
+  run_drc_kernel(NULL, 1, left.data(), right.data(), len);
+  for (size_t i = 0; i < len; i++) {
+    ASSERT_NEAR(ref_left[i], left[i], 1e-4) << i;
+    ASSERT_NEAR(ref_right[i], right[i], 1e-4) << i;
+  }
+}
+
+#if defined HAVE_SSE42 || defined HAVE_AVX || defined HAVE_AVX2 || \
+    defined HAVE_FMA
+TEST(DrcKernelOpsTest, MatchDefault) {
+  dsp_enable_flush_denormal_to_zero();
+#if defined HAVE_SSE42
+  if (__builtin_cpu_supports("sse4.2"))
+    expect_drc_kernel_ops_match(&drc_kernel_ops_sse42);
+#endif
+#if defined HAVE_AVX
+  if (__builtin_cpu_supports("avx"))
+    expect_drc_kernel_ops_match(&drc_kernel_ops_avx);
+#endif
+#if defined HAVE_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    expect_drc_kernel_ops_match(&drc_kernel_ops_avx2);
+#endif
+#if defined HAVE_FMA
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    expect_drc_kernel_ops_match(&drc_kernel_ops_fma);
+#endif
+}
+#endif
+
+#if defined HAVE_SSE42 || defined HAVE_AVX || defined HAVE_AVX2 || \
+    defined HAVE_FMA
+/* Runs a stereo signal through an eq2 with an odd number of biquads, a
+ * crossover2 and an S16 round trip using the given ops. */
+static void run_dsp_ops(const struct dsp_ops* ops,
+                        std::vector<float>* out,
+                        std::vector<int16_t>* s16) {
+  size_t len = 4410;
+  std::vector<float> band[6];
+  float* data[2];
+  struct eq2* eq2;
+  struct crossover2 xo2;
+
+  for (int i = 0; i < 6; i++)
+    band[i].resize(len);
+  for (size_t i = 0; i < len; i++) {
+    band[0][i] = 0.5f * sinf(i * 0.05f) + 0.3f * sinf(i * 0.9f);
+    band[1][i] = 0.5f * cosf(i * 0.03f) + 0.3f * sinf(i * 1.7f);
+  }
+
+  dsp_set_ops(ops);
+  eq2 = eq2_new();
+  eq2_append_biquad(eq2, 0, BQ_PEAKING, 0.1, 2, 6);
+  eq2_append_biquad(eq2, 0, BQ_LOWPASS, 0.5, 0, 0);
+  eq2_append_biquad(eq2, 0, BQ_HIGHSHELF, 0.3, 0, -3);
+  eq2_append_biquad(eq2, 1, BQ_HIGHPASS, 0.01, 0, 0);
+  eq2_append_biquad(eq2, 1, BQ_NOTCH, 0.2, 3, 0);
+  for (size_t start = 0; start < len; start += 1000) {
+    size_t count = std::min(len - start, (size_t)1000);
+    eq2_process(eq2, &band[0][start], &band[1][start], count);
+  }
+  eq2_free(eq2);
+
+  crossover2_init(&xo2, 0.02, 0.2);
+  crossover2_process(&xo2, len, band[0].data(), band[1].data(),
+                     band[2].data(), band[3].data(), band[4].data(),
+                     band[5].data());
+
+  out->clear();
+  for (int i = 0; i < 6; i++)
+    out->insert(out->end(), band[i].begin(), band[i].end());
+
+  s16->resize(len * 2 - 2);
+  data[0] = band[0].data();
+  data[1] = band[2].data();
+  dsp_util_interleave(data, (uint8_t*)s16->data(), 2, SND_PCM_FORMAT_S16_LE,
+                      len - 1);
+  dsp_util_deinterleave((uint8_t*)s16->data(), data, 2, SND_PCM_FORMAT_S16_LE,
+                        len - 1);
+  out->insert(out->end(), band[0].begin(), band[0].end());
+  out->insert(out->end(), band[2].begin(), band[2].end());
+
+  /* A six channel S24 round trip through the multichannel loops. */
+  std::vector<int32_t> s24(len * 6);
+  float* bands[6];
+  for (int i = 0; i < 6; i++)
+    bands[i] = band[i].data();
+  dsp_util_interleave(bands, (uint8_t*)s24.data(), 6, SND_PCM_FORMAT_S24_LE,
+                      len - 1);
+  dsp_util_deinterleave((uint8_t*)s24.data(), bands, 6, SND_PCM_FORMAT_S24_LE,
+                        len - 1);
+  for (int i = 0; i < 6; i++)
+    out->insert(out->end(), band[i].begin(), band[i].end());
+  dsp_set_ops(NULL);
+}
+
+static void expect_dsp_ops_match(const struct dsp_ops* ops) {
+  std::vector<float> ref, out;
+  std::vector<int16_t> ref_s16, s16;
+
+  run_dsp_ops(NULL, &ref, &ref_s16);
+  run_dsp_ops(ops, &out, &s16);
+  ASSERT_EQ(ref.size(), out.size());
+  for (size_t i = 0; i < ref.size(); i++)
+    ASSERT_NEAR(ref[i], out[i], 1e-4) << i;
+  for (size_t i = 0; i < ref_s16.size(); i++)
+    ASSERT_NEAR(ref_s16[i], s16[i], 1) << i;
+}
+
+TEST(DspOpsTest, MatchDefault) {
+  dsp_enable_flush_denormal_to_zero();
+#if defined HAVE_SSE42
+  if (__builtin_cpu_supports("sse4.2"))
+    expect_dsp_ops_match(&dsp_ops_sse42);
+#endif
+#if defined HAVE_AVX
+  if (__builtin_cpu_supports("avx"))
+    expect_dsp_ops_match(&dsp_ops_avx);
+#endif
+#if defined HAVE_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    expect_dsp_ops_match(&dsp_ops_avx2);
+#endif
+#if defined HAVE_FMA
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    expect_dsp_ops_match(&dsp_ops_fma);
+#endif
+}
+#endif
+
 }  //  namespace
 
 int main(int argc, char** argv) {
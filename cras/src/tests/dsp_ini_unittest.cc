@@ -5,7 +5,11 @@
 #include <gtest/gtest.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
+#include <string>
+
+#include "biquad.h"
 #include "cras_dsp_ini.h"
 
 #define FILENAME_TEMPLATE "DspIniTest.XXXXXX"
@@ -68,6 +72,7 @@ TEST_F(DspIniTestSuite, OneSimplePlugin) {
   EXPECT_STREQ("foo.so", plugin->library);
   EXPECT_STREQ("bar", plugin->label);
   EXPECT_TRUE(plugin->disable_expr);
+  EXPECT_EQ(NULL, plugin->impulse_response);
   EXPECT_EQ(0, ARRAY_COUNT(&plugin->ports));
 
   cras_dsp_ini_free(ini);
@@ -92,6 +97,20 @@ TEST_F(DspIniTestSuite, BuiltinPlugin) {
   cras_dsp_ini_free(ini);
 }
 
+TEST_F(DspIniTestSuite, ImpulseResponse) {
+  fprintf(fp, "[foo]\n");
+  fprintf(fp, "library=builtin\n");
+  fprintf(fp, "label=fir\n");
+  fprintf(fp, "impulse_response=/etc/cras/room.raw\n");
+  CloseFile();
+
+  struct ini* ini = cras_dsp_ini_create(filename);
+  EXPECT_EQ(1, ARRAY_COUNT(&ini->plugins));
+  struct plugin* plugin = ARRAY_ELEMENT(&ini->plugins, 0);
+  EXPECT_STREQ("/etc/cras/room.raw", plugin->impulse_response);
+  cras_dsp_ini_free(ini);
+}
+
 TEST_F(DspIniTestSuite, Ports) {
   fprintf(fp, "[foo]\n");
   fprintf(fp, "library=bar\n");
@@ -300,6 +319,274 @@ TEST_F(DspIniTestSuite, TwoChannelWithSwap) {
   cras_dsp_ini_free(ini);
 }
 
+TEST_F(DspIniTestSuite, CacheRoundTrip) {
+  fprintf(fp, "[foo]\n");
+  fprintf(fp, "library=builtin\n");
+  fprintf(fp, "label=source\n");
+  fprintf(fp, "purpose=playback\n");
+  fprintf(fp, "disable=\"#f\"\n");
+  fprintf(fp, "output_0={a0}\n");
+  fprintf(fp, "output_1={a1}\n");
+  fprintf(fp, "output_2=0.5\n");
+  fprintf(fp, "[bar]\n");
+  fprintf(fp, "library=builtin\n");
+  fprintf(fp, "label=sink\n");
+  fprintf(fp, "purpose=playback\n");
+  fprintf(fp, "input_0={a0}\n");
+  fprintf(fp, "input_1={a1}\n");
+  CloseFile();
+
+  std::string cache = std::string(filename) + ".cache";
+  struct ini* parsed = cras_dsp_ini_create_cached(filename, cache.c_str());
+  ASSERT_TRUE(parsed);
+  EXPECT_TRUE(parsed->dict);
+  EXPECT_EQ(NULL, parsed->cache);
+
+  struct ini* cached = cras_dsp_ini_create_cached(filename, cache.c_str());
+  ASSERT_TRUE(cached);
+  EXPECT_EQ(NULL, cached->dict);
+  EXPECT_TRUE(cached->cache);
+
+  /* 2 plugins and 1 swap_lr plugin. */
+  ASSERT_EQ(3, ARRAY_COUNT(&cached->plugins));
+  ASSERT_EQ(ARRAY_COUNT(&parsed->flows), ARRAY_COUNT(&cached->flows));
+  for (int i = 0; i < ARRAY_COUNT(&parsed->plugins); i++) {
+    struct plugin* p = ARRAY_ELEMENT(&parsed->plugins, i);
+    struct plugin* c = ARRAY_ELEMENT(&cached->plugins, i);
+    EXPECT_STREQ(p->title, c->title);
+    EXPECT_STREQ(p->library, c->library);
+    EXPECT_STREQ(p->label, c->label);
+    EXPECT_STREQ(p->purpose, c->purpose);
+    EXPECT_STREQ(p->disable, c->disable);
+    EXPECT_EQ(!!p->disable_expr, !!c->disable_expr);
+    EXPECT_EQ(NULL, c->impulse_response);
+    ASSERT_EQ(ARRAY_COUNT(&p->ports), ARRAY_COUNT(&c->ports));
+    for (int j = 0; j < ARRAY_COUNT(&p->ports); j++) {
+      struct port* pp = ARRAY_ELEMENT(&p->ports, j);
+      struct port* cp = ARRAY_ELEMENT(&c->ports, j);
+      EXPECT_EQ(pp->direction, cp->direction);
+      EXPECT_EQ(pp->type, cp->type);
+      EXPECT_EQ(pp->flow_id, cp->flow_id);
+      EXPECT_EQ(pp->init_value, cp->init_value);
+    }
+  }
+  for (int i = 0; i < ARRAY_COUNT(&parsed->flows); i++) {
+    struct flow* p = ARRAY_ELEMENT(&parsed->flows, i);
+    struct flow* c = ARRAY_ELEMENT(&cached->flows, i);
+    EXPECT_STREQ(p->name, c->name);
+    EXPECT_EQ(p->type, c->type);
+    EXPECT_EQ(ARRAY_INDEX(&parsed->plugins, p->from),
+              ARRAY_INDEX(&cached->plugins, c->from));
+    EXPECT_EQ(ARRAY_INDEX(&parsed->plugins, p->to),
+              ARRAY_INDEX(&cached->plugins, c->to));
+    EXPECT_EQ(p->from_port, c->from_port);
+    EXPECT_EQ(p->to_port, c->to_port);
+  }
+
+  cras_dsp_ini_free(parsed);
+  cras_dsp_ini_free(cached);
+  unlink(cache.c_str());
+}
+
+TEST_F(DspIniTestSuite, CacheRebuiltAfterIniChanges) {
+  fprintf(fp, "[foo]\n");
+  fprintf(fp, "library=foo.so\n");
+  fprintf(fp, "label=bar\n");
+  CloseFile();
+
+  std::string cache = std::string(filename) + ".cache";
+  struct ini* ini = cras_dsp_ini_create_cached(filename, cache.c_str());
+  ASSERT_TRUE(ini);
+  cras_dsp_ini_free(ini);
+
+  fp = fopen(filename, "a");
+  fprintf(fp, "[baz]\n");
+  fprintf(fp, "library=baz.so\n");
+  fprintf(fp, "label=baz\n");
+  CloseFile();
+
+  ini = cras_dsp_ini_create_cached(filename, cache.c_str());
+  ASSERT_TRUE(ini);
+  EXPECT_TRUE(ini->dict);
+  EXPECT_EQ(2, ARRAY_COUNT(&ini->plugins));
+  cras_dsp_ini_free(ini);
+
+  ini = cras_dsp_ini_create_cached(filename, cache.c_str());
+  ASSERT_TRUE(ini);
+  EXPECT_TRUE(ini->cache);
+  EXPECT_EQ(2, ARRAY_COUNT(&ini->plugins));
+  cras_dsp_ini_free(ini);
+  unlink(cache.c_str());
+}
+
+TEST_F(DspIniTestSuite, DamagedCacheIgnored) {
+  fprintf(fp, "[foo]\n");
+  fprintf(fp, "library=foo.so\n");
+  fprintf(fp, "label=bar\n");
+  CloseFile();
+
+  std::string cache = std::string(filename) + ".cache";
+  struct ini* ini = cras_dsp_ini_create_cached(filename, cache.c_str());
+  ASSERT_TRUE(ini);
+  cras_dsp_ini_free(ini);
+
+  /* Flip the last byte of the string table. */
+  FILE* cache_fp = fopen(cache.c_str(), "r+");
+  ASSERT_TRUE(cache_fp);
+  fseek(cache_fp, -1, SEEK_END);
+  fputc('x', cache_fp);
+  fclose(cache_fp);
+
+  ini = cras_dsp_ini_create_cached(filename, cache.c_str());
+  ASSERT_TRUE(ini);
+  EXPECT_TRUE(ini->dict);
+  EXPECT_EQ(NULL, ini->cache);
+  EXPECT_STREQ("bar", ARRAY_ELEMENT(&ini->plugins, 0)->label);
+  cras_dsp_ini_free(ini);
+  unlink(cache.c_str());
+}
+
+static void WriteEq2Plugin(FILE* fp) {
+  fprintf(fp, "[eq]\n");
+  fprintf(fp, "library=builtin\n");
+  fprintf(fp, "label=eq2\n");
+  fprintf(fp, "purpose=playback\n");
+  fprintf(fp, "input_0={a0}\n");
+  fprintf(fp, "input_1={a1}\n");
+  fprintf(fp, "output_2={b0}\n");
+  fprintf(fp, "output_3={b1}\n");
+  /* A peaking filter on the left channel, a lowpass on the right. */
+  fprintf(fp, "input_4=6\n");
+  fprintf(fp, "input_5=1000\n");
+  fprintf(fp, "input_6=2\n");
+  fprintf(fp, "input_7=-3\n");
+  fprintf(fp, "input_8=1\n");
+  fprintf(fp, "input_9=4000\n");
+  fprintf(fp, "input_10=0.7\n");
+  fprintf(fp, "input_11=0\n");
+}
+
+static void ExpectBiquad(const struct plugin_biquads* biquads,
+                         int channel,
+                         int index,
+                         enum biquad_type type,
+                         float freq,
+                         float Q,
+                         float gain) {
+  struct biquad bq;
+
+  biquad_set(&bq, type, freq / (biquads->rate / 2), Q, gain);
+  EXPECT_EQ(bq.b0, biquads->coefs[channel][index].b0);
+  EXPECT_EQ(bq.b1, biquads->coefs[channel][index].b1);
+  EXPECT_EQ(bq.b2, biquads->coefs[channel][index].b2);
+  EXPECT_EQ(bq.a1, biquads->coefs[channel][index].a1);
+  EXPECT_EQ(bq.a2, biquads->coefs[channel][index].a2);
+}
+
+TEST_F(DspIniTestSuite, Eq2BiquadsPrecomputed) {
+  WriteEq2Plugin(fp);
+  CloseFile();
+
+  struct ini* ini = cras_dsp_ini_create(filename);
+  ASSERT_TRUE(ini);
+  struct plugin* plugin = ARRAY_ELEMENT(&ini->plugins, 0);
+  ASSERT_STREQ("eq2", plugin->label);
+
+  const struct plugin_biquads* biquads =
+      cras_dsp_ini_plugin_biquads(plugin, 48000);
+  ASSERT_TRUE(biquads);
+  EXPECT_EQ(1, biquads->num_biquads[0]);
+  EXPECT_EQ(1, biquads->num_biquads[1]);
+  ExpectBiquad(biquads, 0, 0, BQ_PEAKING, 1000, 2, -3);
+  ExpectBiquad(biquads, 1, 0, BQ_LOWPASS, 4000, 0.7, 0);
+
+  biquads = cras_dsp_ini_plugin_biquads(plugin, 44100);
+  ASSERT_TRUE(biquads);
+  ExpectBiquad(biquads, 0, 0, BQ_PEAKING, 1000, 2, -3);
+
+  /* Other rates are left to the eq2 module. */
+  EXPECT_EQ(NULL, cras_dsp_ini_plugin_biquads(plugin, 16000));
+
+  /* The swap_lr plugin has no biquads. */
+  EXPECT_EQ(NULL, cras_dsp_ini_plugin_biquads(
+                      ARRAY_ELEMENT(&ini->plugins, 1), 48000));
+  cras_dsp_ini_free(ini);
+}
+
+TEST_F(DspIniTestSuite, Eq2BiquadsFromFlowNotPrecomputed) {
+  WriteEq2Plugin(fp);
+  fprintf(fp, "input_12=<gain>\n");
+  fprintf(fp, "input_13=1000\n");
+  fprintf(fp, "input_14=2\n");
+  fprintf(fp, "input_15=-3\n");
+  fprintf(fp, "input_16=6\n");
+  fprintf(fp, "input_17=1000\n");
+  fprintf(fp, "input_18=2\n");
+  fprintf(fp, "input_19=-3\n");
+  CloseFile();
+
+  struct ini* ini = cras_dsp_ini_create(filename);
+  ASSERT_TRUE(ini);
+  EXPECT_EQ(NULL, cras_dsp_ini_plugin_biquads(
+                      ARRAY_ELEMENT(&ini->plugins, 0), 48000));
+  cras_dsp_ini_free(ini);
+}
+
+TEST_F(DspIniTestSuite, CacheKeepsEq2Biquads) {
+  WriteEq2Plugin(fp);
+  CloseFile();
+
+  std::string cache = std::string(filename) + ".cache";
+  struct ini* parsed = cras_dsp_ini_create_cached(filename, cache.c_str());
+  ASSERT_TRUE(parsed);
+  struct ini* cached = cras_dsp_ini_create_cached(filename, cache.c_str());
+  ASSERT_TRUE(cached);
+  ASSERT_TRUE(cached->cache);
+
+  struct plugin* p = ARRAY_ELEMENT(&parsed->plugins, 0);
+  struct plugin* c = ARRAY_ELEMENT(&cached->plugins, 0);
+  ASSERT_EQ(p->num_biquads, c->num_biquads);
+  EXPECT_EQ(0, memcmp(p->biquads, c->biquads,
+                      p->num_biquads * sizeof(*p->biquads)));
+
+  cras_dsp_ini_free(parsed);
+  cras_dsp_ini_free(cached);
+  unlink(cache.c_str());
+}
+
+TEST_F(DspIniTestSuite, CompiledCacheMatchedByContent) {
+  WriteEq2Plugin(fp);
+  CloseFile();
+
+  std::string cache = std::string(filename) + ".cache";
+  ASSERT_EQ(0, cras_dsp_ini_compile(filename, cache.c_str()));
+
+  /* A copy of the ini file has another inode and modification time. */
+  std::string copy = std::string(filename) + ".copy";
+  std::string cmd = "cp " + std::string(filename) + " " + copy;
+  ASSERT_EQ(0, system(cmd.c_str()));
+
+  struct ini* ini = cras_dsp_ini_create_cached(copy.c_str(), cache.c_str());
+  ASSERT_TRUE(ini);
+  EXPECT_TRUE(ini->cache);
+  EXPECT_TRUE(cras_dsp_ini_plugin_biquads(ARRAY_ELEMENT(&ini->plugins, 0),
+                                          48000));
+  cras_dsp_ini_free(ini);
+
+  /* Once the content differs the cache is ignored. */
+  FILE* copy_fp = fopen(copy.c_str(), "r+");
+  ASSERT_TRUE(copy_fp);
+  fputc('#', copy_fp);
+  fclose(copy_fp);
+  ini = cras_dsp_ini_create_cached(copy.c_str(), cache.c_str());
+  ASSERT_TRUE(ini);
+  EXPECT_EQ(NULL, ini->cache);
+  cras_dsp_ini_free(ini);
+
+  unlink(copy.c_str());
+  unlink(cache.c_str());
+}
+
 }  //  namespace
 
 int main(int argc, char** argv) {
@@ -58,7 +58,7 @@ TEST_F(DspTestSuite, Simple) {
   fprintf(fp, "%s", content);
   CloseFile();
 
-  cras_dsp_init(filename);
+  cras_dsp_init(filename, NULL);
   struct cras_dsp_context *ctx1, *ctx3, *ctx4;
   ctx1 = cras_dsp_context_new(44100, "playback"); /* wrong purpose */
   ctx3 = cras_dsp_context_new(44100, "capture");
@@ -96,6 +96,137 @@ TEST_F(DspTestSuite, Simple) {
   cras_dsp_stop();
 }
 
+TEST_F(DspTestSuite, LockPipeline) {
+  const char* content =
+      "[M1]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=capture\n"
+      "output_0={audio}\n"
+      "[M2]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=capture\n"
+      "input_0={audio}\n"
+      "\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  cras_dsp_init(filename, NULL);
+  struct cras_dsp_context* ctx = cras_dsp_context_new(44100, "capture");
+  cras_dsp_load_pipeline(ctx);
+
+  struct pipeline* pipeline = cras_dsp_get_pipeline(ctx);
+  ASSERT_TRUE(pipeline);
+  cras_dsp_put_pipeline(ctx);
+
+  /* Readers skip the pipeline while it is locked. */
+  EXPECT_EQ(pipeline, cras_dsp_lock_pipeline(ctx));
+  EXPECT_EQ(NULL, cras_dsp_get_pipeline(ctx));
+  cras_dsp_unlock_pipeline(ctx);
+
+  EXPECT_EQ(pipeline, cras_dsp_get_pipeline(ctx));
+  cras_dsp_put_pipeline(ctx);
+
+  /* A reload publishes a new pipeline once no reader holds the old one. */
+  cras_dsp_reload_ini();
+  pipeline = cras_dsp_get_pipeline(ctx);
+  EXPECT_TRUE(pipeline);
+  cras_dsp_put_pipeline(ctx);
+
+  cras_dsp_context_free(ctx);
+  cras_dsp_stop();
+}
+
+TEST_F(DspTestSuite, Overloaded) {
+  const char* content =
+      "[M1]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=capture\n"
+      "output_0={audio}\n"
+      "disable=overloaded\n"
+      "[M2]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=capture\n"
+      "input_0={audio}\n"
+      "\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  cras_dsp_init(filename, NULL);
+  struct cras_dsp_context* ctx = cras_dsp_context_new(44100, "capture");
+  cras_dsp_load_pipeline(ctx);
+  ASSERT_TRUE(cras_dsp_get_pipeline(ctx));
+  cras_dsp_put_pipeline(ctx);
+
+  /* Pipelines are rebuilt without the plugins disabled by the load. */
+  cras_dsp_set_overloaded(1);
+  EXPECT_EQ(NULL, cras_dsp_get_pipeline(ctx));
+
+  /* Contexts created meanwhile see it too. */
+  struct cras_dsp_context* ctx2 = cras_dsp_context_new(44100, "capture");
+  cras_dsp_load_pipeline(ctx2);
+  EXPECT_EQ(NULL, cras_dsp_get_pipeline(ctx2));
+
+  cras_dsp_set_overloaded(0);
+  EXPECT_TRUE(cras_dsp_get_pipeline(ctx));
+  cras_dsp_put_pipeline(ctx);
+  EXPECT_TRUE(cras_dsp_get_pipeline(ctx2));
+  cras_dsp_put_pipeline(ctx2);
+
+  cras_dsp_context_free(ctx);
+  cras_dsp_context_free(ctx2);
+  cras_dsp_stop();
+}
+
+TEST_F(DspTestSuite, SetControl) {
+  const char* content =
+      "[M1]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=playback\n"
+      "output_0={l}\n"
+      "output_1={r}\n"
+      "input_2=3.0\n"
+      "[M2]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=playback\n"
+      "input_0={l}\n"
+      "input_1={r}\n"
+      "\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  cras_dsp_init(filename, NULL);
+  struct cras_dsp_context* ctx = cras_dsp_context_new(44100, "playback");
+  cras_dsp_load_pipeline(ctx);
+  struct pipeline* pipeline = cras_dsp_get_pipeline(ctx);
+  ASSERT_TRUE(pipeline);
+  cras_dsp_put_pipeline(ctx);
+
+  /* Only control ports set by the ini can change. */
+  EXPECT_EQ(-EINVAL, cras_dsp_set_control(ctx, "m1", 0, 1.0));
+
+  /* These modules can't take a value while running, a new pipeline is
+   * loaded with it. */
+  EXPECT_EQ(0, cras_dsp_set_control(ctx, "m1", 2, 5.0));
+  EXPECT_TRUE(cras_dsp_get_pipeline(ctx));
+  cras_dsp_put_pipeline(ctx);
+
+  /* The running pipeline swaps the stereo sink itself. */
+  pipeline = cras_dsp_get_pipeline(ctx);
+  cras_dsp_put_pipeline(ctx);
+  EXPECT_EQ(0, cras_dsp_set_swap_lr(ctx, 1));
+  EXPECT_EQ(pipeline, cras_dsp_get_pipeline(ctx));
+  cras_dsp_put_pipeline(ctx);
+
+  cras_dsp_context_free(ctx);
+  cras_dsp_stop();
+}
+
 static int empty_instantiate(struct dsp_module* module,
                              unsigned long sample_rate) {
   return 0;
@@ -147,6 +278,12 @@ struct dsp_module* cras_dsp_module_load_builtin(struct plugin* plugin) {
 }
 void cras_dsp_module_set_sink_ext_module(struct dsp_module* module,
                                          struct ext_dsp_module* ext_module) {}
+void cras_mix_pool_run(struct cras_mix_pool* pool,
+                       void (*fn)(void* job),
+                       void* jobs,
+                       size_t job_size,
+                       unsigned int num_jobs) {}
+struct audio_thread_event_log* atlog;
 }  // extern "C"
 
 int main(int argc, char** argv) {
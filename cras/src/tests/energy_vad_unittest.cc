@@ -0,0 +1,100 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "energy_vad.h"
+#include "ewma_power.h"
+}
+
+namespace {
+
+class EnergyVadTestSuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    ewma_power_init(&ewma_, SND_PCM_FORMAT_S16_LE, 48000);
+    energy_vad_init(&vad_, 48000);
+  }
+
+  // Feeds 10ms of a square wave of the given amplitude.
+  bool Feed(int16_t amplitude) {
+    int16_t buf[480];
+
+    for (int i = 0; i < 480; i++)
+      buf[i] = (i & 1) ? amplitude : -amplitude;
+    ewma_power_calculate(&ewma_, (uint8_t*)buf, 1, 480);
+    return energy_vad_update(&vad_, &ewma_, 480);
+  }
+
+  struct ewma_power ewma_;
+  struct energy_vad vad_;
+};
+
+TEST_F(EnergyVadTestSuite, StartsActiveThenHangsOver) {
+  int i;
+
+  EXPECT_TRUE(energy_vad_active(&vad_));
+
+  // Steady noise is learnt as the floor, voice ends after the hangover.
+  for (i = 0; i < 29; i++)
+    EXPECT_FALSE(Feed(100));
+  EXPECT_TRUE(energy_vad_active(&vad_));
+  EXPECT_TRUE(Feed(100));
+  EXPECT_FALSE(energy_vad_active(&vad_));
+  EXPECT_EQ(1, vad_.num_transitions);
+}
+
+TEST_F(EnergyVadTestSuite, VoiceAboveNoiseFloor) {
+  int i;
+
+  for (i = 0; i < 30; i++)
+    Feed(100);
+  ASSERT_FALSE(energy_vad_active(&vad_));
+
+  // Voice well above the floor is detected in the buffer it starts.
+  EXPECT_TRUE(Feed(3000));
+  EXPECT_TRUE(energy_vad_active(&vad_));
+
+  // A short pause doesn't end it.
+  for (i = 0; i < 10; i++)
+    Feed(100);
+  EXPECT_TRUE(energy_vad_active(&vad_));
+  for (i = 0; i < 30; i++)
+    Feed(100);
+  EXPECT_FALSE(energy_vad_active(&vad_));
+  EXPECT_EQ(3, vad_.num_transitions);
+}
+
+TEST_F(EnergyVadTestSuite, SilenceIsNeverVoice) {
+  int i;
+
+  for (i = 0; i < 30; i++)
+    Feed(0);
+  ASSERT_FALSE(energy_vad_active(&vad_));
+
+  // Under the absolute floor, however far above digital silence.
+  for (i = 0; i < 10; i++)
+    EXPECT_FALSE(Feed(20));
+  EXPECT_FALSE(energy_vad_active(&vad_));
+}
+
+TEST_F(EnergyVadTestSuite, DisabledMeterStaysActive) {
+  int i;
+
+  for (i = 0; i < 30; i++)
+    Feed(0);
+  ASSERT_FALSE(energy_vad_active(&vad_));
+
+  ewma_power_disable(&ewma_);
+  EXPECT_TRUE(Feed(0));
+  EXPECT_TRUE(energy_vad_active(&vad_));
+}
+
+}  //  namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -19,22 +19,22 @@ TEST(EWMAPower, RelativePowerValue) {
   for (i = 0; i < 480; i++)
     buf[i] = 0x00fe;
 
-  ewma_power_init(&ewma, 48000);
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S16_LE, 48000);
   EXPECT_EQ(48, ewma.step_fr);
 
-  ewma_power_calculate(&ewma, buf, 1, 480);
+  ewma_power_calculate(&ewma, (uint8_t*)buf, 1, 480);
   EXPECT_LT(0.0f, ewma.power);
 
   // After 10ms of silence the power value decreases.
   f = ewma.power;
   for (i = 0; i < 480; i++)
     buf[i] = 0x00;
-  ewma_power_calculate(&ewma, buf, 1, 480);
+  ewma_power_calculate(&ewma, (uint8_t*)buf, 1, 480);
   EXPECT_LT(ewma.power, f);
 
   // After 300ms of silence the power value decreases to insignificant low.
   for (i = 0; i < 30; i++)
-    ewma_power_calculate(&ewma, buf, 1, 480);
+    ewma_power_calculate(&ewma, (uint8_t*)buf, 1, 480);
   EXPECT_LT(ewma.power, 1.0e-10);
 }
 
@@ -44,35 +44,35 @@ TEST(EWMAPower, PowerInStereoData) {
   int i;
   float f;
 
-  ewma_power_init(&ewma, 48000);
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S16_LE, 48000);
 
   for (i = 0; i < 960; i += 2) {
     buf[i] = 0x0;
     buf[i + 1] = 0x00fe;
   }
-  ewma_power_calculate(&ewma, buf, 2, 480);
+  ewma_power_calculate(&ewma, (uint8_t*)buf, 2, 480);
   EXPECT_LT(0.0f, ewma.power);
 
   // After 10ms of silence the power value decreases.
   f = ewma.power;
   for (i = 0; i < 960; i++)
     buf[i] = 0x0;
-  ewma_power_calculate(&ewma, buf, 2, 480);
+  ewma_power_calculate(&ewma, (uint8_t*)buf, 2, 480);
   EXPECT_LT(ewma.power, f);
 
   // After 300ms of silence the power value decreases to insignificant low.
   for (i = 0; i < 30; i++)
-    ewma_power_calculate(&ewma, buf, 2, 480);
+    ewma_power_calculate(&ewma, (uint8_t*)buf, 2, 480);
   EXPECT_LT(ewma.power, 1.0e-10);
 
   // Assume the data is silent in the other channel.
-  ewma_power_init(&ewma, 48000);
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S16_LE, 48000);
 
   for (i = 0; i < 960; i += 2) {
     buf[i] = 0x0ffe;
     buf[i + 1] = 0x0;
   }
-  ewma_power_calculate(&ewma, buf, 2, 480);
+  ewma_power_calculate(&ewma, (uint8_t*)buf, 2, 480);
   EXPECT_LT(0.0f, ewma.power);
 }
 
@@ -95,8 +95,8 @@ TEST(EWMAPower, PowerInAudioArea) {
     buf[i + 2] = 0x0;
     buf[i + 3] = 0x0ffe;
   }
-  ewma_power_init(&ewma, 48000);
-  ewma_power_calculate_area(&ewma, buf, area, 480);
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S16_LE, 48000);
+  ewma_power_calculate_area(&ewma, (uint8_t*)buf, area, 480);
   f = ewma.power;
   EXPECT_LT(0.0f, f);
 
@@ -105,22 +105,95 @@ TEST(EWMAPower, PowerInAudioArea) {
   layout[CRAS_CH_FR] = 2;
   cras_audio_format_set_channel_layout(fmt, layout);
   cras_audio_area_config_channels(area, fmt);
-  ewma_power_init(&ewma, 48000);
-  ewma_power_calculate_area(&ewma, buf, area, 480);
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S16_LE, 48000);
+  ewma_power_calculate_area(&ewma, (uint8_t*)buf, area, 480);
   EXPECT_GT(f, ewma.power);
 
   /* Change layout to the two silent channels. Expect power is 0.0f. */
   layout[CRAS_CH_FL] = 1;
   cras_audio_format_set_channel_layout(fmt, layout);
   cras_audio_area_config_channels(area, fmt);
-  ewma_power_init(&ewma, 48000);
-  ewma_power_calculate_area(&ewma, buf, area, 480);
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S16_LE, 48000);
+  ewma_power_calculate_area(&ewma, (uint8_t*)buf, area, 480);
   EXPECT_EQ(0.0f, ewma.power);
 
   cras_audio_format_destroy(fmt);
   cras_audio_area_destroy(area);
 }
 
+TEST(EWMAPower, PowerInOtherFormats) {
+  struct ewma_power ewma;
+  int16_t buf16[960];
+  int32_t buf32[960];
+  uint8_t buf24_3[960 * 3];
+  float buf_float[960];
+  float f;
+  int i;
+
+  // Half of full scale in both channels.
+  for (i = 0; i < 960; i++) {
+    buf16[i] = 0x4000;
+    buf32[i] = 0x40000000;
+    buf24_3[i * 3] = 0;
+    buf24_3[i * 3 + 1] = 0;
+    buf24_3[i * 3 + 2] = 0x40;
+    buf_float[i] = 0.5f;
+  }
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S16_LE, 48000);
+  ewma_power_calculate(&ewma, (uint8_t*)buf16, 2, 480);
+  f = ewma.power;
+  EXPECT_FLOAT_EQ(0.25f, f);
+  EXPECT_FLOAT_EQ(0.5f, ewma.peak);
+
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S32_LE, 48000);
+  ewma_power_calculate(&ewma, (uint8_t*)buf32, 2, 480);
+  EXPECT_FLOAT_EQ(f, ewma.power);
+  EXPECT_FLOAT_EQ(0.5f, ewma.peak);
+
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S24_3LE, 48000);
+  ewma_power_calculate(&ewma, buf24_3, 2, 480);
+  EXPECT_FLOAT_EQ(f, ewma.power);
+
+  ewma_power_init(&ewma, SND_PCM_FORMAT_FLOAT_LE, 48000);
+  ewma_power_calculate(&ewma, (uint8_t*)buf_float, 2, 480);
+  EXPECT_FLOAT_EQ(f, ewma.power);
+  EXPECT_FLOAT_EQ(0.5f, ewma.peak);
+
+  // S24_LE keeps the sign in bit 23, the top byte is padding.
+  for (i = 0; i < 960; i++)
+    buf32[i] = 0x7fc00000;
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S24_LE, 48000);
+  ewma_power_calculate(&ewma, (uint8_t*)buf32, 2, 480);
+  EXPECT_FLOAT_EQ(f, ewma.power);
+  EXPECT_FLOAT_EQ(0.5f, ewma.peak);
+
+  // Unsupported formats leave the meter disabled.
+  ewma_power_init(&ewma, SND_PCM_FORMAT_U8, 48000);
+  EXPECT_FALSE(ewma.enabled);
+  EXPECT_EQ(0.0f, ewma_power_get(&ewma));
+}
+
+TEST(EWMAPower, PeakOfLatestBuffer) {
+  struct ewma_power ewma;
+  int16_t buf[960];
+  int i;
+
+  for (i = 0; i < 960; i++)
+    buf[i] = 0;
+  buf[96 * 2 + 1] = -0x2000;
+
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S16_LE, 48000);
+  EXPECT_EQ(0.0f, ewma_power_get_peak(&ewma));
+  ewma_power_calculate(&ewma, (uint8_t*)buf, 2, 480);
+  EXPECT_FLOAT_EQ(0.25f, ewma_power_get_peak(&ewma));
+  EXPECT_LT(0.0f, ewma_power_get(&ewma));
+
+  // The peak only covers the latest buffer.
+  buf[96 * 2 + 1] = 0;
+  ewma_power_calculate(&ewma, (uint8_t*)buf, 2, 480);
+  EXPECT_EQ(0.0f, ewma_power_get_peak(&ewma));
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
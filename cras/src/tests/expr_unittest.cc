@@ -240,6 +240,38 @@ TEST(ExprTest, Builtin) {
   cras_expr_env_free(&env);
 }
 
+TEST(ExprTest, EvalInSeveralEnvironments) {
+  struct cras_expr_expression* expr;
+  struct cras_expr_env env1 = CRAS_EXPR_ENV_INIT;
+  struct cras_expr_env env2 = CRAS_EXPR_ENV_INIT;
+  char boolean;
+
+  /* the variables are at different slots in each environment */
+  cras_expr_env_install_builtins(&env1);
+  cras_expr_env_set_variable_string(&env1, "dsp_name", "drc");
+  cras_expr_env_set_variable_boolean(&env1, "disable_drc", 0);
+  cras_expr_env_set_variable_boolean(&env2, "disable_drc", 1);
+  cras_expr_env_install_builtins(&env2);
+
+  expr = cras_expr_expression_parse(
+      "(or disable_drc (not (equal? dsp_name \"drc\")))");
+  ASSERT_NE(nullptr, expr->program);
+
+  EXPECT_EQ(0, cras_expr_expression_eval_boolean(expr, &env1, &boolean));
+  EXPECT_EQ(0, boolean);
+  EXPECT_EQ(0, cras_expr_expression_eval_boolean(expr, &env2, &boolean));
+  EXPECT_EQ(1, boolean);
+
+  /* a changed variable is picked up on the next evaluation */
+  cras_expr_env_set_variable_string(&env1, "dsp_name", "eq");
+  EXPECT_EQ(0, cras_expr_expression_eval_boolean(expr, &env1, &boolean));
+  EXPECT_EQ(1, boolean);
+
+  cras_expr_expression_free(expr);
+  cras_expr_env_free(&env1);
+  cras_expr_env_free(&env2);
+}
+
 }  //  namespace
 
 int main(int argc, char** argv) {
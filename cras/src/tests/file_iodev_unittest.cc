@@ -0,0 +1,215 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+extern "C" {
+#include "cras_audio_area.h"
+#include "cras_file_iodev.h"
+#include "cras_iodev.h"
+#include "cras_virtual_clock.h"
+}
+
+static struct timespec clock_gettime_retspec;
+static struct cras_audio_format fake_format;
+static cras_audio_area mock_audio_area;
+static uint8_t* config_buf_pointers_base;
+static unsigned int iodev_list_add_output_called;
+static unsigned int iodev_list_add_input_called;
+
+namespace {
+
+class FileIodevTest : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    char name[64];
+
+    snprintf(name, sizeof(name), "/file_iodev_%d.raw", getpid());
+    path_ = std::string(CRAS_UT_TMPDIR) + name;
+    clock_gettime_retspec.tv_sec = 1;
+    clock_gettime_retspec.tv_nsec = 0;
+    cras_virtual_clock_enable();
+    fake_format.format = SND_PCM_FORMAT_S16_LE;
+    fake_format.frame_rate = 48000;
+    fake_format.num_channels = 2;
+    iodev_list_add_output_called = 0;
+    iodev_list_add_input_called = 0;
+  }
+
+  virtual void TearDown() { unlink(path_.c_str()); }
+
+  void Advance(long nsec) {
+    struct timespec delta = {0, nsec};
+    cras_virtual_clock_advance(&delta);
+  }
+
+  std::string path_;
+};
+
+TEST_F(FileIodevTest, OutputRunsOnVirtualClock) {
+  struct cras_iodev* iodev;
+  struct timespec ts;
+  cras_audio_area* area;
+  unsigned nframes;
+  int16_t samples[960];
+  struct stat st;
+  int fd;
+
+  iodev = file_iodev_create(CRAS_STREAM_OUTPUT, path_.c_str());
+  ASSERT_NE((void*)NULL, iodev);
+  EXPECT_EQ(1, iodev_list_add_output_called);
+  iodev->format = &fake_format;
+  ASSERT_EQ(0, iodev->configure_dev(iodev));
+
+  nframes = 480;
+  iodev->get_buffer(iodev, &area, &nframes);
+  ASSERT_EQ(480, nframes);
+  for (int i = 0; i < 960; i++)
+    ((int16_t*)config_buf_pointers_base)[i] = i;
+  ASSERT_EQ(0, iodev->put_buffer(iodev, nframes));
+  EXPECT_EQ(480, iodev->frames_queued(iodev, &ts));
+
+  /* The real clock stands still, only the virtual clock drains the
+   * device. */
+  Advance(5000000);
+  EXPECT_EQ(240, iodev->frames_queued(iodev, &ts));
+  EXPECT_EQ(1, ts.tv_sec);
+  EXPECT_EQ(5000000, ts.tv_nsec);
+  Advance(10000000);
+  EXPECT_EQ(0, iodev->frames_queued(iodev, &ts));
+
+  iodev->close_dev(iodev);
+  file_iodev_destroy(iodev);
+
+  ASSERT_EQ(0, stat(path_.c_str(), &st));
+  ASSERT_EQ(960 * sizeof(int16_t), st.st_size);
+  fd = open(path_.c_str(), O_RDONLY);
+  ASSERT_EQ(sizeof(samples), read(fd, samples, sizeof(samples)));
+  close(fd);
+  for (int i = 0; i < 960; i++)
+    ASSERT_EQ(i, samples[i]);
+}
+
+TEST_F(FileIodevTest, InputReadsFileThenSilence) {
+  struct cras_iodev* iodev;
+  struct timespec ts;
+  cras_audio_area* area;
+  unsigned nframes;
+  int16_t samples[200];
+  int16_t* buf;
+  int fd;
+
+  for (int i = 0; i < 200; i++)
+    samples[i] = i + 1;
+  fd = open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  ASSERT_EQ(sizeof(samples), write(fd, samples, sizeof(samples)));
+  close(fd);
+
+  iodev = file_iodev_create(CRAS_STREAM_INPUT, path_.c_str());
+  ASSERT_NE((void*)NULL, iodev);
+  EXPECT_EQ(1, iodev_list_add_input_called);
+  iodev->format = &fake_format;
+  ASSERT_EQ(0, iodev->configure_dev(iodev));
+  EXPECT_EQ(0, iodev->frames_queued(iodev, &ts));
+
+  Advance(1000000);
+  ASSERT_EQ(48, iodev->frames_queued(iodev, &ts));
+  nframes = 60;
+  iodev->get_buffer(iodev, &area, &nframes);
+  ASSERT_EQ(48, nframes);
+  buf = (int16_t*)config_buf_pointers_base;
+  for (int i = 0; i < 96; i++)
+    ASSERT_EQ(i + 1, buf[i]);
+  ASSERT_EQ(0, iodev->put_buffer(iodev, nframes));
+
+  /* The file holds 100 frames, the rest is captured as silence. */
+  Advance(2000000);
+  nframes = 96;
+  iodev->get_buffer(iodev, &area, &nframes);
+  ASSERT_EQ(96, nframes);
+  buf = (int16_t*)config_buf_pointers_base;
+  for (int i = 0; i < 104; i++)
+    ASSERT_EQ(i + 97, buf[i]);
+  for (int i = 104; i < 192; i++)
+    ASSERT_EQ(0, buf[i]);
+  ASSERT_EQ(0, iodev->put_buffer(iodev, nframes));
+
+  iodev->close_dev(iodev);
+  file_iodev_destroy(iodev);
+}
+
+TEST_F(FileIodevTest, MissingInputFile) {
+  EXPECT_EQ(NULL, file_iodev_create(CRAS_STREAM_INPUT, path_.c_str()));
+  EXPECT_EQ(0, iodev_list_add_input_called);
+}
+
+}  // namespace
+
+extern "C" {
+
+int cras_iodev_default_no_stream_playback(struct cras_iodev* odev, int enable) {
+  return 0;
+}
+
+void cras_iodev_init_audio_area(struct cras_iodev* iodev, int num_channels) {
+  iodev->area = &mock_audio_area;
+}
+
+void cras_iodev_free_audio_area(struct cras_iodev* iodev) {}
+
+void cras_audio_area_config_buf_pointers(struct cras_audio_area* area,
+                                         const struct cras_audio_format* fmt,
+                                         uint8_t* base_buffer) {
+  config_buf_pointers_base = base_buffer;
+}
+
+int cras_iodev_list_add_output(struct cras_iodev* output) {
+  iodev_list_add_output_called++;
+  return 0;
+}
+
+int cras_iodev_list_add_input(struct cras_iodev* input) {
+  iodev_list_add_input_called++;
+  return 0;
+}
+
+int cras_iodev_list_rm_input(struct cras_iodev* input) {
+  return 0;
+}
+
+int cras_iodev_list_rm_output(struct cras_iodev* output) {
+  return 0;
+}
+
+void cras_iodev_free_resources(struct cras_iodev* iodev) {}
+
+void cras_iodev_add_node(struct cras_iodev* iodev, struct cras_ionode* node) {
+  iodev->nodes = node;
+}
+
+void cras_iodev_set_active_node(struct cras_iodev* iodev,
+                                struct cras_ionode* node) {
+  iodev->active_node = node;
+}
+
+//  From librt.
+int clock_gettime(clockid_t clk_id, struct timespec* tp) {
+  tp->tv_sec = clock_gettime_retspec.tv_sec;
+  tp->tv_nsec = clock_gettime_retspec.tv_nsec;
+  return 0;
+}
+
+}  // extern "C"
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
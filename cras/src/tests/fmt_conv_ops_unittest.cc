@@ -11,6 +11,7 @@
 #include <memory>
 
 extern "C" {
+#include "cras_channel_matrix.h"
 #include "cras_fmt_conv_ops.h"
 #include "cras_types.h"
 }
@@ -227,6 +228,46 @@ TEST(FormatConverterOpsTest, ConvertS16LEToS32LE) {
   }
 }
 
+// Test the packed and 32 bit conversions to and from S16_LE for every length
+// around the vector width, so both the vector loop and the tail are used and
+// nothing is written past the end.
+TEST(FormatConverterOpsTest, ConvertS16LEWideFormatsAllLengths) {
+  const size_t max_samples = 40;
+
+  S243LEPtr s243 = CreateS243LE(max_samples);
+  S24LEPtr s24 = CreateS24LE(max_samples);
+  S32LEPtr s32 = CreateS32LE(max_samples);
+  S16LEPtr s16 = CreateS16LE(max_samples);
+
+  for (size_t n = 0; n < max_samples; ++n) {
+    int16_t dst16[max_samples + 1];
+    uint8_t dst243[(max_samples + 1) * 3];
+
+    dst16[n] = 0x5a5a;
+    convert_s243le_to_s16le(s243.get(), n, (uint8_t*)dst16);
+    for (size_t i = 0; i < n; ++i)
+      EXPECT_EQ((int16_t)(ToS243LE(s243.get() + i * 3) >> 8), dst16[i]);
+    EXPECT_EQ(0x5a5a, dst16[n]);
+
+    convert_s24le_to_s16le((uint8_t*)s24.get(), n, (uint8_t*)dst16);
+    for (size_t i = 0; i < n; ++i)
+      EXPECT_EQ((int16_t)((s24[i] & 0x00ffffff) >> 8), dst16[i]);
+    EXPECT_EQ(0x5a5a, dst16[n]);
+
+    convert_s32le_to_s16le((uint8_t*)s32.get(), n, (uint8_t*)dst16);
+    for (size_t i = 0; i < n; ++i)
+      EXPECT_EQ((int16_t)(s32[i] >> 16), dst16[i]);
+    EXPECT_EQ(0x5a5a, dst16[n]);
+
+    memset(dst243 + n * 3, 0x5a, 3);
+    convert_s16le_to_s243le((uint8_t*)s16.get(), n, dst243);
+    for (size_t i = 0; i < n; ++i)
+      EXPECT_EQ((int32_t)((uint32_t)(uint16_t)s16[i] << 8),
+                ToS243LE(dst243 + i * 3));
+    EXPECT_EQ(0x5a5a5a, ToS243LE(dst243 + n * 3));
+  }
+}
+
 // Test Mono to Stereo conversion.  S16_LE.
 TEST(FormatConverterOpsTest, MonoToStereoS16LE) {
   const size_t frames = 4096;
@@ -595,6 +636,27 @@ TEST(FormatConverterOpsTest, StereoToQuadS16LEDefault) {
   }
 }
 
+// Test Stereo to Quad conversion.  S16_LE, Specify in the default order.
+TEST(FormatConverterOpsTest, StereoToQuadS16LEInOrder) {
+  const size_t frames = 4095;
+  const size_t in_ch = 2;
+  const size_t out_ch = 4;
+
+  S16LEPtr src = CreateS16LE(frames * in_ch);
+  S16LEPtr dst = CreateS16LE(frames * out_ch);
+
+  size_t ret = s16_stereo_to_quad(0, 1, 2, 3, (uint8_t*)src.get(), frames,
+                                  (uint8_t*)dst.get());
+  EXPECT_EQ(ret, frames);
+
+  for (size_t i = 0; i < frames; ++i) {
+    EXPECT_EQ(src[i * 2 + 0], dst[i * 4 + 0]);
+    EXPECT_EQ(src[i * 2 + 0], dst[i * 4 + 2]);
+    EXPECT_EQ(src[i * 2 + 1], dst[i * 4 + 1]);
+    EXPECT_EQ(src[i * 2 + 1], dst[i * 4 + 3]);
+  }
+}
+
 // Test Quad to Stereo conversion.  S16_LE, Specify.
 TEST(FormatConverterOpsTest, QuadToStereoS16LESpecify) {
   const size_t frames = 4096;
@@ -755,6 +817,74 @@ TEST(FormatConverterOpsTest, ConvertChannelsS16LE) {
   }
 }
 
+// Fills out_ch rows of in_ch coefficients with every third one zero.
+static std::unique_ptr<float*[]> CreateSparseMatrix(FloatPtr& coef,
+                                                    size_t in_ch,
+                                                    size_t out_ch) {
+  std::unique_ptr<float*[]> mtx(new float*[out_ch]);
+  for (size_t i = 0; i < out_ch; ++i) {
+    mtx[i] = &coef[i * in_ch];
+    for (size_t k = 0; k < in_ch; ++k)
+      if ((i * in_ch + k) % 3 == 0)
+        mtx[i][k] = 0;
+  }
+  return mtx;
+}
+
+// Test the sparse converter matches the dense one.  S16_LE.
+TEST(FormatConverterOpsTest, SparseConvertChannelsS16LE) {
+  const size_t frames = 4096 + 13;
+  const size_t in_ch = 8;
+  const size_t out_ch = 2;
+
+  S16LEPtr src = CreateS16LE(frames * in_ch);
+  S16LEPtr dst = CreateS16LE(frames * out_ch);
+  S16LEPtr exp = CreateS16LE(frames * out_ch);
+  FloatPtr ch_conv_mtx = CreateFloat(out_ch * in_ch);
+  std::unique_ptr<float*[]> mtx =
+      CreateSparseMatrix(ch_conv_mtx, in_ch, out_ch);
+  struct cras_channel_matrix* m =
+      cras_channel_matrix_create(mtx.get(), in_ch, out_ch);
+  ASSERT_NE((void*)NULL, m);
+
+  s16_convert_channels(mtx.get(), in_ch, out_ch, (uint8_t*)src.get(), frames,
+                       (uint8_t*)exp.get());
+  size_t ret = s16_sparse_convert_channels(m, (uint8_t*)src.get(), frames,
+                                           (uint8_t*)dst.get());
+  EXPECT_EQ(ret, frames);
+  for (size_t i = 0; i < frames * out_ch; ++i)
+    EXPECT_EQ(exp[i], dst[i]);
+
+  cras_channel_matrix_destroy(m);
+}
+
+// Test the sparse converter matches the dense one.  Float.
+TEST(FormatConverterOpsTest, SparseConvertChannelsF32) {
+  const size_t frames = 4096 + 13;
+  const size_t in_ch = 6;
+  const size_t out_ch = 8;
+
+  FloatPtr src = CreateFloat(frames * in_ch);
+  FloatPtr dst = CreateFloat(frames * out_ch);
+  FloatPtr exp = CreateFloat(frames * out_ch);
+  FloatPtr ch_conv_mtx = CreateFloat(out_ch * in_ch);
+  std::unique_ptr<float*[]> mtx =
+      CreateSparseMatrix(ch_conv_mtx, in_ch, out_ch);
+  struct cras_channel_matrix* m =
+      cras_channel_matrix_create(mtx.get(), in_ch, out_ch);
+  ASSERT_NE((void*)NULL, m);
+
+  f32_convert_channels(mtx.get(), in_ch, out_ch, (uint8_t*)src.get(), frames,
+                       (uint8_t*)exp.get());
+  size_t ret = f32_sparse_convert_channels(m, (uint8_t*)src.get(), frames,
+                                           (uint8_t*)dst.get());
+  EXPECT_EQ(ret, frames);
+  for (size_t i = 0; i < frames * out_ch; ++i)
+    EXPECT_FLOAT_EQ(exp[i], dst[i]);
+
+  cras_channel_matrix_destroy(m);
+}
+
 // Test Stereo to 20ch conversion.  S16_LE.
 TEST(FormatConverterOpsTest, TwoToTwentyS16LE) {
   const size_t frames = 4096;
@@ -814,6 +944,67 @@ TEST(FormatConverterOpsTest, TwentyToTwoS16LE) {
   }
 }
 
+// Test S24_LE to float and back is lossless.
+TEST(FormatConverterOpsTest, ConvertS24LEToFloatRoundTrip) {
+  const size_t frames = 4096;
+  const size_t ch = 2;
+
+  S24LEPtr src = CreateS24LE(frames * ch);
+  FloatPtr tmp = CreateFloat(frames * ch);
+  S24LEPtr dst = CreateS24LE(frames * ch);
+
+  convert_s24le_to_f32le((uint8_t*)src.get(), frames * ch,
+                         (uint8_t*)tmp.get());
+  convert_f32le_to_s24le((uint8_t*)tmp.get(), frames * ch,
+                         (uint8_t*)dst.get());
+
+  for (size_t i = 0; i < frames * ch; ++i) {
+    int32_t expected = (int32_t)((uint32_t)src[i] << 8) >> 8;
+    EXPECT_FLOAT_EQ(expected / 8388608.0f, tmp[i]);
+    EXPECT_EQ(expected, dst[i]);
+  }
+}
+
+// Test float to S16_LE conversion clips out of range samples.
+TEST(FormatConverterOpsTest, ConvertFloatToS16LEClip) {
+  float src[4] = {1.5f, -1.5f, 0.5f, -0.5f};
+  int16_t dst[4];
+
+  convert_f32le_to_s16le((uint8_t*)src, 4, (uint8_t*)dst);
+
+  EXPECT_EQ(INT16_MAX, dst[0]);
+  EXPECT_EQ(INT16_MIN, dst[1]);
+  EXPECT_EQ(16384, dst[2]);
+  EXPECT_EQ(-16384, dst[3]);
+}
+
+// Test float Stereo to Mono conversion.
+TEST(FormatConverterOpsTest, StereoToMonoF32) {
+  const size_t frames = 4096;
+  const size_t in_ch = 2;
+  const size_t out_ch = 1;
+
+  FloatPtr src = CreateFloat(frames * in_ch);
+  FloatPtr dst = CreateFloat(frames * out_ch);
+
+  size_t ret = f32_stereo_to_mono((uint8_t*)src.get(), frames,
+                                  (uint8_t*)dst.get());
+  EXPECT_EQ(ret, frames);
+
+  for (size_t i = 0; i < frames; ++i)
+    EXPECT_FLOAT_EQ(MIN(src[i * 2] + src[i * 2 + 1], 1.0f), dst[i]);
+}
+
+// Test the generic ops table points at the plain C converters.
+TEST(FormatConverterOpsTest, GenericOpsTable) {
+  EXPECT_EQ(&convert_s24le_to_s16le, fmt_conv_ops.convert_s24le_to_s16le);
+  EXPECT_EQ(&s16_mono_to_stereo, fmt_conv_ops.s16_mono_to_stereo);
+  EXPECT_EQ(&s16_51_to_stereo, fmt_conv_ops.s16_51_to_stereo);
+  EXPECT_EQ(&s16_multiply_buf_with_coef,
+            fmt_conv_ops.s16_multiply_buf_with_coef);
+  EXPECT_EQ(&f32_convert_channels, fmt_conv_ops.f32_convert_channels);
+}
+
 extern "C" {}  // extern "C"
 
 int main(int argc, char** argv) {
@@ -4,11 +4,14 @@
 
 #include <gtest/gtest.h>
 #include <math.h>
+#include <pthread.h>
 #include <sys/param.h>
 
 extern "C" {
+#include "cras_channel_matrix.h"
 #include "cras_fmt_conv.h"
 #include "cras_types.h"
+#include "utlist.h"
 }
 
 static int mono_channel_layout[CRAS_CH_MAX] = {-1, -1, -1, -1, 0, -1,
@@ -23,6 +26,8 @@ static int surround_channel_unknown_layout[CRAS_CH_MAX] = {
     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
 static int quad_channel_layout[CRAS_CH_MAX] = {0,  1,  2,  3,  -1, -1,
                                                -1, -1, -1, -1, -1};
+static int surround71_channel_layout[CRAS_CH_MAX] = {0, 1, 2,  3,  4, 5,
+                                                     6, 7, -1, -1, -1};
 static int linear_resampler_needed_val;
 static double linear_resampler_ratio = 1.0;
 static unsigned int linear_resampler_num_channels;
@@ -75,25 +80,23 @@ TEST(FormatConverterTest, SmallFramesSRCWithLinearResampler) {
   EXPECT_EQ(out_fmt.frame_rate, linear_resampler_src_rate);
   EXPECT_EQ(out_fmt.frame_rate, linear_resampler_dst_rate);
 
-  /* When process on small buffers doing SRC 16KHz -> 48KHz,
-   * speex does the work in two steps:
+  /* When process on small buffers doing SRC 16KHz -> 48KHz, the
+   * polyphase resampler takes only the input it needs and keeps the
+   * phase it stopped at:
    *
-   * (1) 0 -> 2 frames in output
-   * (2) 1 -> 1 frame in output
-   *
-   * Total result is 1 frame consumed in input and generated
-   * 3 frames in output.
+   * (1) 1 -> 2 frames in output, third phase of the frame pending
+   * (2) 1 -> 2 frames in output, pending phase then the next frame
    */
   out_frames = cras_fmt_conv_convert_frames(
       c, (uint8_t*)in_buf, (uint8_t*)out_buf, &in_frames, out_frames);
   EXPECT_EQ(2, out_frames);
-  EXPECT_EQ(0, in_frames);
+  EXPECT_EQ(1, in_frames);
 
   in_frames = 1;
   out_frames = 2;
   out_frames = cras_fmt_conv_convert_frames(
       c, (uint8_t*)in_buf, (uint8_t*)out_buf, &in_frames, out_frames);
-  EXPECT_EQ(1, out_frames);
+  EXPECT_EQ(2, out_frames);
   EXPECT_EQ(1, in_frames);
 
   cras_fmt_conv_destroy(&c);
@@ -101,6 +104,31 @@ TEST(FormatConverterTest, SmallFramesSRCWithLinearResampler) {
   free(out_buf);
 }
 
+// The delay is the one of the sample rate converter, in input frames.
+TEST(FormatConverterTest, SRCDelay) {
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  struct cras_fmt_conv* c;
+
+  ResetStub();
+  in_fmt.format = out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = out_fmt.num_channels = 2;
+  in_fmt.frame_rate = out_fmt.frame_rate = 48000;
+  EXPECT_EQ(0, cras_fmt_conv_get_delay(NULL));
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, 4096, 0);
+  ASSERT_NE((void*)NULL, c);
+  EXPECT_EQ(0, cras_fmt_conv_get_delay(c));
+  cras_fmt_conv_destroy(&c);
+
+  // Polyphase filter of 32 taps by default.
+  in_fmt.frame_rate = 44100;
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, 4096, 0);
+  ASSERT_NE((void*)NULL, c);
+  EXPECT_EQ(15, cras_fmt_conv_get_delay(c));
+  cras_fmt_conv_destroy(&c);
+}
+
 // Only support LE, BE should fail.
 TEST(FormatConverterTest, InvalidParamsOnlyLE) {
   struct cras_audio_format in_fmt;
@@ -672,6 +700,83 @@ TEST(FormatConverterTest, Convert2To1) {
   free(out_buff);
 }
 
+// Test changing the SRC quality keeps the converter working.
+TEST(FormatConverterTest, SetSrcQuality) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  size_t out_frames;
+  int16_t* in_buff;
+  int16_t* out_buff;
+  const size_t buf_size = 4096;
+  unsigned int in_buf_size = 480;
+
+  ResetStub();
+  in_fmt.format = out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 44100;
+  out_fmt.frame_rate = 48000;
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c, (void*)NULL);
+  EXPECT_EQ(0, cras_fmt_conv_set_src_quality(c, CRAS_SRC_QUALITY_HIGH));
+  EXPECT_EQ(0, cras_fmt_conv_set_src_quality(c, CRAS_SRC_QUALITY_HIGH));
+  EXPECT_EQ(0,
+            cras_fmt_conv_set_src_quality(c, CRAS_SRC_QUALITY_LOW_LATENCY));
+
+  in_buff = (int16_t*)ralloc(buf_size * cras_get_format_bytes(&in_fmt));
+  out_buff = (int16_t*)ralloc(buf_size * cras_get_format_bytes(&out_fmt));
+  out_frames = cras_fmt_conv_convert_frames(
+      c, (uint8_t*)in_buff, (uint8_t*)out_buff, &in_buf_size, buf_size);
+  EXPECT_EQ(480, in_buf_size);
+  EXPECT_NEAR(480 * 48000 / 44100, out_frames, 1);
+
+  cras_fmt_conv_destroy(&c);
+  free(in_buff);
+  free(out_buff);
+}
+
+// Test the linear quality resamples with the linear resampler.
+TEST(FormatConverterTest, LinearSrcQuality) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  size_t out_frames;
+  int16_t* in_buff;
+  int16_t* out_buff;
+  const size_t buf_size = 4096;
+  unsigned int in_buf_size = 441;
+
+  ResetStub();
+  in_fmt.format = out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = out_fmt.num_channels = 1;
+  in_fmt.frame_rate = 44100;
+  out_fmt.frame_rate = 48000;
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c, (void*)NULL);
+  EXPECT_EQ(0, cras_fmt_conv_set_src_quality(c, CRAS_SRC_QUALITY_LINEAR));
+  EXPECT_EQ(44100, linear_resampler_src_rate);
+  EXPECT_EQ(48000, linear_resampler_dst_rate);
+  EXPECT_EQ(1, cras_fmt_conv_get_delay(c));
+
+  linear_resampler_ratio = 48000.0 / 44100.0;
+  in_buff = (int16_t*)ralloc(buf_size * cras_get_format_bytes(&in_fmt));
+  out_buff = (int16_t*)ralloc(buf_size * cras_get_format_bytes(&out_fmt));
+  out_frames = cras_fmt_conv_convert_frames(
+      c, (uint8_t*)in_buff, (uint8_t*)out_buff, &in_buf_size, buf_size);
+  EXPECT_EQ(441, in_buf_size);
+  EXPECT_EQ(480, out_frames);
+
+  // Back to the filters.
+  EXPECT_EQ(0, cras_fmt_conv_set_src_quality(c, CRAS_SRC_QUALITY_DEFAULT));
+  EXPECT_NE(1, cras_fmt_conv_get_delay(c));
+
+  cras_fmt_conv_destroy(&c);
+  free(in_buff);
+  free(out_buff);
+}
+
 // Test 1 to 2 SRC.
 TEST(FormatConverterTest, Convert1To2) {
   struct cras_fmt_conv* c;
@@ -778,6 +883,129 @@ TEST(FormatConverterTest, ConvertS32LEToS16LE) {
   free(out_buff);
 }
 
+// Test 24 to 32 bit conversion keeps all 24 bits.
+TEST(FormatConverterTest, ConvertS24LEToS32LE) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+
+  size_t out_frames;
+  int32_t* in_buff;
+  int32_t* out_buff;
+  const size_t buf_size = 4096;
+  unsigned int in_buf_size = 4096;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S24_LE;
+  out_fmt.format = SND_PCM_FORMAT_S32_LE;
+  in_fmt.num_channels = out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c, (void*)NULL);
+
+  out_frames = cras_fmt_conv_in_frames_to_out(c, buf_size);
+  EXPECT_EQ(buf_size, out_frames);
+
+  in_buff = (int32_t*)ralloc(buf_size * cras_get_format_bytes(&in_fmt));
+  out_buff = (int32_t*)ralloc(buf_size * cras_get_format_bytes(&out_fmt));
+  out_frames = cras_fmt_conv_convert_frames(
+      c, (uint8_t*)in_buff, (uint8_t*)out_buff, &in_buf_size, buf_size);
+  EXPECT_EQ(buf_size, out_frames);
+  for (unsigned int i = 0; i < buf_size * 2; i++)
+    EXPECT_EQ((int32_t)((uint32_t)in_buff[i] << 8), out_buff[i]);
+
+  cras_fmt_conv_destroy(&c);
+  free(in_buff);
+  free(out_buff);
+}
+
+// Test 32 bit to float conversion.
+TEST(FormatConverterTest, ConvertS32LEToFloatLE) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+
+  size_t out_frames;
+  int32_t* in_buff;
+  float* out_buff;
+  const size_t buf_size = 4096;
+  unsigned int in_buf_size = 4096;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S32_LE;
+  out_fmt.format = SND_PCM_FORMAT_FLOAT_LE;
+  in_fmt.num_channels = out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c, (void*)NULL);
+  EXPECT_EQ(1, cras_fmt_conversion_needed(c));
+
+  in_buff = (int32_t*)ralloc(buf_size * cras_get_format_bytes(&in_fmt));
+  out_buff = (float*)ralloc(buf_size * cras_get_format_bytes(&out_fmt));
+  out_frames = cras_fmt_conv_convert_frames(
+      c, (uint8_t*)in_buff, (uint8_t*)out_buff, &in_buf_size, buf_size);
+  EXPECT_EQ(buf_size, out_frames);
+  for (unsigned int i = 0; i < buf_size * 2; i++)
+    EXPECT_FLOAT_EQ((in_buff[i] >> 8) / 8388608.0f, out_buff[i]);
+
+  cras_fmt_conv_destroy(&c);
+  free(in_buff);
+  free(out_buff);
+}
+
+// Test float to 16 bit conversion, out of range samples are clipped.
+TEST(FormatConverterTest, ConvertFloatLEToS16LE) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  const float in_buff[8] = { 0.5f, -0.5f, 0.0f, -1.0f,
+                             0.25f, 1.5f,  -2.0f, 1.0f };
+  const int16_t expected[8] = { 16384, -16384, 0,      -32768,
+                                8192,  32767,  -32768, 32767 };
+  int16_t out_buff[8];
+  unsigned int in_buf_size = 4;
+  size_t out_frames;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_FLOAT_LE;
+  out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, 4, 0);
+  ASSERT_NE(c, (void*)NULL);
+  EXPECT_EQ(1, cras_fmt_conversion_needed(c));
+
+  out_frames = cras_fmt_conv_convert_frames(
+      c, (uint8_t*)in_buff, (uint8_t*)out_buff, &in_buf_size, 4);
+  EXPECT_EQ(4, out_frames);
+  for (unsigned int i = 0; i < 8; i++)
+    EXPECT_EQ(expected[i], out_buff[i]);
+
+  cras_fmt_conv_destroy(&c);
+}
+
+// Same format with nothing else to do passes the samples through.
+TEST(FormatConverterTest, S24LEPassThrough) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format fmt;
+
+  ResetStub();
+  fmt.format = SND_PCM_FORMAT_S24_LE;
+  fmt.num_channels = 2;
+  fmt.frame_rate = 48000;
+
+  c = cras_fmt_conv_create(&fmt, &fmt, 4096, 0);
+  ASSERT_NE(c, (void*)NULL);
+  EXPECT_EQ(0, cras_fmt_conversion_needed(c));
+  cras_fmt_conv_destroy(&c);
+}
+
 // Test 24 to 16 bit conversion.
 TEST(FormatConverterTest, ConvertS24LEToS16LE) {
   struct cras_fmt_conv* c;
@@ -1276,6 +1504,114 @@ TEST(FormatConverterTest, ConvertS16LEToS16LEStereoToQuad) {
   free(out_buff);
 }
 
+// Test 7.1 to stereo mixes channels by their layout.
+TEST(FormatConverterTest, ConvertS16LEToS16LE71ToStereo) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+
+  size_t out_frames;
+  int16_t* in_buff;
+  int16_t* out_buff;
+  const size_t buf_size = 4096;
+  unsigned int in_buf_size = 4096;
+  const float scale = 1 + 4 * 0.707;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S16_LE;
+  out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = 8;
+  out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+  for (unsigned int i = 0; i < CRAS_CH_MAX; i++) {
+    in_fmt.channel_layout[i] = surround71_channel_layout[i];
+    out_fmt.channel_layout[i] = stereo_channel_layout[i];
+  }
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c, (void*)NULL);
+
+  in_buff = (int16_t*)calloc(buf_size, cras_get_format_bytes(&in_fmt));
+  for (unsigned int i = 0; i < buf_size; i++) {
+    in_buff[i * 8] = 1000;      // FL
+    in_buff[i * 8 + 4] = 2000;  // FC
+    in_buff[i * 8 + 7] = 3000;  // SR
+  }
+
+  out_buff = (int16_t*)malloc(buf_size * cras_get_format_bytes(&out_fmt));
+  out_frames = cras_fmt_conv_convert_frames(
+      c, (uint8_t*)in_buff, (uint8_t*)out_buff, &in_buf_size, buf_size);
+  EXPECT_EQ(buf_size, out_frames);
+  for (unsigned int i = 0; i < buf_size; i++) {
+    EXPECT_NEAR((1000 + 0.707 * 2000) / scale, out_buff[2 * i], 1);
+    EXPECT_NEAR(0.707 * (2000 + 3000) / scale, out_buff[2 * i + 1], 1);
+  }
+
+  cras_fmt_conv_destroy(&c);
+  free(in_buff);
+  free(out_buff);
+}
+
+// Test a matrix set on the converter replaces the default one.
+TEST(FormatConverterTest, SetChannelMatrix) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  struct cras_channel_matrix *list = NULL, *m;
+  float swap_rows[2][8] = {{0, 1}, {1}};
+  float* rows[2] = {swap_rows[0], swap_rows[1]};
+
+  size_t out_frames;
+  int16_t* in_buff;
+  int16_t* out_buff;
+  const size_t buf_size = 4096;
+  unsigned int in_buf_size = 4096;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S16_LE;
+  out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = 8;
+  out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+  for (unsigned int i = 0; i < CRAS_CH_MAX; i++) {
+    in_fmt.channel_layout[i] = surround71_channel_layout[i];
+    out_fmt.channel_layout[i] = stereo_channel_layout[i];
+  }
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c, (void*)NULL);
+
+  // Only the matrix matching the channel counts is used.
+  m = cras_channel_matrix_create(rows, 2, 2);
+  DL_APPEND(list, m);
+  m = cras_channel_matrix_create(rows, 8, 2);
+  DL_APPEND(list, m);
+  EXPECT_EQ(0, cras_fmt_conv_set_channel_matrix(c, list));
+  cras_channel_matrix_destroy_list(list);
+
+  in_buff = (int16_t*)calloc(buf_size, cras_get_format_bytes(&in_fmt));
+  for (unsigned int i = 0; i < buf_size; i++) {
+    in_buff[i * 8] = 1000;
+    in_buff[i * 8 + 1] = 2000;
+    in_buff[i * 8 + 4] = 3000;
+  }
+
+  out_buff = (int16_t*)malloc(buf_size * cras_get_format_bytes(&out_fmt));
+  out_frames = cras_fmt_conv_convert_frames(
+      c, (uint8_t*)in_buff, (uint8_t*)out_buff, &in_buf_size, buf_size);
+  EXPECT_EQ(buf_size, out_frames);
+  for (unsigned int i = 0; i < buf_size; i++) {
+    EXPECT_EQ(2000, out_buff[2 * i]);
+    EXPECT_EQ(1000, out_buff[2 * i + 1]);
+  }
+
+  cras_fmt_conv_destroy(&c);
+  free(in_buff);
+  free(out_buff);
+}
+
 // Test 32 bit 5.1 to 16 bit stereo conversion with SRC 1 to 2.
 TEST(FormatConverterTest, ConvertS32LEToS16LEDownmix51ToStereo48To96) {
   struct cras_fmt_conv* c;
@@ -1577,6 +1913,50 @@ TEST(FormatConverterTest, Convert96to48PostLinearResample) {
   free(out_buff);
 }
 
+// Test the drift of a converter changing rates goes into its SRC, leaving
+// the linear resampler idle.
+TEST(FormatConverterTest, SrcAbsorbsDrift) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  size_t out_frames;
+  int16_t* in_buff;
+  int16_t* out_buff;
+  const size_t buf_size = 4096;
+  unsigned int in_buf_size = 441;
+
+  ResetStub();
+  in_fmt.format = out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 44100;
+  out_fmt.frame_rate = 48000;
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c, (void*)NULL);
+  cras_fmt_conv_set_linear_resample_rates(c, 48000, 48480);
+  EXPECT_EQ(48000, linear_resampler_src_rate);
+  EXPECT_EQ(48000, linear_resampler_dst_rate);
+  EXPECT_EQ(485, cras_fmt_conv_in_frames_to_out(c, 441));
+  EXPECT_EQ(441, cras_fmt_conv_out_frames_to_in(c, 484));
+
+  in_buff = (int16_t*)ralloc(buf_size * cras_get_format_bytes(&in_fmt));
+  out_buff = (int16_t*)ralloc(buf_size * cras_get_format_bytes(&out_fmt));
+  out_frames = cras_fmt_conv_convert_frames(
+      c, (uint8_t*)in_buff, (uint8_t*)out_buff, &in_buf_size, buf_size);
+  EXPECT_EQ(441, in_buf_size);
+  EXPECT_NEAR(485, out_frames, 1);
+
+  // A reused converter starts back at the nominal ratio.
+  cras_fmt_conv_destroy(&c);
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c, (void*)NULL);
+  EXPECT_EQ(480, cras_fmt_conv_in_frames_to_out(c, 441));
+
+  cras_fmt_conv_destroy(&c);
+  free(in_buff);
+  free(out_buff);
+}
+
 // Test format converter created in config_format_converter
 TEST(FormatConverterTest, ConfigConverter) {
   int i;
@@ -1596,12 +1976,213 @@ TEST(FormatConverterTest, ConfigConverter) {
     out_fmt.channel_layout[i] = stereo_channel_layout[i];
   }
 
-  config_format_converter(&c, CRAS_STREAM_OUTPUT, &in_fmt, &out_fmt, 4096);
+  config_format_converter(&c, CRAS_STREAM_OUTPUT, &in_fmt, &out_fmt, 4096,
+                          CRAS_SRC_QUALITY_DEFAULT);
+  ASSERT_NE(c, (void*)NULL);
+
+  cras_fmt_conv_destroy(&c);
+}
+
+TEST(FormatConverterTest, ReuseDestroyedConverter) {
+  struct cras_fmt_conv *c, *first, *reused, *other;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  int i;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S16_LE;
+  out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = 2;
+  out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 44100;
+  out_fmt.frame_rate = 48000;
+  for (i = 0; i < CRAS_CH_MAX; i++) {
+    in_fmt.channel_layout[i] = stereo_channel_layout[i];
+    out_fmt.channel_layout[i] = stereo_channel_layout[i];
+  }
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, 4096, 0);
+  ASSERT_NE(c, (void*)NULL);
+  first = c;
+  cras_fmt_conv_set_linear_resample_rates(c, 48000, 48100);
+  cras_fmt_conv_destroy(&c);
+  EXPECT_EQ(c, (void*)NULL);
+
+  // A different max_frames needs a new converter.
+  other = cras_fmt_conv_create(&in_fmt, &out_fmt, 2048, 0);
+  ASSERT_NE(other, (void*)NULL);
+
+  // The same formats get the destroyed converter back, with the linear
+  // resampler rewound to the output rate.
+  reused = cras_fmt_conv_create(&in_fmt, &out_fmt, 4096, 0);
+  EXPECT_EQ(first, reused);
+  EXPECT_EQ(48000, linear_resampler_src_rate);
+  EXPECT_EQ(48000, linear_resampler_dst_rate);
+
+  cras_fmt_conv_destroy(&reused);
+  cras_fmt_conv_destroy(&other);
+}
+
+// Test converters run on a thread share their intermediate buffers.
+TEST(FormatConverterTest, ConvertersShareScratch) {
+  struct cras_fmt_conv *c1, *c2, *c3;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  const size_t buf_size = 4096;
+  unsigned int in_frames;
+  size_t scratch;
+  uint8_t* in_buff;
+  uint8_t* out_buff;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S16_LE;
+  out_fmt.format = SND_PCM_FORMAT_S32_LE;
+  in_fmt.num_channels = 2;
+  out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+  for (int i = 0; i < CRAS_CH_MAX; i++) {
+    in_fmt.channel_layout[i] = stereo_channel_layout[i];
+    out_fmt.channel_layout[i] = stereo_channel_layout[i];
+  }
+
+  c1 = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c1, (void*)NULL);
+  c2 = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c2, (void*)NULL);
+
+  in_buff = (uint8_t*)ralloc(buf_size * cras_get_format_bytes(&in_fmt));
+  out_buff = (uint8_t*)ralloc(buf_size * cras_get_format_bytes(&out_fmt));
+  in_frames = buf_size;
+  EXPECT_EQ(buf_size, cras_fmt_conv_convert_frames(c1, in_buff, out_buff,
+                                                   &in_frames, buf_size));
+  scratch = cras_fmt_conv_get_scratch_bytes();
+  EXPECT_LT(0, scratch);
+
+  // The second converter runs on the same buffers.
+  in_frames = buf_size;
+  EXPECT_EQ(buf_size, cras_fmt_conv_convert_frames(c2, in_buff, out_buff,
+                                                   &in_frames, buf_size));
+  EXPECT_EQ(scratch, cras_fmt_conv_get_scratch_bytes());
+
+  // A smaller one fits in the front of it.
+  c3 = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size / 4, 0);
+  ASSERT_NE(c3, (void*)NULL);
+  in_frames = buf_size / 4;
+  EXPECT_EQ(buf_size / 4,
+            cras_fmt_conv_convert_frames(c3, in_buff, out_buff, &in_frames,
+                                         buf_size / 4));
+  EXPECT_EQ(scratch, cras_fmt_conv_get_scratch_bytes());
+
+  cras_fmt_conv_destroy(&c1);
+  cras_fmt_conv_destroy(&c2);
+  cras_fmt_conv_destroy(&c3);
+  free(in_buff);
+  free(out_buff);
+}
+
+static void* convert_mono_to_stereo(void* arg) {
+  struct cras_fmt_conv* c = (struct cras_fmt_conv*)arg;
+  const size_t buf_size = 1024;
+  unsigned int in_frames = buf_size;
+  int16_t* in_buff;
+  int16_t* out_buff;
+  size_t* out_frames;
+
+  in_buff = (int16_t*)ralloc(buf_size * 2);
+  out_buff = (int16_t*)ralloc(buf_size * 4);
+  out_frames = (size_t*)malloc(sizeof(*out_frames));
+  *out_frames = cras_fmt_conv_convert_frames(
+      c, (uint8_t*)in_buff, (uint8_t*)out_buff, &in_frames, buf_size);
+  free(in_buff);
+  free(out_buff);
+  return out_frames;
+}
+
+static void* reserve_and_convert(void* arg) {
+  struct cras_fmt_conv* c = (struct cras_fmt_conv*)arg;
+  const size_t buf_size = 4096;
+  unsigned int in_frames = buf_size;
+  uint8_t* in_buff;
+  uint8_t* out_buff;
+  size_t reserved;
+  int grew;
+
+  EXPECT_EQ(0, cras_fmt_conv_get_scratch_bytes());
+  EXPECT_EQ(0, cras_fmt_conv_reserve_scratch());
+  reserved = cras_fmt_conv_get_scratch_bytes();
+  EXPECT_EQ(cras_fmt_conv_get_scratch_needed(), reserved);
+
+  in_buff = (uint8_t*)ralloc(buf_size * 2 * 2);
+  out_buff = (uint8_t*)ralloc(buf_size * 4 * 2);
+  EXPECT_EQ(buf_size, cras_fmt_conv_convert_frames(c, in_buff, out_buff,
+                                                   &in_frames, buf_size));
+  grew = cras_fmt_conv_get_scratch_bytes() != reserved;
+  free(in_buff);
+  free(out_buff);
+  return (void*)(intptr_t)grew;
+}
+
+// Test a thread reserving scratch up front doesn't grow it to convert.
+TEST(FormatConverterTest, ReserveScratch) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  const size_t buf_size = 4096;
+  pthread_t tid;
+  void* grew;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S16_LE;
+  out_fmt.format = SND_PCM_FORMAT_S32_LE;
+  in_fmt.num_channels = 2;
+  out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+  for (int i = 0; i < CRAS_CH_MAX; i++) {
+    in_fmt.channel_layout[i] = stereo_channel_layout[i];
+    out_fmt.channel_layout[i] = stereo_channel_layout[i];
+  }
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
   ASSERT_NE(c, (void*)NULL);
+  EXPECT_LT(0, cras_fmt_conv_get_scratch_needed());
+
+  ASSERT_EQ(0, pthread_create(&tid, NULL, reserve_and_convert, c));
+  ASSERT_EQ(0, pthread_join(tid, &grew));
+  EXPECT_EQ(NULL, grew);
 
   cras_fmt_conv_destroy(&c);
 }
 
+// Test a single converter needs no scratch, on a thread that never converted.
+TEST(FormatConverterTest, SingleConverterOnNewThread) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  const size_t buf_size = 1024;
+  size_t* out_frames;
+  pthread_t tid;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S16_LE;
+  out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = 1;
+  out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c, (void*)NULL);
+
+  ASSERT_EQ(0, pthread_create(&tid, NULL, convert_mono_to_stereo, c));
+  ASSERT_EQ(0, pthread_join(tid, (void**)&out_frames));
+  EXPECT_EQ(buf_size, *out_frames);
+
+  free(out_frames);
+  cras_fmt_conv_destroy(&c);
+}
+
 // Test format converter not created when in/out format conversion is not
 // needed.
 TEST(FormatConverterTest, ConfigConverterNoNeed) {
@@ -1622,7 +2203,8 @@ TEST(FormatConverterTest, ConfigConverterNoNeed) {
     out_fmt.channel_layout[i] = stereo_channel_layout[i];
   }
 
-  config_format_converter(&c, CRAS_STREAM_OUTPUT, &in_fmt, &out_fmt, 4096);
+  config_format_converter(&c, CRAS_STREAM_OUTPUT, &in_fmt, &out_fmt, 4096,
+                          CRAS_SRC_QUALITY_DEFAULT);
   EXPECT_NE(c, (void*)NULL);
   EXPECT_EQ(0, cras_fmt_conversion_needed(c));
   cras_fmt_conv_destroy(&c);
@@ -1650,12 +2232,122 @@ TEST(FormatConverterTest, ConfigConverterNoNeedForInput) {
     out_fmt.channel_layout[i] = kmic_channel_layout[i];
   }
 
-  config_format_converter(&c, CRAS_STREAM_INPUT, &in_fmt, &out_fmt, 4096);
+  config_format_converter(&c, CRAS_STREAM_INPUT, &in_fmt, &out_fmt, 4096,
+                          CRAS_SRC_QUALITY_DEFAULT);
   EXPECT_NE(c, (void*)NULL);
   EXPECT_EQ(0, cras_fmt_conversion_needed(c));
   cras_fmt_conv_destroy(&c);
 }
 
+// Test an input converter drops the device channels the stream doesn't read
+// before it converts the format of the rest.
+TEST(FormatConverterTest, ConfigConverterPicksInputChannels) {
+  struct cras_fmt_conv* c = NULL;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  const struct cras_audio_format* ofmt;
+  const size_t buf_size = 256;
+  unsigned int in_frames = buf_size;
+  int16_t* in_buff;
+  int32_t* out_buff;
+  size_t out_frames;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S16_LE;
+  out_fmt.format = SND_PCM_FORMAT_S32_LE;
+  in_fmt.num_channels = 8;
+  out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+  for (unsigned int i = 0; i < CRAS_CH_MAX; i++) {
+    in_fmt.channel_layout[i] = surround71_channel_layout[i];
+    out_fmt.channel_layout[i] = -1;
+  }
+  // The stream reads RL and FC.
+  out_fmt.channel_layout[CRAS_CH_RL] = 0;
+  out_fmt.channel_layout[CRAS_CH_FC] = 1;
+
+  config_format_converter(&c, CRAS_STREAM_INPUT, &in_fmt, &out_fmt, buf_size,
+                          CRAS_SRC_QUALITY_DEFAULT);
+  ASSERT_NE(c, (void*)NULL);
+  EXPECT_NE(0, cras_fmt_conversion_needed(c));
+  ofmt = cras_fmt_conv_out_format(c);
+  EXPECT_EQ(2, ofmt->num_channels);
+  EXPECT_EQ(SND_PCM_FORMAT_S32_LE, ofmt->format);
+  EXPECT_EQ(0, ofmt->channel_layout[CRAS_CH_RL]);
+  EXPECT_EQ(1, ofmt->channel_layout[CRAS_CH_FC]);
+  EXPECT_EQ(-1, ofmt->channel_layout[CRAS_CH_FL]);
+  EXPECT_EQ(-1, ofmt->channel_layout[CRAS_CH_SR]);
+
+  in_buff = (int16_t*)ralloc(buf_size * cras_get_format_bytes(&in_fmt));
+  out_buff = (int32_t*)ralloc(buf_size * cras_get_format_bytes(ofmt));
+  out_frames = cras_fmt_conv_convert_frames(
+      c, (uint8_t*)in_buff, (uint8_t*)out_buff, &in_frames, buf_size);
+  EXPECT_EQ(buf_size, out_frames);
+  for (unsigned int i = 0; i < buf_size; i++) {
+    EXPECT_EQ((int32_t)((uint32_t)in_buff[i * 8 + 2] << 16),
+              out_buff[i * 2]);
+    EXPECT_EQ((int32_t)((uint32_t)in_buff[i * 8 + 4] << 16),
+              out_buff[i * 2 + 1]);
+  }
+
+  cras_fmt_conv_destroy(&c);
+  free(in_buff);
+  free(out_buff);
+}
+
+// Test the channels kept for capture match what the stream reads.
+TEST(FormatConverterTest, CaptureChannels) {
+  struct cras_audio_format dev_fmt;
+  struct cras_audio_format fmt;
+  struct cras_audio_format stream_fmt;
+
+  dev_fmt.format = SND_PCM_FORMAT_S16_LE;
+  dev_fmt.frame_rate = 48000;
+  dev_fmt.num_channels = 8;
+  for (unsigned int i = 0; i < CRAS_CH_MAX; i++)
+    dev_fmt.channel_layout[i] = surround71_channel_layout[i];
+  stream_fmt = dev_fmt;
+
+  // A mono stream at FC reads FL and FR.
+  stream_fmt.num_channels = 1;
+  for (unsigned int i = 0; i < CRAS_CH_MAX; i++)
+    stream_fmt.channel_layout[i] = mono_channel_layout[i];
+  fmt = dev_fmt;
+  cras_fmt_conv_capture_channels(&fmt, &stream_fmt);
+  EXPECT_EQ(2, fmt.num_channels);
+  EXPECT_EQ(0, fmt.channel_layout[CRAS_CH_FL]);
+  EXPECT_EQ(1, fmt.channel_layout[CRAS_CH_FR]);
+  EXPECT_EQ(-1, fmt.channel_layout[CRAS_CH_FC]);
+
+  // A single channel left at FL would be read as FR too, keep them all.
+  stream_fmt.num_channels = 2;
+  for (unsigned int i = 0; i < CRAS_CH_MAX; i++)
+    stream_fmt.channel_layout[i] = -1;
+  stream_fmt.channel_layout[CRAS_CH_FL] = 0;
+  fmt = dev_fmt;
+  cras_fmt_conv_capture_channels(&fmt, &stream_fmt);
+  EXPECT_EQ(8, fmt.num_channels);
+
+  // Without a layout the stream reads nothing, keep them all.
+  stream_fmt.channel_layout[CRAS_CH_FL] = -1;
+  fmt = dev_fmt;
+  cras_fmt_conv_capture_channels(&fmt, &stream_fmt);
+  EXPECT_EQ(8, fmt.num_channels);
+  EXPECT_EQ(0, memcmp(fmt.channel_layout, dev_fmt.channel_layout,
+                      sizeof(fmt.channel_layout)));
+
+  // A stereo stream keeps FL and FR, in device order.
+  stream_fmt.channel_layout[CRAS_CH_FL] = 1;
+  stream_fmt.channel_layout[CRAS_CH_FR] = 0;
+  fmt = dev_fmt;
+  cras_fmt_conv_capture_channels(&fmt, &stream_fmt);
+  EXPECT_EQ(2, fmt.num_channels);
+  EXPECT_EQ(0, fmt.channel_layout[CRAS_CH_FL]);
+  EXPECT_EQ(1, fmt.channel_layout[CRAS_CH_FR]);
+  EXPECT_EQ(-1, fmt.channel_layout[CRAS_CH_RL]);
+}
+
 TEST(ChannelRemixTest, ChannelRemixAppliedOrNot) {
   float coeff[4] = {0.5, 0.5, 0.26, 0.73};
   struct cras_fmt_conv* conv;
@@ -1671,12 +2363,6 @@ TEST(ChannelRemixTest, ChannelRemixAppliedOrNot) {
 
   memcpy(res, buf, 50 * 4);
 
-  /* Remix conversion will not apply for non S16_LE format. */
-  fmt.format = SND_PCM_FORMAT_S24_LE;
-  cras_channel_remix_convert(conv, &fmt, (uint8_t*)buf, 50);
-  for (i = 0; i < 100; i++)
-    EXPECT_EQ(res[i], buf[i]);
-
   for (i = 0; i < 100; i += 2) {
     res[i] = coeff[0] * buf[i];
     res[i] += coeff[1] * buf[i + 1];
@@ -1700,6 +2386,31 @@ TEST(ChannelRemixTest, ChannelRemixAppliedOrNot) {
   free(res);
 }
 
+TEST(ChannelRemixTest, ChannelRemixS24LE) {
+  float coeff[4] = {0.5, 0.5, 0.26, 0.73};
+  struct cras_fmt_conv* conv;
+  struct cras_audio_format fmt;
+  int32_t buf[100], res[100];
+  unsigned i;
+
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S24_LE;
+  conv = cras_channel_remix_conv_create(2, coeff);
+
+  for (i = 0; i < 100; i++)
+    buf[i] = (rand() & 0xffffff) - 0x800000;
+  for (i = 0; i < 100; i += 2) {
+    res[i] = coeff[0] * buf[i] + coeff[1] * buf[i + 1];
+    res[i + 1] = coeff[2] * buf[i] + coeff[3] * buf[i + 1];
+  }
+
+  cras_channel_remix_convert(conv, &fmt, (uint8_t*)buf, 50);
+  for (i = 0; i < 100; i++)
+    EXPECT_NEAR(res[i], buf[i], 1);
+
+  cras_fmt_conv_destroy(&conv);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -1736,13 +2447,21 @@ struct linear_resampler* linear_resampler_create(unsigned int num_channels,
   ;
 }
 
+struct linear_resampler* linear_resampler_create_float(
+    unsigned int num_channels,
+    float src_rate,
+    float dst_rate) {
+  return linear_resampler_create(num_channels, sizeof(float), src_rate,
+                                 dst_rate);
+}
+
 int linear_resampler_needed(struct linear_resampler* lr) {
   return linear_resampler_needed_val;
 }
 
 void linear_resampler_set_rates(struct linear_resampler* lr,
-                                unsigned int from,
-                                unsigned int to) {
+                                float from,
+                                float to) {
   linear_resampler_src_rate = from;
   linear_resampler_dst_rate = to;
 }
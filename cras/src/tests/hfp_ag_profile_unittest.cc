@@ -25,6 +25,10 @@ static size_t cras_bt_device_notify_profile_dropped_called;
 static struct cras_bt_device* cras_bt_device_notify_profile_dropped_dev;
 static enum cras_bt_device_profile
     cras_bt_device_notify_profile_dropped_profile;
+static void (*cras_tm_timer_cb)(struct cras_timer* t, void* data);
+static void* cras_tm_timer_cb_data;
+static size_t cras_tm_cancel_timer_called;
+static int cras_bt_device_set_nodes_plugged_value;
 
 static void ResetStubData() {
   hfp_alsa_iodev_create_called = 0;
@@ -32,6 +36,10 @@ static void ResetStubData() {
   hfp_iodev_create_called = 0;
   hfp_iodev_destroy_called = 0;
   cras_bt_device_notify_profile_dropped_called = 0;
+  cras_tm_timer_cb = NULL;
+  cras_tm_timer_cb_data = NULL;
+  cras_tm_cancel_timer_called = 0;
+  cras_bt_device_set_nodes_plugged_value = -1;
 }
 
 namespace {
@@ -93,6 +101,39 @@ TEST_F(HfpAgProfile, StartWithScoPCM) {
   EXPECT_EQ(2, hfp_alsa_iodev_destroy_called);
 }
 
+TEST_F(HfpAgProfile, ScoPCMFailureFallsBackToHfpInfo) {
+  int ret;
+  struct cras_bt_profile* bt_profile;
+
+  with_sco_pcm = 1;
+  fake_device = (struct cras_bt_device*)0xdeadbeef;
+  cras_hfp_ag_profile_create(NULL);
+  bt_profile = internal_bt_profile;
+  bt_profile->new_connection(NULL, bt_profile, fake_device, 0);
+
+  ret = cras_hfp_ag_start(fake_device);
+  EXPECT_EQ(0, ret);
+  EXPECT_EQ(2, hfp_alsa_iodev_create_called);
+
+  /* Both iodevs failing report once, the switch waits for the timer. */
+  cras_hfp_ag_sco_pcm_failed(fake_device);
+  cras_hfp_ag_sco_pcm_failed(fake_device);
+  ASSERT_NE((void*)NULL, (void*)cras_tm_timer_cb);
+  EXPECT_EQ(0, hfp_alsa_iodev_destroy_called);
+
+  cras_tm_timer_cb(NULL, cras_tm_timer_cb_data);
+  EXPECT_EQ(2, hfp_alsa_iodev_destroy_called);
+  EXPECT_EQ(2, hfp_iodev_create_called);
+  EXPECT_EQ(1, cras_bt_device_set_nodes_plugged_value);
+  /* The service level connection is kept. */
+  EXPECT_EQ(0, cras_bt_device_notify_profile_dropped_called);
+
+  bt_profile->release(bt_profile);
+  EXPECT_EQ(2, hfp_iodev_destroy_called);
+  EXPECT_EQ(2, hfp_alsa_iodev_destroy_called);
+  EXPECT_EQ(0, cras_tm_cancel_timer_called);
+}
+
 TEST_F(HfpAgProfile, RemoveConflictAG) {
   struct cras_bt_profile* bt_profile;
   struct cras_bt_device* new_dev =
@@ -302,6 +343,29 @@ int cras_server_metrics_hfp_wideband_selected_codec(int codec) {
   return HFP_CODEC_ID_MSBC;
 }
 
+struct cras_tm* cras_system_state_get_tm() {
+  return NULL;
+}
+
+struct cras_timer* cras_tm_create_timer(struct cras_tm* tm,
+                                        unsigned int ms,
+                                        void (*cb)(struct cras_timer* t,
+                                                   void* data),
+                                        void* cb_data) {
+  cras_tm_timer_cb = cb;
+  cras_tm_timer_cb_data = cb_data;
+  return reinterpret_cast<struct cras_timer*>(0x123);
+}
+
+void cras_tm_cancel_timer(struct cras_tm* tm, struct cras_timer* t) {
+  cras_tm_cancel_timer_called++;
+}
+
+void cras_bt_device_set_nodes_plugged(struct cras_bt_device* device,
+                                      int plugged) {
+  cras_bt_device_set_nodes_plugged_value = plugged;
+}
+
 }  // extern "C"
 
 int main(int argc, char** argv) {
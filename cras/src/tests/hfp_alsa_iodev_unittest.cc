@@ -34,6 +34,7 @@ static size_t cras_iodev_free_resources_called;
 static size_t cras_iodev_set_format_called;
 static size_t hfp_set_call_status_called;
 static size_t hfp_event_speaker_gain_called;
+static size_t cras_hfp_ag_sco_pcm_failed_called;
 
 #define _FAKE_CALL1(name)             \
   static size_t fake_##name##_called; \
@@ -81,6 +82,7 @@ static void ResetStubData() {
   cras_iodev_set_format_called = 0;
   hfp_set_call_status_called = 0;
   hfp_event_speaker_gain_called = 0;
+  cras_hfp_ag_sco_pcm_failed_called = 0;
 
   fake_sco_out.open_dev = fake_sco_in.open_dev =
       (int (*)(struct cras_iodev*))fake_open_dev;
@@ -265,6 +267,25 @@ TEST_F(HfpAlsaIodev, ConfigureDev) {
   hfp_alsa_iodev_destroy(iodev);
 }
 
+static int fake_configure_dev_error(struct cras_iodev* iodev) {
+  return -EIO;
+}
+
+TEST_F(HfpAlsaIodev, ConfigureDevFailureFallsBack) {
+  struct cras_iodev* iodev;
+
+  fake_sco_out.direction = CRAS_STREAM_OUTPUT;
+  fake_sco_out.configure_dev = fake_configure_dev_error;
+  iodev = hfp_alsa_iodev_create(&fake_sco_out, fake_device, fake_slc,
+                                CRAS_BT_DEVICE_PROFILE_HFP_AUDIOGATEWAY);
+  iodev->format = &fake_format;
+
+  EXPECT_EQ(-EIO, iodev->configure_dev(iodev));
+  EXPECT_EQ(1, cras_hfp_ag_sco_pcm_failed_called);
+
+  hfp_alsa_iodev_destroy(iodev);
+}
+
 TEST_F(HfpAlsaIodev, CloseDev) {
   struct cras_iodev* iodev;
 
@@ -527,6 +548,10 @@ int cras_bt_device_get_sco(struct cras_bt_device* device, int codec) {
 
 void cras_bt_device_put_sco(struct cras_bt_device* device) {}
 
+void cras_hfp_ag_sco_pcm_failed(struct cras_bt_device* device) {
+  cras_hfp_ag_sco_pcm_failed_called++;
+}
+
 int hfp_slc_get_selected_codec(struct hfp_slc_handle* handle) {
   return HFP_CODEC_ID_CVSD;
 }
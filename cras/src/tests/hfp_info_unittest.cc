@@ -3,15 +3,10 @@
  * found in the LICENSE file.
  */
 
-#include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <stdint.h>
 #include <time.h>
 
-using testing::MatchesRegex;
-using testing::internal::CaptureStdout;
-using testing::internal::GetCapturedStdout;
-
 extern "C" {
 #include "cras_hfp_info.c"
 #include "sbc_codec_stub.h"
@@ -85,7 +80,7 @@ TEST(HfpInfo, AcquirePlaybackBuffer) {
   info = hfp_info_create();
   ASSERT_NE(info, (void*)NULL);
 
-  hfp_info_start(1, 48, HFP_CODEC_ID_CVSD, info);
+  hfp_info_start(1, 48, HFP_CODEC_ID_CVSD, info, NULL);
   dev.direction = CRAS_STREAM_OUTPUT;
   ASSERT_EQ(0, hfp_info_add_iodev(info, dev.direction, dev.format));
 
@@ -133,7 +128,7 @@ TEST(HfpInfo, AcquireCaptureBuffer) {
   info = hfp_info_create();
   ASSERT_NE(info, (void*)NULL);
 
-  hfp_info_start(1, 48, HFP_CODEC_ID_CVSD, info);
+  hfp_info_start(1, 48, HFP_CODEC_ID_CVSD, info, NULL);
   dev.direction = CRAS_STREAM_INPUT;
   ASSERT_EQ(0, hfp_info_add_iodev(info, dev.direction, dev.format));
 
@@ -182,7 +177,7 @@ TEST(HfpInfo, HfpReadWriteFD) {
   ASSERT_NE(info, (void*)NULL);
 
   dev.direction = CRAS_STREAM_INPUT;
-  hfp_info_start(sock[1], 48, HFP_CODEC_ID_CVSD, info);
+  hfp_info_start(sock[1], 48, HFP_CODEC_ID_CVSD, info, NULL);
   ASSERT_EQ(0, hfp_info_add_iodev(info, dev.direction, dev.format));
 
   /* Mock the sco fd and send some fake data */
@@ -232,7 +227,7 @@ TEST(HfpInfo, StartHfpInfo) {
   info = hfp_info_create();
   ASSERT_NE(info, (void*)NULL);
 
-  hfp_info_start(sock[0], 48, HFP_CODEC_ID_CVSD, info);
+  hfp_info_start(sock[0], 48, HFP_CODEC_ID_CVSD, info, NULL);
   ASSERT_EQ(1, hfp_info_running(info));
   ASSERT_EQ(cb_data, (void*)info);
 
@@ -256,7 +251,7 @@ TEST(HfpInfo, StartHfpInfoAndRead) {
   ASSERT_NE(info, (void*)NULL);
 
   /* Start and send two chunk of fake data */
-  hfp_info_start(sock[1], 48, HFP_CODEC_ID_CVSD, info);
+  hfp_info_start(sock[1], 48, HFP_CODEC_ID_CVSD, info, NULL);
   send(sock[0], sample, 48, 0);
   send(sock[0], sample, 48, 0);
 
@@ -300,7 +295,7 @@ TEST(HfpInfo, StartHfpInfoAndWrite) {
   info = hfp_info_create();
   ASSERT_NE(info, (void*)NULL);
 
-  hfp_info_start(sock[1], 48, HFP_CODEC_ID_CVSD, info);
+  hfp_info_start(sock[1], 48, HFP_CODEC_ID_CVSD, info, NULL);
   send(sock[0], sample, 48, 0);
   send(sock[0], sample, 48, 0);
 
@@ -378,7 +373,7 @@ TEST(HfpInfo, StartHfpInfoAndReadMsbc) {
   uint8_t sample[480];
   ResetStubData();
 
-  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sock));
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
 
   set_sbc_codec_decoded_out(MSBC_CODE_SIZE);
 
@@ -388,7 +383,7 @@ TEST(HfpInfo, StartHfpInfoAndReadMsbc) {
   ASSERT_EQ(0, cras_msbc_plc_create_called);
 
   /* Start and send an mSBC packets with all zero samples */
-  hfp_info_start(sock[1], 63, HFP_CODEC_ID_MSBC, info);
+  hfp_info_start(sock[1], 63, HFP_CODEC_ID_MSBC, info, NULL);
   ASSERT_EQ(2, get_msbc_codec_create_called());
   ASSERT_EQ(1, cras_msbc_plc_create_called);
   send_mSBC_packet(sock[0], pkt_count++, 0);
@@ -478,12 +473,12 @@ TEST(HfpInfo, StartHfpInfoAndWriteMsbc) {
   ResetStubData();
 
   set_sbc_codec_encoded_out(57);
-  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sock));
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
 
   info = hfp_info_create();
   ASSERT_NE(info, (void*)NULL);
 
-  hfp_info_start(sock[1], 63, HFP_CODEC_ID_MSBC, info);
+  hfp_info_start(sock[1], 63, HFP_CODEC_ID_MSBC, info, NULL);
   send(sock[0], sample, 63, 0);
 
   /* Trigger thread callback */
@@ -509,35 +504,188 @@ TEST(HfpInfo, StartHfpInfoAndWriteMsbc) {
   hfp_info_destroy(info);
 }
 
-TEST(HfpInfo, WBSLoggerPacketStatusDumpBinary) {
-  struct packet_status_logger logger;
-  char log_regex[64];
-  int num_wraps[5] = {0, 0, 0, 1, 1};
-  int wp[5] = {40, 150, 162, 100, 32};
-
-  /* Expect the log line wraps at correct length to avoid feedback redact. */
-  snprintf(log_regex, 64, "([01D]{%d}\n)*", PACKET_STATUS_LOG_LINE_WRAP);
-
-  packet_status_logger_init(&logger);
-  logger.size = PACKET_STATUS_LEN_BYTES * 8;
-  for (int i = 0; i < 5; i++) {
-    CaptureStdout();
-    logger.num_wraps = num_wraps[i];
-    logger.wp = wp[i];
-    packet_status_logger_dump_binary(&logger);
-    EXPECT_THAT(GetCapturedStdout(), MatchesRegex(log_regex));
+TEST(HfpInfo, ReadWriteMsbcBatch) {
+  int sock[2];
+  int rc;
+  int i;
+  uint8_t sample[480];
+  ResetStubData();
+  cras_msbc_plc_handle_good_frames_called = 0;
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+
+  set_sbc_codec_decoded_out(MSBC_CODE_SIZE);
+  set_sbc_codec_encoded_out(57);
+
+  info = hfp_info_create();
+  ASSERT_NE(info, (void*)NULL);
+
+  hfp_info_start(sock[1], 60, HFP_CODEC_ID_MSBC, info, NULL);
+  dev.direction = CRAS_STREAM_INPUT;
+  ASSERT_EQ(0, hfp_info_add_iodev(info, dev.direction, dev.format));
+
+  /* Three packets queued by the time the audio thread wakes up. */
+  for (i = 0; i < 3; i++)
+    send_mSBC_packet(sock[0], i, 0);
+  thread_cb((struct hfp_info*)cb_data, POLLIN);
+
+  /* All of them are read in one callback. */
+  ASSERT_EQ(3, info->num_pkts_read);
+  ASSERT_EQ(3, cras_msbc_plc_handle_good_frames_called);
+  ASSERT_EQ(3 * MSBC_CODE_SIZE / 2, hfp_buf_queued(info, dev.direction));
+
+  /* And answered by as many packets with consecutive sequence numbers. */
+  for (i = 0; i < 3; i++) {
+    rc = recv(sock[0], sample, sizeof(sample), MSG_DONTWAIT);
+    ASSERT_EQ(MSBC_PKT_SIZE, rc);
+    EXPECT_EQ(H2_HEADER_0, sample[0]);
+    EXPECT_EQ(h2_header_frames_count[i], sample[1]);
   }
+  EXPECT_EQ(-1, recv(sock[0], sample, sizeof(sample), MSG_DONTWAIT));
+  EXPECT_EQ(0, info->write_rp);
+  EXPECT_EQ(0, info->write_wp);
+
+  hfp_info_stop(info);
+  hfp_info_destroy(info);
 }
 
-}  // namespace
+TEST(HfpInfo, ReadMsbcSplitPacketsInPlace) {
+  int sock[2];
+  int i;
+  uint8_t msbc_pkts[2 * MSBC_PKT_SIZE];
+  uint8_t sample[480];
+  ResetStubData();
+  cras_msbc_plc_handle_good_frames_called = 0;
 
-extern "C" {
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
 
-struct audio_thread* cras_iodev_list_get_audio_thread() {
-  return NULL;
+  set_sbc_codec_decoded_out(MSBC_CODE_SIZE);
+  set_sbc_codec_encoded_out(57);
+
+  info = hfp_info_create();
+  ASSERT_NE(info, (void*)NULL);
+
+  hfp_info_start(sock[1], 24, HFP_CODEC_ID_MSBC, info, NULL);
+  dev.direction = CRAS_STREAM_INPUT;
+  ASSERT_EQ(0, hfp_info_add_iodev(info, dev.direction, dev.format));
+
+  /* Two mSBC packets carried by five 24 bytes SCO packets. */
+  memset(msbc_pkts, 0, sizeof(msbc_pkts));
+  for (i = 0; i < 2; i++) {
+    msbc_pkts[i * MSBC_PKT_SIZE] = H2_HEADER_0;
+    msbc_pkts[i * MSBC_PKT_SIZE + 1] = h2_header_frames_count[i];
+    msbc_pkts[i * MSBC_PKT_SIZE + 2] = MSBC_SYNC_WORD;
+  }
+  for (i = 0; i < 5; i++)
+    send(sock[0], msbc_pkts + i * 24, 24, 0);
+
+  /* Packets are taken one by one until aligned, then in a batch. */
+  thread_cb((struct hfp_info*)cb_data, POLLIN);
+  ASSERT_EQ(1, info->num_pkts_read);
+  thread_cb((struct hfp_info*)cb_data, POLLIN);
+  ASSERT_EQ(4, info->num_pkts_read);
+
+  ASSERT_EQ(2, cras_msbc_plc_handle_good_frames_called);
+  ASSERT_EQ(2 * MSBC_CODE_SIZE / 2, hfp_buf_queued(info, dev.direction));
+  EXPECT_EQ(0, info->read_rp);
+  EXPECT_EQ(0, info->read_wp);
+
+  for (i = 0; i < 5; i++)
+    ASSERT_EQ(24, recv(sock[0], sample, sizeof(sample), MSG_DONTWAIT));
+
+  hfp_info_stop(info);
+  hfp_info_destroy(info);
+}
+
+TEST(HfpInfo, CaptureJitterBuffer) {
+  int sock[2];
+  int i;
+  ResetStubData();
+  cras_msbc_plc_handle_good_frames_called = 0;
+  cras_msbc_plc_handle_bad_frames_called = 0;
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+
+  set_sbc_codec_decoded_out(MSBC_CODE_SIZE);
+  set_sbc_codec_encoded_out(57);
+
+  info = hfp_info_create();
+  ASSERT_NE(info, (void*)NULL);
+
+  hfp_info_start(sock[1], 60, HFP_CODEC_ID_MSBC, info, NULL);
+  dev.direction = CRAS_STREAM_INPUT;
+  ASSERT_EQ(0, hfp_info_add_iodev(info, dev.direction, dev.format));
+
+  /* A frame two periods late widens the depth to three frames. */
+  EXPECT_EQ(0, jb_frame_arrived(info, 0));
+  EXPECT_EQ(JB_MIN_DEPTH, info->jb_depth);
+  EXPECT_EQ(0, jb_frame_arrived(info, 3 * MSBC_FRAME_NSEC));
+  EXPECT_EQ(3, info->jb_depth);
+  EXPECT_EQ(0, jb_frames_due(info, 3 * MSBC_FRAME_NSEC));
+  EXPECT_EQ(3, jb_frames_due(info, 6 * MSBC_FRAME_NSEC));
+
+  /* Three frames of a burst arriving together are held back but the first
+   * two of them. */
+  hfp_info_stop(info);
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+  hfp_info_start(sock[1], 60, HFP_CODEC_ID_MSBC, info, NULL);
+  for (i = 0; i < 3; i++)
+    send_mSBC_packet(sock[0], i, 0);
+  thread_cb((struct hfp_info*)cb_data, POLLIN);
+  ASSERT_EQ(3 * MSBC_CODE_SIZE / 2, hfp_buf_queued(info, dev.direction));
+  info->jb_anchor_ns = clock_ns() - 5 * MSBC_FRAME_NSEC / 2;
+  EXPECT_EQ(2 * MSBC_CODE_SIZE / 2, hfp_capture_frames_due(info));
+  EXPECT_EQ(MSBC_CODE_SIZE / 2, hfp_capture_jitter_depth(info));
+
+  /* Frames late past the depth are concealed when due. */
+  info->jb_anchor_ns = clock_ns() - 11 * MSBC_FRAME_NSEC / 2;
+  EXPECT_EQ(5 * MSBC_CODE_SIZE / 2, hfp_capture_frames_due(info));
+  EXPECT_EQ(2, cras_msbc_plc_handle_bad_frames_called);
+  EXPECT_EQ(2, info->jb_concealed);
+
+  /* And dropped when they arrive. */
+  send_mSBC_packet(sock[0], 3, 0);
+  thread_cb((struct hfp_info*)cb_data, POLLIN);
+  EXPECT_EQ(3, cras_msbc_plc_handle_good_frames_called);
+  EXPECT_EQ(1, info->jb_concealed);
+  EXPECT_EQ(5 * MSBC_CODE_SIZE / 2, hfp_buf_queued(info, dev.direction));
+
+  hfp_info_stop(info);
+  hfp_info_destroy(info);
+}
+
+TEST(HfpInfo, ExtractMsbcFrameSkipsFalseSyncWords) {
+  uint8_t input[MSBC_PKT_SIZE * 2];
+  const uint8_t* frame;
+  unsigned int seq = 0;
+
+  memset(input, 0, sizeof(input));
+  /* Sync words without a valid H2 header in front. */
+  input[2] = MSBC_SYNC_WORD;
+  input[7] = MSBC_SYNC_WORD;
+  input[8] = H2_HEADER_0;
+  input[9] = 0x42;
+  input[10] = MSBC_SYNC_WORD;
+  /* The real frame head. */
+  input[20] = H2_HEADER_0;
+  input[21] = h2_header_frames_count[2];
+  input[22] = MSBC_SYNC_WORD;
+
+  frame = extract_msbc_frame(input, sizeof(input), &seq);
+  EXPECT_EQ(input + 20, frame);
+  EXPECT_EQ(2, seq);
+
+  /* Not found when the frame would run past the input. */
+  EXPECT_EQ(NULL, extract_msbc_frame(input, 20 + MSBC_FRAME_SIZE - 1, &seq));
+  EXPECT_EQ(input + 20, extract_msbc_frame(input, 20 + MSBC_FRAME_SIZE, &seq));
 }
 
-void audio_thread_add_events_callback(int fd,
+}  // namespace
+
+extern "C" {
+
+void audio_thread_add_events_callback(struct audio_thread* thread,
+                                      int fd,
                                       thread_callback cb,
                                       void* data,
                                       int events) {
@@ -552,7 +700,7 @@ int audio_thread_rm_callback_sync(struct audio_thread* thread, int fd) {
   return 0;
 }
 
-void audio_thread_rm_callback(int fd) {}
+void audio_thread_rm_callback(struct audio_thread* thread, int fd) {}
 
 struct cras_msbc_plc* cras_msbc_plc_create() {
   cras_msbc_plc_create_called++;
@@ -304,12 +304,21 @@ int hfp_info_has_iodev(struct hfp_info* info) {
   return hfp_info_has_iodev_return_val;
 }
 
+struct audio_thread* cras_iodev_list_get_dev_audio_thread(
+    const struct cras_iodev* dev) {
+  return NULL;
+}
+
 int hfp_info_running(struct hfp_info* info) {
   hfp_info_running_called++;
   return hfp_info_running_return_val;
 }
 
-int hfp_info_start(int fd, unsigned int mtu, int codec, struct hfp_info* info) {
+int hfp_info_start(int fd,
+                   unsigned int mtu,
+                   int codec,
+                   struct hfp_info* info,
+                   struct audio_thread* thread) {
   hfp_info_start_called++;
   return 0;
 }
@@ -324,6 +333,14 @@ int hfp_buf_queued(struct hfp_info* info,
   return 0;
 }
 
+int hfp_capture_frames_due(struct hfp_info* info) {
+  return 0;
+}
+
+unsigned int hfp_capture_jitter_depth(struct hfp_info* info) {
+  return 0;
+}
+
 int hfp_buf_size(struct hfp_info* info, enum CRAS_STREAM_DIRECTION direction) {
   return fake_buffer_size;
 }
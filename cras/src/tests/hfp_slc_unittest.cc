@@ -236,6 +236,52 @@ TEST(HfpSlc, InitializeSlcSupportsHfIndicator) {
   cras_bt_event_log_deinit(btlog);
 }
 
+TEST(HfpSlc, LookupAndParseCommands) {
+  int sock[2];
+  char buf[256];
+  ssize_t len;
+
+  ResetStubData();
+  btlog = cras_bt_event_log_init();
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sock));
+  handle = hfp_slc_create(sock[0], 0, AG_ENHANCED_CALL_STATUS, device,
+                          slc_initialized_cb, slc_disconnected_cb);
+
+  // Commands are matched by their whole name, not a prefix of it.
+  const struct {
+    const char* cmd;
+    const char* rsp;
+  } cases[] = {
+      {"AT+CMEE=1", "\r\nOK\r\n"},
+      {"AT+CNUM", "\r\nOK\r\n"},
+      {"AT+VGM=7", "\r\nOK\r\n"},
+      {"AT+BIEV=2,50", "\r\nOK\r\n"},
+      {"AT+BIEVX=2,50", "\r\nERROR"},
+      {"AT+CM=1", "\r\nERROR"},
+      {"AT+VG=7", "\r\nERROR"},
+      {"AT+", "\r\nERROR"},
+      {"ATZ", "\r\nERROR"},
+      {"", "\r\nERROR"},
+      {"AT+IPHONEACCEV=2,1,,5,2,1", "\r\nOK\r\n"},
+  };
+  for (const auto& c : cases) {
+    handle_at_command_for_test(handle, c.cmd);
+    len = read(sock[1], buf, sizeof(buf) - 1);
+    ASSERT_LT(0, len);
+    buf[len] = '\0';
+    EXPECT_EQ(0, strncmp(c.rsp, buf, strlen(c.rsp))) << c.cmd;
+  }
+  EXPECT_EQ(0, cras_bt_device_update_hardware_volume_called);
+
+  // Empty arguments are skipped, battery 50 then (5 + 1) * 10.
+  EXPECT_EQ(2, cras_observer_notify_bt_batter_changed_called);
+  EXPECT_EQ(60, hfp_slc_get_hf_battery_level(handle));
+
+  hfp_slc_destroy(handle);
+  close(sock[1]);
+  cras_bt_event_log_deinit(btlog);
+}
+
 TEST(HfpSlc, CodecNegotiation) {
   int codec;
   int err;
@@ -8,6 +8,7 @@
 extern "C" {
 #include "buffer_share.c"
 #include "cras_audio_area.h"
+#include "cras_fmt_conv.h"
 #include "cras_rstream.h"
 #include "input_data.h"
 }
@@ -24,6 +25,13 @@ static struct cras_apm* cras_apm_list_get_active_ret = NULL;
 static bool cras_apm_list_get_use_tuned_settings_val;
 #endif  // HAVE_WEBRTC_APM
 static float cras_rstream_get_volume_scaler_val;
+static struct cras_audio_format conv_in_fmt;
+static struct cras_audio_format conv_out_fmt;
+static unsigned int config_format_converter_called;
+static unsigned int cras_fmt_conv_convert_frames_called;
+static unsigned int cras_fmt_conv_destroy_called;
+static unsigned int cras_fmt_conv_set_src_quality_called;
+static enum CRAS_SRC_QUALITY cras_fmt_conv_set_src_quality_val;
 
 TEST(InputData, GetForInputStream) {
   void* dev_ptr = reinterpret_cast<void*>(0x123);
@@ -79,6 +87,149 @@ TEST(InputData, GetForInputStream) {
   buffer_share_destroy(offsets);
 }
 
+#ifdef HAVE_WEBRTC_APM
+TEST(InputData, GetPlanarForApmStream) {
+  void* dev_ptr = reinterpret_cast<void*>(0x123);
+  struct input_data* data;
+  struct cras_rstream stream;
+  struct buffer_share* offsets;
+  struct cras_audio_area* area = NULL;
+
+  cras_apm_list_process_called = 0;
+  stream.stream_id = 111;
+  stream.apm_list = NULL;
+
+  data = input_data_create(dev_ptr);
+  data->ext.configure(&data->ext, 8192, 2, 48000);
+  offsets = buffer_share_create(8192);
+  buffer_share_add_id(offsets, 111, NULL);
+  buffer_share_offset_update(offsets, 111, 1024);
+
+  // Streams without APM read through input_data_get_for_stream.
+  cras_apm_list_get_active_ret = NULL;
+  EXPECT_EQ(0, input_data_get_planar_for_stream(data, &stream, offsets, &area));
+  EXPECT_EQ(0, cras_apm_list_process_called);
+
+  cras_apm_list_get_active_ret = FAKE_CRAS_APM_PTR;
+  EXPECT_EQ(1, input_data_get_planar_for_stream(data, &stream, offsets, &area));
+  EXPECT_EQ(1, cras_apm_list_process_called);
+  EXPECT_EQ(1024, cras_apm_list_process_offset_val);
+  EXPECT_EQ(&apm_area, area);
+
+  cras_apm_list_get_active_ret = NULL;
+  input_data_destroy(&data);
+  buffer_share_destroy(offsets);
+}
+#endif  // HAVE_WEBRTC_APM
+
+static void SetupCacheStream(struct cras_rstream* stream,
+                             unsigned int id,
+                             void* dev_ptr) {
+  memset(stream, 0, sizeof(*stream));
+  stream->stream_id = id;
+  stream->format.format = SND_PCM_FORMAT_S16_LE;
+  stream->format.frame_rate = 16000;
+  stream->format.num_channels = 2;
+  stream->master_dev.dev_ptr = dev_ptr;
+}
+
+TEST(InputData, StreamsOfTheSameFormatShareConversion) {
+  void* dev_ptr = reinterpret_cast<void*>(0x123);
+  struct input_data* data;
+  struct cras_rstream stream1, stream2, stream3;
+  struct buffer_share* offsets;
+  struct cras_audio_area* area;
+  struct cras_audio_area* dev_area;
+  struct cras_audio_format dev_fmt;
+  int16_t dev_buf[200];
+  unsigned int offset;
+
+  config_format_converter_called = 0;
+  cras_fmt_conv_convert_frames_called = 0;
+  cras_fmt_conv_destroy_called = 0;
+  dev_fmt.format = SND_PCM_FORMAT_S16_LE;
+  dev_fmt.frame_rate = 48000;
+  dev_fmt.num_channels = 2;
+  conv_in_fmt = dev_fmt;
+  conv_out_fmt = dev_fmt;
+  conv_out_fmt.frame_rate = 16000;
+  for (int i = 0; i < 200; i++)
+    dev_buf[i] = i;
+
+  data = input_data_create(dev_ptr);
+  dev_area = cras_audio_area_create(2);
+  dev_area->channels[0].buf = reinterpret_cast<uint8_t*>(dev_buf);
+  dev_area->frames = 100;
+  data->area = dev_area;
+  offsets = buffer_share_create(1024);
+
+  SetupCacheStream(&stream1, 111, dev_ptr);
+  SetupCacheStream(&stream2, 222, dev_ptr);
+  // The device format, no conversion to share.
+  SetupCacheStream(&stream3, 333, dev_ptr);
+  stream3.format.frame_rate = 48000;
+  buffer_share_add_id(offsets, 111, NULL);
+  buffer_share_add_id(offsets, 222, NULL);
+  buffer_share_add_id(offsets, 333, NULL);
+  input_data_add_stream(data, &stream1, &dev_fmt, 1024);
+  input_data_add_stream(data, &stream2, &dev_fmt, 1024);
+  input_data_add_stream(data, &stream3, &dev_fmt, 1024);
+  EXPECT_EQ(1, config_format_converter_called);
+  // Two device buffers of frames converted to 16kHz.
+  EXPECT_EQ(2 * (342 + 1) * 4, input_data_get_mem_bytes(data));
+
+  EXPECT_EQ(0, input_data_get_for_stream(data, &stream3, offsets, &area,
+                                         &offset));
+  EXPECT_EQ(dev_area, area);
+
+  // The first stream converts the device frames.
+  EXPECT_EQ(1, input_data_get_for_stream(data, &stream1, offsets, &area,
+                                         &offset));
+  EXPECT_EQ(1, cras_fmt_conv_convert_frames_called);
+  EXPECT_EQ(100, area->frames);
+  EXPECT_EQ(0, offset);
+  EXPECT_EQ(0, memcmp(dev_buf, area->channels[0].buf, 400));
+  input_data_put_for_stream(data, &stream1, offsets, 60);
+  EXPECT_EQ(100, buffer_share_id_offset(offsets, 111));
+
+  // The second reads the same frames without another conversion.
+  EXPECT_EQ(1, input_data_get_for_stream(data, &stream2, offsets, &area,
+                                         &offset));
+  EXPECT_EQ(1, cras_fmt_conv_convert_frames_called);
+  EXPECT_EQ(100, area->frames);
+  EXPECT_EQ(0, offset);
+  input_data_put_for_stream(data, &stream2, offsets, 80);
+  EXPECT_EQ(100, buffer_share_id_offset(offsets, 222));
+
+  // Frames read by both streams are dropped from the cache.
+  EXPECT_EQ(1, input_data_get_for_stream(data, &stream1, offsets, &area,
+                                         &offset));
+  EXPECT_EQ(40, area->frames);
+  EXPECT_EQ(0, offset);
+  EXPECT_EQ(1, input_data_get_for_stream(data, &stream2, offsets, &area,
+                                         &offset));
+  EXPECT_EQ(20, offset);
+
+  // The shared converter doesn't go below low latency for the load.
+  cras_fmt_conv_set_src_quality_called = 0;
+  input_data_set_overload_level(data, CRAS_OVERLOAD_LINEAR_SRC);
+  EXPECT_EQ(1, cras_fmt_conv_set_src_quality_called);
+  EXPECT_EQ(CRAS_SRC_QUALITY_LOW_LATENCY, cras_fmt_conv_set_src_quality_val);
+  input_data_set_overload_level(data, CRAS_OVERLOAD_NONE);
+  EXPECT_EQ(stream1.src_quality, cras_fmt_conv_set_src_quality_val);
+
+  input_data_rm_stream(data, &stream1);
+  EXPECT_EQ(0, cras_fmt_conv_destroy_called);
+  input_data_rm_stream(data, &stream2);
+  EXPECT_EQ(1, cras_fmt_conv_destroy_called);
+  EXPECT_EQ(NULL, data->caches);
+  EXPECT_EQ(0, input_data_get_mem_bytes(data));
+
+  cras_audio_area_destroy(dev_area);
+  input_data_destroy(&data);
+  buffer_share_destroy(offsets);
+}
+
 TEST(InputData, GetSWCaptureGain) {
   void* dev_ptr = reinterpret_cast<void*>(0x123);
   struct input_data* data = NULL;
@@ -129,8 +280,13 @@ int cras_apm_list_process(struct cras_apm* apm,
 struct cras_audio_area* cras_apm_list_get_processed(struct cras_apm* apm) {
   return &apm_area;
 }
+struct cras_audio_area* cras_apm_list_get_processed_planar(
+    struct cras_apm* apm) {
+  return &apm_area;
+}
 void cras_apm_list_remove_apm(struct cras_apm_list* list, void* dev_ptr) {}
 void cras_apm_list_put_processed(struct cras_apm* apm, unsigned int frames) {}
+void cras_apm_list_set_dev_read(void* dev_ptr, unsigned int frames) {}
 bool cras_apm_list_get_use_tuned_settings(struct cras_apm* apm) {
   return cras_apm_list_get_use_tuned_settings_val;
 }
@@ -139,6 +295,69 @@ bool cras_apm_list_get_use_tuned_settings(struct cras_apm* apm) {
 float cras_rstream_get_volume_scaler(struct cras_rstream* rstream) {
   return cras_rstream_get_volume_scaler_val;
 }
+struct cras_audio_area* cras_audio_area_create(int num_channels) {
+  struct cras_audio_area* area;
+  size_t sz;
+
+  sz = sizeof(*area) + num_channels * sizeof(struct cras_channel_area);
+  area = (cras_audio_area*)calloc(1, sz);
+  area->num_channels = num_channels;
+  return area;
+}
+void cras_audio_area_destroy(struct cras_audio_area* area) {
+  free(area);
+}
+void cras_audio_area_config_channels(struct cras_audio_area* area,
+                                     const struct cras_audio_format* fmt) {}
+void cras_audio_area_config_buf_pointers(struct cras_audio_area* area,
+                                         const struct cras_audio_format* fmt,
+                                         uint8_t* base_buffer) {
+  area->channels[0].buf = base_buffer;
+}
+
+int config_format_converter(struct cras_fmt_conv** conv,
+                            enum CRAS_STREAM_DIRECTION dir,
+                            const struct cras_audio_format* from,
+                            const struct cras_audio_format* to,
+                            unsigned int frames,
+                            enum CRAS_SRC_QUALITY quality) {
+  config_format_converter_called++;
+  *conv = reinterpret_cast<struct cras_fmt_conv*>(0x456);
+  return 0;
+}
+void cras_fmt_conv_destroy(struct cras_fmt_conv** conv) {
+  cras_fmt_conv_destroy_called++;
+  *conv = NULL;
+}
+int cras_fmt_conv_set_src_quality(struct cras_fmt_conv* conv,
+                                  enum CRAS_SRC_QUALITY quality) {
+  cras_fmt_conv_set_src_quality_called++;
+  cras_fmt_conv_set_src_quality_val = quality;
+  return 0;
+}
+void cras_fmt_conv_capture_channels(
+    struct cras_audio_format* fmt,
+    const struct cras_audio_format* stream_fmt) {}
+const struct cras_audio_format* cras_fmt_conv_in_format(
+    const struct cras_fmt_conv* conv) {
+  return &conv_in_fmt;
+}
+const struct cras_audio_format* cras_fmt_conv_out_format(
+    const struct cras_fmt_conv* conv) {
+  return &conv_out_fmt;
+}
+// Copies the frames as is so the test can tell them apart.
+size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv* conv,
+                                    const uint8_t* in_buf,
+                                    uint8_t* out_buf,
+                                    unsigned int* in_frames,
+                                    size_t out_frames) {
+  cras_fmt_conv_convert_frames_called++;
+  *in_frames = MIN(*in_frames, out_frames);
+  memcpy(out_buf, in_buf, *in_frames * 4);
+  return *in_frames;
+}
+
 }  // extern "C"
 }  // namespace
 
@@ -3,15 +3,19 @@
 // found in the LICENSE file.
 
 #include <gtest/gtest.h>
+#include <pthread.h>
 #include <stdio.h>
 
 #include <algorithm>
 #include <map>
+#include <string>
 
 extern "C" {
 #include "audio_thread.h"
+#include "cras_config.h"
 #include "cras_iodev.h"
 #include "cras_iodev_list.h"
+#include "cras_main_message.h"
 #include "cras_main_thread_log.h"
 #include "cras_observer_ops.h"
 #include "cras_ramp.h"
@@ -40,7 +44,12 @@ static cras_iodev* audio_thread_add_open_dev_dev;
 static int audio_thread_add_open_dev_called;
 static int audio_thread_rm_open_dev_called;
 static int audio_thread_is_dev_open_ret;
-static struct audio_thread thread;
+static struct audio_thread threads[CRAS_MAX_AUDIO_THREADS];
+static unsigned int audio_thread_create_called;
+static unsigned int system_get_num_audio_threads_return;
+static unsigned int system_get_output_standby_ms_return;
+static struct audio_thread* audio_thread_add_open_dev_thread;
+static struct audio_thread* audio_thread_add_stream_thread;
 static struct cras_iodev loopback_input;
 static int cras_iodev_close_called;
 static struct cras_iodev* cras_iodev_close_dev;
@@ -51,7 +60,13 @@ static stream_callback* stream_rm_cb;
 static struct cras_rstream* stream_list_get_ret;
 static int server_stream_create_called;
 static int server_stream_destroy_called;
+static int server_stream_create_route_called;
+static struct cras_audio_format server_stream_create_route_fmt;
+static int server_stream_destroy_route_called;
 static int audio_thread_drain_stream_return;
+static int audio_thread_swap_stream_apms_called;
+static int audio_thread_set_stream_paused_called;
+static unsigned int audio_thread_set_stream_paused_fade_in_ms;
 static int audio_thread_drain_stream_called;
 static int cras_tm_create_timer_called;
 static int cras_tm_cancel_timer_called;
@@ -68,6 +83,9 @@ static struct cras_rstream* audio_thread_add_stream_stream;
 static struct cras_iodev* audio_thread_add_stream_dev;
 static struct cras_iodev* audio_thread_disconnect_stream_dev;
 static int audio_thread_add_stream_called;
+static int audio_thread_add_streams_called;
+static unsigned int audio_thread_add_streams_num;
+static struct audio_thread_stream_attach audio_thread_add_streams_attaches[8];
 static unsigned update_active_node_called;
 static struct cras_iodev* update_active_node_iodev_val[5];
 static unsigned update_active_node_node_idx_val[5];
@@ -83,6 +101,13 @@ static size_t cras_observer_notify_output_node_volume_called;
 static size_t cras_observer_notify_node_left_right_swapped_called;
 static size_t cras_observer_notify_input_node_gain_called;
 static int cras_iodev_open_called;
+static long cras_iodev_open_cost_ns;
+static size_t cras_iodev_best_rate_ret;
+static bool cras_iodev_supports_low_latency_ret;
+static bool cras_iodev_supports_passthrough_ret;
+static bool cras_iodev_supports_exclusive_ret;
+static int cras_iodev_resume_called;
+static int cras_iodev_resume_ret;
 static int cras_iodev_open_ret[8];
 static struct cras_audio_format cras_iodev_open_fmt;
 static int set_mute_called;
@@ -95,6 +120,20 @@ static struct cras_rstream* audio_thread_disconnect_stream_stream;
 static int audio_thread_disconnect_stream_called;
 static struct cras_iodev fake_sco_in_dev, fake_sco_out_dev;
 static struct cras_ionode fake_sco_in_node, fake_sco_out_node;
+static struct cras_iodev fake_aggregate_dev;
+static struct cras_ionode fake_aggregate_node;
+static std::vector<struct cras_iodev*> aggregate_iodev_members;
+static int aggregate_iodev_destroy_called;
+/* The open and hotword model workers report back from their own threads. */
+static pthread_mutex_t worker_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t worker_cond = PTHREAD_COND_INITIALIZER;
+static cras_message_callback dev_open_done_cb;
+static cras_message_callback hotword_model_loaded_cb;
+static std::vector<std::string> set_hotword_model_models;
+static size_t cras_observer_notify_hotword_model_loaded_called;
+static std::string cras_observer_notify_hotword_model_loaded_model;
+static int cras_observer_notify_hotword_model_loaded_error;
+static struct cras_main_message* worker_msg;
 
 int dev_idx_in_vector(std::vector<unsigned int> v, unsigned int idx) {
   return std::find(v.begin(), v.end(), idx) != v.end();
@@ -105,17 +144,42 @@ int device_in_vector(std::vector<struct cras_iodev*> v,
   return std::find(v.begin(), v.end(), dev) != v.end();
 }
 
+/* Waits for a worker to report back, and returns its message. */
+struct cras_main_message* wait_worker_msg() {
+  struct cras_main_message* msg;
+
+  pthread_mutex_lock(&worker_mutex);
+  while (!worker_msg)
+    pthread_cond_wait(&worker_cond, &worker_mutex);
+  msg = worker_msg;
+  worker_msg = NULL;
+  pthread_mutex_unlock(&worker_mutex);
+  return msg;
+}
+
 class IoDevTestSuite : public testing::Test {
  protected:
   virtual void SetUp() {
     cras_iodev_list_reset();
 
     cras_iodev_close_called = 0;
+    aggregate_iodev_members.clear();
+    aggregate_iodev_destroy_called = 0;
+    cras_iodev_supports_low_latency_ret = true;
+    cras_iodev_supports_passthrough_ret = true;
+    cras_iodev_supports_exclusive_ret = true;
+    cras_iodev_resume_called = 0;
+    cras_iodev_resume_ret = 0;
     stream_list_get_ret = 0;
     server_stream_create_called = 0;
     server_stream_destroy_called = 0;
+    server_stream_create_route_called = 0;
+    server_stream_destroy_route_called = 0;
     audio_thread_drain_stream_return = 0;
     audio_thread_drain_stream_called = 0;
+    audio_thread_swap_stream_apms_called = 0;
+    audio_thread_set_stream_paused_called = 0;
+    audio_thread_set_stream_paused_fade_in_ms = 0;
     cras_tm_create_timer_called = 0;
     cras_tm_cancel_timer_called = 0;
 
@@ -205,10 +269,17 @@ class IoDevTestSuite : public testing::Test {
     add_stream_called = 0;
     rm_stream_called = 0;
     set_node_plugged_called = 0;
+    audio_thread_create_called = 0;
+    system_get_num_audio_threads_return = 1;
+    system_get_output_standby_ms_return = 0;
     audio_thread_rm_open_dev_called = 0;
     audio_thread_add_open_dev_called = 0;
+    audio_thread_add_open_dev_thread = NULL;
+    audio_thread_add_stream_thread = NULL;
     audio_thread_set_active_dev_called = 0;
     audio_thread_add_stream_called = 0;
+    audio_thread_add_streams_called = 0;
+    audio_thread_add_streams_num = 0;
     update_active_node_called = 0;
     cras_observer_add_called = 0;
     cras_observer_remove_called = 0;
@@ -218,6 +289,8 @@ class IoDevTestSuite : public testing::Test {
     cras_observer_notify_node_left_right_swapped_called = 0;
     cras_observer_notify_input_node_gain_called = 0;
     cras_iodev_open_called = 0;
+    cras_iodev_open_cost_ns = 0;
+    cras_iodev_best_rate_ret = 0;
     memset(cras_iodev_open_ret, 0, sizeof(cras_iodev_open_ret));
     set_mute_called = 0;
     set_mute_dev_vector.clear();
@@ -359,6 +432,141 @@ TEST_F(IoDevTestSuite, SetSuspendResume) {
   EXPECT_EQ(3, cras_observer_notify_active_node_called);
 }
 
+static int fake_resume(struct cras_iodev* iodev) {
+  return 0;
+}
+
+/* Check that a device which can resume stays open across a suspend, and is
+ * reopened only when its hardware lost its state. */
+TEST_F(IoDevTestSuite, SuspendResumeKeepsDeviceOpen) {
+  struct cras_rstream rstream;
+  struct cras_rstream* stream_list = NULL;
+
+  memset(&rstream, 0, sizeof(rstream));
+  cras_iodev_list_init();
+
+  d1_.direction = CRAS_STREAM_OUTPUT;
+  d1_.resume = fake_resume;
+  ASSERT_EQ(0, cras_iodev_list_add_output(&d1_));
+  d1_.format = &fmt_;
+
+  cras_iodev_list_add_active_node(CRAS_STREAM_OUTPUT,
+                                  cras_make_node_id(d1_.info.idx, 1));
+  DL_APPEND(stream_list, &rstream);
+  stream_add_cb(&rstream);
+  EXPECT_EQ(1, cras_iodev_open_called);
+  stream_list_get_ret = stream_list;
+
+  audio_thread_rm_open_dev_called = 0;
+  observer_ops->suspend_changed(NULL, 1);
+  EXPECT_EQ(1, audio_thread_rm_open_dev_called);
+  EXPECT_EQ(0, cras_iodev_close_called);
+  EXPECT_EQ(1, d1_.kept_on_suspend);
+
+  audio_thread_add_open_dev_called = 0;
+  audio_thread_add_stream_called = 0;
+  observer_ops->suspend_changed(NULL, 0);
+  EXPECT_EQ(1, cras_iodev_resume_called);
+  EXPECT_EQ(1, audio_thread_add_open_dev_called);
+  EXPECT_EQ(1, audio_thread_add_stream_called);
+  EXPECT_EQ(1, cras_iodev_open_called);
+  EXPECT_EQ(0, d1_.kept_on_suspend);
+
+  /* The hardware is gone after this suspend, open it again. */
+  observer_ops->suspend_changed(NULL, 1);
+  cras_iodev_resume_ret = -ENODEV;
+  audio_thread_add_open_dev_called = 0;
+  observer_ops->suspend_changed(NULL, 0);
+  EXPECT_EQ(2, cras_iodev_resume_called);
+  EXPECT_EQ(1, cras_iodev_close_called);
+  EXPECT_EQ(2, cras_iodev_open_called);
+  EXPECT_EQ(1, audio_thread_add_open_dev_called);
+
+  d1_.resume = NULL;
+  cras_iodev_list_deinit();
+}
+
+/* A device slow to open is opened on the open worker. Its stream plays on the
+ * fallback device meanwhile, and moves to it once the open completes. */
+TEST_F(IoDevTestSuite, OpenOffMainThreadAttachesOnCompletion) {
+  struct cras_rstream rstream;
+  struct cras_rstream* stream_list = NULL;
+  struct cras_main_message* msg;
+
+  memset(&rstream, 0, sizeof(rstream));
+  cras_iodev_list_init();
+
+  d1_.direction = CRAS_STREAM_OUTPUT;
+  d1_.open_off_main = 1;
+  ASSERT_EQ(0, cras_iodev_list_add_output(&d1_));
+  d1_.format = &fmt_;
+  cras_iodev_list_select_node(CRAS_STREAM_OUTPUT,
+                              cras_make_node_id(d1_.info.idx, 0));
+
+  DL_APPEND(stream_list, &rstream);
+  stream_list_get_ret = stream_list;
+  stream_add_cb(&rstream);
+  EXPECT_TRUE(d1_.opening);
+  EXPECT_FALSE(cras_iodev_is_open(&d1_));
+  EXPECT_TRUE(cras_iodev_list_dev_is_enabled(&mock_empty_iodev[0]));
+  EXPECT_EQ(1, audio_thread_add_stream_called);
+
+  msg = wait_worker_msg();
+  ASSERT_NE(nullptr, dev_open_done_cb);
+  /* Once for the fallback device, once for d1_ on the worker. */
+  EXPECT_EQ(2, cras_iodev_open_called);
+  EXPECT_TRUE(d1_.opening);
+
+  audio_thread_add_stream_called = 0;
+  dev_open_done_cb(msg, NULL);
+  free(msg);
+  EXPECT_FALSE(d1_.opening);
+  EXPECT_TRUE(cras_iodev_is_open(&d1_));
+  EXPECT_EQ(&d1_, audio_thread_add_open_dev_dev);
+  EXPECT_EQ(1, audio_thread_add_stream_called);
+  EXPECT_EQ(&d1_, audio_thread_add_stream_dev);
+  EXPECT_FALSE(cras_iodev_list_dev_is_enabled(&mock_empty_iodev[0]));
+
+  cras_iodev_list_deinit();
+}
+
+/* A device removed while it opens on the worker is closed again, and the
+ * late completion leaves it alone. */
+TEST_F(IoDevTestSuite, OpenOffMainThreadRemovedWhileOpening) {
+  struct cras_rstream rstream;
+  struct cras_rstream* stream_list = NULL;
+  struct cras_main_message* msg;
+
+  memset(&rstream, 0, sizeof(rstream));
+  cras_iodev_list_init();
+
+  d1_.direction = CRAS_STREAM_OUTPUT;
+  d1_.open_off_main = 1;
+  ASSERT_EQ(0, cras_iodev_list_add_output(&d1_));
+  d1_.format = &fmt_;
+  cras_iodev_list_select_node(CRAS_STREAM_OUTPUT,
+                              cras_make_node_id(d1_.info.idx, 0));
+
+  DL_APPEND(stream_list, &rstream);
+  stream_list_get_ret = stream_list;
+  stream_add_cb(&rstream);
+  msg = wait_worker_msg();
+
+  cras_iodev_close_called = 0;
+  EXPECT_EQ(0, cras_iodev_list_rm_output(&d1_));
+  EXPECT_FALSE(d1_.opening);
+  EXPECT_EQ(1, cras_iodev_close_called);
+  EXPECT_EQ(&d1_, cras_iodev_close_dev);
+
+  audio_thread_add_open_dev_called = 0;
+  dev_open_done_cb(msg, NULL);
+  free(msg);
+  EXPECT_EQ(0, audio_thread_add_open_dev_called);
+  EXPECT_FALSE(cras_iodev_is_open(&d1_));
+
+  cras_iodev_list_deinit();
+}
+
 /* Check that the suspend/resume call of active iodev will be triggered and
  * fallback device will be transciently enabled while adding a new stream whose
  * channel count is higher than the active iodev. */
@@ -424,6 +632,105 @@ TEST_F(IoDevTestSuite, ReopenDevForHigherChannels) {
   cras_iodev_list_deinit();
 }
 
+/* Check that streams added in a batch are attached with one audio thread
+ * command, and that a stream removed before the end isn't attached. */
+TEST_F(IoDevTestSuite, StreamBatchAttachesOnce) {
+  struct cras_rstream rstream, rstream2, rstream3;
+  struct cras_rstream* stream_list = NULL;
+  int rc;
+
+  memset(&rstream, 0, sizeof(rstream));
+  memset(&rstream2, 0, sizeof(rstream2));
+  memset(&rstream3, 0, sizeof(rstream3));
+
+  cras_iodev_list_init();
+
+  d1_.direction = CRAS_STREAM_OUTPUT;
+  rc = cras_iodev_list_add_output(&d1_);
+  ASSERT_EQ(0, rc);
+  d1_.format = &fmt_;
+  cras_iodev_list_add_active_node(CRAS_STREAM_OUTPUT,
+                                  cras_make_node_id(d1_.info.idx, 1));
+
+  cras_iodev_list_begin_stream_batch();
+  DL_APPEND(stream_list, &rstream);
+  stream_add_cb(&rstream);
+  DL_APPEND(stream_list, &rstream2);
+  stream_add_cb(&rstream2);
+  DL_APPEND(stream_list, &rstream3);
+  stream_add_cb(&rstream3);
+  EXPECT_EQ(0, audio_thread_add_stream_called);
+  EXPECT_EQ(0, audio_thread_add_streams_called);
+
+  audio_thread_drain_stream_return = 0;
+  DL_DELETE(stream_list, &rstream2);
+  stream_rm_cb(&rstream2);
+
+  cras_iodev_list_end_stream_batch();
+  EXPECT_EQ(0, audio_thread_add_stream_called);
+  EXPECT_EQ(1, audio_thread_add_streams_called);
+  ASSERT_EQ(2, audio_thread_add_streams_num);
+  EXPECT_EQ(&rstream, audio_thread_add_streams_attaches[0].stream);
+  EXPECT_EQ(&rstream3, audio_thread_add_streams_attaches[1].stream);
+  EXPECT_EQ(1, audio_thread_add_streams_attaches[1].num_devs);
+  EXPECT_EQ(&d1_, audio_thread_add_streams_attaches[1].devs[0]);
+
+  /* Out of a batch streams are attached right away. */
+  DL_DELETE(stream_list, &rstream3);
+  stream_rm_cb(&rstream3);
+  DL_APPEND(stream_list, &rstream3);
+  stream_add_cb(&rstream3);
+  EXPECT_EQ(1, audio_thread_add_stream_called);
+  EXPECT_EQ(1, audio_thread_add_streams_called);
+
+  cras_iodev_list_deinit();
+}
+
+/* Check that a device re-opened in the middle of a batch gets each stream
+ * attached once. */
+TEST_F(IoDevTestSuite, StreamBatchReopenDev) {
+  struct cras_rstream rstream, rstream2;
+  struct cras_rstream* stream_list = NULL;
+  int rc;
+
+  memset(&rstream, 0, sizeof(rstream));
+  memset(&rstream2, 0, sizeof(rstream2));
+  rstream.format = fmt_;
+  rstream2.format = fmt_;
+  rstream2.format.num_channels = 6;
+
+  cras_iodev_list_init();
+
+  d1_.direction = CRAS_STREAM_OUTPUT;
+  rc = cras_iodev_list_add_output(&d1_);
+  ASSERT_EQ(0, rc);
+  d1_.format = &fmt_;
+  d1_.info.max_supported_channels = 6;
+  cras_iodev_list_add_active_node(CRAS_STREAM_OUTPUT,
+                                  cras_make_node_id(d1_.info.idx, 1));
+
+  cras_iodev_list_begin_stream_batch();
+  DL_APPEND(stream_list, &rstream);
+  stream_list_get_ret = stream_list;
+  stream_add_cb(&rstream);
+  DL_PREPEND(stream_list, &rstream2);
+  stream_list_get_ret = stream_list;
+  stream_add_cb(&rstream2);
+  cras_iodev_list_end_stream_batch();
+
+  EXPECT_EQ(0, audio_thread_add_stream_called);
+  EXPECT_EQ(1, audio_thread_add_streams_called);
+  ASSERT_EQ(2, audio_thread_add_streams_num);
+  for (unsigned int i = 0; i < 2; i++) {
+    EXPECT_EQ(1, audio_thread_add_streams_attaches[i].num_devs);
+    EXPECT_EQ(&d1_, audio_thread_add_streams_attaches[i].devs[0]);
+  }
+  EXPECT_NE(audio_thread_add_streams_attaches[0].stream,
+            audio_thread_add_streams_attaches[1].stream);
+
+  cras_iodev_list_deinit();
+}
+
 /* Check that after resume, all output devices enter ramp mute state if there is
  * any output stream. */
 TEST_F(IoDevTestSuite, RampMuteAfterResume) {
@@ -491,6 +798,149 @@ TEST_F(IoDevTestSuite, RampMuteAfterResume) {
   cras_iodev_list_deinit();
 }
 
+TEST_F(IoDevTestSuite, LowLatencyStreamAdmission) {
+  struct cras_rstream rstream, rstream2, rstream3;
+  struct cras_rstream* stream_list = NULL;
+  int rc;
+
+  memset(&rstream, 0, sizeof(rstream));
+  memset(&rstream2, 0, sizeof(rstream2));
+  memset(&rstream3, 0, sizeof(rstream3));
+  rstream.format = fmt_;
+  rstream.flags = LOW_LATENCY;
+  rstream2 = rstream;
+  rstream3 = rstream;
+
+  cras_iodev_list_init();
+
+  d1_.direction = CRAS_STREAM_OUTPUT;
+  rc = cras_iodev_list_add_output(&d1_);
+  ASSERT_EQ(0, rc);
+  cras_iodev_list_add_active_node(CRAS_STREAM_OUTPUT,
+                                  cras_make_node_id(d1_.info.idx, 1));
+
+  /* The device can't run it, don't leave it open for nothing. */
+  cras_iodev_supports_low_latency_ret = false;
+  DL_APPEND(stream_list, &rstream);
+  stream_list_get_ret = stream_list;
+  EXPECT_EQ(-ENOTSUP, stream_add_cb(&rstream));
+  EXPECT_EQ(0, audio_thread_add_stream_called);
+  EXPECT_EQ(1, cras_iodev_open_called);
+  EXPECT_EQ(1, cras_iodev_close_called);
+
+  cras_iodev_supports_low_latency_ret = true;
+  EXPECT_EQ(0, stream_add_cb(&rstream));
+  EXPECT_EQ(1, audio_thread_add_stream_called);
+
+  DL_APPEND(stream_list, &rstream2);
+  EXPECT_EQ(0, stream_add_cb(&rstream2));
+  EXPECT_EQ(2, audio_thread_add_stream_called);
+
+  /* No room for a third one. */
+  DL_APPEND(stream_list, &rstream3);
+  EXPECT_EQ(-ENOTSUP, stream_add_cb(&rstream3));
+  EXPECT_EQ(2, audio_thread_add_stream_called);
+  EXPECT_EQ(1, cras_iodev_close_called);
+
+  cras_iodev_list_deinit();
+}
+
+TEST_F(IoDevTestSuite, PassthroughStreamPausesOtherOutputs) {
+  struct cras_rstream rstream, rstream2, rstream3;
+  struct cras_rstream* stream_list = NULL;
+  int rc;
+
+  memset(&rstream, 0, sizeof(rstream));
+  memset(&rstream2, 0, sizeof(rstream2));
+  memset(&rstream3, 0, sizeof(rstream3));
+  rstream.format = fmt_;
+  rstream2.format = fmt_;
+  rstream2.flags = PASSTHROUGH;
+  rstream3.format = fmt_;
+
+  cras_iodev_list_init();
+
+  d1_.direction = CRAS_STREAM_OUTPUT;
+  rc = cras_iodev_list_add_output(&d1_);
+  ASSERT_EQ(0, rc);
+  cras_iodev_list_add_active_node(CRAS_STREAM_OUTPUT,
+                                  cras_make_node_id(d1_.info.idx, 1));
+
+  DL_APPEND(stream_list, &rstream);
+  stream_list_get_ret = stream_list;
+  EXPECT_EQ(0, stream_add_cb(&rstream));
+  EXPECT_EQ(1, audio_thread_add_stream_called);
+
+  /* The sink can't decode it, the other stream keeps playing. */
+  cras_iodev_supports_passthrough_ret = false;
+  DL_APPEND(stream_list, &rstream2);
+  EXPECT_EQ(-ENOTSUP, stream_add_cb(&rstream2));
+  EXPECT_EQ(1, audio_thread_add_stream_called);
+  EXPECT_EQ(0, audio_thread_disconnect_stream_called);
+
+  cras_iodev_supports_passthrough_ret = true;
+  EXPECT_EQ(0, stream_add_cb(&rstream2));
+  EXPECT_EQ(2, audio_thread_add_stream_called);
+  EXPECT_EQ(1, audio_thread_disconnect_stream_called);
+  EXPECT_EQ(&rstream, audio_thread_disconnect_stream_stream);
+
+  /* New output streams wait for it to finish. */
+  DL_APPEND(stream_list, &rstream3);
+  EXPECT_EQ(0, stream_add_cb(&rstream3));
+  EXPECT_EQ(2, audio_thread_add_stream_called);
+
+  DL_DELETE(stream_list, &rstream2);
+  stream_list_get_ret = stream_list;
+  stream_rm_cb(&rstream2);
+  EXPECT_EQ(4, audio_thread_add_stream_called);
+
+  cras_iodev_list_deinit();
+}
+
+TEST_F(IoDevTestSuite, ExclusiveStreamAdmission) {
+  struct cras_rstream rstream, rstream2;
+  struct cras_rstream* stream_list = NULL;
+  int rc;
+
+  memset(&rstream, 0, sizeof(rstream));
+  memset(&rstream2, 0, sizeof(rstream2));
+  rstream.format = fmt_;
+  rstream.flags = EXCLUSIVE;
+  rstream2 = rstream;
+
+  cras_iodev_list_init();
+
+  d1_.direction = CRAS_STREAM_OUTPUT;
+  rc = cras_iodev_list_add_output(&d1_);
+  ASSERT_EQ(0, rc);
+  cras_iodev_list_add_active_node(CRAS_STREAM_OUTPUT,
+                                  cras_make_node_id(d1_.info.idx, 1));
+
+  /* The stream would need converting to the device format. */
+  cras_iodev_supports_exclusive_ret = false;
+  DL_APPEND(stream_list, &rstream);
+  stream_list_get_ret = stream_list;
+  EXPECT_EQ(-ENOTSUP, stream_add_cb(&rstream));
+  EXPECT_EQ(0, audio_thread_add_stream_called);
+  EXPECT_EQ(1, cras_iodev_close_called);
+
+  cras_iodev_supports_exclusive_ret = true;
+  EXPECT_EQ(0, stream_add_cb(&rstream));
+  EXPECT_EQ(1, audio_thread_add_stream_called);
+
+  /* Only one stream has the device to itself, the next one waits. */
+  DL_APPEND(stream_list, &rstream2);
+  EXPECT_EQ(0, stream_add_cb(&rstream2));
+  EXPECT_EQ(1, audio_thread_add_stream_called);
+
+  DL_DELETE(stream_list, &rstream);
+  stream_list_get_ret = stream_list;
+  stream_rm_cb(&rstream);
+  EXPECT_EQ(2, audio_thread_add_stream_called);
+
+  cras_iodev_list_deinit();
+}
+
 TEST_F(IoDevTestSuite, InitDevFailShouldEnableFallback) {
   int rc;
   struct cras_rstream rstream;
@@ -828,6 +1278,99 @@ TEST_F(IoDevTestSuite, SelectNode) {
   cras_iodev_list_deinit();
 }
 
+TEST_F(IoDevTestSuite, SelectNodeOutputStandby) {
+  struct cras_rstream rstream;
+
+  memset(&rstream, 0, sizeof(rstream));
+  system_get_output_standby_ms_return = 1000;
+  cras_iodev_list_init();
+
+  d1_.direction = CRAS_STREAM_OUTPUT;
+  node1.idx = 1;
+  ASSERT_EQ(0, cras_iodev_list_add_output(&d1_));
+  d2_.direction = CRAS_STREAM_OUTPUT;
+  node2.idx = 2;
+  ASSERT_EQ(0, cras_iodev_list_add_output(&d2_));
+
+  cras_iodev_list_select_node(CRAS_STREAM_OUTPUT,
+                              cras_make_node_id(d1_.info.idx, 1));
+  DL_APPEND(stream_list_get_ret, &rstream);
+  stream_add_cb(&rstream);
+  EXPECT_EQ(1, cras_iodev_open_called);
+
+  // The deselected device stays open with its streams removed. Only the
+  // fallback device used in the transition is closed.
+  clock_gettime_retspec.tv_sec = 10;
+  cras_tm_create_timer_called = 0;
+  cras_iodev_list_select_node(CRAS_STREAM_OUTPUT,
+                              cras_make_node_id(d2_.info.idx, 2));
+  EXPECT_EQ(3, cras_iodev_open_called);
+  EXPECT_EQ(1, cras_iodev_close_called);
+  EXPECT_EQ(&mock_empty_iodev[CRAS_STREAM_OUTPUT], cras_iodev_close_dev);
+  EXPECT_EQ(&d1_, audio_thread_disconnect_stream_dev);
+  EXPECT_EQ(1, cras_tm_create_timer_called);
+
+  // Selecting it back within the standby time skips the open, and the
+  // fallback device isn't needed for the transition.
+  audio_thread_add_stream_called = 0;
+  device_enabled_count = 0;
+  EXPECT_EQ(0, cras_iodev_list_set_device_enabled_callback(
+                   device_enabled_cb, device_disabled_cb, (void*)0xABCD));
+  cras_iodev_list_select_node(CRAS_STREAM_OUTPUT,
+                              cras_make_node_id(d1_.info.idx, 1));
+  EXPECT_EQ(3, cras_iodev_open_called);
+  EXPECT_EQ(1, cras_iodev_close_called);
+  EXPECT_EQ(1, device_enabled_count);
+  EXPECT_EQ(1, audio_thread_add_stream_called);
+  EXPECT_EQ(&d1_, audio_thread_add_stream_dev);
+
+  // d2_ is closed once its standby expires.
+  clock_gettime_retspec.tv_sec = 12;
+  cras_tm_timer_cb(NULL, NULL);
+  EXPECT_EQ(2, cras_iodev_close_called);
+  EXPECT_EQ(&d2_, cras_iodev_close_dev);
+
+  EXPECT_EQ(0, cras_iodev_list_set_device_enabled_callback(NULL, NULL, NULL));
+  stream_list_get_ret = NULL;
+  cras_iodev_list_deinit();
+}
+
+TEST_F(IoDevTestSuite, SelectNodeSameDevInPlace) {
+  struct cras_rstream rstream;
+
+  memset(&rstream, 0, sizeof(rstream));
+  system_get_output_standby_ms_return = 1000;
+  cras_iodev_list_init();
+
+  d1_.direction = CRAS_STREAM_OUTPUT;
+  node1.idx = 1;
+  ASSERT_EQ(0, cras_iodev_list_add_output(&d1_));
+
+  cras_iodev_list_select_node(CRAS_STREAM_OUTPUT,
+                              cras_make_node_id(d1_.info.idx, 1));
+  DL_APPEND(stream_list_get_ret, &rstream);
+  stream_add_cb(&rstream);
+  EXPECT_EQ(1, cras_iodev_open_called);
+
+  // Another node of the open device is switched to without reopening.
+  update_active_node_called = 0;
+  audio_thread_rm_open_dev_called = 0;
+  cras_iodev_list_select_node(CRAS_STREAM_OUTPUT,
+                              cras_make_node_id(d1_.info.idx, 2));
+  EXPECT_EQ(1, cras_iodev_open_called);
+  EXPECT_EQ(0, cras_iodev_close_called);
+  EXPECT_EQ(0, audio_thread_rm_open_dev_called);
+  EXPECT_EQ(1, update_active_node_called);
+  EXPECT_EQ(2, update_active_node_node_idx_val[0]);
+  EXPECT_EQ(1, update_active_node_dev_enabled_val[0]);
+  EXPECT_EQ(1, audio_thread_dev_start_ramp_called);
+  EXPECT_EQ(CRAS_IODEV_RAMP_REQUEST_SWITCH_MUTE,
+            audio_thread_dev_start_ramp_req);
+
+  stream_list_get_ret = NULL;
+  cras_iodev_list_deinit();
+}
+
 TEST_F(IoDevTestSuite, SelectPreviouslyEnabledNode) {
   struct cras_rstream rstream;
   int rc;
@@ -1016,6 +1559,38 @@ TEST_F(IoDevTestSuite, AddRemoveOutput) {
   cras_iodev_list_deinit();
 }
 
+TEST_F(IoDevTestSuite, AggregateOutput) {
+  uint32_t dev_idxs[2];
+  int rc;
+  cras_iodev_list_init();
+
+  ASSERT_EQ(0, cras_iodev_list_add_output(&d1_));
+  ASSERT_EQ(0, cras_iodev_list_add_output(&d2_));
+  dev_idxs[0] = d1_.info.idx;
+  dev_idxs[1] = d2_.info.idx;
+
+  // It takes two devices to aggregate.
+  EXPECT_EQ(0, cras_iodev_list_set_aggregate_output(dev_idxs, 1));
+  EXPECT_EQ(0, aggregate_iodev_members.size());
+
+  rc = cras_iodev_list_set_aggregate_output(dev_idxs, 2);
+  EXPECT_EQ(fake_aggregate_dev.info.idx, rc);
+  ASSERT_EQ(2, aggregate_iodev_members.size());
+  EXPECT_EQ(&d1_, aggregate_iodev_members[0]);
+  EXPECT_EQ(&d2_, aggregate_iodev_members[1]);
+  EXPECT_EQ(3, cras_iodev_list_get_outputs(NULL));
+
+  // Removing a member removes the aggregate output too.
+  EXPECT_EQ(0, cras_iodev_list_rm_output(&d2_));
+  EXPECT_EQ(1, aggregate_iodev_destroy_called);
+  EXPECT_EQ(1, cras_iodev_list_get_outputs(NULL));
+
+  // Unknown devices can't be aggregated.
+  EXPECT_EQ(-EINVAL, cras_iodev_list_set_aggregate_output(dev_idxs, 2));
+  EXPECT_EQ(1, aggregate_iodev_destroy_called);
+  cras_iodev_list_deinit();
+}
+
 // Test output_mute_changed callback.
 TEST_F(IoDevTestSuite, OutputMuteChangedToMute) {
   cras_iodev_list_init();
@@ -1137,6 +1712,38 @@ TEST_F(IoDevTestSuite, EnableDisableDevice) {
   cras_iodev_list_deinit();
 }
 
+// Only the changed direction of the shared state is marked as updated.
+TEST_F(IoDevTestSuite, UpdateDeviceListOnlyMarksChangedSection) {
+  uint32_t output_count, input_count;
+
+  d1_.direction = CRAS_STREAM_INPUT;
+  cras_iodev_list_init();
+  memset(&server_state_stub, 0, sizeof(server_state_stub));
+
+  EXPECT_EQ(0, cras_iodev_list_add_input(&d1_));
+  output_count = server_state_stub.section_update_count[CRAS_STATE_OUTPUT_DEVS];
+  input_count = server_state_stub.section_update_count[CRAS_STATE_INPUT_DEVS];
+  EXPECT_EQ(0, output_count);
+  EXPECT_EQ(2, input_count);
+  EXPECT_EQ(1, server_state_stub.num_input_devs);
+
+  // Nothing changed, clients keep their copy.
+  cras_iodev_list_update_device_list();
+  EXPECT_EQ(output_count,
+            server_state_stub.section_update_count[CRAS_STATE_OUTPUT_DEVS]);
+  EXPECT_EQ(input_count,
+            server_state_stub.section_update_count[CRAS_STATE_INPUT_DEVS]);
+
+  EXPECT_EQ(0, cras_iodev_list_rm_input(&d1_));
+  EXPECT_EQ(output_count,
+            server_state_stub.section_update_count[CRAS_STATE_OUTPUT_DEVS]);
+  EXPECT_EQ(input_count + 2,
+            server_state_stub.section_update_count[CRAS_STATE_INPUT_DEVS]);
+  EXPECT_EQ(0, server_state_stub.num_input_devs);
+
+  cras_iodev_list_deinit();
+}
+
 // Test adding/removing an input dev to the list.
 TEST_F(IoDevTestSuite, AddRemoveInput) {
   struct cras_iodev_info* dev_info;
@@ -1202,8 +1809,107 @@ TEST_F(IoDevTestSuite, AddRemoveInput) {
   cras_iodev_list_deinit();
 }
 
-// Test adding/removing an input dev to the list without updating the server
-// state.
+// Test adding/removing an input dev to the list without updating the server
+// state.
+TEST_F(IoDevTestSuite, SetStreamEffects) {
+  struct cras_rstream rstream, rstream2;
+
+  cras_iodev_list_init();
+
+  memset(&rstream, 0, sizeof(rstream));
+  memset(&rstream2, 0, sizeof(rstream2));
+  rstream.stream_id = 0x10001;
+  rstream.direction = CRAS_STREAM_INPUT;
+  rstream2.stream_id = 0x10002;
+  rstream2.direction = CRAS_STREAM_OUTPUT;
+  DL_APPEND(stream_list_get_ret, &rstream);
+  DL_APPEND(stream_list_get_ret, &rstream2);
+
+  // Only input streams have effects to change.
+  EXPECT_EQ(-EINVAL, cras_iodev_list_set_stream_effects(
+                         0x10003, APM_ECHO_CANCELLATION));
+  EXPECT_EQ(-EINVAL, cras_iodev_list_set_stream_effects(
+                         0x10002, APM_ECHO_CANCELLATION));
+
+  // Nothing to do for the same effects.
+  EXPECT_EQ(0, cras_iodev_list_set_stream_effects(0x10001, 0));
+
+  // Without the APM the stream can't get echo cancellation.
+  EXPECT_EQ(-ENOTSUP, cras_iodev_list_set_stream_effects(
+                          0x10001, APM_ECHO_CANCELLATION));
+  EXPECT_EQ(0, audio_thread_swap_stream_apms_called);
+
+  stream_list_get_ret = NULL;
+  cras_iodev_list_deinit();
+}
+
+TEST_F(IoDevTestSuite, SetStreamPaused) {
+  struct cras_rstream rstream;
+
+  cras_iodev_list_init();
+
+  memset(&rstream, 0, sizeof(rstream));
+  rstream.stream_id = 0x10001;
+  rstream.direction = CRAS_STREAM_OUTPUT;
+  DL_APPEND(stream_list_get_ret, &rstream);
+
+  EXPECT_EQ(-EINVAL, cras_iodev_list_set_stream_paused(0x10002, 1, 0));
+
+  // Nothing to do for a stream already playing.
+  EXPECT_EQ(0, cras_iodev_list_set_stream_paused(0x10001, 0, 0));
+  EXPECT_EQ(0, audio_thread_set_stream_paused_called);
+
+  EXPECT_EQ(0, cras_iodev_list_set_stream_paused(0x10001, 2, 0));
+  EXPECT_EQ(1, rstream.paused);
+  EXPECT_EQ(1, audio_thread_set_stream_paused_called);
+  EXPECT_EQ(0, cras_iodev_list_set_stream_paused(0x10001, 1, 0));
+  EXPECT_EQ(1, audio_thread_set_stream_paused_called);
+
+  EXPECT_EQ(0, cras_iodev_list_set_stream_paused(0x10001, 0, 30));
+  EXPECT_EQ(0, rstream.paused);
+  EXPECT_EQ(2, audio_thread_set_stream_paused_called);
+  EXPECT_EQ(30, audio_thread_set_stream_paused_fade_in_ms);
+
+  stream_list_get_ret = NULL;
+  cras_iodev_list_deinit();
+}
+
+TEST_F(IoDevTestSuite, AddRoute) {
+  cras_iodev_list_init();
+
+  d1_.direction = CRAS_STREAM_OUTPUT;
+  ASSERT_EQ(0, cras_iodev_list_add_output(&d1_));
+  d2_.direction = CRAS_STREAM_INPUT;
+  ASSERT_EQ(0, cras_iodev_list_add_input(&d2_));
+
+  // Routes go from an input to an output.
+  EXPECT_EQ(-EINVAL,
+            cras_iodev_list_add_route(d1_.info.idx, d2_.info.idx, 20, 0));
+  EXPECT_EQ(-EINVAL, cras_iodev_list_add_route(d2_.info.idx, 12345, 20, 0));
+  EXPECT_EQ(0, server_stream_create_route_called);
+
+  // A closed output gets the default format.
+  EXPECT_EQ(1, cras_iodev_list_add_route(d2_.info.idx, d1_.info.idx, 20, 0));
+  EXPECT_EQ(48000, server_stream_create_route_fmt.frame_rate);
+  EXPECT_EQ(2, server_stream_create_route_fmt.num_channels);
+
+  // An open one plays in its own format.
+  fmt_.frame_rate = 44100;
+  d1_.format = &fmt_;
+  d1_.state = CRAS_IODEV_STATE_NORMAL_RUN;
+  EXPECT_EQ(1, cras_iodev_list_add_route(d2_.info.idx, d1_.info.idx, 20, 0));
+  EXPECT_EQ(44100, server_stream_create_route_fmt.frame_rate);
+  EXPECT_EQ(2, server_stream_create_route_called);
+
+  EXPECT_EQ(0, cras_iodev_list_rm_route(1));
+  EXPECT_EQ(1, server_stream_destroy_route_called);
+
+  d1_.state = CRAS_IODEV_STATE_CLOSE;
+  cras_iodev_list_rm_input(&d2_);
+  cras_iodev_list_rm_output(&d1_);
+  cras_iodev_list_deinit();
+}
+
 TEST_F(IoDevTestSuite, AddRemoveInputNoSem) {
   int rc;
 
@@ -1527,6 +2233,130 @@ TEST_F(IoDevTestSuite, OutputDevIdleClose) {
   cras_iodev_list_deinit();
 }
 
+TEST_F(IoDevTestSuite, OutputDevIdleKeepAlive) {
+  struct cras_rstream rstream;
+
+  memset(&rstream, 0, sizeof(rstream));
+  cras_iodev_list_init();
+
+  d1_.direction = CRAS_STREAM_OUTPUT;
+  EXPECT_EQ(0, cras_iodev_list_add_output(&d1_));
+  d1_.format = &fmt_;
+  cras_iodev_list_add_active_node(CRAS_STREAM_OUTPUT,
+                                  cras_make_node_id(d1_.info.idx, 1));
+
+  // A device slow to open goes idle, then is used again after 20 seconds.
+  clock_gettime_retspec.tv_sec = 0;
+  clock_gettime_retspec.tv_nsec = 0;
+  cras_iodev_open_cost_ns = 20000000;
+  stream_add_cb(&rstream);
+  EXPECT_EQ(1, cras_iodev_open_called);
+  audio_thread_drain_stream_return = 0;
+  clock_gettime_retspec.tv_sec = 1;
+  stream_rm_cb(&rstream);
+  clock_gettime_retspec.tv_sec = 21;
+  stream_add_cb(&rstream);
+  EXPECT_EQ(1, cras_iodev_open_called);
+
+  // It now stays open twice that gap once idle, instead of 10 seconds.
+  audio_thread_rm_open_dev_called = 0;
+  clock_gettime_retspec.tv_sec = 22;
+  stream_rm_cb(&rstream);
+  clock_gettime_retspec.tv_sec = 40;
+  cras_tm_timer_cb(NULL, NULL);
+  EXPECT_EQ(0, audio_thread_rm_open_dev_called);
+  clock_gettime_retspec.tv_sec = 63;
+  cras_tm_timer_cb(NULL, NULL);
+  EXPECT_EQ(1, audio_thread_rm_open_dev_called);
+
+  cras_iodev_list_deinit();
+}
+
+TEST_F(IoDevTestSuite, InputDevPreRollKeepWarm) {
+  struct cras_rstream rstream;
+
+  memset(&rstream, 0, sizeof(rstream));
+  rstream.direction = CRAS_STREAM_INPUT;
+  rstream.format.frame_rate = 48000;
+  rstream.pre_roll_frames = 4800;
+  cras_iodev_list_init();
+
+  d1_.direction = CRAS_STREAM_INPUT;
+  EXPECT_EQ(0, cras_iodev_list_add_input(&d1_));
+  d1_.format = &fmt_;
+  cras_iodev_list_add_active_node(CRAS_STREAM_INPUT,
+                                  cras_make_node_id(d1_.info.idx, 1));
+
+  // The stream teaches the device to keep 100ms of history.
+  clock_gettime_retspec.tv_sec = 0;
+  clock_gettime_retspec.tv_nsec = 0;
+  stream_add_cb(&rstream);
+  EXPECT_EQ(1, cras_iodev_open_called);
+  EXPECT_EQ(101, d1_.pre_roll_ms);
+
+  // Without an idle gap known yet it closes with its last stream.
+  clock_gettime_retspec.tv_sec = 1;
+  stream_rm_cb(&rstream);
+  EXPECT_EQ(1, cras_iodev_close_called);
+  clock_gettime_retspec.tv_sec = 3;
+  stream_add_cb(&rstream);
+  EXPECT_EQ(2, cras_iodev_open_called);
+
+  // Streams two seconds apart keep it open four seconds once idle.
+  clock_gettime_retspec.tv_sec = 4;
+  stream_rm_cb(&rstream);
+  EXPECT_EQ(1, cras_iodev_close_called);
+  clock_gettime_retspec.tv_sec = 7;
+  cras_tm_timer_cb(NULL, NULL);
+  EXPECT_EQ(1, cras_iodev_close_called);
+  clock_gettime_retspec.tv_sec = 9;
+  cras_tm_timer_cb(NULL, NULL);
+  EXPECT_EQ(2, cras_iodev_close_called);
+
+  cras_iodev_list_deinit();
+}
+
+TEST_F(IoDevTestSuite, OutputDevIdleReopenForRate) {
+  struct cras_rstream rstream;
+
+  memset(&rstream, 0, sizeof(rstream));
+  rstream.format = fmt_;
+  cras_iodev_list_init();
+
+  d1_.direction = CRAS_STREAM_OUTPUT;
+  EXPECT_EQ(0, cras_iodev_list_add_output(&d1_));
+  d1_.format = &fmt_;
+  cras_iodev_list_add_active_node(CRAS_STREAM_OUTPUT,
+                                  cras_make_node_id(d1_.info.idx, 1));
+
+  clock_gettime_retspec.tv_sec = 0;
+  clock_gettime_retspec.tv_nsec = 0;
+  stream_add_cb(&rstream);
+  EXPECT_EQ(1, cras_iodev_open_called);
+  d1_.open_ts = clock_gettime_retspec;
+  audio_thread_drain_stream_return = 0;
+  clock_gettime_retspec.tv_sec = 1;
+  stream_rm_cb(&rstream);
+
+  // A stream better served at another rate soon after the device opened
+  // doesn't reopen it.
+  cras_iodev_best_rate_ret = fmt_.frame_rate * 2;
+  clock_gettime_retspec.tv_sec = 5;
+  stream_add_cb(&rstream);
+  EXPECT_EQ(1, cras_iodev_open_called);
+  EXPECT_EQ(0, cras_iodev_close_called);
+  clock_gettime_retspec.tv_sec = 6;
+  stream_rm_cb(&rstream);
+
+  // Once the rate was held long enough, the idle device is reopened.
+  clock_gettime_retspec.tv_sec = 12;
+  stream_add_cb(&rstream);
+  EXPECT_EQ(1, cras_iodev_close_called);
+  EXPECT_EQ(2, cras_iodev_open_called);
+
+  cras_iodev_list_deinit();
+}
+
 TEST_F(IoDevTestSuite, DrainTimerCancel) {
   int rc;
   struct cras_rstream rstream;
@@ -1775,6 +2605,61 @@ TEST_F(IoDevTestSuite, AddRemovePinnedStream) {
   cras_iodev_list_deinit();
 }
 
+TEST_F(IoDevTestSuite, PinnedStreamOnSecondAudioThread) {
+  struct cras_rstream rstream, rstream2;
+  int card_key;
+
+  system_get_num_audio_threads_return = 2;
+  cras_iodev_list_init();
+  EXPECT_EQ(2, audio_thread_create_called);
+
+  d1_.direction = CRAS_STREAM_OUTPUT;
+  d1_.info.idx = 1;
+  EXPECT_EQ(0, cras_iodev_list_add_output(&d1_));
+  cras_iodev_list_select_node(CRAS_STREAM_OUTPUT,
+                              cras_make_node_id(d1_.info.idx, 0));
+  d2_.direction = CRAS_STREAM_OUTPUT;
+  d2_.info.idx = 2;
+  d2_.thread_key = &card_key;
+  EXPECT_EQ(0, cras_iodev_list_add_output(&d2_));
+  d3_.direction = CRAS_STREAM_OUTPUT;
+  d3_.info.idx = 3;
+  d3_.thread_key = &card_key;
+  EXPECT_EQ(0, cras_iodev_list_add_output(&d3_));
+
+  memset(&rstream, 0, sizeof(rstream));
+  rstream.is_pinned = 1;
+  rstream.pinned_dev_idx = d2_.info.idx;
+  memset(&rstream2, 0, sizeof(rstream2));
+  rstream2.is_pinned = 1;
+  rstream2.pinned_dev_idx = d3_.info.idx;
+
+  // A device only open for a pinned stream runs on the second thread.
+  EXPECT_EQ(0, stream_add_cb(&rstream));
+  EXPECT_EQ(&threads[1], d2_.thread);
+  EXPECT_EQ(&threads[1], audio_thread_add_open_dev_thread);
+  EXPECT_EQ(&threads[1], audio_thread_add_stream_thread);
+
+  // Devices sharing the thread key join it.
+  EXPECT_EQ(0, stream_add_cb(&rstream2));
+  EXPECT_EQ(&threads[1], d3_.thread);
+  EXPECT_EQ(&threads[1], audio_thread_add_stream_thread);
+
+  // Once enabled they move to the first thread, with their streams.
+  DL_APPEND(stream_list_get_ret, &rstream);
+  DL_APPEND(stream_list_get_ret, &rstream2);
+  cras_iodev_close_called = 0;
+  cras_iodev_list_select_node(CRAS_STREAM_OUTPUT,
+                              cras_make_node_id(d2_.info.idx, 0));
+  EXPECT_EQ(2, cras_iodev_close_called);
+  EXPECT_EQ(&threads[0], d2_.thread);
+  EXPECT_EQ(&threads[0], d3_.thread);
+  EXPECT_EQ(&threads[0], audio_thread_add_stream_thread);
+
+  stream_list_get_ret = NULL;
+  cras_iodev_list_deinit();
+}
+
 TEST_F(IoDevTestSuite, SuspendResumePinnedStream) {
   struct cras_rstream rstream;
 
@@ -1924,6 +2809,89 @@ TEST_F(IoDevTestSuite, HotwordStreamsAddedAfterSuspend) {
   cras_iodev_list_deinit();
 }
 
+static char* get_hotword_models(struct cras_iodev* iodev) {
+  return strdup("en_all,en_us");
+}
+
+/* Runs on the hotword model worker. */
+static int set_hotword_model(struct cras_iodev* iodev, const char* model) {
+  pthread_mutex_lock(&worker_mutex);
+  set_hotword_model_models.push_back(model);
+  pthread_mutex_unlock(&worker_mutex);
+  return 0;
+}
+
+TEST_F(IoDevTestSuite, HotwordModelLoadedWithStreamsSuspended) {
+  struct cras_rstream rstream;
+  struct cras_rstream* stream_list = NULL;
+  struct cras_main_message* msg;
+  cras_node_id_t node_id;
+
+  cras_iodev_list_init();
+  set_hotword_model_models.clear();
+  cras_observer_notify_hotword_model_loaded_called = 0;
+
+  node1.type = CRAS_NODE_TYPE_HOTWORD;
+  memset(node1.active_hotword_model, 0, sizeof(node1.active_hotword_model));
+  d1_.direction = CRAS_STREAM_INPUT;
+  d1_.get_hotword_models = get_hotword_models;
+  d1_.set_hotword_model = set_hotword_model;
+  EXPECT_EQ(0, cras_iodev_list_add_input(&d1_));
+  d1_.format = &fmt_;
+  node_id = cras_make_node_id(d1_.info.idx, node1.idx);
+
+  memset(&rstream, 0, sizeof(rstream));
+  rstream.is_pinned = 1;
+  rstream.pinned_dev_idx = d1_.info.idx;
+  rstream.flags = HOTWORD_STREAM;
+  EXPECT_EQ(0, stream_add_cb(&rstream));
+  DL_APPEND(stream_list, &rstream);
+  stream_list_get_ret = stream_list;
+
+  EXPECT_EQ(-EINVAL, cras_iodev_list_set_hotword_model(node_id, "fr_fr"));
+  EXPECT_EQ(0, audio_thread_disconnect_stream_called);
+
+  /* The hotword stream moves to the empty device during the load. */
+  EXPECT_EQ(0, cras_iodev_list_set_hotword_model(node_id, "en_us"));
+  EXPECT_EQ(1, audio_thread_disconnect_stream_called);
+  EXPECT_EQ(&d1_, audio_thread_disconnect_stream_dev);
+  EXPECT_EQ(&mock_hotword_iodev, audio_thread_add_stream_dev);
+
+  /* Asked for during the load, loaded after it. */
+  EXPECT_EQ(0, cras_iodev_list_set_hotword_model(node_id, "en_all"));
+  /* The DSP isn't re-armed before the loads are done. */
+  EXPECT_EQ(0, cras_iodev_list_resume_hotword_stream());
+  EXPECT_EQ(1, audio_thread_disconnect_stream_called);
+
+  msg = wait_worker_msg();
+  ASSERT_NE(nullptr, hotword_model_loaded_cb);
+  hotword_model_loaded_cb(msg, NULL);
+  free(msg);
+  EXPECT_STREQ("en_us", node1.active_hotword_model);
+  EXPECT_EQ(1, cras_observer_notify_hotword_model_loaded_called);
+  EXPECT_EQ("en_us", cras_observer_notify_hotword_model_loaded_model);
+  EXPECT_EQ(0, cras_observer_notify_hotword_model_loaded_error);
+  EXPECT_EQ(1, audio_thread_disconnect_stream_called);
+
+  msg = wait_worker_msg();
+  hotword_model_loaded_cb(msg, NULL);
+  free(msg);
+  EXPECT_STREQ("en_all", node1.active_hotword_model);
+  EXPECT_EQ(2, cras_observer_notify_hotword_model_loaded_called);
+  ASSERT_EQ(2, set_hotword_model_models.size());
+  EXPECT_EQ("en_us", set_hotword_model_models[0]);
+  EXPECT_EQ("en_all", set_hotword_model_models[1]);
+
+  /* Back on the hotword device. */
+  EXPECT_EQ(2, audio_thread_disconnect_stream_called);
+  EXPECT_EQ(&mock_hotword_iodev, audio_thread_disconnect_stream_dev);
+  EXPECT_EQ(&d1_, audio_thread_add_stream_dev);
+
+  d1_.get_hotword_models = NULL;
+  d1_.set_hotword_model = NULL;
+  cras_iodev_list_deinit();
+}
+
 TEST_F(IoDevTestSuite, GetSCOPCMIodevs) {
   cras_iodev_list_init();
 
@@ -1964,8 +2932,55 @@ int cras_system_get_mute() {
   return system_get_mute_return;
 }
 
+unsigned int cras_system_get_output_standby_ms() {
+  return system_get_output_standby_ms_return;
+}
+
+unsigned int cras_system_get_num_audio_threads() {
+  return system_get_num_audio_threads_return;
+}
+
+unsigned long cras_system_get_audio_thread_cpu_mask(unsigned int idx) {
+  return 0;
+}
+
+int cras_virtual_clock_enabled() {
+  return 0;
+}
+
 struct audio_thread* audio_thread_create() {
-  return &thread;
+  return &threads[audio_thread_create_called++ % CRAS_MAX_AUDIO_THREADS];
+}
+
+int audio_thread_set_cpu_affinity(struct audio_thread* thread,
+                                  unsigned long cpu_mask) {
+  return 0;
+}
+
+void audio_thread_set_perf_stats(struct audio_thread* thread,
+                                 struct cras_perf_stats* stats) {}
+
+int audio_thread_dump_thread_info(struct audio_thread* thread,
+                                  struct audio_debug_info* info) {
+  return 0;
+}
+
+int audio_thread_append_thread_info(struct audio_thread* thread,
+                                    struct audio_debug_info* info) {
+  return 0;
+}
+
+int audio_thread_config_global_remix(struct audio_thread* thread,
+                                     unsigned int num_channels,
+                                     const float* coefficient) {
+  return 0;
+}
+
+int audio_thread_set_aec_dump(struct audio_thread* thread,
+                              cras_stream_id_t stream_id,
+                              unsigned int start,
+                              int fd) {
+  return 0;
 }
 
 int audio_thread_start(struct audio_thread* thread) {
@@ -1989,6 +3004,7 @@ void audio_thread_remove_streams(struct audio_thread* thread,
 int audio_thread_add_open_dev(struct audio_thread* thread,
                               struct cras_iodev* dev) {
   audio_thread_add_open_dev_dev = dev;
+  audio_thread_add_open_dev_thread = thread;
   audio_thread_add_open_dev_called++;
   return 0;
 }
@@ -2010,11 +3026,24 @@ int audio_thread_add_stream(struct audio_thread* thread,
                             struct cras_iodev** devs,
                             unsigned int num_devs) {
   audio_thread_add_stream_called++;
+  audio_thread_add_stream_thread = thread;
   audio_thread_add_stream_stream = stream;
   audio_thread_add_stream_dev = (num_devs ? devs[0] : NULL);
   return 0;
 }
 
+int audio_thread_add_streams(struct audio_thread* thread,
+                             struct audio_thread_stream_attach* attaches,
+                             unsigned int num) {
+  audio_thread_add_streams_called++;
+  audio_thread_add_streams_num = num;
+  for (unsigned int i = 0; i < num && i < 8; i++) {
+    attaches[i].rc = 0;
+    audio_thread_add_streams_attaches[i] = attaches[i];
+  }
+  return 0;
+}
+
 int audio_thread_disconnect_stream(struct audio_thread* thread,
                                    struct cras_rstream* stream,
                                    struct cras_iodev* iodev) {
@@ -2024,6 +3053,20 @@ int audio_thread_disconnect_stream(struct audio_thread* thread,
   return 0;
 }
 
+int audio_thread_swap_stream_apms(struct audio_thread* thread,
+                                  struct cras_rstream* stream) {
+  audio_thread_swap_stream_apms_called++;
+  return 1;
+}
+
+int audio_thread_set_stream_paused(struct audio_thread* thread,
+                                   struct cras_rstream* stream,
+                                   unsigned int fade_in_ms) {
+  audio_thread_set_stream_paused_called++;
+  audio_thread_set_stream_paused_fade_in_ms = fade_in_ms;
+  return 0;
+}
+
 int audio_thread_drain_stream(struct audio_thread* thread,
                               struct cras_rstream* stream) {
   audio_thread_drain_stream_called++;
@@ -2047,6 +3090,36 @@ struct cras_iodev* empty_iodev_create(enum CRAS_STREAM_DIRECTION direction,
   return dev;
 }
 
+static void aggregate_update_active_node(struct cras_iodev* iodev,
+                                         unsigned node_idx,
+                                         unsigned dev_enabled) {}
+
+struct cras_iodev* aggregate_iodev_create(struct cras_iodev* const* members,
+                                          unsigned int num_members) {
+  aggregate_iodev_members.assign(members, members + num_members);
+  memset(&fake_aggregate_dev, 0, sizeof(fake_aggregate_dev));
+  memset(&fake_aggregate_node, 0, sizeof(fake_aggregate_node));
+  fake_aggregate_dev.direction = CRAS_STREAM_OUTPUT;
+  fake_aggregate_dev.nodes = &fake_aggregate_node;
+  fake_aggregate_dev.active_node = &fake_aggregate_node;
+  fake_aggregate_dev.update_active_node = aggregate_update_active_node;
+  fake_aggregate_node.dev = &fake_aggregate_dev;
+  cras_iodev_list_add_output(&fake_aggregate_dev);
+  return &fake_aggregate_dev;
+}
+
+void aggregate_iodev_destroy(struct cras_iodev* iodev) {
+  aggregate_iodev_destroy_called++;
+  cras_iodev_list_rm_output(iodev);
+}
+
+int aggregate_iodev_has_member(const struct cras_iodev* iodev,
+                               const struct cras_iodev* dev) {
+  return std::find(aggregate_iodev_members.begin(),
+                   aggregate_iodev_members.end(),
+                   dev) != aggregate_iodev_members.end();
+}
+
 void empty_iodev_destroy(struct cras_iodev* iodev) {
   if (iodev->active_node) {
     free(iodev->active_node);
@@ -2073,11 +3146,21 @@ void loopback_iodev_destroy(struct cras_iodev* iodev) {}
 int cras_iodev_open(struct cras_iodev* iodev,
                     unsigned int cb_level,
                     const struct cras_audio_format* fmt) {
+  int rc;
+
+  pthread_mutex_lock(&worker_mutex);
   if (cras_iodev_open_ret[cras_iodev_open_called] == 0)
     iodev->state = CRAS_IODEV_STATE_OPEN;
   cras_iodev_open_fmt = *fmt;
   iodev->format = &cras_iodev_open_fmt;
-  return cras_iodev_open_ret[cras_iodev_open_called++];
+  clock_gettime_retspec.tv_nsec += cras_iodev_open_cost_ns;
+  rc = cras_iodev_open_ret[cras_iodev_open_called++];
+  pthread_mutex_unlock(&worker_mutex);
+  return rc;
+}
+
+size_t cras_iodev_best_rate(struct cras_iodev* iodev, size_t rate) {
+  return cras_iodev_best_rate_ret ? cras_iodev_best_rate_ret : rate;
 }
 
 int cras_iodev_close(struct cras_iodev* iodev) {
@@ -2088,6 +3171,11 @@ int cras_iodev_close(struct cras_iodev* iodev) {
   return 0;
 }
 
+int cras_iodev_resume(struct cras_iodev* iodev) {
+  cras_iodev_resume_called++;
+  return cras_iodev_resume_ret;
+}
+
 int cras_iodev_set_format(struct cras_iodev* iodev,
                           const struct cras_audio_format* fmt) {
   return 0;
@@ -2112,6 +3200,19 @@ int cras_iodev_start_volume_ramp(struct cras_iodev* odev,
 bool cras_iodev_is_aec_use_case(const struct cras_ionode* node) {
   return 1;
 }
+
+bool cras_iodev_supports_low_latency(const struct cras_iodev* iodev,
+                                     const struct cras_rstream* stream) {
+  return cras_iodev_supports_low_latency_ret;
+}
+bool cras_iodev_supports_exclusive(const struct cras_iodev* iodev,
+                                   const struct cras_rstream* stream) {
+  return cras_iodev_supports_exclusive_ret;
+}
+bool cras_iodev_supports_passthrough(const struct cras_iodev* iodev,
+                                     const struct cras_rstream* stream) {
+  return cras_iodev_supports_passthrough_ret;
+}
 bool stream_list_has_pinned_stream(struct stream_list* list,
                                    unsigned int dev_idx) {
   return stream_list_has_pinned_stream_ret[dev_idx];
@@ -2129,6 +3230,10 @@ struct stream_list* stream_list_create(stream_callback* add_cb,
 
 void stream_list_destroy(struct stream_list* list) {}
 
+unsigned int cras_rstream_get_effects(const struct cras_rstream* stream) {
+  return 0;
+}
+
 struct cras_rstream* stream_list_get(struct stream_list* list) {
   return stream_list_get_ret;
 }
@@ -2140,6 +3245,21 @@ void server_stream_destroy(struct stream_list* stream_list,
                            unsigned int dev_idx) {
   server_stream_destroy_called++;
 }
+int server_stream_create_route(struct stream_list* stream_list,
+                               unsigned int in_idx,
+                               unsigned int out_idx,
+                               const struct cras_audio_format* format,
+                               unsigned int latency_ms,
+                               uint64_t effects) {
+  server_stream_create_route_called++;
+  server_stream_create_route_fmt = *format;
+  return 1;
+}
+int server_stream_destroy_route(struct stream_list* stream_list,
+                                unsigned int route_id) {
+  server_stream_destroy_route_called++;
+  return 0;
+}
 
 int cras_rstream_create(struct cras_rstream_config* config,
                         struct cras_rstream** stream_out) {
@@ -2152,6 +3272,10 @@ struct cras_tm* cras_system_state_get_tm() {
   return NULL;
 }
 
+struct cras_perf_stats* cras_system_state_get_perf_stats(unsigned int idx) {
+  return NULL;
+}
+
 struct cras_timer* cras_tm_create_timer(struct cras_tm* tm,
                                         unsigned int ms,
                                         void (*cb)(struct cras_timer* t,
@@ -2163,6 +3287,15 @@ struct cras_timer* cras_tm_create_timer(struct cras_tm* tm,
   return reinterpret_cast<struct cras_timer*>(0x404);
 }
 
+struct cras_timer* cras_tm_create_timer_slack(struct cras_tm* tm,
+                                              unsigned int ms,
+                                              unsigned int slack_ms,
+                                              void (*cb)(struct cras_timer* t,
+                                                         void* data),
+                                              void* cb_data) {
+  return cras_tm_create_timer(tm, ms, cb, cb_data);
+}
+
 void cras_tm_cancel_timer(struct cras_tm* tm, struct cras_timer* t) {
   cras_tm_cancel_timer_called++;
 }
@@ -2217,6 +3350,14 @@ void cras_observer_notify_input_node_gain(cras_node_id_t node_id,
   cras_observer_notify_input_node_gain_called++;
 }
 
+void cras_observer_notify_hotword_model_loaded(cras_node_id_t node_id,
+                                               const char* model_name,
+                                               int error) {
+  cras_observer_notify_hotword_model_loaded_called++;
+  cras_observer_notify_hotword_model_loaded_model = model_name;
+  cras_observer_notify_hotword_model_loaded_error = error;
+}
+
 int audio_thread_dev_start_ramp(struct audio_thread* thread,
                                 unsigned int dev_idx,
                                 enum CRAS_IODEV_RAMP_REQUEST request) {
@@ -2237,9 +3378,47 @@ void cras_apm_list_remove_apm(struct cras_apm_list* list, void* dev_ptr) {}
 int cras_apm_list_init(const char* device_config_dir) {
   return 0;
 }
+struct cras_apm_list* cras_apm_list_create(void* stream_ptr, uint64_t effects) {
+  return NULL;
+}
+void cras_apm_list_set_background(struct cras_apm_list* list,
+                                  bool background) {}
+int cras_apm_list_stage_effects(struct cras_apm_list* list, uint64_t effects) {
+  return 0;
+}
+int cras_apm_list_stage_apm(struct cras_apm_list* list,
+                            void* dev_ptr,
+                            const struct cras_audio_format* fmt,
+                            bool is_aec_use_case) {
+  return 0;
+}
+void cras_apm_list_commit_effects(struct cras_apm_list* list) {}
 #endif
 
 //  From librt.
+int cras_main_message_add_handler(enum CRAS_MAIN_MESSAGE_TYPE type,
+                                  cras_message_callback callback,
+                                  void* callback_data) {
+  if (type == CRAS_MAIN_DEV_OPEN)
+    dev_open_done_cb = callback;
+  else if (type == CRAS_MAIN_HOTWORD_MODEL)
+    hotword_model_loaded_cb = callback;
+  return 0;
+}
+
+int cras_main_message_send(struct cras_main_message* msg) {
+  pthread_mutex_lock(&worker_mutex);
+  worker_msg = (struct cras_main_message*)malloc(msg->length);
+  memcpy(worker_msg, msg, msg->length);
+  pthread_cond_signal(&worker_cond);
+  pthread_mutex_unlock(&worker_mutex);
+  return 0;
+}
+
+int cras_main_message_send_blocking(struct cras_main_message* msg) {
+  return cras_main_message_send(msg);
+}
+
 int clock_gettime(clockid_t clk_id, struct timespec* tp) {
   tp->tv_sec = clock_gettime_retspec.tv_sec;
   tp->tv_nsec = clock_gettime_retspec.tv_nsec;
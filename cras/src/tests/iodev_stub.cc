@@ -9,6 +9,7 @@
 
 extern "C" {
 #include "cras_iodev.h"
+#include "cras_rstream.h"
 #include "dev_stream.h"
 #include "utlist.h"
 }
@@ -21,17 +22,21 @@ struct cb_data {
 std::unordered_map<cras_iodev*, cb_data> frames_queued_map;
 std::unordered_map<cras_iodev*, cb_data> valid_frames_map;
 std::unordered_map<cras_iodev*, timespec> drop_time_map;
+std::unordered_map<cras_iodev*, int> rewind_ret_map;
+std::unordered_map<cras_iodev*, unsigned int> rewind_frames_map;
 }  // namespace
 
 void iodev_stub_reset() {
   frames_queued_map.clear();
   valid_frames_map.clear();
   drop_time_map.clear();
+  rewind_ret_map.clear();
+  rewind_frames_map.clear();
 }
 
 void iodev_stub_frames_queued(cras_iodev* iodev, int ret, timespec ts) {
   cb_data data = {ret, ts};
-  frames_queued_map.insert({iodev, data});
+  frames_queued_map[iodev] = data;
 }
 
 void iodev_stub_valid_frames(cras_iodev* iodev, int ret, timespec ts) {
@@ -48,10 +53,33 @@ bool iodev_stub_get_drop_time(cras_iodev* iodev, timespec* ts) {
   return false;
 }
 
+void iodev_stub_rewind_output(cras_iodev* iodev, int ret) {
+  rewind_ret_map[iodev] = ret;
+}
+
+unsigned int iodev_stub_get_rewind_frames(cras_iodev* iodev) {
+  auto elem = rewind_frames_map.find(iodev);
+  if (elem != rewind_frames_map.end())
+    return elem->second;
+  return 0;
+}
+
 extern "C" {
 
+void cras_iodev_update_stream_refs(struct cras_iodev* iodev) {
+  struct dev_stream* stream;
+
+  iodev->stream_refs.count = 0;
+  DL_FOREACH (iodev->streams, stream) {
+    struct cras_iodev_stream_ref ref = {stream, stream->stream,
+                                        stream->stream->shm};
+    ARRAY_APPEND(&iodev->stream_refs, ref);
+  }
+}
+
 int cras_iodev_add_stream(struct cras_iodev* iodev, struct dev_stream* stream) {
   DL_APPEND(iodev->streams, stream);
+  cras_iodev_update_stream_refs(iodev);
   return 0;
 }
 
@@ -160,13 +188,17 @@ int cras_iodev_reset_request(struct cras_iodev* iodev) {
   return 0;
 }
 
+int cras_iodev_resume(struct cras_iodev* iodev) {
+  return -ENOTSUP;
+}
+
 unsigned int cras_iodev_stream_offset(struct cras_iodev* iodev,
                                       struct dev_stream* stream) {
   return 0;
 }
 
 unsigned int cras_iodev_get_num_underruns(const struct cras_iodev* iodev) {
-  return 0;
+  return iodev->num_underruns;
 }
 
 unsigned int cras_iodev_frames_to_play_in_sleep(struct cras_iodev* odev,
@@ -183,6 +215,17 @@ void cras_iodev_update_highest_hw_level(struct cras_iodev* iodev,
 void cras_iodev_start_stream(struct cras_iodev* iodev,
                              struct dev_stream* stream) {}
 
+void cras_iodev_stop_stream(struct cras_iodev* iodev,
+                            struct dev_stream* stream) {}
+
+int cras_iodev_rewind_output(struct cras_iodev* odev, unsigned int frames) {
+  rewind_frames_map[odev] = frames;
+  auto elem = rewind_ret_map.find(odev);
+  if (elem != rewind_ret_map.end())
+    return elem->second;
+  return 0;
+}
+
 int cras_iodev_drop_frames_by_time(struct cras_iodev* iodev,
                                    struct timespec ts) {
   drop_time_map.insert({iodev, ts});
@@ -16,4 +16,8 @@ void iodev_stub_valid_frames(cras_iodev* iodev, int ret, timespec ts);
 
 bool iodev_stub_get_drop_time(cras_iodev* iodev, timespec* ts);
 
+void iodev_stub_rewind_output(cras_iodev* iodev, int ret);
+
+unsigned int iodev_stub_get_rewind_frames(cras_iodev* iodev);
+
 #endif  // IODEV_STUB_H_
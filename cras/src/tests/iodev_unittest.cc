@@ -11,6 +11,7 @@ extern "C" {
 #include "cras_iodev.h"
 #include "cras_main_thread_log.h"
 #include "cras_ramp.h"
+#include "cras_ref_ring.h"
 #include "cras_rstream.h"
 #include "dev_stream.h"
 #include "input_data.h"
@@ -48,6 +49,8 @@ static unsigned int cras_system_get_volume_return;
 static int cras_dsp_get_pipeline_called;
 static int cras_dsp_get_pipeline_ret;
 static int cras_dsp_put_pipeline_called;
+static int cras_dsp_lock_pipeline_called;
+static int cras_dsp_unlock_pipeline_called;
 static int cras_dsp_pipeline_get_source_buffer_called;
 static int cras_dsp_pipeline_get_sink_buffer_called;
 static float cras_dsp_pipeline_source_buffer[2][DSP_BUFFER_SIZE];
@@ -56,10 +59,17 @@ static int cras_dsp_pipeline_get_delay_called;
 static int cras_dsp_pipeline_apply_called;
 static int cras_dsp_pipeline_set_sink_ext_module_called;
 static int cras_dsp_pipeline_apply_sample_count;
+static int cras_dsp_pipeline_apply_ramp_called;
+static float cras_dsp_pipeline_apply_ramp_scaler;
+static float cras_dsp_pipeline_apply_ramp_increment;
+static float cras_dsp_pipeline_apply_ramp_target;
 static unsigned int cras_mix_mute_count;
 static unsigned int cras_dsp_num_input_channels_return;
 static unsigned int cras_dsp_num_output_channels_return;
 struct cras_dsp_context* cras_dsp_context_new_return;
+static int cras_dsp_load_pipeline_called;
+static int cras_dsp_set_swap_lr_called;
+static int cras_dsp_set_swap_lr_ret;
 static unsigned int cras_dsp_load_mock_pipeline_called;
 static unsigned int rate_estimator_add_frames_num_frames;
 static unsigned int rate_estimator_add_frames_called;
@@ -113,7 +123,10 @@ static int buffer_share_get_new_write_point_ret;
 static int ext_mod_configure_called;
 static struct input_data* input_data_create_ret;
 static double rate_estimator_get_rate_ret;
+static int rate_estimator_check_ret;
+static unsigned int rate_estimator_reset_rate_rate;
 static int cras_audio_thread_event_dev_overrun_called;
+static uint8_t output_frames[4096];
 
 static char* atlog_name;
 
@@ -124,6 +137,8 @@ int update_channel_layout(struct cras_iodev* iodev) {
 }
 
 void ResetStubData() {
+  // Non-zero audio, so the DSP and volume paths are not bypassed.
+  memset(output_frames, 1, sizeof(output_frames));
   cras_iodev_list_disable_dev_called = 0;
   select_node_called = 0;
   notify_nodes_changed_called = 0;
@@ -135,6 +150,8 @@ void ResetStubData() {
   cras_dsp_get_pipeline_called = 0;
   cras_dsp_get_pipeline_ret = 0;
   cras_dsp_put_pipeline_called = 0;
+  cras_dsp_lock_pipeline_called = 0;
+  cras_dsp_unlock_pipeline_called = 0;
   cras_dsp_pipeline_get_source_buffer_called = 0;
   cras_dsp_pipeline_get_sink_buffer_called = 0;
   memset(&cras_dsp_pipeline_source_buffer, 0,
@@ -145,9 +162,16 @@ void ResetStubData() {
   cras_dsp_pipeline_apply_called = 0;
   cras_dsp_pipeline_set_sink_ext_module_called = 0;
   cras_dsp_pipeline_apply_sample_count = 0;
+  cras_dsp_pipeline_apply_ramp_called = 0;
+  cras_dsp_pipeline_apply_ramp_scaler = 0.0;
+  cras_dsp_pipeline_apply_ramp_increment = 0.0;
+  cras_dsp_pipeline_apply_ramp_target = 0.0;
   cras_dsp_num_input_channels_return = 2;
   cras_dsp_num_output_channels_return = 2;
   cras_dsp_context_new_return = NULL;
+  cras_dsp_load_pipeline_called = 0;
+  cras_dsp_set_swap_lr_called = 0;
+  cras_dsp_set_swap_lr_ret = 0;
   cras_dsp_load_mock_pipeline_called = 0;
   rate_estimator_add_frames_num_frames = 0;
   rate_estimator_add_frames_called = 0;
@@ -209,6 +233,8 @@ void ResetStubData() {
   buffer_share_add_id_called = 0;
   ext_mod_configure_called = 0;
   rate_estimator_get_rate_ret = 0;
+  rate_estimator_check_ret = 0;
+  rate_estimator_reset_rate_rate = 0;
   cras_audio_thread_event_dev_overrun_called = 0;
 }
 
@@ -301,6 +327,35 @@ TEST_F(IoDevSetFormatTestSuite, SupportedFormatSecondary) {
   EXPECT_STREQ(dsp_context_new_purpose, "playback");
 }
 
+TEST_F(IoDevSetFormatTestSuite, RateForAllStreams) {
+  struct cras_audio_format fmt;
+  int rc;
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 44100;
+  fmt.num_channels = 2;
+  iodev_.direction = CRAS_STREAM_OUTPUT;
+  iodev_.rate_demands[0] = {44100, 2};
+  iodev_.rate_demands[1] = {48000, 2};
+  iodev_.rate_demands[2] = {48000, 2};
+  iodev_.num_rate_demands = 3;
+  ResetStubData();
+
+  // Resampling one stream is cheaper than resampling two.
+  rc = cras_iodev_set_format(&iodev_, &fmt);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(48000, iodev_.format->frame_rate);
+
+  // Ties go to the stream opening the device.
+  iodev_.num_rate_demands = 2;
+  EXPECT_EQ(44100, cras_iodev_best_rate(&iodev_, 44100));
+  EXPECT_EQ(48000, cras_iodev_best_rate(&iodev_, 48000));
+
+  // More channels cost more.
+  iodev_.rate_demands[0].num_channels = 6;
+  EXPECT_EQ(44100, cras_iodev_best_rate(&iodev_, 48000));
+}
+
 TEST_F(IoDevSetFormatTestSuite, SupportedFormat32bit) {
   struct cras_audio_format fmt;
   int rc;
@@ -553,7 +608,7 @@ static int loopback_hook_control(bool start, void* cb_data) {
 TEST(IoDevPutOutputBuffer, SystemMuted) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
 
   ResetStubData();
@@ -611,7 +666,7 @@ TEST(IoDevPutOutputBuffer, NodeVolumeZeroShouldMute) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
   struct cras_ionode ionode;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
 
   ResetStubData();
@@ -640,7 +695,7 @@ TEST(IoDevPutOutputBuffer, NodeVolumeZeroShouldMute) {
 TEST(IoDevPutOutputBuffer, SystemMutedWithRamp) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
 
   ResetStubData();
@@ -685,7 +740,7 @@ TEST(IoDevPutOutputBuffer, NodeVolumeZeroShouldMuteWithRamp) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
   struct cras_ionode ionode;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
 
   ResetStubData();
@@ -733,7 +788,7 @@ TEST(IoDevPutOutputBuffer, NoDSP) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
   struct cras_ionode ionode;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
 
   ResetStubData();
@@ -762,7 +817,7 @@ TEST(IoDevPutOutputBuffer, NoDSP) {
 TEST(IoDevPutOutputBuffer, DSP) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
   struct cras_loopback pre_dsp;
   struct cras_loopback post_dsp;
@@ -803,10 +858,186 @@ TEST(IoDevPutOutputBuffer, DSP) {
   EXPECT_EQ(cras_dsp_get_pipeline_called, cras_dsp_put_pipeline_called);
 }
 
+TEST(IoDevPutOutputBuffer, PostDspRefForReceiversWithoutHook) {
+  struct cras_audio_format fmt;
+  struct cras_iodev iodev;
+  uint8_t* frames = output_frames;
+  struct cras_loopback post_dsp;
+  uint64_t offset = 0;
+  unsigned int nframes = 32;
+  int rc;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+  memset(&post_dsp, 0, sizeof(post_dsp));
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  iodev.format = &fmt;
+  iodev.put_buffer = put_buffer;
+  iodev.post_dsp_ref = cras_ref_ring_create(4096);
+  ASSERT_NE((void*)NULL, iodev.post_dsp_ref);
+
+  // Nothing is kept without a receiver reading the ring.
+  rc = cras_iodev_put_output_buffer(&iodev, frames, 32, NULL, nullptr);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(0, cras_ref_ring_write_pos(iodev.post_dsp_ref));
+
+  post_dsp.type = LOOPBACK_POST_DSP;
+  DL_APPEND(iodev.loopbacks, &post_dsp);
+  rc = cras_iodev_put_output_buffer(&iodev, frames, 32, NULL, nullptr);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(32, cras_ref_ring_readable(iodev.post_dsp_ref, &offset));
+  EXPECT_EQ(0, memcmp(frames,
+                      cras_ref_ring_read_pointer(iodev.post_dsp_ref, offset,
+                                                 &nframes),
+                      nframes * 4));
+  EXPECT_EQ(32, nframes);
+  EXPECT_EQ(32, put_buffer_nframes);
+
+  cras_iodev_free_resources(&iodev);
+  EXPECT_EQ(NULL, iodev.post_dsp_ref);
+}
+
+TEST(IoDevPutOutputBuffer, DSPBypassedAfterSilence) {
+  struct cras_audio_format fmt;
+  struct cras_iodev iodev;
+  uint8_t* frames = output_frames;
+  int rc;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+  iodev.dsp_context = reinterpret_cast<cras_dsp_context*>(0x15);
+  cras_dsp_get_pipeline_ret = 0x25;
+  memset(output_frames, 0, sizeof(output_frames));
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  iodev.format = &fmt;
+  iodev.put_buffer = put_buffer;
+
+  // The DSP keeps running for 100ms of silence to flush its tails.
+  for (int i = 0; i < 5; i++) {
+    rc = cras_iodev_put_output_buffer(&iodev, frames, 960, NULL, nullptr);
+    EXPECT_EQ(0, rc);
+  }
+  EXPECT_EQ(5, cras_dsp_pipeline_apply_called);
+
+  // Then silence skips it.
+  rc = cras_iodev_put_output_buffer(&iodev, frames, 960, NULL, nullptr);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(5, cras_dsp_pipeline_apply_called);
+  EXPECT_EQ(960, put_buffer_nframes);
+
+  // Audio goes through the DSP again right away.
+  frames[0] = 1;
+  rc = cras_iodev_put_output_buffer(&iodev, frames, 960, NULL, nullptr);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(6, cras_dsp_pipeline_apply_called);
+}
+
+TEST(IoDevPutOutputBuffer, ExclusiveBypassesProcessing) {
+  struct cras_audio_format fmt;
+  struct cras_iodev iodev;
+  struct dev_stream stream;
+  uint8_t* frames = output_frames;
+  int rc;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+  memset(&stream, 0, sizeof(stream));
+  iodev.dsp_context = reinterpret_cast<cras_dsp_context*>(0x15);
+  cras_dsp_get_pipeline_ret = 0x25;
+  cras_system_get_mute_return = 1;
+  stream.exclusive = 1;
+  DL_APPEND(iodev.streams, &stream);
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  iodev.format = &fmt;
+  iodev.put_buffer = put_buffer;
+
+  rc = cras_iodev_put_output_buffer(&iodev, frames, 20, NULL, nullptr);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(0, cras_dsp_pipeline_apply_called);
+  EXPECT_EQ(0, cras_mix_mute_count);
+  EXPECT_EQ(20, put_buffer_nframes);
+}
+
+TEST(IoDevPutOutputBuffer, DSPFoldsRampAndSoftVol) {
+  struct cras_audio_format fmt;
+  struct cras_iodev iodev;
+  uint8_t* frames = output_frames;
+  struct cras_loopback post_dsp;
+  int rc;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+  iodev.dsp_context = reinterpret_cast<cras_dsp_context*>(0x15);
+  cras_dsp_get_pipeline_ret = 0x25;
+  iodev.software_volume_needed = 1;
+  iodev.ramp = reinterpret_cast<struct cras_ramp*>(0x1);
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  iodev.format = &fmt;
+  iodev.put_buffer = put_buffer;
+
+  cras_system_get_volume_return = 13;
+  softvol_scalers[13] = 0.5;
+  cras_ramp_get_current_action_ret.type = CRAS_RAMP_ACTION_PARTIAL;
+  cras_ramp_get_current_action_ret.scaler = 0.2;
+  cras_ramp_get_current_action_ret.increment = 0.001;
+  cras_ramp_get_current_action_ret.target = 1.0;
+
+  // The pipeline scales the samples as it writes them back.
+  rc = cras_iodev_put_output_buffer(&iodev, frames, 32, NULL, nullptr);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(0, cras_dsp_pipeline_apply_called);
+  EXPECT_EQ(1, cras_dsp_pipeline_apply_ramp_called);
+  EXPECT_FLOAT_EQ(0.1, cras_dsp_pipeline_apply_ramp_scaler);
+  EXPECT_FLOAT_EQ(0.0005, cras_dsp_pipeline_apply_ramp_increment);
+  EXPECT_FLOAT_EQ(0.5, cras_dsp_pipeline_apply_ramp_target);
+  EXPECT_EQ(SND_PCM_FORMAT_UNKNOWN, cras_scale_buffer_increment_fmt);
+  EXPECT_EQ(32, put_buffer_nframes);
+
+  // Without a ramp only the software volume is folded.
+  ResetStubData();
+  cras_dsp_get_pipeline_ret = 0x25;
+  cras_system_get_volume_return = 13;
+  cras_ramp_get_current_action_ret.type = CRAS_RAMP_ACTION_NONE;
+  rc = cras_iodev_put_output_buffer(&iodev, frames, 32, NULL, nullptr);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, cras_dsp_pipeline_apply_ramp_called);
+  EXPECT_FLOAT_EQ(0.5, cras_dsp_pipeline_apply_ramp_scaler);
+  EXPECT_FLOAT_EQ(0.0, cras_dsp_pipeline_apply_ramp_increment);
+  EXPECT_EQ(0, cras_scale_buffer_called);
+
+  // The post DSP loopback gets the samples before they are scaled.
+  ResetStubData();
+  cras_dsp_get_pipeline_ret = 0x25;
+  cras_system_get_volume_return = 13;
+  post_dsp.type = LOOPBACK_POST_DSP;
+  post_dsp.hook_data = post_dsp_hook;
+  post_dsp.hook_control = loopback_hook_control;
+  post_dsp.cb_data = NULL;
+  DL_APPEND(iodev.loopbacks, &post_dsp);
+  rc = cras_iodev_put_output_buffer(&iodev, frames, 32, NULL, nullptr);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, cras_dsp_pipeline_apply_called);
+  EXPECT_EQ(0, cras_dsp_pipeline_apply_ramp_called);
+  EXPECT_EQ(1, post_dsp_hook_called);
+  EXPECT_EQ(1, cras_scale_buffer_called);
+  EXPECT_EQ(0.5, cras_scale_buffer_scaler);
+}
+
 TEST(IoDevPutOutputBuffer, SoftVol) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
 
   ResetStubData();
@@ -835,7 +1066,7 @@ TEST(IoDevPutOutputBuffer, SoftVol) {
 TEST(IoDevPutOutputBuffer, SoftVolWithRamp) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
   int n_frames = 53;
   float ramp_scaler = 0.2;
@@ -910,7 +1141,7 @@ TEST(IoDevPutOutputBuffer, SoftVolWithRamp) {
 TEST(IoDevPutOutputBuffer, NoSoftVolWithRamp) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
   int n_frames = 53;
   float ramp_scaler = 0.2;
@@ -970,7 +1201,7 @@ TEST(IoDevPutOutputBuffer, NoSoftVolWithRamp) {
 TEST(IoDevPutOutputBuffer, Scale32Bit) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
 
   ResetStubData();
@@ -1050,6 +1281,56 @@ TEST(IoDevQueuedBuffer, NonZeroMinBufferLevel) {
   EXPECT_EQ(100, rc);
 }
 
+static unsigned int delay_frames_called;
+static int delay_frames_ret;
+static int delay_frames(const struct cras_iodev* iodev) {
+  delay_frames_called++;
+  return delay_frames_ret;
+}
+
+TEST(IoDevQueuedBuffer, WakeLevelsReadOnce) {
+  struct cras_iodev iodev;
+  struct timespec hw_tstamp;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+  iodev.direction = CRAS_STREAM_OUTPUT;
+  iodev.frames_queued = frames_queued;
+  iodev.delay_frames = delay_frames;
+  iodev.buffer_size = 200;
+  delay_frames_called = 0;
+  delay_frames_ret = 60;
+
+  // Every query goes to the device outside of a wake.
+  fr_queued = 50;
+  EXPECT_EQ(50, cras_iodev_frames_queued(&iodev, &hw_tstamp));
+  fr_queued = 70;
+  EXPECT_EQ(70, cras_iodev_frames_queued(&iodev, &hw_tstamp));
+  EXPECT_EQ(60, cras_iodev_delay_frames(&iodev));
+  EXPECT_EQ(60, cras_iodev_delay_frames(&iodev));
+  EXPECT_EQ(2, delay_frames_called);
+
+  // Within a wake the device is asked once.
+  cras_iodev_begin_wake(&iodev);
+  EXPECT_EQ(70, cras_iodev_frames_queued(&iodev, &hw_tstamp));
+  fr_queued = 90;
+  EXPECT_EQ(70, cras_iodev_frames_queued(&iodev, &hw_tstamp));
+  delay_frames_ret = 80;
+  EXPECT_EQ(80, cras_iodev_delay_frames(&iodev));
+  delay_frames_ret = 100;
+  EXPECT_EQ(80, cras_iodev_delay_frames(&iodev));
+  EXPECT_EQ(3, delay_frames_called);
+
+  // Putting frames to the device reads them again.
+  cras_iodev_invalidate_wake_levels(&iodev);
+  EXPECT_EQ(90, cras_iodev_frames_queued(&iodev, &hw_tstamp));
+  EXPECT_EQ(100, cras_iodev_delay_frames(&iodev));
+
+  cras_iodev_end_wake(&iodev);
+  fr_queued = 110;
+  EXPECT_EQ(110, cras_iodev_frames_queued(&iodev, &hw_tstamp));
+}
+
 static void update_active_node(struct cras_iodev* iodev,
                                unsigned node_idx,
                                unsigned dev_enabled) {}
@@ -1272,6 +1553,79 @@ TEST(IoDev, OpenOutputDeviceWithLowRateFmt) {
   EXPECT_EQ(240, iodev.min_cb_level);
 }
 
+TEST(IoDev, OpenAdvertisesDeviceFormat) {
+  struct cras_iodev iodev;
+
+  memset(&iodev, 0, sizeof(iodev));
+  iodev.configure_dev = configure_dev;
+  iodev.direction = CRAS_STREAM_OUTPUT;
+  iodev.format = &audio_fmt;
+  iodev.get_buffer = get_buffer;
+  iodev.put_buffer = put_buffer;
+  ResetStubData();
+
+  cras_audio_format low_rate_fmt = audio_fmt;
+  low_rate_fmt.frame_rate = 8000;
+  iodev.state = CRAS_IODEV_STATE_CLOSE;
+
+  iodev_buffer_size = 1024;
+  cras_iodev_open(&iodev, 40, &low_rate_fmt);
+
+  // Clients see the format the device runs at, not the one of the stream.
+  EXPECT_EQ(audio_fmt.frame_rate, iodev.info.preferred_rate);
+  EXPECT_EQ(audio_fmt.num_channels, iodev.info.preferred_num_channels);
+  EXPECT_EQ(audio_fmt.format, iodev.info.preferred_format);
+}
+
+static int close_dev(struct cras_iodev* iodev) {
+  return 0;
+}
+
+TEST(IoDev, ClockDomainSharesRateEstimate) {
+  struct cras_iodev odev, idev;
+  struct timespec ts = {};
+  int domain;
+
+  ResetStubData();
+  memset(&odev, 0, sizeof(odev));
+  memset(&idev, 0, sizeof(idev));
+  odev.direction = CRAS_STREAM_OUTPUT;
+  idev.direction = CRAS_STREAM_INPUT;
+  odev.configure_dev = idev.configure_dev = configure_dev;
+  odev.close_dev = idev.close_dev = close_dev;
+  odev.format = idev.format = &audio_fmt;
+  odev.get_buffer = get_buffer;
+  odev.put_buffer = put_buffer;
+  odev.clock_domain = idev.clock_domain = &domain;
+  iodev_buffer_size = 1024;
+  cras_iodev_open(&odev, 240, &audio_fmt);
+  cras_iodev_open(&idev, 240, &audio_fmt);
+  ASSERT_NE(nullptr, odev.clock);
+  EXPECT_EQ(odev.clock, idev.clock);
+
+  // The first device to update leads, the other follows its estimate.
+  rate_estimator_get_rate_ret = 48048.0;
+  rate_estimator_check_ret = 1;
+  EXPECT_EQ(1, cras_iodev_update_rate(&odev, 100, &ts));
+  EXPECT_DOUBLE_EQ(1.001, cras_iodev_get_est_rate_ratio(&odev));
+  EXPECT_EQ(1, cras_iodev_update_rate(&idev, 100, &ts));
+  EXPECT_DOUBLE_EQ(1.001, cras_iodev_get_est_rate_ratio(&idev));
+  EXPECT_EQ(0, cras_iodev_update_rate(&idev, 100, &ts));
+
+  // The follower takes over, starting from the shared estimate.
+  cras_iodev_close(&odev);
+  EXPECT_EQ(nullptr, odev.clock);
+  rate_estimator_check_ret = 0;
+  EXPECT_EQ(0, cras_iodev_update_rate(&idev, 100, &ts));
+  EXPECT_EQ(48048, rate_estimator_reset_rate_rate);
+  EXPECT_DOUBLE_EQ(1.001, cras_iodev_get_est_rate_ratio(&idev));
+
+  cras_iodev_close(&idev);
+  EXPECT_EQ(nullptr, idev.clock);
+  rate_estimator_get_rate_ret = 48000.0;
+  EXPECT_DOUBLE_EQ(1.0, cras_iodev_get_est_rate_ratio(&idev));
+}
+
 int fake_start(const struct cras_iodev* iodev) {
   return 0;
 }
@@ -1297,6 +1651,47 @@ TEST(IoDev, OpenOutputDeviceWithStart) {
   EXPECT_EQ(CRAS_IODEV_STATE_OPEN, iodev.state);
 }
 
+static int fake_resume_ret;
+
+static int fake_resume(struct cras_iodev* iodev) {
+  return fake_resume_ret;
+}
+
+TEST(IoDev, ResumeRestartsOpenDevice) {
+  struct cras_iodev iodev;
+
+  memset(&iodev, 0, sizeof(iodev));
+  iodev.configure_dev = configure_dev;
+  iodev.direction = CRAS_STREAM_OUTPUT;
+  iodev.format = &audio_fmt;
+  iodev.start = fake_start;
+  ResetStubData();
+
+  // Devices without the resume ops have to be reopened.
+  iodev.state = CRAS_IODEV_STATE_NORMAL_RUN;
+  EXPECT_EQ(-ENOTSUP, cras_iodev_resume(&iodev));
+
+  iodev.resume = fake_resume;
+  fake_resume_ret = -ENODEV;
+  EXPECT_EQ(-ENODEV, cras_iodev_resume(&iodev));
+  EXPECT_EQ(CRAS_IODEV_STATE_NORMAL_RUN, iodev.state);
+
+  // The format is kept, the device waits for samples to start again.
+  fake_resume_ret = 0;
+  iodev.highest_hw_level = 1000;
+  EXPECT_EQ(0, cras_iodev_resume(&iodev));
+  EXPECT_EQ(CRAS_IODEV_STATE_OPEN, iodev.state);
+  EXPECT_EQ(&audio_fmt, iodev.format);
+  EXPECT_EQ(0, iodev.highest_hw_level);
+  EXPECT_EQ(audio_fmt.frame_rate, rate_estimator_reset_rate_rate);
+
+  iodev.direction = CRAS_STREAM_INPUT;
+  iodev.input_streaming = 1;
+  EXPECT_EQ(0, cras_iodev_resume(&iodev));
+  EXPECT_EQ(CRAS_IODEV_STATE_NORMAL_RUN, iodev.state);
+  EXPECT_EQ(0, iodev.input_streaming);
+}
+
 TEST(IoDev, OpenInputDeviceNoStart) {
   struct cras_iodev iodev;
 
@@ -1383,9 +1778,11 @@ TEST(IoDev, AddRmStream) {
   rstream1.cb_threshold = 800;
   stream1.stream = &rstream1;
   stream1.is_running = 0;
+  stream1.paused = 0;
   rstream2.cb_threshold = 400;
   stream2.stream = &rstream2;
   stream2.is_running = 0;
+  stream2.paused = 0;
   ResetStubData();
 
   iodev_buffer_size = 1024;
@@ -1417,6 +1814,105 @@ TEST(IoDev, AddRmStream) {
   EXPECT_EQ(512, iodev.min_cb_level);
 }
 
+TEST(IoDev, StopStreamEntersNoStreamRun) {
+  struct cras_iodev iodev;
+  struct cras_rstream rstream1, rstream2;
+  struct dev_stream stream1, stream2;
+
+  memset(&iodev, 0, sizeof(iodev));
+  memset(&rstream1, 0, sizeof(rstream1));
+  memset(&rstream2, 0, sizeof(rstream2));
+  iodev.configure_dev = configure_dev;
+  iodev.no_stream = simple_no_stream;
+  iodev.format = &audio_fmt;
+  iodev.state = CRAS_IODEV_STATE_NORMAL_RUN;
+  iodev.get_buffer = get_buffer;
+  iodev.put_buffer = put_buffer;
+  rstream1.cb_threshold = 480;
+  rstream1.stream_id = 1;
+  stream1.stream = &rstream1;
+  stream1.is_running = 0;
+  stream1.paused = 0;
+  rstream2.cb_threshold = 480;
+  rstream2.stream_id = 2;
+  stream2.stream = &rstream2;
+  stream2.is_running = 0;
+  stream2.paused = 0;
+  ResetStubData();
+
+  iodev_buffer_size = 1024;
+  cras_iodev_open(&iodev, rstream1.cb_threshold, &audio_fmt);
+  iodev.state = CRAS_IODEV_STATE_NORMAL_RUN;
+  cras_iodev_add_stream(&iodev, &stream1);
+  cras_iodev_start_stream(&iodev, &stream1);
+  cras_iodev_add_stream(&iodev, &stream2);
+  cras_iodev_start_stream(&iodev, &stream2);
+
+  // One stream still plays.
+  cras_iodev_stop_stream(&iodev, &stream1);
+  EXPECT_EQ(0, stream1.is_running);
+  EXPECT_EQ(-1, stream1.dev_buf_slot);
+  EXPECT_EQ(0, simple_no_stream_called);
+
+  // Stopping twice is harmless.
+  cras_iodev_stop_stream(&iodev, &stream1);
+  EXPECT_EQ(0, simple_no_stream_called);
+
+  // The stopped streams stay attached.
+  cras_iodev_stop_stream(&iodev, &stream2);
+  EXPECT_EQ(1, simple_no_stream_called);
+  EXPECT_EQ(1, simple_no_stream_enable);
+  EXPECT_EQ(&stream1, iodev.streams);
+
+  cras_iodev_rm_stream(&iodev, &rstream1);
+  cras_iodev_rm_stream(&iodev, &rstream2);
+}
+
+TEST(IoDev, StreamRefsFollowStreams) {
+  struct cras_iodev iodev;
+  struct cras_rstream rstream1, rstream2;
+  struct dev_stream stream1, stream2;
+  struct cras_audio_shm shm2;
+
+  memset(&iodev, 0, sizeof(iodev));
+  memset(&rstream1, 0, sizeof(rstream1));
+  memset(&rstream2, 0, sizeof(rstream2));
+  iodev.configure_dev = configure_dev;
+  iodev.no_stream = simple_no_stream;
+  iodev.format = &audio_fmt;
+  iodev.state = CRAS_IODEV_STATE_NORMAL_RUN;
+  iodev.get_buffer = get_buffer;
+  iodev.put_buffer = put_buffer;
+  rstream1.cb_threshold = 480;
+  stream1.stream = &rstream1;
+  stream1.is_running = 0;
+  stream1.paused = 0;
+  rstream2.cb_threshold = 480;
+  rstream2.shm = &shm2;
+  stream2.stream = &rstream2;
+  stream2.is_running = 0;
+  stream2.paused = 0;
+  ResetStubData();
+
+  iodev_buffer_size = 1024;
+  cras_iodev_open(&iodev, rstream1.cb_threshold, &audio_fmt);
+
+  cras_iodev_add_stream(&iodev, &stream1);
+  cras_iodev_add_stream(&iodev, &stream2);
+  ASSERT_EQ(2, ARRAY_COUNT(&iodev.stream_refs));
+  EXPECT_EQ(&stream1, ARRAY_ELEMENT(&iodev.stream_refs, 0)->dev_stream);
+  EXPECT_EQ(&rstream2, ARRAY_ELEMENT(&iodev.stream_refs, 1)->stream);
+  EXPECT_EQ(&shm2, ARRAY_ELEMENT(&iodev.stream_refs, 1)->shm);
+
+  cras_iodev_rm_stream(&iodev, &rstream1);
+  ASSERT_EQ(1, ARRAY_COUNT(&iodev.stream_refs));
+  EXPECT_EQ(&stream2, ARRAY_ELEMENT(&iodev.stream_refs, 0)->dev_stream);
+
+  cras_iodev_rm_stream(&iodev, &rstream2);
+  EXPECT_EQ(0, ARRAY_COUNT(&iodev.stream_refs));
+  EXPECT_EQ(NULL, iodev.stream_refs.element);
+}
+
 TEST(IoDev, RmStreamUpdateFetchTime) {
   struct cras_iodev iodev;
   struct cras_rstream rstream1, rstream2, rstream3;
@@ -1634,6 +2130,7 @@ TEST(IoDev, PrepareOutputBeforeWriteSamples) {
   rstream1.cb_threshold = min_cb_level;
   stream1.stream = &rstream1;
   stream1.is_running = 1;
+  stream1.paused = 0;
 
   memset(&iodev, 0, sizeof(iodev));
 
@@ -2122,6 +2619,38 @@ TEST(IoDev, GetNumUnderruns) {
   EXPECT_EQ(10, cras_iodev_get_num_underruns(&iodev));
 }
 
+TEST(IoDev, SupportsLowLatency) {
+  struct cras_iodev iodev;
+  struct cras_rstream rstream;
+  struct cras_audio_format fmt;
+
+  memset(&iodev, 0, sizeof(iodev));
+  memset(&rstream, 0, sizeof(rstream));
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  rstream.format = fmt;
+  rstream.cb_threshold = 96;
+
+  // Not open.
+  EXPECT_FALSE(cras_iodev_supports_low_latency(&iodev, &rstream));
+
+  iodev.format = &fmt;
+  EXPECT_TRUE(cras_iodev_supports_low_latency(&iodev, &rstream));
+
+  // Would need converting.
+  rstream.format.frame_rate = 44100;
+  EXPECT_FALSE(cras_iodev_supports_low_latency(&iodev, &rstream));
+  rstream.format = fmt;
+  rstream.format.num_channels = 1;
+  EXPECT_FALSE(cras_iodev_supports_low_latency(&iodev, &rstream));
+  rstream.format = fmt;
+
+  // The period is shorter than what the device keeps queued.
+  iodev.min_buffer_level = 128;
+  EXPECT_FALSE(cras_iodev_supports_low_latency(&iodev, &rstream));
+}
+
 TEST(IoDev, RequestReset) {
   struct cras_iodev iodev;
   memset(&iodev, 0, sizeof(iodev));
@@ -2227,28 +2756,61 @@ TEST(IoDev, SetExtDspMod) {
 
   cras_iodev_open(&iodev, 240, &fmt);
   EXPECT_EQ(1, ext_mod_configure_called);
-  EXPECT_EQ(1, cras_dsp_get_pipeline_called);
+  EXPECT_EQ(1, cras_dsp_lock_pipeline_called);
+  EXPECT_EQ(1, cras_dsp_unlock_pipeline_called);
   EXPECT_EQ(1, cras_dsp_pipeline_set_sink_ext_module_called);
 
   cras_iodev_set_ext_dsp_module(&iodev, NULL);
   EXPECT_EQ(1, ext_mod_configure_called);
-  EXPECT_EQ(2, cras_dsp_get_pipeline_called);
+  EXPECT_EQ(2, cras_dsp_lock_pipeline_called);
+  EXPECT_EQ(2, cras_dsp_unlock_pipeline_called);
   EXPECT_EQ(2, cras_dsp_pipeline_set_sink_ext_module_called);
 
   cras_iodev_set_ext_dsp_module(&iodev, &ext);
   EXPECT_EQ(2, ext_mod_configure_called);
-  EXPECT_EQ(3, cras_dsp_get_pipeline_called);
+  EXPECT_EQ(3, cras_dsp_lock_pipeline_called);
+  EXPECT_EQ(3, cras_dsp_unlock_pipeline_called);
   EXPECT_EQ(3, cras_dsp_pipeline_set_sink_ext_module_called);
 
   /* If pipeline doesn't exist, mock pipeline should be loaded. */
   cras_dsp_get_pipeline_ret = 0x0;
   cras_iodev_set_ext_dsp_module(&iodev, &ext);
   EXPECT_EQ(3, ext_mod_configure_called);
-  EXPECT_EQ(5, cras_dsp_get_pipeline_called);
+  EXPECT_EQ(5, cras_dsp_lock_pipeline_called);
   EXPECT_EQ(1, cras_dsp_load_mock_pipeline_called);
   EXPECT_EQ(4, cras_dsp_pipeline_set_sink_ext_module_called);
 }
 
+TEST(IoDev, SetSwapModeForNode) {
+  struct cras_iodev iodev;
+  struct cras_ionode node;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+  memset(&node, 0, sizeof(node));
+  iodev.active_node = &node;
+  iodev.dsp_context = reinterpret_cast<cras_dsp_context*>(0xf0f);
+
+  // The running pipeline swaps its output, no reload.
+  EXPECT_EQ(0, cras_iodev_dsp_set_swap_mode_for_node(&iodev, &node, 1));
+  EXPECT_EQ(1, node.left_right_swapped);
+  EXPECT_EQ(1, cras_dsp_set_swap_lr_called);
+  EXPECT_EQ(0, cras_dsp_load_pipeline_called);
+
+  // The pipeline can't swap it, reload.
+  cras_dsp_set_swap_lr_ret = -ENOTSUP;
+  EXPECT_EQ(0, cras_iodev_dsp_set_swap_mode_for_node(&iodev, &node, 0));
+  EXPECT_EQ(0, node.left_right_swapped);
+  EXPECT_EQ(2, cras_dsp_set_swap_lr_called);
+  EXPECT_EQ(1, cras_dsp_load_pipeline_called);
+
+  // Nothing changes for an inactive node.
+  iodev.active_node = NULL;
+  EXPECT_EQ(0, cras_iodev_dsp_set_swap_mode_for_node(&iodev, &node, 1));
+  EXPECT_EQ(2, cras_dsp_set_swap_lr_called);
+  EXPECT_EQ(1, cras_dsp_load_pipeline_called);
+}
+
 TEST(IoDev, InputDspOffset) {
   struct cras_iodev iodev;
   struct cras_audio_format fmt;
@@ -2301,6 +2863,56 @@ TEST(IoDev, InputDspOffset) {
   EXPECT_EQ(80, rc);
 }
 
+TEST(IoDev, PreRollKeepsInputHistory) {
+  struct cras_iodev iodev;
+  struct cras_audio_format fmt;
+  struct cras_rstream rstream1;
+  struct dev_stream stream1;
+  struct input_data data;
+  unsigned int frames = 240;
+  uint64_t offset = 0;
+
+  ResetStubData();
+
+  rstream1.cb_threshold = 240;
+  rstream1.stream_id = 123;
+  stream1.stream = &rstream1;
+
+  memset(&iodev, 0, sizeof(iodev));
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  iodev.configure_dev = configure_dev;
+  iodev.close_dev = close_dev;
+  iodev.format = &fmt;
+  iodev.state = CRAS_IODEV_STATE_CLOSE;
+  iodev.get_buffer = get_buffer;
+  iodev.put_buffer = put_buffer;
+  iodev.direction = CRAS_STREAM_INPUT;
+  iodev.buffer_size = 480;
+  iodev.pre_roll_ms = 20;
+  input_data_create_ret = &data;
+
+  cras_iodev_open(&iodev, 240, &fmt);
+  ASSERT_NE((void*)NULL, iodev.pre_roll);
+
+  cras_iodev_add_stream(&iodev, &stream1);
+  cras_iodev_get_input_buffer(&iodev, &frames);
+  EXPECT_EQ(240, cras_ref_ring_readable(iodev.pre_roll, &offset));
+
+  // The 140 frames left in the buffer are not stored again.
+  buffer_share_get_new_write_point_ret = 100;
+  cras_iodev_put_input_buffer(&iodev);
+  frames = 200;
+  cras_iodev_get_input_buffer(&iodev, &frames);
+  offset = 0;
+  EXPECT_EQ(300, cras_ref_ring_readable(iodev.pre_roll, &offset));
+
+  cras_iodev_rm_stream(&iodev, &rstream1);
+  cras_iodev_close(&iodev);
+  EXPECT_EQ((void*)NULL, iodev.pre_roll);
+}
+
 TEST(IoDev, DropDeviceFramesByTime) {
   struct cras_iodev iodev;
   struct cras_audio_format fmt;
@@ -2461,6 +3073,19 @@ unsigned int buffer_share_id_offset(const struct buffer_share* mix,
   return 0;
 }
 
+int buffer_share_id_slot(const struct buffer_share* mix, unsigned int id) {
+  return 0;
+}
+
+void buffer_share_slot_offset_update(struct buffer_share* mix,
+                                     int slot,
+                                     unsigned int frames) {}
+
+unsigned int buffer_share_slot_offset(const struct buffer_share* mix,
+                                      int slot) {
+  return 0;
+}
+
 // From cras_system_state.
 void cras_system_state_stream_added(enum CRAS_STREAM_DIRECTION direction,
                                     enum CRAS_CLIENT_TYPE client_type) {}
@@ -2480,7 +3105,13 @@ void cras_dsp_context_free(struct cras_dsp_context* ctx) {
   dsp_context_free_called++;
 }
 
-void cras_dsp_load_pipeline(struct cras_dsp_context* ctx) {}
+void cras_dsp_load_pipeline(struct cras_dsp_context* ctx) {
+  cras_dsp_load_pipeline_called++;
+}
+int cras_dsp_set_swap_lr(struct cras_dsp_context* ctx, int enable) {
+  cras_dsp_set_swap_lr_called++;
+  return cras_dsp_set_swap_lr_ret;
+}
 void cras_dsp_load_mock_pipeline(struct cras_dsp_context* ctx,
                                  unsigned int num_channels) {
   cras_dsp_load_mock_pipeline_called++;
@@ -2503,6 +3134,18 @@ void cras_dsp_put_pipeline(struct cras_dsp_context* ctx) {
   cras_dsp_put_pipeline_called++;
 }
 
+struct pipeline* cras_dsp_lock_pipeline(struct cras_dsp_context* ctx) {
+  cras_dsp_lock_pipeline_called++;
+  return reinterpret_cast<struct pipeline*>(cras_dsp_get_pipeline_ret);
+}
+
+void cras_dsp_unlock_pipeline(struct cras_dsp_context* ctx) {
+  cras_dsp_unlock_pipeline_called++;
+}
+
+void cras_dsp_set_cb_level(struct cras_dsp_context* ctx,
+                           unsigned int cb_level) {}
+
 float* cras_dsp_pipeline_get_source_buffer(struct pipeline* pipeline,
                                            int index) {
   cras_dsp_pipeline_get_source_buffer_called++;
@@ -2519,6 +3162,10 @@ int cras_dsp_pipeline_get_delay(struct pipeline* pipeline) {
   return 0;
 }
 
+int cras_dsp_pipeline_get_peak_audio_buffers(struct pipeline* pipeline) {
+  return 0;
+}
+
 int cras_dsp_pipeline_apply(struct pipeline* pipeline,
                             uint8_t* buf,
                             snd_pcm_format_t format,
@@ -2528,6 +3175,20 @@ int cras_dsp_pipeline_apply(struct pipeline* pipeline,
   return 0;
 }
 
+int cras_dsp_pipeline_apply_ramp(struct pipeline* pipeline,
+                                 uint8_t* buf,
+                                 snd_pcm_format_t format,
+                                 unsigned int frames,
+                                 float scaler,
+                                 float increment,
+                                 float target) {
+  cras_dsp_pipeline_apply_ramp_called++;
+  cras_dsp_pipeline_apply_ramp_scaler = scaler;
+  cras_dsp_pipeline_apply_ramp_increment = increment;
+  cras_dsp_pipeline_apply_ramp_target = target;
+  return 0;
+}
+
 void cras_dsp_pipeline_add_statistic(struct pipeline* pipeline,
                                      const struct timespec* time_delta,
                                      int samples) {}
@@ -2654,10 +3315,12 @@ void rate_estimator_add_frames(struct rate_estimator* re, int fr) {
 int rate_estimator_check(struct rate_estimator* re,
                          int level,
                          struct timespec* now) {
-  return 0;
+  return rate_estimator_check_ret;
 }
 
-void rate_estimator_reset_rate(struct rate_estimator* re, unsigned int rate) {}
+void rate_estimator_reset_rate(struct rate_estimator* re, unsigned int rate) {
+  rate_estimator_reset_rate_rate = rate;
+}
 
 double rate_estimator_get_rate(struct rate_estimator* re) {
   return rate_estimator_get_rate_ret;
@@ -2744,6 +3407,15 @@ struct input_data* input_data_create(void* dev_ptr) {
 void input_data_destroy(struct input_data** data) {}
 void input_data_set_all_streams_read(struct input_data* data,
                                      unsigned int nframes) {}
+size_t input_data_get_mem_bytes(const struct input_data* data) {
+  return 0;
+}
+void input_data_add_stream(struct input_data* data,
+                           struct cras_rstream* stream,
+                           const struct cras_audio_format* dev_fmt,
+                           unsigned int buffer_frames) {}
+void input_data_rm_stream(struct input_data* data,
+                          const struct cras_rstream* stream) {}
 
 int cras_audio_thread_event_underrun() {
   return 0;
@@ -2762,18 +3434,28 @@ int cras_server_metrics_device_volume(struct cras_iodev* iodev) {
   return 0;
 }
 
-void ewma_power_init(struct ewma_power* ewma, unsigned int rate){};
+void ewma_power_init(struct ewma_power* ewma,
+                     snd_pcm_format_t format,
+                     unsigned int rate){};
 
 void ewma_power_calculate(struct ewma_power* ewma,
-                          const int16_t* buf,
+                          const uint8_t* buf,
                           unsigned int channels,
                           unsigned int size){};
 
 void ewma_power_calculate_area(struct ewma_power* ewma,
-                               const int16_t* buf,
+                               const uint8_t* buf,
                                struct cras_audio_area* area,
                                unsigned int size){};
 
+void energy_vad_init(struct energy_vad* vad, unsigned int rate) {}
+
+bool energy_vad_update(struct energy_vad* vad,
+                       const struct ewma_power* ewma,
+                       unsigned int frames) {
+  return false;
+}
+
 }  // extern "C"
 }  //  namespace
 
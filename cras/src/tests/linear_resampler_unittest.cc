@@ -8,6 +8,7 @@
 #include <stdio.h>
 
 extern "C" {
+#include "cras_util.h"
 #include "linear_resampler.h"
 }
 
@@ -188,6 +189,118 @@ TEST(LinearResampler, ResampleIntegerNoDstBuffer) {
   linear_resampler_destroy(lr);
 }
 
+TEST(LinearResampler, ResampleFloatToLarger) {
+  int i, rc;
+  unsigned int count;
+  struct linear_resampler* lr;
+  float* in = (float*)in_buf;
+  float* out = (float*)out_buf;
+
+  memset(in_buf, 0, BUF_SIZE);
+  memset(out_buf, 0, BUF_SIZE);
+  for (i = 0; i < 100; i++) {
+    in[i * 2] = i * 0.001f;
+    in[i * 2 + 1] = -i * 0.002f;
+  }
+
+  /* Rate 10 -> 11, frame counts match the S16_LE resampler. */
+  lr = linear_resampler_create_float(2, 10, 11);
+
+  count = 60;
+  rc = linear_resampler_resample(lr, in_buf, &count, out_buf, 100);
+  EXPECT_EQ(65, rc);
+  EXPECT_EQ(60, count);
+
+  /* Assert linear interpolation result. */
+  for (i = 0; i < rc; i++) {
+    EXPECT_NEAR(i * 10 / 11.0f * 0.001f, out[i * 2], 1e-6);
+    EXPECT_NEAR(i * 10 / 11.0f * -0.002f, out[i * 2 + 1], 1e-6);
+  }
+  linear_resampler_destroy(lr);
+}
+
+/* Per sample reference of the resampler, for checking the kernels. */
+static unsigned int ReferenceResample(unsigned int num_channels,
+                                      float f,
+                                      unsigned int src_offset,
+                                      unsigned int dst_offset,
+                                      const int16_t* in,
+                                      unsigned int* src_frames,
+                                      int16_t* out,
+                                      unsigned int dst_frames) {
+  unsigned int src_idx = 0, dst_idx, ch;
+  float src_pos;
+
+  for (dst_idx = 0; dst_idx <= dst_frames; dst_idx++) {
+    src_pos = (float)(dst_offset + dst_idx) / f;
+    src_pos = src_pos > src_offset ? src_pos - src_offset : 0;
+    src_idx = (unsigned int)src_pos;
+    if (src_pos > *src_frames - 1 || dst_idx >= dst_frames) {
+      if (src_pos > *src_frames - 1)
+        src_idx = *src_frames - 1;
+      break;
+    }
+    for (ch = 0; ch < num_channels; ch++) {
+      const int16_t* a = in + src_idx * num_channels + ch;
+      out[dst_idx * num_channels + ch] =
+          src_idx == *src_frames - 1
+              ? a[0]
+              : a[0] + (src_pos - src_idx) * (a[num_channels] - a[0]);
+    }
+  }
+  *src_frames = src_idx + 1;
+  return dst_idx;
+}
+
+TEST(LinearResampler, MultiChannelMatchesReference) {
+  static const unsigned int channels[] = {1, 2, 3, 6, 8};
+  static const float rates[][2] = {
+      {48000, 48003}, {48000, 47997}, {44100, 48000}, {10, 11}, {11, 10}};
+  static int16_t ref_buf[BUF_SIZE];
+  int16_t* in = (int16_t*)in_buf;
+  int16_t* out = (int16_t*)out_buf;
+  unsigned int c, r, i, round;
+
+  for (i = 0; i < BUF_SIZE / 2; i++)
+    in[i] = (int16_t)(i * 7919);
+
+  for (c = 0; c < ARRAY_SIZE(channels); c++) {
+    for (r = 0; r < ARRAY_SIZE(rates); r++) {
+      unsigned int nch = channels[c];
+      unsigned int src_offset = 0, dst_offset = 0;
+      struct linear_resampler* lr =
+          linear_resampler_create(nch, nch * 2, rates[r][0], rates[r][1]);
+
+      for (round = 0; round < 20; round++) {
+        unsigned int frames = BUF_SIZE / 2 / 8 / nch / 2 + round;
+        unsigned int dst_frames = frames + 3 - round % 7;
+        unsigned int count = frames, ref_count = frames;
+        unsigned int rc, ref_rc;
+
+        ref_rc = ReferenceResample(nch, rates[r][1] / rates[r][0],
+                                   src_offset, dst_offset, in, &ref_count,
+                                   ref_buf, dst_frames);
+        rc = linear_resampler_resample(lr, in_buf, &count, out_buf,
+                                       dst_frames);
+        ASSERT_EQ(ref_rc, rc) << nch << " " << r << " " << round;
+        ASSERT_EQ(ref_count, count) << nch << " " << r << " " << round;
+        // Allow for rounding when the build contracts multiply-adds.
+        for (i = 0; i < rc * nch; i++)
+          ASSERT_NEAR(ref_buf[i], out[i], 1) << nch << " " << r << " " << i;
+
+        src_offset += count;
+        dst_offset += rc;
+        while (src_offset > rates[r][0] * 100 &&
+               dst_offset > rates[r][1] * 100) {
+          src_offset -= rates[r][0] * 100;
+          dst_offset -= rates[r][1] * 100;
+        }
+      }
+      linear_resampler_destroy(lr);
+    }
+  }
+}
+
 extern "C" {
 
 void cras_mix_add_scale_stride(int fmt,
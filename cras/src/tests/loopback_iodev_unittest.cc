@@ -16,6 +16,7 @@ int atlog_ro_shm_fd;
 #include "cras_iodev.h"
 #include "cras_iodev_list.h"
 #include "cras_loopback_iodev.h"
+#include "cras_ref_ring.h"
 #include "cras_shm.h"
 #include "cras_types.h"
 #include "dev_stream.h"
@@ -31,6 +32,8 @@ static const unsigned int kBufferSize = kBufferFrames * kFrameBytes;
 static struct timespec time_now;
 static cras_audio_area* mock_audio_area;
 static loopback_hook_data_t loop_hook;
+static loopback_hook_control_t loop_hook_start;
+static struct cras_ref_ring* post_dsp_ref;
 static struct cras_iodev* enabled_dev;
 static unsigned int cras_iodev_list_add_input_called;
 static unsigned int cras_iodev_list_rm_input_called;
@@ -60,6 +63,8 @@ class LoopBackTestSuite : public testing::Test {
     loop_in_->format = &fmt_;
 
     loop_hook = NULL;
+    loop_hook_start = NULL;
+    post_dsp_ref = NULL;
     cras_iodev_list_add_input_called = 0;
     cras_iodev_list_rm_input_called = 0;
     cras_iodev_list_set_device_enabled_callback_called = 0;
@@ -195,13 +200,14 @@ TEST_F(LoopBackTestSuite, SimpleLoopback) {
   struct timespec tstamp;
 
   iodev.streams = &stream;
+  iodev.buffer_size = 4096;
   enabled_dev = &iodev;
 
   loop_in_->configure_dev(loop_in_);
   ASSERT_NE(reinterpret_cast<void*>(NULL), loop_hook);
 
   // Loopback callback for the hook.
-  loop_hook(buf_, nframes, &fmt_, loop_in_);
+  EXPECT_EQ(nframes, loop_hook(buf_, nframes, &fmt_, loop_in_));
 
   // Verify frames from loopback record.
   loop_in_->get_buffer(loop_in_, &area, &nread);
@@ -216,6 +222,91 @@ TEST_F(LoopBackTestSuite, SimpleLoopback) {
   EXPECT_EQ(0, loop_in_->close_dev(loop_in_));
 }
 
+TEST_F(LoopBackTestSuite, SlowReaderGetsLatestFrames) {
+  cras_audio_area* area;
+  unsigned int nread = 8192;
+  struct cras_iodev iodev;
+  struct dev_stream stream;
+  struct timespec tstamp;
+
+  // The ring holds two buffers of the sender.
+  iodev.streams = &stream;
+  iodev.buffer_size = 4096;
+  enabled_dev = &iodev;
+
+  loop_in_->configure_dev(loop_in_);
+  ASSERT_NE(reinterpret_cast<void*>(NULL), loop_hook);
+
+  // Nothing is read in between, the oldest 3808 frames are overwritten.
+  EXPECT_EQ(6000, loop_hook(buf_, 6000, &fmt_, loop_in_));
+  EXPECT_EQ(6000, loop_hook(buf_ + 6000 * kFrameBytes, 6000, &fmt_, loop_in_));
+  EXPECT_EQ(8192, loop_in_->frames_queued(loop_in_, &tstamp));
+
+  loop_in_->get_buffer(loop_in_, &area, &nread);
+  EXPECT_EQ(8192 - 3808, nread);
+  EXPECT_EQ(0, memcmp(area->channels[0].buf, buf_ + 3808 * kFrameBytes,
+                      nread * kFrameBytes));
+  loop_in_->put_buffer(loop_in_, nread);
+
+  // The rest wrapped around to the start of the ring.
+  nread = 8192;
+  loop_in_->get_buffer(loop_in_, &area, &nread);
+  EXPECT_EQ(3808, nread);
+  EXPECT_EQ(0, memcmp(area->channels[0].buf, buf_ + 8192 * kFrameBytes,
+                      nread * kFrameBytes));
+  loop_in_->put_buffer(loop_in_, nread);
+  EXPECT_EQ(0, loop_in_->frames_queued(loop_in_, &tstamp));
+
+  // Only the tail of a put larger than the ring is kept.
+  EXPECT_EQ(8192, loop_hook(buf_, 10000, &fmt_, loop_in_));
+  nread = 8192;
+  loop_in_->get_buffer(loop_in_, &area, &nread);
+  EXPECT_EQ(0, memcmp(area->channels[0].buf, buf_ + 1808 * kFrameBytes,
+                      nread * kFrameBytes));
+
+  EXPECT_EQ(0, loop_in_->close_dev(loop_in_));
+}
+
+TEST_F(LoopBackTestSuite, PostDspReadsReferenceRing) {
+  cras_audio_area* area;
+  unsigned int nread = 2048;
+  struct cras_iodev iodev;
+  struct cras_iodev* post_dsp;
+  struct dev_stream stream;
+  struct timespec tstamp;
+
+  iodev.streams = &stream;
+  iodev.buffer_size = 4096;
+  iodev.info.idx = 123;
+  enabled_dev = &iodev;
+  post_dsp_ref = cras_ref_ring_create(kBufferSize);
+  ASSERT_NE((void*)NULL, post_dsp_ref);
+
+  post_dsp = loopback_iodev_create(LOOPBACK_POST_DSP);
+  post_dsp->format = &fmt_;
+  EXPECT_EQ(0, post_dsp->configure_dev(post_dsp));
+
+  // No copy is pushed, the loopback reads the sender's ring once it starts.
+  EXPECT_EQ(reinterpret_cast<loopback_hook_data_t>(NULL), loop_hook);
+  ASSERT_NE(reinterpret_cast<loopback_hook_control_t>(NULL), loop_hook_start);
+  cras_ref_ring_write(post_dsp_ref, buf_, 100, kFrameBytes);
+  loop_hook_start(true, post_dsp);
+  EXPECT_EQ(0, post_dsp->frames_queued(post_dsp, &tstamp));
+
+  cras_ref_ring_write(post_dsp_ref, buf_, 1024, kFrameBytes);
+  EXPECT_EQ(1024, post_dsp->frames_queued(post_dsp, &tstamp));
+  post_dsp->get_buffer(post_dsp, &area, &nread);
+  EXPECT_EQ(1024, nread);
+  EXPECT_EQ(0, memcmp(area->channels[0].buf, buf_, nread * kFrameBytes));
+  post_dsp->put_buffer(post_dsp, nread);
+  EXPECT_EQ(0, post_dsp->frames_queued(post_dsp, &tstamp));
+
+  EXPECT_EQ(0, post_dsp->close_dev(post_dsp));
+  loopback_iodev_destroy(post_dsp);
+  cras_iodev_list_rm_input_called = 0;
+  cras_ref_ring_destroy(post_dsp_ref);
+}
+
 // TODO(chinyue): Test closing last iodev while streaming loopback data.
 
 /* Stubs */
@@ -248,6 +339,12 @@ void cras_iodev_list_register_loopback(enum CRAS_LOOPBACK_TYPE loopback_type,
                                        unsigned int loopback_dev_idx) {
   cras_iodev_list_register_loopback_called++;
   loop_hook = hook_data;
+  loop_hook_start = hook_start;
+}
+
+struct cras_ref_ring* cras_iodev_list_get_post_dsp_ref(
+    unsigned int output_dev_idx) {
+  return post_dsp_ref;
 }
 
 void cras_iodev_list_unregister_loopback(enum CRAS_LOOPBACK_TYPE loopback_type,
@@ -0,0 +1,135 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <stdio.h>
+
+#include <set>
+
+extern "C" {
+#include "cras_mix_pool.h"
+}
+
+namespace {
+
+static int cras_set_rt_scheduling_called;
+
+struct TestJob {
+  unsigned int value;
+  unsigned int runs;
+};
+
+static void double_value(void* arg) {
+  struct TestJob* job = static_cast<struct TestJob*>(arg);
+
+  job->value *= 2;
+  __atomic_fetch_add(&job->runs, 1, __ATOMIC_RELAXED);
+}
+
+TEST(MixPoolTest, CreateZeroWorkers) {
+  EXPECT_EQ(NULL, cras_mix_pool_create(0));
+}
+
+TEST(MixPoolTest, RunsEveryJobOnce) {
+  struct cras_mix_pool* pool;
+  struct TestJob jobs[64];
+
+  pool = cras_mix_pool_create(3);
+  ASSERT_NE((void*)NULL, pool);
+
+  for (unsigned int i = 0; i < 64; i++) {
+    jobs[i].value = i;
+    jobs[i].runs = 0;
+  }
+
+  for (unsigned int batch = 0; batch < 100; batch++) {
+    cras_mix_pool_run(pool, double_value, jobs, sizeof(jobs[0]), 64);
+    for (unsigned int i = 0; i < 64; i++) {
+      EXPECT_EQ(batch + 1, jobs[i].runs);
+      jobs[i].value = i;
+    }
+  }
+
+  cras_mix_pool_destroy(pool);
+}
+
+TEST(MixPoolTest, RunNoJobs) {
+  struct cras_mix_pool* pool;
+  struct TestJob job = {1, 0};
+
+  pool = cras_mix_pool_create(2);
+  ASSERT_NE((void*)NULL, pool);
+
+  cras_mix_pool_run(pool, double_value, &job, sizeof(job), 0);
+  EXPECT_EQ(0, job.runs);
+  cras_mix_pool_run(pool, double_value, &job, sizeof(job), 1);
+  EXPECT_EQ(1, job.runs);
+  EXPECT_EQ(2, job.value);
+
+  cras_mix_pool_destroy(pool);
+}
+
+struct WorkerCalls {
+  pthread_mutex_t mutex;
+  std::set<pthread_t> threads;
+  unsigned int calls;
+};
+
+static void record_worker(void* arg) {
+  struct WorkerCalls* calls = static_cast<struct WorkerCalls*>(arg);
+
+  pthread_mutex_lock(&calls->mutex);
+  calls->threads.insert(pthread_self());
+  calls->calls++;
+  pthread_mutex_unlock(&calls->mutex);
+}
+
+TEST(MixPoolTest, RunOnWorkersOncePerWorker) {
+  struct cras_mix_pool* pool;
+  struct WorkerCalls calls;
+
+  pthread_mutex_init(&calls.mutex, NULL);
+  calls.calls = 0;
+
+  pool = cras_mix_pool_create(3);
+  ASSERT_NE((void*)NULL, pool);
+
+  cras_mix_pool_run_on_workers(pool, record_worker, &calls);
+  EXPECT_EQ(3, calls.calls);
+  EXPECT_EQ(3, calls.threads.size());
+  EXPECT_EQ(0, calls.threads.count(pthread_self()));
+
+  // Batches still run after it.
+  struct TestJob job = {1, 0};
+  cras_mix_pool_run(pool, double_value, &job, sizeof(job), 1);
+  EXPECT_EQ(1, job.runs);
+
+  cras_mix_pool_run_on_workers(pool, record_worker, &calls);
+  EXPECT_EQ(6, calls.calls);
+  EXPECT_EQ(3, calls.threads.size());
+
+  cras_mix_pool_destroy(pool);
+  pthread_mutex_destroy(&calls.mutex);
+}
+
+}  //  namespace
+
+extern "C" {
+
+int cras_set_rt_scheduling(int rt_lim) {
+  __atomic_fetch_add(&cras_set_rt_scheduling_called, 1, __ATOMIC_RELAXED);
+  return -1;
+}
+
+int cras_set_thread_priority(int priority) {
+  return 0;
+}
+
+}  // extern "C"
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
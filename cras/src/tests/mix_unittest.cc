@@ -175,6 +175,55 @@ TEST_F(MixTestSuiteS16_LE, MixTwoSecondHalfVolume) {
   EXPECT_EQ(0, memcmp(mix_buffer_, compare_buffer_, kBufferFrames * 4));
 }
 
+TEST_F(MixTestSuiteS16_LE, MixRampFirst) {
+  float scaler = 0.1;
+  float increment = 0.0001;
+  float target = 0.5;
+
+  cras_mix_add_ramp(fmt_, (uint8_t*)mix_buffer_, (uint8_t*)src_buffer_,
+                    kBufferFrames, kNumChannels, 0, scaler, increment, target);
+
+  for (size_t i = 0; i < kBufferFrames; i++) {
+    float vol = scaler + increment * i;
+    if (vol > target)
+      vol = target;
+    for (size_t j = 0; j < kNumChannels; j++) {
+      size_t k = i * kNumChannels + j;
+      compare_buffer_[k] = src_buffer_[k] * vol;
+    }
+  }
+  EXPECT_EQ(0, memcmp(mix_buffer_, compare_buffer_, kBufferFrames * 4));
+}
+
+TEST_F(MixTestSuiteS16_LE, MixRampTwo) {
+  float scaler = 1.0;
+  float increment = -0.001;
+  float target = 0.0;
+
+  cras_mix_add(fmt_, (uint8_t*)mix_buffer_, (uint8_t*)src_buffer_, kNumSamples,
+               0, 0, 1.0);
+  cras_mix_add_ramp(fmt_, (uint8_t*)mix_buffer_, (uint8_t*)src_buffer_,
+                    kBufferFrames, kNumChannels, 1, scaler, increment, target);
+
+  for (size_t i = 0; i < kBufferFrames; i++) {
+    float vol = scaler + increment * i;
+    if (vol < target)
+      vol = target;
+    for (size_t j = 0; j < kNumChannels; j++) {
+      size_t k = i * kNumChannels + j;
+      int32_t sum = src_buffer_[k];
+      if (vol > kMaxVolumeToScale)
+        sum += src_buffer_[k];
+      else
+        sum += (int16_t)(src_buffer_[k] * vol);
+      if (sum > INT16_MAX)
+        sum = INT16_MAX;
+      compare_buffer_[k] = sum;
+    }
+  }
+  EXPECT_EQ(0, memcmp(mix_buffer_, compare_buffer_, kBufferFrames * 4));
+}
+
 TEST_F(MixTestSuiteS16_LE, ScaleFullVolumeIncrement) {
   float increment = 0.01;
   int step = 2;
@@ -1260,6 +1309,161 @@ TEST_F(MixTestSuiteS24_3LE, StrideCopy) {
   TestScaleStride(0.1);
 }
 
+class MixTestSuiteFLOAT_LE : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    fmt_ = SND_PCM_FORMAT_FLOAT_LE;
+    fr_bytes_ = 4 * kNumChannels;
+    mix_buffer_ = (float*)malloc(kBufferFrames * fr_bytes_);
+    src_buffer_ = static_cast<float*>(
+        calloc(1, kBufferFrames * fr_bytes_ + sizeof(cras_audio_shm_header)));
+
+    for (size_t i = 0; i < kNumSamples; i++) {
+      src_buffer_[i] = (float)i / kNumSamples;
+      mix_buffer_[i] = -(float)i / kNumSamples;
+    }
+
+    compare_buffer_ = (float*)malloc(kBufferFrames * fr_bytes_);
+  }
+
+  virtual void TearDown() {
+    free(mix_buffer_);
+    free(compare_buffer_);
+    free(src_buffer_);
+  }
+
+  float* mix_buffer_;
+  float* src_buffer_;
+  float* compare_buffer_;
+  snd_pcm_format_t fmt_;
+  unsigned int fr_bytes_;
+};
+
+TEST_F(MixTestSuiteFLOAT_LE, MixFirst) {
+  cras_mix_add(fmt_, (uint8_t*)mix_buffer_, (uint8_t*)src_buffer_, kNumSamples,
+               0, 0, 1.0);
+  EXPECT_EQ(0, memcmp(mix_buffer_, src_buffer_, kNumSamples * 4));
+}
+
+TEST_F(MixTestSuiteFLOAT_LE, MixTwoClip) {
+  for (size_t i = 0; i < kNumSamples; i++)
+    mix_buffer_[i] = 0.75f;
+  cras_mix_add(fmt_, (uint8_t*)mix_buffer_, (uint8_t*)src_buffer_, kNumSamples,
+               1, 0, 1.0);
+  for (size_t i = 0; i < kNumSamples; i++)
+    EXPECT_FLOAT_EQ(MIN(0.75f + src_buffer_[i], 1.0f), mix_buffer_[i]);
+}
+
+TEST_F(MixTestSuiteFLOAT_LE, MixTwoSecondHalfVolume) {
+  for (size_t i = 0; i < kNumSamples; i++)
+    compare_buffer_[i] = mix_buffer_[i] + src_buffer_[i] * 0.5f;
+  cras_mix_add(fmt_, (uint8_t*)mix_buffer_, (uint8_t*)src_buffer_, kNumSamples,
+               1, 0, 0.5);
+  for (size_t i = 0; i < kNumSamples; i++)
+    EXPECT_FLOAT_EQ(compare_buffer_[i], mix_buffer_[i]);
+}
+
+TEST_F(MixTestSuiteFLOAT_LE, ScaleHalfVolume) {
+  for (size_t i = 0; i < kNumSamples; i++)
+    compare_buffer_[i] = src_buffer_[i] * 0.5f;
+  cras_scale_buffer(fmt_, (uint8_t*)src_buffer_, kNumSamples, 0.5);
+  EXPECT_EQ(0, memcmp(compare_buffer_, src_buffer_, kNumSamples * 4));
+}
+
+TEST_F(MixTestSuiteFLOAT_LE, StrideClip) {
+  for (size_t i = 0; i < kNumSamples; i++)
+    mix_buffer_[i] = 0.9f;
+  cras_mix_add_scale_stride(fmt_, (uint8_t*)mix_buffer_, (uint8_t*)src_buffer_,
+                            kBufferFrames, 8, 4, 1.0);
+  for (size_t i = 0; i < kNumSamples; i += 2)
+    EXPECT_FLOAT_EQ(MIN(0.9f + src_buffer_[i / 2], 1.0f), mix_buffer_[i]);
+}
+
+TEST_F(MixTestSuiteFLOAT_LE, StridePackedScaleClip) {
+  for (size_t i = 0; i < kNumSamples; i++)
+    compare_buffer_[i] = MIN(mix_buffer_[i] + src_buffer_[i] * 2.0f, 1.0f);
+  cras_mix_add_scale_stride(fmt_, (uint8_t*)mix_buffer_, (uint8_t*)src_buffer_,
+                            kNumSamples, 4, 4, 2.0);
+  for (size_t i = 0; i < kNumSamples; i++)
+    EXPECT_FLOAT_EQ(compare_buffer_[i], mix_buffer_[i]);
+}
+
+TEST(MixMulti, S16SumClipsOnce) {
+  int16_t dst[600];
+  int16_t a[600];
+  int16_t b[600];
+  struct cras_mix_src srcs[2] = {
+      {(uint8_t*)a, 0, 600, 1.0}, {(uint8_t*)b, 0, 600, 1.0}};
+
+  for (size_t i = 0; i < 600; i++) {
+    dst[i] = 30000;
+    a[i] = 30000;
+    b[i] = -30000;
+  }
+  cras_mix_add_multi(SND_PCM_FORMAT_S16_LE, (uint8_t*)dst, srcs, 2, 600);
+  for (size_t i = 0; i < 600; i++)
+    EXPECT_EQ(30000, dst[i]);
+
+  for (size_t i = 0; i < 600; i++)
+    b[i] = 30000;
+  cras_mix_add_multi(SND_PCM_FORMAT_S16_LE, (uint8_t*)dst, srcs, 2, 600);
+  for (size_t i = 0; i < 600; i++)
+    EXPECT_EQ(INT16_MAX, dst[i]);
+}
+
+TEST(MixMulti, S16OffsetCountAndVolume) {
+  int16_t dst[600];
+  int16_t a[300];
+  int16_t b[500];
+  struct cras_mix_src srcs[3] = {{(uint8_t*)a, 250, 300, 0.5},
+                                 {(uint8_t*)b, 10, 500, 1.0},
+                                 {(uint8_t*)b, 0, 500, 0.0}};
+
+  for (size_t i = 0; i < 600; i++)
+    dst[i] = i;
+  for (size_t i = 0; i < 300; i++)
+    a[i] = 100;
+  for (size_t i = 0; i < 500; i++)
+    b[i] = -1;
+  cras_mix_add_multi(SND_PCM_FORMAT_S16_LE, (uint8_t*)dst, srcs, 3, 600);
+  for (size_t i = 0; i < 600; i++) {
+    int16_t expected = i;
+    if (i >= 250 && i < 550)
+      expected += 50;
+    if (i >= 10 && i < 510)
+      expected -= 1;
+    EXPECT_EQ(expected, dst[i]) << i;
+  }
+}
+
+TEST(MixMulti, S243LEAndFloatSum) {
+  uint8_t dst[3 * 300];
+  uint8_t a[3 * 300];
+  float fdst[300];
+  float fa[300];
+  struct cras_mix_src src = {a, 0, 300, 1.0};
+
+  for (size_t i = 0; i < 300; i++) {
+    int32_t d = 0x7ffff0 - 0x10000 * (i & 1);
+    int32_t v = 0x20;
+    memcpy(dst + 3 * i, &d, 3);
+    memcpy(a + 3 * i, &v, 3);
+    fdst[i] = 0.75f;
+    fa[i] = 0.5f;
+  }
+  cras_mix_add_multi(SND_PCM_FORMAT_S24_3LE, dst, &src, 1, 300);
+  for (size_t i = 0; i < 300; i++) {
+    int32_t d = 0;
+    memcpy(&d, dst + 3 * i, 3);
+    EXPECT_EQ(i & 1 ? 0x7f0010 : 0x7fffff, d) << i;
+  }
+
+  src.buf = (uint8_t*)fa;
+  cras_mix_add_multi(SND_PCM_FORMAT_FLOAT_LE, (uint8_t*)fdst, &src, 1, 300);
+  for (size_t i = 0; i < 300; i++)
+    EXPECT_FLOAT_EQ(1.0f, fdst[i]);
+}
+
 /* Stubs */
 extern "C" {}  // extern "C"
 
@@ -0,0 +1,156 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <sched.h>
+
+extern "C" {
+#include "cras_msg_ring.h"
+}
+
+namespace {
+
+#define NUM_PRODUCERS 4
+#define NUM_MESSAGES 20000
+
+struct test_msg {
+  unsigned int producer;
+  unsigned int seq;
+};
+
+TEST(MsgRingTest, CreateInvalid) {
+  EXPECT_EQ(NULL, cras_msg_ring_create(0, 4));
+  EXPECT_EQ(NULL, cras_msg_ring_create(16, 0));
+  EXPECT_EQ(NULL, cras_msg_ring_create(16, 3));
+}
+
+TEST(MsgRingTest, FillDropAndDrain) {
+  struct cras_msg_ring* ring;
+  unsigned int* slot;
+
+  ring = cras_msg_ring_create(sizeof(unsigned int), 4);
+  ASSERT_NE((void*)NULL, ring);
+  EXPECT_EQ(NULL, cras_msg_ring_read_slot(ring));
+
+  for (unsigned int i = 0; i < 4; i++)
+    EXPECT_EQ(0, cras_msg_ring_write(ring, &i, sizeof(i)));
+  unsigned int extra = 4;
+  EXPECT_EQ(-EAGAIN, cras_msg_ring_write(ring, &extra, sizeof(extra)));
+  EXPECT_EQ(-EAGAIN, cras_msg_ring_write(ring, &extra, sizeof(extra)));
+  EXPECT_EQ(2, cras_msg_ring_dropped(ring));
+
+  for (unsigned int i = 0; i < 4; i++) {
+    slot = (unsigned int*)cras_msg_ring_read_slot(ring);
+    ASSERT_NE((void*)NULL, slot);
+    EXPECT_EQ(i, *slot);
+    cras_msg_ring_commit_read(ring);
+  }
+  EXPECT_EQ(NULL, cras_msg_ring_read_slot(ring));
+  EXPECT_EQ(0, cras_msg_ring_write(ring, &extra, sizeof(extra)));
+
+  cras_msg_ring_destroy(ring);
+}
+
+TEST(MsgRingTest, TryWriteNotCountedAsDropped) {
+  struct cras_msg_ring* ring;
+  unsigned int* slot;
+  unsigned int val = 7;
+
+  ring = cras_msg_ring_create(sizeof(unsigned int), 2);
+  ASSERT_NE((void*)NULL, ring);
+  EXPECT_EQ(0, cras_msg_ring_try_write(ring, &val, sizeof(val)));
+  EXPECT_EQ(0, cras_msg_ring_try_write(ring, &val, sizeof(val)));
+  EXPECT_EQ(-EAGAIN, cras_msg_ring_try_write(ring, &val, sizeof(val)));
+  EXPECT_EQ(0, cras_msg_ring_dropped(ring));
+
+  slot = (unsigned int*)cras_msg_ring_read_slot(ring);
+  ASSERT_NE((void*)NULL, slot);
+  EXPECT_EQ(7, *slot);
+  cras_msg_ring_commit_read(ring);
+  EXPECT_EQ(0, cras_msg_ring_try_write(ring, &val, sizeof(val)));
+
+  cras_msg_ring_destroy(ring);
+}
+
+TEST(MsgRingTest, MessageTooLarge) {
+  struct cras_msg_ring* ring;
+  uint8_t buf[64] = {};
+
+  ring = cras_msg_ring_create(16, 4);
+  ASSERT_NE((void*)NULL, ring);
+  EXPECT_EQ(-EMSGSIZE, cras_msg_ring_write(ring, buf, sizeof(buf)));
+  EXPECT_EQ(0, cras_msg_ring_dropped(ring));
+  cras_msg_ring_destroy(ring);
+}
+
+TEST(MsgRingTest, WakeupsCoalesce) {
+  struct cras_msg_ring* ring;
+  unsigned int val = 0;
+
+  ring = cras_msg_ring_create(sizeof(val), 4);
+  ASSERT_NE((void*)NULL, ring);
+
+  EXPECT_EQ(0, cras_msg_ring_write(ring, &val, sizeof(val)));
+  EXPECT_NE(0, cras_msg_ring_need_wake(ring));
+  EXPECT_EQ(0, cras_msg_ring_write(ring, &val, sizeof(val)));
+  EXPECT_EQ(0, cras_msg_ring_need_wake(ring));
+
+  cras_msg_ring_ack_wake(ring);
+  EXPECT_EQ(0, cras_msg_ring_write(ring, &val, sizeof(val)));
+  EXPECT_NE(0, cras_msg_ring_need_wake(ring));
+
+  cras_msg_ring_destroy(ring);
+}
+
+static void* producer(void* arg) {
+  struct cras_msg_ring* ring = (struct cras_msg_ring*)arg;
+  static unsigned int next_id;
+  struct test_msg msg;
+
+  msg.producer = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+  for (msg.seq = 0; msg.seq < NUM_MESSAGES; msg.seq++)
+    while (cras_msg_ring_write(ring, &msg, sizeof(msg)) == -EAGAIN)
+      sched_yield();
+  return NULL;
+}
+
+TEST(MsgRingTest, OrderedPerProducer) {
+  struct cras_msg_ring* ring;
+  pthread_t tids[NUM_PRODUCERS];
+  unsigned int expected[NUM_PRODUCERS] = {};
+  unsigned int received = 0;
+  struct test_msg* msg;
+
+  ring = cras_msg_ring_create(sizeof(struct test_msg), 8);
+  ASSERT_NE((void*)NULL, ring);
+  for (unsigned int i = 0; i < NUM_PRODUCERS; i++)
+    ASSERT_EQ(0, pthread_create(&tids[i], NULL, producer, ring));
+
+  while (received < NUM_PRODUCERS * NUM_MESSAGES) {
+    msg = (struct test_msg*)cras_msg_ring_read_slot(ring);
+    if (!msg) {
+      sched_yield();
+      continue;
+    }
+    ASSERT_GT(NUM_PRODUCERS, msg->producer);
+    EXPECT_EQ(expected[msg->producer], msg->seq);
+    expected[msg->producer] = msg->seq + 1;
+    cras_msg_ring_commit_read(ring);
+    received++;
+  }
+
+  for (unsigned int i = 0; i < NUM_PRODUCERS; i++)
+    pthread_join(tids[i], NULL);
+  EXPECT_EQ(NULL, cras_msg_ring_read_slot(ring));
+  cras_msg_ring_destroy(ring);
+}
+
+}  //  namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
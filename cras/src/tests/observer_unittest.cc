@@ -25,6 +25,7 @@ static alert_callback_map cras_alert_create_prepare_map;
 static alert_callback_map cras_alert_add_callback_map;
 typedef std::map<struct cras_alert*, unsigned int> alert_flags_map;
 static alert_flags_map cras_alert_create_flags_map;
+static alert_flags_map cras_alert_rate_limit_map;
 static struct cras_alert* cras_alert_pending_alert_value;
 static void* cras_alert_pending_data_value = NULL;
 static size_t cras_alert_pending_data_size_value;
@@ -68,6 +69,7 @@ static void ResetStubData() {
   cras_alert_create_return_values.clear();
   cras_alert_create_prepare_map.clear();
   cras_alert_create_flags_map.clear();
+  cras_alert_rate_limit_map.clear();
   cras_alert_add_callback_map.clear();
   cras_alert_pending_alert_value = NULL;
   cras_alert_pending_data_size_value = 0;
@@ -214,7 +216,7 @@ class ObserverTest : public testing::Test {
     ResetStubData();
     rc = cras_observer_server_init();
     ASSERT_EQ(0, rc);
-    EXPECT_EQ(17, cras_alert_create_called);
+    EXPECT_EQ(18, cras_alert_create_called);
     EXPECT_EQ(reinterpret_cast<void*>(output_volume_alert),
               cras_alert_add_callback_map[g_observer->alerts.output_volume]);
     EXPECT_EQ(reinterpret_cast<void*>(output_mute_alert),
@@ -253,12 +255,22 @@ class ObserverTest : public testing::Test {
     EXPECT_EQ(
         reinterpret_cast<void*>(hotword_triggered_alert),
         cras_alert_add_callback_map[g_observer->alerts.hotword_triggered]);
+    EXPECT_EQ(
+        reinterpret_cast<void*>(hotword_model_loaded_alert),
+        cras_alert_add_callback_map[g_observer->alerts.hotword_model_loaded]);
+    EXPECT_EQ(
+        CRAS_ALERT_FLAG_KEEP_ALL_DATA,
+        cras_alert_create_flags_map[g_observer->alerts.hotword_model_loaded]);
     EXPECT_EQ(reinterpret_cast<void*>(non_empty_audio_state_changed_alert),
               cras_alert_add_callback_map[g_observer->alerts
                                               .non_empty_audio_state_changed]);
     EXPECT_EQ(
         reinterpret_cast<void*>(bt_battery_changed_alert),
         cras_alert_add_callback_map[g_observer->alerts.bt_battery_changed]);
+    EXPECT_LT(0, cras_alert_rate_limit_map[g_observer->alerts.output_volume]);
+    EXPECT_LT(0,
+              cras_alert_rate_limit_map[g_observer->alerts.output_node_volume]);
+    EXPECT_EQ(0, cras_alert_rate_limit_map[g_observer->alerts.output_mute]);
 
     cras_observer_get_ops(NULL, &ops1_);
     EXPECT_NE(0, cras_observer_ops_are_empty(&ops1_));
@@ -272,7 +284,7 @@ class ObserverTest : public testing::Test {
 
   virtual void TearDown() {
     cras_observer_server_free();
-    EXPECT_EQ(17, cras_alert_destroy_called);
+    EXPECT_EQ(18, cras_alert_destroy_called);
     ResetStubData();
   }
 
@@ -639,6 +651,22 @@ TEST_F(ObserverTest, NotifyHotwordTriggered) {
   EXPECT_EQ(data->tv_nsec, 200);
 }
 
+TEST_F(ObserverTest, NotifyHotwordModelLoaded) {
+  struct cras_observer_alert_data_hotword_model_loaded* data;
+
+  cras_observer_notify_hotword_model_loaded(0x100000002, "en_us", -EIO);
+  EXPECT_EQ(cras_alert_pending_alert_value,
+            g_observer->alerts.hotword_model_loaded);
+  ASSERT_EQ(cras_alert_pending_data_size_value, sizeof(*data));
+  ASSERT_NE(cras_alert_pending_data_value, reinterpret_cast<void*>(NULL));
+  data =
+      reinterpret_cast<struct cras_observer_alert_data_hotword_model_loaded*>(
+          cras_alert_pending_data_value);
+  EXPECT_EQ(data->node_id, 0x100000002);
+  EXPECT_STREQ(data->model_name, "en_us");
+  EXPECT_EQ(data->error, -EIO);
+}
+
 TEST_F(ObserverTest, NonEmpyAudioStateChanged) {
   struct cras_observer_non_empty_audio_state* data;
 
@@ -693,6 +721,13 @@ int cras_alert_add_callback(struct cras_alert* alert,
   return 0;
 }
 
+void cras_alert_set_rate_limit(struct cras_alert* alert,
+                               unsigned int min_interval_ms) {
+  cras_alert_rate_limit_map[alert] = min_interval_ms;
+}
+
+void cras_alert_set_data_key_size(struct cras_alert* alert, size_t key_size) {}
+
 void cras_alert_pending(struct cras_alert* alert) {
   cras_alert_pending_alert_value = alert;
 }
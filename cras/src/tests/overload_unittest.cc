@@ -0,0 +1,180 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <string.h>
+
+extern "C" {
+#include "cras_main_message.h"
+#include "cras_overload.h"
+}
+
+namespace {
+
+static const uint64_t kWakeNs = 10000000;
+
+static cras_message_callback main_message_callback;
+static unsigned int main_message_send_called;
+static unsigned int dsp_set_overloaded_called;
+static int dsp_overloaded_val;
+
+void ResetStubData() {
+  main_message_callback = NULL;
+  main_message_send_called = 0;
+  dsp_set_overloaded_called = 0;
+  dsp_overloaded_val = 0;
+}
+
+// Feeds wakes taking load thousandths of the wall time, until the level
+// changes or wakes run out. Returns the number of wakes fed.
+unsigned int Feed(struct cras_overload* ol,
+                  unsigned int load,
+                  unsigned int wakes) {
+  unsigned int i;
+
+  for (i = 1; i <= wakes; i++)
+    if (cras_overload_update(ol, kWakeNs * load / 1000, kWakeNs))
+      return i;
+  return i - 1;
+}
+
+class OverloadTestSuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    ResetStubData();
+    ol_ = cras_overload_create();
+    ASSERT_NE(ol_, (void*)NULL);
+  }
+
+  virtual void TearDown() { cras_overload_destroy(ol_); }
+
+  struct cras_overload* ol_;
+};
+
+TEST_F(OverloadTestSuite, StaysAtNoneWithHeadroom) {
+  EXPECT_EQ(CRAS_OVERLOAD_NONE, cras_overload_get_level(ol_));
+  EXPECT_EQ(1000, Feed(ol_, 500, 1000));
+  EXPECT_EQ(CRAS_OVERLOAD_NONE, cras_overload_get_level(ol_));
+  EXPECT_EQ(500, cras_overload_get_load(ol_));
+}
+
+TEST_F(OverloadTestSuite, DegradesOneLevelAtATime) {
+  unsigned int wakes;
+
+  // The average takes a few wakes to climb over the threshold.
+  wakes = Feed(ol_, 950, 1000);
+  EXPECT_GT(wakes, 50);
+  EXPECT_LT(wakes, 70);
+  EXPECT_EQ(CRAS_OVERLOAD_SRC, cras_overload_get_level(ol_));
+
+  EXPECT_EQ(50, Feed(ol_, 950, 1000));
+  EXPECT_EQ(CRAS_OVERLOAD_LINEAR_SRC, cras_overload_get_level(ol_));
+  EXPECT_EQ(50, Feed(ol_, 950, 1000));
+  EXPECT_EQ(CRAS_OVERLOAD_DSP, cras_overload_get_level(ol_));
+  EXPECT_EQ(50, Feed(ol_, 950, 1000));
+  EXPECT_EQ(CRAS_OVERLOAD_APM, cras_overload_get_level(ol_));
+
+  // Nothing left to give up.
+  EXPECT_EQ(1000, Feed(ol_, 1000, 1000));
+  EXPECT_EQ(CRAS_OVERLOAD_APM, cras_overload_get_level(ol_));
+}
+
+TEST_F(OverloadTestSuite, RestoresSlowlyWithHeadroom) {
+  Feed(ol_, 950, 1000);
+  Feed(ol_, 950, 1000);
+  EXPECT_EQ(CRAS_OVERLOAD_LINEAR_SRC, cras_overload_get_level(ol_));
+
+  // In between the thresholds nothing changes.
+  EXPECT_EQ(2000, Feed(ol_, 500, 2000));
+  EXPECT_EQ(CRAS_OVERLOAD_LINEAR_SRC, cras_overload_get_level(ol_));
+
+  EXPECT_GE(Feed(ol_, 100, 1000), 500);
+  EXPECT_EQ(CRAS_OVERLOAD_SRC, cras_overload_get_level(ol_));
+  EXPECT_EQ(500, Feed(ol_, 100, 1000));
+  EXPECT_EQ(CRAS_OVERLOAD_NONE, cras_overload_get_level(ol_));
+}
+
+TEST_F(OverloadTestSuite, ShortBurstDoesNotDegrade) {
+  Feed(ol_, 500, 100);
+  EXPECT_EQ(30, Feed(ol_, 1000, 30));
+  EXPECT_EQ(100, Feed(ol_, 500, 100));
+  EXPECT_EQ(30, Feed(ol_, 1000, 30));
+  EXPECT_EQ(CRAS_OVERLOAD_NONE, cras_overload_get_level(ol_));
+}
+
+TEST_F(OverloadTestSuite, IgnoresEmptyInterval) {
+  EXPECT_EQ(0, cras_overload_update(ol_, 1000, 0));
+  EXPECT_EQ(0, cras_overload_get_load(ol_));
+}
+
+TEST_F(OverloadTestSuite, SrcQualityForLevel) {
+  EXPECT_EQ(CRAS_SRC_QUALITY_HIGH,
+            cras_overload_src_quality(CRAS_OVERLOAD_NONE,
+                                      CRAS_STREAM_TYPE_MULTIMEDIA,
+                                      CRAS_SRC_QUALITY_HIGH));
+  EXPECT_EQ(CRAS_SRC_QUALITY_LOW_LATENCY,
+            cras_overload_src_quality(CRAS_OVERLOAD_SRC,
+                                      CRAS_STREAM_TYPE_MULTIMEDIA,
+                                      CRAS_SRC_QUALITY_HIGH));
+  EXPECT_EQ(CRAS_SRC_QUALITY_LINEAR,
+            cras_overload_src_quality(CRAS_OVERLOAD_LINEAR_SRC,
+                                      CRAS_STREAM_TYPE_MULTIMEDIA,
+                                      CRAS_SRC_QUALITY_HIGH));
+  EXPECT_EQ(CRAS_SRC_QUALITY_LOW_LATENCY,
+            cras_overload_src_quality(CRAS_OVERLOAD_APM,
+                                      CRAS_STREAM_TYPE_VOICE_COMMUNICATION,
+                                      CRAS_SRC_QUALITY_LOW_LATENCY));
+  EXPECT_EQ(CRAS_SRC_QUALITY_LOW_LATENCY,
+            cras_overload_src_quality(CRAS_OVERLOAD_APM,
+                                      CRAS_STREAM_TYPE_PRO_AUDIO,
+                                      CRAS_SRC_QUALITY_HIGH));
+}
+
+TEST_F(OverloadTestSuite, DspOverloadedWhileAnyThreadIs) {
+  cras_overload_handler_init();
+  ASSERT_NE(main_message_callback, (void*)NULL);
+
+  cras_overload_send_dsp_msg(1);
+  cras_overload_send_dsp_msg(1);
+  EXPECT_EQ(2, main_message_send_called);
+  EXPECT_EQ(1, dsp_overloaded_val);
+
+  cras_overload_send_dsp_msg(0);
+  EXPECT_EQ(1, dsp_overloaded_val);
+  cras_overload_send_dsp_msg(0);
+  EXPECT_EQ(0, dsp_overloaded_val);
+  EXPECT_EQ(4, dsp_set_overloaded_called);
+}
+
+}  // namespace
+
+extern "C" {
+
+int cras_main_message_add_handler(enum CRAS_MAIN_MESSAGE_TYPE type,
+                                  cras_message_callback callback,
+                                  void* callback_data) {
+  EXPECT_EQ(CRAS_MAIN_OVERLOAD_DSP, type);
+  main_message_callback = callback;
+  return 0;
+}
+
+// Delivers the message right away, as the main thread would.
+int cras_main_message_send(struct cras_main_message* msg) {
+  main_message_send_called++;
+  if (main_message_callback)
+    main_message_callback(msg, NULL);
+  return 0;
+}
+
+void cras_dsp_set_overloaded(int overloaded) {
+  dsp_set_overloaded_called++;
+  dsp_overloaded_val = overloaded;
+}
+
+}  // extern "C"
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,211 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <pthread.h>
+
+#include <vector>
+
+extern "C" {
+#include "packet_status_logger.h"
+}
+
+using testing::MatchesRegex;
+using testing::internal::CaptureStdout;
+using testing::internal::GetCapturedStdout;
+
+namespace {
+
+struct StatusRun {
+  bool lost;
+  uint32_t len;
+};
+
+class PacketStatusLoggerTestSuite : public testing::Test {
+ protected:
+  virtual void SetUp() { packet_status_logger_init(&logger_); }
+
+  void Log(bool lost, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++)
+      packet_status_logger_update(&logger_, lost);
+  }
+
+  static std::vector<StatusRun> Runs(
+      const struct packet_status_logger* logger) {
+    struct packet_status_run run = {0};
+    std::vector<StatusRun> runs;
+
+    while (packet_status_logger_next_run(logger, &run))
+      runs.push_back({run.lost, run.len});
+    return runs;
+  }
+
+  struct packet_status_logger logger_;
+};
+
+TEST_F(PacketStatusLoggerTestSuite, RunsAlternate) {
+  std::vector<StatusRun> runs;
+
+  EXPECT_TRUE(Runs(&logger_).empty());
+
+  Log(false, 5);
+  Log(true, 2);
+  Log(false, 200);
+
+  // Two closed runs of a byte each, the open one isn't stored yet.
+  EXPECT_EQ(2, logger_.len);
+  EXPECT_EQ(5, logger_.data[0]);
+  EXPECT_EQ(2, logger_.data[1]);
+  EXPECT_EQ(207, logger_.num_packets);
+  EXPECT_EQ(2, logger_.num_lost);
+
+  runs = Runs(&logger_);
+  ASSERT_EQ(3, runs.size());
+  EXPECT_FALSE(runs[0].lost);
+  EXPECT_EQ(5, runs[0].len);
+  EXPECT_TRUE(runs[1].lost);
+  EXPECT_EQ(2, runs[1].len);
+  EXPECT_FALSE(runs[2].lost);
+  EXPECT_EQ(200, runs[2].len);
+
+  // Closing the 200 packet run takes two bytes.
+  Log(true, 1);
+  EXPECT_EQ(4, logger_.len);
+  EXPECT_EQ(0xc8, logger_.data[2]);
+  EXPECT_EQ(0x01, logger_.data[3]);
+
+  CaptureStdout();
+  packet_status_logger_dump_hex(&logger_);
+  EXPECT_EQ("0502c80101\n", GetCapturedStdout());
+}
+
+TEST_F(PacketStatusLoggerTestSuite, FirstPacketLost) {
+  std::vector<StatusRun> runs;
+
+  Log(true, 3);
+  Log(false, 1);
+
+  runs = Runs(&logger_);
+  ASSERT_EQ(2, runs.size());
+  EXPECT_TRUE(runs[0].lost);
+  EXPECT_EQ(3, runs[0].len);
+  EXPECT_FALSE(runs[1].lost);
+  EXPECT_EQ(1, runs[1].len);
+}
+
+TEST_F(PacketStatusLoggerTestSuite, LongRunIsSplit) {
+  std::vector<StatusRun> runs;
+
+  Log(false, PACKET_STATUS_RUN_MAX + 1);
+
+  // Three bytes for the longest run and one for the empty lost run.
+  EXPECT_EQ(4, logger_.len);
+  runs = Runs(&logger_);
+  ASSERT_EQ(3, runs.size());
+  EXPECT_FALSE(runs[0].lost);
+  EXPECT_EQ(PACKET_STATUS_RUN_MAX, runs[0].len);
+  EXPECT_TRUE(runs[1].lost);
+  EXPECT_EQ(0, runs[1].len);
+  EXPECT_FALSE(runs[2].lost);
+  EXPECT_EQ(1, runs[2].len);
+}
+
+TEST_F(PacketStatusLoggerTestSuite, FullHistoryOnlyCounts) {
+  uint32_t logged = 0;
+  int i;
+
+  for (i = 0; i < PACKET_STATUS_HISTORY_BYTES + 10; i++)
+    Log(i & 1, 1);
+
+  EXPECT_TRUE(logger_.full);
+  EXPECT_EQ(PACKET_STATUS_HISTORY_BYTES, logger_.len);
+  EXPECT_EQ(PACKET_STATUS_HISTORY_BYTES + 10, logger_.num_packets);
+  EXPECT_EQ(PACKET_STATUS_HISTORY_BYTES / 2 + 5, logger_.num_lost);
+
+  // The open run is left out once runs are dropped.
+  for (const StatusRun& run : Runs(&logger_))
+    logged += run.len;
+  EXPECT_EQ(PACKET_STATUS_HISTORY_BYTES, logged);
+}
+
+TEST_F(PacketStatusLoggerTestSuite, EndTs) {
+  struct timespec begin, end;
+
+  Log(false, 400);
+  packet_status_logger_begin_ts(&logger_, &begin);
+  packet_status_logger_end_ts(&logger_, &end);
+
+  // 400 packets of 7.5ms.
+  EXPECT_EQ(begin.tv_sec + 3, end.tv_sec);
+  EXPECT_EQ(begin.tv_nsec, end.tv_nsec);
+}
+
+TEST_F(PacketStatusLoggerTestSuite, DumpBinary) {
+  char log_regex[64];
+  int lens[5] = {40, 150, 162, 100, 32};
+
+  /* Expect the log line wraps at correct length to avoid feedback redact. */
+  snprintf(log_regex, 64, "([01D]{%d}\n)*", PACKET_STATUS_LOG_LINE_WRAP);
+
+  for (int i = 0; i < 5; i++) {
+    Log(i & 1, lens[i]);
+    CaptureStdout();
+    packet_status_logger_dump_binary(&logger_);
+    EXPECT_THAT(GetCapturedStdout(), MatchesRegex(log_regex));
+  }
+
+  CaptureStdout();
+  packet_status_logger_init(&logger_);
+  Log(false, 2);
+  Log(true, 1);
+  packet_status_logger_dump_binary(&logger_);
+  EXPECT_EQ(std::string("001") + std::string(47, 'D') + "\n",
+            GetCapturedStdout());
+}
+
+// Run i of the pattern logged by the writer thread is (i % 7) + 1 long.
+static uint32_t PatternLen(size_t i) {
+  return (i % 7) + 1;
+}
+
+static void* WritePattern(void* arg) {
+  struct packet_status_logger* logger = (struct packet_status_logger*)arg;
+
+  for (size_t i = 0; i < 2000; i++)
+    for (uint32_t j = 0; j < PatternLen(i); j++)
+      packet_status_logger_update(logger, i & 1);
+  return NULL;
+}
+
+TEST_F(PacketStatusLoggerTestSuite, CopyWhileLogging) {
+  struct packet_status_logger copy;
+  std::vector<StatusRun> runs;
+  pthread_t tid;
+
+  pthread_create(&tid, NULL, WritePattern, &logger_);
+  for (int n = 0; n < 200; n++) {
+    packet_status_logger_copy(&copy, &logger_);
+    runs = Runs(&copy);
+    // Closed runs match the pattern, and the open one is no longer.
+    for (size_t i = 0; i < runs.size(); i++) {
+      ASSERT_EQ(i & 1, runs[i].lost);
+      if (i + 1 < runs.size())
+        ASSERT_EQ(PatternLen(i), runs[i].len);
+      else
+        ASSERT_GE(PatternLen(i), runs[i].len);
+    }
+  }
+  pthread_join(tid, NULL);
+
+  packet_status_logger_copy(&copy, &logger_);
+  EXPECT_EQ(2000, Runs(&copy).size());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -24,6 +24,8 @@ static unsigned int cras_observer_remove_called;
 static int stream_list_add_called;
 static int stream_list_add_return;
 static unsigned int stream_list_rm_called;
+static unsigned int cras_iodev_list_begin_stream_batch_called;
+static unsigned int cras_iodev_list_end_stream_batch_called;
 static struct cras_audio_shm mock_shm;
 static struct cras_rstream mock_rstream;
 
@@ -34,6 +36,8 @@ void ResetStubData() {
   stream_list_add_called = 0;
   stream_list_add_return = 0;
   stream_list_rm_called = 0;
+  cras_iodev_list_begin_stream_batch_called = 0;
+  cras_iodev_list_end_stream_batch_called = 0;
 }
 
 namespace {
@@ -226,6 +230,72 @@ TEST_F(CPRMessageSuite, StreamDisconnectMessageInvalidClientId) {
   EXPECT_EQ(0, stream_list_add_called);
   EXPECT_EQ(0, stream_list_rm_called);
 }
+TEST_F(CPRMessageSuite, StreamsConnectMessage) {
+  struct cras_client_stream_connected out_msg;
+  struct cras_connect_streams_message msg;
+  cras_stream_id_t stream_ids[2] = {0x10002, 0x10003};
+  int fds[2] = {100, 101};
+  int rc;
+
+  for (int i = 0; i < 2; i++)
+    cras_fill_connect_message(&msg.streams[i], CRAS_STREAM_OUTPUT,
+                              stream_ids[i], CRAS_STREAM_TYPE_DEFAULT,
+                              CRAS_CLIENT_TYPE_UNKNOWN, 480, 240, /*flags=*/0,
+                              /*effects=*/0, fmt, NO_DEVICE);
+  cras_fill_connect_streams_message(&msg, 2);
+
+  rc = rclient_->ops->handle_message_from_client(rclient_, &msg.header, fds,
+                                                 2);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(2, cras_make_fd_nonblocking_called);
+  EXPECT_EQ(2, stream_list_add_called);
+  EXPECT_EQ(1, cras_iodev_list_begin_stream_batch_called);
+  EXPECT_EQ(1, cras_iodev_list_end_stream_batch_called);
+
+  for (int i = 0; i < 2; i++) {
+    rc = read(pipe_fds_[0], &out_msg, sizeof(out_msg));
+    EXPECT_EQ(sizeof(out_msg), rc);
+    EXPECT_EQ(stream_ids[i], out_msg.stream_id);
+    EXPECT_EQ(0, out_msg.err);
+  }
+}
+
+TEST_F(CPRMessageSuite, StreamsConnectMessageFdMismatch) {
+  struct cras_connect_streams_message msg;
+  int fd = -1;
+  int rc;
+
+  for (int i = 0; i < 2; i++)
+    cras_fill_connect_message(&msg.streams[i], CRAS_STREAM_OUTPUT,
+                              0x10002 + i, CRAS_STREAM_TYPE_DEFAULT,
+                              CRAS_CLIENT_TYPE_UNKNOWN, 480, 240, /*flags=*/0,
+                              /*effects=*/0, fmt, NO_DEVICE);
+  cras_fill_connect_streams_message(&msg, 2);
+
+  rc = rclient_->ops->handle_message_from_client(rclient_, &msg.header, &fd,
+                                                 1);
+  EXPECT_EQ(-EINVAL, rc);
+  EXPECT_EQ(0, stream_list_add_called);
+  EXPECT_EQ(0, cras_iodev_list_begin_stream_batch_called);
+
+  /* Claiming more streams than the batch can hold. */
+  msg.num_streams = CRAS_MAX_BATCH_STREAMS + 1;
+  rc = rclient_->ops->handle_message_from_client(rclient_, &msg.header, NULL,
+                                                 0);
+  EXPECT_EQ(-EINVAL, rc);
+  EXPECT_EQ(0, stream_list_add_called);
+}
+
+TEST_F(CPRMessageSuite, StreamsDisconnectMessage) {
+  struct cras_disconnect_streams_message msg;
+  cras_stream_id_t stream_ids[3] = {0x10002, 0x20002, 0x10003};
+
+  // The stream with another client's id is skipped.
+  cras_fill_disconnect_streams_message(&msg, stream_ids, 3);
+  rclient_->ops->handle_message_from_client(rclient_, &msg.header, NULL, 0);
+  EXPECT_EQ(0, stream_list_add_called);
+  EXPECT_EQ(2, stream_list_rm_called);
+}
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -236,10 +306,29 @@ int main(int argc, char** argv) {
 /* stubs */
 extern "C" {
 
+int cras_iodev_list_set_stream_effects(cras_stream_id_t stream_id,
+                                       uint64_t effects) {
+  return 0;
+}
+
+int cras_iodev_list_set_stream_paused(cras_stream_id_t stream_id,
+                                      int paused,
+                                      unsigned int fade_in_ms) {
+  return 0;
+}
+
 struct stream_list* cras_iodev_list_get_stream_list() {
   return NULL;
 }
 
+void cras_iodev_list_begin_stream_batch() {
+  cras_iodev_list_begin_stream_batch_called++;
+}
+
+void cras_iodev_list_end_stream_batch() {
+  cras_iodev_list_end_stream_batch_called++;
+}
+
 int cras_make_fd_nonblocking(int fd) {
   cras_make_fd_nonblocking_called++;
   return 0;
@@ -261,12 +350,22 @@ int cras_send_with_fds(int sockfd,
   return write(sockfd, buf, len);
 }
 
+int cras_send_messages(int sockfd,
+                       const struct iovec* msgs,
+                       unsigned int num_msgs) {
+  for (unsigned int i = 0; i < num_msgs; i++)
+    write(sockfd, msgs[i].iov_base, msgs[i].iov_len);
+  return num_msgs;
+}
+
 key_t cras_sys_state_shm_fd() {
   return 1;
 }
 
 void cras_system_set_suspended(int suspended) {}
 
+void cras_shm_pool_remove_client(unsigned int client_id) {}
+
 int stream_list_rm_all_client_streams(struct stream_list* list,
                                       struct cras_rclient* rclient) {
   return 0;
@@ -0,0 +1,251 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <math.h>
+#include <stdint.h>
+
+extern "C" {
+#include "polyphase_resampler.h"
+}
+
+namespace {
+
+#define BUF_FRAMES 4800
+
+static float in_buf[BUF_FRAMES * 2];
+static float out_buf[BUF_FRAMES * 2];
+static int16_t in_s16[BUF_FRAMES * 2];
+static int16_t out_s16[BUF_FRAMES * 2];
+
+TEST(PolyphaseResampler, UnsupportedRatio) {
+  // 48000 -> 44101 reduces to 48000/44101, far too many phases.
+  EXPECT_EQ(NULL, polyphase_resampler_create(2, 48000, 44101, 32));
+  EXPECT_EQ(NULL, polyphase_resampler_create(2, 44100, 48000, 12));
+  EXPECT_EQ(NULL, polyphase_resampler_create(0, 44100, 48000, 32));
+}
+
+TEST(PolyphaseResampler, Delay) {
+  struct polyphase_resampler* pr;
+
+  // Half the taps, less the half coefficient of the even length filter.
+  pr = polyphase_resampler_create(2, 44100, 48000, 32);
+  ASSERT_NE((void*)NULL, pr);
+  EXPECT_EQ(15, polyphase_resampler_get_delay(pr));
+  polyphase_resampler_destroy(pr);
+
+  // Decimating by 3 widens the filter to 3 * 64 taps.
+  pr = polyphase_resampler_create(1, 48000, 16000, 64);
+  ASSERT_NE((void*)NULL, pr);
+  EXPECT_EQ(95, polyphase_resampler_get_delay(pr));
+  polyphase_resampler_destroy(pr);
+}
+
+static void ExpectOutputCount(unsigned int src_rate, unsigned int dst_rate) {
+  struct polyphase_resampler* pr;
+  unsigned int in_frames, out_frames;
+  unsigned int total_in = 0, total_out = 0;
+  int i;
+
+  pr = polyphase_resampler_create(2, src_rate, dst_rate, 32);
+  ASSERT_NE((void*)NULL, pr);
+
+  // Feed one second in 10ms blocks with plenty of output room.
+  for (i = 0; i < 100; i++) {
+    in_frames = src_rate / 100;
+    out_frames = BUF_FRAMES;
+    polyphase_resampler_process_float(pr, in_buf, &in_frames, out_buf,
+                                      &out_frames);
+    EXPECT_EQ(src_rate / 100, in_frames);
+    total_in += in_frames;
+    total_out += out_frames;
+  }
+  EXPECT_EQ(src_rate, total_in);
+  EXPECT_NEAR(dst_rate, total_out, 1);
+
+  polyphase_resampler_destroy(pr);
+}
+
+TEST(PolyphaseResampler, OutputCount44100To48000) {
+  ExpectOutputCount(44100, 48000);
+}
+
+TEST(PolyphaseResampler, OutputCount16000To48000) {
+  ExpectOutputCount(16000, 48000);
+}
+
+TEST(PolyphaseResampler, OutputCount48000To16000) {
+  ExpectOutputCount(48000, 16000);
+}
+
+TEST(PolyphaseResampler, ConsumesOnlyNeededInput) {
+  struct polyphase_resampler* pr;
+  unsigned int in_frames = 480, out_frames = 10;
+
+  pr = polyphase_resampler_create(2, 16000, 48000, 32);
+  ASSERT_NE((void*)NULL, pr);
+  polyphase_resampler_process_float(pr, in_buf, &in_frames, out_buf,
+                                    &out_frames);
+  EXPECT_EQ(10, out_frames);
+  EXPECT_LE(in_frames, 4);
+  polyphase_resampler_destroy(pr);
+}
+
+TEST(PolyphaseResampler, ResetStartsFromSilence) {
+  struct polyphase_resampler* pr;
+  unsigned int in_frames, out_frames, first_out;
+  unsigned int i;
+
+  for (i = 0; i < 480; i++)
+    in_buf[i] = (i % 16) / 16.0f;
+
+  pr = polyphase_resampler_create(1, 16000, 48000, 32);
+  ASSERT_NE((void*)NULL, pr);
+  in_frames = 480;
+  out_frames = BUF_FRAMES;
+  polyphase_resampler_process_float(pr, in_buf, &in_frames, out_buf,
+                                    &out_frames);
+  first_out = out_frames;
+
+  // Same input after a reset gives the same output as the first run.
+  polyphase_resampler_reset(pr);
+  in_frames = 480;
+  out_frames = BUF_FRAMES;
+  polyphase_resampler_process_float(pr, in_buf, &in_frames,
+                                    out_buf + BUF_FRAMES, &out_frames);
+  ASSERT_EQ(first_out, out_frames);
+  for (i = 0; i < out_frames; i++)
+    EXPECT_FLOAT_EQ(out_buf[i], out_buf[BUF_FRAMES + i]);
+
+  polyphase_resampler_destroy(pr);
+}
+
+TEST(PolyphaseResampler, SineAccuracy) {
+  struct polyphase_resampler* pr;
+  unsigned int in_frames = 4410, out_frames = BUF_FRAMES;
+  unsigned int i;
+  double sin_dot = 0, cos_dot = 0, err = 0;
+
+  for (i = 0; i < in_frames; i++) {
+    in_buf[2 * i] = sinf(2 * M_PI * 1000 * i / 44100.0f) * 0.5f;
+    in_buf[2 * i + 1] = -in_buf[2 * i];
+  }
+
+  pr = polyphase_resampler_create(2, 44100, 48000, 32);
+  ASSERT_NE((void*)NULL, pr);
+  polyphase_resampler_process_float(pr, in_buf, &in_frames, out_buf,
+                                    &out_frames);
+  EXPECT_EQ(4410, in_frames);
+  ASSERT_GT(out_frames, 4000);
+
+  // The filter delay is fractional at the output rate, so fit a 1kHz sine
+  // of unknown phase over whole periods and check the residual.
+  for (i = 960; i < 2880; i++) {
+    double w = 2 * M_PI * 1000 * i / 48000.0;
+    sin_dot += out_buf[2 * i] * sin(w);
+    cos_dot += out_buf[2 * i] * cos(w);
+  }
+  sin_dot /= 960;
+  cos_dot /= 960;
+  for (i = 960; i < 2880; i++) {
+    double w = 2 * M_PI * 1000 * i / 48000.0;
+    double ref = sin_dot * sin(w) + cos_dot * cos(w);
+    err = fmax(err, fabs(out_buf[2 * i] - ref));
+  }
+  EXPECT_NEAR(0.5, sqrt(sin_dot * sin_dot + cos_dot * cos_dot), 0.01);
+  EXPECT_LT(err, 0.005);
+  for (i = 1000; i < 3000; i++)
+    EXPECT_FLOAT_EQ(-out_buf[2 * i], out_buf[2 * i + 1]);
+
+  polyphase_resampler_destroy(pr);
+}
+
+TEST(PolyphaseResampler, DriftStretchesRatio) {
+  struct polyphase_resampler* pr;
+  unsigned int in_frames, out_frames, total_out = 0;
+  unsigned int i;
+  double sin_dot = 0, cos_dot = 0, err = 0;
+
+  for (i = 0; i < 4410; i++) {
+    in_buf[2 * i] = sinf(2 * M_PI * 1000 * i / 44100.0f) * 0.5f;
+    in_buf[2 * i + 1] = 0;
+  }
+
+  // The output is consumed 1% fast, so a 1kHz sine comes out at 1000/1.01
+  // cycles per 48000 frames, from taps between the phases of the bank.
+  pr = polyphase_resampler_create(2, 44100, 48000, 32);
+  ASSERT_NE((void*)NULL, pr);
+  polyphase_resampler_set_drift(pr, 48000, 48480);
+  for (i = 0; i < 8; i++) {
+    in_frames = 441;
+    out_frames = BUF_FRAMES - total_out;
+    polyphase_resampler_process_float(pr, in_buf + 2 * 441 * i, &in_frames,
+                                      out_buf + 2 * total_out, &out_frames);
+    EXPECT_EQ(441, in_frames);
+    total_out += out_frames;
+  }
+  EXPECT_NEAR(441 * 8 * 48480 / 44100, total_out, 1);
+
+  for (i = 960; i < 2880; i++) {
+    double w = 2 * M_PI * 1000 * i / 48480.0;
+    sin_dot += out_buf[2 * i] * sin(w);
+    cos_dot += out_buf[2 * i] * cos(w);
+  }
+  sin_dot /= 960;
+  cos_dot /= 960;
+  for (i = 960; i < 2880; i++) {
+    double w = 2 * M_PI * 1000 * i / 48480.0;
+    double ref = sin_dot * sin(w) + cos_dot * cos(w);
+    err = fmax(err, fabs(out_buf[2 * i] - ref));
+  }
+  EXPECT_NEAR(0.5, sqrt(sin_dot * sin_dot + cos_dot * cos_dot), 0.01);
+  EXPECT_LT(err, 0.005);
+
+  // Back at the nominal ratio the bank is used as is.
+  polyphase_resampler_set_drift(pr, 48000, 48000);
+  polyphase_resampler_reset(pr);
+  in_frames = 441;
+  out_frames = BUF_FRAMES;
+  polyphase_resampler_process_float(pr, in_buf, &in_frames, out_buf,
+                                    &out_frames);
+  EXPECT_NEAR(480, out_frames, 1);
+
+  polyphase_resampler_destroy(pr);
+}
+
+TEST(PolyphaseResampler, S16Clips) {
+  struct polyphase_resampler* pr;
+  unsigned int in_frames = 480, out_frames = BUF_FRAMES;
+  unsigned int i;
+
+  // Full scale square wave overshoots after filtering.
+  for (i = 0; i < in_frames; i++) {
+    in_s16[2 * i] = (i / 8) % 2 ? INT16_MAX : INT16_MIN;
+    in_s16[2 * i + 1] = 0;
+  }
+
+  pr = polyphase_resampler_create(2, 16000, 48000, 32);
+  ASSERT_NE((void*)NULL, pr);
+  polyphase_resampler_process_s16(pr, in_s16, &in_frames, out_s16,
+                                  &out_frames);
+  EXPECT_EQ(480, in_frames);
+  EXPECT_GT(out_frames, 1400);
+  int16_t max = 0, min = 0;
+  for (i = 0; i < out_frames; i++) {
+    max = std::max(max, out_s16[2 * i]);
+    min = std::min(min, out_s16[2 * i]);
+    EXPECT_EQ(0, out_s16[2 * i + 1]);
+  }
+  EXPECT_EQ(INT16_MAX, max);
+  EXPECT_EQ(INT16_MIN, min);
+
+  polyphase_resampler_destroy(pr);
+}
+
+}  //  namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <gtest/gtest.h>
+#include <math.h>
 
 extern "C" {
 #include "rate_estimator.h"
@@ -176,6 +177,130 @@ TEST(RateEstimatorTest, EstimateInputLinear2) {
   rate_estimator_destroy(re);
 }
 
+// Plays to a simulated output device running off the nominal rate, the way
+// the audio thread does: wakes every 10ms with some jitter, reads a hardware
+// pointer that moves in bursts of 1ms, and tops the buffer up.
+class FakeOutput {
+ public:
+  FakeOutput(struct rate_estimator* re, double rate, unsigned int seed)
+      : re_(re), rate_(rate), seed_(seed) {}
+
+  // Advances to the next wake. Returns what rate_estimator_check returned.
+  int Wake() {
+    int level, rc;
+    struct timespec ts;
+    double dt;
+
+    seed_ = seed_ * 1103515245 + 12345;
+    dt = 0.009 + ((seed_ >> 16) % 2000) / 1000000.0;
+    now_ += dt;
+    consumed_ += rate_ * dt;
+    level = written_ - (long)(consumed_ / kBurst) * kBurst + level_error_;
+    level_error_ = 0;
+
+    ts.tv_sec = (time_t)now_;
+    ts.tv_nsec = (long)((now_ - ts.tv_sec) * 1000000000);
+    rc = rate_estimator_check(re_, level, &ts);
+    if (level < kTargetLevel) {
+      rate_estimator_add_frames(re_, kTargetLevel - level);
+      written_ += kTargetLevel - level;
+    }
+    return rc;
+  }
+
+  // Wakes until the estimator updates its rate, and returns how long it took.
+  double WakeUntilUpdate() {
+    double start = now_;
+    while (!Wake())
+      ;
+    return now_ - start;
+  }
+
+  // The device drops frames, e.g. on a USB hiccup.
+  void Skip(int frames) { consumed_ += frames; }
+  // The next read of the hardware pointer is off.
+  void MisreadLevel(int frames) { level_error_ = frames; }
+
+ private:
+  static const int kBurst = 48;
+  static const int kTargetLevel = 4800;
+  struct rate_estimator* re_;
+  double rate_;
+  double now_ = 1.0;
+  double consumed_ = 0;
+  long written_ = 0;
+  int level_error_ = 0;
+  unsigned int seed_;
+};
+
+// A device 40 ppm off 48kHz, estimated the way CRAS does.
+static const double kSkewedRate = 48000 * 1.00004;
+static struct timespec cras_window = {.tv_sec = 5, .tv_nsec = 0};
+static const int kNumTraces = 50;
+
+// Returns the RMS error of the first estimate over kNumTraces traces, with
+// `glitch` applied to each after `glitch_wakes` wakes.
+static double FirstEstimateError(int glitch_wakes,
+                                 void (*glitch)(FakeOutput* dev)) {
+  double sum = 0;
+  int seed, i;
+
+  for (seed = 1; seed <= kNumTraces; seed++) {
+    struct rate_estimator* re = rate_estimator_create(48000, &cras_window, 0);
+    FakeOutput dev(re, kSkewedRate, seed);
+
+    dev.Wake();
+    for (i = 0; i < glitch_wakes; i++)
+      dev.Wake();
+    glitch(&dev);
+    dev.WakeUntilUpdate();
+    sum += pow(rate_estimator_get_rate(re) - kSkewedRate, 2);
+    rate_estimator_destroy(re);
+  }
+  return sqrt(sum / kNumTraces);
+}
+
+TEST(RateEstimatorTest, TraceConverges) {
+  EXPECT_GT(0.6, FirstEstimateError(0, [](FakeOutput* dev) {}));
+}
+
+// A level read 700 frames off starts a new segment of the window for the
+// read, and another one after it.
+TEST(RateEstimatorTest, TraceRejectsMisreadLevel) {
+  EXPECT_GT(1.2, FirstEstimateError(
+                     100, [](FakeOutput* dev) { dev->MisreadLevel(-700); }));
+}
+
+TEST(RateEstimatorTest, TraceSkipsDroppedFrames) {
+  EXPECT_GT(1.2,
+            FirstEstimateError(250, [](FakeOutput* dev) { dev->Skip(480); }));
+}
+
+TEST(RateEstimatorTest, TraceRelocksAfterReset) {
+  struct rate_estimator* re = rate_estimator_create(48000, &cras_window, 0.3);
+  FakeOutput dev(re, kSkewedRate, 1);
+  double locked;
+
+  dev.Wake();
+  dev.WakeUntilUpdate();
+  dev.WakeUntilUpdate();
+  locked = rate_estimator_get_rate(re);
+  ASSERT_NEAR(kSkewedRate, locked, 0.6);
+
+  // E.g. on an underrun. A quarter window confirming the earlier estimate
+  // restores it.
+  rate_estimator_reset_rate(re, 48000);
+  EXPECT_EQ(48000, rate_estimator_get_rate(re));
+  dev.Wake();
+  EXPECT_GT(1.5, dev.WakeUntilUpdate());
+  EXPECT_DOUBLE_EQ(locked, rate_estimator_get_rate(re));
+
+  // Then back to full windows.
+  EXPECT_LE(5.0, dev.WakeUntilUpdate());
+
+  rate_estimator_destroy(re);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
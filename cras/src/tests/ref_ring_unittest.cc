@@ -0,0 +1,108 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "cras_ref_ring.h"
+}
+
+namespace {
+
+static const unsigned int kFrameBytes = 4;
+
+class RefRingTestSuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    for (unsigned int i = 0; i < 64; i++)
+      frames_[i] = i;
+    ring_ = cras_ref_ring_create(8 * kFrameBytes);
+    ASSERT_NE((void*)NULL, ring_);
+  }
+
+  virtual void TearDown() { cras_ref_ring_destroy(ring_); }
+
+  uint32_t frames_[64];
+  struct cras_ref_ring* ring_;
+};
+
+TEST(RefRingTest, CreateInvalid) {
+  EXPECT_EQ(NULL, cras_ref_ring_create(0));
+}
+
+TEST_F(RefRingTestSuite, ReadersKeepTheirOwnOffsets) {
+  uint64_t first = cras_ref_ring_write_pos(ring_);
+  uint64_t second;
+  const uint32_t* p;
+  unsigned int n;
+
+  cras_ref_ring_write(ring_, (uint8_t*)frames_, 3, kFrameBytes);
+  second = cras_ref_ring_write_pos(ring_);
+  cras_ref_ring_write(ring_, (uint8_t*)&frames_[3], 2, kFrameBytes);
+
+  EXPECT_EQ(5, cras_ref_ring_readable(ring_, &first));
+  EXPECT_EQ(2, cras_ref_ring_readable(ring_, &second));
+
+  n = 8;
+  p = (const uint32_t*)cras_ref_ring_read_pointer(ring_, first, &n);
+  EXPECT_EQ(5, n);
+  EXPECT_EQ(0, p[0]);
+  EXPECT_EQ(4, p[4]);
+
+  n = 8;
+  p = (const uint32_t*)cras_ref_ring_read_pointer(ring_, second, &n);
+  EXPECT_EQ(2, n);
+  EXPECT_EQ(3, p[0]);
+}
+
+TEST_F(RefRingTestSuite, ContiguousReadStopsAtWrap) {
+  uint64_t offset = 6;
+  const uint32_t* p;
+  unsigned int n = 8;
+
+  cras_ref_ring_write(ring_, (uint8_t*)frames_, 10, kFrameBytes);
+  EXPECT_EQ(4, cras_ref_ring_readable(ring_, &offset));
+  p = (const uint32_t*)cras_ref_ring_read_pointer(ring_, offset, &n);
+  EXPECT_EQ(2, n);
+  EXPECT_EQ(6, p[0]);
+  EXPECT_EQ(7, p[1]);
+
+  offset += n;
+  n = 8;
+  p = (const uint32_t*)cras_ref_ring_read_pointer(ring_, offset, &n);
+  EXPECT_EQ(2, n);
+  EXPECT_EQ(8, p[0]);
+  EXPECT_EQ(9, p[1]);
+}
+
+TEST_F(RefRingTestSuite, SlowReaderSkipsOverwrittenFrames) {
+  uint64_t offset = cras_ref_ring_write_pos(ring_);
+  const uint32_t* p;
+  unsigned int n = 8;
+
+  // Only the latest 8 frames are kept.
+  cras_ref_ring_write(ring_, (uint8_t*)frames_, 20, kFrameBytes);
+  EXPECT_EQ(20, cras_ref_ring_write_pos(ring_));
+  EXPECT_EQ(8, cras_ref_ring_readable(ring_, &offset));
+  EXPECT_EQ(12, offset);
+  p = (const uint32_t*)cras_ref_ring_read_pointer(ring_, offset, &n);
+  EXPECT_EQ(4, n);
+  EXPECT_EQ(12, p[0]);
+}
+
+TEST_F(RefRingTestSuite, FrameSizeChangeDropsOldFrames) {
+  uint64_t offset = 0;
+
+  cras_ref_ring_write(ring_, (uint8_t*)frames_, 4, kFrameBytes);
+  cras_ref_ring_write(ring_, (uint8_t*)frames_, 2, 2 * kFrameBytes);
+  EXPECT_EQ(2, cras_ref_ring_readable(ring_, &offset));
+  EXPECT_EQ(4, offset);
+}
+
+}  //  namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
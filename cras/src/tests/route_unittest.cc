@@ -0,0 +1,165 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+
+extern "C" {
+#include "cras_route.h"
+}
+
+namespace {
+
+static const unsigned int kLatency = 8;
+static const unsigned int kBlock = 4;
+
+class RouteTestSuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    fmt_.format = SND_PCM_FORMAT_S16_LE;
+    fmt_.frame_rate = 48000;
+    fmt_.num_channels = 1;
+    for (unsigned int i = 0; i < 64; i++)
+      frames_[i] = i + 1;
+    route_ = cras_route_create(3, &fmt_, kLatency, kBlock);
+    ASSERT_NE((void*)NULL, route_);
+  }
+
+  virtual void TearDown() { cras_route_put(route_); }
+
+  unsigned int Write(unsigned int first, unsigned int n) {
+    return cras_route_write(route_, (uint8_t*)&frames_[first], n);
+  }
+
+  unsigned int Read(unsigned int n) {
+    return cras_route_read(route_, (uint8_t*)out_, n);
+  }
+
+  struct cras_audio_format fmt_;
+  int16_t frames_[64];
+  int16_t out_[64];
+  struct cras_route* route_;
+};
+
+TEST(RouteTest, CreateInvalid) {
+  struct cras_audio_format fmt = {SND_PCM_FORMAT_S16_LE, 48000, 2};
+
+  EXPECT_EQ(NULL, cras_route_create(1, &fmt, 480, 0));
+}
+
+TEST_F(RouteTestSuite, HoldsUntilLatencyQueued) {
+  EXPECT_EQ(3, cras_route_id(route_));
+
+  EXPECT_EQ(kBlock, Write(0, kBlock));
+  out_[0] = -1;
+  EXPECT_EQ(0, Read(kBlock));
+  EXPECT_EQ(0, out_[0]);
+  EXPECT_EQ(kBlock, cras_route_queued(route_));
+
+  EXPECT_EQ(kBlock, Write(kBlock, kBlock));
+  EXPECT_EQ(kBlock, Read(kBlock));
+  for (unsigned int i = 0; i < kBlock; i++)
+    EXPECT_EQ(i + 1, out_[i]);
+  EXPECT_EQ(0, cras_route_num_underruns(route_));
+}
+
+TEST_F(RouteTestSuite, UnderrunPrimesAgain) {
+  Write(0, kLatency);
+  EXPECT_EQ(kLatency, Read(kLatency));
+
+  // Runs dry with half a block, the rest is silence.
+  Write(kLatency, 2);
+  EXPECT_EQ(2, Read(kBlock));
+  EXPECT_EQ(kLatency + 1, out_[0]);
+  EXPECT_EQ(kLatency + 2, out_[1]);
+  EXPECT_EQ(0, out_[2]);
+  EXPECT_EQ(0, out_[3]);
+  EXPECT_EQ(1, cras_route_num_underruns(route_));
+
+  // Silent until the latency is queued again.
+  Write(0, kBlock);
+  EXPECT_EQ(0, Read(kBlock));
+  Write(kBlock, kBlock);
+  EXPECT_EQ(kBlock, Read(kBlock));
+  EXPECT_EQ(1, out_[0]);
+}
+
+TEST_F(RouteTestSuite, OverrunDropsNewFrames) {
+  unsigned int size = kLatency + 4 * kBlock;
+
+  EXPECT_EQ(size, Write(0, size + 2));
+  EXPECT_EQ(1, cras_route_num_overruns(route_));
+  EXPECT_EQ(size, cras_route_queued(route_));
+}
+
+TEST_F(RouteTestSuite, DriftTrimsToLatency) {
+  Write(0, kLatency);
+  EXPECT_EQ(kBlock, Read(kBlock));
+
+  // A faster capture clock queues more than two blocks over the latency,
+  // the oldest frames are skipped.
+  Write(kLatency, 3 * kBlock + 1);
+  EXPECT_EQ(17, cras_route_queued(route_));
+  EXPECT_EQ(kBlock, Read(kBlock));
+  EXPECT_EQ(14, out_[0]);
+  EXPECT_EQ(kLatency - kBlock, cras_route_queued(route_));
+}
+
+TEST_F(RouteTestSuite, WrapsAround) {
+  int16_t expect = 1;
+
+  // The ring holds 24 frames, 62 go through it.
+  Write(0, kLatency);
+  for (unsigned int n = 0; n < 18; n++) {
+    Write(kLatency + 3 * n, 3);
+    ASSERT_EQ(3, Read(3));
+    for (unsigned int i = 0; i < 3; i++)
+      EXPECT_EQ(expect++, out_[i]);
+  }
+  EXPECT_EQ(kLatency, cras_route_queued(route_));
+  EXPECT_EQ(0, cras_route_num_underruns(route_));
+}
+
+// The writer thread queues blocks counting up from one.
+static void* WriteBlocks(void* arg) {
+  struct cras_route* route = (struct cras_route*)arg;
+  int16_t block[kBlock];
+  int16_t v = 1;
+  unsigned int n = 0;
+
+  while (n < 500) {
+    if (cras_route_queued(route) > kLatency)
+      continue;
+    for (unsigned int i = 0; i < kBlock; i++)
+      block[i] = v++;
+    cras_route_write(route, (uint8_t*)block, kBlock);
+    n++;
+  }
+  return NULL;
+}
+
+TEST_F(RouteTestSuite, ReadWhileWriting) {
+  int16_t last = 0;
+  unsigned int got;
+  pthread_t tid;
+
+  pthread_create(&tid, NULL, WriteBlocks, route_);
+  while (last < (int)(500 * kBlock)) {
+    got = Read(kBlock);
+    // What was taken follows on from the last frame, in order.
+    for (unsigned int i = 0; i < got; i++) {
+      ASSERT_EQ(last + 1, out_[i]);
+      last = out_[i];
+    }
+  }
+  pthread_join(tid, NULL);
+  EXPECT_EQ(0, cras_route_num_overruns(route_));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -84,6 +84,11 @@ int cras_rstream_get_mute(const struct cras_rstream* rstream) {
   return 0;
 }
 
+void cras_rstream_tap_frames(struct cras_rstream* rstream,
+                             const uint8_t* frames,
+                             unsigned int nframes,
+                             const struct cras_audio_format* fmt) {}
+
 uint8_t* cras_rstream_get_readable_frames(struct cras_rstream* rstream,
                                           unsigned int offset,
                                           size_t* frames) {
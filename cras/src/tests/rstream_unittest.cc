@@ -12,8 +12,10 @@
 extern "C" {
 #include "cras_audio_area.h"
 #include "cras_messages.h"
+#include "cras_route.h"
 #include "cras_rstream.h"
 #include "cras_shm.h"
+#include "cras_shm_pool.h"
 }
 
 #include "metrics_stub.h"
@@ -40,6 +42,10 @@ class RstreamTestSuite : public testing::Test {
     config_.cb_threshold = 2048;
     config_.client_shm_size = 0;
     config_.client_shm_fd = -1;
+    config_.num_shm_buffers = 0;
+    config_.scheduled_ts.tv_sec = 0;
+    config_.scheduled_ts.tv_nsec = 0;
+    config_.pre_roll_frames = 0;
 
     // Create a socket pair because it will be used in rstream.
     rc = socketpair(AF_UNIX, SOCK_STREAM, 0, sock);
@@ -48,6 +54,7 @@ class RstreamTestSuite : public testing::Test {
     client_fd_ = sock[0];
 
     config_.client = NULL;
+    config_.route = NULL;
   }
 
   virtual void TearDown() {
@@ -89,6 +96,56 @@ TEST_F(RstreamTestSuite, InvalidDirection) {
   EXPECT_NE(0, rc);
 }
 
+TEST_F(RstreamTestSuite, DeepBufferInputInvalid) {
+  struct cras_rstream* s;
+  int rc;
+
+  config_.direction = CRAS_STREAM_INPUT;
+  config_.flags = DEEP_BUFFER;
+  rc = cras_rstream_create(&config_, &s);
+  EXPECT_EQ(-EINVAL, rc);
+}
+
+TEST_F(RstreamTestSuite, ScheduledStartInputInvalid) {
+  struct cras_rstream* s;
+  int rc;
+
+  config_.direction = CRAS_STREAM_INPUT;
+  config_.scheduled_ts.tv_sec = 10;
+  rc = cras_rstream_create(&config_, &s);
+  EXPECT_EQ(-EINVAL, rc);
+}
+
+TEST_F(RstreamTestSuite, PreRollInvalid) {
+  struct cras_rstream* s;
+  int rc;
+
+  // Only input streams start with past frames, no more than they hold.
+  config_.pre_roll_frames = 480;
+  rc = cras_rstream_create(&config_, &s);
+  EXPECT_EQ(-EINVAL, rc);
+
+  config_.direction = CRAS_STREAM_INPUT;
+  config_.pre_roll_frames = config_.buffer_frames + 1;
+  rc = cras_rstream_create(&config_, &s);
+  EXPECT_EQ(-EINVAL, rc);
+
+  config_.pre_roll_frames = config_.buffer_frames;
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+  EXPECT_EQ(config_.buffer_frames, s->pre_roll_frames);
+  cras_rstream_destroy(s);
+}
+
+TEST_F(RstreamTestSuite, VadGatedOutputInvalid) {
+  struct cras_rstream* s;
+  int rc;
+
+  config_.flags = VAD_GATED;
+  rc = cras_rstream_create(&config_, &s);
+  EXPECT_EQ(-EINVAL, rc);
+}
+
 TEST_F(RstreamTestSuite, InvalidStreamType) {
   struct cras_rstream* s;
   int rc;
@@ -198,6 +255,77 @@ TEST_F(RstreamTestSuite, CreateInput) {
   cras_rstream_destroy(s);
 }
 
+TEST_F(RstreamTestSuite, CreateFloatOutput) {
+  struct cras_rstream* s;
+  struct cras_audio_format fmt_ret;
+  int rc;
+
+  fmt_.format = SND_PCM_FORMAT_FLOAT_LE;
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+  rc = cras_rstream_get_format(s, &fmt_ret);
+  EXPECT_EQ(0, rc);
+  EXPECT_TRUE(format_equal(&fmt_ret, &fmt_));
+  // Four bytes per sample doubles the ring of the S16 stream.
+  EXPECT_EQ(65536, cras_shm_samples_size(cras_rstream_shm(s)));
+
+  cras_rstream_destroy(s);
+}
+
+TEST_F(RstreamTestSuite, CreateWithDeeperRing) {
+  struct cras_rstream* s;
+  struct cras_audio_shm* shm_ret;
+  int rc;
+
+  config_.num_shm_buffers = 4;
+  rc = cras_rstream_create(&config_, &s);
+  EXPECT_EQ(0, rc);
+  shm_ret = cras_rstream_shm(s);
+  ASSERT_NE((void*)NULL, shm_ret);
+  EXPECT_EQ(4, cras_shm_num_buffers(shm_ret));
+  EXPECT_EQ(4 * 16384, cras_shm_samples_size(shm_ret));
+  EXPECT_EQ(3 * 16384, shm_ret->header->buffer_offset[3]);
+  EXPECT_EQ(4, shm_ret->header->config.num_buffers);
+  EXPECT_TRUE(cras_shm_layout_supported(shm_ret));
+  cras_rstream_destroy(s);
+}
+
+TEST_F(RstreamTestSuite, ReuseShmOfDestroyedStream) {
+  struct cras_rstream* s;
+  struct cras_audio_shm* shm;
+  int sock[2] = {-1, -1};
+
+  ASSERT_EQ(0, cras_rstream_create(&config_, &s));
+  shm = cras_rstream_shm(s);
+  shm->header->write_buf_idx = 1;
+  cras_rstream_destroy(s);
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sock));
+  config_.audio_fd = sock[1];
+  close(sock[0]);
+  config_.stream_id = 556;
+  ASSERT_EQ(0, cras_rstream_create(&config_, &s));
+  EXPECT_EQ(shm, cras_rstream_shm(s));
+  EXPECT_EQ(0, shm->header->write_buf_idx);
+  EXPECT_EQ(16384, cras_shm_used_size(shm));
+  cras_rstream_destroy(s);
+
+  cras_shm_pool_remove_client(0);
+}
+
+TEST_F(RstreamTestSuite, InvalidNumShmBuffers) {
+  struct cras_rstream* s;
+  int rc;
+
+  config_.num_shm_buffers = 3;
+  rc = cras_rstream_create(&config_, &s);
+  EXPECT_NE(0, rc);
+
+  config_.num_shm_buffers = CRAS_MAX_SHM_BUFFERS * 2;
+  rc = cras_rstream_create(&config_, &s);
+  EXPECT_NE(0, rc);
+}
+
 TEST_F(RstreamTestSuite, VerifyStreamTypes) {
   struct cras_rstream* s;
   int rc;
@@ -252,6 +380,40 @@ TEST_F(RstreamTestSuite, OutputStreamIsPendingReply) {
   cras_rstream_destroy(s);
 }
 
+TEST_F(RstreamTestSuite, FetchLeadFollowsReplyTime) {
+  struct cras_rstream* s;
+  struct timespec ts = {1, 0};
+  long lead_ns;
+  int rc;
+
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+  EXPECT_EQ(0, s->fetch_lead.tv_sec);
+  EXPECT_EQ(0, s->fetch_lead.tv_nsec);
+  // Set by the device the stream attaches to.
+  cras_frames_to_time(2048, 48000, &s->sleep_interval_ts);
+
+  // The client hasn't replied 5ms after the fetch.
+  cras_rstream_request_audio(s, &ts);
+  ts.tv_nsec = 5000000;
+  cras_rstream_record_fetch_interval(s, &ts);
+  EXPECT_EQ(0, s->fetch_lead.tv_sec);
+  EXPECT_EQ(5000000, s->fetch_lead.tv_nsec);
+
+  // Capped to half of the 2048 frames callback interval at 48kHz.
+  ts.tv_nsec = 50000000;
+  cras_rstream_record_fetch_interval(s, &ts);
+  EXPECT_EQ(0, s->fetch_lead.tv_sec);
+  lead_ns = s->sleep_interval_ts.tv_nsec / 2;
+  EXPECT_EQ(lead_ns, s->fetch_lead.tv_nsec);
+
+  // Shrinks by a 16th on every fetch.
+  cras_rstream_request_audio(s, &ts);
+  EXPECT_EQ(lead_ns - lead_ns / 16, s->fetch_lead.tv_nsec);
+
+  cras_rstream_destroy(s);
+}
+
 TEST_F(RstreamTestSuite, OutputStreamFlushMessages) {
   struct cras_rstream* s;
   int rc;
@@ -343,6 +505,160 @@ TEST_F(RstreamTestSuite, InputStreamFlushMessages) {
   cras_rstream_destroy(s);
 }
 
+TEST_F(RstreamTestSuite, OutputStreamShmWake) {
+  struct cras_rstream* s;
+  struct audio_message aud_msg;
+  int rc;
+  struct timespec ts;
+  uint32_t seq;
+
+  config_.flags = SHM_WAKE;
+  rc = cras_rstream_create(&config_, &s);
+  EXPECT_EQ(0, rc);
+  EXPECT_TRUE(cras_rstream_uses_shm_wake(s));
+  seq = cras_shm_wake_seq(s->shm);
+
+  // The request is only signalled through the shm.
+  rc = cras_rstream_request_audio(s, &ts);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, cras_rstream_is_pending_reply(s));
+  EXPECT_EQ(seq + 1, cras_shm_wake_seq(s->shm));
+  EXPECT_EQ(config_.cb_threshold, s->shm->header->wake_frames);
+  rc = recv(client_fd_, &aud_msg, sizeof(aud_msg), MSG_DONTWAIT);
+  EXPECT_EQ(-1, rc);
+
+  // Client replies by clearing the pending callback.
+  cras_shm_complete_callback(s->shm);
+  EXPECT_EQ(0, cras_rstream_flush_old_audio_messages(s));
+  EXPECT_EQ(0, cras_rstream_is_pending_reply(s));
+
+  cras_rstream_destroy(s);
+}
+
+TEST_F(RstreamTestSuite, InputStreamShmWake) {
+  struct cras_rstream* s;
+  int rc;
+  uint32_t seq;
+
+  config_.direction = CRAS_STREAM_INPUT;
+  config_.flags = SHM_WAKE;
+  rc = cras_rstream_create(&config_, &s);
+  EXPECT_EQ(0, rc);
+  seq = cras_shm_wake_seq(s->shm);
+
+  rc = cras_rstream_audio_ready(s, 10);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, cras_rstream_is_pending_reply(s));
+  EXPECT_EQ(seq + 1, cras_shm_wake_seq(s->shm));
+  EXPECT_EQ(10, s->shm->header->wake_frames);
+
+  cras_rstream_destroy(s);
+}
+
+TEST_F(RstreamTestSuite, ServerOnlyStreamIgnoresShmWake) {
+  struct cras_rstream* s;
+  int rc;
+
+  config_.flags = SHM_WAKE | SERVER_ONLY;
+  rc = cras_rstream_create(&config_, &s);
+  EXPECT_EQ(0, rc);
+  EXPECT_FALSE(cras_rstream_uses_shm_wake(s));
+  cras_rstream_destroy(s);
+}
+
+TEST_F(RstreamTestSuite, RoutedStreamsPassFrames) {
+  struct cras_rstream *in, *out;
+  struct cras_route* route;
+  struct timespec now = {1, 0};
+  int16_t* buf;
+  int rc;
+
+  route = cras_route_create(1, &fmt_, 0, 480);
+  ASSERT_NE((void*)NULL, route);
+  config_.route = route;
+  config_.flags = SERVER_ONLY;
+  config_.buffer_frames = 960;
+  config_.cb_threshold = 480;
+  rc = cras_rstream_create(&config_, &out);
+  ASSERT_EQ(0, rc);
+  config_.direction = CRAS_STREAM_INPUT;
+  config_.buffer_frames = 480;
+  rc = cras_rstream_create(&config_, &in);
+  ASSERT_EQ(0, rc);
+  cras_route_put(route);
+
+  // The audio thread captured a block into the input stream.
+  buf = (int16_t*)cras_shm_get_write_buffer_base(in->shm);
+  buf[0] = 7;
+  buf[959] = 9;
+  cras_shm_buffer_written(in->shm, 480);
+  EXPECT_EQ(0, cras_rstream_audio_ready(in, 480));
+  EXPECT_EQ(0, cras_shm_get_frames(in->shm));
+  EXPECT_EQ(480, cras_route_queued(route));
+
+  // Fetching the output stream fills it from the route, no client asked.
+  EXPECT_EQ(0, cras_rstream_request_audio(out, &now));
+  EXPECT_EQ(0, cras_rstream_is_pending_reply(out));
+  EXPECT_EQ(480, cras_shm_get_frames(out->shm));
+  buf = (int16_t*)cras_shm_get_read_buffer_base(out->shm);
+  EXPECT_EQ(7, buf[0]);
+  EXPECT_EQ(9, buf[959]);
+  EXPECT_EQ(0, cras_route_queued(route));
+
+  // The streams hold the route until the last of them goes.
+  cras_rstream_destroy(in);
+  cras_rstream_destroy(out);
+}
+
+struct tap_call {
+  const uint8_t* frames;
+  unsigned int nframes;
+  unsigned int num_called;
+};
+
+static int tap_hook(const uint8_t* frames,
+                    unsigned int nframes,
+                    const struct cras_audio_format* fmt,
+                    void* cb_data) {
+  struct tap_call* call = (struct tap_call*)cb_data;
+
+  call->frames = frames;
+  call->nframes = nframes;
+  call->num_called++;
+  return nframes;
+}
+
+TEST_F(RstreamTestSuite, StreamTaps) {
+  struct cras_rstream* s;
+  struct tap_call a = {}, b = {};
+  uint8_t frames[16];
+  int rc;
+
+  rc = cras_rstream_create(&config_, &s);
+  EXPECT_EQ(0, rc);
+
+  // Nothing to do without taps.
+  cras_rstream_tap_frames(s, frames, 4, &fmt_);
+
+  EXPECT_EQ(0, cras_rstream_add_tap(s, tap_hook, &a));
+  EXPECT_EQ(-EEXIST, cras_rstream_add_tap(s, tap_hook, &a));
+  EXPECT_EQ(0, cras_rstream_add_tap(s, tap_hook, &b));
+  cras_rstream_tap_frames(s, frames, 4, &fmt_);
+  EXPECT_EQ(1, a.num_called);
+  EXPECT_EQ(frames, a.frames);
+  EXPECT_EQ(4, a.nframes);
+  EXPECT_EQ(1, b.num_called);
+
+  cras_rstream_rm_tap(s, &a);
+  cras_rstream_tap_frames(s, frames, 2, &fmt_);
+  EXPECT_EQ(1, a.num_called);
+  EXPECT_EQ(2, b.num_called);
+  EXPECT_EQ(2, b.nframes);
+
+  // The remaining tap is freed with the stream.
+  cras_rstream_destroy(s);
+}
+
 }  //  namespace
 
 int main(int argc, char** argv) {
@@ -390,10 +706,12 @@ unsigned int buffer_share_id_offset(const struct buffer_share* mix,
                                     unsigned int id) {
   return 0;
 }
-void ewma_power_init(struct ewma_power* ewma, unsigned int rate) {}
+void ewma_power_init(struct ewma_power* ewma,
+                     snd_pcm_format_t format,
+                     unsigned int rate) {}
 
 void ewma_power_calculate(struct ewma_power* ewma,
-                          const int16_t* buf,
+                          const uint8_t* buf,
                           unsigned int channels,
                           unsigned int size) {}
 
@@ -417,6 +735,8 @@ int cras_server_metrics_stream_destroy(const struct cras_rstream* stream) {
 struct cras_apm_list* cras_apm_list_create(void* stream_ptr, uint64_t effects) {
   return NULL;
 }
+void cras_apm_list_set_background(struct cras_apm_list* list,
+                                  bool background) {}
 struct cras_apm* cras_apm_list_get_active_apm(void* stream_ptr, void* dev_ptr) {
   return FAKE_CRAS_APM_PTR;
 }
@@ -0,0 +1,266 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+extern "C" {
+#include "cras_audio_area.h"
+#include "cras_iodev.h"
+#include "cras_rtp_iodev.h"
+#include "rtp.h"
+}
+
+static struct timespec clock_gettime_retspec;
+static struct cras_audio_format fake_format;
+static cras_audio_area mock_audio_area;
+static uint8_t* config_buf_pointers_base;
+static unsigned int iodev_list_add_output_called;
+static unsigned int iodev_list_add_input_called;
+static int rate_estimator_check_ret;
+static double rate_estimator_get_rate_ret;
+
+namespace {
+
+class RtpIodevTest : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    socklen_t len = sizeof(addr_);
+
+    clock_gettime_retspec.tv_sec = 1;
+    clock_gettime_retspec.tv_nsec = 0;
+    fake_format.format = SND_PCM_FORMAT_S16_LE;
+    fake_format.frame_rate = 48000;
+    fake_format.num_channels = 2;
+    iodev_list_add_output_called = 0;
+    iodev_list_add_input_called = 0;
+    rate_estimator_check_ret = 0;
+    rate_estimator_get_rate_ret = 48000;
+
+    // A socket on a free port of the loopback interface.
+    memset(&addr_, 0, sizeof(addr_));
+    addr_.sin_family = AF_INET;
+    addr_.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+    ASSERT_LE(0, fd_);
+    ASSERT_EQ(0, bind(fd_, (struct sockaddr*)&addr_, sizeof(addr_)));
+    ASSERT_EQ(0, getsockname(fd_, (struct sockaddr*)&addr_, &len));
+  }
+
+  virtual void TearDown() {
+    if (fd_ >= 0)
+      close(fd_);
+  }
+
+  void Advance(long nsec) {
+    clock_gettime_retspec.tv_nsec += nsec;
+  }
+
+  // Sends 240 frames from the socket, each sample holding its timestamp.
+  void SendPacket(uint32_t ts) {
+    uint8_t packet[sizeof(struct rtp_header) + 960];
+    struct rtp_header* header = (struct rtp_header*)packet;
+    uint16_t* samples = (uint16_t*)(packet + sizeof(*header));
+
+    memset(packet, 0, sizeof(packet));
+    header->v = 2;
+    header->pt = 96;
+    header->timestamp = htonl(ts);
+    for (int i = 0; i < 480; i++)
+      samples[i] = htons(ts + i / 2);
+    ASSERT_EQ(sizeof(packet),
+              sendto(fd_, packet, sizeof(packet), 0,
+                     (struct sockaddr*)&addr_, sizeof(addr_)));
+  }
+
+  struct sockaddr_in addr_;
+  int fd_;
+};
+
+TEST_F(RtpIodevTest, OutputSendsPacketsInNetworkOrder) {
+  struct cras_iodev* iodev;
+  struct timespec ts;
+  cras_audio_area* area;
+  unsigned nframes;
+  uint8_t packet[1500];
+  struct rtp_header* header = (struct rtp_header*)packet;
+  uint8_t* payload = packet + sizeof(*header);
+
+  iodev = rtp_iodev_create(CRAS_STREAM_OUTPUT, (struct sockaddr*)&addr_,
+                           sizeof(addr_));
+  ASSERT_NE((void*)NULL, iodev);
+  EXPECT_EQ(1, iodev_list_add_output_called);
+  iodev->format = &fake_format;
+  ASSERT_EQ(0, iodev->configure_dev(iodev));
+
+  nframes = 600;
+  iodev->get_buffer(iodev, &area, &nframes);
+  ASSERT_EQ(600, nframes);
+  for (int i = 0; i < 1200; i++)
+    ((int16_t*)config_buf_pointers_base)[i] = i;
+  ASSERT_EQ(0, iodev->put_buffer(iodev, nframes));
+  EXPECT_EQ(600, iodev->frames_queued(iodev, &ts));
+
+  // Two full packets are sent, the last 120 frames wait for the next one.
+  for (int p = 0; p < 2; p++) {
+    ASSERT_EQ(sizeof(*header) + 960,
+              recv(fd_, packet, sizeof(packet), MSG_DONTWAIT));
+    EXPECT_EQ(2, header->v);
+    EXPECT_EQ(96, header->pt);
+    EXPECT_EQ(p, ntohs(header->sequence_number));
+    EXPECT_EQ(p * 240, ntohl(header->timestamp));
+    EXPECT_EQ((p * 480) >> 8, payload[0]);
+    EXPECT_EQ((p * 480) & 0xff, payload[1]);
+    EXPECT_EQ((p * 480 + 1) & 0xff, payload[3]);
+  }
+  EXPECT_GT(0, recv(fd_, packet, sizeof(packet), MSG_DONTWAIT));
+
+  Advance(5000000);
+  EXPECT_EQ(360, iodev->frames_queued(iodev, &ts));
+
+  iodev->close_dev(iodev);
+  rtp_iodev_destroy(iodev);
+}
+
+TEST_F(RtpIodevTest, InputJitterBufferFollowsSender) {
+  struct cras_iodev* iodev;
+  struct timespec ts;
+  cras_audio_area* area;
+  unsigned nframes;
+  int16_t* buf;
+
+  // The device receives on the port of the socket, which sends to itself.
+  close(fd_);
+  iodev = rtp_iodev_create(CRAS_STREAM_INPUT, (struct sockaddr*)&addr_,
+                           sizeof(addr_));
+  ASSERT_NE((void*)NULL, iodev);
+  EXPECT_EQ(1, iodev_list_add_input_called);
+  iodev->format = &fake_format;
+  ASSERT_EQ(0, iodev->configure_dev(iodev));
+  fd_ = socket(AF_INET, SOCK_DGRAM, 0);
+  ASSERT_LE(0, fd_);
+
+  // Capture waits for 20ms of audio, whatever order it arrives in.
+  SendPacket(1000);
+  SendPacket(1480);
+  EXPECT_EQ(0, iodev->frames_queued(iodev, &ts));
+  SendPacket(1240);
+  SendPacket(1720);
+  EXPECT_EQ(0, iodev->frames_queued(iodev, &ts));
+
+  Advance(5000000);
+  ASSERT_EQ(240, iodev->frames_queued(iodev, &ts));
+  nframes = 300;
+  iodev->get_buffer(iodev, &area, &nframes);
+  ASSERT_EQ(240, nframes);
+  buf = (int16_t*)config_buf_pointers_base;
+  for (int i = 0; i < 480; i++)
+    ASSERT_EQ(1000 + i / 2, buf[i]);
+  ASSERT_EQ(0, iodev->put_buffer(iodev, nframes));
+  EXPECT_EQ(0, iodev->frames_queued(iodev, &ts));
+
+  // Capture follows the rate the sender is estimated to run at.
+  rate_estimator_check_ret = 1;
+  rate_estimator_get_rate_ret = 48480;
+  EXPECT_EQ(0, iodev->frames_queued(iodev, &ts));
+  Advance(10000000);
+  EXPECT_EQ(484, iodev->frames_queued(iodev, &ts));
+  nframes = 484;
+  iodev->get_buffer(iodev, &area, &nframes);
+  ASSERT_EQ(484, nframes);
+  buf = (int16_t*)config_buf_pointers_base;
+  for (int i = 0; i < 968; i++)
+    ASSERT_EQ(1240 + i / 2, buf[i]);
+
+  iodev->close_dev(iodev);
+  rtp_iodev_destroy(iodev);
+}
+
+}  // namespace
+
+extern "C" {
+
+int cras_iodev_default_no_stream_playback(struct cras_iodev* odev, int enable) {
+  return 0;
+}
+
+void cras_iodev_init_audio_area(struct cras_iodev* iodev, int num_channels) {
+  iodev->area = &mock_audio_area;
+}
+
+void cras_iodev_free_audio_area(struct cras_iodev* iodev) {}
+
+void cras_audio_area_config_buf_pointers(struct cras_audio_area* area,
+                                         const struct cras_audio_format* fmt,
+                                         uint8_t* base_buffer) {
+  config_buf_pointers_base = base_buffer;
+}
+
+int cras_iodev_list_add_output(struct cras_iodev* output) {
+  iodev_list_add_output_called++;
+  return 0;
+}
+
+int cras_iodev_list_add_input(struct cras_iodev* input) {
+  iodev_list_add_input_called++;
+  return 0;
+}
+
+int cras_iodev_list_rm_input(struct cras_iodev* input) {
+  return 0;
+}
+
+int cras_iodev_list_rm_output(struct cras_iodev* output) {
+  return 0;
+}
+
+void cras_iodev_free_resources(struct cras_iodev* iodev) {}
+
+void cras_iodev_add_node(struct cras_iodev* iodev, struct cras_ionode* node) {
+  iodev->nodes = node;
+}
+
+void cras_iodev_set_active_node(struct cras_iodev* iodev,
+                                struct cras_ionode* node) {
+  iodev->active_node = node;
+}
+
+struct rate_estimator* rate_estimator_create(unsigned int rate,
+                                             const struct timespec* window_size,
+                                             double smooth_factor) {
+  return reinterpret_cast<struct rate_estimator*>(0x1);
+}
+
+void rate_estimator_destroy(struct rate_estimator* re) {}
+
+void rate_estimator_add_frames(struct rate_estimator* re, int fr) {}
+
+int32_t rate_estimator_check(struct rate_estimator* re,
+                             int level,
+                             const struct timespec* now) {
+  return rate_estimator_check_ret;
+}
+
+double rate_estimator_get_rate(const struct rate_estimator* re) {
+  return rate_estimator_get_rate_ret;
+}
+
+void rate_estimator_reset_rate(struct rate_estimator* re, unsigned int rate) {}
+
+//  From librt.
+int clock_gettime(clockid_t clk_id, struct timespec* tp) {
+  tp->tv_sec = clock_gettime_retspec.tv_sec;
+  tp->tv_nsec = clock_gettime_retspec.tv_nsec;
+  return 0;
+}
+
+}  // extern "C"
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
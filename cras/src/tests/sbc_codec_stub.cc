@@ -28,6 +28,7 @@ static size_t encode_out_encoded_return_val;
 static int encode_fail;
 static int cras_sbc_get_frame_length_val;
 static int cras_sbc_get_codesize_val;
+static uint8_t set_bitpool_val;
 
 };  // namespace
 
@@ -51,6 +52,7 @@ void sbc_codec_stub_reset() {
 
   cras_sbc_get_frame_length_val = 5;
   cras_sbc_get_codesize_val = 5;
+  set_bitpool_val = 0;
 }
 
 void set_sbc_codec_create_fail(int fail) {
@@ -93,6 +95,14 @@ int get_sbc_codec_destroy_called() {
   return destroy_called;
 }
 
+uint8_t get_sbc_set_bitpool_val() {
+  return set_bitpool_val;
+}
+
+void set_sbc_codec_frame_length(int frame_length) {
+  cras_sbc_get_frame_length_val = frame_length;
+}
+
 void set_sbc_codec_decoded_out(size_t ret) {
   decode_out_decoded_return_val = ret;
 }
@@ -172,3 +182,7 @@ int cras_sbc_get_codesize(struct cras_audio_codec* codec) {
 int cras_sbc_get_frame_length(struct cras_audio_codec* codec) {
   return cras_sbc_get_frame_length_val;
 }
+
+void cras_sbc_set_bitpool(struct cras_audio_codec* codec, uint8_t bitpool) {
+  set_bitpool_val = bitpool;
+}
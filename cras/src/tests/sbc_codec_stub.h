@@ -20,6 +20,8 @@ uint8_t get_sbc_codec_create_alloc_val();
 uint8_t get_sbc_codec_create_blocks_val();
 uint8_t get_sbc_codec_create_bitpool_val();
 int get_sbc_codec_destroy_called();
+uint8_t get_sbc_set_bitpool_val();
+void set_sbc_codec_frame_length(int frame_length);
 void set_sbc_codec_decoded_out(size_t ret);
 void set_sbc_codec_decoded_fail(int fail);
 void set_sbc_codec_encoded_out(size_t ret);
@@ -35,5 +37,6 @@ struct cras_audio_codec* cras_msbc_codec_create();
 void cras_sbc_codec_destroy(struct cras_audio_codec* codec);
 int cras_sbc_get_codesize(struct cras_audio_codec* codec);
 int cras_sbc_get_frame_length(struct cras_audio_codec* codec);
+void cras_sbc_set_bitpool(struct cras_audio_codec* codec, uint8_t bitpool);
 
 #endif  // SBC_CODEC_STUB_H_
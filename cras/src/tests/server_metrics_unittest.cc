@@ -5,21 +5,28 @@
 #include <gtest/gtest.h>
 #include <stdio.h>
 
+#include <string>
 #include <vector>
 
 extern "C" {
-#include "cras_main_message.h"
 #include "cras_rstream.h"
 #include "cras_server_metrics.c"
 }
 
-static enum CRAS_MAIN_MESSAGE_TYPE type_set;
+struct HistogramSample {
+  std::string name;
+  int sample;
+  int nbuckets;
+  unsigned int count;
+};
+
 static struct timespec clock_gettime_retspec;
-std::vector<struct cras_server_metrics_message> sent_msgs;
+std::vector<HistogramSample> sent_samples;
 
 void ResetStubData() {
-  type_set = (enum CRAS_MAIN_MESSAGE_TYPE)0;
-  sent_msgs.clear();
+  pending->num = 0;
+  num_dropped = 0;
+  sent_samples.clear();
 }
 
 namespace {
@@ -27,9 +34,71 @@ namespace {
 TEST(ServerMetricsTestSuite, Init) {
   ResetStubData();
 
-  cras_server_metrics_init();
+  EXPECT_EQ(0, cras_server_metrics_init());
+  EXPECT_EQ(1, metrics_thread_started);
+
+  cras_server_metrics_deinit();
+  EXPECT_EQ(0, metrics_thread_started);
+}
+
+TEST(ServerMetricsTestSuite, HistogramBucketMin) {
+  // Buckets of (1, 10000, 20) start at 0, 1, 2, 3, 5, 8, ..., 785, 1306,
+  // 2172, 3613, 6011 and 10000.
+  EXPECT_EQ(0, histogram_bucket_min(0, 1, 10000, 20));
+  EXPECT_EQ(0, histogram_bucket_min(-5, 1, 10000, 20));
+  EXPECT_EQ(1, histogram_bucket_min(1, 1, 10000, 20));
+  EXPECT_EQ(3, histogram_bucket_min(4, 1, 10000, 20));
+  EXPECT_EQ(785, histogram_bucket_min(785, 1, 10000, 20));
+  EXPECT_EQ(785, histogram_bucket_min(1000, 1, 10000, 20));
+  EXPECT_EQ(785, histogram_bucket_min(1305, 1, 10000, 20));
+  EXPECT_EQ(1306, histogram_bucket_min(1306, 1, 10000, 20));
+  EXPECT_EQ(10000, histogram_bucket_min(10000, 1, 10000, 20));
+  EXPECT_EQ(10000, histogram_bucket_min(90000, 1, 10000, 20));
+
+  // A minimum of 0 is the same as 1.
+  EXPECT_EQ(785, histogram_bucket_min(1000, 0, 10000, 20));
+}
+
+TEST(ServerMetricsTestSuite, FlushAccumulatesSamples) {
+  ResetStubData();
+
+  cras_server_metrics_highest_hw_level(1000, CRAS_STREAM_INPUT);
+  cras_server_metrics_highest_hw_level(1200, CRAS_STREAM_INPUT);
+  cras_server_metrics_highest_hw_level(1000, CRAS_STREAM_INPUT);
+  cras_server_metrics_highest_hw_level(5000, CRAS_STREAM_INPUT);
+  cras_server_metrics_hfp_battery_report(2);
+  cras_server_metrics_hfp_battery_report(2);
+  EXPECT_EQ(pending->num, 6);
+
+  flush_metrics();
+
+  EXPECT_EQ(0, queues[0].num);
+  EXPECT_EQ(0, queues[1].num);
+  ASSERT_EQ(3, sent_samples.size());
+  EXPECT_EQ(kHighestInputHardwareLevel, sent_samples[0].name);
+  EXPECT_EQ(785, sent_samples[0].sample);
+  EXPECT_EQ(20, sent_samples[0].nbuckets);
+  EXPECT_EQ(3, sent_samples[0].count);
+  EXPECT_EQ(kHighestInputHardwareLevel, sent_samples[1].name);
+  EXPECT_EQ(3613, sent_samples[1].sample);
+  EXPECT_EQ(1, sent_samples[1].count);
+  EXPECT_EQ(kHfpBatteryReport, sent_samples[2].name);
+  EXPECT_EQ(2, sent_samples[2].sample);
+  EXPECT_EQ(0, sent_samples[2].nbuckets);
+  EXPECT_EQ(2, sent_samples[2].count);
+}
+
+TEST(ServerMetricsTestSuite, QueueFull) {
+  ResetStubData();
+
+  for (int i = 0; i < METRICS_QUEUE_SIZE; i++)
+    EXPECT_EQ(0, cras_server_metrics_busyloop_length(i));
+  EXPECT_EQ(-ENOSPC, cras_server_metrics_busyloop_length(5));
+  EXPECT_EQ(1, num_dropped);
 
-  EXPECT_EQ(type_set, CRAS_MAIN_METRICS);
+  flush_metrics();
+  EXPECT_EQ(0, num_dropped);
+  EXPECT_EQ(0, cras_server_metrics_busyloop_length(5));
 }
 
 TEST(ServerMetricsTestSuite, SetMetricsDeviceRuntime) {
@@ -48,16 +117,13 @@ TEST(ServerMetricsTestSuite, SetMetricsDeviceRuntime) {
 
   cras_server_metrics_device_runtime(&iodev);
 
-  EXPECT_EQ(sent_msgs.size(), 1);
-  EXPECT_EQ(sent_msgs[0].header.type, CRAS_MAIN_METRICS);
-  EXPECT_EQ(sent_msgs[0].header.length,
-            sizeof(struct cras_server_metrics_message));
-  EXPECT_EQ(sent_msgs[0].metrics_type, DEVICE_RUNTIME);
-  EXPECT_EQ(sent_msgs[0].data.device_data.type, CRAS_METRICS_DEVICE_USB);
-  EXPECT_EQ(sent_msgs[0].data.device_data.direction, CRAS_STREAM_INPUT);
-  EXPECT_EQ(sent_msgs[0].data.device_data.runtime.tv_sec, 100);
+  EXPECT_EQ(pending->num, 1);
+  EXPECT_EQ(pending->msgs[0].metrics_type, DEVICE_RUNTIME);
+  EXPECT_EQ(pending->msgs[0].data.device_data.type, CRAS_METRICS_DEVICE_USB);
+  EXPECT_EQ(pending->msgs[0].data.device_data.direction, CRAS_STREAM_INPUT);
+  EXPECT_EQ(pending->msgs[0].data.device_data.runtime.tv_sec, 100);
 
-  sent_msgs.clear();
+  pending->num = 0;
 
   clock_gettime_retspec.tv_sec = 300;
   clock_gettime_retspec.tv_nsec = 0;
@@ -69,14 +135,11 @@ TEST(ServerMetricsTestSuite, SetMetricsDeviceRuntime) {
 
   cras_server_metrics_device_runtime(&iodev);
 
-  EXPECT_EQ(sent_msgs.size(), 1);
-  EXPECT_EQ(sent_msgs[0].header.type, CRAS_MAIN_METRICS);
-  EXPECT_EQ(sent_msgs[0].header.length,
-            sizeof(struct cras_server_metrics_message));
-  EXPECT_EQ(sent_msgs[0].metrics_type, DEVICE_RUNTIME);
-  EXPECT_EQ(sent_msgs[0].data.device_data.type, CRAS_METRICS_DEVICE_HEADPHONE);
-  EXPECT_EQ(sent_msgs[0].data.device_data.direction, CRAS_STREAM_OUTPUT);
-  EXPECT_EQ(sent_msgs[0].data.device_data.runtime.tv_sec, 200);
+  EXPECT_EQ(pending->num, 1);
+  EXPECT_EQ(pending->msgs[0].metrics_type, DEVICE_RUNTIME);
+  EXPECT_EQ(pending->msgs[0].data.device_data.type, CRAS_METRICS_DEVICE_HEADPHONE);
+  EXPECT_EQ(pending->msgs[0].data.device_data.direction, CRAS_STREAM_OUTPUT);
+  EXPECT_EQ(pending->msgs[0].data.device_data.runtime.tv_sec, 200);
 }
 
 TEST(ServerMetricsTestSuite, SetMetricsHighestDeviceDelay) {
@@ -87,24 +150,18 @@ TEST(ServerMetricsTestSuite, SetMetricsHighestDeviceDelay) {
   cras_server_metrics_highest_device_delay(hw_level, largest_cb_level,
                                            CRAS_STREAM_INPUT);
 
-  EXPECT_EQ(sent_msgs.size(), 1);
-  EXPECT_EQ(sent_msgs[0].header.type, CRAS_MAIN_METRICS);
-  EXPECT_EQ(sent_msgs[0].header.length,
-            sizeof(struct cras_server_metrics_message));
-  EXPECT_EQ(sent_msgs[0].metrics_type, HIGHEST_DEVICE_DELAY_INPUT);
-  EXPECT_EQ(sent_msgs[0].data.value, 2000);
+  EXPECT_EQ(pending->num, 1);
+  EXPECT_EQ(pending->msgs[0].metrics_type, HIGHEST_DEVICE_DELAY_INPUT);
+  EXPECT_EQ(pending->msgs[0].data.value, 2000);
 
-  sent_msgs.clear();
+  pending->num = 0;
 
   cras_server_metrics_highest_device_delay(hw_level, largest_cb_level,
                                            CRAS_STREAM_OUTPUT);
 
-  EXPECT_EQ(sent_msgs.size(), 1);
-  EXPECT_EQ(sent_msgs[0].header.type, CRAS_MAIN_METRICS);
-  EXPECT_EQ(sent_msgs[0].header.length,
-            sizeof(struct cras_server_metrics_message));
-  EXPECT_EQ(sent_msgs[0].metrics_type, HIGHEST_DEVICE_DELAY_OUTPUT);
-  EXPECT_EQ(sent_msgs[0].data.value, 2000);
+  EXPECT_EQ(pending->num, 1);
+  EXPECT_EQ(pending->msgs[0].metrics_type, HIGHEST_DEVICE_DELAY_OUTPUT);
+  EXPECT_EQ(pending->msgs[0].data.value, 2000);
 }
 
 TEST(ServerMetricsTestSuite, SetMetricHighestHardwareLevel) {
@@ -113,23 +170,17 @@ TEST(ServerMetricsTestSuite, SetMetricHighestHardwareLevel) {
 
   cras_server_metrics_highest_hw_level(hw_level, CRAS_STREAM_INPUT);
 
-  EXPECT_EQ(sent_msgs.size(), 1);
-  EXPECT_EQ(sent_msgs[0].header.type, CRAS_MAIN_METRICS);
-  EXPECT_EQ(sent_msgs[0].header.length,
-            sizeof(struct cras_server_metrics_message));
-  EXPECT_EQ(sent_msgs[0].metrics_type, HIGHEST_INPUT_HW_LEVEL);
-  EXPECT_EQ(sent_msgs[0].data.value, hw_level);
+  EXPECT_EQ(pending->num, 1);
+  EXPECT_EQ(pending->msgs[0].metrics_type, HIGHEST_INPUT_HW_LEVEL);
+  EXPECT_EQ(pending->msgs[0].data.value, hw_level);
 
-  sent_msgs.clear();
+  pending->num = 0;
 
   cras_server_metrics_highest_hw_level(hw_level, CRAS_STREAM_OUTPUT);
 
-  EXPECT_EQ(sent_msgs.size(), 1);
-  EXPECT_EQ(sent_msgs[0].header.type, CRAS_MAIN_METRICS);
-  EXPECT_EQ(sent_msgs[0].header.length,
-            sizeof(struct cras_server_metrics_message));
-  EXPECT_EQ(sent_msgs[0].metrics_type, HIGHEST_OUTPUT_HW_LEVEL);
-  EXPECT_EQ(sent_msgs[0].data.value, hw_level);
+  EXPECT_EQ(pending->num, 1);
+  EXPECT_EQ(pending->msgs[0].metrics_type, HIGHEST_OUTPUT_HW_LEVEL);
+  EXPECT_EQ(pending->msgs[0].data.value, hw_level);
 }
 
 TEST(ServerMetricsTestSuite, SetMetricsLongestFetchDelay) {
@@ -138,12 +189,9 @@ TEST(ServerMetricsTestSuite, SetMetricsLongestFetchDelay) {
 
   cras_server_metrics_longest_fetch_delay(delay);
 
-  EXPECT_EQ(sent_msgs.size(), 1);
-  EXPECT_EQ(sent_msgs[0].header.type, CRAS_MAIN_METRICS);
-  EXPECT_EQ(sent_msgs[0].header.length,
-            sizeof(struct cras_server_metrics_message));
-  EXPECT_EQ(sent_msgs[0].metrics_type, LONGEST_FETCH_DELAY);
-  EXPECT_EQ(sent_msgs[0].data.value, delay);
+  EXPECT_EQ(pending->num, 1);
+  EXPECT_EQ(pending->msgs[0].metrics_type, LONGEST_FETCH_DELAY);
+  EXPECT_EQ(pending->msgs[0].data.value, delay);
 }
 
 TEST(ServerMetricsTestSuite, SetMetricsNumUnderruns) {
@@ -152,12 +200,9 @@ TEST(ServerMetricsTestSuite, SetMetricsNumUnderruns) {
 
   cras_server_metrics_num_underruns(underrun);
 
-  EXPECT_EQ(sent_msgs.size(), 1);
-  EXPECT_EQ(sent_msgs[0].header.type, CRAS_MAIN_METRICS);
-  EXPECT_EQ(sent_msgs[0].header.length,
-            sizeof(struct cras_server_metrics_message));
-  EXPECT_EQ(sent_msgs[0].metrics_type, NUM_UNDERRUNS);
-  EXPECT_EQ(sent_msgs[0].data.value, underrun);
+  EXPECT_EQ(pending->num, 1);
+  EXPECT_EQ(pending->msgs[0].metrics_type, NUM_UNDERRUNS);
+  EXPECT_EQ(pending->msgs[0].data.value, underrun);
 }
 
 TEST(ServerMetricsTestSuite, SetMetricsMissedCallbackEventInputStream) {
@@ -176,12 +221,9 @@ TEST(ServerMetricsTestSuite, SetMetricsMissedCallbackEventInputStream) {
   cras_server_metrics_missed_cb_event(&stream);
 
   subtract_timespecs(&clock_gettime_retspec, &stream.start_ts, &diff_ts);
-  EXPECT_EQ(sent_msgs.size(), 1);
-  EXPECT_EQ(sent_msgs[0].header.type, CRAS_MAIN_METRICS);
-  EXPECT_EQ(sent_msgs[0].header.length,
-            sizeof(struct cras_server_metrics_message));
-  EXPECT_EQ(sent_msgs[0].metrics_type, MISSED_CB_FIRST_TIME_INPUT);
-  EXPECT_EQ(sent_msgs[0].data.value, diff_ts.tv_sec);
+  EXPECT_EQ(pending->num, 1);
+  EXPECT_EQ(pending->msgs[0].metrics_type, MISSED_CB_FIRST_TIME_INPUT);
+  EXPECT_EQ(pending->msgs[0].data.value, diff_ts.tv_sec);
   EXPECT_EQ(stream.num_missed_cb, 1);
   EXPECT_EQ(stream.first_missed_cb_ts.tv_sec, clock_gettime_retspec.tv_sec);
   EXPECT_EQ(stream.first_missed_cb_ts.tv_nsec, clock_gettime_retspec.tv_nsec);
@@ -192,12 +234,9 @@ TEST(ServerMetricsTestSuite, SetMetricsMissedCallbackEventInputStream) {
 
   subtract_timespecs(&clock_gettime_retspec, &stream.first_missed_cb_ts,
                      &diff_ts);
-  EXPECT_EQ(sent_msgs.size(), 2);
-  EXPECT_EQ(sent_msgs[1].header.type, CRAS_MAIN_METRICS);
-  EXPECT_EQ(sent_msgs[1].header.length,
-            sizeof(struct cras_server_metrics_message));
-  EXPECT_EQ(sent_msgs[1].metrics_type, MISSED_CB_SECOND_TIME_INPUT);
-  EXPECT_EQ(sent_msgs[1].data.value, diff_ts.tv_sec);
+  EXPECT_EQ(pending->num, 2);
+  EXPECT_EQ(pending->msgs[1].metrics_type, MISSED_CB_SECOND_TIME_INPUT);
+  EXPECT_EQ(pending->msgs[1].data.value, diff_ts.tv_sec);
   EXPECT_EQ(stream.num_missed_cb, 2);
 }
 
@@ -217,12 +256,9 @@ TEST(ServerMetricsTestSuite, SetMetricsMissedCallbackEventOutputStream) {
   cras_server_metrics_missed_cb_event(&stream);
 
   subtract_timespecs(&clock_gettime_retspec, &stream.start_ts, &diff_ts);
-  EXPECT_EQ(sent_msgs.size(), 1);
-  EXPECT_EQ(sent_msgs[0].header.type, CRAS_MAIN_METRICS);
-  EXPECT_EQ(sent_msgs[0].header.length,
-            sizeof(struct cras_server_metrics_message));
-  EXPECT_EQ(sent_msgs[0].metrics_type, MISSED_CB_FIRST_TIME_OUTPUT);
-  EXPECT_EQ(sent_msgs[0].data.value, diff_ts.tv_sec);
+  EXPECT_EQ(pending->num, 1);
+  EXPECT_EQ(pending->msgs[0].metrics_type, MISSED_CB_FIRST_TIME_OUTPUT);
+  EXPECT_EQ(pending->msgs[0].data.value, diff_ts.tv_sec);
   EXPECT_EQ(stream.num_missed_cb, 1);
   EXPECT_EQ(stream.first_missed_cb_ts.tv_sec, clock_gettime_retspec.tv_sec);
   EXPECT_EQ(stream.first_missed_cb_ts.tv_nsec, clock_gettime_retspec.tv_nsec);
@@ -233,12 +269,9 @@ TEST(ServerMetricsTestSuite, SetMetricsMissedCallbackEventOutputStream) {
 
   subtract_timespecs(&clock_gettime_retspec, &stream.first_missed_cb_ts,
                      &diff_ts);
-  EXPECT_EQ(sent_msgs.size(), 2);
-  EXPECT_EQ(sent_msgs[1].header.type, CRAS_MAIN_METRICS);
-  EXPECT_EQ(sent_msgs[1].header.length,
-            sizeof(struct cras_server_metrics_message));
-  EXPECT_EQ(sent_msgs[1].metrics_type, MISSED_CB_SECOND_TIME_OUTPUT);
-  EXPECT_EQ(sent_msgs[1].data.value, diff_ts.tv_sec);
+  EXPECT_EQ(pending->num, 2);
+  EXPECT_EQ(pending->msgs[1].metrics_type, MISSED_CB_SECOND_TIME_OUTPUT);
+  EXPECT_EQ(pending->msgs[1].data.value, diff_ts.tv_sec);
   EXPECT_EQ(stream.num_missed_cb, 2);
 }
 
@@ -257,17 +290,14 @@ TEST(ServerMetricsTestSuite, SetMetricsStreamCreate) {
   cras_server_metrics_stream_create(&config);
 
   // Log stream config.
-  EXPECT_EQ(sent_msgs.size(), 1);
-  EXPECT_EQ(sent_msgs[0].header.type, CRAS_MAIN_METRICS);
-  EXPECT_EQ(sent_msgs[0].header.length,
-            sizeof(struct cras_server_metrics_message));
-  EXPECT_EQ(sent_msgs[0].metrics_type, STREAM_CONFIG);
-  EXPECT_EQ(sent_msgs[0].data.stream_config.direction, CRAS_STREAM_INPUT);
-  EXPECT_EQ(sent_msgs[0].data.stream_config.cb_threshold, 1024);
-  EXPECT_EQ(sent_msgs[0].data.stream_config.flags, BULK_AUDIO_OK);
-  EXPECT_EQ(sent_msgs[0].data.stream_config.format, SND_PCM_FORMAT_S16_LE);
-  EXPECT_EQ(sent_msgs[0].data.stream_config.rate, 48000);
-  EXPECT_EQ(sent_msgs[0].data.stream_config.client_type, CRAS_CLIENT_TYPE_TEST);
+  EXPECT_EQ(pending->num, 1);
+  EXPECT_EQ(pending->msgs[0].metrics_type, STREAM_CONFIG);
+  EXPECT_EQ(pending->msgs[0].data.stream_config.direction, CRAS_STREAM_INPUT);
+  EXPECT_EQ(pending->msgs[0].data.stream_config.cb_threshold, 1024);
+  EXPECT_EQ(pending->msgs[0].data.stream_config.flags, BULK_AUDIO_OK);
+  EXPECT_EQ(pending->msgs[0].data.stream_config.format, SND_PCM_FORMAT_S16_LE);
+  EXPECT_EQ(pending->msgs[0].data.stream_config.rate, 48000);
+  EXPECT_EQ(pending->msgs[0].data.stream_config.client_type, CRAS_CLIENT_TYPE_TEST);
 }
 
 TEST(ServerMetricsTestSuite, SetMetricsStreamDestroy) {
@@ -286,38 +316,36 @@ TEST(ServerMetricsTestSuite, SetMetricsStreamDestroy) {
 
   stream.direction = CRAS_STREAM_INPUT;
   stream.client_type = CRAS_CLIENT_TYPE_TEST;
+  stream.cost.convert_ns = 1000000000;
+  stream.cost.mix_ns = 500000000;
+  stream.cost.apm_ns = 500000000;
+  stream.cost.mem_bytes = 8192;
   cras_server_metrics_stream_destroy(&stream);
 
   subtract_timespecs(&clock_gettime_retspec, &stream.start_ts, &diff_ts);
-  EXPECT_EQ(sent_msgs.size(), 3);
+  EXPECT_EQ(pending->num, 3);
 
   // Log missed cb frequency.
-  EXPECT_EQ(sent_msgs[0].header.type, CRAS_MAIN_METRICS);
-  EXPECT_EQ(sent_msgs[0].header.length,
-            sizeof(struct cras_server_metrics_message));
-  EXPECT_EQ(sent_msgs[0].metrics_type, MISSED_CB_FREQUENCY_INPUT);
-  EXPECT_EQ(sent_msgs[0].data.value,
+  EXPECT_EQ(pending->msgs[0].metrics_type, MISSED_CB_FREQUENCY_INPUT);
+  EXPECT_EQ(pending->msgs[0].data.value,
             stream.num_missed_cb * 86400 / diff_ts.tv_sec);
 
   // Log missed cb frequency after rescheduling.
   subtract_timespecs(&clock_gettime_retspec, &stream.first_missed_cb_ts,
                      &diff_ts);
-  EXPECT_EQ(sent_msgs[1].header.type, CRAS_MAIN_METRICS);
-  EXPECT_EQ(sent_msgs[1].header.length,
-            sizeof(struct cras_server_metrics_message));
-  EXPECT_EQ(sent_msgs[1].metrics_type,
+  EXPECT_EQ(pending->msgs[1].metrics_type,
             MISSED_CB_FREQUENCY_AFTER_RESCHEDULING_INPUT);
-  EXPECT_EQ(sent_msgs[1].data.value,
+  EXPECT_EQ(pending->msgs[1].data.value,
             (stream.num_missed_cb - 1) * 86400 / diff_ts.tv_sec);
 
   // Log stream runtime.
-  EXPECT_EQ(sent_msgs[2].header.type, CRAS_MAIN_METRICS);
-  EXPECT_EQ(sent_msgs[2].header.length,
-            sizeof(struct cras_server_metrics_message));
-  EXPECT_EQ(sent_msgs[2].metrics_type, STREAM_RUNTIME);
-  EXPECT_EQ(sent_msgs[2].data.stream_data.type, CRAS_CLIENT_TYPE_TEST);
-  EXPECT_EQ(sent_msgs[2].data.stream_data.direction, CRAS_STREAM_INPUT);
-  EXPECT_EQ(sent_msgs[2].data.stream_data.runtime.tv_sec, 1000);
+  EXPECT_EQ(pending->msgs[2].metrics_type, STREAM_RUNTIME);
+  EXPECT_EQ(pending->msgs[2].data.stream_data.type, CRAS_CLIENT_TYPE_TEST);
+  EXPECT_EQ(pending->msgs[2].data.stream_data.direction, CRAS_STREAM_INPUT);
+  EXPECT_EQ(pending->msgs[2].data.stream_data.runtime.tv_sec, 1000);
+  // 2 seconds of processing over 1000 seconds of runtime.
+  EXPECT_EQ(pending->msgs[2].data.stream_data.cpu_permille, 2);
+  EXPECT_EQ(pending->msgs[2].data.stream_data.mem_kb, 8);
 }
 
 TEST(ServerMetricsTestSuite, SetMetricsBusyloop) {
@@ -327,14 +355,11 @@ TEST(ServerMetricsTestSuite, SetMetricsBusyloop) {
 
   cras_server_metrics_busyloop(&time, count);
 
-  EXPECT_EQ(sent_msgs.size(), 1);
-  EXPECT_EQ(sent_msgs[0].header.type, CRAS_MAIN_METRICS);
-  EXPECT_EQ(sent_msgs[0].header.length,
-            sizeof(struct cras_server_metrics_message));
-  EXPECT_EQ(sent_msgs[0].metrics_type, BUSYLOOP);
-  EXPECT_EQ(sent_msgs[0].data.timespec_data.runtime.tv_sec, 40);
-  EXPECT_EQ(sent_msgs[0].data.timespec_data.runtime.tv_nsec, 0);
-  EXPECT_EQ(sent_msgs[0].data.timespec_data.count, 3);
+  EXPECT_EQ(pending->num, 1);
+  EXPECT_EQ(pending->msgs[0].metrics_type, BUSYLOOP);
+  EXPECT_EQ(pending->msgs[0].data.timespec_data.runtime.tv_sec, 40);
+  EXPECT_EQ(pending->msgs[0].data.timespec_data.runtime.tv_nsec, 0);
+  EXPECT_EQ(pending->msgs[0].data.timespec_data.count, 3);
 }
 
 TEST(ServerMetricsTestSuite, SetMetricsBusyloopLength) {
@@ -343,40 +368,29 @@ TEST(ServerMetricsTestSuite, SetMetricsBusyloopLength) {
 
   cras_server_metrics_busyloop_length(length);
 
-  EXPECT_EQ(sent_msgs.size(), 1);
-  EXPECT_EQ(sent_msgs[0].header.type, CRAS_MAIN_METRICS);
-  EXPECT_EQ(sent_msgs[0].header.length,
-            sizeof(struct cras_server_metrics_message));
-  EXPECT_EQ(sent_msgs[0].metrics_type, BUSYLOOP_LENGTH);
-  EXPECT_EQ(sent_msgs[0].data.value, 5);
+  EXPECT_EQ(pending->num, 1);
+  EXPECT_EQ(pending->msgs[0].metrics_type, BUSYLOOP_LENGTH);
+  EXPECT_EQ(pending->msgs[0].data.value, 5);
 }
 
 extern "C" {
 
-int cras_main_message_add_handler(enum CRAS_MAIN_MESSAGE_TYPE type,
-                                  cras_message_callback callback,
-                                  void* callback_data) {
-  type_set = type;
-  return 0;
+void cras_metrics_log_histogram_repeated(const char* name,
+                                         int sample,
+                                         int min,
+                                         int max,
+                                         int nbuckets,
+                                         unsigned int count) {
+  sent_samples.push_back({name, sample, nbuckets, count});
 }
 
-void cras_metrics_log_histogram(const char* name,
-                                int sample,
-                                int min,
-                                int max,
-                                int nbuckets) {}
-
-void cras_metrics_log_sparse_histogram(const char* name, int sample) {}
-
-int cras_main_message_send(struct cras_main_message* msg) {
-  // Copy the sent message so we can examine it in the test later.
-  struct cras_server_metrics_message sent_msg;
-  memcpy(&sent_msg, msg, sizeof(sent_msg));
-  sent_msgs.push_back(sent_msg);
-  return 0;
+void cras_metrics_log_sparse_histogram_repeated(const char* name,
+                                                int sample,
+                                                unsigned int count) {
+  sent_samples.push_back({name, sample, 0, count});
 }
 
-int cras_system_state_in_main_thread() {
+int cras_set_nice_level(int nice) {
   return 0;
 }
 
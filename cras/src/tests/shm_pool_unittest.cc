@@ -0,0 +1,100 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+extern "C" {
+#include "cras_shm.h"
+#include "cras_shm_pool.h"
+}
+
+namespace {
+
+TEST(ShmPool, GetSealedArea) {
+  struct cras_audio_shm* shm;
+  long page_size = sysconf(_SC_PAGESIZE);
+  int seals;
+
+  ASSERT_EQ(0, cras_shm_pool_get(1, 100, PROT_WRITE, &shm));
+  EXPECT_EQ(page_size, cras_shm_samples_size(shm));
+  EXPECT_EQ(0, shm->header->write_buf_idx);
+
+  // Clients can't resize the area under the server.
+  seals = fcntl(shm->samples_info.fd, F_GET_SEALS);
+  EXPECT_EQ(F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL, seals);
+  EXPECT_NE(0, ftruncate(shm->samples_info.fd, 0));
+  EXPECT_NE(0, ftruncate(shm->header_info.fd, 0));
+  shm->samples[0] = 1;
+
+  cras_shm_pool_put(1, shm);
+  cras_shm_pool_remove_client(1);
+}
+
+TEST(ShmPool, ReuseFreedArea) {
+  struct cras_audio_shm *shm, *shm2;
+
+  ASSERT_EQ(0, cras_shm_pool_get(2, 4000, PROT_READ, &shm));
+  shm->header->write_buf_idx = 1;
+  cras_shm_pool_put(2, shm);
+
+  // Same bucket, the area comes back with a clean header.
+  ASSERT_EQ(0, cras_shm_pool_get(2, 3000, PROT_READ, &shm2));
+  EXPECT_EQ(shm, shm2);
+  EXPECT_EQ(0, shm2->header->write_buf_idx);
+  cras_shm_pool_put(2, shm2);
+
+  // Mapped differently or owned by another client.
+  ASSERT_EQ(0, cras_shm_pool_get(2, 3000, PROT_WRITE, &shm2));
+  EXPECT_NE(shm, shm2);
+  cras_shm_pool_put(2, shm2);
+  ASSERT_EQ(0, cras_shm_pool_get(3, 3000, PROT_READ, &shm2));
+  EXPECT_NE(shm, shm2);
+  cras_shm_pool_put(3, shm2);
+
+  cras_shm_pool_remove_client(2);
+  cras_shm_pool_remove_client(3);
+}
+
+TEST(ShmPool, LimitFreeAreas) {
+  struct cras_audio_shm* shms[CRAS_SHM_POOL_MAX_FREE + 1];
+  struct cras_audio_shm* shm;
+  int i;
+
+  for (i = 0; i <= CRAS_SHM_POOL_MAX_FREE; i++)
+    ASSERT_EQ(0, cras_shm_pool_get(4, 100, PROT_READ, &shms[i]));
+  for (i = 0; i <= CRAS_SHM_POOL_MAX_FREE; i++)
+    cras_shm_pool_put(4, shms[i]);
+
+  // The oldest area was dropped, the others are reused.
+  for (i = 1; i <= CRAS_SHM_POOL_MAX_FREE; i++) {
+    ASSERT_EQ(0, cras_shm_pool_get(4, 100, PROT_READ, &shm));
+    EXPECT_EQ(shms[i], shm);
+  }
+  for (i = 1; i <= CRAS_SHM_POOL_MAX_FREE; i++)
+    cras_shm_pool_put(4, shms[i]);
+  cras_shm_pool_remove_client(4);
+}
+
+TEST(ShmPool, PutAfterClientRemoved) {
+  struct cras_audio_shm *shm, *shm2;
+
+  ASSERT_EQ(0, cras_shm_pool_get(5, 100, PROT_READ, &shm));
+  cras_shm_pool_remove_client(5);
+
+  // Destroyed rather than kept for a client that is gone.
+  cras_shm_pool_put(5, shm);
+  ASSERT_EQ(0, cras_shm_pool_get(5, 100, PROT_READ, &shm2));
+  cras_shm_pool_put(5, shm2);
+  cras_shm_pool_remove_client(5);
+}
+
+}  //  namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -564,6 +564,81 @@ TEST_F(ShmTestSuite, GetCheckedWriteOffset) {
   }
 }
 
+// Test a four deep ring can be queued ahead and read back across buffers.
+TEST_F(ShmTestSuite, FourBufferRing) {
+  uint32_t frame_bytes = cras_shm_frame_bytes(&shm_);
+  uint32_t used_frames = 64;
+
+  cras_shm_set_num_buffers(&shm_, 4);
+  cras_shm_set_used_size(&shm_, used_frames * frame_bytes);
+  EXPECT_EQ(4, cras_shm_num_buffers(&shm_));
+  EXPECT_EQ(3 * used_frames * frame_bytes, shm_.header->buffer_offset[3]);
+  EXPECT_TRUE(cras_shm_layout_supported(&shm_));
+
+  // Queue three periods in a row.
+  for (unsigned int i = 0; i < 3; i++) {
+    EXPECT_EQ(i, shm_.header->write_buf_idx);
+    EXPECT_TRUE(cras_shm_is_buffer_available(&shm_));
+    cras_shm_buffer_written_start(&shm_, 48);
+  }
+  EXPECT_EQ(3 * 48, cras_shm_get_frames(&shm_));
+
+  // The third buffer is reachable from the read pointer.
+  buf_ = cras_shm_get_readable_frames(&shm_, 2 * 48 + 8, &frames_);
+  EXPECT_EQ(40, frames_);
+  EXPECT_EQ(cras_shm_buff_for_idx(&shm_, 2) + 8 * frame_bytes, buf_);
+  buf_ = cras_shm_get_readable_frames(&shm_, 3 * 48, &frames_);
+  EXPECT_EQ(NULL, buf_);
+  EXPECT_EQ(0, frames_);
+
+  // One read spanning the first two buffers and part of the third.
+  cras_shm_buffer_read(&shm_, 2 * 48 + 10);
+  EXPECT_EQ(2, shm_.header->read_buf_idx);
+  EXPECT_EQ(10 * frame_bytes, shm_.header->read_offset[2]);
+  EXPECT_EQ(0, shm_.header->write_offset[0]);
+  EXPECT_EQ(0, shm_.header->write_offset[1]);
+  EXPECT_EQ(38, cras_shm_get_frames(&shm_));
+
+  // Writer wraps around the ring.
+  cras_shm_buffer_written_start(&shm_, 48);
+  cras_shm_buffer_written_start(&shm_, 48);
+  EXPECT_EQ(1, shm_.header->write_buf_idx);
+  cras_shm_buffer_read(&shm_, 38 + 48 + 1);
+  EXPECT_EQ(0, shm_.header->read_buf_idx);
+  EXPECT_EQ(1 * frame_bytes, shm_.header->read_offset[0]);
+}
+
+// Test an unsupported depth falls back to the double buffer.
+TEST_F(ShmTestSuite, InvalidNumBuffers) {
+  EXPECT_FALSE(cras_shm_num_buffers_valid(3));
+  EXPECT_FALSE(cras_shm_num_buffers_valid(CRAS_MAX_SHM_BUFFERS * 2));
+  EXPECT_TRUE(cras_shm_num_buffers_valid(0));
+  shm_.config.num_buffers = 3;
+  EXPECT_EQ(CRAS_NUM_SHM_BUFFERS, cras_shm_num_buffers(&shm_));
+}
+
+TEST_F(ShmTestSuite, WakeReturnsFrames) {
+  uint32_t seq = cras_shm_wake_seq(&shm_);
+  struct timespec timeout = {0, 1000000};
+
+  // Nothing to pick up yet.
+  EXPECT_EQ(-ETIMEDOUT, cras_shm_wait_wake(&shm_, &seq, &timeout));
+
+  cras_shm_wake(&shm_, 480);
+  EXPECT_EQ(480, cras_shm_wait_wake(&shm_, &seq, &timeout));
+  EXPECT_EQ(cras_shm_wake_seq(&shm_), seq);
+
+  // Already handled.
+  EXPECT_EQ(-ETIMEDOUT, cras_shm_wait_wake(&shm_, &seq, &timeout));
+}
+
+TEST_F(ShmTestSuite, CompleteCallback) {
+  cras_shm_set_callback_pending(&shm_, 1);
+  EXPECT_NE(0, cras_shm_callback_pending(&shm_));
+  cras_shm_complete_callback(&shm_);
+  EXPECT_EQ(0, cras_shm_callback_pending(&shm_));
+}
+
 }  //  namespace
 
 int main(int argc, char** argv) {
@@ -6,6 +6,7 @@
 #include <stdio.h>
 
 extern "C" {
+#include "cras_volume_curve.h"
 #include "softvol_curve.h"
 }
 
@@ -25,6 +26,49 @@ TEST(SoftvolCurveTest, ScalerDecibelConvert) {
   EXPECT_NEAR(scaler, 0.0177828f, ABS_ERROR);
 }
 
+static long TestCurveGetdBFS(const struct cras_volume_curve* curve,
+                              size_t volume) {
+  return (static_cast<long>(volume) - 100) * 50;
+}
+
+static long OtherCurveGetdBFS(const struct cras_volume_curve* curve,
+                              size_t volume) {
+  return (static_cast<long>(volume) - 100) * 100;
+}
+
+TEST(SoftvolCurveTest, ScalersFromCurve) {
+  struct cras_volume_curve curve = {TestCurveGetdBFS};
+  const float* scalers;
+
+  EXPECT_EQ(nullptr, softvol_get_scalers(NULL));
+
+  scalers = softvol_get_scalers(&curve);
+  ASSERT_NE(nullptr, scalers);
+  EXPECT_NEAR(scalers[100], 1.0f, ABS_ERROR);
+  EXPECT_NEAR(scalers[60], 0.1f, ABS_ERROR);
+  softvol_put_scalers(scalers);
+}
+
+TEST(SoftvolCurveTest, SameCurvesShareScalers) {
+  struct cras_volume_curve curve1 = {TestCurveGetdBFS};
+  struct cras_volume_curve curve2 = {TestCurveGetdBFS};
+  struct cras_volume_curve other = {OtherCurveGetdBFS};
+  const float *scalers1, *scalers2, *scalers3;
+
+  scalers1 = softvol_get_scalers(&curve1);
+  scalers2 = softvol_get_scalers(&curve2);
+  scalers3 = softvol_get_scalers(&other);
+  EXPECT_EQ(scalers1, scalers2);
+  EXPECT_NE(scalers1, scalers3);
+  EXPECT_NEAR(scalers3[80], 0.1f, ABS_ERROR);
+
+  // The table stays valid until its last user releases it.
+  softvol_put_scalers(scalers1);
+  EXPECT_NEAR(scalers2[60], 0.1f, ABS_ERROR);
+  softvol_put_scalers(scalers2);
+  softvol_put_scalers(scalers3);
+}
+
 }  //  namespace
 
 /* Stubs */
@@ -0,0 +1,121 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+extern "C" {
+#include "cras_startup_log.h"
+}
+
+namespace {
+
+// The log is static and can't be reset, tests look at the phases they add.
+static struct main_thread_startup_log log;
+
+static uint32_t NumPhases() {
+  cras_startup_log_copy(&log);
+  return log.num_phases;
+}
+
+TEST(StartupLog, BeginEnd) {
+  uint32_t first = NumPhases();
+
+  int slot = cras_startup_log_begin(STARTUP_CARD_PROBE, 1, 2);
+  ASSERT_EQ(first, slot);
+
+  cras_startup_log_copy(&log);
+  EXPECT_EQ(first + 1, log.num_phases);
+  EXPECT_EQ(STARTUP_CARD_PROBE, log.phases[slot].phase);
+  EXPECT_EQ(1, log.phases[slot].data1);
+  EXPECT_EQ(2, log.phases[slot].data2);
+  EXPECT_EQ(syscall(SYS_gettid), log.phases[slot].thread);
+  EXPECT_EQ(STARTUP_PHASE_RUNNING, log.phases[slot].duration_us);
+
+  usleep(2000);
+  cras_startup_log_end(slot);
+  cras_startup_log_copy(&log);
+  EXPECT_GE(log.phases[slot].duration_us, 2000);
+  EXPECT_LT(log.phases[slot].duration_us, STARTUP_PHASE_RUNNING);
+}
+
+TEST(StartupLog, Mark) {
+  uint32_t first = NumPhases();
+
+  cras_startup_log_mark(STARTUP_READY, 0, 0);
+  cras_startup_log_copy(&log);
+  ASSERT_EQ(first + 1, log.num_phases);
+  EXPECT_EQ(STARTUP_READY, log.phases[first].phase);
+  EXPECT_EQ(0, log.phases[first].duration_us);
+}
+
+TEST(StartupLog, NestedPhasesInOrder) {
+  uint32_t first = NumPhases();
+
+  int outer = cras_startup_log_begin(STARTUP_CARD_COMMIT, 0, 0);
+  int inner = cras_startup_log_begin(STARTUP_DEVICE_CREATE, 0, 3);
+  cras_startup_log_end(inner);
+  cras_startup_log_end(outer);
+
+  cras_startup_log_copy(&log);
+  ASSERT_EQ(first + 2, log.num_phases);
+  const struct main_thread_startup_phase* o = &log.phases[outer];
+  const struct main_thread_startup_phase* i = &log.phases[inner];
+  uint64_t o_start = (uint64_t)o->sec * 1000000000 + o->nsec;
+  uint64_t i_start = (uint64_t)i->sec * 1000000000 + i->nsec;
+  EXPECT_LE(o_start, i_start);
+  EXPECT_GE(o->duration_us, i->duration_us);
+}
+
+static void* BeginEndThread(void* arg) {
+  for (int i = 0; i < 4; i++)
+    cras_startup_log_end(cras_startup_log_begin(STARTUP_CARD_PROBE,
+                                                (uintptr_t)arg, i));
+  return NULL;
+}
+
+TEST(StartupLog, ThreadsGetTheirOwnSlots) {
+  uint32_t first = NumPhases();
+  pthread_t threads[4];
+
+  for (uintptr_t i = 0; i < 4; i++)
+    pthread_create(&threads[i], NULL, BeginEndThread, (void*)i);
+  for (int i = 0; i < 4; i++)
+    pthread_join(threads[i], NULL);
+
+  cras_startup_log_copy(&log);
+  ASSERT_EQ(first + 16, log.num_phases);
+  unsigned int seen[4] = {0};
+  for (uint32_t i = first; i < log.num_phases; i++) {
+    ASSERT_LT(log.phases[i].data1, 4);
+    seen[log.phases[i].data1] |= 1 << log.phases[i].data2;
+    EXPECT_NE(STARTUP_PHASE_RUNNING, log.phases[i].duration_us);
+  }
+  for (int i = 0; i < 4; i++)
+    EXPECT_EQ(0xf, seen[i]);
+}
+
+// Fills the log, keep it the last test.
+TEST(StartupLog, DropsPhasesWhenFull) {
+  while (NumPhases() < MAIN_THREAD_STARTUP_LOG_SIZE)
+    cras_startup_log_mark(STARTUP_DEVICE_JACKS, 0, 0);
+
+  EXPECT_EQ(-1, cras_startup_log_begin(STARTUP_BT_INIT, 0, 0));
+  cras_startup_log_end(-1);
+  cras_startup_log_mark(STARTUP_READY, 0, 0);
+
+  cras_startup_log_copy(&log);
+  EXPECT_EQ(MAIN_THREAD_STARTUP_LOG_SIZE + 2, log.num_phases);
+  for (uint32_t i = 0; i < MAIN_THREAD_STARTUP_LOG_SIZE; i++)
+    EXPECT_NE(STARTUP_BT_INIT, log.phases[i].phase);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
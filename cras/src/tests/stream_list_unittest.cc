@@ -32,9 +32,12 @@ static int create_rstream_cb(struct cras_rstream_config* stream_config,
                              struct cras_rstream** stream) {
   create_called++;
   create_config = stream_config;
-  *stream = (struct cras_rstream*)malloc(sizeof(struct cras_rstream));
+  *stream = (struct cras_rstream*)calloc(1, sizeof(struct cras_rstream));
   (*stream)->stream_id = stream_config->stream_id;
   (*stream)->direction = stream_config->direction;
+  (*stream)->client = stream_config->client;
+  (*stream)->is_pinned = (stream_config->dev_idx != NO_DEVICE);
+  (*stream)->pinned_dev_idx = stream_config->dev_idx;
   if (stream_config->format)
     (*stream)->format = *(stream_config->format);
 
@@ -59,7 +62,7 @@ static void reset_test_data() {
 TEST(StreamList, AddRemove) {
   struct stream_list* l;
   struct cras_rstream* s1;
-  struct cras_rstream_config s1_config;
+  struct cras_rstream_config s1_config = {};
 
   s1_config.stream_id = 0x3003;
   s1_config.direction = CRAS_STREAM_OUTPUT;
@@ -86,7 +89,7 @@ TEST(StreamList, AddInDescendingOrderByChannels) {
   struct cras_rstream* s2;
   struct cras_rstream* s3;
   struct cras_audio_format s1_format, s2_format, s3_format;
-  struct cras_rstream_config s1_config, s2_config, s3_config;
+  struct cras_rstream_config s1_config = {}, s2_config = {}, s3_config = {};
 
   s1_config.stream_id = 0x4001;
   s1_config.direction = CRAS_STREAM_INPUT;
@@ -129,6 +132,62 @@ TEST(StreamList, AddInDescendingOrderByChannels) {
   stream_list_destroy(l);
 }
 
+TEST(StreamList, IndexedLookupsWithManyStreams) {
+  struct stream_list* l;
+  struct cras_rstream* s;
+  struct cras_rstream_config config = {};
+  struct cras_rclient* clients[3] = {
+      reinterpret_cast<struct cras_rclient*>(0x1000),
+      reinterpret_cast<struct cras_rclient*>(0x1040),
+      reinterpret_cast<struct cras_rclient*>(0x2000),
+  };
+  unsigned int c, i;
+
+  reset_test_data();
+  l = stream_list_create(added_cb, removed_cb, create_rstream_cb,
+                         destroy_rstream_cb, NULL);
+  // 100 streams per client, so every index bucket holds several of them.
+  for (c = 0; c < 3; c++) {
+    for (i = 0; i < 100; i++) {
+      config.stream_id = cras_get_stream_id(c + 1, i);
+      config.client = clients[c];
+      config.dev_idx = (i % 10 == 0) ? 70 + c * 64 : NO_DEVICE;
+      stream_list_add(l, &config, &s);
+    }
+  }
+  EXPECT_EQ(300, add_called);
+
+  EXPECT_TRUE(stream_list_has_pinned_stream(l, 70));
+  EXPECT_TRUE(stream_list_has_pinned_stream(l, 134));
+  EXPECT_FALSE(stream_list_has_pinned_stream(l, 6));
+  EXPECT_FALSE(stream_list_has_pinned_stream(l, 198 + 64));
+
+  EXPECT_EQ(-EINVAL, stream_list_rm(l, cras_get_stream_id(4, 0)));
+  EXPECT_EQ(0, stream_list_rm(l, cras_get_stream_id(2, 5)));
+  EXPECT_EQ(-EINVAL, stream_list_rm(l, cras_get_stream_id(2, 5)));
+
+  // Removing the pinned streams of client 1 leaves those of the others.
+  for (i = 0; i < 100; i += 10)
+    EXPECT_EQ(0, stream_list_rm(l, cras_get_stream_id(1, i)));
+  EXPECT_FALSE(stream_list_has_pinned_stream(l, 70));
+  EXPECT_TRUE(stream_list_has_pinned_stream(l, 134));
+
+  rm_called = 0;
+  stream_list_rm_all_client_streams(l, clients[1]);
+  EXPECT_EQ(99, rm_called);
+  EXPECT_FALSE(stream_list_has_pinned_stream(l, 134));
+  EXPECT_TRUE(stream_list_has_pinned_stream(l, 198));
+  for (s = stream_list_get(l); s; s = s->next)
+    EXPECT_NE(clients[1], s->client);
+  EXPECT_EQ(0, stream_list_rm(l, cras_get_stream_id(3, 99)));
+
+  stream_list_rm_all_client_streams(l, clients[0]);
+  stream_list_rm_all_client_streams(l, clients[2]);
+  EXPECT_EQ(NULL, stream_list_get(l));
+  EXPECT_EQ(300, destroy_called);
+  stream_list_destroy(l);
+}
+
 extern "C" {
 
 struct cras_timer* cras_tm_create_timer(struct cras_tm* tm,
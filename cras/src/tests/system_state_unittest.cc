@@ -18,6 +18,10 @@ namespace {
 static struct cras_alsa_card* kFakeAlsaCard;
 size_t cras_alsa_card_create_called;
 size_t cras_alsa_card_destroy_called;
+static size_t cras_alsa_card_probe_called;
+static size_t cras_alsa_card_probe_formats_called;
+static size_t cras_alsa_card_commit_called;
+static int cras_alsa_card_commit_return;
 static size_t add_stub_called;
 static size_t rm_stub_called;
 static size_t add_task_stub_called;
@@ -44,6 +48,10 @@ static struct cras_board_config fake_board_config;
 static void ResetStubData() {
   cras_alsa_card_create_called = 0;
   cras_alsa_card_destroy_called = 0;
+  cras_alsa_card_probe_called = 0;
+  cras_alsa_card_probe_formats_called = 0;
+  cras_alsa_card_commit_called = 0;
+  cras_alsa_card_commit_return = 0;
   kFakeAlsaCard = reinterpret_cast<struct cras_alsa_card*>(0x33);
   add_stub_called = 0;
   rm_stub_called = 0;
@@ -318,6 +326,48 @@ TEST(SystemStateSuite, AddCard) {
   cras_system_state_deinit();
 }
 
+TEST(SystemStateSuite, AddCards) {
+  ResetStubData();
+  cras_alsa_card_info info[3];
+
+  for (int i = 0; i < 3; i++) {
+    info[i].card_type = ALSA_CARD_TYPE_USB;
+    info[i].card_index = i;
+  }
+  // The same card listed twice is probed once.
+  info[2].card_index = 1;
+  do_sys_init();
+  EXPECT_EQ(2, cras_system_add_alsa_cards(info, 3));
+  EXPECT_EQ(2, cras_alsa_card_probe_called);
+  EXPECT_EQ(2, cras_alsa_card_probe_formats_called);
+  EXPECT_EQ(2, cras_alsa_card_commit_called);
+  EXPECT_EQ(cras_alsa_card_config_dir, device_config_dir);
+  // Cards which already exist are skipped.
+  ResetStubData();
+  EXPECT_EQ(0, cras_system_add_alsa_cards(info, 1));
+  EXPECT_EQ(0, cras_alsa_card_probe_called);
+  // The index stub returns 0 for both cards.
+  cras_system_remove_alsa_card(0);
+  cras_system_remove_alsa_card(0);
+  EXPECT_EQ(2, cras_alsa_card_destroy_called);
+  cras_system_state_deinit();
+}
+
+TEST(SystemStateSuite, AddCardsFailCommit) {
+  ResetStubData();
+  cras_alsa_card_info info;
+
+  info.card_type = ALSA_CARD_TYPE_INTERNAL;
+  info.card_index = 0;
+  cras_alsa_card_commit_return = -EINVAL;
+  do_sys_init();
+  EXPECT_EQ(0, cras_system_add_alsa_cards(&info, 1));
+  EXPECT_EQ(1, cras_alsa_card_commit_called);
+  EXPECT_EQ(1, cras_alsa_card_destroy_called);
+  EXPECT_FALSE(cras_system_alsa_card_exists(0));
+  cras_system_state_deinit();
+}
+
 TEST(SystemSettingsRegisterSelectDescriptor, AddSelectFd) {
   void* stub_data = reinterpret_cast<void*>(44);
   void* select_data = reinterpret_cast<void*>(33);
@@ -442,6 +492,26 @@ struct cras_alsa_card* cras_alsa_card_create(
   return kFakeAlsaCard;
 }
 
+struct cras_alsa_card* cras_alsa_card_probe(struct cras_alsa_card_info* info,
+                                            const char* device_config_dir,
+                                            const char* ucm_suffix) {
+  __atomic_fetch_add(&cras_alsa_card_probe_called, 1, __ATOMIC_RELAXED);
+  cras_alsa_card_config_dir = device_config_dir;
+  return kFakeAlsaCard;
+}
+
+void cras_alsa_card_probe_formats(struct cras_alsa_card* alsa_card) {
+  __atomic_fetch_add(&cras_alsa_card_probe_formats_called, 1,
+                     __ATOMIC_RELAXED);
+}
+
+int cras_alsa_card_commit(struct cras_alsa_card* alsa_card,
+                          struct cras_alsa_card_info* info,
+                          struct cras_device_blocklist* blocklist) {
+  cras_alsa_card_commit_called++;
+  return cras_alsa_card_commit_return;
+}
+
 void cras_alsa_card_destroy(struct cras_alsa_card* alsa_card) {
   cras_alsa_card_destroy_called++;
 }
@@ -12,6 +12,7 @@
 
 extern "C" {
 #include "cras_iodev.h"    // stubbed
+#include "cras_mix_pool.h"  // stubbed
 #include "cras_rstream.h"  // stubbed
 #include "cras_shm.h"
 #include "cras_types.h"
@@ -20,6 +21,7 @@ extern "C" {
 #include "utlist.h"
 
 struct audio_thread_event_log* atlog;
+int atlog_workload;
 }
 
 #include "dev_io_stubs.h"
@@ -1138,6 +1140,40 @@ TEST_F(TimingSuite, OutputStreamsUpdateAfterFetching) {
   EXPECT_EQ(start.tv_nsec, stream->rstream->next_cb_ts.tv_nsec);
 }
 
+// Streams due within the wake fuzz are fetched early, except low latency
+// streams which are only fetched once their period is over.
+TEST_F(TimingSuite, LowLatencyStreamNotFetchedEarly) {
+  cras_audio_format format;
+  fill_audio_format(&format, 48000);
+
+  StreamPtr stream = create_stream(1, 1, CRAS_STREAM_OUTPUT, 480, &format);
+  StreamPtr ll_stream = create_stream(1, 2, CRAS_STREAM_OUTPUT, 480, &format);
+  ll_stream->rstream->flags = LOW_LATENCY;
+
+  // Both callbacks are due in 300us.
+  const timespec early = {0, 300 * 1000};
+  struct timespec next_cb_ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &next_cb_ts);
+  add_timespecs(&next_cb_ts, &early);
+  stream->rstream->next_cb_ts = next_cb_ts;
+  ll_stream->rstream->next_cb_ts = next_cb_ts;
+
+  struct open_dev* dev_list_ = NULL;
+
+  DevicePtr dev = create_device(CRAS_STREAM_OUTPUT, 1024, &format,
+                                CRAS_NODE_TYPE_HEADPHONE);
+  DL_APPEND(dev_list_, dev->odev.get());
+
+  add_stream_to_dev(dev->dev, stream);
+  add_stream_to_dev(dev->dev, ll_stream);
+
+  dev_io_playback_fetch(dev_list_);
+
+  EXPECT_TRUE(timespec_after(&stream->rstream->next_cb_ts, &next_cb_ts));
+  EXPECT_EQ(next_cb_ts.tv_sec, ll_stream->rstream->next_cb_ts.tv_sec);
+  EXPECT_EQ(next_cb_ts.tv_nsec, ll_stream->rstream->next_cb_ts.tv_nsec);
+}
+
 // TODO(yuhsuan): There are some time scheduling rules in cras_iodev. Maybe we
 // can move them into dev_io so that all timing related codes are in the same
 // file or leave them in iodev_unittest like now.
@@ -1155,6 +1191,21 @@ int input_data_get_for_stream(struct input_data* data,
   return 0;
 }
 
+int input_data_get_planar_for_stream(struct input_data* data,
+                                     struct cras_rstream* stream,
+                                     struct buffer_share* offsets,
+                                     struct cras_audio_area** area) {
+  return 0;
+}
+
+int dsp_util_interleave(float* const* input,
+                        uint8_t* output,
+                        int channels,
+                        snd_pcm_format_t format,
+                        int frames) {
+  return 0;
+}
+
 int input_data_put_for_stream(struct input_data* data,
                               struct cras_rstream* stream,
                               struct buffer_share* offsets,
@@ -1182,11 +1233,33 @@ int cras_audio_thread_event_severe_underrun() {
   return 0;
 }
 
+int cras_audio_thread_event_underrun_risk() {
+  return 0;
+}
+
 void* buffer_share_get_data(const struct buffer_share* mix, unsigned int id) {
   return NULL;
 };
 void cras_apm_list_start_apm(struct cras_apm_list* list, void* dev_ptr){};
 void cras_apm_list_stop_apm(struct cras_apm_list* list, void* dev_ptr){};
+struct cras_apm* cras_apm_list_get_active_apm(void* stream_ptr, void* dev_ptr) {
+  return NULL;
+}
+unsigned int cras_apm_list_get_delay_frames(struct cras_apm* apm) {
+  return 0;
+}
+uint64_t cras_apm_list_get_process_ns(struct cras_apm_list* list,
+                                      void* dev_ptr) {
+  return 0;
+}
+size_t cras_apm_list_get_mem_bytes(struct cras_apm_list* list, void* dev_ptr) {
+  return 0;
+}
+void cras_mix_pool_run(struct cras_mix_pool* pool,
+                       cras_mix_pool_job_fn fn,
+                       void* jobs,
+                       size_t job_size,
+                       unsigned int num_jobs) {}
 }  // extern "C"
 
 }  //  namespace
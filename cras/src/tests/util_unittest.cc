@@ -152,6 +152,30 @@ TEST(Util, SendRecvNoDescriptors) {
   close(sock[1]);
 }
 
+TEST(Util, SendMessagesKeepsBoundaries) {
+  char buf[256];
+  char first[] = "first";
+  char second[] = "second message";
+  struct iovec msgs[2] = {{first, sizeof(first)}, {second, sizeof(second)}};
+  unsigned int num_fds = 0;
+  int sock[2];
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+
+  EXPECT_EQ(2, cras_send_messages(sock[0], msgs, 2));
+  EXPECT_EQ(sizeof(first), cras_recv_with_fds_nonblocking(
+                               sock[1], buf, sizeof(buf), NULL, &num_fds));
+  EXPECT_STREQ(first, buf);
+  EXPECT_EQ(sizeof(second), cras_recv_with_fds_nonblocking(
+                                sock[1], buf, sizeof(buf), NULL, &num_fds));
+  EXPECT_STREQ(second, buf);
+  EXPECT_EQ(-EAGAIN, cras_recv_with_fds_nonblocking(sock[1], buf, sizeof(buf),
+                                                    NULL, &num_fds));
+
+  close(sock[0]);
+  close(sock[1]);
+}
+
 TEST(Util, TimevalAfter) {
   struct timeval t0, t1;
   t0.tv_sec = 0;
@@ -0,0 +1,114 @@
+// Copyright 2020 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <string.h>
+
+extern "C" {
+#include "cras_rstream.h"
+#include "cras_util.h"
+#include "cras_wake_heap.h"
+}
+
+namespace {
+
+static const unsigned int kNumStreams = 9;
+
+class WakeHeapTestSuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    memset(streams_, 0, sizeof(streams_));
+    for (unsigned int i = 0; i < kNumStreams; i++) {
+      streams_[i].stream_id = i;
+      streams_[i].next_cb_ts.tv_sec = 100 + (i * 7) % kNumStreams;
+    }
+  }
+
+  virtual void TearDown() {
+    for (unsigned int i = 0; i < kNumStreams; i++)
+      while (streams_[i].wake_heap_refs)
+        cras_wake_heap_rm(&streams_[i]);
+    EXPECT_EQ(NULL, cras_wake_heap_at(0));
+  }
+
+  // Checks that no stream orders before its parent.
+  void ExpectHeapOrdered() {
+    struct timespec key, parent_key;
+    struct cras_rstream* stream;
+
+    for (unsigned int i = 1; (stream = cras_wake_heap_at(i)); i++) {
+      EXPECT_EQ(i + 1, stream->wake_heap_pos);
+      cras_wake_heap_key(stream, &key);
+      cras_wake_heap_key(cras_wake_heap_at((i - 1) / 2), &parent_key);
+      EXPECT_FALSE(timespec_after(&parent_key, &key));
+    }
+  }
+
+  struct cras_rstream streams_[kNumStreams];
+};
+
+TEST_F(WakeHeapTestSuite, EarliestOnTop) {
+  for (unsigned int i = 0; i < kNumStreams; i++)
+    cras_wake_heap_add(&streams_[i]);
+  ExpectHeapOrdered();
+  EXPECT_EQ(100, cras_wake_heap_at(0)->next_cb_ts.tv_sec);
+
+  struct timespec ts = {.tv_sec = 50, .tv_nsec = 0};
+  cras_wake_heap_set_next_cb_ts(&streams_[4], &ts);
+  ExpectHeapOrdered();
+  EXPECT_EQ(&streams_[4], cras_wake_heap_at(0));
+
+  ts.tv_sec = 500;
+  cras_wake_heap_set_next_cb_ts(&streams_[4], &ts);
+  ExpectHeapOrdered();
+  EXPECT_NE(&streams_[4], cras_wake_heap_at(0));
+}
+
+TEST_F(WakeHeapTestSuite, OrderedOnFetchLead) {
+  struct timespec lead = {.tv_sec = 90, .tv_nsec = 0};
+  struct timespec key;
+
+  for (unsigned int i = 0; i < kNumStreams; i++)
+    cras_wake_heap_add(&streams_[i]);
+  cras_wake_heap_set_fetch_lead(&streams_[3], &lead);
+  ExpectHeapOrdered();
+  EXPECT_EQ(&streams_[3], cras_wake_heap_at(0));
+  cras_wake_heap_key(&streams_[3], &key);
+  EXPECT_EQ(streams_[3].next_cb_ts.tv_sec - 90, key.tv_sec);
+
+  // A lead longer than the time to the callback keys the stream at zero.
+  lead.tv_sec = 1000;
+  cras_wake_heap_set_fetch_lead(&streams_[3], &lead);
+  cras_wake_heap_key(&streams_[3], &key);
+  EXPECT_EQ(0, key.tv_sec);
+  EXPECT_EQ(0, key.tv_nsec);
+}
+
+TEST_F(WakeHeapTestSuite, RemovedOnLastReference) {
+  for (unsigned int i = 0; i < kNumStreams; i++)
+    cras_wake_heap_add(&streams_[i]);
+  cras_wake_heap_add(&streams_[0]);
+
+  cras_wake_heap_rm(&streams_[0]);
+  EXPECT_NE(0, streams_[0].wake_heap_pos);
+  cras_wake_heap_rm(&streams_[0]);
+  EXPECT_EQ(0, streams_[0].wake_heap_pos);
+  cras_wake_heap_rm(&streams_[5]);
+  cras_wake_heap_rm(&streams_[2]);
+  ExpectHeapOrdered();
+  EXPECT_EQ(NULL, cras_wake_heap_at(kNumStreams - 3));
+
+  // A stream out of the heap only takes the new time.
+  struct timespec ts = {.tv_sec = 1, .tv_nsec = 0};
+  cras_wake_heap_set_next_cb_ts(&streams_[0], &ts);
+  EXPECT_EQ(1, streams_[0].next_cb_ts.tv_sec);
+  EXPECT_NE(&streams_[0], cras_wake_heap_at(0));
+}
+
+}  //  namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,40 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * Compiles a DSP ini file into the binary form cras loads with --dsp_cache,
+ * so a board image can ship it instead of having cras parse the ini and
+ * compute the eq2 coefficients on the device.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "cras_dsp_ini.h"
+
+static void show_usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s <dsp.ini> <output>\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	int rc;
+
+	if (argc != 3) {
+		show_usage(argv[0]);
+		return 1;
+	}
+
+	openlog("cras_dsp_compile", LOG_PERROR, LOG_USER);
+	rc = cras_dsp_ini_compile(argv[1], argv[2]);
+	if (rc < 0) {
+		fprintf(stderr, "Failed to compile %s: %s\n", argv[1],
+			strerror(-rc));
+		return 1;
+	}
+	return 0;
+}
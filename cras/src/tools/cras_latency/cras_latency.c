@@ -0,0 +1,685 @@
+/* Copyright 2020 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/* Measures the round trip latency of the active output and input, and breaks
+ * it down along the audio path. A tone burst is played as a marker and
+ * detected in the capture, either acoustically or through a loopback cable.
+ * The device, DSP and resampler delays come from the stream telemetry the
+ * server publishes, and the hand-offs between the clients and the audio
+ * thread from the audio thread event log.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cras_client.h"
+#include "cras_shm.h"
+#include "cras_types.h"
+#include "cras_util.h"
+#include "cras_version.h"
+
+#define NUM_CHANNELS 2
+#define BURST_MS 10
+#define BURST_HZ 1000
+#define BURST_AMPLITUDE 0.5
+#define MARKER_TIMEOUT_MS 2000
+
+/* Number of audio thread events of each kind kept for correlation. */
+#define EVENT_HISTORY_SIZE 1024
+
+/* Sleep interval between cras_client_read_atlog calls. */
+static const struct timespec atlog_poll_ts = {
+	0, 50 * 1000 * 1000 /* 50 ms. */
+};
+
+/* The stages a marker goes through, in order. The round trip is the sum of
+ * all stages but STAGE_CLIENT_FETCH.
+ *  STAGE_CLIENT_FETCH - From the audio thread asking for samples to the
+ *    playback callback writing the marker.
+ *  STAGE_OUT_BUFFER - Time spent in the shm and mixer before the DSP.
+ *  STAGE_OUT_SRC, STAGE_OUT_DSP, STAGE_OUT_DEV - Resampler, DSP and device
+ *    delays of the output.
+ *  STAGE_ACOUSTIC - From the DAC playing the marker to the ADC capturing it.
+ *  STAGE_IN_DEV - From the ADC to the audio thread posting the marker to the
+ *    capture stream, less the DSP delay. Covers the device delay and the APM
+ *    processing of the input.
+ *  STAGE_IN_DSP - DSP delay of the input.
+ *  STAGE_IN_CLIENT - From the audio thread posting the marker to the capture
+ *    callback receiving it.
+ */
+enum LATENCY_STAGE {
+	STAGE_CLIENT_FETCH,
+	STAGE_OUT_BUFFER,
+	STAGE_OUT_SRC,
+	STAGE_OUT_DSP,
+	STAGE_OUT_DEV,
+	STAGE_ACOUSTIC,
+	STAGE_IN_DEV,
+	STAGE_IN_DSP,
+	STAGE_IN_CLIENT,
+	STAGE_ROUND_TRIP,
+	NUM_LATENCY_STAGES,
+};
+
+static const char *stage_names[NUM_LATENCY_STAGES] = {
+	[STAGE_CLIENT_FETCH] = "client fetch",
+	[STAGE_OUT_BUFFER] = "output shm+mix",
+	[STAGE_OUT_SRC] = "output src",
+	[STAGE_OUT_DSP] = "output dsp",
+	[STAGE_OUT_DEV] = "output device",
+	[STAGE_ACOUSTIC] = "acoustic loop",
+	[STAGE_IN_DEV] = "input device",
+	[STAGE_IN_DSP] = "input dsp",
+	[STAGE_IN_CLIENT] = "input client",
+	[STAGE_ROUND_TRIP] = "round trip",
+};
+
+/* Timing of one marker.
+ *  write - When the playback callback wrote the marker.
+ *  dac - When the first sample of the marker is played.
+ *  adc - When the first sample of the marker detected was captured.
+ *  read - When the capture callback received it.
+ *  out, in - Telemetry of the streams when the marker was written and read.
+ */
+struct marker {
+	struct timespec write;
+	struct timespec dac;
+	struct timespec adc;
+	struct timespec read;
+	struct cras_audio_shm_telemetry out;
+	struct cras_audio_shm_telemetry in;
+	int has_out_telemetry;
+	int has_in_telemetry;
+};
+
+/* Times of one kind of audio thread event, in microseconds. */
+struct event_history {
+	uint64_t usec[EVENT_HISTORY_SIZE];
+	unsigned int count;
+};
+
+static pthread_mutex_t marker_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct cras_audio_format *aud_format;
+static cras_stream_id_t output_stream_id;
+static cras_stream_id_t input_stream_id;
+static struct marker *markers;
+static unsigned int num_markers;
+static unsigned int markers_done;
+static unsigned int markers_lost;
+static int in_flight;
+static unsigned int burst_frames_left;
+static struct timespec next_marker;
+static unsigned int interval_ms = 500;
+static float threshold = 0.1;
+static int stream_failed;
+
+static struct event_history fetch_events;
+static struct event_history post_events;
+static uint64_t last_event_usec;
+
+/* Gets a CLOCK_MONOTONIC_RAW time in microseconds, wrapped as in the audio
+ * thread event log so the two can be compared. */
+static uint64_t mono_usec(const struct timespec *ts)
+{
+	return (uint64_t)(ts->tv_sec & 0x00ffffff) * 1000000 +
+	       ts->tv_nsec / 1000;
+}
+
+static void add_frames_to_ts(struct timespec *ts, unsigned int frames,
+			     size_t rate)
+{
+	struct timespec delta;
+
+	cras_frames_to_time(frames, rate, &delta);
+	add_timespecs(ts, &delta);
+}
+
+static double ts_diff_ms(const struct timespec *end,
+			 const struct timespec *beg)
+{
+	return ((double)end->tv_sec - beg->tv_sec) * 1000.0 +
+	       ((double)end->tv_nsec - beg->tv_nsec) / 1000000.0;
+}
+
+static double frames_ms(uint32_t frames, uint32_t rate)
+{
+	return rate ? frames * 1000.0 / rate : 0;
+}
+
+static int get_telemetry(struct cras_client *client,
+			 cras_stream_id_t stream_id,
+			 struct cras_audio_shm_telemetry *telemetry)
+{
+	int rc;
+
+	do {
+		rc = cras_client_get_stream_telemetry(client, stream_id,
+						      telemetry);
+	} while (rc == -EAGAIN);
+	return rc == 0;
+}
+
+/* Run from callback thread. Plays silence, and a tone burst every
+ * interval_ms once the previous marker came back. */
+static int put_samples(struct cras_client *client, cras_stream_id_t stream_id,
+		       uint8_t *captured_samples, uint8_t *playback_samples,
+		       unsigned int frames,
+		       const struct timespec *captured_time,
+		       const struct timespec *playback_time, void *user_arg)
+{
+	int16_t *samples = (int16_t *)playback_samples;
+	size_t rate = aud_format->frame_rate;
+	unsigned int burst_frames = rate * BURST_MS / 1000;
+	struct marker *marker;
+	struct timespec now;
+	unsigned int i, c, n;
+
+	memset(playback_samples, 0,
+	       frames * cras_client_format_bytes_per_frame(aud_format));
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+
+	pthread_mutex_lock(&marker_mutex);
+	if (markers_done >= num_markers)
+		goto unlock;
+
+	marker = &markers[markers_done];
+	if (in_flight && ts_diff_ms(&now, &marker->write) > MARKER_TIMEOUT_MS) {
+		fprintf(stderr, "Marker %u lost\n", markers_done);
+		markers_lost++;
+		in_flight = 0;
+		next_marker = now;
+	}
+
+	if (!in_flight && !burst_frames_left &&
+	    timespec_after(&now, &next_marker)) {
+		memset(marker, 0, sizeof(*marker));
+		marker->write = now;
+		marker->dac = *playback_time;
+		marker->has_out_telemetry =
+			get_telemetry(client, stream_id, &marker->out);
+		burst_frames_left = burst_frames;
+		in_flight = 1;
+	}
+
+	/* The burst may span several callbacks. */
+	n = MIN(frames, burst_frames_left);
+	for (i = 0; i < n; i++) {
+		unsigned int pos = burst_frames - burst_frames_left + i;
+		int16_t s = INT16_MAX * BURST_AMPLITUDE *
+			    sin(2 * M_PI * BURST_HZ * pos / rate);
+
+		for (c = 0; c < NUM_CHANNELS; c++)
+			samples[i * NUM_CHANNELS + c] = s;
+	}
+	burst_frames_left -= n;
+
+unlock:
+	pthread_mutex_unlock(&marker_mutex);
+	return frames;
+}
+
+/* Run from callback thread. Looks for the marker in flight. */
+static int got_samples(struct cras_client *client, cras_stream_id_t stream_id,
+		       uint8_t *captured_samples, uint8_t *playback_samples,
+		       unsigned int frames,
+		       const struct timespec *captured_time,
+		       const struct timespec *playback_time, void *user_arg)
+{
+	int16_t *samples = (int16_t *)captured_samples;
+	int16_t level = INT16_MAX * threshold;
+	struct timespec interval = { interval_ms / 1000,
+				     (interval_ms % 1000) * 1000000 };
+	struct timespec now, adc;
+	struct marker *marker;
+	unsigned int i;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+
+	pthread_mutex_lock(&marker_mutex);
+	if (!in_flight)
+		goto unlock;
+
+	marker = &markers[markers_done];
+	for (i = 0; i < frames * NUM_CHANNELS; i++) {
+		if (abs(samples[i]) < level)
+			continue;
+
+		/* Samples captured before the marker was played are noise. */
+		adc = *captured_time;
+		add_frames_to_ts(&adc, i / NUM_CHANNELS,
+				 aud_format->frame_rate);
+		if (timespec_after(&marker->dac, &adc))
+			continue;
+
+		marker->adc = adc;
+		marker->read = now;
+		marker->has_in_telemetry =
+			get_telemetry(client, stream_id, &marker->in);
+		markers_done++;
+		in_flight = 0;
+		next_marker = now;
+		add_timespecs(&next_marker, &interval);
+		break;
+	}
+
+unlock:
+	pthread_mutex_unlock(&marker_mutex);
+	return frames;
+}
+
+static int stream_error(struct cras_client *client, cras_stream_id_t stream_id,
+			int err, void *arg)
+{
+	fprintf(stderr, "Stream error %d\n", err);
+	stream_failed = 1;
+	return 0;
+}
+
+static void add_event(struct event_history *history, uint64_t usec)
+{
+	history->usec[history->count++ % EVENT_HISTORY_SIZE] = usec;
+}
+
+/* Finds the latest event at or before usec, 0 if none is known. */
+static uint64_t event_before(const struct event_history *history,
+			     uint64_t usec)
+{
+	uint64_t found = 0;
+	unsigned int i, n = MIN(history->count, EVENT_HISTORY_SIZE);
+
+	for (i = 0; i < n; i++)
+		if (history->usec[i] <= usec && history->usec[i] > found)
+			found = history->usec[i];
+	return found;
+}
+
+/* Finds the earliest event in [beg, end], 0 if none is known. */
+static uint64_t event_between(const struct event_history *history,
+			      uint64_t beg, uint64_t end)
+{
+	uint64_t found = 0;
+	unsigned int i, n = MIN(history->count, EVENT_HISTORY_SIZE);
+
+	for (i = 0; i < n; i++) {
+		if (history->usec[i] < beg || history->usec[i] > end)
+			continue;
+		if (!found || history->usec[i] < found)
+			found = history->usec[i];
+	}
+	return found;
+}
+
+/* Keeps the times the audio thread fetched the output stream and posted to
+ * the input stream. */
+static void read_atlog(struct cras_client *client, uint64_t *read_idx)
+{
+	struct audio_thread_event_log log;
+	struct audio_thread_event *event;
+	uint64_t missing, usec;
+	unsigned int tag;
+	int i, len;
+
+	len = cras_client_read_atlog(client, read_idx, &missing, &log);
+	for (i = 0; i < len; i++) {
+		event = &log.log[i];
+		tag = (event->tag_sec >> 24) & 0xff;
+		usec = (uint64_t)(event->tag_sec & 0x00ffffff) * 1000000 +
+		       event->nsec / 1000;
+		last_event_usec = MAX(last_event_usec, usec);
+		if (tag == AUDIO_THREAD_FETCH_STREAM &&
+		    event->data1 == output_stream_id)
+			add_event(&fetch_events, usec);
+		else if (tag == AUDIO_THREAD_CAPTURE_POST &&
+			 event->data1 == input_stream_id)
+			add_event(&post_events, usec);
+	}
+}
+
+/* Splits the latency of a marker into stages. Stages that can't be known
+ * are NAN. */
+static void marker_stages(const struct marker *marker, int has_atlog,
+			  double stages[NUM_LATENCY_STAGES])
+{
+	const struct cras_audio_shm_telemetry *out = &marker->out;
+	const struct cras_audio_shm_telemetry *in = &marker->in;
+	uint64_t fetch = 0, post = 0;
+	int i;
+
+	for (i = 0; i < NUM_LATENCY_STAGES; i++)
+		stages[i] = NAN;
+
+	stages[STAGE_ACOUSTIC] = ts_diff_ms(&marker->adc, &marker->dac);
+	stages[STAGE_ROUND_TRIP] = ts_diff_ms(&marker->read, &marker->write);
+	stages[STAGE_OUT_BUFFER] = ts_diff_ms(&marker->dac, &marker->write);
+	/* Without telemetry, the whole output path counts as buffering. */
+	if (marker->has_out_telemetry) {
+		stages[STAGE_OUT_SRC] =
+			frames_ms(out->src_delay_frames, out->dev_rate);
+		stages[STAGE_OUT_DSP] =
+			frames_ms(out->dsp_delay_frames, out->dev_rate);
+		stages[STAGE_OUT_DEV] =
+			frames_ms(out->dev_delay_frames, out->dev_rate);
+		stages[STAGE_OUT_BUFFER] -= stages[STAGE_OUT_SRC] +
+					    stages[STAGE_OUT_DSP] +
+					    stages[STAGE_OUT_DEV];
+	}
+
+	if (has_atlog) {
+		fetch = event_before(&fetch_events, mono_usec(&marker->write));
+		post = event_between(&post_events, mono_usec(&marker->adc),
+				     mono_usec(&marker->read));
+	}
+	if (fetch)
+		stages[STAGE_CLIENT_FETCH] =
+			(mono_usec(&marker->write) - fetch) / 1000.0;
+	if (post) {
+		stages[STAGE_IN_DEV] =
+			(post - mono_usec(&marker->adc)) / 1000.0;
+		stages[STAGE_IN_CLIENT] =
+			(mono_usec(&marker->read) - post) / 1000.0;
+	} else {
+		/* Without the log, the client hand-off counts as input. */
+		stages[STAGE_IN_DEV] = ts_diff_ms(&marker->read, &marker->adc);
+	}
+	if (marker->has_in_telemetry) {
+		stages[STAGE_IN_DSP] =
+			frames_ms(in->dsp_delay_frames, in->dev_rate);
+		stages[STAGE_IN_DEV] -= stages[STAGE_IN_DSP];
+	}
+}
+
+static void print_marker(unsigned int idx, const double *stages)
+{
+	printf("marker %u: round trip %.2f ms, acoustic %.2f ms\n", idx,
+	       stages[STAGE_ROUND_TRIP], stages[STAGE_ACOUSTIC]);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Prints the distribution of each stage over the markers measured. */
+static void print_stages(double (*stages)[NUM_LATENCY_STAGES],
+			 unsigned int count)
+{
+	double *values = (double *)calloc(count, sizeof(*values));
+	unsigned int i, s, n;
+	double sum;
+
+	if (!values)
+		return;
+
+	printf("%-18s %8s %8s %8s %8s %8s  (ms)\n", "stage", "min", "mean",
+	       "p50", "p95", "max");
+	for (s = 0; s < NUM_LATENCY_STAGES; s++) {
+		for (i = 0, n = 0, sum = 0; i < count; i++) {
+			if (isnan(stages[i][s]))
+				continue;
+			values[n++] = stages[i][s];
+			sum += stages[i][s];
+		}
+		if (n == 0) {
+			printf("%-18s %8s\n", stage_names[s], "n/a");
+			continue;
+		}
+		qsort(values, n, sizeof(*values), compare_double);
+		printf("%-18s %8.2f %8.2f %8.2f %8.2f %8.2f\n", stage_names[s],
+		       values[0], sum / n, values[n / 2],
+		       values[MIN(n - 1, n * 95 / 100)], values[n - 1]);
+	}
+	free(values);
+}
+
+static pthread_mutex_t atlog_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t atlog_cond = PTHREAD_COND_INITIALIZER;
+static int atlog_ready;
+
+static void atlog_access_cb(struct cras_client *client)
+{
+	pthread_mutex_lock(&atlog_mutex);
+	atlog_ready = 1;
+	pthread_cond_signal(&atlog_cond);
+	pthread_mutex_unlock(&atlog_mutex);
+}
+
+static int wait_atlog_access(struct cras_client *client)
+{
+	struct timespec wait_time;
+
+	if (cras_client_get_atlog_access(client, atlog_access_cb))
+		return 0;
+
+	clock_gettime(CLOCK_REALTIME, &wait_time);
+	wait_time.tv_sec += 2;
+	pthread_mutex_lock(&atlog_mutex);
+	while (!atlog_ready &&
+	       !pthread_cond_timedwait(&atlog_cond, &atlog_mutex, &wait_time))
+		;
+	pthread_mutex_unlock(&atlog_mutex);
+	return atlog_ready;
+}
+
+static struct cras_stream_params *
+create_params(enum CRAS_STREAM_DIRECTION direction, size_t block_size,
+	      cras_unified_cb_t cb, int aec)
+{
+	struct cras_stream_params *params;
+
+	params = cras_client_unified_params_create(direction, block_size,
+						   CRAS_STREAM_TYPE_DEFAULT, 0,
+						   NULL, cb, stream_error,
+						   aud_format);
+	if (!params)
+		return NULL;
+	cras_client_stream_params_set_client_type(params,
+						  CRAS_CLIENT_TYPE_TEST);
+	if (aec)
+		cras_client_stream_params_enable_aec(params);
+	return params;
+}
+
+static int run_latency(struct cras_client *client, size_t rate,
+		       size_t block_size, int aec)
+{
+	struct cras_stream_params *out_params, *in_params;
+	double(*stages)[NUM_LATENCY_STAGES];
+	unsigned int reported = 0;
+	uint64_t read_idx = 0;
+	int has_atlog;
+	int rc = 0;
+
+	markers = (struct marker *)calloc(num_markers, sizeof(*markers));
+	stages = calloc(num_markers, sizeof(*stages));
+	aud_format = cras_audio_format_create(SND_PCM_FORMAT_S16_LE, rate,
+					      NUM_CHANNELS);
+	if (!markers || !stages || !aud_format)
+		return -ENOMEM;
+
+	out_params = create_params(CRAS_STREAM_OUTPUT, block_size,
+				   put_samples, 0);
+	in_params = create_params(CRAS_STREAM_INPUT, block_size, got_samples,
+				  aec);
+	if (!out_params || !in_params)
+		return -ENOMEM;
+
+	cras_client_run_thread(client);
+	cras_client_connected_wait(client);
+
+	has_atlog = wait_atlog_access(client);
+	if (!has_atlog)
+		fprintf(stderr, "No audio thread log, skipping the client "
+				"stages.\n");
+
+	rc = cras_client_add_stream(client, &input_stream_id, in_params);
+	if (rc < 0) {
+		fprintf(stderr, "Failed to add the input stream: %d\n", rc);
+		goto out;
+	}
+	rc = cras_client_add_stream(client, &output_stream_id, out_params);
+	if (rc < 0) {
+		fprintf(stderr, "Failed to add the output stream: %d\n", rc);
+		goto out;
+	}
+
+	while (reported < num_markers) {
+		unsigned int done, lost;
+		struct timespec now;
+
+		nanosleep(&atlog_poll_ts, NULL);
+		if (stream_failed) {
+			rc = -EIO;
+			goto out;
+		}
+		if (has_atlog)
+			read_atlog(client, &read_idx);
+
+		pthread_mutex_lock(&marker_mutex);
+		done = markers_done;
+		lost = markers_lost;
+		pthread_mutex_unlock(&marker_mutex);
+
+		if (lost > num_markers) {
+			fprintf(stderr, "No marker comes back, check the "
+					"volume and the loop.\n");
+			rc = -ETIMEDOUT;
+			goto out;
+		}
+
+		/* Waits for the log to cover the marker before splitting it,
+		 * unless it lags a second behind. */
+		clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+		for (; reported < done; reported++) {
+			struct marker *marker = &markers[reported];
+
+			if (has_atlog &&
+			    last_event_usec < mono_usec(&marker->read) &&
+			    ts_diff_ms(&now, &marker->read) < 1000)
+				break;
+			marker_stages(&markers[reported], has_atlog,
+				      stages[reported]);
+			print_marker(reported, stages[reported]);
+		}
+	}
+
+	printf("\n%u markers, %u lost\n", num_markers, markers_lost);
+	print_stages(stages, num_markers);
+
+out:
+	cras_client_stop(client);
+	cras_client_stream_params_destroy(out_params);
+	cras_client_stream_params_destroy(in_params);
+	cras_audio_format_destroy(aud_format);
+	free(stages);
+	free(markers);
+	return rc;
+}
+
+static struct option long_options[] = {
+	{ "aec", no_argument, 0, 'a' },
+	{ "block_size", required_argument, 0, 'b' },
+	{ "count", required_argument, 0, 'n' },
+	{ "help", no_argument, 0, 'h' },
+	{ "interval_ms", required_argument, 0, 'i' },
+	{ "rate", required_argument, 0, 'r' },
+	{ "threshold", required_argument, 0, 't' },
+	{ 0, 0, 0, 0 }
+};
+
+static void show_usage(void)
+{
+	printf("--aec - Enable echo cancellation on the input stream.\n");
+	printf("--block_size <N> - Frames per callback, default 480.\n");
+	printf("--count <N> - Number of markers to measure, default 20.\n");
+	printf("--help - Shows this message and exits.\n");
+	printf("--interval_ms <N> - Time between markers, default 500.\n");
+	printf("--rate <N> - Sample rate of the streams, default 48000.\n");
+	printf("--threshold <0.0-1.0> - Level the marker is detected at, "
+	       "default 0.1.\n\n");
+	printf("Plays tone bursts to the active output and detects them in the "
+	       "active input.\n");
+	printf("Connect the two with a loopback cable, or turn the volume up "
+	       "for an acoustic\nloop. Reports the latency of each stage of "
+	       "the round trip.\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct cras_client *client;
+	size_t rate = 48000;
+	size_t block_size = 480;
+	int aec = 0;
+	int rc = 0;
+	int c, option_index = 0;
+
+	num_markers = 20;
+
+	while (1) {
+		c = getopt_long(argc, argv, "ab:hi:n:r:t:", long_options,
+				&option_index);
+		if (c == -1)
+			break;
+		switch (c) {
+		case 'a':
+			aec = 1;
+			break;
+		case 'b':
+			block_size = atoi(optarg);
+			break;
+		case 'i':
+			interval_ms = atoi(optarg);
+			break;
+		case 'n':
+			num_markers = atoi(optarg);
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 't':
+			threshold = atof(optarg);
+			break;
+		case 'h':
+		default:
+			show_usage();
+			return c == 'h' ? 0 : 1;
+		}
+	}
+
+	if (!num_markers || !rate || !block_size || threshold <= 0 ||
+	    threshold > 1) {
+		show_usage();
+		return 1;
+	}
+
+	rc = cras_client_create(&client);
+	if (rc < 0) {
+		fprintf(stderr, "Couldn't create client.\n");
+		return rc;
+	}
+
+	rc = cras_client_connect(client);
+	if (rc) {
+		fprintf(stderr, "Couldn't connect to server.\n");
+		goto destroy_exit;
+	}
+
+	rc = run_latency(client, rate, block_size, aec);
+
+destroy_exit:
+	cras_client_destroy(client);
+	return rc;
+}
@@ -188,12 +188,168 @@ static void server_connection_callback(struct cras_client *client,
 	printf("server %s\n", status_str);
 }
 
+static const char *dev_io_stage_names[CRAS_NUM_DEV_IO_STAGES] = {
+	[CRAS_DEV_IO_STAGE_FETCH] = "fetch",
+	[CRAS_DEV_IO_STAGE_CAPTURE_READ] = "capt_read",
+	[CRAS_DEV_IO_STAGE_CAPTURE_STREAMS] = "capt_strm",
+	[CRAS_DEV_IO_STAGE_SEND_CAPTURED] = "send_capt",
+	[CRAS_DEV_IO_STAGE_MIX] = "mix",
+	[CRAS_DEV_IO_STAGE_WRITE] = "write",
+};
+
+/* Finds the name of device dev_idx, for the perf view. */
+static const char *perf_dev_name(const struct cras_iodev_info *devs,
+				 size_t num_devs, uint32_t dev_idx)
+{
+	size_t i;
+
+	for (i = 0; i < num_devs; i++)
+		if (devs[i].idx == dev_idx)
+			return devs[i].name;
+	return "?";
+}
+
+/* Finds the stats of device dev_idx in the previous refresh, so the stage
+ * times are shown over the last interval rather than since it opened. */
+static const struct cras_dev_perf_stats *
+perf_prev_dev(const struct cras_perf_stats *prev, uint32_t dev_idx)
+{
+	uint32_t i;
+
+	for (i = 0; i < prev->num_devs; i++)
+		if (prev->devs[i].dev_idx == dev_idx)
+			return &prev->devs[i];
+	return NULL;
+}
+
+static void print_dev_perf(const struct cras_dev_perf_stats *ds,
+			   const struct cras_dev_perf_stats *prev,
+			   const char *name)
+{
+	uint32_t count;
+	uint64_t total;
+	unsigned int i;
+
+	printf("%3u %-6s %-24.24s %6u %5u %5u %5u %7u %7u %7u %7u %5u %5u/%u\n",
+	       ds->dev_idx, string_for_direction(ds->direction), name,
+	       ds->frame_rate, ds->buffer_size, ds->min_buffer_level,
+	       ds->highest_hw_level, ds->margin_us, ds->min_margin_us,
+	       ds->late_us, ds->max_late_us, ds->num_risks,
+	       ds->num_underruns, ds->num_severe_underruns);
+	printf("    usec/wake (max):");
+	for (i = 0; i < CRAS_NUM_DEV_IO_STAGES; i++) {
+		count = ds->stage_count[i];
+		total = ds->stage_total_usec[i];
+		if (prev && prev->stage_count[i] <= count) {
+			count -= prev->stage_count[i];
+			total -= prev->stage_total_usec[i];
+		}
+		if (!count)
+			continue;
+		printf(" %s:%" PRIu64 "(%u)", dev_io_stage_names[i],
+		       total / count, ds->stage_max_usec[i]);
+	}
+	printf("\n");
+}
+
+static void print_stream_perf(const struct cras_stream_perf_stats *ss)
+{
+	printf("  %#-10x %3u %-6s %6u %5u %7u %8u %9u\n", ss->stream_id,
+	       ss->dev_idx, string_for_direction(ss->direction),
+	       ss->frame_rate, ss->cb_threshold, ss->num_missed_cb,
+	       ss->num_overruns, ss->longest_fetch_usec);
+}
+
+/* Redraws the perf stats of all the audio threads. prev holds the stats of
+ * the last redraw and is updated. */
+static void print_perf_view(struct cras_client *client,
+			    struct cras_perf_stats *prev,
+			    unsigned int interval_ms)
+{
+	struct cras_perf_stats stats[CRAS_MAX_PERF_STATS];
+	struct cras_iodev_info devs[2 * CRAS_MAX_IODEVS];
+	size_t num_devs = CRAS_MAX_IODEVS, num_in = CRAS_MAX_IODEVS;
+	size_t num_nodes = 0;
+	uint32_t j;
+	int i, num;
+
+	num = cras_client_get_perf_stats(client, stats, CRAS_MAX_PERF_STATS);
+	if (num < 0) {
+		syslog(LOG_ERR, "Couldn't get perf stats: %s", strerror(-num));
+		return;
+	}
+	if (cras_client_get_output_devices(client, devs, NULL, &num_devs,
+					   &num_nodes))
+		num_devs = 0;
+	num_nodes = 0;
+	if (cras_client_get_input_devices(client, devs + num_devs, NULL,
+					  &num_in, &num_nodes) == 0)
+		num_devs += num_in;
+
+	/* Clear the terminal and draw from the top left. */
+	printf("\033[H\033[J");
+	printf("cras_monitor perf view, every %u ms, q to quit\n\n",
+	       interval_ms);
+	for (i = 0; i < num; i++) {
+		if (!stats[i].seq)
+			continue;
+		printf("audio thread %d\n", i);
+		printf("idx dir    %-24s %6s %5s %5s %5s %7s %7s %7s %7s %5s %s\n",
+		       "name", "rate", "buf", "level", "high", "marg_us",
+		       "min_us", "late_us", "max_us", "risks", "xruns/severe");
+		for (j = 0; j < stats[i].num_devs; j++)
+			print_dev_perf(&stats[i].devs[j],
+				       perf_prev_dev(&prev[i],
+						     stats[i].devs[j].dev_idx),
+				       perf_dev_name(devs, num_devs,
+						     stats[i].devs[j].dev_idx));
+		if (stats[i].num_streams)
+			printf("  %-10s %3s %-6s %6s %5s %7s %8s %9s\n",
+			       "stream", "dev", "dir", "rate", "cb",
+			       "missed", "overruns", "fetch_us");
+		for (j = 0; j < stats[i].num_streams; j++)
+			print_stream_perf(&stats[i].streams[j]);
+		printf("\n");
+	}
+	fflush(stdout);
+	memcpy(prev, stats, num * sizeof(stats[0]));
+}
+
+/* Shows the perf stats the audio threads publish in the server state until
+ * q is entered. Only reads shared memory, nothing is sent to the server. */
+static int run_perf_view(struct cras_client *client, unsigned int interval_ms)
+{
+	struct cras_perf_stats prev[CRAS_MAX_PERF_STATS];
+	struct timeval tv;
+	fd_set fds;
+	char c;
+	int rc;
+
+	memset(prev, 0, sizeof(prev));
+	while (1) {
+		print_perf_view(client, prev, interval_ms);
+
+		FD_ZERO(&fds);
+		FD_SET(STDIN_FILENO, &fds);
+		tv.tv_sec = interval_ms / 1000;
+		tv.tv_usec = (interval_ms % 1000) * 1000;
+		rc = select(STDIN_FILENO + 1, &fds, NULL, NULL, &tv);
+		if (rc < 0)
+			return -errno;
+		if (rc > 0 && (read(STDIN_FILENO, &c, 1) <= 0 || c == 'q'))
+			return 0;
+	}
+}
+
 static void print_usage(const char *command)
 {
 	fprintf(stderr,
 		"%s [options]\n"
 		"  Where [options] are:\n"
 		"    --sync|-s  - Use the synchronous connection functions.\n"
+		"    --perf|-p[<ms>]  - Show a live view of the audio thread "
+		"performance,\n"
+		"                       refreshed every <ms> (default 1000).\n"
 		"    --log-level|-l <n>  - Set the syslog level (7 == "
 		"LOG_DEBUG).\n",
 		command);
@@ -205,9 +361,11 @@ int main(int argc, char **argv)
 	int rc;
 	int option_character;
 	bool synchronous = false;
+	int perf_interval_ms = 0;
 	int log_level = LOG_WARNING;
 	static struct option long_options[] = {
 		{ "sync", no_argument, NULL, 's' },
+		{ "perf", optional_argument, NULL, 'p' },
 		{ "log-level", required_argument, NULL, 'l' },
 		{ NULL, 0, NULL, 0 },
 	};
@@ -215,7 +373,7 @@ int main(int argc, char **argv)
 	while (true) {
 		int option_index = 0;
 
-		option_character = getopt_long(argc, argv, "sl:", long_options,
+		option_character = getopt_long(argc, argv, "sp::l:", long_options,
 					       &option_index);
 		if (option_character == -1)
 			break;
@@ -223,6 +381,11 @@ int main(int argc, char **argv)
 		case 's':
 			synchronous = !synchronous;
 			break;
+		case 'p':
+			perf_interval_ms = optarg ? atoi(optarg) : 1000;
+			if (perf_interval_ms <= 0)
+				perf_interval_ms = 1000;
+			break;
 		case 'l':
 			log_level = atoi(optarg);
 			if (log_level < 0)
@@ -251,6 +414,16 @@ int main(int argc, char **argv)
 		return rc;
 	}
 
+	if (perf_interval_ms) {
+		rc = cras_client_connect(client);
+		if (rc != 0) {
+			syslog(LOG_ERR, "Could not connect to server.");
+			goto destroy_exit;
+		}
+		rc = run_perf_view(client, perf_interval_ms);
+		goto destroy_exit;
+	}
+
 	cras_client_set_connection_status_cb(client, server_connection_callback,
 					     NULL);
 
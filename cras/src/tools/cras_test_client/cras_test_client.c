@@ -3,6 +3,10 @@
  * found in the LICENSE file.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* For O_DIRECT */
+#endif
+
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
@@ -71,6 +75,102 @@ static const struct timespec follow_atlog_sleep_ts = {
 	0, 50 * 1000 * 1000 /* 50 ms. */
 };
 
+/* Names of the audio thread events in the trace of --follow_atlog_trace. */
+#define ATLOG_EVENT_NAME(event) [AUDIO_THREAD_##event] = #event
+static const char *atlog_event_names[] = {
+	ATLOG_EVENT_NAME(WAKE),
+	ATLOG_EVENT_NAME(SLEEP),
+	ATLOG_EVENT_NAME(READ_AUDIO),
+	ATLOG_EVENT_NAME(READ_AUDIO_TSTAMP),
+	ATLOG_EVENT_NAME(READ_AUDIO_DONE),
+	ATLOG_EVENT_NAME(READ_OVERRUN),
+	ATLOG_EVENT_NAME(FILL_AUDIO),
+	ATLOG_EVENT_NAME(FILL_AUDIO_TSTAMP),
+	ATLOG_EVENT_NAME(FILL_AUDIO_DONE),
+	ATLOG_EVENT_NAME(WRITE_STREAMS_WAIT),
+	ATLOG_EVENT_NAME(WRITE_STREAMS_WAIT_TO),
+	ATLOG_EVENT_NAME(WRITE_STREAMS_MIX),
+	ATLOG_EVENT_NAME(WRITE_STREAMS_MIXED),
+	ATLOG_EVENT_NAME(WRITE_STREAMS_STREAM),
+	ATLOG_EVENT_NAME(FETCH_STREAM),
+	ATLOG_EVENT_NAME(STREAM_ADDED),
+	ATLOG_EVENT_NAME(STREAM_REMOVED),
+	ATLOG_EVENT_NAME(A2DP_FLUSH),
+	ATLOG_EVENT_NAME(A2DP_THROTTLE_TIME),
+	ATLOG_EVENT_NAME(A2DP_WRITE),
+	ATLOG_EVENT_NAME(A2DP_BITPOOL),
+	ATLOG_EVENT_NAME(DEV_STREAM_MIX),
+	ATLOG_EVENT_NAME(CAPTURE_POST),
+	ATLOG_EVENT_NAME(CAPTURE_WRITE),
+	ATLOG_EVENT_NAME(CONV_COPY),
+	ATLOG_EVENT_NAME(STREAM_FETCH_PENDING),
+	ATLOG_EVENT_NAME(STREAM_RESCHEDULE),
+	ATLOG_EVENT_NAME(STREAM_SLEEP_TIME),
+	ATLOG_EVENT_NAME(STREAM_SLEEP_ADJUST),
+	ATLOG_EVENT_NAME(STREAM_SKIP_CB),
+	ATLOG_EVENT_NAME(DEV_SLEEP_TIME),
+	ATLOG_EVENT_NAME(SET_DEV_WAKE),
+	ATLOG_EVENT_NAME(DEV_ADDED),
+	ATLOG_EVENT_NAME(DEV_REMOVED),
+	ATLOG_EVENT_NAME(IODEV_CB),
+	ATLOG_EVENT_NAME(PB_MSG),
+	ATLOG_EVENT_NAME(ODEV_NO_STREAMS),
+	ATLOG_EVENT_NAME(ODEV_START),
+	ATLOG_EVENT_NAME(ODEV_LEAVE_NO_STREAMS),
+	ATLOG_EVENT_NAME(ODEV_DEFAULT_NO_STREAMS),
+	ATLOG_EVENT_NAME(FILL_ODEV_ZEROS),
+	ATLOG_EVENT_NAME(UNDERRUN),
+	ATLOG_EVENT_NAME(SEVERE_UNDERRUN),
+	ATLOG_EVENT_NAME(CAPTURE_DROP_TIME),
+	ATLOG_EVENT_NAME(DEV_DROP_FRAMES),
+	ATLOG_EVENT_NAME(LOOPBACK_PUT),
+	ATLOG_EVENT_NAME(LOOPBACK_GET),
+	ATLOG_EVENT_NAME(LOOPBACK_SAMPLE_HOOK),
+	ATLOG_EVENT_NAME(DEV_OVERRUN),
+	ATLOG_EVENT_NAME(DEV_IO_STAGE_MAX),
+	ATLOG_EVENT_NAME(UNDERRUN_RISK),
+	ATLOG_EVENT_NAME(BUFFER_LEVEL_ADJUST),
+	ATLOG_EVENT_NAME(STREAM_FORMAT),
+	ATLOG_EVENT_NAME(STREAM_CONFIG),
+	ATLOG_EVENT_NAME(STREAM_REPLY),
+	ATLOG_EVENT_NAME(DEV_FORMAT),
+	ATLOG_EVENT_NAME(DEV_DELAY),
+};
+#undef ATLOG_EVENT_NAME
+
+/* Names of the startup phases in --dump_main and --dump_startup_trace. */
+#define STARTUP_PHASE_NAME(phase) [STARTUP_##phase] = #phase
+static const char *startup_phase_names[STARTUP_NUM_PHASES] = {
+	STARTUP_PHASE_NAME(SERVER_INIT),
+	STARTUP_PHASE_NAME(SYSTEM_STATE_INIT),
+	STARTUP_PHASE_NAME(DSP_INIT),
+	STARTUP_PHASE_NAME(APM_LIST_INIT),
+	STARTUP_PHASE_NAME(IODEV_LIST_INIT),
+	STARTUP_PHASE_NAME(UDEV_ENUMERATE),
+	STARTUP_PHASE_NAME(CARD_PROBE),
+	STARTUP_PHASE_NAME(CARD_UCM),
+	STARTUP_PHASE_NAME(CARD_MIXER),
+	STARTUP_PHASE_NAME(CARD_PCM_PROBE),
+	STARTUP_PHASE_NAME(CARD_COMMIT),
+	STARTUP_PHASE_NAME(DEVICE_CREATE),
+	STARTUP_PHASE_NAME(DEVICE_JACKS),
+	STARTUP_PHASE_NAME(BT_INIT),
+	STARTUP_PHASE_NAME(READY),
+};
+#undef STARTUP_PHASE_NAME
+
+/* Where --dump_startup_trace writes the startup log, NULL to print it. */
+static FILE *startup_trace;
+
+static const char *dev_io_stage_names[CRAS_NUM_DEV_IO_STAGES] = {
+	[CRAS_DEV_IO_STAGE_FETCH] = "fetch",
+	[CRAS_DEV_IO_STAGE_CAPTURE_READ] = "capture_read",
+	[CRAS_DEV_IO_STAGE_CAPTURE_STREAMS] = "capture_streams",
+	[CRAS_DEV_IO_STAGE_SEND_CAPTURED] = "send_captured",
+	[CRAS_DEV_IO_STAGE_MIX] = "mix",
+	[CRAS_DEV_IO_STAGE_WRITE] = "write",
+};
+
 /* Conditional so the client thread can signal that main should exit. */
 static pthread_mutex_t done_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
@@ -83,6 +183,7 @@ struct {
 	{ "S16_LE", SND_PCM_FORMAT_S16_LE },
 	{ "S24_LE", SND_PCM_FORMAT_S24_LE },
 	{ "S32_LE", SND_PCM_FORMAT_S32_LE },
+	{ "FLOAT_LE", SND_PCM_FORMAT_FLOAT_LE },
 	{ NULL, 0 },
 };
 
@@ -219,6 +320,245 @@ static int parse_node_id_with_value(char *input, cras_node_id_t *id_out,
 	return 0;
 }
 
+/* Captured audio is queued in a ring for a writer thread so that a slow
+ * disk never stalls the audio callback. The file is written in large blocks
+ * aligned for O_DIRECT, after a header block holding the WAV header when the
+ * file name ends in ".wav".
+ */
+#define CAPTURE_RING_SIZE (32 * 1024 * 1024)
+#define CAPTURE_WRITE_SIZE (256 * 1024)
+#define CAPTURE_ALIGN 4096
+#define CAPTURE_HEADER_SIZE 4096
+
+struct capture_writer {
+	int fd;
+	uint8_t *ring;
+	uint8_t *header;
+	/* Bytes ever queued and written, only ever increasing. */
+	uint64_t write_pos;
+	uint64_t read_pos;
+	int done;
+	int error;
+	uint64_t dropped;
+	int wav;
+	snd_pcm_format_t format;
+	size_t rate;
+	size_t num_channels;
+	pthread_t thread;
+};
+
+static struct capture_writer *capture_writer;
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+	put_le16(p, v);
+	put_le16(p + 2, v >> 16);
+}
+
+static void put_le64(uint8_t *p, uint64_t v)
+{
+	put_le32(p, v);
+	put_le32(p + 4, v >> 32);
+}
+
+/* Fills the header block for data_bytes of samples. A WAV file that
+ * outgrows the 32 bit RIFF sizes becomes RF64, whose ds64 chunk takes the
+ * place of the first JUNK chunk. The second JUNK chunk pads the header so
+ * that samples start on a block boundary. */
+static void fill_wav_header(struct capture_writer *w, uint64_t data_bytes)
+{
+	uint8_t *h = w->header;
+	size_t sample_bytes = snd_pcm_format_physical_width(w->format) / 8;
+	size_t frame_bytes = sample_bytes * w->num_channels;
+	uint64_t riff_bytes = CAPTURE_HEADER_SIZE - 8 + data_bytes;
+	int rf64 = riff_bytes > UINT32_MAX;
+
+	memset(h, 0, CAPTURE_HEADER_SIZE);
+	memcpy(h, rf64 ? "RF64" : "RIFF", 4);
+	put_le32(h + 4, rf64 ? UINT32_MAX : riff_bytes);
+	memcpy(h + 8, "WAVE", 4);
+	memcpy(h + 12, rf64 ? "ds64" : "JUNK", 4);
+	put_le32(h + 16, 28);
+	if (rf64) {
+		put_le64(h + 20, riff_bytes);
+		put_le64(h + 28, data_bytes);
+		put_le64(h + 36, data_bytes / frame_bytes);
+	}
+	memcpy(h + 48, "fmt ", 4);
+	put_le32(h + 52, 16);
+	put_le16(h + 56, snd_pcm_format_float(w->format) == 1 ? 3 : 1);
+	put_le16(h + 58, w->num_channels);
+	put_le32(h + 60, w->rate);
+	put_le32(h + 64, w->rate * frame_bytes);
+	put_le16(h + 68, frame_bytes);
+	put_le16(h + 70, sample_bytes * 8);
+	memcpy(h + 72, "JUNK", 4);
+	put_le32(h + 76, CAPTURE_HEADER_SIZE - 88);
+	memcpy(h + CAPTURE_HEADER_SIZE - 8, "data", 4);
+	put_le32(h + CAPTURE_HEADER_SIZE - 4, rf64 ? UINT32_MAX : data_bytes);
+}
+
+static int pwrite_all(int fd, const uint8_t *buf, size_t len, off_t offset)
+{
+	ssize_t rc;
+
+	while (len) {
+		rc = pwrite(fd, buf, len, offset);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf += rc;
+		len -= rc;
+		offset += rc;
+	}
+	return 0;
+}
+
+/* Writes len bytes from the ring at read_pos. Writes of CAPTURE_WRITE_SIZE
+ * never wrap as it divides the ring size. */
+static void capture_writer_write(struct capture_writer *w, size_t len)
+{
+	size_t offset = w->read_pos % CAPTURE_RING_SIZE;
+	off_t file_offset = w->read_pos + (w->wav ? CAPTURE_HEADER_SIZE : 0);
+	int rc;
+
+	if (!w->error) {
+		rc = pwrite_all(w->fd, w->ring + offset, len, file_offset);
+		if (rc < 0)
+			w->error = rc;
+	}
+	__atomic_store_n(&w->read_pos, w->read_pos + len, __ATOMIC_RELEASE);
+}
+
+static void *capture_writer_thread(void *arg)
+{
+	struct capture_writer *w = (struct capture_writer *)arg;
+	struct timespec ts = { 0, 10 * 1000 * 1000 /* 10 ms. */ };
+	uint64_t avail;
+	int done, flags;
+
+	while (1) {
+		done = __atomic_load_n(&w->done, __ATOMIC_ACQUIRE);
+		avail = __atomic_load_n(&w->write_pos, __ATOMIC_ACQUIRE) -
+			w->read_pos;
+		if (avail >= CAPTURE_WRITE_SIZE) {
+			capture_writer_write(w, CAPTURE_WRITE_SIZE);
+			continue;
+		}
+		if (done)
+			break;
+		nanosleep(&ts, NULL);
+	}
+
+	/* The unaligned tail and the final header need buffered writes. */
+	flags = fcntl(w->fd, F_GETFL);
+	if (flags >= 0 && (flags & O_DIRECT))
+		fcntl(w->fd, F_SETFL, flags & ~O_DIRECT);
+	if (avail)
+		capture_writer_write(w, avail);
+	if (w->wav && !w->error) {
+		fill_wav_header(w, w->read_pos);
+		w->error = pwrite_all(w->fd, w->header, CAPTURE_HEADER_SIZE, 0);
+	}
+	return NULL;
+}
+
+static struct capture_writer *capture_writer_create(int fd, int wav,
+						    snd_pcm_format_t format,
+						    size_t rate,
+						    size_t num_channels)
+{
+	struct capture_writer *w;
+	int rc;
+
+	w = (struct capture_writer *)calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+	w->fd = fd;
+	w->wav = wav;
+	w->format = format;
+	w->rate = rate;
+	w->num_channels = num_channels;
+
+	if (posix_memalign((void **)&w->ring, CAPTURE_ALIGN,
+			   CAPTURE_RING_SIZE))
+		goto free_writer;
+	if (posix_memalign((void **)&w->header, CAPTURE_ALIGN,
+			   CAPTURE_HEADER_SIZE))
+		goto free_ring;
+
+	/* Reserves the header block, rewritten with the final sizes. */
+	if (wav) {
+		fill_wav_header(w, 0);
+		rc = pwrite_all(fd, w->header, CAPTURE_HEADER_SIZE, 0);
+		if (rc < 0) {
+			fprintf(stderr, "Error writing WAV header: %s\n",
+				strerror(-rc));
+			goto free_header;
+		}
+	}
+
+	if (pthread_create(&w->thread, NULL, capture_writer_thread, w))
+		goto free_header;
+	return w;
+
+free_header:
+	free(w->header);
+free_ring:
+	free(w->ring);
+free_writer:
+	free(w);
+	return NULL;
+}
+
+/* Run from callback thread. Drops the whole buffer rather than blocking
+ * when the writer falls too far behind. */
+static void capture_writer_push(struct capture_writer *w, const uint8_t *buf,
+				size_t len)
+{
+	uint64_t read_pos = __atomic_load_n(&w->read_pos, __ATOMIC_ACQUIRE);
+	size_t offset = w->write_pos % CAPTURE_RING_SIZE;
+	size_t first = MIN(len, CAPTURE_RING_SIZE - offset);
+
+	if (w->write_pos + len - read_pos > CAPTURE_RING_SIZE) {
+		w->dropped += len;
+		return;
+	}
+	memcpy(w->ring + offset, buf, first);
+	memcpy(w->ring, buf + first, len - first);
+	__atomic_store_n(&w->write_pos, w->write_pos + len, __ATOMIC_RELEASE);
+}
+
+/* Flushes the queued samples and finalizes the header. Must be called once
+ * the stream stopped calling back. */
+static int capture_writer_destroy(struct capture_writer *w)
+{
+	int rc;
+
+	__atomic_store_n(&w->done, 1, __ATOMIC_RELEASE);
+	pthread_join(w->thread, NULL);
+
+	if (w->dropped)
+		fprintf(stderr, "Dropped %" PRIu64 " bytes of capture\n",
+			w->dropped);
+	rc = w->error;
+	if (rc < 0)
+		fprintf(stderr, "Error writing file: %s\n", strerror(-rc));
+
+	free(w->header);
+	free(w->ring);
+	free(w);
+	return rc;
+}
+
 /* Run from callback thread. */
 static int got_samples(struct cras_client *client, cras_stream_id_t stream_id,
 		       uint8_t *captured_samples, uint8_t *playback_samples,
@@ -247,6 +587,12 @@ static int got_samples(struct cras_client *client, cras_stream_id_t stream_id,
 
 	check_stream_terminate(frames);
 
+	if (capture_writer) {
+		capture_writer_push(capture_writer, captured_samples,
+				    write_size);
+		return frames;
+	}
+
 	ret = write(*fd, captured_samples, write_size);
 	if (ret != write_size)
 		printf("Error writing file\n");
@@ -635,8 +981,12 @@ static void show_alog_tag(const struct audio_thread_event_log *log,
 		       data1 * 1000 + data2 / 1000000, data3);
 		break;
 	case AUDIO_THREAD_A2DP_WRITE:
-		printf("%-30s written:%d queued:%u\n", "A2DP_WRITE", data1,
-		       data2);
+		printf("%-30s written:%d queued:%u packets:%u\n", "A2DP_WRITE",
+		       data1, data2, data3);
+		break;
+	case AUDIO_THREAD_A2DP_BITPOOL:
+		printf("%-30s bitpool:%u frame_length:%u\n", "A2DP_BITPOOL",
+		       data1, data2);
 		break;
 	case AUDIO_THREAD_DEV_STREAM_MIX:
 		printf("%-30s written:%u read:%u\n", "DEV_STREAM_MIX", data1,
@@ -735,19 +1085,108 @@ static void show_alog_tag(const struct audio_thread_event_log *log,
 		       data1, data2);
 		break;
 	case AUDIO_THREAD_LOOPBACK_SAMPLE_HOOK:
-		printf("%-30s frames_to_copy:%u frames_copied:%u\n",
-		       "LOOPBACK_SAMPLE", data1, data2);
+		printf("%-30s frames_to_copy:%u frames_copied:%u "
+		       "frames_dropped:%u\n",
+		       "LOOPBACK_SAMPLE", data1, data2, data3);
 		break;
 	case AUDIO_THREAD_DEV_OVERRUN:
 		printf("%-30s dev:%u hw_level:%u\n", "DEV_OVERRUN", data1,
 		       data2);
 		break;
+	case AUDIO_THREAD_DEV_IO_STAGE_MAX:
+		printf("%-30s dev:%u stage:%s usec:%u\n", "DEV_IO_STAGE_MAX",
+		       data1,
+		       data2 < CRAS_NUM_DEV_IO_STAGES ?
+			       dev_io_stage_names[data2] :
+			       "unknown",
+		       data3);
+		break;
+	case AUDIO_THREAD_UNDERRUN_RISK:
+		printf("%-30s dev:%u margin_us:%u budget_us:%u\n",
+		       "UNDERRUN_RISK", data1, data2, data3);
+		break;
+	case AUDIO_THREAD_BUFFER_LEVEL_ADJUST:
+		printf("%-30s dev:%u from:%u to:%u\n", "BUFFER_LEVEL_ADJUST",
+		       data1, data2, data3);
+		break;
+	case AUDIO_THREAD_DEV_REWIND:
+		printf("%-30s dev:%u requested:%u rewound:%u\n", "DEV_REWIND",
+		       data1, data2, data3);
+		break;
+	case AUDIO_THREAD_STREAM_SCHEDULED_START:
+		printf("%-30s id:%x delay:%u lead:%u\n",
+		       "STREAM_SCHEDULED_START", data1, data2, data3);
+		break;
+	case AUDIO_THREAD_STREAM_VAD:
+		printf("%-30s id:%x active:%u transitions:%u\n", "STREAM_VAD",
+		       data1, data2, data3);
+		break;
+	case AUDIO_THREAD_STREAM_PRE_ROLL:
+		printf("%-30s id:%x dev:%u frames:%u\n", "STREAM_PRE_ROLL",
+		       data1, data2, data3);
+		break;
+	case AUDIO_THREAD_STREAM_PAUSED:
+		printf("%-30s id:%x dev:%u paused:%u\n", "STREAM_PAUSED", data1,
+		       data2, data3);
+		break;
+	case AUDIO_THREAD_DSP_RUN_MAX:
+		printf("%-30s instance:%u ns:%u frames:%u\n", "DSP_RUN_MAX",
+		       data1, data2, data3);
+		break;
+	case AUDIO_THREAD_STREAM_FORMAT:
+		printf("%-30s id:%x rate:%u dir:%u format:%u client:%u ch:%u\n",
+		       "STREAM_FORMAT", data1, data2, data3 >> 24,
+		       (data3 >> 16) & 0xff, (data3 >> 8) & 0xff,
+		       data3 & 0xff);
+		break;
+	case AUDIO_THREAD_STREAM_CONFIG:
+		printf("%-30s id:%x cbth:%u effects:%#x flags:%#x\n",
+		       "STREAM_CONFIG", data1, data2, data3 >> 16,
+		       data3 & 0xffff);
+		break;
+	case AUDIO_THREAD_STREAM_REPLY:
+		printf("%-30s id:%x reply_us:%u\n", "STREAM_REPLY", data1,
+		       data2);
+		break;
+	case AUDIO_THREAD_DEV_FORMAT:
+		printf("%-30s dev:%u rate:%u buffer_size:%u\n", "DEV_FORMAT",
+		       data1, data2, data3);
+		break;
+	case AUDIO_THREAD_DEV_DELAY:
+		printf("%-30s dev:%u delay:%u\n", "DEV_DELAY", data1, data2);
+		break;
 	default:
 		printf("%-30s tag:%u\n", "UNKNOWN", tag);
 		break;
 	}
 }
 
+/* Prints the count, average and maximum time in usec of each stage a device
+ * went through, followed by the histogram bins. */
+static void print_dev_io_stages(const struct audio_stage_debug_info *stages)
+{
+	int i, j;
+
+	printf("stage_usec: count avg max hist");
+	for (j = 0; j < CRAS_DEV_IO_STAGE_HIST_BINS - 1; j++)
+		printf(" <%u", 32U << j);
+	printf(" >=%u\n", 32U << (CRAS_DEV_IO_STAGE_HIST_BINS - 2));
+
+	for (i = 0; i < CRAS_NUM_DEV_IO_STAGES; i++) {
+		const struct audio_stage_debug_info *stage = &stages[i];
+
+		if (!stage->count)
+			continue;
+		printf("  %s: %u %" PRIu64 " %u", dev_io_stage_names[i],
+		       (unsigned int)stage->count,
+		       (uint64_t)(stage->total_usec / stage->count),
+		       (unsigned int)stage->max_usec);
+		for (j = 0; j < CRAS_DEV_IO_STAGE_HIST_BINS; j++)
+			printf(" %u", (unsigned int)stage->hist[j]);
+		printf("\n");
+	}
+}
+
 static void print_audio_debug_info(const struct audio_debug_info *info)
 {
 	time_t sec_offset;
@@ -755,6 +1194,13 @@ static void print_audio_debug_info(const struct audio_debug_info *info)
 	int i, j;
 
 	printf("Audio Debug Stats:\n");
+	printf("rt_memory_locked: %u\n"
+	       "minor_faults: %" PRIu64 "\n"
+	       "major_faults: %" PRIu64 "\n"
+	       "conv_mem_bytes: %" PRIu64 "\n",
+	       (unsigned int)info->rt_memory_locked,
+	       (uint64_t)info->minor_faults, (uint64_t)info->major_faults,
+	       (uint64_t)info->conv_mem_bytes);
 	printf("-------------devices------------\n");
 	if (info->num_devs > MAX_DEBUG_DEVS)
 		return;
@@ -777,7 +1223,8 @@ static void print_audio_debug_info(const struct audio_debug_info *info)
 		       "highest_hw_level: %u\n"
 		       "runtime: %u.%09u\n"
 		       "longest_wake: %u.%09u\n"
-		       "software_gain_scaler: %lf\n",
+		       "software_gain_scaler: %lf\n"
+		       "mem_bytes: %" PRIu64 "\n",
 		       (unsigned int)info->devs[i].buffer_size,
 		       (unsigned int)info->devs[i].min_buffer_level,
 		       (unsigned int)info->devs[i].min_cb_level,
@@ -792,7 +1239,9 @@ static void print_audio_debug_info(const struct audio_debug_info *info)
 		       (unsigned int)info->devs[i].runtime_nsec,
 		       (unsigned int)info->devs[i].longest_wake_sec,
 		       (unsigned int)info->devs[i].longest_wake_nsec,
-		       info->devs[i].software_gain_scaler);
+		       info->devs[i].software_gain_scaler,
+		       (uint64_t)info->devs[i].mem_bytes);
+		print_dev_io_stages(info->devs[i].stages);
 		printf("\n");
 	}
 
@@ -845,7 +1294,15 @@ static void print_audio_debug_info(const struct audio_debug_info *info)
 		printf("channel map:");
 		for (channel = 0; channel < CRAS_CH_MAX; channel++)
 			printf("%d ", info->streams[i].channel_layout[channel]);
-		printf("\n\n");
+		printf("\n");
+		printf("convert_us: %" PRIu64 "\n"
+		       "mix_us: %" PRIu64 "\n"
+		       "apm_us: %" PRIu64 "\n"
+		       "mem_bytes: %" PRIu64 "\n\n",
+		       info->streams[i].convert_ns / 1000,
+		       info->streams[i].mix_ns / 1000,
+		       info->streams[i].apm_ns / 1000,
+		       info->streams[i].mem_bytes);
 	}
 
 	printf("Audio Thread Event Log:\n");
@@ -915,6 +1372,9 @@ static void show_mainlog_tag(const struct main_thread_event_log *log,
 		printf("%-30s new ch %u old ch %u rate %u\n", "DEV_REOPEN",
 		       data1, data2, data3);
 		break;
+	case MAIN_THREAD_DEV_STANDBY:
+		printf("%-30s dev %u for %u ms\n", "DEV_STANDBY", data1, data2);
+		break;
 	case MAIN_THREAD_ADD_ACTIVE_NODE:
 		printf("%-30s dev %u\n", "ADD_ACTIVE_NODE", data1);
 		break;
@@ -955,6 +1415,14 @@ static void show_mainlog_tag(const struct main_thread_event_log *log,
 	case MAIN_THREAD_STREAM_REMOVED:
 		printf("%-30s stream 0x%x\n", "STREAM_REMOVED", data1);
 		break;
+	case MAIN_THREAD_STREAM_EFFECTS:
+		printf("%-30s stream 0x%x effects 0x%x\n", "STREAM_EFFECTS",
+		       data1, data2);
+		break;
+	case MAIN_THREAD_STREAM_PAUSED:
+		printf("%-30s stream 0x%x %s fade in %u ms\n", "STREAM_PAUSED",
+		       data1, data2 ? "paused" : "resumed", data3);
+		break;
 	default:
 		printf("%-30s\n", "UNKNOWN");
 		break;
@@ -1135,7 +1603,13 @@ static void cras_bt_debug_info(struct cras_client *client)
 	convert_to_time_str(&ts, sec_offset, nsec_offset);
 	printf("%s [end]\n", time_str);
 
-	printf("In hex format:\n");
+	printf("%u packets, %u lost, first packet %s\n",
+	       wbs_logger.num_packets, wbs_logger.num_lost,
+	       wbs_logger.first_lost ? "lost" : "received");
+	if (wbs_logger.full)
+		printf("History is full, later packets are only counted.\n");
+
+	printf("Run lengths in hex varint format:\n");
 	packet_status_logger_dump_hex(&wbs_logger);
 
 	printf("In binary format:\n");
@@ -1147,6 +1621,72 @@ static void cras_bt_debug_info(struct cras_client *client)
 	pthread_mutex_unlock(&done_mutex);
 }
 
+static const char *startup_phase_name(uint32_t phase)
+{
+	if (phase < STARTUP_NUM_PHASES && startup_phase_names[phase])
+		return startup_phase_names[phase];
+	return "UNKNOWN";
+}
+
+/* Gets the CLOCK_MONOTONIC_RAW start of a phase in microseconds. */
+static uint64_t startup_phase_usec(const struct main_thread_startup_phase *p)
+{
+	return (uint64_t)p->sec * 1000000 + p->nsec / 1000;
+}
+
+/* Prints the startup phases, with their start relative to the first one. */
+static void show_startup_log(const struct main_thread_startup_log *log)
+{
+	const struct main_thread_startup_phase *p;
+	uint32_t i, num = MIN(log->num_phases, MAIN_THREAD_STARTUP_LOG_SIZE);
+
+	printf("Startup phases:\n");
+	for (i = 0; i < num; i++) {
+		p = &log->phases[i];
+		printf("%10.3f ms tid %-6u %-20s %3u %3u ",
+		       (startup_phase_usec(p) -
+			startup_phase_usec(&log->phases[0])) /
+			       1000.0,
+		       p->thread, startup_phase_name(p->phase), p->data1,
+		       p->data2);
+		if (p->duration_us == STARTUP_PHASE_RUNNING)
+			printf("running\n");
+		else
+			printf("%10.3f ms\n", p->duration_us / 1000.0);
+	}
+	if (log->num_phases > num)
+		printf("%u phases are missing.\n", log->num_phases - num);
+}
+
+/* Writes the startup phases in the JSON trace event format, on the same
+ * clock as the trace of --follow_atlog_trace. Phases are complete events on
+ * the thread that ran them, a phase still running only has its start. */
+static void write_startup_trace(FILE *trace,
+				const struct main_thread_startup_log *log)
+{
+	const struct main_thread_startup_phase *p;
+	uint32_t i, num = MIN(log->num_phases, MAIN_THREAD_STARTUP_LOG_SIZE);
+
+	fprintf(trace, "[");
+	for (i = 0; i < num; i++) {
+		p = &log->phases[i];
+		fprintf(trace, "%s\n{\"name\":\"%s\",", i ? "," : "",
+			startup_phase_name(p->phase));
+		if (p->phase == STARTUP_READY)
+			fprintf(trace, "\"ph\":\"i\",\"s\":\"g\",");
+		else if (p->duration_us == STARTUP_PHASE_RUNNING)
+			fprintf(trace, "\"ph\":\"B\",");
+		else
+			fprintf(trace, "\"ph\":\"X\",\"dur\":%u,",
+				p->duration_us);
+		fprintf(trace,
+			"\"ts\":%" PRIu64 ",\"pid\":0,\"tid\":%u,"
+			"\"args\":{\"data1\":%u,\"data2\":%u}}",
+			startup_phase_usec(p), p->thread, p->data1, p->data2);
+	}
+	fprintf(trace, "\n]\n");
+}
+
 static void main_thread_debug_info(struct cras_client *client)
 {
 	const struct main_thread_debug_info *info;
@@ -1158,12 +1698,19 @@ static void main_thread_debug_info(struct cras_client *client)
 	fill_time_offset(&sec_offset, &nsec_offset);
 	j = info->main_log.write_pos;
 	i = 0;
+	if (startup_trace) {
+		write_startup_trace(startup_trace, &info->startup_log);
+		goto done;
+	}
 	printf("Main debug log:\n");
 	for (; i < info->main_log.len; i++) {
 		show_mainlog_tag(&info->main_log, j, sec_offset, nsec_offset);
 		j++;
 		j %= info->main_log.len;
 	}
+	show_startup_log(&info->startup_log);
+
+done:
 
 	/* Signal main thread we are done after the last chunk. */
 	pthread_mutex_lock(&done_mutex);
@@ -1199,6 +1746,9 @@ static void print_cras_audio_thread_snapshot(
 	case AUDIO_THREAD_EVENT_DEV_OVERRUN:
 		printf("device overrun\n");
 		break;
+	case AUDIO_THREAD_EVENT_UNDERRUN_RISK:
+		printf("underrun risk\n");
+		break;
 	case AUDIO_THREAD_EVENT_DEBUG:
 		printf("debug\n");
 		break;
@@ -1510,16 +2060,32 @@ static int run_capture(struct cras_client *client, const char *file,
 		       size_t num_channels, uint32_t flags, int is_loopback,
 		       int is_post_dsp)
 {
-	int fd = open(file, O_CREAT | O_RDWR | O_TRUNC, 0666);
+	size_t len = strlen(file);
+	int wav = len > 4 && strcasecmp(file + len - 4, ".wav") == 0;
+	int fd;
+
+	/* Not every file system supports O_DIRECT. */
+	fd = open(file, O_CREAT | O_RDWR | O_TRUNC | O_DIRECT, 0666);
+	if (fd == -1 && errno == EINVAL)
+		fd = open(file, O_CREAT | O_RDWR | O_TRUNC, 0666);
 	if (fd == -1) {
 		perror("failed to open file");
 		return -errno;
 	}
 
+	capture_writer =
+		capture_writer_create(fd, wav, format, rate, num_channels);
+	if (!capture_writer) {
+		close(fd);
+		return -ENOMEM;
+	}
+
 	run_file_io_stream(client, fd, CRAS_STREAM_INPUT, block_size,
 			   stream_type, rate, format, num_channels, flags,
 			   is_loopback, is_post_dsp);
 
+	capture_writer_destroy(capture_writer);
+	capture_writer = NULL;
 	close(fd);
 	return 0;
 }
@@ -1527,7 +2093,7 @@ static int run_capture(struct cras_client *client, const char *file,
 static int run_playback(struct cras_client *client, const char *file,
 			size_t block_size, enum CRAS_STREAM_TYPE stream_type,
 			size_t rate, snd_pcm_format_t format,
-			size_t num_channels)
+			size_t num_channels, uint32_t flags)
 {
 	int fd;
 
@@ -1538,7 +2104,8 @@ static int run_playback(struct cras_client *client, const char *file,
 	}
 
 	run_file_io_stream(client, fd, CRAS_STREAM_OUTPUT, block_size,
-			   stream_type, rate, format, num_channels, 0, 0, 0);
+			   stream_type, rate, format, num_channels, flags, 0,
+			   0);
 
 	close(fd);
 	return 0;
@@ -1683,6 +2250,386 @@ static void show_atlog(time_t sec_offset, int32_t nsec_offset,
 	}
 }
 
+/* Gets the CLOCK_MONOTONIC_RAW time of an event in microseconds. */
+static uint64_t atlog_event_usec(const struct audio_thread_event *event)
+{
+	return (uint64_t)(event->tag_sec & 0x00ffffff) * 1000000 +
+	       event->nsec / 1000;
+}
+
+/* Writes one audio thread event in the JSON trace event format, which the
+ * Perfetto UI and chrome://tracing load. An awake period of the audio thread,
+ * from WAKE to SLEEP, is a slice and the other events are instant events. The
+ * timestamps are CLOCK_MONOTONIC_RAW in microseconds. */
+static void write_atlog_trace_event(FILE *trace,
+				    const struct audio_thread_event *event)
+{
+	unsigned int tag = (event->tag_sec >> 24) & 0xff;
+	const char *name = "UNKNOWN";
+	const char *phase;
+
+	/* Skip unused log entries. */
+	if (event->tag_sec == 0 && event->nsec == 0)
+		return;
+
+	if (tag < ARRAY_SIZE(atlog_event_names) && atlog_event_names[tag])
+		name = atlog_event_names[tag];
+	if (tag == AUDIO_THREAD_WAKE)
+		phase = "\"ph\":\"B\"";
+	else if (tag == AUDIO_THREAD_SLEEP)
+		phase = "\"ph\":\"E\"";
+	else
+		phase = "\"ph\":\"i\",\"s\":\"t\"";
+
+	fprintf(trace,
+		"{\"name\":\"%s\",%s,\"ts\":%" PRIu64 ".%03u,\"pid\":0,"
+		"\"tid\":0,\"args\":{\"data1\":%u,\"data2\":%u,"
+		"\"data3\":%u}},\n",
+		name, phase, atlog_event_usec(event), event->nsec % 1000,
+		event->data1, event->data2, event->data3);
+}
+
+/* Appends the events read from the log to the trace. Missing events are
+ * marked, so gaps in the timeline are not mistaken for idle time. */
+static void write_atlog_trace(FILE *trace, struct audio_thread_event_log *log,
+			      int len, uint64_t missing)
+{
+	int i;
+
+	if (missing && len)
+		fprintf(trace,
+			"{\"name\":\"MISSING\",\"ph\":\"i\",\"s\":\"g\","
+			"\"ts\":%" PRIu64 ",\"pid\":0,\"tid\":0,"
+			"\"args\":{\"count\":%" PRIu64 "}},\n",
+			atlog_event_usec(&log->log[0]), missing);
+	for (i = 0; i < len; ++i)
+		write_atlog_trace_event(trace, &log->log[i]);
+	fflush(trace);
+}
+
+/* First line of the files written by --record_workload. */
+static const char workload_header[] = "# cras workload 1";
+
+/* Max streams --replay_workload keeps track of. */
+#define MAX_REPLAY_STREAMS 64
+
+/* Writes the audio thread events of a recorded workload, one per line as
+ * "<usec> <event> <data1> <data2> <data3>". The events a replay needs or
+ * compares against are kept: the streams added and removed with their
+ * formats, the client replies, and the device levels, delays and
+ * underruns. */
+static void write_workload(FILE *out, struct audio_thread_event_log *log,
+			   int len, uint64_t missing)
+{
+	unsigned int tag;
+	int i;
+
+	if (missing && len)
+		fprintf(out, "%" PRIu64 " MISSING %" PRIu64 " 0 0\n",
+			atlog_event_usec(&log->log[0]), missing);
+	for (i = 0; i < len; ++i) {
+		tag = (log->log[i].tag_sec >> 24) & 0xff;
+		switch (tag) {
+		case AUDIO_THREAD_STREAM_FORMAT:
+		case AUDIO_THREAD_STREAM_CONFIG:
+		case AUDIO_THREAD_STREAM_REPLY:
+		case AUDIO_THREAD_STREAM_REMOVED:
+		case AUDIO_THREAD_DEV_ADDED:
+		case AUDIO_THREAD_DEV_REMOVED:
+		case AUDIO_THREAD_DEV_FORMAT:
+		case AUDIO_THREAD_DEV_DELAY:
+		case AUDIO_THREAD_FILL_AUDIO:
+		case AUDIO_THREAD_READ_AUDIO:
+		case AUDIO_THREAD_UNDERRUN:
+		case AUDIO_THREAD_SEVERE_UNDERRUN:
+			break;
+		default:
+			continue;
+		}
+		fprintf(out, "%" PRIu64 " %s %u %u %u\n",
+			atlog_event_usec(&log->log[i]), atlog_event_names[tag],
+			log->log[i].data1, log->log[i].data2,
+			log->log[i].data3);
+	}
+	fflush(out);
+}
+
+/* A stream of the replayed workload. */
+struct replay_stream {
+	uint32_t recorded_id;
+	cras_stream_id_t id;
+	int added;
+	uint32_t rate;
+	uint32_t format_word;
+	uint32_t cb_threshold;
+	uint32_t config_word;
+	unsigned int frame_bytes;
+	/* Recorded reply times of the client, in usec, and the next one to
+	 * replay. Only touched by the stream's audio callback once added. */
+	uint32_t *reply_us;
+	unsigned int num_replies;
+	unsigned int next_reply;
+};
+
+/* An event read from a recorded workload. */
+struct replay_event {
+	uint64_t usec;
+	unsigned int tag;
+	uint32_t data[3];
+};
+
+/* Replies to the server after the recorded client did, with silence. */
+static int replay_samples(struct cras_client *client,
+			  cras_stream_id_t stream_id, uint8_t *samples,
+			  size_t frames, const struct timespec *sample_time,
+			  void *arg)
+{
+	struct replay_stream *stream = (struct replay_stream *)arg;
+
+	if (stream->next_reply < stream->num_replies)
+		usleep(stream->reply_us[stream->next_reply++]);
+	if ((stream->format_word >> 24) == CRAS_STREAM_OUTPUT)
+		memset(samples, 0, frames * stream->frame_bytes);
+	return frames;
+}
+
+static int replay_error(struct cras_client *client, cras_stream_id_t stream_id,
+			int err, void *arg)
+{
+	struct replay_stream *stream = (struct replay_stream *)arg;
+
+	printf("Replayed stream %x error %d\n", stream->recorded_id, err);
+	return 0;
+}
+
+static struct replay_stream *find_replay_stream(struct replay_stream *streams,
+						unsigned int num_streams,
+						uint32_t recorded_id)
+{
+	unsigned int i;
+
+	/* The latest stream with the id, in case the id got reused. */
+	for (i = num_streams; i > 0; i--)
+		if (streams[i - 1].recorded_id == recorded_id)
+			return &streams[i - 1];
+	return NULL;
+}
+
+/* Reads the events of a recorded workload, gathering its streams and the
+ * reply times of their clients. Returns the number of events or a negative
+ * error code. */
+static int read_workload(FILE *in, struct replay_event **events_out,
+			 struct replay_stream *streams,
+			 unsigned int *num_streams)
+{
+	struct replay_event *events = NULL, *tmp;
+	struct replay_stream *stream;
+	unsigned int num_events = 0, max_events = 0;
+	char line[256], name[64];
+	struct replay_event ev;
+	uint32_t *reply_us;
+	unsigned int tag;
+
+	*num_streams = 0;
+	while (fgets(line, sizeof(line), in)) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%" SCNu64 " %63s %u %u %u", &ev.usec, name,
+			   &ev.data[0], &ev.data[1], &ev.data[2]) != 5)
+			continue;
+		for (tag = 0; tag < ARRAY_SIZE(atlog_event_names); tag++)
+			if (atlog_event_names[tag] &&
+			    !strcmp(atlog_event_names[tag], name))
+				break;
+		if (tag == ARRAY_SIZE(atlog_event_names))
+			continue;
+		ev.tag = tag;
+
+		switch (tag) {
+		case AUDIO_THREAD_STREAM_FORMAT:
+			if (*num_streams == MAX_REPLAY_STREAMS) {
+				fprintf(stderr, "Too many streams to replay\n");
+				continue;
+			}
+			stream = &streams[(*num_streams)++];
+			memset(stream, 0, sizeof(*stream));
+			stream->recorded_id = ev.data[0];
+			stream->rate = ev.data[1];
+			stream->format_word = ev.data[2];
+			break;
+		case AUDIO_THREAD_STREAM_CONFIG:
+			stream = find_replay_stream(streams, *num_streams,
+						    ev.data[0]);
+			if (!stream)
+				continue;
+			stream->cb_threshold = ev.data[1];
+			stream->config_word = ev.data[2];
+			break;
+		case AUDIO_THREAD_STREAM_REPLY:
+			stream = find_replay_stream(streams, *num_streams,
+						    ev.data[0]);
+			if (!stream)
+				continue;
+			reply_us = realloc(stream->reply_us,
+					   (stream->num_replies + 1) *
+						   sizeof(*reply_us));
+			if (!reply_us)
+				goto nomem;
+			stream->reply_us = reply_us;
+			stream->reply_us[stream->num_replies++] = ev.data[1];
+			continue;
+		case AUDIO_THREAD_STREAM_REMOVED:
+			break;
+		case AUDIO_THREAD_UNDERRUN:
+		case AUDIO_THREAD_SEVERE_UNDERRUN:
+			break;
+		default:
+			/* Device traces are kept in the recording to compare
+			 * against, the replay runs on the selected devices. */
+			continue;
+		}
+
+		if (num_events == max_events) {
+			max_events = max_events ? max_events * 2 : 256;
+			tmp = realloc(events, max_events * sizeof(*events));
+			if (!tmp)
+				goto nomem;
+			events = tmp;
+		}
+		events[num_events++] = ev;
+	}
+
+	*events_out = events;
+	return num_events;
+
+nomem:
+	free(events);
+	return -ENOMEM;
+}
+
+static int add_replay_stream(struct cras_client *client,
+			     struct replay_stream *stream)
+{
+	struct cras_stream_params *params;
+	struct cras_audio_format *fmt;
+	unsigned int effects = stream->config_word >> 16;
+	int rc;
+
+	fmt = cras_audio_format_create((stream->format_word >> 16) & 0xff,
+				       stream->rate,
+				       stream->format_word & 0xff);
+	if (!fmt)
+		return -ENOMEM;
+	stream->frame_bytes = cras_client_format_bytes_per_frame(fmt);
+
+	/* Server only streams can't come from a client. */
+	params = cras_client_stream_params_create(
+		stream->format_word >> 24, stream->cb_threshold * 2,
+		stream->cb_threshold, 0, CRAS_STREAM_TYPE_DEFAULT,
+		(stream->config_word & 0xffff) & ~SERVER_ONLY, stream,
+		replay_samples, replay_error, fmt);
+	cras_audio_format_destroy(fmt);
+	if (!params)
+		return -ENOMEM;
+	cras_client_stream_params_set_client_type(
+		params, (stream->format_word >> 8) & 0xff);
+	if (effects & APM_ECHO_CANCELLATION)
+		cras_client_stream_params_enable_aec(params);
+	if (effects & APM_NOISE_SUPRESSION)
+		cras_client_stream_params_enable_ns(params);
+	if (effects & APM_GAIN_CONTROL)
+		cras_client_stream_params_enable_agc(params);
+	if (effects & APM_VOICE_DETECTION)
+		cras_client_stream_params_enable_vad(params);
+
+	rc = cras_client_add_stream(client, &stream->id, params);
+	cras_client_stream_params_destroy(params);
+	if (rc == 0)
+		stream->added = 1;
+	return rc;
+}
+
+/* Replays the streams of a workload written by --record_workload at their
+ * recorded times. Each stream replies to the server as late as its client
+ * did, so the audio thread runs the recorded load on whatever devices are
+ * selected, for example the empty devices of a server with no audio
+ * hardware. */
+static int replay_workload(struct cras_client *client, const char *path)
+{
+	struct replay_stream streams[MAX_REPLAY_STREAMS];
+	struct replay_stream *stream;
+	struct replay_event *events = NULL;
+	unsigned int num_streams, num_underruns = 0;
+	struct timespec start, now;
+	uint64_t first_usec, elapsed_usec;
+	int num_events, i, rc = 0;
+	FILE *in;
+
+	in = fopen(path, "r");
+	if (!in) {
+		fprintf(stderr, "Failed to open %s\n", path);
+		return -errno;
+	}
+	num_events = read_workload(in, &events, streams, &num_streams);
+	fclose(in);
+	if (num_events <= 0) {
+		fprintf(stderr, "No workload to replay in %s\n", path);
+		return num_events ? num_events : -EINVAL;
+	}
+
+	cras_client_run_thread(client);
+	cras_client_connected_wait(client);
+
+	first_usec = events[0].usec;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+	for (i = 0; i < num_events; i++) {
+		clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+		subtract_timespecs(&now, &start, &now);
+		elapsed_usec = now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+		if (events[i].usec - first_usec > elapsed_usec)
+			usleep(events[i].usec - first_usec - elapsed_usec);
+
+		stream = NULL;
+		switch (events[i].tag) {
+		case AUDIO_THREAD_STREAM_FORMAT:
+			/* Added on its config, which follows the format. */
+			break;
+		case AUDIO_THREAD_STREAM_CONFIG:
+			stream = find_replay_stream(streams, num_streams,
+						    events[i].data[0]);
+			if (!stream || stream->added)
+				break;
+			rc = add_replay_stream(client, stream);
+			if (rc)
+				fprintf(stderr, "Failed to add stream %x: %d\n",
+					stream->recorded_id, rc);
+			break;
+		case AUDIO_THREAD_STREAM_REMOVED:
+			stream = find_replay_stream(streams, num_streams,
+						    events[i].data[0]);
+			if (!stream || !stream->added)
+				break;
+			cras_client_rm_stream(client, stream->id);
+			stream->added = 0;
+			break;
+		case AUDIO_THREAD_UNDERRUN:
+		case AUDIO_THREAD_SEVERE_UNDERRUN:
+			num_underruns++;
+			break;
+		}
+	}
+
+	for (i = 0; i < (int)num_streams; i++) {
+		if (streams[i].added)
+			cras_client_rm_stream(client, streams[i].id);
+		free(streams[i].reply_us);
+	}
+	free(events);
+	printf("Replayed %u streams, %u underruns were recorded\n",
+	       num_streams, num_underruns);
+	return 0;
+}
+
 static void unlock_main_thread(struct cras_client *client)
 {
 	pthread_mutex_lock(&done_mutex);
@@ -1690,7 +2637,13 @@ static void unlock_main_thread(struct cras_client *client)
 	pthread_mutex_unlock(&done_mutex);
 }
 
-static void cras_show_continuous_atlog(struct cras_client *client)
+/* Follows the audio thread event log. It is printed, or handed to write
+ * along with out if write is not NULL. */
+static void cras_show_continuous_atlog(
+	struct cras_client *client,
+	void (*write)(FILE *out, struct audio_thread_event_log *log, int len,
+		      uint64_t missing),
+	FILE *out)
 {
 	struct audio_thread_event_log log;
 	struct timespec wait_time;
@@ -1718,13 +2671,22 @@ static void cras_show_continuous_atlog(struct cras_client *client)
 	/* Set stdout buffer to line buffered mode. */
 	setlinebuf(stdout);
 
+	/* The closing bracket of the event array is optional, so the trace
+	 * stays valid when we are interrupted. */
+	if (write == write_atlog_trace)
+		fprintf(out, "[\n");
+	else if (write == write_workload)
+		fprintf(out, "%s\n", workload_header);
+
 	while (1) {
 		len = cras_client_read_atlog(client, &atlog_read_idx, &missing,
 					     &log);
 
 		if (len < 0)
 			break;
-		if (len > 0)
+		if (len > 0 && write)
+			write(out, &log, len, missing);
+		else if (len > 0)
 			show_atlog(sec_offset, nsec_offset, &log, len, missing);
 		nanosleep(&follow_atlog_sleep_ts, NULL);
 	}
@@ -1788,10 +2750,15 @@ static struct option long_options[] = {
 	{"dump_bt",             no_argument,            0, 'H'},
 	{"set_wbs_enabled",     required_argument,      0, 'I'},
 	{"follow_atlog",	no_argument,		0, 'J'},
+	{"follow_atlog_trace",	required_argument,	0, '='},
+	{"record_workload",	required_argument,	0, '('},
+	{"replay_workload",	required_argument,	0, ')'},
 	{"connection_type",     required_argument,      0, 'K'},
 	{"loopback_file",       required_argument,      0, 'L'},
 	{"mute_loop_test",      required_argument,      0, 'M'},
 	{"dump_main",		no_argument,		0, 'N'},
+	{"dump_startup_trace",	required_argument,	0, '+'},
+	{"low_latency",         no_argument,            0, 'O'},
 	{"playback_file",       required_argument,      0, 'P'},
 	{"stream_type",         required_argument,      0, 'T'},
 	{0, 0, 0, 0}
@@ -1813,7 +2780,8 @@ static void show_usage()
 	printf("--block_size <N> - "
 	       "The number for frames per callback(dictates latency).\n");
 	printf("--capture_file <name> - "
-	       "Name of file to record to.\n");
+	       "Name of file to record to. A name ending in .wav gets a "
+	       "WAV header.\n");
 	printf("--capture_gain <dB> - "
 	       "Set system capture gain in dB*100 (100 = 1dB).\n");
 	printf("--capture_mute <0|1> - "
@@ -1844,10 +2812,18 @@ static void show_usage()
 	       "Print status of dsp to syslog.\n");
 	printf("--dump_server_info - "
 	       "Print status of the server.\n");
+	printf("--dump_startup_trace <file> - "
+	       "Writes the timing of the server startup phases to a\n"
+	       "                              "
+	       "trace file which Perfetto UI and chrome://tracing can load.\n");
 	printf("--duration_seconds <N> - "
 	       "Seconds to record or playback.\n");
 	printf("--follow_atlog - "
 	       "Continuously dumps audio thread event log.\n");
+	printf("--follow_atlog_trace <file> - "
+	       "Continuously writes audio thread event log to a trace\n"
+	       "                              "
+	       "file which Perfetto UI and chrome://tracing can load.\n");
 	printf("--format <name> - "
 	       "The sample format. Either ");
 	for (i = 0; supported_formats[i].name; ++i)
@@ -1861,6 +2837,8 @@ static void show_usage()
 	       "Listen and capture hotword stream if supported\n");
 	printf("--loopback_file <name> - "
 	       "Name of file to record from loopback device.\n");
+	printf("--low_latency - "
+	       "Request a low latency stream for playback or capture.\n");
 	printf("--mute <0|1> - "
 	       "Set system mute state.\n");
 	printf("--mute_loop_test <0|1> - "
@@ -1884,8 +2862,16 @@ static void show_usage()
 	       "index M on the device with index N\n");
 	printf("--rate <N> - "
 	       "Specifies the sample rate in Hz.\n");
+	printf("--record_workload <file> - "
+	       "Continuously writes the streams, client replies and device\n"
+	       "                              "
+	       "levels of a server run with --record_workload to file.\n");
 	printf("--reload_dsp - "
 	       "Reload dsp configuration from the ini file\n");
+	printf("--replay_workload <file> - "
+	       "Replays the streams of a recorded workload, replying as\n"
+	       "                              "
+	       "late as the recorded clients did.\n");
 	printf("--rm_active_input <N>:<M> - "
 	       "Removes the ionode with the given id from active input device "
 	       "list\n");
@@ -2211,7 +3197,7 @@ int main(int argc, char **argv)
 			break;
 		}
 		case '7': {
-			stream_flags = HOTWORD_STREAM;
+			stream_flags |= HOTWORD_STREAM;
 			capture_file = optarg;
 			break;
 		}
@@ -2330,7 +3316,38 @@ int main(int argc, char **argv)
 			cras_client_set_bt_wbs_enabled(client, atoi(optarg));
 			break;
 		case 'J':
-			cras_show_continuous_atlog(client);
+			cras_show_continuous_atlog(client, NULL, NULL);
+			break;
+		case '=': {
+			FILE *trace = fopen(optarg, "w");
+
+			if (!trace) {
+				fprintf(stderr, "Failed to open %s\n", optarg);
+				rc = -errno;
+				goto destroy_exit;
+			}
+			cras_show_continuous_atlog(client, write_atlog_trace,
+						   trace);
+			fclose(trace);
+			break;
+		}
+		case '(': {
+			FILE *workload = fopen(optarg, "w");
+
+			if (!workload) {
+				fprintf(stderr, "Failed to open %s\n", optarg);
+				rc = -errno;
+				goto destroy_exit;
+			}
+			cras_show_continuous_atlog(client, write_workload,
+						   workload);
+			fclose(workload);
+			break;
+		}
+		case ')':
+			rc = replay_workload(client, optarg);
+			if (rc)
+				goto destroy_exit;
 			break;
 		case 'K':
 			new_conn_type = atoi(optarg);
@@ -2362,6 +3379,20 @@ int main(int argc, char **argv)
 		case 'N':
 			show_main_thread_debug_info(client);
 			break;
+		case '+':
+			startup_trace = fopen(optarg, "w");
+			if (!startup_trace) {
+				fprintf(stderr, "Failed to open %s\n", optarg);
+				rc = -errno;
+				goto destroy_exit;
+			}
+			show_main_thread_debug_info(client);
+			fclose(startup_trace);
+			startup_trace = NULL;
+			break;
+		case 'O':
+			stream_flags |= LOW_LATENCY;
+			break;
 		case 'P':
 			playback_file = optarg;
 			break;
@@ -2406,7 +3437,7 @@ int main(int argc, char **argv)
 		else
 			rc = run_playback(client, playback_file, block_size,
 					  stream_type, rate, format,
-					  num_channels);
+					  num_channels, stream_flags);
 	} else if (loopback_file != NULL) {
 		rc = run_capture(client, loopback_file, block_size, stream_type,
 				 rate, format, num_channels, stream_flags, 1,
@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+use std::collections::HashMap;
 use std::error;
 use std::fmt;
 
@@ -9,7 +10,7 @@ use remain::sorted;
 
 use crate::control::{self, Control};
 use crate::control_primitive;
-use crate::control_primitive::{Ctl, ElemId, ElemIface};
+use crate::control_primitive::{Ctl, ElemId, ElemIface, ElemInfo, ElemType};
 
 pub type Result<T> = std::result::Result<T, Error>;
 
@@ -47,10 +48,20 @@ impl fmt::Display for Error {
     }
 }
 
+/// A mixer control resolved by `Card::control_by_name()`.
+struct ResolvedControl {
+    id: ElemId,
+    elem_type: ElemType,
+    count: usize,
+}
+
 /// `Card` represents a sound card.
 pub struct Card {
     handle: Ctl,
     name: String,
+    // Mixer controls looked up by name. Their ids carry the numid, so
+    // reads and writes skip the name lookup in the kernel.
+    controls: HashMap<String, ResolvedControl>,
 }
 
 impl Card {
@@ -69,6 +80,7 @@ impl Card {
         Ok(Card {
             name: card_name.to_owned(),
             handle,
+            controls: HashMap::new(),
         })
     }
 
@@ -78,6 +90,7 @@ impl Card {
     }
 
     /// Creates a `Control` from control name.
+    /// The control is resolved on first use and later calls reuse the resolved id and info.
     ///
     /// # Errors
     ///
@@ -89,7 +102,18 @@ impl Card {
     where
         T: Control<'a>,
     {
-        let id = ElemId::new(ElemIface::Mixer, control_name)?;
-        Ok(T::from(&mut self.handle, id)?)
+        if !self.controls.contains_key(control_name) {
+            let id = ElemId::new(ElemIface::Mixer, control_name)?;
+            let info = ElemInfo::new(&mut self.handle, &id)?;
+            let control = ResolvedControl {
+                id: info.id()?,
+                elem_type: info.elem_type()?,
+                count: info.count(),
+            };
+            self.controls.insert(control_name.to_owned(), control);
+        }
+        let control = &self.controls[control_name];
+        T::validate(&control.id, control.elem_type, control.count)?;
+        Ok(T::new(&mut self.handle, control.id.try_clone()?))
     }
 }
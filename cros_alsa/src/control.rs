@@ -128,23 +128,28 @@ pub trait Control<'a>: Sized + 'a {
     /// Called by `Card` to create a `Control`.
     fn from(handle: &'a mut Ctl, id: ElemId) -> Result<Self> {
         let info = ElemInfo::new(handle, &id)?;
-        if info.elem_type()? != Self::elem_type() {
+        Self::validate(&id, info.elem_type()?, info.count())?;
+        Ok(Self::new(handle, id))
+    }
+    /// Called by `Self::from(handle: &'a mut Ctl, id: ElemId)` and `Card` to check the data
+    /// type and the number of value entries of the underlying mixer control.
+    fn validate(id: &ElemId, elem_type: ElemType, count: usize) -> Result<()> {
+        if elem_type != Self::elem_type() {
             return Err(Error::MismatchElemType(
                 id.name()?.to_owned(),
-                info.elem_type()?,
+                elem_type,
                 Self::elem_type(),
             ));
         }
 
-        if info.count() != Self::size() {
+        if count != Self::size() {
             return Err(Error::MismatchElemCount(
                 id.name()?.to_owned(),
-                info.count(),
+                count,
                 Self::size(),
             ));
         }
-
-        Ok(Self::new(handle, id))
+        Ok(())
     }
     /// Called by `Self::from(handle: &'a mut Ctl, id: ElemId)` to validate the data type of a
     /// `Control`.
@@ -180,14 +180,7 @@ impl ElemId {
     /// * If memory allocation fails.
     /// * If ctl_name is not a valid CString.
     pub fn new(iface: ElemIface, ctl_name: &str) -> Result<ElemId> {
-        let mut id_ptr = ptr::null_mut();
-        // Safe because we provide a valid id_ptr to be filled,
-        // and we validate the return code before using id_ptr.
-        let rc = unsafe { snd_ctl_elem_id_malloc(&mut id_ptr) };
-        if rc < 0 {
-            return Err(Error::ElemIdMallocFailed(FFIError::Rc(rc)));
-        }
-        let id = ptr::NonNull::new(id_ptr).ok_or(Error::ElemIdMallocFailed(FFIError::NullPtr))?;
+        let id = Self::malloc()?;
 
         // Safe because id.as_ptr() is a valid snd_ctl_elem_id_t*.
         unsafe { snd_ctl_elem_id_set_interface(id.as_ptr(), iface as u32) };
@@ -197,11 +190,34 @@ impl ElemId {
         Ok(ElemId(id, PhantomData))
     }
 
+    /// Creates a copy of the `ElemId`, including the numid resolved by `ElemInfo::id()`.
+    ///
+    /// # Errors
+    ///
+    /// * If memory allocation fails.
+    pub fn try_clone(&self) -> Result<ElemId> {
+        let id = Self::malloc()?;
+        // Safe because id.as_ptr() and self.as_ptr() are valid snd_ctl_elem_id_t*.
+        unsafe { snd_ctl_elem_id_copy(id.as_ptr(), self.as_ptr()) };
+        Ok(ElemId(id, PhantomData))
+    }
+
     /// Borrows the const inner pointer.
     pub fn as_ptr(&self) -> *const snd_ctl_elem_id_t {
         self.0.as_ptr()
     }
 
+    fn malloc() -> Result<ptr::NonNull<snd_ctl_elem_id_t>> {
+        let mut id_ptr = ptr::null_mut();
+        // Safe because we provide a valid id_ptr to be filled,
+        // and we validate the return code before using id_ptr.
+        let rc = unsafe { snd_ctl_elem_id_malloc(&mut id_ptr) };
+        if rc < 0 {
+            return Err(Error::ElemIdMallocFailed(FFIError::Rc(rc)));
+        }
+        ptr::NonNull::new(id_ptr).ok_or(Error::ElemIdMallocFailed(FFIError::NullPtr))
+    }
+
     /// Safe [snd_ctl_elem_id_get_name()] (https://www.alsa-project.org/alsa-doc/alsa-lib/group___control.html#gaa6cfea3ac963bfdaeb8189e03e927a76) wrapper.
     ///
     /// # Errors
@@ -319,6 +335,21 @@ impl ElemInfo {
         unsafe { ElemType::try_from(snd_ctl_elem_info_get_type(self.0.as_ptr())) }
     }
 
+    /// Safe snd_ctl_elem_info_get_id() wrapper.
+    /// The returned `ElemId` carries the numid of the control, so the kernel resolves it
+    /// without comparing names on every read and write.
+    ///
+    /// # Errors
+    ///
+    /// * If memory allocation fails.
+    pub fn id(&self) -> Result<ElemId> {
+        let id = ElemId::malloc()?;
+        // Safe because self.0.as_ptr() is a valid snd_ctl_elem_info_t* and id.as_ptr() is a
+        // valid snd_ctl_elem_id_t*.
+        unsafe { snd_ctl_elem_info_get_id(self.0.as_ptr(), id.as_ptr()) };
+        Ok(ElemId(id, PhantomData))
+    }
+
     /// Safe [snd_ctl_elem_info_get_count](https://www.alsa-project.org/alsa-doc/alsa-lib/group___control.html#gaa75a20d4190d324bcda5fd6659a4b377) wrapper.
     pub fn count(&self) -> usize {
         // Safe because self.0.as_ptr() is a valid snd_ctl_elem_info_t*.
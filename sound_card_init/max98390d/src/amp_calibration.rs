@@ -17,7 +17,7 @@ use sys_util::{error, info};
 use crate::{
     datastore::Datastore,
     error::{Error, Result},
-    settings::AmpCalibSettings,
+    settings::{AmpCalibSettings, AmpSettings},
     vpd::VPD,
 };
 
@@ -92,15 +92,33 @@ impl<'a> AmpCalibration<'a> {
         Ok(())
     }
 
+    /// Applies the stored calibration values if a previous boot time calibration confirmed
+    /// them with the current VPD values, in which case the amp does not need to be calibrated.
+    ///
+    /// # Results
+    ///
+    /// * `true` - The stored values are applied.
+    /// * `false` - The amp needs to be calibrated.
+    pub fn apply_validated_datastore(&mut self) -> Result<bool> {
+        let vpd = VPD::from_file(&self.setting.rdc_vpd, &self.setting.temp_vpd)?;
+        match Datastore::from_validated_file(self.card.name(), &self.setting.calib_file, &vpd) {
+            Some(d) => {
+                info!("skip calibration, datastore is validated.");
+                self.apply_datastore(d)?;
+                Ok(true)
+            }
+            None => Ok(false),
+        }
+    }
+
     /// The implementation of max98390d boot time calibration logic.
     ///
     /// The boot time calibration logic includes the following steps:
-    ///  * Gets results from `do_calibration`.
+    ///  * Takes the results of `calibrate_amps`.
     ///  * Decides whether the new calibration result should replace the stored value.
     ///  * Applies a good calibration value.
-    pub fn run(&mut self) -> Result<()> {
+    pub fn run(&mut self, rdc_cali: i32, temp_cali: i32) -> Result<()> {
         let vpd = VPD::from_file(&self.setting.rdc_vpd, &self.setting.temp_vpd)?;
-        let (rdc_cali, temp_cali) = self.do_calibration()?;
         let datastore = match Datastore::from_file(self.card.name(), &self.setting.calib_file) {
             Ok(sci_calib) => Some(sci_calib),
             Err(e) => {
@@ -137,6 +155,8 @@ impl<'a> AmpCalibration<'a> {
                 None => Datastore::UseVPD.save(self.card.name(), &self.setting.calib_file)?,
                 Some(d) => self.apply_datastore(d)?,
             }
+            // The stored value is confirmed by this calibration.
+            Datastore::save_validated(self.card.name(), &self.setting.calib_file, &vpd)?;
         } else {
             info!("apply boot time calibration values.");
             self.card
@@ -145,6 +165,7 @@ impl<'a> AmpCalibration<'a> {
             self.card
                 .control_by_name::<IntControl>(&self.setting.amp.temp_ctrl)?
                 .set(temp_cali)?;
+            Datastore::delete_validated(self.card.name(), &self.setting.calib_file)?;
             Datastore::DSM {
                 rdc: rdc_cali,
                 ambient_temp: temp_cali,
@@ -174,146 +195,174 @@ impl<'a> AmpCalibration<'a> {
         temp < self.setting.amp.temp_upper_limit && temp > self.setting.amp.temp_lower_limit
     }
 
-    /// Triggers the amplifier calibration and reads the calibrated rdc and ambient_temp value
-    /// from the mixer control.
-    /// To get accurate calibration results, the main thread calibrates the amplifier while
-    /// the another thread plays zeros to the speakers.
-    fn do_calibration(&mut self) -> Result<(i32, i32)> {
-        // The playback worker uses `playback_started` to notify the main thread that playback
-        // of zeros has started.
-        let playback_started = Arc::new((Mutex::new(false), Condvar::new()));
-        // Shares `calib_finished` to the playback worker and uses it to notify the worker when
-        // the calibration is finished.
-        let calib_finished = Arc::new(AtomicBool::new(false));
-        let handle =
-            AmpCalibration::run_play_zero_worker(playback_started.clone(), calib_finished.clone())?;
-
-        // Waits until zero playback starts or timeout.
-        let mut timeout = Duration::from_millis(1000);
-        let (lock, cvar) = &*playback_started;
-        let mut started = lock.lock()?;
-        while !*started {
-            let start_time = Instant::now();
-            started = cvar.wait_timeout(started, timeout)?.0;
-            if *started {
-                break;
+    /// Skips max98390d boot time calibration when the speaker may be hot.
+    ///
+    /// If datastore exists, applies the stored value and sets volume to high.
+    /// If datastore does not exist, sets volume to low.
+    pub fn hot_speaker_workflow(&mut self) -> Result<()> {
+        if let Ok(sci_calib) = Datastore::from_file(self.card.name(), &self.setting.calib_file) {
+            self.apply_datastore(sci_calib)?;
+            self.set_volume(VolumeMode::High)?;
+            return Ok(());
+        }
+        info!("no datastore, set volume low");
+        self.set_volume(VolumeMode::Low)
+    }
+}
+
+/// Calibrates the given amplifiers and reads the calibrated rdc and ambient_temp values.
+/// To get accurate calibration results, the amplifiers are calibrated while another thread
+/// plays zeros to the speakers. The amplifiers are independent, so each is calibrated by its
+/// own thread with its own `Card`, all during the same zero playback.
+///
+/// # Results
+///
+/// * The (rdc, ambient_temp) result of each amplifier, in the order of `settings`.
+///
+/// # Errors
+///
+/// * If the zero playback fails, in which case no result can be trusted.
+pub fn calibrate_amps(
+    snd_card: &str,
+    settings: &[AmpCalibSettings],
+) -> Result<Vec<Result<(i32, i32)>>> {
+    // The playback worker uses `playback_started` to notify the main thread that playback
+    // of zeros has started.
+    let playback_started = Arc::new((Mutex::new(false), Condvar::new()));
+    // Shares `calib_finished` to the playback worker and uses it to notify the worker when
+    // the calibration is finished.
+    let calib_finished = Arc::new(AtomicBool::new(false));
+    let handle = run_play_zero_worker(playback_started.clone(), calib_finished.clone())?;
+
+    // Waits until zero playback starts or timeout.
+    let mut timeout = Duration::from_millis(1000);
+    let (lock, cvar) = &*playback_started;
+    let mut started = lock.lock()?;
+    while !*started {
+        let start_time = Instant::now();
+        started = cvar.wait_timeout(started, timeout)?.0;
+        if *started {
+            break;
+        } else {
+            let elapsed = start_time.elapsed();
+            if elapsed > timeout {
+                return Err(Error::StartPlaybackTimeout);
             } else {
-                let elapsed = start_time.elapsed();
-                if elapsed > timeout {
-                    return Err(Error::StartPlaybackTimeout);
-                } else {
-                    // Spurious wakes. Decrements the sleep duration by the amount slept.
-                    timeout -= start_time.elapsed();
-                }
+                // Spurious wakes. Decrements the sleep duration by the amount slept.
+                timeout -= start_time.elapsed();
             }
         }
+    }
+    drop(started);
 
-        // Playback of zeros is started, and the main thread can start the calibration.
-        self.card
-            .control_by_name::<SwitchControl>(&self.setting.amp.calib_ctrl)?
-            .on()?;
-        let rdc = self
-            .card
-            .control_by_name::<IntControl>(&self.setting.amp.rdc_ctrl)?
-            .get()?;
-        let temp = self
-            .card
-            .control_by_name::<IntControl>(&self.setting.amp.temp_ctrl)?
-            .get()?;
-        self.card
-            .control_by_name::<SwitchControl>(&self.setting.amp.calib_ctrl)?
-            .off()?;
-        // Notifies the play_zero_worker that the calibration is finished.
-        calib_finished.store(true, Ordering::Relaxed);
-
-        // If play_zero_worker has error during the calibration, returns an error to keep the volume
-        // low to protect the speaker.
-        match handle.join() {
-            Ok(res) => {
-                if let Err(e) = res {
-                    error!("run_play_zero_worker has error: {}", e);
-                    return Err(e);
-                }
-            }
+    // Playback of zeros is started, and the amplifiers can be calibrated.
+    let workers: Vec<JoinHandle<Result<(i32, i32)>>> = settings
+        .iter()
+        .map(|s| {
+            let snd_card = snd_card.to_owned();
+            let amp = s.amp.clone();
+            thread::spawn(move || calibrate_amp(&snd_card, &amp))
+        })
+        .collect();
+    let results: Vec<Result<(i32, i32)>> = workers
+        .into_iter()
+        .map(|worker| match worker.join() {
+            Ok(res) => res,
             Err(e) => {
-                error!("run_play_zero_worker panics: {:?}", e);
-                return Err(Error::WorkerPanics);
+                error!("calibration worker panics: {:?}", e);
+                Err(Error::WorkerPanics)
             }
-        }
+        })
+        .collect();
+    // Notifies the play_zero_worker that the calibration is finished.
+    calib_finished.store(true, Ordering::Relaxed);
 
-        Ok((rdc, temp))
+    // If play_zero_worker has error during the calibration, returns an error to keep the volume
+    // low to protect the speaker.
+    match handle.join() {
+        Ok(res) => {
+            if let Err(e) = res {
+                error!("run_play_zero_worker has error: {}", e);
+                return Err(e);
+            }
+        }
+        Err(e) => {
+            error!("run_play_zero_worker panics: {:?}", e);
+            return Err(Error::WorkerPanics);
+        }
     }
 
-    // Creates a thread to play zeros to the internal speakers.
-    fn run_play_zero_worker(
-        playback_started: Arc<(Mutex<bool>, Condvar)>,
-        calib_finished: Arc<AtomicBool>,
-    ) -> Result<JoinHandle<Result<()>>> {
-        let mut cras_client = CrasClient::new().map_err(Error::CrasClientFailed)?;
-        // TODO(b/155007305): Implement cras_client.wait_node_change and use it here.
-        let node = cras_client
-            .output_nodes()
-            .find(|node| node.node_type == CrasNodeType::CRAS_NODE_TYPE_INTERNAL_SPEAKER)
-            .ok_or(Error::InternalSpeakerNotFound)?;
-
-        let handle = thread::spawn(move || -> Result<()> {
-            let local_buffer = [0u8; FRAMES_PER_BUFFER * NUM_CHANNELS * 2];
-            let iterations = (FRAME_RATE * DURATION_MS) / FRAMES_PER_BUFFER as u32 / 1000;
-            let warm_up_iterations =
-                (FRAME_RATE * WARM_UP_DURATION_MS) / FRAMES_PER_BUFFER as u32 / 1000;
-
-            let (_control, mut stream) = cras_client
-                .new_pinned_playback_stream(
-                    node.iodev_index,
-                    NUM_CHANNELS,
-                    FORMAT,
-                    FRAME_RATE,
-                    FRAMES_PER_BUFFER,
-                )
-                .map_err(|e| Error::NewPlayStreamFailed(e))?;
-
-            // Plays zeros for at most DURATION_MS.
-            for i in 0..iterations {
-                if calib_finished.load(Ordering::Relaxed) {
-                    break;
-                }
-                let mut buffer = stream
-                    .next_playback_buffer()
-                    .map_err(|e| Error::NextPlaybackBufferFailed(e))?;
-                let _write_frames = buffer.write(&local_buffer).map_err(Error::PlaybackFailed)?;
-
-                // Notifies the main thread to start the calibration.
-                // The mute playing time need to be longer than WARM_UP_DURATION_MS to get rdc properly.
-                if i == warm_up_iterations {
-                    let (lock, cvar) = &*playback_started;
-                    let mut started = lock.lock()?;
-                    *started = true;
-                    cvar.notify_one();
-                }
-                // The playback_started lock is unlocked here when `started` goes out of scope.
-            }
+    Ok(results)
+}
+
+// Triggers the calibration of one amplifier and reads the calibrated rdc and ambient_temp
+// values from the mixer controls.
+fn calibrate_amp(snd_card: &str, amp: &AmpSettings) -> Result<(i32, i32)> {
+    let mut card = Card::new(snd_card)?;
+    card.control_by_name::<SwitchControl>(&amp.calib_ctrl)?
+        .on()?;
+    let rdc = card.control_by_name::<IntControl>(&amp.rdc_ctrl)?.get()?;
+    let temp = card.control_by_name::<IntControl>(&amp.temp_ctrl)?.get()?;
+    card.control_by_name::<SwitchControl>(&amp.calib_ctrl)?
+        .off()?;
+    Ok((rdc, temp))
+}
 
-            // Returns an error if the calibration is not finished before playback stops.
-            if !calib_finished.load(Ordering::Relaxed) {
-                return Err(Error::CalibrationTimeout);
+// Creates a thread to play zeros to the internal speakers.
+fn run_play_zero_worker(
+    playback_started: Arc<(Mutex<bool>, Condvar)>,
+    calib_finished: Arc<AtomicBool>,
+) -> Result<JoinHandle<Result<()>>> {
+    let mut cras_client = CrasClient::new().map_err(Error::CrasClientFailed)?;
+    // TODO(b/155007305): Implement cras_client.wait_node_change and use it here.
+    let node = cras_client
+        .output_nodes()
+        .find(|node| node.node_type == CrasNodeType::CRAS_NODE_TYPE_INTERNAL_SPEAKER)
+        .ok_or(Error::InternalSpeakerNotFound)?;
+
+    let handle = thread::spawn(move || -> Result<()> {
+        let local_buffer = [0u8; FRAMES_PER_BUFFER * NUM_CHANNELS * 2];
+        let iterations = (FRAME_RATE * DURATION_MS) / FRAMES_PER_BUFFER as u32 / 1000;
+        let warm_up_iterations =
+            (FRAME_RATE * WARM_UP_DURATION_MS) / FRAMES_PER_BUFFER as u32 / 1000;
+
+        let (_control, mut stream) = cras_client
+            .new_pinned_playback_stream(
+                node.iodev_index,
+                NUM_CHANNELS,
+                FORMAT,
+                FRAME_RATE,
+                FRAMES_PER_BUFFER,
+            )
+            .map_err(|e| Error::NewPlayStreamFailed(e))?;
+
+        // Plays zeros for at most DURATION_MS.
+        for i in 0..iterations {
+            if calib_finished.load(Ordering::Relaxed) {
+                break;
             }
-            Ok(())
-        });
+            let mut buffer = stream
+                .next_playback_buffer()
+                .map_err(|e| Error::NextPlaybackBufferFailed(e))?;
+            let _write_frames = buffer.write(&local_buffer).map_err(Error::PlaybackFailed)?;
 
-        Ok(handle)
-    }
+            // Notifies the main thread to start the calibration.
+            // The mute playing time need to be longer than WARM_UP_DURATION_MS to get rdc properly.
+            if i == warm_up_iterations {
+                let (lock, cvar) = &*playback_started;
+                let mut started = lock.lock()?;
+                *started = true;
+                cvar.notify_one();
+            }
+            // The playback_started lock is unlocked here when `started` goes out of scope.
+        }
 
-    /// Skips max98390d boot time calibration when the speaker may be hot.
-    ///
-    /// If datastore exists, applies the stored value and sets volume to high.
-    /// If datastore does not exist, sets volume to low.
-    pub fn hot_speaker_workflow(&mut self) -> Result<()> {
-        if let Ok(sci_calib) = Datastore::from_file(self.card.name(), &self.setting.calib_file) {
-            self.apply_datastore(sci_calib)?;
-            self.set_volume(VolumeMode::High)?;
-            return Ok(());
+        // Returns an error if the calibration is not finished before playback stops.
+        if !calib_finished.load(Ordering::Relaxed) {
+            return Err(Error::CalibrationTimeout);
         }
-        info!("no datastore, set volume low");
-        self.set_volume(VolumeMode::Low)
-    }
+        Ok(())
+    });
+
+    Ok(handle)
 }
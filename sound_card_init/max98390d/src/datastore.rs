@@ -1,7 +1,7 @@
 // Copyright 2020 The Chromium OS Authors. All rights reserved.
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
-use std::fs::File;
+use std::fs::{self, File};
 use std::io::{prelude::*, BufReader, BufWriter};
 use std::path::PathBuf;
 
@@ -10,6 +10,7 @@ use sys_util::info;
 use utils::DATASTORE_DIR;
 
 use crate::error::{Error, Result};
+use crate::vpd::VPD;
 
 /// `Datastore`, which stores and reads calibration values in yaml format.
 #[derive(Debug, Deserialize, Serialize, Copy, Clone)]
@@ -53,4 +54,51 @@ impl Datastore {
         info!("update Datastore {}: {:?}", path.to_string_lossy(), self);
         Ok(())
     }
+
+    /// Records that the stored `Datastore` was confirmed by a boot time calibration with the
+    /// given VPD values. The calibration is skipped on later boots until the VPD values change.
+    pub fn save_validated(snd_card: &str, file: &str, vpd: &VPD) -> Result<()> {
+        let path = validated_path(snd_card, file);
+        let io_err = |e| Error::FileIOFailed(path.to_string_lossy().to_string(), e);
+
+        let mut writer = BufWriter::new(File::create(&path).map_err(io_err)?);
+        writer
+            .write(
+                serde_yaml::to_string(vpd)
+                    .map_err(Error::SerializationFailed)?
+                    .as_bytes(),
+            )
+            .map_err(io_err)?;
+        writer.flush().map_err(io_err)?;
+        info!("datastore {} validated with {:?}", file, vpd);
+        Ok(())
+    }
+
+    /// Returns the stored `Datastore` if it was confirmed by a boot time calibration with the
+    /// same VPD values.
+    pub fn from_validated_file(snd_card: &str, file: &str, vpd: &VPD) -> Option<Datastore> {
+        let reader = BufReader::new(File::open(validated_path(snd_card, file)).ok()?);
+        let validated: VPD = serde_yaml::from_reader(reader).ok()?;
+        if validated != *vpd {
+            return None;
+        }
+        Datastore::from_file(snd_card, file).ok()
+    }
+
+    /// Forgets that the stored `Datastore` was confirmed, so the next boot calibrates again.
+    pub fn delete_validated(snd_card: &str, file: &str) -> Result<()> {
+        let path = validated_path(snd_card, file);
+        match fs::remove_file(&path) {
+            Err(e) if e.kind() != std::io::ErrorKind::NotFound => {
+                Err(Error::FileIOFailed(path.to_string_lossy().to_string(), e))
+            }
+            _ => Ok(()),
+        }
+    }
+}
+
+fn validated_path(snd_card: &str, file: &str) -> PathBuf {
+    PathBuf::from(DATASTORE_DIR)
+        .join(snd_card)
+        .join(format!("{}.validated", file))
 }
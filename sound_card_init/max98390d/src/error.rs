@@ -96,7 +96,7 @@ impl fmt::Display for Error {
             StartPlaybackTimeout => write!(f, "playback is not started in time"),
             SystemTimeError(e) => write!(f, "{}", e),
             VPDParseFailed(file, e) => write!(f, "failed to parse vpd {}: {}", file, e),
-            WorkerPanics => write!(f, "run_play_zero_worker panics"),
+            WorkerPanics => write!(f, "worker thread panics"),
         }
     }
 }
@@ -18,9 +18,10 @@ use cros_alsa::Card;
 use sys_util::error;
 use utils::{run_time, shutdown_time, DATASTORE_DIR};
 
-use crate::amp_calibration::{AmpCalibration, VolumeMode};
+use crate::amp_calibration::{calibrate_amps, AmpCalibration, VolumeMode};
+use crate::datastore::Datastore;
 use crate::error::{Error, Result};
-use crate::settings::DeviceSettings;
+use crate::settings::{AmpCalibSettings, DeviceSettings};
 
 const SPEAKER_COOL_DOWN_TIME: Duration = Duration::from_secs(180);
 
@@ -61,34 +62,62 @@ pub fn run_max98390d(snd_card: &str, conf: &str) -> Result<()> {
         };
     }
 
-    // If some error occurs during the calibration, the iteration will continue running the
-    // calibration for the next amp.
-    let results: Vec<Result<()>> = settings
-        .amp_calibrations
-        .into_iter()
-        .map(|s| {
-            let mut amp_calib = AmpCalibration::new(&mut card, s)?;
-            amp_calib.set_volume(VolumeMode::Low)?;
-            amp_calib.run()?;
-            amp_calib.set_volume(VolumeMode::High)?;
-            Ok(())
-        })
-        .filter_map(|res| res.err())
-        .map(|e| {
-            error!("calibration error: {}. volume remains low.", e);
-            Err(e)
-        })
-        .collect();
-
-    if !results.is_empty() {
+    // If some error occurs for an amp, the other amps are still calibrated.
+    let mut errors: Vec<Error> = Vec::new();
+    let mut to_calibrate: Vec<AmpCalibSettings> = Vec::new();
+    for s in settings.amp_calibrations {
+        match skip_validated_amp(&mut card, &s) {
+            Ok(true) => (),
+            Ok(false) => to_calibrate.push(s),
+            Err(e) => errors.push(e),
+        }
+    }
+
+    if !to_calibrate.is_empty() {
+        // All amps are calibrated during the same zero playback.
+        match calibrate_amps(snd_card, &to_calibrate) {
+            Ok(results) => {
+                for (s, res) in to_calibrate.into_iter().zip(results) {
+                    if let Err(e) = res.and_then(|(rdc, temp)| {
+                        let mut amp_calib = AmpCalibration::new(&mut card, s)?;
+                        amp_calib.run(rdc, temp)?;
+                        amp_calib.set_volume(VolumeMode::High)
+                    }) {
+                        errors.push(e);
+                    }
+                }
+            }
+            Err(e) => errors.push(e),
+        }
+    }
+
+    for e in &errors {
+        error!("calibration error: {}. volume remains low.", e);
+    }
+    if !errors.is_empty() {
         return Err(Error::CalibrationFailed);
     }
 
     Ok(())
 }
 
+// Sets the amp volume low until it is calibrated, unless its datastore was validated with the
+// current VPD values. Returns true if the calibration is skipped.
+fn skip_validated_amp(card: &mut Card, setting: &AmpCalibSettings) -> Result<bool> {
+    let mut amp_calib = AmpCalibration::new(card, setting.clone())?;
+    amp_calib.set_volume(VolumeMode::Low)?;
+    if !amp_calib.apply_validated_datastore()? {
+        return Ok(false);
+    }
+    amp_calib.set_volume(VolumeMode::High)?;
+    Ok(true)
+}
+
 fn del_all_datastore(snd_card: &str, settings: &DeviceSettings) {
     for s in &settings.amp_calibrations {
+        if let Err(e) = Datastore::delete_validated(snd_card, &s.calib_file) {
+            error!("failed to remove datastore validation: {}.", e);
+        }
         if let Err(e) = fs::remove_file(
             PathBuf::from(DATASTORE_DIR)
                 .join(snd_card)
@@ -6,12 +6,14 @@ use std::io::prelude::*;
 use std::io::BufReader;
 use std::path::PathBuf;
 
+use serde::{Deserialize, Serialize};
+
 use crate::error::{Error, Result};
 
 const VPD_DIR: &str = "/sys/firmware/vpd/ro/vpdfile";
 
 /// `VPD`, which represents the amplifier factory calibration values.
-#[derive(Default, Debug)]
+#[derive(Default, Debug, Deserialize, Serialize, PartialEq)]
 pub struct VPD {
     /// dsm_calib_r0 is (11 / 3) / actual_rdc * 2^20.
     pub dsm_calib_r0: i32,